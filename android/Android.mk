@@ -64,11 +64,13 @@ LOCAL_SRC_FILES := \
 	bluez/src/shared/mgmt.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/hashmap.c \
 	bluez/src/shared/ringbuf.c \
 	bluez/src/shared/hfp.c \
 	bluez/src/shared/gatt-db.c \
 	bluez/src/shared/io-glib.c \
 	bluez/src/shared/timeout-glib.c \
+	bluez/src/shared/aes.c \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/uhid.c \
 	bluez/src/shared/att.c \
@@ -355,11 +357,15 @@ LOCAL_SRC_FILES := \
 	bluez/monitor/keys.c \
 	bluez/monitor/ellisys.c \
 	bluez/monitor/analyze.c \
+	bluez/monitor/filter.c \
 	bluez/monitor/intel.c \
 	bluez/monitor/broadcom.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/hashmap.c \
+	bluez/src/shared/aes.c \
 	bluez/src/shared/crypto.c \
+	bluez/src/shared/lz4.c \
 	bluez/src/shared/btsnoop.c \
 	bluez/src/shared/mainloop.c \
 	bluez/lib/hci.c \
@@ -391,7 +397,9 @@ LOCAL_SRC_FILES := \
 	bluez/tools/btproxy.c \
 	bluez/src/shared/mainloop.c \
 	bluez/src/shared/util.c \
+	bluez/src/shared/queue.c \
 	bluez/src/shared/ecc.c \
+	bluez/src/shared/h4.c \
 
 LOCAL_C_INCLUDES := \
 	$(LOCAL_PATH)/bluez \
@@ -416,6 +424,7 @@ LOCAL_SRC_FILES := \
 	bluez/android/hal-audio.c \
 	bluez/android/hal-audio-sbc.c \
 	bluez/android/hal-audio-aptx.c \
+	bluez/android/hal-pcm.c \
 
 LOCAL_C_INCLUDES = \
 	$(LOCAL_PATH)/bluez \
@@ -448,6 +457,7 @@ include $(BUILD_SHARED_LIBRARY)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := bluez/android/hal-sco.c \
+	bluez/android/hal-pcm.c \
 	bluez/android/hal-utils.c
 
 LOCAL_C_INCLUDES = \
@@ -508,6 +518,7 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
 	bluez/android/bluetoothd-snoop.c \
 	bluez/src/shared/mainloop.c \
+	bluez/src/shared/lz4.c \
 	bluez/src/shared/btsnoop.c \
 	bluez/android/log.c \
 
@@ -553,6 +564,7 @@ LOCAL_SRC_FILES := \
 	bluez/src/shared/io-mainloop.c \
 	bluez/src/shared/mgmt.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/hashmap.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/gap.c \
 	bluez/src/uuid-helper.c \
@@ -105,6 +105,7 @@ struct device {
 	GSList *uuids;
 
 	bool found; /* if device is found in current discovery session */
+	uint8_t hal_type; /* device type last reported to HAL */
 	unsigned int confirm_id; /* mgtm command id if command pending */
 
 	bool valid_remote_csrk;
@@ -1759,10 +1760,10 @@ static void update_new_device(struct device *dev, int8_t rssi,
 	uint8_t buf[IPC_MTU];
 	struct hal_ev_device_found *ev = (void *) buf;
 	uint8_t android_bdaddr[6];
-	uint8_t android_type;
 	size_t size;
 
-	memset(buf, 0, sizeof(buf));
+	/* Properties are appended after the header, no need to clear them */
+	memset(ev, 0, sizeof(*ev));
 
 	if (adapter.cur_discovery_type)
 		dev->found = true;
@@ -1774,9 +1775,9 @@ static void update_new_device(struct device *dev, int8_t rssi,
 				sizeof(android_bdaddr), android_bdaddr);
 	ev->num_props++;
 
-	android_type = get_device_android_type(dev);
+	dev->hal_type = get_device_android_type(dev);
 	size += fill_hal_prop(buf + size, HAL_PROP_DEVICE_TYPE,
-				sizeof(android_type), &android_type);
+				sizeof(dev->hal_type), &dev->hal_type);
 	ev->num_props++;
 
 	if (eir->class)
@@ -1826,23 +1827,24 @@ static void update_device(struct device *dev, int8_t rssi,
 {
 	uint8_t buf[IPC_MTU];
 	struct hal_ev_remote_device_props *ev = (void *) buf;
-	uint8_t old_type, new_type;
+	uint8_t type;
 	size_t size;
 
-	memset(buf, 0, sizeof(buf));
+	memset(ev, 0, sizeof(*ev));
 
 	size = sizeof(*ev);
 
-	ev->status = HAL_STATUS_SUCCESS;
-	get_device_android_addr(dev, ev->bdaddr);
-
-	old_type = get_device_android_type(dev);
-
-	new_type = get_device_android_type(dev);
-
-	if (old_type != new_type) {
+	/*
+	 * Only properties that differ from what was last reported are sent,
+	 * the device fields double as the cache of last sent values. Type
+	 * needs its own copy since transport flags are updated before this
+	 * is called.
+	 */
+	type = get_device_android_type(dev);
+	if (type != dev->hal_type) {
+		dev->hal_type = type;
 		size += fill_hal_prop(buf + size, HAL_PROP_DEVICE_TYPE,
-						sizeof(new_type), &new_type);
+						sizeof(type), &type);
 		ev->num_props++;
 	}
 
@@ -1860,7 +1862,8 @@ static void update_device(struct device *dev, int8_t rssi,
 		ev->num_props++;
 	}
 
-	if (eir->name && strlen(eir->name) && strcmp(dev->name, eir->name)) {
+	if (eir->name && strlen(eir->name) &&
+					g_strcmp0(dev->name, eir->name)) {
 		g_free(dev->name);
 		dev->name = g_strdup(eir->name);
 		size += fill_hal_prop(buf + size, HAL_PROP_DEVICE_NAME,
@@ -1877,8 +1880,13 @@ static void update_device(struct device *dev, int8_t rssi,
 		}
 	}
 
-	if (ev->num_props)
-		ipc_send_notif(hal_ipc, HAL_SERVICE_ID_BLUETOOTH,
+	if (!ev->num_props)
+		return;
+
+	ev->status = HAL_STATUS_SUCCESS;
+	get_device_android_addr(dev, ev->bdaddr);
+
+	ipc_send_notif(hal_ipc, HAL_SERVICE_ID_BLUETOOTH,
 					HAL_EV_REMOTE_DEVICE_PROPS, size, buf);
 }
 
@@ -4807,9 +4815,10 @@ static uint8_t get_device_class(struct device *dev)
 
 static uint8_t get_device_type(struct device *dev)
 {
-	uint8_t type = get_device_android_type(dev);
+	dev->hal_type = get_device_android_type(dev);
 
-	send_device_property(dev, HAL_PROP_DEVICE_TYPE, sizeof(type), &type);
+	send_device_property(dev, HAL_PROP_DEVICE_TYPE, sizeof(dev->hal_type),
+							&dev->hal_type);
 
 	return HAL_STATUS_SUCCESS;
 }
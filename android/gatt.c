@@ -31,6 +31,7 @@
 #include "utils.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/ad.h"
@@ -136,9 +137,8 @@ struct notification_data {
 	struct hal_gatt_srvc_id service;
 	struct hal_gatt_gatt_id ch;
 	struct app_connection *conn;
-	guint notif_id;
-	guint ind_id;
-	int ref;
+	uint16_t handle;
+	struct hal_ev_gatt_client_notify ev;	/* Prefilled event header */
 };
 
 struct gatt_device {
@@ -153,8 +153,12 @@ struct gatt_device {
 
 	guint watch_id;
 	guint server_id;
+	guint notif_id;
 	guint ind_id;
 
+	/* Queues of client notification_data by value handle */
+	struct hashmap *notify_map;
+
 	int ref;
 
 	struct queue *autoconnect_apps;
@@ -532,18 +536,21 @@ static void destroy_notification(void *data)
 	if (!notification)
 		return;
 
-	if (--notification->ref)
-		return;
-
 	app = notification->conn->app;
 	queue_remove_if(app->notifications, match_notification, notification);
 	free(notification);
 }
 
+static void destroy_subscribers(void *data)
+{
+	queue_destroy(data, destroy_notification);
+}
+
 static void unregister_notification(void *data)
 {
 	struct notification_data *notification = data;
 	struct gatt_device *dev = notification->conn->device;
+	struct queue *subscribers;
 
 	/*
 	 * No device means it was already disconnected and client cleanup was
@@ -553,11 +560,16 @@ static void unregister_notification(void *data)
 	if (!queue_find(gatt_devices, NULL, dev))
 		return;
 
-	if (notification->notif_id && dev)
-		g_attrib_unregister(dev->attrib, notification->notif_id);
+	subscribers = hashmap_lookup(dev->notify_map, notification->handle);
+	if (!subscribers || !queue_remove(subscribers, notification))
+		return;
 
-	if (notification->ind_id && dev)
-		g_attrib_unregister(dev->attrib, notification->ind_id);
+	if (queue_isempty(subscribers)) {
+		hashmap_remove(dev->notify_map, notification->handle);
+		queue_destroy(subscribers, NULL);
+	}
+
+	destroy_notification(notification);
 }
 
 static void device_set_state(struct gatt_device *dev, uint32_t state)
@@ -611,9 +623,15 @@ static void connection_cleanup(struct gatt_device *device)
 		if (device->server_id > 0)
 			g_attrib_unregister(device->attrib, device->server_id);
 
+		if (device->notif_id > 0)
+			g_attrib_unregister(device->attrib, device->notif_id);
+
 		if (device->ind_id > 0)
 			g_attrib_unregister(device->attrib, device->ind_id);
 
+		/* Client registrations go away together with the bearer */
+		hashmap_clear(device->notify_map, destroy_subscribers);
+
 		device->attrib = NULL;
 		g_attrib_cancel_all(attrib);
 		g_attrib_unref(attrib);
@@ -718,6 +736,7 @@ static void destroy_device(void *data)
 	queue_destroy(dev->services, destroy_service);
 	queue_destroy(dev->pending_requests, destroy_pending_request);
 	queue_destroy(dev->autoconnect_apps, NULL);
+	hashmap_destroy(dev->notify_map, destroy_subscribers);
 
 	bt_auto_connect_remove(&dev->bdaddr);
 
@@ -756,6 +775,7 @@ static struct gatt_device *create_device(const bdaddr_t *addr)
 	dev->services = queue_new();
 	dev->autoconnect_apps = queue_new();
 	dev->pending_requests = queue_new();
+	dev->notify_map = hashmap_new();
 
 	queue_push_head(gatt_devices, dev);
 
@@ -1440,19 +1460,72 @@ static void create_app_connection(void *data, void *user_data)
 		create_connection(dev, app);
 }
 
+struct notify_event {
+	struct hal_ev_gatt_client_notify *ev;
+	uint16_t len;
+};
+
+static void send_client_notify(void *data, void *user_data)
+{
+	struct notification_data *notification = data;
+	struct notify_event *notify = user_data;
+	uint8_t is_notify = notify->ev->is_notify;
+
+	/* Only the header differs between subscribers of the same handle */
+	memcpy(notify->ev, &notification->ev, sizeof(*notify->ev));
+	notify->ev->is_notify = is_notify;
+	notify->ev->len = notify->len;
+
+	ipc_send_notif(hal_ipc, HAL_SERVICE_ID_GATT, HAL_EV_GATT_CLIENT_NOTIFY,
+				sizeof(*notify->ev) + notify->len, notify->ev);
+}
+
+static void handle_notification(struct gatt_device *dev, const uint8_t *pdu,
+								uint16_t len)
+{
+	uint8_t buf[IPC_MTU];
+	struct notify_event notify;
+	struct queue *subscribers;
+	uint8_t data_offset = sizeof(uint8_t) + sizeof(uint16_t);
+
+	if (len < data_offset)
+		return;
+
+	subscribers = hashmap_lookup(dev->notify_map, get_le16(pdu + 1));
+	if (!subscribers)
+		return;
+
+	notify.ev = (void *) buf;
+	notify.ev->is_notify = pdu[0] == ATT_OP_HANDLE_NOTIFY;
+
+	/* We have to cut opcode and handle from data */
+	notify.len = MIN(len - data_offset, sizeof(buf) - sizeof(*notify.ev));
+	memcpy(notify.ev->value, pdu + data_offset, notify.len);
+
+	queue_foreach(subscribers, send_client_notify, &notify);
+}
+
+static void notif_handler(const uint8_t *cmd, uint16_t cmd_len,
+							gpointer user_data)
+{
+	handle_notification(user_data, cmd, cmd_len);
+}
+
 static void ind_handler(const uint8_t *cmd, uint16_t cmd_len,
 							gpointer user_data)
 {
 	struct gatt_device *dev = user_data;
 	uint16_t resp_length = 0;
 	size_t length;
-	uint8_t *opdu = g_attrib_get_buffer(dev->attrib, &length);
+	uint8_t *opdu;
+
+	handle_notification(dev, cmd, cmd_len);
 
 	/*
-	 * We have to send confirmation here. If some client is
-	 * registered for this indication, event will be send in
-	 * handle_notification
+	 * We have to send confirmation here, clients registered for this
+	 * indication got their event above.
 	 */
+	opdu = g_attrib_get_buffer(dev->attrib, &length);
 
 	resp_length = enc_confirmation(opdu, length);
 	g_attrib_send(dev->attrib, 0, opdu, resp_length, NULL, NULL, NULL);
@@ -1530,6 +1603,12 @@ static void connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 	if ((dev->server_id && dev->ind_id) == 0)
 		error("gatt: Could not attach to server");
 
+	dev->notif_id = g_attrib_register(attrib, ATT_OP_HANDLE_NOTIFY,
+						GATTRIB_ALL_HANDLES,
+						notif_handler, dev, NULL);
+	if (!dev->notif_id)
+		error("gatt: Could not register for notifications");
+
 	device_set_state(dev, DEVICE_CONNECTED);
 
 	/* Send exchange mtu request as we assume being client and server */
@@ -3645,31 +3724,6 @@ reply:
 		send_client_write_execute_notify(cmd->conn_id, GATT_FAILURE);
 }
 
-static void handle_notification(const uint8_t *pdu, uint16_t len,
-							gpointer user_data)
-{
-	uint8_t buf[IPC_MTU];
-	struct hal_ev_gatt_client_notify *ev = (void *) buf;
-	struct notification_data *notification = user_data;
-	uint8_t data_offset = sizeof(uint8_t) + sizeof(uint16_t);
-
-	if (len < data_offset)
-		return;
-
-	memcpy(&ev->char_id, &notification->ch, sizeof(ev->char_id));
-	memcpy(&ev->srvc_id, &notification->service, sizeof(ev->srvc_id));
-	bdaddr2android(&notification->conn->device->bdaddr, &ev->bda);
-	ev->conn_id = notification->conn->id;
-	ev->is_notify = pdu[0] == ATT_OP_HANDLE_NOTIFY;
-
-	/* We have to cut opcode and handle from data */
-	ev->len = len - data_offset;
-	memcpy(ev->value, pdu + data_offset, len - data_offset);
-
-	ipc_send_notif(hal_ipc, HAL_SERVICE_ID_GATT, HAL_EV_GATT_CLIENT_NOTIFY,
-						sizeof(*ev) + ev->len, ev);
-}
-
 static void send_register_for_notification_ev(int32_t id, int32_t registered,
 					int32_t status,
 					const struct hal_gatt_srvc_id *srvc,
@@ -3692,6 +3746,7 @@ static void handle_client_register_for_notification(const void *buf,
 {
 	const struct hal_cmd_gatt_client_register_for_notification *cmd = buf;
 	struct notification_data *notification;
+	struct queue *subscribers;
 	struct characteristic *c;
 	struct element_id match_id;
 	struct app_connection *conn;
@@ -3728,6 +3783,11 @@ static void handle_client_register_for_notification(const void *buf,
 		goto failed;
 	}
 
+	if (!conn->device->attrib) {
+		status = HAL_STATUS_FAILED;
+		goto failed;
+	}
+
 	notification = new0(struct notification_data, 1);
 
 	memcpy(&notification->ch, &cmd->char_id, sizeof(notification->ch));
@@ -3742,39 +3802,24 @@ static void handle_client_register_for_notification(const void *buf,
 		goto failed;
 	}
 
-	notification->notif_id = g_attrib_register(conn->device->attrib,
-							ATT_OP_HANDLE_NOTIFY,
-							c->ch.value_handle,
-							handle_notification,
-							notification,
-							destroy_notification);
-	if (!notification->notif_id) {
-		free(notification);
-		status = HAL_STATUS_FAILED;
-		goto failed;
-	}
+	notification->handle = c->ch.value_handle;
 
-	notification->ind_id = g_attrib_register(conn->device->attrib,
-							ATT_OP_HANDLE_IND,
-							c->ch.value_handle,
-							handle_notification,
-							notification,
-							destroy_notification);
-	if (!notification->ind_id) {
-		g_attrib_unregister(conn->device->attrib,
-							notification->notif_id);
-		free(notification);
-		status = HAL_STATUS_FAILED;
-		goto failed;
-	}
+	memcpy(&notification->ev.char_id, &notification->ch,
+					sizeof(notification->ev.char_id));
+	memcpy(&notification->ev.srvc_id, &notification->service,
+					sizeof(notification->ev.srvc_id));
+	bdaddr2android(&conn->device->bdaddr, &notification->ev.bda);
+	notification->ev.conn_id = conn->id;
 
-	/*
-	 * Because same data - notification - is shared by two handlers, we
-	 * introduce ref counter to be sure that data can be freed with no risk.
-	 * Counter is decremented in destroy_notification.
-	 */
-	notification->ref = 2;
+	subscribers = hashmap_lookup(conn->device->notify_map,
+							notification->handle);
+	if (!subscribers) {
+		subscribers = queue_new();
+		hashmap_insert(conn->device->notify_map, notification->handle,
+								subscribers);
+	}
 
+	queue_push_tail(subscribers, notification);
 	queue_push_tail(conn->app->notifications, notification);
 
 	status = HAL_STATUS_SUCCESS;
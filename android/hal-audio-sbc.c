@@ -383,6 +383,14 @@ static bool sbc_update_qos(void *codec_data, uint8_t op)
 				new_bitpool = SBC_QUALITY_MIN_BITPOOL;
 		}
 		break;
+
+	case QOS_POLICY_INCREASE:
+		if (curr_bitpool < sbc_data->sbc.max_bitpool) {
+			new_bitpool = curr_bitpool + SBC_QUALITY_STEP;
+			if (new_bitpool > sbc_data->sbc.max_bitpool)
+				new_bitpool = sbc_data->sbc.max_bitpool;
+		}
+		break;
 	}
 
 	if (new_bitpool == curr_bitpool)
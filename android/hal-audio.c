@@ -12,10 +12,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/sockios.h>
 
 #include <hardware/audio.h>
 #include <hardware/hardware.h>
@@ -25,6 +27,7 @@
 #include "hal-log.h"
 #include "hal-msg.h"
 #include "hal-audio.h"
+#include "hal-pcm.h"
 #include "hal-utils.h"
 #include "hal.h"
 
@@ -34,6 +37,21 @@
 
 #define MAX_DELAY	100000 /* 100ms */
 
+/*
+ * Socket backlog, in media packets, above which the quality is lowered and
+ * below which it is raised again once the link has been clean for a while.
+ */
+#define QOS_HIGH_BACKLOG	4
+#define QOS_LOW_BACKLOG		1
+#define QOS_HOLD		1000000 /* 1s */
+#define QOS_RAISE_HOLD		5000000 /* 5s */
+
+/* Media packets written ahead of time to cover jitter of the link */
+#define QOS_MAX_BATCH		4
+
+/* Encoded media packets queued for a single sendmmsg() */
+#define MP_RING_SIZE		QOS_MAX_BATCH
+
 static const uint8_t a2dp_src_uuid[] = {
 		0x00, 0x00, 0x11, 0x0a, 0x00, 0x00, 0x10, 0x00,
 		0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb };
@@ -87,6 +105,26 @@ extern int clock_nanosleep(clockid_t clock_id, int flags,
 					struct timespec *remain);
 #endif
 
+#if defined(ANDROID) && ANDROID_VERSION < PLATFORM_VER(5, 0, 0)
+/* Bionic provides sendmmsg() only since Android 5.0 */
+static int sendmmsg(int fd, struct mmsghdr *msgvec, unsigned int vlen,
+								int flags)
+{
+	unsigned int i;
+
+	for (i = 0; i < vlen; i++) {
+		ssize_t ret = sendmsg(fd, &msgvec[i].msg_hdr, flags);
+
+		if (ret < 0)
+			return i ? (int) i : -1;
+
+		msgvec[i].msg_len = ret;
+	}
+
+	return i;
+}
+#endif
+
 static struct {
 	const audio_codec_get_t get_codec;
 	bool loaded;
@@ -99,6 +137,23 @@ static struct {
 
 #define MAX_AUDIO_ENDPOINTS NUM_CODECS
 
+struct endpoint_qos {
+	unsigned int outq;
+	unsigned int backlog;
+	unsigned int jitter;
+	unsigned int batch;
+	unsigned int level;
+
+	unsigned int decreases;
+	unsigned int increases;
+	unsigned int resyncs;
+	unsigned int skipped;
+
+	struct timespec changed;
+	struct timespec clean;
+	bool is_clean;
+};
+
 struct audio_endpoint {
 	uint8_t id;
 	const struct audio_codec *codec;
@@ -108,11 +163,19 @@ struct audio_endpoint {
 	struct media_packet *mp;
 	size_t mp_data_len;
 
+	uint8_t *ring;
+	size_t ring_len;
+	unsigned int queued;
+	struct iovec iov[MP_RING_SIZE];
+	struct mmsghdr msgs[MP_RING_SIZE];
+
 	uint16_t seq;
 	uint32_t samples;
 	struct timespec start;
 
 	bool resync;
+
+	struct endpoint_qos qos;
 };
 
 static struct audio_endpoint audio_endpoints[MAX_AUDIO_ENDPOINTS];
@@ -516,16 +579,28 @@ static bool open_endpoint(struct audio_endpoint **epp,
 	codec->init(preset, payload_len, &ep->codec_data);
 	codec->get_config(ep->codec_data, cfg);
 
-	ep->mp = calloc(mtu, 1);
-	if (!ep->mp)
+	ep->ring = calloc(MP_RING_SIZE, mtu);
+	if (!ep->ring)
 		goto failed;
 
-	if (ep->codec->use_rtp) {
-		struct media_packet_rtp *mp_rtp =
-					(struct media_packet_rtp *) ep->mp;
-		mp_rtp->hdr.v = 2;
-		mp_rtp->hdr.pt = 0x60;
-		mp_rtp->hdr.ssrc = htonl(1);
+	ep->ring_len = mtu;
+	ep->queued = 0;
+	ep->mp = (struct media_packet *) ep->ring;
+
+	for (i = 0; i < MP_RING_SIZE; i++) {
+		uint8_t *slot = ep->ring + i * mtu;
+
+		ep->iov[i].iov_base = slot;
+		ep->msgs[i].msg_hdr.msg_iov = &ep->iov[i];
+		ep->msgs[i].msg_hdr.msg_iovlen = 1;
+
+		if (ep->codec->use_rtp) {
+			struct media_packet_rtp *mp_rtp =
+					(struct media_packet_rtp *) slot;
+			mp_rtp->hdr.v = 2;
+			mp_rtp->hdr.pt = 0x60;
+			mp_rtp->hdr.ssrc = htonl(1);
+		}
 	}
 
 	ep->mp_data_len = payload_len;
@@ -549,7 +624,9 @@ static void close_endpoint(struct audio_endpoint *ep)
 		ep->fd = -1;
 	}
 
-	free(ep->mp);
+	free(ep->ring);
+	ep->ring = NULL;
+	ep->mp = NULL;
 
 	ep->codec->cleanup(ep->codec_data);
 	ep->codec_data = NULL;
@@ -565,25 +642,87 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 
 	ep->codec->update_qos(ep->codec_data, QOS_POLICY_DEFAULT);
 
+	memset(&ep->qos, 0, sizeof(ep->qos));
+	ep->qos.batch = 1;
+	clock_gettime(CLOCK_MONOTONIC, &ep->qos.changed);
+
 	return true;
 }
 
-static void downmix_to_mono(struct a2dp_stream_out *out, const uint8_t *buffer,
-								size_t bytes)
+static void qos_decrease(struct audio_endpoint *ep, struct timespec *now)
 {
-	const int16_t *input = (const void *) buffer;
-	int16_t *output = (void *) out->downmix_buf;
-	size_t i, frames;
+	if (!ep->codec->update_qos(ep->codec_data, QOS_POLICY_DECREASE))
+		return;
+
+	ep->qos.level++;
+	ep->qos.decreases++;
+	ep->qos.changed = *now;
+	ep->qos.is_clean = false;
+}
+
+static void qos_increase(struct audio_endpoint *ep, struct timespec *now)
+{
+	if (!ep->qos.level ||
+		!ep->codec->update_qos(ep->codec_data, QOS_POLICY_INCREASE))
+		return;
+
+	ep->qos.level--;
+	ep->qos.increases++;
+	ep->qos.changed = *now;
+	ep->qos.clean = *now;
+}
+
+/*
+ * Follows the amount of data queued on the socket after each write. A
+ * growing backlog means the link does not keep up with the bitrate, while
+ * its variation is the jitter that writing ahead has to cover.
+ */
+static void qos_update(struct audio_endpoint *ep, size_t pkt_len)
+{
+	struct endpoint_qos *qos = &ep->qos;
+	struct timespec now;
+	unsigned int dev;
+	int outq;
+
+	if (!pkt_len || ioctl(ep->fd, SIOCOUTQ, &outq) < 0 || outq < 0)
+		return;
+
+	qos->outq = outq;
+
+	/* Exponential averages with a weight of 1/8 */
+	dev = qos->outq > qos->backlog ? qos->outq - qos->backlog :
+						qos->backlog - qos->outq;
+	qos->backlog = (qos->backlog * 7 + qos->outq) / 8;
+	qos->jitter = (qos->jitter * 7 + dev) / 8;
+
+	qos->batch = 1 + qos->jitter * 2 / pkt_len;
+	if (qos->batch > QOS_MAX_BATCH)
+		qos->batch = QOS_MAX_BATCH;
 
-	/* PCM 16bit stereo */
-	frames = bytes / (2 * sizeof(int16_t));
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	for (i = 0; i < frames; i++) {
-		int16_t l = get_le16(&input[i * 2]);
-		int16_t r = get_le16(&input[i * 2 + 1]);
+	if (qos->backlog > QOS_HIGH_BACKLOG * pkt_len) {
+		if (timespec_diff_us(&now, &qos->changed) >= QOS_HOLD)
+			qos_decrease(ep, &now);
 
-		put_le16((l + r) / 2, &output[i]);
+		qos->is_clean = false;
+		return;
+	}
+
+	if (qos->backlog >= QOS_LOW_BACKLOG * pkt_len) {
+		qos->is_clean = false;
+		return;
 	}
+
+	if (!qos->is_clean) {
+		qos->clean = now;
+		qos->is_clean = true;
+		return;
+	}
+
+	if (timespec_diff_us(&now, &qos->clean) >= QOS_RAISE_HOLD &&
+			timespec_diff_us(&now, &qos->changed) >= QOS_RAISE_HOLD)
+		qos_increase(ep, &now);
 }
 
 static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
@@ -614,24 +753,38 @@ static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
 	return true;
 }
 
-static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
+static void queue_packet(struct audio_endpoint *ep, size_t bytes)
+{
+	uint8_t *next;
+
+	ep->iov[ep->queued++].iov_len = bytes;
+
+	/* a full ring is flushed before the next packet is encoded */
+	next = ep->ring + ep->queued % MP_RING_SIZE * ep->ring_len;
+	ep->mp = (struct media_packet *) next;
+}
+
+static bool write_to_endpoint(struct audio_endpoint *ep)
 {
-	struct media_packet *mp = (struct media_packet *) ep->mp;
+	unsigned int sent = 0;
 	int ret;
 
-	while (true) {
-		ret = write(ep->fd, mp, bytes);
+	while (sent < ep->queued) {
+		ret = sendmmsg(ep->fd, &ep->msgs[sent], ep->queued - sent, 0);
 
-		if (ret >= 0)
-			break;
+		if (ret >= 0) {
+			sent += ret;
+			continue;
+		}
 
 		/*
 		 * this should not happen so let's issue warning, but do not
-		 * fail, we can try to write next packet
+		 * fail, we can try to write next packets
 		 */
 		if (errno == EAGAIN) {
 			ret = errno;
 			warn("write failed (%d)", ret);
+			ep->qos.skipped += ep->queued - sent;
 			break;
 		}
 
@@ -642,26 +795,54 @@ static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
 		}
 	}
 
+	if (sent)
+		qos_update(ep, ep->iov[sent - 1].iov_len);
+
 	return true;
 }
 
+/*
+ * Sends all queued media packets with a single call. Wait some time for
+ * the socket to be ready for write, but just drop the packets if timeout
+ * occurs.
+ */
+static bool flush_endpoint(struct audio_endpoint *ep)
+{
+	bool do_write = false;
+	bool ret = true;
+
+	if (!ep->queued)
+		return true;
+
+	if (!wait_for_endpoint(ep, &do_write))
+		ret = false;
+	else if (do_write)
+		ret = write_to_endpoint(ep);
+	else
+		ep->qos.skipped += ep->queued;
+
+	ep->queued = 0;
+	ep->mp = (struct media_packet *) ep->ring;
+
+	return ret;
+}
+
 static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 								size_t bytes)
 {
 	struct audio_endpoint *ep = out->ep;
-	struct media_packet *mp = (struct media_packet *) ep->mp;
-	struct media_packet_rtp *mp_rtp = (struct media_packet_rtp *) ep->mp;
 	size_t free_space = ep->mp_data_len;
 	size_t consumed = 0;
 
 	while (consumed < bytes) {
+		struct media_packet *mp = ep->mp;
+		struct media_packet_rtp *mp_rtp = (void *) mp;
 		size_t written = 0;
 		ssize_t read;
 		uint32_t samples;
 		int ret;
 		struct timespec current;
-		uint64_t audio_sent, audio_passed;
-		bool do_write = false;
+		uint64_t audio_sent, audio_passed, lead;
 
 		/*
 		 * prepare media packet in advance so we don't waste time after
@@ -681,7 +862,7 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		 * data and continue
 		 */
 		if (read <= 0)
-			return true;
+			return flush_endpoint(ep);
 
 		/* calculate where are we and where we should be */
 		clock_gettime(CLOCK_MONOTONIC, &current);
@@ -689,18 +870,25 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 			memcpy(&ep->start, &current, sizeof(ep->start));
 		audio_sent = ep->samples * 1000000ll / out->cfg.rate;
 		audio_passed = timespec_diff_us(&current, &ep->start);
+		lead = ep->codec->get_mediapacket_duration(ep->codec_data);
+		lead *= ep->qos.batch > 1 ? ep->qos.batch - 1 : 0;
 
 		/*
-		 * if we're ahead of stream then wait for next write point,
+		 * if we're ahead of stream by more than the packets we may
+		 * write in advance then wait for next write point,
 		 * if we're lagging more than 100ms then stop writing and just
 		 * skip data until we're back in sync
 		 */
-		if (audio_sent > audio_passed) {
+		if (audio_sent > audio_passed + lead) {
 			struct timespec anchor;
 
 			ep->resync = false;
 
-			timespec_add(&ep->start, audio_sent, &anchor);
+			/* packets queued so far are due already */
+			if (!flush_endpoint(ep))
+				return false;
+
+			timespec_add(&ep->start, audio_sent - lead, &anchor);
 
 			while (true) {
 				ret = clock_nanosleep(CLOCK_MONOTONIC,
@@ -716,14 +904,14 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 					return false;
 				}
 			}
-		} else if (!ep->resync) {
+		} else if (!ep->resync && audio_passed > audio_sent) {
 			uint64_t diff = audio_passed - audio_sent;
 
 			if (diff > MAX_DELAY) {
 				warn("lag is %jums, resyncing", diff / 1000);
 
-				ep->codec->update_qos(ep->codec_data,
-							QOS_POLICY_DECREASE);
+				qos_decrease(ep, &current);
+				ep->qos.resyncs++;
 				ep->resync = true;
 			}
 		}
@@ -734,17 +922,15 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		 * in resync mode we'll just drop mediapackets
 		 */
 		if (written > 0 && !ep->resync) {
-			/* wait some time for socket to be ready for write,
-			 * but we'll just skip writing data if timeout occurs
-			 */
-			if (!wait_for_endpoint(ep, &do_write))
-				return false;
+			if (ep->codec->use_rtp)
+				written += sizeof(struct rtp_header);
 
-			if (do_write) {
-				if (ep->codec->use_rtp)
-					written += sizeof(struct rtp_header);
+			queue_packet(ep, written);
 
-				if (!write_to_endpoint(ep, written))
+			/* send once the packets written ahead are encoded */
+			if (ep->queued >= ep->qos.batch ||
+						ep->queued == MP_RING_SIZE) {
+				if (!flush_endpoint(ep))
 					return false;
 			}
 		}
@@ -759,7 +945,7 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		consumed += read;
 	}
 
-	return true;
+	return flush_endpoint(ep);
 }
 
 static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
@@ -807,7 +993,8 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 			return -1;
 		}
 
-		downmix_to_mono(out, buffer, bytes);
+		pcm_downmix_to_mono(buffer, (void *) out->downmix_buf,
+					bytes / (2 * sizeof(int16_t)));
 
 		in_buf = out->downmix_buf;
 		in_len = bytes / 2;
@@ -900,8 +1087,27 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
+	struct audio_endpoint *ep = out->ep;
+
 	DBG("");
-	return -ENOSYS;
+
+	dprintf(fd, "A2DP output: rate %u state %u\n", out->cfg.rate,
+							out->audio_state);
+
+	if (!ep)
+		return 0;
+
+	dprintf(fd, "  endpoint %u: backlog %u bytes (last %u jitter %u)\n",
+				ep->id, ep->qos.backlog, ep->qos.outq,
+				ep->qos.jitter);
+	dprintf(fd, "  batch %u packets, quality %u steps below default\n",
+				ep->qos.batch, ep->qos.level);
+	dprintf(fd, "  decreases %u increases %u resyncs %u skipped %u\n",
+				ep->qos.decreases, ep->qos.increases,
+				ep->qos.resyncs, ep->qos.skipped);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -1563,6 +1769,9 @@ static int audio_open(const hw_module_t *module, const char *name,
 	if (err < 0)
 		return err;
 
+	pcm_init();
+	DBG("PCM kernel: %s", pcm_kernel());
+
 	a2dp_dev = calloc(1, sizeof(struct a2dp_audio_dev));
 	if (!a2dp_dev)
 		return -ENOMEM;
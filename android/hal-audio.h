@@ -84,6 +84,7 @@ struct audio_codec {
 
 #define QOS_POLICY_DEFAULT	0x00
 #define QOS_POLICY_DECREASE	0x01
+#define QOS_POLICY_INCREASE	0x02
 
 typedef const struct audio_codec * (*audio_codec_get_t) (void);
 
@@ -4,6 +4,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <errno.h>
 #include <sys/socket.h>
@@ -24,6 +25,9 @@
 
 #define CONNECT_TIMEOUT (10 * 1000)
 
+/* Notifications taken from the socket per wakeup */
+#define NOTIF_BATCH 16
+
 static int listen_sk = -1;
 static int cmd_sk = -1;
 static int notif_sk = -1;
@@ -118,65 +122,74 @@ static bool handle_msg(void *buf, ssize_t len, int fd)
 
 static void *notification_handler(void *data)
 {
-	struct msghdr msg;
-	struct iovec iv;
+	struct mmsghdr msgs[NOTIF_BATCH];
+	struct iovec iv[NOTIF_BATCH];
 	struct cmsghdr *cmsg;
-	char cmsgbuf[CMSG_SPACE(sizeof(int))];
-	char buf[IPC_MTU];
-	ssize_t ret;
+	char cmsgbuf[NOTIF_BATCH][CMSG_SPACE(sizeof(int))];
+	char buf[NOTIF_BATCH][IPC_MTU];
+	int i, ret;
 	int fd;
 
 	bt_thread_associate();
 
 	while (true) {
-		memset(&msg, 0, sizeof(msg));
-		memset(buf, 0, sizeof(buf));
+		memset(msgs, 0, sizeof(msgs));
 		memset(cmsgbuf, 0, sizeof(cmsgbuf));
 
-		iv.iov_base = buf;
-		iv.iov_len = sizeof(buf);
+		for (i = 0; i < NOTIF_BATCH; i++) {
+			iv[i].iov_base = buf[i];
+			iv[i].iov_len = sizeof(buf[i]);
 
-		msg.msg_iov = &iv;
-		msg.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_iov = &iv[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
 
-		msg.msg_control = cmsgbuf;
-		msg.msg_controllen = sizeof(cmsgbuf);
+			msgs[i].msg_hdr.msg_control = cmsgbuf[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(cmsgbuf[i]);
+		}
 
-		ret = recvmsg(notif_sk, &msg, 0);
+		/* Wait for one notification and take any queued behind it */
+		ret = recvmmsg(notif_sk, msgs, NOTIF_BATCH, MSG_WAITFORONE,
+									NULL);
 		if (ret < 0) {
 			error("Receiving notifications failed: %s",
 							strerror(errno));
 			goto failed;
 		}
 
-		/* socket was shutdown */
-		if (ret == 0) {
-			pthread_mutex_lock(&cmd_sk_mutex);
-			if (cmd_sk == -1) {
-				pthread_mutex_unlock(&cmd_sk_mutex);
-				break;
-			}
-			pthread_mutex_unlock(&cmd_sk_mutex);
+		for (i = 0; i < ret; i++) {
+			struct msghdr *msg = &msgs[i].msg_hdr;
 
-			error("Notification socket closed");
-			goto failed;
-		}
+			/* socket was shutdown */
+			if (msgs[i].msg_len == 0)
+				goto shutdown;
 
-		fd = -1;
+			fd = -1;
 
-		/* Receive auxiliary data in msg */
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_level == SOL_SOCKET
+			/* Receive auxiliary data in msg */
+			for (cmsg = CMSG_FIRSTHDR(msg); cmsg;
+						cmsg = CMSG_NXTHDR(msg, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET
 					&& cmsg->cmsg_type == SCM_RIGHTS) {
-				memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
-				break;
+					memcpy(&fd, CMSG_DATA(cmsg),
+								sizeof(int));
+					break;
+				}
 			}
+
+			if (!handle_msg(buf[i], msgs[i].msg_len, fd))
+				goto failed;
 		}
+	}
 
-		if (!handle_msg(buf, ret, fd))
-			goto failed;
+shutdown:
+	pthread_mutex_lock(&cmd_sk_mutex);
+	if (cmd_sk != -1) {
+		pthread_mutex_unlock(&cmd_sk_mutex);
+
+		error("Notification socket closed");
+		goto failed;
 	}
+	pthread_mutex_unlock(&cmd_sk_mutex);
 
 	close(notif_sk);
 	notif_sk = -1;
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <endian.h>
+#include <stdbool.h>
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define PCM_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_NEON
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+#endif
+
+#include "hal-pcm.h"
+
+static inline int16_t get_sample(int16_t val)
+{
+	return le16toh((uint16_t) val);
+}
+
+/* Averages in 32 bit and rounds towards zero, as (l + r) / 2 does */
+void pcm_downmix_to_mono_scalar(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i < frames; i++) {
+		int16_t l = get_sample(input[i * 2]);
+		int16_t r = get_sample(input[i * 2 + 1]);
+
+		output[i] = htole16((l + r) / 2);
+	}
+}
+
+#ifdef PCM_SSE2
+static inline __m128i __attribute__((target("sse2")))
+downmix_sse2_4(__m128i frames)
+{
+	__m128i l, r, sum;
+
+	/* Each 32 bit lane holds the left sample low and the right one high */
+	l = _mm_srai_epi32(_mm_slli_epi32(frames, 16), 16);
+	r = _mm_srai_epi32(frames, 16);
+
+	sum = _mm_add_epi32(l, r);
+	sum = _mm_add_epi32(sum, _mm_srli_epi32(sum, 31));
+
+	return _mm_srai_epi32(sum, 1);
+}
+
+static void __attribute__((target("sse2")))
+downmix_sse2(const int16_t *input, int16_t *output, size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m128i lo, hi;
+
+		lo = _mm_loadu_si128((const __m128i *) &input[i * 2]);
+		hi = _mm_loadu_si128((const __m128i *) &input[i * 2 + 8]);
+
+		lo = downmix_sse2_4(lo);
+		hi = downmix_sse2_4(hi);
+
+		_mm_storeu_si128((__m128i *) &output[i],
+						_mm_packs_epi32(lo, hi));
+	}
+
+	pcm_downmix_to_mono_scalar(input + i * 2, output + i, frames - i);
+}
+
+static bool has_sse2(void)
+{
+#if defined(__x86_64__) || defined(__SSE2__)
+	return true;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+#ifdef PCM_NEON
+static inline int16x4_t downmix_neon_4(int16x4_t l, int16x4_t r)
+{
+	int32x4_t sum;
+	uint32x4_t sign;
+
+	sum = vaddl_s16(l, r);
+	sign = vshrq_n_u32(vreinterpretq_u32_s32(sum), 31);
+	sum = vaddq_s32(sum, vreinterpretq_s32_u32(sign));
+
+	return vshrn_n_s32(sum, 1);
+}
+
+static void downmix_neon(const int16_t *input, int16_t *output, size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		int16x8x2_t lr = vld2q_s16(&input[i * 2]);
+		int16x4_t lo, hi;
+
+		lo = downmix_neon_4(vget_low_s16(lr.val[0]),
+						vget_low_s16(lr.val[1]));
+		hi = downmix_neon_4(vget_high_s16(lr.val[0]),
+						vget_high_s16(lr.val[1]));
+
+		vst1q_s16(&output[i], vcombine_s16(lo, hi));
+	}
+
+	pcm_downmix_to_mono_scalar(input + i * 2, output + i, frames - i);
+}
+
+static bool has_neon(void)
+{
+#if defined(__aarch64__)
+	return true;
+#else
+	return getauxval(AT_HWCAP) & HWCAP_NEON;
+#endif
+}
+#endif
+
+static void (*downmix)(const int16_t *input, int16_t *output,
+				size_t frames) = pcm_downmix_to_mono_scalar;
+static const char *kernel = "scalar";
+
+void pcm_init(void)
+{
+#ifdef PCM_SSE2
+	if (has_sse2()) {
+		downmix = downmix_sse2;
+		kernel = "sse2";
+	}
+#endif
+#ifdef PCM_NEON
+	if (has_neon()) {
+		downmix = downmix_neon;
+		kernel = "neon";
+	}
+#endif
+}
+
+const char *pcm_kernel(void)
+{
+	return kernel;
+}
+
+void pcm_downmix_to_mono(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	downmix(input, output, frames);
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void pcm_init(void);
+const char *pcm_kernel(void);
+
+/* Mixes frames of interleaved 16 bit little endian stereo into mono */
+void pcm_downmix_to_mono(const int16_t *input, int16_t *output,
+								size_t frames);
+void pcm_downmix_to_mono_scalar(const int16_t *input, int16_t *output,
+								size_t frames);
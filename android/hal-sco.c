@@ -11,15 +11,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <linux/sockios.h>
 
 #include <hardware/audio.h>
 #include <hardware/hardware.h>
 #include <audio_utils/resampler.h>
+#include <cutils/properties.h>
 
 #include "hal-utils.h"
+#include "hal-pcm.h"
 #include "sco-msg.h"
 #include "ipc-common.h"
 #include "hal-log.h"
@@ -35,6 +40,9 @@
 
 #define SOCKET_POLL_TIMEOUT_MS		500
 
+/* Bytes of SCO audio per second, 16 bit mono samples */
+#define SCO_BYTES_PER_SEC		(AUDIO_STREAM_SCO_RATE * 2)
+
 static int listen_sk = -1;
 static int ipc_sk = -1;
 
@@ -48,6 +56,27 @@ static pthread_mutex_t sk_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct sco_stream_in *sco_stream_in = NULL;
 static struct sco_stream_out *sco_stream_out = NULL;
 
+/*
+ * Low latency mode, set with the sco_lowlatency property. Socket buffers
+ * are shrunk to sco_sndbuf and sco_rcvbuf bytes when set, reads are kept
+ * aligned to SCO packets and threads doing SCO I/O are moved to SCHED_FIFO
+ * with priority sco_rtprio when set.
+ */
+static struct {
+	bool enabled;
+	int sndbuf;
+	int rcvbuf;
+	int rt_priority;
+} sco_ll;
+
+struct sco_stats {
+	uint32_t packets;
+	uint32_t timeouts;
+	uint64_t delay_sum;
+	uint32_t delay_max;
+	bool rt;
+};
+
 struct sco_audio_config {
 	uint32_t rate;
 	uint32_t channels;
@@ -72,6 +101,8 @@ struct sco_stream_out {
 	uint32_t resample_frame_num;
 
 	bt_bdaddr_t bd_addr;
+
+	struct sco_stats stats;
 };
 
 static void sco_close_socket(void)
@@ -95,7 +126,16 @@ struct sco_stream_in {
 	int16_t *resample_buf;
 	uint32_t resample_frame_num;
 
+	uint8_t *pkt;
+	size_t pkt_len;
+	size_t pkt_off;
+
+	size_t samples;
+	struct timespec start;
+
 	bt_bdaddr_t bd_addr;
+
+	struct sco_stats stats;
 };
 
 struct sco_dev {
@@ -272,6 +312,103 @@ failed:
 	return SCO_STATUS_FAILED;
 }
 
+static void sco_load_config(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+
+	memset(&sco_ll, 0, sizeof(sco_ll));
+
+	if (get_config("sco_lowlatency", value, NULL) <= 0 ||
+			(strcasecmp(value, "true") && atoi(value) <= 0))
+		return;
+
+	sco_ll.enabled = true;
+
+	if (get_config("sco_sndbuf", value, NULL) > 0)
+		sco_ll.sndbuf = atoi(value);
+
+	if (get_config("sco_rcvbuf", value, NULL) > 0)
+		sco_ll.rcvbuf = atoi(value);
+
+	if (get_config("sco_rtprio", value, NULL) > 0)
+		sco_ll.rt_priority = atoi(value);
+
+	DBG("low latency: sndbuf %d rcvbuf %d rtprio %d", sco_ll.sndbuf,
+					sco_ll.rcvbuf, sco_ll.rt_priority);
+}
+
+static void sco_setup_socket(void)
+{
+	if (sco_ll.sndbuf > 0 && setsockopt(sco_fd, SOL_SOCKET, SO_SNDBUF,
+				&sco_ll.sndbuf, sizeof(sco_ll.sndbuf)) < 0)
+		warn("sco: Failed to set send buffer: %s", strerror(errno));
+
+	if (sco_ll.rcvbuf > 0 && setsockopt(sco_fd, SOL_SOCKET, SO_RCVBUF,
+				&sco_ll.rcvbuf, sizeof(sco_ll.rcvbuf)) < 0)
+		warn("sco: Failed to set receive buffer: %s", strerror(errno));
+}
+
+/*
+ * Audio flinger already runs a thread per stream, so instead of handing the
+ * I/O to yet another thread the calling thread is made real-time the first
+ * time it writes or reads.
+ */
+static void sco_set_rt(struct sco_stats *stats)
+{
+	struct sched_param param;
+	int err;
+
+	if (stats->rt || sco_ll.rt_priority <= 0)
+		return;
+
+	stats->rt = true;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = sco_ll.rt_priority;
+
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err)
+		warn("sco: Failed to set SCHED_FIFO: %s", strerror(err));
+}
+
+static void sco_stats_update(struct sco_stats *stats, uint64_t delay)
+{
+	stats->packets++;
+	stats->delay_sum += delay;
+
+	if (delay > stats->delay_max)
+		stats->delay_max = delay;
+}
+
+static void sco_stats_dump(int fd, const char *name, struct sco_stats *stats)
+{
+	dprintf(fd, "  %s: packets %u timeouts %u delay avg %u max %u us\n",
+			name, stats->packets, stats->timeouts,
+			stats->packets ? (uint32_t) (stats->delay_sum /
+						stats->packets) : 0,
+			stats->delay_max);
+}
+
+static void ipc_send_sco_stats(bt_bdaddr_t *bd_addr, uint8_t dir,
+						struct sco_stats *stats)
+{
+	struct sco_cmd_stats cmd;
+
+	if (!stats->packets)
+		return;
+
+	memcpy(cmd.bdaddr, bd_addr, sizeof(cmd.bdaddr));
+	cmd.dir = dir;
+	cmd.packets = stats->packets;
+	cmd.timeouts = stats->timeouts;
+	cmd.delay_avg = stats->delay_sum / stats->packets;
+	cmd.delay_max = stats->delay_max;
+
+	if (sco_ipc_cmd(SCO_SERVICE_ID, SCO_OP_STATS, sizeof(cmd), &cmd,
+					NULL, NULL, NULL) != SCO_STATUS_SUCCESS)
+		DBG("Failed to send stats");
+}
+
 static int ipc_get_sco_fd(bt_bdaddr_t *bd_addr)
 {
 	int ret = SCO_STATUS_SUCCESS;
@@ -292,6 +429,9 @@ static int ipc_get_sco_fd(bt_bdaddr_t *bd_addr)
 
 		/* Sometimes mtu returned is wrong */
 		sco_mtu = /* rsp.mtu */ 48;
+
+		if (ret == SCO_STATUS_SUCCESS)
+			sco_setup_socket();
 	}
 
 	pthread_mutex_unlock(&sco_mutex);
@@ -301,21 +441,6 @@ static int ipc_get_sco_fd(bt_bdaddr_t *bd_addr)
 
 /* Audio stream functions */
 
-static void downmix_to_mono(struct sco_stream_out *out, const uint8_t *buffer,
-							size_t frame_num)
-{
-	const int16_t *input = (const void *) buffer;
-	int16_t *output = (void *) out->downmix_buf;
-	size_t i;
-
-	for (i = 0; i < frame_num; i++) {
-		int16_t l = get_le16(&input[i * 2]);
-		int16_t r = get_le16(&input[i * 2 + 1]);
-
-		put_le16((l + r) / 2, &output[i]);
-	}
-}
-
 static uint64_t timespec_diff_us(struct timespec *a, struct timespec *b)
 {
 	struct timespec res;
@@ -349,6 +474,7 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 		/* poll for sending */
 		if (poll(&pfd, 1, SOCKET_POLL_TIMEOUT_MS) == 0) {
 			DBG("timeout fd %d", sco_fd);
+			out->stats.timeouts++;
 			return false;
 		}
 
@@ -400,6 +526,13 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 
 		ret = write(sco_fd, p, len);
 		if (ret > 0) {
+			int outq;
+
+			/* Data still queued is what delays the packet */
+			if (ioctl(sco_fd, SIOCOUTQ, &outq) == 0 && outq >= 0)
+				sco_stats_update(&out->stats, outq * 1000000ll /
+							SCO_BYTES_PER_SEC);
+
 			if (out->cache_len) {
 				written = sco_mtu - out->cache_len;
 				out->cache_len = 0;
@@ -450,12 +583,14 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 	if (ipc_get_sco_fd(&out->bd_addr) != SCO_STATUS_SUCCESS)
 		return -1;
 
+	sco_set_rt(&out->stats);
+
 	if (!out->downmix_buf) {
 		error("sco: downmix buffer not initialized");
 		return -1;
 	}
 
-	downmix_to_mono(out, buffer, frame_num);
+	pcm_downmix_to_mono(buffer, (void *) out->downmix_buf, frame_num);
 
 	if (out->resampler) {
 		int ret;
@@ -560,9 +695,15 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct sco_stream_out *out = (struct sco_stream_out *) stream;
+
 	DBG("");
 
-	return -ENOSYS;
+	dprintf(fd, "SCO output: rate %u low latency %u\n", out->cfg.rate,
+							sco_ll.enabled);
+	sco_stats_dump(fd, "output", &out->stats);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -790,6 +931,8 @@ static void sco_close_output_stream(struct audio_hw_device *dev,
 
 	DBG("dev %p stream %p fd %d", dev, out, sco_fd);
 
+	ipc_send_sco_stats(&out->bd_addr, SCO_STATS_DIR_OUT, &out->stats);
+
 	if (out->resampler) {
 		release_resampler(out->resampler);
 		free(out->resample_buf);
@@ -946,9 +1089,15 @@ static int in_standby(struct audio_stream *stream)
 
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+	struct sco_stream_in *in = (struct sco_stream_in *) stream;
+
 	DBG("");
 
-	return -ENOSYS;
+	dprintf(fd, "SCO input: rate %u low latency %u\n", in->cfg.rate,
+							sco_ll.enabled);
+	sco_stats_dump(fd, "input", &in->stats);
+
+	return 0;
 }
 
 static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -989,6 +1138,29 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
 	return -ENOSYS;
 }
 
+/*
+ * Audio received but not read yet, estimated from the audio read so far and
+ * the time passed since the first read.
+ */
+static void in_update_delay(struct sco_stream_in *in, size_t len)
+{
+	struct timespec now;
+	uint64_t audio_read_us, audio_passed_us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (!in->samples)
+		memcpy(&in->start, &now, sizeof(in->start));
+
+	in->samples += len / 2;
+
+	audio_read_us = in->samples * 1000000ll / AUDIO_STREAM_SCO_RATE;
+	audio_passed_us = timespec_diff_us(&now, &in->start);
+
+	sco_stats_update(&in->stats, audio_passed_us > audio_read_us ?
+					audio_passed_us - audio_read_us : 0);
+}
+
 static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 {
 	struct pollfd pfd;
@@ -1000,9 +1172,21 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 	while (bytes > read_bytes) {
 		int ret;
 
+		/* Rest of a packet read by the previous call */
+		if (in->pkt_len) {
+			len = bytes - read_bytes > in->pkt_len ? in->pkt_len :
+							bytes - read_bytes;
+			memcpy(buffer + read_bytes, in->pkt + in->pkt_off, len);
+			in->pkt_off += len;
+			in->pkt_len -= len;
+			read_bytes += len;
+			continue;
+		}
+
 		/* poll for reading */
 		if (poll(&pfd, 1, SOCKET_POLL_TIMEOUT_MS) == 0) {
 			DBG("timeout fd %d", sco_fd);
+			in->stats.timeouts++;
 			return false;
 		}
 
@@ -1011,14 +1195,30 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 			return false;
 		}
 
-		len = bytes - read_bytes > sco_mtu ? sco_mtu :
+		/*
+		 * Reading less than a packet drops the rest of it, so in low
+		 * latency mode a whole packet is read and what does not fit is
+		 * kept for the next call.
+		 */
+		if (in->pkt && bytes - read_bytes < sco_mtu) {
+			ret = read(sco_fd, in->pkt, sco_mtu);
+			if (ret > 0) {
+				in_update_delay(in, ret);
+				in->pkt_off = 0;
+				in->pkt_len = ret;
+				continue;
+			}
+		} else {
+			len = bytes - read_bytes > sco_mtu ? sco_mtu :
 							bytes - read_bytes;
 
-		ret = read(sco_fd, buffer + read_bytes, len);
-		if (ret > 0) {
-			read_bytes += ret;
-			DBG("read %d total %zd", ret, read_bytes);
-			continue;
+			ret = read(sco_fd, buffer + read_bytes, len);
+			if (ret > 0) {
+				in_update_delay(in, ret);
+				read_bytes += ret;
+				DBG("read %d total %zd", ret, read_bytes);
+				continue;
+			}
 		}
 
 		if (errno == EAGAIN) {
@@ -1066,6 +1266,14 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 	if (ipc_get_sco_fd(&in->bd_addr) != SCO_STATUS_SUCCESS)
 		return -1;
 
+	sco_set_rt(&in->stats);
+
+	if (sco_ll.enabled && !in->pkt) {
+		in->pkt = malloc(sco_mtu);
+		if (!in->pkt)
+			return -1;
+	}
+
 	if (!in->resampler && in->cfg.rate != AUDIO_STREAM_SCO_RATE) {
 		error("Cannot find resampler");
 		return -1;
@@ -1266,11 +1474,14 @@ static void sco_close_input_stream(struct audio_hw_device *dev,
 
 	DBG("dev %p stream %p fd %d", dev, in, sco_fd);
 
+	ipc_send_sco_stats(&in->bd_addr, SCO_STATS_DIR_IN, &in->stats);
+
 	if (in->resampler) {
 		release_resampler(in->resampler);
 		free(in->resample_buf);
 	}
 
+	free(in->pkt);
 	free(in);
 	sco_dev->in = NULL;
 
@@ -1466,6 +1677,10 @@ static int sco_open(const hw_module_t *module, const char *name,
 	if (err < 0)
 		return err;
 
+	pcm_init();
+
+	sco_load_config();
+
 	dev = calloc(1, sizeof(struct sco_dev));
 	if (!dev)
 		return -ENOMEM;
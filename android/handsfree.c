@@ -2913,9 +2913,29 @@ failed:
 	ipc_send_rsp(sco_ipc, SCO_SERVICE_ID, SCO_OP_STATUS, SCO_STATUS_FAILED);
 }
 
+static void bt_sco_stats(const void *buf, uint16_t len)
+{
+	const struct sco_cmd_stats *cmd = buf;
+	bdaddr_t bdaddr;
+	char addr[18];
+
+	android2bdaddr(cmd->bdaddr, &bdaddr);
+	ba2str(&bdaddr, addr);
+
+	info("handsfree: %s %s packets %u timeouts %u delay avg %u max %u us",
+			addr, cmd->dir == SCO_STATS_DIR_IN ? "in" : "out",
+			cmd->packets, cmd->timeouts, cmd->delay_avg,
+			cmd->delay_max);
+
+	ipc_send_rsp(sco_ipc, SCO_SERVICE_ID, SCO_OP_STATS,
+							SCO_STATUS_SUCCESS);
+}
+
 static const struct ipc_handler sco_handlers[] = {
 	/* SCO_OP_GET_FD */
-	{ bt_sco_get_fd, false, sizeof(struct sco_cmd_get_fd) }
+	{ bt_sco_get_fd, false, sizeof(struct sco_cmd_get_fd) },
+	/* SCO_OP_STATS */
+	{ bt_sco_stats, false, sizeof(struct sco_cmd_stats) },
 };
 
 static void bt_sco_unregister(void)
@@ -12,6 +12,7 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stddef.h>
 #include <errno.h>
 #include <stdint.h>
@@ -27,11 +28,19 @@
 #include "ipc.h"
 #include "src/log.h"
 
+/* Notifications queued in one main loop iteration and sent together */
+#define IPC_NOTIF_BATCH 16
+
 struct service_handler {
 	const struct ipc_handler *handler;
 	uint8_t size;
 };
 
+struct ipc_notif {
+	size_t len;
+	uint8_t buf[IPC_MTU];
+};
+
 struct ipc {
 	struct service_handler *services;
 	int service_max;
@@ -46,12 +55,23 @@ struct ipc {
 	GIOChannel *notif_io;
 	guint notif_watch;
 
+	struct ipc_notif notif[IPC_NOTIF_BATCH];
+	unsigned int notif_count;
+	guint notif_flush;
+
 	ipc_disconnect_cb disconnect_cb;
 	void *disconnect_cb_data;
 };
 
 static void ipc_disconnect(struct ipc *ipc, bool in_cleanup)
 {
+	if (ipc->notif_flush) {
+		g_source_remove(ipc->notif_flush);
+		ipc->notif_flush = 0;
+	}
+
+	ipc->notif_count = 0;
+
 	if (ipc->cmd_watch) {
 		g_source_remove(ipc->cmd_watch);
 		ipc->cmd_watch = 0;
@@ -308,8 +328,12 @@ struct ipc *ipc_init(const char *path, size_t size, int max_service_id,
 	return ipc;
 }
 
+static void ipc_flush_notif(struct ipc *ipc);
+
 void ipc_cleanup(struct ipc *ipc)
 {
+	ipc_flush_notif(ipc);
+
 	ipc_disconnect(ipc, true);
 
 	g_free(ipc->services);
@@ -369,6 +393,9 @@ void ipc_send_rsp(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 	struct ipc_status s;
 	int sk;
 
+	/* Keep notifications ahead of the responses that followed them */
+	ipc_flush_notif(ipc);
+
 	sk = g_io_channel_unix_get_fd(ipc->cmd_io);
 
 	if (status == IPC_STATUS_SUCCESS) {
@@ -384,6 +411,8 @@ void ipc_send_rsp(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 void ipc_send_rsp_full(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd)
 {
+	ipc_flush_notif(ipc);
+
 	ipc_send(g_io_channel_unix_get_fd(ipc->cmd_io), service_id, opcode, len,
 								param, fd);
 }
@@ -394,14 +423,98 @@ void ipc_send_notif(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 	return ipc_send_notif_with_fd(ipc, service_id, opcode, len, param, -1);
 }
 
+static void ipc_flush_notif(struct ipc *ipc)
+{
+	struct mmsghdr msgs[IPC_NOTIF_BATCH];
+	struct iovec iv[IPC_NOTIF_BATCH];
+	unsigned int i;
+	int sk, ret;
+
+	if (ipc->notif_flush) {
+		g_source_remove(ipc->notif_flush);
+		ipc->notif_flush = 0;
+	}
+
+	if (!ipc->notif_count)
+		return;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < ipc->notif_count; i++) {
+		iv[i].iov_base = ipc->notif[i].buf;
+		iv[i].iov_len = ipc->notif[i].len;
+
+		msgs[i].msg_hdr.msg_iov = &iv[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	sk = g_io_channel_unix_get_fd(ipc->notif_io);
+
+	for (i = 0; i < ipc->notif_count; i += ret) {
+		ret = sendmmsg(sk, msgs + i, ipc->notif_count - i, 0);
+		if (ret < 0) {
+			error("IPC send failed :%s", strerror(errno));
+
+			/* TODO disconnect IPC here, same as in ipc_send() */
+			raise(SIGTERM);
+			break;
+		}
+	}
+
+	ipc->notif_count = 0;
+}
+
+static gboolean notif_flush_cb(gpointer user_data)
+{
+	struct ipc *ipc = user_data;
+
+	ipc->notif_flush = 0;
+
+	ipc_flush_notif(ipc);
+
+	return FALSE;
+}
+
 void ipc_send_notif_with_fd(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd)
 {
+	struct ipc_notif *notif;
+	struct ipc_hdr *m;
+
 	if (!ipc || !ipc->notif_io)
 		return;
 
-	ipc_send(g_io_channel_unix_get_fd(ipc->notif_io), service_id, opcode,
-								len, param, fd);
+	/*
+	 * Queue plain notifications so that bursts, such as GATT
+	 * notifications, reach the HAL with one sendmmsg() per main loop
+	 * iteration. Anything carrying a descriptor goes out right away,
+	 * after whatever was queued before it.
+	 */
+	if (fd >= 0 || sizeof(*m) + len > IPC_MTU) {
+		ipc_flush_notif(ipc);
+		ipc_send(g_io_channel_unix_get_fd(ipc->notif_io), service_id,
+						opcode, len, param, fd);
+		return;
+	}
+
+	if (ipc->notif_count == IPC_NOTIF_BATCH)
+		ipc_flush_notif(ipc);
+
+	notif = &ipc->notif[ipc->notif_count++];
+	notif->len = sizeof(*m) + len;
+
+	m = (struct ipc_hdr *) notif->buf;
+	m->service_id = service_id;
+	m->opcode = opcode;
+	m->len = len;
+
+	if (len)
+		memcpy(m->payload, param, len);
+
+	if (!ipc->notif_flush)
+		ipc->notif_flush = g_idle_add_full(G_PRIORITY_DEFAULT,
+							notif_flush_cb, ipc,
+							NULL);
 }
 
 void ipc_register(struct ipc *ipc, uint8_t service,
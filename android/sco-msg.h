@@ -25,3 +25,16 @@ struct sco_cmd_get_fd {
 struct sco_rsp_get_fd {
 	uint16_t mtu;
 } __attribute__((packed));
+
+#define SCO_OP_STATS			0x02
+struct sco_cmd_stats {
+	uint8_t bdaddr[6];
+	uint8_t dir;
+	uint32_t packets;
+	uint32_t timeouts;
+	uint32_t delay_avg;
+	uint32_t delay_max;
+} __attribute__((packed));
+
+#define SCO_STATS_DIR_OUT		0x00
+#define SCO_STATS_DIR_IN		0x01
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include <glib.h>
+
+#include "android/hal-pcm.h"
+
+/* One FIXED_BUFFER_SIZE write of the A2DP output */
+#define FRAMES		(20 * 512 / 4)
+#define ITERATIONS	5000
+
+static int16_t input[FRAMES * 2 + 2];
+static int16_t output[FRAMES + 1];
+static int16_t expect[FRAMES + 1];
+
+static void fill_random(void)
+{
+	size_t i;
+
+	srand(0);
+	for (i = 0; i < G_N_ELEMENTS(input); i++)
+		input[i] = htole16(rand());
+}
+
+static void check_downmix(const int16_t *in, size_t frames)
+{
+	memset(output, 0x55, sizeof(output));
+	memset(expect, 0x55, sizeof(expect));
+
+	pcm_downmix_to_mono_scalar(in, expect, frames);
+	pcm_downmix_to_mono(in, output, frames);
+
+	/* Includes the sample after the last frame to catch overruns */
+	g_assert(!memcmp(output, expect, (frames + 1) * sizeof(int16_t)));
+}
+
+static void test_extremes(void)
+{
+	static const int16_t values[] = { 0, 1, -1, 2, -2, 3, -3, INT16_MAX,
+						INT16_MIN, INT16_MAX - 1,
+						INT16_MIN + 1 };
+	size_t i;
+
+	for (i = 0; i < FRAMES * 2; i++)
+		input[i] = htole16(values[i % G_N_ELEMENTS(values)]);
+
+	check_downmix(input, FRAMES);
+
+	input[0] = htole16(INT16_MIN);
+	input[1] = htole16(INT16_MIN);
+	pcm_downmix_to_mono(input, output, 1);
+	g_assert(le16toh(output[0]) == (uint16_t) INT16_MIN);
+
+	input[0] = htole16(-3);
+	input[1] = htole16(0);
+	pcm_downmix_to_mono(input, output, 1);
+	g_assert((int16_t) le16toh(output[0]) == -1);
+}
+
+static void test_lengths(void)
+{
+	size_t frames;
+
+	fill_random();
+
+	for (frames = 0; frames <= 64; frames++)
+		check_downmix(input, frames);
+
+	check_downmix(input, FRAMES);
+}
+
+static void test_unaligned(void)
+{
+	fill_random();
+
+	check_downmix(input + 1, FRAMES - 1);
+	check_downmix(input + 2, FRAMES - 1);
+}
+
+static double bench(void (*func)(const int16_t *input, int16_t *output,
+							size_t frames))
+{
+	int i;
+
+	g_test_timer_start();
+
+	for (i = 0; i < ITERATIONS; i++)
+		func(input, output, FRAMES);
+
+	return g_test_timer_elapsed();
+}
+
+static void test_benchmark(void)
+{
+	double scalar, simd;
+
+	fill_random();
+
+	scalar = bench(pcm_downmix_to_mono_scalar);
+	simd = bench(pcm_downmix_to_mono);
+
+	g_test_message("downmix of %d frames: scalar %.2f us %s %.2f us",
+			FRAMES, scalar * 1000000 / ITERATIONS, pcm_kernel(),
+			simd * 1000000 / ITERATIONS);
+	g_test_minimized_result(simd, "%s downmix %.3f s", pcm_kernel(), simd);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	pcm_init();
+
+	g_test_add_func("/android_pcm/downmix/extremes", test_extremes);
+	g_test_add_func("/android_pcm/downmix/lengths", test_lengths);
+	g_test_add_func("/android_pcm/downmix/unaligned", test_unaligned);
+
+	if (g_test_perf())
+		g_test_add_func("/android_pcm/downmix/benchmark",
+							test_benchmark);
+
+	return g_test_run();
+}
@@ -88,6 +88,24 @@ struct server {
 	GDestroyNotify destroy;
 };
 
+struct bt_io_group {
+	int ref_count;
+	bdaddr_t src;
+	bdaddr_t dst;
+	gboolean leading;		/* First channel still connecting */
+	gboolean up;			/* First channel connected */
+	GSList *pending;		/* Channels waiting for the first one */
+};
+
+struct group_member {
+	struct bt_io_group *group;
+	GIOChannel *io;
+	struct set_opts opts;
+	BtIOConnect connect;
+	gpointer user_data;
+	GDestroyNotify destroy;
+};
+
 static BtIOType bt_io_get_type(GIOChannel *io, GError **gerr)
 {
 	int sk = g_io_channel_unix_get_fd(io);
@@ -1675,62 +1693,73 @@ failed:
 	return NULL;
 }
 
-GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
-				GDestroyNotify destroy, GError **gerr,
-				BtIOOption opt1, ...)
+static gboolean connect_io(GIOChannel *io, struct set_opts *opts,
+								GError **gerr)
 {
-	GIOChannel *io;
-	va_list args;
-	struct set_opts opts;
 	int err, sock;
-	gboolean ret;
 	char addr[18];
 
-	va_start(args, opt1);
-	ret = parse_set_opts(&opts, gerr, opt1, args);
-	va_end(args);
-
-	if (ret == FALSE)
-		return NULL;
-
-	io = create_io(FALSE, &opts, gerr);
-	if (io == NULL)
-		return NULL;
-
 	sock = g_io_channel_unix_get_fd(io);
 
 	/* Use DEFER_SETUP when connecting using Ext-Flowctl */
-	if (opts.mode == BT_IO_MODE_EXT_FLOWCTL && opts.defer) {
+	if (opts->mode == BT_IO_MODE_EXT_FLOWCTL && opts->defer) {
 		if (setsockopt(sock, SOL_BLUETOOTH, BT_DEFER_SETUP,
-					&opts.defer, sizeof(opts.defer)) < 0) {
+				&opts->defer, sizeof(opts->defer)) < 0) {
 			ERROR_FAILED(gerr, "setsockopt(BT_DEFER_SETUP)", errno);
-			return NULL;
+			return FALSE;
 		}
 	}
 
-	switch (opts.type) {
+	switch (opts->type) {
 	case BT_IO_L2CAP:
-		err = l2cap_connect(sock, &opts.dst, opts.dst_type,
-							opts.psm, opts.cid);
+		err = l2cap_connect(sock, &opts->dst, opts->dst_type,
+							opts->psm, opts->cid);
 		break;
 	case BT_IO_RFCOMM:
-		err = rfcomm_connect(sock, &opts.dst, opts.channel);
+		err = rfcomm_connect(sock, &opts->dst, opts->channel);
 		break;
 	case BT_IO_SCO:
-		err = sco_connect(sock, &opts.dst);
+		err = sco_connect(sock, &opts->dst);
 		break;
 	case BT_IO_INVALID:
 	default:
 		g_set_error(gerr, BT_IO_ERROR, EINVAL,
-					"Unknown BtIO type %d", opts.type);
-		return NULL;
+					"Unknown BtIO type %d", opts->type);
+		return FALSE;
 	}
 
 	if (err < 0) {
-		ba2str(&opts.dst, addr);
+		ba2str(&opts->dst, addr);
 		g_set_error(gerr, BT_IO_ERROR, -err,
 				"connect to %s: %s (%d)", addr, strerror(-err),
 				-err);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
+				GDestroyNotify destroy, GError **gerr,
+				BtIOOption opt1, ...)
+{
+	GIOChannel *io;
+	va_list args;
+	struct set_opts opts;
+	gboolean ret;
+
+	va_start(args, opt1);
+	ret = parse_set_opts(&opts, gerr, opt1, args);
+	va_end(args);
+
+	if (ret == FALSE)
+		return NULL;
+
+	io = create_io(FALSE, &opts, gerr);
+	if (io == NULL)
+		return NULL;
+
+	if (!connect_io(io, &opts, gerr)) {
 		g_io_channel_unref(io);
 		return NULL;
 	}
@@ -1740,6 +1769,188 @@ GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
 	return io;
 }
 
+struct bt_io_group *bt_io_group_new(void)
+{
+	struct bt_io_group *group;
+
+	group = g_new0(struct bt_io_group, 1);
+
+	return bt_io_group_ref(group);
+}
+
+struct bt_io_group *bt_io_group_ref(struct bt_io_group *group)
+{
+	if (!group)
+		return NULL;
+
+	group->ref_count++;
+
+	return group;
+}
+
+void bt_io_group_unref(struct bt_io_group *group)
+{
+	if (!group)
+		return;
+
+	if (--group->ref_count > 0)
+		return;
+
+	g_free(group);
+}
+
+static void member_free(gpointer data)
+{
+	struct group_member *member = data;
+
+	if (member->destroy)
+		member->destroy(member->user_data);
+
+	if (member->io)
+		g_io_channel_unref(member->io);
+
+	bt_io_group_unref(member->group);
+	g_free(member);
+}
+
+static void member_start(gpointer data, gpointer user_data)
+{
+	struct group_member *member = data;
+	GError *err = user_data;
+	GError *gerr = NULL;
+
+	/* If the user aborted this connect attempt meanwhile */
+	if (check_nval(member->io)) {
+		member_free(member);
+		return;
+	}
+
+	if (!err && !connect_io(member->io, &member->opts, &gerr))
+		err = gerr;
+
+	if (err) {
+		member->connect(member->io, err, member->user_data);
+		g_clear_error(&gerr);
+		member_free(member);
+		return;
+	}
+
+	/* From now on the channel is handled as any other connection */
+	connect_add(member->io, member->connect, member->opts.dst,
+				member->user_data, member->destroy);
+
+	member->destroy = NULL;
+	member_free(member);
+}
+
+static void group_start(struct bt_io_group *group, GError *err)
+{
+	GSList *pending;
+
+	group->leading = FALSE;
+	group->up = err ? FALSE : TRUE;
+
+	pending = group->pending;
+	group->pending = NULL;
+
+	g_slist_foreach(pending, member_start, err);
+	g_slist_free(pending);
+}
+
+static void group_lead_cb(GIOChannel *io, GError *err, gpointer user_data)
+{
+	struct group_member *member = user_data;
+
+	member->connect(io, err, member->user_data);
+
+	/* The link is up and secured, connect the other channels at once */
+	group_start(member->group, err);
+}
+
+static void group_lead_free(gpointer data)
+{
+	struct group_member *member = data;
+	GError *err = NULL;
+
+	/* The first channel was aborted before connecting */
+	if (member->group->leading) {
+		g_set_error(&err, BT_IO_ERROR, ECANCELED,
+					"First channel of the group aborted");
+		group_start(member->group, err);
+		g_error_free(err);
+	}
+
+	member_free(member);
+}
+
+GIOChannel *bt_io_group_connect(struct bt_io_group *group,
+				BtIOConnect connect, gpointer user_data,
+				GDestroyNotify destroy, GError **gerr,
+				BtIOOption opt1, ...)
+{
+	struct group_member *member;
+	GIOChannel *io;
+	va_list args;
+	struct set_opts opts;
+	gboolean ret;
+
+	va_start(args, opt1);
+	ret = parse_set_opts(&opts, gerr, opt1, args);
+	va_end(args);
+
+	if (ret == FALSE)
+		return NULL;
+
+	if (group->leading || group->up) {
+		if (bacmp(&opts.src, &group->src) ||
+					bacmp(&opts.dst, &group->dst)) {
+			g_set_error(gerr, BT_IO_ERROR, EINVAL,
+					"Channel not to the peer of the group");
+			return NULL;
+		}
+	}
+
+	io = create_io(FALSE, &opts, gerr);
+	if (io == NULL)
+		return NULL;
+
+	member = g_new0(struct group_member, 1);
+	member->group = bt_io_group_ref(group);
+	member->opts = opts;
+	member->connect = connect;
+	member->user_data = user_data;
+	member->destroy = destroy;
+
+	/* Wait for the first channel to bring the link up */
+	if (group->leading) {
+		member->io = g_io_channel_ref(io);
+		group->pending = g_slist_append(group->pending, member);
+		return io;
+	}
+
+	if (!connect_io(io, &opts, gerr)) {
+		member->destroy = NULL;
+		member_free(member);
+		g_io_channel_unref(io);
+		return NULL;
+	}
+
+	if (group->up) {
+		connect_add(io, connect, opts.dst, user_data, destroy);
+		member->destroy = NULL;
+		member_free(member);
+		return io;
+	}
+
+	bacpy(&group->src, &opts.src);
+	bacpy(&group->dst, &opts.dst);
+	group->leading = TRUE;
+
+	connect_add(io, group_lead_cb, opts.dst, member, group_lead_free);
+
+	return io;
+}
+
 GIOChannel *bt_io_listen(BtIOConnect connect, BtIOConfirm confirm,
 				gpointer user_data, GDestroyNotify destroy,
 				GError **err, BtIOOption opt1, ...)
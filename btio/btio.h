@@ -76,6 +76,17 @@ GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
 				GDestroyNotify destroy, GError **gerr,
 				BtIOOption opt1, ...);
 
+struct bt_io_group;
+
+struct bt_io_group *bt_io_group_new(void);
+struct bt_io_group *bt_io_group_ref(struct bt_io_group *group);
+void bt_io_group_unref(struct bt_io_group *group);
+
+GIOChannel *bt_io_group_connect(struct bt_io_group *group,
+				BtIOConnect connect, gpointer user_data,
+				GDestroyNotify destroy, GError **gerr,
+				BtIOOption opt1, ...);
+
 GIOChannel *bt_io_listen(BtIOConnect connect, BtIOConfirm confirm,
 				gpointer user_data, GDestroyNotify destroy,
 				GError **err, BtIOOption opt1, ...);
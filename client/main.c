@@ -18,6 +18,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <wordexp.h>
 
 #include <glib.h>
@@ -50,6 +51,19 @@ struct adapter {
 	GDBusProxy *ad_proxy;
 	GDBusProxy *adv_monitor_proxy;
 	GList *devices;
+	GHashTable *addresses;
+};
+
+/* Scan output aggregated and refreshed once per interval */
+static struct scan_display {
+	bool summary;
+	unsigned int interval;
+	guint timer;
+	unsigned int added;
+	unsigned int removed;
+	GHashTable *changed;
+} scan_display = {
+	.interval = 1,
 };
 
 static struct adapter *default_ctrl;
@@ -489,7 +503,20 @@ static void device_added(GDBusProxy *proxy)
 	}
 
 	adapter->devices = g_list_append(adapter->devices, proxy);
-	print_device(proxy, COLORED_NEW);
+
+	if (g_dbus_proxy_get_property(proxy, "Address", &iter)) {
+		const char *address;
+
+		dbus_message_iter_get_basic(&iter, &address);
+		g_hash_table_insert(adapter->addresses,
+					g_ascii_strup(address, -1), proxy);
+	}
+
+	if (scan_display.summary)
+		scan_display.added++;
+	else
+		print_device(proxy, COLORED_NEW);
+
 	bt_shell_set_env(g_dbus_proxy_get_path(proxy), proxy);
 
 	if (default_dev)
@@ -511,6 +538,9 @@ static struct adapter *adapter_new(GDBusProxy *proxy)
 {
 	struct adapter *adapter = g_malloc0(sizeof(struct adapter));
 
+	adapter->addresses = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+
 	ctrl_list = g_list_append(ctrl_list, adapter);
 
 	if (!default_ctrl)
@@ -575,6 +605,23 @@ static void admin_policy_status_added(GDBusProxy *proxy)
 	admin_policy_set_status_proxy(proxy);
 }
 
+/* Objects without any of these interfaces get no proxy at all */
+static const char * const interfaces[] = {
+	"org.bluez.Device1",
+	"org.bluez.Adapter1",
+	"org.bluez.AgentManager1",
+	"org.bluez.GattService1",
+	"org.bluez.GattCharacteristic1",
+	"org.bluez.GattDescriptor1",
+	"org.bluez.GattManager1",
+	"org.bluez.LEAdvertisingManager1",
+	"org.bluez.Battery1",
+	"org.bluez.AdvertisementMonitorManager1",
+	"org.bluez.AdminPolicySet1",
+	"org.bluez.AdminPolicyStatus1",
+	NULL
+};
+
 static void proxy_added(GDBusProxy *proxy, void *user_data)
 {
 	const char *interface;
@@ -631,6 +678,8 @@ static void set_default_attribute(GDBusProxy *proxy)
 static void device_removed(GDBusProxy *proxy)
 {
 	struct adapter *adapter = find_parent(proxy);
+	DBusMessageIter iter;
+
 	if (!adapter) {
 		/* TODO: Error */
 		return;
@@ -638,7 +687,25 @@ static void device_removed(GDBusProxy *proxy)
 
 	adapter->devices = g_list_remove(adapter->devices, proxy);
 
-	print_device(proxy, COLORED_DEL);
+	if (g_dbus_proxy_get_property(proxy, "Address", &iter)) {
+		const char *address;
+		char *key;
+
+		dbus_message_iter_get_basic(&iter, &address);
+		key = g_ascii_strup(address, -1);
+		if (g_hash_table_lookup(adapter->addresses, key) == proxy)
+			g_hash_table_remove(adapter->addresses, key);
+		g_free(key);
+	}
+
+	if (scan_display.changed)
+		g_hash_table_remove(scan_display.changed, proxy);
+
+	if (scan_display.summary)
+		scan_display.removed++;
+	else
+		print_device(proxy, COLORED_DEL);
+
 	bt_shell_set_env(g_dbus_proxy_get_path(proxy), NULL);
 
 	if (default_dev == proxy)
@@ -663,6 +730,7 @@ static void adapter_removed(GDBusProxy *proxy)
 
 			ctrl_list = g_list_remove_link(ctrl_list, ll);
 			g_list_free(adapter->devices);
+			g_hash_table_destroy(adapter->addresses);
 			g_free(adapter);
 			g_list_free(ll);
 			return;
@@ -787,7 +855,11 @@ static void property_changed(GDBusProxy *proxy, const char *name,
 					set_default_device(NULL, NULL);
 			}
 
-			print_iter(str, name, iter);
+			if (scan_display.summary)
+				g_hash_table_add(scan_display.changed, proxy);
+			else
+				print_iter(str, name, iter);
+
 			g_free(str);
 		}
 	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
@@ -881,25 +953,17 @@ static GDBusProxy *find_proxies_by_path(GList *source, const char *path)
 	return NULL;
 }
 
-static GDBusProxy *find_proxy_by_address(GList *source, const char *address)
+static GDBusProxy *find_proxy_by_address(struct adapter *adapter,
+							const char *address)
 {
-	GList *list;
-
-	for (list = g_list_first(source); list; list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
-		DBusMessageIter iter;
-		const char *str;
-
-		if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
-			continue;
-
-		dbus_message_iter_get_basic(&iter, &str);
+	GDBusProxy *proxy;
+	char *key;
 
-		if (!strcasecmp(str, address))
-			return proxy;
-	}
+	key = g_ascii_strup(address, -1);
+	proxy = g_hash_table_lookup(adapter->addresses, key);
+	g_free(key);
 
-	return NULL;
+	return proxy;
 }
 
 static gboolean check_default_ctrl(void)
@@ -1048,13 +1112,127 @@ static void cmd_select(int argc, char *argv[])
 	return bt_shell_noninteractive_quit(EXIT_SUCCESS);
 }
 
+static int16_t get_device_rssi(GDBusProxy *proxy)
+{
+	DBusMessageIter iter;
+	dbus_int16_t rssi;
+
+	if (g_dbus_proxy_get_property(proxy, "RSSI", &iter) == FALSE)
+		return INT16_MIN;
+
+	dbus_message_iter_get_basic(&iter, &rssi);
+
+	return rssi;
+}
+
+static const char *get_device_string(GDBusProxy *proxy, const char *name)
+{
+	DBusMessageIter iter;
+	const char *str;
+
+	if (g_dbus_proxy_get_property(proxy, name, &iter) == FALSE)
+		return "";
+
+	dbus_message_iter_get_basic(&iter, &str);
+
+	return str;
+}
+
+static gint device_cmp_rssi(gconstpointer a, gconstpointer b)
+{
+	GDBusProxy *proxy_a = *(GDBusProxy **) a;
+	GDBusProxy *proxy_b = *(GDBusProxy **) b;
+
+	return get_device_rssi(proxy_b) - get_device_rssi(proxy_a);
+}
+
+static gint device_cmp_name(gconstpointer a, gconstpointer b)
+{
+	GDBusProxy *proxy_a = *(GDBusProxy **) a;
+	GDBusProxy *proxy_b = *(GDBusProxy **) b;
+
+	return g_utf8_collate(get_device_string(proxy_a, "Alias"),
+				get_device_string(proxy_b, "Alias"));
+}
+
+static gint device_cmp_address(gconstpointer a, gconstpointer b)
+{
+	GDBusProxy *proxy_a = *(GDBusProxy **) a;
+	GDBusProxy *proxy_b = *(GDBusProxy **) b;
+
+	return strcasecmp(get_device_string(proxy_a, "Address"),
+				get_device_string(proxy_b, "Address"));
+}
+
+static void print_device_table(GCompareFunc cmp)
+{
+	GPtrArray *array;
+	GList *ll;
+	unsigned int i;
+
+	array = g_ptr_array_sized_new(g_list_length(default_ctrl->devices));
+
+	for (ll = g_list_first(default_ctrl->devices); ll;
+						ll = g_list_next(ll))
+		g_ptr_array_add(array, ll->data);
+
+	g_ptr_array_sort(array, cmp);
+
+	bt_shell_printf("%-17s %5s %s\n", "Address", "RSSI", "Name");
+
+	for (i = 0; i < array->len; i++) {
+		GDBusProxy *proxy = g_ptr_array_index(array, i);
+		int16_t rssi = get_device_rssi(proxy);
+
+		if (rssi == INT16_MIN)
+			bt_shell_printf("%-17s %5s %s\n",
+				get_device_string(proxy, "Address"), "-",
+				get_device_string(proxy, "Alias"));
+		else
+			bt_shell_printf("%-17s %5d %s\n",
+				get_device_string(proxy, "Address"), rssi,
+				get_device_string(proxy, "Alias"));
+	}
+
+	g_ptr_array_free(array, TRUE);
+}
+
 static void cmd_devices(int argc, char *argv[])
 {
+	GCompareFunc cmp = NULL;
+	bool count = false;
 	GList *ll;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--count"))
+			count = true;
+		else if (!strcmp(argv[i], "--sort=rssi"))
+			cmp = device_cmp_rssi;
+		else if (!strcmp(argv[i], "--sort=name"))
+			cmp = device_cmp_name;
+		else if (!strcmp(argv[i], "--sort=address"))
+			cmp = device_cmp_address;
+		else {
+			bt_shell_printf("Invalid argument %s\n", argv[i]);
+			return bt_shell_noninteractive_quit(EXIT_FAILURE);
+		}
+	}
 
 	if (check_default_ctrl() == FALSE)
 		return bt_shell_noninteractive_quit(EXIT_SUCCESS);
 
+	if (count) {
+		bt_shell_printf("%u devices\n",
+				g_list_length(default_ctrl->devices));
+		return bt_shell_noninteractive_quit(EXIT_SUCCESS);
+	}
+
+	if (cmp) {
+		print_device_table(cmp);
+		return bt_shell_noninteractive_quit(EXIT_SUCCESS);
+	}
+
 	for (ll = g_list_first(default_ctrl->devices);
 			ll; ll = g_list_next(ll)) {
 		GDBusProxy *proxy = ll->data;
@@ -1458,6 +1636,102 @@ static void cmd_scan(int argc, char *argv[])
 	}
 }
 
+static gboolean scan_display_refresh(gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (!scan_display.added && !scan_display.removed &&
+				!g_hash_table_size(scan_display.changed))
+		return TRUE;
+
+	g_hash_table_iter_init(&iter, scan_display.changed);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		GDBusProxy *proxy = key;
+		int16_t rssi = get_device_rssi(proxy);
+
+		if (rssi == INT16_MIN)
+			continue;
+
+		bt_shell_printf("[" COLORED_CHG "] Device %s RSSI: %d %s\n",
+				get_device_string(proxy, "Address"), rssi,
+				get_device_string(proxy, "Alias"));
+	}
+
+	bt_shell_printf("Devices: %u (%u new, %u removed, %u changed)\n",
+			default_ctrl ? g_list_length(default_ctrl->devices) : 0,
+			scan_display.added, scan_display.removed,
+			g_hash_table_size(scan_display.changed));
+
+	scan_display.added = 0;
+	scan_display.removed = 0;
+	g_hash_table_remove_all(scan_display.changed);
+
+	return TRUE;
+}
+
+static void scan_display_set(bool summary, unsigned int interval)
+{
+	if (scan_display.timer) {
+		g_source_remove(scan_display.timer);
+		scan_display.timer = 0;
+	}
+
+	scan_display.summary = summary;
+	scan_display.interval = interval;
+	scan_display.added = 0;
+	scan_display.removed = 0;
+
+	if (!summary) {
+		if (scan_display.changed) {
+			g_hash_table_destroy(scan_display.changed);
+			scan_display.changed = NULL;
+		}
+		return;
+	}
+
+	if (!scan_display.changed)
+		scan_display.changed = g_hash_table_new(NULL, NULL);
+
+	scan_display.timer = g_timeout_add_seconds(interval,
+						scan_display_refresh, NULL);
+}
+
+static void cmd_scan_display(int argc, char *argv[])
+{
+	unsigned int interval = scan_display.interval;
+
+	if (argc < 2 || !strlen(argv[1])) {
+		bt_shell_printf("Display: %s", scan_display.summary ?
+						"summary" : "all");
+		if (scan_display.summary)
+			bt_shell_printf(" every %u s", scan_display.interval);
+		bt_shell_printf("\n");
+		return bt_shell_noninteractive_quit(EXIT_SUCCESS);
+	}
+
+	if (argc > 2) {
+		char *endptr = NULL;
+
+		interval = strtol(argv[2], &endptr, 0);
+		if (!endptr || *endptr != '\0' || !interval) {
+			bt_shell_printf("Invalid interval %s\n", argv[2]);
+			return bt_shell_noninteractive_quit(EXIT_FAILURE);
+		}
+	}
+
+	if (!strcmp(argv[1], "all"))
+		scan_display_set(false, interval);
+	else if (!strcmp(argv[1], "summary"))
+		scan_display_set(true, interval);
+	else {
+		bt_shell_printf("Invalid argument %s\n", argv[1]);
+		return bt_shell_noninteractive_quit(EXIT_FAILURE);
+	}
+
+	return bt_shell_noninteractive_quit(EXIT_SUCCESS);
+}
+
 static void cmd_scan_filter_uuids(int argc, char *argv[])
 {
 	if (argc < 2 || !strlen(argv[1])) {
@@ -1739,7 +2013,7 @@ static struct GDBusProxy *find_device(int argc, char *argv[])
 	if (check_default_ctrl() == FALSE)
 		return NULL;
 
-	proxy = find_proxy_by_address(default_ctrl->devices, argv[1]);
+	proxy = find_proxy_by_address(default_ctrl, argv[1]);
 	if (!proxy) {
 		bt_shell_printf("Device %s not available\n", argv[1]);
 		return NULL;
@@ -2044,7 +2318,7 @@ static void cmd_remove(int argc, char *argv[])
 		return;
 	}
 
-	proxy = find_proxy_by_address(default_ctrl->devices, argv[1]);
+	proxy = find_proxy_by_address(default_ctrl, argv[1]);
 	if (!proxy) {
 		bt_shell_printf("Device %s not available\n", argv[1]);
 		return bt_shell_noninteractive_quit(EXIT_FAILURE);
@@ -2080,7 +2354,7 @@ static void cmd_connect(int argc, char *argv[])
 	if (check_default_ctrl() == FALSE)
 		return bt_shell_noninteractive_quit(EXIT_FAILURE);
 
-	proxy = find_proxy_by_address(default_ctrl->devices, argv[1]);
+	proxy = find_proxy_by_address(default_ctrl, argv[1]);
 	if (!proxy) {
 		bt_shell_printf("Device %s not available\n", argv[1]);
 		return bt_shell_noninteractive_quit(EXIT_FAILURE);
@@ -3034,6 +3308,8 @@ static const struct bt_shell_menu scan_menu = {
 	{ "pattern", "[value]", cmd_scan_filter_pattern,
 				"Set/Get pattern filter",
 				NULL },
+	{ "display", "[all/summary] [interval]", cmd_scan_display,
+				"Set/Get how discovered devices are printed" },
 	{ "clear",
 	"[uuids/rssi/pathloss/transport/duplicate-data/discoverable/pattern]",
 				cmd_scan_filter_clear,
@@ -3113,7 +3389,8 @@ static const struct bt_shell_menu main_menu = {
 							ctrl_generator },
 	{ "select",       "<ctrl>",   cmd_select, "Select default controller",
 							ctrl_generator },
-	{ "devices",      NULL,       cmd_devices, "List available devices" },
+	{ "devices", "[--count] [--sort=rssi/name/address]", cmd_devices,
+					"List available devices" },
 	{ "paired-devices", NULL,     cmd_paired_devices,
 					"List paired devices"},
 	{ "system-alias", "<name>",   cmd_system_alias,
@@ -3226,6 +3503,7 @@ int main(int argc, char *argv[])
 
 	g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed,
 							property_changed, NULL);
+	g_dbus_client_set_interface_filter(client, interfaces);
 
 	g_dbus_client_set_ready_watch(client, client_ready, NULL);
 
@@ -1002,6 +1002,13 @@ static void item_added(GDBusProxy *proxy)
 	print_item(proxy, COLORED_NEW);
 }
 
+static const char * const interfaces[] = {
+	BLUEZ_MEDIA_PLAYER_INTERFACE,
+	BLUEZ_MEDIA_FOLDER_INTERFACE,
+	BLUEZ_MEDIA_ITEM_INTERFACE,
+	NULL
+};
+
 static void proxy_added(GDBusProxy *proxy, void *user_data)
 {
 	const char *interface;
@@ -1113,6 +1120,7 @@ void player_add_submenu(void)
 
 	g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed,
 							property_changed, NULL);
+	g_dbus_client_set_interface_filter(client, interfaces);
 }
 
 void player_remove_submenu(void)
@@ -100,6 +100,18 @@ struct le_ext_adv {
 	unsigned int id;
 };
 
+#define CMD_OGF(_opcode)	((_opcode) >> 10)
+#define CMD_OCF(_opcode)	((_opcode) & 0x03ff)
+#define CMD_OGF_MAX		64
+
+struct btdev_cmd;
+
+/* Commands of one OGF indexed by OCF */
+struct btdev_cmd_table {
+	const struct btdev_cmd **cmds;
+	uint16_t len;
+};
+
 struct btdev {
 	enum btdev_type type;
 	uint16_t id;
@@ -145,6 +157,7 @@ struct btdev {
 	uint8_t  le_features[8];
 	uint8_t  le_states[8];
 	const struct btdev_cmd *cmds;
+	struct btdev_cmd_table cmd_table[CMD_OGF_MAX];
 	uint16_t msft_opcode;
 	const struct btdev_cmd *msft_cmds;
 	uint16_t emu_opcode;
@@ -243,7 +256,7 @@ struct inquiry_data {
 
 #define DEFAULT_INQUIRY_INTERVAL 100 /* 100 miliseconds */
 
-#define MAX_BTDEV_ENTRIES 16
+#define MAX_BTDEV_ENTRIES 1024
 
 static const uint8_t LINK_KEY_NONE[16] = { 0 };
 static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
@@ -251,6 +264,21 @@ static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
 
 static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
 
+#define ADV_SCHED_INTERVAL 10 /* 10 miliseconds */
+
+/*
+ * Advertising reports are only sent when scanning or advertising gets
+ * enabled, unless a report rate is set. The scheduler then sends the
+ * reports of the advertising devices in turn, each device at most once
+ * per interval.
+ */
+static struct {
+	unsigned int rate;		/* reports per second */
+	unsigned int credit;
+	unsigned int id;
+	int next;
+} adv_sched;
+
 static int get_hook_index(struct btdev *btdev, enum btdev_hook_type type,
 								uint16_t opcode)
 {
@@ -3401,6 +3429,65 @@ static void le_set_adv_enable_complete(struct btdev *btdev)
 	}
 }
 
+static void le_set_ext_adv_enable_complete(struct btdev *btdev,
+						struct le_ext_adv *ext_adv);
+
+static void adv_sched_report(void *data, void *user_data)
+{
+	struct le_ext_adv *ext_adv = data;
+
+	if (ext_adv->enable)
+		le_set_ext_adv_enable_complete(ext_adv->dev, ext_adv);
+}
+
+static bool adv_sched_timeout(void *user_data)
+{
+	unsigned int count;
+	int i;
+
+	adv_sched.credit += adv_sched.rate * ADV_SCHED_INTERVAL;
+	count = adv_sched.credit / 1000;
+	adv_sched.credit %= 1000;
+
+	for (i = 0; count && i < MAX_BTDEV_ENTRIES; i++) {
+		struct btdev *btdev = btdev_list[adv_sched.next];
+
+		adv_sched.next = (adv_sched.next + 1) % MAX_BTDEV_ENTRIES;
+
+		if (!btdev || !btdev->le_adv_enable)
+			continue;
+
+		if (queue_isempty(btdev->le_ext_adv))
+			le_set_adv_enable_complete(btdev);
+		else
+			queue_foreach(btdev->le_ext_adv, adv_sched_report,
+									NULL);
+
+		count--;
+	}
+
+	return true;
+}
+
+bool btdev_set_adv_report_rate(unsigned int rate)
+{
+	if (adv_sched.id) {
+		timeout_remove(adv_sched.id);
+		adv_sched.id = 0;
+	}
+
+	adv_sched.rate = rate;
+	adv_sched.credit = 0;
+
+	if (!rate)
+		return true;
+
+	adv_sched.id = timeout_add(ADV_SCHED_INTERVAL, adv_sched_timeout,
+								NULL, NULL);
+
+	return adv_sched.id != 0;
+}
+
 #define RL_ADDR_EQUAL(_rl, _type, _addr) \
 	(_rl->type == _type && !bacmp(&_rl->addr, (bdaddr_t *)_addr))
 
@@ -6706,6 +6793,58 @@ static void set_amp_features(struct btdev *btdev)
 {
 }
 
+static void free_cmd_table(struct btdev *btdev)
+{
+	int i;
+
+	for (i = 0; i < CMD_OGF_MAX; i++) {
+		free(btdev->cmd_table[i].cmds);
+		btdev->cmd_table[i].cmds = NULL;
+		btdev->cmd_table[i].len = 0;
+	}
+}
+
+/*
+ * Index the commands of the controller by opcode, so they don't need to
+ * be looked up in the command list on every command. The list may have
+ * duplicates in which case the first entry is used.
+ */
+static bool build_cmd_table(struct btdev *btdev)
+{
+	const struct btdev_cmd *cmd;
+	struct btdev_cmd_table *table;
+	int i;
+
+	for (cmd = btdev->cmds; cmd && cmd->func; cmd++) {
+		table = &btdev->cmd_table[CMD_OGF(cmd->opcode)];
+
+		if (CMD_OCF(cmd->opcode) >= table->len)
+			table->len = CMD_OCF(cmd->opcode) + 1;
+	}
+
+	for (i = 0; i < CMD_OGF_MAX; i++) {
+		table = &btdev->cmd_table[i];
+
+		if (!table->len)
+			continue;
+
+		table->cmds = calloc(table->len, sizeof(*table->cmds));
+		if (!table->cmds) {
+			free_cmd_table(btdev);
+			return false;
+		}
+	}
+
+	for (cmd = btdev->cmds; cmd && cmd->func; cmd++) {
+		table = &btdev->cmd_table[CMD_OGF(cmd->opcode)];
+
+		if (!table->cmds[CMD_OCF(cmd->opcode)])
+			table->cmds[CMD_OCF(cmd->opcode)] = cmd;
+	}
+
+	return true;
+}
+
 struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 {
 	struct btdev *btdev;
@@ -6780,8 +6919,15 @@ struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 
 	btdev->country_code = 0x00;
 
+	if (!build_cmd_table(btdev)) {
+		bt_crypto_unref(btdev->crypto);
+		free(btdev);
+		return NULL;
+	}
+
 	index = add_btdev(btdev);
 	if (index < 0) {
+		free_cmd_table(btdev);
 		bt_crypto_unref(btdev->crypto);
 		free(btdev);
 		return NULL;
@@ -6811,6 +6957,7 @@ void btdev_destroy(struct btdev *btdev)
 	queue_destroy(btdev->conns, conn_remove);
 	queue_destroy(btdev->le_ext_adv, le_ext_adv_free);
 
+	free_cmd_table(btdev);
 	free(btdev);
 }
 
@@ -6956,6 +7103,17 @@ static const struct btdev_cmd *vnd_cmd(struct btdev *btdev, uint8_t op,
 	return NULL;
 }
 
+static const struct btdev_cmd *find_cmd(struct btdev *btdev, uint16_t opcode)
+{
+	const struct btdev_cmd_table *table;
+
+	table = &btdev->cmd_table[CMD_OGF(opcode)];
+	if (CMD_OCF(opcode) >= table->len)
+		return NULL;
+
+	return table->cmds[CMD_OCF(opcode)];
+}
+
 static const struct btdev_cmd *default_cmd(struct btdev *btdev, uint16_t opcode,
 						const void *data, uint8_t len)
 {
@@ -6967,12 +7125,9 @@ static const struct btdev_cmd *default_cmd(struct btdev *btdev, uint16_t opcode,
 	if (btdev->msft_opcode == opcode)
 		return vnd_cmd(btdev, opcode, btdev->msft_cmds, data, len);
 
-	for (cmd = btdev->cmds; cmd->func; cmd++) {
-		if (cmd->opcode != opcode)
-			continue;
-
+	cmd = find_cmd(btdev, opcode);
+	if (cmd)
 		return run_cmd(btdev, cmd, data, len);
-	}
 
 	util_debug(btdev->debug_callback, btdev->debug_data,
 			"Unsupported command 0x%4.4x\n", opcode);
@@ -7222,6 +7377,19 @@ bool btdev_del_hook(struct btdev *btdev, enum btdev_hook_type type,
 	return false;
 }
 
+void btdev_clear_hooks(struct btdev *btdev)
+{
+	int i;
+
+	if (!btdev)
+		return;
+
+	for (i = 0; i < MAX_HOOK_ENTRIES; i++) {
+		free(btdev->hook_list[i]);
+		btdev->hook_list[i] = NULL;
+	}
+}
+
 static int cmd_msft_read_features(struct btdev *dev, const void *data,
 							uint8_t len)
 {
@@ -100,6 +100,10 @@ int btdev_add_hook(struct btdev *btdev, enum btdev_hook_type type,
 bool btdev_del_hook(struct btdev *btdev, enum btdev_hook_type type,
 							uint16_t opcode);
 
+void btdev_clear_hooks(struct btdev *btdev);
+
 int btdev_set_msft_opcode(struct btdev *btdev, uint16_t opcode);
 int btdev_set_aosp_capable(struct btdev *btdev, bool enable);
 int btdev_set_emu_opcode(struct btdev *btdev, uint16_t opcode);
+
+bool btdev_set_adv_report_rate(unsigned int rate);
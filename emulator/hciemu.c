@@ -744,3 +744,42 @@ bool hciemu_del_hook(struct hciemu *hciemu, enum hciemu_hook_type type,
 
 	return btdev_del_hook(dev, hook_type, opcode);
 }
+
+/*
+ * Bring a used emulator back to the state hciemu_new_num() left it in so
+ * it can be handed to the next test without recreating the vhci device.
+ * Hooks are dropped and the clients are recreated with the same ids, and
+ * thus the same addresses, while the central controller itself is reset
+ * by the kernel sending HCI_Reset on the next power on. Capabilities set
+ * with hciemu_set_central_* are kept.
+ */
+bool hciemu_reset(struct hciemu *hciemu)
+{
+	unsigned int num, i;
+
+	if (!hciemu || !hciemu->vhci)
+		return false;
+
+	queue_remove_all(hciemu->post_command_hooks,
+					NULL, NULL, destroy_command_hook);
+
+	btdev_clear_hooks(vhci_get_btdev(hciemu->vhci));
+
+	num = queue_length(hciemu->clients);
+
+	queue_remove_all(hciemu->clients, NULL, NULL, hciemu_client_destroy);
+
+	for (i = 0; i < num; i++) {
+		struct hciemu_client *client = hciemu_client_new(hciemu, i);
+
+		if (!client)
+			return false;
+
+		if (hciemu->debug_callback)
+			hciemu_client_set_debug(client, hciemu);
+
+		queue_push_tail(hciemu->clients, client);
+	}
+
+	return true;
+}
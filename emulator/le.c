@@ -521,12 +521,14 @@ static void adv_timeout_callback(int id, void *user_data)
 	struct bt_le *hci = user_data;
 	unsigned int msec, min_msec, max_msec;
 
+	bt_phy_batch_begin(hci->phy);
 	if (hci->le_adv_channel_map & 0x01)
 		send_adv_pkt(hci, 37);
 	if (hci->le_adv_channel_map & 0x02)
 		send_adv_pkt(hci, 38);
 	if (hci->le_adv_channel_map & 0x04)
 		send_adv_pkt(hci, 39);
+	bt_phy_batch_end(hci->phy);
 
 	min_msec = (hci->le_adv_min_interval * 625) / 1000;
 	max_msec = (hci->le_adv_max_interval * 625) / 1000;
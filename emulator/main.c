@@ -16,9 +16,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <getopt.h>
 #include <sys/uio.h>
 
+#include "monitor/bt.h"
 #include "src/shared/mainloop.h"
 #include "src/shared/util.h"
 
@@ -54,6 +56,8 @@ static void usage(void)
 		"\t-B                    Create BR/EDR only controller\n"
 		"\t-A                    Create AMP controller\n"
 		"\t-T[num]               Number of test AMP controllers\n"
+		"\t-P[num]               Number of advertising peripherals\n"
+		"\t-R rate               Advertising reports per second\n"
 		"\t-h, --help            Show help options\n");
 }
 
@@ -67,6 +71,8 @@ static const struct option main_options[] = {
 	{ "amp",     no_argument,       NULL, 'A' },
 	{ "letest",  optional_argument, NULL, 'U' },
 	{ "amptest", optional_argument, NULL, 'T' },
+	{ "peripherals", optional_argument, NULL, 'P' },
+	{ "adv-rate", required_argument, NULL, 'R' },
 	{ "version", no_argument,	NULL, 'v' },
 	{ "help",    no_argument,	NULL, 'h' },
 	{ }
@@ -79,6 +85,59 @@ static void vhci_debug(const char *str, void *user_data)
 	printf("vhci%u: %s\n", i, str);
 }
 
+static void send_cmd(struct btdev *btdev, uint16_t opcode, const void *data,
+								uint8_t len)
+{
+	uint8_t pkt[1 + sizeof(struct bt_hci_cmd_hdr) + UINT8_MAX];
+	struct bt_hci_cmd_hdr *hdr = (void *) (pkt + 1);
+
+	pkt[0] = BT_H4_CMD_PKT;
+	hdr->opcode = cpu_to_le16(opcode);
+	hdr->plen = len;
+	memcpy(pkt + 1 + sizeof(*hdr), data, len);
+
+	btdev_receive_h4(btdev, pkt, 1 + sizeof(*hdr) + len);
+}
+
+/*
+ * Peripherals have no transport to a host, they are only set up to
+ * advertise towards the scanning controllers of the emulator.
+ */
+static bool create_peripheral(int index)
+{
+	struct bt_hci_cmd_le_set_adv_data adv_data;
+	struct bt_hci_cmd_le_set_adv_enable adv_enable;
+	struct btdev *btdev;
+	int len;
+
+	btdev = btdev_create(BTDEV_TYPE_LE, 0x1000 + index);
+	if (!btdev)
+		return false;
+
+	memset(&adv_data, 0, sizeof(adv_data));
+
+	/* Flags: LE General Discoverable, BR/EDR Not Supported */
+	adv_data.data[0] = 0x02;
+	adv_data.data[1] = 0x01;
+	adv_data.data[2] = 0x06;
+
+	/* Complete Local Name */
+	len = snprintf((char *) adv_data.data + 5, sizeof(adv_data.data) - 5,
+						"Peripheral %d", index);
+	adv_data.data[3] = len + 1;
+	adv_data.data[4] = 0x09;
+	adv_data.len = 5 + len;
+
+	send_cmd(btdev, BT_HCI_CMD_LE_SET_ADV_DATA, &adv_data,
+							sizeof(adv_data));
+
+	adv_enable.enable = 0x01;
+	send_cmd(btdev, BT_HCI_CMD_LE_SET_ADV_ENABLE, &adv_enable,
+							sizeof(adv_enable));
+
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 	struct server *server1;
@@ -91,6 +150,8 @@ int main(int argc, char *argv[])
 	bool serial_enabled = false;
 	int letest_count = 0;
 	int amptest_count = 0;
+	int peripheral_count = 0;
+	int adv_rate = 0;
 	int vhci_count = 0;
 	enum btdev_type type = BTDEV_TYPE_BREDRLE52;
 	int i;
@@ -100,7 +161,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "dSsl::LBAU::T::vh",
+		opt = getopt_long(argc, argv, "dSsl::LBAU::T::P::R:vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -142,6 +203,15 @@ int main(int argc, char *argv[])
 			else
 				amptest_count = 1;
 			break;
+		case 'P':
+			if (optarg)
+				peripheral_count = atoi(optarg);
+			else
+				peripheral_count = 1;
+			break;
+		case 'R':
+			adv_rate = atoi(optarg);
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -181,6 +251,18 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	for (i = 0; i < peripheral_count; i++) {
+		if (!create_peripheral(i)) {
+			fprintf(stderr, "Failed to create peripheral %d\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (adv_rate > 0 && !btdev_set_adv_report_rate(adv_rate)) {
+		fprintf(stderr, "Failed to set advertising report rate\n");
+		return EXIT_FAILURE;
+	}
+
 	for (i = 0; i < vhci_count; i++) {
 		struct vhci *vhci;
 
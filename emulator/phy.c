@@ -30,6 +30,25 @@
 
 #define BT_PHY_PORT 45023
 
+#define BT_PHY_FLAG_TIMESTAMP	0x00000001
+
+#define PHY_BATCH_MAX	16
+#define PHY_DATA_MAX	4096
+
+struct bt_phy_hdr {
+	uint64_t id;
+	uint32_t flags;
+	uint16_t type;
+	uint16_t len;
+} __attribute__ ((packed));
+
+/* Frames carry the time of transmission after the header */
+struct bt_phy_frame {
+	struct bt_phy_hdr hdr;
+	uint64_t timestamp;
+	uint8_t data[PHY_DATA_MAX];
+} __attribute__ ((packed));
+
 struct bt_phy {
 	volatile int ref_count;
 	int rx_fd;
@@ -37,15 +56,13 @@ struct bt_phy {
 	uint64_t id;
 	bt_phy_callback_func_t callback;
 	void *user_data;
+	uint64_t rx_timestamp;
+	struct bt_phy_frame rx[PHY_BATCH_MAX];
+	struct bt_phy_frame tx[PHY_BATCH_MAX];
+	unsigned int tx_count;
+	unsigned int batch;
 };
 
-struct bt_phy_hdr {
-	uint64_t id;
-	uint32_t flags;
-	uint16_t type;
-	uint16_t len;
-} __attribute__ ((packed));
-
 static bool get_random_bytes(void *buf, size_t num_bytes)
 {
 	ssize_t len;
@@ -65,45 +82,79 @@ static bool get_random_bytes(void *buf, size_t num_bytes)
 	return true;
 }
 
+static uint64_t get_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void phy_rx_frame(struct bt_phy *phy, struct bt_phy_frame *frame,
+								size_t len)
+{
+	const uint8_t *data;
+
+	if (len < sizeof(frame->hdr))
+		return;
+
+	if (le64_to_cpu(frame->hdr.id) == phy->id)
+		return;
+
+	len -= sizeof(frame->hdr);
+
+	if (le32_to_cpu(frame->hdr.flags) & BT_PHY_FLAG_TIMESTAMP) {
+		if (len < sizeof(frame->timestamp))
+			return;
+
+		len -= sizeof(frame->timestamp);
+		phy->rx_timestamp = le64_to_cpu(frame->timestamp);
+		data = frame->data;
+	} else {
+		phy->rx_timestamp = 0;
+		data = (const uint8_t *) &frame->timestamp;
+	}
+
+	if (len != le16_to_cpu(frame->hdr.len))
+		return;
+
+	if (phy->callback)
+		phy->callback(le16_to_cpu(frame->hdr.type), data, len,
+							phy->user_data);
+}
+
 static void phy_rx_callback(int fd, uint32_t events, void *user_data)
 {
 	struct bt_phy *phy = user_data;
-	struct msghdr msg;
-	struct iovec iov[2];
-	struct bt_phy_hdr hdr;
-	unsigned char buf[4096];
-	ssize_t len;
+	struct mmsghdr msgs[PHY_BATCH_MAX];
+	struct iovec iov[PHY_BATCH_MAX];
+	int i, count;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		mainloop_remove_fd(fd);
 		return;
 	}
 
-	iov[0].iov_base = &hdr;
-	iov[0].iov_len = sizeof(hdr);
-	iov[1].iov_base = buf;
-	iov[1].iov_len = sizeof(buf);
+	memset(msgs, 0, sizeof(msgs));
 
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 2;
-
-	len = recvmsg(phy->rx_fd, &msg, MSG_DONTWAIT);
-	if (len < 0)
-		return;
+	for (i = 0; i < PHY_BATCH_MAX; i++) {
+		iov[i].iov_base = &phy->rx[i];
+		iov[i].iov_len = sizeof(phy->rx[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
-	if ((size_t) len < sizeof(hdr))
+	count = recvmmsg(phy->rx_fd, msgs, PHY_BATCH_MAX, MSG_DONTWAIT, NULL);
+	if (count < 0)
 		return;
 
-	if (le64_to_cpu(hdr.id) == phy->id)
-		return;
+	bt_phy_ref(phy);
 
-	if (len - sizeof(hdr) != le16_to_cpu(hdr.len))
-		return;
+	for (i = 0; i < count; i++)
+		phy_rx_frame(phy, &phy->rx[i], msgs[i].msg_len);
 
-	if (phy->callback)
-		phy->callback(le16_to_cpu(hdr.type),
-				buf, len - sizeof(hdr), phy->user_data);
+	bt_phy_unref(phy);
 }
 
 static int create_rx_socket(void)
@@ -149,6 +200,48 @@ static int create_tx_socket(void)
 	return fd;
 }
 
+static bool phy_flush(struct bt_phy *phy)
+{
+	struct sockaddr_in addr;
+	struct mmsghdr msgs[PHY_BATCH_MAX];
+	struct iovec iov[PHY_BATCH_MAX];
+	unsigned int i, sent = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BT_PHY_PORT);
+	addr.sin_addr.s_addr = INADDR_BROADCAST;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < phy->tx_count; i++) {
+		struct bt_phy_frame *frame = &phy->tx[i];
+
+		iov[i].iov_base = frame;
+		iov[i].iov_len = sizeof(frame->hdr) + sizeof(frame->timestamp) +
+						le16_to_cpu(frame->hdr.len);
+		msgs[i].msg_hdr.msg_name = &addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < phy->tx_count) {
+		int count;
+
+		count = sendmmsg(phy->tx_fd, msgs + sent, phy->tx_count - sent,
+								MSG_DONTWAIT);
+		if (count <= 0)
+			break;
+
+		sent += count;
+	}
+
+	phy->tx_count = 0;
+
+	return sent > 0;
+}
+
 struct bt_phy *bt_phy_new(void)
 {
 	struct bt_phy *phy;
@@ -205,6 +298,9 @@ void bt_phy_unref(struct bt_phy *phy)
 	if (__sync_sub_and_fetch(&phy->ref_count, 1))
 		return;
 
+	if (phy->tx_count)
+		phy_flush(phy);
+
 	mainloop_remove_fd(phy->rx_fd);
 
 	close(phy->tx_fd);
@@ -224,66 +320,76 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 					const void *data2, size_t size2,
 					const void *data3, size_t size3)
 {
-	struct bt_phy_hdr hdr;
-	struct sockaddr_in addr;
-	struct msghdr msg;
-	struct iovec iov[4];
-	ssize_t len;
+	struct bt_phy_frame *frame;
+	size_t len = 0;
 
 	if (!phy)
 		return false;
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(BT_PHY_PORT);
-	addr.sin_addr.s_addr = INADDR_BROADCAST;
-
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_name = &addr;
-	msg.msg_namelen = sizeof(addr);
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 0;
+	if (size1 + size2 + size3 > PHY_DATA_MAX)
+		return false;
 
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.id = cpu_to_le64(phy->id);
-	hdr.flags = cpu_to_le32(0);
-	hdr.type = cpu_to_le16(type);
-	hdr.len = cpu_to_le16(size1 + size2 + size3);
+	frame = &phy->tx[phy->tx_count];
 
-	iov[msg.msg_iovlen].iov_base = &hdr;
-	iov[msg.msg_iovlen].iov_len = sizeof(hdr);
-	msg.msg_iovlen++;
+	frame->hdr.id = cpu_to_le64(phy->id);
+	frame->hdr.flags = cpu_to_le32(BT_PHY_FLAG_TIMESTAMP);
+	frame->hdr.type = cpu_to_le16(type);
+	frame->timestamp = cpu_to_le64(get_timestamp());
 
 	if (data1 && size1 > 0) {
-		iov[msg.msg_iovlen].iov_base = (void *) data1;
-		iov[msg.msg_iovlen].iov_len = size1;
-		msg.msg_iovlen++;
+		memcpy(frame->data + len, data1, size1);
+		len += size1;
 	}
 
 	if (data2 && size2 > 0) {
-		iov[msg.msg_iovlen].iov_base = (void *) data2;
-		iov[msg.msg_iovlen].iov_len = size2;
-		msg.msg_iovlen++;
+		memcpy(frame->data + len, data2, size2);
+		len += size2;
 	}
 
 	if (data3 && size3 > 0) {
-		iov[msg.msg_iovlen].iov_base = (void *) data3;
-		iov[msg.msg_iovlen].iov_len = size3;
-		msg.msg_iovlen++;
+		memcpy(frame->data + len, data3, size3);
+		len += size3;
 	}
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(BT_PHY_PORT);
-	addr.sin_addr.s_addr = INADDR_BROADCAST;
+	frame->hdr.len = cpu_to_le16(len);
 
-	len = sendmsg(phy->tx_fd, &msg, MSG_DONTWAIT);
-	if (len < 0)
+	phy->tx_count++;
+
+	if (phy->batch && phy->tx_count < PHY_BATCH_MAX)
+		return true;
+
+	return phy_flush(phy);
+}
+
+bool bt_phy_batch_begin(struct bt_phy *phy)
+{
+	if (!phy)
 		return false;
 
+	phy->batch++;
+
 	return true;
 }
 
+bool bt_phy_batch_end(struct bt_phy *phy)
+{
+	if (!phy || !phy->batch)
+		return false;
+
+	if (--phy->batch || !phy->tx_count)
+		return true;
+
+	return phy_flush(phy);
+}
+
+uint64_t bt_phy_get_timestamp(struct bt_phy *phy)
+{
+	if (!phy)
+		return 0;
+
+	return phy->rx_timestamp;
+}
+
 bool bt_phy_register(struct bt_phy *phy, bt_phy_callback_func_t callback,
 							void *user_data)
 {
@@ -26,12 +26,17 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 					const void *data2, size_t size2,
 					const void *data3, size_t size3);
 
+bool bt_phy_batch_begin(struct bt_phy *phy);
+bool bt_phy_batch_end(struct bt_phy *phy);
+
 typedef void (*bt_phy_callback_func_t)(uint16_t type, const void *data,
 						size_t size, void *user_data);
 
 bool bt_phy_register(struct bt_phy *phy, bt_phy_callback_func_t callback,
 							void *user_data);
 
+uint64_t bt_phy_get_timestamp(struct bt_phy *phy);
+
 #define BT_PHY_PKT_NULL		0x0000
 
 #define BT_PHY_PKT_ADV		0x0001
@@ -35,6 +35,7 @@ struct GDBusClient {
 	guint watch;
 	guint added_watch;
 	guint removed_watch;
+	guint props_watch;
 	GPtrArray *match_rules;
 	DBusPendingCall *pending_call;
 	DBusPendingCall *get_objects_call;
@@ -52,6 +53,8 @@ struct GDBusClient {
 	GDBusPropertyFunction property_changed;
 	void *user_data;
 	GList *proxy_list;
+	GHashTable *proxies;
+	char **filter;
 };
 
 struct GDBusProxy {
@@ -60,7 +63,8 @@ struct GDBusProxy {
 	char *obj_path;
 	char *interface;
 	GHashTable *prop_list;
-	guint watch;
+	DBusMessage *props_msg;
+	DBusMessageIter props_iter;
 	GDBusPropertyFunction prop_func;
 	void *prop_data;
 	GDBusProxyFunction removed_func;
@@ -75,6 +79,33 @@ struct prop_entry {
 	DBusMessage *msg;
 };
 
+static guint proxy_hash(gconstpointer key)
+{
+	const GDBusProxy *proxy = key;
+
+	return g_str_hash(proxy->obj_path) ^ g_str_hash(proxy->interface);
+}
+
+static gboolean proxy_equal(gconstpointer a, gconstpointer b)
+{
+	const GDBusProxy *proxy1 = a;
+	const GDBusProxy *proxy2 = b;
+
+	return g_str_equal(proxy1->obj_path, proxy2->obj_path) &&
+			g_str_equal(proxy1->interface, proxy2->interface);
+}
+
+static GDBusProxy *proxy_find(GDBusClient *client, const char *path,
+						const char *interface)
+{
+	GDBusProxy key;
+
+	key.obj_path = (char *) path;
+	key.interface = (char *) interface;
+
+	return g_hash_table_lookup(client->proxies, &key);
+}
+
 static void modify_match_reply(DBusPendingCall *call, void *user_data)
 {
 	DBusMessage *reply = dbus_pending_call_steal_reply(call);
@@ -298,31 +329,86 @@ static void prop_entry_free(gpointer data)
 	g_free(prop);
 }
 
+static gboolean store_property(GDBusProxy *proxy, const char *name,
+							DBusMessageIter *value)
+{
+	struct prop_entry *prop;
+
+	prop = g_hash_table_lookup(proxy->prop_list, name);
+	if (prop != NULL) {
+		prop_entry_update(prop, value);
+		return TRUE;
+	}
+
+	prop = prop_entry_new(name, value);
+	if (prop == NULL)
+		return FALSE;
+
+	g_hash_table_replace(proxy->prop_list, prop->name, prop);
+
+	return TRUE;
+}
+
+static gboolean next_property(DBusMessageIter *dict, const char **name,
+							DBusMessageIter *value)
+{
+	DBusMessageIter entry;
+
+	if (dbus_message_iter_get_arg_type(dict) != DBUS_TYPE_DICT_ENTRY)
+		return FALSE;
+
+	dbus_message_iter_recurse(dict, &entry);
+	dbus_message_iter_next(dict);
+
+	if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING)
+		return FALSE;
+
+	dbus_message_iter_get_basic(&entry, name);
+	dbus_message_iter_next(&entry);
+
+	if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT)
+		return FALSE;
+
+	dbus_message_iter_recurse(&entry, value);
+
+	return TRUE;
+}
+
+static void load_properties(GDBusProxy *proxy)
+{
+	DBusMessage *msg = proxy->props_msg;
+	DBusMessageIter dict, value;
+	const char *name;
+
+	if (msg == NULL)
+		return;
+
+	proxy->props_msg = NULL;
+
+	dbus_message_iter_recurse(&proxy->props_iter, &dict);
+
+	while (next_property(&dict, &name, &value))
+		store_property(proxy, name, &value);
+
+	dbus_message_unref(msg);
+}
+
 static void add_property(GDBusProxy *proxy, const char *name,
 				DBusMessageIter *iter, gboolean send_changed)
 {
 	GDBusClient *client = proxy->client;
 	DBusMessageIter value;
-	struct prop_entry *prop;
 
 	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_VARIANT)
 		return;
 
 	dbus_message_iter_recurse(iter, &value);
 
-	prop = g_hash_table_lookup(proxy->prop_list, name);
-	if (prop != NULL) {
-		prop_entry_update(prop, &value);
-		goto done;
-	}
+	load_properties(proxy);
 
-	prop = prop_entry_new(name, &value);
-	if (prop == NULL)
+	if (!store_property(proxy, name, &value))
 		return;
 
-	g_hash_table_replace(proxy->prop_list, prop->name, prop);
-
-done:
 	if (proxy->prop_func)
 		proxy->prop_func(proxy, name, &value, proxy->prop_data);
 
@@ -362,6 +448,30 @@ static void update_properties(GDBusProxy *proxy, DBusMessageIter *iter,
 	}
 }
 
+/*
+ * Objects usually come in bulk with GetManagedObjects and most of their
+ * properties are never looked at, so proxies without a property watch
+ * keep a reference to the message and only copy the properties into
+ * prop_list once they change or are refreshed.
+ */
+static void set_properties(GDBusProxy *proxy, DBusMessage *msg,
+							DBusMessageIter *iter)
+{
+	int type = dbus_message_iter_get_arg_type(iter);
+
+	if (proxy->prop_func || g_hash_table_size(proxy->prop_list) ||
+						type != DBUS_TYPE_ARRAY) {
+		update_properties(proxy, iter, FALSE);
+		return;
+	}
+
+	if (proxy->props_msg != NULL)
+		dbus_message_unref(proxy->props_msg);
+
+	proxy->props_msg = dbus_message_ref(msg);
+	proxy->props_iter = *iter;
+}
+
 static void proxy_added(GDBusClient *client, GDBusProxy *proxy)
 {
 	if (!proxy->pending)
@@ -392,7 +502,7 @@ static void get_all_properties_reply(DBusPendingCall *call, void *user_data)
 
 	dbus_message_iter_init(reply, &iter);
 
-	update_properties(proxy, &iter, FALSE);
+	set_properties(proxy, reply, &iter);
 
 done:
 	proxy_added(client, proxy);
@@ -480,8 +590,8 @@ char *g_dbus_proxy_path_lookup(GList *list, int *index, const char *path)
 static gboolean properties_changed(DBusConnection *conn, DBusMessage *msg,
 							void *user_data)
 {
-	GDBusProxy *proxy = user_data;
-	GDBusClient *client = proxy->client;
+	GDBusClient *client = user_data;
+	GDBusProxy *proxy;
 	DBusMessageIter iter, entry;
 	const char *interface;
 
@@ -494,6 +604,12 @@ static gboolean properties_changed(DBusConnection *conn, DBusMessage *msg,
 	dbus_message_iter_get_basic(&iter, &interface);
 	dbus_message_iter_next(&iter);
 
+	proxy = proxy_find(client, dbus_message_get_path(msg), interface);
+	if (proxy == NULL)
+		return TRUE;
+
+	load_properties(proxy);
+
 	update_properties(proxy, &iter, TRUE);
 
 	dbus_message_iter_next(&iter);
@@ -538,15 +654,10 @@ static GDBusProxy *proxy_new(GDBusClient *client, const char *path,
 
 	proxy->prop_list = g_hash_table_new_full(g_str_hash, g_str_equal,
 							NULL, prop_entry_free);
-	proxy->watch = g_dbus_add_properties_watch(client->dbus_conn,
-							client->service_name,
-							proxy->obj_path,
-							proxy->interface,
-							properties_changed,
-							proxy, NULL);
 	proxy->pending = TRUE;
 
 	client->proxy_list = g_list_append(client->proxy_list, proxy);
+	g_hash_table_add(client->proxies, proxy);
 
 	return g_dbus_proxy_ref(proxy);
 }
@@ -567,7 +678,12 @@ static void proxy_free(gpointer data)
 		if (client->proxy_removed)
 			client->proxy_removed(proxy, client->user_data);
 
-		g_dbus_remove_watch(client->dbus_conn, proxy->watch);
+		g_hash_table_remove(client->proxies, proxy);
+
+		if (proxy->props_msg != NULL) {
+			dbus_message_unref(proxy->props_msg);
+			proxy->props_msg = NULL;
+		}
 
 		g_hash_table_remove_all(proxy->prop_list);
 
@@ -583,20 +699,14 @@ static void proxy_free(gpointer data)
 static void proxy_remove(GDBusClient *client, const char *path,
 						const char *interface)
 {
-	GList *list;
+	GDBusProxy *proxy;
 
-	for (list = g_list_first(client->proxy_list); list;
-						list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
+	proxy = proxy_find(client, path, interface);
+	if (proxy == NULL)
+		return;
 
-		if (g_str_equal(proxy->interface, interface) == TRUE &&
-				g_str_equal(proxy->obj_path, path) == TRUE) {
-			client->proxy_list =
-				g_list_delete_link(client->proxy_list, list);
-			proxy_free(proxy);
-			break;
-		}
-	}
+	client->proxy_list = g_list_remove(client->proxy_list, proxy);
+	proxy_free(proxy);
 }
 
 static void start_service(GDBusProxy *proxy)
@@ -628,8 +738,7 @@ GDBusProxy *g_dbus_proxy_new(GDBusClient *client, const char *path,
 	if (client == NULL)
 		return NULL;
 
-	proxy = g_dbus_proxy_lookup(client->proxy_list, NULL,
-						path, interface);
+	proxy = proxy_find(client, path, interface);
 	if (proxy)
 		return g_dbus_proxy_ref(proxy);
 
@@ -672,6 +781,9 @@ void g_dbus_proxy_unref(GDBusProxy *proxy)
 		dbus_pending_call_unref(proxy->get_all_call);
 	}
 
+	if (proxy->props_msg != NULL)
+		dbus_message_unref(proxy->props_msg);
+
 	g_hash_table_destroy(proxy->prop_list);
 
 	g_free(proxy->obj_path);
@@ -704,6 +816,20 @@ gboolean g_dbus_proxy_get_property(GDBusProxy *proxy, const char *name,
 	if (proxy == NULL || name == NULL)
 		return FALSE;
 
+	if (proxy->props_msg != NULL) {
+		DBusMessageIter dict;
+		const char *prop_name;
+
+		dbus_message_iter_recurse(&proxy->props_iter, &dict);
+
+		while (next_property(&dict, &prop_name, iter)) {
+			if (!strcmp(prop_name, name))
+				return TRUE;
+		}
+
+		return FALSE;
+	}
+
 	prop = g_hash_table_lookup(proxy->prop_list, name);
 	if (prop == NULL)
 		return FALSE;
@@ -1057,8 +1183,24 @@ static void refresh_properties(GList *list)
         }
 }
 
-static void parse_properties(GDBusClient *client, const char *path,
-				const char *interface, DBusMessageIter *iter)
+static gboolean filter_interface(GDBusClient *client, const char *interface)
+{
+	char **filter;
+
+	if (client->filter == NULL)
+		return TRUE;
+
+	for (filter = client->filter; *filter; filter++) {
+		if (g_str_equal(*filter, interface) == TRUE)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void parse_properties(GDBusClient *client, DBusMessage *msg,
+				const char *path, const char *interface,
+				DBusMessageIter *iter)
 {
 	GDBusProxy *proxy;
 
@@ -1068,26 +1210,28 @@ static void parse_properties(GDBusClient *client, const char *path,
 	if (g_str_equal(interface, DBUS_INTERFACE_PROPERTIES) == TRUE)
 		return;
 
-	proxy = g_dbus_proxy_lookup(client->proxy_list, NULL,
-						path, interface);
+	proxy = proxy_find(client, path, interface);
 	if (proxy && !proxy->pending) {
 		update_properties(proxy, iter, FALSE);
 		return;
 	}
 
 	if (!proxy) {
+		if (!filter_interface(client, interface))
+			return;
+
 		proxy = proxy_new(client, path, interface);
 		if (proxy == NULL)
 			return;
 	}
 
-	update_properties(proxy, iter, FALSE);
+	set_properties(proxy, msg, iter);
 
 	proxy_added(client, proxy);
 }
 
-static void parse_interfaces(GDBusClient *client, const char *path,
-						DBusMessageIter *iter)
+static void parse_interfaces(GDBusClient *client, DBusMessage *msg,
+				const char *path, DBusMessageIter *iter)
 {
 	DBusMessageIter dict;
 
@@ -1108,7 +1252,7 @@ static void parse_interfaces(GDBusClient *client, const char *path,
 		dbus_message_iter_get_basic(&entry, &interface);
 		dbus_message_iter_next(&entry);
 
-		parse_properties(client, path, interface, &entry);
+		parse_properties(client, msg, path, interface, &entry);
 
 		dbus_message_iter_next(&dict);
 	}
@@ -1132,7 +1276,7 @@ static gboolean interfaces_added(DBusConnection *conn, DBusMessage *msg,
 
 	g_dbus_client_ref(client);
 
-	parse_interfaces(client, path, &iter);
+	parse_interfaces(client, msg, path, &iter);
 
 	g_dbus_client_unref(client);
 
@@ -1200,7 +1344,7 @@ static void parse_managed_objects(GDBusClient *client, DBusMessage *msg)
 		dbus_message_iter_get_basic(&entry, &path);
 		dbus_message_iter_next(&entry);
 
-		parse_interfaces(client, path, &entry);
+		parse_interfaces(client, msg, path, &entry);
 
 		dbus_message_iter_next(&dict);
 	}
@@ -1368,6 +1512,14 @@ GDBusClient *g_dbus_client_new_full(DBusConnection *connection,
 	client->match_rules = g_ptr_array_sized_new(1);
 	g_ptr_array_set_free_func(client->match_rules, g_free);
 
+	client->proxies = g_hash_table_new(proxy_hash, proxy_equal);
+
+	/* A single watch for all proxies, instead of a match rule each */
+	client->props_watch = g_dbus_add_properties_watch(connection, service,
+							NULL, NULL,
+							properties_changed,
+							client, NULL);
+
 	client->watch = g_dbus_add_service_watch(connection, service,
 						service_connect,
 						service_disconnect,
@@ -1441,6 +1593,8 @@ void g_dbus_client_unref(GDBusClient *client)
 						message_filter, client);
 
 	g_list_free_full(client->proxy_list, proxy_free);
+	g_hash_table_destroy(client->proxies);
+	g_strfreev(client->filter);
 
 	/*
 	 * Don't call disconn_func twice if disconnection
@@ -1452,6 +1606,7 @@ void g_dbus_client_unref(GDBusClient *client)
 	g_dbus_remove_watch(client->dbus_conn, client->watch);
 	g_dbus_remove_watch(client->dbus_conn, client->added_watch);
 	g_dbus_remove_watch(client->dbus_conn, client->removed_watch);
+	g_dbus_remove_watch(client->dbus_conn, client->props_watch);
 
 	dbus_connection_unref(client->dbus_conn);
 
@@ -1529,3 +1684,15 @@ gboolean g_dbus_client_set_proxy_handlers(GDBusClient *client,
 
 	return TRUE;
 }
+
+gboolean g_dbus_client_set_interface_filter(GDBusClient *client,
+					const char * const *interfaces)
+{
+	if (client == NULL)
+		return FALSE;
+
+	g_strfreev(client->filter);
+	client->filter = g_strdupv((char **) interfaces);
+
+	return TRUE;
+}
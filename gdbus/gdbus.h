@@ -209,6 +209,8 @@ struct GDBusSecurityTable {
 
 void g_dbus_set_flags(int flags);
 int g_dbus_get_flags(void);
+void g_dbus_set_property_limits(unsigned int interval, unsigned int budget);
+unsigned long g_dbus_get_signal_count(void);
 
 gboolean g_dbus_register_interface(DBusConnection *connection,
 					const char *path, const char *name,
@@ -395,6 +397,8 @@ gboolean g_dbus_client_set_proxy_handlers(GDBusClient *client,
 					GDBusProxyFunction proxy_removed,
 					GDBusPropertyFunction property_changed,
 					void *user_data);
+gboolean g_dbus_client_set_interface_filter(GDBusClient *client,
+					const char * const *interfaces);
 
 #ifdef __cplusplus
 }
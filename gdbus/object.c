@@ -42,7 +42,9 @@ struct generic_data {
 	GSList *objects;
 	GSList *added;
 	GSList *removed;
-	guint process_id;
+	GList *pending_link;
+	guint throttle_id;
+	gint64 last_emit;
 	gboolean pending_prop;
 	char *introspect;
 	struct generic_data *parent;
@@ -56,6 +58,15 @@ struct interface_data {
 	GSList *pending_prop;
 	void *user_data;
 	GDBusDestroyFunction destroy;
+	struct interface_xml *xml;
+	DBusMessage *snapshot;
+};
+
+/* Introspection data shared by all interfaces using the same tables */
+struct interface_xml {
+	char *key;
+	char *xml;
+	unsigned int refcount;
 };
 
 struct security_data {
@@ -73,9 +84,16 @@ struct property_data {
 
 static int global_flags = 0;
 static struct generic_data *root;
-static GSList *pending = NULL;
-
-static gboolean process_changes(gpointer user_data);
+static GHashTable *interface_xmls = NULL;
+static GQueue pending = G_QUEUE_INIT;
+static guint pending_id = 0;
+static unsigned int property_interval = 0;
+static unsigned int signal_budget = 0;
+static gint64 budget_start = 0;
+static unsigned int budget_used = 0;
+static unsigned long signal_count = 0;
+
+static void process_changes(struct generic_data *data);
 static void process_properties_from_interface(struct generic_data *data,
 						struct interface_data *iface);
 static void process_property_changes(struct generic_data *data);
@@ -177,6 +195,62 @@ static void generate_interface_xml(GString *gstr, struct interface_data *iface)
 	}
 }
 
+static struct interface_xml *interface_xml_ref(const char *name,
+					const GDBusMethodTable *methods,
+					const GDBusSignalTable *signals,
+					const GDBusPropertyTable *properties)
+{
+	struct interface_xml *xml;
+	char *key;
+
+	if (interface_xmls == NULL)
+		interface_xmls = g_hash_table_new(g_str_hash, g_str_equal);
+
+	key = g_strdup_printf("%s %p %p %p", name, methods, signals,
+								properties);
+
+	xml = g_hash_table_lookup(interface_xmls, key);
+	if (xml != NULL) {
+		g_free(key);
+		xml->refcount++;
+		return xml;
+	}
+
+	xml = g_new0(struct interface_xml, 1);
+	xml->key = key;
+	xml->refcount = 1;
+
+	g_hash_table_insert(interface_xmls, xml->key, xml);
+
+	return xml;
+}
+
+static void interface_xml_unref(struct interface_xml *xml)
+{
+	if (--xml->refcount > 0)
+		return;
+
+	g_hash_table_remove(interface_xmls, xml->key);
+
+	g_free(xml->key);
+	g_free(xml->xml);
+	g_free(xml);
+}
+
+static const char *get_interface_xml(struct interface_data *iface)
+{
+	GString *gstr;
+
+	if (iface->xml->xml != NULL)
+		return iface->xml->xml;
+
+	gstr = g_string_new(NULL);
+	generate_interface_xml(gstr, iface);
+	iface->xml->xml = g_string_free(gstr, FALSE);
+
+	return iface->xml->xml;
+}
+
 static void generate_introspection_xml(DBusConnection *conn,
 				struct generic_data *data, const char *path)
 {
@@ -197,7 +271,7 @@ static void generate_introspection_xml(DBusConnection *conn,
 		g_string_append_printf(gstr, "<interface name=\"%s\">",
 								iface->name);
 
-		generate_interface_xml(gstr, iface);
+		g_string_append(gstr, get_interface_xml(iface));
 
 		g_string_append_printf(gstr, "</interface>");
 	}
@@ -543,6 +617,90 @@ static void append_interface(gpointer data, gpointer user_data)
 	dbus_message_iter_close_container(array, &entry);
 }
 
+static void invalidate_snapshot(struct interface_data *iface)
+{
+	if (iface->snapshot == NULL)
+		return;
+
+	dbus_message_unref(iface->snapshot);
+	iface->snapshot = NULL;
+}
+
+static void iter_append_iter(DBusMessageIter *base, DBusMessageIter *iter)
+{
+	int type;
+
+	type = dbus_message_iter_get_arg_type(iter);
+
+	if (dbus_type_is_basic(type)) {
+		dbus_uint64_t value;
+
+		dbus_message_iter_get_basic(iter, &value);
+		dbus_message_iter_append_basic(base, type, &value);
+	} else if (dbus_type_is_container(type)) {
+		DBusMessageIter iter_sub, base_sub;
+		char *sig;
+
+		dbus_message_iter_recurse(iter, &iter_sub);
+
+		switch (type) {
+		case DBUS_TYPE_ARRAY:
+		case DBUS_TYPE_VARIANT:
+			sig = dbus_message_iter_get_signature(&iter_sub);
+			break;
+		default:
+			sig = NULL;
+			break;
+		}
+
+		dbus_message_iter_open_container(base, type, sig, &base_sub);
+
+		if (sig != NULL)
+			dbus_free(sig);
+
+		while (dbus_message_iter_get_arg_type(&iter_sub) !=
+							DBUS_TYPE_INVALID) {
+			iter_append_iter(&base_sub, &iter_sub);
+			dbus_message_iter_next(&iter_sub);
+		}
+
+		dbus_message_iter_close_container(base, &base_sub);
+	}
+}
+
+/*
+ * The properties of an interface are serialized once and copied into every
+ * GetManagedObjects reply until one of them is signalled as changed. Clients
+ * of the ObjectManager already rely on those signals to stay up to date.
+ */
+static void append_interface_snapshot(gpointer data, gpointer user_data)
+{
+	struct interface_data *iface = data;
+	DBusMessageIter *array = user_data;
+	DBusMessageIter entry, iter;
+
+	if (iface->snapshot == NULL) {
+		iface->snapshot = dbus_message_new(
+					DBUS_MESSAGE_TYPE_METHOD_RETURN);
+		if (iface->snapshot == NULL) {
+			append_interface(data, user_data);
+			return;
+		}
+
+		dbus_message_iter_init_append(iface->snapshot, &iter);
+		append_properties(iface, &iter);
+	}
+
+	dbus_message_iter_open_container(array, DBUS_TYPE_DICT_ENTRY, NULL,
+								&entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &iface->name);
+
+	dbus_message_iter_init(iface->snapshot, &iter);
+	iter_append_iter(&entry, &iter);
+
+	dbus_message_iter_close_container(array, &entry);
+}
+
 static void emit_interfaces_added(struct generic_data *data)
 {
 	DBusMessage *signal;
@@ -584,7 +742,8 @@ static void emit_interfaces_added(struct generic_data *data)
 	dbus_message_iter_close_container(&iter, &array);
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
-	dbus_connection_send(data->conn, signal, NULL);
+	if (dbus_connection_send(data->conn, signal, NULL))
+		signal_count++;
 	dbus_message_unref(signal);
 }
 
@@ -626,22 +785,43 @@ static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 	return TRUE;
 }
 
+static gboolean process_pending(gpointer user_data)
+{
+	guint count = g_queue_get_length(&pending);
+	struct generic_data *data;
+
+	pending_id = 0;
+
+	/*
+	 * process_changes always takes the object out of the pending queue,
+	 * objects queued again while emitting are left for the next idler.
+	 */
+	while (count-- > 0 && (data = g_queue_peek_head(&pending)))
+		process_changes(data);
+
+	return FALSE;
+}
+
 static void add_pending(struct generic_data *data)
 {
-	guint old_id = data->process_id;
+	if (data->throttle_id > 0) {
+		/* Only property changes are held back by the limits */
+		if (data->added == NULL && data->removed == NULL)
+			return;
 
-	data->process_id = g_idle_add(process_changes, data);
+		g_source_remove(data->throttle_id);
+		data->throttle_id = 0;
+	}
 
-	if (old_id > 0) {
-		/*
-		 * If the element already had an old idler, remove the old one,
-		 * no need to re-add it to the pending list.
-		 */
-		g_source_remove(old_id);
+	if (data->pending_link != NULL)
 		return;
-	}
 
-	pending = g_slist_append(pending, data);
+	/* A single idler processes every object changed in this iteration */
+	g_queue_push_tail(&pending, data);
+	data->pending_link = pending.tail;
+
+	if (pending_id == 0)
+		pending_id = g_idle_add(process_pending, NULL);
 }
 
 static gboolean remove_interface(struct generic_data *data, const char *name)
@@ -655,6 +835,8 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 	process_properties_from_interface(data, iface);
 
 	data->interfaces = g_slist_remove(data->interfaces, iface);
+	interface_xml_unref(iface->xml);
+	invalidate_snapshot(iface);
 
 	if (iface->destroy) {
 		iface->destroy(iface->user_data);
@@ -978,41 +1160,98 @@ static void emit_interfaces_removed(struct generic_data *data)
 	dbus_message_iter_close_container(&iter, &array);
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
-	dbus_connection_send(data->conn, signal, NULL);
+	if (dbus_connection_send(data->conn, signal, NULL))
+		signal_count++;
 	dbus_message_unref(signal);
 }
 
 static void remove_pending(struct generic_data *data)
 {
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
+	if (data->throttle_id > 0) {
+		g_source_remove(data->throttle_id);
+		data->throttle_id = 0;
 	}
 
-	pending = g_slist_remove(pending, data);
+	if (data->pending_link != NULL) {
+		g_queue_delete_link(&pending, data->pending_link);
+		data->pending_link = NULL;
+	}
 }
 
-static gboolean process_changes(gpointer user_data)
+static void emit_changes(struct generic_data *data)
 {
-	struct generic_data *data = user_data;
-
 	remove_pending(data);
 
 	if (data->added != NULL)
 		emit_interfaces_added(data);
 
 	/* Flush pending properties */
-	if (data->pending_prop == TRUE)
+	if (data->pending_prop == TRUE) {
 		process_property_changes(data);
+		data->last_emit = g_get_monotonic_time();
+		budget_used++;
+	}
 
 	if (data->removed != NULL)
 		emit_interfaces_removed(data);
+}
+
+static guint throttle_delay(struct generic_data *data)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 delay = 0;
+
+	if (property_interval > 0)
+		delay = data->last_emit - now +
+				(gint64) property_interval * 1000;
 
-	data->process_id = 0;
+	if (signal_budget > 0) {
+		if (now - budget_start >= G_USEC_PER_SEC) {
+			budget_start = now;
+			budget_used = 0;
+		}
+
+		if (budget_used >= signal_budget)
+			delay = MAX(delay, budget_start + G_USEC_PER_SEC - now);
+	}
+
+	if (delay <= 0)
+		return 0;
+
+	return (delay + 999) / 1000;
+}
+
+static gboolean throttle_timeout(gpointer user_data)
+{
+	struct generic_data *data = user_data;
+
+	data->throttle_id = 0;
+	process_changes(data);
 
 	return FALSE;
 }
 
+static void process_changes(struct generic_data *data)
+{
+	guint delay;
+
+	/* Objects appearing or going away are never held back */
+	if (data->added != NULL || data->removed != NULL ||
+						data->pending_prop == FALSE)
+		goto emit;
+
+	delay = throttle_delay(data);
+	if (delay == 0)
+		goto emit;
+
+	remove_pending(data);
+	data->throttle_id = g_timeout_add(delay, throttle_timeout, data);
+	return;
+
+emit:
+	emit_changes(data);
+}
+
 static void generic_unregister(DBusConnection *connection, void *user_data)
 {
 	struct generic_data *data = user_data;
@@ -1021,11 +1260,8 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	if (parent != NULL)
 		parent->objects = g_slist_remove(parent->objects, data);
 
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
-		process_changes(data);
-	}
+	if (data->pending_link != NULL || data->throttle_id > 0)
+		emit_changes(data);
 
 	g_slist_foreach(data->objects, reset_parent, data->parent);
 	g_slist_free(data->objects);
@@ -1087,9 +1323,34 @@ static const GDBusMethodTable introspect_methods[] = {
 	{ }
 };
 
-static void append_interfaces(struct generic_data *data, DBusMessageIter *iter)
+struct objects_filter {
+	char **interfaces;
+	int count;
+	dbus_uint32_t skip;
+	dbus_uint32_t left;
+};
+
+static gboolean filter_match(struct objects_filter *filter,
+						struct interface_data *iface)
+{
+	int i;
+
+	if (filter == NULL || filter->count == 0)
+		return TRUE;
+
+	for (i = 0; i < filter->count; i++) {
+		if (!strcmp(filter->interfaces[i], iface->name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void append_interfaces(struct generic_data *data, DBusMessageIter *iter,
+					struct objects_filter *filter)
 {
 	DBusMessageIter array;
+	GSList *l;
 
 	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 				DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
@@ -1101,31 +1362,74 @@ static void append_interfaces(struct generic_data *data, DBusMessageIter *iter)
 				DBUS_DICT_ENTRY_END_CHAR_AS_STRING
 				DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &array);
 
-	g_slist_foreach(data->interfaces, append_interface, &array);
+	for (l = data->interfaces; l; l = l->next) {
+		if (filter_match(filter, l->data))
+			append_interface_snapshot(l->data, &array);
+	}
 
 	dbus_message_iter_close_container(iter, &array);
 }
 
-static void append_object(gpointer data, gpointer user_data)
+static gboolean object_match(struct generic_data *object,
+					struct objects_filter *filter)
 {
-	struct generic_data *child = data;
-	DBusMessageIter *array = user_data;
-	DBusMessageIter entry;
+	GSList *l;
 
-	dbus_message_iter_open_container(array, DBUS_TYPE_DICT_ENTRY, NULL,
-								&entry);
-	dbus_message_iter_append_basic(&entry, DBUS_TYPE_OBJECT_PATH,
-								&child->path);
-	append_interfaces(child, &entry);
-	dbus_message_iter_close_container(array, &entry);
+	if (filter == NULL)
+		return TRUE;
+
+	for (l = object->interfaces; l; l = l->next) {
+		if (filter_match(filter, l->data))
+			break;
+	}
+
+	if (l == NULL)
+		return FALSE;
+
+	if (filter->skip > 0) {
+		filter->skip--;
+		return FALSE;
+	}
+
+	if (filter->left == 0)
+		return FALSE;
 
-	g_slist_foreach(child->objects, append_object, user_data);
+	filter->left--;
+
+	return TRUE;
 }
 
-static DBusMessage *get_objects(DBusConnection *connection,
-				DBusMessage *message, void *user_data)
+static void append_objects(struct generic_data *data, DBusMessageIter *array,
+					struct objects_filter *filter)
+{
+	GSList *l;
+
+	for (l = data->objects; l; l = l->next) {
+		struct generic_data *child = l->data;
+		DBusMessageIter entry;
+
+		if (filter != NULL && filter->left == 0)
+			return;
+
+		if (object_match(child, filter)) {
+			dbus_message_iter_open_container(array,
+						DBUS_TYPE_DICT_ENTRY, NULL,
+						&entry);
+			dbus_message_iter_append_basic(&entry,
+						DBUS_TYPE_OBJECT_PATH,
+						&child->path);
+			append_interfaces(child, &entry, filter);
+			dbus_message_iter_close_container(array, &entry);
+		}
+
+		append_objects(child, array, filter);
+	}
+}
+
+static DBusMessage *objects_reply(DBusMessage *message,
+					struct generic_data *data,
+					struct objects_filter *filter)
 {
-	struct generic_data *data = user_data;
 	DBusMessage *reply;
 	DBusMessageIter iter;
 	DBusMessageIter array;
@@ -1151,16 +1455,55 @@ static DBusMessage *get_objects(DBusConnection *connection,
 					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
 					&array);
 
-	g_slist_foreach(data->objects, append_object, &array);
+	append_objects(data, &array, filter);
 
 	dbus_message_iter_close_container(&iter, &array);
 
 	return reply;
 }
 
+static DBusMessage *get_objects(DBusConnection *connection,
+				DBusMessage *message, void *user_data)
+{
+	return objects_reply(message, user_data, NULL);
+}
+
+static DBusMessage *get_objects_filtered(DBusConnection *connection,
+				DBusMessage *message, void *user_data)
+{
+	struct objects_filter filter;
+	DBusMessage *reply;
+
+	memset(&filter, 0, sizeof(filter));
+
+	if (!dbus_message_get_args(message, NULL,
+				DBUS_TYPE_ARRAY, DBUS_TYPE_STRING,
+				&filter.interfaces, &filter.count,
+				DBUS_TYPE_UINT32, &filter.skip,
+				DBUS_TYPE_UINT32, &filter.left,
+				DBUS_TYPE_INVALID))
+		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
+							"Invalid arguments");
+
+	/* A count of 0 means no limit */
+	if (filter.left == 0)
+		filter.left = G_MAXUINT32;
+
+	reply = objects_reply(message, user_data, &filter);
+
+	dbus_free_string_array(filter.interfaces);
+
+	return reply;
+}
+
 static const GDBusMethodTable manager_methods[] = {
 	{ GDBUS_METHOD("GetManagedObjects", NULL,
 		GDBUS_ARGS({ "objects", "a{oa{sa{sv}}}" }), get_objects) },
+	{ GDBUS_EXPERIMENTAL_METHOD("GetManagedObjectsFiltered",
+		GDBUS_ARGS({ "interfaces", "as" }, { "offset", "u" },
+							{ "count", "u" }),
+		GDBUS_ARGS({ "objects", "a{oa{sa{sv}}}" }),
+		get_objects_filtered) },
 	{ }
 };
 
@@ -1215,6 +1558,7 @@ done:
 	iface->properties = properties;
 	iface->user_data = user_data;
 	iface->destroy = destroy;
+	iface->xml = interface_xml_ref(name, methods, signals, properties);
 
 	data->interfaces = g_slist_append(data->interfaces, iface);
 	if (data->parent == NULL)
@@ -1488,9 +1832,13 @@ DBusMessage *g_dbus_create_reply(DBusMessage *message, int type, ...)
 
 static void g_dbus_flush(DBusConnection *connection)
 {
-	GSList *l;
+	GList *l;
 
-	for (l = pending; l;) {
+	/*
+	 * Objects whose property changes are held back by the emission
+	 * limits are not part of the pending queue and stay held back.
+	 */
+	for (l = pending.head; l;) {
 		struct generic_data *data = l->data;
 
 		l = l->next;
@@ -1524,6 +1872,9 @@ gboolean g_dbus_send_message(DBusConnection *connection, DBusMessage *message)
 	g_dbus_flush(connection);
 
 	result = dbus_connection_send(connection, message, NULL);
+	if (result && dbus_message_get_type(message) ==
+						DBUS_MESSAGE_TYPE_SIGNAL)
+		signal_count++;
 
 out:
 	dbus_message_unref(message);
@@ -1721,7 +2072,8 @@ static void process_properties_from_interface(struct generic_data *data,
 	iface->pending_prop = NULL;
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
-	dbus_connection_send(data->conn, signal, NULL);
+	if (dbus_connection_send(data->conn, signal, NULL))
+		signal_count++;
 	dbus_message_unref(signal);
 }
 
@@ -1758,6 +2110,8 @@ void g_dbus_emit_property_changed_full(DBusConnection *connection,
 	if (iface == NULL)
 		return;
 
+	invalidate_snapshot(iface);
+
 	/*
 	 * If ObjectManager is attached, don't emit property changed if
 	 * interface is not yet published
@@ -1840,12 +2194,36 @@ gboolean g_dbus_detach_object_manager(DBusConnection *connection)
 	return TRUE;
 }
 
+static void clear_interface_xml(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct interface_xml *xml = value;
+
+	g_free(xml->xml);
+	xml->xml = NULL;
+}
+
 void g_dbus_set_flags(int flags)
 {
 	global_flags = flags;
+
+	/* Experimental members may have to be shown or hidden now */
+	if (interface_xmls != NULL)
+		g_hash_table_foreach(interface_xmls, clear_interface_xml, NULL);
+}
+
+void g_dbus_set_property_limits(unsigned int interval, unsigned int budget)
+{
+	property_interval = interval;
+	signal_budget = budget;
 }
 
 int g_dbus_get_flags(void)
 {
 	return global_flags;
 }
+
+unsigned long g_dbus_get_signal_count(void)
+{
+	return signal_count;
+}
@@ -10,6 +10,7 @@
 #ifndef __GOBEX_DEFS_H
 #define __GOBEX_DEFS_H
 
+#include <sys/types.h>
 #include <glib.h>
 
 typedef enum {
@@ -31,6 +32,16 @@ typedef enum {
 } GObexError;
 
 typedef gssize (*GObexDataProducer) (void *buf, gsize len, gpointer user_data);
+/* Points buf at up to len bytes of body data owned by the caller, which must
+ * remain valid until the function is called again or the transfer completes.
+ */
+typedef gssize (*GObexDataRef) (const void **buf, gsize len,
+							gpointer user_data);
+/* Sets fd and offset to the file region holding up to len bytes of body data,
+ * which is sent without being read into userspace when possible.
+ */
+typedef gssize (*GObexDataFd) (int *fd, off_t *offset, gsize len,
+							gpointer user_data);
 typedef gboolean (*GObexDataConsumer) (const void *buf, gsize len,
 							gpointer user_data);
 
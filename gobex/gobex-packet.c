@@ -13,6 +13,7 @@
 
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gobex-defs.h"
 #include "gobex-packet.h"
@@ -36,16 +37,49 @@ struct _GObexPacket {
 	gsize hlen;		/* Length of all encoded headers */
 	GSList *headers;
 
+	/* Body header left undecoded in the buffer of a referencing packet */
+	const guint8 *body_view;
+	gsize body_view_len;
+	guint body_view_pos;	/* Position of the body among the headers */
+
 	GObexDataProducer get_body;
+	GObexDataRef get_body_ref;
+	GObexDataFd get_body_fd;
 	gpointer get_body_data;
+
+	int body_fd;		/* File region of the last encoded body */
+	off_t body_offset;
 };
 
+/* Turns the body view into a regular header at its original position */
+static void decode_body_view(GObexPacket *pkt)
+{
+	GObexHeader *header;
+	gsize parsed;
+
+	if (pkt->body_view == NULL)
+		return;
+
+	header = g_obex_header_decode(pkt->body_view, pkt->body_view_len,
+					G_OBEX_DATA_REF, &parsed, NULL);
+	pkt->body_view = NULL;
+
+	if (header == NULL)
+		return;
+
+	pkt->headers = g_slist_insert(pkt->headers, header,
+							pkt->body_view_pos);
+}
+
 GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id)
 {
 	GSList *l;
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
+	if (pkt->body_view && pkt->body_view[0] == id)
+		decode_body_view(pkt);
+
 	for (l = pkt->headers; l != NULL; l = g_slist_next(l)) {
 		GObexHeader *hdr = l->data;
 
@@ -69,6 +103,26 @@ GObexHeader *g_obex_packet_get_body(GObexPacket *pkt)
 	return g_obex_packet_get_header(pkt, G_OBEX_HDR_BODY_END);
 }
 
+gboolean g_obex_packet_get_body_bytes(GObexPacket *pkt, const guint8 **val,
+								gsize *len)
+{
+	GObexHeader *body;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->body_view != NULL) {
+		*val = pkt->body_view + 3;
+		*len = pkt->body_view_len - 3;
+		return TRUE;
+	}
+
+	body = g_obex_packet_get_body(pkt);
+	if (body == NULL)
+		return FALSE;
+
+	return g_obex_header_get_bytes(body, val, len);
+}
+
 guint8 g_obex_packet_get_operation(GObexPacket *pkt, gboolean *final)
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
@@ -86,6 +140,9 @@ gboolean g_obex_packet_prepend_header(GObexPacket *pkt, GObexHeader *header)
 	pkt->headers = g_slist_prepend(pkt->headers, header);
 	pkt->hlen += g_obex_header_get_length(header);
 
+	if (pkt->body_view != NULL)
+		pkt->body_view_pos++;
+
 	return TRUE;
 }
 
@@ -104,7 +161,7 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
-	if (pkt->get_body != NULL)
+	if (pkt->get_body || pkt->get_body_ref || pkt->get_body_fd)
 		return FALSE;
 
 	pkt->get_body = func;
@@ -113,6 +170,45 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 	return TRUE;
 }
 
+gboolean g_obex_packet_add_body_ref(GObexPacket *pkt, GObexDataRef func,
+							gpointer user_data)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->get_body || pkt->get_body_ref || pkt->get_body_fd)
+		return FALSE;
+
+	pkt->get_body_ref = func;
+	pkt->get_body_data = user_data;
+
+	return TRUE;
+}
+
+gboolean g_obex_packet_add_body_fd(GObexPacket *pkt, GObexDataFd func,
+							gpointer user_data)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->get_body || pkt->get_body_ref || pkt->get_body_fd)
+		return FALSE;
+
+	pkt->get_body_fd = func;
+	pkt->get_body_data = user_data;
+
+	return TRUE;
+}
+
+int g_obex_packet_get_body_fd(GObexPacket *pkt, off_t *offset)
+{
+	if (pkt->get_body_fd == NULL)
+		return -1;
+
+	if (offset)
+		*offset = pkt->body_offset;
+
+	return pkt->body_fd;
+}
+
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str)
 {
@@ -271,30 +367,68 @@ void g_obex_packet_free(GObexPacket *pkt)
 	g_free(pkt);
 }
 
+/*
+ * Packets referencing the receive buffer keep their body header as a view
+ * into it, so body-only packets are parsed without any header allocation.
+ * The body is only decoded if it is looked up as a regular header.
+ */
+static gsize parse_body_view(GObexPacket *pkt, const guint8 *buf, gsize len,
+								guint pos)
+{
+	guint16 hdr_len;
+
+	if (pkt->body_view != NULL || len < 3)
+		return 0;
+
+	if (buf[0] != G_OBEX_HDR_BODY && buf[0] != G_OBEX_HDR_BODY_END)
+		return 0;
+
+	memcpy(&hdr_len, &buf[1], sizeof(hdr_len));
+	hdr_len = g_ntohs(hdr_len);
+	if (hdr_len < 3 || hdr_len > len)
+		return 0;
+
+	pkt->body_view = buf;
+	pkt->body_view_len = hdr_len;
+	pkt->body_view_pos = pos;
+
+	return hdr_len;
+}
+
 static gboolean parse_headers(GObexPacket *pkt, const void *data, gsize len,
 						GObexDataPolicy data_policy,
 						GError **err)
 {
 	const guint8 *buf = data;
+	guint count = 0;
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
 	while (len > 0) {
 		GObexHeader *header;
-		gsize parsed;
+		gsize parsed = 0;
+
+		if (data_policy == G_OBEX_DATA_REF)
+			parsed = parse_body_view(pkt, buf, len, count);
+
+		if (parsed == 0) {
+			header = g_obex_header_decode(buf, len, data_policy,
+								&parsed, err);
+			if (header == NULL)
+				return FALSE;
 
-		header = g_obex_header_decode(buf, len, data_policy, &parsed,
-									err);
-		if (header == NULL)
-			return FALSE;
+			pkt->headers = g_slist_prepend(pkt->headers, header);
+			count++;
+		}
 
-		pkt->headers = g_slist_append(pkt->headers, header);
 		pkt->hlen += parsed;
 
 		len -= parsed;
 		buf += parsed;
 	}
 
+	pkt->headers = g_slist_reverse(pkt->headers);
+
 	return TRUE;
 }
 
@@ -372,9 +506,21 @@ failed:
 	return NULL;
 }
 
-static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+static void set_body_header(guint8 *buf, gssize len)
 {
 	guint16 u16;
+
+	if (len > 0)
+		buf[0] = G_OBEX_HDR_BODY;
+	else
+		buf[0] = G_OBEX_HDR_BODY_END;
+
+	u16 = g_htons(len + 3);
+	memcpy(&buf[1], &u16, sizeof(u16));
+}
+
+static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+{
 	gssize ret;
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
@@ -386,21 +532,71 @@ static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
 	if (ret < 0)
 		return ret;
 
-	if (ret > 0)
-		buf[0] = G_OBEX_HDR_BODY;
-	else
-		buf[0] = G_OBEX_HDR_BODY_END;
+	set_body_header(buf, ret);
 
-	u16 = g_htons(ret + 3);
-	memcpy(&buf[1], &u16, sizeof(u16));
+	return ret;
+}
+
+static gssize get_body_ref(GObexPacket *pkt, guint8 *buf, gsize len,
+							const void **body)
+{
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (len < 3)
+		return -ENOBUFS;
+
+	*body = NULL;
+
+	ret = pkt->get_body_ref(body, len - 3, pkt->get_body_data);
+	if (ret < 0)
+		return ret;
+
+	if ((gsize) ret > len - 3 || (ret > 0 && *body == NULL))
+		return -EINVAL;
+
+	set_body_header(buf, ret);
 
 	return ret;
 }
 
-gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
+static gssize get_body_fd(GObexPacket *pkt, guint8 *buf, gsize len)
 {
 	gssize ret;
-	gsize count;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (len < 3)
+		return -ENOBUFS;
+
+	pkt->body_fd = -1;
+
+	ret = pkt->get_body_fd(&pkt->body_fd, &pkt->body_offset, len - 3,
+							pkt->get_body_data);
+	if (ret < 0)
+		return ret;
+
+	if ((gsize) ret > len - 3 || (ret > 0 && pkt->body_fd < 0))
+		return -EINVAL;
+
+	set_body_header(buf, ret);
+
+	return ret;
+}
+
+/*
+ * Encodes the packet with the body left out of buf when it is provided by
+ * reference or file, iov[0] then covers buf and iov[1] the body so both can
+ * be written at once without copying the body. For file bodies iov[1] has
+ * no base and the region is given by g_obex_packet_get_body_fd().
+ */
+gssize g_obex_packet_encode_iov(GObexPacket *pkt, guint8 *buf, gsize len,
+							struct iovec *iov)
+{
+	const void *body = NULL;
+	gssize ret;
+	gsize count, body_len = 0;
 	guint16 u16;
 	GSList *l;
 
@@ -422,6 +618,8 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 
 	count = 3 + pkt->data_len;
 
+	decode_body_view(pkt);
+
 	for (l = pkt->headers; l != NULL; l = g_slist_next(l)) {
 		GObexHeader *hdr = l->data;
 
@@ -435,8 +633,14 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 		count += ret;
 	}
 
-	if (pkt->get_body) {
-		ret = get_body(pkt, buf + count, len - count);
+	if (pkt->get_body || pkt->get_body_ref || pkt->get_body_fd) {
+		if (pkt->get_body)
+			ret = get_body(pkt, buf + count, len - count);
+		else if (pkt->get_body_ref)
+			ret = get_body_ref(pkt, buf + count, len - count,
+									&body);
+		else
+			ret = get_body_fd(pkt, buf + count, len - count);
 		if (ret < 0)
 			return ret;
 		if (ret == 0) {
@@ -445,11 +649,42 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 			buf[0] |= FINAL_BIT;
 		}
 
-		count += ret + 3;
+		if (body || pkt->get_body_fd) {
+			count += 3;
+			body_len = ret;
+		} else
+			count += ret + 3;
 	}
 
-	u16 = g_htons(count);
+	u16 = g_htons(count + body_len);
 	memcpy(&buf[1], &u16, sizeof(u16));
 
-	return count;
+	iov[0].iov_base = buf;
+	iov[0].iov_len = count;
+	iov[1].iov_base = (void *) body;
+	iov[1].iov_len = body_len;
+
+	return count + body_len;
+}
+
+gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
+{
+	struct iovec iov[2];
+	gssize ret;
+
+	ret = g_obex_packet_encode_iov(pkt, buf, len, iov);
+	if (ret < 0 || !iov[1].iov_len)
+		return ret;
+
+	/* The body fits as it has been checked against len */
+	if (iov[1].iov_base) {
+		memcpy(buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+		return ret;
+	}
+
+	if (pread(pkt->body_fd, buf + iov[0].iov_len, iov[1].iov_len,
+				pkt->body_offset) != (ssize_t) iov[1].iov_len)
+		return -EIO;
+
+	return ret;
 }
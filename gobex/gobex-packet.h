@@ -11,6 +11,7 @@
 #define __GOBEX_PACKET_H
 
 #include <stdarg.h>
+#include <sys/uio.h>
 #include <glib.h>
 
 #include "gobex/gobex-defs.h"
@@ -70,11 +71,18 @@ typedef struct _GObexPacket GObexPacket;
 
 GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id);
 GObexHeader *g_obex_packet_get_body(GObexPacket *pkt);
+gboolean g_obex_packet_get_body_bytes(GObexPacket *pkt, const guint8 **val,
+								gsize *len);
 guint8 g_obex_packet_get_operation(GObexPacket *pkt, gboolean *final);
 gboolean g_obex_packet_prepend_header(GObexPacket *pkt, GObexHeader *header);
 gboolean g_obex_packet_add_header(GObexPacket *pkt, GObexHeader *header);
 gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 							gpointer user_data);
+gboolean g_obex_packet_add_body_ref(GObexPacket *pkt, GObexDataRef func,
+							gpointer user_data);
+gboolean g_obex_packet_add_body_fd(GObexPacket *pkt, GObexDataFd func,
+							gpointer user_data);
+int g_obex_packet_get_body_fd(GObexPacket *pkt, off_t *offset);
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str);
 gboolean g_obex_packet_add_bytes(GObexPacket *pkt, guint8 id,
@@ -95,5 +103,7 @@ GObexPacket *g_obex_packet_decode(const void *data, gsize len,
 						GObexDataPolicy data_policy,
 						GError **err);
 gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len);
+gssize g_obex_packet_encode_iov(GObexPacket *pkt, guint8 *buf, gsize len,
+							struct iovec *iov);
 
 #endif /* __GOBEX_PACKET_H */
@@ -37,6 +37,8 @@ struct transfer {
 	guint abort_id;
 
 	GObexDataProducer data_producer;
+	GObexDataRef data_ref;
+	GObexDataFd data_fd;
 	GObexDataConsumer data_consumer;
 	GObexFunc complete_func;
 
@@ -118,14 +120,13 @@ static void transfer_abort_response(GObex *obex, GError *err, GObexPacket *rsp,
 }
 
 
-static gssize put_get_data(void *buf, gsize len, gpointer user_data)
+static void put_add_body(struct transfer *transfer, GObexPacket *req);
+
+static gssize put_data_done(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req;
 	GError *err = NULL;
-	gssize ret;
 
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret == 0 || ret == -EAGAIN)
 		return ret;
 
@@ -137,7 +138,7 @@ static gssize put_get_data(void *buf, gsize len, gpointer user_data)
 		/* Generate next packet */
 		req = g_obex_packet_new(transfer->opcode, FALSE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(req, put_get_data, transfer);
+		put_add_body(transfer, req);
 		transfer->req_id = g_obex_send_req(transfer->obex, req, -1,
 						transfer_response, transfer,
 						&err);
@@ -155,18 +156,57 @@ done:
 	return ret;
 }
 
+static gssize put_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->data_producer(buf, len, transfer->user_data);
+
+	return put_data_done(transfer, ret);
+}
+
+static gssize put_get_ref(const void **buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->data_ref(buf, len, transfer->user_data);
+
+	return put_data_done(transfer, ret);
+}
+
+static gssize put_get_fd(int *fd, off_t *offset, gsize len,
+							gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->data_fd(fd, offset, len, transfer->user_data);
+
+	return put_data_done(transfer, ret);
+}
+
+static void put_add_body(struct transfer *transfer, GObexPacket *req)
+{
+	if (transfer->data_ref)
+		g_obex_packet_add_body_ref(req, put_get_ref, transfer);
+	else if (transfer->data_fd)
+		g_obex_packet_add_body_fd(req, put_get_fd, transfer);
+	else
+		g_obex_packet_add_body(req, put_get_data, transfer);
+}
+
 static gboolean handle_get_body(struct transfer *transfer, GObexPacket *rsp,
 								GError **err)
 {
-	GObexHeader *body = g_obex_packet_get_body(rsp);
 	gboolean ret;
 	const guint8 *buf;
 	gsize len;
 
-	if (body == NULL)
+	if (!g_obex_packet_get_body_bytes(rsp, &buf, &len))
 		return TRUE;
 
-	g_obex_header_get_bytes(body, &buf, &len);
 	if (len == 0)
 		return TRUE;
 
@@ -217,7 +257,7 @@ static void transfer_response(GObex *obex, GError *err, GObexPacket *rsp,
 	if (transfer->opcode == G_OBEX_OP_PUT) {
 		req = g_obex_packet_new(transfer->opcode, FALSE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(req, put_get_data, transfer);
+		put_add_body(transfer, req);
 	} else if (!g_obex_srm_active(transfer->obex)) {
 		req = g_obex_packet_new(transfer->opcode, TRUE,
 							G_OBEX_HDR_INVALID);
@@ -258,6 +298,23 @@ static struct transfer *transfer_new(GObex *obex, guint8 opcode,
 	return transfer;
 }
 
+static guint put_req_start(struct transfer *transfer, GObex *obex,
+					GObexPacket *req, GError **err)
+{
+	put_add_body(transfer, req);
+
+	transfer->req_id = g_obex_send_req(obex, req, FIRST_PACKET_TIMEOUT,
+					transfer_response, transfer, err);
+	if (transfer->req_id == 0) {
+		transfer_free(transfer);
+		return 0;
+	}
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	return transfer->id;
+}
+
 guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
 			GObexDataProducer data_func, GObexFunc complete_func,
 			gpointer user_data, GError **err)
@@ -272,18 +329,41 @@ guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
 	transfer = transfer_new(obex, G_OBEX_OP_PUT, complete_func, user_data);
 	transfer->data_producer = data_func;
 
-	g_obex_packet_add_body(req, put_get_data, transfer);
+	return put_req_start(transfer, obex, req, err);
+}
 
-	transfer->req_id = g_obex_send_req(obex, req, FIRST_PACKET_TIMEOUT,
-					transfer_response, transfer, err);
-	if (transfer->req_id == 0) {
-		transfer_free(transfer);
+guint g_obex_put_req_pkt_ref(GObex *obex, GObexPacket *req,
+			GObexDataRef data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	if (g_obex_packet_get_operation(req, NULL) != G_OBEX_OP_PUT)
 		return 0;
-	}
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+	transfer = transfer_new(obex, G_OBEX_OP_PUT, complete_func, user_data);
+	transfer->data_ref = data_func;
 
-	return transfer->id;
+	return put_req_start(transfer, obex, req, err);
+}
+
+guint g_obex_put_req_pkt_fd(GObex *obex, GObexPacket *req,
+			GObexDataFd data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	if (g_obex_packet_get_operation(req, NULL) != G_OBEX_OP_PUT)
+		return 0;
+
+	transfer = transfer_new(obex, G_OBEX_OP_PUT, complete_func, user_data);
+	transfer->data_fd = data_func;
+
+	return put_req_start(transfer, obex, req, err);
 }
 
 guint g_obex_put_req(GObex *obex, GObexDataProducer data_func,
@@ -323,7 +403,6 @@ static void transfer_abort_req(GObex *obex, GObexPacket *req, gpointer user_data
 
 static guint8 put_get_bytes(struct transfer *transfer, GObexPacket *req)
 {
-	GObexHeader *body;
 	gboolean final;
 	guint8 rsp;
 	const guint8 *buf;
@@ -337,11 +416,9 @@ static guint8 put_get_bytes(struct transfer *transfer, GObexPacket *req)
 	else
 		rsp = G_OBEX_RSP_CONTINUE;
 
-	body = g_obex_packet_get_body(req);
-	if (body == NULL)
+	if (!g_obex_packet_get_body_bytes(req, &buf, &len))
 		return rsp;
 
-	g_obex_header_get_bytes(body, &buf, &len);
 	if (len == 0)
 		return rsp;
 
@@ -491,17 +568,14 @@ guint g_obex_get_req(GObex *obex, GObexDataConsumer data_func,
 	return transfer->id;
 }
 
-static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+static void get_add_body(struct transfer *transfer, GObexPacket *rsp);
+
+static gssize get_data_done(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req, *rsp;
 	GError *err = NULL;
-	gssize ret;
 	guint8 op;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
-
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret > 0) {
 		if (!g_obex_srm_active(transfer->obex))
 			return ret;
@@ -509,7 +583,7 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 		/* Generate next response */
 		rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(rsp, get_get_data, transfer);
+		get_add_body(transfer, rsp);
 
 		if (!g_obex_send(transfer->obex, rsp, &err)) {
 			transfer_complete(transfer, err);
@@ -541,6 +615,53 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 	return ret;
 }
 
+static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->data_producer(buf, len, transfer->user_data);
+
+	return get_data_done(transfer, ret);
+}
+
+static gssize get_get_ref(const void **buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->data_ref(buf, len, transfer->user_data);
+
+	return get_data_done(transfer, ret);
+}
+
+static gssize get_get_fd(int *fd, off_t *offset, gsize len,
+							gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->data_fd(fd, offset, len, transfer->user_data);
+
+	return get_data_done(transfer, ret);
+}
+
+static void get_add_body(struct transfer *transfer, GObexPacket *rsp)
+{
+	if (transfer->data_ref)
+		g_obex_packet_add_body_ref(rsp, get_get_ref, transfer);
+	else if (transfer->data_fd)
+		g_obex_packet_add_body_fd(rsp, get_get_fd, transfer);
+	else
+		g_obex_packet_add_body(rsp, get_get_data, transfer);
+}
+
 static gboolean transfer_get_req_first(struct transfer *transfer,
 							GObexPacket *rsp)
 {
@@ -548,7 +669,7 @@ static gboolean transfer_get_req_first(struct transfer *transfer,
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	get_add_body(transfer, rsp);
 
 	if (!g_obex_send(transfer->obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -568,7 +689,7 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
 	rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE, G_OBEX_HDR_INVALID);
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	get_add_body(transfer, rsp);
 
 	if (!g_obex_send(obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -576,18 +697,11 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	}
 }
 
-guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
-			GObexDataProducer data_func, GObexFunc complete_func,
-			gpointer user_data, GError **err)
+static guint get_rsp_start(struct transfer *transfer, GObex *obex,
+							GObexPacket *rsp)
 {
-	struct transfer *transfer;
 	guint id;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
-
-	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
-	transfer->data_producer = data_func;
-
 	if (!transfer_get_req_first(transfer, rsp))
 		return 0;
 
@@ -607,6 +721,48 @@ guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
 	return transfer->id;
 }
 
+guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
+			GObexDataProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->data_producer = data_func;
+
+	return get_rsp_start(transfer, obex, rsp);
+}
+
+guint g_obex_get_rsp_pkt_ref(GObex *obex, GObexPacket *rsp,
+			GObexDataRef data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->data_ref = data_func;
+
+	return get_rsp_start(transfer, obex, rsp);
+}
+
+guint g_obex_get_rsp_pkt_fd(GObex *obex, GObexPacket *rsp,
+			GObexDataFd data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->data_fd = data_func;
+
+	return get_rsp_start(transfer, obex, rsp);
+}
+
 guint g_obex_get_rsp(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint first_hdr_id, ...)
@@ -11,9 +11,12 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include "gobex.h"
 #include "gobex-debug.h"
@@ -22,6 +25,9 @@
 #define G_OBEX_MINIMUM_MTU	255
 #define G_OBEX_MAXIMUM_MTU	65535
 
+/* Packets written per socket wakeup while SRM is enabled */
+#define G_OBEX_DEFAULT_TX_WINDOW	8
+
 #define G_OBEX_DEFAULT_TIMEOUT	10
 #define G_OBEX_ABORT_TIMEOUT	5
 
@@ -64,6 +70,12 @@ struct _GObex {
 	guint8 *tx_buf;
 	size_t tx_data;
 	size_t tx_sent;
+	const guint8 *tx_body;	/* Body referenced by the packet in tx_buf */
+	size_t tx_body_len;
+	int tx_pipe[2];		/* Packet with body spliced from a file */
+	gboolean tx_spliced;
+	gboolean tx_nosplice;
+	guint tx_window;
 
 	gboolean suspended;
 	gboolean use_srm;
@@ -254,19 +266,210 @@ static gboolean req_timeout(gpointer user_data)
 	return FALSE;
 }
 
-static gboolean write_stream(GObex *obex, GError **err)
+/* Fills iov with the part of the packet in tx not written yet */
+static int tx_iov(GObex *obex, struct iovec *iov)
 {
-	GIOStatus status;
-	gsize bytes_written;
-	char *buf;
+	size_t hdr_len = obex->tx_sent + obex->tx_data - obex->tx_body_len;
+	int cnt = 0;
 
-	buf = (char *) &obex->tx_buf[obex->tx_sent];
-	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
-							&bytes_written, err);
-	if (status != G_IO_STATUS_NORMAL)
+	if (obex->tx_sent < hdr_len) {
+		iov[cnt].iov_base = obex->tx_buf + obex->tx_sent;
+		iov[cnt].iov_len = hdr_len - obex->tx_sent;
+		cnt++;
+	}
+
+	if (obex->tx_body_len > 0) {
+		size_t off = obex->tx_sent > hdr_len ?
+					obex->tx_sent - hdr_len : 0;
+
+		iov[cnt].iov_base = (void *) (obex->tx_body + off);
+		iov[cnt].iov_len = obex->tx_body_len - off;
+		cnt++;
+	}
+
+	return cnt;
+}
+
+static gssize tx_writev(GObex *obex, GError **err)
+{
+	struct iovec iov[2];
+	ssize_t ret, len;
+	int fd, i, cnt;
+
+	cnt = tx_iov(obex, iov);
+	fd = g_io_channel_unix_get_fd(obex->io);
+
+	do {
+		ret = writev(fd, iov, cnt);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		/* Retried on the next G_IO_OUT */
+		if (errno == EAGAIN)
+			return 0;
+
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+				"writev: %s (%d)", strerror(errno), errno);
+		return ret;
+	}
+
+	for (i = 0, len = ret; i < cnt && len > 0; i++) {
+		size_t dump = MIN((size_t) len, iov[i].iov_len);
+
+		g_obex_dump(G_OBEX_DEBUG_DATA, "<", iov[i].iov_base, dump);
+		len -= dump;
+	}
+
+	return ret;
+}
+
+static void tx_pipe_close(GObex *obex)
+{
+	if (obex->tx_pipe[0] < 0)
+		return;
+
+	close(obex->tx_pipe[0]);
+	close(obex->tx_pipe[1]);
+	obex->tx_pipe[0] = -1;
+	obex->tx_pipe[1] = -1;
+	obex->tx_window = G_OBEX_DEFAULT_TX_WINDOW;
+}
+
+/* Moves the encoded headers and the body from file into the pipe */
+static gboolean tx_splice_file(GObex *obex, int fd, off_t offset,
+						size_t hdr_len, size_t len)
+{
+	loff_t off = offset;
+	ssize_t ret;
+
+	if (obex->tx_pipe[0] < 0 &&
+			pipe2(obex->tx_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
 		return FALSE;
 
-	g_obex_dump(G_OBEX_DEBUG_DATA, "<", buf, bytes_written);
+	ret = write(obex->tx_pipe[1], obex->tx_buf, hdr_len);
+	if (ret != (ssize_t) hdr_len)
+		goto fail;
+
+	while (len > 0) {
+		ret = splice(fd, &off, obex->tx_pipe[1], NULL, len,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret <= 0)
+			goto fail;
+
+		len -= ret;
+	}
+
+	obex->tx_spliced = TRUE;
+
+	return TRUE;
+
+fail:
+	if (ret < 0 && errno == EINVAL) {
+		g_obex_debug(G_OBEX_DEBUG_DATA, "splice not supported");
+		obex->tx_nosplice = TRUE;
+	}
+
+	tx_pipe_close(obex);
+
+	return FALSE;
+}
+
+/*
+ * Bodies backed by a file are spliced into the socket while SRM is enabled,
+ * as responses then follow each other without waiting for the remote, and
+ * read into tx_buf otherwise.
+ */
+static gboolean g_obex_srm_enabled(GObex *obex)
+{
+	if (!obex->use_srm)
+		return FALSE;
+
+	if (obex->srm == NULL)
+		return FALSE;
+
+	return obex->srm->enabled;
+}
+
+static gboolean tx_load_file(GObex *obex, int fd, off_t offset, GError **err)
+{
+	size_t len = obex->tx_body_len;
+	size_t hdr_len = obex->tx_data - len;
+
+	obex->tx_body = NULL;
+	obex->tx_body_len = 0;
+
+	if (g_obex_srm_enabled(obex) && !obex->tx_nosplice &&
+			tx_splice_file(obex, fd, offset, hdr_len, len))
+		return TRUE;
+
+	if (pread(fd, obex->tx_buf + hdr_len, len, offset) != (ssize_t) len) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+						"Unable to read body data");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gssize tx_splice(GObex *obex, GError **err)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(obex->io);
+
+	/* Sends the header and body pages as one packet */
+	ret = splice(obex->tx_pipe[0], NULL, fd, NULL, obex->tx_data,
+							SPLICE_F_NONBLOCK);
+	if (ret >= 0) {
+		g_obex_debug(G_OBEX_DEBUG_DATA, "< %zd bytes spliced", ret);
+		return ret;
+	}
+
+	if (errno == EAGAIN)
+		return 0;
+
+	if (errno != EINVAL) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+				"splice: %s (%d)", strerror(errno), errno);
+		return ret;
+	}
+
+	/* The socket doesn't support splice, copy the packet out instead */
+	g_obex_debug(G_OBEX_DEBUG_DATA, "splice not supported, copying");
+
+	obex->tx_nosplice = TRUE;
+	obex->tx_spliced = FALSE;
+
+	ret = read(obex->tx_pipe[0], obex->tx_buf, obex->tx_data);
+	tx_pipe_close(obex);
+
+	if (ret != (ssize_t) obex->tx_data) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+						"Unable to copy packet");
+		return -1;
+	}
+
+	obex->tx_sent = 0;
+
+	return tx_writev(obex, err);
+}
+
+static gssize tx_send(GObex *obex, GError **err)
+{
+	if (obex->tx_spliced)
+		return tx_splice(obex, err);
+
+	return tx_writev(obex, err);
+}
+
+static gboolean write_stream(GObex *obex, GError **err)
+{
+	gssize bytes_written;
+
+	bytes_written = tx_send(obex, err);
+	if (bytes_written < 0)
+		return FALSE;
 
 	obex->tx_sent += bytes_written;
 	obex->tx_data -= bytes_written;
@@ -276,20 +479,17 @@ static gboolean write_stream(GObex *obex, GError **err)
 
 static gboolean write_packet(GObex *obex, GError **err)
 {
-	GIOStatus status;
-	gsize bytes_written;
-	char *buf;
+	gssize bytes_written;
 
-	buf = (char *) &obex->tx_buf[obex->tx_sent];
-	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
-							&bytes_written, err);
-	if (status != G_IO_STATUS_NORMAL)
-		return FALSE;
+	bytes_written = tx_send(obex, err);
+	if (bytes_written <= 0)
+		return bytes_written == 0;
 
-	if (bytes_written != obex->tx_data)
+	if ((size_t) bytes_written != obex->tx_data) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+					"Packet partially written");
 		return FALSE;
-
-	g_obex_dump(G_OBEX_DEBUG_DATA, "<", buf, bytes_written);
+	}
 
 	obex->tx_sent += bytes_written;
 	obex->tx_data -= bytes_written;
@@ -353,17 +553,6 @@ done:
 	obex->srm = NULL;
 }
 
-static gboolean g_obex_srm_enabled(GObex *obex)
-{
-	if (!obex->use_srm)
-		return FALSE;
-
-	if (obex->srm == NULL)
-		return FALSE;
-
-	return obex->srm->enabled;
-}
-
 static void check_srm_final(GObex *obex, guint8 op)
 {
 	if (!g_obex_srm_enabled(obex))
@@ -421,6 +610,7 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 	GObex *obex = user_data;
 	struct pending_pkt *p = NULL;
 	GError *err = NULL;
+	guint sent = 0;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
@@ -428,8 +618,12 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 	if (cond & (G_IO_HUP | G_IO_ERR))
 		goto stop_tx;
 
+next:
 	if (obex->tx_data == 0) {
+		struct iovec iov[2];
 		ssize_t len;
+		off_t offset;
+		int fd;
 
 		p = g_queue_pop_head(obex->tx_queue);
 		if (p == NULL)
@@ -447,7 +641,8 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 		}
 
 encode:
-		len = g_obex_packet_encode(p->pkt, obex->tx_buf, obex->tx_mtu);
+		len = g_obex_packet_encode_iov(p->pkt, obex->tx_buf,
+							obex->tx_mtu, iov);
 		if (len == -EAGAIN) {
 			g_queue_push_head(obex->tx_queue, p);
 			g_obex_suspend(obex);
@@ -459,6 +654,8 @@ encode:
 			goto done;
 		}
 
+		fd = g_obex_packet_get_body_fd(p->pkt, &offset);
+
 		if (p->id > 0) {
 			if (obex->pending_req != NULL)
 				pending_pkt_free(obex->pending_req);
@@ -477,6 +674,13 @@ encode:
 
 		obex->tx_data = len;
 		obex->tx_sent = 0;
+		obex->tx_body = iov[1].iov_base;
+		obex->tx_body_len = iov[1].iov_len;
+		obex->tx_spliced = FALSE;
+
+		if (obex->tx_body_len > 0 && obex->tx_body == NULL &&
+				!tx_load_file(obex, fd, offset, &err))
+			goto failed;
 	}
 
 	if (obex->suspended) {
@@ -484,18 +688,19 @@ encode:
 		return FALSE;
 	}
 
-	if (!obex->write(obex, &err)) {
-		g_obex_debug(G_OBEX_DEBUG_ERROR, "%s", err->message);
-
-		if (p) {
-			if (p->rsp_func)
-				p->rsp_func(obex, err, NULL, p->rsp_data);
-
-			pending_pkt_free(p);
-		}
+	if (!obex->write(obex, &err))
+		goto failed;
 
-		g_error_free(err);
-		goto stop_tx;
+	/*
+	 * With SRM responses don't need to be waited for, so keep the socket
+	 * busy with the packets queued meanwhile, which includes the one the
+	 * transfer producer has just generated while encoding.
+	 */
+	if (obex->tx_data == 0 && ++sent < obex->tx_window &&
+				g_obex_srm_enabled(obex) && !obex->suspended &&
+				g_queue_get_length(obex->tx_queue) > 0) {
+		p = NULL;
+		goto next;
 	}
 
 done:
@@ -503,10 +708,27 @@ done:
 		return TRUE;
 
 stop_tx:
+	/* Drop whatever is left of a spliced packet */
+	if (obex->tx_spliced && obex->tx_data > 0)
+		tx_pipe_close(obex);
+
 	obex->rx_last_op = G_OBEX_OP_NONE;
 	obex->tx_data = 0;
 	obex->write_source = 0;
 	return FALSE;
+
+failed:
+	g_obex_debug(G_OBEX_DEBUG_ERROR, "%s", err->message);
+
+	if (p) {
+		if (p->rsp_func)
+			p->rsp_func(obex, err, NULL, p->rsp_data);
+
+		pending_pkt_free(p);
+	}
+
+	g_error_free(err);
+	goto stop_tx;
 }
 
 static void enable_tx(GObex *obex)
@@ -1011,6 +1233,13 @@ done:
 		enable_tx(obex);
 }
 
+void g_obex_set_tx_window(GObex *obex, guint window)
+{
+	g_obex_debug(G_OBEX_DEBUG_COMMAND, "window %u", window);
+
+	obex->tx_window = window ? window : 1;
+}
+
 gboolean g_obex_srm_active(GObex *obex)
 {
 	gboolean ret = FALSE;
@@ -1482,6 +1711,8 @@ GObex *g_obex_new(GIOChannel *io, GObexTransportType transport_type,
 	obex->tx_queue = g_queue_new();
 	obex->rx_buf = g_malloc(obex->rx_mtu);
 	obex->tx_buf = g_malloc(obex->tx_mtu);
+	obex->tx_pipe[0] = -1;
+	obex->tx_pipe[1] = -1;
 
 	switch (transport_type) {
 	case G_OBEX_TRANSPORT_STREAM:
@@ -1554,6 +1785,8 @@ void g_obex_unref(GObex *obex)
 	g_free(obex->tx_buf);
 	g_free(obex->srm);
 
+	tx_pipe_close(obex);
+
 	if (obex->pending_req)
 		pending_pkt_free(obex->pending_req);
 
@@ -1265,6 +1265,408 @@ done:
 	return 0;
 }
 
+enum {
+	HCI_REQ_QUEUED,
+	HCI_REQ_SENT,
+	HCI_REQ_EVENT,		/* Waiting for the request event */
+};
+
+struct hci_req_entry {
+	struct hci_request *req;
+	uint16_t opcode;
+	int state;
+	hci_req_func_t func;
+	void *user_data;
+	struct hci_req_entry *next;
+};
+
+struct hci_req_queue {
+	int dd;
+	struct hci_filter of;
+	int credits;		/* Num_HCI_Command_Packets */
+	int flushing;
+	struct hci_req_entry *head;
+	hci_event_func_t func;
+	void *user_data;
+};
+
+struct hci_req_queue *hci_req_queue_new(int dd, hci_event_func_t func,
+							void *user_data)
+{
+	struct hci_req_queue *q;
+	struct hci_filter nf;
+	socklen_t olen;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return NULL;
+
+	olen = sizeof(q->of);
+	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &q->of, &olen) < 0)
+		goto failed;
+
+	/*
+	 * Keep what the socket already receives so those events can be
+	 * passed on instead of being dropped, the opcode filter is cleared
+	 * since several commands can be outstanding.
+	 */
+	nf = q->of;
+	hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+	hci_filter_set_event(EVT_CMD_STATUS, &nf);
+	hci_filter_set_event(EVT_CMD_COMPLETE, &nf);
+	hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+	hci_filter_set_opcode(0, &nf);
+	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0)
+		goto failed;
+
+	q->dd = dd;
+	q->credits = 1;
+	q->func = func;
+	q->user_data = user_data;
+
+	return q;
+
+failed:
+	free(q);
+	return NULL;
+}
+
+static void hci_req_complete(struct hci_req_queue *q, struct hci_req_entry *e,
+					const void *data, int len, int err)
+{
+	struct hci_req_entry **p;
+
+	for (p = &q->head; *p; p = &(*p)->next) {
+		if (*p == e) {
+			*p = e->next;
+			break;
+		}
+	}
+
+	if (err || len < 0)
+		len = 0;
+
+	e->req->rlen = MIN(len, e->req->rlen);
+	if (e->req->rlen)
+		memcpy(e->req->rparam, data, e->req->rlen);
+
+	if (e->func)
+		e->func(e->req, err, e->user_data);
+
+	free(e);
+}
+
+void hci_req_queue_free(struct hci_req_queue *q)
+{
+	if (!q)
+		return;
+
+	while (q->head)
+		hci_req_complete(q, q->head, NULL, 0, ECANCELED);
+
+	setsockopt(q->dd, SOL_HCI, HCI_FILTER, &q->of, sizeof(q->of));
+	free(q);
+}
+
+static void hci_req_queue_flush(struct hci_req_queue *q)
+{
+	struct hci_req_entry *e = q->head;
+
+	/* Completion callbacks may submit new requests */
+	if (q->flushing)
+		return;
+
+	q->flushing = 1;
+
+	while (e && q->credits > 0) {
+		struct hci_request *r = e->req;
+		struct hci_req_entry *next = e->next;
+
+		if (e->state != HCI_REQ_QUEUED) {
+			e = next;
+			continue;
+		}
+
+		if (hci_send_cmd(q->dd, r->ogf, r->ocf, r->clen,
+							r->cparam) < 0) {
+			hci_req_complete(q, e, NULL, 0, errno);
+			e = next;
+			continue;
+		}
+
+		e->state = HCI_REQ_SENT;
+		q->credits--;
+		e = next;
+	}
+
+	q->flushing = 0;
+}
+
+int hci_req_queue_submit(struct hci_req_queue *q, struct hci_request *req,
+					hci_req_func_t func, void *user_data)
+{
+	struct hci_req_entry *e, **p;
+	struct hci_filter nf;
+	socklen_t olen;
+
+	if (!q || !req) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	olen = sizeof(nf);
+	if (getsockopt(q->dd, SOL_HCI, HCI_FILTER, &nf, &olen) < 0)
+		return -1;
+
+	hci_filter_set_event(req->event, &nf);
+	if (setsockopt(q->dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0)
+		return -1;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return -1;
+
+	e->req = req;
+	e->opcode = htobs(cmd_opcode_pack(req->ogf, req->ocf));
+	e->state = HCI_REQ_QUEUED;
+	e->func = func;
+	e->user_data = user_data;
+
+	for (p = &q->head; *p; p = &(*p)->next)
+		;
+	*p = e;
+
+	hci_req_queue_flush(q);
+
+	return 0;
+}
+
+int hci_req_queue_pending(struct hci_req_queue *q)
+{
+	struct hci_req_entry *e;
+	int count = 0;
+
+	if (!q)
+		return 0;
+
+	for (e = q->head; e; e = e->next)
+		count++;
+
+	return count;
+}
+
+static struct hci_req_entry *hci_req_find(struct hci_req_queue *q, int state,
+							uint16_t opcode)
+{
+	struct hci_req_entry *e;
+
+	for (e = q->head; e; e = e->next) {
+		if (e->state == state && e->opcode == opcode)
+			return e;
+	}
+
+	return NULL;
+}
+
+static struct hci_req_entry *hci_req_find_event(struct hci_req_queue *q,
+						int event, int le,
+						const bdaddr_t *bdaddr)
+{
+	struct hci_req_entry *e;
+
+	for (e = q->head; e; e = e->next) {
+		remote_name_req_cp *cp = e->req->cparam;
+
+		if (e->state != HCI_REQ_EVENT || e->req->event != event)
+			continue;
+
+		/* LE requests wait for a subevent of the LE Meta event */
+		if ((e->req->ogf == OGF_LE_CTL) != !!le)
+			continue;
+
+		if (bdaddr && bacmp(&cp->bdaddr, bdaddr))
+			continue;
+
+		return e;
+	}
+
+	return NULL;
+}
+
+static int hci_req_process_event(struct hci_req_queue *q,
+					unsigned char *buf, int len)
+{
+	hci_event_hdr *hdr = (void *) (buf + 1);
+	unsigned char *ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
+	struct hci_req_entry *e;
+	evt_cmd_complete *cc;
+	evt_cmd_status *cs;
+	evt_remote_name_req_complete *rn;
+	evt_le_meta_event *me;
+
+	if (len < 1 + HCI_EVENT_HDR_SIZE || buf[0] != HCI_EVENT_PKT)
+		return 0;
+
+	len -= (1 + HCI_EVENT_HDR_SIZE);
+
+	switch (hdr->evt) {
+	case EVT_CMD_STATUS:
+		if (len < EVT_CMD_STATUS_SIZE)
+			return 0;
+
+		cs = (void *) ptr;
+		q->credits = cs->ncmd;
+
+		e = hci_req_find(q, HCI_REQ_SENT, cs->opcode);
+		if (!e)
+			return 0;
+
+		if (e->req->event == EVT_CMD_STATUS)
+			hci_req_complete(q, e, ptr, len, 0);
+		else if (cs->status)
+			hci_req_complete(q, e, NULL, 0, EIO);
+		else
+			e->state = HCI_REQ_EVENT;
+
+		return 1;
+
+	case EVT_CMD_COMPLETE:
+		if (len < EVT_CMD_COMPLETE_SIZE)
+			return 0;
+
+		cc = (void *) ptr;
+		q->credits = cc->ncmd;
+
+		e = hci_req_find(q, HCI_REQ_SENT, cc->opcode);
+		if (!e)
+			return 0;
+
+		hci_req_complete(q, e, ptr + EVT_CMD_COMPLETE_SIZE,
+					len - EVT_CMD_COMPLETE_SIZE, 0);
+		return 1;
+
+	case EVT_REMOTE_NAME_REQ_COMPLETE:
+		if (len < 1 + (int) sizeof(bdaddr_t))
+			return 0;
+
+		rn = (void *) ptr;
+
+		e = hci_req_find_event(q, hdr->evt, 0, &rn->bdaddr);
+		if (!e)
+			return 0;
+
+		hci_req_complete(q, e, ptr, len, 0);
+		return 1;
+
+	case EVT_LE_META_EVENT:
+		if (len < EVT_LE_META_EVENT_SIZE)
+			return 0;
+
+		me = (void *) ptr;
+
+		e = hci_req_find_event(q, me->subevent, 1, NULL);
+		if (!e)
+			return 0;
+
+		hci_req_complete(q, e, me->data, len - 1, 0);
+		return 1;
+
+	default:
+		e = hci_req_find_event(q, hdr->evt, 0, NULL);
+		if (!e)
+			return 0;
+
+		hci_req_complete(q, e, ptr, len, 0);
+		return 1;
+	}
+}
+
+int hci_req_queue_process(struct hci_req_queue *q)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE];
+	int len;
+
+	if (!q) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while ((len = recv(q->dd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		if (!hci_req_process_event(q, buf, len) && q->func)
+			q->func(buf, len, q->user_data);
+	}
+
+	if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+							errno != EINTR)
+		return -1;
+
+	/* Completions may have returned command credits */
+	hci_req_queue_flush(q);
+
+	return 0;
+}
+
+static void hci_req_batch_complete(struct hci_request *req, int err,
+							void *user_data)
+{
+	int *result = user_data;
+
+	if (err && !*result)
+		*result = err;
+}
+
+int hci_send_req_batch(int dd, struct hci_request *reqs, int count, int to)
+{
+	struct hci_req_queue *q;
+	int i, err = 0;
+
+	q = hci_req_queue_new(dd, NULL, NULL);
+	if (!q)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (hci_req_queue_submit(q, &reqs[i], hci_req_batch_complete,
+								&err) < 0) {
+			err = errno;
+			goto done;
+		}
+	}
+
+	while (hci_req_queue_pending(q)) {
+		struct pollfd p;
+		int n;
+
+		p.fd = dd; p.events = POLLIN;
+		while ((n = poll(&p, 1, to ? to : -1)) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			err = errno;
+			goto done;
+		}
+
+		if (!n) {
+			err = ETIMEDOUT;
+			goto done;
+		}
+
+		if (hci_req_queue_process(q) < 0) {
+			err = errno;
+			goto done;
+		}
+	}
+
+done:
+	i = err;
+	hci_req_queue_free(q);
+
+	if (i) {
+		errno = i;
+		return -1;
+	}
+
+	return 0;
+}
+
 int hci_create_connection(int dd, const bdaddr_t *bdaddr, uint16_t ptype,
 				uint16_t clkoffset, uint8_t rswitch,
 				uint16_t *handle, int to)
@@ -40,6 +40,27 @@ int hci_close_dev(int dd);
 int hci_send_cmd(int dd, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param);
 int hci_send_req(int dd, struct hci_request *req, int timeout);
 
+/*
+ * Asynchronous command submission. Commands are sent as long as the
+ * controller reports free command slots and are completed from
+ * hci_req_queue_process() once the socket becomes readable. Events that
+ * do not complete a request are passed to the event callback.
+ */
+struct hci_req_queue;
+
+typedef void (*hci_req_func_t)(struct hci_request *req, int err,
+							void *user_data);
+typedef void (*hci_event_func_t)(const void *buf, int len, void *user_data);
+
+struct hci_req_queue *hci_req_queue_new(int dd, hci_event_func_t func,
+							void *user_data);
+void hci_req_queue_free(struct hci_req_queue *q);
+int hci_req_queue_submit(struct hci_req_queue *q, struct hci_request *req,
+					hci_req_func_t func, void *user_data);
+int hci_req_queue_pending(struct hci_req_queue *q);
+int hci_req_queue_process(struct hci_req_queue *q);
+int hci_send_req_batch(int dd, struct hci_request *reqs, int count, int to);
+
 int hci_create_connection(int dd, const bdaddr_t *bdaddr, uint16_t ptype, uint16_t clkoffset, uint8_t rswitch, uint16_t *handle, int to);
 int hci_disconnect(int dd, uint16_t handle, uint8_t reason, int to);
 
@@ -1356,6 +1356,141 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	return elem;
 }
 
+/*
+ * Return the total length of the data element at p, header included, or 0
+ * if it is malformed or does not fit in bufsize.
+ */
+static int element_size(const uint8_t *p, int bufsize)
+{
+	static const uint8_t fixed_size[] = { 1, 2, 4, 8, 16 };
+	int hdr = sizeof(uint8_t);
+	uint32_t len;
+	uint8_t dtd;
+
+	if (bufsize < hdr)
+		return 0;
+
+	dtd = *p;
+	if (dtd == SDP_DATA_NIL)
+		return hdr;
+
+	if ((dtd >> 3) > (SDP_URL_STR8 >> 3))
+		return 0;
+
+	switch (dtd & 0x07) {
+	case 5:
+		if (bufsize < hdr + (int) sizeof(uint8_t))
+			return 0;
+		len = p[1];
+		hdr += sizeof(uint8_t);
+		break;
+	case 6:
+		if (bufsize < hdr + (int) sizeof(uint16_t))
+			return 0;
+		len = bt_get_be16(p + 1);
+		hdr += sizeof(uint16_t);
+		break;
+	case 7:
+		if (bufsize < hdr + (int) sizeof(uint32_t))
+			return 0;
+		len = bt_get_be32(p + 1);
+		hdr += sizeof(uint32_t);
+		break;
+	default:
+		len = fixed_size[dtd & 0x07];
+		break;
+	}
+
+	if (len > (uint32_t) (bufsize - hdr))
+		return 0;
+
+	return hdr + len;
+}
+
+int sdp_record_view_init(sdp_record_view_t *view, const uint8_t *buf,
+								int bufsize)
+{
+	int scanned, seqlen = 0;
+	uint8_t dtd;
+
+	scanned = sdp_extract_seqtype(buf, bufsize, &dtd, &seqlen);
+	if (!scanned || !SDP_IS_SEQ(dtd))
+		return 0;
+
+	if (seqlen > bufsize - scanned)
+		return 0;
+
+	view->attrs = buf + scanned;
+	view->size = seqlen;
+
+	return scanned + seqlen;
+}
+
+int sdp_record_view_find(const sdp_record_view_t *view, uint16_t attr,
+					const uint8_t **val, int *len)
+{
+	const uint8_t *p = view->attrs;
+	int left = view->size;
+
+	while (left >= 3) {
+		int n;
+
+		if (*p != SDP_UINT16)
+			break;
+
+		n = element_size(p + 3, left - 3);
+		if (!n)
+			break;
+
+		if (bt_get_be16(p + 1) == attr) {
+			*val = p + 3;
+			*len = n;
+			return 0;
+		}
+
+		p += 3 + n;
+		left -= 3 + n;
+	}
+
+	return -1;
+}
+
+int sdp_record_view_svclass(const sdp_record_view_t *view, uuid_t *uuid)
+{
+	const uint8_t *val;
+	int len, scanned, seqlen = 0, n = 0;
+	uint8_t dtd;
+
+	if (sdp_record_view_find(view, SDP_ATTR_SVCLASS_ID_LIST, &val,
+								&len) < 0)
+		return -1;
+
+	scanned = sdp_extract_seqtype(val, len, &dtd, &seqlen);
+	if (!scanned || !SDP_IS_SEQ(dtd) || !seqlen)
+		return -1;
+
+	if (!SDP_IS_UUID(val[scanned]))
+		return -1;
+
+	return sdp_uuid_extract(val + scanned, len - scanned, uuid, &n);
+}
+
+sdp_data_t *sdp_record_view_get(const sdp_record_view_t *view, uint16_t attr)
+{
+	const uint8_t *val;
+	sdp_data_t *d;
+	int len, n = 0;
+
+	if (sdp_record_view_find(view, attr, &val, &len) < 0)
+		return NULL;
+
+	d = sdp_extract_attr(val, len, &n, NULL);
+	if (d)
+		d->attrId = attr;
+
+	return d;
+}
+
 #ifdef SDP_DEBUG
 static void attr_print_func(void *value, void *userData)
 {
@@ -3336,6 +3471,33 @@ typedef struct {
 	unsigned char data[16];
 } __attribute__ ((packed)) sdp_cstate_t;
 
+/*
+ * Append a continuation fragment to a split response. The buffer grows
+ * geometrically so long responses are not reallocated for every PDU.
+ */
+static int concat_rsp(sdp_buf_t *buf, const uint8_t *data, uint32_t len)
+{
+	if (buf->data_size + len > buf->buf_size) {
+		uint32_t size = buf->buf_size ? buf->buf_size : len;
+		uint8_t *tmp;
+
+		while (size < buf->data_size + len)
+			size *= 2;
+
+		tmp = realloc(buf->data, size);
+		if (!tmp)
+			return -1;
+
+		buf->data = tmp;
+		buf->buf_size = size;
+	}
+
+	memcpy(buf->data + buf->data_size, data, len);
+	buf->data_size += len;
+
+	return 0;
+}
+
 static int copy_cstate(uint8_t *pdata, int pdata_len, const sdp_cstate_t *cstate)
 {
 	if (cstate) {
@@ -3666,16 +3828,13 @@ sdp_record_t *sdp_service_attr_req(sdp_session_t *session, uint32_t handle,
 		 * and the last one (which has cstate_len == 0)
 		 */
 		if (cstate_len > 0 || rsp_concat_buf.data_size != 0) {
-			uint8_t *targetPtr = NULL;
-
 			cstate = cstate_len > 0 ? (sdp_cstate_t *) (pdata + rsp_count) : 0;
 
 			/* build concatenated response buffer */
-			rsp_concat_buf.data = realloc(rsp_concat_buf.data, rsp_concat_buf.data_size + rsp_count);
-			rsp_concat_buf.buf_size = rsp_concat_buf.data_size + rsp_count;
-			targetPtr = rsp_concat_buf.data + rsp_concat_buf.data_size;
-			memcpy(targetPtr, pdata, rsp_count);
-			rsp_concat_buf.data_size += rsp_count;
+			if (concat_rsp(&rsp_concat_buf, pdata, rsp_count) < 0) {
+				errno = ENOMEM;
+				goto end;
+			}
 		}
 	} while (cstate);
 
@@ -4150,7 +4309,7 @@ int sdp_process(sdp_session_t *session)
 	struct sdp_transaction *t;
 	sdp_pdu_hdr_t *reqhdr, *rsphdr;
 	sdp_cstate_t *pcstate;
-	uint8_t *pdata, *rspbuf, *targetPtr;
+	uint8_t *pdata, *rspbuf;
 	int rsp_count, err = -1;
 	size_t size = 0;
 	int n, plen;
@@ -4312,11 +4471,11 @@ int sdp_process(sdp_session_t *session)
 	 * This is a split response, need to concatenate intermediate
 	 * responses and the last one which will have cstate length == 0
 	 */
-	t->rsp_concat_buf.data = realloc(t->rsp_concat_buf.data, t->rsp_concat_buf.data_size + rsp_count);
-	targetPtr = t->rsp_concat_buf.data + t->rsp_concat_buf.data_size;
-	t->rsp_concat_buf.buf_size = t->rsp_concat_buf.data_size + rsp_count;
-	memcpy(targetPtr, pdata, rsp_count);
-	t->rsp_concat_buf.data_size += rsp_count;
+	if (concat_rsp(&t->rsp_concat_buf, pdata, rsp_count) < 0) {
+		t->err = ENOMEM;
+		status = 0xffff;
+		goto end;
+	}
 
 	if (pcstate->length > 0) {
 		int reqsize, cstate_len;
@@ -4529,16 +4688,14 @@ int sdp_service_search_attr_req(sdp_session_t *session, const sdp_list_t *search
 		 * responses and the last one which will have cstate_len == 0
 		 */
 		if (cstate_len > 0 || rsp_concat_buf.data_size != 0) {
-			uint8_t *targetPtr = NULL;
-
 			cstate = cstate_len > 0 ? (sdp_cstate_t *) (pdata + rsp_count) : 0;
 
 			/* build concatenated response buffer */
-			rsp_concat_buf.data = realloc(rsp_concat_buf.data, rsp_concat_buf.data_size + rsp_count);
-			targetPtr = rsp_concat_buf.data + rsp_concat_buf.data_size;
-			rsp_concat_buf.buf_size = rsp_concat_buf.data_size + rsp_count;
-			memcpy(targetPtr, pdata, rsp_count);
-			rsp_concat_buf.data_size += rsp_count;
+			if (concat_rsp(&rsp_concat_buf, pdata, rsp_count) < 0) {
+				errno = ENOMEM;
+				status = -1;
+				goto end;
+			}
 		}
 	} while (cstate);
 
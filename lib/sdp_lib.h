@@ -588,6 +588,40 @@ int sdp_set_supp_feat(sdp_record_t *rec, const sdp_list_t *sf);
 int sdp_get_supp_feat(const sdp_record_t *rec, sdp_list_t **seqp);
 
 sdp_record_t *sdp_extract_pdu(const uint8_t *pdata, int bufsize, int *scanned);
+
+/*
+ * Read-only view of a raw service record. The attribute list is walked
+ * in place and attributes are only decoded on request, so records can
+ * be inspected without building the sdp_data_t tree.
+ */
+typedef struct {
+	const uint8_t *attrs;
+	int size;
+} sdp_record_view_t;
+
+/*
+ * Set up a view on the record at buf. Returns the record length including
+ * the sequence header, or 0 if the record is malformed or truncated.
+ */
+int sdp_record_view_init(sdp_record_view_t *view, const uint8_t *buf, int bufsize);
+
+/*
+ * Look up the raw data element of an attribute. Returns 0 and points val
+ * into the record on success, -1 if the attribute is not present.
+ */
+int sdp_record_view_find(const sdp_record_view_t *view, uint16_t attr, const uint8_t **val, int *len);
+
+/*
+ * Get the first UUID of the service class ID list. Returns 0 on success
+ * or -1 if the record does not have one.
+ */
+int sdp_record_view_svclass(const sdp_record_view_t *view, uuid_t *uuid);
+
+/*
+ * Decode a single attribute. Returns NULL if it is not present, otherwise
+ * the caller owns the result and frees it with sdp_data_free().
+ */
+sdp_data_t *sdp_record_view_get(const sdp_record_view_t *view, uint16_t attr);
 sdp_record_t *sdp_copy_record(sdp_record_t *rec);
 
 void sdp_data_print(sdp_data_t *data);
@@ -15,6 +15,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 
 #include "lib/bluetooth.h"
@@ -110,9 +111,64 @@ int bt_uuid128_create(bt_uuid_t *btuuid, uint128_t value)
 	return 0;
 }
 
+/*
+ * Get the 32-bit value of UUIDs based on the Bluetooth Base UUID, which
+ * orders the same way as their 128-bit form.
+ */
+static bool bt_uuid_to_base32(const bt_uuid_t *uuid, uint32_t *val)
+{
+	const uint8_t *data = uuid->value.u128.data;
+	uint32_t be32;
+
+	switch (uuid->type) {
+	case BT_UUID16:
+		*val = uuid->value.u16;
+		return true;
+	case BT_UUID32:
+		*val = uuid->value.u32;
+		return true;
+	case BT_UUID128:
+		if (memcmp(&data[4], &bluetooth_base_uuid.data[4], 12))
+			return false;
+
+		memcpy(&be32, &data[BASE_UUID32_OFFSET], sizeof(be32));
+		*val = ntohl(be32);
+		return true;
+	case BT_UUID_UNSPEC:
+	default:
+		return false;
+	}
+}
+
+static int bt_uuid32_cmp(uint32_t v1, uint32_t v2)
+{
+	return (v1 > v2) - (v1 < v2);
+}
+
 int bt_uuid_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
 {
 	bt_uuid_t u1, u2;
+	uint32_t v1, v2;
+
+	/* Avoid converting when both UUIDs have the same size */
+	if (uuid1->type == uuid2->type) {
+		switch (uuid1->type) {
+		case BT_UUID16:
+			return bt_uuid32_cmp(uuid1->value.u16,
+						uuid2->value.u16);
+		case BT_UUID32:
+			return bt_uuid32_cmp(uuid1->value.u32,
+						uuid2->value.u32);
+		case BT_UUID128:
+			return bt_uuid128_cmp(uuid1, uuid2);
+		case BT_UUID_UNSPEC:
+		default:
+			break;
+		}
+	}
+
+	if (bt_uuid_to_base32(uuid1, &v1) && bt_uuid_to_base32(uuid2, &v2))
+		return bt_uuid32_cmp(v1, v2);
 
 	bt_uuid_to_uuid128(uuid1, &u1);
 	bt_uuid_to_uuid128(uuid2, &u2);
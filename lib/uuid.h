@@ -115,6 +115,7 @@ extern "C" {
 #define GATT_CHARAC_HARDWARE_REVISION_STRING		0x2A27
 #define GATT_CHARAC_SOFTWARE_REVISION_STRING		0x2A28
 #define GATT_CHARAC_MANUFACTURER_NAME_STRING		0x2A29
+#define GATT_CHARAC_REPORT_MAP				0x2A4B
 #define GATT_CHARAC_PNP_ID				0x2A50
 #define GATT_CHARAC_CAR					0x2AA6
 
@@ -28,9 +28,9 @@
 struct mesh_app_key {
 	uint16_t net_idx;
 	uint16_t app_idx;
-	uint8_t key[16];
+	struct mesh_crypto_key key;
 	uint8_t key_aid;
-	uint8_t new_key[16];
+	struct mesh_crypto_key new_key;
 	uint8_t new_key_aid;
 };
 
@@ -65,7 +65,10 @@ static void finalize_key(void *a, void *b)
 
 	key->new_key_aid = APP_AID_INVALID;
 
-	memcpy(key->key, key->new_key, 16);
+	/* The contexts of the new key move over with it */
+	mesh_crypto_key_clear(&key->key);
+	key->key = key->new_key;
+	mesh_crypto_key_init(&key->new_key, key->key.key);
 }
 
 void appkey_finalize(struct mesh_net *net, uint16_t net_idx)
@@ -90,6 +93,7 @@ static struct mesh_app_key *app_key_new(void)
 static bool set_key(struct mesh_app_key *key, uint16_t app_idx,
 			const uint8_t *key_value, bool is_new)
 {
+	struct mesh_crypto_key *ctx;
 	uint8_t key_aid;
 
 	if (!mesh_crypto_k4(key_value, &key_aid))
@@ -101,7 +105,9 @@ static bool set_key(struct mesh_app_key *key, uint16_t app_idx,
 	else
 		key->new_key_aid = key_aid;
 
-	memcpy(is_new ? key->new_key : key->key, key_value, 16);
+	ctx = is_new ? &key->new_key : &key->key;
+	mesh_crypto_key_clear(ctx);
+	mesh_crypto_key_init(ctx, key_value);
 
 	return true;
 }
@@ -113,6 +119,8 @@ void appkey_key_free(void *data)
 	if (!key)
 		return;
 
+	mesh_crypto_key_clear(&key->key);
+	mesh_crypto_key_clear(&key->new_key);
 	l_free(key);
 }
 
@@ -150,7 +158,7 @@ bool appkey_key_init(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 	return true;
 }
 
-const uint8_t *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
+struct mesh_crypto_key *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
 							uint8_t *key_aid)
 {
 	struct mesh_app_key *app_key;
@@ -172,30 +180,31 @@ const uint8_t *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
 
 	if (phase != KEY_REFRESH_PHASE_TWO) {
 		*key_aid = app_key->key_aid;
-		return app_key->key;
+		return &app_key->key;
 	}
 
 	if (app_key->new_key_aid == APP_AID_INVALID)
 		return NULL;
 
 	*key_aid = app_key->new_key_aid;
-	return app_key->new_key;
+	return &app_key->new_key;
 }
 
 int appkey_get_key_idx(struct mesh_app_key *app_key,
-				const uint8_t **key, uint8_t *key_aid,
-				const uint8_t **new_key, uint8_t *new_key_aid)
+				struct mesh_crypto_key **key, uint8_t *key_aid,
+				struct mesh_crypto_key **new_key,
+				uint8_t *new_key_aid)
 {
 	if (!app_key)
 		return -1;
 
 	if (key && key_aid) {
-		*key = app_key->key;
+		*key = &app_key->key;
 		*key_aid = app_key->key_aid;
 	}
 
 	if (new_key && new_key_aid) {
-		*new_key = app_key->new_key;
+		*new_key = &app_key->new_key;
 		*new_key_aid = app_key->new_key_aid;
 	}
 
@@ -264,7 +273,7 @@ int appkey_key_update(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 		return MESH_STATUS_CANNOT_UPDATE;
 
 	/* Check if the key has been already successfully updated */
-	if (memcmp(new_key, key->new_key, 16) == 0)
+	if (memcmp(new_key, key->new_key.key, 16) == 0)
 		return MESH_STATUS_SUCCESS;
 
 	if (!set_key(key, app_idx, new_key, true))
@@ -292,7 +301,7 @@ int appkey_key_add(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 
 	key = l_queue_find(app_keys, match_key_index, L_UINT_TO_PTR(app_idx));
 	if (key) {
-		if (memcmp(new_key, key->key, 16) == 0)
+		if (memcmp(new_key, key->key.key, 16) == 0)
 			return MESH_STATUS_SUCCESS;
 		else
 			return MESH_STATUS_IDX_ALREADY_STORED;
@@ -12,16 +12,18 @@
 #define MAX_APP_KEYS	32
 
 struct mesh_app_key;
+struct mesh_crypto_key;
 
 bool appkey_key_init(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 				uint8_t *key_value, uint8_t *new_key_value);
 void appkey_key_free(void *data);
 void appkey_finalize(struct mesh_net *net, uint16_t net_idx);
-const uint8_t *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
+struct mesh_crypto_key *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
 							uint8_t *key_aid);
 int appkey_get_key_idx(struct mesh_app_key *app_key,
-				const uint8_t **key, uint8_t *key_aid,
-				const uint8_t **new_key, uint8_t *new_key_aid);
+				struct mesh_crypto_key **key, uint8_t *key_aid,
+				struct mesh_crypto_key **new_key,
+				uint8_t *new_key_aid);
 bool appkey_have_key(struct mesh_net *net, uint16_t app_idx);
 uint16_t appkey_net_idx(struct mesh_net *net, uint16_t app_idx);
 int appkey_key_add(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
@@ -80,16 +80,83 @@ bool mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg,
 	return aes_cmac_one(key, msg, msg_len, res);
 }
 
-bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
+void mesh_crypto_key_init(struct mesh_crypto_key *ctx, const uint8_t key[16])
+{
+	memset(ctx, 0, sizeof(*ctx));
+	memcpy(ctx->key, key, 16);
+}
+
+/* Frees the AES contexts, the key itself is kept */
+void mesh_crypto_key_clear(struct mesh_crypto_key *ctx)
+{
+	l_cipher_free(ctx->ecb);
+	l_aead_cipher_free(ctx->ccm[0]);
+	l_aead_cipher_free(ctx->ccm[1]);
+	l_checksum_free(ctx->cmac);
+
+	ctx->ecb = NULL;
+	ctx->ccm[0] = NULL;
+	ctx->ccm[1] = NULL;
+	ctx->cmac = NULL;
+}
+
+static bool key_ecb(struct mesh_crypto_key *ctx, const uint8_t in[16],
+								uint8_t out[16])
+{
+	if (!ctx->ecb)
+		ctx->ecb = l_cipher_new(L_CIPHER_AES, ctx->key, 16);
+
+	if (!ctx->ecb)
+		return false;
+
+	return l_cipher_encrypt(ctx->ecb, in, out, 16);
+}
+
+static bool key_cmac(struct mesh_crypto_key *ctx, const uint8_t *msg,
+					size_t msg_len, uint8_t res[16])
+{
+	if (!ctx->cmac)
+		ctx->cmac = l_checksum_new_cmac_aes(ctx->key, 16);
+
+	if (!ctx->cmac)
+		return false;
+
+	if (aes_cmac(ctx->cmac, msg, msg_len, res))
+		return true;
+
+	/* Don't reuse a context left in an unknown state */
+	l_checksum_free(ctx->cmac);
+	ctx->cmac = NULL;
+
+	return false;
+}
+
+static struct l_aead_cipher *key_ccm(struct mesh_crypto_key *ctx,
+							size_t mic_size)
+{
+	int i = (mic_size == 8);
+
+	if (mic_size != 4 && mic_size != 8)
+		return NULL;
+
+	if (!ctx->ccm[i])
+		ctx->ccm[i] = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM,
+						ctx->key, 16, mic_size);
+
+	return ctx->ccm[i];
+}
+
+static bool aes_ccm_encrypt(struct l_aead_cipher *cipher,
+					const uint8_t nonce[13],
 					const uint8_t *aad, uint16_t aad_len,
 					const void *msg, uint16_t msg_len,
 					void *out_msg,
 					void *out_mic, size_t mic_size)
 {
-	void *cipher;
 	bool result;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+	if (!cipher)
+		return false;
 
 	result = l_aead_cipher_encrypt(cipher, msg, msg_len, aad, aad_len,
 					nonce, 13, out_msg, msg_len + mic_size);
@@ -101,22 +168,21 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 			*(uint64_t *)out_mic = l_get_be64(out_msg + msg_len);
 	}
 
-	l_aead_cipher_free(cipher);
-
 	return result;
 }
 
-bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
+static bool aes_ccm_decrypt(struct l_aead_cipher *cipher,
+				const uint8_t nonce[13],
 				const uint8_t *aad, uint16_t aad_len,
 				const void *enc_msg, uint16_t enc_msg_len,
 				void *out_msg,
 				void *out_mic, size_t mic_size)
 {
-	void *cipher;
 	bool result;
 	size_t out_msg_len = enc_msg_len - mic_size;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+	if (!cipher)
+		return false;
 
 	result = l_aead_cipher_decrypt(cipher, enc_msg, enc_msg_len,
 							aad, aad_len, nonce, 13,
@@ -131,6 +197,42 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				l_get_be64(enc_msg + enc_msg_len - mic_size);
 	}
 
+	return result;
+}
+
+bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
+					const uint8_t *aad, uint16_t aad_len,
+					const void *msg, uint16_t msg_len,
+					void *out_msg,
+					void *out_mic, size_t mic_size)
+{
+	void *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+
+	result = aes_ccm_encrypt(cipher, nonce, aad, aad_len, msg, msg_len,
+						out_msg, out_mic, mic_size);
+
+	l_aead_cipher_free(cipher);
+
+	return result;
+}
+
+bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
+				const uint8_t *aad, uint16_t aad_len,
+				const void *enc_msg, uint16_t enc_msg_len,
+				void *out_msg,
+				void *out_mic, size_t mic_size)
+{
+	void *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+
+	result = aes_ccm_decrypt(cipher, nonce, aad, aad_len, enc_msg,
+				enc_msg_len, out_msg, out_mic, mic_size);
+
 	l_aead_cipher_free(cipher);
 
 	return result;
@@ -299,6 +401,22 @@ bool mesh_crypto_beacon_cmac(const uint8_t encryption_key[16],
 				const uint8_t network_id[8],
 				uint32_t iv_index, bool kr, bool iu,
 				uint64_t *cmac)
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, encryption_key);
+	result = mesh_crypto_beacon_cmac_ctx(&ctx, network_id, iv_index, kr,
+								iu, cmac);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
+bool mesh_crypto_beacon_cmac_ctx(struct mesh_crypto_key *beacon_key,
+				const uint8_t network_id[8],
+				uint32_t iv_index, bool kr, bool iu,
+				uint64_t *cmac)
 {
 	uint8_t msg[13], tmp[16];
 
@@ -310,7 +428,7 @@ bool mesh_crypto_beacon_cmac(const uint8_t encryption_key[16],
 	memcpy(msg + 1, network_id, 8);
 	l_put_be32(iv_index, msg + 9);
 
-	if (!aes_cmac_one(encryption_key, msg, 13, tmp))
+	if (!key_cmac(beacon_key, msg, 13, tmp))
 		return false;
 
 	*cmac = l_get_be64(tmp);
@@ -472,17 +590,17 @@ static void mesh_crypto_privacy_counter(uint32_t iv_index,
 	memcpy(privacy_counter + 9, payload, 7);
 }
 
-static bool mesh_crypto_pecb(const uint8_t privacy_key[16],
+static bool mesh_crypto_pecb(struct mesh_crypto_key *privacy_key,
 						uint32_t iv_index,
 						const uint8_t *payload,
 						uint8_t pecb[16])
 {
 	mesh_crypto_privacy_counter(iv_index, payload, pecb);
-	return aes_ecb_one(privacy_key, pecb, pecb);
+	return key_ecb(privacy_key, pecb, pecb);
 }
 
-static bool mesh_crypto_network_obfuscate(uint8_t *packet,
-						const uint8_t privacy_key[16],
+static bool network_obfuscate(uint8_t *packet,
+					struct mesh_crypto_key *privacy_key,
 						uint32_t iv_index,
 						bool ctl, uint8_t ttl,
 						uint32_t seq, uint16_t src)
@@ -504,8 +622,8 @@ static bool mesh_crypto_network_obfuscate(uint8_t *packet,
 	return true;
 }
 
-static bool mesh_crypto_network_clarify(uint8_t *packet,
-						const uint8_t privacy_key[16],
+static bool network_clarify(uint8_t *packet,
+					struct mesh_crypto_key *privacy_key,
 						uint32_t iv_index,
 						bool *ctl, uint8_t *ttl,
 						uint32_t *seq, uint16_t *src)
@@ -528,6 +646,38 @@ static bool mesh_crypto_network_clarify(uint8_t *packet,
 	return true;
 }
 
+static bool mesh_crypto_network_obfuscate(uint8_t *packet,
+						const uint8_t privacy_key[16],
+						uint32_t iv_index,
+						bool ctl, uint8_t ttl,
+						uint32_t seq, uint16_t src)
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, privacy_key);
+	result = network_obfuscate(packet, &ctx, iv_index, ctl, ttl, seq, src);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
+static bool mesh_crypto_network_clarify(uint8_t *packet,
+						const uint8_t privacy_key[16],
+						uint32_t iv_index,
+						bool *ctl, uint8_t *ttl,
+						uint32_t *seq, uint16_t *src)
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, privacy_key);
+	result = network_clarify(packet, &ctx, iv_index, ctl, ttl, seq, src);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
 bool mesh_crypto_packet_build(bool ctl, uint8_t ttl,
 				uint32_t seq,
 				uint16_t src, uint16_t dst,
@@ -720,8 +870,28 @@ bool mesh_crypto_payload_encrypt(uint8_t *aad, const uint8_t *payload,
 				uint32_t seq, uint32_t iv_index,
 				bool aszmic,
 				const uint8_t app_key[16])
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, app_key);
+	result = mesh_crypto_payload_encrypt_ctx(aad, payload, out,
+						payload_len, src, dst, key_aid,
+						seq, iv_index, aszmic, &ctx);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
+bool mesh_crypto_payload_encrypt_ctx(uint8_t *aad, const uint8_t *payload,
+				uint8_t *out, uint16_t payload_len,
+				uint16_t src, uint16_t dst, uint8_t key_aid,
+				uint32_t seq, uint32_t iv_index,
+				bool aszmic,
+				struct mesh_crypto_key *app_key)
 {
 	uint8_t nonce[13];
+	size_t mic_size = aszmic ? 8 : 4;
 
 	if (payload_len < 1)
 		return false;
@@ -733,11 +903,10 @@ bool mesh_crypto_payload_encrypt(uint8_t *aad, const uint8_t *payload,
 		mesh_crypto_application_nonce(seq, src, dst, iv_index, aszmic,
 									nonce);
 
-	if (!mesh_crypto_aes_ccm_encrypt(nonce, app_key,
+	if (!aes_ccm_encrypt(key_ccm(app_key, mic_size), nonce,
 							aad, aad ? 16 : 0,
 							payload, payload_len,
-							out, NULL,
-							aszmic ? 8 : 4))
+							out, NULL, mic_size))
 		return false;
 
 	return true;
@@ -750,6 +919,27 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 				uint8_t key_aid, uint32_t seq,
 				uint32_t iv_index, uint8_t *out,
 				const uint8_t app_key[16])
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, app_key);
+	result = mesh_crypto_payload_decrypt_ctx(aad, aad_len, payload,
+						payload_len, aszmic, src, dst,
+						key_aid, seq, iv_index, out,
+						&ctx);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
+bool mesh_crypto_payload_decrypt_ctx(uint8_t *aad, uint16_t aad_len,
+				const uint8_t *payload, uint16_t payload_len,
+				bool aszmic,
+				uint16_t src, uint16_t dst,
+				uint8_t key_aid, uint32_t seq,
+				uint32_t iv_index, uint8_t *out,
+				struct mesh_crypto_key *app_key)
 {
 	uint8_t nonce[13];
 	uint32_t mic32;
@@ -768,7 +958,7 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 	memcpy(out, payload, payload_len);
 
 	if (aszmic) {
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, app_key,
+		if (!aes_ccm_decrypt(key_ccm(app_key, sizeof(mic64)), nonce,
 					aad, aad_len,
 					payload, payload_len,
 					out, &mic64, sizeof(mic64)))
@@ -780,7 +970,7 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 		if (mic64)
 			return false;
 	} else {
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, app_key,
+		if (!aes_ccm_decrypt(key_ccm(app_key, sizeof(mic32)), nonce,
 					aad, aad_len,
 					payload, payload_len,
 					out, &mic32, sizeof(mic32)))
@@ -796,8 +986,8 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 	return true;
 }
 
-static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
-				const uint8_t network_key[16],
+static bool packet_encrypt(uint8_t *packet, uint8_t packet_len,
+				struct mesh_crypto_key *network_key,
 				uint32_t iv_index, bool proxy,
 				bool ctl, uint8_t ttl, uint32_t seq,
 				uint16_t src)
@@ -812,13 +1002,13 @@ static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
 
 	/* Check for Long net-MIC */
 	if (ctl) {
-		if (!mesh_crypto_aes_ccm_encrypt(nonce, network_key,
+		if (!aes_ccm_encrypt(key_ccm(network_key, 8), nonce,
 					NULL, 0,
 					packet + 7, packet_len - 7 - 8,
 					packet + 7, NULL, 8))
 			return false;
 	} else {
-		if (!mesh_crypto_aes_ccm_encrypt(nonce, network_key,
+		if (!aes_ccm_encrypt(key_ccm(network_key, 4), nonce,
 					NULL, 0,
 					packet + 7, packet_len - 7 - 4,
 					packet + 7, NULL, 4))
@@ -828,6 +1018,23 @@ static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
 	return true;
 }
 
+static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
+				const uint8_t network_key[16],
+				uint32_t iv_index, bool proxy,
+				bool ctl, uint8_t ttl, uint32_t seq,
+				uint16_t src)
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, network_key);
+	result = packet_encrypt(packet, packet_len, &ctx, iv_index, proxy,
+							ctl, ttl, seq, src);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
 bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
 				uint32_t iv_index,
 				const uint8_t network_key[16],
@@ -853,8 +1060,33 @@ bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
 							ctl, ttl, seq, src);
 }
 
-static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
-				const uint8_t network_key[16],
+bool mesh_crypto_packet_encode_ctx(uint8_t *packet, uint8_t packet_len,
+				uint32_t iv_index,
+				struct mesh_crypto_key *network_key,
+				struct mesh_crypto_key *privacy_key)
+{
+	bool ctl;
+	uint8_t ttl;
+	uint32_t seq;
+	uint16_t src;
+	uint16_t dst;
+
+	if (!network_header_parse(packet, packet_len,
+						&ctl, &ttl, &seq, &src, &dst))
+		return false;
+
+	if (!packet_encrypt(packet, packet_len, network_key,
+							iv_index, !dst,
+							ctl, ttl, seq, src))
+
+		return false;
+
+	return network_obfuscate(packet, privacy_key, iv_index,
+							ctl, ttl, seq, src);
+}
+
+static bool packet_decrypt(uint8_t *packet, uint8_t packet_len,
+				struct mesh_crypto_key *network_key,
 				uint32_t iv_index, bool proxy,
 				bool ctl, uint8_t ttl, uint32_t seq,
 				uint16_t src)
@@ -875,7 +1107,7 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	if (ctl) {
 		uint64_t mic;
 
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, network_key,
+		if (!aes_ccm_decrypt(key_ccm(network_key, sizeof(mic)), nonce,
 					NULL, 0,
 					packet + 7, packet_len - 7,
 					packet + 7, &mic, sizeof(mic)))
@@ -889,7 +1121,7 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	} else {
 		uint32_t mic;
 
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, network_key,
+		if (!aes_ccm_decrypt(key_ccm(network_key, sizeof(mic)), nonce,
 					NULL, 0,
 					packet + 7, packet_len - 7,
 					packet + 7, &mic, sizeof(mic)))
@@ -905,6 +1137,23 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	return true;
 }
 
+static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
+				const uint8_t network_key[16],
+				uint32_t iv_index, bool proxy,
+				bool ctl, uint8_t ttl, uint32_t seq,
+				uint16_t src)
+{
+	struct mesh_crypto_key ctx;
+	bool result;
+
+	mesh_crypto_key_init(&ctx, network_key);
+	result = packet_decrypt(packet, packet_len, &ctx, iv_index, proxy,
+							ctl, ttl, seq, src);
+	mesh_crypto_key_clear(&ctx);
+
+	return result;
+}
+
 bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 				bool proxy, uint8_t *out, uint32_t iv_index,
 				const uint8_t network_key[16],
@@ -929,6 +1178,30 @@ bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 							ctl, ttl, seq, src);
 }
 
+bool mesh_crypto_packet_decode_ctx(const uint8_t *packet, uint8_t packet_len,
+				bool proxy, uint8_t *out, uint32_t iv_index,
+				struct mesh_crypto_key *network_key,
+				struct mesh_crypto_key *privacy_key)
+{
+	bool ctl;
+	uint8_t ttl;
+	uint32_t seq;
+	uint16_t src;
+
+	if (packet_len < 14)
+		return false;
+
+	memcpy(out, packet, packet_len);
+
+	if (!network_clarify(out, privacy_key, iv_index,
+						&ctl, &ttl, &seq, &src))
+		return false;
+
+	return packet_decrypt(out, packet_len, network_key,
+							iv_index, proxy,
+							ctl, ttl, seq, src);
+}
+
 bool mesh_crypto_packet_label(uint8_t *packet, uint8_t packet_len,
 				uint16_t iv_index, uint8_t network_id)
 {
@@ -12,6 +12,17 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+/* Key with its AES contexts, which are set up on first use */
+struct mesh_crypto_key {
+	uint8_t key[16];
+	struct l_cipher *ecb;
+	struct l_aead_cipher *ccm[2];	/* 32 and 64 bit MIC */
+	struct l_checksum *cmac;
+};
+
+void mesh_crypto_key_init(struct mesh_crypto_key *ctx, const uint8_t key[16]);
+void mesh_crypto_key_clear(struct mesh_crypto_key *ctx);
+
 bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 					const uint8_t *aad, uint16_t aad_len,
 					const void *msg, uint16_t msg_len,
@@ -33,6 +44,10 @@ bool mesh_crypto_beacon_cmac(const uint8_t encryption_key[16],
 				const uint8_t network_id[8],
 				uint32_t iv_index, bool kr,
 				bool iu, uint64_t *cmac);
+bool mesh_crypto_beacon_cmac_ctx(struct mesh_crypto_key *beacon_key,
+				const uint8_t network_id[8],
+				uint32_t iv_index, bool kr,
+				bool iu, uint64_t *cmac);
 bool mesh_crypto_device_key(const uint8_t secret[32],
 						const uint8_t salt[16],
 						uint8_t device_key[16]);
@@ -83,6 +98,12 @@ bool mesh_crypto_payload_encrypt(uint8_t *aad, const uint8_t *payload,
 				uint32_t seq_num, uint32_t iv_index,
 				bool aszmic,
 				const uint8_t application_key[16]);
+bool mesh_crypto_payload_encrypt_ctx(uint8_t *aad, const uint8_t *payload,
+				uint8_t *out, uint16_t payload_len,
+				uint16_t src, uint16_t dst, uint8_t key_aid,
+				uint32_t seq_num, uint32_t iv_index,
+				bool aszmic,
+				struct mesh_crypto_key *application_key);
 bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 				const uint8_t *payload, uint16_t payload_len,
 				bool szmict,
@@ -90,14 +111,29 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 				uint32_t seq_num, uint32_t iv_index,
 				uint8_t *out,
 				const uint8_t application_key[16]);
+bool mesh_crypto_payload_decrypt_ctx(uint8_t *aad, uint16_t aad_len,
+				const uint8_t *payload, uint16_t payload_len,
+				bool szmict,
+				uint16_t src, uint16_t dst, uint8_t key_aid,
+				uint32_t seq_num, uint32_t iv_index,
+				uint8_t *out,
+				struct mesh_crypto_key *application_key);
 bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
 				uint32_t iv_index,
 				const uint8_t network_key[16],
 				const uint8_t privacy_key[16]);
+bool mesh_crypto_packet_encode_ctx(uint8_t *packet, uint8_t packet_len,
+				uint32_t iv_index,
+				struct mesh_crypto_key *network_key,
+				struct mesh_crypto_key *privacy_key);
 bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 				bool proxy, uint8_t *out, uint32_t iv_index,
 				const uint8_t network_key[16],
 				const uint8_t privacy_key[16]);
+bool mesh_crypto_packet_decode_ctx(const uint8_t *packet, uint8_t packet_len,
+				bool proxy, uint8_t *out, uint32_t iv_index,
+				struct mesh_crypto_key *network_key,
+				struct mesh_crypto_key *privacy_key);
 bool mesh_crypto_packet_label(uint8_t *packet, uint8_t packet_len,
 				uint16_t iv_index, uint8_t network_id);
 
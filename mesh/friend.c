@@ -508,7 +508,7 @@ void friend_poll(struct mesh_net *net, uint16_t src, bool seq,
 			pkt->cnt_out++;
 		} else {
 			pkt = l_queue_pop_head(frnd->pkt_cache);
-			l_free(pkt);
+			mesh_friend_pkt_free(frnd, pkt);
 		}
 	}
 
@@ -34,6 +34,34 @@ const char *dev_key_dir = "/dev_keys";
 const char *app_key_dir = "/app_keys";
 const char *net_key_dir = "/net_keys";
 
+struct dev_key_range {
+	uint16_t unicast;
+	uint8_t count;
+	uint8_t value[16];
+};
+
+struct dev_key_write {
+	struct dev_key_range range;
+	bool del;
+};
+
+/*
+ * Keys are read from storage once per node and kept in memory afterwards.
+ * Net and App keys are written through as they are updated, while the
+ * writes of Device Keys, which a provisioner adds for every node it
+ * configures, are batched and flushed from idle.
+ */
+struct keyring_cache {
+	struct mesh_node *node;
+	struct l_queue *net_keys;
+	struct l_queue *app_keys;
+	struct l_queue *dev_keys;
+	struct l_queue *dev_key_writes;
+	struct l_idle *flush;
+};
+
+static struct l_queue *caches;
+
 static int open_key_file(struct mesh_node *node, const char *key_dir,
 							uint16_t idx, int flags)
 {
@@ -62,22 +90,18 @@ static int open_key_file(struct mesh_node *node, const char *key_dir,
 		return open(fname, flags);
 }
 
-bool keyring_put_net_key(struct mesh_node *node, uint16_t net_idx,
-						struct keyring_net_key *key)
+static bool put_key(struct mesh_node *node, const char *key_dir,
+				uint16_t key_idx, const void *key, ssize_t sz)
 {
 	bool result = false;
 	int fd;
 
-	if (!key)
-		return false;
-
-	fd = open_key_file(node, net_key_dir, net_idx,
+	fd = open_key_file(node, key_dir, key_idx,
 					O_WRONLY | O_CREAT | O_TRUNC);
-
 	if (fd < 0)
 		return false;
 
-	if (write(fd, key, sizeof(*key)) == sizeof(*key))
+	if (write(fd, key, sz) == sz)
 		result = true;
 
 	close(fd);
@@ -85,219 +109,527 @@ bool keyring_put_net_key(struct mesh_node *node, uint16_t net_idx,
 	return result;
 }
 
-bool keyring_put_app_key(struct mesh_node *node, uint16_t app_idx,
-				uint16_t net_idx, struct keyring_app_key *key)
+static bool match_cache_node(const void *a, const void *b)
 {
-	bool result = false;
-	int fd;
+	const struct keyring_cache *cache = a;
 
-	if (!key)
-		return false;
+	return cache->node == b;
+}
 
-	fd = open_key_file(node, app_key_dir, app_idx, O_RDWR);
+static bool match_net_key_idx(const void *a, const void *b)
+{
+	const struct keyring_net_key *key = a;
 
-	if (fd >= 0) {
-		struct keyring_app_key old_key;
+	return key->net_idx == L_PTR_TO_UINT(b);
+}
 
-		if (read(fd, &old_key, sizeof(old_key)) == sizeof(old_key)) {
-			if (old_key.net_idx != net_idx) {
-				close(fd);
-				return false;
-			}
-		}
+static bool match_app_key_idx(const void *a, const void *b)
+{
+	const struct keyring_app_key *key = a;
 
-		lseek(fd, 0, SEEK_SET);
-	} else
-		fd = open_key_file(node, app_key_dir, app_idx,
-						O_WRONLY | O_CREAT | O_TRUNC);
+	return key->app_idx == L_PTR_TO_UINT(b);
+}
 
-	if (fd < 0)
-		return false;
+static bool match_dev_key_unicast(const void *a, const void *b)
+{
+	const struct dev_key_range *range = a;
+	uint16_t unicast = L_PTR_TO_UINT(b);
 
-	if (write(fd, key, sizeof(*key)) == sizeof(*key))
-		result = true;
+	return unicast >= range->unicast &&
+				unicast < range->unicast + range->count;
+}
 
-	close(fd);
+static int compare_dev_key_unicast(const void *a, const void *b,
+							void *user_data)
+{
+	const struct dev_key_range *range_a = a;
+	const struct dev_key_range *range_b = b;
 
-	return result;
+	return range_a->unicast - range_b->unicast;
+}
+
+static DIR *open_key_dir(const char *node_path, const char *key_dir_name)
+{
+	char dir_path[PATH_MAX];
+	DIR *key_dir;
+
+	if (strlen(node_path) + strlen(key_dir_name) + 1 >= PATH_MAX)
+		return NULL;
+
+	snprintf(dir_path, PATH_MAX, "%s%s", node_path, key_dir_name);
+
+	key_dir = opendir(dir_path);
+	if (!key_dir) {
+		l_error("Failed to open keyring storage directory: %s",
+								dir_path);
+		return NULL;
+	}
+
+	return key_dir;
 }
 
-static void finalize(int dir_fd, const char *fname, uint16_t net_idx)
+static int open_key_dir_entry(int dir_fd, struct dirent *entry,
+							uint8_t fname_len)
 {
-	struct keyring_app_key key;
-	int fd;
+	if (entry->d_type != DT_REG)
+		return -1;
 
-	fd = openat(dir_fd, fname, O_RDWR);
+	/* Check the file name length */
+	if (strlen(entry->d_name) != fname_len)
+		return -1;
 
-	if (fd < 0)
+	return openat(dir_fd, entry->d_name, O_RDONLY);
+}
+
+static DIR *load_key_dir(const char *node_path, const char *key_dir_name)
+{
+	char dir_path[PATH_MAX];
+
+	if (strlen(node_path) + strlen(key_dir_name) + 1 >= PATH_MAX)
+		return NULL;
+
+	snprintf(dir_path, PATH_MAX, "%s%s", node_path, key_dir_name);
+
+	/* Nothing stored yet */
+	if (access(dir_path, F_OK) < 0 && errno == ENOENT)
+		return NULL;
+
+	return open_key_dir(node_path, key_dir_name);
+}
+
+static void load_keys(const char *node_path, const char *key_dir_name,
+					struct l_queue *keys, ssize_t sz)
+{
+	DIR *key_dir;
+	int key_dir_fd;
+	struct dirent *entry;
+
+	key_dir = load_key_dir(node_path, key_dir_name);
+	if (!key_dir)
 		return;
 
-	if (read(fd, &key, sizeof(key)) != sizeof(key) ||
-						key.net_idx != net_idx)
-		goto done;
+	key_dir_fd = dirfd(key_dir);
 
-	l_debug("Finalize %s", fname);
-	memcpy(key.old_key, key.new_key, 16);
-	lseek(fd, 0, SEEK_SET);
+	while ((entry = readdir(key_dir)) != NULL) {
+		void *key = l_malloc(sz);
+		int fd = open_key_dir_entry(key_dir_fd, entry, 3);
 
-	if (write(fd, &key, sizeof(key)) != sizeof(key))
-		goto done;
+		if (fd < 0 || read(fd, key, sz) != sz) {
+			l_free(key);
+			if (fd >= 0)
+				close(fd);
 
-done:
-	close(fd);
+			continue;
+		}
+
+		close(fd);
+		l_queue_push_tail(keys, key);
+	}
+
+	closedir(key_dir);
 }
 
-bool keyring_finalize_app_keys(struct mesh_node *node, uint16_t net_idx)
+static void load_dev_keys(const char *node_path, struct l_queue *keys)
 {
-	const char *node_path;
-	char key_dir[PATH_MAX];
-	DIR *dir;
-	int dir_fd;
+	DIR *key_dir;
+	int key_dir_fd;
 	struct dirent *entry;
+	const struct l_queue_entry *e;
+	struct l_queue *files;
+	struct dev_key_range *last = NULL;
+
+	key_dir = load_key_dir(node_path, dev_key_dir);
+	if (!key_dir)
+		return;
+
+	key_dir_fd = dirfd(key_dir);
+	files = l_queue_new();
+
+	while ((entry = readdir(key_dir)) != NULL) {
+		struct dev_key_range *range;
+		uint8_t buf[16];
+		uint16_t unicast;
+		int fd = open_key_dir_entry(key_dir_fd, entry, 4);
+
+		if (fd < 0)
+			continue;
+
+		if (read(fd, buf, 16) != 16 ||
+			sscanf(entry->d_name, "%04hx", &unicast) != 1) {
+			close(fd);
+			continue;
+		}
+
+		close(fd);
+
+		range = l_new(struct dev_key_range, 1);
+		range->unicast = unicast;
+		range->count = 1;
+		memcpy(range->value, buf, 16);
+		l_queue_insert(files, range, compare_dev_key_unicast, NULL);
+	}
+
+	closedir(key_dir);
+
+	/* Elements of the same node share the key, keep a range per node */
+	for (e = l_queue_get_entries(files); e; e = e->next) {
+		struct dev_key_range *range = e->data;
+
+		if (last && last->count < 0xff &&
+				last->unicast + last->count == range->unicast &&
+				!memcmp(last->value, range->value, 16)) {
+			last->count++;
+			l_free(range);
+			continue;
+		}
+
+		l_queue_push_tail(keys, range);
+		last = range;
+	}
+
+	l_queue_destroy(files, NULL);
+}
+
+static struct keyring_cache *get_cache(struct mesh_node *node)
+{
+	struct keyring_cache *cache;
+	const char *node_path;
 
 	if (!node)
-		return false;
+		return NULL;
+
+	cache = l_queue_find(caches, match_cache_node, node);
+	if (cache)
+		return cache;
 
 	node_path = node_get_storage_dir(node);
+	if (!node_path)
+		return NULL;
 
-	if (strlen(node_path) + strlen(app_key_dir) + 1 >= PATH_MAX)
-		return false;
+	cache = l_new(struct keyring_cache, 1);
+	cache->node = node;
+	cache->net_keys = l_queue_new();
+	cache->app_keys = l_queue_new();
+	cache->dev_keys = l_queue_new();
+	cache->dev_key_writes = l_queue_new();
+
+	load_keys(node_path, net_key_dir, cache->net_keys,
+					sizeof(struct keyring_net_key));
+	load_keys(node_path, app_key_dir, cache->app_keys,
+					sizeof(struct keyring_app_key));
+	load_dev_keys(node_path, cache->dev_keys);
 
-	snprintf(key_dir, PATH_MAX, "%s%s", node_path, app_key_dir);
-	dir = opendir(key_dir);
-	if (!dir) {
-		if (errno == ENOENT)
-			return true;
+	if (!caches)
+		caches = l_queue_new();
 
-		l_error("Failed to open AppKey storage directory: %s", key_dir);
+	l_queue_push_tail(caches, cache);
+
+	return cache;
+}
+
+bool keyring_put_net_key(struct mesh_node *node, uint16_t net_idx,
+						struct keyring_net_key *key)
+{
+	struct keyring_cache *cache;
+	struct keyring_net_key *cached;
+
+	if (!key)
 		return false;
-	}
 
-	dir_fd = dirfd(dir);
+	cache = get_cache(node);
+	if (!cache)
+		return false;
+
+	if (!put_key(node, net_key_dir, net_idx, key, sizeof(*key)))
+		return false;
 
-	while ((entry = readdir(dir)) != NULL) {
-		/* AppKeys are stored in regular files */
-		if (entry->d_type == DT_REG)
-			finalize(dir_fd, entry->d_name, net_idx);
+	cached = l_queue_find(cache->net_keys, match_net_key_idx,
+						L_UINT_TO_PTR(net_idx));
+	if (!cached) {
+		cached = l_new(struct keyring_net_key, 1);
+		l_queue_push_tail(cache->net_keys, cached);
 	}
 
-	closedir(dir);
+	memcpy(cached, key, sizeof(*key));
 
 	return true;
 }
 
-bool keyring_put_remote_dev_key(struct mesh_node *node, uint16_t unicast,
-					uint8_t count, uint8_t dev_key[16])
+bool keyring_put_app_key(struct mesh_node *node, uint16_t app_idx,
+				uint16_t net_idx, struct keyring_app_key *key)
 {
-	const char *node_path;
-	char key_file[PATH_MAX];
-	bool result = true;
-	int fd, i;
+	struct keyring_cache *cache;
+	struct keyring_app_key *cached;
 
-	if (!IS_UNICAST_RANGE(unicast, count))
+	if (!key)
 		return false;
 
-	if (!node)
+	cache = get_cache(node);
+	if (!cache)
 		return false;
 
-	node_path = node_get_storage_dir(node);
+	cached = l_queue_find(cache->app_keys, match_app_key_idx,
+						L_UINT_TO_PTR(app_idx));
+	if (cached && cached->net_idx != net_idx)
+		return false;
 
-	if (strlen(node_path) + strlen(dev_key_dir) + 1 + 4 >= PATH_MAX)
+	if (!put_key(node, app_key_dir, app_idx, key, sizeof(*key)))
 		return false;
 
-	snprintf(key_file, PATH_MAX, "%s%s", node_path, dev_key_dir);
+	if (!cached) {
+		cached = l_new(struct keyring_app_key, 1);
+		l_queue_push_tail(cache->app_keys, cached);
+	}
+
+	memcpy(cached, key, sizeof(*key));
+
+	return true;
+}
+
+bool keyring_finalize_app_keys(struct mesh_node *node, uint16_t net_idx)
+{
+	struct keyring_cache *cache;
+	const struct l_queue_entry *entry;
+
+	cache = get_cache(node);
+	if (!cache)
+		return false;
+
+	entry = l_queue_get_entries(cache->app_keys);
+
+	for (; entry; entry = entry->next) {
+		struct keyring_app_key *key = entry->data;
+
+		if (key->net_idx != net_idx)
+			continue;
+
+		l_debug("Finalize %3.3x", key->app_idx);
+		memcpy(key->old_key, key->new_key, 16);
+
+		if (!put_key(node, app_key_dir, key->app_idx, key,
+								sizeof(*key)))
+			l_error("Failed to finalize App Key %3.3x",
+								key->app_idx);
+	}
+
+	return true;
+}
+
+static void flush_dev_key_write(void *data, void *user_data)
+{
+	struct dev_key_write *w = data;
+	const char *node_path = user_data;
+	char key_file[PATH_MAX];
+	int fd, i;
+
+	if (!w->del) {
+		snprintf(key_file, PATH_MAX, "%s%s", node_path, dev_key_dir);
 
-	if (mkdir(key_file, 0755) != 0 && errno != EEXIST)
-		l_error("Failed to create dir(%d): %s", errno, key_file);
+		if (mkdir(key_file, 0755) != 0 && errno != EEXIST)
+			l_error("Failed to create dir(%d): %s", errno,
+								key_file);
+	}
 
-	for (i = 0; i < count; i++) {
+	for (i = 0; i < w->range.count; i++) {
 		snprintf(key_file, PATH_MAX, "%s%s/%4.4x", node_path,
-						dev_key_dir, unicast + i);
+					dev_key_dir, w->range.unicast + i);
+
+		if (w->del) {
+			l_debug("RM Dev Key %s", key_file);
+			remove(key_file);
+			continue;
+		}
+
 		l_debug("Put Dev Key %s", key_file);
 
 		fd = open(key_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-		if (fd >= 0) {
-			if (write(fd, dev_key, 16) != 16)
-				result = false;
+		if (fd < 0 || write(fd, w->range.value, 16) != 16)
+			l_error("Failed to write Dev Key %s", key_file);
 
+		if (fd >= 0)
 			close(fd);
+	}
+}
+
+static void flush_dev_keys(struct keyring_cache *cache)
+{
+	const char *node_path = node_get_storage_dir(cache->node);
+
+	l_idle_remove(cache->flush);
+	cache->flush = NULL;
+
+	if (l_queue_isempty(cache->dev_key_writes))
+		return;
+
+	if (node_path && strlen(node_path) + strlen(dev_key_dir) + 1 + 4 <
+								PATH_MAX)
+		l_queue_foreach(cache->dev_key_writes, flush_dev_key_write,
+							(void *) node_path);
+
+	l_queue_clear(cache->dev_key_writes, l_free);
+}
+
+static void flush_idle(struct l_idle *idle, void *user_data)
+{
+	flush_dev_keys(user_data);
+}
+
+static void queue_dev_key_write(struct keyring_cache *cache,
+					const struct dev_key_range *range,
+					bool del)
+{
+	struct dev_key_write *w = l_new(struct dev_key_write, 1);
+
+	memcpy(&w->range, range, sizeof(*range));
+	w->del = del;
+	l_queue_push_tail(cache->dev_key_writes, w);
+
+	if (!cache->flush)
+		cache->flush = l_idle_create(flush_idle, cache, NULL);
+}
+
+static void del_dev_key_range(struct keyring_cache *cache, uint16_t unicast,
+								uint8_t count)
+{
+	const struct l_queue_entry *entry;
+	struct l_queue *keys = cache->dev_keys;
+	uint32_t end = unicast + count;
+
+	cache->dev_keys = l_queue_new();
+
+	/* Trim the ranges overlapping with the removed one */
+	for (entry = l_queue_get_entries(keys); entry; entry = entry->next) {
+		struct dev_key_range *range = entry->data;
+		uint32_t range_end = range->unicast + range->count;
+		struct dev_key_range *tail;
+
+		if (range_end <= unicast || range->unicast >= end) {
+			l_queue_push_tail(cache->dev_keys, range);
+			continue;
+		}
+
+		if (range_end > end) {
+			tail = l_memdup(range, sizeof(*range));
+			tail->unicast = end;
+			tail->count = range_end - end;
+			l_queue_push_tail(cache->dev_keys, tail);
+		}
+
+		if (range->unicast < unicast) {
+			range->count = unicast - range->unicast;
+			l_queue_insert(cache->dev_keys, range,
+					compare_dev_key_unicast, NULL);
 		} else
-			result = false;
+			l_free(range);
 	}
 
-	return result;
+	l_queue_destroy(keys, NULL);
 }
 
-static bool get_key(struct mesh_node *node, const char *key_dir,
-					uint16_t key_idx, void *key, ssize_t sz)
+bool keyring_put_remote_dev_key(struct mesh_node *node, uint16_t unicast,
+					uint8_t count, uint8_t dev_key[16])
 {
-	bool result = false;
-	int fd;
+	struct keyring_cache *cache;
+	struct dev_key_range *range;
 
-	if (!key)
+	if (!IS_UNICAST_RANGE(unicast, count))
+		return false;
+
+	cache = get_cache(node);
+	if (!cache)
 		return false;
 
-	fd = open_key_file(node, key_dir, key_idx, O_RDONLY);
+	if (strlen(node_get_storage_dir(node)) + strlen(dev_key_dir) + 1 + 4 >=
+								PATH_MAX)
+		return false;
 
-	if (fd >= 0) {
-		if (read(fd, key, sz) == sz)
-			result = true;
+	del_dev_key_range(cache, unicast, count);
 
-		close(fd);
-	}
+	range = l_new(struct dev_key_range, 1);
+	range->unicast = unicast;
+	range->count = count;
+	memcpy(range->value, dev_key, 16);
+	l_queue_insert(cache->dev_keys, range, compare_dev_key_unicast, NULL);
 
-	return result;
+	queue_dev_key_write(cache, range, false);
+
+	return true;
 }
 
 bool keyring_get_net_key(struct mesh_node *node, uint16_t net_idx,
 						struct keyring_net_key *key)
 {
-	return get_key(node, net_key_dir, net_idx, key, sizeof(*key));
+	struct keyring_cache *cache = get_cache(node);
+	struct keyring_net_key *cached;
+
+	if (!cache || !key)
+		return false;
+
+	cached = l_queue_find(cache->net_keys, match_net_key_idx,
+						L_UINT_TO_PTR(net_idx));
+	if (!cached)
+		return false;
+
+	memcpy(key, cached, sizeof(*key));
+
+	return true;
 }
 
 bool keyring_get_app_key(struct mesh_node *node, uint16_t app_idx,
 						struct keyring_app_key *key)
 {
-	return get_key(node, app_key_dir, app_idx, key, sizeof(*key));
+	struct keyring_cache *cache = get_cache(node);
+	struct keyring_app_key *cached;
+
+	if (!cache || !key)
+		return false;
+
+	cached = l_queue_find(cache->app_keys, match_app_key_idx,
+						L_UINT_TO_PTR(app_idx));
+	if (!cached)
+		return false;
+
+	memcpy(key, cached, sizeof(*key));
+
+	return true;
 }
 
 bool keyring_get_remote_dev_key(struct mesh_node *node, uint16_t unicast,
 							uint8_t dev_key[16])
 {
-	const char *node_path;
-	char key_file[PATH_MAX];
-	bool result = false;
-	int fd;
+	struct keyring_cache *cache;
+	struct dev_key_range *range;
 
 	if (!IS_UNICAST(unicast))
 		return false;
 
-	if (!node)
+	cache = get_cache(node);
+	if (!cache)
 		return false;
 
-	node_path = node_get_storage_dir(node);
-
-	snprintf(key_file, PATH_MAX, "%s%s/%4.4x", node_path, dev_key_dir,
-								unicast);
-	fd = open(key_file, O_RDONLY);
-	if (fd >= 0) {
-		if (read(fd, dev_key, 16) == 16)
-			result = true;
+	range = l_queue_find(cache->dev_keys, match_dev_key_unicast,
+						L_UINT_TO_PTR(unicast));
+	if (!range)
+		return false;
 
-		close(fd);
-	}
+	memcpy(dev_key, range->value, 16);
 
-	return result;
+	return true;
 }
 
 bool keyring_del_net_key(struct mesh_node *node, uint16_t net_idx)
 {
+	struct keyring_cache *cache;
 	const char *node_path;
 	char key_file[PATH_MAX];
 
-	if (!node)
+	cache = get_cache(node);
+	if (!cache)
 		return false;
 
+	l_free(l_queue_remove_if(cache->net_keys, match_net_key_idx,
+						L_UINT_TO_PTR(net_idx)));
+
 	node_path = node_get_storage_dir(node);
 	snprintf(key_file, PATH_MAX, "%s%s/%3.3x", node_path, net_key_dir,
 								net_idx);
@@ -312,12 +644,17 @@ bool keyring_del_net_key(struct mesh_node *node, uint16_t net_idx)
 
 bool keyring_del_app_key(struct mesh_node *node, uint16_t app_idx)
 {
+	struct keyring_cache *cache;
 	const char *node_path;
 	char key_file[PATH_MAX];
 
-	if (!node)
+	cache = get_cache(node);
+	if (!cache)
 		return false;
 
+	l_free(l_queue_remove_if(cache->app_keys, match_app_key_idx,
+						L_UINT_TO_PTR(app_idx)));
+
 	node_path = node_get_storage_dir(node);
 	snprintf(key_file, PATH_MAX, "%s%s/%3.3x", node_path, app_key_dir,
 								app_idx);
@@ -330,59 +667,47 @@ bool keyring_del_app_key(struct mesh_node *node, uint16_t app_idx)
 bool keyring_del_remote_dev_key(struct mesh_node *node, uint16_t unicast,
 								uint8_t count)
 {
-	const char *node_path;
-	char key_file[PATH_MAX];
-	int i;
+	struct keyring_cache *cache;
+	struct dev_key_range range = {
+		.unicast = unicast,
+		.count = count,
+	};
 
 	if (!IS_UNICAST_RANGE(unicast, count))
 		return false;
 
-	if (!node)
+	cache = get_cache(node);
+	if (!cache)
 		return false;
 
-	node_path = node_get_storage_dir(node);
-
-	for (i = 0; i < count; i++) {
-		snprintf(key_file, PATH_MAX, "%s%s/%4.4x", node_path,
-						dev_key_dir, unicast + i);
-		l_debug("RM Dev Key %s", key_file);
-		remove(key_file);
-	}
+	del_dev_key_range(cache, unicast, count);
+	queue_dev_key_write(cache, &range, true);
 
 	return true;
 }
 
-static DIR *open_key_dir(const char *node_path, const char *key_dir_name)
+void keyring_release(struct mesh_node *node, bool flush)
 {
-	char dir_path[PATH_MAX];
-	DIR *key_dir;
-
-	if (strlen(node_path) + strlen(key_dir_name) + 1 >= PATH_MAX)
-		return NULL;
-
-	snprintf(dir_path, PATH_MAX, "%s%s", node_path, key_dir_name);
-
-	key_dir = opendir(dir_path);
-	if (!key_dir) {
-		l_error("Failed to open keyring storage directory: %s",
-								dir_path);
-		return NULL;
-	}
+	struct keyring_cache *cache;
 
-	return key_dir;
-}
+	cache = l_queue_remove_if(caches, match_cache_node, node);
+	if (!cache)
+		return;
 
-static int open_key_dir_entry(int dir_fd, struct dirent *entry,
-							uint8_t fname_len)
-{
-	if (entry->d_type != DT_REG)
-		return -1;
+	if (flush)
+		flush_dev_keys(cache);
 
-	/* Check the file name length */
-	if (strlen(entry->d_name) != fname_len)
-		return -1;
+	l_idle_remove(cache->flush);
+	l_queue_destroy(cache->net_keys, l_free);
+	l_queue_destroy(cache->app_keys, l_free);
+	l_queue_destroy(cache->dev_keys, l_free);
+	l_queue_destroy(cache->dev_key_writes, l_free);
+	l_free(cache);
 
-	return openat(dir_fd, entry->d_name, O_RDONLY);
+	if (l_queue_isempty(caches)) {
+		l_queue_destroy(caches, NULL);
+		caches = NULL;
+	}
 }
 
 static void append_old_key(struct l_dbus_message_builder *builder,
@@ -623,6 +948,7 @@ done:
 bool keyring_build_export_keys_reply(struct mesh_node *node,
 					struct l_dbus_message_builder *builder)
 {
+	struct keyring_cache *cache;
 	const char *node_path;
 
 	if (!node)
@@ -630,6 +956,11 @@ bool keyring_build_export_keys_reply(struct mesh_node *node,
 
 	node_path = node_get_storage_dir(node);
 
+	/* Export is built from storage, write out any pending Device Keys */
+	cache = l_queue_find(caches, match_cache_node, node);
+	if (cache)
+		flush_dev_keys(cache);
+
 	if (!build_net_keys_reply(node_path, builder))
 		return false;
 
@@ -13,8 +13,11 @@
 #endif
 
 #include <errno.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
 #include <ell/ell.h>
 
 #include "monitor/bt.h"
@@ -28,6 +31,38 @@
 #include "mesh/mesh-io-api.h"
 #include "mesh/mesh-io-generic.h"
 
+#define RX_RING_SIZE	64	/* Must be a power of two */
+#define RX_BATCH	8
+
+#define TX_SETS_MAX		4	/* Extended advertising sets for TX */
+#define TX_SET_INTERVAL		0x000020	/* 20 ms, N * 0.625 ms */
+
+#define FILTER_AD_MAX		15	/* AD structures fitting 31 bytes */
+#define FILTER_TYPES_MAX	8	/* Keeps BPF jumps within 8 bits */
+
+/* LE Advertising Report behind the H4 type, event header and subevent */
+#define ADV_REPORT_FIELD(field) \
+		(1 + sizeof(struct bt_hci_evt_hdr) + 1 + \
+			offsetof(struct bt_hci_evt_le_adv_report, field))
+#define EXT_ADV_REPORT_FIELD(field) \
+		(1 + sizeof(struct bt_hci_evt_hdr) + 1 + \
+			sizeof(struct bt_hci_evt_le_ext_adv_report) + \
+			offsetof(struct bt_hci_le_ext_adv_report, field))
+
+struct rx_pkt {
+	uint32_t			instant;
+	int8_t				rssi;
+	uint8_t				addr[6];
+	uint8_t				len;
+	uint8_t				data[31];
+};
+
+struct tx_set {
+	struct tx_pkt *tx;		/* PDU advertised, NULL once done */
+	bool enabled;
+	bool done;			/* PDU is on its last transmission */
+};
+
 struct mesh_io_private {
 	struct bt_hci *hci;
 	void *user_data;
@@ -36,10 +71,18 @@ struct mesh_io_private {
 	struct l_queue *rx_regs;
 	struct l_queue *tx_pkts;
 	struct tx_pkt *tx;
+	struct l_idle *rx_idle;
+	struct rx_pkt rx_ring[RX_RING_SIZE];
+	unsigned int rx_head;
+	unsigned int rx_tail;
+	struct tx_set tx_sets[TX_SETS_MAX];
+	uint8_t num_sets;		/* 0 if using legacy advertising */
+	uint8_t next_set;
 	uint16_t index;
 	uint16_t interval;
 	bool sending;
 	bool active;
+	bool restarted;
 };
 
 struct pvt_rx_reg {
@@ -112,28 +155,12 @@ static void process_rx(struct mesh_io_private *pvt, int8_t rssi,
 	l_queue_foreach(pvt->rx_regs, process_rx_callbacks, &rx);
 }
 
-static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
+static void process_adv(struct mesh_io_private *pvt, const struct rx_pkt *pkt)
 {
-	const struct bt_hci_evt_le_adv_report *evt = buf;
-	const uint8_t *adv;
-	const uint8_t *addr;
-	uint32_t instant;
-	uint8_t adv_len;
+	const uint8_t *adv = pkt->data;
 	uint16_t len = 0;
-	int8_t rssi;
-
-	if (evt->event_type != 0x03)
-		return;
 
-	instant = get_instant();
-	adv = evt->data;
-	adv_len = evt->data_len;
-	addr = evt->addr;
-
-	/* rssi is just beyond last byte of data */
-	rssi = (int8_t) adv[adv_len];
-
-	while (len < adv_len - 1) {
+	while (len < pkt->len - 1) {
 		uint8_t field_len = adv[0];
 
 		/* Check for the end of advertising data */
@@ -143,16 +170,102 @@ static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
 		len += field_len + 1;
 
 		/* Do not continue data parsing if got incorrect length */
-		if (len > adv_len)
+		if (len > pkt->len)
 			break;
 
 		/* TODO: Create an Instant to use */
-		process_rx(io->pvt, rssi, instant, addr, adv + 1, adv[0]);
+		process_rx(pvt, pkt->rssi, pkt->instant, pkt->addr, adv + 1,
+								adv[0]);
 
 		adv += field_len + 1;
 	}
 }
 
+static void rx_idle_cb(struct l_idle *idle, void *user_data)
+{
+	struct mesh_io_private *pvt = user_data;
+	unsigned int i;
+
+	/* Let pending HCI events in between batches */
+	for (i = 0; i < RX_BATCH && pvt->rx_tail != pvt->rx_head; i++) {
+		struct rx_pkt *pkt = &pvt->rx_ring[pvt->rx_tail %
+								RX_RING_SIZE];
+
+		pvt->rx_tail++;
+		process_adv(pvt, pkt);
+	}
+
+	if (pvt->rx_tail == pvt->rx_head) {
+		l_idle_remove(pvt->rx_idle);
+		pvt->rx_idle = NULL;
+	}
+}
+
+static void queue_adv(struct mesh_io_private *pvt, const uint8_t *addr,
+				int8_t rssi, const uint8_t *data, uint8_t len)
+{
+	struct rx_pkt *pkt;
+
+	if (len > sizeof(pkt->data))
+		return;
+
+	/*
+	 * Only queue the advertising data here so that the HCI events are
+	 * read as fast as they come in, processing happens from idle.
+	 */
+	if (pvt->rx_head - pvt->rx_tail == RX_RING_SIZE) {
+		l_debug("RX ring full, dropping advertising report");
+		return;
+	}
+
+	pkt = &pvt->rx_ring[pvt->rx_head % RX_RING_SIZE];
+	pkt->instant = get_instant();
+	pkt->len = len;
+	pkt->rssi = rssi;
+	memcpy(pkt->addr, addr, sizeof(pkt->addr));
+	memcpy(pkt->data, data, len);
+
+	pvt->rx_head++;
+
+	if (!pvt->rx_idle)
+		pvt->rx_idle = l_idle_create(rx_idle_cb, pvt, NULL);
+}
+
+static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
+{
+	const struct bt_hci_evt_le_adv_report *evt = buf;
+
+	if (evt->event_type != 0x03)
+		return;
+
+	if (size < sizeof(*evt) + evt->data_len + 1)
+		return;
+
+	/* rssi is just beyond last byte of data */
+	queue_adv(io->pvt, evt->addr, (int8_t) evt->data[evt->data_len],
+						evt->data, evt->data_len);
+}
+
+static void event_ext_adv_report(struct mesh_io *io, const void *buf,
+								uint8_t size)
+{
+	const struct bt_hci_evt_le_ext_adv_report *evt = buf;
+	const struct bt_hci_le_ext_adv_report *report = buf + sizeof(*evt);
+
+	if (size < sizeof(*evt) + sizeof(*report) || !evt->num_reports)
+		return;
+
+	/* Mesh PDUs are sent as legacy ADV_NONCONN_IND */
+	if (L_LE16_TO_CPU(report->event_type) != 0x0010)
+		return;
+
+	if (size < sizeof(*evt) + sizeof(*report) + report->data_len)
+		return;
+
+	queue_adv(io->pvt, report->addr, report->rssi, report->data,
+							report->data_len);
+}
+
 static void event_callback(const void *buf, uint8_t size, void *user_data)
 {
 	uint8_t event = l_get_u8(buf);
@@ -163,18 +276,289 @@ static void event_callback(const void *buf, uint8_t size, void *user_data)
 		event_adv_report(io, buf + 1, size - 1);
 		break;
 
+	case BT_HCI_EVT_LE_EXT_ADV_REPORT:
+		event_ext_adv_report(io, buf + 1, size - 1);
+		break;
+
 	default:
 		l_debug("Other Meta Evt - %d", event);
 	}
 }
 
-static void local_commands_callback(const void *data, uint8_t size,
+static void scan_enable_rsp(const void *buf, uint8_t size,
 							void *user_data)
 {
-	const struct bt_hci_rsp_read_local_commands *rsp = data;
+	uint8_t status = *((uint8_t *) buf);
 
-	if (rsp->status)
-		l_error("Failed to read local commands");
+	if (status)
+		l_error("LE Scan enable failed (0x%02x)", status);
+}
+
+static void scan_enable(struct mesh_io_private *pvt, bool enable,
+						bt_hci_callback_func_t cb)
+{
+	struct bt_hci_cmd_le_set_ext_scan_enable ext_cmd;
+	struct bt_hci_cmd_le_set_scan_enable cmd;
+
+	if (!pvt->num_sets) {
+		cmd.enable = enable ? 0x01 : 0x00;
+		cmd.filter_dup = 0x00;	/* Report duplicates */
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
+					&cmd, sizeof(cmd), cb, pvt, NULL);
+		return;
+	}
+
+	memset(&ext_cmd, 0, sizeof(ext_cmd));
+	ext_cmd.enable = enable ? 0x01 : 0x00;
+	ext_cmd.filter_dup = 0x00;	/* Report duplicates */
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_ENABLE,
+				&ext_cmd, sizeof(ext_cmd), cb, pvt, NULL);
+}
+
+static void set_recv_scan_enable(const void *buf, uint8_t size,
+							void *user_data)
+{
+	struct mesh_io_private *pvt = user_data;
+
+	scan_enable(pvt, true, scan_enable_rsp);
+}
+
+static void set_ext_scan_params(struct mesh_io_private *pvt)
+{
+	uint8_t buf[sizeof(struct bt_hci_cmd_le_set_ext_scan_params) +
+					sizeof(struct bt_hci_le_scan_phy)];
+	struct bt_hci_cmd_le_set_ext_scan_params *cmd = (void *) buf;
+	struct bt_hci_le_scan_phy *phy = (void *) cmd->data;
+
+	cmd->own_addr_type = 0x01;	/* ADDR_TYPE_RANDOM */
+	cmd->filter_policy = 0x00;	/* Accept all */
+	cmd->num_phys = 0x01;		/* LE 1M */
+	phy->type = pvt->active ? 0x01 : 0x00;	/* Passive/Active scanning */
+	phy->interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+	phy->window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_PARAMS,
+			buf, sizeof(buf), set_recv_scan_enable, pvt, NULL);
+}
+
+static void scan_disable_rsp(const void *buf, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_cmd_le_set_scan_parameters cmd;
+	struct mesh_io_private *pvt = user_data;
+	uint8_t status = *((uint8_t *) buf);
+
+	if (status)
+		l_error("LE Scan disable failed (0x%02x)", status);
+
+	if (pvt->num_sets) {
+		set_ext_scan_params(pvt);
+		return;
+	}
+
+	cmd.type = pvt->active ? 0x01 : 0x00;	/* Passive/Active scanning */
+	cmd.interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+	cmd.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+	cmd.own_addr_type = 0x01;		/* ADDR_TYPE_RANDOM */
+	cmd.filter_policy = 0x00;		/* Accept all */
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
+			&cmd, sizeof(cmd),
+			set_recv_scan_enable, pvt, NULL);
+}
+
+static bool simple_match(const void *a, const void *b)
+{
+	return a == b;
+}
+
+static bool find_by_ad_type(const void *a, const void *b)
+{
+	const struct tx_pkt *tx = a;
+	uint8_t ad_type = L_PTR_TO_UINT(b);
+
+	return !ad_type || ad_type == tx->pkt[0];
+}
+
+static bool find_by_pattern(const void *a, const void *b)
+{
+	const struct tx_pkt *tx = a;
+	const struct tx_pattern *pattern = b;
+
+	if (tx->len < pattern->len)
+		return false;
+
+	return (!memcmp(tx->pkt, pattern->data, pattern->len));
+}
+
+static bool find_active(const void *a, const void *b)
+{
+	const struct pvt_rx_reg *rx_reg = a;
+
+	/* Mesh specific AD types do *not* require active scanning,
+	 * so do not turn on Active Scanning on their account.
+	 */
+	if (rx_reg->filter[0] < MESH_AD_TYPE_PROVISION ||
+			rx_reg->filter[0] > MESH_AD_TYPE_BEACON)
+		return true;
+
+	return false;
+}
+
+static void add_filter_type(uint8_t *types, unsigned int *num_types,
+								uint8_t type)
+{
+	unsigned int i;
+
+	for (i = 0; i < *num_types; i++) {
+		if (types[i] == type)
+			return;
+	}
+
+	if (*num_types < FILTER_TYPES_MAX)
+		types[i] = type;
+
+	(*num_types)++;
+}
+
+static void filter_stmt(struct sock_filter *code, unsigned int *pc,
+						uint16_t op, uint32_t k)
+{
+	code[*pc] = (struct sock_filter) BPF_STMT(op, k);
+	(*pc)++;
+}
+
+/* Jump targets are absolute here and made relative to the next instruction */
+static void filter_jump(struct sock_filter *code, unsigned int *pc,
+				uint16_t op, uint32_t k, unsigned int jt,
+				unsigned int jf)
+{
+	unsigned int next = *pc + 1;
+
+	code[*pc] = (struct sock_filter) BPF_JUMP(op, k,
+				jt ? jt - next : 0, jf ? jf - next : 0);
+	(*pc)++;
+}
+
+/*
+ * Drops the advertising reports not carrying any of the mesh AD types or the
+ * AD type of a registered pattern in the kernel, everything else on the user
+ * channel is let through. The patterns themselves are still matched from
+ * process_rx() since classic BPF cannot compare variable length data.
+ */
+static void attach_adv_filter(struct mesh_io_private *pvt)
+{
+	struct sock_filter code[13 + FILTER_AD_MAX * (8 + FILTER_TYPES_MAX) +
+									2];
+	struct sock_fprog fprog;
+	uint8_t types[FILTER_TYPES_MAX];
+	unsigned int num_types = 0;
+	unsigned int pc = 0, reject, accept, i, j;
+	const struct l_queue_entry *entry;
+	uint8_t subevent, event_type;
+	uint32_t event_type_off, data_len_off, data_off;
+	int fd;
+
+	fd = bt_hci_get_fd(pvt->hci);
+	if (fd < 0)
+		return;
+
+	add_filter_type(types, &num_types, MESH_AD_TYPE_PROVISION);
+	add_filter_type(types, &num_types, MESH_AD_TYPE_NETWORK);
+	add_filter_type(types, &num_types, MESH_AD_TYPE_BEACON);
+
+	for (entry = l_queue_get_entries(pvt->rx_regs); entry;
+							entry = entry->next) {
+		struct pvt_rx_reg *rx_reg = entry->data;
+
+		add_filter_type(types, &num_types, rx_reg->filter[0]);
+	}
+
+	/* Jump offsets are 8 bits wide, leave it to userspace instead */
+	if (num_types > FILTER_TYPES_MAX) {
+		setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+		return;
+	}
+
+	reject = 13 + FILTER_AD_MAX * (8 + num_types);
+	accept = reject + 1;
+
+	/* Only the first report is looked at, same as the event handlers */
+	if (pvt->num_sets) {
+		subevent = BT_HCI_EVT_LE_EXT_ADV_REPORT;
+		event_type = 0x10;	/* Low octet, the high one is RFU */
+		event_type_off = EXT_ADV_REPORT_FIELD(event_type);
+		data_len_off = EXT_ADV_REPORT_FIELD(data_len);
+		data_off = EXT_ADV_REPORT_FIELD(data);
+	} else {
+		subevent = BT_HCI_EVT_LE_ADV_REPORT;
+		event_type = 0x03;
+		event_type_off = ADV_REPORT_FIELD(event_type);
+		data_len_off = ADV_REPORT_FIELD(data_len);
+		data_off = ADV_REPORT_FIELD(data);
+	}
+
+	/* Pass anything but LE Advertising Report events */
+	filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_ABS, 0);
+	filter_jump(code, &pc, BPF_JMP + BPF_JEQ + BPF_K, BT_H4_EVT_PKT,
+								0, 6);
+	filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_ABS,
+				1 + offsetof(struct bt_hci_evt_hdr, evt));
+	filter_jump(code, &pc, BPF_JMP + BPF_JEQ + BPF_K,
+					BT_HCI_EVT_LE_META_EVENT, 0, 6);
+	filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_ABS,
+					1 + sizeof(struct bt_hci_evt_hdr));
+	filter_jump(code, &pc, BPF_JMP + BPF_JEQ + BPF_K, subevent, 7, 0);
+	filter_stmt(code, &pc, BPF_RET + BPF_K, 0x0fffffff);
+
+	/* Only non-connectable advertising is handled by the event handlers */
+	filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_ABS, event_type_off);
+	filter_jump(code, &pc, BPF_JMP + BPF_JEQ + BPF_K, event_type, 0,
+								reject);
+
+	/* M[0] <- end of the AD, X <- offset of the current AD structure */
+	filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_ABS, data_len_off);
+	filter_stmt(code, &pc, BPF_ALU + BPF_ADD + BPF_K, data_off);
+	filter_stmt(code, &pc, BPF_ST, 0);
+	filter_stmt(code, &pc, BPF_LDX + BPF_IMM, data_off);
+
+	/* Backward jumps are not allowed so the AD walk is unrolled */
+	for (i = 0; i < FILTER_AD_MAX; i++) {
+		filter_stmt(code, &pc, BPF_LD + BPF_MEM, 0);
+		filter_jump(code, &pc, BPF_JMP + BPF_JGT + BPF_X, 0, 0, reject);
+
+		filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_IND, 1);
+
+		for (j = 0; j < num_types; j++)
+			filter_jump(code, &pc, BPF_JMP + BPF_JEQ + BPF_K,
+							types[j], accept, 0);
+
+		filter_stmt(code, &pc, BPF_LD + BPF_B + BPF_IND, 0);
+		filter_jump(code, &pc, BPF_JMP + BPF_JEQ + BPF_K, 0, reject, 0);
+		filter_stmt(code, &pc, BPF_ALU + BPF_ADD + BPF_K, 1);
+		filter_stmt(code, &pc, BPF_ALU + BPF_ADD + BPF_X, 0);
+		filter_stmt(code, &pc, BPF_MISC + BPF_TAX, 0);
+	}
+
+	filter_stmt(code, &pc, BPF_RET + BPF_K, 0);
+	filter_stmt(code, &pc, BPF_RET + BPF_K, 0x0fffffff);
+
+	fprog.len = pc;
+	fprog.filter = code;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+							sizeof(fprog)) < 0)
+		l_debug("Unable to attach advertising filter: %s",
+							strerror(errno));
+}
+
+static void restart_scan(struct mesh_io_private *pvt)
+{
+	if (l_queue_isempty(pvt->rx_regs))
+		return;
+
+	pvt->active = l_queue_find(pvt->rx_regs, find_active, NULL);
+	scan_enable(pvt, false, scan_disable_rsp);
 }
 
 static void local_features_callback(const void *data, uint8_t size,
@@ -195,12 +579,20 @@ static void hci_generic_callback(const void *data, uint8_t size,
 		l_error("Failed to initialize HCI");
 }
 
-static void configure_hci(struct mesh_io_private *io)
+static void configure_done(struct mesh_io_private *pvt)
+{
+	attach_adv_filter(pvt);
+
+	if (pvt->restarted)
+		restart_scan(pvt);
+
+	if (pvt->ready_callback)
+		pvt->ready_callback(pvt->user_data, true);
+}
+
+static void configure_legacy(struct mesh_io_private *pvt)
 {
 	struct bt_hci_cmd_le_set_scan_parameters cmd;
-	struct bt_hci_cmd_set_event_mask cmd_sem;
-	struct bt_hci_cmd_le_set_event_mask cmd_slem;
-	struct bt_hci_cmd_le_set_random_address cmd_raddr;
 
 	/* Set scan parameters */
 	cmd.type = 0x00; /* Passive Scanning. No scanning PDUs shall be sent */
@@ -212,6 +604,112 @@ static void configure_hci(struct mesh_io_private *io)
 	 */
 	cmd.filter_policy = 0x00;
 
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS, &cmd,
+				sizeof(cmd), hci_generic_callback, NULL, NULL);
+
+	configure_done(pvt);
+}
+
+static void set_tx_set_addr(struct mesh_io_private *pvt, uint8_t handle)
+{
+	struct bt_hci_cmd_le_set_adv_set_rand_addr cmd;
+
+	cmd.handle = handle;
+	l_getrandom(cmd.bdaddr, 6);
+	cmd.bdaddr[5] |= 0xc0;
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_ADV_SET_RAND_ADDR,
+				&cmd, sizeof(cmd), NULL, NULL, NULL);
+}
+
+static void adv_sets_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	const struct bt_hci_rsp_le_read_num_supported_adv_sets *rsp = data;
+	struct mesh_io_private *pvt = user_data;
+	struct bt_hci_cmd_le_set_ext_adv_params cmd;
+	struct bt_hci_cmd_le_set_event_mask cmd_slem;
+	uint8_t i;
+
+	if (rsp->status || !rsp->num_of_sets) {
+		configure_legacy(pvt);
+		return;
+	}
+
+	pvt->num_sets = L_MIN(rsp->num_of_sets, TX_SETS_MAX);
+
+	l_debug("Using %u extended advertising sets", pvt->num_sets);
+
+	/* Same LE event mask plus LE Extended Advertising Report */
+	memset(&cmd_slem, 0, sizeof(cmd_slem));
+	cmd_slem.mask[0] = 0x7f;
+	cmd_slem.mask[1] = 0x18;
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EVENT_MASK, &cmd_slem,
+			sizeof(cmd_slem), hci_generic_callback, NULL, NULL);
+
+	/*
+	 * Every set sends legacy ADV_NONCONN_IND from its own random address
+	 * and keeps the same parameters, so that loading a PDU only takes an
+	 * LE Set Extended Advertising Data command.
+	 */
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.evt_properties = L_CPU_TO_LE16(0x0010);
+	cmd.min_interval[0] = TX_SET_INTERVAL & 0xff;
+	cmd.min_interval[1] = (TX_SET_INTERVAL >> 8) & 0xff;
+	cmd.min_interval[2] = (TX_SET_INTERVAL >> 16) & 0xff;
+	memcpy(cmd.max_interval, cmd.min_interval, sizeof(cmd.max_interval));
+	cmd.channel_map = 0x07;
+	cmd.own_addr_type = 0x01; /* ADDR_TYPE_RANDOM */
+	cmd.filter_policy = 0x00;
+	cmd.tx_power = 0x7f; /* No preference */
+	cmd.primary_phy = 0x01; /* LE 1M */
+	cmd.secondary_phy = 0x01; /* LE 1M */
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		cmd.handle = i;
+		cmd.sid = i;
+
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_PARAMS, &cmd,
+				sizeof(cmd), hci_generic_callback, NULL, NULL);
+		set_tx_set_addr(pvt, i);
+	}
+
+	configure_done(pvt);
+}
+
+static void local_commands_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	const struct bt_hci_rsp_read_local_commands *rsp = data;
+	struct mesh_io_private *pvt = user_data;
+
+	if (rsp->status) {
+		l_error("Failed to read local commands");
+		configure_legacy(pvt);
+		return;
+	}
+
+	/*
+	 * Legacy and extended advertising or scanning commands cannot be
+	 * mixed, so only switch over if both are supported.
+	 */
+	if ((rsp->commands[36] & 0xae) != 0xae ||
+					(rsp->commands[37] & 0x60) != 0x60) {
+		configure_legacy(pvt);
+		return;
+	}
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_READ_NUM_SUPPORTED_ADV_SETS, NULL,
+					0, adv_sets_callback, pvt, NULL);
+}
+
+static void configure_hci(struct mesh_io_private *io)
+{
+	struct bt_hci_cmd_set_event_mask cmd_sem;
+	struct bt_hci_cmd_le_set_event_mask cmd_slem;
+	struct bt_hci_cmd_le_set_random_address cmd_raddr;
+
 	/* Set event mask
 	 *
 	 * Mask: 0x2000800002008890
@@ -264,7 +762,7 @@ static void configure_hci(struct mesh_io_private *io)
 
 	/* Read local supported commands */
 	bt_hci_send(io->hci, BT_HCI_CMD_READ_LOCAL_COMMANDS, NULL, 0,
-					local_commands_callback, NULL, NULL);
+					local_commands_callback, io, NULL);
 
 	/* Read local supported features */
 	bt_hci_send(io->hci, BT_HCI_CMD_READ_LOCAL_FEATURES, NULL, 0,
@@ -282,113 +780,23 @@ static void configure_hci(struct mesh_io_private *io)
 	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_RANDOM_ADDRESS, &cmd_raddr,
 			sizeof(cmd_raddr), hci_generic_callback, NULL, NULL);
 
-	/* Scan Params */
-	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS, &cmd,
-				sizeof(cmd), hci_generic_callback, NULL, NULL);
-}
-
-static void scan_enable_rsp(const void *buf, uint8_t size,
-							void *user_data)
-{
-	uint8_t status = *((uint8_t *) buf);
-
-	if (status)
-		l_error("LE Scan enable failed (0x%02x)", status);
-}
-
-static void set_recv_scan_enable(const void *buf, uint8_t size,
-							void *user_data)
-{
-	struct mesh_io_private *pvt = user_data;
-	struct bt_hci_cmd_le_set_scan_enable cmd;
-
-	cmd.enable = 0x01;	/* Enable scanning */
-	cmd.filter_dup = 0x00;	/* Report duplicates */
-	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-			&cmd, sizeof(cmd), scan_enable_rsp, pvt, NULL);
-}
-
-static void scan_disable_rsp(const void *buf, uint8_t size,
-							void *user_data)
-{
-	struct bt_hci_cmd_le_set_scan_parameters cmd;
-	struct mesh_io_private *pvt = user_data;
-	uint8_t status = *((uint8_t *) buf);
-
-	if (status)
-		l_error("LE Scan disable failed (0x%02x)", status);
-
-	cmd.type = pvt->active ? 0x01 : 0x00;	/* Passive/Active scanning */
-	cmd.interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
-	cmd.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
-	cmd.own_addr_type = 0x01;		/* ADDR_TYPE_RANDOM */
-	cmd.filter_policy = 0x00;		/* Accept all */
-
-	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
-			&cmd, sizeof(cmd),
-			set_recv_scan_enable, pvt, NULL);
-}
-
-static bool simple_match(const void *a, const void *b)
-{
-	return a == b;
-}
-
-static bool find_by_ad_type(const void *a, const void *b)
-{
-	const struct tx_pkt *tx = a;
-	uint8_t ad_type = L_PTR_TO_UINT(b);
-
-	return !ad_type || ad_type == tx->pkt[0];
-}
-
-static bool find_by_pattern(const void *a, const void *b)
-{
-	const struct tx_pkt *tx = a;
-	const struct tx_pattern *pattern = b;
-
-	if (tx->len < pattern->len)
-		return false;
-
-	return (!memcmp(tx->pkt, pattern->data, pattern->len));
-}
-
-static bool find_active(const void *a, const void *b)
-{
-	const struct pvt_rx_reg *rx_reg = a;
-
-	/* Mesh specific AD types do *not* require active scanning,
-	 * so do not turn on Active Scanning on their account.
+	/*
+	 * The scan parameters and the readiness of the I/O follow from the
+	 * supported commands, either configure_legacy() or the extended
+	 * advertising sets.
 	 */
-	if (rx_reg->filter[0] < MESH_AD_TYPE_PROVISION ||
-			rx_reg->filter[0] > MESH_AD_TYPE_BEACON)
-		return true;
-
-	return false;
-}
-
-static void restart_scan(struct mesh_io_private *pvt)
-{
-	struct bt_hci_cmd_le_set_scan_enable cmd;
-
-	if (l_queue_isempty(pvt->rx_regs))
-		return;
-
-	pvt->active = l_queue_find(pvt->rx_regs, find_active, NULL);
-	cmd.enable = 0x00;	/* Disable scanning */
-	cmd.filter_dup = 0x00;	/* Report duplicates */
-	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), scan_disable_rsp, pvt, NULL);
 }
 
 static void hci_init(void *user_data)
 {
 	struct mesh_io *io = user_data;
 	bool result = true;
-	bool restarted = false;
+
+	io->pvt->restarted = false;
+	io->pvt->num_sets = 0;
 
 	if (io->pvt->hci) {
-		restarted = true;
+		io->pvt->restarted = true;
 		bt_hci_unref(io->pvt->hci);
 	}
 
@@ -400,6 +808,7 @@ static void hci_init(void *user_data)
 	}
 
 	if (result) {
+		attach_adv_filter(io->pvt);
 		configure_hci(io->pvt);
 
 		bt_hci_register(io->pvt->hci, BT_HCI_EVT_LE_META_EVENT,
@@ -407,8 +816,8 @@ static void hci_init(void *user_data)
 
 		l_debug("Started mesh on hci %u", io->pvt->index);
 
-		if (restarted)
-			restart_scan(io->pvt);
+		/* Ready once the supported commands are known */
+		return;
 	}
 
 	if (io->pvt->ready_callback)
@@ -461,6 +870,8 @@ static bool dev_destroy(struct mesh_io *io)
 
 	bt_hci_unref(pvt->hci);
 	l_timeout_remove(pvt->tx_timeout);
+	l_idle_remove(pvt->rx_idle);
+	pvt->rx_idle = NULL;
 	l_queue_destroy(pvt->rx_regs, l_free);
 	l_queue_remove_if(pvt->tx_pkts, simple_match, pvt->tx);
 	l_queue_destroy(pvt->tx_pkts, l_free);
@@ -489,6 +900,7 @@ static void send_cancel_done(const void *buf, uint8_t size,
 {
 	struct mesh_io_private *pvt = user_data;
 	struct bt_hci_cmd_le_set_random_address cmd;
+	uint8_t i;
 
 	if (!pvt)
 		return;
@@ -496,6 +908,13 @@ static void send_cancel_done(const void *buf, uint8_t size,
 	pvt->sending = false;
 
 	/* At end of any burst of ADVs, change random address */
+	if (pvt->num_sets) {
+		for (i = 0; i < pvt->num_sets; i++)
+			set_tx_set_addr(pvt, i);
+
+		return;
+	}
+
 	l_getrandom(cmd.addr, 6);
 	cmd.addr[5] |= 0xc0;
 	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_RANDOM_ADDRESS,
@@ -505,15 +924,27 @@ static void send_cancel_done(const void *buf, uint8_t size,
 static void send_cancel(struct mesh_io_private *pvt)
 {
 	struct bt_hci_cmd_le_set_adv_enable cmd;
+	struct bt_hci_cmd_le_set_ext_adv_enable ext_cmd;
 
 	if (!pvt)
 		return;
 
+	memset(pvt->tx_sets, 0, sizeof(pvt->tx_sets));
+
 	if (!pvt->sending) {
 		send_cancel_done(NULL, 0, pvt);
 		return;
 	}
 
+	if (pvt->num_sets) {
+		ext_cmd.enable = 0x00;		/* Disable advertising */
+		ext_cmd.num_of_sets = 0x00;	/* All sets */
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE,
+					&ext_cmd, sizeof(ext_cmd),
+					send_cancel_done, pvt, NULL);
+		return;
+	}
+
 	cmd.enable = 0x00;	/* Disable advertising */
 	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_ADV_ENABLE,
 				&cmd, sizeof(cmd),
@@ -592,11 +1023,139 @@ static void set_send_adv_params(const void *buf, uint8_t size,
 				set_send_adv_data, pvt, NULL);
 }
 
+static void release_tx_set(struct mesh_io_private *pvt, struct tx_pkt *tx)
+{
+	uint8_t i;
+
+	if (!tx)
+		return;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->tx_sets[i].tx != tx)
+			continue;
+
+		/* Stopped along with the next PDU to go out */
+		pvt->tx_sets[i].tx = NULL;
+		pvt->tx_sets[i].done = true;
+	}
+}
+
+static uint8_t get_tx_set(struct mesh_io_private *pvt, struct tx_pkt *tx,
+								bool *loaded)
+{
+	uint8_t i;
+
+	*loaded = true;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->tx_sets[i].tx == tx)
+			return i;
+	}
+
+	*loaded = false;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (!pvt->tx_sets[i].tx)
+			return i;
+	}
+
+	/* Every set is busy, take turns in replacing them */
+	i = pvt->next_set;
+	pvt->next_set = (pvt->next_set + 1) % pvt->num_sets;
+
+	return i;
+}
+
+/*
+ * Each PDU being repeated keeps advertising from its own set until its last
+ * transmission, so that the PDUs go out concurrently instead of taking turns
+ * in the single legacy advertising instance.
+ */
+static void send_pkt_ext(struct mesh_io_private *pvt, struct tx_pkt *tx)
+{
+	uint8_t buf[sizeof(struct bt_hci_cmd_le_set_ext_adv_enable) +
+			TX_SETS_MAX * sizeof(struct bt_hci_cmd_ext_adv_set)];
+	uint8_t data[sizeof(struct bt_hci_cmd_le_set_ext_adv_data) + 31];
+	struct bt_hci_cmd_le_set_ext_adv_enable *cmd = (void *) buf;
+	struct bt_hci_cmd_ext_adv_set *sets = (void *) (cmd + 1);
+	struct bt_hci_cmd_le_set_ext_adv_data *cmd_data = (void *) data;
+	struct tx_set *set;
+	uint8_t handle, i;
+	bool loaded;
+
+	handle = get_tx_set(pvt, tx, &loaded);
+	set = &pvt->tx_sets[handle];
+
+	if (!loaded) {
+		cmd_data->handle = handle;
+		cmd_data->operation = 0x03;		/* Complete data */
+		cmd_data->fragment_preference = 0x01;	/* No fragments */
+		cmd_data->data_len = tx->len + 1;
+		cmd_data->data[0] = tx->len;
+		memcpy(cmd_data->data + 1, tx->pkt, tx->len);
+
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_DATA, data,
+				sizeof(*cmd_data) + cmd_data->data_len,
+				NULL, NULL, NULL);
+	}
+
+	set->tx = tx;
+	set->done = false;
+
+	/* Sets whose PDU went out for the last time are stopped now */
+	memset(buf, 0, sizeof(buf));
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		struct tx_set *other = &pvt->tx_sets[i];
+
+		if (i == handle || !other->done)
+			continue;
+
+		other->done = false;
+
+		if (!other->enabled)
+			continue;
+
+		other->enabled = false;
+		sets[cmd->num_of_sets++].handle = i;
+	}
+
+	if (cmd->num_of_sets)
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE, buf,
+				sizeof(*cmd) + cmd->num_of_sets * sizeof(*sets),
+				NULL, NULL, NULL);
+
+	if (!set->enabled) {
+		memset(buf, 0, sizeof(buf));
+		cmd->enable = 0x01;	/* Enable advertising */
+		cmd->num_of_sets = 0x01;
+		sets[0].handle = handle;
+
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE, buf,
+					sizeof(*cmd) + sizeof(*sets),
+					NULL, NULL, NULL);
+		set->enabled = true;
+	}
+
+	pvt->sending = true;
+
+	if (tx->delete) {
+		release_tx_set(pvt, tx);
+		l_queue_remove_if(pvt->tx_pkts, simple_match, tx);
+		l_free(tx);
+	}
+}
+
 static void send_pkt(struct mesh_io_private *pvt, struct tx_pkt *tx,
 							uint16_t interval)
 {
 	struct bt_hci_cmd_le_set_adv_enable cmd;
 
+	if (pvt->num_sets) {
+		send_pkt_ext(pvt, tx);
+		return;
+	}
+
 	/* Delete superseded packet in favor of new packet */
 	if (pvt->tx && pvt->tx != tx && pvt->tx->delete) {
 		l_queue_remove_if(pvt->tx_pkts, simple_match, pvt->tx);
@@ -776,6 +1335,7 @@ static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 		do {
 			tx = l_queue_remove_if(pvt->tx_pkts, find_by_ad_type,
 							L_UINT_TO_PTR(data[0]));
+			release_tx_set(pvt, tx);
 			l_free(tx);
 
 			if (tx == pvt->tx)
@@ -791,6 +1351,7 @@ static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 		do {
 			tx = l_queue_remove_if(pvt->tx_pkts, find_by_pattern,
 								&pattern);
+			release_tx_set(pvt, tx);
 			l_free(tx);
 
 			if (tx == pvt->tx)
@@ -822,7 +1383,6 @@ static bool find_by_filter(const void *a, const void *b)
 static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 			uint8_t len, mesh_io_recv_func_t cb, void *user_data)
 {
-	struct bt_hci_cmd_le_set_scan_enable cmd;
 	struct mesh_io_private *pvt = io->pvt;
 	struct pvt_rx_reg *rx_reg, *rx_reg_old;
 	bool already_scanning;
@@ -845,6 +1405,7 @@ static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 	already_scanning = !l_queue_isempty(pvt->rx_regs);
 
 	l_queue_push_head(pvt->rx_regs, rx_reg);
+	attach_adv_filter(pvt);
 
 	/* Look for any AD types requiring Active Scanning */
 	if (l_queue_find(pvt->rx_regs, find_active, NULL))
@@ -852,11 +1413,7 @@ static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 
 	if (!already_scanning || pvt->active != active) {
 		pvt->active = active;
-		cmd.enable = 0x00;	/* Disable scanning */
-		cmd.filter_dup = 0x00;	/* Report duplicates */
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), scan_disable_rsp, pvt, NULL);
-
+		scan_enable(pvt, false, scan_disable_rsp);
 	}
 
 	return true;
@@ -865,7 +1422,6 @@ static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 static bool recv_deregister(struct mesh_io *io, const uint8_t *filter,
 								uint8_t len)
 {
-	struct bt_hci_cmd_le_set_scan_enable cmd = {0, 0};
 	struct mesh_io_private *pvt = io->pvt;
 	struct pvt_rx_reg *rx_reg, *rx_reg_tmp;
 	bool active = false;
@@ -881,18 +1437,18 @@ static bool recv_deregister(struct mesh_io *io, const uint8_t *filter,
 
 	l_free(rx_reg_tmp);
 
+	attach_adv_filter(pvt);
+
 	/* Look for any AD types requiring Active Scanning */
 	if (l_queue_find(pvt->rx_regs, find_active, NULL))
 		active = true;
 
 	if (l_queue_isempty(pvt->rx_regs)) {
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-					&cmd, sizeof(cmd), NULL, NULL, NULL);
+		scan_enable(pvt, false, NULL);
 
 	} else if (active != pvt->active) {
 		pvt->active = active;
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), scan_disable_rsp, pvt, NULL);
+		scan_enable(pvt, false, scan_disable_rsp);
 	}
 
 	return true;
@@ -36,6 +36,8 @@ struct mesh_io_private {
 	struct l_queue *rx_regs;
 	struct l_queue *tx_pkts;
 	struct sockaddr_un addr;
+	struct sockaddr_un peer;
+	socklen_t peer_len;
 	int fd;
 	uint16_t interval;
 };
@@ -110,30 +112,53 @@ static void process_rx(struct mesh_io_private *pvt, int8_t rssi,
 	l_queue_foreach(pvt->rx_regs, process_rx_callbacks, &rx);
 }
 
+static ssize_t unit_send(struct mesh_io_private *pvt, const void *buf,
+								size_t len)
+{
+	if (!pvt->peer_len)
+		return send(pvt->fd, buf, len, MSG_DONTWAIT);
+
+	return sendto(pvt->fd, buf, len, MSG_DONTWAIT,
+			(struct sockaddr *) &pvt->peer, pvt->peer_len);
+}
+
 static bool incoming(struct l_io *sio, void *user_data)
 {
 	struct mesh_io_private *pvt = user_data;
 	uint32_t instant;
+	struct sockaddr_un peer;
+	socklen_t peer_len = sizeof(peer);
 	uint8_t buf[31];
-	size_t size;
+	ssize_t size;
+	size_t name_len;
 
 	instant = get_instant();
 
-	size = recv(pvt->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	size = recvfrom(pvt->fd, buf, sizeof(buf), MSG_DONTWAIT,
+					(struct sockaddr *) &peer, &peer_len);
+	if (size < 0)
+		return true;
+
+	/* Reply to whoever talked to us last if they have a bound socket */
+	if (peer_len > offsetof(struct sockaddr_un, sun_path)) {
+		pvt->peer = peer;
+		pvt->peer_len = peer_len;
+	}
 
 	if (size > 9 && buf[0]) {
-		process_rx(pvt, -20, instant, NULL, buf + 1, (uint8_t)size);
+		process_rx(pvt, -20, instant, NULL, buf + 1,
+							(uint8_t) size - 1);
 	} else if (size == 1 && !buf[0] && pvt->unique_name) {
 
 		/* Return DBUS unique name */
-		size = strlen(pvt->unique_name);
+		name_len = strlen(pvt->unique_name);
 
-		if (size > sizeof(buf) - 2)
+		if (name_len > sizeof(buf) - 2)
 			return true;
 
 		buf[0] = 0;
-		memcpy(buf + 1, pvt->unique_name, size + 1);
-		if (send(pvt->fd, buf, size + 2, MSG_DONTWAIT) < 0)
+		memcpy(buf + 1, pvt->unique_name, name_len + 1);
+		if (unit_send(pvt, buf, name_len + 2) < 0)
 			l_error("Failed to send(%d)", errno);
 	}
 
@@ -305,7 +330,7 @@ static bool simple_match(const void *a, const void *b)
 static void send_pkt(struct mesh_io_private *pvt, struct tx_pkt *tx,
 							uint16_t interval)
 {
-	if (send(pvt->fd, tx->pkt, tx->len, MSG_DONTWAIT) < 0)
+	if (unit_send(pvt, tx->pkt, tx->len) < 0)
 		l_error("Failed to send(%d)", errno);
 
 	if (tx->delete) {
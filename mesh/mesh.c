@@ -34,6 +34,7 @@
 #define DEFAULT_PROV_TIMEOUT 60
 #define DEFAULT_CRPL 100
 #define DEFAULT_FRIEND_QUEUE_SZ 32
+#define DEFAULT_MSG_CACHE_SZ 70
 
 #define DEFAULT_ALGORITHMS 0x0001
 
@@ -54,6 +55,7 @@ struct bt_mesh {
 	bool lpn_support;
 	bool proxy_support;
 	uint16_t crpl;
+	uint16_t msg_cache_sz;
 	uint16_t algorithms;
 	uint16_t req_index;
 	uint8_t friend_queue_sz;
@@ -84,6 +86,7 @@ static struct bt_mesh mesh = {
 	.proxy_support = false,
 	.crpl = DEFAULT_CRPL,
 	.friend_queue_sz = DEFAULT_FRIEND_QUEUE_SZ,
+	.msg_cache_sz = DEFAULT_MSG_CACHE_SZ,
 	.initialized = false
 };
 
@@ -203,6 +206,11 @@ uint8_t mesh_get_friend_queue_size(void)
 	return mesh.friend_queue_sz;
 }
 
+uint16_t mesh_get_msg_cache_size(void)
+{
+	return mesh.msg_cache_sz;
+}
+
 static void parse_settings(const char *mesh_conf_fname)
 {
 	struct l_settings *settings;
@@ -242,6 +250,10 @@ static void parse_settings(const char *mesh_conf_fname)
 								&& value < 127)
 		mesh.friend_queue_sz = value;
 
+	if (l_settings_get_uint(settings, "General", "MessageCacheSize", &value)
+					&& value >= 1 && value <= 65535)
+		mesh.msg_cache_sz = value;
+
 	if (l_settings_get_uint(settings, "General", "ProvTimeout", &value))
 		mesh.prov_timeout = value;
 
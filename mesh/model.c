@@ -69,7 +69,28 @@ struct mod_forward {
 	bool done;
 };
 
+/* Publication waiting to be sent with the others queued in this tick */
+struct pub_msg {
+	struct mesh_node *node;
+	struct mesh_model *mod;
+	uint16_t src;
+	uint16_t dst;
+	uint16_t app_idx;
+	uint16_t net_idx;
+	uint16_t interval;
+	uint16_t len;
+	uint8_t ttl;
+	uint8_t cnt;
+	bool cred;
+	bool segmented;
+	bool virt;
+	uint8_t label[16];
+	uint8_t data[];
+};
+
 static struct l_queue *mesh_virtuals;
+static struct l_queue *pub_batch;
+static struct l_idle *pub_idle;
 
 static bool is_internal(uint32_t id)
 {
@@ -399,7 +420,7 @@ static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 
 	for (entry = l_queue_get_entries(app_keys); entry;
 							entry = entry->next) {
-		const uint8_t *old_key = NULL, *new_key = NULL;
+		struct mesh_crypto_key *old_key = NULL, *new_key = NULL;
 		uint8_t old_key_aid, new_key_aid;
 		int app_idx;
 		bool decrypted;
@@ -412,29 +433,31 @@ static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 			continue;
 
 		if (old_key && old_key_aid == key_aid) {
-			decrypted = mesh_crypto_payload_decrypt(virt, virt_size,
-					data, size, szmict, src, dst, key_aid,
-						seq, iv_idx, out, old_key);
+			decrypted = mesh_crypto_payload_decrypt_ctx(virt,
+					virt_size, data, size, szmict, src,
+					dst, key_aid, seq, iv_idx, out,
+					old_key);
 
 			if (decrypted) {
-				print_packet("Used App Key", old_key, 16);
+				print_packet("Used App Key", old_key->key, 16);
 				return app_idx;
 			}
 
-			print_packet("Failed App Key", old_key, 16);
+			print_packet("Failed App Key", old_key->key, 16);
 		}
 
 		if (new_key && new_key_aid == key_aid) {
-			decrypted = mesh_crypto_payload_decrypt(virt, virt_size,
-					data, size, szmict, src, dst, key_aid,
-						seq, iv_idx, out, new_key);
+			decrypted = mesh_crypto_payload_decrypt_ctx(virt,
+					virt_size, data, size, szmict, src,
+					dst, key_aid, seq, iv_idx, out,
+					new_key);
 
 			if (decrypted) {
-				print_packet("Used App Key", new_key, 16);
+				print_packet("Used App Key", new_key->key, 16);
 				return app_idx;
 			}
 
-			print_packet("Failed App Key", new_key, 16);
+			print_packet("Failed App Key", new_key->key, 16);
 		}
 	}
 
@@ -497,19 +520,52 @@ static int virt_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 	return -1;
 }
 
-static bool msg_send(struct mesh_node *node, bool cred, uint16_t src,
-			uint16_t dst, uint16_t app_idx, uint16_t net_idx,
-			uint8_t *label, uint8_t ttl, uint8_t cnt,
-			uint16_t interval, bool segmented, const void *msg,
-			uint16_t msg_len)
+/* Device keys are set up in dev_key, which must be cleared after use */
+static struct mesh_crypto_key *msg_key(struct mesh_node *node,
+					uint16_t app_idx, uint16_t dst,
+					struct mesh_crypto_key *dev_key,
+					uint8_t *key_aid)
+{
+	struct mesh_crypto_key *key;
+	uint8_t buf[16];
+	const uint8_t *dk;
+
+	*key_aid = APP_AID_DEV;
+
+	if (app_idx == APP_IDX_DEV_LOCAL) {
+		dk = node_get_device_key(node);
+		if (!dk)
+			return NULL;
+
+		mesh_crypto_key_init(dev_key, dk);
+		return dev_key;
+	}
+
+	if (app_idx == APP_IDX_DEV_REMOTE) {
+		if (!keyring_get_remote_dev_key(node, dst, buf))
+			return NULL;
+
+		mesh_crypto_key_init(dev_key, buf);
+		return dev_key;
+	}
+
+	key = appkey_get_key(node_get_net(node), app_idx, key_aid);
+	if (!key)
+		l_debug("no app key for (%x)", app_idx);
+
+	return key;
+}
+
+/* out must have room for msg_len plus the largest MIC */
+static bool msg_encrypt_send(struct mesh_node *node, bool cred, uint16_t src,
+			uint16_t dst, struct mesh_crypto_key *key,
+			uint8_t key_aid, uint16_t net_idx, uint8_t *label,
+			uint8_t ttl, uint8_t cnt, uint16_t interval,
+			bool segmented, const void *msg, uint16_t msg_len,
+			uint8_t *out)
 {
-	uint8_t dev_key[16];
 	uint32_t iv_index, seq_num;
-	const uint8_t *key;
-	uint8_t *out;
-	uint8_t key_aid = APP_AID_DEV;
 	bool szmic = false;
-	bool ret = false;
 	uint16_t out_len = msg_len + sizeof(uint32_t);
 	struct mesh_net *net = node_get_net(node);
 
@@ -521,43 +577,108 @@ static bool msg_send(struct mesh_node *node, bool cred, uint16_t src,
 		}
 	}
 
-	if (app_idx == APP_IDX_DEV_LOCAL) {
-		key = node_get_device_key(node);
-		if (!key)
-			return false;
-	} else if (app_idx == APP_IDX_DEV_REMOTE) {
-		if (!keyring_get_remote_dev_key(node, dst, dev_key))
-			return false;
-
-		key = dev_key;
-	} else {
-		key = appkey_get_key(node_get_net(node), app_idx, &key_aid);
-		if (!key) {
-			l_debug("no app key for (%x)", app_idx);
-			return false;
-		}
-	}
-
-	out = l_malloc(out_len);
-
 	iv_index = mesh_net_get_iv_index(net);
 
 	seq_num = mesh_net_next_seq_num(net);
 
-	if (!mesh_crypto_payload_encrypt(label, msg, out, msg_len, src, dst,
-				key_aid, seq_num, iv_index, szmic, key)) {
+	if (!mesh_crypto_payload_encrypt_ctx(label, msg, out, msg_len, src,
+					dst, key_aid, seq_num, iv_index, szmic,
+					key)) {
 		l_error("Failed to Encrypt Payload");
-		goto done;
+		return false;
 	}
 
-	ret =  mesh_net_app_send(net, cred, src, dst, key_aid, net_idx, ttl,
+	return mesh_net_app_send(net, cred, src, dst, key_aid, net_idx, ttl,
 					cnt, interval, seq_num, iv_index,
 					segmented, szmic, out, out_len);
-done:
+}
+
+static bool msg_send(struct mesh_node *node, bool cred, uint16_t src,
+			uint16_t dst, uint16_t app_idx, uint16_t net_idx,
+			uint8_t *label, uint8_t ttl, uint8_t cnt,
+			uint16_t interval, bool segmented, const void *msg,
+			uint16_t msg_len)
+{
+	struct mesh_crypto_key dev_key;
+	struct mesh_crypto_key *key;
+	uint8_t *out;
+	uint8_t key_aid;
+	bool ret;
+
+	key = msg_key(node, app_idx, dst, &dev_key, &key_aid);
+	if (!key)
+		return false;
+
+	out = l_malloc(msg_len + sizeof(uint64_t));
+
+	ret = msg_encrypt_send(node, cred, src, dst, key, key_aid, net_idx,
+					label, ttl, cnt, interval, segmented,
+					msg, msg_len, out);
+
 	l_free(out);
+
+	if (key == &dev_key)
+		mesh_crypto_key_clear(&dev_key);
+
 	return ret;
 }
 
+static bool remove_pub_msg(void *data, void *user_data)
+{
+	struct pub_msg *msg = data;
+
+	if (msg->mod != user_data)
+		return false;
+
+	l_free(msg);
+	return true;
+}
+
+static void pub_batch_send(struct l_idle *idle, void *user_data)
+{
+	struct pub_msg *msg, *prev = NULL;
+	uint8_t out[MAX_MSG_LEN + sizeof(uint64_t)];
+	struct mesh_crypto_key dev_key;
+	struct mesh_crypto_key *key = NULL;
+	uint8_t key_aid = APP_AID_DEV;
+
+	l_idle_remove(pub_idle);
+	pub_idle = NULL;
+
+	while ((msg = l_queue_pop_head(pub_batch))) {
+		/*
+		 * Publications queued back to back mostly share their key.
+		 * Sending can't remove application keys, only the config
+		 * server does that and it is not reached through them.
+		 */
+		if (!prev || prev->node != msg->node ||
+				prev->app_idx != msg->app_idx ||
+				(msg->app_idx == APP_IDX_DEV_REMOTE &&
+						prev->dst != msg->dst)) {
+			if (key == &dev_key)
+				mesh_crypto_key_clear(&dev_key);
+
+			key = msg_key(msg->node, msg->app_idx, msg->dst,
+							&dev_key, &key_aid);
+		}
+
+		if (key && !msg_encrypt_send(msg->node, msg->cred, msg->src,
+					msg->dst, key, key_aid, msg->net_idx,
+					msg->virt ? msg->label : NULL, msg->ttl,
+					msg->cnt, msg->interval, msg->segmented,
+					msg->data, msg->len, out))
+			l_debug("publication to %4.4x failed", msg->dst);
+
+		l_free(prev);
+		prev = msg;
+	}
+
+	if (key == &dev_key)
+		mesh_crypto_key_clear(&dev_key);
+
+	l_free(prev);
+}
+
 static void remove_pub(struct mesh_node *node, uint16_t ele_idx,
 							struct mesh_model *mod)
 {
@@ -770,9 +891,9 @@ static int add_sub(struct mesh_net *net, struct mesh_model *mod,
 }
 
 static void send_dev_key_msg_rcvd(struct mesh_node *node, uint8_t ele_idx,
-					uint16_t src, uint16_t app_idx,
-					uint16_t net_idx, uint16_t size,
-					const uint8_t *data)
+					uint16_t src, uint16_t dst,
+					uint16_t app_idx, uint16_t net_idx,
+					uint16_t size, const uint8_t *data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
 	struct l_dbus_message *msg;
@@ -781,6 +902,10 @@ static void send_dev_key_msg_rcvd(struct mesh_node *node, uint8_t ele_idx,
 	const char *path;
 	bool remote = (app_idx != APP_IDX_DEV_LOCAL);
 
+	if (node_msg_channel_dev_key_recv(node, ele_idx, src, dst, remote,
+							net_idx, data, size))
+		return;
+
 	owner = node_get_owner(node);
 	path = node_get_element_path(node, ele_idx);
 	if (!path || !owner)
@@ -817,6 +942,11 @@ static void send_msg_rcvd(struct mesh_node *node, uint8_t ele_idx,
 	const char *owner;
 	const char *path;
 
+	if (node_msg_channel_recv(node, ele_idx, src, dst,
+					virt ? virt->label : NULL, app_idx,
+					data, size))
+		return;
+
 	owner = node_get_owner(node);
 	path = node_get_element_path(node, ele_idx);
 	if (!path || !owner)
@@ -947,9 +1077,10 @@ bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 						forward.data);
 			else if (decrypt_idx == APP_IDX_DEV_REMOTE ||
 				 decrypt_idx == APP_IDX_DEV_LOCAL)
-				send_dev_key_msg_rcvd(node, i, src, decrypt_idx,
-							net_idx, forward.size,
-								forward.data);
+				send_dev_key_msg_rcvd(node, i, src, dst,
+							decrypt_idx, net_idx,
+							forward.size,
+							forward.data);
 		}
 
 		/*
@@ -982,12 +1113,12 @@ int mesh_model_publish(struct mesh_node *node, uint32_t id, uint16_t src,
 {
 	struct mesh_net *net = node_get_net(node);
 	struct mesh_model *mod;
-	uint8_t *label = NULL;
-	uint16_t net_idx;
-	bool result;
+	struct pub_msg *pub;
+	struct mesh_crypto_key dev_key, *key;
+	uint8_t key_aid;
 	int ele_idx;
 
-	if (!net || msg_len > 380)
+	if (!net || msg_len > MAX_MSG_LEN)
 		return MESH_ERROR_INVALID_ARGS;
 
 	/* If SRC is 0, use the Primary Element */
@@ -1010,17 +1141,40 @@ int mesh_model_publish(struct mesh_node *node, uint32_t id, uint16_t src,
 	if (IS_UNASSIGNED(mod->pub->addr))
 		return MESH_ERROR_DOES_NOT_EXIST;
 
-	if (mod->pub->virt)
-		label = mod->pub->virt->label;
+	/* Fail now for a missing key, it is looked up again when sending */
+	key = msg_key(node, mod->pub->idx, mod->pub->addr, &dev_key, &key_aid);
+	if (!key)
+		return MESH_ERROR_FAILED;
+
+	if (key == &dev_key)
+		mesh_crypto_key_clear(&dev_key);
+
+	pub = l_malloc(sizeof(*pub) + msg_len);
+	pub->node = node;
+	pub->mod = mod;
+	pub->src = src;
+	pub->dst = mod->pub->addr;
+	pub->app_idx = mod->pub->idx;
+	pub->net_idx = appkey_net_idx(net, mod->pub->idx);
+	pub->interval = mod->pub->rtx.interval;
+	pub->len = msg_len;
+	pub->ttl = mod->pub->ttl;
+	pub->cnt = mod->pub->rtx.cnt;
+	pub->cred = mod->pub->credential != 0;
+	pub->segmented = segmented;
+	pub->virt = mod->pub->virt != NULL;
 
-	net_idx = appkey_net_idx(net, mod->pub->idx);
+	if (pub->virt)
+		memcpy(pub->label, mod->pub->virt->label, 16);
 
-	result = msg_send(node, mod->pub->credential != 0, src, mod->pub->addr,
-				mod->pub->idx, net_idx, label, mod->pub->ttl,
-				mod->pub->rtx.cnt, mod->pub->rtx.interval,
-				segmented, msg, msg_len);
+	memcpy(pub->data, msg, msg_len);
 
-	return result ? MESH_ERROR_NONE : MESH_ERROR_FAILED;
+	l_queue_push_tail(pub_batch, pub);
+
+	if (!pub_idle)
+		pub_idle = l_idle_create(pub_batch_send, NULL, NULL);
+
+	return MESH_ERROR_NONE;
 }
 
 bool mesh_model_send(struct mesh_node *node, uint16_t src, uint16_t dst,
@@ -1138,6 +1292,7 @@ void mesh_model_free(void *data)
 {
 	struct mesh_model *mod = data;
 
+	l_queue_foreach_remove(pub_batch, remove_pub_msg, mod);
 	l_queue_destroy(mod->bindings, NULL);
 	l_queue_destroy(mod->subs, NULL);
 	l_queue_destroy(mod->virtuals, unref_virt);
@@ -1958,10 +2113,16 @@ done:
 void mesh_model_init(void)
 {
 	mesh_virtuals = l_queue_new();
+	pub_batch = l_queue_new();
 }
 
 void mesh_model_cleanup(void)
 {
 	l_queue_destroy(mesh_virtuals, l_free);
 	mesh_virtuals = NULL;
+
+	l_idle_remove(pub_idle);
+	pub_idle = NULL;
+	l_queue_destroy(pub_batch, l_free);
+	pub_batch = NULL;
 }
@@ -28,8 +28,13 @@
 #define BEACON_INTERVAL_MIN	10
 #define BEACON_INTERVAL_MAX	600
 
+/* Beacons of all keys due within this window are sent in one wakeup */
+#define BEACON_ALIGN_MS		2000
+
+#define NID_MASK		0x7f
+
 struct net_beacon {
-	struct l_timeout *timeout;
+	uint64_t due;
 	uint32_t ts;
 	uint16_t observe_period;
 	uint16_t observed;
@@ -46,14 +51,18 @@ struct net_key {
 	uint8_t friend_key;
 	uint8_t nid;
 	uint8_t flooding[16];
-	uint8_t encrypt[16];
-	uint8_t privacy[16];
-	uint8_t beacon[16];
+	struct mesh_crypto_key encrypt;
+	struct mesh_crypto_key privacy;
+	struct mesh_crypto_key beacon;
 	uint8_t network[8];
 };
 
 static struct l_queue *keys = NULL;
 static uint32_t last_flooding_id = 0;
+static struct l_timeout *beacon_timeout;
+
+/* Keys sharing the same NID, most recently used first */
+static struct l_queue *nid_keys[NID_MASK + 1];
 
 /* To avoid re-decrypting same packet for multiple nodes, cache and check */
 static uint8_t cache_pkt[29];
@@ -63,6 +72,18 @@ static size_t cache_plainlen;
 static uint32_t cache_id;
 static uint32_t cache_iv_index;
 
+static void schedule_beacons(void);
+
+static void net_key_free(void *data)
+{
+	struct net_key *key = data;
+
+	mesh_crypto_key_clear(&key->encrypt);
+	mesh_crypto_key_clear(&key->privacy);
+	mesh_crypto_key_clear(&key->beacon);
+	l_free(key);
+}
+
 static bool match_flooding(const void *a, const void *b)
 {
 	const struct net_key *key = a;
@@ -104,8 +125,8 @@ uint32_t net_key_add(const uint8_t flooding[16])
 	key = l_new(struct net_key, 1);
 	memcpy(key->flooding, flooding, 16);
 	key->ref_cnt++;
-	result = mesh_crypto_k2(flooding, p, sizeof(p), &key->nid, key->encrypt,
-								key->privacy);
+	result = mesh_crypto_k2(flooding, p, sizeof(p), &key->nid,
+					key->encrypt.key, key->privacy.key);
 	if (!result)
 		goto fail;
 
@@ -113,16 +134,21 @@ uint32_t net_key_add(const uint8_t flooding[16])
 	if (!result)
 		goto fail;
 
-	result = mesh_crypto_nkbk(flooding, key->beacon);
+	result = mesh_crypto_nkbk(flooding, key->beacon.key);
 	if (!result)
 		goto fail;
 
 	key->id = ++last_flooding_id;
 	l_queue_push_tail(keys, key);
+
+	if (!nid_keys[key->nid])
+		nid_keys[key->nid] = l_queue_new();
+
+	l_queue_push_tail(nid_keys[key->nid], key);
 	return key->id;
 
 fail:
-	l_free(key);
+	net_key_free(key);
 	return 0;
 }
 
@@ -146,10 +172,10 @@ uint32_t net_key_frnd_add(uint32_t flooding_id, uint16_t lpn, uint16_t frnd,
 	l_put_be16(fn_cnt, p + 7);
 
 	result = mesh_crypto_k2(key->flooding, p, sizeof(p), &frnd_key->nid,
-				frnd_key->encrypt, frnd_key->privacy);
+				frnd_key->encrypt.key, frnd_key->privacy.key);
 
 	if (!result) {
-		l_free(frnd_key);
+		net_key_free(frnd_key);
 		return 0;
 	}
 
@@ -158,6 +184,11 @@ uint32_t net_key_frnd_add(uint32_t flooding_id, uint16_t lpn, uint16_t frnd,
 	frnd_key->id = ++last_flooding_id;
 	l_queue_push_head(keys, frnd_key);
 
+	if (!nid_keys[frnd_key->nid])
+		nid_keys[frnd_key->nid] = l_queue_new();
+
+	l_queue_push_head(nid_keys[frnd_key->nid], frnd_key);
+
 	return frnd_key->id;
 }
 
@@ -167,9 +198,10 @@ void net_key_unref(uint32_t id)
 
 	if (key && key->ref_cnt) {
 		if (--key->ref_cnt == 0) {
-			l_timeout_remove(key->snb.timeout);
 			l_queue_remove(keys, key);
-			l_free(key);
+			l_queue_remove(nid_keys[key->nid], key);
+			net_key_free(key);
+			schedule_beacons();
 		}
 	}
 }
@@ -196,17 +228,18 @@ bool net_key_retrieve(uint32_t id, uint8_t *flooding)
 	return false;
 }
 
-static void decrypt_net_pkt(void *a, void *b)
+static bool decrypt_net_pkt(const void *a, const void *b)
 {
-	const struct net_key *key = a;
+	/* The key contexts are set up on first use */
+	struct net_key *key = (struct net_key *) a;
 	bool result;
 
-	if (cache_id || !key->ref_cnt || (cache_pkt[0] & 0x7f) != key->nid)
-		return;
+	if (!key->ref_cnt)
+		return false;
 
-	result = mesh_crypto_packet_decode(cache_pkt, cache_len, false,
+	result = mesh_crypto_packet_decode_ctx(cache_pkt, cache_len, false,
 						cache_plain, cache_iv_index,
-						key->encrypt, key->privacy);
+						&key->encrypt, &key->privacy);
 
 	if (result) {
 		cache_id = key->id;
@@ -215,11 +248,16 @@ static void decrypt_net_pkt(void *a, void *b)
 		else
 			cache_plainlen = cache_len - 4;
 	}
+
+	return result;
 }
 
 uint32_t net_key_decrypt(uint32_t iv_index, const uint8_t *pkt, size_t len,
 					uint8_t **plain, size_t *plain_len)
 {
+	struct l_queue *bucket;
+	struct net_key *key;
+
 	/* If we already successfully decrypted this packet, use cached data */
 	if (cache_id && cache_len == len && !memcmp(pkt, cache_pkt, len)) {
 		/* IV Index must match what was used to decrypt */
@@ -234,8 +272,15 @@ uint32_t net_key_decrypt(uint32_t iv_index, const uint8_t *pkt, size_t len,
 	cache_len = len;
 	cache_iv_index = iv_index;
 
-	/* Try all network keys known to us */
-	l_queue_foreach(keys, decrypt_net_pkt, NULL);
+	/* Try the network keys known to us with the same NID */
+	bucket = nid_keys[pkt[0] & NID_MASK];
+	key = l_queue_find(bucket, decrypt_net_pkt, NULL);
+
+	/* Keep the key around at the front for the next packets */
+	if (key && l_queue_peek_head(bucket) != key) {
+		l_queue_remove(bucket, key);
+		l_queue_push_head(bucket, key);
+	}
 
 done:
 	if (cache_id) {
@@ -254,8 +299,8 @@ bool net_key_encrypt(uint32_t id, uint32_t iv_index, uint8_t *pkt, size_t len)
 	if (!key)
 		return false;
 
-	result = mesh_crypto_packet_encode(pkt, len, iv_index, key->encrypt,
-							key->privacy);
+	result = mesh_crypto_packet_encode_ctx(pkt, len, iv_index,
+						&key->encrypt, &key->privacy);
 
 	if (!result)
 		return false;
@@ -285,8 +330,8 @@ bool net_key_snb_check(uint32_t id, uint32_t iv_index, bool kr, bool ivu,
 		return false;
 
 	/* Any behavioral changes must pass CMAC test */
-	if (!mesh_crypto_beacon_cmac(key->beacon, key->network, iv_index, kr,
-							ivu, &cmac_check)) {
+	if (!mesh_crypto_beacon_cmac_ctx(&key->beacon, key->network, iv_index,
+						kr, ivu, &cmac_check)) {
 		l_error("mesh_crypto_beacon_cmac failed");
 		return false;
 	}
@@ -310,8 +355,8 @@ bool net_key_snb_compose(uint32_t id, uint32_t iv_index, bool kr, bool ivu,
 		return false;
 
 	/* Any behavioral changes must pass CMAC test */
-	if (!mesh_crypto_beacon_cmac(key->beacon, key->network, iv_index, kr,
-								ivu, &cmac)) {
+	if (!mesh_crypto_beacon_cmac_ctx(&key->beacon, key->network, iv_index,
+							kr, ivu, &cmac)) {
 		l_error("mesh_crypto_beacon_cmac failed");
 		return false;
 	}
@@ -346,9 +391,8 @@ static void send_network_beacon(struct net_key *key)
 	mesh_io_send(NULL, &info, key->snb.beacon, sizeof(key->snb.beacon));
 }
 
-static void snb_timeout(struct l_timeout *timeout, void *user_data)
+static void snb_process(struct net_key *key, uint64_t now)
 {
-	struct net_key *key = user_data;
 	uint32_t interval, scale_factor;
 
 	/* Always send at least one beacon */
@@ -404,11 +448,56 @@ static void snb_timeout(struct l_timeout *timeout, void *user_data)
 	key->snb.half_period = !key->snb.half_period;
 
 	if (key->beacon_enables)
-		l_timeout_modify(timeout, interval);
-	else {
-		l_timeout_remove(timeout);
-		key->snb.timeout = NULL;
+		key->snb.due = now + interval * 1000;
+	else
+		key->snb.due = 0;
+}
+
+static void beacon_timeout_cb(struct l_timeout *timeout, void *user_data)
+{
+	const struct l_queue_entry *entry;
+	uint64_t now = get_timestamp_ms();
+
+	/*
+	 * Send the beacons of every key due soon along with the ones due now
+	 * instead of waking up again for each of them.
+	 */
+	for (entry = l_queue_get_entries(keys); entry; entry = entry->next) {
+		struct net_key *key = entry->data;
+
+		if (key->snb.due && key->snb.due <= now + BEACON_ALIGN_MS)
+			snb_process(key, now);
+	}
+
+	schedule_beacons();
+}
+
+static void schedule_beacons(void)
+{
+	const struct l_queue_entry *entry;
+	uint64_t now, due = 0;
+
+	for (entry = l_queue_get_entries(keys); entry; entry = entry->next) {
+		struct net_key *key = entry->data;
+
+		if (key->snb.due && (!due || key->snb.due < due))
+			due = key->snb.due;
+	}
+
+	if (!due) {
+		l_timeout_remove(beacon_timeout);
+		beacon_timeout = NULL;
+		return;
 	}
+
+	now = get_timestamp_ms();
+	due = due > now ? due - now : 1;
+
+	if (beacon_timeout)
+		l_timeout_modify_ms(beacon_timeout, due);
+	else
+		beacon_timeout = l_timeout_create_ms(due, beacon_timeout_cb,
+								NULL, NULL);
 }
 
 void net_key_beacon_seen(uint32_t id)
@@ -457,8 +546,8 @@ void net_key_beacon_enable(uint32_t id)
 	key->snb.expected = 2;
 	key->snb.observed = 0;
 	key->snb.half_period = true;
-	l_timeout_remove(key->snb.timeout);
-	key->snb.timeout = l_timeout_create_ms(rand_ms, snb_timeout, key, NULL);
+	key->snb.due = get_timestamp_ms() + rand_ms;
+	schedule_beacons();
 }
 
 bool net_key_beacon_refresh(uint32_t id, uint32_t iv_index, bool kr, bool ivu)
@@ -488,12 +577,8 @@ bool net_key_beacon_refresh(uint32_t id, uint32_t iv_index, bool kr, bool ivu)
 	l_getrandom(&rand_ms, sizeof(rand_ms));
 	rand_ms %= 1000;
 	key->snb.expected++;
-
-	if (key->snb.timeout)
-		l_timeout_modify_ms(key->snb.timeout, 500 + rand_ms);
-	else
-		key->snb.timeout = l_timeout_create_ms(500 + rand_ms,
-						snb_timeout, key, NULL);
+	key->snb.due = get_timestamp_ms() + 500 + rand_ms;
+	schedule_beacons();
 
 	return true;
 }
@@ -511,12 +596,22 @@ void net_key_beacon_disable(uint32_t id)
 		return;
 
 	/* Disable periodic Beaconing on this key */
-	l_timeout_remove(key->snb.timeout);
-	key->snb.timeout = NULL;
+	key->snb.due = 0;
+	schedule_beacons();
 }
 
 void net_key_cleanup(void)
 {
-	l_queue_destroy(keys, l_free);
+	unsigned int i;
+
+	for (i = 0; i <= NID_MASK; i++) {
+		l_queue_destroy(nid_keys[i], NULL);
+		nid_keys[i] = NULL;
+	}
+
+	l_queue_destroy(keys, net_key_free);
 	keys = NULL;
+
+	l_timeout_remove(beacon_timeout);
+	beacon_timeout = NULL;
 }
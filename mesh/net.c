@@ -15,10 +15,12 @@
 #define _GNU_SOURCE
 
 #include <sys/time.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
 #include "mesh/mesh-defs.h"
+#include "mesh/mesh.h"
 #include "mesh/util.h"
 #include "mesh/crypto.h"
 #include "mesh/net-keys.h"
@@ -50,9 +52,9 @@
 #define DEFAULT_TRANSMIT_COUNT		1
 #define DEFAULT_TRANSMIT_INTERVAL	100
 
-#define SAR_KEY(src, seq0)	((((uint32_t)(seq0)) << 16) | (src))
+#define RPL_SAVE_DELAY			1
 
-#define FAST_CACHE_SIZE 8
+#define SAR_KEY(src, seq0)	((((uint32_t)(seq0)) << 16) | (src))
 
 enum _relay_advice {
 	RELAY_NONE,		/* Relay not enabled in node */
@@ -131,27 +133,47 @@ struct mesh_net {
 	uint16_t features;
 
 	struct l_queue *subnets;
-	struct l_queue *msg_cache;
-	struct l_queue *replay_cache;
+	struct msg_cache *msg_cache;
+	struct l_hashmap *replay_cache;		/* mesh_rpl entries by src */
+	struct l_queue *replay_pending;		/* Entries not saved yet */
+	struct l_timeout *replay_save;
 	struct l_queue *sar_in;
 	struct l_queue *sar_out;
 	struct l_queue *sar_queue;
+	struct l_timeout *sar_out_timeout;	/* Shared by all of sar_out */
 	struct l_queue *frnd_msgs;
 	struct l_queue *friends;
+	uint32_t frnd_pkts;		/* Friend queue slots allocated */
+	uint32_t frnd_pkts_used;
 	struct l_queue *negotiations;
 	struct l_queue *destinations;
 };
 
-struct mesh_msg {
-	uint16_t src;
-	uint32_t seq;
+struct msg_cache_entry {
+	uint64_t id;
 	uint32_t mic;
 };
 
+/*
+ * Fixed size set of recently seen messages. The entries are kept in a ring
+ * in arrival order, the oldest one being overwritten once it is full, and
+ * indexed by an open addressing hash table of twice the ring size.
+ */
+struct msg_cache {
+	struct msg_cache_entry *ring;
+	uint32_t *table;		/* Ring index + 1, 0 if unused */
+	unsigned int size;
+	unsigned int count;
+	unsigned int next;		/* Oldest entry once full */
+	unsigned int mask;
+};
+
 struct mesh_sar {
 	unsigned int id;
 	struct l_timeout *seg_timeout;
 	struct l_timeout *msg_timeout;
+	uint64_t seg_expire;		/* Outgoing only, in ms */
+	uint64_t msg_expire;
 	uint32_t flags;
 	uint32_t last_nak;
 	uint32_t iv_index;
@@ -217,11 +239,109 @@ struct net_beacon_data {
 	bool processed;
 };
 
-static struct l_queue *fast_cache;
+static struct msg_cache *fast_cache;
 static struct l_queue *nets;
 
 static void net_rx(void *net_ptr, void *user_data);
 
+static struct msg_cache *msg_cache_new(unsigned int size)
+{
+	struct msg_cache *cache = l_new(struct msg_cache, 1);
+	unsigned int table_size = 1;
+
+	while (table_size < size * 2)
+		table_size <<= 1;
+
+	cache->ring = l_new(struct msg_cache_entry, size);
+	cache->table = l_new(uint32_t, table_size);
+	cache->size = size;
+	cache->mask = table_size - 1;
+
+	return cache;
+}
+
+static void msg_cache_free(struct msg_cache *cache)
+{
+	if (!cache)
+		return;
+
+	l_free(cache->ring);
+	l_free(cache->table);
+	l_free(cache);
+}
+
+static void msg_cache_clear(struct msg_cache *cache)
+{
+	memset(cache->table, 0, (cache->mask + 1) * sizeof(*cache->table));
+	cache->count = 0;
+	cache->next = 0;
+}
+
+static unsigned int msg_cache_slot(struct msg_cache *cache,
+					const struct msg_cache_entry *entry)
+{
+	uint64_t hash = (entry->id ^ ((uint64_t) entry->mic << 24)) *
+							0x9e3779b97f4a7c15ULL;
+
+	return (hash >> 32) & cache->mask;
+}
+
+static void msg_cache_evict(struct msg_cache *cache, unsigned int index)
+{
+	unsigned int i, j, k;
+
+	i = msg_cache_slot(cache, &cache->ring[index]);
+	while (cache->table[i] != index + 1)
+		i = (i + 1) & cache->mask;
+
+	/* Move back the entries that would not be found past the hole */
+	for (j = i;;) {
+		j = (j + 1) & cache->mask;
+		if (!cache->table[j])
+			break;
+
+		k = msg_cache_slot(cache, &cache->ring[cache->table[j] - 1]);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		cache->table[i] = cache->table[j];
+		i = j;
+	}
+
+	cache->table[i] = 0;
+}
+
+/* Returns true if the message was already in the cache, adds it otherwise */
+static bool msg_cache_check(struct msg_cache *cache, uint64_t id, uint32_t mic)
+{
+	struct msg_cache_entry entry = { .id = id, .mic = mic };
+	unsigned int i;
+
+	for (i = msg_cache_slot(cache, &entry); cache->table[i];
+					i = (i + 1) & cache->mask) {
+		struct msg_cache_entry *e = &cache->ring[cache->table[i] - 1];
+
+		if (e->id == id && e->mic == mic)
+			return true;
+	}
+
+	if (cache->count == cache->size) {
+		msg_cache_evict(cache, cache->next);
+
+		/* The hole left may be closer to the key than the slot found */
+		for (i = msg_cache_slot(cache, &entry); cache->table[i];
+						i = (i + 1) & cache->mask)
+			;
+	} else
+		cache->count++;
+
+	cache->ring[cache->next] = entry;
+	cache->table[i] = cache->next + 1;
+	cache->next = (cache->next + 1) % cache->size;
+
+	return false;
+}
+
 static inline struct mesh_subnet *get_primary_subnet(struct mesh_net *net)
 {
 	return l_queue_peek_head(net->subnets);
@@ -303,10 +423,43 @@ static bool match_by_friend(const void *a, const void *b)
 	return frnd->lp_addr == dst;
 }
 
+static struct mesh_friend_msg *friend_pkt_alloc(struct mesh_friend *frnd)
+{
+	int i = __builtin_ffsll(frnd->pkt_free);
+
+	if (!i)
+		return NULL;
+
+	i--;
+	frnd->pkt_free &= ~(1ULL << i);
+	frnd->net->frnd_pkts_used++;
+
+	return (void *) (frnd->pkt_pool + i * FRND_MSG_SIZE);
+}
+
+void mesh_friend_pkt_free(struct mesh_friend *frnd,
+						struct mesh_friend_msg *pkt)
+{
+	size_t i = ((uint8_t *) pkt - frnd->pkt_pool) / FRND_MSG_SIZE;
+
+	frnd->pkt_free |= 1ULL << i;
+	frnd->net->frnd_pkts_used--;
+}
+
 static void free_friend_internals(struct mesh_friend *frnd)
 {
-	if (frnd->pkt_cache)
-		l_queue_destroy(frnd->pkt_cache, l_free);
+	if (frnd->pkt_pool) {
+		unsigned int unused = __builtin_popcountll(frnd->pkt_free);
+
+		frnd->net->frnd_pkts -= FRND_CACHE_MAX + 1;
+		frnd->net->frnd_pkts_used -= FRND_CACHE_MAX + 1 - unused;
+	}
+
+	/* Entries live in pkt_pool */
+	l_queue_destroy(frnd->pkt_cache, NULL);
+	l_free(frnd->pkt_pool);
+	frnd->pkt_pool = NULL;
+	frnd->pkt_free = 0;
 
 	l_free(frnd->u.active.grp_list);
 	frnd->u.active.grp_list = NULL;
@@ -386,6 +539,11 @@ struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 	frnd->pkt_cache = l_queue_new();
 	frnd->net_key_upd = 0;
 
+	/* One more than the queue holds, as overflow is pushed before popped */
+	frnd->pkt_pool = l_malloc((FRND_CACHE_MAX + 1) * FRND_MSG_SIZE);
+	frnd->pkt_free = (1ULL << (FRND_CACHE_MAX + 1)) - 1;
+	net->frnd_pkts += FRND_CACHE_MAX + 1;
+
 	subnet = get_primary_subnet(net);
 	/* TODO: the primary key must be present, do we need to add check?. */
 
@@ -617,20 +775,21 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 	net->tx_interval = DEFAULT_TRANSMIT_INTERVAL;
 
 	net->subnets = l_queue_new();
-	net->msg_cache = l_queue_new();
+	net->msg_cache = msg_cache_new(mesh_get_msg_cache_size());
 	net->sar_in = l_queue_new();
 	net->sar_out = l_queue_new();
 	net->sar_queue = l_queue_new();
 	net->frnd_msgs = l_queue_new();
 	net->destinations = l_queue_new();
 	net->app_keys = l_queue_new();
-	net->replay_cache = l_queue_new();
+	net->replay_cache = l_hashmap_new();
+	net->replay_pending = l_queue_new();
 
 	if (!nets)
 		nets = l_queue_new();
 
 	if (!fast_cache)
-		fast_cache = l_queue_new();
+		fast_cache = msg_cache_new(mesh_get_msg_cache_size());
 
 	return net;
 }
@@ -643,9 +802,13 @@ void mesh_net_free(void *user_data)
 		return;
 
 	l_queue_destroy(net->subnets, subnet_free);
-	l_queue_destroy(net->msg_cache, l_free);
-	l_queue_destroy(net->replay_cache, l_free);
+	msg_cache_free(net->msg_cache);
+	/* Updates not saved yet are dropped, see mesh_net_save_rpl() */
+	l_timeout_remove(net->replay_save);
+	l_queue_destroy(net->replay_pending, NULL);
+	l_hashmap_destroy(net->replay_cache, l_free);
 	l_queue_destroy(net->sar_in, mesh_sar_free);
+	l_timeout_remove(net->sar_out_timeout);
 	l_queue_destroy(net->sar_out, mesh_sar_free);
 	l_queue_destroy(net->sar_queue, mesh_sar_free);
 	l_queue_destroy(net->frnd_msgs, l_free);
@@ -659,7 +822,7 @@ void mesh_net_free(void *user_data)
 
 void mesh_net_cleanup(void)
 {
-	l_queue_destroy(fast_cache, l_free);
+	msg_cache_free(fast_cache);
 	fast_cache = NULL;
 	l_queue_destroy(nets, mesh_net_free);
 	nets = NULL;
@@ -1004,60 +1167,32 @@ void mesh_net_set_frnd_seq(struct mesh_net *net, bool seq)
 	net->friend_seq = seq;
 }
 
-static bool match_cache(const void *a, const void *b)
-{
-	const struct mesh_msg *msg = a;
-	const struct mesh_msg *tst = b;
-
-	if (msg->seq != tst->seq || msg->mic != tst->mic ||
-					msg->src != tst->src)
-		return false;
-
-	return true;
-}
-
 static bool msg_in_cache(struct mesh_net *net, uint16_t src, uint32_t seq,
 								uint32_t mic)
 {
-	struct mesh_msg *msg;
-	struct mesh_msg tst = {
-		.src = src,
-		.seq = seq,
-		.mic = mic,
-	};
-
-	msg = l_queue_remove_if(net->msg_cache, match_cache, &tst);
-
-	if (msg) {
+	if (msg_cache_check(net->msg_cache, ((uint64_t) src << 24) | seq,
+								mic)) {
 		l_debug("Supressing duplicate %4.4x + %6.6x + %8.8x",
 							src, seq, mic);
-		l_queue_push_head(net->msg_cache, msg);
 		return true;
 	}
 
-	msg = l_new(struct mesh_msg, 1);
-	*msg = tst;
-	l_queue_push_head(net->msg_cache, msg);
 	l_debug("Add %4.4x + %6.6x + %8.8x", src, seq, mic);
 
-	if (l_queue_length(net->msg_cache) > MSG_CACHE_SIZE) {
-		msg = l_queue_peek_tail(net->msg_cache);
-		/* Remove Tail (oldest msg in cache) */
-		l_debug("Remove %4.4x + %6.6x + %8.8x",
-						msg->src, msg->seq, msg->mic);
-		if (l_queue_remove(net->msg_cache, msg))
-			l_free(msg);
-	}
-
 	return false;
 }
 
+struct sar_match {
+	uint16_t src;
+	uint16_t seqZero;
+};
+
 static bool match_sar_seq0(const void *a, const void *b)
 {
 	const struct mesh_sar *sar = a;
-	uint16_t seqZero = L_PTR_TO_UINT(b);
+	const struct sar_match *match = b;
 
-	return sar->seqZero == seqZero;
+	return sar->seqZero == match->seqZero && sar->src == match->src;
 }
 
 static bool match_sar_remote(const void *a, const void *b)
@@ -1243,7 +1378,7 @@ enqueue:
 				 */
 				frnd->u.active.last = frnd->u.active.seq;
 
-			l_free(old);
+			mesh_friend_pkt_free(frnd, old);
 
 		} while (true);
 	}
@@ -1259,7 +1394,12 @@ enqueue:
 	} else
 		size = sizeof(struct mesh_friend_msg);
 
-	pkt = l_malloc(size);
+	pkt = friend_pkt_alloc(frnd);
+	if (!pkt) {
+		l_error("Friend queue for %4.4x exhausted", frnd->lp_addr);
+		return;
+	}
+
 	memcpy(pkt, rx, size);
 
 	l_queue_push_tail(frnd->pkt_cache, pkt);
@@ -1270,7 +1410,7 @@ enqueue:
 		 * (disallowed per spec)
 		 */
 		pkt = l_queue_pop_head(frnd->pkt_cache);
-		l_free(pkt);
+		mesh_friend_pkt_free(frnd, pkt);
 		frnd->u.active.last = frnd->u.active.seq;
 	}
 }
@@ -1304,14 +1444,18 @@ static bool friend_packet_queue(struct mesh_net *net,
 					uint32_t hdr,
 					const uint8_t *data, uint16_t size)
 {
-	struct mesh_friend_msg *frnd_msg;
+	union {
+		struct mesh_friend_msg msg;
+		uint8_t buf[FRND_MSG_SIZE];
+	} rx;
+	struct mesh_friend_msg *frnd_msg = &rx.msg;
 	uint8_t seg_max = SEG_TOTAL(hdr);
-	bool ret;
 
 	if (seg_max && !IS_SEGMENTED(hdr))
 		return false;
 
-	frnd_msg = mesh_friend_msg_new(seg_max);
+	/* Only staged here, enqueue_friend_pkt copies into the friend pools */
+	memset(&rx, 0, sizeof(rx));
 
 	if (IS_SEGMENTED(hdr)) {
 		uint32_t seqAuth = seq_auth(seq, hdr >> SEQ_ZERO_HDR_SHIFT);
@@ -1335,10 +1479,8 @@ static bool friend_packet_queue(struct mesh_net *net,
 		if (ctl && opcode != NET_OP_SEG_ACKNOWLEDGE) {
 
 			/* Don't cache Friend Ctl opcodes */
-			if (FRND_OPCODE(opcode)) {
-				l_free(frnd_msg);
+			if (FRND_OPCODE(opcode))
 				return false;
-			}
 
 			memcpy(frnd_msg->u.one[0].data + 1, data, size);
 			frnd_msg->last_len = size + 1;
@@ -1360,12 +1502,8 @@ static bool friend_packet_queue(struct mesh_net *net,
 
 	/* Re-Package into Friend Delivery payload */
 	l_queue_foreach(net->friends, enqueue_friend_pkt, frnd_msg);
-	ret = frnd_msg->done;
 
-	/* TODO Optimization(?): Unicast messages keep this buffer */
-	l_free(frnd_msg);
-
-	return ret;
+	return frnd_msg->done;
 }
 
 static void friend_ack_rxed(struct mesh_net *net, uint32_t iv_index,
@@ -1504,21 +1642,60 @@ static void inmsg_to(struct l_timeout *msg_timeout, void *user_data)
 	mesh_sar_free(sar);
 }
 
-static void outmsg_to(struct l_timeout *msg_timeout, void *user_data)
+static uint64_t get_time_ms(void)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_remove_if(net->sar_out,
-			match_msg_timeout, msg_timeout);
+	struct timespec ts;
 
-	l_timeout_remove(msg_timeout);
-	if (!sar)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void sar_out_to(struct l_timeout *timeout, void *user_data);
+
+/* Arms the timer shared by outgoing SARs for the earliest of their expiry */
+static void sar_out_schedule(struct mesh_net *net)
+{
+	const struct l_queue_entry *entry;
+	uint64_t next = UINT64_MAX;
+	uint64_t now;
+	unsigned int ms;
+
+	entry = l_queue_get_entries(net->sar_out);
+	for (; entry; entry = entry->next) {
+		const struct mesh_sar *sar = entry->data;
+
+		if (sar->seg_expire < next)
+			next = sar->seg_expire;
+
+		if (sar->msg_expire < next)
+			next = sar->msg_expire;
+	}
+
+	if (next == UINT64_MAX) {
+		l_timeout_remove(net->sar_out_timeout);
+		net->sar_out_timeout = NULL;
 		return;
+	}
 
-	sar->msg_timeout = NULL;
-	mesh_sar_free(sar);
+	now = get_time_ms();
+	ms = next > now ? next - now : 1;
+
+	if (net->sar_out_timeout)
+		l_timeout_modify_ms(net->sar_out_timeout, ms);
+	else
+		net->sar_out_timeout = l_timeout_create_ms(ms, sar_out_to, net,
+									NULL);
 }
 
-static void outseg_to(struct l_timeout *seg_timeout, void *user_data);
+static void sar_out_start(struct mesh_net *net, struct mesh_sar *sar,
+							uint64_t seg_expire)
+{
+	sar->seg_expire = seg_expire;
+	sar->msg_expire = get_time_ms() + MSG_TO * 1000;
+	l_queue_push_head(net->sar_out, sar);
+	sar_out_schedule(net);
+}
 
 static void send_queued_sar(struct mesh_net *net, uint16_t dst)
 {
@@ -1529,16 +1706,14 @@ static void send_queued_sar(struct mesh_net *net, uint16_t dst)
 		return;
 
 	/* Out to current outgoing, and immediate expire Seg TO */
-	l_queue_push_head(net->sar_out, sar);
-	sar->seg_timeout = NULL;
-	sar->msg_timeout = l_timeout_create(MSG_TO, outmsg_to, net, NULL);
-	outseg_to(NULL, net);
+	sar_out_start(net, sar, get_time_ms());
 }
 
 static void ack_received(struct mesh_net *net, bool timeout,
 				uint16_t src, uint16_t dst,
 				uint16_t seq0, uint32_t ack_flag)
 {
+	struct sar_match match = { .src = dst, .seqZero = seq0 };
 	struct mesh_sar *outgoing;
 	uint32_t seg_flag = 0x00000001;
 	uint32_t ack_copy = ack_flag;
@@ -1546,8 +1721,8 @@ static void ack_received(struct mesh_net *net, bool timeout,
 
 	l_debug("ACK Rxed (%x) (to:%d): %8.8x", seq0, timeout, ack_flag);
 
-	outgoing = l_queue_find(net->sar_out, match_sar_seq0,
-							L_UINT_TO_PTR(seq0));
+	/* Several SARs to different destinations may be outgoing at once */
+	outgoing = l_queue_find(net->sar_out, match_sar_seq0, &match);
 
 	if (!outgoing) {
 		l_debug("Not Found: %4.4x", seq0);
@@ -1568,6 +1743,7 @@ static void ack_received(struct mesh_net *net, bool timeout,
 		l_queue_remove(net->sar_out, outgoing);
 		send_queued_sar(net, outgoing->remote);
 		mesh_sar_free(outgoing);
+		sar_out_schedule(net);
 
 		return;
 	}
@@ -1591,39 +1767,55 @@ static void ack_received(struct mesh_net *net, bool timeout,
 		send_seg(net, net->tx_cnt, net->tx_interval, outgoing, i);
 	}
 
-	l_timeout_remove(outgoing->seg_timeout);
-	outgoing->seg_timeout = l_timeout_create(SEG_TO, outseg_to, net, NULL);
+	outgoing->seg_expire = get_time_ms() + SEG_TO * 1000;
+	sar_out_schedule(net);
 }
 
-static void outseg_to(struct l_timeout *seg_timeout, void *user_data)
+static bool match_msg_expired(const void *a, const void *b)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_out,
-					match_seg_timeout, seg_timeout);
+	const struct mesh_sar *sar = a;
+	const uint64_t *now = b;
 
-	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
+	return sar->msg_expire <= *now;
+}
 
-	sar->seg_timeout = NULL;
+static bool match_seg_expired(const void *a, const void *b)
+{
+	const struct mesh_sar *sar = a;
+	const uint64_t *now = b;
 
-	/* Re-Send missing segments by faking NACK */
-	ack_received(net, true, sar->remote, sar->src,
-					sar->seqZero, sar->last_nak);
+	return sar->seg_expire <= *now;
 }
 
-static bool match_replay_cache(const void *a, const void *b)
+static void sar_out_to(struct l_timeout *timeout, void *user_data)
 {
-	const struct mesh_rpl *rpe = a;
-	uint16_t src = L_PTR_TO_UINT(b);
+	struct mesh_net *net = user_data;
+	uint64_t now = get_time_ms();
+	struct mesh_sar *sar;
+
+	/* Give up on the messages that were not acknowledged in time */
+	while ((sar = l_queue_remove_if(net->sar_out, match_msg_expired,
+								&now))) {
+		send_queued_sar(net, sar->remote);
+		mesh_sar_free(sar);
+	}
 
-	return src == rpe->src;
+	/*
+	 * Re-Send missing segments by faking NACK, which either completes
+	 * the SAR or pushes back its segment expiry.
+	 */
+	while ((sar = l_queue_find(net->sar_out, match_seg_expired, &now)))
+		ack_received(net, true, sar->remote, sar->src,
+					sar->seqZero, sar->last_nak);
+
+	sar_out_schedule(net);
 }
 
-static bool clean_old_iv_index(void *a, void *b)
+static bool clean_old_iv_index(const void *key, void *value,
+							void *user_data)
 {
-	struct mesh_rpl *rpe = a;
-	uint32_t iv_index = L_PTR_TO_UINT(b);
+	struct mesh_rpl *rpe = value;
+	uint32_t iv_index = L_PTR_TO_UINT(user_data);
 
 	if (iv_index < 2)
 		return false;
@@ -1636,6 +1828,26 @@ static bool clean_old_iv_index(void *a, void *b)
 	return false;
 }
 
+static void replay_cache_save(struct mesh_net *net)
+{
+	struct mesh_rpl *rpe;
+
+	l_timeout_remove(net->replay_save);
+	net->replay_save = NULL;
+
+	while ((rpe = l_queue_pop_head(net->replay_pending))) {
+		rpe->pending = false;
+		rpl_put_entry(net->node, rpe->src, rpe->iv_index, rpe->seq);
+	}
+}
+
+static void replay_save_to(struct l_timeout *timeout, void *user_data)
+{
+	struct mesh_net *net = user_data;
+
+	replay_cache_save(net);
+}
+
 static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 				uint16_t crpl, uint32_t seq, uint32_t iv_index)
 {
@@ -1645,8 +1857,7 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 	if (!net || !net->node)
 		return true;
 
-	rpe = l_queue_find(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	rpe = l_hashmap_lookup(net->replay_cache, L_UINT_TO_PTR(src));
 
 	if (rpe) {
 		if (iv_index > rpe->iv_index)
@@ -1657,10 +1868,14 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 			l_debug("Ignoring replayed packet");
 			return true;
 		}
-	} else if (l_queue_length(net->replay_cache) >= crpl) {
+	} else if (l_hashmap_size(net->replay_cache) >= crpl) {
 		/* SRC not in Replay Cache... see if there is space for it */
+		unsigned int ret;
+
+		/* Pending entries may be among the ones removed */
+		replay_cache_save(net);
 
-		int ret = l_queue_foreach_remove(net->replay_cache,
+		ret = l_hashmap_foreach_remove(net->replay_cache,
 				clean_old_iv_index, L_UINT_TO_PTR(iv_index));
 
 		/* Return true if no space could be freed */
@@ -1681,20 +1896,26 @@ static void msg_add_replay_cache(struct mesh_net *net, uint16_t src,
 	if (!net || !net->replay_cache)
 		return;
 
-	rpe = l_queue_remove_if(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	rpe = l_hashmap_lookup(net->replay_cache, L_UINT_TO_PTR(src));
 
 	if (!rpe) {
 		rpe = l_new(struct mesh_rpl, 1);
 		rpe->src = src;
+		l_hashmap_insert(net->replay_cache, L_UINT_TO_PTR(src), rpe);
 	}
 
 	rpe->seq = seq;
 	rpe->iv_index = iv_index;
-	rpl_put_entry(net->node, src, iv_index, seq);
 
-	/* Optimize so that most recent conversations stay earliest in cache */
-	l_queue_push_head(net->replay_cache, rpe);
+	/* Write the updates of all sources at once after a short delay */
+	if (!rpe->pending) {
+		rpe->pending = true;
+		l_queue_push_tail(net->replay_pending, rpe);
+	}
+
+	if (!net->replay_save)
+		net->replay_save = l_timeout_create(RPL_SAVE_DELAY,
+						replay_save_to, net, NULL);
 }
 
 static bool msg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
@@ -2161,31 +2382,9 @@ static bool ctl_received(struct mesh_net *net, uint16_t net_key_id,
 	return true;
 }
 
-static bool find_fast_hash(const void *a, const void *b)
-{
-	const uint64_t *entry = a;
-	const uint64_t *test = b;
-
-	return *entry == *test;
-}
-
 static bool check_fast_cache(uint64_t hash)
 {
-	void *found = l_queue_find(fast_cache, find_fast_hash, &hash);
-	uint64_t *new_hash;
-
-	if (found)
-		return false;
-
-	if (l_queue_length(fast_cache) >= FAST_CACHE_SIZE)
-		new_hash = l_queue_pop_head(fast_cache);
-	else
-		new_hash = l_malloc(sizeof(hash));
-
-	*new_hash = hash;
-	l_queue_push_tail(fast_cache, new_hash);
-
-	return true;
+	return !msg_cache_check(fast_cache, hash, 0);
 }
 
 static bool match_by_dst(const void *a, const void *b)
@@ -2512,7 +2711,7 @@ static void iv_upd_to(struct l_timeout *upd_timeout, void *user_data)
 							net->iv_index, false);
 		l_queue_foreach(net->subnets, refresh_beacon, net);
 		queue_friend_update(net);
-		l_queue_clear(net->msg_cache, l_free);
+		msg_cache_clear(net->msg_cache);
 		break;
 
 	case IV_UPD_INIT:
@@ -2691,6 +2890,7 @@ static bool update_iv_ivu_state(struct mesh_net *net, uint32_t iv_index,
 		mesh_config_write_iv_index(cfg, iv_index, ivu);
 
 		/* Cleanup Replay Protection List NVM */
+		replay_cache_save(net);
 		rpl_update(net->node, iv_index);
 	}
 
@@ -2878,7 +3078,7 @@ bool mesh_net_attach(struct mesh_net *net, struct mesh_io *io)
 			nets = l_queue_new();
 
 		if (!fast_cache)
-			fast_cache = l_queue_new();
+			fast_cache = msg_cache_new(mesh_get_msg_cache_size());
 
 		mesh_io_register_recv_cb(io, snb, sizeof(snb),
 							beacon_recv, NULL);
@@ -2928,7 +3128,7 @@ bool mesh_net_iv_index_update(struct mesh_net *net)
 		return false;
 
 	l_debug("iv_upd_state = IV_UPD_UPDATING");
-	l_queue_clear(net->msg_cache, l_free);
+	msg_cache_clear(net->msg_cache);
 
 	if (!mesh_config_write_iv_index(node_config_get(net->node),
 						net->iv_index + 1, true))
@@ -3184,11 +3384,7 @@ bool mesh_net_app_send(struct mesh_net *net, bool frnd_cred, uint16_t src,
 
 	/* Reliable: Cache; Unreliable: Flush*/
 	if (result && segmented && IS_UNICAST(dst)) {
-		l_queue_push_head(net->sar_out, payload);
-		payload->seg_timeout =
-			l_timeout_create(SEG_TO, outseg_to, net, NULL);
-		payload->msg_timeout =
-			l_timeout_create(MSG_TO, outmsg_to, net, NULL);
+		sar_out_start(net, payload, get_time_ms() + SEG_TO * 1000);
 		payload->id = ++net->sar_id_next;
 	} else
 		mesh_sar_free(payload);
@@ -3451,6 +3647,14 @@ struct l_queue *mesh_net_get_negotiations(struct mesh_net *net)
 	return NULL;
 }
 
+void mesh_net_get_friend_cache(struct mesh_net *net, uint16_t *friends,
+					uint32_t *entries, uint32_t *in_use)
+{
+	*friends = l_queue_length(net->friends);
+	*entries = net->frnd_pkts;
+	*in_use = net->frnd_pkts_used;
+}
+
 struct mesh_node *mesh_net_node_get(struct mesh_net *net)
 {
 	return  net->node;
@@ -3709,7 +3913,30 @@ int mesh_net_set_heartbeat_pub(struct mesh_net *net, uint16_t dst,
 	return MESH_STATUS_SUCCESS;
 }
 
+static void replay_cache_insert(void *data, void *user_data)
+{
+	struct mesh_rpl *rpe = data;
+	struct mesh_net *net = user_data;
+
+	l_hashmap_insert(net->replay_cache, L_UINT_TO_PTR(rpe->src), rpe);
+}
+
 bool mesh_net_load_rpl(struct mesh_net *net)
 {
-	return rpl_get_list(net->node, net->replay_cache);
+	struct l_queue *rpl_list = l_queue_new();
+	bool result;
+
+	result = rpl_get_list(net->node, rpl_list);
+	l_queue_foreach(rpl_list, replay_cache_insert, net);
+	l_queue_destroy(rpl_list, NULL);
+
+	return result;
+}
+
+void mesh_net_save_rpl(struct mesh_net *net)
+{
+	if (!net)
+		return;
+
+	replay_cache_save(net);
 }
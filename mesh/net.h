@@ -76,7 +76,6 @@ struct mesh_node;
 
 
 
-#define MSG_CACHE_SIZE		70
 #define REPLAY_CACHE_SIZE	10
 
 /* Proxy Configuration Opcodes */
@@ -167,6 +166,8 @@ struct mesh_friend {
 	struct mesh_net *net;
 	struct l_timeout *timeout;
 	struct l_queue *pkt_cache;
+	uint8_t *pkt_pool;
+	uint64_t pkt_free;	/* Bitmap of unused pkt_pool slots */
 	void *pkt;
 	uint32_t poll_timeout;
 	uint32_t net_key_cur;
@@ -219,6 +220,11 @@ struct mesh_friend_msg {
 	} u;
 };
 
+/* Worst case friend queue entry, one fully segmented message */
+#define FRND_MSG_SIZE	(sizeof(struct mesh_friend_msg) - \
+			sizeof(struct mesh_friend_seg_one) + \
+			(SEG_MASK + 1) * sizeof(struct mesh_friend_seg_12))
+
 typedef void (*mesh_status_func_t)(void *user_data, bool result);
 
 struct mesh_net *mesh_net_new(struct mesh_node *node);
@@ -283,6 +289,10 @@ struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 					uint16_t fn_cnt, uint16_t lp_cnt);
 void mesh_friend_free(void *frnd);
 bool mesh_friend_clear(struct mesh_net *net, struct mesh_friend *frnd);
+void mesh_friend_pkt_free(struct mesh_friend *frnd,
+						struct mesh_friend_msg *pkt);
+void mesh_net_get_friend_cache(struct mesh_net *net, uint16_t *friends,
+					uint32_t *entries, uint32_t *in_use);
 void mesh_friend_sub_add(struct mesh_net *net, uint16_t lpn, uint8_t ele_cnt,
 							uint8_t grp_cnt,
 							const uint8_t *list);
@@ -321,3 +331,4 @@ uint32_t mesh_net_get_instant(struct mesh_net *net);
 struct l_queue *mesh_net_get_friends(struct mesh_net *net);
 struct l_queue *mesh_net_get_negotiations(struct mesh_net *net);
 bool mesh_net_load_rpl(struct mesh_net *net);
+void mesh_net_save_rpl(struct mesh_net *net);
@@ -14,8 +14,11 @@
 
 #define _GNU_SOURCE
 #include <dirent.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 
 #include <ell/ell.h>
@@ -47,6 +50,17 @@
 /* Default element location: unknown */
 #define DEFAULT_LOCATION 0x0000
 
+/* Message channel frame opcodes */
+#define MSG_CHANNEL_RECV		0x01
+#define MSG_CHANNEL_DEV_KEY_RECV	0x02
+#define MSG_CHANNEL_SEND		0x03
+#define MSG_CHANNEL_DEV_KEY_SEND	0x04
+
+/* Message channel frame flags */
+#define MSG_CHANNEL_VIRTUAL		0x01
+#define MSG_CHANNEL_REMOTE		0x02
+#define MSG_CHANNEL_SEGMENTED		0x04
+
 enum request_type {
 	REQUEST_TYPE_JOIN,
 	REQUEST_TYPE_ATTACH,
@@ -78,6 +92,7 @@ struct mesh_node {
 	struct mesh_agent *agent;
 	struct mesh_config *cfg;
 	char *storage_dir;
+	struct l_io *msg_io;
 	uint32_t disc_watch;
 	uint32_t seq_number;
 	bool busy;
@@ -131,6 +146,16 @@ struct send_options {
 	uint16_t vendor_id;
 };
 
+/* All multi-octet fields are little endian */
+struct msg_channel_hdr {
+	uint8_t opcode;
+	uint8_t ele_idx;
+	uint8_t flags;
+	uint16_t src;
+	uint16_t dst;
+	uint16_t key_idx;
+} __packed;
+
 static struct l_queue *nodes;
 
 static bool match_device_uuid(const void *a, const void *b)
@@ -255,6 +280,9 @@ static void free_node_dbus_resources(struct mesh_node *node)
 		node->disc_watch = 0;
 	}
 
+	l_io_destroy(node->msg_io);
+	node->msg_io = NULL;
+
 	l_queue_foreach(node->elements, free_element_path, NULL);
 	l_free(node->owner);
 	node->owner = NULL;
@@ -290,6 +318,7 @@ static void free_node_resources(void *data)
 
 	/* Free dynamic resources */
 	free_node_dbus_resources(node);
+	keyring_release(node, true);
 	l_queue_destroy(node->elements, element_free);
 	l_queue_destroy(node->pages, l_free);
 	mesh_agent_remove(node->agent);
@@ -310,6 +339,8 @@ void node_remove(struct mesh_node *node)
 
 	l_queue_remove(nodes, node);
 
+	/* Pending key writes would recreate the removed storage */
+	keyring_release(node, false);
 	mesh_config_destroy_nvm(node->cfg);
 
 	free_node_resources(node);
@@ -505,6 +536,9 @@ static void cleanup_node(void *data)
 	/* Preserve the last used sequence number */
 	mesh_config_write_seq_number(node->cfg, seq_num, false);
 
+	/* And the replay protection list updates not saved yet */
+	mesh_net_save_rpl(node->net);
+
 	free_node_resources(node);
 }
 
@@ -2056,6 +2090,137 @@ static struct l_dbus_message *publish_call(struct l_dbus *dbus,
 	return l_dbus_message_new_method_return(msg);
 }
 
+static void msg_channel_send(struct mesh_node *node,
+					const struct msg_channel_hdr *hdr,
+					const uint8_t *data, uint16_t len)
+{
+	struct node_element *ele;
+	uint16_t src, dst, key_idx, net_idx, app_idx;
+	bool segmented = !!(hdr->flags & MSG_CHANNEL_SEGMENTED);
+
+	ele = l_queue_find(node->elements, match_element_idx,
+						L_UINT_TO_PTR(hdr->ele_idx));
+	if (!ele) {
+		l_debug("Element %u not found", hdr->ele_idx);
+		return;
+	}
+
+	src = node_get_primary(node) + ele->idx;
+	dst = L_LE16_TO_CPU(hdr->dst);
+	key_idx = L_LE16_TO_CPU(hdr->key_idx);
+
+	if (hdr->opcode == MSG_CHANNEL_SEND) {
+		if (key_idx & ~APP_IDX_MASK)
+			return;
+
+		app_idx = key_idx;
+		net_idx = appkey_net_idx(node_get_net(node), app_idx);
+		if (net_idx == NET_IDX_INVALID)
+			return;
+	} else {
+		bool remote = !!(hdr->flags & MSG_CHANNEL_REMOTE);
+
+		/* Loopbacks to local servers must use *remote* addressing */
+		if (!remote && mesh_net_is_local_address(node->net, dst, 1))
+			return;
+
+		app_idx = remote ? APP_IDX_DEV_REMOTE : APP_IDX_DEV_LOCAL;
+		net_idx = key_idx;
+	}
+
+	if (!mesh_model_send(node, src, dst, app_idx, net_idx, DEFAULT_TTL,
+						segmented, len, data))
+		l_debug("Failed to send message to %4.4x", dst);
+}
+
+static bool msg_channel_read(struct l_io *io, void *user_data)
+{
+	struct mesh_node *node = user_data;
+	uint8_t buf[sizeof(struct msg_channel_hdr) + MAX_MSG_LEN + 1];
+	const struct msg_channel_hdr *hdr = (void *) buf;
+	ssize_t len;
+
+	len = recv(l_io_get_fd(io), buf, sizeof(buf), MSG_DONTWAIT);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	/* Closed by the app, cleaned up by the disconnect handler */
+	if (!len)
+		return true;
+
+	/* No reply goes back on the channel, invalid frames are dropped */
+	if ((size_t) len <= sizeof(*hdr) ||
+				(size_t) len > sizeof(*hdr) + MAX_MSG_LEN) {
+		l_debug("Invalid message channel frame (%zd)", len);
+		return true;
+	}
+
+	len -= sizeof(*hdr);
+
+	switch (hdr->opcode) {
+	case MSG_CHANNEL_SEND:
+	case MSG_CHANNEL_DEV_KEY_SEND:
+		msg_channel_send(node, hdr, buf + sizeof(*hdr), len);
+		break;
+	default:
+		l_debug("Unknown message channel opcode %u", hdr->opcode);
+	}
+
+	return true;
+}
+
+static void msg_channel_destroy(void *user_data)
+{
+	l_io_destroy(user_data);
+}
+
+static void msg_channel_disconnect(struct l_io *io, void *user_data)
+{
+	struct mesh_node *node = user_data;
+
+	l_debug("Message channel closed");
+
+	/* Messages are delivered over D-Bus again */
+	l_idle_oneshot(msg_channel_destroy, io, NULL);
+	node->msg_io = NULL;
+}
+
+static struct l_dbus_message *acquire_msg_channel_call(struct l_dbus *dbus,
+						struct l_dbus_message *msg,
+						void *user_data)
+{
+	struct mesh_node *node = user_data;
+	struct l_dbus_message *reply;
+	const char *sender;
+	int fds[2];
+
+	l_debug("AcquireMessageChannel");
+
+	sender = l_dbus_message_get_sender(msg);
+
+	if (strcmp(sender, node->owner))
+		return dbus_error(msg, MESH_ERROR_NOT_AUTHORIZED, NULL);
+
+	if (node->msg_io)
+		return dbus_error(msg, MESH_ERROR_ALREADY_EXISTS, NULL);
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+								0, fds) < 0)
+		return dbus_error(msg, MESH_ERROR_FAILED, strerror(errno));
+
+	node->msg_io = l_io_new(fds[0]);
+	l_io_set_close_on_destroy(node->msg_io, true);
+	l_io_set_read_handler(node->msg_io, msg_channel_read, node, NULL);
+	l_io_set_disconnect_handler(node->msg_io, msg_channel_disconnect,
+								node, NULL);
+
+	reply = l_dbus_message_new_method_return(msg);
+	l_dbus_message_set_arguments(reply, "h", fds[1]);
+	close(fds[1]);
+
+	return reply;
+}
+
 static bool features_getter(struct l_dbus *dbus, struct l_dbus_message *msg,
 					struct l_dbus_message_builder *builder,
 					void *user_data)
@@ -2087,6 +2252,26 @@ static bool features_getter(struct l_dbus *dbus, struct l_dbus_message *msg,
 	return true;
 }
 
+static bool friend_cache_getter(struct l_dbus *dbus,
+					struct l_dbus_message *msg,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct mesh_node *node = user_data;
+	uint16_t friends;
+	uint32_t entries, in_use;
+
+	mesh_net_get_friend_cache(node->net, &friends, &entries, &in_use);
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+	dbus_append_dict_entry_basic(builder, "Friendships", "q", &friends);
+	dbus_append_dict_entry_basic(builder, "Entries", "u", &entries);
+	dbus_append_dict_entry_basic(builder, "EntriesInUse", "u", &in_use);
+	l_dbus_message_builder_leave_array(builder);
+
+	return true;
+}
+
 static bool beacon_getter(struct l_dbus *dbus, struct l_dbus_message *msg,
 					struct l_dbus_message_builder *builder,
 					void *user_data)
@@ -2206,8 +2391,13 @@ static void setup_node_interface(struct l_dbus_interface *iface)
 	l_dbus_interface_method(iface, "Publish", 0, publish_call, "",
 					"oqa{sv}ay", "element_path", "model_id",
 							"options", "data");
+	l_dbus_interface_method(iface, "AcquireMessageChannel", 0,
+					acquire_msg_channel_call, "h", "",
+					"fd");
 	l_dbus_interface_property(iface, "Features", 0, "a{sv}",
 							features_getter, NULL);
+	l_dbus_interface_property(iface, "FriendCache", 0, "a{sv}",
+						friend_cache_getter, NULL);
 	l_dbus_interface_property(iface, "Beacon", 0, "b", beacon_getter, NULL);
 	l_dbus_interface_property(iface, "IvUpdate", 0, "b", ivupdate_getter,
 									NULL);
@@ -2247,6 +2437,77 @@ const char *node_get_owner(struct mesh_node *node)
 	return node->owner;
 }
 
+static bool msg_channel_write(struct mesh_node *node,
+					const struct msg_channel_hdr *hdr,
+					const uint8_t *label,
+					const uint8_t *data, uint16_t size)
+{
+	struct iovec iov[3];
+	struct msghdr msg;
+	int n = 0;
+
+	if (!node->msg_io)
+		return false;
+
+	iov[n].iov_base = (void *) hdr;
+	iov[n++].iov_len = sizeof(*hdr);
+
+	if (label) {
+		iov[n].iov_base = (void *) label;
+		iov[n++].iov_len = 16;
+	}
+
+	iov[n].iov_base = (void *) data;
+	iov[n++].iov_len = size;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+
+	/* Fall back to D-Bus rather than dropping if the app falls behind */
+	if (sendmsg(l_io_get_fd(node->msg_io), &msg,
+					MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		l_debug("Message channel write failed: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+bool node_msg_channel_recv(struct mesh_node *node, uint8_t ele_idx,
+					uint16_t src, uint16_t dst,
+					const uint8_t *label, uint16_t app_idx,
+					const uint8_t *data, uint16_t size)
+{
+	struct msg_channel_hdr hdr = {
+		.opcode = MSG_CHANNEL_RECV,
+		.ele_idx = ele_idx,
+		.flags = label ? MSG_CHANNEL_VIRTUAL : 0,
+		.src = L_CPU_TO_LE16(src),
+		.dst = L_CPU_TO_LE16(dst),
+		.key_idx = L_CPU_TO_LE16(app_idx),
+	};
+
+	return msg_channel_write(node, &hdr, label, data, size);
+}
+
+bool node_msg_channel_dev_key_recv(struct mesh_node *node, uint8_t ele_idx,
+					uint16_t src, uint16_t dst,
+					bool remote, uint16_t net_idx,
+					const uint8_t *data, uint16_t size)
+{
+	struct msg_channel_hdr hdr = {
+		.opcode = MSG_CHANNEL_DEV_KEY_RECV,
+		.ele_idx = ele_idx,
+		.flags = remote ? MSG_CHANNEL_REMOTE : 0,
+		.src = L_CPU_TO_LE16(src),
+		.dst = L_CPU_TO_LE16(dst),
+		.key_idx = L_CPU_TO_LE16(net_idx),
+	};
+
+	return msg_channel_write(node, &hdr, NULL, data, size);
+}
+
 const char *node_get_element_path(struct mesh_node *node, uint8_t ele_idx)
 {
 	struct node_element *ele;
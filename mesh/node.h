@@ -66,6 +66,14 @@ bool node_friend_mode_set(struct mesh_node *node, bool enable);
 uint8_t node_friend_mode_get(struct mesh_node *node);
 const char *node_get_element_path(struct mesh_node *node, uint8_t ele_idx);
 const char *node_get_owner(struct mesh_node *node);
+bool node_msg_channel_recv(struct mesh_node *node, uint8_t ele_idx,
+					uint16_t src, uint16_t dst,
+					const uint8_t *label, uint16_t app_idx,
+					const uint8_t *data, uint16_t size);
+bool node_msg_channel_dev_key_recv(struct mesh_node *node, uint8_t ele_idx,
+					uint16_t src, uint16_t dst,
+					bool remote, uint16_t net_idx,
+					const uint8_t *data, uint16_t size);
 const char *node_get_app_path(struct mesh_node *node);
 bool node_add_pending_local(struct mesh_node *node, void *info);
 void node_attach_io_all(struct mesh_io *io);
@@ -12,6 +12,7 @@ struct mesh_rpl {
 	uint32_t iv_index;
 	uint32_t seq;
 	uint16_t src;
+	bool pending;
 };
 
 bool rpl_put_entry(struct mesh_node *node, uint16_t src, uint32_t iv_index,
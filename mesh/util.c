@@ -59,6 +59,14 @@ uint32_t get_timestamp_secs(void)
 	return ts.tv_sec;
 }
 
+uint64_t get_timestamp_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 bool str2hex(const char *str, uint16_t in_len, uint8_t *out,
 							uint16_t out_len)
 {
@@ -9,6 +9,7 @@
  */
 
 uint32_t get_timestamp_secs(void);
+uint64_t get_timestamp_ms(void);
 bool str2hex(const char *str, uint16_t in_len, uint8_t *out,
 							uint16_t out_len);
 size_t hex2str(uint8_t *in, size_t in_len, char *out, size_t out_len);
@@ -15,14 +15,18 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <sys/time.h>
 
 #include "lib/bluetooth.h"
 
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/btsnoop.h"
+#include "src/shared/mainloop.h"
 #include "monitor/bt.h"
 #include "monitor/display.h"
 #include "monitor/packet.h"
@@ -47,6 +51,50 @@ struct hci_dev {
 	unsigned long unknown;
 	uint16_t manufacturer;
 	struct queue *conn_list;
+	struct hashmap *conn_map;	/* Active connections by handle */
+};
+
+/*
+ * Latency histogram with 4 buckets for each power of two microseconds, so
+ * every bucket is within 25% of the values it holds.
+ */
+#define HIST_SUB_BITS	2
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(HIST_SUB + (32 - HIST_SUB_BITS) * HIST_SUB)
+
+struct hist {
+	unsigned long count;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+/* Throughput over time, bins get wider as the trace gets longer */
+#define TIMELINE_BINS	32
+
+struct timeline {
+	struct timeval start;
+	uint64_t width;
+	unsigned int used;
+	uint64_t bytes[TIMELINE_BINS];
+};
+
+/* SDUs of one direction of an isochronous stream */
+struct iso_stream {
+	unsigned long sdus;
+	unsigned long missing;
+	unsigned long invalid;
+	unsigned long lost;
+	bool seen;
+	bool last_has_ts;
+	uint16_t last_sn;
+	uint32_t last_ts;
+	struct timeval last_tv;
+	uint64_t last_interval;
+	uint64_t interval_min;
+	uint64_t interval_max;
+	uint64_t interval_sum;
+	unsigned long intervals;
+	double jitter;
+	struct hist interval;
 };
 
 #define CONN_BR_ACL	0x01
@@ -72,6 +120,12 @@ struct hci_conn {
 	uint16_t tx_pkt_min;
 	uint16_t tx_pkt_max;
 	uint16_t tx_pkt_med;
+	struct hist tx_lat;
+	struct timeline tx_timeline;
+	struct timeline rx_timeline;
+	uint32_t iso_interval;
+	struct iso_stream iso_tx;
+	struct iso_stream iso_rx;
 	struct queue *chan_list;
 };
 
@@ -84,6 +138,150 @@ struct l2cap_chan {
 
 static struct queue *dev_list;
 
+static unsigned int hist_index(uint32_t val)
+{
+	unsigned int exp;
+
+	if (val < HIST_SUB)
+		return val;
+
+	exp = 31 - __builtin_clz(val);
+
+	return HIST_SUB + (exp - HIST_SUB_BITS) * HIST_SUB +
+		((val >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_lower(unsigned int index)
+{
+	unsigned int exp;
+
+	if (index < HIST_SUB)
+		return index;
+
+	exp = (index - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+
+	return (uint64_t) (HIST_SUB + index % HIST_SUB) <<
+						(exp - HIST_SUB_BITS);
+}
+
+static void hist_add(struct hist *hist, const struct timeval *val)
+{
+	uint64_t usec = val->tv_sec * 1000000ULL + val->tv_usec;
+
+	if (usec > UINT32_MAX)
+		usec = UINT32_MAX;
+
+	hist->buckets[hist_index(usec)]++;
+	hist->count++;
+}
+
+/* Upper bound of the bucket holding the given share of the values */
+static uint64_t hist_percentile(const struct hist *hist, unsigned int pct)
+{
+	unsigned long target = (hist->count * pct + 99) / 100;
+	unsigned long count = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		count += hist->buckets[i];
+		if (count >= target)
+			break;
+	}
+
+	return i + 1 < HIST_BUCKETS ? hist_lower(i + 1) : UINT32_MAX;
+}
+
+static void hist_print(const char *label, const struct hist *hist)
+{
+	unsigned long max = 0;
+	unsigned int i;
+
+	if (!hist->count)
+		return;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (hist->buckets[i] > max)
+			max = hist->buckets[i];
+	}
+
+	print_field("%s histogram (msec):", label);
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		char bar[41];
+		size_t len;
+
+		if (!hist->buckets[i])
+			continue;
+
+		len = (hist->buckets[i] * (sizeof(bar) - 1) + max - 1) / max;
+		memset(bar, '#', len);
+		bar[len] = '\0';
+
+		print_field("  %8.3f - %8.3f: %-8lu %s",
+				hist_lower(i) / 1000.0,
+				(i + 1 < HIST_BUCKETS ? hist_lower(i + 1) :
+						UINT32_MAX) / 1000.0,
+				hist->buckets[i], bar);
+	}
+
+	print_field("  %.3f/%.3f/%.3f msec p50/p90/p99",
+				hist_percentile(hist, 50) / 1000.0,
+				hist_percentile(hist, 90) / 1000.0,
+				hist_percentile(hist, 99) / 1000.0);
+}
+
+static void timeline_add(struct timeline *line, const struct timeval *tv,
+								size_t bytes)
+{
+	struct timeval res;
+	uint64_t offset;
+	unsigned int i, bin;
+
+	if (!line->width) {
+		line->start = *tv;
+		line->width = 1000000;
+	}
+
+	timersub(tv, &line->start, &res);
+	if (res.tv_sec < 0)
+		return;
+
+	offset = res.tv_sec * 1000000ULL + res.tv_usec;
+
+	/* Merge pairs of bins until the packet fits */
+	while ((bin = offset / line->width) >= TIMELINE_BINS) {
+		for (i = 0; i < TIMELINE_BINS / 2; i++)
+			line->bytes[i] = line->bytes[i * 2] +
+						line->bytes[i * 2 + 1];
+
+		memset(line->bytes + TIMELINE_BINS / 2, 0,
+				sizeof(line->bytes) / 2);
+		line->used = (line->used + 1) / 2;
+		line->width *= 2;
+	}
+
+	line->bytes[bin] += bytes;
+
+	if (bin >= line->used)
+		line->used = bin + 1;
+}
+
+static void timeline_print(const char *label, const struct timeline *line)
+{
+	unsigned int i;
+
+	if (!line->used)
+		return;
+
+	print_field("%s throughput (%" PRIu64 " sec per line):", label,
+						line->width / 1000000);
+
+	for (i = 0; i < line->used; i++)
+		print_field("  %6" PRIu64 " sec: %10.1f kbit/s",
+				i * line->width / 1000000,
+				line->bytes[i] * 8000.0 / line->width);
+}
+
 static void chan_destroy(void *data)
 {
 	struct l2cap_chan *chan = data;
@@ -135,6 +333,35 @@ static struct l2cap_chan *chan_lookup(struct hci_conn *conn, uint16_t cid,
 	return chan;
 }
 
+static void iso_print(const char *label, const struct iso_stream *iso,
+								bool out)
+{
+	char str[32];
+
+	if (!iso->sdus)
+		return;
+
+	print_field("%lu %s SDUs, %lu missing", iso->sdus, label,
+								iso->missing);
+
+	if (!out)
+		print_field("%lu %s SDUs possibly invalid, %lu lost",
+					iso->invalid, label, iso->lost);
+
+	if (!iso->intervals)
+		return;
+
+	print_field("%.3f/%.3f/%.3f msec min/avg/max %s SDU interval",
+				iso->interval_min / 1000.0,
+				iso->interval_sum / 1000.0 / iso->intervals,
+				iso->interval_max / 1000.0, label);
+	print_field("%.3f msec %s SDU interval jitter", iso->jitter / 1000.0,
+								label);
+
+	snprintf(str, sizeof(str), "%s SDU interval", label);
+	hist_print(str, &iso->interval);
+}
+
 static void conn_destroy(void *data)
 {
 	struct hci_conn *conn = data;
@@ -184,6 +411,14 @@ static void conn_destroy(void *data)
 	print_field("%u octets TX min packet size", conn->tx_pkt_min);
 	print_field("%u octets TX max packet size", conn->tx_pkt_max);
 	print_field("%u octets TX median packet size", conn->tx_pkt_med);
+	hist_print("TX latency", &conn->tx_lat);
+	if (conn->iso_interval)
+		print_field("%.2f msec ISO interval",
+					conn->iso_interval / 1000.0);
+	iso_print("TX", &conn->iso_tx, true);
+	iso_print("RX", &conn->iso_rx, false);
+	timeline_print("TX", &conn->tx_timeline);
+	timeline_print("RX", &conn->rx_timeline);
 	queue_destroy(conn->chan_list, chan_destroy);
 
 	queue_destroy(conn->tx_queue, free);
@@ -216,8 +451,7 @@ static bool conn_match_handle(const void *a, const void *b)
 
 static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle)
 {
-	return queue_find(dev->conn_list, conn_match_handle,
-						UINT_TO_PTR(handle));
+	return hashmap_lookup(dev->conn_map, handle);
 }
 
 static struct hci_conn *conn_lookup_type(struct hci_dev *dev, uint16_t handle,
@@ -225,11 +459,13 @@ static struct hci_conn *conn_lookup_type(struct hci_dev *dev, uint16_t handle,
 {
 	struct hci_conn *conn;
 
-	conn = queue_find(dev->conn_list, conn_match_handle,
-						UINT_TO_PTR(handle));
+	conn = conn_lookup(dev, handle);
 	if (!conn || conn->type != type) {
 		conn = conn_alloc(dev, handle, type);
 		queue_push_tail(dev->conn_list, conn);
+
+		/* An existing connection keeps shadowing the new one */
+		hashmap_insert(dev->conn_map, handle, conn);
 	}
 
 	return conn;
@@ -271,6 +507,7 @@ static void dev_destroy(void *data)
 	printf("  %lu user logs\n", dev->user_log);
 	printf("  %lu control messages \n", dev->ctrl_msg);
 	printf("  %lu unknown opcodes\n", dev->unknown);
+	hashmap_destroy(dev->conn_map, NULL);
 	queue_destroy(dev->conn_list, conn_destroy);
 	printf("\n");
 
@@ -287,6 +524,7 @@ static struct hci_dev *dev_alloc(uint16_t index)
 	dev->manufacturer = 0xffff;
 
 	dev->conn_list = queue_new();
+	dev->conn_map = hashmap_new();
 
 	return dev;
 }
@@ -410,6 +648,7 @@ static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_evt_disconnect_complete *evt = data;
+	uint16_t handle = le16_to_cpu(evt->handle);
 	struct hci_conn *conn;
 
 	data += sizeof(*evt);
@@ -418,11 +657,17 @@ static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
 	if (evt->status)
 		return;
 
-	conn = conn_lookup(dev, le16_to_cpu(evt->handle));
+	conn = hashmap_remove(dev->conn_map, handle);
 	if (!conn)
 		return;
 
 	conn->terminated = true;
+
+	/* Fall back to any other connection still using the handle */
+	conn = queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+	if (conn)
+		hashmap_insert(dev->conn_map, handle, conn);
 }
 
 static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
@@ -479,10 +724,13 @@ static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
 
 		conn->tx_num_comp += count;
 
-		last_tx = queue_pop_head(conn->tx_queue);
-		if (last_tx) {
+		/* Each completed packet was queued by an earlier TX */
+		while (count-- && (last_tx = queue_pop_head(conn->tx_queue))) {
 			timersub(tv, last_tx, &res);
 
+			if (res.tv_sec >= 0)
+				hist_add(&conn->tx_lat, &res);
+
 			if ((!timerisset(&conn->tx_lat_min) ||
 					timercmp(&res, &conn->tx_lat_min, <)) &&
 					res.tv_sec >= 0 && res.tv_usec >= 0)
@@ -516,6 +764,64 @@ static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
 	}
 }
 
+static void iso_established(struct hci_dev *dev, uint16_t handle,
+							uint16_t interval)
+{
+	struct hci_conn *conn;
+
+	conn = conn_lookup_type(dev, handle, CONN_LE_ISO);
+	if (!conn)
+		return;
+
+	conn->setup_seen = true;
+	conn->iso_interval = le16_to_cpu(interval) * 1250;
+}
+
+static void evt_le_cis_established(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_cis_established *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	iso_established(dev, le16_to_cpu(evt->conn_handle), evt->interval);
+}
+
+static void evt_le_big_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_big_complete *evt = data;
+	int i;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	if (size < sizeof(*evt) + evt->num_bis * sizeof(uint16_t))
+		return;
+
+	for (i = 0; i < evt->num_bis; i++)
+		iso_established(dev, le16_to_cpu(evt->bis_handle[i]),
+								evt->interval);
+}
+
+static void evt_le_big_sync_established(struct hci_dev *dev,
+					struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_big_sync_estabilished *evt = data;
+	int i;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	if (size < sizeof(*evt) + evt->num_bis * sizeof(uint16_t))
+		return;
+
+	for (i = 0; i < evt->num_bis; i++)
+		iso_established(dev, le16_to_cpu(evt->bis[i]), evt->interval);
+}
+
 static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
@@ -525,6 +831,15 @@ static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
 	size -= sizeof(subtype);
 
 	switch (subtype) {
+	case BT_HCI_EVT_LE_CIS_ESTABLISHED:
+		evt_le_cis_established(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_BIG_COMPLETE:
+		evt_le_big_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_BIG_SYNC_ESTABILISHED:
+		evt_le_big_sync_established(dev, tv, data, size);
+		break;
 	}
 }
 
@@ -563,6 +878,30 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	}
 }
 
+static void conn_data(struct hci_conn *conn, struct timeval *tv, bool out,
+								uint16_t size)
+{
+	if (out) {
+		struct timeval *last_tx;
+
+		conn->tx_num++;
+		last_tx = new0(struct timeval, 1);
+		memcpy(last_tx, tv, sizeof(*tv));
+		queue_push_tail(conn->tx_queue, last_tx);
+		conn->tx_bytes += size;
+
+		if (!conn->tx_pkt_min || size < conn->tx_pkt_min)
+			conn->tx_pkt_min = size;
+		if (!conn->tx_pkt_max || size > conn->tx_pkt_max)
+			conn->tx_pkt_max = size;
+
+		timeline_add(&conn->tx_timeline, tv, size);
+	} else {
+		conn->rx_num++;
+		timeline_add(&conn->rx_timeline, tv, size);
+	}
+}
+
 static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
@@ -599,22 +938,7 @@ static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 		break;
 	}
 
-	if (out) {
-		struct timeval *last_tx;
-
-		conn->tx_num++;
-		last_tx = new0(struct timeval, 1);
-		memcpy(last_tx, tv, sizeof(*tv));
-		queue_push_tail(conn->tx_queue, last_tx);
-		conn->tx_bytes += size;
-
-		if (!conn->tx_pkt_min || size < conn->tx_pkt_min)
-			conn->tx_pkt_min = size;
-		if (!conn->tx_pkt_max || size > conn->tx_pkt_max)
-			conn->tx_pkt_max = size;
-	} else {
-		conn->rx_num++;
-	}
+	conn_data(conn, tv, out, size);
 }
 
 static void sco_pkt(struct timeval *tv, uint16_t index,
@@ -698,11 +1022,114 @@ static void ctrl_msg(struct timeval *tv, uint16_t index,
 	dev->ctrl_msg++;
 }
 
-static void iso_pkt(struct timeval *tv, uint16_t index,
+static void iso_interval_add(struct iso_stream *iso, uint64_t interval)
+{
+	struct timeval tv;
+	uint64_t diff;
+
+	if (!iso->intervals || interval < iso->interval_min)
+		iso->interval_min = interval;
+	if (interval > iso->interval_max)
+		iso->interval_max = interval;
+
+	iso->interval_sum += interval;
+	iso->intervals++;
+
+	tv.tv_sec = interval / 1000000;
+	tv.tv_usec = interval % 1000000;
+	hist_add(&iso->interval, &tv);
+
+	/* Interarrival jitter estimate as used by RTP (RFC 3550) */
+	if (iso->intervals > 1) {
+		diff = interval > iso->last_interval ?
+					interval - iso->last_interval :
+					iso->last_interval - interval;
+		iso->jitter += (diff - iso->jitter) / 16;
+	}
+
+	iso->last_interval = interval;
+}
+
+/*
+ * Only the first fragment or a complete SDU carries the sequence number,
+ * and the optional controller timestamp is preferred over the capture
+ * time for the interval between SDUs.
+ */
+static void iso_sdu(struct hci_conn *conn, struct timeval *tv, bool out,
+				uint16_t flags, const void *data, uint16_t size)
+{
+	struct iso_stream *iso = out ? &conn->iso_tx : &conn->iso_rx;
+	const struct bt_hci_iso_data_start *start;
+	bool has_ts = flags & 0x04;
+	uint32_t ts = 0;
+	uint64_t interval;
+	uint16_t gap, slen;
+	struct timeval res;
+
+	/* Continuation or last fragment */
+	if (flags & 0x01)
+		return;
+
+	if (has_ts) {
+		if (size < 4)
+			return;
+
+		ts = get_le32(data);
+		data += 4;
+		size -= 4;
+	}
+
+	if (size < sizeof(*start))
+		return;
+
+	start = data;
+	slen = le16_to_cpu(start->slen);
+
+	iso->sdus++;
+
+	switch (slen >> 14) {
+	case 0x01:
+		iso->invalid++;
+		break;
+	case 0x02:
+		iso->lost++;
+		break;
+	}
+
+	gap = le16_to_cpu(start->sn) - iso->last_sn;
+
+	/* Restart the interval tracking on duplicates or reordering */
+	if (!iso->seen || gap == 0 || gap >= 0x8000)
+		goto done;
+
+	iso->missing += gap - 1;
+
+	if (has_ts && iso->last_has_ts)
+		interval = (uint32_t) (ts - iso->last_ts);
+	else {
+		timersub(tv, &iso->last_tv, &res);
+		if (res.tv_sec < 0)
+			goto done;
+
+		interval = res.tv_sec * 1000000ULL + res.tv_usec;
+	}
+
+	iso_interval_add(iso, interval / gap);
+
+done:
+	iso->seen = true;
+	iso->last_sn = le16_to_cpu(start->sn);
+	iso->last_has_ts = has_ts;
+	iso->last_ts = ts;
+	iso->last_tv = *tv;
+}
+
+static void iso_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_iso_hdr *hdr = data;
 	struct hci_dev *dev;
+	struct hci_conn *conn;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -713,6 +1140,15 @@ static void iso_pkt(struct timeval *tv, uint16_t index,
 
 	dev->num_hci++;
 	dev->num_iso++;
+
+	conn = conn_lookup_type(dev, le16_to_cpu(hdr->handle) & 0x0fff,
+								CONN_LE_ISO);
+	if (!conn)
+		return;
+
+	iso_sdu(conn, tv, out, le16_to_cpu(hdr->handle) >> 12, data, size);
+
+	conn_data(conn, tv, out, size);
 }
 
 static void unknown_opcode(struct timeval *tv, uint16_t index,
@@ -727,6 +1163,421 @@ static void unknown_opcode(struct timeval *tv, uint16_t index,
 	dev->unknown++;
 }
 
+/* Transmitted packets whose timestamp is kept to measure latency */
+#define STATS_PENDING	64
+
+struct stats_conn {
+	uint16_t handle;
+	bool terminated;
+	unsigned long tx_num;
+	unsigned long rx_num;
+	unsigned long tx_bytes;
+	unsigned long rx_bytes;
+	unsigned long tx_num_comp;
+	unsigned long lat_num;
+	uint64_t lat_min;
+	uint64_t lat_max;
+	uint64_t lat_sum;
+	unsigned int pending;
+	unsigned int pending_max;
+	unsigned int pending_head;
+	uint64_t pending_ts[STATS_PENDING];
+};
+
+struct stats_dev {
+	uint16_t index;
+	bool removed;
+	unsigned long num_cmd;
+	unsigned long num_evt;
+	unsigned long num_acl_tx;
+	unsigned long num_acl_rx;
+	unsigned long num_sco;
+	unsigned long num_iso_tx;
+	unsigned long num_iso_rx;
+	struct queue *conn_list;
+	struct hashmap *conn_map;	/* Active connections by handle */
+};
+
+static unsigned int stats_interval;
+static struct queue *stats_list;
+static unsigned long stats_num;
+static uint64_t stats_base;
+static uint64_t stats_end;
+static bool stats_started;
+
+static uint64_t stats_time(const struct timeval *tv)
+{
+	struct timeval now;
+
+	if (!tv) {
+		gettimeofday(&now, NULL);
+		tv = &now;
+	}
+
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void stats_dev_free(void *data)
+{
+	struct stats_dev *dev = data;
+
+	hashmap_destroy(dev->conn_map, NULL);
+	queue_destroy(dev->conn_list, free);
+	free(dev);
+}
+
+static bool stats_match_index(const void *a, const void *b)
+{
+	const struct stats_dev *dev = a;
+	uint16_t index = PTR_TO_UINT(b);
+
+	return dev->index == index && !dev->removed;
+}
+
+static struct stats_dev *stats_dev_lookup(uint16_t index)
+{
+	struct stats_dev *dev;
+
+	if (!stats_list)
+		stats_list = queue_new();
+
+	dev = queue_find(stats_list, stats_match_index, UINT_TO_PTR(index));
+	if (!dev) {
+		dev = new0(struct stats_dev, 1);
+		dev->index = index;
+		dev->conn_list = queue_new();
+		dev->conn_map = hashmap_new();
+		queue_push_tail(stats_list, dev);
+	}
+
+	return dev;
+}
+
+static struct stats_conn *stats_conn_lookup(struct stats_dev *dev,
+							uint16_t handle)
+{
+	struct stats_conn *conn;
+
+	conn = hashmap_lookup(dev->conn_map, handle);
+	if (!conn) {
+		conn = new0(struct stats_conn, 1);
+		conn->handle = handle;
+		queue_push_tail(dev->conn_list, conn);
+		hashmap_insert(dev->conn_map, handle, conn);
+	}
+
+	return conn;
+}
+
+static double stats_kbps(unsigned long bytes)
+{
+	return (double) bytes * 8 / stats_interval;
+}
+
+static void stats_print_conn(void *data, void *user_data)
+{
+	struct stats_conn *conn = data;
+
+	if (!conn->tx_num && !conn->rx_num && !conn->tx_num_comp &&
+							!conn->pending)
+		return;
+
+	printf("    Handle %u%s\n", conn->handle,
+				conn->terminated ? " (disconnected)" : "");
+	printf("      %lu TX packets, %.1f kbit/s\n", conn->tx_num,
+						stats_kbps(conn->tx_bytes));
+	printf("      %lu RX packets, %.1f kbit/s\n", conn->rx_num,
+						stats_kbps(conn->rx_bytes));
+	printf("      %lu TX completed, %u in flight (max %u)\n",
+				conn->tx_num_comp, conn->pending,
+				conn->pending_max);
+
+	if (conn->lat_num)
+		printf("      %.3f/%.3f/%.3f msec min/avg/max latency\n",
+				conn->lat_min / 1000.0,
+				conn->lat_sum / 1000.0 / conn->lat_num,
+				conn->lat_max / 1000.0);
+}
+
+static bool stats_match_terminated(const void *data, const void *user_data)
+{
+	const struct stats_conn *conn = data;
+
+	return conn->terminated;
+}
+
+static void stats_reset_conn(void *data, void *user_data)
+{
+	struct stats_conn *conn = data;
+
+	conn->tx_num = 0;
+	conn->rx_num = 0;
+	conn->tx_bytes = 0;
+	conn->rx_bytes = 0;
+	conn->tx_num_comp = 0;
+	conn->lat_num = 0;
+	conn->lat_min = 0;
+	conn->lat_max = 0;
+	conn->lat_sum = 0;
+	conn->pending_max = conn->pending;
+}
+
+static void stats_print_dev(void *data, void *user_data)
+{
+	struct stats_dev *dev = data;
+
+	printf("  Controller with index %u%s\n", dev->index,
+					dev->removed ? " (removed)" : "");
+	printf("    %lu commands, %lu events\n", dev->num_cmd, dev->num_evt);
+	printf("    %lu/%lu ACL packets TX/RX\n", dev->num_acl_tx,
+							dev->num_acl_rx);
+	printf("    %lu/%lu ISO packets TX/RX\n", dev->num_iso_tx,
+							dev->num_iso_rx);
+	printf("    %lu SCO packets\n", dev->num_sco);
+
+	queue_foreach(dev->conn_list, stats_print_conn, NULL);
+
+	/* Disconnected handles are only reported once */
+	queue_remove_all(dev->conn_list, stats_match_terminated, NULL, free);
+	queue_foreach(dev->conn_list, stats_reset_conn, NULL);
+
+	dev->num_cmd = 0;
+	dev->num_evt = 0;
+	dev->num_acl_tx = 0;
+	dev->num_acl_rx = 0;
+	dev->num_sco = 0;
+	dev->num_iso_tx = 0;
+	dev->num_iso_rx = 0;
+}
+
+static bool stats_match_removed(const void *data, const void *user_data)
+{
+	const struct stats_dev *dev = data;
+
+	return dev->removed;
+}
+
+static void stats_report(void)
+{
+	uint64_t start = stats_end - stats_base - stats_interval * 1000ULL;
+	uint64_t end = stats_end - stats_base;
+
+	printf("Interval %lu: %" PRIu64 ".%03" PRIu64 "-%" PRIu64 ".%03"
+			PRIu64 " sec\n", ++stats_num,
+			start / 1000000, start / 1000 % 1000,
+			end / 1000000, end / 1000 % 1000);
+
+	queue_foreach(stats_list, stats_print_dev, NULL);
+	queue_remove_all(stats_list, stats_match_removed, NULL, stats_dev_free);
+
+	printf("\n");
+	fflush(stdout);
+}
+
+/* Reports the interval once time moved past it, skipping idle ones */
+static void stats_advance(uint64_t ts)
+{
+	uint64_t interval = stats_interval * 1000ULL;
+
+	if (!stats_started) {
+		stats_base = ts;
+		stats_end = ts + interval;
+		stats_started = true;
+		return;
+	}
+
+	if (ts < stats_end)
+		return;
+
+	stats_report();
+
+	stats_end = ts - (ts - stats_base) % interval + interval;
+}
+
+static void stats_tx(struct stats_conn *conn, uint64_t ts, uint16_t size)
+{
+	conn->tx_num++;
+	conn->tx_bytes += size;
+
+	/* With too many in flight the oldest timestamps are overwritten */
+	conn->pending_ts[conn->pending_head] = ts;
+	conn->pending_head = (conn->pending_head + 1) % STATS_PENDING;
+	conn->pending++;
+
+	if (conn->pending > conn->pending_max)
+		conn->pending_max = conn->pending;
+}
+
+static void stats_completed(struct stats_conn *conn, uint64_t ts,
+							uint16_t count)
+{
+	conn->tx_num_comp += count;
+
+	for (; count && conn->pending; count--, conn->pending--) {
+		unsigned int stored, pos;
+		uint64_t lat;
+
+		stored = conn->pending < STATS_PENDING ? conn->pending :
+								STATS_PENDING;
+		if (conn->pending > stored)
+			continue;
+
+		pos = (conn->pending_head + STATS_PENDING - stored) %
+								STATS_PENDING;
+		if (ts < conn->pending_ts[pos])
+			continue;
+
+		lat = ts - conn->pending_ts[pos];
+
+		if (!conn->lat_num || lat < conn->lat_min)
+			conn->lat_min = lat;
+		if (lat > conn->lat_max)
+			conn->lat_max = lat;
+
+		conn->lat_sum += lat;
+		conn->lat_num++;
+	}
+}
+
+static void stats_event(struct stats_dev *dev, uint64_t ts,
+					const uint8_t *data, uint16_t size)
+{
+	struct stats_conn *conn;
+	uint8_t num;
+
+	dev->num_evt++;
+
+	if (size < 2)
+		return;
+
+	switch (data[0]) {
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		if (size < 3)
+			return;
+
+		num = data[2];
+		data += 3;
+		size -= 3;
+
+		for (; num && size >= 4; num--, data += 4, size -= 4) {
+			conn = hashmap_lookup(dev->conn_map,
+						get_le16(data) & 0x0fff);
+			if (conn)
+				stats_completed(conn, ts, get_le16(data + 2));
+		}
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		if (size < 6 || data[2])
+			return;
+
+		conn = hashmap_remove(dev->conn_map,
+					get_le16(data + 3) & 0x0fff);
+		if (conn)
+			conn->terminated = true;
+		break;
+	}
+}
+
+static void stats_data(struct stats_dev *dev, uint64_t ts, bool out,
+					const uint8_t *data, uint16_t size)
+{
+	struct stats_conn *conn;
+
+	if (size < 4)
+		return;
+
+	conn = stats_conn_lookup(dev, get_le16(data) & 0x0fff);
+
+	if (out) {
+		stats_tx(conn, ts, size - 4);
+	} else {
+		conn->rx_num++;
+		conn->rx_bytes += size - 4;
+	}
+}
+
+void analyze_stats_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	uint64_t ts = stats_time(tv);
+	struct stats_dev *dev;
+
+	stats_advance(ts);
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		stats_dev_lookup(index);
+		break;
+	case BTSNOOP_OPCODE_DEL_INDEX:
+		dev = stats_dev_lookup(index);
+		dev->removed = true;
+		break;
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		stats_dev_lookup(index)->num_cmd++;
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		stats_event(stats_dev_lookup(index), ts, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		dev = stats_dev_lookup(index);
+		dev->num_acl_tx++;
+		stats_data(dev, ts, true, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		dev = stats_dev_lookup(index);
+		dev->num_acl_rx++;
+		stats_data(dev, ts, false, data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		stats_dev_lookup(index)->num_sco++;
+		break;
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+		dev = stats_dev_lookup(index);
+		dev->num_iso_tx++;
+		stats_data(dev, ts, true, data, size);
+		break;
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		dev = stats_dev_lookup(index);
+		dev->num_iso_rx++;
+		stats_data(dev, ts, false, data, size);
+		break;
+	}
+}
+
+static void stats_timeout(int id, void *user_data)
+{
+	uint64_t now = stats_time(NULL);
+
+	stats_advance(now);
+
+	/* Wake up right after the end of the current interval */
+	if (mainloop_modify_timeout(id, (stats_end - now) / 1000 + 1) < 0)
+		mainloop_exit_failure();
+}
+
+void analyze_stats_interval(unsigned int msec)
+{
+	stats_interval = msec;
+}
+
+bool analyze_stats_enabled(void)
+{
+	return stats_interval > 0;
+}
+
+/* Reports intervals of live traffic even if nothing is received */
+bool analyze_stats_start(void)
+{
+	if (!stats_interval)
+		return false;
+
+	stats_advance(stats_time(NULL));
+
+	return mainloop_add_timeout(stats_interval, stats_timeout,
+							NULL, NULL) >= 0;
+}
+
 void analyze_trace(const char *path)
 {
 	struct btsnoop *btsnoop_file;
@@ -752,14 +1603,22 @@ void analyze_trace(const char *path)
 	dev_list = queue_new();
 
 	while (1) {
-		unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+		const void *buf;
 		struct timeval tv;
 		uint16_t index, opcode, pktlen;
 
-		if (!btsnoop_read_hci(btsnoop_file, &tv, &index, &opcode,
-								buf, &pktlen))
+		if (!btsnoop_next_hci(btsnoop_file, &tv, &index, &opcode,
+								&buf, &pktlen))
 			break;
 
+		num_packets++;
+
+		/* Intervals are measured in trace time */
+		if (stats_interval) {
+			analyze_stats_hci(&tv, index, opcode, buf, pktlen);
+			continue;
+		}
+
 		switch (opcode) {
 		case BTSNOOP_OPCODE_NEW_INDEX:
 			new_index(&tv, index, buf, pktlen);
@@ -805,17 +1664,20 @@ void analyze_trace(const char *path)
 			ctrl_msg(&tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_ISO_TX_PKT:
+			iso_pkt(&tv, index, true, buf, pktlen);
+			break;
 		case BTSNOOP_OPCODE_ISO_RX_PKT:
-			iso_pkt(&tv, index, buf, pktlen);
+			iso_pkt(&tv, index, false, buf, pktlen);
 			break;
 		default:
 			unknown_opcode(&tv, index, buf, pktlen);
 			break;
 		}
-
-		num_packets++;
 	}
 
+	if (stats_started)
+		stats_report();
+
 	printf("Trace contains %lu packets\n\n", num_packets);
 
 	queue_destroy(dev_list, dev_destroy);
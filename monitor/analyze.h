@@ -9,4 +9,13 @@
  *
  */
 
+#include <stdint.h>
+#include <stdbool.h>
+
 void analyze_trace(const char *path);
+
+void analyze_stats_interval(unsigned int msec);
+bool analyze_stats_enabled(void);
+bool analyze_stats_start(void);
+void analyze_stats_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size);
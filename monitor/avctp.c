@@ -1030,6 +1030,8 @@ response:
 	for (; num > 0; num--) {
 		uint8_t attr, len;
 		uint16_t charset;
+		char str[256];
+		int i;
 
 		if (!l2cap_frame_get_u8(frame, &attr))
 			return false;
@@ -1048,16 +1050,17 @@ response:
 
 		print_field("%*cStringLength: 0x%02x", (indent - 8), ' ', len);
 
-		printf("String: ");
-		for (; len > 0; len--) {
+		for (i = 0; i < len; i++) {
 			uint8_t c;
 
 			if (!l2cap_frame_get_u8(frame, &c))
 				return false;
 
-			printf("%1c", isprint(c) ? c : '.');
+			str[i] = isprint(c) ? c : '.';
 		}
-		printf("\n");
+		str[i] = '\0';
+
+		print_field("%*cString: %s", (indent - 8), ' ', str);
 	}
 
 	return true;
@@ -1106,6 +1109,8 @@ response:
 	for (; num > 0; num--) {
 		uint8_t value, len;
 		uint16_t charset;
+		char str[256];
+		int i;
 
 		if (!l2cap_frame_get_u8(frame, &value))
 			return false;
@@ -1124,16 +1129,17 @@ response:
 
 		print_field("%*cStringLength: 0x%02x", (indent - 8), ' ', len);
 
-		printf("String: ");
-		for (; len > 0; len--) {
+		for (i = 0; i < len; i++) {
 			uint8_t c;
 
 			if (!l2cap_frame_get_u8(frame, &c))
 				return false;
 
-			printf("%1c", isprint(c) ? c : '.');
+			str[i] = isprint(c) ? c : '.';
 		}
-		printf("\n");
+		str[i] = '\0';
+
+		print_field("%*cString: %s", (indent - 8), ' ', str);
 	}
 
 	return true;
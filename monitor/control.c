@@ -26,8 +26,12 @@
 #include <sys/un.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <linux/filter.h>
 
 #include "lib/bluetooth.h"
@@ -38,10 +42,13 @@
 #include "src/shared/btsnoop.h"
 #include "src/shared/mainloop.h"
 
+#include "bt.h"
 #include "display.h"
 #include "packet.h"
 #include "hcidump.h"
 #include "ellisys.h"
+#include "analyze.h"
+#include "filter.h"
 #include "tty.h"
 #include "control.h"
 #include "jlink.h"
@@ -50,6 +57,13 @@ static struct btsnoop *btsnoop_file = NULL;
 static bool hcidump_fallback = false;
 static bool decode_control = true;
 static uint16_t filter_index = HCI_DEV_NONE;
+static uint64_t filter_since;
+static uint64_t filter_until;
+static uint16_t filter_handle = 0xffff;
+
+#define CONTROL_WRITE_BUFFER	(256 * 1024)
+#define CONTROL_FLUSH_INTERVAL	1000
+#define CONTROL_RCVBUF		(4 * 1024 * 1024)
 
 struct control_data {
 	uint16_t channel;
@@ -900,81 +914,453 @@ void control_message(uint16_t opcode, const void *data, uint16_t size)
 	}
 }
 
+static bool is_index_opcode(uint16_t opcode)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Records the decoder keeps state from: controllers, connections being
+ * created and terminated, L2CAP signaling for the channel list and SMP for
+ * the keys used to resolve addresses.
+ */
+static bool is_state_record(uint16_t opcode, const uint8_t *data,
+								uint16_t size)
+{
+	uint16_t cid;
+
+	if (is_index_opcode(opcode))
+		return true;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		if (size < 1)
+			return false;
+
+		switch (data[0]) {
+		case BT_HCI_EVT_CONN_COMPLETE:
+		case BT_HCI_EVT_DISCONNECT_COMPLETE:
+			return true;
+		case BT_HCI_EVT_LE_META_EVENT:
+			if (size < 3)
+				return false;
+
+			return data[2] == BT_HCI_EVT_LE_CONN_COMPLETE ||
+				data[2] == BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE;
+		}
+
+		return false;
+
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		/* Only start fragments carry the L2CAP header */
+		if (size < 8 || (data[1] & 0x10))
+			return false;
+
+		cid = get_le16(data + 6);
+
+		return cid == 0x0001 || cid == 0x0005 || cid == 0x0006 ||
+								cid == 0x0007;
+	}
+
+	return false;
+}
+
+static int null_fd = -1;
+
+/*
+ * Packets not matching the filter expression are not decoded, except for
+ * those the decoder takes its state from. Their output is discarded.
+ */
+static void decode_packet(struct timeval *tv, struct ucred *cred,
+					uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	int fd;
+
+	if (filter_match(index, opcode, data, size)) {
+		packet_monitor(tv, cred, index, opcode, data, size);
+		return;
+	}
+
+	if (!is_state_record(opcode, data, size)) {
+		packet_skip(index, opcode);
+		return;
+	}
+
+	if (null_fd < 0)
+		null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+	fflush(stdout);
+
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+		if (fd >= 0)
+			close(fd);
+
+		packet_skip(index, opcode);
+		return;
+	}
+
+	packet_monitor(tv, cred, index, opcode, data, size);
+
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+}
+
+/* Messages received with a single system call */
+#define CONTROL_BATCH	32
+
+struct control_batch {
+	struct mmsghdr msg[CONTROL_BATCH];
+	struct iovec iov[CONTROL_BATCH][2];
+	struct mgmt_hdr hdr[CONTROL_BATCH];
+	unsigned char buf[CONTROL_BATCH][BTSNOOP_MAX_PACKET_SIZE];
+	unsigned char control[CONTROL_BATCH][64];
+};
+
+static struct control_batch *batch;
+static uint32_t kernel_drops;
+static unsigned long write_drops;
+static unsigned long ring_drops;
+
+static void report_drops(void)
+{
+	static uint32_t last_kernel;
+	static unsigned long last_write;
+	static unsigned long last_ring;
+
+	if (kernel_drops != last_kernel)
+		fprintf(stderr, "Kernel dropped %u packets (%u total)\n",
+				kernel_drops - last_kernel, kernel_drops);
+
+	if (write_drops != last_write)
+		fprintf(stderr, "Failed to save %lu packets (%lu total)\n",
+				write_drops - last_write, write_drops);
+
+	if (ring_drops != last_ring)
+		fprintf(stderr, "Decoder dropped %lu packets (%lu total)\n",
+					ring_drops - last_ring, ring_drops);
+
+	last_kernel = kernel_drops;
+	last_write = write_drops;
+	last_ring = ring_drops;
+}
+
+static void process_msg(struct control_data *data, struct msghdr *msg,
+				const struct mgmt_hdr *hdr, unsigned char *buf)
+{
+	struct cmsghdr *cmsg;
+	struct timeval *tv = NULL;
+	struct timeval ctv;
+	struct ucred *cred = NULL;
+	struct ucred ccred;
+	uint16_t opcode, index, pktlen;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+				cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+			memcpy(&ctv, CMSG_DATA(cmsg), sizeof(ctv));
+			tv = &ctv;
+		}
+
+		if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+			memcpy(&ccred, CMSG_DATA(cmsg), sizeof(ccred));
+			cred = &ccred;
+		}
+
+		if (cmsg->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&kernel_drops, CMSG_DATA(cmsg),
+						sizeof(kernel_drops));
+	}
+
+	opcode = le16_to_cpu(hdr->opcode);
+	index  = le16_to_cpu(hdr->index);
+	pktlen = le16_to_cpu(hdr->len);
+
+	switch (data->channel) {
+	case HCI_CHANNEL_CONTROL:
+		packet_control(tv, cred, index, opcode, buf, pktlen);
+		break;
+	case HCI_CHANNEL_MONITOR:
+		if (btsnoop_file && !btsnoop_write_hci(btsnoop_file, tv, index,
+					opcode, kernel_drops, buf, pktlen))
+			write_drops++;
+
+		ellisys_inject_hci(tv, index, opcode, buf, pktlen);
+
+		if (analyze_stats_enabled())
+			analyze_stats_hci(tv, index, opcode, buf, pktlen);
+		else
+			decode_packet(tv, cred, index, opcode, buf, pktlen);
+		break;
+	}
+}
+
 static void data_callback(int fd, uint32_t events, void *user_data)
 {
 	struct control_data *data = user_data;
-	unsigned char control[64];
-	struct mgmt_hdr hdr;
-	struct msghdr msg;
-	struct iovec iov[2];
+	int i, count;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		mainloop_remove_fd(data->fd);
 		return;
 	}
 
-	iov[0].iov_base = &hdr;
-	iov[0].iov_len = MGMT_HDR_SIZE;
-	iov[1].iov_base = data->buf;
-	iov[1].iov_len = sizeof(data->buf);
+	if (!batch) {
+		batch = new0(struct control_batch, 1);
+
+		for (i = 0; i < CONTROL_BATCH; i++) {
+			struct msghdr *msg = &batch->msg[i].msg_hdr;
 
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 2;
-	msg.msg_control = control;
-	msg.msg_controllen = sizeof(control);
+			batch->iov[i][0].iov_base = &batch->hdr[i];
+			batch->iov[i][0].iov_len = MGMT_HDR_SIZE;
+			batch->iov[i][1].iov_base = batch->buf[i];
+			batch->iov[i][1].iov_len = sizeof(batch->buf[i]);
+
+			msg->msg_iov = batch->iov[i];
+			msg->msg_iovlen = 2;
+			msg->msg_control = batch->control[i];
+		}
+	}
 
 	while (1) {
-		struct cmsghdr *cmsg;
-		struct timeval *tv = NULL;
-		struct timeval ctv;
-		struct ucred *cred = NULL;
-		struct ucred ccred;
-		uint16_t opcode, index, pktlen;
-		ssize_t len;
+		for (i = 0; i < CONTROL_BATCH; i++)
+			batch->msg[i].msg_hdr.msg_controllen =
+						sizeof(batch->control[i]);
 
-		len = recvmsg(data->fd, &msg, MSG_DONTWAIT);
-		if (len < 0)
+		count = recvmmsg(data->fd, batch->msg, CONTROL_BATCH,
+							MSG_DONTWAIT, NULL);
+		if (count <= 0)
 			break;
 
-		if (len < MGMT_HDR_SIZE)
+		for (i = 0; i < count; i++) {
+			if (batch->msg[i].msg_len < MGMT_HDR_SIZE)
+				return;
+
+			process_msg(data, &batch->msg[i].msg_hdr,
+					&batch->hdr[i], batch->buf[i]);
+		}
+
+		if (count < CONTROL_BATCH)
 			break;
+	}
+}
+
+/*
+ * Live traces are captured by a separate thread that only copies the
+ * messages, including their timestamps, into a ring. Decoding and the
+ * terminal output stay on the mainloop and no longer hold back reading
+ * from the socket.
+ */
+#define CONTROL_RING_SIZE	4096
+#define CONTROL_RING_MASK	(CONTROL_RING_SIZE - 1)
+#define CONTROL_RING_BUDGET	256
+
+#define CONTROL_CMSG_SPACE	(CMSG_SPACE(sizeof(struct timeval)) + \
+				CMSG_SPACE(sizeof(struct ucred)) + \
+				CMSG_SPACE(sizeof(uint32_t)))
+
+struct control_slot {
+	struct mgmt_hdr hdr;
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	unsigned char control[CONTROL_CMSG_SPACE];
+	size_t controllen;
+	unsigned int len;
+};
+
+struct control_capture {
+	struct control_data *data;
+	pthread_t thread;
+	int event_fd;
+	unsigned int head;
+	unsigned int tail;
+	unsigned long drops;
+	bool done;
+	struct mmsghdr msg[CONTROL_BATCH];
+	struct iovec iov[CONTROL_BATCH][2];
+	struct control_slot spare;
+	struct control_slot ring[CONTROL_RING_SIZE];
+};
+
+static struct control_capture *capture;
+
+static void capture_signal(struct control_capture *cap)
+{
+	uint64_t val = 1;
+
+	if (write(cap->event_fd, &val, sizeof(val)) < 0)
+		return;
+}
+
+static void *capture_thread(void *user_data)
+{
+	struct control_capture *cap = user_data;
+	unsigned int head = 0, tail, room, len, i;
+	int count;
 
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_level != SOL_SOCKET)
+	while (1) {
+		tail = __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE);
+		room = CONTROL_RING_SIZE - (head - tail);
+		len = room && room < CONTROL_BATCH ? room : CONTROL_BATCH;
+
+		/* Keep reading when the ring is full, but discard the data */
+		for (i = 0; i < len; i++) {
+			struct msghdr *msg = &cap->msg[i].msg_hdr;
+			unsigned int pos = (head + i) & CONTROL_RING_MASK;
+			struct control_slot *slot;
+
+			if (room)
+				slot = &cap->ring[pos];
+			else
+				slot = &cap->spare;
+
+			cap->iov[i][0].iov_base = &slot->hdr;
+			cap->iov[i][0].iov_len = MGMT_HDR_SIZE;
+			cap->iov[i][1].iov_base = slot->buf;
+			cap->iov[i][1].iov_len = sizeof(slot->buf);
+
+			msg->msg_iov = cap->iov[i];
+			msg->msg_iovlen = 2;
+			msg->msg_control = slot->control;
+			msg->msg_controllen = sizeof(slot->control);
+		}
+
+		count = recvmmsg(cap->data->fd, cap->msg, len,
+							MSG_WAITFORONE, NULL);
+		if (count < 0) {
+			if (errno == EINTR)
 				continue;
+			break;
+		}
 
-			if (cmsg->cmsg_type == SCM_TIMESTAMP) {
-				memcpy(&ctv, CMSG_DATA(cmsg), sizeof(ctv));
-				tv = &ctv;
-			}
+		if (!room) {
+			__atomic_add_fetch(&cap->drops, count,
+							__ATOMIC_RELAXED);
+			continue;
+		}
 
-			if (cmsg->cmsg_type == SCM_CREDENTIALS) {
-				memcpy(&ccred, CMSG_DATA(cmsg), sizeof(ccred));
-				cred = &ccred;
-			}
+		for (i = 0; i < (unsigned int) count; i++) {
+			struct control_slot *slot;
+
+			slot = &cap->ring[(head + i) & CONTROL_RING_MASK];
+			slot->len = cap->msg[i].msg_len;
+			slot->controllen = cap->msg[i].msg_hdr.msg_controllen;
 		}
 
-		opcode = le16_to_cpu(hdr.opcode);
-		index  = le16_to_cpu(hdr.index);
-		pktlen = le16_to_cpu(hdr.len);
+		head += count;
+		__atomic_store_n(&cap->head, head, __ATOMIC_RELEASE);
 
-		switch (data->channel) {
-		case HCI_CHANNEL_CONTROL:
-			packet_control(tv, cred, index, opcode,
-							data->buf, pktlen);
-			break;
-		case HCI_CHANNEL_MONITOR:
-			btsnoop_write_hci(btsnoop_file, tv, index, opcode, 0,
-							data->buf, pktlen);
-			ellisys_inject_hci(tv, index, opcode,
-							data->buf, pktlen);
-			packet_monitor(tv, cred, index, opcode,
-							data->buf, pktlen);
-			break;
+		capture_signal(cap);
+	}
+
+	__atomic_store_n(&cap->done, true, __ATOMIC_RELEASE);
+	capture_signal(cap);
+
+	return NULL;
+}
+
+static void capture_callback(int fd, uint32_t events, void *user_data)
+{
+	struct control_capture *cap = user_data;
+	unsigned int head, tail, budget = CONTROL_RING_BUDGET;
+	uint64_t val;
+
+	if (read(cap->event_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		return;
+
+	head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+	tail = cap->tail;
+
+	while (tail != head && budget--) {
+		struct control_slot *slot = &cap->ring[tail & CONTROL_RING_MASK];
+		struct msghdr msg;
+
+		if (slot->len >= MGMT_HDR_SIZE) {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_control = slot->control;
+			msg.msg_controllen = slot->controllen;
+
+			process_msg(cap->data, &msg, &slot->hdr, slot->buf);
 		}
+
+		__atomic_store_n(&cap->tail, ++tail, __ATOMIC_RELEASE);
+	}
+
+	ring_drops = __atomic_load_n(&cap->drops, __ATOMIC_RELAXED);
+	report_drops();
+
+	/* Give other events a chance while the decoder is behind */
+	if (tail != head) {
+		capture_signal(cap);
+		return;
 	}
+
+	if (__atomic_load_n(&cap->done, __ATOMIC_ACQUIRE) &&
+			tail == __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE))
+		mainloop_remove_fd(cap->event_fd);
+}
+
+static void capture_destroy(void *user_data)
+{
+	struct control_capture *cap = user_data;
+
+	close(cap->event_fd);
+}
+
+static int start_capture(struct control_data *data)
+{
+	struct control_capture *cap;
+
+	cap = new0(struct control_capture, 1);
+	cap->data = data;
+
+	cap->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (cap->event_fd < 0)
+		goto failed;
+
+	if (mainloop_add_fd(cap->event_fd, EPOLLIN, capture_callback,
+						cap, capture_destroy) < 0) {
+		close(cap->event_fd);
+		goto failed;
+	}
+
+	if (pthread_create(&cap->thread, NULL, capture_thread, cap)) {
+		mainloop_remove_fd(cap->event_fd);
+		goto failed;
+	}
+
+	capture = cap;
+
+	return 0;
+
+failed:
+	free(cap);
+	return -1;
+}
+
+static void stop_capture(void)
+{
+	if (!capture)
+		return;
+
+	pthread_cancel(capture->thread);
+	pthread_join(capture->thread, NULL);
+
+	ring_drops = __atomic_load_n(&capture->drops, __ATOMIC_RELAXED);
 }
 
 static int open_socket(uint16_t channel)
@@ -1017,6 +1403,15 @@ static int open_socket(uint16_t channel)
 		return -1;
 	}
 
+	/* Only reported by kernels that count drops on this socket */
+	setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt));
+
+	/* Give the writer more slack when the system is loaded */
+	if (btsnoop_file && channel == HCI_CHANNEL_MONITOR) {
+		opt = CONTROL_RCVBUF;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(opt));
+	}
+
 	return fd;
 }
 
@@ -1071,6 +1466,9 @@ static int open_channel(uint16_t channel)
 	if (filter_index != HCI_DEV_NONE)
 		attach_index_filter(data->fd, filter_index);
 
+	if (channel == HCI_CHANNEL_MONITOR && !start_capture(data))
+		return 0;
+
 	if (mainloop_add_fd(data->fd, EPOLLIN, data_callback,
 						data, free_data) < 0) {
 		close(data->fd);
@@ -1109,7 +1507,7 @@ static void client_callback(int fd, uint32_t events, void *user_data)
 		opcode = le16_to_cpu(hdr->opcode);
 		index = le16_to_cpu(hdr->index);
 
-		packet_monitor(NULL, NULL, index, opcode,
+		decode_packet(NULL, NULL, index, opcode,
 					data->buf + MGMT_HDR_SIZE, pktlen);
 
 		data->offset -= pktlen + MGMT_HDR_SIZE;
@@ -1297,8 +1695,12 @@ static bool tty_parse_header(uint8_t *hdr, uint8_t len, struct timeval **tv,
 
 static void process_data(struct control_data *data)
 {
-	while (data->offset >= sizeof(struct tty_hdr)) {
-		struct tty_hdr *hdr = (struct tty_hdr *) data->buf;
+	uint16_t start = 0, len;
+
+	/* Decode packets in place and move the remainder only once */
+	for (len = data->offset; len >= sizeof(struct tty_hdr);
+					len = data->offset - start) {
+		struct tty_hdr *hdr = (struct tty_hdr *) (data->buf + start);
 		uint16_t pktlen, opcode, data_len;
 		struct timeval *tv = NULL;
 		struct timeval ctv;
@@ -1306,14 +1708,13 @@ static void process_data(struct control_data *data)
 
 		data_len = le16_to_cpu(hdr->data_len);
 
-		if (data->offset < 2 + data_len)
-			return;
+		if (len < 2 + data_len)
+			break;
 
-		if (data->offset < sizeof(*hdr) + hdr->hdr_len) {
+		if (data_len < 4 + hdr->hdr_len) {
 			fprintf(stderr, "Received corrupted data from TTY\n");
-			memmove(data->buf, data->buf + 2 + data_len,
-								data->offset);
-			return;
+			start += 2 + data_len;
+			continue;
 		}
 
 		if (!tty_parse_header(hdr->ext_hdr, hdr->hdr_len,
@@ -1327,15 +1728,24 @@ static void process_data(struct control_data *data)
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 		ellisys_inject_hci(tv, 0, opcode, hdr->ext_hdr + hdr->hdr_len,
 					pktlen);
-		packet_monitor(tv, NULL, 0, opcode,
-					hdr->ext_hdr + hdr->hdr_len, pktlen);
 
-		data->offset -= 2 + data_len;
+		if (analyze_stats_enabled())
+			analyze_stats_hci(tv, 0, opcode,
+					hdr->ext_hdr + hdr->hdr_len, pktlen);
+		else
+			decode_packet(tv, NULL, 0, opcode,
+					hdr->ext_hdr + hdr->hdr_len, pktlen);
 
-		if (data->offset > 0)
-			memmove(data->buf, data->buf + 2 + data_len,
-								data->offset);
+		start += 2 + data_len;
 	}
+
+	if (!start)
+		return;
+
+	data->offset -= start;
+
+	if (data->offset > 0)
+		memmove(data->buf, data->buf + start, data->offset);
 }
 
 static void tty_callback(int fd, uint32_t events, void *user_data)
@@ -1465,19 +1875,363 @@ int control_rtt(char *jlink, char *rtt)
 	return 0;
 }
 
-bool control_writer(const char *path)
+static void flush_callback(int id, void *user_data)
+{
+	if (!btsnoop_flush(btsnoop_file))
+		fprintf(stderr, "Failed to write trace file\n");
+
+	report_drops();
+
+	if (mainloop_modify_timeout(id, CONTROL_FLUSH_INTERVAL) < 0)
+		mainloop_exit_failure();
+}
+
+bool control_writer(const char *path, bool compress)
+{
+	if (compress)
+		btsnoop_file = btsnoop_create_compressed(path, 0, 0,
+							BTSNOOP_FORMAT_MONITOR);
+	else
+		btsnoop_file = btsnoop_create(path, 0, 0,
+							BTSNOOP_FORMAT_MONITOR);
+	if (!btsnoop_file)
+		return false;
+
+	/* Records are written in batches and at least once per interval */
+	if (compress || btsnoop_set_write_buffer(btsnoop_file,
+							CONTROL_WRITE_BUFFER))
+		mainloop_add_timeout(CONTROL_FLUSH_INTERVAL, flush_callback,
+								NULL, NULL);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	stop_capture();
+
+	if (!btsnoop_file) {
+		report_drops();
+		return;
+	}
+
+	btsnoop_flush(btsnoop_file);
+	report_drops();
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+static uint64_t tv_to_us(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static bool match_handle(uint16_t opcode, const void *data, uint16_t size)
+{
+	const uint8_t *ptr = data;
+
+	if (filter_handle == 0xffff)
+		return true;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		break;
+	default:
+		/* Keep commands and events for the connection state */
+		return true;
+	}
+
+	if (size < 2)
+		return false;
+
+	return ((ptr[0] | ptr[1] << 8) & 0x0fff) == filter_handle;
+}
+
+static void seek_to_start(uint64_t start)
 {
-	btsnoop_file = btsnoop_create(path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	struct timeval tv;
+	uint64_t since = start + filter_since;
+
+	if (!filter_since && filter_handle == 0xffff)
+		return;
+
+	tv.tv_sec = since / 1000000;
+	tv.tv_usec = since % 1000000;
 
-	return !!btsnoop_file;
+	btsnoop_seek(btsnoop_file, filter_since ? &tv : NULL, filter_index,
+								filter_handle);
+}
+
+struct reader_state {
+	uint64_t start;
+	bool started;
+	bool seek;
+};
+
+/* Returns false at the end of the file or of the requested time range */
+static bool reader_hci(struct reader_state *state, bool filter)
+{
+	uint16_t index, opcode, pktlen;
+	const void *data;
+	struct timeval tv;
+	uint64_t ts;
+
+	if (!btsnoop_next_hci(btsnoop_file, &tv, &index, &opcode, &data,
+								&pktlen))
+		return false;
+
+	if (opcode == 0xffff)
+		return true;
+
+	ts = tv_to_us(&tv);
+
+	/* Times are relative to the first record */
+	if (!state->started) {
+		state->start = ts;
+		state->started = true;
+
+		if (state->seek)
+			seek_to_start(state->start);
+	}
+
+	if (filter && !is_index_opcode(opcode)) {
+		if (ts < state->start + filter_since)
+			return true;
+
+		if (filter_until && ts > state->start + filter_until)
+			return false;
+
+		if (!match_handle(opcode, data, pktlen))
+			return true;
+	}
+
+	decode_packet(&tv, NULL, index, opcode, data, pktlen);
+	ellisys_inject_hci(&tv, index, opcode, data, pktlen);
+
+	return true;
+}
+
+/* Records decoded ahead of a chunk to finish PDUs split in fragments */
+#define READER_WARMUP	256
+
+struct reader_chunk {
+	off_t warmup;
+	off_t start;
+	off_t end;
+	FILE *out;
+	pid_t pid;
+};
+
+static unsigned int reader_jobs = 1;
+
+static bool reader_prepass(const char *path, struct reader_chunk *chunks,
+							unsigned int jobs)
+{
+	off_t warmup[READER_WARMUP];
+	unsigned int count = 0, n = 0;
+	off_t offset, size;
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return false;
+
+	size = st.st_size;
+
+	while (1) {
+		uint16_t index, opcode, pktlen;
+		const void *data;
+		struct timeval tv;
+
+		offset = btsnoop_get_offset(btsnoop_file);
+		if (offset < 0)
+			return false;
+
+		/* The chunks start at the first record past an equal split */
+		if (n < jobs && offset >= size * n / jobs) {
+			chunks[n].start = offset;
+
+			if (count < READER_WARMUP)
+				chunks[n].warmup = count ? warmup[0] : offset;
+			else
+				chunks[n].warmup =
+					warmup[count % READER_WARMUP];
+
+			if (n)
+				chunks[n - 1].end = offset;
+
+			n++;
+		}
+
+		if (!btsnoop_next_hci(btsnoop_file, &tv, &index, &opcode,
+							&data, &pktlen))
+			break;
+
+		warmup[count++ % READER_WARMUP] = offset;
+	}
+
+	if (!n)
+		return false;
+
+	for (; n < jobs; n++)
+		chunks[n].warmup = chunks[n].start = offset;
+
+	chunks[jobs - 1].end = offset;
+
+	return true;
+}
+
+/* Decodes only what later records depend on and counts the rest */
+static bool reader_skip_hci(struct reader_state *state)
+{
+	uint16_t index, opcode, pktlen;
+	const void *data;
+	struct timeval tv;
+
+	if (!btsnoop_next_hci(btsnoop_file, &tv, &index, &opcode, &data,
+								&pktlen))
+		return false;
+
+	if (opcode == 0xffff)
+		return true;
+
+	/* The filter needs to see every record for its own state */
+	filter_match(index, opcode, data, pktlen);
+
+	/* The first record sets the time base */
+	if (!state->started) {
+		state->start = tv_to_us(&tv);
+		state->started = true;
+	} else if (!is_state_record(opcode, data, pktlen)) {
+		packet_skip(index, opcode);
+		return true;
+	}
+
+	packet_monitor(&tv, NULL, index, opcode, data, pktlen);
+
+	return true;
+}
+
+static void reader_worker(const char *path, off_t first,
+						struct reader_chunk *chunk)
+{
+	struct reader_state state = { };
+	int fd;
+
+	/* The file offset would be shared with the other workers otherwise */
+	btsnoop_unref(btsnoop_file);
+
+	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop_file || !btsnoop_set_offset(btsnoop_file, first))
+		_exit(EXIT_FAILURE);
+
+	fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		_exit(EXIT_FAILURE);
+
+	/* Rebuild the decoder state silently before the chunk */
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	while (btsnoop_get_offset(btsnoop_file) < chunk->warmup) {
+		if (!reader_skip_hci(&state))
+			break;
+	}
+
+	while (btsnoop_get_offset(btsnoop_file) < chunk->start) {
+		if (!reader_hci(&state, false))
+			break;
+	}
+
+	fflush(stdout);
+	dup2(fileno(chunk->out), STDOUT_FILENO);
+
+	while (btsnoop_get_offset(btsnoop_file) < chunk->end) {
+		if (!reader_hci(&state, true))
+			break;
+	}
+
+	fflush(stdout);
+	_exit(EXIT_SUCCESS);
+}
+
+static bool reader_parallel(const char *path, unsigned int jobs)
+{
+	struct reader_chunk *chunks;
+	char buf[4096];
+	unsigned int i;
+	bool result = false;
+	size_t len;
+
+	chunks = calloc(jobs, sizeof(*chunks));
+	if (!chunks)
+		return false;
+
+	if (!reader_prepass(path, chunks, jobs))
+		goto done;
+
+	/* Workers must make the same output decisions as a single reader */
+	use_color();
+	num_columns();
+	fflush(stdout);
+
+	for (i = 0; i < jobs; i++) {
+		chunks[i].out = tmpfile();
+		if (!chunks[i].out)
+			goto done;
+
+		chunks[i].pid = fork();
+		if (chunks[i].pid < 0)
+			goto done;
+
+		if (!chunks[i].pid)
+			reader_worker(path, chunks[0].start, &chunks[i]);
+	}
+
+	result = true;
+
+	for (i = 0; i < jobs; i++) {
+		int status;
+
+		if (waitpid(chunks[i].pid, &status, 0) < 0 ||
+				!WIFEXITED(status) || WEXITSTATUS(status))
+			fprintf(stderr, "Failed to decode part %u\n", i);
+
+		rewind(chunks[i].out);
+
+		while ((len = fread(buf, 1, sizeof(buf), chunks[i].out)) > 0)
+			fwrite(buf, 1, len, stdout);
+	}
+
+done:
+	for (i = 0; i < jobs; i++) {
+		if (!result && chunks[i].pid > 0) {
+			kill(chunks[i].pid, SIGTERM);
+			waitpid(chunks[i].pid, NULL, 0);
+		}
+
+		if (chunks[i].out)
+			fclose(chunks[i].out);
+	}
+
+	free(chunks);
+
+	return result;
 }
 
 void control_reader(const char *path, bool pager)
 {
 	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct reader_state state = { .seek = true };
 	uint16_t pktlen;
 	uint32_t format;
 	struct timeval tv;
+	off_t offset;
 
 	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
 	if (!btsnoop_file)
@@ -1504,19 +2258,18 @@ void control_reader(const char *path, bool pager)
 	case BTSNOOP_FORMAT_HCI:
 	case BTSNOOP_FORMAT_UART:
 	case BTSNOOP_FORMAT_MONITOR:
-		while (1) {
-			uint16_t index, opcode;
+		offset = btsnoop_get_offset(btsnoop_file);
 
-			if (!btsnoop_read_hci(btsnoop_file, &tv, &index,
-							&opcode, buf, &pktlen))
+		if (reader_jobs > 1 && offset >= 0) {
+			if (reader_parallel(path, reader_jobs))
 				break;
 
-			if (opcode == 0xffff)
-				continue;
-
-			packet_monitor(&tv, NULL, index, opcode, buf, pktlen);
-			ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
+			/* Start over if the file couldn't be split */
+			if (!btsnoop_set_offset(btsnoop_file, offset))
+				break;
 		}
+
+		while (reader_hci(&state, true));
 		break;
 
 	case BTSNOOP_FORMAT_SIMULATOR:
@@ -1538,6 +2291,11 @@ void control_reader(const char *path, bool pager)
 	btsnoop_unref(btsnoop_file);
 }
 
+void control_reader_jobs(unsigned int jobs)
+{
+	reader_jobs = jobs;
+}
+
 int control_tracing(void)
 {
 	packet_add_filter(PACKET_FILTER_SHOW_INDEX);
@@ -1568,3 +2326,14 @@ void control_filter_index(uint16_t index)
 {
 	filter_index = index;
 }
+
+void control_filter_time(uint64_t since, uint64_t until)
+{
+	filter_since = since;
+	filter_until = until;
+}
+
+void control_filter_handle(uint16_t handle)
+{
+	filter_handle = handle;
+}
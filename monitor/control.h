@@ -11,7 +11,8 @@
 
 #include <stdint.h>
 
-bool control_writer(const char *path);
+bool control_writer(const char *path, bool compress);
+void control_cleanup(void);
 void control_reader(const char *path, bool pager);
 void control_server(const char *path);
 int control_tty(const char *path, unsigned int speed);
@@ -19,5 +20,8 @@ int control_rtt(char *jlink, char *rtt);
 int control_tracing(void);
 void control_disable_decoding(void);
 void control_filter_index(uint16_t index);
+void control_filter_time(uint64_t since, uint64_t until);
+void control_filter_handle(uint16_t handle);
+void control_reader_jobs(unsigned int jobs);
 
 void control_message(uint16_t opcode, const void *data, uint16_t size);
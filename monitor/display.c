@@ -15,6 +15,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -30,6 +31,10 @@
 static pid_t pager_pid = 0;
 int default_pager_num_columns = FALLBACK_TERMINAL_WIDTH;
 enum monitor_color setting_monitor_color = COLOR_AUTO;
+static bool json_output;
+static bool json_record;
+static bool json_fields;
+static bool json_first;
 
 void set_monitor_color(enum monitor_color color)
 {
@@ -40,6 +45,9 @@ bool use_color(void)
 {
 	static int cached_use_color = -1;
 
+	if (json_output)
+		return false;
+
 	if (setting_monitor_color == COLOR_ALWAYS)
 		cached_use_color = 1;
 	else if (setting_monitor_color == COLOR_NEVER)
@@ -173,3 +181,202 @@ void close_pager(void)
 	wait_for_terminate(pager_pid);
 	pager_pid = 0;
 }
+
+void set_monitor_json(bool enable)
+{
+	json_output = enable;
+}
+
+bool use_json(void)
+{
+	return json_output;
+}
+
+/* Length of the UTF-8 sequence at str or 0 if it is not valid */
+static size_t utf8_seq_len(const unsigned char *str, size_t len)
+{
+	size_t i, n;
+
+	if (str[0] >= 0xc2 && str[0] <= 0xdf)
+		n = 2;
+	else if (str[0] >= 0xe0 && str[0] <= 0xef)
+		n = 3;
+	else if (str[0] >= 0xf0 && str[0] <= 0xf4)
+		n = 4;
+	else
+		return 0;
+
+	if (n > len)
+		return 0;
+
+	for (i = 1; i < n; i++) {
+		if ((str[i] & 0xc0) != 0x80)
+			return 0;
+	}
+
+	return n;
+}
+
+static void json_string(const char *str, size_t len)
+{
+	const unsigned char *ptr = (const unsigned char *) str;
+	size_t i, n;
+
+	putchar('"');
+
+	for (i = 0; i < len; i++) {
+		switch (ptr[i]) {
+		case '"':
+			fputs("\\\"", stdout);
+			continue;
+		case '\\':
+			fputs("\\\\", stdout);
+			continue;
+		}
+
+		if (ptr[i] >= 0x20 && ptr[i] < 0x7f) {
+			putchar(ptr[i]);
+			continue;
+		}
+
+		/* Names from remote devices are not guaranteed to be UTF-8 */
+		n = ptr[i] > 0x7f ? utf8_seq_len(ptr + i, len - i) : 0;
+		if (n) {
+			fwrite(ptr + i, 1, n, stdout);
+			i += n - 1;
+		} else
+			printf("\\u%04x", ptr[i]);
+	}
+
+	putchar('"');
+}
+
+static void json_key(const char *name)
+{
+	if (json_fields) {
+		putchar(']');
+		json_fields = false;
+	}
+
+	if (json_first)
+		json_first = false;
+	else
+		putchar(',');
+
+	printf("\"%s\":", name);
+}
+
+static void json_open(void)
+{
+	putchar('{');
+	json_record = true;
+	json_first = true;
+}
+
+void json_begin(void)
+{
+	json_end();
+	json_open();
+}
+
+void json_end(void)
+{
+	if (!json_record)
+		return;
+
+	if (json_fields) {
+		putchar(']');
+		json_fields = false;
+	}
+
+	fputs("}\n", stdout);
+	json_record = false;
+}
+
+void json_str(const char *name, const char *value)
+{
+	if (!json_record || !value)
+		return;
+
+	json_key(name);
+	json_string(value, strlen(value));
+}
+
+void json_uint(const char *name, uint64_t value)
+{
+	if (!json_record)
+		return;
+
+	json_key(name);
+	printf("%" PRIu64, value);
+}
+
+void json_time(const char *name, const struct timeval *tv)
+{
+	if (!json_record || !tv)
+		return;
+
+	json_key(name);
+	printf("%lld.%06ld", (long long) tv->tv_sec, (long) tv->tv_usec);
+}
+
+/*
+ * Decoded lines become fields of the current record. Lines of the form
+ * "Name: value" are split so consumers don't have to parse them again.
+ */
+void json_line(int indent, const char *fmt, ...)
+{
+	char buf[512], *str = buf, *ptr, *sep;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	if ((size_t) len >= sizeof(buf)) {
+		va_start(ap, fmt);
+		len = vasprintf(&str, fmt, ap);
+		va_end(ap);
+
+		if (len < 0)
+			return;
+	}
+
+	if (!json_record)
+		json_open();
+
+	if (!json_fields) {
+		json_key("fields");
+		putchar('[');
+		json_fields = true;
+	} else
+		putchar(',');
+
+	for (ptr = str; *ptr == ' '; ptr++)
+		indent++;
+
+	printf("{\"indent\":%d,", indent);
+
+	sep = strstr(ptr, ": ");
+	if (sep) {
+		fputs("\"name\":", stdout);
+		json_string(ptr, sep - ptr);
+		fputs(",\"value\":", stdout);
+		json_string(sep + 2, len - (sep + 2 - str));
+	} else if (len > ptr - str && str[len - 1] == ':') {
+		fputs("\"name\":", stdout);
+		json_string(ptr, len - (ptr - str) - 1);
+	} else {
+		fputs("\"text\":", stdout);
+		json_string(ptr, len - (ptr - str));
+	}
+
+	putchar('}');
+
+	if (str != buf)
+		free(str);
+}
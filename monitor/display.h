@@ -17,6 +17,18 @@ bool use_color(void);
 enum monitor_color { COLOR_AUTO, COLOR_ALWAYS, COLOR_NEVER };
 void set_monitor_color(enum monitor_color);
 
+struct timeval;
+
+bool use_json(void);
+void set_monitor_json(bool enable);
+void json_begin(void);
+void json_end(void);
+void json_str(const char *name, const char *value);
+void json_uint(const char *name, uint64_t value);
+void json_time(const char *name, const struct timeval *tv);
+void json_line(int indent, const char *fmt, ...)
+					__attribute__((format(printf, 2, 3)));
+
 #define COLOR_OFF	"\x1B[0m"
 #define COLOR_BLACK	"\x1B[0;30m"
 #define COLOR_RED	"\x1B[0;31m"
@@ -43,10 +55,13 @@ void set_monitor_color(enum monitor_color);
 
 #define print_indent(indent, color1, prefix, title, color2, fmt, args...) \
 do { \
-	printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
-		use_color() ? (color1) : "", prefix, title, \
-		use_color() ? (color2) : "", ## args, \
-		use_color() ? COLOR_OFF : ""); \
+	if (use_json()) \
+		json_line((indent), "%s%s" fmt, prefix, title, ## args); \
+	else \
+		printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
+			use_color() ? (color1) : "", prefix, title, \
+			use_color() ? (color2) : "", ## args, \
+			use_color() ? COLOR_OFF : ""); \
 } while (0)
 
 #define print_text(color, fmt, args...) \
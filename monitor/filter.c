@@ -0,0 +1,871 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+/*
+ * Filter expressions evaluated on the raw packet headers, so packets that
+ * do not match can be skipped before they are decoded. The little state
+ * this needs, the address of each connection and the PSM of each L2CAP
+ * channel, is tracked here from the packets themselves.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+#include "monitor/bt.h"
+#include "monitor/filter.h"
+
+#define MAX_TERMS	16
+#define MAX_VALUES	8
+
+#define PSM_ATT		0x001f
+#define PSM_EATT	0x0027
+
+enum filter_key {
+	KEY_HANDLE,
+	KEY_ADDR,
+	KEY_OPCODE,
+	KEY_EVENT,
+	KEY_PSM,
+	KEY_CID,
+	KEY_ATT,
+};
+
+static const struct {
+	const char *name;
+	enum filter_key key;
+	unsigned long max;
+} key_table[] = {
+	{ "handle",	KEY_HANDLE,	0x0fff	},
+	{ "addr",	KEY_ADDR,	0	},
+	{ "opcode",	KEY_OPCODE,	0xffff	},
+	{ "event",	KEY_EVENT,	0xff	},
+	{ "psm",	KEY_PSM,	0xffff	},
+	{ "cid",	KEY_CID,	0xffff	},
+	{ "att",	KEY_ATT,	0xff	},
+	{ }
+};
+
+struct filter_term {
+	enum filter_key key;
+	bool negate;
+	unsigned int count;
+	uint16_t values[MAX_VALUES];
+	bdaddr_t addrs[MAX_VALUES];
+};
+
+static struct filter_term terms[MAX_TERMS];
+static unsigned int num_terms;
+
+/* The L2CAP PDU the fragments of one direction currently belong to */
+struct filter_pdu {
+	int cid;
+	int psm;
+	int att;
+};
+
+struct filter_conn {
+	uint16_t index;
+	uint16_t handle;
+	bool has_addr;
+	uint8_t bdaddr[6];
+	struct filter_pdu pdu[2];
+};
+
+struct filter_chan {
+	uint16_t index;
+	uint16_t handle;
+	uint16_t lcid;
+	uint16_t rcid;
+	uint16_t psm;
+	uint8_t ident;
+	bool credits;
+};
+
+static struct queue *conn_list;
+static struct queue *chan_list;
+
+/* What a packet refers to, negative values are not applicable */
+struct filter_pkt {
+	const uint8_t *handles;
+	unsigned int num_handles;
+	unsigned int stride;
+	bool has_addr;
+	uint8_t bdaddr[6];
+	int opcode;
+	int event;
+	int psm;
+	int cid;
+	int att;
+	bool disconnect;
+};
+
+static bool parse_term(struct filter_term *term, char *str)
+{
+	char *value, *tok, *saveptr, *end;
+	unsigned long val;
+	unsigned int i;
+
+	if (*str == '!') {
+		term->negate = true;
+		str++;
+	}
+
+	value = strchr(str, '=');
+	if (!value)
+		return false;
+
+	*value++ = '\0';
+
+	for (i = 0; key_table[i].name; i++) {
+		if (!strcmp(key_table[i].name, str))
+			break;
+	}
+
+	if (!key_table[i].name)
+		return false;
+
+	term->key = key_table[i].key;
+
+	for (tok = strtok_r(value, ",", &saveptr); tok;
+				tok = strtok_r(NULL, ",", &saveptr)) {
+		if (term->count == MAX_VALUES)
+			return false;
+
+		if (term->key == KEY_ADDR) {
+			if (bachk(tok) < 0)
+				return false;
+
+			str2ba(tok, &term->addrs[term->count++]);
+			continue;
+		}
+
+		val = strtoul(tok, &end, 0);
+		if (end == tok || *end != '\0' || val > key_table[i].max)
+			return false;
+
+		term->values[term->count++] = val;
+	}
+
+	return term->count > 0;
+}
+
+/*
+ * Parses whitespace separated terms of the form [!]key=value[,value...]
+ * that all have to match. Further expressions add to the terms parsed
+ * before.
+ */
+bool filter_parse(const char *expr)
+{
+	char *str, *tok, *saveptr;
+	unsigned int count = num_terms;
+
+	str = strdup(expr);
+	if (!str)
+		return false;
+
+	for (tok = strtok_r(str, " \t", &saveptr); tok;
+				tok = strtok_r(NULL, " \t", &saveptr)) {
+		if (count == MAX_TERMS)
+			goto failed;
+
+		memset(&terms[count], 0, sizeof(terms[count]));
+
+		if (!parse_term(&terms[count], tok))
+			goto failed;
+
+		count++;
+	}
+
+	free(str);
+
+	if (count == num_terms)
+		return false;
+
+	num_terms = count;
+
+	return true;
+
+failed:
+	free(str);
+
+	return false;
+}
+
+bool filter_enabled(void)
+{
+	return num_terms > 0;
+}
+
+static bool match_conn(const void *data, const void *match_data)
+{
+	const struct filter_conn *conn = data;
+	const struct filter_conn *match = match_data;
+
+	return conn->index == match->index && conn->handle == match->handle;
+}
+
+static struct filter_conn *find_conn(uint16_t index, uint16_t handle)
+{
+	struct filter_conn match = { .index = index, .handle = handle };
+
+	return queue_find(conn_list, match_conn, &match);
+}
+
+static struct filter_conn *get_conn(uint16_t index, uint16_t handle)
+{
+	struct filter_conn *conn;
+	unsigned int i;
+
+	conn = find_conn(index, handle);
+	if (conn)
+		return conn;
+
+	conn = new0(struct filter_conn, 1);
+	conn->index = index;
+	conn->handle = handle;
+
+	for (i = 0; i < 2; i++) {
+		conn->pdu[i].cid = -1;
+		conn->pdu[i].psm = -1;
+		conn->pdu[i].att = -1;
+	}
+
+	if (!conn_list)
+		conn_list = queue_new();
+
+	queue_push_tail(conn_list, conn);
+
+	return conn;
+}
+
+static bool match_chan_conn(const void *data, const void *match_data)
+{
+	const struct filter_chan *chan = data;
+	const struct filter_conn *conn = match_data;
+
+	return chan->index == conn->index && chan->handle == conn->handle;
+}
+
+static void remove_conn(uint16_t index, uint16_t handle)
+{
+	struct filter_conn *conn;
+
+	conn = find_conn(index, handle);
+	if (!conn)
+		return;
+
+	queue_remove_all(chan_list, match_chan_conn, conn, free);
+	queue_remove(conn_list, conn);
+	free(conn);
+}
+
+struct chan_match {
+	const struct filter_conn *conn;
+	bool in;
+	uint16_t cid;
+	uint8_t ident;
+};
+
+/* Received frames carry the local CID, transmitted ones the remote CID */
+static bool match_chan_cid(const void *data, const void *match_data)
+{
+	const struct filter_chan *chan = data;
+	const struct chan_match *match = match_data;
+
+	if (!match_chan_conn(chan, match->conn))
+		return false;
+
+	return (match->in ? chan->lcid : chan->rcid) == match->cid;
+}
+
+/* Responses go the other way than the request they answer */
+static bool match_chan_pending(const void *data, const void *match_data)
+{
+	const struct filter_chan *chan = data;
+	const struct chan_match *match = match_data;
+
+	if (!match_chan_conn(chan, match->conn) || chan->ident != match->ident)
+		return false;
+
+	if (match->in)
+		return !chan->rcid && (!match->cid || chan->lcid == match->cid);
+
+	return !chan->lcid && (!match->cid || chan->rcid == match->cid);
+}
+
+static struct filter_chan *find_chan(const struct filter_conn *conn,
+						bool in, uint16_t cid)
+{
+	struct chan_match match = { .conn = conn, .in = in, .cid = cid };
+
+	return queue_find(chan_list, match_chan_cid, &match);
+}
+
+static int add_chan(const struct filter_conn *conn, bool in, uint8_t ident,
+				uint16_t psm, uint16_t scid, bool credits)
+{
+	struct chan_match match = { .conn = conn, .in = !in, .cid = scid };
+	struct filter_chan *chan;
+
+	/* The identifier is reused once the old channel is gone */
+	queue_remove_all(chan_list, match_chan_cid, &match, free);
+
+	chan = new0(struct filter_chan, 1);
+	chan->index = conn->index;
+	chan->handle = conn->handle;
+
+	if (in)
+		chan->rcid = scid;
+	else
+		chan->lcid = scid;
+
+	chan->psm = psm;
+	chan->ident = ident;
+	chan->credits = credits;
+
+	if (!chan_list)
+		chan_list = queue_new();
+
+	queue_push_tail(chan_list, chan);
+
+	return psm;
+}
+
+static int connect_chan(const struct filter_conn *conn, bool in,
+				uint8_t ident, uint16_t scid, uint16_t dcid)
+{
+	struct chan_match match = { .conn = conn, .in = in, .cid = scid,
+							.ident = ident };
+	struct filter_chan *chan;
+
+	chan = queue_find(chan_list, match_chan_pending, &match);
+	if (!chan)
+		return -1;
+
+	if (in)
+		chan->rcid = dcid;
+	else
+		chan->lcid = dcid;
+
+	return chan->psm;
+}
+
+/* Disconnections carry the CID of the receiver of the request first */
+static int disconnect_chan(const struct filter_conn *conn, bool in,
+					bool rsp, const uint8_t *data)
+{
+	struct chan_match match = { .conn = conn, .in = true };
+	struct filter_chan *chan;
+	int psm;
+
+	match.cid = get_le16(in == rsp ? data + 2 : data);
+
+	chan = queue_find(chan_list, match_chan_cid, &match);
+	if (!chan)
+		return -1;
+
+	psm = chan->psm;
+
+	if (rsp) {
+		queue_remove(chan_list, chan);
+		free(chan);
+	}
+
+	return psm;
+}
+
+static void parse_sig(const struct filter_conn *conn, bool in,
+			struct filter_pdu *pdu, const uint8_t *data,
+			uint16_t size)
+{
+	uint16_t len, psm;
+	uint8_t code, ident;
+	unsigned int i;
+	int result;
+
+	while (size >= 4) {
+		code = data[0];
+		ident = data[1];
+		len = get_le16(data + 2);
+
+		data += 4;
+		size -= 4;
+
+		if (len > size)
+			break;
+
+		result = -1;
+
+		switch (code) {
+		case BT_L2CAP_PDU_CONN_REQ:
+			if (len < 4)
+				break;
+
+			result = add_chan(conn, in, ident, get_le16(data),
+						get_le16(data + 2), false);
+			break;
+		case BT_L2CAP_PDU_CONN_RSP:
+			if (len < 4)
+				break;
+
+			result = connect_chan(conn, in, ident,
+						get_le16(data + 2),
+						get_le16(data));
+			break;
+		case BT_L2CAP_PDU_DISCONN_REQ:
+		case BT_L2CAP_PDU_DISCONN_RSP:
+			if (len < 4)
+				break;
+
+			result = disconnect_chan(conn, in,
+					code == BT_L2CAP_PDU_DISCONN_RSP, data);
+			break;
+		case BT_L2CAP_PDU_LE_CONN_REQ:
+			if (len < 4)
+				break;
+
+			result = add_chan(conn, in, ident, get_le16(data),
+						get_le16(data + 2), true);
+			break;
+		case BT_L2CAP_PDU_LE_CONN_RSP:
+			if (len < 2)
+				break;
+
+			result = connect_chan(conn, in, ident, 0,
+							get_le16(data));
+			break;
+		case BT_L2CAP_PDU_ECRED_CONN_REQ:
+			if (len < 8)
+				break;
+
+			psm = get_le16(data);
+
+			for (i = 8; i + 2 <= len; i += 2)
+				result = add_chan(conn, in, ident, psm,
+						get_le16(data + i), true);
+			break;
+		case BT_L2CAP_PDU_ECRED_CONN_RSP:
+			/* Channels are assigned in the order requested */
+			for (i = 8; i + 2 <= len; i += 2)
+				result = connect_chan(conn, in, ident, 0,
+							get_le16(data + i));
+			break;
+		}
+
+		if (result >= 0 && pdu->psm < 0)
+			pdu->psm = result;
+
+		data += len;
+		size -= len;
+	}
+}
+
+static void parse_acl(uint16_t index, bool in, struct filter_pkt *pkt,
+					const uint8_t *data, uint16_t size)
+{
+	struct filter_conn *conn;
+	struct filter_chan *chan;
+	struct filter_pdu *pdu;
+	uint16_t handle;
+
+	if (size < 4)
+		return;
+
+	handle = get_le16(data);
+
+	pkt->handles = data;
+	pkt->num_handles = 1;
+
+	conn = get_conn(index, handle & 0x0fff);
+	pdu = &conn->pdu[in];
+
+	/* Continuation fragments belong to the PDU started before */
+	if ((acl_flags(handle) & 0x03) == 0x01)
+		goto done;
+
+	pdu->cid = -1;
+	pdu->psm = -1;
+	pdu->att = -1;
+
+	if (size < 8)
+		goto done;
+
+	pdu->cid = get_le16(data + 6);
+
+	data += 8;
+	size -= 8;
+
+	switch (pdu->cid) {
+	case 0x0001:
+	case 0x0005:
+		parse_sig(conn, in, pdu, data, size);
+		break;
+	case 0x0004:
+		if (size)
+			pdu->att = data[0];
+		break;
+	default:
+		chan = find_chan(conn, in, pdu->cid);
+		if (!chan)
+			break;
+
+		pdu->psm = chan->psm;
+
+		/* Credit based frames start with the SDU length */
+		if (chan->credits && size >= 2) {
+			data += 2;
+			size -= 2;
+		}
+
+		if ((chan->psm == PSM_ATT || chan->psm == PSM_EATT) && size)
+			pdu->att = data[0];
+		break;
+	}
+
+done:
+	pkt->cid = pdu->cid;
+	pkt->psm = pdu->psm;
+	pkt->att = pdu->att;
+}
+
+static void set_addr(struct filter_pkt *pkt, const uint8_t *bdaddr)
+{
+	memcpy(pkt->bdaddr, bdaddr, 6);
+	pkt->has_addr = true;
+}
+
+static void parse_cmd(struct filter_pkt *pkt, const uint8_t *data,
+								uint16_t size)
+{
+	const uint8_t *params = data + 3;
+	uint16_t len;
+
+	if (size < 3)
+		return;
+
+	pkt->opcode = get_le16(data);
+	len = size - 3;
+
+	switch (pkt->opcode) {
+	case BT_HCI_CMD_DISCONNECT:
+	case BT_HCI_CMD_AUTH_REQUESTED:
+	case BT_HCI_CMD_SET_CONN_ENCRYPT:
+	case BT_HCI_CMD_READ_REMOTE_FEATURES:
+	case BT_HCI_CMD_READ_REMOTE_VERSION:
+	case BT_HCI_CMD_LE_CONN_UPDATE:
+	case BT_HCI_CMD_LE_READ_REMOTE_FEATURES:
+	case BT_HCI_CMD_LE_START_ENCRYPT:
+	case BT_HCI_CMD_LE_LTK_REQ_REPLY:
+	case BT_HCI_CMD_LE_LTK_REQ_NEG_REPLY:
+	case BT_HCI_CMD_LE_SET_DATA_LENGTH:
+	case BT_HCI_CMD_LE_READ_PHY:
+	case BT_HCI_CMD_LE_SET_PHY:
+		if (len < 2)
+			break;
+
+		pkt->handles = params;
+		pkt->num_handles = 1;
+		break;
+	case BT_HCI_CMD_CREATE_CONN:
+	case BT_HCI_CMD_ACCEPT_CONN_REQUEST:
+	case BT_HCI_CMD_REJECT_CONN_REQUEST:
+	case BT_HCI_CMD_REMOTE_NAME_REQUEST:
+		if (len >= 6)
+			set_addr(pkt, params);
+		break;
+	case BT_HCI_CMD_LE_CREATE_CONN:
+		if (len >= 12)
+			set_addr(pkt, params + 6);
+		break;
+	case BT_HCI_CMD_LE_EXT_CREATE_CONN:
+		if (len >= 9)
+			set_addr(pkt, params + 3);
+		break;
+	}
+}
+
+static void parse_conn_complete(uint16_t index, struct filter_pkt *pkt,
+				const uint8_t *status, const uint8_t *handle,
+				const uint8_t *bdaddr)
+{
+	struct filter_conn *conn;
+
+	pkt->handles = handle;
+	pkt->num_handles = 1;
+	set_addr(pkt, bdaddr);
+
+	if (*status)
+		return;
+
+	conn = get_conn(index, get_le16(handle) & 0x0fff);
+	memcpy(conn->bdaddr, bdaddr, 6);
+	conn->has_addr = true;
+}
+
+static void parse_le_meta(uint16_t index, struct filter_pkt *pkt,
+					const uint8_t *params, uint16_t len)
+{
+	if (len < 1)
+		return;
+
+	switch (params[0]) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		if (len >= 12)
+			parse_conn_complete(index, pkt, params + 1, params + 2,
+								params + 6);
+		return;
+	case BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE:
+	case BT_HCI_EVT_LE_REMOTE_FEATURES_COMPLETE:
+	case BT_HCI_EVT_LE_PHY_UPDATE_COMPLETE:
+		if (len < 4)
+			return;
+
+		pkt->handles = params + 2;
+		break;
+	case BT_HCI_EVT_LE_LONG_TERM_KEY_REQUEST:
+	case BT_HCI_EVT_LE_DATA_LENGTH_CHANGE:
+		if (len < 3)
+			return;
+
+		pkt->handles = params + 1;
+		break;
+	default:
+		return;
+	}
+
+	pkt->num_handles = 1;
+}
+
+static void parse_evt(uint16_t index, struct filter_pkt *pkt,
+					const uint8_t *data, uint16_t size)
+{
+	const uint8_t *params = data + 2;
+	uint16_t len;
+
+	if (size < 2)
+		return;
+
+	pkt->event = data[0];
+	len = size - 2;
+
+	switch (pkt->event) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		if (len >= 9)
+			parse_conn_complete(index, pkt, params, params + 1,
+								params + 3);
+		break;
+	case BT_HCI_EVT_CONN_REQUEST:
+		if (len >= 6)
+			set_addr(pkt, params);
+		break;
+	case BT_HCI_EVT_REMOTE_NAME_REQUEST_COMPLETE:
+		if (len >= 7)
+			set_addr(pkt, params + 1);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		if (len < 3)
+			break;
+
+		pkt->handles = params + 1;
+		pkt->num_handles = 1;
+		pkt->disconnect = !params[0];
+		break;
+	case BT_HCI_EVT_AUTH_COMPLETE:
+	case BT_HCI_EVT_ENCRYPT_CHANGE:
+	case BT_HCI_EVT_REMOTE_FEATURES_COMPLETE:
+	case BT_HCI_EVT_REMOTE_VERSION_COMPLETE:
+	case BT_HCI_EVT_ENCRYPT_KEY_REFRESH_COMPLETE:
+		if (len < 3)
+			break;
+
+		pkt->handles = params + 1;
+		pkt->num_handles = 1;
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		if (len < 1 || len < 1 + params[0] * 4)
+			break;
+
+		pkt->handles = params + 1;
+		pkt->num_handles = params[0];
+		pkt->stride = 4;
+		break;
+	case BT_HCI_EVT_CMD_COMPLETE:
+		if (len >= 3)
+			pkt->opcode = get_le16(params + 1);
+		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		if (len >= 4)
+			pkt->opcode = get_le16(params + 2);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		parse_le_meta(index, pkt, params, len);
+		break;
+	}
+}
+
+static uint16_t pkt_handle(const struct filter_pkt *pkt, unsigned int i)
+{
+	return get_le16(pkt->handles + i * pkt->stride) & 0x0fff;
+}
+
+static bool match_value(const struct filter_term *term, int value)
+{
+	unsigned int i;
+
+	if (value < 0)
+		return false;
+
+	for (i = 0; i < term->count; i++) {
+		if (term->values[i] == value)
+			return true;
+	}
+
+	return false;
+}
+
+static bool match_addr(const struct filter_term *term, const uint8_t *bdaddr)
+{
+	unsigned int i;
+
+	for (i = 0; i < term->count; i++) {
+		if (!memcmp(term->addrs[i].b, bdaddr, 6))
+			return true;
+	}
+
+	return false;
+}
+
+static bool match_term(uint16_t index, const struct filter_term *term,
+						const struct filter_pkt *pkt)
+{
+	struct filter_conn *conn;
+	unsigned int i;
+
+	switch (term->key) {
+	case KEY_HANDLE:
+		for (i = 0; i < pkt->num_handles; i++) {
+			if (match_value(term, pkt_handle(pkt, i)))
+				return true;
+		}
+
+		return false;
+	case KEY_ADDR:
+		if (pkt->has_addr && match_addr(term, pkt->bdaddr))
+			return true;
+
+		for (i = 0; i < pkt->num_handles; i++) {
+			conn = find_conn(index, pkt_handle(pkt, i));
+			if (conn && conn->has_addr &&
+					match_addr(term, conn->bdaddr))
+				return true;
+		}
+
+		return false;
+	case KEY_OPCODE:
+		return match_value(term, pkt->opcode);
+	case KEY_EVENT:
+		return match_value(term, pkt->event);
+	case KEY_PSM:
+		return match_value(term, pkt->psm);
+	case KEY_CID:
+		return match_value(term, pkt->cid);
+	case KEY_ATT:
+		return match_value(term, pkt->att);
+	}
+
+	return false;
+}
+
+/*
+ * Has to see every packet in order to keep track of connections and
+ * channels. Controller records always match, terms that do not apply to
+ * a packet never do.
+ */
+bool filter_match(uint16_t index, uint16_t opcode, const void *data,
+								uint16_t size)
+{
+	struct filter_pkt pkt = {
+		.stride = 2,
+		.opcode = -1,
+		.event = -1,
+		.psm = -1,
+		.cid = -1,
+		.att = -1,
+	};
+	bool result = true;
+	unsigned int i;
+
+	if (!num_terms)
+		return true;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		return true;
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		parse_cmd(&pkt, data, size);
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		parse_evt(index, &pkt, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		parse_acl(index, opcode == BTSNOOP_OPCODE_ACL_RX_PKT, &pkt,
+								data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		if (size < 2)
+			break;
+
+		pkt.handles = data;
+		pkt.num_handles = 1;
+		break;
+	}
+
+	for (i = 0; i < num_terms; i++) {
+		if (match_term(index, &terms[i], &pkt) == terms[i].negate) {
+			result = false;
+			break;
+		}
+	}
+
+	/* Matched against the address before it is forgotten */
+	if (pkt.disconnect)
+		remove_conn(index, pkt_handle(&pkt, 0));
+
+	return result;
+}
+
+void filter_cleanup(void)
+{
+	queue_destroy(chan_list, free);
+	chan_list = NULL;
+
+	queue_destroy(conn_list, free);
+	conn_list = NULL;
+}
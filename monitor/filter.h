@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool filter_parse(const char *expr);
+bool filter_enabled(void);
+bool filter_match(uint16_t index, uint16_t opcode, const void *data,
+								uint16_t size);
+void filter_cleanup(void);
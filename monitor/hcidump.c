@@ -28,6 +28,7 @@
 
 #include "src/shared/mainloop.h"
 
+#include "display.h"
 #include "packet.h"
 #include "hcidump.h"
 
@@ -164,6 +165,8 @@ static void device_callback(int fd, uint32_t events, void *user_data)
 							buf + 1, len - 1);
 			break;
 		}
+
+		json_end();
 	}
 }
 
@@ -247,6 +250,7 @@ static void device_list(int fd, int max_dev)
 		device_info(fd, dr->dev_id, &type, &bus, &bdaddr, name);
 		ba2str(&bdaddr, str);
 		packet_new_index(tv, dr->dev_id, str, type, bus, name);
+		json_end();
 		open_device(dr->dev_id);
 	}
 
@@ -378,6 +382,8 @@ static void stack_internal_callback(int fd, uint32_t events, void *user_data)
 		packet_del_index(tv, sd->dev_id, str);
 		break;
 	}
+
+	json_end();
 }
 
 int hcidump_tracing(void)
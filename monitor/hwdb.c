@@ -15,6 +15,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "hwdb.h"
@@ -22,23 +23,45 @@
 #ifdef HAVE_UDEV_HWDB_NEW
 #include <libudev.h>
 
+/* Cache of recent OUI lookups, indexed by the low bits of the OUI */
+#define OUI_CACHE_SIZE	256
+
+static struct {
+	uint32_t oui;
+	bool valid;
+	char *company;
+} oui_cache[OUI_CACHE_SIZE];
+
+static struct udev *udev;
+static struct udev_hwdb *hwdb;
+
+/*
+ * Opening the hardware database maps the whole file, so keep it open for
+ * the lifetime of the process instead of doing it for every lookup.
+ */
+static struct udev_hwdb *hwdb_open(void)
+{
+	if (hwdb)
+		return hwdb;
+
+	if (!udev) {
+		udev = udev_new();
+		if (!udev)
+			return NULL;
+	}
+
+	hwdb = udev_hwdb_new(udev);
+
+	return hwdb;
+}
+
 bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
 	struct udev_list_entry *head, *entry;
-	bool result;
 
-	udev = udev_new();
-	if (!udev)
+	if (!hwdb_open())
 		return false;
 
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb) {
-		result = false;
-		goto done;
-	}
-
 	*vendor = NULL;
 	*model = NULL;
 
@@ -56,61 +79,53 @@ bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
 			*model = strdup(udev_list_entry_get_value(entry));
 	}
 
-	hwdb = udev_hwdb_unref(hwdb);
-
-	result = true;
-
-done:
-	udev = udev_unref(udev);
-
-	return result;
+	return true;
 }
 
-bool hwdb_get_company(const uint8_t *bdaddr, char **company)
+static char *lookup_company(uint32_t oui)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
 	struct udev_list_entry *head, *entry;
 	char modalias[11];
-	bool result;
 
-	if (!bdaddr[2] && !bdaddr[1] && !bdaddr[0])
-		return false;
+	sprintf(modalias, "OUI:%6.6X", oui);
 
-	sprintf(modalias, "OUI:%2.2X%2.2X%2.2X",
-				bdaddr[5], bdaddr[4], bdaddr[3]);
+	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
 
-	udev = udev_new();
-	if (!udev)
-		return false;
+	udev_list_entry_foreach(entry, head) {
+		const char *name = udev_list_entry_get_name(entry);
 
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb) {
-		result = false;
-		goto done;
+		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE"))
+			return strdup(udev_list_entry_get_value(entry));
 	}
 
-	*company = NULL;
+	return NULL;
+}
 
-	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
+bool hwdb_get_company(const uint8_t *bdaddr, char **company)
+{
+	uint32_t oui;
+	int idx;
 
-	udev_list_entry_foreach(entry, head) {
-		const char *name = udev_list_entry_get_name(entry);
+	if (!bdaddr[2] && !bdaddr[1] && !bdaddr[0])
+		return false;
 
-		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE")) {
-			*company = strdup(udev_list_entry_get_value(entry));
-			break;
-		}
-	}
+	if (!hwdb_open())
+		return false;
 
-	hwdb = udev_hwdb_unref(hwdb);
+	oui = bdaddr[5] << 16 | bdaddr[4] << 8 | bdaddr[3];
+	idx = oui % OUI_CACHE_SIZE;
 
-	result = true;
+	if (!oui_cache[idx].valid || oui_cache[idx].oui != oui) {
+		free(oui_cache[idx].company);
+		oui_cache[idx].company = lookup_company(oui);
+		oui_cache[idx].oui = oui;
+		oui_cache[idx].valid = true;
+	}
 
-done:
-	udev = udev_unref(udev);
+	*company = oui_cache[idx].company ? strdup(oui_cache[idx].company) :
+									NULL;
 
-	return result;
+	return true;
 }
 #else
 bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
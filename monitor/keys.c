@@ -34,6 +34,23 @@ struct irk_data {
 
 static struct queue *irk_list;
 
+/* Flat copy of the IRKs in irk_list for batched resolution */
+static uint8_t (*irk_keys)[16];
+static struct irk_data **irk_index;
+static size_t irk_count;
+static bool irk_dirty;
+
+#define RPA_CACHE_SIZE 32
+
+/* Recently resolved addresses, most recently used first */
+struct rpa_cache {
+	uint8_t addr[6];
+	struct irk_data *irk;
+};
+
+static struct rpa_cache rpa_cache[RPA_CACHE_SIZE];
+static unsigned int rpa_cache_len;
+
 void keys_setup(void)
 {
 	crypto = bt_crypto_new();
@@ -46,12 +63,21 @@ void keys_cleanup(void)
 	bt_crypto_unref(crypto);
 
 	queue_destroy(irk_list, free);
+
+	free(irk_keys);
+	irk_keys = NULL;
+	free(irk_index);
+	irk_index = NULL;
+	irk_count = 0;
+	rpa_cache_len = 0;
 }
 
 void keys_update_identity_key(const uint8_t key[16])
 {
 	struct irk_data *irk;
 
+	irk_dirty = true;
+
 	irk = queue_peek_tail(irk_list);
 	if (irk && !memcmp(irk->key, empty_key, 16)) {
 		memcpy(irk->key, key, 16);
@@ -86,29 +112,90 @@ void keys_update_identity_addr(const uint8_t addr[6], uint8_t addr_type)
 	}
 }
 
-static bool match_resolve_irk(const void *data, const void *match_data)
+static void append_irk(void *data, void *user_data)
 {
-	const struct irk_data *irk = data;
-	const uint8_t *addr = match_data;
-	uint8_t local_hash[3];
+	struct irk_data *irk = data;
 
-	bt_crypto_ah(crypto, irk->key, addr + 3, local_hash);
+	if (!memcmp(irk->key, empty_key, 16))
+		return;
 
-	return !memcmp(addr, local_hash, 3);
+	memcpy(irk_keys[irk_count], irk->key, 16);
+	irk_index[irk_count] = irk;
+	irk_count++;
+}
+
+static void update_irk_keys(void)
+{
+	unsigned int len = queue_length(irk_list);
+
+	irk_dirty = false;
+	irk_count = 0;
+
+	free(irk_keys);
+	free(irk_index);
+
+	irk_keys = calloc(len, sizeof(*irk_keys));
+	irk_index = new0(struct irk_data *, len);
+
+	queue_foreach(irk_list, append_irk, NULL);
+}
+
+static void rpa_cache_add(const uint8_t addr[6], struct irk_data *irk)
+{
+	if (rpa_cache_len < RPA_CACHE_SIZE)
+		rpa_cache_len++;
+
+	memmove(&rpa_cache[1], &rpa_cache[0],
+				(rpa_cache_len - 1) * sizeof(rpa_cache[0]));
+
+	memcpy(rpa_cache[0].addr, addr, 6);
+	rpa_cache[0].irk = irk;
+}
+
+static struct irk_data *rpa_cache_lookup(const uint8_t addr[6])
+{
+	struct rpa_cache entry;
+	unsigned int i;
+
+	for (i = 0; i < rpa_cache_len; i++) {
+		if (memcmp(rpa_cache[i].addr, addr, 6))
+			continue;
+
+		/* Move entry to the front */
+		entry = rpa_cache[i];
+		memmove(&rpa_cache[1], &rpa_cache[0],
+					i * sizeof(rpa_cache[0]));
+		rpa_cache[0] = entry;
+
+		return entry.irk;
+	}
+
+	return NULL;
 }
 
 bool keys_resolve_identity(const uint8_t addr[6], uint8_t ident[6],
 							uint8_t *ident_type)
 {
 	struct irk_data *irk;
+	size_t index;
 
-	irk = queue_find(irk_list, match_resolve_irk, addr);
+	irk = rpa_cache_lookup(addr);
+	if (irk)
+		goto done;
 
-	if (irk) {
-		memcpy(ident, irk->addr, 6);
-		*ident_type = irk->addr_type;
-		return true;
-	}
+	if (irk_dirty)
+		update_irk_keys();
+
+	if (!bt_crypto_resolve_rpa(crypto, (const uint8_t (*)[16]) irk_keys,
+						irk_count, addr, &index))
+		return false;
+
+	irk = irk_index[index];
+	rpa_cache_add(addr, irk);
+
+done:
+	memcpy(ident, irk->addr, 6);
+	*ident_type = irk->addr_type;
 
-	return false;
+	return true;
 }
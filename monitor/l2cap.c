@@ -23,6 +23,8 @@
 #include "lib/uuid.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "bt.h"
 #include "packet.h"
 #include "display.h"
@@ -85,9 +87,8 @@
 #define L2CAP_SAR_END		0x02
 #define L2CAP_SAR_CONTINUE	0x03
 
-#define MAX_CHAN 64
-
 struct chan_data {
+	uint16_t id;
 	uint16_t index;
 	uint16_t handle;
 	uint8_t ident;
@@ -101,182 +102,277 @@ struct chan_data {
 	uint16_t sdu;
 };
 
-static struct chan_data chan_list[MAX_CHAN];
+/* Channels by id, which is what the frames refer to */
+static struct chan_data **chan_list;
+static unsigned int chan_size;
+static unsigned int chan_free;
 
-static void assign_scid(const struct l2cap_frame *frame, uint16_t scid,
-			uint16_t psm, uint8_t mode, uint8_t ctrlid)
+/* Channels by index, handle and their source or destination CID */
+static struct hashmap *scid_map;
+static struct hashmap *dcid_map;
+
+/* Channels of each connection by index and handle */
+static struct hashmap *conn_map;
+
+/* Channels created on an AMP controller */
+static struct queue *amp_list;
+
+/* Indexes past MAX_INDEX are rejected before getting here */
+static unsigned int chan_key(uint16_t index, uint16_t handle, uint16_t cid)
 {
-	int i, n = -1;
-	uint8_t seq_num = 1;
+	return (index & 0x000f) << 28 | (handle & 0x0fff) << 16 | cid;
+}
 
-	if (!scid)
+static unsigned int conn_key(uint16_t index, uint16_t handle)
+{
+	return index << 16 | handle;
+}
+
+static struct chan_data *find_chan(uint16_t index, uint16_t handle,
+						uint16_t cid, bool local)
+{
+	return hashmap_lookup(local ? scid_map : dcid_map,
+					chan_key(index, handle, cid));
+}
+
+static void set_cid(struct chan_data *chan, bool local, uint16_t cid)
+{
+	struct hashmap *map = local ? scid_map : dcid_map;
+	uint16_t *ptr = local ? &chan->scid : &chan->dcid;
+	unsigned int key;
+
+	if (*ptr) {
+		key = chan_key(chan->index, chan->handle, *ptr);
+		if (hashmap_lookup(map, key) == chan)
+			hashmap_remove(map, key);
+	}
+
+	*ptr = cid;
+
+	if (!cid)
 		return;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000) {
-			n = i;
-			continue;
-		}
+	/* The newest channel takes over a reused CID */
+	key = chan_key(chan->index, chan->handle, cid);
+	hashmap_remove(map, key);
+	hashmap_insert(map, key, chan);
+}
 
-		if (chan_list[i].index != frame->index)
-			continue;
+static struct chan_data *chan_new(const struct l2cap_frame *frame)
+{
+	struct chan_data *chan;
+	struct queue *conn;
+	unsigned int key;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	/* Ids are reused lowest first as they show up in the output */
+	while (chan_free < chan_size && chan_list[chan_free])
+		chan_free++;
 
-		if (chan_list[i].psm == psm)
-			seq_num++;
+	if (chan_free == UINT16_MAX)
+		return NULL;
 
-		/* Don't break on match - we still need to go through all
-		 * channels to find proper seq_num.
-		 */
-		if (frame->in) {
-			if (chan_list[i].dcid == scid)
-				n = i;
-		} else {
-			if (chan_list[i].scid == scid)
-				n = i;
-		}
+	if (chan_free == chan_size) {
+		unsigned int size = chan_size ? chan_size * 2 : 64;
+		struct chan_data **list;
+
+		if (size > UINT16_MAX)
+			size = UINT16_MAX;
+
+		list = realloc(chan_list, size * sizeof(*list));
+		if (!list)
+			return NULL;
+
+		memset(list + chan_size, 0,
+				(size - chan_size) * sizeof(*list));
+		chan_list = list;
+		chan_size = size;
 	}
 
-	if (n < 0)
-		return;
+	if (!scid_map) {
+		scid_map = hashmap_new();
+		dcid_map = hashmap_new();
+		conn_map = hashmap_new();
+		amp_list = queue_new();
+	}
 
-	memset(&chan_list[n], 0, sizeof(chan_list[n]));
-	chan_list[n].index = frame->index;
-	chan_list[n].handle = frame->handle;
-	chan_list[n].ident = frame->ident;
+	key = conn_key(frame->index, frame->handle);
 
-	if (frame->in)
-		chan_list[n].dcid = scid;
-	else
-		chan_list[n].scid = scid;
+	conn = hashmap_lookup(conn_map, key);
+	if (!conn) {
+		conn = queue_new();
+		hashmap_insert(conn_map, key, conn);
+	}
+
+	chan = new0(struct chan_data, 1);
+	chan->id = chan_free;
+	chan->index = frame->index;
+	chan->handle = frame->handle;
 
-	chan_list[n].psm = psm;
-	chan_list[n].ctrlid = ctrlid;
-	chan_list[n].mode = mode;
+	chan_list[chan_free++] = chan;
+	queue_push_tail(conn, chan);
 
-	chan_list[n].seq_num = seq_num;
+	return chan;
 }
 
-static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
+static void chan_release(struct chan_data *chan)
 {
-	int i;
+	struct queue *conn;
+	unsigned int key;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	set_cid(chan, true, 0);
+	set_cid(chan, false, 0);
+	queue_remove(amp_list, chan);
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	key = conn_key(chan->index, chan->handle);
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		}
+	conn = hashmap_lookup(conn_map, key);
+	queue_remove(conn, chan);
+
+	if (queue_isempty(conn)) {
+		hashmap_remove(conn_map, key);
+		queue_destroy(conn, NULL);
 	}
+
+	chan_list[chan->id] = NULL;
+
+	if (chan->id < chan_free)
+		chan_free = chan->id;
+
+	free(chan);
 }
 
-static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
-								uint16_t scid)
+struct psm_count {
+	uint16_t psm;
+	uint8_t count;
+};
+
+static void count_psm(void *data, void *user_data)
 {
-	int i;
+	struct chan_data *chan = data;
+	struct psm_count *count = user_data;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	if (chan->psm == count->psm)
+		count->count++;
+}
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+static void assign_scid(const struct l2cap_frame *frame, uint16_t scid,
+			uint16_t psm, uint8_t mode, uint8_t ctrlid)
+{
+	struct psm_count count = { .psm = psm, .count = 1 };
+	struct chan_data *chan;
+	struct queue *conn;
 
-		if (frame->ident != 0 && chan_list[i].ident != frame->ident)
-			continue;
+	if (!scid)
+		return;
 
-		if (frame->in) {
-			if (scid) {
-				if (chan_list[i].scid == scid) {
-					chan_list[i].dcid = dcid;
-					break;
-				}
-			} else {
-				if (chan_list[i].scid && !chan_list[i].dcid) {
-					chan_list[i].dcid = dcid;
-					break;
-				}
-			}
-		} else {
-			if (scid) {
-				if (chan_list[i].dcid == scid) {
-					chan_list[i].scid = dcid;
-					break;
-				}
-			} else {
-				if (chan_list[i].dcid && !chan_list[i].scid) {
-					chan_list[i].scid = dcid;
-					break;
-				}
-			}
-		}
+	conn = hashmap_lookup(conn_map, conn_key(frame->index, frame->handle));
+	queue_foreach(conn, count_psm, &count);
+
+	chan = find_chan(frame->index, frame->handle, scid, !frame->in);
+	if (chan) {
+		set_cid(chan, true, 0);
+		set_cid(chan, false, 0);
+		queue_remove(amp_list, chan);
+	} else {
+		chan = chan_new(frame);
+		if (!chan)
+			return;
 	}
+
+	chan->ident = frame->ident;
+	chan->psm = psm;
+	chan->ctrlid = ctrlid;
+	chan->mode = mode;
+	chan->ext_ctrl = 0;
+	chan->sdu = 0;
+
+	set_cid(chan, !frame->in, scid);
+
+	if (ctrlid)
+		queue_push_tail(amp_list, chan);
+
+	chan->seq_num = count.count;
 }
 
-static void assign_mode(const struct l2cap_frame *frame,
-					uint8_t mode, uint16_t dcid)
+static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	chan = find_chan(frame->index, frame->handle, scid, frame->in);
+	if (chan)
+		chan_release(chan);
+}
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+static bool match_pending(const void *data, const void *user_data)
+{
+	const struct chan_data *chan = data;
+	const struct l2cap_frame *frame = user_data;
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		}
+	if (frame->ident != 0 && chan->ident != frame->ident)
+		return false;
+
+	if (frame->in)
+		return chan->scid && !chan->dcid;
+
+	return chan->dcid && !chan->scid;
+}
+
+static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
+								uint16_t scid)
+{
+	struct chan_data *chan;
+	struct queue *conn;
+
+	if (scid) {
+		chan = find_chan(frame->index, frame->handle, scid, frame->in);
+		if (chan && frame->ident != 0 && chan->ident != frame->ident)
+			return;
+	} else {
+		conn = hashmap_lookup(conn_map,
+				conn_key(frame->index, frame->handle));
+		chan = queue_find(conn, match_pending, frame);
 	}
+
+	if (chan)
+		set_cid(chan, !frame->in, dcid);
 }
 
-static int get_chan_data_index(const struct l2cap_frame *frame)
+static void assign_mode(const struct l2cap_frame *frame,
+					uint8_t mode, uint16_t dcid)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	chan = find_chan(frame->index, frame->handle, dcid, frame->in);
+	if (chan)
+		chan->mode = mode;
+}
 
-		if (chan_list[i].ctrlid != 0 &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+static bool match_amp(const void *data, const void *user_data)
+{
+	const struct chan_data *chan = data;
+	const struct l2cap_frame *frame = user_data;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	if (chan->ctrlid != frame->index || chan->handle != frame->handle)
+		return false;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return i;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return i;
-		}
-	}
+	if (frame->in)
+		return chan->scid == frame->cid;
+
+	return chan->dcid == frame->cid;
+}
+
+static int get_chan_data_index(const struct l2cap_frame *frame)
+{
+	struct chan_data *chan;
+
+	chan = find_chan(frame->index, frame->handle, frame->cid, frame->in);
+	if (chan && (!chan->ctrlid || chan->ctrlid == frame->index))
+		return chan->id;
+
+	/* AMP channels are known by the index they were created on */
+	chan = queue_find(amp_list, match_amp, frame);
+	if (chan)
+		return chan->id;
 
 	return -1;
 }
@@ -285,14 +381,18 @@ static struct chan_data *get_chan(const struct l2cap_frame *frame)
 {
 	int i;
 
-	if (frame->chan != UINT16_MAX)
-		return &chan_list[frame->chan];
+	if (frame->chan != UINT16_MAX) {
+		if (frame->chan >= chan_size)
+			return NULL;
+
+		return chan_list[frame->chan];
+	}
 
 	i = get_chan_data_index(frame);
 	if (i < 0)
 		return NULL;
 
-	return &chan_list[i];
+	return chan_list[i];
 }
 
 static uint16_t get_psm(const struct l2cap_frame *frame)
@@ -328,27 +428,11 @@ static uint8_t get_seq_num(const struct l2cap_frame *frame)
 static void assign_ext_ctrl(const struct l2cap_frame *frame,
 					uint8_t ext_ctrl, uint16_t dcid)
 {
-	int i;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
-
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	struct chan_data *chan;
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		}
-	}
+	chan = find_chan(frame->index, frame->handle, dcid, frame->in);
+	if (chan)
+		chan->ext_ctrl = ext_ctrl;
 }
 
 static uint8_t get_ext_ctrl(const struct l2cap_frame *frame)
@@ -417,73 +501,89 @@ static char *mode2str(uint8_t mode)
 
 static void l2cap_ctrl_ext_parse(struct l2cap_frame *frame, uint32_t ctrl)
 {
-	printf("      %s:",
+	char str[96];
+	int n;
+
+	n = sprintf(str, "%s:",
 		ctrl & L2CAP_EXT_CTRL_FRAME_TYPE ? "S-frame" : "I-frame");
 
 	if (ctrl & L2CAP_EXT_CTRL_FRAME_TYPE) {
-		printf(" %s",
+		n += sprintf(str + n, " %s",
 		supervisory2str((ctrl & L2CAP_EXT_CTRL_SUPERVISE_MASK) >>
 						L2CAP_EXT_CTRL_SUPER_SHIFT));
 
 		if (ctrl & L2CAP_EXT_CTRL_POLL)
-			printf(" P-bit");
+			n += sprintf(str + n, " P-bit");
 	} else {
 		uint8_t sar = (ctrl & L2CAP_EXT_CTRL_SAR_MASK) >>
 						L2CAP_EXT_CTRL_SAR_SHIFT;
-		printf(" %s", sar2str(sar));
+		n += sprintf(str + n, " %s", sar2str(sar));
 		if (sar == L2CAP_SAR_START) {
 			uint16_t len;
 
 			if (!l2cap_frame_get_le16(frame, &len))
-				return;
+				goto done;
 
-			printf(" (len %d)", len);
+			n += sprintf(str + n, " (len %d)", len);
 		}
-		printf(" TxSeq %d", (ctrl & L2CAP_EXT_CTRL_TXSEQ_MASK) >>
+		n += sprintf(str + n, " TxSeq %d",
+				(ctrl & L2CAP_EXT_CTRL_TXSEQ_MASK) >>
 						L2CAP_EXT_CTRL_TXSEQ_SHIFT);
 	}
 
-	printf(" ReqSeq %d", (ctrl & L2CAP_EXT_CTRL_REQSEQ_MASK) >>
+	n += sprintf(str + n, " ReqSeq %d",
+				(ctrl & L2CAP_EXT_CTRL_REQSEQ_MASK) >>
 						L2CAP_EXT_CTRL_REQSEQ_SHIFT);
 
 	if (ctrl & L2CAP_EXT_CTRL_FINAL)
-		printf(" F-bit");
+		sprintf(str + n, " F-bit");
+
+done:
+	print_indent(6, COLOR_OFF, "", "", COLOR_OFF, "%s", str);
 }
 
 static void l2cap_ctrl_parse(struct l2cap_frame *frame, uint32_t ctrl)
 {
-	printf("      %s:",
+	char str[96];
+	int n;
+
+	n = sprintf(str, "%s:",
 			ctrl & L2CAP_CTRL_FRAME_TYPE ? "S-frame" : "I-frame");
 
 	if (ctrl & 0x01) {
-		printf(" %s",
+		n += sprintf(str + n, " %s",
 			supervisory2str((ctrl & L2CAP_CTRL_SUPERVISE_MASK) >>
 						L2CAP_CTRL_SUPER_SHIFT));
 
 		if (ctrl & L2CAP_CTRL_POLL)
-			printf(" P-bit");
+			n += sprintf(str + n, " P-bit");
 	} else {
 		uint8_t sar;
 
 		sar = (ctrl & L2CAP_CTRL_SAR_MASK) >> L2CAP_CTRL_SAR_SHIFT;
-		printf(" %s", sar2str(sar));
+		n += sprintf(str + n, " %s", sar2str(sar));
 		if (sar == L2CAP_SAR_START) {
 			uint16_t len;
 
 			if (!l2cap_frame_get_le16(frame, &len))
-				return;
+				goto done;
 
-			printf(" (len %d)", len);
+			n += sprintf(str + n, " (len %d)", len);
 		}
-		printf(" TxSeq %d", (ctrl & L2CAP_CTRL_TXSEQ_MASK) >>
+		n += sprintf(str + n, " TxSeq %d",
+					(ctrl & L2CAP_CTRL_TXSEQ_MASK) >>
 						L2CAP_CTRL_TXSEQ_SHIFT);
 	}
 
-	printf(" ReqSeq %d", (ctrl & L2CAP_CTRL_REQSEQ_MASK) >>
+	n += sprintf(str + n, " ReqSeq %d",
+					(ctrl & L2CAP_CTRL_REQSEQ_MASK) >>
 						L2CAP_CTRL_REQSEQ_SHIFT);
 
 	if (ctrl & L2CAP_CTRL_FINAL)
-		printf(" F-bit");
+		sprintf(str + n, " F-bit");
+
+done:
+	print_indent(6, COLOR_OFF, "", "", COLOR_OFF, "%s", str);
 }
 
 #define MAX_INDEX 16
@@ -3238,7 +3338,6 @@ void l2cap_frame(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 				l2cap_ctrl_parse(&frame, ctrl16);
 			}
 
-			printf("\n");
 			break;
 		}
 
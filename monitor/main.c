@@ -18,6 +18,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <getopt.h>
 #include <sys/un.h>
 
@@ -28,6 +29,7 @@
 #include "lmp.h"
 #include "keys.h"
 #include "analyze.h"
+#include "filter.h"
 #include "ellisys.h"
 #include "control.h"
 #include "display.h"
@@ -49,7 +51,15 @@ static void usage(void)
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t    --since <sec>      Skip traces before time offset\n"
+		"\t    --until <sec>      Stop reading after time offset\n"
+		"\t    --handle <handle>  Show only data of connection handle\n"
+		"\t    --filter <expr>    Decode only matching packets\n"
+		"\t    --jobs <count>     Decode with parallel processes\n"
+		"\t    --stats-interval <sec>\n"
+		"\t                       Show statistics instead of packets\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t    --compress         Save traces compressed\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-p, --priority <level> Show only priority or lower\n"
@@ -70,9 +80,35 @@ static void usage(void)
 		"\t                       RTT control block parameters\n"
 		"\t-C, --columns [width]  Output width if not a terminal\n"
 		"\t-c, --color [mode]     Output color: auto/always/never\n"
+		"\t    --json             Output one JSON record per packet\n"
 		"\t-h, --help             Show help options\n");
 }
 
+enum {
+	OPT_SINCE = 0x100,
+	OPT_UNTIL,
+	OPT_HANDLE,
+	OPT_JOBS,
+	OPT_STATS_INTERVAL,
+	OPT_COMPRESS,
+	OPT_FILTER,
+	OPT_JSON,
+};
+
+static bool parse_offset(const char *str, uint64_t *usec)
+{
+	char *end;
+	double val;
+
+	val = strtod(str, &end);
+	if (end == str || *end != '\0' || val < 0)
+		return false;
+
+	*usec = val * 1000000;
+
+	return true;
+}
+
 static const struct option main_options[] = {
 	{ "read",      required_argument, NULL, 'r' },
 	{ "write",     required_argument, NULL, 'w' },
@@ -95,6 +131,14 @@ static const struct option main_options[] = {
 	{ "rtt",       required_argument, NULL, 'R' },
 	{ "columns",   required_argument, NULL, 'C' },
 	{ "color",     required_argument, NULL, 'c' },
+	{ "since",     required_argument, NULL, OPT_SINCE },
+	{ "until",     required_argument, NULL, OPT_UNTIL },
+	{ "handle",    required_argument, NULL, OPT_HANDLE },
+	{ "jobs",      required_argument, NULL, OPT_JOBS },
+	{ "stats-interval", required_argument, NULL, OPT_STATS_INTERVAL },
+	{ "compress",  no_argument,       NULL, OPT_COMPRESS },
+	{ "filter",    required_argument, NULL, OPT_FILTER },
+	{ "json",      no_argument,       NULL, OPT_JSON },
 	{ "todo",      no_argument,       NULL, '#' },
 	{ "version",   no_argument,       NULL, 'v' },
 	{ "help",      no_argument,       NULL, 'h' },
@@ -107,6 +151,7 @@ int main(int argc, char *argv[])
 	bool use_pager = true;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	bool compress = false;
 	const char *analyze_path = NULL;
 	const char *ellisys_server = NULL;
 	const char *tty = NULL;
@@ -115,6 +160,10 @@ int main(int argc, char *argv[])
 	const char *str;
 	char *jlink = NULL;
 	char *rtt = NULL;
+	uint64_t since = 0, until = 0, interval;
+	unsigned long handle, jobs = 1;
+	bool json = false;
+	char *end;
 	int exit_status;
 
 	mainloop_init();
@@ -226,6 +275,55 @@ int main(int argc, char *argv[])
 				return EXIT_FAILURE;
 			}
 			break;
+		case OPT_SINCE:
+		case OPT_UNTIL:
+			if (!parse_offset(optarg, opt == OPT_SINCE ? &since :
+								&until)) {
+				fprintf(stderr, "Invalid time offset: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			control_filter_time(since, until);
+			break;
+		case OPT_HANDLE:
+			handle = strtoul(optarg, &end, 0);
+			if (end == optarg || *end != '\0' || handle > 0x0eff) {
+				fprintf(stderr, "Invalid handle: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			control_filter_handle(handle);
+			break;
+		case OPT_JOBS:
+			jobs = strtoul(optarg, &end, 0);
+			if (end == optarg || *end != '\0' || !jobs ||
+								jobs > 256) {
+				fprintf(stderr, "Invalid job count: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_STATS_INTERVAL:
+			if (!parse_offset(optarg, &interval) ||
+					interval < 1000 ||
+					interval / 1000 > UINT_MAX) {
+				fprintf(stderr, "Invalid interval: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			analyze_stats_interval(interval / 1000);
+			break;
+		case OPT_COMPRESS:
+			compress = true;
+			break;
+		case OPT_FILTER:
+			if (!filter_parse(optarg)) {
+				fprintf(stderr, "Invalid filter: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_JSON:
+			json = true;
+			break;
 		case '#':
 			packet_todo();
 			lmp_todo();
@@ -251,7 +349,23 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	printf("Bluetooth monitor ver %s\n", VERSION);
+	if (reader_path && analyze_stats_enabled()) {
+		fprintf(stderr, "Display and statistics can't be combined\n");
+		return EXIT_FAILURE;
+	}
+
+	if (json && (analyze_path || analyze_stats_enabled() ||
+			(filter_mask & PACKET_FILTER_SHOW_MGMT_SOCKET))) {
+		fprintf(stderr, "JSON output is only supported for packets\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Records are meant for other programs, not for a terminal */
+	if (json) {
+		set_monitor_json(true);
+		use_pager = false;
+	} else
+		printf("Bluetooth monitor ver %s\n", VERSION);
 
 	keys_setup();
 
@@ -263,14 +377,18 @@ int main(int argc, char *argv[])
 	}
 
 	if (reader_path) {
+		/* Injection has to happen in trace order */
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
+		else
+			control_reader_jobs(jobs);
 
 		control_reader(reader_path, use_pager);
+		filter_cleanup();
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, compress)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -287,9 +405,14 @@ int main(int argc, char *argv[])
 	if (jlink && control_rtt(jlink, rtt) < 0)
 		return EXIT_FAILURE;
 
+	if (analyze_stats_enabled() && !analyze_stats_start())
+		return EXIT_FAILURE;
+
 	exit_status = mainloop_run_with_signal(signal_callback, NULL);
 
+	control_cleanup();
 	keys_cleanup();
+	filter_cleanup();
 
 	return exit_status;
 }
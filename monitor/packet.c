@@ -289,16 +289,48 @@ void packet_set_msft_evt_prefix(const uint8_t *prefix, uint8_t len)
 		memcpy(index_list[index_current].msft_evt_prefix, prefix, len);
 }
 
+/* Starts a record that the decoded fields of the packet are added to */
+static void print_json_packet(struct timeval *tv, char ident, uint16_t index,
+					const char *channel, const char *label,
+					const char *text, const char *extra)
+{
+	char str[2] = { ident, '\0' };
+
+	json_begin();
+	json_time("time", tv);
+	json_str("channel", channel);
+
+	if (index != HCI_DEV_NONE) {
+		json_uint("index", index);
+
+		if (index < MAX_INDEX)
+			json_uint("frame", index_list[index].frame);
+	}
+
+	json_str("ident", str);
+	json_str("label", label);
+	json_str("text", text);
+	json_str("extra", extra);
+}
+
 static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 					uint16_t index, const char *channel,
 					const char *color, const char *label,
 					const char *text, const char *extra)
 {
-	int col = num_columns();
+	int col;
 	char line[256], ts_str[96];
 	int n, ts_len = 0, ts_pos = 0, len = 0, pos = 0;
 	static size_t last_frame;
 
+	if (use_json()) {
+		print_json_packet(tv, ident, index, channel, label, text,
+									extra);
+		return;
+	}
+
+	col = num_columns();
+
 	if (channel) {
 		if (use_color()) {
 			n = sprintf(ts_str + ts_pos, "%s", COLOR_CHANNEL_LABEL);
@@ -3912,6 +3944,26 @@ static int addr2str(const uint8_t *addr, char *str)
 			addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
 }
 
+/* Counts a packet that isn't decoded so later frame numbers still match */
+void packet_skip(uint16_t index, uint16_t opcode)
+{
+	if (index >= MAX_INDEX)
+		return;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+	case BTSNOOP_OPCODE_EVENT_PKT:
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		index_list[index].frame++;
+		break;
+	}
+}
+
 void packet_monitor(struct timeval *tv, struct ucred *cred,
 					uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
@@ -3929,6 +3981,7 @@ void packet_monitor(struct timeval *tv, struct ucred *cred,
 
 	if (index != HCI_DEV_NONE && index >= MAX_INDEX) {
 		print_field("Invalid index (%d)", index);
+		json_end();
 		return;
 	}
 
@@ -4076,6 +4129,8 @@ void packet_monitor(struct timeval *tv, struct ucred *cred,
 		packet_hexdump(data, size);
 		break;
 	}
+
+	json_end();
 }
 
 void packet_simulator(struct timeval *tv, uint16_t frequency,
@@ -4092,6 +4147,8 @@ void packet_simulator(struct timeval *tv, uint16_t frequency,
 					"Physical packet:", NULL, str);
 
 	ll_packet(frequency, data, size, false);
+
+	json_end();
 }
 
 static void null_cmd(const void *data, uint8_t size)
@@ -9325,18 +9382,77 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
-static const char *get_supported_command(int bit)
+/* Direct index of opcode_table by OGF and OCF, built on first use */
+#define OPCODE_INDEX_OGF	0x09
+#define OPCODE_INDEX_OCF	0x100
+#define OPCODE_INDEX_BIT	(64 * 8)
+
+static const struct opcode_data *opcode_index[OPCODE_INDEX_OGF]
+							[OPCODE_INDEX_OCF];
+static const struct opcode_data *opcode_bit_index[OPCODE_INDEX_BIT];
+static bool opcode_index_partial;
+static bool opcode_index_ready;
+
+static void opcode_index_init(void)
 {
 	int i;
 
 	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].bit == bit)
-			return opcode_table[i].str;
+		const struct opcode_data *op = &opcode_table[i];
+		uint16_t ogf = cmd_opcode_ogf(op->opcode);
+		uint16_t ocf = cmd_opcode_ocf(op->opcode);
+
+		if (op->bit >= 0 && op->bit < OPCODE_INDEX_BIT &&
+						!opcode_bit_index[op->bit])
+			opcode_bit_index[op->bit] = op;
+
+		if (ogf >= OPCODE_INDEX_OGF || ocf >= OPCODE_INDEX_OCF) {
+			opcode_index_partial = true;
+			continue;
+		}
+
+		if (!opcode_index[ogf][ocf])
+			opcode_index[ogf][ocf] = op;
+	}
+
+	opcode_index_ready = true;
+}
+
+static const struct opcode_data *find_opcode(uint16_t opcode)
+{
+	uint16_t ogf = cmd_opcode_ogf(opcode);
+	uint16_t ocf = cmd_opcode_ocf(opcode);
+	int i;
+
+	if (!opcode_index_ready)
+		opcode_index_init();
+
+	if (ogf < OPCODE_INDEX_OGF && ocf < OPCODE_INDEX_OCF)
+		return opcode_index[ogf][ocf];
+
+	/* Only entries that did not fit the index need to be searched */
+	if (!opcode_index_partial)
+		return NULL;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].opcode == opcode)
+			return &opcode_table[i];
 	}
 
 	return NULL;
 }
 
+static const char *get_supported_command(int bit)
+{
+	if (!opcode_index_ready)
+		opcode_index_init();
+
+	if (bit < 0 || bit >= OPCODE_INDEX_BIT || !opcode_bit_index[bit])
+		return NULL;
+
+	return opcode_bit_index[bit]->str;
+}
+
 static const char *current_vendor_str(void)
 {
 	uint16_t manufacturer, msft_opcode;
@@ -9572,14 +9688,8 @@ static void cmd_complete_evt(const void *data, uint8_t size)
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -9667,14 +9777,8 @@ static void cmd_status_evt(const void *data, uint8_t size)
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -11007,12 +11111,33 @@ static const struct subevent_data le_meta_event_table[] = {
 	{ }
 };
 
+static const struct subevent_data *le_meta_event_index[256];
+static bool le_meta_event_index_ready;
+
+static const struct subevent_data *find_le_meta_event(uint8_t subevent)
+{
+	int i;
+
+	if (!le_meta_event_index_ready) {
+		for (i = 0; le_meta_event_table[i].str; i++) {
+			uint8_t sub = le_meta_event_table[i].subevent;
+
+			if (!le_meta_event_index[sub])
+				le_meta_event_index[sub] =
+						&le_meta_event_table[i];
+		}
+
+		le_meta_event_index_ready = true;
+	}
+
+	return le_meta_event_index[subevent];
+}
+
 static void le_meta_event_evt(const void *data, uint8_t size)
 {
 	uint8_t subevent = *((const uint8_t *) data);
 	struct subevent_data unknown;
-	const struct subevent_data *subevent_data = &unknown;
-	int i;
+	const struct subevent_data *subevent_data;
 
 	unknown.subevent = subevent;
 	unknown.str = "Unknown";
@@ -11020,12 +11145,9 @@ static void le_meta_event_evt(const void *data, uint8_t size)
 	unknown.size = 0;
 	unknown.fixed = true;
 
-	for (i = 0; le_meta_event_table[i].str; i++) {
-		if (le_meta_event_table[i].subevent == subevent) {
-			subevent_data = &le_meta_event_table[i];
-			break;
-		}
-	}
+	subevent_data = find_le_meta_event(subevent);
+	if (!subevent_data)
+		subevent_data = &unknown;
 
 	print_subevent(subevent_data, data + 1, size - 1);
 }
@@ -11229,6 +11351,27 @@ static const struct event_data event_table[] = {
 	{ }
 };
 
+static const struct event_data *event_index[256];
+static bool event_index_ready;
+
+static const struct event_data *find_event(uint8_t event)
+{
+	int i;
+
+	if (!event_index_ready) {
+		for (i = 0; event_table[i].str; i++) {
+			uint8_t evt = event_table[i].event;
+
+			if (!event_index[evt])
+				event_index[evt] = &event_table[i];
+		}
+
+		event_index_ready = true;
+	}
+
+	return event_index[event];
+}
+
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
@@ -11403,7 +11546,6 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25], vendor_str[150];
-	int i;
 
 	if (index >= MAX_INDEX) {
 		print_field("Invalid index (%d).", index);
@@ -11422,12 +11564,7 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -11510,7 +11647,6 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct event_data *event_data = NULL;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	if (index >= MAX_INDEX) {
 		print_field("Invalid index (%d).", index);
@@ -11531,12 +11667,7 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
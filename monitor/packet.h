@@ -53,6 +53,7 @@ void packet_print_io_authentication(uint8_t authentication);
 void packet_control(struct timeval *tv, struct ucred *cred,
 					uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size);
+void packet_skip(uint16_t index, uint16_t opcode);
 void packet_monitor(struct timeval *tv, struct ucred *cred,
 					uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size);
@@ -38,6 +38,12 @@
 #define ERROR_INTERFACE		"org.bluez.obex.Error"
 #define CLIENT_PATH		"/org/bluez/obex"
 
+/* Interval in seconds at which the aggregate throughput is sampled */
+#define THROUGHPUT_INTERVAL	1
+
+/* Key used for sessions created without an explicit source adapter */
+#define SOURCE_ANY		"00:00:00:00:00:00"
+
 struct send_data {
 	DBusConnection *connection;
 	DBusMessage *message;
@@ -45,6 +51,81 @@ struct send_data {
 
 static GSList *sessions = NULL;
 
+static DBusConnection *conn = NULL;
+
+/* Last transferred byte count sampled for each session */
+static GHashTable *samples = NULL;
+
+/* Bytes per second transferred through each source adapter */
+static GHashTable *throughput = NULL;
+static guint throughput_id = 0;
+
+static gboolean update_throughput(gpointer user_data)
+{
+	GHashTable *rates;
+	GSList *l;
+
+	rates = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+									g_free);
+
+	for (l = sessions; l; l = l->next) {
+		struct obc_session *session = l->data;
+		const char *source = obc_session_get_source(session);
+		guint64 *last, *rate;
+		guint64 bytes;
+
+		if (source == NULL)
+			source = SOURCE_ANY;
+
+		last = g_hash_table_lookup(samples, session);
+		if (last == NULL) {
+			last = g_new0(guint64, 1);
+			g_hash_table_insert(samples, session, last);
+		}
+
+		bytes = obc_session_get_transferred(session);
+
+		rate = g_hash_table_lookup(rates, source);
+		if (rate == NULL) {
+			rate = g_new0(guint64, 1);
+			g_hash_table_insert(rates, g_strdup(source), rate);
+		}
+
+		*rate += (bytes - *last) / THROUGHPUT_INTERVAL;
+		*last = bytes;
+	}
+
+	if (g_hash_table_size(rates) > 0 ||
+				g_hash_table_size(throughput) > 0)
+		g_dbus_emit_property_changed(conn, CLIENT_PATH,
+					CLIENT_INTERFACE, "Throughput");
+
+	g_hash_table_destroy(throughput);
+	throughput = rates;
+
+	if (sessions != NULL)
+		return TRUE;
+
+	throughput_id = 0;
+
+	return FALSE;
+}
+
+static void track_session(struct obc_session *session)
+{
+	sessions = g_slist_append(sessions, session);
+
+	if (throughput_id == 0)
+		throughput_id = g_timeout_add_seconds(THROUGHPUT_INTERVAL,
+						update_throughput, NULL);
+}
+
+static void untrack_session(struct obc_session *session)
+{
+	sessions = g_slist_remove(sessions, session);
+	g_hash_table_remove(samples, session);
+}
+
 static void shutdown_session(struct obc_session *session)
 {
 	obc_session_shutdown(session);
@@ -53,7 +134,7 @@ static void shutdown_session(struct obc_session *session)
 
 static void release_session(struct obc_session *session)
 {
-	sessions = g_slist_remove(sessions, session);
+	untrack_session(session);
 	shutdown_session(session);
 }
 
@@ -64,7 +145,7 @@ static void unregister_session(void *data)
 	if (g_slist_find(sessions, session) == NULL)
 		return;
 
-	sessions = g_slist_remove(sessions, session);
+	untrack_session(session);
 	obc_session_unref(session);
 }
 
@@ -95,7 +176,7 @@ static void create_callback(struct obc_session *session,
 		goto done;
 	}
 
-	sessions = g_slist_append(sessions, session);
+	track_session(session);
 	g_dbus_send_reply(data->connection, data->message,
 				DBUS_TYPE_OBJECT_PATH, &path,
 				DBUS_TYPE_INVALID);
@@ -239,7 +320,40 @@ static const GDBusMethodTable client_methods[] = {
 	{ }
 };
 
-static DBusConnection *conn = NULL;
+static gboolean get_throughput(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	DBusMessageIter dict;
+	GHashTableIter i;
+	gpointer key, value;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_UINT64_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	g_hash_table_iter_init(&i, throughput);
+	while (g_hash_table_iter_next(&i, &key, &value)) {
+		DBusMessageIter entry;
+
+		dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY,
+								NULL, &entry);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_UINT64, value);
+		dbus_message_iter_close_container(&dict, &entry);
+	}
+
+	dbus_message_iter_close_container(iter, &dict);
+
+	return TRUE;
+}
+
+static const GDBusPropertyTable client_properties[] = {
+	{ "Throughput", "a{st}", get_throughput },
+	{ }
+};
 
 static struct obc_module {
 	const char *name;
@@ -268,10 +382,17 @@ int client_manager_init(void)
 		return -1;
 	}
 
+	samples = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	throughput = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+									g_free);
+
 	if (g_dbus_register_interface(conn, CLIENT_PATH, CLIENT_INTERFACE,
-						client_methods, NULL, NULL,
-							NULL, NULL) == FALSE) {
+						client_methods, NULL,
+						client_properties,
+						NULL, NULL) == FALSE) {
 		error("Can't register client interface");
+		g_hash_table_destroy(samples);
+		g_hash_table_destroy(throughput);
 		dbus_connection_unref(conn);
 		conn = NULL;
 		return -1;
@@ -299,5 +420,13 @@ void client_manager_exit(void)
 
 	g_dbus_unregister_interface(conn, CLIENT_PATH, CLIENT_INTERFACE);
 
+	if (throughput_id > 0) {
+		g_source_remove(throughput_id);
+		throughput_id = 0;
+	}
+
+	g_hash_table_destroy(samples);
+	g_hash_table_destroy(throughput);
+
 	dbus_connection_unref(conn);
 }
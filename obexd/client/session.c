@@ -26,6 +26,7 @@
 #include "gdbus/gdbus.h"
 #include "gobex/gobex.h"
 
+#include "obexd/src/obexd.h"
 #include "obexd/src/log.h"
 #include "transfer.h"
 #include "session.h"
@@ -100,6 +101,7 @@ struct obc_session {
 	guint process_id;
 	char *folder;
 	struct callback_data *callback;
+	guint64 transferred;	/* Bytes of finished transfers */
 };
 
 static GSList *sessions = NULL;
@@ -375,6 +377,9 @@ static void transport_func(GIOChannel *io, GError *err, gpointer user_data)
 	if (obex == NULL)
 		goto done;
 
+	if (obex_option_srm_window() > 0)
+		g_obex_set_tx_window(obex, obex_option_srm_window());
+
 	g_io_channel_set_close_on_unref(io, TRUE);
 
 	apparam = NULL;
@@ -915,6 +920,10 @@ static void session_terminate_transfer(struct obc_session *session,
 	} else
 		session->p = NULL;
 
+	if (p->transfer)
+		session->transferred +=
+				obc_transfer_get_transferred(p->transfer);
+
 	obc_session_ref(session);
 
 	if (p->func)
@@ -1029,6 +1038,21 @@ const char *obc_session_get_folder(struct obc_session *session)
 	return session->folder;
 }
 
+const char *obc_session_get_source(struct obc_session *session)
+{
+	return session->source;
+}
+
+guint64 obc_session_get_transferred(struct obc_session *session)
+{
+	struct pending_request *p = session->p;
+
+	if (p == NULL || p->transfer == NULL)
+		return session->transferred;
+
+	return session->transferred + obc_transfer_get_transferred(p->transfer);
+}
+
 static void setpath_complete(struct obc_session *session,
 						struct obc_transfer *transfer,
 						GError *err, void *user_data)
@@ -45,6 +45,8 @@ const void *obc_session_get_attribute(struct obc_session *session,
 							int attribute_id);
 
 const char *obc_session_get_folder(struct obc_session *session);
+const char *obc_session_get_source(struct obc_session *session);
+guint64 obc_session_get_transferred(struct obc_session *session);
 
 guint obc_session_queue(struct obc_session *session,
 				struct obc_transfer *transfer,
@@ -714,12 +714,8 @@ static void get_xfer_progress_first(GObex *obex, GError *err, GObexPacket *rsp,
 			obc_transfer_set_apparam(transfer, apparam);
 	}
 
-	hdr = g_obex_packet_get_body(rsp);
-	if (hdr) {
-		g_obex_header_get_bytes(hdr, &buf, &len);
-		if (len != 0)
-			get_xfer_progress(buf, len, transfer);
-	}
+	if (g_obex_packet_get_body_bytes(rsp, &buf, &len) && len != 0)
+		get_xfer_progress(buf, len, transfer);
 
 	if (rspcode == G_OBEX_RSP_SUCCESS) {
 		transfer->req = 0;
@@ -754,6 +750,23 @@ static gssize put_xfer_progress(void *buf, gsize len, gpointer user_data)
 	return size;
 }
 
+/* Hands out file regions so the body is sent without copying it */
+static gssize put_xfer_file(int *fd, off_t *offset, gsize len,
+							gpointer user_data)
+{
+	struct obc_transfer *transfer = user_data;
+	gssize size;
+
+	size = MIN((gint64) len, transfer->size - transfer->transferred);
+
+	*fd = transfer->fd;
+	*offset = transfer->transferred;
+
+	transfer->transferred += size;
+
+	return size;
+}
+
 gboolean obc_transfer_set_callback(struct obc_transfer *transfer,
 					transfer_callback_t func,
 					void *user_data)
@@ -867,9 +880,15 @@ static gboolean transfer_start_put(struct obc_transfer *transfer, GError **err)
 		g_obex_packet_add_header(req, hdr);
 	}
 
-	transfer->xfer = g_obex_put_req_pkt(transfer->obex, req,
-					put_xfer_progress, xfer_complete,
-					transfer, err);
+	/* Non regular files, such as pipes, report no size and are read */
+	if (transfer->size > 0)
+		transfer->xfer = g_obex_put_req_pkt_fd(transfer->obex, req,
+						put_xfer_file, xfer_complete,
+						transfer, err);
+	else
+		transfer->xfer = g_obex_put_req_pkt(transfer->obex, req,
+						put_xfer_progress,
+						xfer_complete, transfer, err);
 	if (transfer->xfer == 0)
 		return FALSE;
 
@@ -971,3 +990,8 @@ gint64 obc_transfer_get_size(struct obc_transfer *transfer)
 {
 	return transfer->size;
 }
+
+gint64 obc_transfer_get_transferred(struct obc_transfer *transfer)
+{
+	return transfer->transferred;
+}
@@ -62,6 +62,9 @@
 			" modified=\"%s\" mem-type=\"DEV\"" \
 			" created=\"%s\"/>" EOL_CHARS
 
+/* Number of directory entries stat'ed per listing refill */
+#define FL_BATCH_SIZE 64
+
 #define FTP_TARGET_SIZE 16
 
 static const uint8_t FTP_TARGET[FTP_TARGET_SIZE] = {
@@ -230,6 +233,11 @@ static ssize_t filesystem_read(void *object, void *buf, size_t count)
 	return ret;
 }
 
+static int filesystem_get_fd(void *object)
+{
+	return GPOINTER_TO_INT(object);
+}
+
 static ssize_t filesystem_write(void *object, const void *buf, size_t count)
 {
 	ssize_t ret;
@@ -447,55 +455,85 @@ fail:
 	return NULL;
 }
 
-static GString *append_pcsuite_preamble(GString *object)
-{
-	return g_string_append(object, FL_TYPE_PCSUITE);
-}
-
-static GString *append_folder_preamble(GString *object)
-{
-	return g_string_append(object, FL_TYPE);
-}
+struct folder_listing {
+	GString *buffer;
+	DIR *dp;
+	struct stat dstat;
+	gboolean root;
+};
 
-static GString *append_listing(GString *object, const char *name,
-				gboolean pcsuite, size_t *size, int *err)
+static void *folder_listing_open(const char *name, const char *preamble,
+								int *err)
 {
-	struct stat fstat, dstat;
-	struct dirent *ep;
+	struct folder_listing *listing;
+	struct stat dstat;
 	DIR *dp;
-	gboolean root;
 	int ret;
 
-	root = g_str_equal(name, obex_option_root_folder());
-
 	dp = opendir(name);
 	if (dp == NULL) {
 		if (err)
 			*err = -ENOENT;
-		goto failed;
+		return NULL;
 	}
 
-	if (!root)
-		object = g_string_append(object, FL_PARENT_FOLDER_ELEMENT);
-
 	ret = verify_path(name);
 	if (ret < 0) {
-		*err = ret;
+		if (err)
+			*err = ret;
 		goto failed;
 	}
 
-	ret = stat(name, &dstat);
-	if (ret < 0) {
+	if (fstat(dirfd(dp), &dstat) < 0) {
 		if (err)
 			*err = -errno;
 		goto failed;
 	}
 
-	while ((ep = readdir(dp))) {
+	listing = g_new0(struct folder_listing, 1);
+	listing->dp = dp;
+	listing->dstat = dstat;
+	listing->root = g_str_equal(name, obex_option_root_folder());
+
+	listing->buffer = g_string_new(FL_VERSION);
+	g_string_append(listing->buffer, preamble);
+	g_string_append(listing->buffer, FL_BODY_BEGIN);
+
+	if (!listing->root)
+		g_string_append(listing->buffer, FL_PARENT_FOLDER_ELEMENT);
+
+	if (err)
+		*err = 0;
+
+	return listing;
+
+failed:
+	closedir(dp);
+	return NULL;
+}
+
+/*
+ * Stat up to FL_BATCH_SIZE entries and append their elements to the buffer,
+ * closing the listing once the directory has been fully read.
+ */
+static void folder_listing_fill(struct folder_listing *listing)
+{
+	struct stat fstat;
+	struct dirent *ep;
+	unsigned int n = 0;
+
+	while (n < FL_BATCH_SIZE) {
 		char *filename;
-		char *fullname;
 		char *line;
 
+		ep = readdir(listing->dp);
+		if (ep == NULL) {
+			closedir(listing->dp);
+			listing->dp = NULL;
+			g_string_append(listing->buffer, FL_BODY_END);
+			return;
+		}
+
 		if (ep->d_name[0] == '.')
 			continue;
 
@@ -505,78 +543,47 @@ static GString *append_listing(GString *object, const char *name,
 			continue;
 		}
 
-		fullname = g_build_filename(name, ep->d_name, NULL);
+		n++;
 
-		ret = stat(fullname, &fstat);
-		if (ret < 0) {
+		if (fstatat(dirfd(listing->dp), ep->d_name, &fstat, 0) < 0) {
 			DBG("stat: %s(%d)", strerror(errno), errno);
 			g_free(filename);
-			g_free(fullname);
 			continue;
 		}
 
-		g_free(fullname);
+		line = file_stat_line(filename, &fstat, &listing->dstat,
+							listing->root, FALSE);
+		g_free(filename);
 
-		line = file_stat_line(filename, &fstat, &dstat, root, FALSE);
-		if (line == NULL) {
-			g_free(filename);
+		if (line == NULL)
 			continue;
-		}
-
-		g_free(filename);
 
-		object = g_string_append(object, line);
+		g_string_append(listing->buffer, line);
 		g_free(line);
 	}
-
-	closedir(dp);
-
-	object = g_string_append(object, FL_BODY_END);
-	if (size)
-		*size = object->len;
-
-	if (err)
-		*err = 0;
-
-	return object;
-
-failed:
-	if (dp)
-		closedir(dp);
-
-	g_string_free(object, TRUE);
-	return NULL;
 }
 
 static void *folder_open(const char *name, int oflag, mode_t mode,
 					void *context, size_t *size, int *err)
 {
-	GString *object;
-
-	object = g_string_new(FL_VERSION);
-	object = append_folder_preamble(object);
-	object = g_string_append(object, FL_BODY_BEGIN);
-
-	return append_listing(object, name, FALSE, size, err);
+	return folder_listing_open(name, FL_TYPE, err);
 }
 
 static void *pcsuite_open(const char *name, int oflag, mode_t mode,
 					void *context, size_t *size, int *err)
 {
-	GString *object;
-
-	object = g_string_new(FL_VERSION);
-	object = append_pcsuite_preamble(object);
-	object = g_string_append(object, FL_BODY_BEGIN);
-
-	return append_listing(object, name, TRUE, size, err);
+	return folder_listing_open(name, FL_TYPE_PCSUITE, err);
 }
 
-static int string_free(void *object)
+static int folder_close(void *object)
 {
-	GString *string = object;
+	struct folder_listing *listing = object;
+
+	if (listing->dp)
+		closedir(listing->dp);
 
-	g_string_free(string, TRUE);
+	g_string_free(listing->buffer, TRUE);
+	g_free(listing);
 
 	return 0;
 }
@@ -598,7 +605,13 @@ ssize_t string_read(void *object, void *buf, size_t count)
 
 static ssize_t folder_read(void *object, void *buf, size_t count)
 {
-	return string_read(object, buf, count);
+	struct folder_listing *listing = object;
+
+	/* Only stat as many entries as are needed to fill this read */
+	while (listing->dp && listing->buffer->len < count)
+		folder_listing_fill(listing);
+
+	return string_read(listing->buffer, buf, count);
 }
 
 static ssize_t capability_read(void *object, void *buf, size_t count)
@@ -646,6 +659,7 @@ static struct obex_mime_type_driver file = {
 	.open = filesystem_open,
 	.close = filesystem_close,
 	.read = filesystem_read,
+	.get_fd = filesystem_get_fd,
 	.write = filesystem_write,
 	.remove = remove,
 	.move = filesystem_rename,
@@ -666,7 +680,7 @@ static struct obex_mime_type_driver folder = {
 	.target_size = FTP_TARGET_SIZE,
 	.mimetype = "x-obex/folder-listing",
 	.open = folder_open,
-	.close = string_free,
+	.close = folder_close,
 	.read = folder_read,
 };
 
@@ -677,7 +691,7 @@ static struct obex_mime_type_driver pcsuite = {
 	.who_size = PCSUITE_WHO_SIZE,
 	.mimetype = "x-obex/folder-listing",
 	.open = pcsuite_open,
-	.close = string_free,
+	.close = folder_close,
 	.read = folder_read,
 };
 
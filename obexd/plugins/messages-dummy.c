@@ -13,6 +13,7 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <stdio.h>
 #include <errno.h>
@@ -27,6 +28,9 @@
 
 static char *root_folder = NULL;
 
+/* Parsed message listings, keyed by the path of their listing file */
+static GHashTable *indexes = NULL;
+
 struct session {
 	char *cwd;
 	char *cwd_absolute;
@@ -42,15 +46,19 @@ struct folder_listing_data {
 	void *user_data;
 };
 
+struct message_index {
+	struct timespec mtime;
+	off_t size;
+	GPtrArray *messages;
+};
+
 struct message_listing_data {
 	struct session *session;
 	const char *name;
 	uint16_t max;
 	uint16_t offset;
 	uint8_t subject_len;
-	uint16_t size;
 	char *path;
-	FILE *fp;
 	const struct messages_filter *filter;
 	messages_get_messages_listing_cb callback;
 	void *user_data;
@@ -195,6 +203,29 @@ static gboolean get_folder_listing(void *d)
 	return FALSE;
 }
 
+static void message_free(void *data)
+{
+	struct messages_message *msg = data;
+
+	g_free(msg->reception_status);
+	g_free(msg->type);
+	g_free(msg->recipient_addressing);
+	g_free(msg->sender_addressing);
+	g_free(msg->subject);
+	g_free(msg->datetime);
+	g_free(msg->attachment_size);
+	g_free(msg->handle);
+	g_free(msg);
+}
+
+static void message_index_free(void *data)
+{
+	struct message_index *listing = data;
+
+	g_ptr_array_unref(listing->messages);
+	g_free(listing);
+}
+
 int messages_init(void)
 {
 	char *tmp;
@@ -202,6 +233,9 @@ int messages_init(void)
 	if (root_folder)
 		return 0;
 
+	indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+							message_index_free);
+
 	tmp = getenv("MAP_ROOT");
 	if (tmp) {
 		root_folder = g_strdup(tmp);
@@ -221,6 +255,11 @@ void messages_exit(void)
 {
 	g_free(root_folder);
 	root_folder = NULL;
+
+	if (indexes) {
+		g_hash_table_destroy(indexes);
+		indexes = NULL;
+	}
 }
 
 int messages_connect(void **s)
@@ -323,44 +362,19 @@ int messages_get_folder_listing(void *s, const char *name, uint16_t max,
 	return 0;
 }
 
-static void max_msg_element(GMarkupParseContext *ctxt, const char *element,
-				const char **names, const char **values,
-				gpointer user_data, GError **gerr)
-{
-	struct message_listing_data *mld = user_data;
-	const char *key;
-	int i;
-
-	for (i = 0, key = names[i]; key; key = names[++i]) {
-		if (g_strcmp0(names[i], "handle") == 0) {
-			mld->size++;
-			break;
-		}
-	}
-}
-
 static void msg_element(GMarkupParseContext *ctxt, const char *element,
 				const char **names, const char **values,
 				gpointer user_data, GError **gerr)
 {
-	struct message_listing_data *mld = user_data;
+	struct message_index *listing = user_data;
 	struct messages_message *entry = NULL;
 	int i;
 
 	entry = g_new0(struct messages_message, 1);
-	if (mld->filter->parameter_mask == 0) {
-		entry->mask = (entry->mask | PMASK_SUBJECT \
-			| PMASK_DATETIME | PMASK_RECIPIENT_ADDRESSING \
-			| PMASK_SENDER_ADDRESSING \
-			| PMASK_ATTACHMENT_SIZE | PMASK_TYPE \
-			| PMASK_RECEPTION_STATUS);
-	} else
-		entry->mask = mld->filter->parameter_mask;
 
 	for (i = 0 ; names[i]; ++i) {
 		if (g_strcmp0(names[i], "handle") == 0) {
 			entry->handle = g_strdup(values[i]);
-			mld->size++;
 			continue;
 		}
 		if (g_strcmp0(names[i], "attachment_size") == 0) {
@@ -391,17 +405,12 @@ static void msg_element(GMarkupParseContext *ctxt, const char *element,
 			entry->reception_status = g_strdup(values[i]);
 	}
 
-	if (mld->size > mld->offset)
-		mld->callback(mld->session, -EAGAIN, mld->size, 0, entry, mld->user_data);
-
-	g_free(entry->reception_status);
-	g_free(entry->type);
-	g_free(entry->sender_addressing);
-	g_free(entry->subject);
-	g_free(entry->datetime);
-	g_free(entry->attachment_size);
-	g_free(entry->handle);
-	g_free(entry);
+	if (entry->handle == NULL) {
+		message_free(entry);
+		return;
+	}
+
+	g_ptr_array_add(listing->messages, entry);
 }
 
 static const GMarkupParser msg_parser = {
@@ -412,50 +421,121 @@ static const GMarkupParser msg_parser = {
         NULL
 };
 
-static const GMarkupParser max_msg_parser = {
-        max_msg_element,
-        NULL,
-        NULL,
-        NULL,
-        NULL
-};
-
-static gboolean get_messages_listing(void *d)
+static struct message_index *message_index_load(const char *path,
+							struct stat *st)
 {
-
-	struct message_listing_data *mld = d;
+	struct message_index *listing;
 	/* 1024 is the maximum size of the line which is calculated to be more
 	 * sufficient*/
 	char buffer[1024];
 	GMarkupParseContext *ctxt;
-	size_t len;
-
-	while (fgets(buffer, 1024, mld->fp)) {
-		len = strlen(buffer);
-
-		if (mld->max == 0) {
-			ctxt = g_markup_parse_context_new(&max_msg_parser, 0, mld, NULL);
-			g_markup_parse_context_parse(ctxt, buffer, len, NULL);
-			g_markup_parse_context_free(ctxt);
-		} else {
-			ctxt = g_markup_parse_context_new(&msg_parser, 0, mld, NULL);
-			g_markup_parse_context_parse(ctxt, buffer, len, NULL);
-			g_markup_parse_context_free(ctxt);
-		}
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return NULL;
+
+	listing = g_new0(struct message_index, 1);
+	listing->mtime = st->st_mtim;
+	listing->size = st->st_size;
+	listing->messages = g_ptr_array_new_with_free_func(message_free);
+
+	while (fgets(buffer, 1024, fp)) {
+		ctxt = g_markup_parse_context_new(&msg_parser, 0, listing,
+									NULL);
+		g_markup_parse_context_parse(ctxt, buffer, strlen(buffer),
+									NULL);
+		g_markup_parse_context_free(ctxt);
 	}
 
+	fclose(fp);
+
+	DBG("%s: %u messages", path, listing->messages->len);
+
+	return listing;
+}
+
+/*
+ * Returns the parsed listing file at path, which is only parsed again
+ * once the listing file has changed since it was last indexed.
+ */
+static struct message_index *message_index_get(const char *path)
+{
+	struct message_index *listing;
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return NULL;
+
+	listing = g_hash_table_lookup(indexes, path);
+	if (listing && listing->size == st.st_size &&
+			listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+			listing->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return listing;
+
+	listing = message_index_load(path, &st);
+	if (listing == NULL)
+		return NULL;
+
+	g_hash_table_replace(indexes, g_strdup(path), listing);
+
+	return listing;
+}
+
+static gboolean get_messages_listing(void *d)
+{
+	struct message_listing_data *mld = d;
+	struct message_index *listing;
+	uint32_t mask;
+	guint i, size;
+
+	listing = message_index_get(mld->path);
+	if (listing == NULL) {
+		mld->callback(mld->session, -EBADR, 0, 0, NULL,
+							mld->user_data);
+		return FALSE;
+	}
+
+	size = MIN(listing->messages->len, UINT16_MAX);
+
 	if (mld->max == 0) {
-		mld->callback(mld->session, 0, mld->size, 0, NULL, mld->user_data);
-		goto done;
+		mld->callback(mld->session, 0, size, 0, NULL, mld->user_data);
+		return FALSE;
+	}
+
+	if (mld->filter->parameter_mask == 0)
+		mask = PMASK_SUBJECT | PMASK_DATETIME |
+			PMASK_RECIPIENT_ADDRESSING | PMASK_SENDER_ADDRESSING |
+			PMASK_ATTACHMENT_SIZE | PMASK_TYPE |
+			PMASK_RECEPTION_STATUS;
+	else
+		mask = mld->filter->parameter_mask;
+
+	/* Only the requested window is served from the index */
+	for (i = mld->offset; i < size && i - mld->offset < mld->max; i++) {
+		struct messages_message entry;
+
+		entry = *(struct messages_message *)
+					g_ptr_array_index(listing->messages, i);
+		entry.mask = mask;
+
+		mld->callback(mld->session, -EAGAIN, i + 1, 0, &entry,
+							mld->user_data);
 	}
 
-	mld->callback(mld->session, 0, mld->size, 0, NULL, mld->user_data);
+	mld->callback(mld->session, 0, size, 0, NULL, mld->user_data);
 
-done:
-	fclose(mld->fp);
 	return FALSE;
 }
 
+static void message_listing_free(void *data)
+{
+	struct message_listing_data *mld = data;
+
+	g_free(mld->path);
+	g_free(mld);
+}
+
 int messages_get_messages_listing(void *session, const char *name,
 				uint16_t max, uint16_t offset,
 				uint8_t subject_len,
@@ -467,6 +547,18 @@ int messages_get_messages_listing(void *session, const char *name,
 	struct session *s =  session;
 	char *path;
 
+	path = g_build_filename(s->cwd_absolute, MSG_LIST_XML, NULL);
+	if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+		g_free(path);
+		messages_set_folder(s, name, 0);
+		path = g_build_filename(s->cwd_absolute, MSG_LIST_XML, NULL);
+		if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+			DBG("%s: not found", path);
+			g_free(path);
+			return -EBADR;
+		}
+	}
+
 	mld = g_new0(struct message_listing_data, 1);
 	mld->session = s;
 	mld->name = name;
@@ -476,27 +568,10 @@ int messages_get_messages_listing(void *session, const char *name,
 	mld->callback = callback;
 	mld->filter = filter;
 	mld->user_data = user_data;
-
-	path = g_build_filename(s->cwd_absolute, MSG_LIST_XML, NULL);
-	mld->fp = fopen(path, "r");
-	if (mld->fp == NULL) {
-		g_free(path);
-		messages_set_folder(s, mld->name, 0);
-		path = g_build_filename(s->cwd_absolute, MSG_LIST_XML, NULL);
-		mld->fp = fopen(path, "r");
-		if (mld->fp == NULL) {
-			int err = -errno;
-			DBG("fopen(): %d, %s", -err, strerror(-err));
-			g_free(path);
-			g_free(mld);
-			return -EBADR;
-		}
-	}
-
+	mld->path = path;
 
 	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, get_messages_listing,
-								mld, g_free);
-	g_free(path);
+						mld, message_listing_free);
 
 	return 0;
 }
@@ -32,6 +32,8 @@
 #include "obexd/src/log.h"
 #include "phonebook.h"
 
+#define VCARDS_PART_COUNT 50 /* amount of vcards sent at once to PBAP core */
+
 typedef void (*vcard_func_t) (const char *file, VObject *vo, void *user_data);
 
 struct dummy_data {
@@ -41,6 +43,11 @@ struct dummy_data {
 	char *folder;
 	int fd;
 	guint id;
+	gboolean pull;		/* Pulled in parts, freed on finalize */
+	DIR *dp;
+	GSList *entries;	/* Sorted vCard file names */
+	GSList *next;		/* Next entry to be sent */
+	uint16_t sent;
 };
 
 struct cache_query {
@@ -59,6 +66,10 @@ static void dummy_free(void *user_data)
 	if (dummy->fd >= 0)
 		close(dummy->fd);
 
+	if (dummy->dp)
+		closedir(dummy->dp);
+
+	g_slist_free_full(dummy->entries, g_free);
 	g_free(dummy->folder);
 	g_free(dummy);
 }
@@ -105,29 +116,17 @@ static int handle_cmp(gconstpointer a, gconstpointer b)
 	return (i1 - i2);
 }
 
-static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
-			uint16_t maxlistcount, void *user_data, uint16_t *count)
+/*
+ * Sorting vcards by file name. versionsort is a GNU extension.
+ * The simple sorting function implemented on handle_cmp address
+ * vcards handle only(handle is always a number). This sort function
+ * doesn't address filename started by "0".
+ */
+static GSList *list_vcards(DIR *dp)
 {
 	struct dirent *ep;
-	GSList *sorted = NULL, *l;
-	VObject *v;
-	FILE *fp;
-	int err, fd, folderfd;
-	uint16_t n = 0;
+	GSList *sorted = NULL;
 
-	folderfd = dirfd(dp);
-	if (folderfd < 0) {
-		err = errno;
-		error("dirfd(): %s(%d)", strerror(err), err);
-		return -err;
-	}
-
-	/*
-	 * Sorting vcards by file name. versionsort is a GNU extension.
-	 * The simple sorting function implemented on handle_cmp address
-	 * vcards handle only(handle is always a number). This sort function
-	 * doesn't address filename started by "0".
-	 */
 	while ((ep = readdir(dp))) {
 		char *filename;
 
@@ -148,30 +147,59 @@ static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
 		sorted = g_slist_insert_sorted(sorted, filename, handle_cmp);
 	}
 
+	return sorted;
+}
+
+static gboolean parse_vcard(int folderfd, const char *filename,
+					vcard_func_t func, void *user_data)
+{
+	VObject *v;
+	FILE *fp;
+	int err, fd;
+
+	fd = openat(folderfd, filename, O_RDONLY);
+	if (fd < 0) {
+		err = errno;
+		error("openat(%s): %s(%d)", filename, strerror(err), err);
+		return FALSE;
+	}
+
+	fp = fdopen(fd, "r");
+	v = Parse_MIME_FromFile(fp);
+	if (v != NULL) {
+		func(filename, v, user_data);
+		deleteVObject(v);
+	}
+
+	close(fd);
+
+	return v != NULL;
+}
+
+static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
+			uint16_t maxlistcount, void *user_data, uint16_t *count)
+{
+	GSList *sorted, *l;
+	int err, folderfd;
+	uint16_t n = 0;
+
+	folderfd = dirfd(dp);
+	if (folderfd < 0) {
+		err = errno;
+		error("dirfd(): %s(%d)", strerror(err), err);
+		return -err;
+	}
+
+	sorted = list_vcards(dp);
+
 	/*
 	 * Filtering only the requested vCards attributes. Offset
 	 * shall be based on the first entry of the phonebook.
 	 */
 	for (l = g_slist_nth(sorted, offset);
 			l && n < maxlistcount; l = l->next) {
-		const char *filename = l->data;
-
-		fd = openat(folderfd, filename, O_RDONLY);
-		if (fd < 0) {
-			err = errno;
-			error("openat(%s): %s(%d)", filename, strerror(err), err);
-			continue;
-		}
-
-		fp = fdopen(fd, "r");
-		v = Parse_MIME_FromFile(fp);
-		if (v != NULL) {
-			func(filename, v, user_data);
-			deleteVObject(v);
+		if (parse_vcard(folderfd, l->data, func, user_data))
 			n++;
-		}
-
-		close(fd);
 	}
 
 	g_slist_free_full(sorted, g_free);
@@ -201,42 +229,71 @@ static void entry_concat(const char *filename, VObject *v, void *user_data)
 	g_string_append_len(buffer, tmp, len);
 }
 
+/*
+ * Sends the next VCARDS_PART_COUNT vCards, PBAP core asks for the following
+ * part once it has sent this one so only a part is kept in memory. Skipped
+ * entries are never parsed.
+ */
 static gboolean read_dir(void *user_data)
 {
 	struct dummy_data *dummy = user_data;
 	GString *buffer;
-	DIR *dp;
-	uint16_t count = 0, max, offset;
+	uint16_t count = 0, max;
+
+	/* Finalizing from the callback frees dummy, nothing to remove then */
+	dummy->id = 0;
 
 	buffer = g_string_new("");
 
-	dp = opendir(dummy->folder);
-	if (dp == NULL) {
-		int err = errno;
-		DBG("opendir(): %s(%d)", strerror(err), err);
-		goto done;
+	if (dummy->dp == NULL) {
+		dummy->dp = opendir(dummy->folder);
+		if (dummy->dp == NULL) {
+			int err = errno;
+			DBG("opendir(): %s(%d)", strerror(err), err);
+			goto done;
+		}
+
+		dummy->entries = list_vcards(dummy->dp);
+
+		/*
+		 * For PullPhoneBook function, the decision of returning the
+		 * size or contacts is made in the PBAP core. When MaxListCount
+		 * is ZERO, PCE wants to know the size of a given folder, PSE
+		 * shall ignore all other applicattion parameters that may be
+		 * present in the request.
+		 */
+		if (dummy->apparams->maxlistcount == 0) {
+			dummy->sent = g_slist_length(dummy->entries);
+			goto done;
+		}
+
+		dummy->next = g_slist_nth(dummy->entries,
+					dummy->apparams->liststartoffset);
 	}
 
-	/*
-	 * For PullPhoneBook function, the decision of returning the size
-	 * or contacts is made in the PBAP core. When MaxListCount is ZERO,
-	 * PCE wants to know the size of a given folder, PSE shall ignore all
-	 * other applicattion parameters that may be present in the request.
-	 */
-	if (dummy->apparams->maxlistcount == 0) {
-		max = 0xffff;
-		offset = 0;
-	} else {
-		max = dummy->apparams->maxlistcount;
-		offset = dummy->apparams->liststartoffset;
+	max = dummy->apparams->maxlistcount;
+
+	for (; dummy->next && dummy->sent < max && count < VCARDS_PART_COUNT;
+					dummy->next = dummy->next->next) {
+		if (parse_vcard(dirfd(dummy->dp), dummy->next->data,
+						entry_concat, buffer)) {
+			dummy->sent++;
+			count++;
+		}
 	}
 
-	foreach_vcard(dp, entry_concat, offset, max, buffer, &count);
+	if (dummy->next && dummy->sent < max) {
+		/* FIXME: Missing vCards fields filtering */
+		dummy->cb(buffer->str, buffer->len, dummy->sent, 0, FALSE,
+							dummy->user_data);
+		g_string_free(buffer, TRUE);
+		return FALSE;
+	}
 
-	closedir(dp);
 done:
 	/* FIXME: Missing vCards fields filtering */
-	dummy->cb(buffer->str, buffer->len, count, 0, TRUE, dummy->user_data);
+	dummy->cb(buffer->str, buffer->len, dummy->sent, 0, TRUE,
+							dummy->user_data);
 
 	g_string_free(buffer, TRUE);
 
@@ -439,9 +496,21 @@ void phonebook_req_finalize(void *request)
 {
 	struct dummy_data *dummy = request;
 
+	if (dummy == NULL)
+		return;
+
+	/* Pulls are read in parts so they are only cleaned here */
+	if (dummy->pull) {
+		if (dummy->id)
+			g_source_remove(dummy->id);
+
+		dummy_free(dummy);
+		return;
+	}
+
 	/* dummy_data will be cleaned when request will be finished via
 	 * g_source_remove */
-	if (dummy && dummy->id)
+	if (dummy->id)
 		g_source_remove(dummy->id);
 }
 
@@ -481,6 +550,7 @@ void *phonebook_pull(const char *name, const struct apparam_field *params,
 	dummy->apparams = params;
 	dummy->folder = folder;
 	dummy->fd = -1;
+	dummy->pull = TRUE;
 
 	if (err)
 		*err = 0;
@@ -495,8 +565,11 @@ int phonebook_pull_read(void *request)
 	if (!dummy)
 		return -ENOENT;
 
+	if (dummy->id)
+		return 0;
+
 	dummy->id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, read_dir, dummy,
-								dummy_free);
+									NULL);
 
 	return 0;
 }
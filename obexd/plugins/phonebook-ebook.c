@@ -33,6 +33,7 @@
 #include "phonebook.h"
 
 #define CONNECTION_TIMEOUT 30  // seconds
+#define VCARDS_PART_COUNT 50 /* amount of vcards sent at once to PBAP core */
 #define PB_FORMAT_VCARD21	0
 #define PB_FORMAT_VCARD30	1
 #define PB_FORMAT_NONE		2
@@ -48,7 +49,9 @@ struct query_context {
 	phonebook_cache_ready_cb ready_cb;
 	gchar *query;
 	unsigned int count;
-	GString *buf;
+	GSList *contacts;	/* Contacts pulled, converted in parts */
+	GSList *next;		/* Next contact to be converted */
+	guint part_id;
 	char *uid;
 	unsigned queued_calls;
 	void *user_data;
@@ -92,8 +95,10 @@ static void free_query_context(struct query_context *data)
 {
 	g_free(data->uid);
 
-	if (data->buf != NULL)
-		g_string_free(data->buf, TRUE);
+	if (data->part_id)
+		g_source_remove(data->part_id);
+
+	g_slist_free_full(data->contacts, (GDestroyNotify) g_object_unref);
 
 	if (data->query != NULL)
 		g_free(data->query);
@@ -257,7 +262,6 @@ void *phonebook_pull(const char *name, const struct apparam_field *params,
 	data->contacts_cb = cb;
 	data->params = params;
 	data->user_data = user_data;
-	data->buf = g_string_new("");
 	query = e_book_query_any_field_contains("");  // all contacts
 	data->query = e_book_query_to_string(query);
 	e_book_query_unref(query);
@@ -265,14 +269,68 @@ void *phonebook_pull(const char *name, const struct apparam_field *params,
 	return data;
 }
 
+/*
+ * Converts the next VCARDS_PART_COUNT contacts to vCards, PBAP core asks for
+ * the following part once it has sent this one so the whole phonebook is
+ * never converted at once.
+ */
+static void phonebook_pull_send_part(struct query_context *data)
+{
+	unsigned int count, maxcount = data->params->maxlistcount;
+	GString *buf = g_string_new("");
+	gboolean lastpart;
+
+	for (count = 0; data->next && data->count < maxcount &&
+					count < VCARDS_PART_COUNT;
+					data->next = g_slist_next(data->next),
+					count++, data->count++) {
+		EContact *contact = E_CONTACT(data->next->data);
+		EVCard *evcard = E_VCARD(contact);
+		char *vcard;
+
+		if (data->params->format == PB_FORMAT_VCARD30)
+			vcard = evcard_to_string(evcard, EVC_FORMAT_VCARD_30,
+							data->params->filter);
+		else if (data->params->format == PB_FORMAT_VCARD21)
+			vcard = evcard_to_string(evcard, EVC_FORMAT_VCARD_21,
+							data->params->filter);
+		else {
+			error("unknown format: %d", data->params->format);
+			continue;
+		}
+
+		buf = g_string_append(buf, vcard);
+		buf = g_string_append(buf, "\r\n");
+		g_free(vcard);
+	}
+
+	DBG("collected %d contacts", count);
+
+	lastpart = data->next == NULL || data->count >= maxcount;
+
+	/* data may be freed by the callback once lastpart is reported */
+	data->contacts_cb(buf->str, buf->len, data->count, 0, lastpart,
+							data->user_data);
+	g_string_free(buf, TRUE);
+}
+
+static gboolean phonebook_pull_next_part(gpointer user_data)
+{
+	struct query_context *data = user_data;
+
+	data->part_id = 0;
+
+	phonebook_pull_send_part(data);
+
+	return FALSE;
+}
+
 static void phonebook_pull_read_ready(GObject *source_object,
 				      GAsyncResult *result, gpointer user_data)
 {
 	struct query_context *data = user_data;
-	GSList *l = NULL;
 	GSList *contacts = NULL;
 	GError *gerr = NULL;
-	unsigned int count, maxcount;
 
 	/* Finish async call to retrieve contacts */
 	data->queued_calls--;
@@ -294,51 +352,21 @@ static void phonebook_pull_read_ready(GObject *source_object,
 	 * indexes in the phonebook of interest. All other parameters that
 	 * may be present in the request shall be ignored.
 	 */
-	maxcount = data->params->maxlistcount;
-	if (maxcount == 0) {
+	if (data->params->maxlistcount == 0) {
 		data->count += g_slist_length(contacts);
+		g_slist_free_full(contacts, (GDestroyNotify) g_object_unref);
 		goto done;
 	}
 
-	/*
-	 * Convert each contact to a vCard and append the card to
-	 * the buffer string.
-	 */
-	l = g_slist_nth(contacts, data->params->liststartoffset);
-	for (count = 0; l && count + data->count < maxcount;
-						l = g_slist_next(l), count++) {
-		EContact *contact = E_CONTACT(l->data);
-		EVCard *evcard = E_VCARD(contact);
-		char *vcard;
+	data->contacts = contacts;
+	data->next = g_slist_nth(contacts, data->params->liststartoffset);
 
-		if (data->params->format == PB_FORMAT_VCARD30)
-			vcard = evcard_to_string(evcard, EVC_FORMAT_VCARD_30,
-							 data->params->filter);
-		else if (data->params->format == PB_FORMAT_VCARD21)
-			vcard = evcard_to_string(evcard, EVC_FORMAT_VCARD_21,
-							 data->params->filter);
-		else
-			error("unknown format: %d", data->params->format);
-
-		data->buf = g_string_append(data->buf, vcard);
-		data->buf = g_string_append(data->buf, "\r\n");
-		g_free(vcard);
-	}
+	phonebook_pull_send_part(data);
 
-	DBG("collected %d contacts", count);
-
-	data->count += count;
-	g_slist_free_full(contacts, (GDestroyNotify) g_object_unref);
+	return;
 
 done:
-	if (data->queued_calls == 0) {
-		GString *buf = data->buf;
-		data->buf = NULL;
-
-		data->contacts_cb(buf->str, buf->len, data->count, 0, TRUE,
-							      data->user_data);
-		g_string_free(buf, TRUE);
-	}
+	data->contacts_cb("", 0, data->count, 0, TRUE, data->user_data);
 
 	return;
 
@@ -350,13 +378,20 @@ canceled:
 int phonebook_pull_read(void *request)
 {
 	struct query_context *data = request;
-	GError *gerr = NULL;
 
 	if (!data) {
 		error("Request data is empty");
 		return -ENOENT;
 	}
 
+	/* Following parts are converted from the contacts already pulled */
+	if (data->contacts) {
+		if (!data->part_id)
+			data->part_id = g_idle_add(phonebook_pull_next_part,
+									data);
+		return 0;
+	}
+
 	DBG("retrieving all contacts");
 
 	/* Fetch async contacts from default address book */
@@ -126,6 +126,7 @@ static char *option_noplugin = NULL;
 
 static gboolean option_autoaccept = FALSE;
 static gboolean option_symlinks = FALSE;
+static int option_srm_window = 0;
 
 static gboolean parse_debug(const char *key, const char *value,
 				gpointer user_data, GError **error)
@@ -164,6 +165,9 @@ static GOptionEntry options[] = {
 				"scripts", "FILE" },
 	{ "auto-accept", 'a', 0, G_OPTION_ARG_NONE, &option_autoaccept,
 				"Automatically accept push requests" },
+	{ "srm-window", 'w', 0, G_OPTION_ARG_INT, &option_srm_window,
+				"Packets sent back to back with Single "
+				"Response Mode", "NUM" },
 	{ NULL },
 };
 
@@ -187,6 +191,11 @@ const char *obex_option_capability(void)
 	return option_capability;
 }
 
+int obex_option_srm_window(void)
+{
+	return option_srm_window;
+}
+
 static gboolean is_dir(const char *dir)
 {
 	struct stat st;
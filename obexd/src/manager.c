@@ -41,6 +41,9 @@
 
 #define TIMEOUT 60*1000 /* Timeout for user response (miliseconds) */
 
+#define PROGRESS_INTERVAL 250 /* Progress update interval (miliseconds) */
+#define PROGRESS_STEP 100 /* Progress update step (fraction of the size) */
+
 struct agent {
 	char *bus_name;
 	char *path;
@@ -61,6 +64,10 @@ struct obex_transfer {
 	uint8_t status;
 	char *path;
 	struct obex_session *session;
+	int64_t progress;	/* Last reported offset */
+	gint64 progress_time;	/* Time of the last report */
+	guint progress_interval;	/* Minimum report interval (ms) */
+	guint progress_step;	/* Fraction of the size always reported */
 };
 
 static struct agent *agent = NULL;
@@ -546,6 +553,12 @@ static void emit_transfer_completed(struct obex_transfer *transfer,
 	transfer->status = success ? TRANSFER_STATUS_COMPLETE :
 						TRANSFER_STATUS_ERROR;
 
+	/* Flush any progress that was held back */
+	if (transfer->session->offset != transfer->progress) {
+		transfer->progress = transfer->session->offset;
+		manager_emit_transfer_property(transfer, "Transferred");
+	}
+
 	manager_emit_transfer_property(transfer, "Status");
 }
 
@@ -564,6 +577,8 @@ struct obex_transfer *manager_register_transfer(struct obex_session *os)
 	transfer->path = g_strdup_printf("%s/session%u/transfer%u",
 					SESSION_BASE_PATH, os->id, id++);
 	transfer->session = os;
+	transfer->progress_interval = PROGRESS_INTERVAL;
+	transfer->progress_step = PROGRESS_STEP;
 
 	if (!g_dbus_register_interface(connection, transfer->path,
 				TRANSFER_INTERFACE,
@@ -768,6 +783,29 @@ void manager_unregister_session(struct obex_session *os)
 
 void manager_emit_transfer_progress(struct obex_transfer *transfer)
 {
+	struct obex_session *os = transfer->session;
+	int64_t delta = os->offset - transfer->progress;
+	gint64 now, elapsed;
+
+	if (delta == 0)
+		return;
+
+	/*
+	 * Drivers report progress for every packet, so coalesce the updates
+	 * to at most one per interval unless a whole step of the object size
+	 * was transferred since the last one.
+	 */
+	now = g_get_monotonic_time();
+	elapsed = (now - transfer->progress_time) / 1000;
+
+	if (elapsed < transfer->progress_interval) {
+		if (os->size <= 0 || delta < os->size / transfer->progress_step)
+			return;
+	}
+
+	transfer->progress = os->offset;
+	transfer->progress_time = now;
+
 	manager_emit_transfer_property(transfer, "Transferred");
 }
 
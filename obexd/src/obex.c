@@ -381,6 +381,36 @@ static gssize send_data(void *buf, gsize size, gpointer user_data)
 	return driver_read(os, buf, size);
 }
 
+/* Hands out file regions so the body is sent without copying it */
+static gssize send_file(int *fd, off_t *offset, gsize size,
+							gpointer user_data)
+{
+	struct obex_session *os = user_data;
+	gssize len;
+
+	DBG("name=%s type=%s file=%p size=%zu", os->name, os->type, os->object,
+									size);
+
+	if (os->aborted)
+		return os->err < 0 ? os->err : -EPERM;
+
+	if (os->object == NULL)
+		return -EIO;
+
+	if (os->service->progress != NULL)
+		os->service->progress(os, os->service_data);
+
+	*fd = os->driver->get_fd(os->object);
+	*offset = os->offset;
+
+	len = MIN((int64_t) size, os->size - os->offset);
+	os->offset += len;
+
+	DBG("%zd read", len);
+
+	return len;
+}
+
 static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 {
 	struct obex_session *os = user_data;
@@ -456,8 +486,12 @@ done:
 		g_obex_packet_add_header(rsp, hdr);
 	}
 
-	g_obex_get_rsp_pkt(os->obex, rsp, send_data, transfer_complete, os,
-									NULL);
+	if (os->driver->get_fd && os->size != OBJECT_SIZE_UNKNOWN)
+		g_obex_get_rsp_pkt_fd(os->obex, rsp, send_file,
+						transfer_complete, os, NULL);
+	else
+		g_obex_get_rsp_pkt(os->obex, rsp, send_data,
+						transfer_complete, os, NULL);
 
 	os->headers_sent = TRUE;
 
@@ -987,6 +1021,9 @@ int obex_session_start(GIOChannel *io, uint16_t tx_mtu, uint16_t rx_mtu,
 		return -EIO;
 	}
 
+	if (obex_option_srm_window() > 0)
+		g_obex_set_tx_window(obex, obex_option_srm_window());
+
 	g_obex_set_disconnect_function(obex, disconn_func, os);
 	g_obex_add_request_function(obex, G_OBEX_OP_CONNECT, cmd_connect, os);
 	g_obex_add_request_function(obex, G_OBEX_OP_DISCONNECT, cmd_disconnect,
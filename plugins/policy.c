@@ -14,6 +14,8 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -44,12 +46,19 @@
 #define CT_RETRIES 1
 #define TG_RETRIES CT_RETRIES
 
+/* Release the slot of an attempt that never reported back, in seconds */
+#define RECONNECT_CONNECT_TIMEOUT 30
+
 struct reconnect_data {
 	struct btd_device *dev;
 	bool reconnect;
 	GSList *services;
-	unsigned int timer;
 	bool active;
+	bool queued;
+	bool connecting;
+	int64_t due;
+	int64_t started;
+	unsigned int priority;
 	unsigned int attempt;
 	bool on_resume;
 };
@@ -69,7 +78,12 @@ static size_t reconnect_intervals_len = 0;
 static const int default_resume_delay = 2;
 static int resume_delay;
 
+static const int default_concurrency = 2;
+static int reconnect_concurrency;
+
+/* All reconnects are started from a single timer, see reconnect_dispatch */
 static GSList *reconnects = NULL;
+static unsigned int reconnect_timer = 0;
 
 static unsigned int service_id = 0;
 static GSList *devices = NULL;
@@ -542,15 +556,86 @@ static void target_cb(struct btd_service *service,
 	}
 }
 
+static int64_t reconnect_now(void)
+{
+	return g_get_monotonic_time() / 1000;
+}
+
+static unsigned int reconnect_inflight(struct btd_adapter *adapter)
+{
+	unsigned int count = 0;
+	GSList *l;
+
+	for (l = reconnects; l; l = g_slist_next(l)) {
+		struct reconnect_data *reconnect = l->data;
+
+		if (reconnect->connecting &&
+				device_get_adapter(reconnect->dev) == adapter)
+			count++;
+	}
+
+	return count;
+}
+
+static bool reconnect_blocked(struct reconnect_data *reconnect)
+{
+	struct btd_adapter *adapter = device_get_adapter(reconnect->dev);
+
+	return reconnect_inflight(adapter) >= (unsigned int)
+							reconnect_concurrency;
+}
+
+static bool reconnect_dispatch(gpointer user_data);
+
+/*
+ * Arm the timer for the next reconnect that is due, or for the next attempt
+ * whose slot should be reclaimed. Reconnects that are due but wait for a
+ * free slot are left out, finishing an attempt rearms the timer.
+ */
+static void reconnect_arm(void)
+{
+	int64_t now = reconnect_now();
+	int64_t next = INT64_MAX;
+	GSList *l;
+
+	if (reconnect_timer > 0) {
+		timeout_remove(reconnect_timer);
+		reconnect_timer = 0;
+	}
+
+	for (l = reconnects; l; l = g_slist_next(l)) {
+		struct reconnect_data *reconnect = l->data;
+		int64_t when;
+
+		if (reconnect->connecting)
+			when = reconnect->started +
+					RECONNECT_CONNECT_TIMEOUT * 1000;
+		else if (!reconnect->queued)
+			continue;
+		else if (reconnect->due <= now && reconnect_blocked(reconnect))
+			continue;
+		else
+			when = reconnect->due;
+
+		if (when < next)
+			next = when;
+	}
+
+	if (next == INT64_MAX)
+		return;
+
+	reconnect_timer = timeout_add(next > now ? next - now : 0,
+						reconnect_dispatch, NULL, NULL);
+}
+
 static void reconnect_reset(struct reconnect_data *reconnect)
 {
 	reconnect->attempt = 0;
 	reconnect->active = false;
+	reconnect->queued = false;
+	reconnect->connecting = false;
 
-	if (reconnect->timer > 0) {
-		timeout_remove(reconnect->timer);
-		reconnect->timer = 0;
-	}
+	reconnect_arm();
 }
 
 static bool reconnect_match(const char *uuid)
@@ -593,9 +678,6 @@ static void reconnect_destroy(gpointer data)
 {
 	struct reconnect_data *reconnect = data;
 
-	if (reconnect->timer > 0)
-		timeout_remove(reconnect->timer);
-
 	g_slist_free_full(reconnect->services,
 					(GDestroyNotify) btd_service_unref);
 	g_free(reconnect);
@@ -623,10 +705,10 @@ static void reconnect_remove(struct btd_service *service)
 
 	reconnects = g_slist_remove(reconnects, reconnect);
 
-	if (reconnect->timer > 0)
-		timeout_remove(reconnect->timer);
-
 	g_free(reconnect);
+
+	/* It might have held a slot or the earliest deadline */
+	reconnect_arm();
 }
 
 static void service_cb(struct btd_service *service,
@@ -683,6 +765,12 @@ static void service_cb(struct btd_service *service,
 	reconnect = reconnect_add(service);
 
 	reconnect->active = false;
+	reconnect->queued = false;
+
+	if (reconnect->connecting) {
+		reconnect->connecting = false;
+		reconnect_arm();
+	}
 
 	/*
 	 * Should this device be reconnected? A matching UUID might not
@@ -695,15 +783,13 @@ static void service_cb(struct btd_service *service,
 	DBG("Added %s reconnect %u", profile->name, reconnect->reconnect);
 }
 
-static bool reconnect_timeout(gpointer data)
+static void reconnect_start(struct reconnect_data *reconnect)
 {
-	struct reconnect_data *reconnect = data;
 	int err;
 
 	DBG("Reconnecting profiles");
 
-	/* Mark the GSource as invalid */
-	reconnect->timer = 0;
+	reconnect->queued = false;
 
 	/* Mark any reconnect on resume as handled */
 	reconnect->on_resume = false;
@@ -713,31 +799,126 @@ static bool reconnect_timeout(gpointer data)
 		error("Reconnecting services failed: %s (%d)",
 							strerror(-err), -err);
 		reconnect_reset(reconnect);
-		return FALSE;
+		return;
 	}
 
+	reconnect->connecting = true;
+	reconnect->started = reconnect_now();
 	reconnect->attempt++;
+}
+
+static bool reconnect_before(struct reconnect_data *a,
+						struct reconnect_data *b)
+{
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+
+	return a->due < b->due;
+}
+
+/*
+ * Start the due reconnects, best priority first, as long as their adapter
+ * has less than ReconnectConcurrency attempts in flight, so that after an
+ * adapter reset the bonded devices don't all page at once.
+ */
+static bool reconnect_dispatch(gpointer user_data)
+{
+	int64_t now = reconnect_now();
+	GSList *l;
+
+	reconnect_timer = 0;
+
+	for (l = reconnects; l; l = g_slist_next(l)) {
+		struct reconnect_data *reconnect = l->data;
+
+		if (reconnect->connecting && now - reconnect->started >=
+					RECONNECT_CONNECT_TIMEOUT * 1000) {
+			DBG("%s attempt timed out",
+					device_get_path(reconnect->dev));
+			reconnect->connecting = false;
+		}
+	}
+
+	while (1) {
+		struct reconnect_data *best = NULL;
+
+		for (l = reconnects; l; l = g_slist_next(l)) {
+			struct reconnect_data *reconnect = l->data;
+
+			if (!reconnect->queued || reconnect->due > now)
+				continue;
+
+			if (best && !reconnect_before(reconnect, best))
+				continue;
+
+			if (reconnect_blocked(reconnect))
+				continue;
+
+			best = reconnect;
+		}
+
+		if (!best)
+			break;
+
+		reconnect_start(best);
+	}
+
+	reconnect_arm();
 
 	return FALSE;
 }
 
+/* Lower is better: the position of the best profile in ReconnectUUIDs */
+static unsigned int reconnect_priority(struct reconnect_data *reconnect)
+{
+	unsigned int priority = UINT_MAX;
+	GSList *l;
+
+	for (l = reconnect->services; l; l = g_slist_next(l)) {
+		struct btd_profile *profile = btd_service_get_profile(l->data);
+		unsigned int i;
+
+		for (i = 0; reconnect_uuids[i] && i < priority; i++) {
+			if (!bt_uuid_strcmp(profile->remote_uuid,
+							reconnect_uuids[i])) {
+				priority = i;
+				break;
+			}
+		}
+	}
+
+	return priority;
+}
+
 static void reconnect_set_timer(struct reconnect_data *reconnect, int timeout)
 {
 	static int interval_timeout = 0;
+	int64_t delay;
 
 	reconnect->active = true;
+	reconnect->connecting = false;
 
 	if (reconnect->attempt < reconnect_intervals_len)
 		interval_timeout = reconnect_intervals[reconnect->attempt];
 
-	if (timeout < 0)
-		timeout = interval_timeout;
+	if (timeout < 0) {
+		/*
+		 * Spread the backoff by +/- 25% so that devices which lost
+		 * their link at the same time don't retry in lockstep.
+		 */
+		delay = interval_timeout * 1000;
+		delay = delay * 3 / 4 + g_random_int_range(0, delay / 2 + 1);
+	} else
+		delay = timeout * 1000;
+
+	DBG("attempt %u/%zu %" PRId64 " ms", reconnect->attempt + 1,
+						reconnect_attempts, delay);
 
-	DBG("attempt %u/%zu %d seconds", reconnect->attempt + 1,
-						reconnect_attempts, timeout);
+	reconnect->due = reconnect_now() + delay;
+	reconnect->priority = reconnect_priority(reconnect);
+	reconnect->queued = true;
 
-	reconnect->timer = timeout_add_seconds(timeout, reconnect_timeout,
-						reconnect, NULL);
+	reconnect_arm();
 }
 
 static void disconnect_cb(struct btd_device *dev, uint8_t reason)
@@ -858,6 +1039,7 @@ static int policy_init(void)
 						sizeof(*reconnect_intervals);
 		reconnect_intervals = util_memdup(default_intervals,
 						sizeof(default_intervals));
+		reconnect_concurrency = default_concurrency;
 		goto done;
 	}
 
@@ -901,6 +1083,14 @@ static int policy_init(void)
 		g_clear_error(&gerr);
 		resume_delay = default_resume_delay;
 	}
+
+	reconnect_concurrency = g_key_file_get_integer(conf, "Policy",
+							"ReconnectConcurrency",
+							&gerr);
+	if (gerr || reconnect_concurrency < 1) {
+		g_clear_error(&gerr);
+		reconnect_concurrency = default_concurrency;
+	}
 done:
 	if (reconnect_uuids && reconnect_uuids[0] && reconnect_attempts) {
 		btd_add_disconnect_cb(disconnect_cb);
@@ -922,6 +1112,9 @@ static void policy_exit(void)
 
 	free(reconnect_intervals);
 
+	if (reconnect_timer > 0)
+		timeout_remove(reconnect_timer);
+
 	g_slist_free_full(reconnects, reconnect_destroy);
 
 	g_slist_free_full(devices, policy_remove);
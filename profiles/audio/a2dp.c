@@ -40,6 +40,7 @@
 #include "src/service.h"
 #include "src/log.h"
 #include "src/sdpd.h"
+#include "src/storage.h"
 #include "src/shared/queue.h"
 #include "src/shared/timeout.h"
 #include "src/shared/util.h"
@@ -102,6 +103,7 @@ struct a2dp_setup {
 	avdtp_set_configuration_cb setconf_cb;
 	GSList *seps;
 	GSList *caps;
+	bool cached_config;
 	gboolean reconfigure;
 	gboolean start;
 	GSList *cb;
@@ -134,6 +136,8 @@ struct a2dp_remote_sep {
 struct a2dp_last_used {
 	struct a2dp_sep *lsep;
 	struct a2dp_remote_sep *rsep;
+	uint8_t *config;
+	size_t config_len;
 };
 
 struct a2dp_channel {
@@ -826,7 +830,7 @@ static void store_remote_seps(struct a2dp_channel *chan)
 	char dst_addr[18];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	char *data;
+	char *data, *config;
 	gsize length = 0;
 
 	ba2str(device_get_address(device), dst_addr);
@@ -835,7 +839,7 @@ static void store_remote_seps(struct a2dp_channel *chan)
 			btd_adapter_get_storage_dir(device_get_adapter(device)),
 			dst_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -843,6 +847,8 @@ static void store_remote_seps(struct a2dp_channel *chan)
 
 	data = g_key_file_get_string(key_file, "Endpoints", "LastUsed",
 								NULL);
+	config = g_key_file_get_string(key_file, "Endpoints",
+						"LastUsedConfig", NULL);
 
 	/* Remove current endpoints since it might have changed */
 	g_key_file_remove_group(key_file, "Endpoints", NULL);
@@ -855,8 +861,14 @@ static void store_remote_seps(struct a2dp_channel *chan)
 		g_free(data);
 	}
 
+	if (config) {
+		g_key_file_set_string(key_file, "Endpoints", "LastUsedConfig",
+						config);
+		g_free(config);
+	}
+
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, data, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -866,12 +878,136 @@ static void store_remote_seps(struct a2dp_channel *chan)
 	g_key_file_free(key_file);
 }
 
+static void store_last_used(struct a2dp_channel *chan)
+{
+	struct a2dp_last_used *last_used = chan->last_used;
+	GKeyFile *key_file;
+	GError *gerr = NULL;
+	char filename[PATH_MAX];
+	char dst_addr[18];
+	char value[6];
+	char config[512];
+	char *data;
+	size_t i, len = 0;
+
+	ba2str(device_get_address(chan->device), dst_addr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+		btd_adapter_get_storage_dir(device_get_adapter(chan->device)),
+		dst_addr);
+	key_file = g_key_file_new();
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
+		error("Unable to load key file from %s: (%s)", filename,
+								gerr->message);
+		g_clear_error(&gerr);
+	}
+
+	sprintf(value, "%02hhx:%02hhx",
+				avdtp_sep_get_seid(last_used->lsep->lsep),
+				avdtp_get_seid(last_used->rsep->sep));
+
+	g_key_file_set_string(key_file, "Endpoints", "LastUsed", value);
+
+	if (last_used->config) {
+		for (i = 0; i < last_used->config_len; i++)
+			sprintf(config + i * 2, "%02hhx", last_used->config[i]);
+
+		g_key_file_set_string(key_file, "Endpoints", "LastUsedConfig",
+								config);
+	} else
+		g_key_file_remove_key(key_file, "Endpoints", "LastUsedConfig",
+								NULL);
+
+	data = g_key_file_to_data(key_file, &len, NULL);
+	if (!btd_storage_set_contents(filename, data, len, &gerr)) {
+		error("Unable set contents for %s: (%s)", filename,
+								gerr->message);
+		g_error_free(gerr);
+	}
+
+	g_free(data);
+	g_key_file_free(key_file);
+}
+
+static void add_last_used(struct a2dp_channel *chan, struct a2dp_sep *lsep,
+				struct a2dp_remote_sep *rsep)
+{
+	if (!chan->last_used)
+		chan->last_used = new0(struct a2dp_last_used, 1);
+
+	chan->last_used->lsep = lsep;
+	chan->last_used->rsep = rsep;
+}
+
+static void set_last_used_config(struct a2dp_channel *chan,
+					const uint8_t *config, size_t len)
+{
+	free(chan->last_used->config);
+	chan->last_used->config = len ? util_memdup(config, len) : NULL;
+	chan->last_used->config_len = len;
+}
+
+static void free_last_used(struct a2dp_last_used *last_used)
+{
+	if (!last_used)
+		return;
+
+	free(last_used->config);
+	free(last_used);
+}
+
+static void update_last_used(struct a2dp_channel *chan, struct a2dp_sep *lsep,
+					struct avdtp_stream *stream)
+{
+	struct avdtp_remote_sep *rsep;
+	struct a2dp_remote_sep *sep;
+	struct avdtp_service_capability *service;
+	struct avdtp_media_codec_capability *codec;
+	size_t len;
+
+	rsep = avdtp_stream_get_remote_sep(stream);
+	sep = queue_find(chan->seps, match_remote_sep, rsep);
+	if (!sep) {
+		error("Unable to find remote SEP");
+		return;
+	}
+
+	service = avdtp_stream_get_codec(stream);
+	if (!service)
+		return;
+
+	codec = (void *) service->data;
+	len = service->length - sizeof(*codec);
+
+	/* Check if already stored then skip */
+	if (chan->last_used && (chan->last_used->lsep == lsep &&
+				chan->last_used->rsep == sep) &&
+				chan->last_used->config_len == len &&
+				!memcmp(chan->last_used->config, codec->data,
+								len))
+		return;
+
+	add_last_used(chan, lsep, sep);
+	set_last_used_config(chan, codec->data, len);
+
+	store_last_used(chan);
+}
+
 static void invalidate_remote_cache(struct a2dp_setup *setup,
 						struct avdtp_error *err)
 {
 	if (err->category == AVDTP_ERRNO)
 		return;
 
+	/* Drop the cached configuration so the next attempt selects a new
+	 * one.
+	 */
+	if (setup->cached_config && setup->chan && setup->chan->last_used) {
+		warn("Invalidating last used configuration");
+		set_last_used_config(setup->chan, NULL, 0);
+		store_last_used(setup->chan);
+	}
+
 	/* Attempt to unregister Remote SEP if configuration fails and it was
 	 * loaded from cache.
 	 */
@@ -990,78 +1126,6 @@ static void getconf_cfm(struct avdtp *session, struct avdtp_local_sep *sep,
 		DBG("Source %p: Set_Configuration_Cfm", sep);
 }
 
-static void store_last_used(struct a2dp_channel *chan, uint8_t lseid,
-							uint8_t rseid)
-{
-	GKeyFile *key_file;
-	GError *gerr = NULL;
-	char filename[PATH_MAX];
-	char dst_addr[18];
-	char value[6];
-	char *data;
-	size_t len = 0;
-
-	ba2str(device_get_address(chan->device), dst_addr);
-
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
-		btd_adapter_get_storage_dir(device_get_adapter(chan->device)),
-		dst_addr);
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
-		error("Unable to load key file from %s: (%s)", filename,
-								gerr->message);
-		g_clear_error(&gerr);
-	}
-
-	sprintf(value, "%02hhx:%02hhx", lseid, rseid);
-
-	g_key_file_set_string(key_file, "Endpoints", "LastUsed", value);
-
-	data = g_key_file_to_data(key_file, &len, NULL);
-	if (!g_file_set_contents(filename, data, len, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-
-	g_free(data);
-	g_key_file_free(key_file);
-}
-
-static void add_last_used(struct a2dp_channel *chan, struct a2dp_sep *lsep,
-				struct a2dp_remote_sep *rsep)
-{
-	if (!chan->last_used)
-		chan->last_used = new0(struct a2dp_last_used, 1);
-
-	chan->last_used->lsep = lsep;
-	chan->last_used->rsep = rsep;
-}
-
-static void update_last_used(struct a2dp_channel *chan, struct a2dp_sep *lsep,
-					struct avdtp_stream *stream)
-{
-	struct avdtp_remote_sep *rsep;
-	struct a2dp_remote_sep *sep;
-
-	rsep = avdtp_stream_get_remote_sep(stream);
-	sep = queue_find(chan->seps, match_remote_sep, rsep);
-	if (!sep) {
-		error("Unable to find remote SEP");
-		return;
-	}
-
-	/* Check if already stored then skip */
-	if (chan->last_used && (chan->last_used->lsep == lsep &&
-				chan->last_used->rsep == sep))
-		return;
-
-	add_last_used(chan, lsep, sep);
-
-	store_last_used(chan, avdtp_sep_get_seid(lsep->lsep),
-					avdtp_get_seid(rsep));
-}
-
 static gboolean open_ind(struct avdtp *session, struct avdtp_local_sep *sep,
 				struct avdtp_stream *stream, uint8_t *err,
 				void *user_data)
@@ -1690,7 +1754,7 @@ static void channel_free(void *data)
 	avdtp_remove_state_cb(chan->state_id);
 
 	queue_destroy(chan->seps, remove_remote_sep);
-	free(chan->last_used);
+	free_last_used(chan->last_used);
 
 	setup = find_setup_by_session(chan->session);
 	if (setup) {
@@ -2149,8 +2213,10 @@ static void load_remote_sep(struct a2dp_channel *chan, GKeyFile *key_file,
 	struct a2dp_remote_sep *sep;
 	struct avdtp_remote_sep *rsep;
 	uint8_t lseid, rseid;
+	uint8_t data[128];
 	char *value;
 	bool update = false;
+	int i, size;
 
 	if (!seids)
 		return;
@@ -2161,8 +2227,6 @@ static void load_remote_sep(struct a2dp_channel *chan, GKeyFile *key_file,
 		uint8_t delay_reporting;
 		GSList *l = NULL;
 		char caps[256];
-		uint8_t data[128];
-		int i, size;
 
 		if (sscanf(*seids, "%02hhx", &rseid) != 1)
 			continue;
@@ -2249,6 +2313,26 @@ static void load_remote_sep(struct a2dp_channel *chan, GKeyFile *key_file,
 	DBG("LastUsed: lseid %u rseid %u", lseid, rseid);
 
 	add_last_used(chan, lsep, sep);
+
+	value = g_key_file_get_string(key_file, "Endpoints", "LastUsedConfig",
+								NULL);
+	if (!value)
+		return;
+
+	for (i = 0, size = strlen(value); i < size &&
+					i / 2 < (int) sizeof(data); i += 2) {
+		if (sscanf(value + i, "%02hhx", data + i / 2) != 1)
+			break;
+	}
+
+	g_free(value);
+
+	if (i != size) {
+		warn("Unable to load LastUsedConfig");
+		return;
+	}
+
+	set_last_used_config(chan, data, size / 2);
 }
 
 static void load_remote_seps(struct a2dp_channel *chan)
@@ -2266,7 +2350,7 @@ static void load_remote_seps(struct a2dp_channel *chan)
 			btd_adapter_get_storage_dir(device_get_adapter(device)),
 			dst_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -2796,6 +2880,38 @@ done:
 	setup_unref(setup);
 }
 
+/* Reuse the configuration of the last connection so reconnecting does not
+ * wait for the endpoint to select one.
+ */
+static bool select_cached(struct a2dp_setup *setup)
+{
+	struct a2dp_last_used *last_used = setup->chan->last_used;
+
+	setup->cached_config = false;
+
+	if (!btd_opts.avdtp.fast_reconnect || !last_used ||
+						!last_used->config)
+		return false;
+
+	if (last_used->lsep != setup->sep || last_used->rsep != setup->rsep)
+		return false;
+
+	DBG("Using last used configuration");
+
+	caps_add_codec(&setup->caps, setup->sep->codec, last_used->config,
+							last_used->config_len);
+	setup->cached_config = true;
+
+	return true;
+}
+
+static gboolean finalize_select_cached(gpointer data)
+{
+	finalize_select(data);
+
+	return FALSE;
+}
+
 static struct queue *a2dp_find_eps(struct avdtp *session, GSList *list,
 					const char *sender)
 {
@@ -2949,6 +3065,11 @@ unsigned int a2dp_select_capabilities(struct avdtp *session,
 		goto fail;
 	}
 
+	if (select_cached(setup)) {
+		cb_data->source_id = g_idle_add(finalize_select_cached, setup);
+		return cb_data->id;
+	}
+
 	service = avdtp_get_codec(setup->rsep->sep);
 	codec = (struct avdtp_media_codec_capability *) service->data;
 
@@ -3557,5 +3678,11 @@ static void a2dp_exit(void)
 	btd_profile_unregister(&a2dp_sink_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(a2dp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-		a2dp_init, a2dp_exit)
+static const char * const a2dp_uuids[] = {
+	A2DP_SOURCE_UUID,
+	A2DP_SINK_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_UUIDS(a2dp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+					a2dp_init, a2dp_exit, a2dp_uuids)
@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -79,6 +80,16 @@
 #define DISCONNECT_TIMEOUT 1
 #define START_TIMEOUT 1
 
+/* Requests preallocated per session and payload stored in place */
+#define REQ_SLOTS 16
+#define REQ_DATA_SIZE 64
+
+/* GET_CAPABILITIES requests sent without waiting for each response */
+#define GETCAP_PIPELINE 8
+
+/* Request round trip times kept per session */
+#define RTT_SAMPLES 16
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 struct avdtp_common_header {
@@ -300,6 +311,10 @@ struct pending_req {
 	struct avdtp_stream *stream; /* Set if the request targeted a stream */
 	unsigned int timeout;
 	gboolean collided;
+	bool slot;
+	bool in_use;
+	gint64 sent;		/* Monotonic time the request was sent */
+	uint8_t buf[REQ_DATA_SIZE];
 };
 
 struct avdtp_remote_sep {
@@ -344,6 +359,7 @@ struct discover_callback {
 	unsigned int id;
 	avdtp_discover_cb_t cb;
 	void *user_data;
+	bool cached;	/* Keep SEPs that have not been discovered */
 };
 
 struct avdtp_stream {
@@ -403,12 +419,21 @@ struct avdtp {
 
 	struct discover_callback *discover;
 	struct pending_req *req;
+	GSList *getcap_reqs; /* Pipelined GET_CAPABILITIES in flight */
+
+	struct pending_req slots[REQ_SLOTS];
 
 	unsigned int dc_timer;
 	int dc_timeout;
 
 	/* Attempt stream setup instead of disconnecting */
 	gboolean stream_setup;
+
+	/* SEPs loaded from cache have been used without discovery */
+	bool cache_used;
+
+	uint32_t rtt[RTT_SAMPLES]; /* Round trip times in microseconds */
+	unsigned int rtt_count;
 };
 
 static GSList *state_callbacks = NULL;
@@ -425,6 +450,8 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 					uint8_t transaction, uint8_t signal_id,
 					void *buf, int size);
 static int process_queue(struct avdtp *session);
+static gboolean getcap_resp(struct avdtp *session, uint8_t transaction,
+							uint8_t message_type);
 static void avdtp_sep_set_state(struct avdtp *session,
 				struct avdtp_local_sep *sep,
 				avdtp_state_t state);
@@ -449,12 +476,21 @@ static const char *avdtp_statestr(avdtp_state_t state)
 	}
 }
 
-static gboolean try_send(int sk, void *data, size_t len)
+static gboolean try_send(int sk, void *hdr, size_t hdr_len, void *data,
+								size_t len)
 {
+	struct iovec iov[2];
 	int err;
 
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = hdr_len;
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+
+	len += hdr_len;
+
 	do {
-		err = send(sk, data, len, 0);
+		err = writev(sk, iov, data ? 2 : 1);
 	} while (err < 0 && errno == EINTR);
 
 	if (err < 0) {
@@ -496,12 +532,7 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 		single.message_type = message_type;
 		single.signal_id = signal_id;
 
-		memcpy(session->buf, &single, sizeof(single));
-
-		if (data)
-			memcpy(session->buf + sizeof(single), data, len);
-
-		return try_send(sock, session->buf, sizeof(single) + len);
+		return try_send(sock, &single, sizeof(single), data, len);
 	}
 
 	/* Check if there is enough space to start packet */
@@ -524,11 +555,8 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 	start.no_of_packets = cont_fragments + 1;
 	start.signal_id = signal_id;
 
-	memcpy(session->buf, &start, sizeof(start));
-	memcpy(session->buf + sizeof(start), data,
-					session->omtu - sizeof(start));
-
-	if (!try_send(sock, session->buf, session->omtu))
+	if (!try_send(sock, &start, sizeof(start), data,
+					session->omtu - sizeof(start)))
 		return FALSE;
 
 	DBG("first packet with %zu bytes sent", session->omtu - sizeof(start));
@@ -553,10 +581,7 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 		cont.transaction = transaction;
 		cont.message_type = message_type;
 
-		memcpy(session->buf, &cont, sizeof(cont));
-		memcpy(session->buf + sizeof(cont), data + sent, to_copy);
-
-		if (!try_send(sock, session->buf, to_copy + sizeof(cont)))
+		if (!try_send(sock, &cont, sizeof(cont), data + sent, to_copy))
 			return FALSE;
 
 		sent += to_copy;
@@ -565,14 +590,61 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 	return TRUE;
 }
 
+static struct pending_req *pending_req_new(struct avdtp *session,
+						void *data, size_t size)
+{
+	struct pending_req *req = NULL;
+	size_t i;
+
+	for (i = 0; i < REQ_SLOTS; i++) {
+		if (!session->slots[i].in_use) {
+			req = &session->slots[i];
+			memset(req, 0, sizeof(*req));
+			req->slot = true;
+			break;
+		}
+	}
+
+	if (!req)
+		req = g_new0(struct pending_req, 1);
+
+	req->in_use = true;
+	req->data_size = size;
+
+	if (size <= sizeof(req->buf)) {
+		if (size)
+			memcpy(req->buf, data, size);
+		req->data = req->buf;
+	} else
+		req->data = util_memdup(data, size);
+
+	return req;
+}
+
 static void pending_req_free(void *data)
 {
 	struct pending_req *req = data;
 
 	if (req->timeout)
 		timeout_remove(req->timeout);
-	free(req->data);
-	g_free(req);
+
+	if (req->data != req->buf)
+		free(req->data);
+
+	if (req->slot)
+		req->in_use = false;
+	else
+		g_free(req);
+}
+
+static void update_rtt(struct avdtp *session, struct pending_req *req)
+{
+	uint32_t rtt = g_get_monotonic_time() - req->sent;
+
+	session->rtt[session->rtt_count++ % RTT_SAMPLES] = rtt;
+
+	DBG("signal 0x%02x transaction %u RTT %u us", req->signal_id,
+						req->transaction, rtt);
 }
 
 static void close_stream(struct avdtp_stream *stream)
@@ -1082,7 +1154,7 @@ static void finalize_discovery(struct avdtp *session, int err)
 	if (discover->id > 0)
 		g_source_remove(discover->id);
 
-	if (!err)
+	if (!err && !discover->cached)
 		g_slist_foreach(session->seps, remove_disappeared, session);
 
 	if (discover->cb)
@@ -1138,6 +1210,7 @@ static void avdtp_free(void *data)
 	if (session->req)
 		pending_req_free(session->req);
 
+	g_slist_free_full(session->getcap_reqs, pending_req_free);
 	g_slist_free_full(session->req_queue, pending_req_free);
 	g_slist_free_full(session->prio_queue, pending_req_free);
 	g_slist_free_full(session->seps, sep_free);
@@ -1160,6 +1233,9 @@ static void connection_lost(struct avdtp *session, int err)
 	g_slist_foreach(session->streams, (GFunc) release_stream, session);
 	session->streams = NULL;
 
+	g_slist_free_full(session->getcap_reqs, pending_req_free);
+	session->getcap_reqs = NULL;
+
 	finalize_discovery(session, err);
 
 	avdtp_set_state(session, AVDTP_SESSION_STATE_DISCONNECTED);
@@ -2207,6 +2283,14 @@ static enum avdtp_parse_result avdtp_parse_data(struct avdtp *session,
 	return PARSE_SUCCESS;
 }
 
+static int pending_req_transaction_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct pending_req *req = a;
+	uint8_t transaction = GPOINTER_TO_UINT(b);
+
+	return req->transaction == transaction ? 0 : -1;
+}
+
 static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 				gpointer data)
 {
@@ -2263,6 +2347,14 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		return TRUE;
 	}
 
+	if (session->getcap_reqs) {
+		if (!getcap_resp(session, header->transaction,
+						header->message_type))
+			goto failed;
+
+		return TRUE;
+	}
+
 	if (session->req == NULL) {
 		error("No pending request, ignoring message");
 		return TRUE;
@@ -2281,6 +2373,8 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 	timeout_remove(session->req->timeout);
 	session->req->timeout = 0;
 
+	update_rtt(session, session->req);
+
 	switch (header->message_type) {
 	case AVDTP_MSG_TYPE_ACCEPT:
 		if (!avdtp_parse_resp(session, session->req->stream,
@@ -2465,6 +2559,16 @@ uint16_t avdtp_get_version(struct avdtp *session)
 	return session->version;
 }
 
+size_t avdtp_get_rtt(struct avdtp *session, uint32_t *rtt, size_t len)
+{
+	size_t count = MIN(session->rtt_count, RTT_SAMPLES);
+
+	count = MIN(count, len);
+	memcpy(rtt, session->rtt, count * sizeof(*rtt));
+
+	return count;
+}
+
 static GIOChannel *l2cap_connect(struct avdtp *session, BtIOMode mode)
 {
 	GError *err = NULL;
@@ -2632,10 +2736,18 @@ static bool request_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static uint8_t next_transaction(void)
+{
+	static uint8_t transaction = 0;
+
+	transaction = (transaction + 1) % 16;
+
+	return transaction;
+}
+
 static int send_req(struct avdtp *session, gboolean priority,
 			struct pending_req *req)
 {
-	static int transaction = 0;
 	int err, timeout;
 
 	if (session->state == AVDTP_SESSION_STATE_DISCONNECTED) {
@@ -2655,13 +2767,12 @@ static int send_req(struct avdtp *session, gboolean priority,
 	}
 
 	if (session->state < AVDTP_SESSION_STATE_CONNECTED ||
-			session->req != NULL) {
+			session->req != NULL || session->getcap_reqs) {
 		queue_request(session, req, priority);
 		return 0;
 	}
 
-	req->transaction = transaction++;
-	transaction %= 16;
+	req->transaction = next_transaction();
 
 	/* FIXME: Should we retry to send if the buffer
 	was not totally sent or in case of EINTR? */
@@ -2671,6 +2782,7 @@ static int send_req(struct avdtp *session, gboolean priority,
 		goto failed;
 	}
 
+	req->sent = g_get_monotonic_time();
 	session->req = req;
 
 	switch (req->signal_id) {
@@ -2689,8 +2801,7 @@ static int send_req(struct avdtp *session, gboolean priority,
 	return 0;
 
 failed:
-	free(req->data);
-	g_free(req);
+	pending_req_free(req);
 	return err;
 }
 
@@ -2705,15 +2816,62 @@ static int send_request(struct avdtp *session, gboolean priority,
 		return -EINVAL;
 	}
 
-	req = g_new0(struct pending_req, 1);
+	req = pending_req_new(session, buffer, size);
 	req->signal_id = signal_id;
-	req->data = util_memdup(buffer, size);
-	req->data_size = size;
 	req->stream = stream;
 
 	return send_req(session, priority, req);
 }
 
+static bool getcap_timeout(gpointer user_data)
+{
+	struct avdtp *session = user_data;
+
+	error("GetCapabilities: %s (%d)", strerror(ETIMEDOUT), ETIMEDOUT);
+
+	connection_lost(session, ETIMEDOUT);
+
+	return FALSE;
+}
+
+/*
+ * Sends GET_CAPABILITIES right away while the pipeline has room instead of
+ * waiting for the previous response, as the remote SEPs are independent.
+ */
+static int send_getcap(struct avdtp *session, uint8_t signal_id,
+							uint8_t seid)
+{
+	struct seid_req sreq;
+	struct pending_req *req;
+
+	memset(&sreq, 0, sizeof(sreq));
+	sreq.acp_seid = seid;
+
+	if (session->state != AVDTP_SESSION_STATE_CONNECTED ||
+			session->prio_queue || session->req_queue ||
+			g_slist_length(session->getcap_reqs) >= GETCAP_PIPELINE)
+		return send_request(session, TRUE, NULL, signal_id, &sreq,
+								sizeof(sreq));
+
+	req = pending_req_new(session, &sreq, sizeof(sreq));
+	req->signal_id = signal_id;
+	req->transaction = next_transaction();
+
+	if (!avdtp_send(session, req->transaction, AVDTP_MSG_TYPE_COMMAND,
+				req->signal_id, req->data, req->data_size)) {
+		pending_req_free(req);
+		return -EIO;
+	}
+
+	req->sent = g_get_monotonic_time();
+	req->timeout = timeout_add_seconds(REQ_TIMEOUT, getcap_timeout,
+								session, NULL);
+
+	session->getcap_reqs = g_slist_append(session->getcap_reqs, req);
+
+	return 0;
+}
+
 static gboolean avdtp_discover_resp(struct avdtp *session,
 					struct discover_resp *resp, int size)
 {
@@ -2732,7 +2890,6 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 	for (i = 0; i < sep_count; i++) {
 		struct avdtp_remote_sep *sep;
 		struct avdtp_stream *stream;
-		struct seid_req req;
 
 		DBG("seid %d type %d media %d in use %d",
 				resp->seps[i].seid, resp->seps[i].type,
@@ -2760,11 +2917,7 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 		sep->media_type = resp->seps[i].media_type;
 		sep->discovered = true;
 
-		memset(&req, 0, sizeof(req));
-		req.acp_seid = sep->seid;
-
-		ret = send_request(session, TRUE, NULL, getcap_cmd,
-							&req, sizeof(req));
+		ret = send_getcap(session, getcap_cmd, sep->seid);
 		if (ret < 0)
 			break;
 		getcap_pending = TRUE;
@@ -2777,11 +2930,11 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 }
 
 static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
+						uint8_t seid,
 						struct getcap_resp *resp,
 						unsigned int size)
 {
 	struct avdtp_remote_sep *sep;
-	uint8_t seid;
 
 	/* Check for minimum required packet size includes:
 	 *   1. getcap resp header
@@ -2795,8 +2948,6 @@ static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
 		return FALSE;
 	}
 
-	seid = ((struct seid_req *) session->req->data)->acp_seid;
-
 	sep = find_remote_sep(session->seps, seid);
 
 	DBG("seid %d type %d media %d", sep->seid,
@@ -2815,6 +2966,76 @@ static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
 	return TRUE;
 }
 
+static gboolean getcap_resp(struct avdtp *session, uint8_t transaction,
+							uint8_t message_type)
+{
+	struct pending_req *req, *next;
+	GSList *l;
+
+	l = g_slist_find_custom(session->getcap_reqs,
+					GUINT_TO_POINTER(transaction),
+					pending_req_transaction_cmp);
+	if (!l) {
+		error("Transaction label doesn't match");
+		return TRUE;
+	}
+
+	req = l->data;
+
+	if (session->in.signal_id != req->signal_id) {
+		error("Response signal doesn't match");
+		return TRUE;
+	}
+
+	session->getcap_reqs = g_slist_remove(session->getcap_reqs, req);
+
+	update_rtt(session, req);
+
+	switch (message_type) {
+	case AVDTP_MSG_TYPE_ACCEPT:
+		DBG("GET_CAPABILITIES request succeeded");
+		if (!avdtp_get_capabilities_resp(session, req_get_seid(req),
+						(void *) session->in.buf,
+						session->in.data_size)) {
+			error("Unable to parse accept response");
+			pending_req_free(req);
+			return FALSE;
+		}
+		break;
+	case AVDTP_MSG_TYPE_REJECT:
+		if (!avdtp_parse_rej(session, NULL, transaction,
+						session->in.signal_id,
+						session->in.buf,
+						session->in.data_size)) {
+			error("Unable to parse reject response");
+			pending_req_free(req);
+			return FALSE;
+		}
+		break;
+	case AVDTP_MSG_TYPE_GEN_REJECT:
+		error("Received a General Reject message");
+		break;
+	default:
+		error("Unknown message type 0x%02X", message_type);
+		break;
+	}
+
+	pending_req_free(req);
+
+	if (session->getcap_reqs)
+		return TRUE;
+
+	/* SEPs beyond the pipeline are queried one by one afterwards */
+	next = session->prio_queue ? session->prio_queue->data : NULL;
+	if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
+			next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
+		finalize_discovery(session, 0);
+
+	process_queue(session);
+
+	return TRUE;
+}
+
 static gboolean avdtp_set_configuration_resp(struct avdtp *session,
 						struct avdtp_stream *stream,
 						struct avdtp_single_header *resp,
@@ -2951,7 +3172,9 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 		/* fall through */
 	case AVDTP_GET_CAPABILITIES:
 		DBG("GET_%sCAPABILITIES request succeeded", get_all);
-		if (!avdtp_get_capabilities_resp(session, buf, size))
+		if (!avdtp_get_capabilities_resp(session,
+						req_get_seid(session->req),
+						buf, size))
 			return FALSE;
 		if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
 				next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
@@ -3274,7 +3497,7 @@ static int process_queue(struct avdtp *session)
 	GSList **queue, *l;
 	struct pending_req *req;
 
-	if (session->req)
+	if (session->req || session->getcap_reqs)
 		return 0;
 
 	if (session->prio_queue)
@@ -3389,24 +3612,79 @@ void avdtp_remote_sep_set_destroy(struct avdtp_remote_sep *sep, void *user_data,
 	sep->destroy = destroy;
 }
 
+/*
+ * Discovers in the background after the cached SEPs have been reported, so
+ * SEPs added since then get their capabilities. SEPs that have disappeared
+ * are only dropped by the next discovery since a setup may be using them,
+ * configuring them fails and invalidates the cache anyway.
+ */
+static void validate_cache(struct avdtp *session)
+{
+	session->discover = g_new0(struct discover_callback, 1);
+	session->discover->cached = true;
+
+	if (send_request(session, FALSE, NULL, AVDTP_DISCOVER, NULL, 0) < 0) {
+		g_free(session->discover);
+		session->discover = NULL;
+	}
+}
+
 static gboolean process_discover(gpointer data)
 {
 	struct avdtp *session = data;
+	bool cached = session->discover->cached;
 
 	session->discover->id = 0;
 
+	avdtp_ref(session);
+
 	finalize_discovery(session, 0);
 
+	if (cached && !session->discover)
+		validate_cache(session);
+
+	avdtp_unref(session);
+
 	return FALSE;
 }
 
+static bool discover_from_cache(struct avdtp *session)
+{
+	GSList *l;
+
+	if (!btd_opts.avdtp.fast_reconnect || session->cache_used)
+		return false;
+
+	for (l = session->seps; l; l = g_slist_next(l)) {
+		struct avdtp_remote_sep *sep = l->data;
+
+		if (!sep->codec)
+			return false;
+	}
+
+	DBG("Using cached SEPs");
+
+	session->cache_used = true;
+
+	return true;
+}
+
 int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 			void *user_data)
 {
 	int err;
 
-	if (session->discover)
+	if (session->discover) {
+		/* Wait for the background discovery to complete */
+		if (session->discover->cached && !session->discover->cb) {
+			session->discover->cached = false;
+			session->discover->cb = cb;
+			session->discover->user_data = user_data;
+			return 0;
+		}
+
 		return -EBUSY;
+	}
 
 	session->discover = g_new0(struct discover_callback, 1);
 
@@ -3416,7 +3694,8 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 		/* Check that SEP have been discovered as it may be loaded from
 		 * cache.
 		 */
-		if (sep->discovered) {
+		if (sep->discovered || discover_from_cache(session)) {
+			session->discover->cached = !sep->discovered;
 			session->discover->cb = cb;
 			session->discover->user_data = user_data;
 			session->discover->id = g_idle_add(process_discover,
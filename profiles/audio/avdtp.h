@@ -311,3 +311,4 @@ struct avdtp_server *avdtp_get_server(struct avdtp_local_sep *lsep);
 struct avdtp *avdtp_new(GIOChannel *chan, struct btd_device *device,
 							struct queue *lseps);
 uint16_t avdtp_get_version(struct avdtp *session);
+size_t avdtp_get_rtt(struct avdtp *session, uint32_t *rtt, size_t len);
@@ -176,6 +176,9 @@ struct avrcp_browsing_header {
 } __attribute__ ((packed));
 #define AVRCP_BROWSING_HEADER_LENGTH 3
 
+/* Number of tracks whose attributes are kept, most recent first */
+#define AVRCP_TRACK_CACHE_SIZE 8
+
 struct get_folder_items_rsp {
 	uint8_t status;
 	uint16_t uid_counter;
@@ -228,6 +231,13 @@ struct pending_list_items {
 	uint64_t total;
 };
 
+struct track_cache {
+	uint64_t uid;
+	uint8_t count;
+	size_t len;
+	uint8_t data[0];
+};
+
 struct avrcp_player {
 	struct avrcp_server *server;
 	GSList *sessions;
@@ -244,6 +254,7 @@ struct avrcp_player {
 	struct pending_list_items *p;
 	char *change_path;
 	uint64_t change_uid;
+	GSList *tracks;
 
 	struct avrcp_player_cb *cb;
 	void *user_data;
@@ -2484,6 +2495,80 @@ static void avrcp_get_element_attributes(struct avrcp *session)
 					session);
 }
 
+static void player_set_uid_counter(struct avrcp_player *player,
+							uint16_t uid_counter)
+{
+	if (player->uid_counter == uid_counter)
+		return;
+
+	player->uid_counter = uid_counter;
+
+	/* UIDs are only valid for the UID counter they were listed with */
+	g_slist_free_full(player->tracks, g_free);
+	player->tracks = NULL;
+
+	media_player_uids_changed(player->user_data);
+}
+
+static int track_cache_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct track_cache *track = a;
+	const uint64_t *uid = b;
+
+	return track->uid == *uid ? 0 : -1;
+}
+
+static void player_cache_track(struct avrcp_player *player, uint8_t *data,
+						size_t len, uint8_t count)
+{
+	struct track_cache *track;
+	GSList *l;
+
+	if (!player->uid)
+		return;
+
+	l = g_slist_find_custom(player->tracks, &player->uid, track_cache_cmp);
+	if (l) {
+		g_free(l->data);
+		player->tracks = g_slist_delete_link(player->tracks, l);
+	}
+
+	track = g_malloc(sizeof(*track) + len);
+	track->uid = player->uid;
+	track->count = count;
+	track->len = len;
+	memcpy(track->data, data, len);
+
+	player->tracks = g_slist_prepend(player->tracks, track);
+
+	l = g_slist_nth(player->tracks, AVRCP_TRACK_CACHE_SIZE - 1);
+	if (l && l->next) {
+		g_slist_free_full(l->next, g_free);
+		l->next = NULL;
+	}
+}
+
+static bool player_load_track(struct avrcp *session,
+						struct avrcp_player *player)
+{
+	struct track_cache *track;
+	GSList *l;
+
+	l = g_slist_find_custom(player->tracks, &player->uid, track_cache_cmp);
+	if (!l)
+		return false;
+
+	track = l->data;
+
+	DBG("uid %" PRIu64 " cached", track->uid);
+
+	avrcp_parse_attribute_list(player, track->data, track->count);
+
+	avrcp_get_play_status(session);
+
+	return true;
+}
+
 static const char *type_to_string(uint8_t type)
 {
 	switch (type & 0x0F) {
@@ -2778,7 +2863,7 @@ static gboolean avrcp_set_browsed_player_rsp(struct avctp *conn,
 							operand_count < 13)
 		return FALSE;
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	player_set_uid_counter(player, get_be16(&pdu->params[1]));
 	player->browsed = true;
 
 	items = get_be32(&pdu->params[3]);
@@ -2860,6 +2945,11 @@ static gboolean avrcp_get_item_attributes_rsp(struct avctp *conn,
 
 	avrcp_parse_attribute_list(player, &pdu->params[2], count);
 
+	if (operand_count > AVRCP_BROWSING_HEADER_LENGTH + 2)
+		player_cache_track(player, &pdu->params[2], operand_count -
+					AVRCP_BROWSING_HEADER_LENGTH - 2,
+					count);
+
 	avrcp_get_play_status(session);
 
 	return FALSE;
@@ -3233,7 +3323,7 @@ static gboolean avrcp_search_rsp(struct avctp *conn, uint8_t *operands,
 		goto done;
 	}
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	player_set_uid_counter(player, get_be16(&pdu->params[1]));
 	ret = get_be32(&pdu->params[3]);
 
 done:
@@ -3427,7 +3517,7 @@ static gboolean avrcp_get_total_numberofitems_rsp(struct avctp *conn,
 	if (pdu->params[0] == AVRCP_STATUS_OUT_OF_BOUNDS)
 		goto done;
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	player_set_uid_counter(player, get_be16(&pdu->params[1]));
 	num_of_items = get_be32(&pdu->params[3]);
 
 	if (!num_of_items)
@@ -3620,6 +3710,7 @@ static void player_destroy(gpointer data)
 		g_source_remove(player->changed_id);
 
 	g_slist_free(player->sessions);
+	g_slist_free_full(player->tracks, g_free);
 	g_free(player->path);
 	g_free(player->change_path);
 	free(player->features);
@@ -3759,10 +3850,15 @@ static void avrcp_status_changed(struct avrcp *session,
 static void avrcp_track_changed(struct avrcp *session,
 						struct avrcp_header *pdu)
 {
+	struct avrcp_player *player = session->controller->player;
+
+	/* The now playing list may have changed along with the track */
+	media_player_playlist_changed(player->user_data);
+
 	if (session->browsing_id) {
-		struct avrcp_player *player = session->controller->player;
 		player->uid = get_be64(&pdu->params[1]);
-		avrcp_get_item_attributes(session, player->uid);
+		if (!player_load_track(session, player))
+			avrcp_get_item_attributes(session, player->uid);
 	} else
 		avrcp_get_element_attributes(session);
 }
@@ -3825,7 +3921,7 @@ static void avrcp_addressed_player_changed(struct avrcp *session,
 	}
 
 	player->addressed = true;
-	player->uid_counter = get_be16(&pdu->params[3]);
+	player_set_uid_counter(player, get_be16(&pdu->params[3]));
 	set_ct_player(session, player);
 
 	if (player->features != NULL)
@@ -3838,7 +3934,7 @@ static void avrcp_uids_changed(struct avrcp *session, struct avrcp_header *pdu)
 {
 	struct avrcp_player *player = session->controller->player;
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	player_set_uid_counter(player, get_be16(&pdu->params[1]));
 }
 
 static gboolean avrcp_handle_event(struct avctp *conn, uint8_t code,
@@ -4818,5 +4914,12 @@ static void avrcp_exit(void)
 	btd_profile_unregister(&avrcp_target_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(avrcp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-							avrcp_init, avrcp_exit)
+static const char * const avrcp_uuids[] = {
+	AVRCP_REMOTE_UUID,
+	AVRCP_TARGET_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_UUIDS(avrcp, VERSION,
+				BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+				avrcp_init, avrcp_exit, avrcp_uuids)
@@ -42,6 +42,7 @@
 #include "media.h"
 #include "transport.h"
 #include "a2dp.h"
+#include "a2dp-codecs.h"
 #include "avrcp.h"
 
 #define MEDIA_INTERFACE "org.bluez.Media1"
@@ -74,6 +75,8 @@ struct endpoint_request {
 	struct media_transport	*transport;
 	DBusMessage		*msg;
 	DBusPendingCall		*call;
+	GByteArray		*config;	/* Locally selected config */
+	guint			id;
 	media_endpoint_cb_t	cb;
 	GDestroyNotify		destroy;
 	void			*user_data;
@@ -87,6 +90,7 @@ struct media_endpoint {
 	uint8_t			codec;		/* Endpoint codec */
 	uint8_t			*capabilities;	/* Endpoint property capabilities */
 	size_t			size;		/* Endpoint capabilities size */
+	GSList			*configurations; /* Preferred configs */
 	guint			hs_watch;
 	guint			ag_watch;
 	guint			watch;
@@ -128,7 +132,9 @@ static void endpoint_request_free(struct endpoint_request *request)
 	if (request->destroy)
 		request->destroy(request->user_data);
 
-	dbus_message_unref(request->msg);
+	if (request->msg)
+		dbus_message_unref(request->msg);
+
 	g_free(request);
 }
 
@@ -139,6 +145,9 @@ static void media_endpoint_cancel(struct endpoint_request *request)
 	if (request->call)
 		dbus_pending_call_cancel(request->call);
 
+	if (request->id)
+		g_source_remove(request->id);
+
 	endpoint->requests = g_slist_remove(endpoint->requests, request);
 
 	if (request->cb)
@@ -153,6 +162,11 @@ static void media_endpoint_cancel_all(struct media_endpoint *endpoint)
 		media_endpoint_cancel(endpoint->requests->data);
 }
 
+static void free_configuration(void *data)
+{
+	g_byte_array_free(data, TRUE);
+}
+
 static void media_endpoint_destroy(struct media_endpoint *endpoint)
 {
 	DBG("sender=%s path=%s", endpoint->sender, endpoint->path);
@@ -164,6 +178,7 @@ static void media_endpoint_destroy(struct media_endpoint *endpoint)
 
 	g_dbus_remove_watch(btd_get_dbus_connection(), endpoint->watch);
 	g_free(endpoint->capabilities);
+	g_slist_free_full(endpoint->configurations, free_configuration);
 	g_free(endpoint->sender);
 	g_free(endpoint->path);
 	g_free(endpoint->uuid);
@@ -389,6 +404,130 @@ static gboolean media_endpoint_async_call(DBusMessage *msg,
 	return TRUE;
 }
 
+static bool bits_supported(const uint8_t *caps, const uint8_t *config,
+								size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (config[i] & ~caps[i])
+			return false;
+	}
+
+	return true;
+}
+
+static bool sbc_config_supported(const uint8_t *caps, const uint8_t *config)
+{
+	/* Minimum and maximum bitpool must be within the supported range */
+	if (config[2] < caps[2] || config[3] > caps[3] || config[2] > config[3])
+		return false;
+
+	return bits_supported(caps, config, 2);
+}
+
+static bool aac_config_supported(const uint8_t *caps, const uint8_t *config)
+{
+	uint32_t caps_rate, config_rate;
+
+	/* Bitrate is the maximum supported so it is not a bitmask */
+	caps_rate = (caps[3] & 0x7f) << 16 | caps[4] << 8 | caps[5];
+	config_rate = (config[3] & 0x7f) << 16 | config[4] << 8 | config[5];
+	if (caps_rate && config_rate > caps_rate)
+		return false;
+
+	return bits_supported(caps, config, 3) &&
+					!((config[3] & 0x80) & ~caps[3]);
+}
+
+static bool config_supported(uint8_t codec, const uint8_t *caps,
+				size_t caps_len, const uint8_t *config,
+				size_t len)
+{
+	if (len != caps_len)
+		return false;
+
+	switch (codec) {
+	case A2DP_CODEC_SBC:
+		if (len != sizeof(a2dp_sbc_t))
+			return false;
+		return sbc_config_supported(caps, config);
+	case A2DP_CODEC_MPEG24:
+		if (len != sizeof(a2dp_aac_t))
+			return false;
+		return aac_config_supported(caps, config);
+	case A2DP_CODEC_VENDOR:
+		/* Vendor and codec IDs must match */
+		if (len < sizeof(a2dp_vendor_codec_t) || memcmp(caps, config,
+						sizeof(a2dp_vendor_codec_t)))
+			return false;
+		return bits_supported(caps + sizeof(a2dp_vendor_codec_t),
+				config + sizeof(a2dp_vendor_codec_t),
+				len - sizeof(a2dp_vendor_codec_t));
+	default:
+		return bits_supported(caps, config, len);
+	}
+}
+
+static gboolean select_local_reply(gpointer user_data)
+{
+	struct endpoint_request *request = user_data;
+	struct media_endpoint *endpoint = request->endpoint;
+
+	request->id = 0;
+
+	if (request->cb)
+		request->cb(endpoint, request->config->data,
+				request->config->len, request->user_data);
+
+	endpoint->requests = g_slist_remove(endpoint->requests, request);
+	endpoint_request_free(request);
+
+	return FALSE;
+}
+
+/* Pick the first of the configurations the endpoint registered, in order of
+ * preference, that the remote capabilities support so SelectConfiguration
+ * does not need to be called.
+ */
+static gboolean select_local(struct media_endpoint *endpoint,
+						uint8_t *capabilities,
+						size_t length,
+						media_endpoint_cb_t cb,
+						void *user_data,
+						GDestroyNotify destroy)
+{
+	struct endpoint_request *request;
+	GSList *l;
+
+	for (l = endpoint->configurations; l; l = l->next) {
+		GByteArray *config = l->data;
+
+		if (config_supported(endpoint->codec, capabilities, length,
+						config->data, config->len))
+			break;
+	}
+
+	if (!l)
+		return FALSE;
+
+	DBG("sender=%s path=%s", endpoint->sender, endpoint->path);
+
+	request = g_new0(struct endpoint_request, 1);
+	request->endpoint = endpoint;
+	request->config = l->data;
+	request->cb = cb;
+	request->destroy = destroy;
+	request->user_data = user_data;
+
+	/* Reply from idle as the caller expects an asynchronous reply */
+	request->id = g_idle_add(select_local_reply, request);
+
+	endpoint->requests = g_slist_append(endpoint->requests, request);
+
+	return TRUE;
+}
+
 static gboolean select_configuration(struct media_endpoint *endpoint,
 						uint8_t *capabilities,
 						size_t length,
@@ -398,6 +537,10 @@ static gboolean select_configuration(struct media_endpoint *endpoint,
 {
 	DBusMessage *msg;
 
+	if (select_local(endpoint, capabilities, length, cb, user_data,
+								destroy))
+		return TRUE;
+
 	msg = dbus_message_new_method_call(endpoint->sender, endpoint->path,
 						MEDIA_ENDPOINT_INTERFACE,
 						"SelectConfiguration");
@@ -787,16 +930,19 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 						uint8_t codec,
 						uint8_t *capabilities,
 						int size,
+						GSList *configurations,
 						int *err)
 {
 	struct media_endpoint *endpoint;
 	gboolean succeeded;
+	GSList *l;
 
 	endpoint = g_new0(struct media_endpoint, 1);
 	endpoint->sender = g_strdup(sender);
 	endpoint->path = g_strdup(path);
 	endpoint->uuid = g_strdup(uuid);
 	endpoint->codec = codec;
+	endpoint->configurations = configurations;
 
 	if (size > 0) {
 		endpoint->capabilities = g_new(uint8_t, size);
@@ -806,6 +952,20 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 
 	endpoint->adapter = adapter;
 
+	/* Configurations must be supported by the endpoint itself */
+	for (l = configurations; l; l = l->next) {
+		GByteArray *config = l->data;
+
+		if (!config_supported(codec, endpoint->capabilities,
+					endpoint->size, config->data,
+					config->len)) {
+			if (err)
+				*err = -EINVAL;
+			media_endpoint_destroy(endpoint);
+			return NULL;
+		}
+	}
+
 	if (strcasecmp(uuid, A2DP_SOURCE_UUID) == 0)
 		succeeded = endpoint_init_a2dp_source(endpoint,
 							delay_reporting, err);
@@ -849,9 +1009,44 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 	return endpoint;
 }
 
+static int parse_configurations(DBusMessageIter *iter, GSList **list)
+{
+	DBusMessageIter array;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY ||
+			dbus_message_iter_get_element_type(iter) !=
+							DBUS_TYPE_ARRAY)
+		return -EINVAL;
+
+	dbus_message_iter_recurse(iter, &array);
+
+	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_ARRAY) {
+		DBusMessageIter value;
+		GByteArray *config;
+		uint8_t *data;
+		int len;
+
+		if (dbus_message_iter_get_element_type(&array) !=
+							DBUS_TYPE_BYTE)
+			return -EINVAL;
+
+		dbus_message_iter_recurse(&array, &value);
+		dbus_message_iter_get_fixed_array(&value, &data, &len);
+
+		config = g_byte_array_sized_new(len);
+		g_byte_array_append(config, data, len);
+		*list = g_slist_append(*list, config);
+
+		dbus_message_iter_next(&array);
+	}
+
+	return 0;
+}
+
 static int parse_properties(DBusMessageIter *props, const char **uuid,
 				gboolean *delay_reporting, uint8_t *codec,
-				uint8_t **capabilities, int *size)
+				uint8_t **capabilities, int *size,
+				GSList **configurations)
 {
 	gboolean has_uuid = FALSE;
 	gboolean has_codec = FALSE;
@@ -891,6 +1086,9 @@ static int parse_properties(DBusMessageIter *props, const char **uuid,
 			dbus_message_iter_recurse(&value, &array);
 			dbus_message_iter_get_fixed_array(&array, capabilities,
 							size);
+		} else if (strcasecmp(key, "Configurations") == 0) {
+			if (parse_configurations(&value, configurations) < 0)
+				return -EINVAL;
 		}
 
 		dbus_message_iter_next(props);
@@ -909,6 +1107,7 @@ static DBusMessage *register_endpoint(DBusConnection *conn, DBusMessage *msg,
 	uint8_t codec;
 	uint8_t *capabilities;
 	int size = 0;
+	GSList *configurations = NULL;
 	int err;
 
 	sender = dbus_message_get_sender(msg);
@@ -926,11 +1125,14 @@ static DBusMessage *register_endpoint(DBusConnection *conn, DBusMessage *msg,
 		return btd_error_invalid_args(msg);
 
 	if (parse_properties(&props, &uuid, &delay_reporting, &codec,
-						&capabilities, &size) < 0)
+				&capabilities, &size, &configurations) < 0) {
+		g_slist_free_full(configurations, free_configuration);
 		return btd_error_invalid_args(msg);
+	}
 
 	if (media_endpoint_create(adapter, sender, path, uuid, delay_reporting,
-				codec, capabilities, size, &err) == NULL) {
+				codec, capabilities, size, configurations,
+				&err) == NULL) {
 		if (err == -EPROTONOSUPPORT)
 			return btd_error_not_supported(msg);
 		else
@@ -1958,6 +2160,7 @@ static void app_register_endpoint(void *data, void *user_data)
 	uint8_t codec;
 	uint8_t *capabilities = NULL;
 	int size = 0;
+	GSList *configurations = NULL;
 	DBusMessageIter iter, array;
 	struct media_endpoint *endpoint;
 
@@ -2000,9 +2203,16 @@ static void app_register_endpoint(void *data, void *user_data)
 		dbus_message_iter_get_fixed_array(&array, &capabilities, &size);
 	}
 
+	if (g_dbus_proxy_get_property(proxy, "Configurations", &iter)) {
+		if (parse_configurations(&iter, &configurations) < 0) {
+			g_slist_free_full(configurations, free_configuration);
+			goto fail;
+		}
+	}
+
 	endpoint = media_endpoint_create(app->adapter, app->sender, path, uuid,
 					delay_reporting, codec, capabilities,
-					size, &app->err);
+					size, configurations, &app->err);
 	if (!endpoint) {
 		error("Unable to register endpoint %s:%s: %s", app->sender,
 						path, strerror(-app->err));
@@ -66,6 +66,11 @@ struct media_folder {
 	GSList			*subfolders;
 	GSList			*items;
 	DBusMessage		*msg;
+	GSList			*cache;		/* Items last listed */
+	uint32_t		cache_start;
+	uint32_t		cache_end;
+	bool			cached;		/* Cache is valid */
+	bool			caching;	/* Listing can be cached */
 };
 
 struct media_player {
@@ -635,22 +640,12 @@ static void parse_folder_list(gpointer data, gpointer user_data)
 	dbus_message_iter_close_container(array, &entry);
 }
 
-void media_player_list_complete(struct media_player *mp, GSList *items,
-								int err)
+static DBusMessage *list_items_reply(DBusMessage *msg, GSList *items)
 {
-	struct media_folder *folder = mp->scope;
 	DBusMessage *reply;
 	DBusMessageIter iter, array;
 
-	if (folder == NULL || folder->msg == NULL)
-		return;
-
-	if (err < 0) {
-		reply = btd_error_failed(folder->msg, strerror(-err));
-		goto done;
-	}
-
-	reply = dbus_message_new_method_return(folder->msg);
+	reply = dbus_message_new_method_return(msg);
 
 	dbus_message_iter_init_append(reply, &iter);
 
@@ -668,12 +663,73 @@ void media_player_list_complete(struct media_player *mp, GSList *items,
 	g_slist_foreach(items, parse_folder_list, &array);
 	dbus_message_iter_close_container(&iter, &array);
 
+	return reply;
+}
+
+static void media_folder_clear_cache(struct media_folder *folder)
+{
+	g_slist_free(folder->cache);
+	folder->cache = NULL;
+	folder->cached = false;
+	folder->caching = false;
+}
+
+static void media_folder_clear_cache_all(void *data, void *user_data)
+{
+	struct media_folder *folder = data;
+
+	media_folder_clear_cache(folder);
+
+	g_slist_foreach(folder->subfolders, media_folder_clear_cache_all,
+								NULL);
+}
+
+void media_player_list_complete(struct media_player *mp, GSList *items,
+								int err)
+{
+	struct media_folder *folder = mp->scope;
+	DBusMessage *reply;
+
+	if (folder == NULL || folder->msg == NULL)
+		return;
+
+	if (err < 0) {
+		reply = btd_error_failed(folder->msg, strerror(-err));
+		goto done;
+	}
+
+	reply = list_items_reply(folder->msg, items);
+
+	/* Items stay valid until the scope changes or UIDs are changed */
+	if (folder->caching) {
+		g_slist_free(folder->cache);
+		folder->cache = g_slist_copy(items);
+		folder->cached = true;
+		folder->caching = false;
+	}
+
 done:
 	g_dbus_send_message(btd_get_dbus_connection(), reply);
 	dbus_message_unref(folder->msg);
 	folder->msg = NULL;
 }
 
+void media_player_uids_changed(struct media_player *mp)
+{
+	if (!mp)
+		return;
+
+	g_slist_foreach(mp->folders, media_folder_clear_cache_all, NULL);
+}
+
+void media_player_playlist_changed(struct media_player *mp)
+{
+	if (!mp || !mp->playlist)
+		return;
+
+	media_folder_clear_cache(mp->playlist);
+}
+
 static struct media_item *
 media_player_create_subfolder(struct media_player *mp, const char *name,
 								uint64_t uid)
@@ -888,6 +944,13 @@ static DBusMessage *media_folder_list_items(DBusConnection *conn,
 	if (folder->msg != NULL)
 		return btd_error_failed(msg, strerror(EBUSY));
 
+	if (folder->cached && folder->cache_start == start &&
+						folder->cache_end == end) {
+		DBG("%s start %u end %u cached", folder->item->name, start,
+									end);
+		return list_items_reply(msg, folder->cache);
+	}
+
 	err = cb->cbs->list_items(mp, folder->item->name, start, end,
 							cb->user_data);
 	if (err < 0)
@@ -895,6 +958,11 @@ static DBusMessage *media_folder_list_items(DBusConnection *conn,
 
 	folder->msg = dbus_message_ref(msg);
 
+	media_folder_clear_cache(folder);
+	folder->cache_start = start;
+	folder->cache_end = end;
+	folder->caching = true;
+
 	return NULL;
 }
 
@@ -926,6 +994,7 @@ static void media_folder_destroy(void *data)
 
 	g_slist_free_full(folder->subfolders, media_folder_destroy);
 	g_slist_free_full(folder->items, media_item_destroy);
+	g_slist_free(folder->cache);
 
 	if (folder->msg != NULL)
 		dbus_message_unref(folder->msg);
@@ -956,6 +1025,7 @@ static void media_player_change_scope(struct media_player *mp,
 		goto done;
 
 cleanup:
+	media_folder_clear_cache(mp->scope);
 	g_slist_free_full(mp->scope->items, media_item_destroy);
 	mp->scope->items = NULL;
 
@@ -15,6 +15,11 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 
 #include <glib.h>
 
@@ -31,6 +36,8 @@
 #include "src/log.h"
 #include "src/error.h"
 #include "src/shared/queue.h"
+#include "src/shared/util.h"
+#include "src/shared/io.h"
 
 #include "avdtp.h"
 #include "media.h"
@@ -63,9 +70,42 @@ struct media_request {
 	guint			id;
 };
 
+/* Record header of packets written by the client to a forwarded fd */
+struct media_forward_hdr {
+	uint16_t		len;
+	uint32_t		timestamp;
+} __packed;
+
+/* Latency samples kept per transport for the Latency property */
+#define LATENCY_SAMPLES		16
+
+struct latency_stats {
+	uint32_t		samples[LATENCY_SAMPLES]; /* Microseconds */
+	unsigned int		count;
+};
+
+#define RTP_HDR_LEN		12
+#define RTP_PAYLOAD_TYPE	0x60
+
+struct media_forward {
+	int			src;
+	int			pipe[2];
+	struct io		*src_io;
+	struct io		*sk_io;
+	bool			rtp;
+	bool			copy;
+	bool			started;	/* First packet written */
+	uint16_t		seq;
+	uint8_t			hdr[sizeof(struct media_forward_hdr)];
+	size_t			hdr_len;
+	size_t			payload;	/* Bytes left to splice in */
+	size_t			queued;		/* Bytes in pipe */
+};
+
 struct media_owner {
 	struct media_transport	*transport;
 	struct media_request	*pending;
+	struct media_forward	*forward;
 	char			*name;
 	guint			watch;
 };
@@ -88,6 +128,12 @@ struct media_transport {
 	uint16_t		imtu;		/* Transport input mtu */
 	uint16_t		omtu;		/* Transport output mtu */
 	transport_state_t	state;
+	gint64			state_time;	/* Last state change */
+	gint64			resume_time;	/* Resume requested */
+	gint64			suspend_time;	/* Suspend requested */
+	struct latency_stats	resume_lat;	/* Resume to fd handed out */
+	struct latency_stats	suspend_lat;	/* Suspend to completion */
+	struct latency_stats	first_packet_lat; /* Resume to first packet */
 	guint			hs_watch;
 	guint			source_watch;
 	guint			sink_watch;
@@ -134,6 +180,50 @@ static gboolean state_in_use(transport_state_t state)
 	return FALSE;
 }
 
+static uint32_t latency_since(gint64 start)
+{
+	return g_get_monotonic_time() - start;
+}
+
+static void latency_add(struct media_transport *transport,
+				struct latency_stats *stats, const char *name,
+				uint32_t latency)
+{
+	stats->samples[stats->count++ % LATENCY_SAMPLES] = latency;
+
+	DBG("%s: %s latency %u us", transport->path, name, latency);
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t *) a;
+	uint32_t vb = *(const uint32_t *) b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+/* Appends 50th, 90th percentile and maximum of the samples as au */
+static void latency_append(DBusMessageIter *dict, const char *key,
+					const uint32_t *samples, size_t count)
+{
+	uint32_t sorted[LATENCY_SAMPLES];
+	uint32_t values[3];
+	const uint32_t *ptr = values;
+
+	if (!count)
+		return;
+
+	count = MIN(count, LATENCY_SAMPLES);
+	memcpy(sorted, samples, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), latency_cmp);
+
+	values[0] = sorted[(count - 1) * 50 / 100];
+	values[1] = sorted[(count - 1) * 90 / 100];
+	values[2] = sorted[count - 1];
+
+	dict_append_array(dict, key, DBUS_TYPE_UINT32, &ptr, 3);
+}
+
 static void transport_set_state(struct media_transport *transport,
 							transport_state_t state)
 {
@@ -145,8 +235,11 @@ static void transport_set_state(struct media_transport *transport,
 
 	transport->state = state;
 
-	DBG("State changed %s: %s -> %s", transport->path, str_state[old_state],
-							str_state[state]);
+	DBG("State changed %s: %s -> %s after %u us", transport->path,
+				str_state[old_state], str_state[state],
+				latency_since(transport->state_time));
+
+	transport->state_time = g_get_monotonic_time();
 
 	str = state2str(state);
 
@@ -226,12 +319,32 @@ static void media_owner_remove(struct media_owner *owner)
 	g_free(req);
 }
 
+static void media_forward_free(struct media_forward *fwd)
+{
+	io_destroy(fwd->src_io);
+	io_destroy(fwd->sk_io);
+
+	if (fwd->pipe[0] >= 0)
+		close(fwd->pipe[0]);
+
+	if (fwd->pipe[1] >= 0)
+		close(fwd->pipe[1]);
+
+	if (fwd->src >= 0)
+		close(fwd->src);
+
+	g_free(fwd);
+}
+
 static void media_owner_free(struct media_owner *owner)
 {
 	DBG("Owner %s", owner->name);
 
 	media_owner_remove(owner);
 
+	if (owner->forward)
+		media_forward_free(owner->forward);
+
 	g_free(owner->name);
 	g_free(owner);
 }
@@ -272,6 +385,198 @@ static gboolean media_transport_set_fd(struct media_transport *transport,
 	return TRUE;
 }
 
+static bool forward_read(struct io *io, void *user_data);
+
+static void forward_stop(struct media_transport *transport, int err)
+{
+	if (err)
+		error("%s: forwarding failed: %s (%d)", transport->path,
+							strerror(err), err);
+	else
+		DBG("%s: forwarding done", transport->path);
+
+	if (transport->owner)
+		media_transport_remove_owner(transport);
+}
+
+static ssize_t forward_copy(struct media_forward *fwd, int fd)
+{
+	uint8_t buf[UINT16_MAX];
+	ssize_t len;
+
+	len = read(fwd->pipe[0], buf, fwd->queued);
+	if (len < 0)
+		return len;
+
+	return write(fd, buf, len);
+}
+
+static bool forward_write(struct io *io, void *user_data)
+{
+	struct media_transport *transport = user_data;
+	struct media_forward *fwd = transport->owner->forward;
+	ssize_t ret = -1;
+
+	if (!fwd->copy) {
+		/* Sends the header and payload pages as one packet */
+		ret = splice(fwd->pipe[0], NULL, transport->fd, NULL,
+					fwd->queued, SPLICE_F_NONBLOCK);
+		if (ret < 0 && errno == EINVAL) {
+			DBG("%s: splice not supported, copying",
+							transport->path);
+			fwd->copy = true;
+		}
+	}
+
+	if (fwd->copy)
+		ret = forward_copy(fwd, transport->fd);
+
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
+		forward_stop(transport, errno);
+		return false;
+	}
+
+	if ((size_t) ret != fwd->queued) {
+		forward_stop(transport, EMSGSIZE);
+		return false;
+	}
+
+	if (!fwd->started) {
+		fwd->started = true;
+		latency_add(transport, &transport->first_packet_lat,
+				"First packet",
+				latency_since(transport->resume_time));
+	}
+
+	fwd->queued = 0;
+	fwd->seq++;
+
+	io_set_read_handler(fwd->src_io, forward_read, transport, NULL);
+
+	return false;
+}
+
+static bool forward_packet(struct media_transport *transport)
+{
+	struct media_forward *fwd = transport->owner->forward;
+	struct media_forward_hdr *hdr = (void *) fwd->hdr;
+	uint8_t rtp[RTP_HDR_LEN];
+	uint16_t len = le16_to_cpu(hdr->len);
+
+	fwd->hdr_len = 0;
+
+	if (!len || len + (fwd->rtp ? RTP_HDR_LEN : 0) > transport->omtu) {
+		error("%s: invalid packet length %u", transport->path, len);
+		return false;
+	}
+
+	fwd->payload = len;
+
+	if (!fwd->rtp)
+		return true;
+
+	rtp[0] = 0x80;
+	rtp[1] = RTP_PAYLOAD_TYPE;
+	put_be16(fwd->seq, &rtp[2]);
+	put_be32(le32_to_cpu(hdr->timestamp), &rtp[4]);
+	put_be32(1, &rtp[8]);
+
+	/* Too small for vmsplice to pay off, and rtp would be reused */
+	if (write(fwd->pipe[1], rtp, sizeof(rtp)) != sizeof(rtp))
+		return false;
+
+	fwd->queued = sizeof(rtp);
+
+	return true;
+}
+
+static bool forward_read(struct io *io, void *user_data)
+{
+	struct media_transport *transport = user_data;
+	struct media_forward *fwd = transport->owner->forward;
+	ssize_t ret;
+
+	if (!fwd->payload) {
+		ret = read(fwd->src, fwd->hdr + fwd->hdr_len,
+					sizeof(fwd->hdr) - fwd->hdr_len);
+		if (ret <= 0)
+			goto done;
+
+		fwd->hdr_len += ret;
+		if (fwd->hdr_len < sizeof(fwd->hdr))
+			return true;
+
+		if (!forward_packet(transport)) {
+			forward_stop(transport, EINVAL);
+			return false;
+		}
+	}
+
+	/* Moves the payload pages from the client without copying */
+	ret = splice(fwd->src, NULL, fwd->pipe[1], NULL, fwd->payload,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret <= 0)
+		goto done;
+
+	fwd->payload -= ret;
+	fwd->queued += ret;
+
+	if (fwd->payload)
+		return true;
+
+	io_set_write_handler(fwd->sk_io, forward_write, transport, NULL);
+
+	return false;
+
+done:
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return true;
+
+	forward_stop(transport, ret < 0 ? errno : 0);
+
+	return false;
+}
+
+static bool forward_disconnect(struct io *io, void *user_data)
+{
+	struct media_transport *transport = user_data;
+	struct media_forward *fwd = transport->owner->forward;
+	int avail = 0;
+
+	/* Keep going until everything written before hang up is sent */
+	if (fwd->queued && !fwd->payload)
+		return true;
+
+	if (!ioctl(fwd->src, FIONREAD, &avail) && avail > 0)
+		return true;
+
+	forward_stop(transport, 0);
+
+	return false;
+}
+
+static bool media_forward_start(struct media_transport *transport)
+{
+	struct media_forward *fwd = transport->owner->forward;
+
+	if (pipe2(fwd->pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+		return false;
+
+	fwd->src_io = io_new(fwd->src);
+	fwd->sk_io = io_new(transport->fd);
+	if (!fwd->src_io || !fwd->sk_io)
+		return false;
+
+	io_set_read_handler(fwd->src_io, forward_read, transport, NULL);
+	io_set_disconnect_handler(fwd->src_io, forward_disconnect, transport,
+									NULL);
+
+	return true;
+}
+
 static void a2dp_resume_complete(struct avdtp *session, int err,
 							void *user_data)
 {
@@ -299,7 +604,20 @@ static void a2dp_resume_complete(struct avdtp *session, int err,
 
 	media_transport_set_fd(transport, fd, imtu, omtu);
 
-	ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
+	if (owner->forward) {
+		uint16_t mtu = omtu;
+
+		if (!media_forward_start(transport))
+			goto fail;
+
+		if (owner->forward->rtp)
+			mtu -= RTP_HDR_LEN;
+
+		ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
+						DBUS_TYPE_UINT16, &mtu,
+						DBUS_TYPE_INVALID);
+	} else
+		ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
 						DBUS_TYPE_UNIX_FD, &fd,
 						DBUS_TYPE_UINT16, &imtu,
 						DBUS_TYPE_UINT16, &omtu,
@@ -309,6 +627,9 @@ static void a2dp_resume_complete(struct avdtp *session, int err,
 
 	media_owner_remove(owner);
 
+	latency_add(transport, &transport->resume_lat, "Resume",
+				latency_since(transport->resume_time));
+
 	transport_set_state(transport, TRANSPORT_STATE_ACTIVE);
 
 	return;
@@ -331,6 +652,8 @@ static guint resume_a2dp(struct media_transport *transport,
 			return 0;
 	}
 
+	transport->resume_time = g_get_monotonic_time();
+
 	if (state_in_use(transport->state))
 		return a2dp_resume(a2dp->session, sep, a2dp_resume_complete,
 									owner);
@@ -366,6 +689,9 @@ static void a2dp_suspend_complete(struct avdtp *session, int err,
 		media_owner_remove(owner);
 	}
 
+	latency_add(transport, &transport->suspend_lat, "Suspend",
+				latency_since(transport->suspend_time));
+
 	a2dp_sep_unlock(sep, a2dp->session);
 	transport_set_state(transport, TRANSPORT_STATE_IDLE);
 	media_transport_remove_owner(transport);
@@ -378,9 +704,11 @@ static guint suspend_a2dp(struct media_transport *transport,
 	struct media_endpoint *endpoint = transport->endpoint;
 	struct a2dp_sep *sep = media_endpoint_get_sep(endpoint);
 
-	if (owner != NULL)
+	if (owner != NULL) {
+		transport->suspend_time = g_get_monotonic_time();
 		return a2dp_suspend(a2dp->session, sep, a2dp_suspend_complete,
 									owner);
+	}
 
 	transport_set_state(transport, TRANSPORT_STATE_IDLE);
 	a2dp_sep_unlock(sep, a2dp->session);
@@ -496,6 +824,85 @@ static DBusMessage *try_acquire(DBusConnection *conn, DBusMessage *msg,
 	return NULL;
 }
 
+static int parse_forward_options(DBusMessageIter *props,
+						struct media_forward *fwd)
+{
+	while (dbus_message_iter_get_arg_type(props) == DBUS_TYPE_DICT_ENTRY) {
+		const char *key;
+		DBusMessageIter value, entry;
+		dbus_bool_t rtp;
+
+		dbus_message_iter_recurse(props, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &value);
+
+		if (strcasecmp(key, "RTP") == 0) {
+			if (dbus_message_iter_get_arg_type(&value) !=
+							DBUS_TYPE_BOOLEAN)
+				return -EINVAL;
+
+			dbus_message_iter_get_basic(&value, &rtp);
+			fwd->rtp = rtp;
+		}
+
+		dbus_message_iter_next(props);
+	}
+
+	return 0;
+}
+
+static DBusMessage *forward(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct media_transport *transport = data;
+	struct media_owner *owner;
+	struct media_forward *fwd;
+	struct media_request *req;
+	DBusMessageIter args, props;
+	guint id;
+	int fd;
+
+	if (transport->owner != NULL)
+		return btd_error_not_authorized(msg);
+
+	if (transport->state >= TRANSPORT_STATE_REQUESTING)
+		return btd_error_not_authorized(msg);
+
+	dbus_message_iter_init(msg, &args);
+	dbus_message_iter_get_basic(&args, &fd);
+	dbus_message_iter_next(&args);
+	dbus_message_iter_recurse(&args, &props);
+
+	fwd = g_new0(struct media_forward, 1);
+	fwd->src = fd;
+	fwd->pipe[0] = -1;
+	fwd->pipe[1] = -1;
+	fwd->rtp = true;
+
+	if (parse_forward_options(&props, fwd) < 0 ||
+				fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		media_forward_free(fwd);
+		return btd_error_invalid_args(msg);
+	}
+
+	owner = media_owner_create(msg);
+	owner->forward = fwd;
+
+	id = transport->resume(transport, owner);
+	if (id == 0) {
+		media_owner_free(owner);
+		return btd_error_not_authorized(msg);
+	}
+
+	req = media_request_create(msg, id);
+	media_owner_add(owner, req);
+	media_transport_set_owner(transport, owner);
+
+	return NULL;
+}
+
 static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 					void *data)
 {
@@ -515,7 +922,8 @@ static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 
 		member = dbus_message_get_member(owner->pending->msg);
 		/* Cancel Acquire request if that exist */
-		if (g_str_equal(member, "Acquire"))
+		if (g_str_equal(member, "Acquire") ||
+					g_str_equal(member, "Forward"))
 			media_owner_remove(owner);
 		else
 			return btd_error_in_progress(msg);
@@ -694,6 +1102,40 @@ static gboolean get_endpoint(const GDBusPropertyTable *property,
 	return TRUE;
 }
 
+static gboolean get_latency(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct media_transport *transport = data;
+	struct a2dp_transport *a2dp = transport->data;
+	DBusMessageIter dict;
+	uint32_t rtt[LATENCY_SAMPLES];
+	size_t count = 0;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	latency_append(&dict, "Resume", transport->resume_lat.samples,
+						transport->resume_lat.count);
+	latency_append(&dict, "Suspend", transport->suspend_lat.samples,
+						transport->suspend_lat.count);
+	latency_append(&dict, "FirstPacket",
+				transport->first_packet_lat.samples,
+				transport->first_packet_lat.count);
+
+	if (a2dp->session)
+		count = avdtp_get_rtt(a2dp->session, rtt, LATENCY_SAMPLES);
+
+	latency_append(&dict, "Signaling", rtt, count);
+
+	dbus_message_iter_close_container(iter, &dict);
+
+	return TRUE;
+}
+
 static const GDBusMethodTable transport_methods[] = {
 	{ GDBUS_ASYNC_METHOD("Acquire",
 			NULL,
@@ -706,6 +1148,10 @@ static const GDBusMethodTable transport_methods[] = {
 							{ "mtu_w", "q" }),
 			try_acquire) },
 	{ GDBUS_ASYNC_METHOD("Release", NULL, NULL, release) },
+	{ GDBUS_EXPERIMENTAL_ASYNC_METHOD("Forward",
+			GDBUS_ARGS({ "fd", "h" }, { "options", "a{sv}" }),
+			GDBUS_ARGS({ "mtu_w", "q" }),
+			forward) },
 	{ },
 };
 
@@ -719,6 +1165,8 @@ static const GDBusPropertyTable transport_properties[] = {
 	{ "Volume", "q", get_volume, set_volume, volume_exists },
 	{ "Endpoint", "o", get_endpoint, NULL, endpoint_exists,
 				G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
+	{ "Latency", "a{sv}", get_latency, NULL, NULL,
+				G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
 	{ }
 };
 
@@ -863,6 +1311,7 @@ struct media_transport *media_transport_create(struct btd_device *device,
 				remote_endpoint ? remote_endpoint :
 				device_get_path(device), fd++);
 	transport->fd = -1;
+	transport->state_time = g_get_monotonic_time();
 
 	uuid = media_endpoint_get_uuid(endpoint);
 	if (strcasecmp(uuid, A2DP_SOURCE_UUID) == 0) {
@@ -55,14 +55,25 @@ struct batt {
 	struct gatt_db_attribute *attr;
 
 	unsigned int batt_level_cb_id;
+	unsigned int batt_level_read_id;
 	uint16_t batt_level_io_handle;
 
 	uint8_t *initial_value;
 	uint8_t percentage;
 };
 
+static void batt_cancel_read(struct batt *batt)
+{
+	if (!batt->batt_level_read_id)
+		return;
+
+	btd_device_gatt_read_cancel(batt->device, batt->batt_level_read_id);
+	batt->batt_level_read_id = 0;
+}
+
 static void batt_free(struct batt *batt)
 {
+	batt_cancel_read(batt);
 	gatt_db_unref(batt->db);
 	bt_gatt_client_unref(batt->client);
 	btd_device_unref(batt->device);
@@ -74,6 +85,7 @@ static void batt_free(struct batt *batt)
 
 static void batt_reset(struct batt *batt)
 {
+	batt_cancel_read(batt);
 	batt->attr = NULL;
 	batt->percentage = -1;
 	gatt_db_unref(batt->db);
@@ -150,6 +162,8 @@ static void read_initial_battery_level_cb(bool success,
 {
 	struct batt *batt = user_data;
 
+	batt->batt_level_read_id = 0;
+
 	if (!success) {
 		DBG("Reading battery level failed with ATT errror: %u",
 								att_ecode);
@@ -175,8 +189,11 @@ static void handle_battery_level(struct batt *batt, uint16_t value_handle)
 {
 	batt->batt_level_io_handle = value_handle;
 
-	if (!bt_gatt_client_read_value(batt->client, batt->batt_level_io_handle,
-						read_initial_battery_level_cb, batt, NULL))
+	/* Batched with the other values read when the device connects */
+	batt->batt_level_read_id = btd_device_gatt_read(batt->device,
+					batt->batt_level_io_handle, 1,
+					read_initial_battery_level_cb, batt);
+	if (!batt->batt_level_read_id)
 		DBG("Failed to send request to read battery level");
 }
 
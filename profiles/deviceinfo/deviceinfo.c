@@ -58,10 +58,8 @@ static void read_pnpid_cb(bool success, uint8_t att_ecode, const uint8_t *value,
 
 static void handle_pnpid(struct btd_device *device, uint16_t value_handle)
 {
-	struct bt_gatt_client *client = btd_device_get_gatt_client(device);
-
-	if (!bt_gatt_client_read_value(client, value_handle,
-						read_pnpid_cb, device, NULL))
+	if (!btd_device_gatt_read(device, value_handle, PNP_ID_SIZE,
+						read_pnpid_cb, device))
 		DBG("Failed to send request to read pnpid");
 }
 
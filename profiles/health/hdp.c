@@ -12,6 +12,7 @@
 #endif
 
 #define _GNU_SOURCE
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -679,6 +680,62 @@ static DBusMessage *channel_release(DBusConnection *conn,
 	return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
 }
 
+static DBusMessage *channel_get_statistics(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct hdp_channel *chan = user_data;
+	struct mcap_mdl_stats stats;
+	DBusMessageIter iter, dict;
+	DBusMessage *reply;
+
+	if (!mcap_mdl_get_stats(chan->mdl, &stats))
+		return g_dbus_create_error(msg, ERROR_INTERFACE ".HealthError",
+						"Channel has no data link");
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	dict_append_entry(&dict, "Connections", DBUS_TYPE_UINT32,
+							&stats.connections);
+	dict_append_entry(&dict, "SetupLatency", DBUS_TYPE_UINT32,
+							&stats.setup_latency);
+
+	if (stats.connected) {
+		uint32_t secs;
+
+		secs = (g_get_monotonic_time() - stats.connected) /
+							G_USEC_PER_SEC;
+		dict_append_entry(&dict, "ConnectedTime", DBUS_TYPE_UINT32,
+								&secs);
+		dict_append_entry(&dict, "RxQueued", DBUS_TYPE_UINT32,
+							&stats.rx_queued);
+		dict_append_entry(&dict, "TxQueued", DBUS_TYPE_UINT32,
+							&stats.tx_queued);
+	}
+
+	dict_append_entry(&dict, "RxBytes", DBUS_TYPE_UINT64,
+							&stats.rx_bytes);
+	dict_append_entry(&dict, "RxPackets", DBUS_TYPE_UINT64,
+							&stats.rx_packets);
+	dict_append_entry(&dict, "TxBytes", DBUS_TYPE_UINT64,
+							&stats.tx_bytes);
+	dict_append_entry(&dict, "TxPackets", DBUS_TYPE_UINT64,
+							&stats.tx_packets);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
 static void free_echo_data(struct hdp_echo_data *edata)
 {
 	if (edata == NULL)
@@ -726,6 +783,9 @@ static const GDBusMethodTable health_channels_methods[] = {
 			NULL, GDBUS_ARGS({ "fd", "h" }),
 			channel_acquire) },
 	{ GDBUS_METHOD("Release", NULL, NULL, channel_release) },
+	{ GDBUS_EXPERIMENTAL_METHOD("GetStatistics", NULL,
+			GDBUS_ARGS({ "statistics", "a{sv}" }),
+			channel_get_statistics) },
 	{ }
 };
 
@@ -828,50 +888,23 @@ static void close_device_con(struct hdp_device *dev, gboolean cache)
 	}
 }
 
-static int send_echo_data(int sock, const void *buf, uint32_t size)
-{
-	const uint8_t *buf_b = buf;
-	uint32_t sent = 0;
-
-	while (sent < size) {
-		int n = write(sock, buf_b + sent, size - sent);
-		if (n < 0)
-			return -1;
-		sent += n;
-	}
-
-	return 0;
-}
-
-static gboolean serve_echo(GIOChannel *io_chan, GIOCondition cond,
-								gpointer data)
+static gboolean serve_echo(struct mcap_mdl *mdl, const struct iovec *iov,
+						int count, gpointer data)
 {
 	struct hdp_channel *chan = data;
-	uint8_t buf[MCAP_DC_MTU];
-	int fd, len;
-
-	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
-		hdp_channel_unref(chan);
-		return FALSE;
-	}
 
 	if (chan->edata->echo_done)
 		goto fail;
 
 	chan->edata->echo_done = TRUE;
 
-	fd = g_io_channel_unix_get_fd(io_chan);
-
-	len = read(fd, buf, sizeof(buf));
-	if (len < 0)
-		goto fail;
-
-	if (send_echo_data(fd, buf, len)  >= 0)
+	/* Only one echo request is allowed, anything after it is an error */
+	if (mcap_mdl_send(mdl, iov[0].iov_base, iov[0].iov_len) == 0 &&
+								count == 1)
 		return TRUE;
 
 fail:
 	close_device_con(chan->dev, FALSE);
-	hdp_channel_unref(chan);
 	return FALSE;
 }
 
@@ -953,18 +986,17 @@ static void hdp_mcap_mdl_connected_cb(struct mcap_mdl *mdl, void *data)
 	}
 
 	if (chan->mdep == HDP_MDEP_ECHO) {
-		GIOChannel *io;
-		int fd;
-
-		fd = mcap_mdl_get_fd(chan->mdl);
-		if (fd < 0)
-			goto end;
+		GError *gerr = NULL;
 
 		chan->edata->echo_done = FALSE;
-		io = g_io_channel_unix_new(fd);
-		g_io_add_watch(io, G_IO_ERR | G_IO_HUP | G_IO_NVAL | G_IO_IN,
-				serve_echo, hdp_channel_ref(chan));
-		g_io_channel_unref(io);
+		if (!mcap_mdl_set_recv(chan->mdl, serve_echo,
+					hdp_channel_ref(chan),
+					(GDestroyNotify) hdp_channel_unref,
+					&gerr)) {
+			error("%s", gerr->message);
+			g_error_free(gerr);
+			hdp_channel_unref(chan);
+		}
 		goto end;
 	}
 
@@ -1604,7 +1636,7 @@ static void hdp_echo_connect_cb(struct mcap_mdl *mdl, GError *err,
 
 	edata = hdp_conn->hdp_chann->edata;
 	edata->buf = generate_echo_packet();
-	send_echo_data(fd, edata->buf, HDP_ECHO_LEN);
+	mcap_mdl_send(hdp_conn->hdp_chann->mdl, edata->buf, HDP_ECHO_LEN);
 
 	io = g_io_channel_unix_new(fd);
 	g_io_add_watch(io, G_IO_ERR | G_IO_HUP | G_IO_NVAL | G_IO_IN,
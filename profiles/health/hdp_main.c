@@ -13,6 +13,9 @@
 
 #include <errno.h>
 
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+
 #include "gdbus/gdbus.h"
 
 #include "src/plugin.h"
@@ -28,5 +31,13 @@ static void hdp_exit(void)
 	hdp_manager_exit();
 }
 
-BLUETOOTH_PLUGIN_DEFINE(health, VERSION,
-			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, hdp_init, hdp_exit)
+static const char * const hdp_uuids[] = {
+	HDP_UUID,
+	HDP_SOURCE_UUID,
+	HDP_SINK_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_UUIDS(health, VERSION,
+			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, hdp_init, hdp_exit,
+			hdp_uuids)
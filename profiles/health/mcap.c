@@ -14,6 +14,9 @@
 #endif
 
 #define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -110,6 +113,14 @@ struct mcap_mdl_op_cb {
 	gpointer		user_data;	/* Callback user data */
 };
 
+struct mcap_mdl_recv {
+	struct mcap_mdl		*mdl;		/* MDL being read */
+	guint			id;		/* Watcher id */
+	mcap_mdl_recv_cb	cb;		/* Receive callback */
+	GDestroyNotify		destroy;	/* Destroy callback */
+	gpointer		user_data;	/* Callback user data */
+};
+
 /* MCAP finite state machine functions */
 static void proc_req_connected(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t l);
 static void proc_req_pending(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t l);
@@ -267,9 +278,41 @@ static void update_mcl_state(struct mcap_mcl *mcl)
 	mcl->state = MCL_CONNECTED;
 }
 
+static void mdl_recv_stop(struct mcap_mdl *mdl)
+{
+	struct mcap_mdl_recv *recv = mdl->recv;
+
+	if (!recv)
+		return;
+
+	mdl->recv = NULL;
+	g_source_remove(recv->id);
+}
+
+static void mdl_setup_start(struct mcap_mdl *mdl)
+{
+	mdl->setup_start = g_get_monotonic_time();
+}
+
+static void mdl_setup_done(struct mcap_mdl *mdl)
+{
+	mdl->stats.connected = g_get_monotonic_time();
+	mdl->stats.connections++;
+
+	if (!mdl->setup_start)
+		return;
+
+	mdl->stats.setup_latency = MIN(mdl->stats.connected -
+						mdl->setup_start, UINT32_MAX);
+	mdl->setup_start = 0;
+}
+
 static void shutdown_mdl(struct mcap_mdl *mdl)
 {
 	mdl->state = MDL_CLOSED;
+	mdl->stats.connected = 0;
+
+	mdl_recv_stop(mdl);
 
 	if (mdl->wid) {
 		g_source_remove(mdl->wid);
@@ -289,6 +332,7 @@ static void free_mdl(struct mcap_mdl *mdl)
 		return;
 
 	mcap_mcl_unref(mdl->mcl);
+	g_free(mdl->rx_ring);
 	g_free(mdl);
 }
 
@@ -551,6 +595,7 @@ gboolean mcap_create_mdl(struct mcap_mcl *mcl,
 
 	mcl->mdls = g_slist_insert_sorted(mcl->mdls, mcap_mdl_ref(mdl),
 								compare_mdl);
+	mdl_setup_start(mdl);
 	mcl->tid = timeout_add_seconds(RESPONSE_TIMER, wait_response_timer,
 					mcl, NULL);
 	return TRUE;
@@ -579,6 +624,7 @@ gboolean mcap_reconnect_mdl(struct mcap_mdl *mdl,
 	}
 
 	mdl->state = MDL_WAITING;
+	mdl_setup_start(mdl);
 
 	con = g_new0(struct mcap_mdl_op_cb, 1);
 	con->mdl = mcap_mdl_ref(mdl);
@@ -755,6 +801,144 @@ uint16_t mcap_mdl_get_mdlid(struct mcap_mdl *mdl)
 	return mdl->mdlid;
 }
 
+static gboolean mdl_recv_cb(GIOChannel *chan, GIOCondition cond,
+								gpointer data)
+{
+	struct mcap_mdl_recv *recv = data;
+	struct mcap_mdl *mdl = recv->mdl;
+	struct mmsghdr msgs[MCAP_MDL_RX_BATCH];
+	struct iovec iov[MCAP_MDL_RX_BATCH];
+	int i, n;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+		return FALSE;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < MCAP_MDL_RX_BATCH; i++) {
+		iov[i].iov_base = mdl->rx_ring + i * mdl->rx_slot;
+		iov[i].iov_len = mdl->rx_slot;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* Drain whatever SDUs are queued with a single system call */
+	n = recvmmsg(g_io_channel_unix_get_fd(chan), msgs, MCAP_MDL_RX_BATCH,
+							MSG_DONTWAIT, NULL);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	if (n == 0)
+		return FALSE;
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_len = msgs[i].msg_len;
+		mdl->stats.rx_bytes += msgs[i].msg_len;
+	}
+
+	mdl->stats.rx_packets += n;
+
+	return recv->cb(mdl, iov, n, recv->user_data);
+}
+
+static void mdl_recv_destroy(gpointer data)
+{
+	struct mcap_mdl_recv *recv = data;
+
+	if (recv->mdl->recv == recv)
+		recv->mdl->recv = NULL;
+
+	if (recv->destroy)
+		recv->destroy(recv->user_data);
+
+	mcap_mdl_unref(recv->mdl);
+	g_free(recv);
+}
+
+gboolean mcap_mdl_set_recv(struct mcap_mdl *mdl, mcap_mdl_recv_cb recv_cb,
+					gpointer user_data,
+					GDestroyNotify destroy,
+					GError **err)
+{
+	struct mcap_mdl_recv *recv;
+	uint16_t imtu;
+
+	if (!mdl || mdl->state != MDL_CONNECTED) {
+		g_set_error(err, MCAP_ERROR, MCAP_ERROR_INVALID_MDL,
+					"%s", error2str(MCAP_INVALID_MDL));
+		return FALSE;
+	}
+
+	mdl_recv_stop(mdl);
+
+	if (!recv_cb)
+		return TRUE;
+
+	if (!bt_io_get(mdl->dc, err, BT_IO_OPT_IMTU, &imtu,
+							BT_IO_OPT_INVALID))
+		return FALSE;
+
+	/* The ring is kept across reconnections of the same MDL */
+	if (imtu != mdl->rx_slot) {
+		g_free(mdl->rx_ring);
+		mdl->rx_ring = g_malloc(MCAP_MDL_RX_BATCH * imtu);
+		mdl->rx_slot = imtu;
+	}
+
+	recv = g_new0(struct mcap_mdl_recv, 1);
+	recv->mdl = mcap_mdl_ref(mdl);
+	recv->cb = recv_cb;
+	recv->destroy = destroy;
+	recv->user_data = user_data;
+	recv->id = g_io_add_watch_full(mdl->dc, G_PRIORITY_DEFAULT,
+					G_IO_IN | G_IO_ERR | G_IO_HUP |
+					G_IO_NVAL, mdl_recv_cb, recv,
+					mdl_recv_destroy);
+	mdl->recv = recv;
+
+	return TRUE;
+}
+
+int mcap_mdl_send(struct mcap_mdl *mdl, const void *buf, uint32_t size)
+{
+	if (!mdl || mdl->state != MDL_CONNECTED)
+		return -ENOTCONN;
+
+	if (mcap_send_data(g_io_channel_unix_get_fd(mdl->dc), buf, size) < 0)
+		return -errno;
+
+	mdl->stats.tx_bytes += size;
+	mdl->stats.tx_packets++;
+
+	return 0;
+}
+
+gboolean mcap_mdl_get_stats(struct mcap_mdl *mdl,
+					struct mcap_mdl_stats *stats)
+{
+	int fd, len;
+
+	if (!mdl)
+		return FALSE;
+
+	*stats = mdl->stats;
+	stats->rx_queued = 0;
+	stats->tx_queued = 0;
+
+	if (mdl->state != MDL_CONNECTED)
+		return TRUE;
+
+	fd = g_io_channel_unix_get_fd(mdl->dc);
+
+	if (ioctl(fd, TIOCINQ, &len) == 0)
+		stats->rx_queued = len;
+
+	if (ioctl(fd, TIOCOUTQ, &len) == 0)
+		stats->tx_queued = len;
+
+	return TRUE;
+}
+
 static void shutdown_mdl_cb(void *data, void *user_data)
 {
 	shutdown_mdl(data);
@@ -1118,6 +1302,7 @@ static void process_md_create_mdl_req(struct mcap_mcl *mcl, void *cmd,
 
 	mdl->mdep_id = mdep_id;
 	mdl->state = MDL_WAITING;
+	mdl_setup_start(mdl);
 
 	mcl->state = MCL_PENDING;
 	mcap_send_cmd(mcl, MCAP_MD_CREATE_MDL_RSP, MCAP_SUCCESS, mdl_id,
@@ -1169,6 +1354,7 @@ static void process_md_reconnect_mdl_req(struct mcap_mcl *mcl, void *cmd,
 		shutdown_mdl(mdl);
 
 	mdl->state = MDL_WAITING;
+	mdl_setup_start(mdl);
 	mcl->state = MCL_PENDING;
 	mcap_send_cmd(mcl, MCAP_MD_RECONNECT_MDL_RSP, MCAP_SUCCESS, mdl_id,
 								NULL, 0);
@@ -1706,6 +1892,7 @@ static void mcap_connect_mdl_cb(GIOChannel *chan, GError *conn_err,
 	}
 
 	mdl->state = MDL_CONNECTED;
+	mdl_setup_done(mdl);
 	mdl->wid = g_io_add_watch_full(mdl->dc, G_PRIORITY_DEFAULT,
 					G_IO_ERR | G_IO_HUP | G_IO_NVAL,
 					(GIOFunc) mdl_event_cb,
@@ -1859,6 +2046,7 @@ static void set_mdl_properties(GIOChannel *chan, struct mcap_mdl *mdl)
 
 	mdl->state = MDL_CONNECTED;
 	mdl->dc = g_io_channel_ref(chan);
+	mdl_setup_done(mdl);
 	mdl->wid = g_io_add_watch_full(mdl->dc, G_PRIORITY_DEFAULT,
 					G_IO_ERR | G_IO_HUP | G_IO_NVAL,
 					(GIOFunc) mdl_event_cb,
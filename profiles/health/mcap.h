@@ -18,6 +18,9 @@
 #define MCAP_CC_MTU	48
 #define MCAP_DC_MTU	65535
 
+/* SDUs drained from a data channel per wakeup by mcap_mdl_set_recv */
+#define MCAP_MDL_RX_BATCH	8
+
 /* MCAP Standard Op Codes */
 #define MCAP_ERROR_RSP			0x00
 #define MCAP_MD_CREATE_MDL_REQ		0x01
@@ -198,10 +201,12 @@ typedef enum {
 
 struct mcap_csp;
 struct mcap_mdl_op_cb;
+struct mcap_mdl_recv;
 struct mcap_instance;
 struct mcap_mcl;
 struct mcap_mdl;
 struct sync_info_ind_data;
+struct iovec;
 
 /************ Callbacks ************/
 
@@ -213,6 +218,10 @@ typedef void (* mcap_mdl_operation_conf_cb) (struct mcap_mdl *mdl, uint8_t conf,
 typedef void (* mcap_mdl_operation_cb) (struct mcap_mdl *mdl, GError *err,
 						gpointer data);
 typedef void (* mcap_mdl_notify_cb) (GError *err, gpointer data);
+/* Receives up to MCAP_MDL_RX_BATCH SDUs, return FALSE to stop receiving */
+typedef gboolean (* mcap_mdl_recv_cb) (struct mcap_mdl *mdl,
+						const struct iovec *iov,
+						int count, gpointer data);
 
 /* Next function should return an MCAP appropriate response code */
 typedef uint8_t (* mcap_remote_mdl_conn_req_cb) (struct mcap_mcl *mcl,
@@ -296,6 +305,18 @@ struct mcap_mcl {
 	struct mcap_csp		*csp;		/* CSP control structure */
 };
 
+struct mcap_mdl_stats {
+	uint32_t	connections;	/* Times the data channel connected */
+	uint32_t	setup_latency;	/* Last MDL request to connect (us) */
+	int64_t		connected;	/* Monotonic time of the last connect */
+	uint64_t	rx_bytes;	/* Bytes read by mcap_mdl_set_recv */
+	uint64_t	rx_packets;	/* SDUs read by mcap_mdl_set_recv */
+	uint64_t	tx_bytes;	/* Bytes written by mcap_mdl_send */
+	uint64_t	tx_packets;	/* SDUs written by mcap_mdl_send */
+	uint32_t	rx_queued;	/* Bytes waiting to be read */
+	uint32_t	tx_queued;	/* Bytes waiting to be sent */
+};
+
 struct mcap_mdl {
 	struct mcap_mcl		*mcl;		/* MCL where this MDL belongs */
 	GIOChannel		*dc;		/* MCAP Data Channel IO */
@@ -304,6 +325,11 @@ struct mcap_mdl {
 	uint8_t			mdep_id;	/* MCAP Data End Point */
 	MDLState		state;		/* MDL state */
 	int			ref;		/* References counter */
+	struct mcap_mdl_recv	*recv;		/* Receive watcher data */
+	uint8_t			*rx_ring;	/* Receive buffers */
+	uint16_t		rx_slot;	/* Receive buffer size */
+	int64_t			setup_start;	/* Last MDL request time */
+	struct mcap_mdl_stats	stats;		/* MDL statistics */
 };
 
 struct sync_info_ind_data {
@@ -353,6 +379,14 @@ gboolean mcap_mdl_abort(struct mcap_mdl *mdl,
 
 int mcap_mdl_get_fd(struct mcap_mdl *mdl);
 uint16_t mcap_mdl_get_mdlid(struct mcap_mdl *mdl);
+gboolean mcap_mdl_set_recv(struct mcap_mdl *mdl,
+				mcap_mdl_recv_cb recv_cb,
+				gpointer user_data,
+				GDestroyNotify destroy,
+				GError **err);
+int mcap_mdl_send(struct mcap_mdl *mdl, const void *buf, uint32_t size);
+gboolean mcap_mdl_get_stats(struct mcap_mdl *mdl,
+				struct mcap_mdl_stats *stats);
 struct mcap_mdl *mcap_mdl_ref(struct mcap_mdl *mdl);
 void mcap_mdl_unref(struct mcap_mdl *mdl);
 
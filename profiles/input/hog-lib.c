@@ -66,7 +66,6 @@
 
 #define HOG_REPORT_MAP_MAX_SIZE        512
 #define HID_INFO_SIZE			4
-#define ATT_NOTIFICATION_HEADER_SIZE	3
 
 struct bt_hog {
 	int			ref_count;
@@ -117,6 +116,7 @@ struct report {
 	uint16_t		value_handle;
 	uint8_t			properties;
 	uint16_t		ccc_handle;
+	struct gatt_db_attribute	*ref_attr;
 	guint			notifyid;
 	uint16_t		len;
 	uint8_t			*value;
@@ -328,21 +328,12 @@ static void find_included(struct bt_hog *hog, GAttrib *attrib,
 	}
 }
 
-static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
+static void report_queue_input(struct report *report, const uint8_t *pdu,
+								uint16_t len)
 {
-	struct report *report = user_data;
 	struct bt_hog *hog = report->hog;
 	struct uhid_event ev;
 	uint8_t *buf;
-	int err;
-
-	if (len < ATT_NOTIFICATION_HEADER_SIZE) {
-		error("Malformed ATT notification");
-		return;
-	}
-
-	pdu += ATT_NOTIFICATION_HEADER_SIZE;
-	len -= ATT_NOTIFICATION_HEADER_SIZE;
 
 	memset(&ev, 0, sizeof(ev));
 	ev.type = UHID_INPUT;
@@ -359,18 +350,53 @@ static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
 		ev.u.input.size = len;
 	}
 
+	if (!hog->input)
+		hog->input = queue_new();
+
+	queue_push_tail(hog->input, util_memdup(&ev, sizeof(ev)));
+}
+
+/*
+ * Input reports are handled straight from bt_att and written to uHID from
+ * the notification PDU, without the GAttrib copy or a full uhid_event.
+ */
+static void report_value_cb(struct bt_att_chan *chan, uint8_t opcode,
+					const void *pdu, uint16_t len,
+					void *user_data)
+{
+	struct report *report = user_data;
+	struct bt_hog *hog = report->hog;
+	const uint8_t *value = pdu;
+	int err;
+
+	if (len < sizeof(uint16_t)) {
+		error("Malformed ATT notification");
+		return;
+	}
+
+	if (get_le16(value) != report->value_handle)
+		return;
+
+	value += sizeof(uint16_t);
+	len -= sizeof(uint16_t);
+
 	/* If uhid had not sent UHID_START yet queue up the input */
 	if (!hog->uhid_created || !hog->uhid_start) {
-		if (!hog->input)
-			hog->input = queue_new();
-
-		queue_push_tail(hog->input, util_memdup(&ev, sizeof(ev)));
+		report_queue_input(report, value, len);
 		return;
 	}
 
-	err = bt_uhid_send(hog->uhid, &ev);
+	err = bt_uhid_input(hog->uhid, report->numbered ? report->id : 0,
+								value, len);
 	if (err < 0)
-		error("bt_uhid_send: %s (%d)", strerror(-err), -err);
+		error("bt_uhid_input: %s (%d)", strerror(-err), -err);
+}
+
+static unsigned int report_register(struct bt_hog *hog, struct report *report)
+{
+	return bt_att_register(g_attrib_get_att(hog->attrib),
+					BT_ATT_OP_HANDLE_NFY, report_value_cb,
+					report, NULL);
 }
 
 static void report_ccc_written_cb(guint8 status, const guint8 *pdu,
@@ -386,13 +412,8 @@ static void report_ccc_written_cb(guint8 status, const guint8 *pdu,
 		goto remove;
 	}
 
-	if (report->notifyid)
-		goto remove;
-
-	report->notifyid = g_attrib_register(hog->attrib,
-					ATT_OP_HANDLE_NOTIFY,
-					report->value_handle,
-					report_value_cb, report, NULL);
+	if (!report->notifyid)
+		report->notifyid = report_register(hog, report);
 
 	DBG("Report characteristic descriptor written: notifications enabled");
 
@@ -411,23 +432,6 @@ static void write_ccc(struct bt_hog *hog, GAttrib *attrib, uint16_t handle,
 					report_ccc_written_cb, user_data);
 }
 
-static void ccc_read_cb(guint8 status, const guint8 *pdu, guint16 len,
-							gpointer user_data)
-{
-	struct gatt_request *req = user_data;
-	struct report *report = req->user_data;
-
-	if (status != 0) {
-		error("Error reading CCC value: %s", att_ecode2str(status));
-		goto remove;
-	}
-
-	write_ccc(report->hog, report->hog->attrib, report->ccc_handle, report);
-
-remove:
-	remove_gatt_req(req, status);
-}
-
 static const char *type_to_string(uint8_t type)
 {
 	switch (type) {
@@ -442,6 +446,36 @@ static const char *type_to_string(uint8_t type)
 	return NULL;
 }
 
+static void report_reference_set(struct report *report, const uint8_t *value)
+{
+	struct bt_hog *hog = report->hog;
+
+	report->id = value[0];
+	report->type = value[1];
+
+	DBG("Report 0x%04x: id 0x%02x type %s", report->value_handle,
+				report->id, type_to_string(report->type));
+
+	/* Enable notifications only for Input Reports */
+	if (report->type != HOG_REPORT_TYPE_INPUT || !report->ccc_handle)
+		return;
+
+	/* Bonded devices may notify as soon as they reconnect so handle
+	 * input right away, the CCC is written regardless of its value.
+	 */
+	if (!report->notifyid)
+		report->notifyid = report_register(hog, report);
+
+	write_ccc(hog, hog->attrib, report->ccc_handle, report);
+}
+
+static void db_report_ref_write_value_cb(struct gatt_db_attribute *attr,
+						int err, void *user_data)
+{
+	if (err)
+		error("Error writing report reference value to gatt db");
+}
+
 static void report_reference_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data)
 {
@@ -459,16 +493,13 @@ static void report_reference_cb(guint8 status, const guint8 *pdu,
 		goto remove;
 	}
 
-	report->id = pdu[1];
-	report->type = pdu[2];
-
-	DBG("Report 0x%04x: id 0x%02x type %s", report->value_handle,
-				report->id, type_to_string(report->type));
+	/* Cache the report reference if gatt_db is available */
+	if (report->ref_attr)
+		gatt_db_attribute_write(report->ref_attr, 0, pdu + 1, 2, 0,
+					NULL, db_report_ref_write_value_cb,
+					NULL);
 
-	/* Enable notifications only for Input Reports */
-	if (report->type == HOG_REPORT_TYPE_INPUT)
-		read_char(report->hog, report->hog->attrib, report->ccc_handle,
-							ccc_read_cb, report);
+	report_reference_set(report, pdu + 1);
 
 remove:
 	remove_gatt_req(req, status);
@@ -1311,7 +1342,6 @@ struct bt_hog *bt_hog_new_default(const char *name, uint16_t vendor,
 static void foreach_hog_report(struct gatt_db_attribute *attr, void *user_data)
 {
 	struct report *report = user_data;
-	struct bt_hog *hog = report->hog;
 	const bt_uuid_t *uuid;
 	bt_uuid_t ref_uuid, ccc_uuid;
 	uint16_t handle;
@@ -1321,8 +1351,7 @@ static void foreach_hog_report(struct gatt_db_attribute *attr, void *user_data)
 
 	bt_uuid16_create(&ref_uuid, GATT_REPORT_REFERENCE);
 	if (!bt_uuid_cmp(&ref_uuid, uuid)) {
-		read_char(hog, hog->attrib, handle, report_reference_cb,
-								report);
+		report->ref_attr = attr;
 		return;
 	}
 
@@ -1360,12 +1389,43 @@ static struct report *report_add(struct bt_hog *hog,
 
 	hog->reports = g_slist_append(hog->reports, report);
 
-	read_char(hog, hog->attrib, report->value_handle, report_read_cb,
-								report);
-
 	return report;
 }
 
+static void db_report_ref_read_value_cb(struct gatt_db_attribute *attrib,
+						int err, const uint8_t *value,
+						size_t length, void *user_data)
+{
+	struct iovec *iov = user_data;
+
+	if (err)
+		return;
+
+	iov->iov_base = (void *) value;
+	iov->iov_len = length;
+}
+
+static void report_read_reference(struct report *report)
+{
+	struct bt_hog *hog = report->hog;
+	struct iovec iov = { NULL, 0 };
+	uint16_t handle;
+
+	if (!report->ref_attr)
+		return;
+
+	/* Try to read the cache of report reference if available */
+	gatt_db_attribute_read(report->ref_attr, 0, BT_ATT_OP_READ_REQ, NULL,
+					db_report_ref_read_value_cb, &iov);
+	if (iov.iov_len == 2) {
+		report_reference_set(report, iov.iov_base);
+		return;
+	}
+
+	handle = gatt_db_attribute_get_handle(report->ref_attr);
+	read_char(hog, hog->attrib, handle, report_reference_cb, report);
+}
+
 static void foreach_hog_external(struct gatt_db_attribute *attr,
 							void *user_data)
 {
@@ -1417,6 +1477,7 @@ static void foreach_hog_chrc(struct gatt_db_attribute *attr, void *user_data)
 	if (!bt_uuid_cmp(&report_uuid, &uuid)) {
 		struct report *report = report_add(hog, attr);
 		gatt_db_service_foreach_desc(attr, foreach_hog_report, report);
+		report_read_reference(report);
 		return;
 	}
 
@@ -1777,10 +1838,7 @@ bool bt_hog_attach(struct bt_hog *hog, void *gatt)
 		if (r->notifyid)
 			continue;
 
-		r->notifyid = g_attrib_register(hog->attrib,
-					ATT_OP_HANDLE_NOTIFY,
-					r->value_handle,
-					report_value_cb, r, NULL);
+		r->notifyid = report_register(hog, r);
 	}
 
 	return true;
@@ -1828,7 +1886,8 @@ void bt_hog_detach(struct bt_hog *hog)
 		struct report *r = l->data;
 
 		if (r->notifyid > 0) {
-			g_attrib_unregister(hog->attrib, r->notifyid);
+			bt_att_unregister(g_attrib_get_att(hog->attrib),
+								r->notifyid);
 			r->notifyid = 0;
 		}
 	}
@@ -231,6 +231,17 @@ void midi_read_ev(struct midi_write_parser *parser, const snd_seq_event_t *ev,
 {
 	MIDI_ASSERT(write_cb);
 
+	/* Events coalesced into the same packet keep their own time, which
+	   takes a new timestampLow and thus breaks the running status */
+	if (midi_write_has_data(parser)) {
+		int64_t rtime = g_get_monotonic_time() / 1000;
+
+		if (rtime != parser->rtime) {
+			parser->rtime = rtime;
+			parser->rstatus = SND_SEQ_EVENT_NONE;
+		}
+	}
+
 	append_timestamp_high_maybe(parser);
 
 	/* SysEx is special case:
@@ -253,49 +264,44 @@ static void update_ev_timestamp(struct midi_read_parser *parser,
                                 snd_seq_event_t *ev, uint16_t ts_low)
 {
 	int delta_timestamp;
-	int delta_rtime;
 	int64_t rtime_current;
 	uint16_t timestamp;
 
 	/* time_low overwflow results on time_high to increment by one */
 	if (parser->timestamp_low > ts_low)
-		parser->timestamp_high++;
+		parser->timestamp_high = (parser->timestamp_high + 1) & 0x3F;
+
+	parser->timestamp_low = ts_low;
 
 	timestamp = (parser->timestamp_high << 7) | parser->timestamp_low;
 
 	rtime_current = g_get_monotonic_time() / 1000; /* convert µs to ms */
-	delta_timestamp = timestamp - (int)parser->timestamp;
-	delta_rtime = rtime_current - parser->rtime;
 
-	if (delta_rtime > MIDI_MAX_TIMESTAMP)
-		parser->rtime = rtime_current;
-	else {
-
-		/* If delta_timestamp is way to big than delta_rtime,
-		   this means that the device sent a message in the past,
-		   so we have to compensate for this. */
-		if (delta_timestamp > 7000 && delta_rtime < 1000)
-			delta_timestamp = 0;
-
-		/* check if timestamp did overflow */
-		if (delta_timestamp < 0) {
-			/* same timestamp in the past problem */
-			if ((delta_timestamp + MIDI_MAX_TIMESTAMP) > 7000 &&
-			    delta_rtime < 1000)
-				delta_timestamp = 0;
-			else
-				delta_timestamp = delta_timestamp + MIDI_MAX_TIMESTAMP;
-		}
+	/* Timestamps wrap around, a step forward of more than half of the
+	   range is rather a message sent before the previous one */
+	delta_timestamp = (timestamp - parser->timestamp) & MIDI_MAX_TIMESTAMP;
+	if (delta_timestamp > MIDI_MAX_TIMESTAMP / 2)
+		delta_timestamp -= MIDI_MAX_TIMESTAMP + 1;
 
+	if (parser->rtime < 0 ||
+	    rtime_current - parser->rtime > MIDI_MAX_TIMESTAMP)
+		parser->rtime = rtime_current;
+	else
 		parser->rtime += delta_timestamp;
-	}
 
-	parser->timestamp += delta_timestamp;
-	if (parser->timestamp > MIDI_MAX_TIMESTAMP)
-		parser->timestamp %= MIDI_MAX_TIMESTAMP + 1;
+	/* A message can not be received before it was sent, so either the
+	   first message was delayed or the device clock runs faster than
+	   ours. Either way the arrival time is the better reference. */
+	if (parser->rtime > rtime_current)
+		parser->rtime = rtime_current;
+
+	parser->timestamp = timestamp;
 
-	/* set event timestamp */
-	/* TODO: update event timestamp here! */
+	/* set event timestamp, it is up to the caller to schedule it */
+	ev->flags &= ~SND_SEQ_TIME_STAMP_MASK;
+	ev->flags |= SND_SEQ_TIME_STAMP_REAL;
+	ev->time.time.tv_sec = parser->rtime / 1000;
+	ev->time.time.tv_nsec = (parser->rtime % 1000) * 1000000;
 }
 
 static size_t handle_end_of_sysex(struct midi_read_parser *parser,
@@ -104,6 +104,8 @@ static inline void midi_read_reset(struct midi_read_parser *parser)
 
 /* Parses raw BLE-MIDI messages and populates a sequencer event representing the
    current MIDI message. It returns how much raw data was processed.
+   The event real time is set to when the message was sent, in the
+   g_get_monotonic_time() clock, as far as the BLE-MIDI timestamps tell.
  */
 size_t midi_read_raw(struct midi_read_parser *parser, const uint8_t *data,
                      size_t size, snd_seq_event_t *ev /* OUT */);
@@ -30,11 +30,22 @@
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/io.h"
+#include "src/shared/timeout.h"
 #include "src/log.h"
 #include "attrib/att.h"
 
 #include "libmidi.h"
 
+/* Outgoing events are held for less than the shortest connection interval
+ * so the ones in between connection events go out in a single packet.
+ */
+#define MIDI_WRITE_DELAY	5	/* ms */
+
+/* Upper bound of the latency added to incoming events to compensate the
+ * jitter of the connection interval.
+ */
+#define MIDI_MAX_LATENCY	20000	/* µs */
+
 struct midi {
 	struct btd_device *dev;
 	struct gatt_db *db;
@@ -47,12 +58,34 @@ struct midi {
 	snd_seq_t *seq_handle;
 	int seq_client_id;
 	int seq_port_id;
+	int seq_queue_id;
+	int64_t queue_start;	/* µs, monotonic time the queue started */
+	int64_t latency;	/* µs, added to the incoming events time */
+	unsigned int write_id;
 
 	/* MIDI parser*/
 	struct midi_read_parser midi_in;
 	struct midi_write_parser midi_out;
 };
 
+static bool midi_write_flush(void *user_data)
+{
+	struct midi *midi = user_data;
+
+	midi->write_id = 0;
+
+	if (midi_write_has_data(&midi->midi_out))
+		bt_gatt_client_write_without_response(midi->client,
+		                                      midi->midi_io_handle,
+		                                      false,
+		                                      midi_write_data(&midi->midi_out),
+		                                      midi_write_data_size(&midi->midi_out));
+
+	midi_write_reset(&midi->midi_out);
+
+	return false;
+}
+
 static bool midi_write_cb(struct io *io, void *user_data)
 {
 	struct midi *midi = user_data;
@@ -79,18 +112,68 @@ static bool midi_write_cb(struct io *io, void *user_data)
 
 	} while (err > 0);
 
-	if (midi_write_has_data(&midi->midi_out))
-		bt_gatt_client_write_without_response(midi->client,
-		                                      midi->midi_io_handle,
-		                                      false,
-		                                      midi_write_data(&midi->midi_out),
-		                                      midi_write_data_size(&midi->midi_out));
-
-	midi_write_reset(&midi->midi_out);
+	/* Full packets are already sent, hold the rest for a little while so
+	 * events that follow shortly are coalesced into the same packet.
+	 */
+	if (midi_write_has_data(&midi->midi_out) && !midi->write_id)
+		midi->write_id = timeout_add(MIDI_WRITE_DELAY, midi_write_flush,
+		                             midi, NULL);
 
 	return true;
 }
 
+static void midi_write_cancel(struct midi *midi)
+{
+	if (!midi->write_id)
+		return;
+
+	timeout_remove(midi->write_id);
+	midi->write_id = 0;
+}
+
+/* Schedules the event at the time it was sent plus a latency that follows
+ * the largest transport delay seen lately, so events keep the spacing they
+ * were played with regardless of when their packet made it through.
+ */
+static void midi_schedule_ev(struct midi *midi, const snd_seq_event_t *ev)
+{
+	snd_seq_event_t out = *ev;
+	snd_seq_real_time_t qtime;
+	int64_t now, time, delay;
+
+	if (midi->seq_queue_id < 0 ||
+	    !(ev->flags & SND_SEQ_TIME_STAMP_REAL))
+		goto direct;
+
+	now = g_get_monotonic_time();
+	time = (int64_t) ev->time.time.tv_sec * 1000000 +
+	       ev->time.time.tv_nsec / 1000;
+	delay = now - time;
+
+	/* Follow a larger delay at once but decay slowly */
+	if (delay > midi->latency)
+		midi->latency = MIN(delay, MIDI_MAX_LATENCY);
+	else
+		midi->latency -= (midi->latency - delay) / 256;
+
+	time += midi->latency;
+	if (time <= now)
+		goto direct;
+
+	time -= midi->queue_start;
+	qtime.tv_sec = time / 1000000;
+	qtime.tv_nsec = (time % 1000000) * 1000;
+
+	snd_seq_ev_schedule_real(&out, midi->seq_queue_id, 0, &qtime);
+	snd_seq_event_output_direct(midi->seq_handle, &out);
+
+	return;
+
+direct:
+	snd_seq_ev_set_direct(&out);
+	snd_seq_event_output_direct(midi->seq_handle, &out);
+}
+
 static void midi_io_value_cb(uint16_t value_handle, const uint8_t *value,
                              uint16_t length, void *user_data)
 {
@@ -118,7 +201,7 @@ static void midi_io_value_cb(uint16_t value_handle, const uint8_t *value,
 			goto _err;
 
 		if (ev.type != SND_SEQ_EVENT_NONE)
-			snd_seq_event_output_direct(midi->seq_handle, &ev);
+			midi_schedule_ev(midi, &ev);
 
 		i += count;
 	}
@@ -256,6 +339,7 @@ static void midi_device_remove(struct btd_service *service)
 	}
 
 	if (midi->seq_handle) {
+		midi_write_cancel(midi);
 		midi_read_free(&midi->midi_in);
 		midi_write_free(&midi->midi_out);
 		io_destroy(midi->io);
@@ -336,6 +420,18 @@ static int midi_accept(struct btd_service *service)
 	}
 	midi->seq_port_id = err;
 
+	/* Incoming events are scheduled on a queue, directly if none */
+	midi->seq_queue_id = snd_seq_alloc_queue(midi->seq_handle);
+	if (midi->seq_queue_id < 0)
+		warn("Could not allocate ALSA queue: %s (%d)",
+		     snd_strerror(midi->seq_queue_id), midi->seq_queue_id);
+	else {
+		snd_seq_start_queue(midi->seq_handle, midi->seq_queue_id, NULL);
+		snd_seq_drain_output(midi->seq_handle);
+		midi->queue_start = g_get_monotonic_time();
+	}
+	midi->latency = 0;
+
 	snd_seq_client_info_alloca(&info);
 	err = snd_seq_get_client_info(midi->seq_handle, info);
 	if (err < 0)
@@ -432,6 +528,7 @@ static int midi_disconnect(struct btd_service *service)
 		return -ENODEV;
 	}
 
+	midi_write_cancel(midi);
 	midi_read_free(&midi->midi_in);
 	midi_write_free(&midi->midi_out);
 	io_destroy(midi->io);
@@ -474,5 +571,10 @@ static void midi_exit(void)
 	btd_profile_unregister(&midi_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(midi, VERSION, BLUETOOTH_PLUGIN_PRIORITY_HIGH,
-                        midi_init, midi_exit);
+static const char * const midi_uuids[] = {
+	MIDI_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_UUIDS(midi, VERSION, BLUETOOTH_PLUGIN_PRIORITY_HIGH,
+					midi_init, midi_exit, midi_uuids)
@@ -22,7 +22,9 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <net/if.h>
-#include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
 
 #include <glib.h>
 
@@ -42,6 +44,8 @@
 #define CON_SETUP_TO           9
 
 static int ctl;
+static int rtnl = -1;
+static uint32_t rtnl_seq;
 
 struct __service_16 {
 	uint16_t dst;
@@ -78,12 +82,24 @@ int bnep_init(void)
 		return err;
 	}
 
+	/* Interfaces of all sessions are managed over a single socket */
+	rtnl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (rtnl < 0)
+		error("bnep: Failed to open netlink socket: %s (%d)",
+							strerror(errno), errno);
+
 	return 0;
 }
 
 int bnep_cleanup(void)
 {
 	close(ctl);
+
+	if (rtnl >= 0) {
+		close(rtnl);
+		rtnl = -1;
+	}
+
 	return 0;
 }
 
@@ -137,50 +153,120 @@ static uint32_t bnep_getsuppfeat(void)
 	return feat;
 }
 
-static int bnep_if_up(const char *devname)
+static int rtnl_request(struct nlmsghdr *nlh, void *buf, size_t size)
 {
-	struct ifreq ifr;
-	int sk, err = 0;
+	struct sockaddr_nl addr;
+	uint8_t ack[256];
+	struct nlmsghdr *rsp;
+	ssize_t len;
 
-	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	if (rtnl < 0)
+		return -ENOTCONN;
 
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, devname, IF_NAMESIZE - 1);
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
 
-	ifr.ifr_flags |= IFF_UP;
-	ifr.ifr_flags |= IFF_MULTICAST;
+	nlh->nlmsg_seq = ++rtnl_seq;
 
-	if (ioctl(sk, SIOCSIFFLAGS, (void *) &ifr) < 0) {
-		err = -errno;
-		error("bnep: Could not bring up %s: %s(%d)",
-						devname, strerror(-err), -err);
+	if (sendto(rtnl, nlh, nlh->nlmsg_len, 0, (struct sockaddr *) &addr,
+							sizeof(addr)) < 0)
+		return -errno;
+
+	if (!buf) {
+		buf = ack;
+		size = sizeof(ack);
 	}
 
-	close(sk);
+	/* Skip replies to requests that were given up on */
+	do {
+		len = recv(rtnl, buf, size, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
 
-	return err;
+			return -errno;
+		}
+
+		rsp = buf;
+		if (!NLMSG_OK(rsp, (size_t) len))
+			return -EIO;
+	} while (len < 0 || rsp->nlmsg_seq != nlh->nlmsg_seq);
+
+	if (rsp->nlmsg_type == NLMSG_ERROR) {
+		struct nlmsgerr *nlerr = NLMSG_DATA(rsp);
+
+		return nlerr->error;
+	}
+
+	return len;
 }
 
-static int bnep_if_down(const char *devname)
+/*
+ * Changes the interface master, if master is not negative, and the up state
+ * with a single request, which is what the kernel applies in this order.
+ */
+static int bnep_set_link(const char *devname, int master, bool up)
 {
-	struct ifreq ifr;
-	int sk, err = 0;
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+		uint8_t attr[RTA_SPACE(sizeof(uint32_t))];
+	} req;
+	struct rtattr *rta;
+	int ifindex;
 
-	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	ifindex = if_nametoindex(devname);
+	if (!ifindex)
+		return -errno;
 
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, devname, IF_NAMESIZE - 1);
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nlh.nlmsg_type = RTM_NEWLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	req.ifi.ifi_change = IFF_UP;
+	req.ifi.ifi_flags = 0;
 
-	ifr.ifr_flags &= ~IFF_UP;
+	if (up) {
+		req.ifi.ifi_change |= IFF_MULTICAST;
+		req.ifi.ifi_flags = IFF_UP | IFF_MULTICAST;
+	}
 
-	/* Bring down the interface */
-	if (ioctl(sk, SIOCSIFFLAGS, (void *) &ifr) < 0) {
-		err = -errno;
-		error("bnep: Could not bring down %s: %s(%d)",
-						devname, strerror(-err), -err);
+	if (master >= 0) {
+		uint32_t master_index = master;
+
+		/* Attribute payloads are in host byte order */
+		rta = (void *) req.attr;
+		rta->rta_type = IFLA_MASTER;
+		rta->rta_len = RTA_LENGTH(sizeof(master_index));
+		memcpy(RTA_DATA(rta), &master_index, sizeof(master_index));
+		req.nlh.nlmsg_len += RTA_SPACE(sizeof(master_index));
 	}
 
-	close(sk);
+	return rtnl_request(&req.nlh, NULL, 0);
+}
+
+static int bnep_if_up(const char *devname)
+{
+	int err;
+
+	err = bnep_set_link(devname, -1, true);
+	if (err < 0)
+		error("bnep: Could not bring up %s: %s(%d)",
+						devname, strerror(-err), -err);
+
+	return err;
+}
+
+static int bnep_if_down(const char *devname)
+{
+	int err;
+
+	err = bnep_set_link(devname, -1, false);
+	if (err < 0)
+		error("bnep: Could not bring down %s: %s(%d)",
+						devname, strerror(-err), -err);
 
 	return err;
 }
@@ -428,68 +514,98 @@ void bnep_disconnect(struct bnep *session)
 	bnep_conndel(&session->dst_addr);
 }
 
+/* Enslaves the interface to the bridge and brings it up */
 static int bnep_add_to_bridge(const char *devname, const char *bridge)
 {
-	int ifindex;
-	struct ifreq ifr;
-	int sk, err = 0;
+	int master, err;
 
 	if (!devname || !bridge)
 		return -EINVAL;
 
-	ifindex = if_nametoindex(devname);
-
-	sk = socket(AF_INET, SOCK_STREAM, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, bridge, IFNAMSIZ - 1);
-	ifr.ifr_ifindex = ifindex;
-
-	if (ioctl(sk, SIOCBRADDIF, &ifr) < 0) {
+	master = if_nametoindex(bridge);
+	if (!master)
 		err = -errno;
+	else
+		err = bnep_set_link(devname, master, true);
+
+	if (err < 0) {
 		error("bnep: Can't add %s to the bridge %s: %s(%d)",
 					devname, bridge, strerror(-err), -err);
-	} else {
-		info("bnep: bridge %s: interface %s added", bridge, devname);
+		return err;
 	}
 
-	close(sk);
+	info("bnep: bridge %s: interface %s added", bridge, devname);
 
-	return err;
+	return 0;
 }
 
+/* Releases the interface from its bridge and brings it down */
 static int bnep_del_from_bridge(const char *devname, const char *bridge)
 {
-	int ifindex;
-	struct ifreq ifr;
-	int sk, err = 0;
+	int err;
 
 	if (!devname || !bridge)
 		return -EINVAL;
 
-	ifindex = if_nametoindex(devname);
-
-	sk = socket(AF_INET, SOCK_STREAM, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, bridge, IFNAMSIZ - 1);
-	ifr.ifr_ifindex = ifindex;
-
-	if (ioctl(sk, SIOCBRDELIF, &ifr) < 0) {
-		err = -errno;
+	err = bnep_set_link(devname, 0, false);
+	if (err < 0) {
 		error("bnep: Can't delete %s from the bridge %s: %s(%d)",
 					devname, bridge, strerror(-err), -err);
-	} else {
-		info("bnep: bridge %s: interface %s removed", bridge, devname);
+		return err;
 	}
 
-	close(sk);
+	info("bnep: bridge %s: interface %s removed", bridge, devname);
 
-	return err;
+	return 0;
+}
+
+int bnep_get_stats(const char *iface, struct rtnl_link_stats64 *stats)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	uint8_t buf[4096];
+	struct nlmsghdr *rsp = (void *) buf;
+	struct rtattr *rta;
+	int len, ifindex;
+
+	if (!iface || !stats)
+		return -EINVAL;
+
+	ifindex = if_nametoindex(iface);
+	if (!ifindex)
+		return -errno;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+
+	len = rtnl_request(&req.nlh, buf, sizeof(buf));
+	if (len < 0)
+		return len;
+
+	if (rsp->nlmsg_type != RTM_NEWLINK)
+		return -EIO;
+
+	len = IFLA_PAYLOAD(rsp);
+
+	for (rta = IFLA_RTA(NLMSG_DATA(rsp)); RTA_OK(rta, len);
+						rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFLA_STATS64)
+			continue;
+
+		memset(stats, 0, sizeof(*stats));
+		memcpy(stats, RTA_DATA(rta), MIN(RTA_PAYLOAD(rta),
+							sizeof(*stats)));
+
+		return 0;
+	}
+
+	return -ENOENT;
 }
 
 static ssize_t bnep_send_ctrl_rsp(int sk, uint8_t ctrl, uint16_t resp)
@@ -621,14 +737,6 @@ static int bnep_server_add_legacy(int sk, uint16_t dst, char *bridge,
 		goto reply;
 	}
 
-	err = bnep_if_up(iface);
-	if (err < 0) {
-		bnep_del_from_bridge(iface, bridge);
-		bnep_conndel(addr);
-		rsp = BNEP_CONN_NOT_ALLOWED;
-		goto reply;
-	}
-
 	rsp = BNEP_SUCCESS;
 
 reply:
@@ -690,23 +798,13 @@ int bnep_server_add(int sk, char *bridge, char *iface, const bdaddr_t *addr,
 	}
 
 	err = bnep_add_to_bridge(iface, bridge);
-	if (err < 0)
-		goto failed_conn;
-
-	err = bnep_if_up(iface);
-	if (err < 0)
-		goto failed_bridge;
+	if (err < 0) {
+		bnep_conndel(addr);
+		return err;
+	}
 
 	return 0;
 
-failed_bridge:
-	bnep_del_from_bridge(iface, bridge);
-
-failed_conn:
-	bnep_conndel(addr);
-
-	return err;
-
 failed:
 	if (bnep_send_ctrl_rsp(sk, BNEP_SETUP_CONN_RSP, rsp) < 0) {
 		err = -errno;
@@ -723,6 +821,5 @@ void bnep_server_delete(char *bridge, char *iface, const bdaddr_t *addr)
 		return;
 
 	bnep_del_from_bridge(iface, bridge);
-	bnep_if_down(iface);
 	bnep_conndel(addr);
 }
@@ -9,6 +9,7 @@
  */
 
 struct bnep;
+struct rtnl_link_stats64;
 
 int bnep_init(void);
 int bnep_cleanup(void);
@@ -27,3 +28,4 @@ void bnep_disconnect(struct bnep *session);
 int bnep_server_add(int sk, char *bridge, char *iface, const bdaddr_t *addr,
 						uint8_t *setup_data, int len);
 void bnep_server_delete(char *bridge, char *iface, const bdaddr_t *addr);
+int bnep_get_stats(const char *iface, struct rtnl_link_stats64 *stats);
@@ -193,5 +193,13 @@ static void network_exit(void)
 	bnep_cleanup();
 }
 
-BLUETOOTH_PLUGIN_DEFINE(network, VERSION,
-			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, network_init, network_exit)
+static const char * const network_uuids[] = {
+	PANU_UUID,
+	NAP_UUID,
+	GN_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_UUIDS(network, VERSION,
+			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, network_init,
+			network_exit, network_uuids)
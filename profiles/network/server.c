@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <linux/if_link.h>
 
 #include <glib.h>
 
@@ -44,18 +45,24 @@
 #define BNEP_INTERFACE "bnep%d"
 #define SETUP_TIMEOUT		1
 
-/* Pending Authorization */
+struct network_adapter;
+struct network_server;
+
+/* Pending Authorization or connected client */
 struct network_session {
 	bdaddr_t	dst;		/* Remote Bluetooth Address */
 	char		dev[16];	/* Interface name */
 	GIOChannel	*io;		/* Pending connect channel */
 	guint		watch;		/* BNEP socket watch */
+	guint		auth_id;	/* Pending authorization */
+	struct network_adapter *na;	/* Adapter reference */
+	struct network_server *ns;	/* Server once connected */
 };
 
 struct network_adapter {
 	struct btd_adapter *adapter;	/* Adapter pointer */
 	GIOChannel	*io;		/* Bnep socket */
-	struct network_session *setup;	/* Setup in progress */
+	GSList		*setups;	/* Setups in progress */
 	GSList		*servers;	/* Server register to adapter */
 };
 
@@ -272,31 +279,62 @@ static void session_free(void *data)
 	if (session->watch)
 		g_source_remove(session->watch);
 
+	if (session->auth_id)
+		btd_cancel_authorization(session->auth_id);
+
 	if (session->io)
 		g_io_channel_unref(session->io);
 
 	g_free(session);
 }
 
-static void setup_destroy(void *user_data)
+static void setup_free(struct network_session *setup)
 {
-	struct network_adapter *na = user_data;
-	struct network_session *setup = na->setup;
+	struct network_adapter *na = setup->na;
 
-	if (!setup)
-		return;
-
-	na->setup = NULL;
+	na->setups = g_slist_remove(na->setups, setup);
 
 	session_free(setup);
 }
 
+static gboolean session_disconnected(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct network_session *session = user_data;
+	struct network_server *ns = session->ns;
+
+	DBG("%s disconnected", session->dev);
+
+	/* The kernel removes the interface along with the BNEP session */
+	session->watch = 0;
+	ns->sessions = g_slist_remove(ns->sessions, session);
+	session_free(session);
+
+	return FALSE;
+}
+
+static void session_connected(struct network_server *ns,
+					struct network_session *session)
+{
+	struct network_adapter *na = session->na;
+
+	na->setups = g_slist_remove(na->setups, session);
+
+	session->ns = ns;
+	session->watch = g_io_add_watch(session->io,
+					G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+					session_disconnected, session);
+
+	ns->sessions = g_slist_append(ns->sessions, session);
+}
+
 static gboolean bnep_setup(GIOChannel *chan,
 			GIOCondition cond, gpointer user_data)
 {
 	const uint8_t bt_base[] = { 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
 					0x00, 0x80, 0x5F, 0x9B, 0x34, 0xFB };
-	struct network_adapter *na = user_data;
+	struct network_session *setup = user_data;
+	struct network_adapter *na = setup->na;
 	struct network_server *ns;
 	uint8_t packet[BNEP_MTU];
 	struct bnep_setup_conn_req *req = (void *) packet;
@@ -305,12 +343,15 @@ static gboolean bnep_setup(GIOChannel *chan,
 	int n, sk;
 	char *bridge = NULL;
 
+	/* The watch is gone once this returns */
+	setup->watch = 0;
+
 	if (cond & G_IO_NVAL)
-		return FALSE;
+		goto failed;
 
 	if (cond & (G_IO_ERR | G_IO_HUP)) {
 		error("Hangup or error on BNEP socket");
-		return FALSE;
+		goto failed;
 	}
 
 	sk = g_io_channel_unix_get_fd(chan);
@@ -322,7 +363,7 @@ static gboolean bnep_setup(GIOChannel *chan,
 	n = recv(sk, packet, sizeof(packet), MSG_PEEK);
 	if (n < 0) {
 		error("read(): %s(%d)", strerror(errno), errno);
-		return FALSE;
+		goto failed;
 	}
 
 	/*
@@ -332,7 +373,7 @@ static gboolean bnep_setup(GIOChannel *chan,
 	 */
 	if (n < 3) {
 		error("To few setup connection request data received");
-		return FALSE;
+		goto failed;
 	}
 
 	switch (req->uuid_size) {
@@ -360,47 +401,55 @@ static gboolean bnep_setup(GIOChannel *chan,
 	else
 		bridge = ns->bridge;
 
-	strncpy(na->setup->dev, BNEP_INTERFACE, 16);
-	na->setup->dev[15] = '\0';
+	strncpy(setup->dev, BNEP_INTERFACE, 16);
+	setup->dev[15] = '\0';
 
-	if (bnep_server_add(sk, bridge, na->setup->dev, &na->setup->dst,
-							packet, n) < 0)
+	if (bnep_server_add(sk, bridge, setup->dev, &setup->dst,
+							packet, n) < 0) {
 		error("BNEP server cannot be added");
+		goto failed;
+	}
+
+	session_connected(ns, setup);
+
+	return FALSE;
 
-	na->setup = NULL;
+failed:
+	setup_free(setup);
 
 	return FALSE;
 }
 
 static void connect_event(GIOChannel *chan, GError *err, gpointer user_data)
 {
-	struct network_adapter *na = user_data;
+	struct network_session *setup = user_data;
 
 	if (err) {
 		error("%s", err->message);
-		setup_destroy(na);
+		setup_free(setup);
 		return;
 	}
 
 	g_io_channel_set_close_on_unref(chan, TRUE);
 
-	na->setup->watch = g_io_add_watch_full(chan, G_PRIORITY_DEFAULT,
+	setup->watch = g_io_add_watch(chan,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				bnep_setup, na, setup_destroy);
+				bnep_setup, setup);
 }
 
 static void auth_cb(DBusError *derr, void *user_data)
 {
-	struct network_adapter *na = user_data;
+	struct network_session *setup = user_data;
 	GError *err = NULL;
 
+	setup->auth_id = 0;
+
 	if (derr) {
 		error("Access denied: %s", derr->message);
 		goto reject;
 	}
 
-	if (!bt_io_accept(na->setup->io, connect_event, na, NULL,
-							&err)) {
+	if (!bt_io_accept(setup->io, connect_event, setup, NULL, &err)) {
 		error("bt_io_accept: %s", err->message);
 		g_error_free(err);
 		goto reject;
@@ -409,17 +458,17 @@ static void auth_cb(DBusError *derr, void *user_data)
 	return;
 
 reject:
-	g_io_channel_shutdown(na->setup->io, TRUE, NULL);
-	setup_destroy(na);
+	g_io_channel_shutdown(setup->io, TRUE, NULL);
+	setup_free(setup);
 }
 
 static void confirm_event(GIOChannel *chan, gpointer user_data)
 {
 	struct network_adapter *na = user_data;
+	struct network_session *setup;
 	bdaddr_t src, dst;
 	char address[18];
 	GError *err = NULL;
-	guint ret;
 
 	bt_io_get(chan, &err,
 			BT_IO_OPT_SOURCE_BDADDR, &src,
@@ -434,23 +483,21 @@ static void confirm_event(GIOChannel *chan, gpointer user_data)
 
 	DBG("BNEP: incoming connect from %s", address);
 
-	if (na->setup) {
-		error("Refusing connect from %s: setup in progress", address);
-		goto drop;
-	}
-
 	if (!na->servers)
 		goto drop;
 
-	na->setup = g_new0(struct network_session, 1);
-	bacpy(&na->setup->dst, &dst);
-	na->setup->io = g_io_channel_ref(chan);
+	/* Clients are set up in parallel, each with its own session */
+	setup = g_new0(struct network_session, 1);
+	bacpy(&setup->dst, &dst);
+	setup->io = g_io_channel_ref(chan);
+	setup->na = na;
+	na->setups = g_slist_append(na->setups, setup);
 
-	ret = btd_request_authorization(&src, &dst, BNEP_SVC_UUID,
-					auth_cb, na);
-	if (ret == 0) {
+	setup->auth_id = btd_request_authorization(&src, &dst, BNEP_SVC_UUID,
+							auth_cb, setup);
+	if (setup->auth_id == 0) {
 		error("Refusing connect from %s", address);
-		setup_destroy(na);
+		setup_free(setup);
 		goto drop;
 	}
 
@@ -594,7 +641,7 @@ static void adapter_free(struct network_adapter *na)
 		g_io_channel_unref(na->io);
 	}
 
-	setup_destroy(na);
+	g_slist_free_full(na->setups, session_free);
 	btd_adapter_unref(na->adapter);
 	g_free(na);
 }
@@ -631,6 +678,84 @@ static void path_unregister(void *data)
 	adapter_free(na);
 }
 
+static void append_session_stats(DBusMessageIter *dict,
+					struct network_session *session)
+{
+	struct rtnl_link_stats64 stats;
+	DBusMessageIter entry, value;
+	char address[18];
+	const char *str = address;
+	const char *dev = session->dev;
+
+	if (bnep_get_stats(session->dev, &stats) < 0)
+		return;
+
+	ba2str(&session->dst, address);
+
+	dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL,
+								&entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &str);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&value);
+
+	dict_append_entry(&value, "Interface", DBUS_TYPE_STRING, &dev);
+	dict_append_entry(&value, "RxBytes", DBUS_TYPE_UINT64,
+							&stats.rx_bytes);
+	dict_append_entry(&value, "TxBytes", DBUS_TYPE_UINT64,
+							&stats.tx_bytes);
+	dict_append_entry(&value, "RxPackets", DBUS_TYPE_UINT64,
+							&stats.rx_packets);
+	dict_append_entry(&value, "TxPackets", DBUS_TYPE_UINT64,
+							&stats.tx_packets);
+	dict_append_entry(&value, "RxDropped", DBUS_TYPE_UINT64,
+							&stats.rx_dropped);
+	dict_append_entry(&value, "TxDropped", DBUS_TYPE_UINT64,
+							&stats.tx_dropped);
+
+	dbus_message_iter_close_container(&entry, &value);
+	dbus_message_iter_close_container(dict, &entry);
+}
+
+static DBusMessage *get_statistics(DBusConnection *conn,
+					DBusMessage *msg, void *data)
+{
+	struct network_adapter *na = data;
+	DBusMessageIter iter, dict;
+	DBusMessage *reply;
+	GSList *l, *s;
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_ARRAY_AS_STRING
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	for (l = na->servers; l; l = l->next) {
+		struct network_server *ns = l->data;
+
+		for (s = ns->sessions; s; s = s->next)
+			append_session_stats(&dict, s->data);
+	}
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
 static const GDBusMethodTable server_methods[] = {
 	{ GDBUS_METHOD("Register",
 			GDBUS_ARGS({ "uuid", "s" }, { "bridge", "s" }), NULL,
@@ -638,6 +763,9 @@ static const GDBusMethodTable server_methods[] = {
 	{ GDBUS_METHOD("Unregister",
 			GDBUS_ARGS({ "uuid", "s" }), NULL,
 			unregister_server) },
+	{ GDBUS_EXPERIMENTAL_METHOD("GetStatistics", NULL,
+			GDBUS_ARGS({ "statistics", "a{sa{sv}}" }),
+			get_statistics) },
 	{ }
 };
 
@@ -23,7 +23,7 @@
 #include <sys/ioctl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
-#include <dirent.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -44,9 +44,11 @@
 #include "src/shared/mgmt.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/io.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/timeout.h"
+#include "src/shared/metrics.h"
 
 #include "btio/btio.h"
 #include "btd.h"
@@ -82,6 +84,8 @@
 #define SCAN_TYPE_LE ((1 << BDADDR_LE_PUBLIC) | (1 << BDADDR_LE_RANDOM))
 #define SCAN_TYPE_DUAL (SCAN_TYPE_BREDR | SCAN_TYPE_LE)
 
+#define LOAD_DEVICES_BATCH	64
+
 #define HCI_RSSI_INVALID	127
 #define DISTANCE_VAL_INVALID	0x7FFF
 #define PATHLOSS_MAX		137
@@ -152,6 +156,7 @@ static bool powering_down = false;
 static GSList *adapters = NULL;
 
 static struct mgmt *mgmt_primary = NULL;
+static struct metric *found_metric;
 
 static uint8_t mgmt_version = 0;
 static uint8_t mgmt_revision = 0;
@@ -213,6 +218,7 @@ struct discovery_client {
 	char *owner;
 	guint watch;
 	struct discovery_filter *discovery_filter;
+	bool stream;			/* Held by an advertisement stream */
 };
 
 struct service_auth {
@@ -262,6 +268,7 @@ struct btd_adapter {
 
 	bool discovering;		/* discovering property state */
 	bool filtered_discovery;	/* we are doing filtered discovery */
+	struct filter_matcher *filter_matcher;	/* Compiled discovery_list */
 	bool no_scan_restart_delay;	/* when this flag is set, restart scan
 					 * without delay */
 	uint8_t discovery_type;		/* current active discovery type */
@@ -288,9 +295,22 @@ struct btd_adapter {
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *devices_addr;	/* Devices by address */
+	GHashTable *devices_path;	/* Devices by object path */
+	GHashTable *stored_devices;	/* Stored devices not yet loaded */
+	GSList *unprobed_devices;	/* Loaded devices not yet probed */
+	guint load_devices_id;		/* Deferred loading of devices */
 	GSList *connect_list;		/* Devices to connect when found */
+	struct queue *auto_connect_changes; /* Add/Remove Device not yet sent */
+	guint auto_connect_changes_id;	/* Pending auto-connect flush */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
+	struct queue *uuid_changes;	/* UUID changes not yet sent */
+	guint uuid_changes_id;		/* Pending UUID changes flush */
+	unsigned int uuid_commands;	/* UUID commands awaiting reply */
+	struct queue *found_events;	/* Device found events not yet handled */
+	guint found_events_id;		/* Pending device found processing */
+	struct queue *adv_streams;	/* Raw advertising report streams */
 
 	struct btd_gatt_database *database;
 	struct btd_adv_manager *adv_manager;
@@ -538,10 +558,10 @@ static void store_adapter_info(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 					btd_adapter_get_storage_dir(adapter));
 
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -894,6 +914,105 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+
+	return get_le32(bdaddr->b) ^ get_le16(bdaddr->b + 4);
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+static guint path_hash(gconstpointer key)
+{
+	const char *p;
+	guint hash = 5381;
+
+	for (p = key; *p; p++)
+		hash = (hash << 5) + hash + g_ascii_tolower(*p);
+
+	return hash;
+}
+
+static gboolean path_equal(gconstpointer a, gconstpointer b)
+{
+	return !strcasecmp(a, b);
+}
+
+static void index_addr_add(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
+						struct btd_device *device)
+{
+	GSList *list;
+
+	list = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	if (g_slist_find(list, device))
+		return;
+
+	/* Keep the list order so lookups match the first device created */
+	if (list) {
+		g_slist_append(list, device);
+		return;
+	}
+
+	list = g_slist_append(NULL, device);
+	g_hash_table_insert(adapter->devices_addr,
+				util_memdup(bdaddr, sizeof(*bdaddr)), list);
+}
+
+static void index_addr_remove(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr,
+						struct btd_device *device)
+{
+	GSList *list, *head;
+
+	head = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	list = g_slist_remove(head, device);
+
+	/* Nothing to update unless the first device was removed */
+	if (list == head)
+		return;
+
+	if (!list)
+		g_hash_table_remove(adapter->devices_addr, bdaddr);
+	else
+		g_hash_table_insert(adapter->devices_addr,
+				util_memdup(bdaddr, sizeof(*bdaddr)), list);
+}
+
+/*
+ * Devices are indexed by their address and, when it differs, by the address
+ * of their last connection since device_addr_type_cmp matches both.
+ */
+static void index_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	const bdaddr_t *conn = device_get_conn_address(device);
+
+	index_addr_add(adapter, bdaddr, device);
+
+	if (bacmp(conn, bdaddr) && bacmp(conn, BDADDR_ANY))
+		index_addr_add(adapter, conn, device);
+}
+
+static void unindex_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	const bdaddr_t *conn = device_get_conn_address(device);
+
+	index_addr_remove(adapter, bdaddr, device);
+
+	if (bacmp(conn, bdaddr) && bacmp(conn, BDADDR_ANY))
+		index_addr_remove(adapter, conn, device);
+}
+
+static void load_stored_device_by_addr(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr);
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
@@ -908,8 +1027,12 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
+	/* Devices still waiting to be loaded from storage are loaded now */
+	if (adapter->stored_devices)
+		load_stored_device_by_addr(adapter, dst);
+
+	list = g_hash_table_lookup(adapter->devices_addr, dst);
+	list = g_slist_find_custom(list, &addr, device_addr_type_cmp);
 	if (!list)
 		return NULL;
 
@@ -928,28 +1051,13 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	return device;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 struct btd_device *btd_adapter_find_device_by_path(struct btd_adapter *adapter,
 						   const char *path)
 {
-	GSList *list;
-
 	if (!adapter)
 		return NULL;
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
-		return NULL;
-
-	return list->data;
+	return g_hash_table_lookup(adapter->devices_path, path);
 }
 
 static void uuid_to_uuid128(uuid_t *uuid128, const uuid_t *uuid)
@@ -981,6 +1089,25 @@ static bool is_supported_uuid(const uuid_t *uuid)
 	return true;
 }
 
+struct uuid_change {
+	uint8_t uuid[16];
+	uint8_t svc_hint;
+	bool add;
+};
+
+static void uuid_command_done(struct btd_adapter *adapter)
+{
+	if (adapter->uuid_commands > 0)
+		adapter->uuid_commands--;
+
+	/* Signal the UUIDs once the whole batch has been applied */
+	if (adapter->uuid_commands || !adapter->initialized)
+		return;
+
+	g_dbus_emit_property_changed(dbus_conn, adapter->path,
+						ADAPTER_INTERFACE, "UUIDs");
+}
+
 static void add_uuid_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -989,6 +1116,7 @@ static void add_uuid_complete(uint8_t status, uint16_t length,
 	if (status != MGMT_STATUS_SUCCESS) {
 		btd_error(adapter->dev_id, "Failed to add UUID: %s (0x%02x)",
 						mgmt_errstr(status), status);
+		uuid_command_done(adapter);
 		return;
 	}
 
@@ -999,40 +1127,7 @@ static void add_uuid_complete(uint8_t status, uint16_t length,
 	 */
 	dev_class_changed_callback(adapter->dev_id, length, param, adapter);
 
-	if (adapter->initialized)
-		g_dbus_emit_property_changed(dbus_conn, adapter->path,
-						ADAPTER_INTERFACE, "UUIDs");
-}
-
-static int add_uuid(struct btd_adapter *adapter, uuid_t *uuid, uint8_t svc_hint)
-{
-	struct mgmt_cp_add_uuid cp;
-	uuid_t uuid128;
-	uint128_t uint128;
-
-	if (!is_supported_uuid(uuid)) {
-		btd_warn(adapter->dev_id,
-				"Ignoring unsupported UUID for addition");
-		return 0;
-	}
-
-	uuid_to_uuid128(&uuid128, uuid);
-
-	ntoh128((uint128_t *) uuid128.value.uuid128.data, &uint128);
-	htob128(&uint128, (uint128_t *) cp.uuid);
-	cp.svc_hint = svc_hint;
-
-	DBG("sending add uuid command for index %u", adapter->dev_id);
-
-	if (mgmt_send(adapter->mgmt, MGMT_OP_ADD_UUID,
-				adapter->dev_id, sizeof(cp), &cp,
-				add_uuid_complete, adapter, NULL) > 0)
-		return 0;
-
-	btd_error(adapter->dev_id, "Failed to add UUID for index %u",
-							adapter->dev_id);
-
-	return -EIO;
+	uuid_command_done(adapter);
 }
 
 static void remove_uuid_complete(uint8_t status, uint16_t length,
@@ -1043,6 +1138,7 @@ static void remove_uuid_complete(uint8_t status, uint16_t length,
 	if (status != MGMT_STATUS_SUCCESS) {
 		btd_error(adapter->dev_id, "Failed to remove UUID: %s (0x%02x)",
 						mgmt_errstr(status), status);
+		uuid_command_done(adapter);
 		return;
 	}
 
@@ -1053,39 +1149,134 @@ static void remove_uuid_complete(uint8_t status, uint16_t length,
 	 */
 	dev_class_changed_callback(adapter->dev_id, length, param, adapter);
 
-	if (adapter->initialized)
-		g_dbus_emit_property_changed(dbus_conn, adapter->path,
-						ADAPTER_INTERFACE, "UUIDs");
+	uuid_command_done(adapter);
 }
 
-static int remove_uuid(struct btd_adapter *adapter, uuid_t *uuid)
+static void send_uuid_change(void *data, void *user_data)
 {
-	struct mgmt_cp_remove_uuid cp;
+	struct uuid_change *change = data;
+	struct btd_adapter *adapter = user_data;
+	struct mgmt_cp_add_uuid add_cp;
+	struct mgmt_cp_remove_uuid remove_cp;
+	unsigned int id;
+
+	if (change->add) {
+		memcpy(add_cp.uuid, change->uuid, sizeof(add_cp.uuid));
+		add_cp.svc_hint = change->svc_hint;
+
+		id = mgmt_send(adapter->mgmt, MGMT_OP_ADD_UUID,
+				adapter->dev_id, sizeof(add_cp), &add_cp,
+				add_uuid_complete, adapter, NULL);
+	} else {
+		memcpy(remove_cp.uuid, change->uuid, sizeof(remove_cp.uuid));
+
+		id = mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_UUID,
+				adapter->dev_id, sizeof(remove_cp), &remove_cp,
+				remove_uuid_complete, adapter, NULL);
+	}
+
+	if (id > 0) {
+		adapter->uuid_commands++;
+		return;
+	}
+
+	btd_error(adapter->dev_id, "Failed to %s UUID for index %u",
+				change->add ? "add" : "remove",
+				adapter->dev_id);
+}
+
+static gboolean flush_uuid_changes(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->uuid_changes_id = 0;
+
+	DBG("sending %u uuid changes for index %u",
+			queue_length(adapter->uuid_changes), adapter->dev_id);
+
+	queue_foreach(adapter->uuid_changes, send_uuid_change, adapter);
+	queue_remove_all(adapter->uuid_changes, NULL, NULL, g_free);
+
+	return FALSE;
+}
+
+static bool match_uuid_change(const void *data, const void *match_data)
+{
+	const struct uuid_change *change = data;
+
+	return !memcmp(change->uuid, match_data, sizeof(change->uuid));
+}
+
+/*
+ * Services tend to be registered in bursts, so changes are collected until
+ * the mainloop is idle. A UUID that is added and removed again within the
+ * same burst then never reaches the kernel.
+ */
+static void queue_uuid_change(struct btd_adapter *adapter, uuid_t *uuid,
+						uint8_t svc_hint, bool add)
+{
+	struct uuid_change *change;
 	uuid_t uuid128;
 	uint128_t uint128;
+	uint8_t val[16];
+
+	uuid_to_uuid128(&uuid128, uuid);
+
+	ntoh128((uint128_t *) uuid128.value.uuid128.data, &uint128);
+	htob128(&uint128, (uint128_t *) val);
+
+	change = queue_find(adapter->uuid_changes, match_uuid_change, val);
+	if (change) {
+		if (change->add != add) {
+			queue_remove(adapter->uuid_changes, change);
+			g_free(change);
+			return;
+		}
+
+		change->svc_hint = svc_hint;
+		return;
+	}
+
+	change = g_new0(struct uuid_change, 1);
+	memcpy(change->uuid, val, sizeof(change->uuid));
+	change->svc_hint = svc_hint;
+	change->add = add;
+
+	queue_push_tail(adapter->uuid_changes, change);
+
+	if (!adapter->uuid_changes_id)
+		adapter->uuid_changes_id = g_idle_add(flush_uuid_changes,
+								adapter);
+}
 
+static int add_uuid(struct btd_adapter *adapter, uuid_t *uuid, uint8_t svc_hint)
+{
 	if (!is_supported_uuid(uuid)) {
 		btd_warn(adapter->dev_id,
-				"Ignoring unsupported UUID for removal");
+				"Ignoring unsupported UUID for addition");
 		return 0;
 	}
 
-	uuid_to_uuid128(&uuid128, uuid);
+	DBG("queueing add uuid command for index %u", adapter->dev_id);
 
-	ntoh128((uint128_t *) uuid128.value.uuid128.data, &uint128);
-	htob128(&uint128, (uint128_t *) cp.uuid);
+	queue_uuid_change(adapter, uuid, svc_hint, true);
 
-	DBG("sending remove uuid command for index %u", adapter->dev_id);
+	return 0;
+}
 
-	if (mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_UUID,
-				adapter->dev_id, sizeof(cp), &cp,
-				remove_uuid_complete, adapter, NULL) > 0)
+static int remove_uuid(struct btd_adapter *adapter, uuid_t *uuid)
+{
+	if (!is_supported_uuid(uuid)) {
+		btd_warn(adapter->dev_id,
+				"Ignoring unsupported UUID for removal");
 		return 0;
+	}
 
-	btd_error(adapter->dev_id, "Failed to remove UUID for index %u",
-							adapter->dev_id);
+	DBG("queueing remove uuid command for index %u", adapter->dev_id);
 
-	return -EIO;
+	queue_uuid_change(adapter, uuid, 0, false);
+
+	return 0;
 }
 
 static void clear_uuids_complete(uint8_t status, uint16_t length,
@@ -1302,16 +1493,43 @@ static void service_auth_cancel(struct service_auth *auth)
 	g_free(auth);
 }
 
+struct auto_connect_change {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	bool add;
+};
+
+static bool match_auto_connect_change(const void *data, const void *match_data)
+{
+	const struct auto_connect_change *change = data;
+	struct btd_device *device = (struct btd_device *) match_data;
+
+	return change->bdaddr_type == btd_device_get_bdaddr_type(device) &&
+			!bacmp(&change->bdaddr, device_get_address(device));
+}
+
 static void adapter_remove_device(struct btd_adapter *adapter,
 						struct btd_device *device);
 
 void btd_adapter_remove_device(struct btd_adapter *adapter,
 				struct btd_device *dev)
 {
+	struct auto_connect_change *change;
 	GList *l;
 
 	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
 
+	/* An Add Device still pending would outlive the device */
+	change = queue_find(adapter->auto_connect_changes,
+					match_auto_connect_change, dev);
+	if (change && change->add) {
+		queue_remove(adapter->auto_connect_changes, change);
+		g_free(change);
+	}
+
+	adapter->unprobed_devices = g_slist_remove(adapter->unprobed_devices,
+									dev);
+
 	adapter_remove_device(adapter, dev);
 	btd_adv_monitor_device_remove(adapter->adv_monitor_manager, dev);
 
@@ -1564,6 +1782,10 @@ static void invalidate_rssi_and_tx_power(gpointer a)
 
 	device_set_rssi(dev, 0);
 	device_set_tx_power(dev, 127);
+
+	/* Make sure the next report restores them */
+	device_set_report(dev, BDADDR_BREDR, 0);
+	device_set_report(dev, BDADDR_LE_PUBLIC, 0);
 }
 
 static void discovery_cleanup(struct btd_adapter *adapter, int timeout)
@@ -1622,6 +1844,8 @@ static void discovery_free(void *user_data)
 	g_free(client);
 }
 
+static void discovery_filters_changed(struct btd_adapter *adapter);
+
 static void discovery_remove(struct discovery_client *client)
 {
 	struct btd_adapter *adapter = client->adapter;
@@ -1633,6 +1857,7 @@ static void discovery_remove(struct discovery_client *client)
 
 	adapter->discovery_list = g_slist_remove(adapter->discovery_list,
 								client);
+	discovery_filters_changed(adapter);
 
 	if (adapter->client == client)
 		adapter->client = NULL;
@@ -2220,6 +2445,8 @@ static int update_discovery_filter(struct btd_adapter *adapter)
 
 	DBG("");
 
+	discovery_filters_changed(adapter);
+
 	if (discovery_filter_to_mgmt_cp(adapter, &sd_cp)) {
 		btd_error(adapter->dev_id,
 				"discovery_filter_to_mgmt_cp returned error");
@@ -2733,87 +2960,341 @@ static DBusMessage *stop_discovery(DBusConnection *conn,
 	}
 }
 
-static gboolean property_get_address(const GDBusPropertyTable *property,
-					DBusMessageIter *iter, void *user_data)
-{
-	struct btd_adapter *adapter = user_data;
-	char addr[18];
-	const char *str = addr;
+struct adv_stream {
+	struct btd_adapter *adapter;
+	struct io *io;
+	int16_t rssi;
+	bool has_manufacturer;
+	uint16_t manufacturer;
+	struct discovery_client *client;
+};
 
-	ba2str(&adapter->bdaddr, addr);
+static void adv_stream_free(void *data)
+{
+	struct adv_stream *stream = data;
 
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+	if (stream->client)
+		discovery_stop(stream->client);
 
-	return TRUE;
+	io_destroy(stream->io);
+	free(stream);
 }
 
-static gboolean property_get_address_type(const GDBusPropertyTable *property,
-					DBusMessageIter *iter, void *user_data)
+static bool adv_stream_hup(struct io *io, void *user_data)
 {
-	struct btd_adapter *adapter = user_data;
-	const char *str;
+	struct adv_stream *stream = user_data;
+	struct btd_adapter *adapter = stream->adapter;
 
-	if ((adapter->current_settings & MGMT_SETTING_LE) &&
-				(adapter->bdaddr_type == BDADDR_LE_RANDOM))
-		str = "random";
-	else
-		str = "public";
+	DBG("stream %p closed", stream);
 
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+	queue_remove(adapter->adv_streams, stream);
+	adv_stream_free(stream);
 
-	return TRUE;
+	return false;
 }
 
-static gboolean property_get_name(const GDBusPropertyTable *property,
-					DBusMessageIter *iter, void *user_data)
+static void adv_streams_close(struct btd_adapter *adapter)
 {
-	struct btd_adapter *adapter = user_data;
-	const char *str = adapter->system_name ? : "";
+	const struct queue_entry *entry;
 
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+	/* The discovery clients are released along with the discovery list */
+	for (entry = queue_get_entries(adapter->adv_streams); entry;
+							entry = entry->next) {
+		struct adv_stream *stream = entry->data;
 
-	return TRUE;
+		stream->client = NULL;
+	}
+
+	queue_remove_all(adapter->adv_streams, NULL, NULL, adv_stream_free);
 }
 
-static gboolean property_get_alias(const GDBusPropertyTable *property,
-					DBusMessageIter *iter, void *user_data)
+static bool adv_stream_match_manufacturer(const uint8_t *eir, uint16_t len,
+							uint16_t company)
 {
-	struct btd_adapter *adapter = user_data;
-	const char *str;
+	uint16_t offset = 0;
 
-	if (adapter->current_alias)
-		str = adapter->current_alias;
-	else if (adapter->stored_alias)
-		str = adapter->stored_alias;
-	else
-		str = adapter->system_name ? : "";
+	while (offset + 1 < len) {
+		uint8_t field_len = eir[offset];
 
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+		if (!field_len || offset + 1 + field_len > len)
+			break;
 
-	return TRUE;
+		if (eir[offset + 1] == EIR_MANUFACTURER_DATA &&
+					field_len >= 3 &&
+					get_le16(&eir[offset + 2]) == company)
+			return true;
+
+		offset += field_len + 1;
+	}
+
+	return false;
 }
 
-static void property_set_alias(const GDBusPropertyTable *property,
-				DBusMessageIter *iter,
-				GDBusPendingPropertySet id, void *user_data)
+static void adv_streams_send(struct btd_adapter *adapter,
+					const struct mgmt_ev_device_found *ev,
+					uint16_t length)
 {
-	struct btd_adapter *adapter = user_data;
-	const char *name;
-	int ret;
+	const struct queue_entry *entry;
 
-	dbus_message_iter_get_basic(iter, &name);
+	/*
+	 * The record sent is the Device Found event as is: address, address
+	 * type, RSSI, flags and the raw advertising data, all little endian.
+	 */
+	for (entry = queue_get_entries(adapter->adv_streams); entry;
+							entry = entry->next) {
+		struct adv_stream *stream = entry->data;
 
-	if (g_str_equal(name, "")  == TRUE) {
-		if (adapter->stored_alias == NULL) {
-			/* no alias set, nothing to restore */
-			g_dbus_pending_property_success(id);
-			return;
-		}
+		if (stream->rssi != DISTANCE_VAL_INVALID &&
+						ev->rssi < stream->rssi)
+			continue;
 
-		/* restore to system name */
-		ret = set_name(adapter, adapter->system_name);
-	} else {
-		if (g_strcmp0(adapter->stored_alias, name) == 0) {
+		if (stream->has_manufacturer &&
+				!adv_stream_match_manufacturer(ev->eir,
+						btohs(ev->eir_len),
+						stream->manufacturer))
+			continue;
+
+		/* A reader that falls behind loses reports, never the daemon */
+		if (send(io_get_fd(stream->io), ev, length,
+					MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+					errno != EAGAIN)
+			DBG("stream %p: %s", stream, strerror(errno));
+	}
+}
+
+static bool discovery_streams_only(struct btd_adapter *adapter)
+{
+	GSList *l;
+
+	for (l = adapter->discovery_list; l; l = g_slist_next(l)) {
+		struct discovery_client *client = l->data;
+
+		if (!client->stream)
+			return false;
+	}
+
+	return true;
+}
+
+static int adv_stream_discover(struct adv_stream *stream)
+{
+	struct btd_adapter *adapter = stream->adapter;
+	struct discovery_client *client;
+	int err;
+
+	client = g_new0(struct discovery_client, 1);
+	client->adapter = adapter;
+	client->stream = true;
+
+	/* Let the controller drop weak reports when a threshold is given */
+	client->discovery_filter = g_new0(struct discovery_filter, 1);
+	client->discovery_filter->type = SCAN_TYPE_LE;
+	client->discovery_filter->pathloss = DISTANCE_VAL_INVALID;
+	client->discovery_filter->rssi = stream->rssi;
+	client->discovery_filter->duplicate = true;
+
+	adapter->discovery_list = g_slist_prepend(adapter->discovery_list,
+								client);
+	stream->client = client;
+
+	err = update_discovery_filter(adapter);
+	if (err == -EINPROGRESS)
+		return 0;
+
+	if (err < 0) {
+		stream->client = NULL;
+		discovery_remove(client);
+	}
+
+	return err;
+}
+
+static bool parse_adv_stream_options(DBusMessage *msg,
+					struct adv_stream *stream,
+					dbus_bool_t *discovery)
+{
+	DBusMessageIter iter, dict;
+
+	dbus_message_iter_init(msg, &iter);
+	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(&iter, &dict);
+
+	while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry, value;
+		const char *key;
+		int type;
+
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &value);
+		type = dbus_message_iter_get_arg_type(&value);
+
+		if (!strcmp(key, "RSSI") && type == DBUS_TYPE_INT16) {
+			dbus_message_iter_get_basic(&value, &stream->rssi);
+			if (stream->rssi > 20 || stream->rssi < -127)
+				return false;
+		} else if (!strcmp(key, "Manufacturer") &&
+						type == DBUS_TYPE_UINT16) {
+			dbus_message_iter_get_basic(&value,
+						&stream->manufacturer);
+			stream->has_manufacturer = true;
+		} else if (!strcmp(key, "Discovery") &&
+						type == DBUS_TYPE_BOOLEAN) {
+			dbus_message_iter_get_basic(&value, discovery);
+		} else
+			return false;
+
+		dbus_message_iter_next(&dict);
+	}
+
+	return true;
+}
+
+static DBusMessage *acquire_adv_stream(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	struct adv_stream *stream;
+	dbus_bool_t discovery = FALSE;
+	DBusMessage *reply;
+	int fds[2];
+	int err;
+
+	DBG("sender %s", dbus_message_get_sender(msg));
+
+	if (!btd_adapter_get_powered(adapter))
+		return btd_error_not_ready(msg);
+
+	stream = new0(struct adv_stream, 1);
+	stream->adapter = adapter;
+	stream->rssi = DISTANCE_VAL_INVALID;
+
+	if (!parse_adv_stream_options(msg, stream, &discovery)) {
+		free(stream);
+		return btd_error_invalid_args(msg);
+	}
+
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+								0, fds) < 0) {
+		free(stream);
+		return btd_error_failed(msg, strerror(errno));
+	}
+
+	stream->io = io_new(fds[0]);
+	if (!stream->io) {
+		close(fds[0]);
+		close(fds[1]);
+		free(stream);
+		return btd_error_failed(msg, strerror(EIO));
+	}
+
+	io_set_close_on_destroy(stream->io, true);
+	io_set_disconnect_handler(stream->io, adv_stream_hup, stream, NULL);
+
+	if (discovery) {
+		err = adv_stream_discover(stream);
+		if (err < 0) {
+			close(fds[1]);
+			adv_stream_free(stream);
+			return btd_error_failed(msg, strerror(-err));
+		}
+	}
+
+	queue_push_tail(adapter->adv_streams, stream);
+
+	reply = g_dbus_create_reply(msg, DBUS_TYPE_UNIX_FD, &fds[1],
+							DBUS_TYPE_INVALID);
+	close(fds[1]);
+
+	DBG("stream %p fd %d", stream, fds[0]);
+
+	return reply;
+}
+
+static gboolean property_get_address(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	char addr[18];
+	const char *str = addr;
+
+	ba2str(&adapter->bdaddr, addr);
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+
+	return TRUE;
+}
+
+static gboolean property_get_address_type(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	const char *str;
+
+	if ((adapter->current_settings & MGMT_SETTING_LE) &&
+				(adapter->bdaddr_type == BDADDR_LE_RANDOM))
+		str = "random";
+	else
+		str = "public";
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+
+	return TRUE;
+}
+
+static gboolean property_get_name(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	const char *str = adapter->system_name ? : "";
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+
+	return TRUE;
+}
+
+static gboolean property_get_alias(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	const char *str;
+
+	if (adapter->current_alias)
+		str = adapter->current_alias;
+	else if (adapter->stored_alias)
+		str = adapter->stored_alias;
+	else
+		str = adapter->system_name ? : "";
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+
+	return TRUE;
+}
+
+static void property_set_alias(const GDBusPropertyTable *property,
+				DBusMessageIter *iter,
+				GDBusPendingPropertySet id, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	const char *name;
+	int ret;
+
+	dbus_message_iter_get_basic(iter, &name);
+
+	if (g_str_equal(name, "")  == TRUE) {
+		if (adapter->stored_alias == NULL) {
+			/* no alias set, nothing to restore */
+			g_dbus_pending_property_success(id);
+			return;
+		}
+
+		/* restore to system name */
+		ret = set_name(adapter, adapter->system_name);
+	} else {
+		if (g_strcmp0(adapter->stored_alias, name) == 0) {
 			/* alias already set, nothing to do */
 			g_dbus_pending_property_success(id);
 			return;
@@ -3361,15 +3842,13 @@ static DBusMessage *remove_device(DBusConnection *conn,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = g_hash_table_lookup(adapter->devices_path, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!btd_adapter_get_powered(adapter))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, true);
 
 	if (!btd_device_is_connected(device)) {
@@ -3686,6 +4165,10 @@ static const GDBusMethodTable adapter_methods[] = {
 	{ GDBUS_EXPERIMENTAL_ASYNC_METHOD("ConnectDevice",
 				GDBUS_ARGS({ "properties", "a{sv}" }), NULL,
 				connect_device) },
+	{ GDBUS_EXPERIMENTAL_METHOD("AcquireAdvertisementStream",
+				GDBUS_ARGS({ "options", "a{sv}" }),
+				GDBUS_ARGS({ "fd", "h" }),
+				acquire_adv_stream) },
 	{ }
 };
 
@@ -3964,7 +4447,7 @@ static int generate_and_write_irk(uint8_t *irk, GKeyFile *key_file,
 	g_key_file_set_string(key_file, "General", "IdentityResolvingKey",
 								str_irk_out);
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -3986,7 +4469,7 @@ static int load_irk(struct btd_adapter *adapter, uint8_t *irk)
 					btd_adapter_get_storage_dir(adapter));
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -4059,6 +4542,103 @@ static int set_privacy(struct btd_adapter *adapter, uint8_t privacy)
 	return -1;
 }
 
+static void set_phy_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		btd_error(adapter->dev_id, "Failed to set PHYs: %s (0x%02x)",
+						mgmt_errstr(status), status);
+		return;
+	}
+
+	DBG("LE 2M PHY preferred for index %u", adapter->dev_id);
+}
+
+static void get_phy_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	const struct mgmt_rp_get_phy_confguration *rp = param;
+	struct mgmt_cp_set_phy_confguration cp;
+	uint32_t supported, configurable, selected, le_2m;
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		btd_error(adapter->dev_id, "Failed to get PHYs: %s (0x%02x)",
+						mgmt_errstr(status), status);
+		return;
+	}
+
+	if (length < sizeof(*rp)) {
+		btd_error(adapter->dev_id, "Wrong size of get PHYs response");
+		return;
+	}
+
+	supported = btohl(rp->supported_phys);
+	configurable = btohl(rp->configurable_phys);
+	selected = btohl(rp->selected_phys);
+
+	DBG("supported 0x%08x configurable 0x%08x selected 0x%08x",
+					supported, configurable, selected);
+
+	le_2m = (MGMT_PHY_LE_2M_TX | MGMT_PHY_LE_2M_RX) & supported &
+								configurable;
+	if (!le_2m || (selected & le_2m) == le_2m)
+		return;
+
+	/*
+	 * The selected PHYs become the default PHY preference of the
+	 * controller, which then switches new links to 2M by itself as soon
+	 * as the remote supports it.
+	 */
+	cp.selected_phys = htobl(selected | le_2m);
+
+	if (mgmt_send(adapter->mgmt, MGMT_OP_SET_PHY_CONFIGURATION,
+				adapter->dev_id, sizeof(cp), &cp,
+				set_phy_complete, adapter, NULL) > 0)
+		return;
+
+	btd_error(adapter->dev_id, "Failed to set PHYs for index %u",
+							adapter->dev_id);
+}
+
+static void prefer_le_2m_phy(struct btd_adapter *adapter)
+{
+	if (mgmt_send(adapter->mgmt, MGMT_OP_GET_PHY_CONFIGURATION,
+				adapter->dev_id, 0, NULL,
+				get_phy_complete, adapter, NULL) > 0)
+		return;
+
+	btd_error(adapter->dev_id, "Failed to get PHYs for index %u",
+							adapter->dev_id);
+}
+
+/*
+ * The kernel replaces its whole list of keys or parameters with the content
+ * of each load command, so they cannot be split over several commands. Load
+ * as many entries as fit in a single command instead of failing the command
+ * altogether.
+ */
+static size_t load_count(struct btd_adapter *adapter, const char *what,
+				size_t count, size_t cp_len, size_t entry_len)
+{
+	uint16_t mtu = mgmt_get_mtu(adapter->mgmt);
+	size_t max_count = 0;
+
+	if (mtu > cp_len)
+		max_count = (mtu - cp_len) / entry_len;
+
+	if (count <= max_count)
+		return count;
+
+	btd_warn(adapter->dev_id, "Unable to load %zu of %zu %s for hci%u",
+					count - max_count, count, what,
+					adapter->dev_id);
+
+	return max_count;
+}
+
 static void load_link_keys_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -4093,7 +4673,8 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 	if (!(adapter->supported_settings & MGMT_SETTING_BREDR))
 		return;
 
-	key_count = g_slist_length(keys);
+	key_count = load_count(adapter, "link keys", g_slist_length(keys),
+						sizeof(*cp), sizeof(*key));
 
 	DBG("hci%u keys %zu debug_keys %d", adapter->dev_id, key_count,
 								debug_keys);
@@ -4118,7 +4699,8 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 	cp->debug_keys = debug_keys;
 	cp->key_count = htobs(key_count);
 
-	for (l = keys, key = cp->keys; l != NULL; l = g_slist_next(l), key++) {
+	for (l = keys, key = cp->keys; l && key_count;
+			l = g_slist_next(l), key++, key_count--) {
 		struct link_key_info *info = l->data;
 
 		bacpy(&key->addr.bdaddr, &info->bdaddr);
@@ -4157,9 +4739,8 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 {
 	struct mgmt_cp_load_long_term_keys *cp;
 	struct mgmt_ltk_info *key;
-	size_t key_count, max_key_count, cp_size;
+	size_t key_count, cp_size;
 	GSList *l;
-	uint16_t mtu;
 
 	/*
 	 * If the controller does not support Low Energy operation,
@@ -4174,10 +4755,8 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	if (!(adapter->supported_settings & MGMT_SETTING_LE))
 		return;
 
-	key_count = g_slist_length(keys);
-	mtu = mgmt_get_mtu(adapter->mgmt);
-	max_key_count = (mtu - sizeof(*cp)) / sizeof(*key);
-	key_count = MIN(max_key_count, key_count);
+	key_count = load_count(adapter, "LTKs", g_slist_length(keys),
+						sizeof(*cp), sizeof(*key));
 
 	DBG("hci%u keys %zu", adapter->dev_id, key_count);
 
@@ -4273,7 +4852,8 @@ static void load_irks(struct btd_adapter *adapter, GSList *irks)
 	if (!(adapter->supported_settings & MGMT_SETTING_PRIVACY))
 		return;
 
-	irk_count = g_slist_length(irks);
+	irk_count = load_count(adapter, "IRKs", g_slist_length(irks),
+						sizeof(*cp), sizeof(*irk));
 
 	DBG("hci%u irks %zu", adapter->dev_id, irk_count);
 
@@ -4293,7 +4873,8 @@ static void load_irks(struct btd_adapter *adapter, GSList *irks)
 	 */
 	cp->irk_count = htobs(irk_count);
 
-	for (l = irks, irk = cp->irks; l != NULL; l = g_slist_next(l), irk++) {
+	for (l = irks, irk = cp->irks; l && irk_count;
+			l = g_slist_next(l), irk++, irk_count--) {
 		struct irk_info *info = l->data;
 
 		bacpy(&irk->addr.bdaddr, &info->bdaddr);
@@ -4342,7 +4923,9 @@ static void load_conn_params(struct btd_adapter *adapter, GSList *params)
 	if (!(adapter->supported_settings & MGMT_SETTING_LE))
 		return;
 
-	param_count = g_slist_length(params);
+	param_count = load_count(adapter, "connection parameters",
+					g_slist_length(params), sizeof(*cp),
+					sizeof(*param));
 
 	DBG("hci%u conn params %zu", adapter->dev_id, param_count);
 
@@ -4357,7 +4940,8 @@ static void load_conn_params(struct btd_adapter *adapter, GSList *params)
 
 	cp->param_count = htobs(param_count);
 
-	for (l = params, param = cp->params; l; l = g_slist_next(l), param++) {
+	for (l = params, param = cp->params; l && param_count;
+			l = g_slist_next(l), param++, param_count--) {
 		struct conn_param *info = l->data;
 
 		bacpy(&param->addr.bdaddr, &info->bdaddr);
@@ -4377,6 +4961,41 @@ static void load_conn_params(struct btd_adapter *adapter, GSList *params)
 		btd_error(adapter->dev_id, "Load connection parameters failed");
 }
 
+/*
+ * Kernels that support it also update the connection if the device is
+ * connected, otherwise the parameters are used for the next connection.
+ */
+int btd_adapter_update_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type,
+				uint16_t min_interval, uint16_t max_interval,
+				uint16_t latency, uint16_t timeout)
+{
+	uint8_t buf[sizeof(struct mgmt_cp_load_conn_param) +
+					sizeof(struct mgmt_conn_param)];
+	struct mgmt_cp_load_conn_param *cp = (void *) buf;
+	struct mgmt_conn_param *param = cp->params;
+
+	if (!(adapter->supported_settings & MGMT_SETTING_LE))
+		return -ENOTSUP;
+
+	memset(buf, 0, sizeof(buf));
+	cp->param_count = htobs(1);
+
+	bacpy(&param->addr.bdaddr, bdaddr);
+	param->addr.type = bdaddr_type;
+	param->min_interval = htobs(min_interval);
+	param->max_interval = htobs(max_interval);
+	param->latency = htobs(latency);
+	param->timeout = htobs(timeout);
+
+	if (!mgmt_send(adapter->mgmt, MGMT_OP_LOAD_CONN_PARAM,
+				adapter->dev_id, sizeof(buf), buf,
+				load_conn_params_complete, adapter, NULL))
+		return -EIO;
+
+	return 0;
+}
+
 static uint8_t get_le_addr_type(GKeyFile *keyfile)
 {
 	uint8_t addr_type;
@@ -4641,6 +5260,154 @@ done:
 	mgmt_tlv_list_free(list);
 }
 
+struct stored_device {
+	bdaddr_t bdaddr;
+	char name[18];
+	GKeyFile *key_file;
+	bool paired;
+};
+
+static void stored_device_free(void *data)
+{
+	struct stored_device *stored = data;
+
+	g_key_file_free(stored->key_file);
+	g_free(stored);
+}
+
+static void load_stored_device(struct btd_adapter *adapter,
+					struct stored_device *stored)
+{
+	struct btd_device *device;
+	GSList *list;
+
+	list = g_hash_table_lookup(adapter->devices_addr, &stored->bdaddr);
+	list = g_slist_find_custom(list, stored->name, device_address_cmp);
+	if (list) {
+		device = list->data;
+		goto device_exist;
+	}
+
+	device = device_create_from_storage(adapter, stored->name,
+							stored->key_file);
+	if (!device)
+		return;
+
+	btd_device_set_temporary(device, false);
+	adapter_add_device(adapter, device);
+
+	/* TODO: register services from pre-loaded list of primaries */
+
+	adapter->unprobed_devices = g_slist_prepend(adapter->unprobed_devices,
+								device);
+
+device_exist:
+	if (stored->paired) {
+		device_set_paired(device, BDADDR_BREDR);
+		device_set_bonded(device, BDADDR_BREDR);
+	}
+}
+
+static void load_stored_device_by_addr(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr)
+{
+	struct stored_device *stored;
+
+	stored = g_hash_table_lookup(adapter->stored_devices, bdaddr);
+	if (!stored)
+		return;
+
+	/* Profiles are probed by the next batch, not from within a lookup */
+	g_hash_table_steal(adapter->stored_devices, bdaddr);
+	load_stored_device(adapter, stored);
+	stored_device_free(stored);
+}
+
+static void probe_loaded_devices(struct btd_adapter *adapter)
+{
+	GSList *devices = g_slist_reverse(adapter->unprobed_devices);
+
+	adapter->unprobed_devices = NULL;
+
+	g_slist_free_full(devices, probe_devices);
+}
+
+static bool load_devices_batch(struct btd_adapter *adapter)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GSList *batch = NULL, *l;
+	int count = 0;
+
+	/*
+	 * Creating a device may look up others, which loads them on demand,
+	 * so the batch is taken out of the table before any is loaded.
+	 */
+	g_hash_table_iter_init(&iter, adapter->stored_devices);
+
+	while (count++ < LOAD_DEVICES_BATCH &&
+				g_hash_table_iter_next(&iter, NULL, &value)) {
+		g_hash_table_iter_steal(&iter);
+		batch = g_slist_prepend(batch, value);
+	}
+
+	for (l = batch; l; l = g_slist_next(l))
+		load_stored_device(adapter, l->data);
+
+	g_slist_free_full(batch, stored_device_free);
+
+	probe_loaded_devices(adapter);
+
+	/* Probing may have loaded further devices on demand */
+	if (g_hash_table_size(adapter->stored_devices) > 0 ||
+						adapter->unprobed_devices)
+		return true;
+
+	g_hash_table_destroy(adapter->stored_devices);
+	adapter->stored_devices = NULL;
+
+	DBG("hci%u all stored devices loaded", adapter->dev_id);
+
+	/* restore Service Changed CCC value for bonded devices */
+	btd_gatt_database_restore_svc_chng_ccc(adapter->database);
+
+	return false;
+}
+
+static gboolean load_devices_idle(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (load_devices_batch(adapter))
+		return TRUE;
+
+	adapter->load_devices_id = 0;
+
+	return FALSE;
+}
+
+static void cancel_load_devices(struct btd_adapter *adapter)
+{
+	if (adapter->load_devices_id) {
+		g_source_remove(adapter->load_devices_id);
+		adapter->load_devices_id = 0;
+	}
+
+	if (adapter->stored_devices) {
+		g_hash_table_destroy(adapter->stored_devices);
+		adapter->stored_devices = NULL;
+	}
+
+	g_slist_free(adapter->unprobed_devices);
+	adapter->unprobed_devices = NULL;
+}
+
+/*
+ * Loading is split in two phases. The keys are read from storage and handed
+ * to the kernel right away, so that bonded devices can reconnect, while the
+ * device objects are created in batches from an idle source. A device that is
+ * looked up before its batch is loaded on demand.
+ */
 static void load_devices(struct btd_adapter *adapter)
 {
 	char dirname[PATH_MAX];
@@ -4648,61 +5415,54 @@ static void load_devices(struct btd_adapter *adapter)
 	GSList *ltks = NULL;
 	GSList *irks = NULL;
 	GSList *params = NULL;
-	GSList *added_devices = NULL;
 	GError *gerr = NULL;
-	DIR *dir;
-	struct dirent *entry;
+	GSList *names, *l;
 
 	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s",
 					btd_adapter_get_storage_dir(adapter));
 
-	dir = opendir(dirname);
-	if (!dir) {
-		btd_error(adapter->dev_id,
-				"Unable to open adapter storage directory: %s",
-								dirname);
-		return;
-	}
+	names = btd_storage_list_dirs(dirname);
 
-	while ((entry = readdir(dir)) != NULL) {
-		struct btd_device *device;
+	adapter->stored_devices = g_hash_table_new_full(bdaddr_hash,
+							bdaddr_equal, NULL,
+							stored_device_free);
+
+	for (l = names; l; l = g_slist_next(l)) {
+		const char *name = l->data;
+		struct stored_device *stored;
 		char filename[PATH_MAX];
 		GKeyFile *key_file;
 		struct link_key_info *key_info;
 		struct smp_ltk_info *ltk_info;
 		struct smp_ltk_info *peripheral_ltk_info;
-		GSList *list;
 		struct irk_info *irk_info;
 		struct conn_param *param;
 		uint8_t bdaddr_type;
 
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		if (entry->d_type != DT_DIR || bachk(entry->d_name) < 0)
+		if (bachk(name) < 0)
 			continue;
 
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					btd_adapter_get_storage_dir(adapter),
-					entry->d_name);
+					name);
 
 		key_file = g_key_file_new();
-		if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+		if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 			error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 			g_clear_error(&gerr);
 		}
 
-		key_info = get_key_info(key_file, entry->d_name);
+		key_info = get_key_info(key_file, name);
 
 		bdaddr_type = get_le_addr_type(key_file);
 
-		ltk_info = get_ltk_info(key_file, entry->d_name, bdaddr_type);
+		ltk_info = get_ltk_info(key_file, name, bdaddr_type);
 
 		peripheral_ltk_info = get_peripheral_ltk_info(key_file,
-						entry->d_name, bdaddr_type);
+						name, bdaddr_type);
 
-		irk_info = get_irk_info(key_file, entry->d_name, bdaddr_type);
+		irk_info = get_irk_info(key_file, name, bdaddr_type);
 
 		// If any key for the device is blocked, we discard all.
 		if ((key_info && key_info->is_blocked) ||
@@ -4731,55 +5491,37 @@ static void load_devices(struct btd_adapter *adapter)
 				irk_info = NULL;
 			}
 
-			goto free;
+			g_key_file_free(key_file);
+			continue;
 		}
 
 		if (key_info)
-			keys = g_slist_append(keys, key_info);
+			keys = g_slist_prepend(keys, key_info);
 
 		if (ltk_info)
-			ltks = g_slist_append(ltks, ltk_info);
+			ltks = g_slist_prepend(ltks, ltk_info);
 
 		if (peripheral_ltk_info)
-			ltks = g_slist_append(ltks, peripheral_ltk_info);
+			ltks = g_slist_prepend(ltks, peripheral_ltk_info);
 
 		if (irk_info)
-			irks = g_slist_append(irks, irk_info);
+			irks = g_slist_prepend(irks, irk_info);
 
-		param = get_conn_param(key_file, entry->d_name, bdaddr_type);
+		param = get_conn_param(key_file, name, bdaddr_type);
 		if (param)
-			params = g_slist_append(params, param);
-
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
-		if (list) {
-			device = list->data;
-			goto device_exist;
-		}
+			params = g_slist_prepend(params, param);
 
-		device = device_create_from_storage(adapter, entry->d_name,
-							key_file);
-		if (!device)
-			goto free;
+		stored = g_new0(struct stored_device, 1);
+		str2ba(name, &stored->bdaddr);
+		strncpy(stored->name, name, sizeof(stored->name) - 1);
+		stored->key_file = key_file;
+		stored->paired = key_info != NULL;
 
-		btd_device_set_temporary(device, false);
-		adapter_add_device(adapter, device);
-
-		/* TODO: register services from pre-loaded list of primaries */
-
-		added_devices = g_slist_append(added_devices, device);
-
-device_exist:
-		if (key_info) {
-			device_set_paired(device, BDADDR_BREDR);
-			device_set_bonded(device, BDADDR_BREDR);
-		}
-
-free:
-		g_key_file_free(key_file);
+		g_hash_table_replace(adapter->stored_devices, &stored->bdaddr,
+									stored);
 	}
 
-	closedir(dir);
+	g_slist_free_full(names, g_free);
 
 	load_link_keys(adapter, keys, btd_opts.debug_keys);
 	g_slist_free_full(keys, g_free);
@@ -4791,7 +5533,13 @@ free:
 	load_conn_params(adapter, params);
 	g_slist_free_full(params, g_free);
 
-	g_slist_free_full(added_devices, probe_devices);
+	DBG("hci%u %u stored devices", adapter->dev_id,
+				g_hash_table_size(adapter->stored_devices));
+
+	/* The first batch is loaded right away so small setups are unchanged */
+	if (load_devices_batch(adapter))
+		adapter->load_devices_id = g_idle_add(load_devices_idle,
+								adapter);
 }
 
 int btd_adapter_block_address(struct btd_adapter *adapter,
@@ -4959,6 +5707,9 @@ static void adapter_add_device(struct btd_adapter *adapter,
 						struct btd_device *device)
 {
 	adapter->devices = g_slist_append(adapter->devices, device);
+	index_device(adapter, device);
+	g_hash_table_insert(adapter->devices_path,
+				(void *) device_get_path(device), device);
 	device_added_drivers(adapter, device);
 }
 
@@ -4966,6 +5717,8 @@ static void adapter_remove_device(struct btd_adapter *adapter,
 						struct btd_device *device)
 {
 	adapter->devices = g_slist_remove(adapter->devices, device);
+	unindex_device(adapter, device);
+	g_hash_table_remove(adapter->devices_path, device_get_path(device));
 	device_removed_drivers(adapter, device);
 }
 
@@ -4973,7 +5726,10 @@ static void adapter_add_connection(struct btd_adapter *adapter,
 						struct btd_device *device,
 						uint8_t bdaddr_type)
 {
+	/* The connection address becomes the current address */
+	unindex_device(adapter, device);
 	device_add_connection(device, bdaddr_type);
+	index_device(adapter, device);
 
 	if (g_slist_find(adapter->connections, device)) {
 		btd_error(adapter->dev_id,
@@ -5344,14 +6100,126 @@ static void add_device_complete(uint8_t status, uint16_t length,
 	}
 }
 
-void adapter_auto_connect_add(struct btd_adapter *adapter,
-					struct btd_device *device)
+static void remove_device_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
 {
-	struct mgmt_cp_add_device cp;
-	const bdaddr_t *bdaddr;
-	uint8_t bdaddr_type;
+	const struct mgmt_rp_remove_device *rp = param;
+	char addr[18];
+
+	if (length < sizeof(*rp)) {
+		error("Too small Remove Device complete event");
+		return;
+	}
+
+	ba2str(&rp->addr.bdaddr, addr);
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		error("Failed to remove device %s (%u): %s (0x%02x)",
+			addr, rp->addr.type, mgmt_errstr(status), status);
+		return;
+	}
+
+	DBG("%s (%u) removed from kernel connect list", addr, rp->addr.type);
+}
+
+static void send_auto_connect_change(void *data, void *user_data)
+{
+	struct auto_connect_change *change = data;
+	struct btd_adapter *adapter = user_data;
+	struct mgmt_cp_add_device add_cp;
+	struct mgmt_cp_remove_device remove_cp;
+	struct btd_device *device;
 	unsigned int id;
 
+	if (!change->add) {
+		memset(&remove_cp, 0, sizeof(remove_cp));
+		bacpy(&remove_cp.addr.bdaddr, &change->bdaddr);
+		remove_cp.addr.type = change->bdaddr_type;
+
+		mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
+				adapter->dev_id, sizeof(remove_cp), &remove_cp,
+				remove_device_complete, adapter, NULL);
+		return;
+	}
+
+	memset(&add_cp, 0, sizeof(add_cp));
+	bacpy(&add_cp.addr.bdaddr, &change->bdaddr);
+	add_cp.addr.type = change->bdaddr_type;
+	add_cp.action = 0x02;
+
+	id = mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE,
+			adapter->dev_id, sizeof(add_cp), &add_cp,
+			add_device_complete, adapter, NULL);
+	if (id > 0)
+		return;
+
+	device = btd_adapter_find_device(adapter, &change->bdaddr,
+							change->bdaddr_type);
+	adapter->connect_list = g_slist_remove(adapter->connect_list, device);
+}
+
+static gboolean flush_auto_connect_changes(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (adapter->auto_connect_changes_id) {
+		g_source_remove(adapter->auto_connect_changes_id);
+		adapter->auto_connect_changes_id = 0;
+	}
+
+	if (queue_isempty(adapter->auto_connect_changes))
+		return FALSE;
+
+	DBG("sending %u auto-connect changes for index %u",
+			queue_length(adapter->auto_connect_changes),
+			adapter->dev_id);
+
+	queue_foreach(adapter->auto_connect_changes, send_auto_connect_change,
+								adapter);
+	queue_remove_all(adapter->auto_connect_changes, NULL, NULL, g_free);
+
+	return FALSE;
+}
+
+/*
+ * Profiles enable auto-connect one device at a time, which at startup means
+ * a burst of Add Device commands that each make the kernel rewrite its
+ * accept list. Like the UUID changes they are collected until the mainloop
+ * is idle and then sent back to back, and adding and removing the same
+ * device within one burst cancel out. Addresses are copied since the device
+ * might be gone by the time the change is sent.
+ */
+static void queue_auto_connect_change(struct btd_adapter *adapter,
+					struct btd_device *device, bool add)
+{
+	struct auto_connect_change *change;
+
+	change = queue_find(adapter->auto_connect_changes,
+					match_auto_connect_change, device);
+	if (change) {
+		if (change->add != add) {
+			queue_remove(adapter->auto_connect_changes, change);
+			g_free(change);
+		}
+		return;
+	}
+
+	change = g_new0(struct auto_connect_change, 1);
+	bacpy(&change->bdaddr, device_get_address(device));
+	change->bdaddr_type = btd_device_get_bdaddr_type(device);
+	change->add = add;
+
+	queue_push_tail(adapter->auto_connect_changes, change);
+
+	if (!adapter->auto_connect_changes_id)
+		adapter->auto_connect_changes_id = g_idle_add(
+						flush_auto_connect_changes,
+						adapter);
+}
+
+void adapter_auto_connect_add(struct btd_adapter *adapter,
+					struct btd_device *device)
+{
 	if (!btd_has_kernel_features(KERNEL_CONN_CONTROL))
 		return;
 
@@ -5361,24 +6229,12 @@ void adapter_auto_connect_add(struct btd_adapter *adapter,
 		return;
 	}
 
-	bdaddr = device_get_address(device);
-	bdaddr_type = btd_device_get_bdaddr_type(device);
-
-	if (bdaddr_type == BDADDR_BREDR) {
+	if (btd_device_get_bdaddr_type(device) == BDADDR_BREDR) {
 		DBG("auto-connection feature is not avaiable for BR/EDR");
 		return;
 	}
 
-	memset(&cp, 0, sizeof(cp));
-	bacpy(&cp.addr.bdaddr, bdaddr);
-	cp.addr.type = bdaddr_type;
-	cp.action = 0x02;
-
-	id = mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE,
-			adapter->dev_id, sizeof(cp), &cp, add_device_complete,
-			adapter, NULL);
-	if (id == 0)
-		return;
+	queue_auto_connect_change(adapter, device, true);
 
 	adapter->connect_list = g_slist_append(adapter->connect_list, device);
 }
@@ -5434,36 +6290,9 @@ static void device_flags_changed_callback(uint16_t index, uint16_t length,
 }
 
 
-static void remove_device_complete(uint8_t status, uint16_t length,
-					const void *param, void *user_data)
-{
-	const struct mgmt_rp_remove_device *rp = param;
-	char addr[18];
-
-	if (length < sizeof(*rp)) {
-		error("Too small Remove Device complete event");
-		return;
-	}
-
-	ba2str(&rp->addr.bdaddr, addr);
-
-	if (status != MGMT_STATUS_SUCCESS) {
-		error("Failed to remove device %s (%u): %s (0x%02x)",
-			addr, rp->addr.type, mgmt_errstr(status), status);
-		return;
-	}
-
-	DBG("%s (%u) removed from kernel connect list", addr, rp->addr.type);
-}
-
 void adapter_auto_connect_remove(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
-	struct mgmt_cp_remove_device cp;
-	const bdaddr_t *bdaddr;
-	uint8_t bdaddr_type;
-	unsigned int id;
-
 	if (!btd_has_kernel_features(KERNEL_CONN_CONTROL))
 		return;
 
@@ -5472,23 +6301,12 @@ void adapter_auto_connect_remove(struct btd_adapter *adapter,
 		return;
 	}
 
-	bdaddr = device_get_address(device);
-	bdaddr_type = btd_device_get_bdaddr_type(device);
-
-	if (bdaddr_type == BDADDR_BREDR) {
+	if (btd_device_get_bdaddr_type(device) == BDADDR_BREDR) {
 		DBG("auto-connection feature is not avaiable for BR/EDR");
 		return;
-	}
-
-	memset(&cp, 0, sizeof(cp));
-	bacpy(&cp.addr.bdaddr, bdaddr);
-	cp.addr.type = bdaddr_type;
-
-	id = mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
-			adapter->dev_id, sizeof(cp), &cp,
-			remove_device_complete, adapter, NULL);
-	if (id == 0)
-		return;
+	}
+
+	queue_auto_connect_change(adapter, device, false);
 
 	adapter->connect_list = g_slist_remove(adapter->connect_list, device);
 }
@@ -5500,6 +6318,9 @@ static void adapter_start(struct btd_adapter *adapter)
 
 	DBG("adapter %s has been enabled", adapter->path);
 
+	/* Let the kernel see the complete accept list before scanning */
+	flush_auto_connect_changes(adapter);
+
 	trigger_passive_scanning(adapter);
 }
 
@@ -5563,6 +6384,8 @@ static void remove_discovery_list(struct btd_adapter *adapter)
 
 	g_slist_free_full(adapter->discovery_list, discovery_free);
 	adapter->discovery_list = NULL;
+
+	discovery_filters_changed(adapter);
 }
 
 static void adapter_free(gpointer user_data)
@@ -5574,6 +6397,7 @@ static void adapter_free(gpointer user_data)
 	/* Make sure the adapter's discovery list is cleaned up before freeing
 	 * the adapter.
 	 */
+	adv_streams_close(adapter);
 	remove_discovery_list(adapter);
 
 	if (adapter->pairable_timeout_id > 0) {
@@ -5589,9 +6413,28 @@ static void adapter_free(gpointer user_data)
 	if (adapter->auth_idle_id)
 		g_source_remove(adapter->auth_idle_id);
 
+	if (adapter->uuid_changes_id)
+		g_source_remove(adapter->uuid_changes_id);
+
+	queue_destroy(adapter->uuid_changes, g_free);
+
+	if (adapter->found_events_id)
+		g_source_remove(adapter->found_events_id);
+
+	queue_destroy(adapter->found_events, free);
+
+	queue_destroy(adapter->adv_streams, NULL);
+
+	if (adapter->auto_connect_changes_id)
+		g_source_remove(adapter->auto_connect_changes_id);
+
+	queue_destroy(adapter->auto_connect_changes, g_free);
+
 	g_queue_foreach(adapter->auths, free_service_auth, NULL);
 	g_queue_free(adapter->auths);
 	queue_destroy(adapter->exps, NULL);
+	g_hash_table_destroy(adapter->devices_addr);
+	g_hash_table_destroy(adapter->devices_path);
 
 	/*
 	 * Unregister all handlers for this specific index since
@@ -5670,10 +6513,10 @@ static void convert_names_entry(char *key, char *value, void *user_data)
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", address, str);
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -5681,7 +6524,7 @@ static void convert_names_entry(char *key, char *value, void *user_data)
 	g_key_file_set_string(key_file, "General", "Name", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, data, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -5891,14 +6734,10 @@ static void convert_entry(char *key, char *value, void *user_data)
 		return;
 
 	if (converter->force == FALSE) {
-		struct stat st;
-		int err;
-
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s",
 				converter->address, key);
 
-		err = stat(filename, &st);
-		if (err || !S_ISDIR(st.st_mode))
+		if (!btd_storage_dir_exists(filename))
 			return;
 	}
 
@@ -5906,7 +6745,7 @@ static void convert_entry(char *key, char *value, void *user_data)
 			converter->address, key);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -5918,8 +6757,8 @@ static void convert_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6012,7 +6851,7 @@ static void store_sdp_record(char *local, char *peer, int handle, char *value)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6023,8 +6862,8 @@ static void store_sdp_record(char *local, char *peer, int handle, char *value)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6045,12 +6884,10 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	struct stat st;
 	sdp_record_t *rec;
 	uuid_t uuid;
 	char *att_uuid, *prim_uuid;
 	uint16_t start = 0, end = 0, psm = 0;
-	int err;
 	char *data;
 	gsize length = 0;
 
@@ -6068,8 +6905,7 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, dst_addr);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_dir_exists(filename))
 		return;
 
 	/* store device records in cache */
@@ -6096,7 +6932,7 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 								dst_addr);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6106,8 +6942,8 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6156,7 +6992,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", address,
 									key);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6180,8 +7016,8 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	if (length == 0)
 		goto end;
 
-	create_file(filename, 0600);
-	if (!g_file_set_contents(filename, data, length, &gerr)) {
+	btd_storage_create(filename);
+	if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6196,7 +7032,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", address, key);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6205,8 +7041,8 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6225,11 +7061,10 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	char dst_addr[18];
 	char type = BDADDR_BREDR;
 	uint16_t handle;
-	int ret, err;
+	int ret;
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	struct stat st;
 	char group[6];
 	char *data;
 	gsize length = 0;
@@ -6245,14 +7080,13 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, dst_addr);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_dir_exists(filename))
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/ccc", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6263,8 +7097,8 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6281,11 +7115,10 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	char dst_addr[18];
 	char type = BDADDR_BREDR;
 	uint16_t handle;
-	int ret, err;
+	int ret;
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	struct stat st;
 	char group[6];
 	char *data;
 	gsize length = 0;
@@ -6301,14 +7134,13 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, dst_addr);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_dir_exists(filename))
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/gatt", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6319,8 +7151,8 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6338,8 +7170,6 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	struct stat st;
-	int err;
 	char *data;
 	gsize length = 0;
 
@@ -6356,14 +7186,13 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, key);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_dir_exists(filename))
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/proximity", src_addr,
 									key);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6373,8 +7202,8 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -6476,10 +7305,10 @@ static void convert_config(struct btd_adapter *adapter, const char *filename,
 	if (read_local_name(&adapter->bdaddr, str) == 0)
 		g_key_file_set_string(key_file, "General", "Alias", str);
 
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, data, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -6554,7 +7383,6 @@ static void load_config(struct btd_adapter *adapter)
 {
 	GKeyFile *key_file;
 	char filename[PATH_MAX];
-	struct stat st;
 	GError *gerr = NULL;
 
 	key_file = g_key_file_new();
@@ -6562,12 +7390,12 @@ static void load_config(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 					btd_adapter_get_storage_dir(adapter));
 
-	if (stat(filename, &st) < 0) {
+	if (!btd_storage_exists(filename)) {
 		convert_config(adapter, filename, key_file);
 		convert_device_storage(adapter);
 	}
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6651,6 +7479,13 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 	adapter->exps = queue_new();
+	adapter->uuid_changes = queue_new();
+	adapter->found_events = queue_new();
+	adapter->adv_streams = queue_new();
+	adapter->auto_connect_changes = queue_new();
+	adapter->devices_addr = g_hash_table_new_full(bdaddr_hash, bdaddr_equal,
+								free, NULL);
+	adapter->devices_path = g_hash_table_new(path_hash, path_equal);
 
 	return btd_adapter_ref(adapter);
 }
@@ -6665,13 +7500,24 @@ static void adapter_remove(struct btd_adapter *adapter)
 	g_slist_free(adapter->connect_list);
 	adapter->connect_list = NULL;
 
+	cancel_load_devices(adapter);
+
 	for (l = adapter->devices; l; l = l->next) {
+		unindex_device(adapter, l->data);
 		device_removed_drivers(adapter, l->data);
 		device_remove(l->data, FALSE);
 	}
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
+	g_hash_table_remove_all(adapter->devices_path);
+
+	if (adapter->found_events_id) {
+		g_source_remove(adapter->found_events_id);
+		adapter->found_events_id = 0;
+	}
+
+	queue_remove_all(adapter->found_events, NULL, NULL, free);
 
 	discovery_cleanup(adapter, 0);
 
@@ -6778,8 +7624,8 @@ static void adapter_msd_notify(struct btd_adapter *adapter,
 	}
 }
 
-static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
-								int8_t rssi)
+static bool clients_filter_match(GSList *discovery_filter,
+					const struct eir_view *view, int8_t rssi)
 {
 	GSList *l, *m;
 	bool got_match = false;
@@ -6806,12 +7652,15 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 		else {
 			for (m = item->uuids; m != NULL && got_match != true;
 							m = g_slist_next(m)) {
+				bt_uuid_t uuid;
+
 				/* m->data contains string representation of
 				 * uuid.
 				 */
-				if (g_slist_find_custom(eir_data->services,
-							m->data,
-							g_strcmp) != NULL)
+				if (bt_string_to_uuid(&uuid, m->data) < 0)
+					continue;
+
+				if (eir_view_has_uuid(view, &uuid))
 					got_match = true;
 			}
 		}
@@ -6821,8 +7670,8 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 			if (item->rssi == DISTANCE_VAL_INVALID ||
 			    item->rssi <= rssi ||
 			    item->pathloss == DISTANCE_VAL_INVALID ||
-			    (eir_data->tx_power != 127 &&
-			     eir_data->tx_power - rssi <= item->pathloss))
+			    (view->tx_power != 127 &&
+			     view->tx_power - rssi <= item->pathloss))
 				return true;
 
 			got_match = false;
@@ -6832,6 +7681,236 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 	return got_match;
 }
 
+/* Clients are tracked with one bit each */
+#define FILTER_MATCHER_MAX	64
+
+struct matcher_uuid {
+	uint128_t value;
+	uint64_t clients;
+};
+
+struct filter_matcher {
+	bool match_all;
+	bool fallback;
+	uint64_t clients;
+	uint64_t no_uuids;		/* Clients without UUID filter */
+	uint64_t no_proximity;		/* Clients without proximity filter */
+	int16_t rssi[FILTER_MATCHER_MAX];
+	uint16_t pathloss[FILTER_MATCHER_MAX];
+	struct matcher_uuid *uuids;	/* Sorted by value */
+	unsigned int uuid_count;
+	uint8_t uuid16[(UINT16_MAX + 1) / 8];
+};
+
+static int matcher_uuid_cmp(const void *a, const void *b)
+{
+	const struct matcher_uuid *uuid_a = a;
+	const struct matcher_uuid *uuid_b = b;
+
+	return memcmp(&uuid_a->value, &uuid_b->value, sizeof(uuid_a->value));
+}
+
+static uint16_t uuid128_get_uuid16(const bt_uuid_t *uuid, bool *base)
+{
+	bt_uuid_t uuid16;
+	uint16_t value;
+
+	value = get_be16(&uuid->value.u128.data[2]);
+
+	bt_uuid16_create(&uuid16, value);
+	*base = !bt_uuid_cmp(&uuid16, uuid);
+
+	return value;
+}
+
+static void filter_matcher_add_uuids(struct filter_matcher *matcher,
+						GSList *uuids, uint64_t client)
+{
+	GSList *l;
+
+	for (l = uuids; l; l = g_slist_next(l)) {
+		struct matcher_uuid *entry;
+		bt_uuid_t uuid, uuid128;
+		uint16_t value;
+		bool base;
+
+		if (bt_string_to_uuid(&uuid, l->data) < 0)
+			continue;
+
+		bt_uuid_to_uuid128(&uuid, &uuid128);
+
+		matcher->uuids = g_renew(struct matcher_uuid, matcher->uuids,
+						matcher->uuid_count + 1);
+		entry = &matcher->uuids[matcher->uuid_count++];
+		entry->value = uuid128.value.u128;
+		entry->clients = client;
+
+		value = uuid128_get_uuid16(&uuid128, &base);
+		if (base)
+			matcher->uuid16[value / 8] |= 1 << (value % 8);
+	}
+}
+
+static struct filter_matcher *filter_matcher_new(GSList *discovery_list)
+{
+	struct filter_matcher *matcher;
+	unsigned int i, count = 0;
+	GSList *l;
+
+	matcher = g_new0(struct filter_matcher, 1);
+
+	for (l = discovery_list; l; l = g_slist_next(l)) {
+		struct discovery_client *client = l->data;
+		struct discovery_filter *item = client->discovery_filter;
+		uint64_t bit;
+
+		/* A regular discovery reports every device */
+		if (!item) {
+			matcher->match_all = true;
+			return matcher;
+		}
+
+		if (count == FILTER_MATCHER_MAX) {
+			matcher->fallback = true;
+			return matcher;
+		}
+
+		bit = UINT64_C(1) << count;
+
+		matcher->clients |= bit;
+		matcher->rssi[count] = item->rssi;
+		matcher->pathloss[count] = item->pathloss;
+
+		if (item->rssi == DISTANCE_VAL_INVALID ||
+				item->pathloss == DISTANCE_VAL_INVALID)
+			matcher->no_proximity |= bit;
+
+		if (!item->uuids)
+			matcher->no_uuids |= bit;
+		else
+			filter_matcher_add_uuids(matcher, item->uuids, bit);
+
+		count++;
+	}
+
+	if (!matcher->uuid_count)
+		return matcher;
+
+	qsort(matcher->uuids, matcher->uuid_count, sizeof(*matcher->uuids),
+							matcher_uuid_cmp);
+
+	/* Merge the clients of UUIDs that appear in several filters */
+	for (i = 1, count = 0; i < matcher->uuid_count; i++) {
+		struct matcher_uuid *last = &matcher->uuids[count];
+
+		if (!matcher_uuid_cmp(last, &matcher->uuids[i]))
+			last->clients |= matcher->uuids[i].clients;
+		else
+			matcher->uuids[++count] = matcher->uuids[i];
+	}
+
+	matcher->uuid_count = count + 1;
+
+	return matcher;
+}
+
+static void filter_matcher_free(struct filter_matcher *matcher)
+{
+	if (!matcher)
+		return;
+
+	g_free(matcher->uuids);
+	g_free(matcher);
+}
+
+struct filter_match {
+	const struct filter_matcher *matcher;
+	uint64_t clients;
+};
+
+static bool filter_match_uuid(const bt_uuid_t *uuid, void *user_data)
+{
+	struct filter_match *match = user_data;
+	const struct filter_matcher *matcher = match->matcher;
+	struct matcher_uuid key, *entry;
+	bt_uuid_t uuid128;
+
+	/* Most reports only carry 16-bit UUIDs, avoid searching those */
+	if (uuid->type == BT_UUID16) {
+		uint16_t value = uuid->value.u16;
+
+		if (!(matcher->uuid16[value / 8] & (1 << (value % 8))))
+			return false;
+	}
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+	key.value = uuid128.value.u128;
+
+	entry = bsearch(&key, matcher->uuids, matcher->uuid_count,
+					sizeof(*matcher->uuids),
+					matcher_uuid_cmp);
+	if (entry)
+		match->clients |= entry->clients;
+
+	/* Stop once every client has been matched */
+	return match->clients == matcher->clients;
+}
+
+static void discovery_filters_changed(struct btd_adapter *adapter)
+{
+	filter_matcher_free(adapter->filter_matcher);
+	adapter->filter_matcher = NULL;
+}
+
+/*
+ * The filters of all clients are compiled into a single matcher the first
+ * time a report needs them, so the cost of matching a report doesn't grow
+ * with the number of clients.
+ */
+static bool is_filter_match(struct btd_adapter *adapter,
+					const struct eir_view *view, int8_t rssi)
+{
+	struct filter_matcher *matcher;
+	struct filter_match match;
+	unsigned int i;
+
+	if (!adapter->filter_matcher)
+		adapter->filter_matcher = filter_matcher_new(
+						adapter->discovery_list);
+
+	matcher = adapter->filter_matcher;
+
+	if (matcher->match_all)
+		return true;
+
+	if (matcher->fallback)
+		return clients_filter_match(adapter->discovery_list, view,
+									rssi);
+
+	match.matcher = matcher;
+	match.clients = matcher->no_uuids;
+
+	if (matcher->uuid_count && match.clients != matcher->clients)
+		eir_view_foreach_uuid(view, filter_match_uuid, &match);
+
+	if (match.clients & matcher->no_proximity)
+		return true;
+
+	for (i = 0; i < FILTER_MATCHER_MAX; i++) {
+		if (!(match.clients & (UINT64_C(1) << i)))
+			continue;
+
+		if (matcher->rssi[i] <= rssi)
+			return true;
+
+		if (view->tx_power != 127 &&
+				view->tx_power - rssi <= matcher->pathloss[i])
+			return true;
+	}
+
+	return false;
+}
+
 static void filter_duplicate_data(void *data, void *user_data)
 {
 	struct discovery_client *client = data;
@@ -6843,17 +7922,49 @@ static void filter_duplicate_data(void *data, void *user_data)
 	*duplicate = client->discovery_filter->duplicate;
 }
 
+static bool discovery_has_filter(struct btd_adapter *adapter)
+{
+	GSList *l;
+
+	for (l = adapter->discovery_list; l; l = g_slist_next(l)) {
+		struct discovery_client *client = l->data;
+
+		if (client->discovery_filter)
+			return true;
+	}
+
+	return false;
+}
+
+/* FNV-1a of the report data and of what affects how it is handled */
+static uint64_t report_fingerprint(const uint8_t *data, uint8_t data_len,
+							bool discovery)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t i;
+
+	hash = (hash ^ discovery) * 0x100000001b3ULL;
+	hash = (hash ^ data_len) * 0x100000001b3ULL;
+
+	for (i = 0; i < data_len; i++)
+		hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+	/* 0 is used for devices without any report */
+	return hash ? hash : 1;
+}
+
 static bool device_is_discoverable(struct btd_adapter *adapter,
-					struct eir_data *eir, const char *addr,
-					uint8_t bdaddr_type)
+					const struct eir_view *view,
+					const char *addr, uint8_t bdaddr_type)
 {
 	GSList *l;
+	char *name = NULL;
 	bool discoverable;
 
 	if (bdaddr_type == BDADDR_BREDR || adapter->filtered_discovery)
 		discoverable = true;
 	else
-		discoverable = eir->flags & (EIR_LIM_DISC | EIR_GEN_DISC);
+		discoverable = view->flags & (EIR_LIM_DISC | EIR_GEN_DISC);
 
 	/*
 	 * Mark as not discoverable if no client has requested discovery and
@@ -6875,17 +7986,28 @@ static bool device_is_discoverable(struct btd_adapter *adapter,
 		discoverable = false;
 
 		pattern_len = strlen(filter->pattern);
-		if (!pattern_len)
-			return true;
+		if (!pattern_len) {
+			discoverable = true;
+			break;
+		}
 
-		if (!strncmp(filter->pattern, addr, pattern_len))
-			return true;
+		if (!strncmp(filter->pattern, addr, pattern_len)) {
+			discoverable = true;
+			break;
+		}
 
-		if (eir->name && !strncmp(filter->pattern, eir->name,
-							pattern_len))
-			return true;
+		/* Only convert the name once a pattern needs it */
+		if (!name)
+			name = eir_view_get_name(view);
+
+		if (name && !strncmp(filter->pattern, name, pattern_len)) {
+			discoverable = true;
+			break;
+		}
 	}
 
+	g_free(name);
+
 	return discoverable;
 }
 
@@ -6900,13 +8022,16 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 {
 	struct btd_device *dev;
 	struct bt_ad *ad = NULL;
+	struct eir_view view;
 	struct eir_data eir_data;
 	bool name_known, discoverable;
 	char addr[18];
 	bool duplicate = false;
 	struct queue *matched_monitors = NULL;
+	uint64_t report = 0;
 
-	if (!btd_adv_monitor_offload_enabled(adapter->adv_monitor_manager)) {
+	if (btd_adv_monitor_host_filter_enabled(
+					adapter->adv_monitor_manager)) {
 		if (bdaddr_type != BDADDR_BREDR)
 			ad = bt_ad_new_with_data(data_len, data);
 
@@ -6926,20 +8051,55 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 	if (!adapter->discovering && !monitoring)
 		return;
 
-	memset(&eir_data, 0, sizeof(eir_data));
-	eir_parse(&eir_data, data, data_len);
+	/* Reports only wanted by streams never create Device objects */
+	if (!monitoring && adapter->discovery_list &&
+					discovery_streams_only(adapter))
+		return;
+
+	/*
+	 * Unless monitors or discovery filters need to look at the data, a
+	 * report identical to the last one handled for the device can only
+	 * update its RSSI so skip parsing it again.
+	 */
+	if (!monitoring && !adapter->msd_callbacks &&
+					!discovery_has_filter(adapter))
+		report = report_fingerprint(data, data_len,
+					adapter->discovery_list != NULL);
+
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+	if (dev && device_match_report(dev, bdaddr_type, report)) {
+		device_update_last_seen(dev, bdaddr_type);
+
+		if (!btd_device_is_connected(dev) &&
+			(device_is_temporary(dev) && !adapter->discovery_list))
+			return;
+
+		device_set_legacy(dev, legacy);
+
+		if (name_resolve_failed)
+			device_name_resolve_fail(dev);
+
+		device_set_rssi(dev, rssi);
+
+		name_known = device_name_known(dev);
+
+		goto found;
+	}
+
+	/*
+	 * Only look at the fields needed to filter the report, everything
+	 * else is parsed once the device is known to be updated.
+	 */
+	eir_view_init(&view, data, data_len);
 
 	ba2str(bdaddr, addr);
 
-	discoverable = device_is_discoverable(adapter, &eir_data, addr,
+	discoverable = device_is_discoverable(adapter, &view, addr,
 							bdaddr_type);
 
-	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
 	if (!dev) {
-		if (!discoverable && !monitoring) {
-			eir_data_free(&eir_data);
+		if (!discoverable && !monitoring)
 			return;
-		}
 
 		dev = adapter_create_device(adapter, bdaddr, bdaddr_type);
 	}
@@ -6947,7 +8107,6 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 	if (!dev) {
 		btd_error(adapter->dev_id,
 			"Unable to create object for found device %s", addr);
-		eir_data_free(&eir_data);
 		return;
 	}
 
@@ -6959,15 +8118,19 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 	 * kernels send them merged, so once we know which mgmt version
 	 * supports this we can make the non-zero check conditional.
 	 */
-	if (bdaddr_type != BDADDR_BREDR && eir_data.flags &&
-					!(eir_data.flags & EIR_BREDR_UNSUP)) {
+	if (bdaddr_type != BDADDR_BREDR && view.flags &&
+					!(view.flags & EIR_BREDR_UNSUP)) {
 		device_set_bredr_support(dev);
 		/* Update last seen for BR/EDR in case its flag is set */
 		device_update_last_seen(dev, BDADDR_BREDR);
 	}
 
-	if (eir_data.name != NULL && eir_data.name_complete)
-		device_store_cached_name(dev, eir_data.name);
+	if (view.name && view.name_complete) {
+		char *name = eir_view_get_name(&view);
+
+		device_store_cached_name(dev, name);
+		g_free(name);
+	}
 
 	/*
 	 * Only skip devices that are not connected, are temporary, and there
@@ -6975,20 +8138,19 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 	 */
 	if (!btd_device_is_connected(dev) &&
 		(device_is_temporary(dev) && !adapter->discovery_list) &&
-		!monitoring) {
-		eir_data_free(&eir_data);
+		!monitoring)
 		return;
-	}
 
 	/* If there is no matched Adv monitors, don't continue if not
 	 * discoverable or if active discovery filter don't match.
 	 */
 	if (!monitoring && (!discoverable ||
-		(adapter->filtered_discovery && !is_filter_match(
-				adapter->discovery_list, &eir_data, rssi)))) {
-		eir_data_free(&eir_data);
+		(adapter->filtered_discovery &&
+				!is_filter_match(adapter, &view, rssi))))
 		return;
-	}
+
+	memset(&eir_data, 0, sizeof(eir_data));
+	eir_parse(&eir_data, data, data_len);
 
 	device_set_legacy(dev, legacy);
 
@@ -7045,6 +8207,8 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 
 	eir_data_free(&eir_data);
 
+	device_set_report(dev, bdaddr_type, report);
+
 	/* After the device is updated, notify the matched Adv monitors */
 	if (matched_monitors) {
 		btd_adv_monitor_notify_monitors(adapter->adv_monitor_manager,
@@ -7053,6 +8217,7 @@ void btd_adapter_update_found_device(struct btd_adapter *adapter,
 		matched_monitors = NULL;
 	}
 
+found:
 	/*
 	 * Only if at least one client has requested discovery, maintain
 	 * list of found devices and name confirming for legacy devices.
@@ -7108,11 +8273,9 @@ connect_le:
 	}
 }
 
-static void device_found_callback(uint16_t index, uint16_t length,
-					const void *param, void *user_data)
+static void process_device_found(struct btd_adapter *adapter,
+					const struct mgmt_ev_device_found *ev)
 {
-	const struct mgmt_ev_device_found *ev = param;
-	struct btd_adapter *adapter = user_data;
 	const uint8_t *eir;
 	uint16_t eir_len;
 	uint32_t flags;
@@ -7122,20 +8285,7 @@ static void device_found_callback(uint16_t index, uint16_t length,
 	bool name_resolve_failed;
 	char addr[18];
 
-	if (length < sizeof(*ev)) {
-		btd_error(adapter->dev_id,
-			"Too short device found event (%u bytes)", length);
-		return;
-	}
-
 	eir_len = btohs(ev->eir_len);
-	if (length != sizeof(*ev) + eir_len) {
-		btd_error(adapter->dev_id,
-				"Device found event size mismatch (%u != %zu)",
-					length, sizeof(*ev) + eir_len);
-		return;
-	}
-
 	if (eir_len == 0)
 		eir = NULL;
 	else
@@ -7145,7 +8295,7 @@ static void device_found_callback(uint16_t index, uint16_t length,
 
 	ba2str(&ev->addr.bdaddr, addr);
 	DBG("hci%u addr %s, rssi %d flags 0x%04x eir_len %u",
-			index, addr, ev->rssi, flags, eir_len);
+			adapter->dev_id, addr, ev->rssi, flags, eir_len);
 
 	confirm_name = (flags & MGMT_DEV_FOUND_CONFIRM_NAME);
 	legacy = (flags & MGMT_DEV_FOUND_LEGACY_PAIRING);
@@ -7159,6 +8309,99 @@ static void device_found_callback(uint16_t index, uint16_t length,
 					false);
 }
 
+static gboolean process_found_events(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	struct mgmt_ev_device_found *ev;
+	uint32_t i;
+
+	for (i = 0; i < btd_opts.found_batch; i++) {
+		ev = queue_pop_head(adapter->found_events);
+		if (!ev)
+			break;
+
+		process_device_found(adapter, ev);
+		free(ev);
+	}
+
+	if (!queue_isempty(adapter->found_events))
+		return TRUE;
+
+	adapter->found_events_id = 0;
+
+	return FALSE;
+}
+
+static bool match_found_event(const void *data, const void *match_data)
+{
+	const struct mgmt_ev_device_found *a = data;
+	const struct mgmt_ev_device_found *b = match_data;
+
+	/* Only the RSSI may differ, the rest of the report is kept as is */
+	return !bacmp(&a->addr.bdaddr, &b->addr.bdaddr) &&
+				a->addr.type == b->addr.type &&
+				a->flags == b->flags &&
+				a->eir_len == b->eir_len &&
+				!memcmp(a->eir, b->eir, btohs(b->eir_len));
+}
+
+/*
+ * Device found events of an adapter are handled from an idle source, a
+ * batch per mainloop iteration. Connection, pairing and D-Bus traffic of
+ * every adapter is then served while one of them reports a storm of
+ * advertisements, and repeated reports of an unchanged advertisement
+ * that are still waiting only update the RSSI.
+ */
+static void queue_found_event(struct btd_adapter *adapter,
+					const struct mgmt_ev_device_found *ev,
+					uint16_t length)
+{
+	struct mgmt_ev_device_found *queued;
+
+	queued = queue_find(adapter->found_events, match_found_event, ev);
+	if (queued) {
+		queued->rssi = ev->rssi;
+		return;
+	}
+
+	queue_push_tail(adapter->found_events, util_memdup(ev, length));
+
+	if (!adapter->found_events_id)
+		adapter->found_events_id = g_idle_add(process_found_events,
+								adapter);
+}
+
+static void device_found_callback(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_ev_device_found *ev = param;
+	struct btd_adapter *adapter = user_data;
+	uint16_t eir_len;
+
+	metrics_inc(found_metric);
+
+	if (length < sizeof(*ev)) {
+		btd_error(adapter->dev_id,
+			"Too short device found event (%u bytes)", length);
+		return;
+	}
+
+	eir_len = btohs(ev->eir_len);
+	if (length != sizeof(*ev) + eir_len) {
+		btd_error(adapter->dev_id,
+				"Device found event size mismatch (%u != %zu)",
+					length, sizeof(*ev) + eir_len);
+		return;
+	}
+
+	adv_streams_send(adapter, ev, length);
+
+	if (btd_opts.found_batch)
+		queue_found_event(adapter, ev, length);
+	else
+		process_device_found(adapter, ev);
+}
+
 struct agent *adapter_get_agent(struct btd_adapter *adapter)
 {
 	return agent_get(NULL);
@@ -7194,6 +8437,7 @@ static void adapter_stop(struct btd_adapter *adapter)
 
 	cancel_passive_scanning(adapter);
 
+	adv_streams_close(adapter);
 	remove_discovery_list(adapter);
 
 	discovery_cleanup(adapter, 0);
@@ -8228,10 +9472,10 @@ static void store_link_key(struct btd_adapter *adapter,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -8248,7 +9492,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -8324,7 +9568,7 @@ static void store_ltk_group(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -8342,10 +9586,10 @@ static void store_ltk_group(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -8490,7 +9734,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 			btd_adapter_get_storage_dir(adapter), device_addr);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -8503,10 +9747,10 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "Counter", counter);
 	g_key_file_set_boolean(key_file, group, "Authenticated", auth);
 
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -8568,10 +9812,10 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -8585,7 +9829,7 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, store_data, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, store_data, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -8635,7 +9879,9 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 		return;
 	}
 
+	unindex_device(adapter, device);
 	device_update_addr(device, &addr->bdaddr, addr->type);
+	index_device(adapter, device);
 
 	if (duplicate)
 		device_merge_duplicate(device, duplicate);
@@ -8668,7 +9914,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -8683,10 +9929,10 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, store_data, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, store_data, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -9048,9 +10294,6 @@ load:
 	load_defaults(adapter);
 	load_devices(adapter);
 
-	/* restore Service Changed CCC value for bonded devices */
-	btd_gatt_database_restore_svc_chng_ccc(adapter->database);
-
 	/* retrieve the active connections: address the scenario where
 	 * the are active connections before the daemon've started */
 	if (btd_adapter_get_powered(adapter))
@@ -9327,7 +10570,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -9343,7 +10586,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	}
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -9428,7 +10671,7 @@ static bool get_static_addr(struct btd_adapter *adapter)
 	snprintf(mfg, sizeof(mfg), "0x%04x", adapter->manufacturer);
 
 	file = g_key_file_new();
-	if (!g_key_file_load_from_file(file, STORAGEDIR "/addresses", 0,
+	if (!btd_storage_load(file, STORAGEDIR "/addresses", 0,
 								&gerr)) {
 		error("Unable to load key file from %s: (%s)",
 					STORAGEDIR "/addresses", gerr->message);
@@ -9487,7 +10730,8 @@ static bool get_static_addr(struct btd_adapter *adapter)
 						(const char **)addrs, len);
 
 	str = g_key_file_to_data(file, &len, NULL);
-	if (!g_file_set_contents(STORAGEDIR "/addresses", str, len, &gerr)) {
+	if (!btd_storage_set_contents(STORAGEDIR "/addresses", str, len,
+								&gerr)) {
 		error("Unable set contents for %s: (%s)",
 					STORAGEDIR "/addresses", gerr->message);
 		g_error_free(gerr);
@@ -9884,6 +11128,10 @@ static void read_info_complete(uint8_t status, uint16_t length,
 	if (adapter->supported_settings & MGMT_SETTING_PRIVACY)
 		set_privacy(adapter, btd_opts.privacy);
 
+	if (btd_opts.le_2m_phy && (adapter->supported_settings &
+					MGMT_SETTING_PHY_CONFIGURATION))
+		prefer_le_2m_phy(adapter);
+
 	if (btd_opts.fast_conn &&
 			(missing_settings & MGMT_SETTING_FAST_CONNECTABLE))
 		set_mode(adapter, MGMT_OP_SET_FAST_CONNECTABLE, 0x01);
@@ -10348,6 +11596,9 @@ int adapter_init(void)
 {
 	dbus_conn = btd_get_dbus_connection();
 
+	found_metric = metrics_counter("device_found_total",
+					"Device Found events received");
+
 	mgmt_primary = mgmt_new_default();
 	if (!mgmt_primary) {
 		error("Failed to access management interface");
@@ -10355,6 +11606,7 @@ int adapter_init(void)
 	}
 
 	mgmt_set_debug(mgmt_primary, mgmt_debug, NULL, NULL);
+	mgmt_set_pipeline(mgmt_primary, btd_opts.mgmt_pipeline);
 
 	DBG("sending read version command");
 
@@ -10370,6 +11622,8 @@ int adapter_init(void)
 
 void adapter_cleanup(void)
 {
+	found_metric = NULL;
+
 	g_list_free(adapter_list);
 
 	while (adapters) {
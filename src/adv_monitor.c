@@ -14,6 +14,7 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -50,6 +51,8 @@
 #define ADV_MONITOR_DEFAULT_HIGH_TIMEOUT 10	/* second */
 #define ADV_MONITOR_UNSET_SAMPLING_PERIOD 256	/* 100 ms */
 #define ADV_MONITOR_MAX_SAMPLING_PERIOD	255	/* 100 ms */
+#define ADV_MONITOR_SAMPLE_WINDOW	1	/* second */
+#define ADV_MONITOR_REBALANCE_INTERVAL	60	/* second */
 
 struct btd_adv_monitor_manager {
 	struct btd_adapter *adapter;
@@ -63,6 +66,21 @@ struct btd_adv_monitor_manager {
 
 	struct queue *apps;	/* apps who registered for Adv monitoring */
 	struct queue *merged_patterns;
+	struct bt_ad_matcher *matcher;	/* Index of merged_patterns content */
+
+	struct queue *sampled_devices;	/* adv_monitor_device objects with
+					 * pending samples or found
+					 */
+	unsigned int sample_timer;	/* Closes the sampling window of
+					 * every device in |sampled_devices|
+					 */
+
+	unsigned int offload_count;	/* Merged patterns sent to kernel */
+	unsigned int host_count;	/* Merged patterns matched by host */
+	unsigned int offload_limit;	/* Slots the controller really has */
+	unsigned int rebalance_timer;	/* Reranks |merged_patterns| for the
+					 * available offload slots
+					 */
 };
 
 struct adv_monitor_app {
@@ -137,6 +155,10 @@ struct adv_monitor_merged_pattern {
 	struct queue *patterns;		/* List of bt_ad_pattern objects */
 	enum merged_pattern_state current_state; /* MERGED_PATTERN_STATE_* */
 	enum merged_pattern_state next_state;	 /* MERGED_PATTERN_STATE_* */
+	bool host;			/* Not offloaded, matched by the host */
+	bool demote;			/* Removing from kernel to host match */
+	unsigned int hits;		/* Matches in the current interval */
+	unsigned int hit_rate;		/* Average matches per interval << 8 */
 };
 
 /* Some data like last_seen, timer/timeout values need to be maintained
@@ -154,9 +176,12 @@ struct adv_monitor_device {
 					 */
 	time_t last_seen;		/* Time when last Adv was received */
 	bool found;			/* State of the device - lost/found */
-	unsigned int lost_timer;	/* Timer to track if the device goes
-					 * offline/out-of-range
+	time_t lost_time;		/* Time when the device is considered
+					 * offline/out-of-range unless seen
+					 * again, 0 if not tracked
 					 */
+	int rssi_sum;			/* Sum and number of RSSI samples */
+	unsigned int num_samples;	/* in the current sampling window */
 };
 
 struct app_match_data {
@@ -165,7 +190,7 @@ struct app_match_data {
 };
 
 struct adv_content_filter_info {
-	struct bt_ad *ad;
+	struct queue *matched_patterns;	/* List of matched merged patterns */
 	struct queue *matched_monitors;	/* List of matched monitors */
 };
 
@@ -240,9 +265,18 @@ static void merged_pattern_free(void *data)
 	queue_destroy(merged_pattern->patterns, pattern_free);
 	queue_destroy(merged_pattern->monitors, NULL);
 
-	if (merged_pattern->manager)
-		queue_remove(merged_pattern->manager->merged_patterns,
-							merged_pattern);
+	if (merged_pattern->manager) {
+		struct btd_adv_monitor_manager *manager =
+						merged_pattern->manager;
+
+		queue_remove(manager->merged_patterns, merged_pattern);
+		bt_ad_matcher_remove(manager->matcher, merged_pattern);
+
+		if (merged_pattern->host)
+			manager->host_count--;
+		else
+			manager->offload_count--;
+	}
 	free(merged_pattern);
 }
 
@@ -377,6 +411,15 @@ static void merged_pattern_remove(
 {
 	rssi_unset(&merged_pattern->rssi);
 
+	/* Host matched patterns were never sent to the kernel */
+	if (merged_pattern->host) {
+		merged_pattern_free(merged_pattern);
+		return;
+	}
+
+	/* The pattern is going away rather than moving to host matching */
+	merged_pattern->demote = false;
+
 	/* If we currently are removing, cancel subsequent ADD command if any */
 	if (merged_pattern->current_state == MERGED_PATTERN_STATE_REMOVING) {
 		merged_pattern->next_state = MERGED_PATTERN_STATE_STABLE;
@@ -419,6 +462,10 @@ static void merged_pattern_replace(
 
 	merged_pattern->rssi = *rssi;
 
+	/* The host applies the RSSI thresholds of each monitor by itself */
+	if (merged_pattern->host)
+		return;
+
 	/* If stable, we can proceed with replacement. */
 	if (merged_pattern->current_state == MERGED_PATTERN_STATE_STABLE) {
 		/* Replacement is done by first removing, then re-adding */
@@ -1011,6 +1058,187 @@ static void merged_pattern_destroy_monitors(
 	}
 }
 
+/* Returns true if the monitors of the merged pattern are already reporting */
+static bool merged_pattern_is_active(
+			struct adv_monitor_merged_pattern *merged_pattern)
+{
+	struct adv_monitor *monitor = queue_peek_head(merged_pattern->monitors);
+
+	return monitor && monitor->state == MONITOR_STATE_ACTIVE;
+}
+
+/* Leaves the merged pattern to the content filter of the host */
+static void merged_pattern_set_host(
+			struct adv_monitor_merged_pattern *merged_pattern)
+{
+	struct btd_adv_monitor_manager *manager = merged_pattern->manager;
+
+	DBG("Adv monitor with handle:0x%04x moved to host matching",
+						merged_pattern->monitor_handle);
+
+	merged_pattern->current_state = MERGED_PATTERN_STATE_STABLE;
+	merged_pattern->next_state = MERGED_PATTERN_STATE_STABLE;
+	merged_pattern->demote = false;
+	merged_pattern->monitor_handle = 0;
+
+	if (!merged_pattern->host) {
+		merged_pattern->host = true;
+		manager->offload_count--;
+		manager->host_count++;
+	}
+
+	queue_foreach(merged_pattern->monitors, monitor_state_active, NULL);
+}
+
+/* Returns the number of merged patterns the kernel can be given */
+static unsigned int offload_slots(struct btd_adv_monitor_manager *manager)
+{
+	unsigned int slots = UINT_MAX;
+
+	if (btd_opts.advmon.offload_slots)
+		slots = btd_opts.advmon.offload_slots;
+	else if (manager->max_num_monitors)
+		slots = manager->max_num_monitors;
+
+	return MIN(slots, manager->offload_limit);
+}
+
+/* Patterns shared by more monitors save more work per offloaded match */
+static unsigned int merged_pattern_score(
+			const struct adv_monitor_merged_pattern *merged_pattern)
+{
+	return merged_pattern->hit_rate *
+				queue_length(merged_pattern->monitors);
+}
+
+static void merged_pattern_update_rate(void *data, void *user_data)
+{
+	struct adv_monitor_merged_pattern *merged_pattern = data;
+	unsigned int hits = MIN(merged_pattern->hits, 0xffff);
+
+	merged_pattern->hit_rate = (merged_pattern->hit_rate * 3 +
+							(hits << 8)) / 4;
+	merged_pattern->hits = 0;
+}
+
+struct rebalance_data {
+	struct adv_monitor_merged_pattern *best_host;
+	struct adv_monitor_merged_pattern *worst_offload;
+};
+
+static void rebalance_rank(void *data, void *user_data)
+{
+	struct adv_monitor_merged_pattern *merged_pattern = data;
+	struct rebalance_data *rank = user_data;
+	unsigned int score = merged_pattern_score(merged_pattern);
+
+	/* Leave the patterns with kernel commands in flight alone */
+	if (merged_pattern->current_state != MERGED_PATTERN_STATE_STABLE ||
+		merged_pattern->next_state != MERGED_PATTERN_STATE_STABLE)
+		return;
+
+	if (merged_pattern->host) {
+		if (!rank->best_host ||
+				score > merged_pattern_score(rank->best_host))
+			rank->best_host = merged_pattern;
+	} else if (!rank->worst_offload || score <
+			merged_pattern_score(rank->worst_offload))
+		rank->worst_offload = merged_pattern;
+}
+
+/* Sends a host matched pattern to the kernel */
+static void merged_pattern_promote(
+			struct adv_monitor_merged_pattern *merged_pattern)
+{
+	struct btd_adv_monitor_manager *manager = merged_pattern->manager;
+
+	DBG("Offloading merged pattern %p", merged_pattern);
+
+	merged_pattern->host = false;
+	manager->host_count--;
+	manager->offload_count++;
+
+	merged_pattern_add(merged_pattern);
+}
+
+/* Removes an offloaded pattern from the kernel but keeps its monitors */
+static void merged_pattern_demote(
+			struct adv_monitor_merged_pattern *merged_pattern)
+{
+	DBG("Demoting adv monitor with handle:0x%04x",
+						merged_pattern->monitor_handle);
+
+	merged_pattern->demote = true;
+	merged_pattern->current_state = MERGED_PATTERN_STATE_REMOVING;
+	merged_pattern_send_remove(merged_pattern);
+}
+
+static bool rebalance_timeout(gpointer user_data)
+{
+	struct btd_adv_monitor_manager *manager = user_data;
+	struct rebalance_data rank;
+
+	if (queue_isempty(manager->merged_patterns)) {
+		manager->rebalance_timer = 0;
+		return false;
+	}
+
+	queue_foreach(manager->merged_patterns, merged_pattern_update_rate,
+									NULL);
+
+	while (manager->host_count) {
+		memset(&rank, 0, sizeof(rank));
+		queue_foreach(manager->merged_patterns, rebalance_rank, &rank);
+
+		if (!rank.best_host)
+			break;
+
+		if (manager->offload_count < offload_slots(manager)) {
+			merged_pattern_promote(rank.best_host);
+			continue;
+		}
+
+		/* Only swap for a clear gain so patterns do not flap */
+		if (!rank.worst_offload ||
+				merged_pattern_score(rank.best_host) <=
+				merged_pattern_score(rank.worst_offload) * 2)
+			break;
+
+		merged_pattern_demote(rank.worst_offload);
+		merged_pattern_promote(rank.best_host);
+	}
+
+	return true;
+}
+
+/* Offloads a new merged pattern if a slot is left, otherwise the host matches
+ * it until the periodic rebalance finds it worth a slot.
+ */
+static void merged_pattern_place(
+			struct adv_monitor_merged_pattern *merged_pattern)
+{
+	struct btd_adv_monitor_manager *manager = merged_pattern->manager;
+
+	if (!manager->rebalance_timer)
+		manager->rebalance_timer = timeout_add_seconds(
+					ADV_MONITOR_REBALANCE_INTERVAL,
+					rebalance_timeout, manager, NULL);
+
+	if (manager->offload_count < offload_slots(manager)) {
+		manager->offload_count++;
+		merged_pattern_add(merged_pattern);
+		return;
+	}
+
+	DBG("No offload slot left, matching merged pattern %p on host",
+							merged_pattern);
+
+	merged_pattern->host = true;
+	manager->host_count++;
+
+	queue_foreach(merged_pattern->monitors, monitor_state_active, NULL);
+}
+
 /* Handles the callback of Remove Adv Monitor command */
 static void remove_adv_monitor_cb(uint8_t status, uint16_t length,
 				const void *param, void *user_data)
@@ -1034,8 +1262,17 @@ static void remove_adv_monitor_cb(uint8_t status, uint16_t length,
 
 	merged_pattern_process_next_step(merged_pattern);
 
-	if (merged_pattern->current_state == MERGED_PATTERN_STATE_STABLE)
-		merged_pattern_free(merged_pattern);
+	if (merged_pattern->current_state != MERGED_PATTERN_STATE_STABLE) {
+		merged_pattern->demote = false;
+		return;
+	}
+
+	if (merged_pattern->demote) {
+		merged_pattern_set_host(merged_pattern);
+		return;
+	}
+
+	merged_pattern_free(merged_pattern);
 
 	return;
 
@@ -1073,6 +1310,21 @@ static void add_adv_patterns_monitor_cb(uint8_t status, uint16_t length,
 		btd_error(adapter_id,
 				"Failed to Add Adv Patterns Monitor with status"
 				" 0x%02x", status);
+
+		/* The controller may have fewer slots than advertised */
+		if (status == MGMT_STATUS_NO_RESOURCES)
+			merged_pattern->manager->offload_limit =
+				merged_pattern->manager->offload_count - 1;
+
+		/* Out of offload slots or promoted from host matching */
+		if (merged_pattern->next_state !=
+					MERGED_PATTERN_STATE_REMOVING &&
+				(status == MGMT_STATUS_NO_RESOURCES ||
+				merged_pattern_is_active(merged_pattern))) {
+			merged_pattern_set_host(merged_pattern);
+			return;
+		}
+
 		goto fail;
 	}
 
@@ -1236,7 +1488,11 @@ static void monitor_proxy_added_cb(GDBusProxy *proxy, void *user_data)
 		monitor->merged_pattern->manager = monitor->app->manager;
 		queue_push_tail(monitor->app->manager->merged_patterns,
 						monitor->merged_pattern);
-		merged_pattern_add(monitor->merged_pattern);
+		if (monitor->merged_pattern->type == MONITOR_TYPE_OR_PATTERNS)
+			bt_ad_matcher_add(monitor->app->manager->matcher,
+					monitor->merged_pattern->patterns,
+					monitor->merged_pattern);
+		merged_pattern_place(monitor->merged_pattern);
 	} else {
 		/* Since there is a matching pattern, abandon the one we have */
 		merged_pattern_free(monitor->merged_pattern);
@@ -1499,7 +1755,7 @@ static void remove_merged_pattern(void *data, void *user_data)
 	struct adv_monitor_merged_pattern *merged_pattern = data;
 	uint16_t *handle = user_data;
 
-	if (!handle)
+	if (!handle || merged_pattern->host)
 		return;
 
 	/* handle = 0 indicates kernel has removed all monitors */
@@ -1569,6 +1825,15 @@ static void notify_device_found_per_app(void *data, void *user_data)
 		      user_data);
 }
 
+static bool merged_pattern_match_handle(const void *data,
+						const void *match_data)
+{
+	const struct adv_monitor_merged_pattern *merged_pattern = data;
+
+	return !merged_pattern->host &&
+		merged_pattern->monitor_handle == PTR_TO_UINT(match_data);
+}
+
 /* Processes Adv Monitor Device Found event from kernel */
 static void adv_monitor_device_found_callback(uint16_t index, uint16_t length,
 						const void *param,
@@ -1580,6 +1845,7 @@ static void adv_monitor_device_found_callback(uint16_t index, uint16_t length,
 	struct btd_adapter *adapter = manager->adapter;
 	uint16_t handle = le16_to_cpu(ev->monitor_handle);
 	struct monitored_device_info info;
+	struct adv_monitor_merged_pattern *merged_pattern;
 	const uint8_t *ad_data = NULL;
 	uint16_t ad_data_len;
 	uint32_t flags;
@@ -1626,6 +1892,12 @@ static void adv_monitor_device_found_callback(uint16_t index, uint16_t length,
 		DBG("Adv Monitor with handle 0x%04x started tracking "
 		    "the device %s", handle, addr);
 
+		merged_pattern = queue_find(manager->merged_patterns,
+						merged_pattern_match_handle,
+						UINT_TO_PTR(handle));
+		if (merged_pattern)
+			merged_pattern->hits++;
+
 		info.device = btd_adapter_find_device(adapter, &ev->addr.bdaddr,
 						      ev->addr.type);
 		if (!info.device) {
@@ -1720,6 +1992,9 @@ static struct btd_adv_monitor_manager *manager_new(
 	manager->adapter_id = btd_adapter_get_index(adapter);
 	manager->apps = queue_new();
 	manager->merged_patterns = queue_new();
+	manager->matcher = bt_ad_matcher_new();
+	manager->sampled_devices = queue_new();
+	manager->offload_limit = UINT_MAX;
 
 	mgmt_register(manager->mgmt, MGMT_EV_ADV_MONITOR_REMOVED,
 			manager->adapter_id, adv_monitor_removed_callback,
@@ -1743,6 +2018,15 @@ static void manager_free(struct btd_adv_monitor_manager *manager)
 
 	queue_destroy(manager->apps, app_destroy);
 	queue_destroy(manager->merged_patterns, merged_pattern_free);
+	bt_ad_matcher_free(manager->matcher);
+
+	if (manager->sample_timer)
+		timeout_remove(manager->sample_timer);
+
+	queue_destroy(manager->sampled_devices, NULL);
+
+	if (manager->rebalance_timer)
+		timeout_remove(manager->rebalance_timer);
 
 	free(manager);
 }
@@ -1853,50 +2137,50 @@ bool btd_adv_monitor_offload_enabled(struct btd_adv_monitor_manager *manager)
 				MGMT_ADV_MONITOR_FEATURE_MASK_OR_PATTERNS);
 }
 
-/* Processes the content matching based pattern(s) of a monitor */
-static void adv_match_per_monitor(void *data, void *user_data)
+/* Returns true if advertisements need to go through the content filter of the
+ * host, either since nothing is offloaded or some patterns did not get a slot.
+ */
+bool btd_adv_monitor_host_filter_enabled(
+				struct btd_adv_monitor_manager *manager)
 {
-	struct adv_monitor *monitor = data;
-	struct adv_content_filter_info *info = user_data;
-	struct queue *patterns;
+	if (!manager)
+		return true;
 
-	if (!monitor) {
-		error("Unexpected NULL adv_monitor object upon match");
-		return;
-	}
+	return !btd_adv_monitor_offload_enabled(manager) ||
+							manager->host_count;
+}
 
-	if (monitor->state != MONITOR_STATE_ACTIVE)
-		return;
+/* Collects the active monitors of a merged pattern matching the ad data */
+static void adv_match_per_pattern(void *data, void *user_data)
+{
+	struct adv_monitor_merged_pattern *merged_pattern = data;
+	struct adv_content_filter_info *info = user_data;
+	const struct queue_entry *entry;
 
-	if (!monitor->merged_pattern)
+	/* Offloaded patterns are reported by the kernel */
+	if (!merged_pattern->host &&
+			btd_adv_monitor_offload_enabled(merged_pattern->manager))
 		return;
 
-	patterns = monitor->merged_pattern->patterns;
-	if (monitor->merged_pattern->type == MONITOR_TYPE_OR_PATTERNS &&
-				bt_ad_pattern_match(info->ad, patterns)) {
-		goto matched;
-	}
+	/* A merged pattern is reported once per matching pattern */
+	if (queue_find(info->matched_patterns, NULL, merged_pattern))
+		return;
 
-	return;
+	queue_push_tail(info->matched_patterns, merged_pattern);
+	merged_pattern->hits++;
 
-matched:
-	if (!info->matched_monitors)
-		info->matched_monitors = queue_new();
+	entry = queue_get_entries(merged_pattern->monitors);
+	for (; entry; entry = entry->next) {
+		struct adv_monitor *monitor = entry->data;
 
-	queue_push_tail(info->matched_monitors, monitor);
-}
+		if (monitor->state != MONITOR_STATE_ACTIVE)
+			continue;
 
-/* Processes the content matching for the monitor(s) of an app */
-static void adv_match_per_app(void *data, void *user_data)
-{
-	struct adv_monitor_app *app = data;
+		if (!info->matched_monitors)
+			info->matched_monitors = queue_new();
 
-	if (!app) {
-		error("Unexpected NULL adv_monitor_app object upon match");
-		return;
+		queue_push_tail(info->matched_monitors, monitor);
 	}
-
-	queue_foreach(app->monitors, adv_match_per_monitor, user_data);
 }
 
 /* Processes the content matching for every app without RSSI filtering and
@@ -1913,10 +2197,13 @@ struct queue *btd_adv_monitor_content_filter(
 	if (!manager || !ad)
 		return NULL;
 
-	info.ad = ad;
+	info.matched_patterns = queue_new();
 	info.matched_monitors = NULL;
 
-	queue_foreach(manager->apps, adv_match_per_app, &info);
+	bt_ad_matcher_match(manager->matcher, ad, adv_match_per_pattern,
+									&info);
+
+	queue_destroy(info.matched_patterns, NULL);
 
 	return info.matched_monitors;
 }
@@ -1983,10 +2270,7 @@ static void monitor_device_free(void *data)
 		return;
 	}
 
-	if (dev->lost_timer) {
-		timeout_remove(dev->lost_timer);
-		dev->lost_timer = 0;
-	}
+	queue_remove(dev->monitor->app->manager->sampled_devices, dev);
 
 	dev->monitor = NULL;
 	dev->device = NULL;
@@ -2059,9 +2343,8 @@ static struct adv_monitor_device *monitor_device_create(
 }
 
 /* Handles a situation where the device goes offline/out-of-range */
-static bool handle_device_lost_timeout(gpointer user_data)
+static void handle_device_lost(struct adv_monitor_device *dev)
 {
-	struct adv_monitor_device *dev = user_data;
 	struct adv_monitor *monitor = dev->monitor;
 
 	DBG("Device Lost timeout triggered for device %p. Calling DeviceLost() "
@@ -2072,49 +2355,20 @@ static bool handle_device_lost_timeout(gpointer user_data)
 				 report_device_state_setup,
 				 NULL, dev->device, NULL);
 
-	dev->lost_timer = 0;
+	dev->lost_time = 0;
 	dev->found = false;
-
-	return FALSE;
 }
 
-/* Filters an Adv based on its RSSI value */
-static void adv_monitor_filter_rssi(struct adv_monitor *monitor,
-				    struct btd_device *device, int8_t rssi)
+/* Filters the RSSI of a device averaged over the sampling window */
+static void monitor_device_filter_rssi(struct adv_monitor_device *dev,
+							time_t curr_time)
 {
-	struct adv_monitor_device *dev = NULL;
-	time_t curr_time = time(NULL);
-	uint16_t adapter_id = monitor->app->manager->adapter_id;
-
-	/* If the RSSI thresholds and timeouts are not specified, report the
-	 * DeviceFound() event without tracking for the RSSI as the Adv has
-	 * already matched the pattern filter.
-	 */
-	if (rssi_is_unset(&monitor->rssi)) {
-		DBG("Calling DeviceFound() on Adv Monitor of owner %s "
-		    "at path %s", monitor->app->owner, monitor->path);
-
-		g_dbus_proxy_method_call(monitor->proxy, "DeviceFound",
-					 report_device_state_setup, NULL,
-					 device, NULL);
-
-		return;
-	}
-
-	dev = queue_find(monitor->devices, monitor_device_match, device);
-	if (!dev) {
-		dev = monitor_device_create(monitor, device);
-		if (!dev) {
-			btd_error(adapter_id,
-				"Failed to create Adv Monitor device object.");
-			return;
-		}
-	}
+	struct adv_monitor *monitor = dev->monitor;
+	int8_t rssi = dev->rssi_sum / (int) dev->num_samples;
 
-	if (dev->lost_timer) {
-		timeout_remove(dev->lost_timer);
-		dev->lost_timer = 0;
-	}
+	dev->rssi_sum = 0;
+	dev->num_samples = 0;
+	dev->lost_time = 0;
 
 	/* Reset the timings of found/lost if a device has been offline for
 	 * longer than the high/low timeouts.
@@ -2181,29 +2435,107 @@ static void adv_monitor_filter_rssi(struct adv_monitor *monitor,
 		dev->low_rssi_first_seen = 0;
 	}
 
-	/* Setup a timer to track if the device goes offline/out-of-range, only
-	 * if we are tracking for the Low RSSI Threshold. If we are tracking
-	 * the High RSSI Threshold, nothing needs to be done.
+	/* Track if the device goes offline/out-of-range, only if we are
+	 * tracking for the Low RSSI Threshold. If we are tracking the High
+	 * RSSI Threshold, nothing needs to be done.
+	 */
+	if (dev->found)
+		dev->lost_time = curr_time + monitor->rssi.low_rssi_timeout;
+}
+
+/* Closes the sampling window of a device, returns true if it is no longer
+ * tracked.
+ */
+static bool monitor_device_sample(void *data, void *user_data)
+{
+	struct adv_monitor_device *dev = data;
+	time_t *curr_time = user_data;
+
+	if (dev->num_samples)
+		monitor_device_filter_rssi(dev, *curr_time);
+	else if (dev->lost_time && *curr_time >= dev->lost_time)
+		handle_device_lost(dev);
+
+	return !dev->num_samples && !dev->lost_time;
+}
+
+/* Evaluates the RSSI samples of every device at the end of each window,
+ * sharing a single timer instead of having one per device.
+ */
+static bool sample_timeout(gpointer user_data)
+{
+	struct btd_adv_monitor_manager *manager = user_data;
+	time_t curr_time = time(NULL);
+
+	queue_remove_all(manager->sampled_devices, monitor_device_sample,
+							&curr_time, NULL);
+
+	if (!queue_isempty(manager->sampled_devices))
+		return TRUE;
+
+	manager->sample_timer = 0;
+
+	return FALSE;
+}
+
+/* Filters an Adv based on its RSSI value */
+static void adv_monitor_filter_rssi(struct adv_monitor *monitor,
+				    struct btd_device *device, int8_t rssi)
+{
+	struct btd_adv_monitor_manager *manager = monitor->app->manager;
+	struct adv_monitor_device *dev = NULL;
+
+	/* If the RSSI thresholds and timeouts are not specified, report the
+	 * DeviceFound() event without tracking for the RSSI as the Adv has
+	 * already matched the pattern filter.
 	 */
-	if (dev->found) {
-		dev->lost_timer =
-			timeout_add_seconds(monitor->rssi.low_rssi_timeout,
-					    handle_device_lost_timeout, dev,
-					    NULL);
+	if (rssi_is_unset(&monitor->rssi)) {
+		DBG("Calling DeviceFound() on Adv Monitor of owner %s "
+		    "at path %s", monitor->app->owner, monitor->path);
+
+		g_dbus_proxy_method_call(monitor->proxy, "DeviceFound",
+					 report_device_state_setup, NULL,
+					 device, NULL);
+
+		return;
+	}
+
+	dev = queue_find(monitor->devices, monitor_device_match, device);
+	if (!dev) {
+		dev = monitor_device_create(monitor, device);
+		if (!dev) {
+			btd_error(manager->adapter_id,
+				"Failed to create Adv Monitor device object.");
+			return;
+		}
 	}
+
+	/* The sample is only evaluated once the window closes */
+	if (!dev->num_samples && !dev->lost_time)
+		queue_push_tail(manager->sampled_devices, dev);
+
+	dev->rssi_sum += rssi;
+	dev->num_samples++;
+
+	if (!manager->sample_timer)
+		manager->sample_timer = timeout_add_seconds(
+						ADV_MONITOR_SAMPLE_WINDOW,
+						sample_timeout, manager, NULL);
 }
 
 /* Clears running DeviceLost timer for a given device */
 static void clear_device_lost_timer(void *data, void *user_data)
 {
 	struct adv_monitor_device *dev = data;
-	struct adv_monitor *monitor = NULL;
+	struct adv_monitor *monitor = dev->monitor;
 
-	if (dev->lost_timer) {
-		timeout_remove(dev->lost_timer);
-		dev->lost_timer = 0;
+	/* Pending samples are dropped along with the timer */
+	queue_remove(monitor->app->manager->sampled_devices, dev);
+	dev->rssi_sum = 0;
+	dev->num_samples = 0;
 
-		monitor = dev->monitor;
+	if (dev->lost_time) {
+		dev->lost_time = 0;
 
 		DBG("Calling DeviceLost() for device %p on Adv Monitor "
 				"of owner %s at path %s", dev->device,
@@ -28,6 +28,8 @@ struct btd_adv_monitor_manager *btd_adv_monitor_manager_create(
 void btd_adv_monitor_manager_destroy(struct btd_adv_monitor_manager *manager);
 
 bool btd_adv_monitor_offload_enabled(struct btd_adv_monitor_manager *manager);
+bool btd_adv_monitor_host_filter_enabled(
+				struct btd_adv_monitor_manager *manager);
 
 struct queue *btd_adv_monitor_content_filter(
 				struct btd_adv_monitor_manager *manager,
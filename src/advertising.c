@@ -52,6 +52,7 @@ struct btd_adv_manager {
 	bool extended_add_cmds;
 	int8_t min_tx_power;
 	int8_t max_tx_power;
+	unsigned int mux_id;
 };
 
 #define AD_TYPE_BROADCAST 0
@@ -62,6 +63,24 @@ struct btd_adv_manager {
  */
 #define ADV_TX_POWER_NO_PREFERENCE 0x7F
 
+/* Advertisements beyond the controller instances wait for their turn and
+ * take over an instance for ADV_MUX_SLICE seconds, which matches the default
+ * rotation duration of the kernel.
+ */
+#define ADV_MUX_MAX_CLIENTS 64
+#define ADV_MUX_SLICE 2
+
+/* Rotating faster than the shortest advertising interval is pointless */
+#define ADV_ROTATION_MIN_INTERVAL 20
+
+struct adv_rotation {
+	uint8_t *data;
+	uint8_t len;
+	uint16_t interval;
+	void *cmd;
+	uint16_t cmd_len;
+};
+
 struct btd_adv_client {
 	struct btd_adv_manager *manager;
 	char *owner;
@@ -85,6 +104,15 @@ struct btd_adv_client {
 	uint32_t min_interval;
 	uint32_t max_interval;
 	int8_t tx_power;
+	uint8_t max_adv_data_len;
+	struct adv_rotation *rotation;
+	size_t rotation_len;
+	size_t rotation_pos;
+	unsigned int rotation_id;
+	int64_t reg_time;
+	int64_t air_start;
+	int64_t air_time;
+	unsigned int slices;
 	mgmt_request_func_t refresh_done_func;
 };
 
@@ -107,10 +135,48 @@ static bool match_client(const void *a, const void *b)
 	return true;
 }
 
+static void rotation_stop(struct btd_adv_client *client)
+{
+	if (client->rotation_id > 0) {
+		timeout_remove(client->rotation_id);
+		client->rotation_id = 0;
+	}
+}
+
+static void rotation_clear_cmds(struct btd_adv_client *client)
+{
+	size_t i;
+
+	for (i = 0; i < client->rotation_len; i++) {
+		free(client->rotation[i].cmd);
+		client->rotation[i].cmd = NULL;
+		client->rotation[i].cmd_len = 0;
+	}
+}
+
+static void rotation_free(struct btd_adv_client *client)
+{
+	size_t i;
+
+	rotation_stop(client);
+
+	for (i = 0; i < client->rotation_len; i++) {
+		free(client->rotation[i].data);
+		free(client->rotation[i].cmd);
+	}
+
+	free(client->rotation);
+	client->rotation = NULL;
+	client->rotation_len = 0;
+	client->rotation_pos = 0;
+}
+
 static void client_free(void *data)
 {
 	struct btd_adv_client *client = data;
 
+	rotation_free(client);
+
 	if (client->to_id > 0)
 		timeout_remove(client->to_id);
 
@@ -193,22 +259,72 @@ static void remove_advertising(struct btd_adv_manager *manager,
 			manager->mgmt_index, sizeof(cp), &cp, NULL, NULL, NULL);
 }
 
+static void client_air_start(struct btd_adv_client *client)
+{
+	client->air_start = g_get_monotonic_time();
+	client->slices++;
+}
+
+static void client_air_stop(struct btd_adv_client *client)
+{
+	if (!client->air_start)
+		return;
+
+	client->air_time += g_get_monotonic_time() - client->air_start;
+	client->air_start = 0;
+}
+
+/* Percentage of the time since registration the advertisement was on air */
+static unsigned int client_duty_cycle(struct btd_adv_client *client)
+{
+	int64_t now = g_get_monotonic_time();
+	int64_t air_time = client->air_time;
+
+	if (client->air_start)
+		air_time += now - client->air_start;
+
+	if (now <= client->reg_time)
+		return 100;
+
+	return air_time * 100 / (now - client->reg_time);
+}
+
+static void mux_fill(struct btd_adv_manager *manager, struct queue *filled);
+
 static void client_remove(void *data)
 {
 	struct btd_adv_client *client = data;
+	struct btd_adv_manager *manager = client->manager;
 	struct mgmt_cp_remove_advertising cp;
 
 	g_dbus_client_set_proxy_handlers(client->client, NULL, NULL, NULL,
 									client);
 	g_dbus_client_set_disconnect_watch(client->client, NULL, NULL);
 
-	cp.instance = client->instance;
+	/* Don't let a pending rotation re-add the instance */
+	rotation_stop(client);
 
-	mgmt_send(client->manager->mgmt, MGMT_OP_REMOVE_ADVERTISING,
-			client->manager->mgmt_index, sizeof(cp), &cp,
-			NULL, NULL, NULL);
+	client_air_stop(client);
 
-	queue_remove(client->manager->clients, client);
+	DBG("%s was on air %u%% of the time in %u slices", client->path,
+				client_duty_cycle(client), client->slices);
+
+	/* Waiting advertisements have no instance, and 0 would remove all */
+	if (client->instance) {
+		cp.instance = client->instance;
+
+		mgmt_send(manager->mgmt, MGMT_OP_REMOVE_ADVERTISING,
+				manager->mgmt_index, sizeof(cp), &cp,
+				NULL, NULL, NULL);
+
+		util_clear_uid(&manager->instance_bitmap, client->instance);
+		client->instance = 0;
+	}
+
+	queue_remove(manager->clients, client);
+
+	/* Hand the instance over to an advertisement waiting for one */
+	mux_fill(manager, NULL);
 
 	g_idle_add(client_free_idle_cb, client);
 
@@ -956,12 +1072,334 @@ static int refresh_extended_adv(struct btd_adv_client *client,
 static int refresh_advertisement(struct btd_adv_client *client,
 			mgmt_request_func_t func, unsigned int *mgmt_id)
 {
+	/* Waiting advertisements are refreshed once they get an instance */
+	if (!client->instance)
+		return 0;
+
 	if (client->manager->extended_add_cmds)
 		return refresh_extended_adv(client, func, mgmt_id);
 
 	return refresh_legacy_adv(client, func, mgmt_id);
 }
 
+static void *rotation_build_cmd(struct btd_adv_client *client, uint32_t flags,
+				const struct adv_rotation *rotation,
+				const uint8_t *scan_rsp, size_t scan_rsp_len,
+				uint16_t *cmd_len)
+{
+	if (client->manager->extended_add_cmds) {
+		struct mgmt_cp_add_ext_adv_data *cp;
+
+		*cmd_len = sizeof(*cp) + rotation->len + scan_rsp_len;
+
+		cp = malloc0(*cmd_len);
+		if (!cp)
+			return NULL;
+
+		cp->instance = client->instance;
+		cp->adv_data_len = rotation->len;
+		cp->scan_rsp_len = scan_rsp_len;
+		memcpy(cp->data, rotation->data, rotation->len);
+		memcpy(cp->data + rotation->len, scan_rsp, scan_rsp_len);
+
+		return cp;
+	} else {
+		struct mgmt_cp_add_advertising *cp;
+
+		*cmd_len = sizeof(*cp) + rotation->len + scan_rsp_len;
+
+		cp = malloc0(*cmd_len);
+		if (!cp)
+			return NULL;
+
+		cp->flags = htobl(flags);
+		cp->instance = client->instance;
+		cp->duration = client->duration;
+		cp->adv_data_len = rotation->len;
+		cp->scan_rsp_len = scan_rsp_len;
+		memcpy(cp->data, rotation->data, rotation->len);
+		memcpy(cp->data + rotation->len, scan_rsp, scan_rsp_len);
+
+		return cp;
+	}
+}
+
+/* Serialize every rotation entry into its mgmt command up front so that
+ * the timer only has to hand a ready buffer to the kernel.
+ */
+static bool rotation_build(struct btd_adv_client *client)
+{
+	uint8_t *scan_rsp;
+	size_t scan_rsp_len = -1;
+	uint32_t flags;
+	size_t max, i;
+
+	flags = get_adv_flags(client);
+
+	scan_rsp = generate_scan_rsp(client, &flags, &scan_rsp_len);
+	if (!scan_rsp && scan_rsp_len) {
+		error("Scan data couldn't be generated.");
+		return false;
+	}
+
+	if (client->manager->extended_add_cmds)
+		max = client->max_adv_data_len;
+	else
+		max = calc_max_adv_len(client, flags);
+
+	for (i = 0; i < client->rotation_len; i++) {
+		struct adv_rotation *rotation = &client->rotation[i];
+
+		if (rotation->len > max) {
+			error("Rotation entry %zu too long (%u > %zu)", i,
+							rotation->len, max);
+			goto fail;
+		}
+
+		rotation->cmd = rotation_build_cmd(client, flags, rotation,
+							scan_rsp, scan_rsp_len,
+							&rotation->cmd_len);
+		if (!rotation->cmd) {
+			error("Couldn't allocate for MGMT!");
+			goto fail;
+		}
+	}
+
+	free(scan_rsp);
+
+	return true;
+
+fail:
+	free(scan_rsp);
+	rotation_clear_cmds(client);
+
+	return false;
+}
+
+static bool rotation_timeout(void *user_data)
+{
+	struct btd_adv_client *client = user_data;
+	struct adv_rotation *rotation;
+	uint16_t opcode;
+
+	client->rotation_id = 0;
+
+	if (!client->rotation[0].cmd && !rotation_build(client)) {
+		error("Failed to prepare advertising rotation: %s",
+								client->path);
+		return FALSE;
+	}
+
+	rotation = &client->rotation[client->rotation_pos];
+
+	if (client->manager->extended_add_cmds)
+		opcode = MGMT_OP_ADD_EXT_ADV_DATA;
+	else
+		opcode = MGMT_OP_ADD_ADVERTISING;
+
+	if (!mgmt_send(client->manager->mgmt, opcode,
+				client->manager->mgmt_index, rotation->cmd_len,
+				rotation->cmd, NULL, NULL, NULL))
+		error("Failed to rotate Advertising Data");
+
+	/* A single entry stays in place, there is nothing to rotate */
+	if (client->rotation_len == 1)
+		return FALSE;
+
+	client->rotation_pos = (client->rotation_pos + 1) %
+							client->rotation_len;
+
+	client->rotation_id = timeout_add(rotation->interval, rotation_timeout,
+								client, NULL);
+
+	return FALSE;
+}
+
+static void rotation_start(struct btd_adv_client *client)
+{
+	rotation_stop(client);
+	rotation_clear_cmds(client);
+	client->rotation_pos = 0;
+
+	/* Wait until the kernel has assigned an instance */
+	if (!client->rotation_len || !client->instance)
+		return;
+
+	rotation_timeout(client);
+}
+
+static bool client_is_waiting(struct btd_adv_client *client)
+{
+	return !client->instance && !client->reg;
+}
+
+static void mux_add_callback(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adv_client *client = user_data;
+
+	client->add_adv_id = 0;
+
+	if (status) {
+		error("Failed to schedule advertisement %s: %s (0x%02x)",
+				client->path, mgmt_errstr(status), status);
+		util_clear_uid(&client->manager->instance_bitmap,
+							client->instance);
+		client->instance = 0;
+		client_air_stop(client);
+		return;
+	}
+
+	rotation_start(client);
+}
+
+static void mux_park(struct btd_adv_client *client)
+{
+	struct btd_adv_manager *manager = client->manager;
+	struct mgmt_cp_remove_advertising cp;
+
+	rotation_stop(client);
+
+	cp.instance = client->instance;
+
+	mgmt_send(manager->mgmt, MGMT_OP_REMOVE_ADVERTISING,
+			manager->mgmt_index, sizeof(cp), &cp, NULL, NULL, NULL);
+
+	util_clear_uid(&manager->instance_bitmap, client->instance);
+	client->instance = 0;
+
+	client_air_stop(client);
+
+	DBG("Parking %s, on air %u%% of the time", client->path,
+						client_duty_cycle(client));
+}
+
+static bool mux_unpark(struct btd_adv_client *client)
+{
+	struct btd_adv_manager *manager = client->manager;
+
+	client->instance = util_get_uid(&manager->instance_bitmap,
+							manager->max_ads);
+	if (!client->instance)
+		return false;
+
+	if (refresh_advertisement(client, mux_add_callback,
+						&client->add_adv_id) < 0) {
+		util_clear_uid(&manager->instance_bitmap, client->instance);
+		client->instance = 0;
+		return false;
+	}
+
+	DBG("Scheduling %s on instance %u", client->path, client->instance);
+
+	client_air_start(client);
+
+	return true;
+}
+
+/* Give the free instances to the advertisements that waited the longest */
+static void mux_fill(struct btd_adv_manager *manager, struct queue *filled)
+{
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		struct btd_adv_client *client = entry->data;
+
+		if (!client_is_waiting(client))
+			continue;
+
+		if (!mux_unpark(client))
+			break;
+
+		if (filled)
+			queue_push_tail(filled, client);
+	}
+}
+
+static void mux_detach(void *data, void *user_data)
+{
+	struct btd_adv_manager *manager = user_data;
+
+	queue_remove(manager->clients, data);
+}
+
+static void mux_append(void *data, void *user_data)
+{
+	struct btd_adv_manager *manager = user_data;
+
+	queue_push_tail(manager->clients, data);
+}
+
+/* Time-slice the instances: the advertisements that have been on air the
+ * longest make room for as many waiting ones. All swaps are done in the same
+ * pass so their mgmt commands go out back to back. The client queue is kept
+ * in round-robin order by moving whatever changed state to its tail.
+ */
+static bool mux_timeout(void *user_data)
+{
+	struct btd_adv_manager *manager = user_data;
+	const struct queue_entry *entry;
+	struct queue *parked, *filled;
+	unsigned int waiting = 0;
+
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		if (client_is_waiting(entry->data))
+			waiting++;
+	}
+
+	if (!waiting) {
+		DBG("No advertisement waiting, stop time-slicing");
+		manager->mux_id = 0;
+		return FALSE;
+	}
+
+	parked = queue_new();
+	filled = queue_new();
+
+	for (entry = queue_get_entries(manager->clients); entry && waiting;
+							entry = entry->next) {
+		struct btd_adv_client *client = entry->data;
+
+		/* Leave alone the ones still being set up */
+		if (!client->instance || client->reg || client->add_adv_id)
+			continue;
+
+		mux_park(client);
+		queue_push_tail(parked, client);
+		waiting--;
+	}
+
+	/* Keep the parked ones from taking their instance right back */
+	queue_foreach(parked, mux_detach, manager);
+
+	mux_fill(manager, filled);
+
+	queue_foreach(filled, mux_detach, manager);
+	queue_foreach(filled, mux_append, manager);
+	queue_foreach(parked, mux_append, manager);
+
+	/* Instances nobody else could take go back to the parked ones */
+	mux_fill(manager, NULL);
+
+	queue_destroy(filled, NULL);
+	queue_destroy(parked, NULL);
+
+	return TRUE;
+}
+
+static void mux_start(struct btd_adv_manager *manager)
+{
+	if (manager->mux_id)
+		return;
+
+	DBG("More advertisements than instances, start time-slicing");
+
+	manager->mux_id = timeout_add_seconds(ADV_MUX_SLICE, mux_timeout,
+							manager, NULL);
+}
+
 static bool client_discoverable_timeout(void *user_data)
 {
 	struct btd_adv_client *client = user_data;
@@ -1133,6 +1571,85 @@ static bool parse_tx_power(DBusMessageIter *iter,
 	return true;
 }
 
+static bool parse_rotation(DBusMessageIter *iter,
+					struct btd_adv_client *client)
+{
+	DBusMessageIter array;
+	struct adv_rotation *rotation = NULL;
+	size_t len = 0;
+
+	if (!iter) {
+		rotation_free(client);
+		return true;
+	}
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(iter, &array);
+
+	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+		DBusMessageIter entry, value;
+		struct adv_rotation *tmp;
+		uint16_t interval;
+		uint8_t *data;
+		int data_len;
+
+		dbus_message_iter_recurse(&array, &entry);
+
+		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_ARRAY ||
+				dbus_message_iter_get_element_type(&entry) !=
+							DBUS_TYPE_BYTE)
+			goto fail;
+
+		dbus_message_iter_recurse(&entry, &value);
+		dbus_message_iter_get_fixed_array(&value, &data, &data_len);
+
+		if (!data_len || data_len > UINT8_MAX)
+			goto fail;
+
+		dbus_message_iter_next(&entry);
+
+		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_UINT16)
+			goto fail;
+
+		dbus_message_iter_get_basic(&entry, &interval);
+
+		if (interval < ADV_ROTATION_MIN_INTERVAL)
+			goto fail;
+
+		tmp = realloc(rotation, (len + 1) * sizeof(*rotation));
+		if (!tmp)
+			goto fail;
+
+		rotation = tmp;
+		memset(&rotation[len], 0, sizeof(*rotation));
+		rotation[len].data = util_memdup(data, data_len);
+		rotation[len].len = data_len;
+		rotation[len].interval = interval;
+		len++;
+
+		DBG("Adding Rotation entry len %u interval %u ms", data_len,
+								interval);
+
+		dbus_message_iter_next(&array);
+	}
+
+	rotation_free(client);
+	client->rotation = rotation;
+	client->rotation_len = len;
+
+	return true;
+
+fail:
+	while (len--)
+		free(rotation[len].data);
+
+	free(rotation);
+
+	return false;
+}
+
 static struct adv_parser {
 	const char *name;
 	bool (*func)(DBusMessageIter *iter, struct btd_adv_client *client);
@@ -1154,6 +1671,7 @@ static struct adv_parser {
 	{ "MinInterval", parse_min_interval },
 	{ "MaxInterval", parse_max_interval },
 	{ "TxPower", parse_tx_power },
+	{ "Rotation", parse_rotation },
 	{ },
 };
 
@@ -1169,6 +1687,7 @@ static void properties_changed(GDBusProxy *proxy, const char *name,
 
 		if (parser->func(iter, client)) {
 			refresh_advertisement(client, NULL, NULL);
+			rotation_start(client);
 
 			break;
 		}
@@ -1195,6 +1714,24 @@ static void add_client_complete(struct btd_adv_client *client, uint8_t status)
 	client->reg = NULL;
 }
 
+static void client_registered(struct btd_adv_client *client)
+{
+	g_dbus_client_set_disconnect_watch(client->client, client_disconnect_cb,
+									client);
+	DBG("Advertisement registered: %s", client->path);
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(),
+				adapter_get_path(client->manager->adapter),
+				LE_ADVERTISING_MGR_IFACE, "SupportedInstances");
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(),
+				adapter_get_path(client->manager->adapter),
+				LE_ADVERTISING_MGR_IFACE, "ActiveInstances");
+
+	g_dbus_proxy_set_property_watch(client->proxy, properties_changed,
+								client);
+}
+
 static void add_adv_callback(uint8_t status, uint16_t length,
 					  const void *param, void *user_data)
 {
@@ -1213,20 +1750,9 @@ static void add_adv_callback(uint8_t status, uint16_t length,
 
 	client->instance = rp->instance;
 
-	g_dbus_client_set_disconnect_watch(client->client, client_disconnect_cb,
-									client);
-	DBG("Advertisement registered: %s", client->path);
-
-	g_dbus_emit_property_changed(btd_get_dbus_connection(),
-				adapter_get_path(client->manager->adapter),
-				LE_ADVERTISING_MGR_IFACE, "SupportedInstances");
-
-	g_dbus_emit_property_changed(btd_get_dbus_connection(),
-				adapter_get_path(client->manager->adapter),
-				LE_ADVERTISING_MGR_IFACE, "ActiveInstances");
-
-	g_dbus_proxy_set_property_watch(client->proxy, properties_changed,
-								client);
+	client_registered(client);
+	client_air_start(client);
+	rotation_start(client);
 
 done:
 	add_client_complete(client, status);
@@ -1237,6 +1763,7 @@ static void add_adv_params_callback(uint8_t status, uint16_t length,
 {
 	struct btd_adv_client *client = user_data;
 	const struct mgmt_rp_add_ext_adv_params *rp = param;
+	mgmt_request_func_t done_func = client->refresh_done_func;
 	struct mgmt_cp_add_ext_adv_data *cp = NULL;
 	uint8_t param_len;
 	uint8_t *adv_data = NULL;
@@ -1264,6 +1791,7 @@ static void add_adv_params_callback(uint8_t status, uint16_t length,
 				DBUS_TYPE_INT16, &tx_power, NULL, NULL, NULL);
 
 	client->instance = rp->instance;
+	client->max_adv_data_len = rp->max_adv_data_len;
 
 	flags = get_adv_flags(client);
 
@@ -1334,8 +1862,13 @@ fail:
 	if (!status)
 		status = -EINVAL;
 
+	client->refresh_done_func = NULL;
+
 	/* Failure for any reason ends this advertising request */
-	add_client_complete(client, status);
+	if (client->reg)
+		add_client_complete(client, status);
+	else if (done_func)
+		done_func(status, 0, NULL, client);
 }
 
 static DBusMessage *parse_advertisement(struct btd_adv_client *client)
@@ -1396,6 +1929,15 @@ static DBusMessage *parse_advertisement(struct btd_adv_client *client)
 		goto fail;
 	}
 
+	/* Without an instance the advertisement waits for its turn */
+	if (!client->instance) {
+		DBG("No free instance for %s, waiting", client->path);
+		client_registered(client);
+		add_client_complete(client, 0);
+		mux_start(client->manager);
+		return NULL;
+	}
+
 	err = refresh_advertisement(client, add_adv_callback,
 					&client->add_adv_id);
 
@@ -1478,6 +2020,7 @@ static struct btd_adv_client *client_create(struct btd_adv_manager *manager,
 	client->max_interval = 0;
 
 	client->refresh_done_func = NULL;
+	client->reg_time = g_get_monotonic_time();
 
 	return client;
 
@@ -1522,7 +2065,8 @@ static DBusMessage *register_advertisement(DBusConnection *conn,
 
 	client->instance = util_get_uid(&manager->instance_bitmap,
 							manager->max_ads);
-	if (!client->instance) {
+	if (!client->instance &&
+			queue_length(manager->clients) >= ADV_MUX_MAX_CLIENTS) {
 		client_free(client);
 		return btd_error_not_permitted(msg,
 					"Maximum advertisements reached");
@@ -1571,9 +2115,17 @@ static gboolean get_instances(const GDBusPropertyTable *property,
 					DBusMessageIter *iter, void *data)
 {
 	struct btd_adv_manager *manager = data;
-	uint8_t instances;
+	const struct queue_entry *entry;
+	uint8_t instances = manager->max_ads;
+
+	/* Waiting advertisements don't hold an instance */
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		struct btd_adv_client *client = entry->data;
 
-	instances = manager->max_ads - queue_length(manager->clients);
+		if (client->instance)
+			instances--;
+	}
 
 	dbus_message_iter_append_basic(iter, DBUS_TYPE_BYTE, &instances);
 
@@ -1757,6 +2309,9 @@ static void manager_destroy(void *user_data)
 {
 	struct btd_adv_manager *manager = user_data;
 
+	if (manager->mux_id)
+		timeout_remove(manager->mux_id);
+
 	queue_destroy(manager->clients, client_destroy);
 
 	mgmt_unref(manager->mgmt);
@@ -111,6 +111,8 @@ void btd_backtrace(uint16_t index)
 done:
 	dwfl_end(dwfl);
 #endif
+	/* Show what led up to it when debug messages were only recorded */
+	__btd_log_dump();
 }
 
 void btd_assertion_message_expr(const char *file, int line,
@@ -24,6 +24,17 @@ typedef enum {
 	BT_GATT_CACHE_NO,
 } bt_gatt_cache_t;
 
+typedef enum {
+	BT_STORAGE_FILE,
+	BT_STORAGE_JOURNAL,
+} bt_storage_t;
+
+typedef enum {
+	BT_STORAGE_SYNC_NEVER,
+	BT_STORAGE_SYNC_BATCH,
+	BT_STORAGE_SYNC_ALWAYS,
+} bt_storage_sync_t;
+
 enum jw_repairing_t {
 	JW_REPAIRING_NEVER,
 	JW_REPAIRING_CONFIRM,
@@ -89,10 +100,21 @@ struct btd_defaults {
 struct btd_avdtp_opts {
 	uint8_t  session_mode;
 	uint8_t  stream_mode;
+	bool     fast_reconnect;
+};
+
+struct btd_conn_param_opts {
+	bool		adaptive;
+	uint16_t	busy_interval;
+	uint16_t	idle_interval;
+	uint16_t	idle_latency;
+	uint16_t	busy_threshold;	/* ATT PDUs per second */
+	uint16_t	idle_timeout;	/* Seconds */
 };
 
 struct btd_advmon_opts {
 	uint8_t		rssi_sampling_period;
+	uint16_t	offload_slots;
 };
 
 struct btd_opts {
@@ -102,6 +124,14 @@ struct btd_opts {
 	uint32_t	pairto;
 	uint32_t	discovto;
 	uint32_t	tmpto;
+	uint8_t		rssi_hysteresis;
+	uint32_t	rssi_interval;
+	uint8_t		mgmt_pipeline;
+	uint32_t	props_interval;
+	uint32_t	signal_budget;
+	uint32_t	found_batch;
+	char		*metrics_socket;
+	char		**lazy_plugins;
 	uint8_t		privacy;
 	bool		device_privacy;
 	uint32_t	name_request_retry_delay;
@@ -133,13 +163,20 @@ struct btd_opts {
 
 	enum jw_repairing_t jw_repairing;
 
+	bt_storage_t	storage;
+	bt_storage_sync_t storage_sync;
+
 	struct btd_advmon_opts	advmon;
+
+	struct btd_conn_param_opts conn_param;
+	bool		le_2m_phy;
 };
 
 extern struct btd_opts btd_opts;
 
 gboolean plugin_init(const char *enable, const char *disable);
 void plugin_cleanup(void);
+void plugin_activate_uuid(const char *uuid);
 
 void rfkill_init(void);
 void rfkill_exit(void);
@@ -20,9 +20,9 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <errno.h>
-#include <dirent.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -39,6 +39,7 @@
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/gatt-server.h"
 #include "src/shared/ad.h"
@@ -72,7 +73,22 @@
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
-#define RSSI_THRESHOLD		8
+#define DEVICE_STORE_DELAY	1000
+
+/* Values planned with btd_device_gatt_read are sent once the profiles
+ * being accepted in the current main loop iteration are done.
+ */
+#define GATT_READ_PLAN_DELAY	0
+
+/* Connection parameters last requested for ATT traffic */
+#define CONN_PARAM_UNKNOWN	0
+#define CONN_PARAM_BUSY		1
+#define CONN_PARAM_IDLE		2
+
+/* The kernel does not report PHY updates, so the PHYs of LE links are
+ * read again once the controller had time to switch to its preferred PHY.
+ */
+#define PHY_CHECK_DELAY		2
 
 #define GATT_PRIM_SVC_UUID_STR "2800"
 #define GATT_SND_SVC_UUID_STR  "2801"
@@ -82,6 +98,10 @@
 static DBusConnection *dbus_conn = NULL;
 static unsigned service_state_cb_id;
 
+/* Devices with info waiting to be written in the next batch */
+static struct queue *store_queue;
+static unsigned int store_timer;
+
 struct btd_disconnect_data {
 	guint id;
 	disconnect_watch watch;
@@ -152,12 +172,30 @@ struct svc_callback {
 	void *user_data;
 };
 
+struct gatt_read {
+	unsigned int id;
+	uint16_t handle;
+	uint16_t length;
+	device_read_cb_t func;
+	void *user_data;
+};
+
+struct gatt_read_req {
+	struct btd_device *dev;
+	unsigned int id;
+	struct queue *reads;
+	uint16_t total;
+	bool variable;
+	bool done;
+};
+
 /* Per-bearer (LE or BR/EDR) device state */
 struct bearer_state {
 	bool paired;
 	bool bonded;
 	bool connected;
 	bool svc_resolved;
+	uint64_t report;	/* Fingerprint of the last report handled */
 };
 
 struct csrk_info {
@@ -223,6 +261,8 @@ struct btd_device {
 	unsigned int	disconn_timer;
 	unsigned int	discov_timer;
 	unsigned int	temporary_timer;	/* Temporary/disappear timer */
+	unsigned int	rssi_timer;		/* RSSI signal rate limit */
+	bool		rssi_changed;
 	struct browse_req *browse;		/* service discover request */
 	struct bonding_req *bonding;
 	struct authentication_req *authr;	/* authentication request */
@@ -234,6 +274,12 @@ struct btd_device {
 	struct bt_att *att;			/* The new ATT transport */
 	uint16_t att_mtu;			/* The ATT MTU */
 	unsigned int att_disconn_id;
+	unsigned int conn_param_timer;		/* ATT traffic sampling */
+	unsigned int conn_param_pdus;
+	uint16_t conn_param_idle;		/* Seconds without traffic */
+	uint8_t conn_param_state;
+	uint32_t phys;				/* BT_PHY of the ATT link */
+	unsigned int phy_timer;
 
 	/*
 	 * TODO: For now, device creates and owns the client-role gatt_db, but
@@ -245,6 +291,10 @@ struct btd_device {
 	struct bt_gatt_client *client;		/* GATT client instance */
 	struct bt_gatt_server *server;		/* GATT server instance */
 	unsigned int gatt_ready_id;
+	struct queue *planned_reads;		/* Reads waiting for a batch */
+	struct queue *read_reqs;		/* Batches being read */
+	unsigned int read_plan_id;
+	unsigned int next_read_id;
 
 	struct btd_gatt_client *client_dbus;
 
@@ -271,7 +321,7 @@ struct btd_device {
 	int8_t		tx_power;
 
 	GIOChannel	*att_io;
-	guint		store_id;
+	bool		store_pending;
 
 	time_t		name_resolve_failed_time;
 };
@@ -377,9 +427,8 @@ static void store_csrk(struct csrk_info *csrk, GKeyFile *key_file,
 	g_key_file_set_integer(key_file, group, "Counter", csrk->counter);
 }
 
-static gboolean store_device_info_cb(gpointer user_data)
+static void write_device_info(struct btd_device *device)
 {
-	struct btd_device *device = user_data;
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	char filename[PATH_MAX];
@@ -389,21 +438,21 @@ static gboolean store_device_info_cb(gpointer user_data)
 	char **uuids = NULL;
 	gsize length = 0;
 
-	device->store_id = 0;
+	device->store_pending = false;
 
 	ba2str(&device->bdaddr, device_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
 		g_key_file_free(key_file);
-		return FALSE;
+		return;
 	}
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
@@ -475,7 +524,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 		store_csrk(device->remote_csrk, key_file, "RemoteSignatureKey");
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -485,8 +534,6 @@ static gboolean store_device_info_cb(gpointer user_data)
 
 	g_key_file_free(key_file);
 	g_free(uuids);
-
-	return FALSE;
 }
 
 static bool device_address_is_private(struct btd_device *dev)
@@ -503,9 +550,36 @@ static bool device_address_is_private(struct btd_device *dev)
 	}
 }
 
+static void flush_device_info(void)
+{
+	struct btd_device *device;
+
+	if (store_timer) {
+		timeout_remove(store_timer);
+		store_timer = 0;
+	}
+
+	if (queue_isempty(store_queue))
+		return;
+
+	while ((device = queue_pop_head(store_queue)))
+		write_device_info(device);
+
+	btd_storage_sync();
+}
+
+static bool store_device_info_cb(void *user_data)
+{
+	store_timer = 0;
+
+	flush_device_info();
+
+	return false;
+}
+
 static void store_device_info(struct btd_device *device)
 {
-	if (device->temporary || device->store_id > 0)
+	if (device->temporary || device->store_pending)
 		return;
 
 	if (device_address_is_private(device)) {
@@ -514,7 +588,16 @@ static void store_device_info(struct btd_device *device)
 		return;
 	}
 
-	device->store_id = g_idle_add(store_device_info_cb, device);
+	/* Changes tend to come in bursts so write them out together */
+	device->store_pending = queue_push_tail(store_queue, device);
+	if (!device->store_pending) {
+		write_device_info(device);
+		return;
+	}
+
+	if (!store_timer)
+		store_timer = timeout_add(DEVICE_STORE_DELAY,
+						store_device_info_cb, NULL, NULL);
 }
 
 void device_store_cached_name(struct btd_device *dev, const char *name)
@@ -537,10 +620,10 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -553,7 +636,7 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	data = g_key_file_to_data(key_file, &length, NULL);
 
 	if ((length != length_old) || (memcmp(data, data_old, length))) {
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_clear_error(&gerr);
@@ -586,10 +669,10 @@ static void device_store_cached_name_resolve(struct btd_device *dev)
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -605,7 +688,7 @@ static void device_store_cached_name_resolve(struct btd_device *dev)
 	data = g_key_file_to_data(key_file, &length, NULL);
 
 	if ((length != length_old) || (memcmp(data, data_old, length))) {
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -659,11 +742,33 @@ static void gatt_cache_cleanup(struct btd_device *device)
 	device->le_state.svc_resolved = false;
 }
 
+static void gatt_read_cleanup(struct btd_device *device)
+{
+	struct gatt_read_req *req;
+
+	if (device->read_plan_id) {
+		timeout_remove(device->read_plan_id);
+		device->read_plan_id = 0;
+	}
+
+	queue_destroy(device->planned_reads, free);
+	device->planned_reads = NULL;
+
+	while ((req = queue_pop_head(device->read_reqs))) {
+		req->dev = NULL;
+		bt_gatt_client_cancel(device->client, req->id);
+	}
+
+	queue_destroy(device->read_reqs, NULL);
+	device->read_reqs = NULL;
+}
+
 static void gatt_client_cleanup(struct btd_device *device)
 {
 	if (!device->client)
 		return;
 
+	gatt_read_cleanup(device);
 	gatt_cache_cleanup(device);
 	bt_gatt_client_set_service_changed(device->client, NULL, NULL, NULL);
 
@@ -691,6 +796,22 @@ static void gatt_server_cleanup(struct btd_device *device)
 
 static void attio_cleanup(struct btd_device *device)
 {
+	if (device->conn_param_timer) {
+		timeout_remove(device->conn_param_timer);
+		device->conn_param_timer = 0;
+	}
+
+	if (device->phy_timer) {
+		timeout_remove(device->phy_timer);
+		device->phy_timer = 0;
+	}
+
+	if (device->phys) {
+		device->phys = 0;
+		g_dbus_emit_property_changed(dbus_conn, device->path,
+						DEVICE_INTERFACE, "PHYs");
+	}
+
 	if (device->att_disconn_id)
 		bt_att_unregister_disconnect(device->att,
 							device->att_disconn_id);
@@ -748,6 +869,9 @@ static void device_free(gpointer user_data)
 {
 	struct btd_device *device = user_data;
 
+	if (device->store_pending)
+		queue_remove(store_queue, device);
+
 	btd_gatt_client_destroy(device->client_dbus);
 	device->client_dbus = NULL;
 
@@ -777,6 +901,9 @@ static void device_free(gpointer user_data)
 	if (device->temporary_timer)
 		timeout_remove(device->temporary_timer);
 
+	if (device->rssi_timer)
+		timeout_remove(device->rssi_timer);
+
 	if (device->connect)
 		dbus_message_unref(device->connect);
 
@@ -1575,6 +1702,80 @@ static gboolean dev_property_wake_allowed_exist(
 	return device_get_wake_support(device);
 }
 
+static const struct {
+	uint32_t bit;
+	const char *str;
+} phy_table[] = {
+	{ BT_PHY_LE_1M_TX, "LE1MTX" },
+	{ BT_PHY_LE_1M_RX, "LE1MRX" },
+	{ BT_PHY_LE_2M_TX, "LE2MTX" },
+	{ BT_PHY_LE_2M_RX, "LE2MRX" },
+	{ BT_PHY_LE_CODED_TX, "LECODEDTX" },
+	{ BT_PHY_LE_CODED_RX, "LECODEDRX" },
+};
+
+static gboolean dev_property_get_phys(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct btd_device *device = data;
+	DBusMessageIter array;
+	size_t i;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					DBUS_TYPE_STRING_AS_STRING, &array);
+
+	for (i = 0; i < ARRAY_SIZE(phy_table); i++) {
+		if (!(device->phys & phy_table[i].bit))
+			continue;
+
+		dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING,
+							&phy_table[i].str);
+	}
+
+	dbus_message_iter_close_container(iter, &array);
+
+	return TRUE;
+}
+
+static gboolean dev_property_phys_exist(const GDBusPropertyTable *property,
+								void *data)
+{
+	struct btd_device *device = data;
+
+	return device->phys ? TRUE : FALSE;
+}
+
+static void device_update_phys(struct btd_device *device)
+{
+	uint32_t phys = 0;
+	socklen_t len = sizeof(phys);
+
+	if (getsockopt(bt_att_get_fd(device->att), SOL_BLUETOOTH, BT_PHY,
+							&phys, &len) < 0) {
+		DBG("getsockopt(BT_PHY): %s (%d)", strerror(errno), errno);
+		return;
+	}
+
+	if (phys == device->phys)
+		return;
+
+	DBG("PHYs 0x%08x", phys);
+
+	device->phys = phys;
+	g_dbus_emit_property_changed(dbus_conn, device->path,
+						DEVICE_INTERFACE, "PHYs");
+}
+
+static bool phy_check(gpointer user_data)
+{
+	struct btd_device *device = user_data;
+
+	device->phy_timer = 0;
+	device_update_phys(device);
+
+	return false;
+}
+
 static bool disconnect_all(gpointer user_data)
 {
 	struct btd_device *device = user_data;
@@ -2467,8 +2668,8 @@ static void store_services(struct btd_device *device)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -2480,171 +2681,37 @@ static void store_services(struct btd_device *device)
 	g_key_file_free(key_file);
 }
 
-struct gatt_saver {
-	struct btd_device *device;
-	uint16_t ext_props;
-	GKeyFile *key_file;
-};
-
-static void db_hash_read_value_cb(struct gatt_db_attribute *attrib,
-						int err, const uint8_t *value,
-						size_t length, void *user_data)
+static void remove_cached_attributes(const char *filename)
 {
-	const uint8_t **hash = user_data;
-
-	if (err || (length != 16))
-		return;
-
-	*hash = value;
-}
-
-static void store_desc(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	const bt_uuid_t *uuid;
-	bt_uuid_t ext_uuid;
-	uint16_t handle_num;
-
-	handle_num = gatt_db_attribute_get_handle(attr);
-	sprintf(handle, "%04hx", handle_num);
-
-	uuid = gatt_db_attribute_get_type(attr);
-	bt_uuid_to_string(uuid, uuid_str, sizeof(uuid_str));
-
-	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
-	if (!bt_uuid_cmp(uuid, &ext_uuid) && saver->ext_props)
-		sprintf(value, "%04hx:%s", saver->ext_props, uuid_str);
-	else
-		sprintf(value, "%s", uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-}
-
-static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, value_handle;
-	uint8_t properties;
-	bt_uuid_t uuid, hash_uuid;
-
-	if (!gatt_db_attribute_get_char_data(attr, &handle_num, &value_handle,
-						&properties, &saver->ext_props,
-						&uuid)) {
-		warn("Error storing characteristic - can't get data");
-		return;
-	}
-
-	sprintf(handle, "%04hx", handle_num);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-
-	/* Store Database Hash  value if available */
-	bt_uuid16_create(&hash_uuid, GATT_CHARAC_DB_HASH);
-	if (!bt_uuid_cmp(&uuid, &hash_uuid)) {
-		const uint8_t *hash = NULL;
-
-		attr = gatt_db_get_attribute(saver->device->db, value_handle);
-
-		gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
-					db_hash_read_value_cb, &hash);
-		if (hash)
-			sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:"
-				"%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
-				"%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
-				"%02hhx%02hhx:%s", value_handle, properties,
-				hash[0], hash[1], hash[2], hash[3],
-				hash[4], hash[5], hash[6], hash[7],
-				hash[8], hash[9], hash[10], hash[11],
-				hash[12], hash[13], hash[14], hash[15],
-				uuid_str);
-		else
-			sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
-				value_handle, properties, uuid_str);
-
-	} else
-		sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
-				value_handle, properties, uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-
-	gatt_db_service_foreach_desc(attr, store_desc, saver);
-}
-
-static void store_incl(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	struct gatt_db_attribute *service;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, start, end;
-	bt_uuid_t uuid;
-
-	if (!gatt_db_attribute_get_incl_data(attr, &handle_num, &start, &end)) {
-		warn("Error storing included service - can't get data");
-		return;
-	}
+	GKeyFile *key_file;
+	GError *gerr = NULL;
+	char *data;
+	gsize length = 0;
 
-	service = gatt_db_get_attribute(saver->device->db, start);
-	if (!service) {
-		warn("Error storing included service - can't find it");
+	key_file = g_key_file_new();
+	if (!btd_storage_load(key_file, filename, 0, NULL) ||
+			!g_key_file_has_group(key_file, "Attributes")) {
+		g_key_file_free(key_file);
 		return;
 	}
 
-	sprintf(handle, "%04hx", handle_num);
-
-	gatt_db_attribute_get_service_uuid(service, &uuid);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", start,
-								end, uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-}
-
-static void store_service(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char uuid_str[MAX_LEN_UUID_STR], handle[6], value[256];
-	uint16_t start, end;
-	bt_uuid_t uuid;
-	bool primary;
-	char *type;
+	g_key_file_remove_group(key_file, "Attributes", NULL);
 
-	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
-								&uuid)) {
-		warn("Error storing service - can't get data");
-		return;
+	data = g_key_file_to_data(key_file, &length, NULL);
+	if (!btd_storage_set_contents(filename, data, length, &gerr)) {
+		error("Unable set contents for %s: (%s)", filename,
+								gerr->message);
+		g_error_free(gerr);
 	}
 
-	sprintf(handle, "%04hx", start);
-
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-
-	if (primary)
-		type = GATT_PRIM_SVC_UUID_STR;
-	else
-		type = GATT_SND_SVC_UUID_STR;
-
-	sprintf(value, "%s:%04hx:%s", type, end, uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-
-	gatt_db_service_foreach_incl(attr, store_incl, saver);
-	gatt_db_service_foreach_char(attr, store_chrc, saver);
+	g_free(data);
+	g_key_file_free(key_file);
 }
 
 static void store_gatt_db(struct btd_device *device)
 {
 	char filename[PATH_MAX];
 	char dst_addr[18];
-	GKeyFile *key_file;
-	GError *gerr = NULL;
-	char *data;
-	gsize length = 0;
-	struct gatt_saver saver;
 
 	if (device_address_is_private(device)) {
 		DBG("Can't store GATT db for private addressed device %s",
@@ -2657,38 +2724,23 @@ static void store_gatt_db(struct btd_device *device)
 
 	ba2str(&device->bdaddr, dst_addr);
 
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s.gatt",
 				btd_adapter_get_storage_dir(device->adapter),
 				dst_addr);
 	create_file(filename, 0600);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
-		error("Unable to load key file from %s: (%s)", filename,
-								gerr->message);
-		g_clear_error(&gerr);
-	}
-
-	/* Remove current attributes since it might have changed */
-	g_key_file_remove_group(key_file, "Attributes", NULL);
-
-	saver.key_file = key_file;
-	saver.device = device;
-
-	gatt_db_foreach_service(device->db, NULL, store_service, &saver);
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, data, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
+	if (!gatt_cache_store(device->db, filename)) {
+		error("Unable to store GATT db to %s", filename);
+		return;
 	}
 
-	g_free(data);
-	g_key_file_free(key_file);
+	/* Attributes stored by older versions are no longer needed */
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+				btd_adapter_get_storage_dir(device->adapter),
+				dst_addr);
+	remove_cached_attributes(filename);
 }
 
-
 static void browse_request_complete(struct browse_req *req, uint8_t type,
 						uint8_t bdaddr_type, int err)
 {
@@ -3145,6 +3197,8 @@ static const GDBusPropertyTable device_properties[] = {
 	{ "WakeAllowed", "b", dev_property_get_wake_allowed,
 				dev_property_set_wake_allowed,
 				dev_property_wake_allowed_exist },
+	{ "PHYs", "as", dev_property_get_phys, NULL, dev_property_phys_exist,
+				G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
 	{ }
 };
 
@@ -3361,7 +3415,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	key_file = g_key_file_new();
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
+	if (!btd_storage_load(key_file, filename, 0, NULL))
 		goto failed;
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
@@ -3391,7 +3445,7 @@ static void load_cached_name_resolve(struct btd_device *device,
 
 	key_file = g_key_file_new();
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
+	if (!btd_storage_load(key_file, filename, 0, NULL))
 		goto failed;
 
 	failed_time = g_key_file_get_uint64(key_file, "NameResolving",
@@ -3487,7 +3541,7 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 			device_addr);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -3636,7 +3690,6 @@ static void load_att_info(struct btd_device *device, const char *local,
 				const char *peer)
 {
 	char filename[PATH_MAX];
-	struct stat st;
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	char *prim_uuid, *str;
@@ -3650,11 +3703,11 @@ static void load_att_info(struct btd_device *device, const char *local,
 			peer);
 
 	/* Check if attributes file exists */
-	if (stat(filename, &st) < 0)
+	if (!btd_storage_exists(filename))
 		return;
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -4032,22 +4085,42 @@ static int load_gatt_db_impl(GKeyFile *key_file, char **keys,
 	return 0;
 }
 
+static void debug_gatt_db_usage(struct btd_device *device)
+{
+	struct gatt_db_usage usage;
+
+	if (!gatt_db_get_usage(device->db, &usage))
+		return;
+
+	DBG("%u services, %u attributes, %zu bytes, %zu shared bytes",
+					usage.services, usage.attributes,
+					usage.bytes, usage.shared_bytes);
+}
+
 static void load_gatt_db(struct btd_device *device, const char *local,
 							const char *peer)
 {
 	char **keys, filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
+	bool migrate = false;
 
 	if (!gatt_cache_is_enabled(device))
 		return;
 
 	DBG("Restoring %s gatt database from file", peer);
 
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s.gatt", local,
+									peer);
+
+	if (gatt_cache_load(device->db, filename))
+		goto done;
+
+	/* Fallback to the attributes stored by older versions */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -4062,14 +4135,22 @@ static void load_gatt_db(struct btd_device *device, const char *local,
 
 	if (load_gatt_db_impl(key_file, keys, device->db))
 		warn("Unable to load gatt db from file for %s", peer);
+	else
+		migrate = true;
 
 	g_strfreev(keys);
 	g_key_file_free(key_file);
 
+	if (migrate)
+		store_gatt_db(device);
+
+done:
 	g_slist_free_full(device->primaries, g_free);
 	device->primaries = NULL;
 	gatt_db_foreach_service(device->db, NULL, add_primary,
 							&device->primaries);
+
+	debug_gatt_db_usage(device);
 }
 
 static void device_add_uuids(struct btd_device *device, GSList *uuids)
@@ -4686,36 +4767,6 @@ uint16_t btd_device_get_version(struct btd_device *device)
 	return device->version;
 }
 
-static void delete_folder_tree(const char *dirname)
-{
-	DIR *dir;
-	struct dirent *entry;
-	char filename[PATH_MAX];
-
-	dir = opendir(dirname);
-	if (dir == NULL)
-		return;
-
-	while ((entry = readdir(dir)) != NULL) {
-		if (g_str_equal(entry->d_name, ".") ||
-				g_str_equal(entry->d_name, ".."))
-			continue;
-
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
-
-		if (entry->d_type == DT_DIR)
-			delete_folder_tree(filename);
-		else
-			unlink(filename);
-	}
-	closedir(dir);
-
-	rmdir(dirname);
-}
-
 void device_remove_bonding(struct btd_device *device, uint8_t bdaddr_type)
 {
 	if (bdaddr_type == BDADDR_BREDR)
@@ -4756,14 +4807,22 @@ static void device_remove_stored(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
-	delete_folder_tree(filename);
+	btd_storage_remove_tree(filename);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s.gatt",
+				btd_adapter_get_storage_dir(device->adapter),
+				device_addr);
+	unlink(filename);
+
+	bt_clear_cached_records(btd_adapter_get_address(device->adapter),
+							&device->bdaddr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		g_error_free(gerr);
 		g_key_file_free(key_file);
 		return;
@@ -4773,8 +4832,8 @@ static void device_remove_stored(struct btd_device *device)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
+		btd_storage_create(filename);
+		if (!btd_storage_set_contents(filename, data, length, &gerr)) {
 			error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 			g_error_free(gerr);
@@ -4826,12 +4885,12 @@ void device_remove(struct btd_device *device, gboolean remove_stored)
 
 	clear_temporary_timer(device);
 
-	if (device->store_id > 0) {
-		g_source_remove(device->store_id);
-		device->store_id = 0;
+	if (device->store_pending) {
+		queue_remove(store_queue, device);
+		device->store_pending = false;
 
 		if (!remove_stored)
-			store_device_info_cb(device);
+			write_device_info(device);
 	}
 
 	if (remove_stored)
@@ -5026,6 +5085,7 @@ void device_probe_profiles(struct btd_device *device, GSList *uuids)
 {
 	struct probe_data d = { device, uuids };
 	char addr[18];
+	GSList *l;
 
 	ba2str(&device->bdaddr, addr);
 
@@ -5036,6 +5096,9 @@ void device_probe_profiles(struct btd_device *device, GSList *uuids)
 
 	DBG("Probing profiles for device %s", addr);
 
+	for (l = uuids; l; l = g_slist_next(l))
+		plugin_activate_uuid(l->data);
+
 	btd_profile_foreach(dev_probe, &d);
 
 add_uuids:
@@ -5167,10 +5230,10 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 
 	snprintf(sdp_file, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
 								dstaddr);
-	create_file(sdp_file, 0600);
+	btd_storage_create(sdp_file);
 
 	sdp_key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(sdp_key_file, sdp_file, 0, &gerr)) {
+	if (!btd_storage_load(sdp_key_file, sdp_file, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", sdp_file,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -5180,10 +5243,10 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 
 	snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes", srcaddr,
 								dstaddr);
-	create_file(att_file, 0600);
+	btd_storage_create(att_file);
 
 	att_key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(att_key_file, att_file, 0, &gerr)) {
+	if (!btd_storage_load(att_key_file, att_file, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", att_file,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -5243,7 +5306,7 @@ next:
 	if (sdp_key_file) {
 		data = g_key_file_to_data(sdp_key_file, &length, NULL);
 		if (length > 0) {
-			if (!g_file_set_contents(sdp_file, data, length,
+			if (!btd_storage_set_contents(sdp_file, data, length,
 								&gerr)) {
 				error("Unable set contents for %s: (%s)",
 						sdp_file, gerr->message);
@@ -5258,7 +5321,7 @@ next:
 	if (att_key_file) {
 		data = g_key_file_to_data(att_key_file, &length, NULL);
 		if (length > 0) {
-			if (!g_file_set_contents(att_file, data, length,
+			if (!btd_storage_set_contents(att_file, data, length,
 								&gerr)) {
 				error("Unable set contents for %s: (%s)",
 						att_file, gerr->message);
@@ -5363,6 +5426,9 @@ static void search_cb(sdp_list_t *recs, int err, gpointer user_data)
 	device->tmp_records = req->records;
 	req->records = NULL;
 
+	bt_cache_records(btd_adapter_get_address(device->adapter),
+					&device->bdaddr, device->tmp_records);
+
 	if (!req->profiles_added) {
 		DBG("%s: No service update", addr);
 		goto send_reply;
@@ -5423,9 +5489,9 @@ static void browse_cb(sdp_list_t *recs, int err, gpointer user_data)
 	if (uuid_list[req->search_uuid]) {
 		sdp_uuid16_create(&uuid, uuid_list[req->search_uuid++]);
 		bt_search_service(btd_adapter_get_address(adapter),
-						&device->bdaddr, &uuid,
-						browse_cb, user_data, NULL,
-						req->sdp_flags);
+					&device->bdaddr, &uuid,
+					browse_cb, user_data, NULL,
+					req->sdp_flags | BT_SEARCH_NO_CACHE);
 		return;
 	}
 
@@ -5466,6 +5532,11 @@ static void att_disconnected_cb(int err, void *user_data)
 
 	g_slist_foreach(device->services, disconnect_gatt_service, NULL);
 
+	/* Profiles may have cached values, e.g. the HID Report Map, after
+	 * the database was last stored.
+	 */
+	store_gatt_db(device);
+
 	btd_gatt_client_disconnected(device->client_dbus);
 
 	if (!device_get_auto_connect(device)) {
@@ -5534,6 +5605,8 @@ static void gatt_client_ready_cb(bool success, uint8_t att_ecode,
 	device_svc_resolved(device, BROWSE_GATT, device->bdaddr_type, 0);
 
 	store_gatt_db(device);
+
+	debug_gatt_db_usage(device);
 }
 
 static void gatt_client_service_changed(uint16_t start_handle,
@@ -5652,6 +5725,87 @@ static bool remote_counter(uint32_t *sign_cnt, void *user_data)
 	return true;
 }
 
+/* Supervision timeout in 10 ms units from intervals in 1.25 ms units */
+static uint16_t conn_param_timeout(uint16_t interval, uint16_t latency)
+{
+	uint32_t timeout;
+
+	/* Twice the minimum of (1 + latency) * interval * 2 */
+	timeout = (1 + latency) * interval / 2;
+
+	return MIN(MAX(timeout, 100), 0x0C80);
+}
+
+static void conn_param_update(struct btd_device *dev, uint8_t state)
+{
+	uint16_t interval, latency;
+
+	if (state == CONN_PARAM_BUSY) {
+		interval = btd_opts.conn_param.busy_interval;
+		latency = 0;
+	} else {
+		interval = btd_opts.conn_param.idle_interval;
+		latency = btd_opts.conn_param.idle_latency;
+	}
+
+	/* Keep the supervision timeout within its 32 seconds limit */
+	latency = MIN(latency, 12799 / interval - 1);
+
+	DBG("%s interval %u latency %u", state == CONN_PARAM_BUSY ?
+					"busy" : "idle", interval, latency);
+
+	if (btd_adapter_update_conn_param(dev->adapter, &dev->bdaddr,
+					dev->bdaddr_type, interval, interval,
+					latency,
+					conn_param_timeout(interval, latency)))
+		return;
+
+	dev->conn_param_state = state;
+}
+
+/*
+ * Links moving a lot of ATT data get short intervals, links that have
+ * been quiet for a while long ones so the controller can schedule more
+ * connections.
+ */
+static bool conn_param_sample(gpointer user_data)
+{
+	struct btd_device *dev = user_data;
+	unsigned int pdus, rate;
+
+	pdus = bt_att_get_pdu_count(dev->att);
+	rate = pdus - dev->conn_param_pdus;
+	dev->conn_param_pdus = pdus;
+
+	if (rate >= btd_opts.conn_param.busy_threshold) {
+		dev->conn_param_idle = 0;
+
+		if (dev->conn_param_state != CONN_PARAM_BUSY)
+			conn_param_update(dev, CONN_PARAM_BUSY);
+
+		return true;
+	}
+
+	if (dev->conn_param_idle < btd_opts.conn_param.idle_timeout) {
+		dev->conn_param_idle++;
+		return true;
+	}
+
+	if (dev->conn_param_state != CONN_PARAM_IDLE)
+		conn_param_update(dev, CONN_PARAM_IDLE);
+
+	return true;
+}
+
+static void conn_param_start(struct btd_device *dev)
+{
+	dev->conn_param_pdus = bt_att_get_pdu_count(dev->att);
+	dev->conn_param_idle = 0;
+	dev->conn_param_state = CONN_PARAM_UNKNOWN;
+	dev->conn_param_timer = timeout_add_seconds(1, conn_param_sample,
+								dev, NULL);
+}
+
 bool device_attach_att(struct btd_device *dev, GIOChannel *io)
 {
 	GError *gerr = NULL;
@@ -5743,6 +5897,15 @@ bool device_attach_att(struct btd_device *dev, GIOChannel *io)
 	gatt_client_init(dev);
 	gatt_server_init(dev, database);
 
+	if (btd_opts.conn_param.adaptive && cid == ATT_CID)
+		conn_param_start(dev);
+
+	if (cid == ATT_CID) {
+		device_update_phys(dev);
+		dev->phy_timer = timeout_add_seconds(PHY_CHECK_DELAY,
+							phy_check, dev, NULL);
+	}
+
 	/*
 	 * Remove the device from the connect_list and give the passive
 	 * scanning another chance to be restarted in case there are
@@ -6041,6 +6204,11 @@ uint8_t device_get_le_address_type(struct btd_device *device)
 	return device->bdaddr_type;
 }
 
+const bdaddr_t *device_get_conn_address(struct btd_device *device)
+{
+	return &device->conn_bdaddr;
+}
+
 const char *device_get_path(const struct btd_device *device)
 {
 	if (!device)
@@ -6160,7 +6328,7 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 				device_addr);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6187,10 +6355,10 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 									value);
 	}
 
-	create_file(filename, 0600);
+	btd_storage_create(filename);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
+	if (!btd_storage_set_contents(filename, str, length, &gerr)) {
 		error("Unable set contents for %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -6214,7 +6382,7 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 				device_addr);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -6240,6 +6408,39 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 	g_key_file_free(key_file);
 }
 
+static bool rssi_timeout(void *user_data)
+{
+	struct btd_device *device = user_data;
+
+	if (!device->rssi_changed) {
+		device->rssi_timer = 0;
+		return false;
+	}
+
+	device->rssi_changed = false;
+
+	g_dbus_emit_property_changed(dbus_conn, device->path,
+						DEVICE_INTERFACE, "RSSI");
+
+	return true;
+}
+
+static void emit_rssi(struct btd_device *device)
+{
+	/* Only signal the latest value once the interval is over */
+	if (device->rssi_timer) {
+		device->rssi_changed = true;
+		return;
+	}
+
+	g_dbus_emit_property_changed(dbus_conn, device->path,
+						DEVICE_INTERFACE, "RSSI");
+
+	if (btd_opts.rssi_interval)
+		device->rssi_timer = timeout_add(btd_opts.rssi_interval,
+						rssi_timeout, device, NULL);
+}
+
 void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
 							int8_t delta_threshold)
 {
@@ -6270,13 +6471,24 @@ void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
 		device->rssi = rssi;
 	}
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "RSSI");
+	emit_rssi(device);
 }
 
 void device_set_rssi(struct btd_device *device, int8_t rssi)
 {
-	device_set_rssi_with_delta(device, rssi, RSSI_THRESHOLD);
+	device_set_rssi_with_delta(device, rssi, btd_opts.rssi_hysteresis);
+}
+
+bool device_match_report(struct btd_device *device, uint8_t bdaddr_type,
+							uint64_t report)
+{
+	return report && get_state(device, bdaddr_type)->report == report;
+}
+
+void device_set_report(struct btd_device *device, uint8_t bdaddr_type,
+							uint64_t report)
+{
+	get_state(device, bdaddr_type)->report = report;
 }
 
 void device_set_tx_power(struct btd_device *device, int8_t tx_power)
@@ -7008,6 +7220,281 @@ struct bt_gatt_client *btd_device_get_gatt_client(struct btd_device *device)
 	return device->client;
 }
 
+static void gatt_read_send(struct btd_device *device,
+						struct gatt_read_req *req);
+
+static struct gatt_read_req *gatt_read_req_new(struct btd_device *device)
+{
+	struct gatt_read_req *req;
+
+	req = new0(struct gatt_read_req, 1);
+	req->dev = device;
+	req->reads = queue_new();
+	req->variable = bt_gatt_client_get_features(device->client) &
+						BT_GATT_CHRC_CLI_FEAT_EATT;
+
+	return req;
+}
+
+static void gatt_read_complete(struct gatt_read *read, bool success,
+					uint8_t att_ecode, const uint8_t *value,
+					uint16_t length)
+{
+	if (read->func)
+		read->func(success, att_ecode, value, length, read->user_data);
+
+	free(read);
+}
+
+static void gatt_read_split(void *data, void *user_data)
+{
+	struct gatt_read *read = data;
+	struct btd_device *device = user_data;
+	struct gatt_read_req *req;
+
+	if (!read->func) {
+		free(read);
+		return;
+	}
+
+	req = gatt_read_req_new(device);
+	queue_push_tail(req->reads, read);
+	gatt_read_send(device, req);
+}
+
+static void gatt_read_req_free(void *data)
+{
+	struct gatt_read_req *req = data;
+	struct btd_device *device = req->dev;
+
+	if (device)
+		queue_remove(device->read_reqs, req);
+
+	/*
+	 * Values the batch did not return, either because the server
+	 * rejected it or because the response got truncated, are read one
+	 * at a time.
+	 */
+	if (device && req->done) {
+		struct queue *reads = req->reads;
+
+		req->reads = NULL;
+		queue_foreach(reads, gatt_read_split, device);
+		queue_destroy(reads, NULL);
+	}
+
+	queue_destroy(req->reads, free);
+	free(req);
+}
+
+static void gatt_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct gatt_read_req *req = user_data;
+
+	req->done = true;
+
+	gatt_read_complete(queue_pop_head(req->reads), success, att_ecode,
+								value, length);
+}
+
+static void gatt_read_multiple_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct gatt_read_req *req = user_data;
+	struct gatt_read *read;
+
+	req->done = true;
+
+	if (!success)
+		return;
+
+	/* Read Multiple Variable reports each value on its own */
+	if (req->variable) {
+		read = queue_pop_head(req->reads);
+		if (read)
+			gatt_read_complete(read, true, 0, value, length);
+		return;
+	}
+
+	/* Otherwise the values are concatenated and can only be split if
+	 * they all have the length they were planned with.
+	 */
+	if (length != req->total)
+		return;
+
+	while ((read = queue_pop_head(req->reads))) {
+		uint16_t len = read->length;
+
+		gatt_read_complete(read, true, 0, value, len);
+		value += len;
+	}
+}
+
+static void gatt_read_send(struct btd_device *device,
+						struct gatt_read_req *req)
+{
+	unsigned int count = queue_length(req->reads);
+	struct gatt_read *read = queue_peek_head(req->reads);
+
+	if (count == 1) {
+		req->id = bt_gatt_client_read_value(device->client,
+						read->handle, gatt_read_cb,
+						req, gatt_read_req_free);
+		if (!req->id) {
+			queue_pop_head(req->reads);
+			gatt_read_req_free(req);
+			gatt_read_complete(read, false, 0, NULL, 0);
+			return;
+		}
+	} else {
+		const struct queue_entry *entry;
+		uint16_t handles[count];
+		unsigned int i = 0;
+
+		for (entry = queue_get_entries(req->reads); entry;
+							entry = entry->next) {
+			read = entry->data;
+			handles[i++] = read->handle;
+		}
+
+		req->id = bt_gatt_client_read_multiple(device->client,
+						handles, count,
+						gatt_read_multiple_cb, req,
+						gatt_read_req_free);
+		if (!req->id) {
+			req->done = true;
+			gatt_read_req_free(req);
+			return;
+		}
+	}
+
+	queue_push_tail(device->read_reqs, req);
+}
+
+static bool gatt_read_flush(gpointer user_data)
+{
+	struct btd_device *device = user_data;
+	struct gatt_read_req *req = NULL;
+	struct gatt_read *read;
+	unsigned int max_len, max_count, len;
+
+	device->read_plan_id = 0;
+
+	/* Both the handles and the values have to fit in a single PDU */
+	max_len = bt_gatt_client_get_mtu(device->client) - 1;
+	max_count = max_len / 2;
+
+	while ((read = queue_pop_head(device->planned_reads))) {
+		/*
+		 * Values with no known length cannot be split out of a Read
+		 * Multiple response so they are read on their own.
+		 */
+		if (!read->length) {
+			struct gatt_read_req *single;
+
+			single = gatt_read_req_new(device);
+			queue_push_tail(single->reads, read);
+			gatt_read_send(device, single);
+			continue;
+		}
+
+		if (!req)
+			req = gatt_read_req_new(device);
+
+		/* Read Multiple Variable adds a length to every value */
+		len = req->variable ? read->length + 2 : read->length;
+
+		if (!queue_isempty(req->reads) &&
+				(req->total + len > max_len ||
+				queue_length(req->reads) == max_count)) {
+			gatt_read_send(device, req);
+			req = gatt_read_req_new(device);
+		}
+
+		queue_push_tail(req->reads, read);
+		req->total += read->length;
+	}
+
+	if (req)
+		gatt_read_send(device, req);
+
+	return false;
+}
+
+unsigned int btd_device_gatt_read(struct btd_device *device,
+					uint16_t value_handle, uint16_t length,
+					device_read_cb_t func, void *user_data)
+{
+	struct gatt_read *read;
+
+	if (!device || !device->client || !func)
+		return 0;
+
+	if (!device->planned_reads) {
+		device->planned_reads = queue_new();
+		device->read_reqs = queue_new();
+	}
+
+	read = new0(struct gatt_read, 1);
+	read->handle = value_handle;
+	read->length = length;
+	read->func = func;
+	read->user_data = user_data;
+
+	if (!++device->next_read_id)
+		device->next_read_id++;
+	read->id = device->next_read_id;
+
+	queue_push_tail(device->planned_reads, read);
+
+	if (!device->read_plan_id)
+		device->read_plan_id = timeout_add(GATT_READ_PLAN_DELAY,
+							gatt_read_flush,
+							device, NULL);
+
+	return read->id;
+}
+
+static bool match_read_id(const void *data, const void *match_data)
+{
+	const struct gatt_read *read = data;
+
+	return read->id == PTR_TO_UINT(match_data);
+}
+
+bool btd_device_gatt_read_cancel(struct btd_device *device, unsigned int id)
+{
+	const struct queue_entry *entry;
+	struct gatt_read *read;
+
+	if (!device || !id)
+		return false;
+
+	read = queue_remove_if(device->planned_reads, match_read_id,
+							UINT_TO_PTR(id));
+	if (read) {
+		free(read);
+		return true;
+	}
+
+	/* Batches already sent just stop reporting the value */
+	for (entry = queue_get_entries(device->read_reqs); entry;
+							entry = entry->next) {
+		struct gatt_read_req *req = entry->data;
+
+		read = queue_find(req->reads, match_read_id, UINT_TO_PTR(id));
+		if (read) {
+			read->func = NULL;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void *btd_device_get_attrib(struct btd_device *device)
 {
 	if (!device)
@@ -7072,7 +7559,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	if (!btd_storage_load(key_file, filename, 0, &gerr)) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -7142,6 +7629,23 @@ const sdp_record_t *btd_device_get_record(struct btd_device *device,
 	return find_record_in_list(device->tmp_records, uuid);
 }
 
+static sdp_list_t *load_cached_records(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	struct btd_adapter *adapter;
+	struct btd_device *device;
+
+	adapter = adapter_find(src);
+	if (!adapter)
+		return NULL;
+
+	device = btd_adapter_find_device(adapter, dst, BDADDR_BREDR);
+	if (!device || !device->bredr_state.svc_resolved)
+		return NULL;
+
+	return read_device_records(device);
+}
+
 struct btd_device *btd_device_ref(struct btd_device *device)
 {
 	__sync_fetch_and_add(&device->ref_count, 1);
@@ -7294,11 +7798,18 @@ struct btd_service *btd_device_get_service(struct btd_device *dev,
 void btd_device_init(void)
 {
 	dbus_conn = btd_get_dbus_connection();
+	store_queue = queue_new();
 	service_state_cb_id = btd_service_add_state_cb(
 						service_state_changed, NULL);
+	bt_set_record_loader(load_cached_records);
 }
 
 void btd_device_cleanup(void)
 {
 	btd_service_remove_state_cb(service_state_cb_id);
+	bt_set_record_loader(NULL);
+
+	flush_device_info();
+	queue_destroy(store_queue, NULL);
+	store_queue = NULL;
 }
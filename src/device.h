@@ -63,6 +63,15 @@ struct gatt_primary *btd_device_get_primary(struct btd_device *device,
 GSList *btd_device_get_primaries(struct btd_device *device);
 struct gatt_db *btd_device_get_gatt_db(struct btd_device *device);
 struct bt_gatt_client *btd_device_get_gatt_client(struct btd_device *device);
+
+typedef void (*device_read_cb_t) (bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data);
+
+unsigned int btd_device_gatt_read(struct btd_device *device,
+					uint16_t value_handle, uint16_t length,
+					device_read_cb_t func, void *user_data);
+bool btd_device_gatt_read_cancel(struct btd_device *device, unsigned int id);
 struct bt_gatt_server *btd_device_get_gatt_server(struct btd_device *device);
 void *btd_device_get_attrib(struct btd_device *device);
 void btd_device_gatt_set_service_changed(struct btd_device *device,
@@ -81,6 +90,7 @@ void device_remove_profile(gpointer a, gpointer b);
 struct btd_adapter *device_get_adapter(struct btd_device *device);
 const bdaddr_t *device_get_address(struct btd_device *device);
 uint8_t device_get_le_address_type(struct btd_device *device);
+const bdaddr_t *device_get_conn_address(struct btd_device *device);
 const char *device_get_path(const struct btd_device *device);
 gboolean device_is_temporary(struct btd_device *device);
 bool device_is_connectable(struct btd_device *device);
@@ -96,6 +106,10 @@ void device_set_legacy(struct btd_device *device, bool legacy);
 void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
 							int8_t delta_threshold);
 void device_set_rssi(struct btd_device *device, int8_t rssi);
+bool device_match_report(struct btd_device *device, uint8_t bdaddr_type,
+							uint64_t report);
+void device_set_report(struct btd_device *device, uint8_t bdaddr_type,
+							uint64_t report);
 void device_set_tx_power(struct btd_device *device, int8_t tx_power);
 void device_set_flags(struct btd_device *device, uint8_t flags);
 bool btd_device_is_connected(struct btd_device *dev);
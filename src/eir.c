@@ -238,36 +238,183 @@ static void eir_parse_data(struct eir_data *eir, uint8_t type,
 	eir->data_list = g_slist_append(eir->data_list, ad);
 }
 
-void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+void eir_iter_init(struct eir_iter *iter, const uint8_t *eir_data,
+							uint8_t eir_len)
 {
-	uint16_t len = 0;
+	iter->data = eir_data;
+	iter->len = eir_data ? eir_len : 0;
+	iter->offset = 0;
+}
 
-	eir->flags = 0;
-	eir->tx_power = 127;
+bool eir_iter_next(struct eir_iter *iter, struct eir_field *field)
+{
+	uint8_t field_len;
 
-	/* No EIR data to parse */
-	if (eir_data == NULL)
-		return;
+	if (iter->offset + 1 >= iter->len)
+		return false;
 
-	while (len < eir_len - 1) {
-		uint8_t field_len = eir_data[0];
-		const uint8_t *data;
-		uint8_t data_len;
+	field_len = iter->data[iter->offset];
 
-		/* Check for the end of EIR */
-		if (field_len == 0)
+	/* Check for the end of EIR */
+	if (field_len == 0)
+		return false;
+
+	/* Do not continue EIR Data parsing if got incorrect length */
+	if (iter->offset + field_len + 1 > iter->len)
+		return false;
+
+	field->type = iter->data[iter->offset + 1];
+	field->data = &iter->data[iter->offset + 2];
+	field->len = field_len - 1;
+
+	iter->offset += field_len + 1;
+
+	return true;
+}
+
+void eir_view_init(struct eir_view *view, const uint8_t *eir_data,
+							uint8_t eir_len)
+{
+	struct eir_iter iter;
+	struct eir_field field;
+
+	memset(view, 0, sizeof(*view));
+	view->data = eir_data;
+	view->len = eir_len;
+	view->tx_power = 127;
+
+	eir_iter_init(&iter, eir_data, eir_len);
+
+	while (eir_iter_next(&iter, &field)) {
+		switch (field.type) {
+		case EIR_FLAGS:
+			if (field.len > 0)
+				view->flags = field.data[0];
 			break;
 
-		len += field_len + 1;
+		case EIR_NAME_SHORT:
+		case EIR_NAME_COMPLETE:
+			/* Some vendors put a NUL byte terminator into
+			 * the name */
+			while (field.len > 0 &&
+					field.data[field.len - 1] == '\0')
+				field.len--;
 
-		/* Do not continue EIR Data parsing if got incorrect length */
-		if (len > eir_len)
+			view->name = field.data;
+			view->name_len = field.len;
+			view->name_complete = field.type == EIR_NAME_COMPLETE;
 			break;
 
-		data = &eir_data[2];
-		data_len = field_len - 1;
+		case EIR_TX_POWER:
+			if (field.len > 0)
+				view->tx_power = (int8_t) field.data[0];
+			break;
+		}
+	}
+}
+
+char *eir_view_get_name(const struct eir_view *view)
+{
+	if (!view->name)
+		return NULL;
+
+	return name2utf8(view->name, view->name_len);
+}
+
+static bool uuid_list_foreach(const uint8_t *data, uint8_t len, uint8_t size,
+					eir_uuid_func_t func, void *user_data)
+{
+	bt_uuid_t uuid;
+	int k;
+
+	for (; len >= size; data += size, len -= size) {
+		switch (size) {
+		case 2:
+			bt_uuid16_create(&uuid, get_le16(data));
+			break;
+		case 4:
+			bt_uuid32_create(&uuid, get_le32(data));
+			break;
+		default:
+			uuid.type = BT_UUID128;
+			for (k = 0; k < 16; k++)
+				uuid.value.u128.data[k] = data[16 - k - 1];
+			break;
+		}
+
+		if (func(&uuid, user_data))
+			return true;
+	}
 
-		switch (eir_data[1]) {
+	return false;
+}
+
+/* Calls func for each service UUID until it returns true */
+bool eir_view_foreach_uuid(const struct eir_view *view, eir_uuid_func_t func,
+							void *user_data)
+{
+	struct eir_iter iter;
+	struct eir_field field;
+
+	eir_iter_init(&iter, view->data, view->len);
+
+	while (eir_iter_next(&iter, &field)) {
+		uint8_t size;
+
+		switch (field.type) {
+		case EIR_UUID16_SOME:
+		case EIR_UUID16_ALL:
+			size = 2;
+			break;
+		case EIR_UUID32_SOME:
+		case EIR_UUID32_ALL:
+			size = 4;
+			break;
+		case EIR_UUID128_SOME:
+		case EIR_UUID128_ALL:
+			size = 16;
+			break;
+		default:
+			continue;
+		}
+
+		if (uuid_list_foreach(field.data, field.len, size, func,
+								user_data))
+			return true;
+	}
+
+	return false;
+}
+
+static bool uuid_match(const bt_uuid_t *uuid, void *user_data)
+{
+	return !bt_uuid_cmp(uuid, user_data);
+}
+
+bool eir_view_has_uuid(const struct eir_view *view, const bt_uuid_t *uuid)
+{
+	bt_uuid_t uuid128;
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+
+	return eir_view_foreach_uuid(view, uuid_match, &uuid128);
+}
+
+void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+{
+	struct eir_iter iter;
+	struct eir_field field;
+
+	eir->flags = 0;
+	eir->tx_power = 127;
+
+	eir_iter_init(&iter, eir_data, eir_len);
+
+	while (eir_iter_next(&iter, &field)) {
+		const uint8_t *data = field.data;
+		uint8_t data_len = field.len;
+
+		switch (field.type) {
 		case EIR_UUID16_SOME:
 		case EIR_UUID16_ALL:
 			eir_parse_uuid16(eir, data, data_len);
@@ -298,7 +445,7 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			g_free(eir->name);
 
 			eir->name = name2utf8(data, data_len);
-			eir->name_complete = eir_data[1] == EIR_NAME_COMPLETE;
+			eir->name_complete = field.type == EIR_NAME_COMPLETE;
 			break;
 
 		case EIR_TX_POWER:
@@ -359,11 +506,9 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			break;
 
 		default:
-			eir_parse_data(eir, eir_data[1], data, data_len);
+			eir_parse_data(eir, field.type, data, data_len);
 			break;
 		}
-
-		eir_data += field_len + 1;
 	}
 }
 
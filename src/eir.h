@@ -12,6 +12,7 @@
 #include <glib.h>
 
 #include "lib/sdp.h"
+#include "lib/uuid.h"
 
 #define EIR_FLAGS                   0x01  /* flags */
 #define EIR_UUID16_SOME             0x02  /* 16-bit UUID, more available */
@@ -89,6 +90,43 @@ struct eir_data {
 	GSList *data_list;
 };
 
+/* Field of EIR/AD data pointing into the original buffer */
+struct eir_field {
+	uint8_t type;
+	const uint8_t *data;
+	uint8_t len;
+};
+
+struct eir_iter {
+	const uint8_t *data;
+	uint8_t len;
+	uint16_t offset;
+};
+
+/* Fields needed before deciding whether a report needs to be parsed */
+struct eir_view {
+	const uint8_t *data;
+	uint8_t len;
+	unsigned int flags;
+	int8_t tx_power;
+	const uint8_t *name;
+	uint8_t name_len;
+	bool name_complete;
+};
+
+typedef bool (*eir_uuid_func_t)(const bt_uuid_t *uuid, void *user_data);
+
+void eir_iter_init(struct eir_iter *iter, const uint8_t *eir_data,
+							uint8_t eir_len);
+bool eir_iter_next(struct eir_iter *iter, struct eir_field *field);
+
+void eir_view_init(struct eir_view *view, const uint8_t *eir_data,
+							uint8_t eir_len);
+char *eir_view_get_name(const struct eir_view *view);
+bool eir_view_foreach_uuid(const struct eir_view *view, eir_uuid_func_t func,
+							void *user_data);
+bool eir_view_has_uuid(const struct eir_view *view, const bt_uuid_t *uuid);
+
 void eir_data_free(struct eir_data *eir);
 void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
@@ -50,10 +50,18 @@
 #define GATT_CHARACTERISTIC_IFACE	"org.bluez.GattCharacteristic1"
 #define GATT_DESCRIPTOR_IFACE		"org.bluez.GattDescriptor1"
 
+/* MTU sized writes queued before an acquired write socket is paused */
+#define WRITE_QUEUE_LIMIT		8
+
+/* Datagrams taken from an acquired write socket per wakeup */
+#define WRITE_RX_BATCH			8
+
 struct btd_gatt_client {
 	struct btd_device *device;
 	uint8_t features;
 	bool ready;
+	bool eatt_connecting;
+	bool eatt_failed;
 	char devaddr[18];
 	struct gatt_db *db;
 	struct bt_gatt_client *gatt;
@@ -105,6 +113,7 @@ struct characteristic {
 
 	unsigned int ready_id;
 	unsigned int exchange_id;
+	unsigned int write_wait_id;
 	struct sock_io *write_io;
 	struct sock_io *notify_io;
 
@@ -1087,37 +1096,98 @@ fail:
 	return btd_error_not_supported(msg);
 }
 
+static void sock_write_resume(void *user_data);
+static void sock_write_wait_destroy(void *user_data);
+
 static bool sock_read(struct io *io, void *user_data)
 {
 	struct characteristic *chrc = user_data;
 	struct bt_gatt_client *gatt = chrc->service->client->gatt;
-	struct msghdr msg;
-	uint8_t buf[512];
-	struct iovec iov;
-	int fd = io_get_fd(io);
-	ssize_t bytes_read;
-
-	iov.iov_base = buf;
-	iov.iov_len = sizeof(buf);
-
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
+	struct mmsghdr msgs[WRITE_RX_BATCH];
+	struct iovec iov[WRITE_RX_BATCH];
+	uint8_t buf[WRITE_RX_BATCH][512];
+	unsigned int limit;
+	int i, count;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < WRITE_RX_BATCH; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = sizeof(buf[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
-	bytes_read = recvmsg(fd, &msg, MSG_DONTWAIT);
-	if (bytes_read < 0) {
-		error("recvmsg: %s", strerror(errno));
+	/*
+	 * Take everything the application has written so far with a single
+	 * call, the resulting commands then leave together on the next
+	 * wakeup of the ATT writer.
+	 */
+	count = io_recvmmsg(io, msgs, WRITE_RX_BATCH);
+	if (count < 0) {
+		error("recvmmsg: %s", strerror(-count));
 		return false;
 	}
 
-	if (!gatt || bytes_read == 0)
+	if (!gatt || count == 0)
 		return false;
 
-	bt_gatt_client_write_without_response(gatt, chrc->value_handle,
+	for (i = 0; i < count; i++) {
+		if (!msgs[i].msg_len)
+			return false;
+
+		bt_gatt_client_write_without_response(gatt, chrc->value_handle,
 					chrc->props & BT_GATT_CHRC_PROP_AUTH,
-					buf, bytes_read);
+					buf[i], msgs[i].msg_len);
+	}
+
+	limit = WRITE_QUEUE_LIMIT * bt_gatt_client_get_mtu(gatt);
+	if (bt_gatt_client_get_write_queued(gatt) <= limit)
+		return true;
+
+	/*
+	 * Stop reading until half of the queue has been sent so the socket
+	 * fills up and the application blocks, or gets EAGAIN, instead of
+	 * having its data buffered here without bounds.
+	 */
+	chrc->write_wait_id = bt_gatt_client_wait_writable(gatt, limit / 2,
+							sock_write_resume, chrc,
+							sock_write_wait_destroy);
+	if (!chrc->write_wait_id)
+		return true;
+
+	DBG("%s: write queue full, pausing", chrc->path);
+
+	return false;
+}
+
+static void sock_write_resume(void *user_data)
+{
+	struct characteristic *chrc = user_data;
+
+	if (!chrc->write_io || !chrc->write_io->io)
+		return;
+
+	DBG("%s: write queue drained, resuming", chrc->path);
+
+	io_set_read_handler(chrc->write_io->io, sock_read, chrc, NULL);
+}
 
-	return true;
+static void sock_write_wait_destroy(void *user_data)
+{
+	struct characteristic *chrc = user_data;
+
+	chrc->write_wait_id = 0;
+}
+
+static void sock_write_cancel(struct characteristic *chrc)
+{
+	if (!chrc->write_wait_id)
+		return;
+
+	bt_gatt_client_cancel_writable(chrc->service->client->gatt,
+							chrc->write_wait_id);
+	chrc->write_wait_id = 0;
 }
 
 static void sock_io_destroy(struct sock_io *io)
@@ -1137,6 +1207,7 @@ static void destroy_sock(struct characteristic *chrc, struct io *io)
 	queue_remove(chrc->service->client->ios, io);
 
 	if (chrc->write_io && io == chrc->write_io->io) {
+		sock_write_cancel(chrc);
 		sock_io_destroy(chrc->write_io);
 		chrc->write_io = NULL;
 		g_dbus_emit_property_changed(btd_get_dbus_connection(),
@@ -1720,6 +1791,7 @@ static void characteristic_free(void *data)
 	queue_destroy(chrc->descs, NULL);
 
 	if (chrc->write_io) {
+		sock_write_cancel(chrc);
 		queue_remove(chrc->service->client->ios, chrc->write_io->io);
 		sock_io_destroy(chrc->write_io);
 	}
@@ -2170,6 +2242,11 @@ void btd_gatt_client_destroy(struct btd_gatt_client *client)
 	queue_destroy(client->services, unregister_service);
 	queue_destroy(client->all_notify_clients, NULL);
 	queue_destroy(client->ios, NULL);
+
+	if (client->gatt)
+		bt_att_set_busy_cb(bt_gatt_client_get_att(client->gatt), NULL,
+								NULL, NULL);
+
 	bt_gatt_client_unref(client->gatt);
 	gatt_db_unref(client->db);
 	free(client);
@@ -2239,12 +2316,22 @@ static void eatt_connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 {
 	struct btd_gatt_client *client = user_data;
 
-	if (gerr)
+	client->eatt_connecting = false;
+
+	if (gerr) {
+		/* Don't keep retrying on every request for this connection */
+		client->eatt_failed = true;
 		return;
+	}
 
 	device_attach_att(client->device, io);
 }
 
+/*
+ * EATT channels are opened one at a time: the first one when the connection
+ * is established and then one more each time a request has to wait because
+ * all channels have one outstanding, up to the configured number.
+ */
 void btd_gatt_client_eatt_connect(struct btd_gatt_client *client)
 {
 	struct bt_att *att = bt_gatt_client_get_att(client->gatt);
@@ -2253,65 +2340,71 @@ void btd_gatt_client_eatt_connect(struct btd_gatt_client *client)
 	GIOChannel *io;
 	GError *gerr = NULL;
 	char addr[18];
-	int i;
 
 	if (!(client->features & BT_GATT_CHRC_CLI_FEAT_EATT))
 		return;
 
-	if (bt_att_get_channels(att) == btd_opts.gatt_channels)
+	if (client->eatt_connecting || client->eatt_failed)
 		return;
 
-	ba2str(device_get_address(dev), addr);
-
-	for (i = bt_att_get_channels(att); i < btd_opts.gatt_channels; i++) {
-		int defer_timeout = i + 1 < btd_opts.gatt_channels ? 1 : 0;
+	if (bt_att_get_channels(att) >= btd_opts.gatt_channels)
+		return;
 
-		DBG("Connection attempt to: %s defer %s", addr,
-					defer_timeout ? "true" : "false");
+	ba2str(device_get_address(dev), addr);
 
-		/* Attempt to connect using the Ext-Flowctl */
+	DBG("Connection attempt to: %s channels %d", addr,
+						bt_att_get_channels(att));
+
+	/* Attempt to connect using the Ext-Flowctl */
+	io = bt_io_connect(eatt_connect_cb, client, NULL, &gerr,
+				BT_IO_OPT_SOURCE_BDADDR,
+				btd_adapter_get_address(adapter),
+				BT_IO_OPT_SOURCE_TYPE,
+				btd_adapter_get_address_type(adapter),
+				BT_IO_OPT_DEST_BDADDR,
+				device_get_address(dev),
+				BT_IO_OPT_DEST_TYPE,
+				device_get_le_address_type(dev),
+				BT_IO_OPT_MODE, BT_IO_MODE_EXT_FLOWCTL,
+				BT_IO_OPT_PSM, BT_ATT_EATT_PSM,
+				BT_IO_OPT_SEC_LEVEL, BT_IO_SEC_LOW,
+				BT_IO_OPT_MTU, btd_opts.gatt_mtu,
+				BT_IO_OPT_INVALID);
+	if (!io) {
+		g_error_free(gerr);
+		gerr = NULL;
+		/* Fallback to legacy LE Mode */
 		io = bt_io_connect(eatt_connect_cb, client, NULL, &gerr,
-					BT_IO_OPT_SOURCE_BDADDR,
-					btd_adapter_get_address(adapter),
-					BT_IO_OPT_SOURCE_TYPE,
-					btd_adapter_get_address_type(adapter),
-					BT_IO_OPT_DEST_BDADDR,
-					device_get_address(dev),
-					BT_IO_OPT_DEST_TYPE,
-					device_get_le_address_type(dev),
-					BT_IO_OPT_MODE, BT_IO_MODE_EXT_FLOWCTL,
-					BT_IO_OPT_PSM, BT_ATT_EATT_PSM,
-					BT_IO_OPT_SEC_LEVEL, BT_IO_SEC_LOW,
-					BT_IO_OPT_MTU, btd_opts.gatt_mtu,
-					BT_IO_OPT_DEFER_TIMEOUT, defer_timeout,
-					BT_IO_OPT_INVALID);
+				BT_IO_OPT_SOURCE_BDADDR,
+				btd_adapter_get_address(adapter),
+				BT_IO_OPT_SOURCE_TYPE,
+				btd_adapter_get_address_type(adapter),
+				BT_IO_OPT_DEST_BDADDR,
+				device_get_address(dev),
+				BT_IO_OPT_DEST_TYPE,
+				device_get_le_address_type(dev),
+				BT_IO_OPT_PSM, BT_ATT_EATT_PSM,
+				BT_IO_OPT_SEC_LEVEL, BT_IO_SEC_LOW,
+				BT_IO_OPT_MTU, btd_opts.gatt_mtu,
+				BT_IO_OPT_INVALID);
 		if (!io) {
-			g_error_free(gerr);
-			gerr = NULL;
-			/* Fallback to legacy LE Mode */
-			io = bt_io_connect(eatt_connect_cb, client, NULL, &gerr,
-					BT_IO_OPT_SOURCE_BDADDR,
-					btd_adapter_get_address(adapter),
-					BT_IO_OPT_SOURCE_TYPE,
-					btd_adapter_get_address_type(adapter),
-					BT_IO_OPT_DEST_BDADDR,
-					device_get_address(dev),
-					BT_IO_OPT_DEST_TYPE,
-					device_get_le_address_type(dev),
-					BT_IO_OPT_PSM, BT_ATT_EATT_PSM,
-					BT_IO_OPT_SEC_LEVEL, BT_IO_SEC_LOW,
-					BT_IO_OPT_MTU, btd_opts.gatt_mtu,
-					BT_IO_OPT_INVALID);
-			if (!io) {
-				error("EATT bt_io_connect(%s): %s", addr,
+			error("EATT bt_io_connect(%s): %s", addr,
 							gerr->message);
-				g_error_free(gerr);
-				return;
-			}
+			g_error_free(gerr);
+			client->eatt_failed = true;
+			return;
 		}
-
-		g_io_channel_unref(io);
 	}
+
+	client->eatt_connecting = true;
+	g_io_channel_unref(io);
+}
+
+static void eatt_busy_cb(void *user_data)
+{
+	struct btd_gatt_client *client = user_data;
+
+	btd_gatt_client_eatt_connect(client);
 }
 
 void btd_gatt_client_connected(struct btd_gatt_client *client)
@@ -2329,6 +2422,11 @@ void btd_gatt_client_connected(struct btd_gatt_client *client)
 	bt_gatt_client_unref(client->gatt);
 	client->gatt = bt_gatt_client_clone(gatt);
 
+	client->eatt_connecting = false;
+	client->eatt_failed = false;
+	bt_att_set_busy_cb(bt_gatt_client_get_att(gatt), eatt_busy_cb, client,
+									NULL);
+
 	/*
 	 * Services have already been created before. Re-enable notifications
 	 * for any pre-registered notification sessions.
@@ -2393,6 +2491,9 @@ void btd_gatt_client_disconnected(struct btd_gatt_client *client)
 	 */
 	queue_foreach(client->all_notify_clients, clear_notify_id, NULL);
 
+	bt_att_set_busy_cb(bt_gatt_client_get_att(client->gatt), NULL, NULL,
+									NULL);
+
 	bt_gatt_client_unref(client->gatt);
 	client->gatt = NULL;
 }
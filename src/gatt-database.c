@@ -89,6 +89,8 @@ struct gatt_app {
 	struct queue *profiles;
 	struct queue *services;
 	struct queue *proxies;
+	GHashTable *service_paths;	/* Services by path while registering */
+	GHashTable *chrc_paths;		/* Characteristics by path */
 };
 
 struct external_service {
@@ -121,11 +123,16 @@ struct external_chrc {
 	struct io *notify_io;
 	struct gatt_db_attribute *attrib;
 	struct gatt_db_attribute *ccc;
+	struct queue *descs;
 	struct queue *pending_reads;
 	struct queue *pending_writes;
 	unsigned int ntfy_cnt;
 	bool prep_authorized;
 	bool req_prep_authorization;
+	bool cache_value;
+	bool value_valid;
+	uint8_t *value;
+	uint16_t value_len;
 };
 
 struct external_desc {
@@ -159,6 +166,7 @@ struct notify {
 	uint16_t handle, ccc_handle;
 	uint8_t *value;
 	uint16_t len;
+	struct bt_att_pdu *pdu;		/* Shared by all subscribed devices */
 	bt_gatt_server_conf_func_t conf;
 	void *user_data;
 };
@@ -468,10 +476,13 @@ static void chrc_free(void *data)
 	io_destroy(chrc->write_io);
 	io_destroy(chrc->notify_io);
 
+	/* Descriptors are owned by the service, only drop the references */
+	queue_destroy(chrc->descs, NULL);
 	queue_destroy(chrc->pending_reads, cancel_pending_read);
 	queue_destroy(chrc->pending_writes, cancel_pending_write);
 
 	g_free(chrc->path);
+	free(chrc->value);
 
 	g_dbus_proxy_set_property_watch(chrc->proxy, NULL, NULL);
 	g_dbus_proxy_unref(chrc->proxy);
@@ -1361,10 +1372,26 @@ static void state_set_pending(struct device_state *state, struct notify *notify)
 	/* Copy notify contents to pending */
 	state->pending = new0(struct notify, 1);
 	memcpy(state->pending, notify, sizeof(*notify));
+	state->pending->pdu = NULL;
 	state->pending->value = malloc(notify->len);
 	memcpy(state->pending->value, notify->value, notify->len);
 }
 
+static struct bt_att_pdu *notify_pdu_new(struct notify *notify)
+{
+	uint8_t handle[2];
+	struct iovec iov[2];
+
+	put_le16(notify->handle, handle);
+
+	iov[0].iov_base = handle;
+	iov[0].iov_len = sizeof(handle);
+	iov[1].iov_base = notify->value;
+	iov[1].iov_len = notify->len;
+
+	return bt_att_pdu_new(BT_ATT_OP_HANDLE_NFY, iov, 2);
+}
+
 static void send_notification_to_device(void *data, void *user_data)
 {
 	struct device_state *device_state = data;
@@ -1411,10 +1438,26 @@ static void send_notification_to_device(void *data, void *user_data)
 	 */
 	if (!(ccc->value & 0x0002)) {
 		DBG("GATT server sending notification");
-		bt_gatt_server_send_notification(server,
+
+		/* Multiple notifications are aggregated per device */
+		if (device_state->cli_feat[0] &
+					BT_GATT_CHRC_CLI_FEAT_NFY_MULTI) {
+			bt_gatt_server_send_notification(server,
+					notify->handle, notify->value,
+					notify->len, true);
+			return;
+		}
+
+		if (!notify->pdu)
+			notify->pdu = notify_pdu_new(notify);
+
+		if (notify->pdu)
+			bt_gatt_server_send_notification_pdu(server,
+								notify->pdu);
+		else
+			bt_gatt_server_send_notification(server,
 					notify->handle, notify->value,
-					notify->len, device_state->cli_feat[0] &
-					BT_GATT_CHRC_CLI_FEAT_NFY_MULTI);
+					notify->len, false);
 		return;
 	}
 
@@ -1465,6 +1508,8 @@ static void gatt_notify_cb(struct gatt_db_attribute *attrib,
 	} else
 		queue_foreach(database->device_states,
 				send_notification_to_device, &notify);
+
+	bt_att_pdu_unref(notify.pdu);
 }
 
 static void register_core_services(struct btd_gatt_database *database)
@@ -1495,8 +1540,14 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.conf = conf;
 	notify.user_data = user_data;
 
+	/*
+	 * Devices without support for multiple notifications all get the
+	 * same PDU, which is encoded once and shared by their bt_att.
+	 */
 	queue_foreach(database->device_states, send_notification_to_device,
 								&notify);
+
+	bt_att_pdu_unref(notify.pdu);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
@@ -1680,17 +1731,19 @@ static bool incr_attr_count(struct external_service *service, uint16_t incr)
 static bool parse_chrc_flags(DBusMessageIter *array, uint8_t *props,
 					uint8_t *ext_props, uint32_t *perm,
 					uint32_t *ccc_perm,
-					bool *req_prep_authorization)
+					bool *req_prep_authorization,
+					bool *cache_value)
 {
 	const char *flag;
 
-	if (!props || !ext_props || !perm || !ccc_perm)
+	if (!props || !ext_props || !perm || !ccc_perm || !cache_value)
 		return false;
 
 	*props = 0;
 	*ext_props = 0;
 	*perm = 0;
 	*ccc_perm = 0;
+	*cache_value = false;
 
 	do {
 		if (dbus_message_iter_get_arg_type(array) != DBUS_TYPE_STRING)
@@ -1761,6 +1814,8 @@ static bool parse_chrc_flags(DBusMessageIter *array, uint8_t *props,
 		} else if (!strcmp("secure-indicate", flag)) {
 			*ccc_perm |= BT_ATT_PERM_WRITE_SECURE;
 			*props |= BT_GATT_CHRC_PROP_INDICATE;
+		} else if (!strcmp("cache-value", flag)) {
+			*cache_value = true;
 		} else {
 			error("Invalid characteristic flag: %s", flag);
 			return false;
@@ -1815,7 +1870,8 @@ static bool parse_desc_flags(DBusMessageIter *array, uint32_t *perm,
 
 static bool parse_flags(GDBusProxy *proxy, uint8_t *props, uint8_t *ext_props,
 					    uint32_t *perm, uint32_t *ccc_perm,
-					    bool *req_prep_authorization)
+					    bool *req_prep_authorization,
+					    bool *cache_value)
 {
 	DBusMessageIter iter, array;
 	const char *iface;
@@ -1833,7 +1889,36 @@ static bool parse_flags(GDBusProxy *proxy, uint8_t *props, uint8_t *ext_props,
 		return parse_desc_flags(&array, perm, req_prep_authorization);
 
 	return parse_chrc_flags(&array, props, ext_props, perm, ccc_perm,
-							req_prep_authorization);
+					req_prep_authorization, cache_value);
+}
+
+static bool parse_value(DBusMessageIter *iter, uint8_t **value, int *len)
+{
+	DBusMessageIter array;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(iter, &array);
+	dbus_message_iter_get_fixed_array(&array, value, len);
+
+	if (*len < 0)
+		return false;
+
+	/* Truncate the value if it's too large */
+	*len = MIN(BT_ATT_MAX_VALUE_LEN, *len);
+	*value = *len ? *value : NULL;
+
+	return true;
+}
+
+static void chrc_set_value(struct external_chrc *chrc, const uint8_t *value,
+								int len)
+{
+	free(chrc->value);
+	chrc->value = len ? util_memdup(value, len) : NULL;
+	chrc->value_len = len;
+	chrc->value_valid = true;
 }
 
 static struct external_chrc *chrc_create(struct gatt_app *app,
@@ -1843,20 +1928,23 @@ static struct external_chrc *chrc_create(struct gatt_app *app,
 	struct external_service *service;
 	struct external_chrc *chrc;
 	const char *service_path;
+	DBusMessageIter iter;
+	uint8_t *value;
+	int len;
 
 	if (!parse_path(proxy, "Service", &service_path)) {
 		error("Failed to obtain service path for characteristic");
 		return NULL;
 	}
 
-	service = queue_find(app->services, match_service_by_path,
-								service_path);
+	service = g_hash_table_lookup(app->service_paths, service_path);
 	if (!service) {
 		error("Unable to find service for characteristic: %s", path);
 		return NULL;
 	}
 
 	chrc = new0(struct external_chrc, 1);
+	chrc->descs = queue_new();
 	chrc->pending_reads = queue_new();
 	chrc->pending_writes = queue_new();
 
@@ -1882,11 +1970,18 @@ static struct external_chrc *chrc_create(struct gatt_app *app,
 	 * created.
 	 */
 	if (!parse_flags(proxy, &chrc->props, &chrc->ext_props, &chrc->perm,
-			&chrc->ccc_perm, &chrc->req_prep_authorization)) {
+			&chrc->ccc_perm, &chrc->req_prep_authorization,
+			&chrc->cache_value)) {
 		error("Failed to parse characteristic properties");
 		goto fail;
 	}
 
+	/* Start with the value the application exported, if any */
+	if (chrc->cache_value &&
+			g_dbus_proxy_get_property(proxy, "Value", &iter) &&
+			parse_value(&iter, &value, &len))
+		chrc_set_value(chrc, value, len);
+
 	if ((chrc->props & BT_GATT_CHRC_PROP_NOTIFY ||
 				chrc->props & BT_GATT_CHRC_PROP_INDICATE) &&
 				!incr_attr_count(chrc->service, 1)) {
@@ -1900,6 +1995,7 @@ static struct external_chrc *chrc_create(struct gatt_app *app,
 	}
 
 	queue_push_tail(chrc->service->chrcs, chrc);
+	g_hash_table_insert(app->chrc_paths, chrc->path, chrc);
 
 	return chrc;
 
@@ -1908,26 +2004,10 @@ fail:
 	return NULL;
 }
 
-static bool match_chrc(const void *a, const void *b)
-{
-	const struct external_chrc *chrc = a;
-	const char *path = b;
-
-	return strcmp(chrc->path, path) == 0;
-}
-
-static bool match_service_by_chrc(const void *a, const void *b)
-{
-	const struct external_service *service = a;
-	const char *path = b;
-
-	return queue_find(service->chrcs, match_chrc, path);
-}
-
 static struct external_desc *desc_create(struct gatt_app *app,
 							GDBusProxy *proxy)
 {
-	struct external_service *service;
+	struct external_chrc *chrc;
 	struct external_desc *desc;
 	const char *chrc_path;
 
@@ -1936,8 +2016,8 @@ static struct external_desc *desc_create(struct gatt_app *app,
 		return NULL;
 	}
 
-	service = queue_find(app->services, match_service_by_chrc, chrc_path);
-	if (!service) {
+	chrc = g_hash_table_lookup(app->chrc_paths, chrc_path);
+	if (!chrc) {
 		error("Unable to find service for characteristic: %s",
 								chrc_path);
 		return NULL;
@@ -1951,7 +2031,7 @@ static struct external_desc *desc_create(struct gatt_app *app,
 	if (!desc->chrc_path)
 		goto fail;
 
-	desc->service = service;
+	desc->service = chrc->service;
 	desc->proxy = g_dbus_proxy_ref(proxy);
 
 	/* Add 1 for the descriptor attribute */
@@ -1965,12 +2045,13 @@ static struct external_desc *desc_create(struct gatt_app *app,
 	 * determine the permission the descriptor should have
 	 */
 	if (!parse_flags(proxy, NULL, NULL, &desc->perm, NULL,
-					&desc->req_prep_authorization)) {
+					&desc->req_prep_authorization, NULL)) {
 		error("Failed to parse characteristic properties");
 		goto fail;
 	}
 
 	queue_push_tail(desc->service->descs, desc);
+	queue_push_tail(chrc->descs, desc);
 
 	return desc;
 
@@ -1999,7 +2080,7 @@ static struct external_service *create_service(struct gatt_app *app,
 	if (!path || !g_str_has_prefix(path, "/"))
 		return NULL;
 
-	service = queue_find(app->services, match_service_by_path, path);
+	service = g_hash_table_lookup(app->service_paths, path);
 	if (service) {
 		error("Duplicated service: %s", path);
 		return NULL;
@@ -2025,6 +2106,7 @@ static struct external_service *create_service(struct gatt_app *app,
 	}
 
 	queue_push_tail(app->services, service);
+	g_hash_table_insert(app->service_paths, service->path, service);
 
 	return service;
 
@@ -2826,29 +2908,22 @@ static void property_changed_cb(GDBusProxy *proxy, const char *name,
 					DBusMessageIter *iter, void *user_data)
 {
 	struct external_chrc *chrc = user_data;
-	DBusMessageIter array;
 	uint8_t *value = NULL;
 	int len = 0;
 
 	if (strcmp(name, "Value"))
 		return;
 
-	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY) {
+	if (!parse_value(iter, &value, &len)) {
 		DBG("Malformed \"Value\" property received");
 		return;
 	}
 
-	dbus_message_iter_recurse(iter, &array);
-	dbus_message_iter_get_fixed_array(&array, &value, &len);
+	if (chrc->cache_value)
+		chrc_set_value(chrc, value, len);
 
-	if (len < 0) {
-		DBG("Malformed \"Value\" property received");
+	if (!chrc->ccc)
 		return;
-	}
-
-	/* Truncate the value if it's too large */
-	len = MIN(BT_ATT_MAX_VALUE_LEN, len);
-	value = len ? value : NULL;
 
 	send_notification_to_devices(chrc->service->app->database,
 				gatt_db_attribute_get_handle(chrc->attrib),
@@ -2872,12 +2947,6 @@ static bool database_add_ccc(struct external_service *service,
 		return false;
 	}
 
-	if (g_dbus_proxy_set_property_watch(chrc->proxy, property_changed_cb,
-							chrc) == FALSE) {
-		error("Failed to set up property watch for characteristic");
-		return false;
-	}
-
 	DBG("Created CCC entry for characteristic");
 
 	return true;
@@ -3068,6 +3137,21 @@ static void chrc_read_cb(struct gatt_db_attribute *attrib,
 		goto fail;
 	}
 
+	/* Answer from the cached value without a ReadValue round trip */
+	if (chrc->value_valid) {
+		if (offset > chrc->value_len) {
+			gatt_db_attribute_read_result(attrib, id,
+						BT_ATT_ERROR_INVALID_OFFSET,
+						NULL, 0);
+			return;
+		}
+
+		gatt_db_attribute_read_result(attrib, id, 0,
+					chrc->value ? chrc->value + offset :
+					NULL, chrc->value_len - offset);
+		return;
+	}
+
 	if (send_read(att, attrib, chrc->proxy, chrc->pending_reads, id,
 	       offset))
 		return;
@@ -3119,6 +3203,12 @@ static void chrc_write_cb(struct gatt_db_attribute *attrib,
 	if (opcode == BT_ATT_OP_EXEC_WRITE_REQ)
 		chrc->prep_authorized = false;
 
+	/*
+	 * The application may change the value as result of the write so
+	 * read it again until a new value is set with PropertiesChanged.
+	 */
+	chrc->value_valid = false;
+
 	if (chrc->write_io) {
 		if (sock_io_send(chrc->write_io, value, len) < 0) {
 			error("Unable to write: %s", strerror(errno));
@@ -3211,6 +3301,17 @@ static bool database_add_chrc(struct external_service *service,
 	if (!database_add_cep(service, chrc))
 		return false;
 
+	/*
+	 * Value changes are either notified to the devices or used to
+	 * refresh the cached value.
+	 */
+	if ((chrc->ccc || chrc->cache_value) &&
+			g_dbus_proxy_set_property_watch(chrc->proxy,
+					property_changed_cb, chrc) == FALSE) {
+		error("Failed to set up property watch for characteristic");
+		return false;
+	}
+
 	if (!handle) {
 		handle = gatt_db_attribute_get_handle(chrc->attrib);
 		write_handle(chrc->proxy, handle);
@@ -3221,11 +3322,11 @@ static bool database_add_chrc(struct external_service *service,
 	DBG("handle 0x%04x UUID %s", handle, str);
 
 	/* Handle the descriptors that belong to this characteristic. */
-	for (entry = queue_get_entries(service->descs); entry;
+	for (entry = queue_get_entries(chrc->descs); entry;
 							entry = entry->next) {
 		struct external_desc *desc = entry->data;
 
-		if (desc->handled || g_strcmp0(desc->chrc_path, chrc->path))
+		if (desc->handled)
 			continue;
 
 		if (!database_add_desc(service, desc)) {
@@ -3558,11 +3659,24 @@ static void client_ready_cb(GDBusClient *client, void *user_data)
 		goto reply;
 	}
 
+	/*
+	 * Index the objects by path while parsing them so that looking up
+	 * the parent of each characteristic and descriptor does not walk
+	 * every object registered so far.
+	 */
+	app->service_paths = g_hash_table_new(g_str_hash, g_str_equal);
+	app->chrc_paths = g_hash_table_new(g_str_hash, g_str_equal);
+
 	queue_foreach(app->proxies, register_profile, app);
 	queue_foreach(app->proxies, register_service, app);
 	queue_foreach(app->proxies, register_characteristic, app);
 	queue_foreach(app->proxies, register_descriptor, app);
 
+	g_hash_table_destroy(app->service_paths);
+	app->service_paths = NULL;
+	g_hash_table_destroy(app->chrc_paths);
+	app->chrc_paths = NULL;
+
 	if ((queue_isempty(app->services) && queue_isempty(app->profiles)) ||
 							app->failed) {
 		error("No valid external GATT objects found");
@@ -3877,6 +3991,7 @@ void btd_gatt_database_server_connected(struct btd_gatt_database *database,
 
 	send_notification_to_device(state, state->pending);
 
+	bt_att_pdu_unref(state->pending->pdu);
 	free(state->pending->value);
 	free(state->pending);
 	state->pending = NULL;
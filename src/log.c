@@ -21,6 +21,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include <glib.h>
@@ -34,12 +36,81 @@
 
 #define LOG_IDENT "bluetoothd"
 
+#define RECORDER_LINE_MAX	512
+
+/*
+ * The flight recorder keeps the latest messages in memory instead of
+ * sending debug messages to syslog and the monitor socket. The daemon is
+ * single threaded, so the ring needs no locking. Messages are formatted
+ * when recorded since their arguments may not outlive the call.
+ */
+static struct {
+	char *buf;
+	size_t size;
+	size_t pos;
+	bool wrapped;
+} recorder;
+
+static const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE,
+								SIGABRT };
+
 static void monitor_log(uint16_t index, int priority,
 					const char *format, va_list ap)
 {
 	bt_log_vprintf(index, LOG_IDENT, priority, format, ap);
 }
 
+static void recorder_write(const char *data, size_t len)
+{
+	while (len > 0) {
+		size_t n = MIN(len, recorder.size - recorder.pos);
+
+		memcpy(recorder.buf + recorder.pos, data, n);
+		recorder.pos += n;
+		data += n;
+		len -= n;
+
+		if (recorder.pos == recorder.size) {
+			recorder.pos = 0;
+			recorder.wrapped = true;
+		}
+	}
+}
+
+static void recorder_log(uint16_t index, int priority,
+					const char *format, va_list ap)
+{
+	char line[RECORDER_LINE_MAX];
+	struct timespec ts;
+	int len, n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	len = snprintf(line, sizeof(line), "%lld.%06ld <%d> ",
+				(long long) ts.tv_sec, ts.tv_nsec / 1000,
+				priority);
+
+	if (index != HCI_DEV_NONE)
+		len += snprintf(line + len, sizeof(line) - len, "hci%u ",
+									index);
+
+	n = vsnprintf(line + len, sizeof(line) - len - 1, format, ap);
+	if (n > 0)
+		len += MIN(n, (int) (sizeof(line) - len - 2));
+
+	line[len++] = '\n';
+
+	recorder_write(line, len);
+}
+
+/* Other messages still go to syslog, the ring keeps them for context */
+static void record(uint16_t index, int priority, const char *format,
+								va_list ap)
+{
+	if (recorder.buf)
+		recorder_log(index, priority, format, ap);
+}
+
 void info(const char *format, ...)
 {
 	va_list ap;
@@ -51,6 +122,10 @@ void info(const char *format, ...)
 	va_start(ap, format);
 	monitor_log(HCI_DEV_NONE, LOG_INFO, format, ap);
 	va_end(ap);
+
+	va_start(ap, format);
+	record(HCI_DEV_NONE, LOG_INFO, format, ap);
+	va_end(ap);
 }
 
 void btd_log(uint16_t index, int priority, const char *format, ...)
@@ -64,6 +139,10 @@ void btd_log(uint16_t index, int priority, const char *format, ...)
 	va_start(ap, format);
 	monitor_log(index, priority, format, ap);
 	va_end(ap);
+
+	va_start(ap, format);
+	record(index, priority, format, ap);
+	va_end(ap);
 }
 
 void btd_error(uint16_t index, const char *format, ...)
@@ -77,6 +156,10 @@ void btd_error(uint16_t index, const char *format, ...)
 	va_start(ap, format);
 	monitor_log(index, LOG_ERR, format, ap);
 	va_end(ap);
+
+	va_start(ap, format);
+	record(index, LOG_ERR, format, ap);
+	va_end(ap);
 }
 
 void btd_warn(uint16_t index, const char *format, ...)
@@ -90,6 +173,10 @@ void btd_warn(uint16_t index, const char *format, ...)
 	va_start(ap, format);
 	monitor_log(index, LOG_WARNING, format, ap);
 	va_end(ap);
+
+	va_start(ap, format);
+	record(index, LOG_WARNING, format, ap);
+	va_end(ap);
 }
 
 void btd_info(uint16_t index, const char *format, ...)
@@ -103,12 +190,23 @@ void btd_info(uint16_t index, const char *format, ...)
 	va_start(ap, format);
 	monitor_log(index, LOG_INFO, format, ap);
 	va_end(ap);
+
+	va_start(ap, format);
+	record(index, LOG_INFO, format, ap);
+	va_end(ap);
 }
 
 void btd_debug(uint16_t index, const char *format, ...)
 {
 	va_list ap;
 
+	if (recorder.buf) {
+		va_start(ap, format);
+		recorder_log(index, LOG_DEBUG, format, ap);
+		va_end(ap);
+		return;
+	}
+
 	va_start(ap, format);
 	vsyslog(LOG_DEBUG, format, ap);
 	va_end(ap);
@@ -121,6 +219,12 @@ void btd_debug(uint16_t index, const char *format, ...)
 extern struct btd_debug_desc __start___debug[];
 extern struct btd_debug_desc __stop___debug[];
 
+/* Keeps the section present when all debug messages are compiled out */
+static struct btd_debug_desc __btd_debug_anchor
+	__attribute__((used, section("__debug"), aligned(8))) = {
+	.file = NULL, .flags = BTD_DEBUG_FLAG_DEFAULT,
+};
+
 static char **enabled = NULL;
 
 static gboolean is_enabled(struct btd_debug_desc *desc)
@@ -179,6 +283,125 @@ void __btd_log_init(const char *debug, int detach)
 	info("Bluetooth daemon %s", VERSION);
 }
 
+/*
+ * Locate the oldest complete line in the ring. Once the ring has wrapped
+ * the first line is usually cut, so it is skipped.
+ */
+static size_t recorder_span(size_t *start)
+{
+	size_t base, len, i;
+
+	if (!recorder.wrapped) {
+		*start = 0;
+		return recorder.pos;
+	}
+
+	base = recorder.pos;
+	len = recorder.size;
+
+	for (i = 0; i < len; i++) {
+		if (recorder.buf[(base + i) % recorder.size] == '\n')
+			break;
+	}
+
+	i = MIN(i + 1, len);
+
+	*start = (base + i) % recorder.size;
+	return len - i;
+}
+
+static void recorder_dump_fd(int fd)
+{
+	size_t start, len, n;
+	ssize_t ret;
+
+	/* Only async-signal-safe calls from here on */
+	len = recorder_span(&start);
+
+	n = MIN(len, recorder.size - start);
+	ret = write(fd, recorder.buf + start, n);
+
+	if (len > n)
+		ret = write(fd, recorder.buf, len - n);
+
+	(void) ret;
+}
+
+static void fatal_signal(int signum)
+{
+	static const char msg[] = "bluetoothd: flight recorder\n";
+	ssize_t ret;
+
+	ret = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	(void) ret;
+
+	recorder_dump_fd(STDERR_FILENO);
+
+	signal(signum, SIG_DFL);
+	raise(signum);
+}
+
+void __btd_log_recorder(size_t size)
+{
+	struct sigaction sa;
+	unsigned int i;
+
+	if (recorder.buf || !size)
+		return;
+
+	recorder.buf = malloc(size);
+	if (!recorder.buf)
+		return;
+
+	recorder.size = size;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fatal_signal;
+	sa.sa_flags = SA_RESETHAND;
+
+	for (i = 0; i < G_N_ELEMENTS(fatal_signals); i++)
+		sigaction(fatal_signals[i], &sa, NULL);
+
+	info("Flight recorder enabled with %zu bytes", size);
+}
+
+void __btd_log_dump(void)
+{
+	char *buf, *line, *next;
+	size_t start, len, n;
+
+	if (!recorder.buf)
+		return;
+
+	/* Put the ring in order so it can be split into lines */
+	len = recorder_span(&start);
+
+	buf = malloc(len + 1);
+	if (!buf)
+		return;
+
+	n = MIN(len, recorder.size - start);
+	memcpy(buf, recorder.buf + start, n);
+	memcpy(buf + n, recorder.buf, len - n);
+
+	buf[len] = '\0';
+
+	syslog(LOG_INFO, "++++++++ flight recorder ++++++++");
+
+	for (line = buf; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+
+		syslog(LOG_INFO, "%s", line);
+		bt_log_printf(HCI_DEV_NONE, LOG_IDENT, LOG_INFO, "%s", line);
+	}
+
+	syslog(LOG_INFO, "+++++++++++++++++++++++++++++++++");
+
+	free(buf);
+}
+
 void __btd_log_cleanup(void)
 {
 	closelog();
@@ -186,4 +409,7 @@ void __btd_log_cleanup(void)
 	bt_log_close();
 
 	g_strfreev(enabled);
+
+	free(recorder.buf);
+	memset(&recorder, 0, sizeof(recorder));
 }
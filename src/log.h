@@ -10,6 +10,16 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Messages with a syslog priority above BTD_LOG_LEVEL are compiled out.
+ * Only debug messages are affected so far, 6 (LOG_INFO) removes all of
+ * them including the evaluation of their arguments.
+ */
+#ifndef BTD_LOG_LEVEL
+#define BTD_LOG_LEVEL 7
+#endif
 
 void info(const char *format, ...) __attribute__((format(printf, 1, 2)));
 
@@ -28,6 +38,8 @@ void btd_debug(uint16_t index, const char *format, ...)
 void __btd_log_init(const char *debug, int detach);
 void __btd_log_cleanup(void);
 void __btd_toggle_debug(void);
+void __btd_log_recorder(size_t size);
+void __btd_log_dump(void);
 
 struct btd_debug_desc {
 	const char *file;
@@ -47,6 +59,7 @@ void __btd_enable_debug(struct btd_debug_desc *start,
  * Simple macro around btd_debug() which also include the function
  * name it is called in.
  */
+#if BTD_LOG_LEVEL >= 7
 #define DBG_IDX(idx, fmt, arg...) do { \
 	static struct btd_debug_desc __btd_debug_desc \
 	__attribute__((used, section("__debug"), aligned(8))) = { \
@@ -55,6 +68,13 @@ void __btd_enable_debug(struct btd_debug_desc *start,
 	if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_PRINT) \
 		btd_debug(idx, fmt, ## arg); \
 } while (0)
+#else
+/* Keep the format checked without generating any code */
+#define DBG_IDX(idx, fmt, arg...) do { \
+	if (0) \
+		btd_debug(idx, fmt, ## arg); \
+} while (0)
+#endif
 
 #define DBG(fmt, arg...) \
 	DBG_IDX(0xffff, "%s:%s() " fmt, __FILE__, __func__, ## arg)
@@ -52,6 +52,8 @@
 #include "dbus-common.h"
 #include "agent.h"
 #include "profile.h"
+#include "storage.h"
+#include "metrics.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -59,6 +61,7 @@
 #define DEFAULT_DISCOVERABLE_TIMEOUT     180 /* 3 minutes */
 #define DEFAULT_TEMPORARY_TIMEOUT         30 /* 30 seconds */
 #define DEFAULT_NAME_REQUEST_RETRY_DELAY 300 /* 5 minutes */
+#define DEFAULT_RSSI_HYSTERESIS            8 /* 8 dBm */
 
 #define SHUTDOWN_GRACE_SECONDS 10
 
@@ -85,6 +88,16 @@ static const char *supported_options[] = {
 	"TemporaryTimeout",
 	"Experimental",
 	"RemoteNameRequestRetryDelay",
+	"StorageBackend",
+	"StorageSync",
+	"RSSIHysteresis",
+	"RSSIUpdateInterval",
+	"MgmtPipeline",
+	"PropertiesInterval",
+	"SignalBudget",
+	"DeviceFoundBatch",
+	"MetricsSocket",
+	"LazyPlugins",
 	NULL
 };
 
@@ -124,6 +137,13 @@ static const char *le_options[] = {
 	"AdvMonAllowlistScanDuration",
 	"AdvMonNoFilterScanDuration",
 	"EnableAdvMonInterleaveScan",
+	"AdaptiveConnectionParameters",
+	"BusyConnectionInterval",
+	"IdleConnectionInterval",
+	"IdleConnectionLatency",
+	"BusyThreshold",
+	"IdleTimeout",
+	"PreferLE2MPHY",
 	NULL
 };
 
@@ -147,11 +167,13 @@ static const char *gatt_options[] = {
 static const char *avdtp_options[] = {
 	"SessionMode",
 	"StreamMode",
+	"FastReconnect",
 	NULL
 };
 
 static const char *advmon_options[] = {
 	"RSSISamplingPeriod",
+	"OffloadSlots",
 	NULL
 };
 
@@ -247,6 +269,32 @@ static bt_gatt_cache_t parse_gatt_cache(const char *cache)
 	}
 }
 
+static bt_storage_t parse_storage(const char *storage)
+{
+	if (!strcmp(storage, "file")) {
+		return BT_STORAGE_FILE;
+	} else if (!strcmp(storage, "journal")) {
+		return BT_STORAGE_JOURNAL;
+	} else {
+		DBG("Invalid value for StorageBackend=%s", storage);
+		return BT_STORAGE_FILE;
+	}
+}
+
+static bt_storage_sync_t parse_storage_sync(const char *sync)
+{
+	if (!strcmp(sync, "never")) {
+		return BT_STORAGE_SYNC_NEVER;
+	} else if (!strcmp(sync, "batch")) {
+		return BT_STORAGE_SYNC_BATCH;
+	} else if (!strcmp(sync, "always")) {
+		return BT_STORAGE_SYNC_ALWAYS;
+	} else {
+		DBG("Invalid value for StorageSync=%s", sync);
+		return BT_STORAGE_SYNC_BATCH;
+	}
+}
+
 static enum jw_repairing_t parse_jw_repairing(const char *jw_repairing)
 {
 	if (!strcmp(jw_repairing, "never")) {
@@ -626,6 +674,91 @@ static void btd_parse_experimental(char **list)
 	}
 }
 
+/* Not part of the defaults loaded into the kernel */
+static void parse_conn_param_config(GKeyFile *config)
+{
+	static const struct config_param params[] = {
+		{ "BusyConnectionInterval",
+		  &btd_opts.conn_param.busy_interval,
+		  sizeof(btd_opts.conn_param.busy_interval),
+		  0x0006,
+		  0x0C80},
+		{ "IdleConnectionInterval",
+		  &btd_opts.conn_param.idle_interval,
+		  sizeof(btd_opts.conn_param.idle_interval),
+		  0x0006,
+		  0x0C80},
+		{ "IdleConnectionLatency",
+		  &btd_opts.conn_param.idle_latency,
+		  sizeof(btd_opts.conn_param.idle_latency),
+		  0x0000,
+		  0x01F3},
+		{ "BusyThreshold",
+		  &btd_opts.conn_param.busy_threshold,
+		  sizeof(btd_opts.conn_param.busy_threshold),
+		  0x0001,
+		  0xFFFF},
+		{ "IdleTimeout",
+		  &btd_opts.conn_param.idle_timeout,
+		  sizeof(btd_opts.conn_param.idle_timeout),
+		  0x0001,
+		  0x0E10},
+	};
+	GError *err = NULL;
+	gboolean boolean;
+	size_t i;
+	int val;
+
+	if (!config)
+		return;
+
+	boolean = g_key_file_get_boolean(config, "LE",
+					"AdaptiveConnectionParameters", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("AdaptiveConnectionParameters=%s",
+					boolean ? "true" : "false");
+		btd_opts.conn_param.adaptive = boolean;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		val = g_key_file_get_integer(config, "LE", params[i].val_name,
+									&err);
+		if (err) {
+			DBG("%s", err->message);
+			g_clear_error(&err);
+			continue;
+		}
+
+		DBG("%s=%d", params[i].val_name, val);
+
+		val = MAX(val, params[i].min);
+		val = MIN(val, params[i].max);
+		*((uint16_t *) params[i].val) = val;
+	}
+}
+
+/* Not part of the defaults loaded into the kernel */
+static void parse_le_phy_config(GKeyFile *config)
+{
+	GError *err = NULL;
+	gboolean boolean;
+
+	if (!config)
+		return;
+
+	boolean = g_key_file_get_boolean(config, "LE", "PreferLE2MPHY", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("PreferLE2MPHY=%s", boolean ? "true" : "false");
+		btd_opts.le_2m_phy = boolean;
+	}
+}
+
 static void parse_config(GKeyFile *config)
 {
 	GError *err = NULL;
@@ -718,6 +851,26 @@ static void parse_config(GKeyFile *config)
 		g_free(str);
 	}
 
+	str = g_key_file_get_string(config, "General", "StorageBackend", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("storage_backend=%s", str);
+		btd_opts.storage = parse_storage(str);
+		g_free(str);
+	}
+
+	str = g_key_file_get_string(config, "General", "StorageSync", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("storage_sync=%s", str);
+		btd_opts.storage_sync = parse_storage_sync(str);
+		g_free(str);
+	}
+
 	val = g_key_file_get_integer(config, "General",
 						"TemporaryTimeout", &err);
 	if (err) {
@@ -728,6 +881,92 @@ static void parse_config(GKeyFile *config)
 		btd_opts.tmpto = val;
 	}
 
+	val = g_key_file_get_integer(config, "General",
+						"RSSIHysteresis", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MAX(0, MIN(val, INT8_MAX));
+		DBG("rssi_hysteresis=%d", val);
+		btd_opts.rssi_hysteresis = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"RSSIUpdateInterval", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MAX(0, val);
+		DBG("rssi_interval=%d", val);
+		btd_opts.rssi_interval = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"MgmtPipeline", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MAX(0, MIN(val, UINT8_MAX));
+		DBG("mgmt_pipeline=%d", val);
+		btd_opts.mgmt_pipeline = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"PropertiesInterval", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MAX(0, val);
+		DBG("props_interval=%d", val);
+		btd_opts.props_interval = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"SignalBudget", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MAX(0, val);
+		DBG("signal_budget=%d", val);
+		btd_opts.signal_budget = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"DeviceFoundBatch", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MAX(0, val);
+		DBG("found_batch=%d", val);
+		btd_opts.found_batch = val;
+	}
+
+	str = g_key_file_get_string(config, "General", "MetricsSocket", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("metrics_socket=%s", str);
+		g_free(btd_opts.metrics_socket);
+		btd_opts.metrics_socket = str;
+	}
+
+	strlist = g_key_file_get_string_list(config, "General", "LazyPlugins",
+						NULL, &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		g_strfreev(btd_opts.lazy_plugins);
+		btd_opts.lazy_plugins = strlist;
+	}
+
 	str = g_key_file_get_string(config, "General", "Name", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -926,6 +1165,16 @@ static void parse_config(GKeyFile *config)
 		g_free(str);
 	}
 
+	boolean = g_key_file_get_boolean(config, "AVDTP", "FastReconnect",
+									&err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("FastReconnect=%s", boolean ? "true" : "false");
+		btd_opts.avdtp.fast_reconnect = boolean;
+	}
+
 	val = g_key_file_get_integer(config, "AdvMon", "RSSISamplingPeriod",
 									&err);
 	if (err) {
@@ -938,8 +1187,21 @@ static void parse_config(GKeyFile *config)
 		btd_opts.advmon.rssi_sampling_period = val;
 	}
 
+	val = g_key_file_get_integer(config, "AdvMon", "OffloadSlots", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MIN(val, UINT16_MAX);
+		val = MAX(val, 0);
+		DBG("OffloadSlots=%d", val);
+		btd_opts.advmon.offload_slots = val;
+	}
+
 	parse_br_config(config);
 	parse_le_config(config);
+	parse_conn_param_config(config);
+	parse_le_phy_config(config);
 }
 
 static void init_defaults(void)
@@ -953,11 +1215,13 @@ static void init_defaults(void)
 	btd_opts.pairto = DEFAULT_PAIRABLE_TIMEOUT;
 	btd_opts.discovto = DEFAULT_DISCOVERABLE_TIMEOUT;
 	btd_opts.tmpto = DEFAULT_TEMPORARY_TIMEOUT;
+	btd_opts.rssi_hysteresis = DEFAULT_RSSI_HYSTERESIS;
 	btd_opts.reverse_discovery = TRUE;
 	btd_opts.name_resolv = TRUE;
 	btd_opts.debug_keys = FALSE;
 	btd_opts.refresh_discovery = TRUE;
 	btd_opts.name_request_retry_delay = DEFAULT_NAME_REQUEST_RETRY_DELAY;
+	btd_opts.storage_sync = BT_STORAGE_SYNC_BATCH;
 
 	btd_opts.defaults.num_entries = 0;
 	btd_opts.defaults.br.page_scan_type = 0xFFFF;
@@ -980,6 +1244,14 @@ static void init_defaults(void)
 	btd_opts.avdtp.stream_mode = BT_IO_MODE_BASIC;
 
 	btd_opts.advmon.rssi_sampling_period = 0xFF;
+
+	btd_opts.conn_param.busy_interval = 0x000C;	/* 15 ms */
+	btd_opts.conn_param.idle_interval = 0x0190;	/* 500 ms */
+	btd_opts.conn_param.idle_latency = 4;
+	btd_opts.conn_param.busy_threshold = 10;
+	btd_opts.conn_param.idle_timeout = 10;
+
+	btd_opts.le_2m_phy = true;
 }
 
 static void log_handler(const gchar *log_domain, GLogLevelFlags log_level,
@@ -1026,6 +1298,9 @@ static void signal_callback(int signum, void *user_data)
 
 		terminated = true;
 		break;
+	case SIGUSR1:
+		__btd_log_dump();
+		break;
 	case SIGUSR2:
 		__btd_toggle_debug();
 		break;
@@ -1039,6 +1314,7 @@ static char *option_configfile = NULL;
 static gboolean option_compat = FALSE;
 static gboolean option_detach = TRUE;
 static gboolean option_version = FALSE;
+static int option_recorder = 0;
 
 static void free_options(void)
 {
@@ -1110,6 +1386,21 @@ static gboolean parse_debug(const char *key, const char *value,
 	return TRUE;
 }
 
+static gboolean parse_recorder(const char *key, const char *value,
+					gpointer user_data, GError **error)
+{
+	/* Size in KiB, 256 KiB unless given */
+	option_recorder = value ? atoi(value) : 256;
+
+	if (option_recorder <= 0) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+				"Invalid flight recorder size: %s", value);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static gboolean parse_experimental(const char *key, const char *value,
 					gpointer user_data, GError **error)
 {
@@ -1143,6 +1434,10 @@ static GOptionEntry options[] = {
 	{ "experimental", 'E', G_OPTION_FLAG_OPTIONAL_ARG,
 				G_OPTION_ARG_CALLBACK, parse_experimental,
 				"Enable experimental features/interfaces" },
+	{ "flight-recorder", 'R', G_OPTION_FLAG_OPTIONAL_ARG,
+				G_OPTION_ARG_CALLBACK, parse_recorder,
+				"Keep debug messages in memory instead of "
+				"logging them", "KIB" },
 	{ "nodetach", 'n', G_OPTION_FLAG_REVERSE,
 				G_OPTION_ARG_NONE, &option_detach,
 				"Run with logging in foreground" },
@@ -1187,6 +1482,7 @@ int main(int argc, char *argv[])
 	mainloop_init();
 
 	__btd_log_init(option_debug, option_detach);
+	__btd_log_recorder((size_t) option_recorder * 1024);
 
 	g_log_set_handler("GLib", G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL |
 							G_LOG_FLAG_RECURSION,
@@ -1212,6 +1508,13 @@ int main(int argc, char *argv[])
 		gdbus_flags = G_DBUS_FLAG_ENABLE_EXPERIMENTAL;
 
 	g_dbus_set_flags(gdbus_flags);
+	g_dbus_set_property_limits(btd_opts.props_interval,
+						btd_opts.signal_budget);
+
+	if (btd_storage_init() < 0)
+		error("Unable to open storage, falling back to files");
+
+	btd_metrics_init();
 
 	if (adapter_init() < 0) {
 		error("Adapter handling initialization failed");
@@ -1266,8 +1569,14 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	btd_storage_cleanup();
+
 	rfkill_exit();
 
+	btd_metrics_cleanup();
+	g_free(btd_opts.metrics_socket);
+	g_strfreev(btd_opts.lazy_plugins);
+
 	if (btd_opts.mode != BT_MODE_LE)
 		stop_sdp_server();
 
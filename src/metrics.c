@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "gdbus/gdbus.h"
+
+#include "log.h"
+#include "btd.h"
+#include "dbus-common.h"
+#include "metrics.h"
+#include "src/shared/io.h"
+#include "src/shared/metrics.h"
+
+#define METRICS_INTERFACE "org.bluez.Metrics1"
+
+static struct metric *dbus_signals;
+static struct io *metrics_io;
+
+/* Values owned by other libraries are only copied in when exported */
+static void update_metrics(void)
+{
+	metrics_set(dbus_signals, g_dbus_get_signal_count());
+}
+
+static void append_metric(const struct metric *metric, void *user_data)
+{
+	DBusMessageIter *dict = user_data;
+	uint64_t buckets[METRICS_BUCKETS + 1];
+	char key[128];
+	int i;
+
+	switch (metric->type) {
+	case METRICS_COUNTER:
+		dict_append_entry(dict, metric->name, DBUS_TYPE_UINT64,
+						(void *) &metric->value);
+		return;
+	case METRICS_GAUGE:
+		dict_append_entry(dict, metric->name, DBUS_TYPE_INT64,
+						(void *) &metric->value);
+		return;
+	case METRICS_HISTOGRAM:
+		break;
+	}
+
+	/* Bucket counts are cumulative, the last one has no upper bound */
+	for (i = 0; i <= METRICS_BUCKETS; i++)
+		buckets[i] = metric->buckets[i] + (i ? buckets[i - 1] : 0);
+
+	snprintf(key, sizeof(key), "%s_count", metric->name);
+	dict_append_entry(dict, key, DBUS_TYPE_UINT64,
+						(void *) &metric->count);
+
+	snprintf(key, sizeof(key), "%s_sum", metric->name);
+	dict_append_entry(dict, key, DBUS_TYPE_UINT64, (void *) &metric->sum);
+
+	snprintf(key, sizeof(key), "%s_bounds", metric->name);
+	dict_append_array(dict, key, DBUS_TYPE_UINT64,
+				(void *) metric->bounds, METRICS_BUCKETS);
+
+	snprintf(key, sizeof(key), "%s_buckets", metric->name);
+	dict_append_array(dict, key, DBUS_TYPE_UINT64, buckets,
+							METRICS_BUCKETS + 1);
+}
+
+static DBusMessage *get_metrics(DBusConnection *conn, DBusMessage *msg,
+							void *user_data)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, dict;
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	update_metrics();
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	metrics_foreach(append_metric, &dict);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
+static const GDBusMethodTable methods[] = {
+	{ GDBUS_METHOD("GetMetrics", NULL,
+			GDBUS_ARGS({ "metrics", "a{sv}" }),
+			get_metrics) },
+	{ }
+};
+
+static bool metrics_accept(struct io *io, void *user_data)
+{
+	char *text;
+	size_t len, done = 0;
+	int fd;
+
+	fd = accept4(io_get_fd(io), NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return true;
+
+	update_metrics();
+
+	text = metrics_format();
+	len = text ? strlen(text) : 0;
+
+	/* The client only reads, so the whole text is written and closed */
+	while (done < len) {
+		ssize_t ret = write(fd, text + done, len - done);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			DBG("metrics write: %s", strerror(errno));
+			break;
+		}
+
+		done += ret;
+	}
+
+	free(text);
+	close(fd);
+
+	return true;
+}
+
+static void metrics_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		error("Metrics socket path too long: %s", path);
+		return;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		error("Unable to create metrics socket: %s", strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+						listen(fd, 4) < 0) {
+		error("Unable to listen on %s: %s", path, strerror(errno));
+		close(fd);
+		return;
+	}
+
+	chmod(path, 0660);
+
+	metrics_io = io_new(fd);
+	io_set_close_on_destroy(metrics_io, true);
+	io_set_read_handler(metrics_io, metrics_accept, NULL, NULL);
+
+	DBG("Metrics available on %s", path);
+}
+
+void btd_metrics_init(void)
+{
+	dbus_signals = metrics_counter("dbus_signals_total",
+					"D-Bus signals emitted");
+
+	g_dbus_register_interface(btd_get_dbus_connection(),
+				"/org/bluez", METRICS_INTERFACE,
+				methods, NULL, NULL, NULL, NULL);
+
+	if (btd_opts.metrics_socket)
+		metrics_listen(btd_opts.metrics_socket);
+}
+
+void btd_metrics_cleanup(void)
+{
+	if (metrics_io) {
+		io_destroy(metrics_io);
+		metrics_io = NULL;
+
+		unlink(btd_opts.metrics_socket);
+	}
+
+	g_dbus_unregister_interface(btd_get_dbus_connection(),
+				"/org/bluez", METRICS_INTERFACE);
+
+	dbus_signals = NULL;
+	metrics_cleanup();
+}
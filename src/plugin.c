@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 
 #include <glib.h>
@@ -27,10 +28,13 @@
 #include "src/btd.h"
 
 static GSList *plugins = NULL;
+static guint start_id = 0;
 
 struct bluetooth_plugin {
 	void *handle;
 	gboolean active;
+	gboolean lazy;
+	gboolean pending;
 	struct bluetooth_plugin_desc *desc;
 };
 
@@ -97,6 +101,38 @@ static gboolean enable_plugin(const char *name, char **cli_enable,
 	return TRUE;
 }
 
+static gboolean is_lazy(struct bluetooth_plugin_desc *desc)
+{
+	char **pattern;
+
+	if (!desc->uuids || !btd_opts.lazy_plugins)
+		return FALSE;
+
+	for (pattern = btd_opts.lazy_plugins; *pattern; pattern++)
+		if (g_pattern_match_simple(*pattern, desc->name))
+			return TRUE;
+
+	return FALSE;
+}
+
+static void start_plugin(struct bluetooth_plugin *plugin)
+{
+	int err;
+
+	err = plugin->desc->init();
+	if (err < 0) {
+		if (err == -ENOSYS)
+			warn("System does not support %s plugin",
+						plugin->desc->name);
+		else
+			error("Failed to init %s plugin",
+						plugin->desc->name);
+		return;
+	}
+
+	plugin->active = TRUE;
+}
+
 #include "src/builtin.h"
 
 gboolean plugin_init(const char *enable, const char *disable)
@@ -182,20 +218,14 @@ gboolean plugin_init(const char *enable, const char *disable)
 start:
 	for (list = plugins; list; list = list->next) {
 		struct bluetooth_plugin *plugin = list->data;
-		int err;
-
-		err = plugin->desc->init();
-		if (err < 0) {
-			if (err == -ENOSYS)
-				warn("System does not support %s plugin",
-							plugin->desc->name);
-			else
-				error("Failed to init %s plugin",
-							plugin->desc->name);
+
+		if (is_lazy(plugin->desc)) {
+			DBG("Deferring %s plugin", plugin->desc->name);
+			plugin->lazy = TRUE;
 			continue;
 		}
 
-		plugin->active = TRUE;
+		start_plugin(plugin);
 	}
 
 	g_strfreev(cli_enabled);
@@ -204,12 +234,69 @@ start:
 	return TRUE;
 }
 
+static gboolean start_pending(gpointer user_data)
+{
+	GSList *list;
+
+	start_id = 0;
+
+	for (list = plugins; list; list = list->next) {
+		struct bluetooth_plugin *plugin = list->data;
+
+		if (!plugin->pending)
+			continue;
+
+		plugin->pending = FALSE;
+		start_plugin(plugin);
+	}
+
+	return FALSE;
+}
+
+/*
+ * Deferred plugins are initialized from the main loop, so adapters still
+ * being set up are done with it by then and the profiles the plugins
+ * register get probed against them and their devices right away.
+ */
+void plugin_activate_uuid(const char *uuid)
+{
+	GSList *list;
+
+	for (list = plugins; list; list = list->next) {
+		struct bluetooth_plugin *plugin = list->data;
+		const char * const *u;
+
+		if (!plugin->lazy)
+			continue;
+
+		for (u = plugin->desc->uuids; *u; u++)
+			if (!strcasecmp(*u, uuid))
+				break;
+
+		if (!*u)
+			continue;
+
+		DBG("Starting %s plugin for %s", plugin->desc->name, uuid);
+
+		plugin->lazy = FALSE;
+		plugin->pending = TRUE;
+
+		if (!start_id)
+			start_id = g_idle_add(start_pending, NULL);
+	}
+}
+
 void plugin_cleanup(void)
 {
 	GSList *list;
 
 	DBG("Cleanup plugins");
 
+	if (start_id) {
+		g_source_remove(start_id);
+		start_id = 0;
+	}
+
 	for (list = plugins; list; list = list->next) {
 		struct bluetooth_plugin *plugin = list->data;
 
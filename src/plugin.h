@@ -19,15 +19,24 @@ struct bluetooth_plugin_desc {
 	void (*exit) (void);
 	void *debug_start;
 	void *debug_stop;
+	const char * const *uuids;
 };
 
+/*
+ * Plugins defined with a NULL terminated list of profile UUIDs can be listed
+ * in the LazyPlugins option of main.conf, they are then only initialized
+ * once a device with one of the UUIDs shows up.
+ */
 #ifdef BLUETOOTH_PLUGIN_BUILTIN
-#define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
+#define BLUETOOTH_PLUGIN_DEFINE_UUIDS(name, version, priority, init, exit, \
+								uuids) \
 		struct bluetooth_plugin_desc __bluetooth_builtin_ ## name = { \
-			#name, version, priority, init, exit \
+			#name, version, priority, init, exit, NULL, NULL, \
+			uuids \
 		};
 #else
-#define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
+#define BLUETOOTH_PLUGIN_DEFINE_UUIDS(name, version, priority, init, exit, \
+								uuids) \
 		extern struct btd_debug_desc __start___debug[] \
 				__attribute__ ((weak, visibility("hidden"))); \
 		extern struct btd_debug_desc __stop___debug[] \
@@ -36,6 +45,10 @@ struct bluetooth_plugin_desc {
 				__attribute__ ((visibility("default"))); \
 		struct bluetooth_plugin_desc bluetooth_plugin_desc = { \
 			#name, version, priority, init, exit, \
-			__start___debug, __stop___debug \
+			__start___debug, __stop___debug, uuids \
 		};
 #endif
+
+#define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
+		BLUETOOTH_PLUGIN_DEFINE_UUIDS(name, version, priority, init, \
+								exit, NULL)
@@ -776,6 +776,10 @@ static struct btd_profile *btd_profile_find_uuid(const char *uuid)
 int btd_profile_register(struct btd_profile *profile)
 {
 	profiles = g_slist_append(profiles, profile);
+
+	/* Only plugins initialized after start up find adapters here */
+	adapter_foreach(adapter_add_profile, profile);
+
 	return 0;
 }
 
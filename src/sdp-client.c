@@ -13,6 +13,7 @@
 #endif
 
 #include <errno.h>
+#include <stdbool.h>
 
 #include <glib.h>
 
@@ -28,6 +29,9 @@
 /* Number of seconds to keep a sdp_session_t in the cache */
 #define CACHE_TIMEOUT 2
 
+/* Number of seconds service records are served from the record cache */
+#define RECORD_CACHE_TTL (24 * 60 * 60)
+
 struct cached_sdp_session {
 	bdaddr_t src;
 	bdaddr_t dst;
@@ -132,6 +136,7 @@ struct search_context {
 	uuid_t			uuid;
 	guint			io_id;
 	gboolean		filter_svc_class;
+	sdp_list_t		*recs;
 };
 
 static GSList *context_list = NULL;
@@ -143,9 +148,27 @@ static void search_context_cleanup(struct search_context *ctxt)
 	if (ctxt->destroy)
 		ctxt->destroy(ctxt->user_data);
 
+	if (ctxt->recs)
+		sdp_list_free(ctxt->recs, (sdp_free_func_t) sdp_record_free);
+
 	g_free(ctxt);
 }
 
+static bool match_svclass(struct search_context *ctxt,
+					const sdp_record_view_t *view)
+{
+	uuid_t svclass;
+
+	if (!ctxt->filter_svc_class)
+		return true;
+
+	/* Records missing the service class ID never match */
+	if (sdp_record_view_svclass(view, &svclass) < 0)
+		return false;
+
+	return sdp_uuid_cmp(&ctxt->uuid, &svclass) == 0;
+}
+
 static void search_completed_cb(uint8_t type, uint16_t status,
 			uint8_t *rsp, size_t size, void *user_data)
 {
@@ -167,34 +190,28 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 	rsp += scanned;
 	bytesleft -= scanned;
 	do {
-		sdp_record_t *rec;
+		sdp_record_view_t view;
 		int recsize;
 
-		recsize = 0;
-		rec = sdp_extract_pdu(rsp, bytesleft, &recsize);
-		if (!rec)
+		recsize = sdp_record_view_init(&view, rsp, bytesleft);
+		if (!recsize)
 			break;
 
-		if (!recsize) {
-			sdp_record_free(rec);
-			break;
+		/* Only records matching the requested service class are
+		 * extracted, the others are skipped in place.
+		 */
+		if (match_svclass(ctxt, &view)) {
+			sdp_record_t *rec;
+			int n = 0;
+
+			rec = sdp_extract_pdu(rsp, recsize, &n);
+			if (rec)
+				recs = sdp_list_append(recs, rec);
 		}
 
 		scanned += recsize;
 		rsp += recsize;
 		bytesleft -= recsize;
-
-		/* Check whether service class ID matches some specified uuid.
-		 * If the record is missing service class ID, svclass will be
-		 * all zero, and thus will be unequal to the requested uuid.
-		 */
-		if (ctxt->filter_svc_class &&
-				sdp_uuid_cmp(&ctxt->uuid, &rec->svclass) != 0) {
-			sdp_record_free(rec);
-			continue;
-		}
-
-		recs = sdp_list_append(recs, rec);
 	} while (scanned < (ssize_t) size && bytesleft > 0);
 
 done:
@@ -358,6 +375,258 @@ static int create_search_context_full(struct search_context **ctxt,
 	return 0;
 }
 
+struct cached_records {
+	bdaddr_t		src;
+	bdaddr_t		dst;
+	sdp_list_t		*recs;
+	gint64			timestamp;
+	bool			has_db_state;
+	uint32_t		db_state;
+	struct search_context	*refresh;
+};
+
+static GSList *cached_records_list = NULL;
+static bt_record_loader_t record_loader = NULL;
+
+static void free_records(sdp_list_t *recs)
+{
+	sdp_list_free(recs, (sdp_free_func_t) sdp_record_free);
+}
+
+static sdp_list_t *copy_records(sdp_list_t *recs, const uuid_t *svclass)
+{
+	sdp_list_t *copy = NULL;
+
+	for (; recs; recs = recs->next) {
+		sdp_record_t *rec = recs->data;
+
+		if (svclass && sdp_uuid_cmp(svclass, &rec->svclass) != 0)
+			continue;
+
+		copy = sdp_list_append(copy, sdp_copy_record(rec));
+	}
+
+	return copy;
+}
+
+/* ServiceDatabaseState is only present in the SDP server record */
+static bool get_db_state(sdp_list_t *recs, uint32_t *state)
+{
+	for (; recs; recs = recs->next) {
+		sdp_record_t *rec = recs->data;
+		sdp_data_t *d;
+
+		if (rec->handle != 0x00000000)
+			continue;
+
+		d = sdp_data_get(rec, SDP_ATTR_SVCDB_STATE);
+		if (!d || d->dtd != SDP_UINT32)
+			return false;
+
+		*state = d->val.uint32;
+		return true;
+	}
+
+	return false;
+}
+
+static void set_cached_records(struct cached_records *cached,
+							sdp_list_t *recs)
+{
+	if (cached->recs)
+		free_records(cached->recs);
+
+	cached->recs = recs;
+	cached->timestamp = g_get_monotonic_time();
+	cached->has_db_state = get_db_state(recs, &cached->db_state);
+}
+
+static void cached_records_free(struct cached_records *cached)
+{
+	cached_records_list = g_slist_remove(cached_records_list, cached);
+
+	/* A pending refresh completes on its own, just detach from it */
+	if (cached->refresh) {
+		cached->refresh->cb = NULL;
+		cached->refresh->user_data = NULL;
+	}
+
+	free_records(cached->recs);
+	g_free(cached);
+}
+
+static struct cached_records *find_cached_records(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	struct cached_records *cached;
+	sdp_list_t *recs;
+	GSList *l;
+
+	for (l = cached_records_list; l != NULL; l = l->next) {
+		cached = l->data;
+
+		if (!bacmp(&cached->src, src) && !bacmp(&cached->dst, dst))
+			return cached;
+	}
+
+	/* Fall back to the records stored from a previous browse */
+	if (!record_loader)
+		return NULL;
+
+	recs = record_loader(src, dst);
+	if (!recs)
+		return NULL;
+
+	cached = g_new0(struct cached_records, 1);
+	bacpy(&cached->src, src);
+	bacpy(&cached->dst, dst);
+	set_cached_records(cached, recs);
+
+	cached_records_list = g_slist_append(cached_records_list, cached);
+
+	return cached;
+}
+
+static int refresh_cached_records(struct cached_records *cached,
+							uint16_t uuid16);
+
+static void browse_refresh_cb(sdp_list_t *recs, int err, gpointer user_data)
+{
+	struct cached_records *cached = user_data;
+
+	if (!cached)
+		return;
+
+	cached->refresh = NULL;
+
+	/* Drop what can no longer be trusted so the next search goes to
+	 * the remote device.
+	 */
+	if (err < 0 || !recs) {
+		cached_records_free(cached);
+		return;
+	}
+
+	set_cached_records(cached, copy_records(recs, NULL));
+}
+
+static void state_refresh_cb(sdp_list_t *recs, int err, gpointer user_data)
+{
+	struct cached_records *cached = user_data;
+	uint32_t state;
+
+	if (!cached)
+		return;
+
+	cached->refresh = NULL;
+
+	if (err < 0)
+		return;
+
+	if (cached->has_db_state && get_db_state(recs, &state) &&
+						state == cached->db_state) {
+		cached->timestamp = g_get_monotonic_time();
+		return;
+	}
+
+	/* The database changed or it cannot be told, browse it again */
+	if (refresh_cached_records(cached, L2CAP_UUID) < 0)
+		cached_records_free(cached);
+}
+
+static int refresh_cached_records(struct cached_records *cached,
+							uint16_t uuid16)
+{
+	struct search_context *ctxt = NULL;
+	bt_callback_t cb;
+	uuid_t uuid;
+	int err;
+
+	if (cached->refresh)
+		return 0;
+
+	if (uuid16 == SDP_SERVER_SVCLASS_ID)
+		cb = state_refresh_cb;
+	else
+		cb = browse_refresh_cb;
+
+	sdp_uuid16_create(&uuid, uuid16);
+
+	err = create_search_context_full(&ctxt, &cached->src, &cached->dst,
+					&uuid, 0, cached, cb, NULL,
+					uuid16 == SDP_SERVER_SVCLASS_ID);
+	if (err < 0)
+		return err;
+
+	cached->refresh = ctxt;
+
+	return 0;
+}
+
+static gboolean cached_search_cb(gpointer user_data)
+{
+	struct search_context *ctxt = user_data;
+
+	ctxt->io_id = 0;
+
+	if (ctxt->cb)
+		ctxt->cb(ctxt->recs, 0, ctxt->user_data);
+
+	search_context_cleanup(ctxt);
+
+	return FALSE;
+}
+
+static int search_cached_records(const bdaddr_t *src, const bdaddr_t *dst,
+					uuid_t *uuid, bt_callback_t cb,
+					void *user_data, bt_destroy_t destroy)
+{
+	struct cached_records *cached;
+	struct search_context *ctxt;
+	sdp_list_t *recs;
+
+	cached = find_cached_records(src, dst);
+	if (!cached)
+		return -ENOENT;
+
+	/* Stale records are browsed again in the background while this
+	 * search goes to the remote device.
+	 */
+	if (g_get_monotonic_time() - cached->timestamp >
+				(gint64) RECORD_CACHE_TTL * G_USEC_PER_SEC) {
+		if (refresh_cached_records(cached, L2CAP_UUID) < 0)
+			cached_records_free(cached);
+		return -ENOENT;
+	}
+
+	/* Records not found in the cache may have been missed by the last
+	 * browse, so only hits are answered from it.
+	 */
+	recs = copy_records(cached->recs, uuid);
+	if (!recs)
+		return -ENOENT;
+
+	ctxt = g_new0(struct search_context, 1);
+	bacpy(&ctxt->src, src);
+	bacpy(&ctxt->dst, dst);
+	ctxt->uuid = *uuid;
+	ctxt->cb = cb;
+	ctxt->destroy = destroy;
+	ctxt->user_data = user_data;
+	ctxt->filter_svc_class = TRUE;
+	ctxt->recs = recs;
+	ctxt->io_id = g_idle_add(cached_search_cb, ctxt);
+
+	context_list = g_slist_append(context_list, ctxt);
+
+	/* Check ServiceDatabaseState in the background, the link is about
+	 * to be used by the caller anyway.
+	 */
+	refresh_cached_records(cached, SDP_SERVER_SVCLASS_ID);
+
+	return 0;
+}
+
 int bt_search(const bdaddr_t *src, const bdaddr_t *dst,
 			uuid_t *uuid, bt_callback_t cb, void *user_data,
 			bt_destroy_t destroy, uint16_t flags)
@@ -389,6 +658,13 @@ int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 	if (!cb)
 		return -EINVAL;
 
+	if (!(flags & BT_SEARCH_NO_CACHE) &&
+			!search_cached_records(src, dst, uuid, cb, user_data,
+								destroy))
+		return 0;
+
+	flags &= ~BT_SEARCH_NO_CACHE;
+
 	/* The resulting service class ID need to match uuid */
 	err = create_search_context_full(&ctxt, src, dst, uuid, flags,
 					user_data, cb, destroy, TRUE);
@@ -428,7 +704,7 @@ int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 
 	ctxt = l->data;
 
-	if (!ctxt->session)
+	if (!ctxt->session && !ctxt->recs)
 		return -ENOTCONN;
 
 	if (ctxt->io_id)
@@ -450,3 +726,48 @@ void bt_clear_cached_session(const bdaddr_t *src, const bdaddr_t *dst)
 	if (session)
 		sdp_close(session);
 }
+
+void bt_set_record_loader(bt_record_loader_t loader)
+{
+	record_loader = loader;
+}
+
+void bt_cache_records(const bdaddr_t *src, const bdaddr_t *dst,
+							sdp_list_t *recs)
+{
+	struct cached_records *cached;
+	GSList *l;
+
+	for (l = cached_records_list; l != NULL; l = l->next) {
+		cached = l->data;
+
+		if (!bacmp(&cached->src, src) && !bacmp(&cached->dst, dst)) {
+			set_cached_records(cached, copy_records(recs, NULL));
+			return;
+		}
+	}
+
+	if (!recs)
+		return;
+
+	cached = g_new0(struct cached_records, 1);
+	bacpy(&cached->src, src);
+	bacpy(&cached->dst, dst);
+	set_cached_records(cached, copy_records(recs, NULL));
+
+	cached_records_list = g_slist_append(cached_records_list, cached);
+}
+
+void bt_clear_cached_records(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = cached_records_list; l != NULL; l = l->next) {
+		struct cached_records *cached = l->data;
+
+		if (!bacmp(&cached->src, src) && !bacmp(&cached->dst, dst)) {
+			cached_records_free(cached);
+			return;
+		}
+	}
+}
@@ -10,6 +10,11 @@
 
 typedef void (*bt_callback_t) (sdp_list_t *recs, int err, gpointer user_data);
 typedef void (*bt_destroy_t) (gpointer user_data);
+typedef sdp_list_t *(*bt_record_loader_t) (const bdaddr_t *src,
+							const bdaddr_t *dst);
+
+/* Skip the record cache in bt_search_service(), not passed to sdp_connect */
+#define BT_SEARCH_NO_CACHE	0x8000
 
 int bt_search(const bdaddr_t *src, const bdaddr_t *dst,
 			uuid_t *uuid, bt_callback_t cb, void *user_data,
@@ -19,3 +24,8 @@ int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 			bt_destroy_t destroy, uint16_t flags);
 int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst);
 void bt_clear_cached_session(const bdaddr_t *src, const bdaddr_t *dst);
+
+void bt_set_record_loader(bt_record_loader_t loader);
+void bt_cache_records(const bdaddr_t *src, const bdaddr_t *dst,
+							sdp_list_t *recs);
+void bt_clear_cached_records(const bdaddr_t *src, const bdaddr_t *dst);
@@ -16,23 +16,48 @@
 #endif
 
 #include <stdlib.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "lib/bluetooth.h"
 #include "lib/sdp.h"
 #include "lib/sdp_lib.h"
 
+#include "src/shared/hashmap.h"
+
 #include "sdpd.h"
 #include "log.h"
 
 static sdp_list_t *service_db;
 static sdp_list_t *access_db;
 
+/* Records and access data by handle */
+static struct hashmap *record_map;
+static struct hashmap *access_map;
+
+/*
+ * Records by the UUIDs of their pattern. The patterns are completed after
+ * the records have been added, so the index is rebuilt on the first search
+ * after the database changed.
+ */
+static struct hashmap *uuid_map;
+static bool uuid_map_valid;
+
+/* Serialized attribute lists by record handle, built on first request */
+static struct hashmap *pdu_map;
+
 typedef struct {
 	uint32_t handle;
 	bdaddr_t device;
 } sdp_access_t;
 
+typedef struct {
+	sdp_list_t *records;
+	sdp_list_t *tail;
+	int len;
+} sdp_uuid_bucket_t;
+
 /*
  * Ordering function called when inserting a service record.
  * The service repository is a linked list in sorted order
@@ -69,6 +94,125 @@ static void access_free(void *p)
 	free(p);
 }
 
+static void uuid_bucket_free(void *p)
+{
+	sdp_uuid_bucket_t *bucket = p;
+
+	sdp_list_free(bucket->records, NULL);
+	free(bucket);
+}
+
+static unsigned int uuid128_hash(const uuid_t *uuid)
+{
+	const uint8_t *data = uuid->value.uuid128.data;
+	unsigned int hash = 0;
+	uint32_t word;
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		memcpy(&word, data + i, sizeof(word));
+		hash ^= word;
+	}
+
+	return hash;
+}
+
+static void record_pdu_free(void *p)
+{
+	sdp_record_pdu_unref(p);
+}
+
+static void record_pdu_drop(uint32_t handle)
+{
+	sdp_record_pdu_unref(hashmap_remove(pdu_map, handle));
+}
+
+void sdp_svcdb_invalidate(void)
+{
+	uuid_map_valid = false;
+
+	/* Records are updated in place, so any of them might have changed */
+	hashmap_clear(pdu_map, record_pdu_free);
+}
+
+static void uuid_map_build(void)
+{
+	sdp_list_t *r, *u;
+
+	if (!uuid_map)
+		uuid_map = hashmap_new();
+	else
+		hashmap_clear(uuid_map, uuid_bucket_free);
+
+	/* Records are visited in handle order, so each bucket is sorted */
+	for (r = service_db; r; r = r->next) {
+		sdp_record_t *rec = r->data;
+
+		for (u = rec->pattern; u; u = u->next) {
+			unsigned int key = uuid128_hash(u->data);
+			sdp_uuid_bucket_t *bucket;
+
+			bucket = hashmap_lookup(uuid_map, key);
+			if (!bucket) {
+				bucket = calloc(1, sizeof(*bucket));
+				if (!bucket)
+					continue;
+
+				hashmap_insert(uuid_map, key, bucket);
+			}
+
+			/* Colliding UUIDs of the same record */
+			if (bucket->tail && bucket->tail->data == rec)
+				continue;
+
+			if (!bucket->tail) {
+				bucket->records = sdp_list_append(NULL, rec);
+				bucket->tail = bucket->records;
+			} else {
+				sdp_list_append(bucket->tail, rec);
+				bucket->tail = bucket->tail->next;
+			}
+
+			bucket->len++;
+		}
+	}
+
+	uuid_map_valid = true;
+}
+
+/*
+ * Return the records that may match every UUID of the search pattern, in
+ * handle order. Candidates still need to be checked against the pattern.
+ */
+sdp_list_t *sdp_get_record_list_by_uuid(sdp_list_t *search)
+{
+	sdp_uuid_bucket_t *best = NULL;
+
+	if (!uuid_map_valid)
+		uuid_map_build();
+
+	for (; search; search = search->next) {
+		sdp_uuid_bucket_t *bucket;
+		uuid_t *uuid128;
+
+		if (!search->data)
+			return service_db;
+
+		uuid128 = sdp_uuid_to_uuid128(search->data);
+		bucket = hashmap_lookup(uuid_map, uuid128_hash(uuid128));
+		bt_free(uuid128);
+
+		/* No record has this UUID, so none can match */
+		if (!bucket)
+			return NULL;
+
+		if (!best || bucket->len < best->len)
+			best = bucket;
+	}
+
+	return best ? best->records : service_db;
+}
+
 /*
  * Reset the service repository by deleting its contents
  */
@@ -79,6 +223,19 @@ void sdp_svcdb_reset(void)
 
 	sdp_list_free(access_db, access_free);
 	access_db = NULL;
+
+	hashmap_destroy(record_map, NULL);
+	record_map = NULL;
+
+	hashmap_destroy(access_map, NULL);
+	access_map = NULL;
+
+	hashmap_destroy(uuid_map, uuid_bucket_free);
+	uuid_map = NULL;
+	uuid_map_valid = false;
+
+	hashmap_destroy(pdu_map, record_pdu_free);
+	pdu_map = NULL;
 }
 
 typedef struct _indexed {
@@ -168,6 +325,13 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 
 	service_db = sdp_list_insert_sorted(service_db, rec, record_sort);
 
+	if (!record_map)
+		record_map = hashmap_new();
+
+	hashmap_insert(record_map, rec->handle, rec);
+	uuid_map_valid = false;
+	record_pdu_drop(rec->handle);
+
 	dev = malloc(sizeof(*dev));
 	if (!dev)
 		return;
@@ -176,36 +340,11 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 	dev->handle = rec->handle;
 
 	access_db = sdp_list_insert_sorted(access_db, dev, access_sort);
-}
 
-static sdp_list_t *record_locate(uint32_t handle)
-{
-	if (service_db) {
-		sdp_list_t *p;
-		sdp_record_t r;
-
-		r.handle = handle;
-		p = sdp_list_find(service_db, &r, record_sort);
-		return p;
-	}
+	if (!access_map)
+		access_map = hashmap_new();
 
-	SDPDBG("Could not find svcRec for : 0x%x", handle);
-	return NULL;
-}
-
-static sdp_list_t *access_locate(uint32_t handle)
-{
-	if (access_db) {
-		sdp_list_t *p;
-		sdp_access_t a;
-
-		a.handle = handle;
-		p = sdp_list_find(access_db, &a, access_sort);
-		return p;
-	}
-
-	SDPDBG("Could not find access data for : 0x%x", handle);
-	return NULL;
+	hashmap_insert(access_map, dev->handle, dev);
 }
 
 /*
@@ -213,14 +352,14 @@ static sdp_list_t *access_locate(uint32_t handle)
  */
 sdp_record_t *sdp_record_find(uint32_t handle)
 {
-	sdp_list_t *p = record_locate(handle);
+	sdp_record_t *rec = hashmap_lookup(record_map, handle);
 
-	if (!p) {
+	if (!rec) {
 		SDPDBG("Couldn't find record for : 0x%x", handle);
 		return 0;
 	}
 
-	return p->data;
+	return rec;
 }
 
 /*
@@ -228,25 +367,23 @@ sdp_record_t *sdp_record_find(uint32_t handle)
  */
 int sdp_record_remove(uint32_t handle)
 {
-	sdp_list_t *p = record_locate(handle);
 	sdp_record_t *r;
 	sdp_access_t *a;
 
-	if (!p) {
+	r = hashmap_remove(record_map, handle);
+	if (!r) {
 		error("Remove : Couldn't find record for : 0x%x", handle);
 		return -1;
 	}
 
-	r = p->data;
-	if (r)
-		service_db = sdp_list_remove(service_db, r);
+	service_db = sdp_list_remove(service_db, r);
+	uuid_map_valid = false;
+	record_pdu_drop(handle);
 
-	p = access_locate(handle);
-	if (p == NULL || p->data == NULL)
+	a = hashmap_remove(access_map, handle);
+	if (!a)
 		return 0;
 
-	a = p->data;
-
 	access_db = sdp_list_remove(access_db, a);
 	access_free(a);
 
@@ -263,13 +400,8 @@ sdp_list_t *sdp_get_record_list(void)
 
 int sdp_check_access(uint32_t handle, bdaddr_t *device)
 {
-	sdp_list_t *p = access_locate(handle);
-	sdp_access_t *a;
-
-	if (!p)
-		return 1;
+	sdp_access_t *a = hashmap_lookup(access_map, handle);
 
-	a = p->data;
 	if (!a)
 		return 1;
 
@@ -281,6 +413,133 @@ int sdp_check_access(uint32_t handle, bdaddr_t *device)
 	return 1;
 }
 
+/* Size of the header of the attribute list sequence */
+static uint32_t seq_header_len(const sdp_buf_t *buf)
+{
+	if (!buf->data_size)
+		return 0;
+
+	switch (buf->data[0]) {
+	case SDP_SEQ8:
+		return sizeof(uint8_t) + sizeof(uint8_t);
+	case SDP_SEQ16:
+		return sizeof(uint8_t) + sizeof(uint16_t);
+	default:
+		return sizeof(uint8_t) + sizeof(uint32_t);
+	}
+}
+
+static sdp_record_pdu_t *record_pdu_new(const sdp_record_t *rec)
+{
+	sdp_record_pdu_t *rpdu;
+	sdp_buf_t *buf;
+	sdp_list_t *l;
+	uint32_t hdr;
+	int i;
+
+	rpdu = calloc(1, sizeof(*rpdu));
+	if (!rpdu)
+		return NULL;
+
+	rpdu->refcount = 1;
+
+	if (!rec->attrlist)
+		return rpdu;
+
+	rpdu->attrs = calloc(sdp_list_len(rec->attrlist), sizeof(*rpdu->attrs));
+	if (!rpdu->attrs)
+		goto failed;
+
+	/* Responses are limited to USHRT_MAX so larger records can't be sent */
+	buf = &rpdu->buf;
+	buf->data = calloc(1, USHRT_MAX);
+	if (!buf->data)
+		goto failed;
+
+	buf->buf_size = USHRT_MAX;
+
+	/*
+	 * Attributes are appended in the order of the attribute list of the
+	 * record, so sorted by id. The sequence header grows as the list
+	 * gets longer, so offsets are first relative to the end of it.
+	 */
+	for (l = rec->attrlist; l; l = l->next) {
+		sdp_data_t *d = l->data;
+		sdp_attr_slice_t *attr = &rpdu->attrs[rpdu->count];
+		uint32_t size = buf->data_size;
+
+		hdr = seq_header_len(buf);
+
+		sdp_append_to_pdu(buf, d);
+		if (buf->data_size == size)
+			goto failed;
+
+		attr->id = d->attrId;
+		attr->offset = size - hdr;
+		attr->len = buf->data_size - seq_header_len(buf) - attr->offset;
+
+		rpdu->count++;
+	}
+
+	hdr = seq_header_len(buf);
+
+	for (i = 0; i < rpdu->count; i++)
+		rpdu->attrs[i].offset += hdr;
+
+	buf->data = realloc(buf->data, buf->data_size);
+	buf->buf_size = buf->data_size;
+
+	return rpdu;
+
+failed:
+	error("Unable to serialize record 0x%x", rec->handle);
+	sdp_record_pdu_unref(rpdu);
+	return NULL;
+}
+
+sdp_record_pdu_t *sdp_record_get_pdu(const sdp_record_t *rec)
+{
+	sdp_record_pdu_t *rpdu;
+
+	rpdu = hashmap_lookup(pdu_map, rec->handle);
+	if (rpdu)
+		return rpdu;
+
+	rpdu = record_pdu_new(rec);
+	if (!rpdu)
+		return NULL;
+
+	if (!pdu_map)
+		pdu_map = hashmap_new();
+
+	hashmap_insert(pdu_map, rec->handle, rpdu);
+
+	return rpdu;
+}
+
+sdp_record_pdu_t *sdp_record_pdu_ref(sdp_record_pdu_t *rpdu)
+{
+	if (!rpdu)
+		return NULL;
+
+	rpdu->refcount++;
+
+	return rpdu;
+}
+
+void sdp_record_pdu_unref(sdp_record_pdu_t *rpdu)
+{
+	if (!rpdu)
+		return;
+
+	if (--rpdu->refcount > 0)
+		return;
+
+	free(rpdu->buf.data);
+	free(rpdu->attrs);
+	free(rpdu);
+}
+
 uint32_t sdp_next_handle(void)
 {
 	uint32_t handle = 0x10000;
@@ -49,6 +49,7 @@ struct sdp_cont_info {
 	uint8_t opcode;
 	uint32_t timestamp;
 	sdp_buf_t buf;
+	sdp_record_pdu_t *pdu;
 };
 
 static sdp_list_t *cstates;
@@ -68,7 +69,12 @@ static void sdp_cont_info_free(sdp_cont_info_t *cinfo)
 		return;
 
 	cstates = sdp_list_remove(cstates, cinfo);
-	free(cinfo->buf.data);
+
+	if (cinfo->pdu)
+		sdp_record_pdu_unref(cinfo->pdu);
+	else
+		free(cinfo->buf.data);
+
 	free(cinfo);
 }
 
@@ -97,16 +103,30 @@ static sdp_cont_info_t *sdp_get_cont_info(sdp_req_t *req,
 	return NULL;
 }
 
-static uint32_t sdp_cstate_alloc_buf(sdp_req_t *req, sdp_buf_t *buf)
+/*
+ * Keep the response for the continuation requests. Responses holding the
+ * whole attribute list of a record are served from the serialized record
+ * instead of a copy.
+ */
+static uint32_t sdp_cstate_alloc_buf(sdp_req_t *req, sdp_buf_t *buf,
+						sdp_record_pdu_t *rpdu)
 {
 	sdp_cont_info_t *cinfo = malloc(sizeof(sdp_cont_info_t));
-	uint8_t *data = malloc(buf->data_size);
 
-	memcpy(data, buf->data, buf->data_size);
 	memset(cinfo, 0, sizeof(sdp_cont_info_t));
-	cinfo->buf.data = data;
-	cinfo->buf.data_size = buf->data_size;
-	cinfo->buf.buf_size = buf->data_size;
+
+	if (rpdu) {
+		cinfo->pdu = sdp_record_pdu_ref(rpdu);
+		cinfo->buf = rpdu->buf;
+	} else {
+		uint8_t *data = malloc(buf->data_size);
+
+		memcpy(data, buf->data, buf->data_size);
+		cinfo->buf.data = data;
+		cinfo->buf.data_size = buf->data_size;
+		cinfo->buf.buf_size = buf->data_size;
+	}
+
 	cinfo->timestamp = sdp_get_time();
 	cinfo->sock = req->sock;
 	cinfo->opcode = req->opcode;
@@ -460,8 +480,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->data_size += sizeof(uint16_t);
 
 	if (cstate == NULL) {
-		/* for every record in the DB, do a pattern search */
-		sdp_list_t *list = sdp_get_record_list();
+		/* for every candidate record, do a pattern search */
+		sdp_list_t *list = sdp_get_record_list_by_uuid(pattern);
 
 		handleSize = 0;
 		for (; list && rsp_count < expected; list = list->next) {
@@ -486,7 +506,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 		if (rsp_count > actual) {
 			/* cache the rsp and generate a continuation state */
-			cStateId = sdp_cstate_alloc_buf(req, buf);
+			cStateId = sdp_cstate_alloc_buf(req, buf, NULL);
 			/*
 			 * subtract handleSize since we now send only
 			 * a subset of handles
@@ -586,16 +606,52 @@ done:
 	return status;
 }
 
+/*
+ * Append the attributes of the serialized record with ids between low
+ * and high. The attributes are sorted by id so they are appended as one
+ * slice of the serialized record.
+ */
+static void append_attr_range(sdp_record_pdu_t *rpdu, uint16_t low,
+						uint16_t high, sdp_buf_t *buf)
+{
+	int first = 0, last = rpdu->count;
+	uint32_t start, end;
+
+	while (first < last) {
+		int mid = (first + last) / 2;
+
+		if (rpdu->attrs[mid].id < low)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	for (last = first; last < rpdu->count; last++) {
+		if (rpdu->attrs[last].id > high)
+			break;
+	}
+
+	if (first == last)
+		return;
+
+	start = rpdu->attrs[first].offset;
+	end = rpdu->attrs[last - 1].offset + rpdu->attrs[last - 1].len;
+
+	sdp_append_to_buf(buf, rpdu->buf.data + start, end - start);
+}
+
 /*
  * Extract attribute identifiers from the request PDU.
  * Clients could request a subset of attributes (by id)
  * from a service record, instead of the whole set. The
  * requested identifiers are present in the PDU form of
- * the request
+ * the request. If the response is the whole serialized
+ * record, it is returned in whole.
  */
-static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
+static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf,
+						sdp_record_pdu_t **whole)
 {
-	sdp_buf_t pdu;
+	sdp_record_pdu_t *rpdu;
 
 	if (!rec)
 		return SDP_INVALID_RECORD_HANDLE;
@@ -607,7 +663,9 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 
 	SDPDBG("Entries in attr seq : %d", sdp_list_len(seq));
 
-	sdp_gen_record_pdu(rec, &pdu);
+	rpdu = sdp_record_get_pdu(rec);
+	if (!rpdu)
+		return 0;
 
 	for (; seq; seq = seq->next) {
 		struct attrid *aid = seq->data;
@@ -615,46 +673,37 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 		SDPDBG("AttrDataType : %d", aid->dtd);
 
 		if (aid->dtd == SDP_UINT16) {
-			uint16_t attr = aid->uint16;
-			sdp_data_t *a = sdp_data_get(rec, attr);
-			if (a)
-				sdp_append_to_pdu(buf, a);
+			append_attr_range(rpdu, aid->uint16, aid->uint16, buf);
 		} else if (aid->dtd == SDP_UINT32) {
 			uint32_t range = aid->uint32;
-			uint16_t attr;
 			uint16_t low = (0xffff0000 & range) >> 16;
 			uint16_t high = 0x0000ffff & range;
-			sdp_data_t *data;
 
 			SDPDBG("attr range : 0x%x", range);
 			SDPDBG("Low id : 0x%x", low);
 			SDPDBG("High id : 0x%x", high);
 
-			if (low == 0x0000 && high == 0xffff && pdu.data_size <= buf->buf_size) {
+			if (low == 0x0000 && high == 0xffff &&
+					rpdu->buf.data_size <= buf->buf_size) {
 				/* copy it */
-				memcpy(buf->data, pdu.data, pdu.data_size);
-				buf->data_size = pdu.data_size;
+				memcpy(buf->data, rpdu->buf.data,
+							rpdu->buf.data_size);
+				buf->data_size = rpdu->buf.data_size;
+				if (whole)
+					*whole = rpdu;
 				break;
 			}
+
 			/* (else) sub-range of attributes */
-			for (attr = low; attr < high; attr++) {
-				data = sdp_data_get(rec, attr);
-				if (data)
-					sdp_append_to_pdu(buf, data);
-			}
-			data = sdp_data_get(rec, high);
-			if (data)
-				sdp_append_to_pdu(buf, data);
+			append_attr_range(rpdu, low > high ? high : low, high,
+									buf);
 		} else {
 			error("Unexpected data type : 0x%x", aid->dtd);
 			error("Expect uint16_t or uint32_t");
-			free(pdu.data);
 			return SDP_INVALID_SYNTAX;
 		}
 	}
 
-	free(pdu.data);
-
 	return 0;
 }
 
@@ -793,12 +842,15 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 		}
 	} else {
 		sdp_record_t *rec = sdp_record_find(handle);
-		status = extract_attrs(rec, seq, buf);
+		sdp_record_pdu_t *rpdu = NULL;
+
+		status = extract_attrs(rec, seq, buf, &rpdu);
 		if (buf->data_size > max_rsp_size) {
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(req, buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req, buf,
+									rpdu);
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -907,7 +959,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 		goto done;
 	}
 
-	svcList = sdp_get_record_list();
+	svcList = sdp_get_record_list_by_uuid(pattern);
 
 	tmpbuf.data = malloc(USHRT_MAX);
 	tmpbuf.data_size = 0;
@@ -932,7 +984,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
 					sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
-				status = extract_attrs(rec, seq, &tmpbuf);
+				status = extract_attrs(rec, seq, &tmpbuf, NULL);
 
 				SDPDBG("Response count : %d", rsp_count);
 				SDPDBG("Local PDU size : %d", tmpbuf.data_size);
@@ -956,7 +1008,8 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(req, buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req, buf,
+									NULL);
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
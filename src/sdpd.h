@@ -56,7 +56,27 @@ sdp_record_t *sdp_record_find(uint32_t handle);
 void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec);
 int sdp_record_remove(uint32_t handle);
 sdp_list_t *sdp_get_record_list(void);
+sdp_list_t *sdp_get_record_list_by_uuid(sdp_list_t *search);
+void sdp_svcdb_invalidate(void);
 int sdp_check_access(uint32_t handle, bdaddr_t *device);
+
+typedef struct {
+	uint16_t id;
+	uint32_t offset;
+	uint32_t len;
+} sdp_attr_slice_t;
+
+/* Serialized attribute list of a record, indexed by attribute */
+typedef struct {
+	sdp_buf_t buf;
+	int count;
+	sdp_attr_slice_t *attrs;
+	int refcount;
+} sdp_record_pdu_t;
+
+sdp_record_pdu_t *sdp_record_get_pdu(const sdp_record_t *rec);
+sdp_record_pdu_t *sdp_record_pdu_ref(sdp_record_pdu_t *rpdu);
+void sdp_record_pdu_unref(sdp_record_pdu_t *rpdu);
 uint32_t sdp_next_handle(void);
 
 uint32_t sdp_get_time(void);
@@ -29,6 +29,33 @@ struct bt_ad {
 	struct queue *solicit_uuids;
 	struct queue *service_data;
 	struct queue *data;
+	uint8_t cache[BT_AD_MAX_DATA_LEN];	/* Last serialized form */
+	uint8_t cache_len;
+	bool cache_valid;
+};
+
+struct ad_matcher_entry {
+	const uint8_t *data;
+	void *user_data;
+};
+
+/* Patterns of the same type sharing offset and length, sorted by content */
+struct ad_matcher_group {
+	uint8_t offset;
+	uint8_t len;
+	struct ad_matcher_entry *entries;
+	unsigned int num_entries;
+	unsigned int max_entries;
+};
+
+struct bt_ad_matcher {
+	struct queue *groups[UINT8_MAX + 1];	/* Indexed by AD type */
+};
+
+struct ad_matcher_info {
+	struct bt_ad_matcher *matcher;
+	bt_ad_func_t func;
+	void *user_data;
 };
 
 struct pattern_match_info {
@@ -203,9 +230,12 @@ static bool ad_replace_data(struct bt_ad *ad, uint8_t type, const void *data,
 		new_data->data = realloc(new_data->data, len);
 		memcpy(new_data->data, data, len);
 		new_data->len = len;
+		ad->cache_valid = false;
 		return true;
 	}
 
+	ad->cache_valid = false;
+
 	new_data = new0(struct bt_ad_data, 1);
 	new_data->type = type;
 	new_data->data = malloc(len);
@@ -225,134 +255,12 @@ static bool ad_replace_data(struct bt_ad *ad, uint8_t type, const void *data,
 	return false;
 }
 
-static size_t uuid_list_length(struct queue *uuid_queue)
+static bool ad_fits(uint8_t pos, size_t len)
 {
-	bool uuid16_included = false;
-	bool uuid32_included = false;
-	bool uuid128_included = false;
-	size_t length = 0;
-	const struct queue_entry *entry;
-
-	entry = queue_get_entries(uuid_queue);
-
-	while (entry) {
-		bt_uuid_t *uuid = entry->data;
-
-		length += bt_uuid_len(uuid);
-
-		if (uuid->type == BT_UUID16)
-			uuid16_included = true;
-		else if (uuid->type == BT_UUID32)
-			uuid32_included = true;
-		else
-			uuid128_included = true;
-
-		entry = entry->next;
-	}
-
-	if (uuid16_included)
-		length += 2;
-
-	if (uuid32_included)
-		length += 2;
-
-	if (uuid128_included)
-		length += 2;
-
-	return length;
+	return len <= (size_t) (BT_AD_MAX_DATA_LEN - pos);
 }
 
-static size_t mfg_data_length(struct queue *manuf_data)
-{
-	size_t length = 0;
-	const struct queue_entry *entry;
-
-	entry = queue_get_entries(manuf_data);
-
-	while (entry) {
-		struct bt_ad_manufacturer_data *data = entry->data;
-
-		length += 2 + sizeof(uint16_t) + data->len;
-
-		entry = entry->next;
-	}
-
-	return length;
-}
-
-static size_t uuid_data_length(struct queue *uuid_data)
-{
-	size_t length = 0;
-	const struct queue_entry *entry;
-
-	entry = queue_get_entries(uuid_data);
-
-	while (entry) {
-		struct bt_ad_service_data *data = entry->data;
-
-		length += 2 + bt_uuid_len(&data->uuid) + data->len;
-
-		entry = entry->next;
-	}
-
-	return length;
-}
-
-static size_t name_length(const char *name, size_t *pos)
-{
-	size_t len;
-
-	if (!name)
-		return 0;
-
-	len = 2 + strlen(name);
-
-	if (len > BT_AD_MAX_DATA_LEN - *pos)
-		len = BT_AD_MAX_DATA_LEN - *pos;
-
-	return len;
-}
-
-static size_t data_length(struct queue *queue)
-{
-	size_t length = 0;
-	const struct queue_entry *entry;
-
-	entry = queue_get_entries(queue);
-
-	while (entry) {
-		struct bt_ad_data *data = entry->data;
-
-		length += 1 + 1 + data->len;
-
-		entry = entry->next;
-	}
-
-	return length;
-}
-
-static size_t calculate_length(struct bt_ad *ad)
-{
-	size_t length = 0;
-
-	length += uuid_list_length(ad->service_uuids);
-
-	length += uuid_list_length(ad->solicit_uuids);
-
-	length += mfg_data_length(ad->manufacturer_data);
-
-	length += uuid_data_length(ad->service_data);
-
-	length += name_length(ad->name, &length);
-
-	length += ad->appearance != UINT16_MAX ? 4 : 0;
-
-	length += data_length(ad->data);
-
-	return length;
-}
-
-static void serialize_uuids(struct queue *uuids, uint8_t uuid_type,
+static bool serialize_uuids(struct queue *uuids, uint8_t uuid_type,
 						uint8_t ad_type, uint8_t *buf,
 						uint8_t *pos)
 {
@@ -364,6 +272,9 @@ static void serialize_uuids(struct queue *uuids, uint8_t uuid_type,
 		bt_uuid_t *uuid = entry->data;
 
 		if (uuid->type == uuid_type) {
+			if (!ad_fits(*pos, bt_uuid_len(uuid) + (added ? 0 : 2)))
+				return false;
+
 			if (!added) {
 				length_pos = (*pos)++;
 				buf[(*pos)++] = ad_type;
@@ -383,29 +294,27 @@ static void serialize_uuids(struct queue *uuids, uint8_t uuid_type,
 
 	if (added)
 		buf[length_pos] = *pos - length_pos - 1;
+
+	return true;
 }
 
-static void serialize_service_uuids(struct queue *uuids, uint8_t *buf,
+static bool serialize_service_uuids(struct queue *uuids, uint8_t *buf,
 								uint8_t *pos)
 {
-	serialize_uuids(uuids, BT_UUID16, BT_AD_UUID16_ALL, buf, pos);
-
-	serialize_uuids(uuids, BT_UUID32, BT_AD_UUID32_ALL, buf, pos);
-
-	serialize_uuids(uuids, BT_UUID128, BT_AD_UUID128_ALL, buf, pos);
+	return serialize_uuids(uuids, BT_UUID16, BT_AD_UUID16_ALL, buf, pos) &&
+		serialize_uuids(uuids, BT_UUID32, BT_AD_UUID32_ALL, buf, pos) &&
+		serialize_uuids(uuids, BT_UUID128, BT_AD_UUID128_ALL, buf, pos);
 }
 
-static void serialize_solicit_uuids(struct queue *uuids, uint8_t *buf,
+static bool serialize_solicit_uuids(struct queue *uuids, uint8_t *buf,
 								uint8_t *pos)
 {
-	serialize_uuids(uuids, BT_UUID16, BT_AD_SOLICIT16, buf, pos);
-
-	serialize_uuids(uuids, BT_UUID32, BT_AD_SOLICIT32, buf, pos);
-
-	serialize_uuids(uuids, BT_UUID128, BT_AD_SOLICIT128, buf, pos);
+	return serialize_uuids(uuids, BT_UUID16, BT_AD_SOLICIT16, buf, pos) &&
+		serialize_uuids(uuids, BT_UUID32, BT_AD_SOLICIT32, buf, pos) &&
+		serialize_uuids(uuids, BT_UUID128, BT_AD_SOLICIT128, buf, pos);
 }
 
-static void serialize_manuf_data(struct queue *manuf_data, uint8_t *buf,
+static bool serialize_manuf_data(struct queue *manuf_data, uint8_t *buf,
 								uint8_t *pos)
 {
 	const struct queue_entry *entry = queue_get_entries(manuf_data);
@@ -413,6 +322,9 @@ static void serialize_manuf_data(struct queue *manuf_data, uint8_t *buf,
 	while (entry) {
 		struct bt_ad_manufacturer_data *data = entry->data;
 
+		if (!ad_fits(*pos, 2 + sizeof(uint16_t) + data->len))
+			return false;
+
 		buf[(*pos)++] = data->len + 2 + 1;
 
 		buf[(*pos)++] = BT_AD_MANUFACTURER_DATA;
@@ -427,9 +339,11 @@ static void serialize_manuf_data(struct queue *manuf_data, uint8_t *buf,
 
 		entry = entry->next;
 	}
+
+	return true;
 }
 
-static void serialize_service_data(struct queue *service_data, uint8_t *buf,
+static bool serialize_service_data(struct queue *service_data, uint8_t *buf,
 								uint8_t *pos)
 {
 	const struct queue_entry *entry = queue_get_entries(service_data);
@@ -438,6 +352,9 @@ static void serialize_service_data(struct queue *service_data, uint8_t *buf,
 		struct bt_ad_service_data *data = entry->data;
 		int uuid_len = bt_uuid_len(&data->uuid);
 
+		if (!ad_fits(*pos, 2 + uuid_len + data->len))
+			return false;
+
 		buf[(*pos)++] =  uuid_len + data->len + 1;
 
 		switch (uuid_len) {
@@ -465,15 +382,20 @@ static void serialize_service_data(struct queue *service_data, uint8_t *buf,
 
 		entry = entry->next;
 	}
+
+	return true;
 }
 
-static void serialize_name(const char *name, uint8_t *buf, uint8_t *pos)
+static bool serialize_name(const char *name, uint8_t *buf, uint8_t *pos)
 {
 	int len;
 	uint8_t type = BT_AD_NAME_COMPLETE;
 
 	if (!name)
-		return;
+		return true;
+
+	if (!ad_fits(*pos, 2))
+		return false;
 
 	len = strlen(name);
 	if (len > BT_AD_MAX_DATA_LEN - (*pos + 2)) {
@@ -486,27 +408,37 @@ static void serialize_name(const char *name, uint8_t *buf, uint8_t *pos)
 
 	memcpy(buf + *pos, name, len);
 	*pos += len;
+
+	return true;
 }
 
-static void serialize_appearance(uint16_t value, uint8_t *buf, uint8_t *pos)
+static bool serialize_appearance(uint16_t value, uint8_t *buf, uint8_t *pos)
 {
 	if (value == UINT16_MAX)
-		return;
+		return true;
+
+	if (!ad_fits(*pos, 2 + sizeof(value)))
+		return false;
 
 	buf[(*pos)++] = sizeof(value) + 1;
 	buf[(*pos)++] = BT_AD_GAP_APPEARANCE;
 
 	bt_put_le16(value, buf + (*pos));
 	*pos += 2;
+
+	return true;
 }
 
-static void serialize_data(struct queue *queue, uint8_t *buf, uint8_t *pos)
+static bool serialize_data(struct queue *queue, uint8_t *buf, uint8_t *pos)
 {
 	const struct queue_entry *entry = queue_get_entries(queue);
 
 	while (entry) {
 		struct bt_ad_data *data = entry->data;
 
+		if (!ad_fits(*pos, 2 + data->len))
+			return false;
+
 		buf[(*pos)++] = data->len + 1;
 		buf[(*pos)++] = data->type;
 
@@ -516,38 +448,51 @@ static void serialize_data(struct queue *queue, uint8_t *buf, uint8_t *pos)
 
 		entry = entry->next;
 	}
+
+	return true;
+}
+
+/* Serialize in a single bounded pass into the cache, any field that does
+ * not fit fails the whole advertising data like before.
+ */
+static bool ad_serialize(struct bt_ad *ad)
+{
+	uint8_t pos = 0;
+
+	if (!serialize_service_uuids(ad->service_uuids, ad->cache, &pos) ||
+		!serialize_solicit_uuids(ad->solicit_uuids, ad->cache, &pos) ||
+		!serialize_manuf_data(ad->manufacturer_data, ad->cache, &pos) ||
+		!serialize_service_data(ad->service_data, ad->cache, &pos) ||
+		!serialize_name(ad->name, ad->cache, &pos) ||
+		!serialize_appearance(ad->appearance, ad->cache, &pos) ||
+		!serialize_data(ad->data, ad->cache, &pos))
+		return false;
+
+	ad->cache_len = pos;
+	ad->cache_valid = true;
+
+	return true;
 }
 
 uint8_t *bt_ad_generate(struct bt_ad *ad, size_t *length)
 {
 	uint8_t *adv_data;
-	uint8_t pos = 0;
 
 	if (!ad)
 		return NULL;
 
-	*length = calculate_length(ad);
-
-	if (*length > BT_AD_MAX_DATA_LEN)
+	if (!ad->cache_valid && !ad_serialize(ad)) {
+		*length = 0;
 		return NULL;
+	}
+
+	*length = ad->cache_len;
 
 	adv_data = malloc0(*length);
 	if (!adv_data)
 		return NULL;
 
-	serialize_service_uuids(ad->service_uuids, adv_data, &pos);
-
-	serialize_solicit_uuids(ad->solicit_uuids, adv_data, &pos);
-
-	serialize_manuf_data(ad->manufacturer_data, adv_data, &pos);
-
-	serialize_service_data(ad->service_data, adv_data, &pos);
-
-	serialize_name(ad->name, adv_data, &pos);
-
-	serialize_appearance(ad->appearance, adv_data, &pos);
-
-	serialize_data(ad->data, adv_data, &pos);
+	memcpy(adv_data, ad->cache, *length);
 
 	return adv_data;
 }
@@ -618,6 +563,8 @@ bool bt_ad_add_service_uuid(struct bt_ad *ad, const bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	return queue_add_uuid(ad->service_uuids, uuid);
 }
 
@@ -626,6 +573,8 @@ bool bt_ad_remove_service_uuid(struct bt_ad *ad, bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	return queue_remove_uuid(ad->service_uuids, uuid);
 }
 
@@ -634,6 +583,8 @@ void bt_ad_clear_service_uuid(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	queue_remove_all(ad->service_uuids, NULL, NULL, free);
 }
 
@@ -664,9 +615,12 @@ bool bt_ad_add_manufacturer_data(struct bt_ad *ad, uint16_t manufacturer_id,
 		new_data->data = realloc(new_data->data, len);
 		memcpy(new_data->data, data, len);
 		new_data->len = len;
+		ad->cache_valid = false;
 		return true;
 	}
 
+	ad->cache_valid = false;
+
 	new_data = new0(struct bt_ad_manufacturer_data, 1);
 	new_data->manufacturer_id = manufacturer_id;
 
@@ -730,6 +684,8 @@ bool bt_ad_remove_manufacturer_data(struct bt_ad *ad, uint16_t manufacturer_id)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	data = queue_remove_if(ad->manufacturer_data, manuf_match,
 						UINT_TO_PTR(manufacturer_id));
 
@@ -746,6 +702,8 @@ void bt_ad_clear_manufacturer_data(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	queue_remove_all(ad->manufacturer_data, NULL, NULL, manuf_destroy);
 }
 
@@ -754,6 +712,8 @@ bool bt_ad_add_solicit_uuid(struct bt_ad *ad, const bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	return queue_add_uuid(ad->solicit_uuids, uuid);
 }
 
@@ -762,6 +722,8 @@ bool bt_ad_remove_solicit_uuid(struct bt_ad *ad, bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	return queue_remove_uuid(ad->solicit_uuids, uuid);
 }
 
@@ -770,6 +732,8 @@ void bt_ad_clear_solicit_uuid(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	queue_remove_all(ad->solicit_uuids, NULL, NULL, free);
 }
 
@@ -800,9 +764,12 @@ bool bt_ad_add_service_data(struct bt_ad *ad, const bt_uuid_t *uuid, void *data,
 		new_data->data = realloc(new_data->data, len);
 		memcpy(new_data->data, data, len);
 		new_data->len = len;
+		ad->cache_valid = false;
 		return true;
 	}
 
+	ad->cache_valid = false;
+
 	new_data = new0(struct bt_ad_service_data, 1);
 
 	new_data->uuid = *uuid;
@@ -867,6 +834,8 @@ bool bt_ad_remove_service_data(struct bt_ad *ad, bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	data = queue_remove_if(ad->service_data, uuid_data_match, uuid);
 
 	if (!data)
@@ -882,6 +851,8 @@ void bt_ad_clear_service_data(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	queue_remove_all(ad->service_data, NULL, NULL, uuid_destroy);
 }
 
@@ -890,9 +861,13 @@ bool bt_ad_add_name(struct bt_ad *ad, const char *name)
 	if (!ad)
 		return false;
 
+	if (ad->name && !strcmp(ad->name, name))
+		return true;
+
 	free(ad->name);
 
 	ad->name = strdup(name);
+	ad->cache_valid = false;
 
 	return true;
 }
@@ -902,6 +877,8 @@ void bt_ad_clear_name(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	free(ad->name);
 	ad->name = NULL;
 }
@@ -911,7 +888,10 @@ bool bt_ad_add_appearance(struct bt_ad *ad, uint16_t appearance)
 	if (!ad)
 		return false;
 
-	ad->appearance = appearance;
+	if (ad->appearance != appearance) {
+		ad->appearance = appearance;
+		ad->cache_valid = false;
+	}
 
 	return true;
 }
@@ -921,6 +901,8 @@ void bt_ad_clear_appearance(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	ad->appearance = UINT16_MAX;
 }
 
@@ -955,6 +937,8 @@ void bt_ad_clear_flags(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	queue_remove_all(ad->data, data_type_match, UINT_TO_PTR(BT_AD_FLAGS),
 							data_destroy);
 }
@@ -1060,6 +1044,8 @@ bool bt_ad_remove_data(struct bt_ad *ad, uint8_t type)
 	if (!ad)
 		return false;
 
+	ad->cache_valid = false;
+
 	data = queue_remove_if(ad->data, data_type_match, UINT_TO_PTR(type));
 	if (!data)
 		return false;
@@ -1074,6 +1060,8 @@ void bt_ad_clear_data(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->cache_valid = false;
+
 	queue_remove_all(ad->data, NULL, NULL, data_destroy);
 }
 
@@ -1160,3 +1148,203 @@ struct bt_ad_pattern *bt_ad_pattern_match(struct bt_ad *ad,
 
 	return info.matched_pattern;
 }
+
+struct bt_ad_matcher *bt_ad_matcher_new(void)
+{
+	return new0(struct bt_ad_matcher, 1);
+}
+
+static void matcher_group_free(void *data)
+{
+	struct ad_matcher_group *group = data;
+
+	free(group->entries);
+	free(group);
+}
+
+void bt_ad_matcher_free(struct bt_ad_matcher *matcher)
+{
+	unsigned int i;
+
+	if (!matcher)
+		return;
+
+	for (i = 0; i <= UINT8_MAX; i++)
+		queue_destroy(matcher->groups[i], matcher_group_free);
+
+	free(matcher);
+}
+
+static bool matcher_group_match(const void *data, const void *match_data)
+{
+	const struct ad_matcher_group *group = data;
+	const struct bt_ad_pattern *pattern = match_data;
+
+	return group->offset == pattern->offset && group->len == pattern->len;
+}
+
+/* Returns the index of the first entry not lower than |data| */
+static unsigned int matcher_group_lower_bound(struct ad_matcher_group *group,
+							const uint8_t *data)
+{
+	unsigned int low = 0, high = group->num_entries;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if (memcmp(group->entries[mid].data, data, group->len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static void matcher_add_pattern(void *data, void *user_data)
+{
+	struct bt_ad_pattern *pattern = data;
+	struct ad_matcher_info *info = user_data;
+	struct queue **groups = &info->matcher->groups[pattern->type];
+	struct ad_matcher_group *group;
+	unsigned int i;
+
+	if (!*groups)
+		*groups = queue_new();
+
+	group = queue_find(*groups, matcher_group_match, pattern);
+	if (!group) {
+		group = new0(struct ad_matcher_group, 1);
+		group->offset = pattern->offset;
+		group->len = pattern->len;
+		queue_push_tail(*groups, group);
+	}
+
+	if (group->num_entries == group->max_entries) {
+		group->max_entries = group->max_entries ?
+						group->max_entries * 2 : 4;
+		group->entries = realloc(group->entries, group->max_entries *
+						sizeof(*group->entries));
+	}
+
+	i = matcher_group_lower_bound(group, pattern->data);
+	memmove(&group->entries[i + 1], &group->entries[i],
+			(group->num_entries - i) * sizeof(*group->entries));
+	group->entries[i].data = pattern->data;
+	group->entries[i].user_data = info->user_data;
+	group->num_entries++;
+}
+
+/* Indexes |patterns| so that bt_ad_matcher_match() reports |user_data| when
+ * any of them matches. The patterns are not copied so they must remain valid
+ * until bt_ad_matcher_remove() is called with the same |user_data|.
+ */
+bool bt_ad_matcher_add(struct bt_ad_matcher *matcher, struct queue *patterns,
+							void *user_data)
+{
+	struct ad_matcher_info info;
+
+	if (!matcher || queue_isempty(patterns))
+		return false;
+
+	info.matcher = matcher;
+	info.user_data = user_data;
+
+	queue_foreach(patterns, matcher_add_pattern, &info);
+
+	return true;
+}
+
+static void matcher_group_remove(void *data, void *user_data)
+{
+	struct ad_matcher_group *group = data;
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < group->num_entries; i++) {
+		if (group->entries[i].user_data == user_data)
+			continue;
+
+		group->entries[j++] = group->entries[i];
+	}
+
+	group->num_entries = j;
+}
+
+static bool matcher_group_is_empty(const void *data, const void *match_data)
+{
+	const struct ad_matcher_group *group = data;
+
+	return !group->num_entries;
+}
+
+void bt_ad_matcher_remove(struct bt_ad_matcher *matcher, void *user_data)
+{
+	unsigned int i;
+
+	if (!matcher)
+		return;
+
+	for (i = 0; i <= UINT8_MAX; i++) {
+		if (!matcher->groups[i])
+			continue;
+
+		queue_foreach(matcher->groups[i], matcher_group_remove,
+								user_data);
+		queue_remove_all(matcher->groups[i], matcher_group_is_empty,
+						NULL, matcher_group_free);
+
+		if (queue_isempty(matcher->groups[i])) {
+			queue_destroy(matcher->groups[i], NULL);
+			matcher->groups[i] = NULL;
+		}
+	}
+}
+
+static void matcher_match_data(void *data, void *user_data)
+{
+	struct bt_ad_data *ad_data = data;
+	struct ad_matcher_info *info = user_data;
+	const struct queue_entry *entry;
+
+	entry = queue_get_entries(info->matcher->groups[ad_data->type]);
+
+	for (; entry; entry = entry->next) {
+		struct ad_matcher_group *group = entry->data;
+		const uint8_t *value;
+		unsigned int i;
+
+		if (ad_data->len < group->offset + group->len)
+			continue;
+
+		value = ad_data->data + group->offset;
+
+		for (i = matcher_group_lower_bound(group, value);
+				i < group->num_entries; i++) {
+			if (memcmp(group->entries[i].data, value, group->len))
+				break;
+
+			info->func(group->entries[i].user_data,
+							info->user_data);
+		}
+	}
+}
+
+/* Calls |func| with the user data of every pattern set that has a pattern
+ * matching |ad|. The cost depends on the number of distinct pattern offsets
+ * and lengths rather than on the number of patterns. |func| may be called
+ * more than once for the same set.
+ */
+void bt_ad_matcher_match(struct bt_ad_matcher *matcher, struct bt_ad *ad,
+					bt_ad_func_t func, void *user_data)
+{
+	struct ad_matcher_info info;
+
+	if (!matcher || !ad || !func)
+		return;
+
+	info.matcher = matcher;
+	info.func = func;
+	info.user_data = user_data;
+
+	bt_ad_foreach_data(ad, matcher_match_data, &info);
+}
@@ -0,0 +1,552 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define AES_X86_HW
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#define AES_ARM_HW
+#endif
+
+#include "src/shared/aes.h"
+
+/*
+ * The software path handles LTKs, IRKs and CSRKs, so the S-box is not a
+ * table lookup, whose cache footprint would depend on the secret bytes.
+ * Instead up to 32 bytes are bitsliced, with q[i] holding bit i of every
+ * byte, and run through the Boyar-Peralta circuit of 113 logic gates.
+ */
+static void sbox_bitsliced(uint32_t q[8])
+{
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	uint32_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	uint32_t y20, y21;
+	uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	uint32_t z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	uint32_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint32_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	uint32_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint32_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	uint32_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint32_t t60, t61, t62, t63, t64, t65, t66, t67;
+	uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* Top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* Inversion in GF(2^8) */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* Bottom linear transformation, including the affine constant */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+static void sub_bytes(uint8_t *b, size_t len)
+{
+	uint32_t q[8] = { 0 };
+	size_t i, j;
+
+	for (j = 0; j < len; j++) {
+		for (i = 0; i < 8; i++)
+			q[i] |= (uint32_t) ((b[j] >> i) & 1) << j;
+	}
+
+	sbox_bitsliced(q);
+
+	for (j = 0; j < len; j++) {
+		b[j] = 0;
+
+		for (i = 0; i < 8; i++)
+			b[j] |= ((q[i] >> j) & 1) << i;
+	}
+}
+
+static const uint8_t rcon[10] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+};
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return (x << 1) ^ (((x >> 7) & 1) * 0x1b);
+}
+
+#ifdef AES_X86_HW
+static bool hw_support(void)
+{
+	static int supported = -1;
+
+	if (supported < 0) {
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("aes") &&
+					__builtin_cpu_supports("sse2");
+	}
+
+	return supported;
+}
+
+__attribute__((target("aes,sse2")))
+static void hw_encrypt(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t out[16])
+{
+	__m128i s;
+	int r;
+
+	s = _mm_loadu_si128((const __m128i *) in);
+	s = _mm_xor_si128(s, _mm_load_si128((const __m128i *) aes->rk[0]));
+
+	for (r = 1; r < 10; r++)
+		s = _mm_aesenc_si128(s,
+				_mm_load_si128((const __m128i *) aes->rk[r]));
+
+	s = _mm_aesenclast_si128(s,
+				_mm_load_si128((const __m128i *) aes->rk[10]));
+
+	_mm_storeu_si128((__m128i *) out, s);
+}
+
+/* Interleave four independent keys to keep the AES units busy */
+__attribute__((target("aes,sse2")))
+static void hw_encrypt_x4(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t (*out)[16])
+{
+	__m128i p, s0, s1, s2, s3;
+	int r;
+
+	p = _mm_loadu_si128((const __m128i *) in);
+	s0 = _mm_xor_si128(p, _mm_load_si128((const __m128i *) aes[0].rk[0]));
+	s1 = _mm_xor_si128(p, _mm_load_si128((const __m128i *) aes[1].rk[0]));
+	s2 = _mm_xor_si128(p, _mm_load_si128((const __m128i *) aes[2].rk[0]));
+	s3 = _mm_xor_si128(p, _mm_load_si128((const __m128i *) aes[3].rk[0]));
+
+	for (r = 1; r < 10; r++) {
+		s0 = _mm_aesenc_si128(s0,
+			_mm_load_si128((const __m128i *) aes[0].rk[r]));
+		s1 = _mm_aesenc_si128(s1,
+			_mm_load_si128((const __m128i *) aes[1].rk[r]));
+		s2 = _mm_aesenc_si128(s2,
+			_mm_load_si128((const __m128i *) aes[2].rk[r]));
+		s3 = _mm_aesenc_si128(s3,
+			_mm_load_si128((const __m128i *) aes[3].rk[r]));
+	}
+
+	s0 = _mm_aesenclast_si128(s0,
+			_mm_load_si128((const __m128i *) aes[0].rk[10]));
+	s1 = _mm_aesenclast_si128(s1,
+			_mm_load_si128((const __m128i *) aes[1].rk[10]));
+	s2 = _mm_aesenclast_si128(s2,
+			_mm_load_si128((const __m128i *) aes[2].rk[10]));
+	s3 = _mm_aesenclast_si128(s3,
+			_mm_load_si128((const __m128i *) aes[3].rk[10]));
+
+	_mm_storeu_si128((__m128i *) out[0], s0);
+	_mm_storeu_si128((__m128i *) out[1], s1);
+	_mm_storeu_si128((__m128i *) out[2], s2);
+	_mm_storeu_si128((__m128i *) out[3], s3);
+}
+#elif defined(AES_ARM_HW)
+static bool hw_support(void)
+{
+	return true;
+}
+
+static void hw_encrypt(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t out[16])
+{
+	uint8x16_t s;
+	int r;
+
+	s = vld1q_u8(in);
+
+	for (r = 0; r < 9; r++)
+		s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(aes->rk[r])));
+
+	s = vaeseq_u8(s, vld1q_u8(aes->rk[9]));
+	s = veorq_u8(s, vld1q_u8(aes->rk[10]));
+
+	vst1q_u8(out, s);
+}
+
+static void hw_encrypt_x4(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t (*out)[16])
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		hw_encrypt(&aes[i], in, out[i]);
+}
+#else
+static bool hw_support(void)
+{
+	return false;
+}
+
+static void hw_encrypt(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t out[16])
+{
+}
+
+static void hw_encrypt_x4(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t (*out)[16])
+{
+}
+#endif
+
+bool bt_aes_hw_support(void)
+{
+	return hw_support();
+}
+
+void bt_aes_set_key(struct bt_aes *aes, const uint8_t key[16])
+{
+	uint8_t *rk = aes->rk[0];
+	uint8_t t[4], tmp;
+	int i;
+
+	memcpy(rk, key, 16);
+
+	for (i = 16; i < 176; i += 4) {
+		memcpy(t, &rk[i - 4], 4);
+
+		if (!(i % 16)) {
+			/* RotWord + SubWord + Rcon */
+			tmp = t[0];
+			t[0] = t[1];
+			t[1] = t[2];
+			t[2] = t[3];
+			t[3] = tmp;
+
+			sub_bytes(t, 4);
+			t[0] ^= rcon[i / 16 - 1];
+		}
+
+		rk[i + 0] = rk[i - 16] ^ t[0];
+		rk[i + 1] = rk[i - 15] ^ t[1];
+		rk[i + 2] = rk[i - 14] ^ t[2];
+		rk[i + 3] = rk[i - 13] ^ t[3];
+	}
+}
+
+static void add_round_key(uint8_t s[16], const uint8_t rk[16])
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+static void sub_shift_rows(uint8_t s[16])
+{
+	uint8_t t;
+
+	sub_bytes(s, 16);
+
+	t = s[1];
+	s[1] = s[5];
+	s[5] = s[9];
+	s[9] = s[13];
+	s[13] = t;
+
+	t = s[2];
+	s[2] = s[10];
+	s[10] = t;
+	t = s[6];
+	s[6] = s[14];
+	s[14] = t;
+
+	t = s[3];
+	s[3] = s[15];
+	s[15] = s[11];
+	s[11] = s[7];
+	s[7] = t;
+}
+
+static void mix_columns(uint8_t s[16])
+{
+	uint8_t a0, a1, a2, a3, all;
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		a0 = s[i];
+		a1 = s[i + 1];
+		a2 = s[i + 2];
+		a3 = s[i + 3];
+		all = a0 ^ a1 ^ a2 ^ a3;
+
+		s[i] ^= all ^ xtime(a0 ^ a1);
+		s[i + 1] ^= all ^ xtime(a1 ^ a2);
+		s[i + 2] ^= all ^ xtime(a2 ^ a3);
+		s[i + 3] ^= all ^ xtime(a3 ^ a0);
+	}
+}
+
+void bt_aes_encrypt(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t out[16])
+{
+	uint8_t s[16];
+	int r;
+
+	if (hw_support()) {
+		hw_encrypt(aes, in, out);
+		return;
+	}
+
+	memcpy(s, in, 16);
+	add_round_key(s, aes->rk[0]);
+
+	for (r = 1; r < 10; r++) {
+		sub_shift_rows(s);
+		mix_columns(s);
+		add_round_key(s, aes->rk[r]);
+	}
+
+	sub_shift_rows(s);
+	add_round_key(s, aes->rk[10]);
+
+	memcpy(out, s, 16);
+}
+
+void bt_aes_encrypt_multi(const struct bt_aes *aes, size_t num_keys,
+				const uint8_t in[16], uint8_t (*out)[16])
+{
+	size_t i = 0;
+
+	if (hw_support()) {
+		for (; i + 4 <= num_keys; i += 4)
+			hw_encrypt_x4(&aes[i], in, &out[i]);
+	}
+
+	for (; i < num_keys; i++)
+		bt_aes_encrypt(&aes[i], in, out[i]);
+}
+
+/* RFC 4493 subkey generation: left shift by one bit in GF(2^128) */
+static void cmac_subkey(const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t msb = in[0] >> 7;
+	int i;
+
+	for (i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+
+	/* Conditional reduction without branching on the secret bit */
+	out[15] = (in[15] << 1) ^ (-msb & 0x87);
+}
+
+void bt_aes_cmac_init(struct bt_aes_cmac *cmac, const uint8_t key[16])
+{
+	uint8_t l[16] = {};
+
+	bt_aes_set_key(&cmac->aes, key);
+	bt_aes_encrypt(&cmac->aes, l, l);
+
+	cmac_subkey(l, cmac->k1);
+	cmac_subkey(cmac->k1, cmac->k2);
+
+	memset(cmac->x, 0, 16);
+	cmac->len = 0;
+}
+
+void bt_aes_cmac_update(struct bt_aes_cmac *cmac, const void *data,
+								size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len) {
+		size_t n;
+
+		/*
+		 * Only process a full block when more data follows since the
+		 * last block needs to be combined with a subkey.
+		 */
+		if (cmac->len == 16) {
+			add_round_key(cmac->x, cmac->buf);
+			bt_aes_encrypt(&cmac->aes, cmac->x, cmac->x);
+			cmac->len = 0;
+		}
+
+		n = 16 - cmac->len;
+		if (n > len)
+			n = len;
+
+		memcpy(cmac->buf + cmac->len, p, n);
+		cmac->len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+void bt_aes_cmac_final(struct bt_aes_cmac *cmac, uint8_t mac[16])
+{
+	if (cmac->len == 16) {
+		add_round_key(cmac->buf, cmac->k1);
+	} else {
+		cmac->buf[cmac->len] = 0x80;
+		memset(cmac->buf + cmac->len + 1, 0, 15 - cmac->len);
+		add_round_key(cmac->buf, cmac->k2);
+	}
+
+	add_round_key(cmac->x, cmac->buf);
+	bt_aes_encrypt(&cmac->aes, cmac->x, mac);
+
+	memset(cmac, 0, sizeof(*cmac));
+}
+
+void bt_aes_cmac(const uint8_t key[16], const struct iovec *iov,
+					size_t iov_len, uint8_t mac[16])
+{
+	struct bt_aes_cmac cmac;
+	size_t i;
+
+	bt_aes_cmac_init(&cmac, key);
+
+	for (i = 0; i < iov_len; i++)
+		bt_aes_cmac_update(&cmac, iov[i].iov_base, iov[i].iov_len);
+
+	bt_aes_cmac_final(&cmac, mac);
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+struct bt_aes {
+	uint8_t rk[11][16] __attribute__((aligned(16)));
+};
+
+struct bt_aes_cmac {
+	struct bt_aes aes;
+	uint8_t k1[16];
+	uint8_t k2[16];
+	uint8_t x[16];
+	uint8_t buf[16];
+	uint8_t len;
+};
+
+bool bt_aes_hw_support(void);
+
+void bt_aes_set_key(struct bt_aes *aes, const uint8_t key[16]);
+void bt_aes_encrypt(const struct bt_aes *aes, const uint8_t in[16],
+							uint8_t out[16]);
+void bt_aes_encrypt_multi(const struct bt_aes *aes, size_t num_keys,
+				const uint8_t in[16], uint8_t (*out)[16]);
+
+void bt_aes_cmac_init(struct bt_aes_cmac *cmac, const uint8_t key[16]);
+void bt_aes_cmac_update(struct bt_aes_cmac *cmac, const void *data,
+								size_t len);
+void bt_aes_cmac_final(struct bt_aes_cmac *cmac, uint8_t mac[16]);
+
+void bt_aes_cmac(const uint8_t key[16], const struct iovec *iov,
+					size_t iov_len, uint8_t mac[16]);
@@ -12,14 +12,19 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/util.h"
 #include "src/shared/timeout.h"
+#include "src/shared/metrics.h"
 #include "lib/bluetooth.h"
 #include "lib/l2cap.h"
 #include "lib/uuid.h"
@@ -30,6 +35,8 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_WRITE_BATCH_DEFAULT		8
+#define ATT_WRITE_BATCH_MAX		32
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
@@ -53,6 +60,9 @@ struct bt_att_chan {
 
 	uint8_t *buf;
 	uint16_t mtu;
+
+	int sndbuf;			/* Socket send buffer, 0 if unknown */
+	size_t load;			/* Bytes waiting to be transmitted */
 };
 
 struct bt_att {
@@ -61,10 +71,14 @@ struct bt_att {
 	struct queue *chans;
 	uint8_t enc_size;
 	uint16_t mtu;			/* Biggest possible MTU */
+	uint8_t write_batch;		/* PDUs written per wakeup */
+	unsigned int pdu_count;		/* PDUs sent and received */
 
 	struct queue *notify_list;	/* List of registered callbacks */
+	struct hashmap *notify_map;	/* Registered callbacks by id */
 	struct queue *disconn_list;	/* List of disconnect handlers */
 	struct queue *exchange_list;	/* List of MTU changed handlers */
+	struct queue *writable_list;	/* Waiting for write queue space */
 
 	unsigned int next_send_id;	/* IDs for "send" ops */
 	unsigned int next_reg_id;	/* IDs for registered callbacks */
@@ -78,6 +92,10 @@ struct bt_att {
 	bt_att_destroy_func_t timeout_destroy;
 	void *timeout_data;
 
+	bt_att_busy_func_t busy_callback;
+	bt_att_destroy_func_t busy_destroy;
+	void *busy_data;
+
 	uint8_t debug_level;
 	bt_att_debug_func_t debug_callback;
 	bt_att_destroy_func_t debug_destroy;
@@ -87,6 +105,11 @@ struct bt_att {
 
 	struct sign_info *local_sign;
 	struct sign_info *remote_sign;
+
+	struct metric *requests;
+	struct metric *timeouts;
+	struct metric *depth;
+	struct metric *rtt;
 };
 
 struct sign_info {
@@ -124,6 +147,8 @@ static const struct {
 	{ BT_ATT_OP_READ_BLOB_RSP,		ATT_OP_TYPE_RSP },
 	{ BT_ATT_OP_READ_MULT_REQ,		ATT_OP_TYPE_REQ },
 	{ BT_ATT_OP_READ_MULT_RSP,		ATT_OP_TYPE_RSP },
+	{ BT_ATT_OP_READ_MULT_VL_REQ,		ATT_OP_TYPE_REQ },
+	{ BT_ATT_OP_READ_MULT_VL_RSP,		ATT_OP_TYPE_RSP },
 	{ BT_ATT_OP_READ_BY_GRP_TYPE_REQ,	ATT_OP_TYPE_REQ },
 	{ BT_ATT_OP_READ_BY_GRP_TYPE_RSP,	ATT_OP_TYPE_RSP },
 	{ BT_ATT_OP_WRITE_REQ,			ATT_OP_TYPE_REQ },
@@ -167,6 +192,7 @@ static const struct {
 	{ BT_ATT_OP_READ_REQ,			BT_ATT_OP_READ_RSP },
 	{ BT_ATT_OP_READ_BLOB_REQ,		BT_ATT_OP_READ_BLOB_RSP },
 	{ BT_ATT_OP_READ_MULT_REQ,		BT_ATT_OP_READ_MULT_RSP },
+	{ BT_ATT_OP_READ_MULT_VL_REQ,		BT_ATT_OP_READ_MULT_VL_RSP },
 	{ BT_ATT_OP_READ_BY_GRP_TYPE_REQ,	BT_ATT_OP_READ_BY_GRP_TYPE_RSP },
 	{ BT_ATT_OP_WRITE_REQ,			BT_ATT_OP_WRITE_RSP },
 	{ BT_ATT_OP_PREP_WRITE_REQ,		BT_ATT_OP_PREP_WRITE_RSP },
@@ -186,6 +212,12 @@ static uint8_t get_req_opcode(uint8_t rsp_opcode)
 	return 0;
 }
 
+struct bt_att_pdu {
+	int ref_count;
+	uint16_t len;
+	uint8_t data[];		/* Opcode followed by the parameters */
+};
+
 struct att_send_op {
 	unsigned int id;
 	unsigned int timeout_id;
@@ -193,9 +225,11 @@ struct att_send_op {
 	uint8_t opcode;
 	void *pdu;
 	uint16_t len;
+	struct bt_att_pdu *shared;	/* Owner of pdu if not NULL */
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
+	uint64_t sent;
 };
 
 static void destroy_att_send_op(void *data)
@@ -208,7 +242,11 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->pdu);
+	if (op->shared)
+		bt_att_pdu_unref(op->shared);
+	else
+		free(op->pdu);
+
 	free(op);
 }
 
@@ -242,14 +280,6 @@ static void destroy_att_notify(void *data)
 	free(notify);
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct att_notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 struct att_disconn {
 	unsigned int id;
 	bool removed;
@@ -266,6 +296,14 @@ struct att_exchange {
 	void *user_data;
 };
 
+struct att_writable {
+	unsigned int id;
+	unsigned int limit;
+	bt_att_writable_func_t callback;
+	bt_att_destroy_func_t destroy;
+	void *user_data;
+};
+
 static void destroy_att_disconn(void *data)
 {
 	struct att_disconn *disconn = data;
@@ -286,6 +324,16 @@ static void destroy_att_exchange(void *data)
 	free(exchange);
 }
 
+static void destroy_att_writable(void *data)
+{
+	struct att_writable *writable = data;
+
+	if (writable->destroy)
+		writable->destroy(writable->user_data);
+
+	free(writable);
+}
+
 static bool match_disconn_id(const void *a, const void *b)
 {
 	const struct att_disconn *disconn = a;
@@ -366,10 +414,7 @@ fail:
 	return false;
 }
 
-static struct att_send_op *create_att_send_op(struct bt_att *att,
-						uint8_t opcode,
-						const void *pdu,
-						uint16_t length,
+static struct att_send_op *alloc_att_send_op(uint8_t opcode,
 						bt_att_response_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy)
@@ -377,9 +422,6 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	struct att_send_op *op;
 	enum att_op_type type;
 
-	if (length && !pdu)
-		return NULL;
-
 	type = get_op_type(opcode);
 	if (type == ATT_OP_TYPE_UNKNOWN)
 		return NULL;
@@ -404,6 +446,26 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	op->destroy = destroy;
 	op->user_data = user_data;
 
+	return op;
+}
+
+static struct att_send_op *create_att_send_op(struct bt_att *att,
+						uint8_t opcode,
+						const void *pdu,
+						uint16_t length,
+						bt_att_response_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (length && !pdu)
+		return NULL;
+
+	op = alloc_att_send_op(opcode, callback, user_data, destroy);
+	if (!op)
+		return NULL;
+
 	if (!encode_pdu(att, op, pdu, length)) {
 		free(op);
 		return NULL;
@@ -412,6 +474,87 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	return op;
 }
 
+static void add_op_len(void *data, void *user_data)
+{
+	struct att_send_op *op = data;
+	size_t *len = user_data;
+
+	*len += op->len;
+}
+
+static void chan_update_load(void *data, void *user_data)
+{
+	struct bt_att_chan *chan = data;
+	int space;
+
+	chan->load = 0;
+	queue_foreach(chan->queue, add_op_len, &chan->load);
+
+	/* For Bluetooth sockets TIOCOUTQ reports the free send space */
+	if (chan->sndbuf && !ioctl(chan->fd, TIOCOUTQ, &space) &&
+						space < chan->sndbuf)
+		chan->load += chan->sndbuf - space;
+}
+
+static bool chan_can_send(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	if (op->len > chan->mtu)
+		return false;
+
+	if (op->type == ATT_OP_TYPE_REQ) {
+		/* Don't send Exchange MTU over EATT */
+		if (op->opcode == BT_ATT_OP_MTU_REQ &&
+					chan->type == BT_ATT_EATT)
+			return false;
+
+		return !chan->pending_req;
+	}
+
+	if (op->type == ATT_OP_TYPE_IND)
+		return !chan->pending_ind;
+
+	return true;
+}
+
+/*
+ * Operations that are not bound to a channel are sent over the least loaded
+ * channel able to send them, so that with EATT the PDUs are spread over all
+ * channels instead of filling the first one that becomes writable.
+ */
+static bool chan_is_least_loaded(struct bt_att_chan *chan,
+						struct att_send_op *op)
+{
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(chan->att->chans); entry;
+							entry = entry->next) {
+		struct bt_att_chan *c = entry->data;
+
+		/*
+		 * Only leave the operation if the other channel would still be
+		 * less loaded after sending it, otherwise two channels with
+		 * similar load could keep passing it to each other.
+		 */
+		if (c != chan && c->load + op->len <= chan->load &&
+						chan_can_send(c, op))
+			return false;
+	}
+
+	return true;
+}
+
+static struct att_send_op *pick_shared_op(struct bt_att_chan *chan,
+							struct queue *queue)
+{
+	struct att_send_op *op;
+
+	op = queue_peek_head(queue);
+	if (!op || !chan_can_send(chan, op) || !chan_is_least_loaded(chan, op))
+		return NULL;
+
+	return queue_pop_head(queue);
+}
+
 static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
 {
 	struct bt_att *att = chan->att;
@@ -423,36 +566,21 @@ static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
 		return op;
 
 	/* See if any operations are already in the write queue */
-	op = queue_peek_head(att->write_queue);
-	if (op && op->len <= chan->mtu)
-		return queue_pop_head(att->write_queue);
+	op = pick_shared_op(chan, att->write_queue);
+	if (op)
+		return op;
 
 	/* If there is no pending request, pick an operation from the
 	 * request queue.
 	 */
-	if (!chan->pending_req) {
-		op = queue_peek_head(att->req_queue);
-		if (op && op->len <= chan->mtu) {
-			/* Don't send Exchange MTU over EATT */
-			if (op->opcode == BT_ATT_OP_MTU_REQ &&
-					chan->type == BT_ATT_EATT)
-				goto indicate;
-
-			return queue_pop_head(att->req_queue);
-		}
-	}
+	op = pick_shared_op(chan, att->req_queue);
+	if (op)
+		return op;
 
-indicate:
 	/* There is either a request pending or no requests queued. If there is
 	 * no pending indication, pick an operation from the indication queue.
 	 */
-	if (!chan->pending_ind) {
-		op = queue_peek_head(att->ind_queue);
-		if (op && op->len <= chan->mtu)
-			return queue_pop_head(att->ind_queue);
-	}
-
-	return NULL;
+	return pick_shared_op(chan, att->ind_queue);
 }
 
 static void disc_att_send_op(void *data)
@@ -491,6 +619,9 @@ static bool timeout_cb(void *user_data)
 	DBG(att, "(chan %p) Operation timed out: 0x%02x", chan,
 						op->opcode);
 
+	if (op->type == ATT_OP_TYPE_REQ)
+		metrics_inc(att->timeouts);
+
 	if (att->timeout_callback)
 		att->timeout_callback(op->id, op->opcode, att->timeout_data);
 
@@ -540,24 +671,51 @@ static ssize_t bt_att_chan_write(struct bt_att_chan *chan, uint8_t opcode,
 	return ret;
 }
 
-static bool can_write_data(struct io *io, void *user_data)
+/*
+ * Write several PDUs with a single system call. Each one is still sent as
+ * a separate message so the packet boundaries are kept on SEQPACKET based
+ * L2CAP sockets. Returns the number of PDUs written, anything not covered
+ * is left to bt_att_chan_write.
+ */
+static int bt_att_chan_write_batch(struct bt_att_chan *chan,
+					struct att_send_op **ops, int count)
 {
-	struct bt_att_chan *chan = user_data;
-	struct att_send_op *op;
-	struct timeout_data *timeout;
+	struct bt_att *att = chan->att;
+	struct mmsghdr msgs[ATT_WRITE_BATCH_MAX];
+	struct iovec iov[ATT_WRITE_BATCH_MAX];
+	int i, ret;
 
-	op = pick_next_send_op(chan);
-	if (!op)
-		return false;
+	memset(msgs, 0, count * sizeof(*msgs));
 
-	if (!bt_att_chan_write(chan, op->opcode, op->pdu, op->len)) {
-		if (op->callback)
-			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
-							op->user_data);
-		destroy_att_send_op(op);
-		return true;
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = ops[i]->pdu;
+		iov[i].iov_len = ops[i]->len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = io_sendmmsg(chan->io, msgs, count);
+	if (ret < 0) {
+		DBG(att, "(chan %p) batched write failed: %s", chan,
+							strerror(-ret));
+		return 0;
 	}
 
+	for (i = 0; i < ret; i++) {
+		VERBOSE(att, "(chan %p) ATT op 0x%02x", chan, ops[i]->opcode);
+
+		if (att->debug_level)
+			util_hexdump('<', ops[i]->pdu, msgs[i].msg_len,
+					att->debug_callback, att->debug_data);
+	}
+
+	return ret;
+}
+
+static void write_complete(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	struct timeout_data *timeout;
+
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
 	 * no need to keep it around.
@@ -565,6 +723,7 @@ static bool can_write_data(struct io *io, void *user_data)
 	switch (op->type) {
 	case ATT_OP_TYPE_REQ:
 		chan->pending_req = op;
+		op->sent = metrics_now();
 		break;
 	case ATT_OP_TYPE_IND:
 		chan->pending_ind = op;
@@ -579,7 +738,7 @@ static bool can_write_data(struct io *io, void *user_data)
 	case ATT_OP_TYPE_UNKNOWN:
 	default:
 		destroy_att_send_op(op);
-		return true;
+		return;
 	}
 
 	timeout = new0(struct timeout_data, 1);
@@ -587,6 +746,112 @@ static bool can_write_data(struct io *io, void *user_data)
 	timeout->id = op->id;
 	op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
 								timeout, free);
+}
+
+static void sum_op_len(void *data, void *user_data)
+{
+	struct att_send_op *op = data;
+	unsigned int *len = user_data;
+
+	*len += op->len;
+}
+
+static unsigned int write_queued(struct bt_att *att)
+{
+	unsigned int len = 0;
+
+	queue_foreach(att->write_queue, sum_op_len, &len);
+
+	return len;
+}
+
+static bool match_writable_limit(const void *a, const void *b)
+{
+	const struct att_writable *writable = a;
+
+	return writable->limit >= PTR_TO_UINT(b);
+}
+
+static void notify_writable(struct bt_att *att)
+{
+	struct att_writable *writable;
+
+	/* Callbacks may queue more PDUs so recheck the length every time */
+	while ((writable = queue_remove_if(att->writable_list,
+					match_writable_limit,
+					UINT_TO_PTR(write_queued(att))))) {
+		if (writable->callback)
+			writable->callback(writable->user_data);
+
+		destroy_att_writable(writable);
+	}
+}
+
+static void wakeup_writer(struct bt_att *att);
+
+static bool can_write_data(struct io *io, void *user_data)
+{
+	struct bt_att_chan *chan = user_data;
+	struct bt_att *att = chan->att;
+	struct att_send_op *ops[ATT_WRITE_BATCH_MAX];
+	int i, count = 0, sent = 0;
+
+	/*
+	 * Drain up to write_batch PDUs per wakeup, stopping after a request
+	 * or indication since nothing else of that kind may be sent until
+	 * it has been answered.
+	 */
+	if (queue_length(att->chans) > 1)
+		queue_foreach(att->chans, chan_update_load, NULL);
+
+	while (count < att->write_batch) {
+		struct att_send_op *op = pick_next_send_op(chan);
+
+		if (!op)
+			break;
+
+		ops[count++] = op;
+		chan->load += op->len;
+
+		if (op->type == ATT_OP_TYPE_REQ || op->type == ATT_OP_TYPE_IND)
+			break;
+	}
+
+	if (!count) {
+		/*
+		 * Operations left to a less loaded channel are only sent once
+		 * its writer is active, which may not be the case if it had
+		 * nothing to send when it was last checked.
+		 */
+		wakeup_writer(att);
+		return false;
+	}
+
+	if (count > 1)
+		sent = bt_att_chan_write_batch(chan, ops, count);
+
+	/* Destroy callbacks could otherwise drop the last reference */
+	bt_att_ref(att);
+
+	for (i = 0; i < count; i++) {
+		struct att_send_op *op = ops[i];
+
+		if (i >= sent && !bt_att_chan_write(chan, op->opcode, op->pdu,
+								op->len)) {
+			if (op->callback)
+				op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
+								op->user_data);
+			destroy_att_send_op(op);
+			continue;
+		}
+
+		att->pdu_count++;
+		write_complete(chan, op);
+	}
+
+	notify_writable(att);
+
+	bt_att_unref(att);
 
 	/* Return true as there may be more operations ready to write. */
 	return true;
@@ -856,6 +1121,8 @@ fail:
 	rsp_opcode = BT_ATT_OP_ERROR_RSP;
 
 done:
+	metrics_observe(att->rtt, metrics_now() - op->sent);
+
 	if (op->callback)
 		op->callback(rsp_opcode, rsp_pdu, rsp_pdu_len, op->user_data);
 
@@ -1039,6 +1306,8 @@ static bool can_read_data(struct io *io, void *user_data)
 	if (bytes_read < ATT_MIN_PDU_LEN)
 		return true;
 
+	att->pdu_count++;
+
 	pdu = chan->buf;
 	opcode = pdu[0];
 
@@ -1126,6 +1395,9 @@ static void bt_att_free(struct bt_att *att)
 	if (att->timeout_destroy)
 		att->timeout_destroy(att->timeout_data);
 
+	if (att->busy_destroy)
+		att->busy_destroy(att->busy_data);
+
 	if (att->debug_destroy)
 		att->debug_destroy(att->debug_data);
 
@@ -1136,8 +1408,10 @@ static void bt_att_free(struct bt_att *att)
 	queue_destroy(att->ind_queue, NULL);
 	queue_destroy(att->write_queue, NULL);
 	queue_destroy(att->notify_list, NULL);
+	hashmap_destroy(att->notify_map, NULL);
 	queue_destroy(att->disconn_list, NULL);
 	queue_destroy(att->exchange_list, NULL);
+	queue_destroy(att->writable_list, NULL);
 	queue_destroy(att->chans, bt_att_chan_free);
 
 	free(att);
@@ -1218,6 +1492,14 @@ static struct bt_att_chan *bt_att_chan_new(int fd, uint8_t type)
 
 	chan->queue = queue_new();
 
+	if (chan->type != BT_ATT_LOCAL) {
+		socklen_t len = sizeof(chan->sndbuf);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &chan->sndbuf,
+								&len) < 0)
+			chan->sndbuf = 0;
+	}
+
 	return chan;
 
 fail:
@@ -1254,6 +1536,7 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	att = new0(struct bt_att, 1);
 	att->chans = queue_new();
 	att->mtu = chan->mtu;
+	att->write_batch = ATT_WRITE_BATCH_DEFAULT;
 
 	/* crypto is optional, if not available leave it NULL */
 	if (!ext_signed)
@@ -1263,8 +1546,20 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	att->ind_queue = queue_new();
 	att->write_queue = queue_new();
 	att->notify_list = queue_new();
+	att->notify_map = hashmap_new();
 	att->disconn_list = queue_new();
 	att->exchange_list = queue_new();
+	att->writable_list = queue_new();
+
+	att->requests = metrics_counter("att_requests_total",
+					"ATT requests queued for sending");
+	att->timeouts = metrics_counter("att_request_timeouts_total",
+					"ATT requests that timed out");
+	att->depth = metrics_histogram("att_request_queue_depth",
+					"ATT requests already queued when a "
+					"new one is added", 1);
+	att->rtt = metrics_histogram("att_request_rtt_usec",
+					"ATT request round trip time", 1000);
 
 	bt_att_attach_chan(att, chan);
 
@@ -1426,6 +1721,16 @@ bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 	return true;
 }
 
+bool bt_att_set_write_batch(struct bt_att *att, uint8_t count)
+{
+	if (!att || !count || count > ATT_WRITE_BATCH_MAX)
+		return false;
+
+	att->write_batch = count;
+
+	return true;
+}
+
 uint8_t bt_att_get_link_type(struct bt_att *att)
 {
 	struct bt_att_chan *chan;
@@ -1440,6 +1745,14 @@ uint8_t bt_att_get_link_type(struct bt_att *att)
 	return chan->type;
 }
 
+unsigned int bt_att_get_pdu_count(struct bt_att *att)
+{
+	if (!att)
+		return 0;
+
+	return att->pdu_count;
+}
+
 bool bt_att_set_timeout_cb(struct bt_att *att, bt_att_timeout_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy)
@@ -1457,6 +1770,23 @@ bool bt_att_set_timeout_cb(struct bt_att *att, bt_att_timeout_func_t callback,
 	return true;
 }
 
+bool bt_att_set_busy_cb(struct bt_att *att, bt_att_busy_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	if (!att)
+		return false;
+
+	if (att->busy_destroy)
+		att->busy_destroy(att->busy_data);
+
+	att->busy_callback = callback;
+	att->busy_destroy = destroy;
+	att->busy_data = user_data;
+
+	return true;
+}
+
 unsigned int bt_att_register_disconnect(struct bt_att *att,
 					bt_att_disconnect_func_t callback,
 					void *user_data,
@@ -1567,21 +1897,75 @@ bool bt_att_unregister_exchange(struct bt_att *att, unsigned int id)
 	return true;
 }
 
-unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
-				const void *pdu, uint16_t length,
-				bt_att_response_func_t callback, void *user_data,
-				bt_att_destroy_func_t destroy)
+unsigned int bt_att_get_write_queued(struct bt_att *att)
 {
-	struct att_send_op *op;
-	bool result;
+	if (!att)
+		return 0;
 
-	if (!att || queue_isempty(att->chans))
+	return write_queued(att);
+}
+
+/*
+ * The callback is called once, as soon as no more than limit bytes are left
+ * in the write queue after the writer has run, so it shall only be used while
+ * bt_att_get_write_queued() is above limit.
+ */
+unsigned int bt_att_wait_writable(struct bt_att *att, unsigned int limit,
+					bt_att_writable_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy)
+{
+	struct att_writable *writable;
+
+	if (!att || !callback || queue_isempty(att->chans))
 		return 0;
 
-	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
-								destroy);
-	if (!op)
+	writable = new0(struct att_writable, 1);
+	writable->limit = limit;
+	writable->callback = callback;
+	writable->destroy = destroy;
+	writable->user_data = user_data;
+
+	if (att->next_reg_id < 1)
+		att->next_reg_id = 1;
+
+	writable->id = att->next_reg_id++;
+
+	if (!queue_push_tail(att->writable_list, writable)) {
+		free(writable);
 		return 0;
+	}
+
+	return writable->id;
+}
+
+bool bt_att_cancel_writable(struct bt_att *att, unsigned int id)
+{
+	struct att_writable *writable;
+
+	if (!att || !id)
+		return false;
+
+	writable = queue_remove_if(att->writable_list, match_disconn_id,
+							UINT_TO_PTR(id));
+	if (!writable)
+		return false;
+
+	destroy_att_writable(writable);
+	return true;
+}
+
+static bool match_chan_can_send(const void *a, const void *b)
+{
+	struct bt_att_chan *chan = (void *) a;
+	struct att_send_op *op = (void *) b;
+
+	return chan_can_send(chan, op);
+}
+
+static unsigned int queue_send_op(struct bt_att *att, struct att_send_op *op)
+{
+	bool result;
 
 	if (att->next_send_id < 1)
 		att->next_send_id = 1;
@@ -1591,6 +1975,8 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	/* Add the op to the correct queue based on its type */
 	switch (op->type) {
 	case ATT_OP_TYPE_REQ:
+		metrics_inc(att->requests);
+		metrics_observe(att->depth, queue_length(att->req_queue));
 		result = queue_push_tail(att->req_queue, op);
 		break;
 	case ATT_OP_TYPE_IND:
@@ -1607,16 +1993,129 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	}
 
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		op->destroy = NULL;
+		destroy_att_send_op(op);
 		return 0;
 	}
 
+	/* Let the user know if the operation has to wait for a channel */
+	if ((op->type == ATT_OP_TYPE_REQ || op->type == ATT_OP_TYPE_IND) &&
+				att->busy_callback &&
+				!queue_find(att->chans, match_chan_can_send, op))
+		att->busy_callback(att->busy_data);
+
 	wakeup_writer(att);
 
 	return op->id;
 }
 
+unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
+				const void *pdu, uint16_t length,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || queue_isempty(att->chans))
+		return 0;
+
+	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
+								destroy);
+	if (!op)
+		return 0;
+
+	return queue_send_op(att, op);
+}
+
+struct bt_att_pdu *bt_att_pdu_new(uint8_t opcode, const struct iovec *iov,
+								size_t iovcnt)
+{
+	struct bt_att_pdu *pdu;
+	size_t i, len = 1;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > UINT16_MAX)
+		return NULL;
+
+	pdu = malloc(sizeof(*pdu) + len);
+	if (!pdu)
+		return NULL;
+
+	pdu->ref_count = 1;
+	pdu->len = len;
+	pdu->data[0] = opcode;
+
+	for (i = 0, len = 1; i < iovcnt; i++) {
+		memcpy(pdu->data + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	return pdu;
+}
+
+struct bt_att_pdu *bt_att_pdu_ref(struct bt_att_pdu *pdu)
+{
+	if (!pdu)
+		return NULL;
+
+	__sync_fetch_and_add(&pdu->ref_count, 1);
+
+	return pdu;
+}
+
+void bt_att_pdu_unref(struct bt_att_pdu *pdu)
+{
+	if (!pdu)
+		return;
+
+	if (__sync_sub_and_fetch(&pdu->ref_count, 1))
+		return;
+
+	free(pdu);
+}
+
+unsigned int bt_att_send_pdu(struct bt_att *att, struct bt_att_pdu *pdu,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+	uint16_t len;
+
+	if (!att || !pdu || queue_isempty(att->chans))
+		return 0;
+
+	/* Signatures are specific to each link so can't be shared */
+	if (pdu->data[0] & ATT_OP_SIGNED_MASK)
+		return 0;
+
+	op = alloc_att_send_op(pdu->data[0], callback, user_data, destroy);
+	if (!op)
+		return 0;
+
+	/*
+	 * The same PDU may be sent over links with different MTUs, values of
+	 * notifications and indications are truncated to fit as usual.
+	 */
+	len = pdu->len;
+	if (len > att->mtu) {
+		if (op->type != ATT_OP_TYPE_NFY &&
+					op->type != ATT_OP_TYPE_IND) {
+			free(op);
+			return 0;
+		}
+
+		len = att->mtu;
+	}
+
+	op->shared = bt_att_pdu_ref(pdu);
+	op->pdu = pdu->data;
+	op->len = len;
+
+	return queue_send_op(att, op);
+}
+
 int bt_att_resend(struct bt_att *att, unsigned int id, uint8_t opcode,
 				const void *pdu, uint16_t length,
 				bt_att_response_func_t callback,
@@ -1906,7 +2405,13 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 
 	notify->id = att->next_reg_id++;
 
+	if (!hashmap_insert(att->notify_map, notify->id, notify)) {
+		free(notify);
+		return 0;
+	}
+
 	if (!queue_push_tail(att->notify_list, notify)) {
+		hashmap_remove(att->notify_map, notify->id);
 		free(notify);
 		return 0;
 	}
@@ -1921,11 +2426,11 @@ bool bt_att_unregister(struct bt_att *att, unsigned int id)
 	if (!att || !id)
 		return false;
 
-	notify = queue_remove_if(att->notify_list, match_notify_id,
-							UINT_TO_PTR(id));
+	notify = hashmap_remove(att->notify_map, id);
 	if (!notify)
 		return false;
 
+	queue_remove(att->notify_list, notify);
 	destroy_att_notify(notify);
 	return true;
 }
@@ -1935,9 +2440,11 @@ bool bt_att_unregister_all(struct bt_att *att)
 	if (!att)
 		return false;
 
+	hashmap_clear(att->notify_map, NULL);
 	queue_remove_all(att->notify_list, NULL, NULL, destroy_att_notify);
 	queue_remove_all(att->disconn_list, NULL, NULL, destroy_att_disconn);
 	queue_remove_all(att->exchange_list, NULL, NULL, destroy_att_exchange);
+	queue_remove_all(att->writable_list, NULL, NULL, destroy_att_writable);
 
 	return true;
 }
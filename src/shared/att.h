@@ -10,6 +10,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "src/shared/att-types.h"
 
@@ -19,6 +20,7 @@
 
 struct bt_att;
 struct bt_att_chan;
+struct bt_att_pdu;
 
 struct bt_att *bt_att_new(int fd, bool ext_signed);
 
@@ -44,6 +46,8 @@ typedef void (*bt_att_timeout_func_t)(unsigned int id, uint8_t opcode,
 							void *user_data);
 typedef void (*bt_att_disconnect_func_t)(int err, void *user_data);
 typedef void (*bt_att_exchange_func_t)(uint16_t mtu, void *user_data);
+typedef void (*bt_att_writable_func_t)(void *user_data);
+typedef void (*bt_att_busy_func_t)(void *user_data);
 typedef bool (*bt_att_counter_func_t)(uint32_t *sign_cnt, void *user_data);
 
 bool bt_att_set_debug(struct bt_att *att, uint8_t level,
@@ -52,17 +56,40 @@ bool bt_att_set_debug(struct bt_att *att, uint8_t level,
 
 uint16_t bt_att_get_mtu(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
+bool bt_att_set_write_batch(struct bt_att *att, uint8_t count);
 uint8_t bt_att_get_link_type(struct bt_att *att);
+unsigned int bt_att_get_pdu_count(struct bt_att *att);
 
 bool bt_att_set_timeout_cb(struct bt_att *att, bt_att_timeout_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy);
 
+/*
+ * Called when a request or indication is queued while every channel already
+ * has one outstanding, e.g. to open additional EATT channels.
+ */
+bool bt_att_set_busy_cb(struct bt_att *att, bt_att_busy_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy);
+
 unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					const void *pdu, uint16_t length,
 					bt_att_response_func_t callback,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
+
+/*
+ * Reference counted PDU that can be queued on any number of bt_att
+ * instances without being copied for each of them.
+ */
+struct bt_att_pdu *bt_att_pdu_new(uint8_t opcode, const struct iovec *iov,
+								size_t iovcnt);
+struct bt_att_pdu *bt_att_pdu_ref(struct bt_att_pdu *pdu);
+void bt_att_pdu_unref(struct bt_att_pdu *pdu);
+unsigned int bt_att_send_pdu(struct bt_att *att, struct bt_att_pdu *pdu,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy);
+
 int bt_att_resend(struct bt_att *att, unsigned int id, uint8_t opcode,
 					const void *pdu, uint16_t length,
 					bt_att_response_func_t callback,
@@ -99,6 +126,13 @@ unsigned int bt_att_register_exchange(struct bt_att *att,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
 bool bt_att_unregister_exchange(struct bt_att *att, unsigned int id);
+
+unsigned int bt_att_get_write_queued(struct bt_att *att);
+unsigned int bt_att_wait_writable(struct bt_att *att, unsigned int limit,
+					bt_att_writable_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
+bool bt_att_cancel_writable(struct bt_att *att, unsigned int id);
 bool bt_att_unregister_all(struct bt_att *att);
 
 int bt_att_get_security(struct bt_att *att, uint8_t *enc_size);
@@ -14,6 +14,7 @@
 
 #define _GNU_SOURCE
 #include <endian.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -21,8 +22,11 @@
 #include <stdio.h>
 #include <limits.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 
+#include "src/shared/lz4.h"
 #include "src/shared/btsnoop.h"
 
 struct btsnoop_hdr {
@@ -47,6 +51,24 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 
 static const uint32_t btsnoop_version = 1;
 
+/*
+ * Compressed traces share the header layout but carry their own pattern,
+ * followed by blocks of LZ4 compressed records. Each block header doubles
+ * as index entry, since it allows skipping a block by size or time.
+ */
+static const uint8_t btsnoop_lz4_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x6f, 0x6f, 0x70, 0x7a };
+
+struct btsnoop_block {
+	uint32_t	size;		/* Compressed Length */
+	uint32_t	len;		/* Uncompressed Length */
+	uint32_t	count;		/* Number of Records */
+	uint64_t	ts;		/* Timestamp of first Record */
+} __attribute__ ((packed));
+#define BTSNOOP_BLOCK_SIZE (sizeof(struct btsnoop_block))
+
+#define BTSNOOP_BLOCK_MAX (64 * 1024)
+
 struct pklg_pkt {
 	uint32_t	len;
 	uint64_t	ts;
@@ -68,8 +90,194 @@ struct btsnoop {
 	size_t cur_size;
 	unsigned int max_count;
 	unsigned int cur_count;
+	const uint8_t *map;
+	size_t map_size;
+	size_t map_offset;
+	bool map_alloc;
+	uint8_t *buf;
+	char *idx_path;
+	off_t *replay;
+	unsigned int replay_count;
+	unsigned int replay_pos;
+	off_t resume;
+	uint8_t *wbuf;
+	size_t wbuf_size;
+	size_t wbuf_len;
+	uint8_t *block;
+	size_t block_len;
+	unsigned int block_count;
+	uint64_t block_ts;
+	uint8_t *zbuf;
 };
 
+struct btsnoop_idx_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 1 */
+	uint32_t	interval;	/* Records between entries */
+	uint64_t	size;		/* Size of the indexed file */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_HDR_SIZE (sizeof(struct btsnoop_idx_hdr))
+
+struct btsnoop_idx_entry {
+	uint64_t	ts;		/* Timestamp microseconds */
+	uint64_t	offset;		/* Offset of the record */
+	uint16_t	index;		/* Controller index */
+	uint16_t	handle;		/* Connection handle */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_ENTRY_SIZE (sizeof(struct btsnoop_idx_entry))
+
+#define BTSNOOP_IDX_TIME	0xffff
+#define BTSNOOP_IDX_CONTROLLER	0xfffe
+
+static const uint8_t btsnoop_idx_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x70, 0x69, 0x64, 0x78 };
+
+static const uint32_t btsnoop_idx_version = 1;
+
+static void btsnoop_map(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+					st.st_size <= 0 ||
+					(uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	/* Records are only ever read front to back */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->map_offset = lseek(btsnoop->fd, 0, SEEK_CUR);
+}
+
+/*
+ * Returns up to len bytes of the next part of the file in *data, pointing
+ * into the mapping when there is one or into a buffer that is reused by
+ * the next call otherwise. The return value has the semantics of read().
+ */
+static ssize_t btsnoop_fetch(struct btsnoop *btsnoop, const void **data,
+								size_t len)
+{
+	if (btsnoop->map) {
+		size_t avail = btsnoop->map_size - btsnoop->map_offset;
+
+		if (len > avail)
+			len = avail;
+
+		*data = btsnoop->map + btsnoop->map_offset;
+		btsnoop->map_offset += len;
+
+		return len;
+	}
+
+	if (len > BTSNOOP_MAX_PACKET_SIZE)
+		len = BTSNOOP_MAX_PACKET_SIZE;
+
+	if (!btsnoop->buf) {
+		btsnoop->buf = malloc(BTSNOOP_MAX_PACKET_SIZE);
+		if (!btsnoop->buf)
+			return -1;
+	}
+
+	*data = btsnoop->buf;
+
+	return read(btsnoop->fd, btsnoop->buf, len);
+}
+
+static bool read_full(int fd, void *buf, size_t len)
+{
+	size_t offset = 0;
+	ssize_t n;
+
+	while (offset < len) {
+		n = read(fd, (uint8_t *) buf + offset, len - offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		offset += n;
+	}
+
+	return true;
+}
+
+/*
+ * Decompresses all blocks of a compressed trace behind a regular header,
+ * so it is read like an uncompressed one from memory. A block cut short
+ * by the writer dying ends the trace.
+ */
+static bool btsnoop_load_blocks(struct btsnoop *btsnoop,
+						const struct btsnoop_hdr *hdr)
+{
+	struct btsnoop_block blk;
+	struct btsnoop_hdr *out;
+	uint8_t *buf, *zbuf, *tmp;
+	size_t size = BTSNOOP_HDR_SIZE, alloc = BTSNOOP_BLOCK_MAX;
+	uint32_t zlen, len;
+
+	buf = malloc(alloc);
+	zbuf = malloc(BTSNOOP_BLOCK_MAX);
+	if (!buf || !zbuf)
+		goto failed;
+
+	while (read_full(btsnoop->fd, &blk, BTSNOOP_BLOCK_SIZE)) {
+		zlen = be32toh(blk.size);
+		len = be32toh(blk.len);
+
+		/* Blocks that do not compress are stored as they are */
+		if (len > BTSNOOP_BLOCK_MAX || zlen > len)
+			break;
+
+		if (!read_full(btsnoop->fd, zbuf, zlen))
+			break;
+
+		if (size + len > alloc) {
+			alloc = (size + len) * 2;
+			tmp = realloc(buf, alloc);
+			if (!tmp)
+				goto failed;
+
+			buf = tmp;
+		}
+
+		if (zlen == len)
+			memcpy(buf + size, zbuf, len);
+		else if (lz4_decompress(zbuf, zlen, buf + size, len) !=
+								(ssize_t) len)
+			break;
+
+		size += len;
+	}
+
+	out = (struct btsnoop_hdr *) buf;
+	memcpy(out->id, btsnoop_id, sizeof(btsnoop_id));
+	out->version = hdr->version;
+	out->type = hdr->type;
+
+	free(zbuf);
+
+	btsnoop->map = buf;
+	btsnoop->map_size = size;
+	btsnoop->map_offset = BTSNOOP_HDR_SIZE;
+	btsnoop->map_alloc = true;
+
+	return true;
+
+failed:
+	free(zbuf);
+	free(buf);
+
+	return false;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -99,6 +307,15 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 		btsnoop->format = be32toh(hdr.type);
 		btsnoop->index = 0xffff;
+	} else if (!memcmp(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id))) {
+		if (be32toh(hdr.version) != btsnoop_version)
+			goto failed;
+
+		btsnoop->format = be32toh(hdr.type);
+		btsnoop->index = 0xffff;
+
+		if (!btsnoop_load_blocks(btsnoop, &hdr))
+			goto failed;
 	} else {
 		if (!(btsnoop->flags & BTSNOOP_FLAG_PKLG_SUPPORT))
 			goto failed;
@@ -117,6 +334,12 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
+	if (asprintf(&btsnoop->idx_path, "%s.idx", path) < 0)
+		btsnoop->idx_path = NULL;
+
+	if (!btsnoop->map)
+		btsnoop_map(btsnoop);
+
 	return btsnoop_ref(btsnoop);
 
 failed:
@@ -126,14 +349,35 @@ failed:
 	return NULL;
 }
 
-struct btsnoop *btsnoop_create(const char *path, size_t max_size,
-					unsigned int max_count, uint32_t format)
+static bool write_header(struct btsnoop *btsnoop)
 {
-	struct btsnoop *btsnoop;
 	struct btsnoop_hdr hdr;
+	ssize_t written;
+
+	if (btsnoop->block)
+		memcpy(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id));
+	else
+		memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(btsnoop->format);
+
+	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+	if (written < 0)
+		return false;
+
+	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+
+	return true;
+}
+
+static struct btsnoop *create_file(const char *path, size_t max_size,
+					unsigned int max_count, uint32_t format,
+					bool compress)
+{
+	struct btsnoop *btsnoop;
 	const char *real_path;
 	char tmp[PATH_MAX];
-	ssize_t written;
 
 	if (!max_size && max_count)
 		return NULL;
@@ -142,20 +386,26 @@ struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 	if (!btsnoop)
 		return NULL;
 
+	if (compress) {
+		btsnoop->block = malloc(BTSNOOP_BLOCK_MAX);
+		btsnoop->zbuf = malloc(LZ4_COMPRESS_BOUND(BTSNOOP_BLOCK_MAX));
+		if (!btsnoop->block || !btsnoop->zbuf)
+			goto failed;
+	}
+
 	/* If max file size is specified, always add counter to file path */
 	if (max_size) {
 		snprintf(tmp, PATH_MAX, "%s.0", path);
 		real_path = tmp;
+		btsnoop->cur_count = 1;
 	} else {
 		real_path = path;
 	}
 
 	btsnoop->fd = open(real_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
 									0644);
-	if (btsnoop->fd < 0) {
-		free(btsnoop);
-		return NULL;
-	}
+	if (btsnoop->fd < 0)
+		goto failed;
 
 	btsnoop->format = format;
 	btsnoop->index = 0xffff;
@@ -163,20 +413,36 @@ struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 	btsnoop->max_count = max_count;
 	btsnoop->max_size = max_size;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->format);
-
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
+	if (!write_header(btsnoop)) {
 		close(btsnoop->fd);
-		free(btsnoop);
-		return NULL;
+		goto failed;
 	}
 
-	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
-
 	return btsnoop_ref(btsnoop);
+
+failed:
+	free(btsnoop->block);
+	free(btsnoop->zbuf);
+	free(btsnoop);
+
+	return NULL;
+}
+
+struct btsnoop *btsnoop_create(const char *path, size_t max_size,
+					unsigned int max_count, uint32_t format)
+{
+	return create_file(path, max_size, max_count, format, false);
+}
+
+/*
+ * Same as btsnoop_create(), but records are written in LZ4 compressed
+ * blocks. Pending records reach the file once a block is full or on
+ * btsnoop_flush(), and max_size applies to the compressed size.
+ */
+struct btsnoop *btsnoop_create_compressed(const char *path, size_t max_size,
+					unsigned int max_count, uint32_t format)
+{
+	return create_file(path, max_size, max_count, format, true);
 }
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop)
@@ -197,9 +463,22 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	btsnoop_flush(btsnoop);
+
+	if (btsnoop->map_alloc)
+		free((void *) btsnoop->map);
+	else if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
+	free(btsnoop->buf);
+	free(btsnoop->wbuf);
+	free(btsnoop->block);
+	free(btsnoop->zbuf);
+	free(btsnoop->idx_path);
+	free(btsnoop->replay);
 	free(btsnoop);
 }
 
@@ -213,9 +492,10 @@ uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
 
 static bool btsnoop_rotate(struct btsnoop *btsnoop)
 {
-	struct btsnoop_hdr hdr;
 	char path[PATH_MAX];
-	ssize_t written;
+
+	/* Buffered records belong to the current file */
+	btsnoop_flush(btsnoop);
 
 	close(btsnoop->fd);
 
@@ -234,15 +514,69 @@ static bool btsnoop_rotate(struct btsnoop *btsnoop)
 	if (btsnoop->fd < 0)
 		return false;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->format);
+	return write_header(btsnoop);
+}
 
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+static bool write_block(struct btsnoop *btsnoop)
+{
+	struct btsnoop_block blk;
+	struct iovec iov[2];
+	size_t zlen;
+	ssize_t written;
+
+	if (!btsnoop->block_len)
+		return true;
+
+	zlen = lz4_compress(btsnoop->block, btsnoop->block_len, btsnoop->zbuf,
+				LZ4_COMPRESS_BOUND(BTSNOOP_BLOCK_MAX));
+
+	iov[0].iov_base = &blk;
+	iov[0].iov_len = BTSNOOP_BLOCK_SIZE;
+
+	if (zlen && zlen < btsnoop->block_len) {
+		iov[1].iov_base = btsnoop->zbuf;
+		iov[1].iov_len = zlen;
+	} else {
+		iov[1].iov_base = btsnoop->block;
+		iov[1].iov_len = btsnoop->block_len;
+	}
+
+	blk.size = htobe32(iov[1].iov_len);
+	blk.len = htobe32(btsnoop->block_len);
+	blk.count = htobe32(btsnoop->block_count);
+	blk.ts = btsnoop->block_ts;
+
+	btsnoop->block_len = 0;
+	btsnoop->block_count = 0;
+
+	written = writev(btsnoop->fd, iov, 2);
 	if (written < 0)
 		return false;
 
-	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+	btsnoop->cur_size += written;
+
+	return true;
+}
+
+static bool block_append(struct btsnoop *btsnoop,
+					const struct btsnoop_pkt *pkt,
+					const void *data, uint16_t size)
+{
+	if (btsnoop->block_len + BTSNOOP_PKT_SIZE + size > BTSNOOP_BLOCK_MAX &&
+						!write_block(btsnoop))
+		return false;
+
+	if (!btsnoop->block_count)
+		btsnoop->block_ts = pkt->ts;
+
+	memcpy(btsnoop->block + btsnoop->block_len, pkt, BTSNOOP_PKT_SIZE);
+	btsnoop->block_len += BTSNOOP_PKT_SIZE;
+
+	if (size)
+		memcpy(btsnoop->block + btsnoop->block_len, data, size);
+	btsnoop->block_len += size;
+
+	btsnoop->block_count++;
 
 	return true;
 }
@@ -252,14 +586,15 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct iovec iov[2];
 	uint64_t ts;
 	ssize_t written;
 
 	if (!btsnoop || !tv)
 		return false;
 
-	if (btsnoop->max_size && btsnoop->max_size <=
-			btsnoop->cur_size + size + BTSNOOP_PKT_SIZE)
+	if (btsnoop->max_size && btsnoop->max_size <= btsnoop->cur_size +
+				btsnoop->block_len + size + BTSNOOP_PKT_SIZE)
 		if (!btsnoop_rotate(btsnoop))
 			return false;
 
@@ -271,19 +606,99 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	if (!data)
+		size = 0;
+
+	if (btsnoop->block)
+		return block_append(btsnoop, &pkt, data, size);
+
+	if (btsnoop->wbuf) {
+		if (btsnoop->wbuf_len + BTSNOOP_PKT_SIZE + size >
+						btsnoop->wbuf_size &&
+						!btsnoop_flush(btsnoop))
+			return false;
+
+		if (BTSNOOP_PKT_SIZE + size <= btsnoop->wbuf_size) {
+			memcpy(btsnoop->wbuf + btsnoop->wbuf_len, &pkt,
+							BTSNOOP_PKT_SIZE);
+			btsnoop->wbuf_len += BTSNOOP_PKT_SIZE;
+
+			if (size)
+				memcpy(btsnoop->wbuf + btsnoop->wbuf_len,
+								data, size);
+			btsnoop->wbuf_len += size;
+
+			btsnoop->cur_size += BTSNOOP_PKT_SIZE + size;
+			return true;
+		}
+	}
+
+	iov[0].iov_base = &pkt;
+	iov[0].iov_len = BTSNOOP_PKT_SIZE;
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = size;
+
+	written = writev(btsnoop->fd, iov, size ? 2 : 1);
 	if (written < 0)
 		return false;
 
-	btsnoop->cur_size += BTSNOOP_PKT_SIZE;
+	btsnoop->cur_size += BTSNOOP_PKT_SIZE + size;
+
+	return true;
+}
+
+/*
+ * Collects written records in a buffer of the given size, so they reach
+ * the file in large writes from btsnoop_flush() or once the buffer is full.
+ * A size of 0 writes every record directly again.
+ */
+bool btsnoop_set_write_buffer(struct btsnoop *btsnoop, size_t size)
+{
+	uint8_t *wbuf = NULL;
+
+	if (!btsnoop || !btsnoop_flush(btsnoop))
+		return false;
+
+	if (size) {
+		wbuf = malloc(size);
+		if (!wbuf)
+			return false;
+	}
+
+	free(btsnoop->wbuf);
+	btsnoop->wbuf = wbuf;
+	btsnoop->wbuf_size = size;
+
+	return true;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	size_t offset = 0;
+	ssize_t written;
+
+	if (!btsnoop)
+		return false;
+
+	if (!write_block(btsnoop))
+		return false;
+
+	while (offset < btsnoop->wbuf_len) {
+		written = write(btsnoop->fd, btsnoop->wbuf + offset,
+					btsnoop->wbuf_len - offset);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
 
-	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
+			/* Drop the records instead of failing forever */
+			btsnoop->wbuf_len = 0;
 			return false;
+		}
+
+		offset += written;
 	}
 
-	btsnoop->cur_size += size;
+	btsnoop->wbuf_len = 0;
 
 	return true;
 }
@@ -368,14 +783,15 @@ bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 
 static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
-					void *data, uint16_t *size)
+					const void **data, uint16_t *size)
 {
 	struct pklg_pkt pkt;
+	const void *ptr;
 	uint32_t toread;
 	uint64_t ts;
 	ssize_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
+	len = btsnoop_fetch(btsnoop, &ptr, PKLG_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -384,6 +800,8 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
+	memcpy(&pkt, ptr, PKLG_PKT_SIZE);
+
 	if (btsnoop->pklg_v2) {
 		toread = le32toh(pkt.len) - (PKLG_PKT_SIZE - 4);
 
@@ -442,13 +860,13 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = btsnoop_fetch(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	*size = toread;
+	*size = len;
 
 	return true;
 }
@@ -488,14 +906,15 @@ static uint16_t get_opcode_from_flags(uint8_t type, uint32_t flags)
 	return 0xffff;
 }
 
-bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+static bool read_record(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
-					void *data, uint16_t *size)
+					const void **data, uint16_t *size)
 {
 	struct btsnoop_pkt pkt;
 	uint32_t toread, flags;
 	uint64_t ts;
 	uint8_t pkt_type;
+	const void *ptr;
 	ssize_t len;
 
 	if (!btsnoop || btsnoop->aborted)
@@ -504,7 +923,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = btsnoop_fetch(btsnoop, &ptr, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -513,6 +932,8 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
+	memcpy(&pkt, ptr, BTSNOOP_PKT_SIZE);
+
 	toread = be32toh(pkt.size);
 	if (toread > BTSNOOP_MAX_PACKET_SIZE) {
 		btsnoop->aborted = true;
@@ -532,14 +953,15 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
-		if (len < 0) {
+		len = btsnoop_fetch(btsnoop, &ptr, 1);
+		if (len != 1) {
 			btsnoop->aborted = true;
 			return false;
 		}
 		toread--;
 
 		*index = 0;
+		pkt_type = *((const uint8_t *) ptr);
 		*opcode = get_opcode_from_flags(pkt_type, flags);
 		break;
 
@@ -553,13 +975,461 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = btsnoop_fetch(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	*size = toread;
+	*size = len;
+
+	return true;
+}
+
+static off_t get_position(struct btsnoop *btsnoop)
+{
+	if (btsnoop->map)
+		return btsnoop->map_offset;
+
+	return lseek(btsnoop->fd, 0, SEEK_CUR);
+}
+
+static bool set_position(struct btsnoop *btsnoop, off_t offset)
+{
+	if (btsnoop->map) {
+		if ((size_t) offset > btsnoop->map_size)
+			return false;
+
+		btsnoop->map_offset = offset;
+		return true;
+	}
+
+	return lseek(btsnoop->fd, offset, SEEK_SET) == offset;
+}
+
+/*
+ * Like btsnoop_read_hci(), but without copying the packet. The returned
+ * data stays valid until the next read or until the btsnoop is released.
+ */
+bool btsnoop_next_hci(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					const void **data, uint16_t *size)
+{
+	bool result;
+
+	if (!btsnoop || btsnoop->aborted)
+		return false;
+
+	if (btsnoop->replay_pos >= btsnoop->replay_count)
+		return read_record(btsnoop, tv, index, opcode, data, size);
+
+	/* Controller records skipped over by btsnoop_seek() come first */
+	if (!set_position(btsnoop, btsnoop->replay[btsnoop->replay_pos++])) {
+		btsnoop->aborted = true;
+		return false;
+	}
+
+	result = read_record(btsnoop, tv, index, opcode, data, size);
+
+	if (btsnoop->replay_pos == btsnoop->replay_count) {
+		free(btsnoop->replay);
+		btsnoop->replay = NULL;
+		btsnoop->replay_count = 0;
+		btsnoop->replay_pos = 0;
+
+		if (!set_position(btsnoop, btsnoop->resume))
+			btsnoop->aborted = true;
+	}
+
+	return result;
+}
+
+static bool is_controller_opcode(uint16_t opcode)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		return true;
+	}
+
+	return false;
+}
+
+static bool get_conn_handle(uint16_t opcode, const void *data, uint16_t size,
+							uint16_t *handle)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		break;
+	default:
+		return false;
+	}
+
+	if (size < 2)
+		return false;
+
+	*handle = (((const uint8_t *) data)[0] |
+				((const uint8_t *) data)[1] << 8) & 0x0fff;
+
+	return true;
+}
+
+struct idx_handle {
+	uint16_t index;
+	uint16_t handle;
+	unsigned int count;
+};
+
+struct idx_builder {
+	struct btsnoop_idx_entry *entries;
+	size_t num_entries;
+	size_t max_entries;
+	struct idx_handle *handles;
+	size_t num_handles;
+};
+
+static bool idx_add(struct idx_builder *idx, uint64_t ts, off_t offset,
+					uint16_t index, uint16_t handle)
+{
+	struct btsnoop_idx_entry *entry;
+
+	if (idx->num_entries == idx->max_entries) {
+		size_t max = idx->max_entries ? idx->max_entries * 2 : 1024;
+
+		entry = realloc(idx->entries, max * sizeof(*entry));
+		if (!entry)
+			return false;
+
+		idx->entries = entry;
+		idx->max_entries = max;
+	}
+
+	entry = &idx->entries[idx->num_entries++];
+	entry->ts = htobe64(ts);
+	entry->offset = htobe64(offset);
+	entry->index = htobe16(index);
+	entry->handle = htobe16(handle);
+
+	return true;
+}
+
+static struct idx_handle *idx_get_handle(struct idx_builder *idx,
+					uint16_t index, uint16_t handle)
+{
+	struct idx_handle *h;
+	size_t i;
+
+	for (i = 0; i < idx->num_handles; i++) {
+		h = &idx->handles[i];
+
+		if (h->index == index && h->handle == handle)
+			return h;
+	}
+
+	h = realloc(idx->handles, (idx->num_handles + 1) * sizeof(*h));
+	if (!h)
+		return NULL;
+
+	idx->handles = h;
+
+	h = &idx->handles[idx->num_handles++];
+	h->index = index;
+	h->handle = handle;
+	h->count = 0;
+
+	return h;
+}
+
+static uint64_t tv_to_us(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/*
+ * Writes an index next to the file at path, with an entry every interval
+ * records, one for every controller record and one every interval records
+ * of each connection handle.
+ */
+bool btsnoop_write_index(const char *path, unsigned int interval)
+{
+	struct idx_builder idx = { };
+	struct btsnoop_idx_hdr hdr;
+	struct btsnoop *btsnoop;
+	unsigned int count = 0;
+	bool result = false;
+	ssize_t written;
+	int fd = -1;
+
+	if (!interval)
+		return false;
+
+	btsnoop = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop)
+		return false;
+
+	while (1) {
+		struct timeval tv;
+		uint16_t index, opcode, size, handle;
+		struct idx_handle *h;
+		const void *data;
+		off_t offset;
+
+		offset = get_position(btsnoop);
+		if (offset < 0)
+			goto done;
+
+		if (!read_record(btsnoop, &tv, &index, &opcode, &data, &size))
+			break;
+
+		if (!(count++ % interval) && !idx_add(&idx, tv_to_us(&tv),
+					offset, index, BTSNOOP_IDX_TIME))
+			goto done;
+
+		if (is_controller_opcode(opcode)) {
+			if (!idx_add(&idx, tv_to_us(&tv), offset, index,
+						BTSNOOP_IDX_CONTROLLER))
+				goto done;
+
+			continue;
+		}
+
+		if (!get_conn_handle(opcode, data, size, &handle))
+			continue;
+
+		h = idx_get_handle(&idx, index, handle);
+		if (!h)
+			goto done;
+
+		if (!(h->count++ % interval) && !idx_add(&idx, tv_to_us(&tv),
+						offset, index, handle))
+			goto done;
+	}
+
+	if (btsnoop->aborted || !btsnoop->idx_path)
+		goto done;
+
+	fd = open(btsnoop->idx_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		goto done;
+
+	memcpy(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id));
+	hdr.version = htobe32(btsnoop_idx_version);
+	hdr.interval = htobe32(interval);
+	hdr.size = htobe64(get_position(btsnoop));
+
+	written = write(fd, &hdr, BTSNOOP_IDX_HDR_SIZE);
+	if (written != BTSNOOP_IDX_HDR_SIZE)
+		goto done;
+
+	written = write(fd, idx.entries,
+				idx.num_entries * BTSNOOP_IDX_ENTRY_SIZE);
+	if (written < 0 ||
+		(size_t) written != idx.num_entries * BTSNOOP_IDX_ENTRY_SIZE)
+		goto done;
+
+	result = true;
+
+done:
+	if (fd >= 0) {
+		close(fd);
+
+		if (!result)
+			unlink(btsnoop->idx_path);
+	}
+
+	free(idx.entries);
+	free(idx.handles);
+	btsnoop_unref(btsnoop);
+
+	return result;
+}
+
+static struct btsnoop_idx_entry *load_index(struct btsnoop *btsnoop,
+							size_t *num_entries)
+{
+	struct btsnoop_idx_entry *entries;
+	struct btsnoop_idx_hdr hdr;
+	struct stat st;
+	ssize_t len;
+	size_t size;
+	int fd;
+
+	if (!btsnoop->idx_path)
+		return NULL;
+
+	fd = open(btsnoop->idx_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) BTSNOOP_IDX_HDR_SIZE)
+		goto failed;
+
+	len = read(fd, &hdr, BTSNOOP_IDX_HDR_SIZE);
+	if (len != BTSNOOP_IDX_HDR_SIZE)
+		goto failed;
+
+	if (memcmp(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id)) ||
+			be32toh(hdr.version) != btsnoop_idx_version)
+		goto failed;
+
+	/* The trace has been truncated or replaced since it was indexed */
+	if (fstat(btsnoop->fd, &st) < 0 ||
+			(uint64_t) st.st_size < be64toh(hdr.size))
+		goto failed;
+
+	if (fstat(fd, &st) < 0)
+		goto failed;
+
+	size = st.st_size - BTSNOOP_IDX_HDR_SIZE;
+	*num_entries = size / BTSNOOP_IDX_ENTRY_SIZE;
+
+	entries = malloc(size);
+	if (!entries)
+		goto failed;
+
+	len = read(fd, entries, size);
+	if (len < 0 || (size_t) len != size) {
+		free(entries);
+		goto failed;
+	}
+
+	close(fd);
+
+	return entries;
+
+failed:
+	close(fd);
+	return NULL;
+}
+
+off_t btsnoop_get_offset(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || btsnoop->replay)
+		return -1;
+
+	return get_position(btsnoop);
+}
+
+bool btsnoop_set_offset(struct btsnoop *btsnoop, off_t offset)
+{
+	if (!btsnoop || btsnoop->replay || offset < 0)
+		return false;
+
+	if (!set_position(btsnoop, offset))
+		return false;
+
+	btsnoop->aborted = false;
+
+	return true;
+}
+
+/*
+ * Uses the index written by btsnoop_write_index() to skip ahead to the last
+ * indexed record at or before tv, or to the first record of the connection
+ * handle if that comes later. Either one is optional. Controller records
+ * that are skipped are still returned first so the decoder knows about
+ * the controllers. Returns false if there is no index or nothing to skip.
+ */
+bool btsnoop_seek(struct btsnoop *btsnoop, const struct timeval *tv,
+					uint16_t index, uint16_t handle)
+{
+	struct btsnoop_idx_entry *entries;
+	size_t num_entries, i;
+	off_t current, target;
+	uint64_t ts = 0;
+
+	if (!btsnoop || btsnoop->aborted || btsnoop->replay)
+		return false;
+
+	current = get_position(btsnoop);
+	if (current < 0)
+		return false;
+
+	entries = load_index(btsnoop, &num_entries);
+	if (!entries)
+		return false;
+
+	if (tv)
+		ts = tv_to_us(tv);
+
+	target = current;
+
+	for (i = 0; i < num_entries && tv; i++) {
+		if (be16toh(entries[i].handle) != BTSNOOP_IDX_TIME)
+			continue;
+
+		if (be64toh(entries[i].ts) > ts)
+			break;
+
+		if ((off_t) be64toh(entries[i].offset) > target)
+			target = be64toh(entries[i].offset);
+	}
+
+	for (i = 0; i < num_entries && handle <= 0x0fff; i++) {
+		if (be16toh(entries[i].handle) != handle)
+			continue;
+
+		if (index != 0xffff && be16toh(entries[i].index) != index)
+			continue;
+
+		if ((off_t) be64toh(entries[i].offset) > target)
+			target = be64toh(entries[i].offset);
+
+		break;
+	}
+
+	if (target == current) {
+		free(entries);
+		return false;
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		off_t offset = be64toh(entries[i].offset);
+		off_t *replay;
+
+		if (be16toh(entries[i].handle) != BTSNOOP_IDX_CONTROLLER ||
+					offset < current || offset >= target)
+			continue;
+
+		replay = realloc(btsnoop->replay, (btsnoop->replay_count + 1) *
+							sizeof(*replay));
+		if (!replay)
+			break;
+
+		btsnoop->replay = replay;
+		btsnoop->replay[btsnoop->replay_count++] = offset;
+	}
+
+	free(entries);
+
+	btsnoop->replay_pos = 0;
+	btsnoop->resume = target;
+
+	if (btsnoop->replay_count)
+		return true;
+
+	return set_position(btsnoop, target);
+}
+
+bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					void *data, uint16_t *size)
+{
+	const void *ptr;
+
+	if (!btsnoop_next_hci(btsnoop, tv, index, opcode, &ptr, size))
+		return false;
+
+	memcpy(data, ptr, *size);
 
 	return true;
 }
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include <sys/types.h>
 
 #define BTSNOOP_FORMAT_INVALID		0
 #define BTSNOOP_FORMAT_HCI		1001
@@ -90,6 +91,8 @@ struct btsnoop;
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags);
 struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 				unsigned int max_count, uint32_t format);
+struct btsnoop *btsnoop_create_compressed(const char *path, size_t max_size,
+				unsigned int max_count, uint32_t format);
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop);
 void btsnoop_unref(struct btsnoop *btsnoop);
@@ -103,9 +106,19 @@ bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
 			const void *data, uint16_t size);
 bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t frequency, const void *data, uint16_t size);
+bool btsnoop_set_write_buffer(struct btsnoop *btsnoop, size_t size);
+bool btsnoop_flush(struct btsnoop *btsnoop);
 
 bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
 					void *data, uint16_t *size);
+bool btsnoop_next_hci(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					const void **data, uint16_t *size);
+bool btsnoop_write_index(const char *path, unsigned int interval);
+bool btsnoop_seek(struct btsnoop *btsnoop, const struct timeval *tv,
+					uint16_t index, uint16_t handle);
+off_t btsnoop_get_offset(struct btsnoop *btsnoop);
+bool btsnoop_set_offset(struct btsnoop *btsnoop, off_t offset);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
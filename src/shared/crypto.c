@@ -15,9 +15,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/socket.h>
 
 #include "src/shared/util.h"
+#include "src/shared/aes.h"
 #include "src/shared/crypto.h"
 
 #ifndef HAVE_LINUX_IF_ALG_H
@@ -64,8 +66,13 @@ struct af_alg_iv {
 
 #define ATT_SIGN_LEN	12
 
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
 struct bt_crypto {
 	int ref_count;
+	enum bt_crypto_backend backend;
 	int ecb_aes;
 	int urandom;
 	int cmac_aes;
@@ -126,40 +133,93 @@ static int cmac_aes_setup(void)
 	return fd;
 }
 
-static struct bt_crypto *singleton;
+static struct bt_crypto *singleton[BT_CRYPTO_BACKEND_SOFTWARE + 1];
 
-struct bt_crypto *bt_crypto_new(void)
+static struct bt_crypto *crypto_new(enum bt_crypto_backend backend)
 {
-	if (singleton)
-		return bt_crypto_ref(singleton);
+	struct bt_crypto *crypto;
 
-	singleton = new0(struct bt_crypto, 1);
+	crypto = new0(struct bt_crypto, 1);
+	crypto->backend = backend;
+	crypto->ecb_aes = -1;
+	crypto->cmac_aes = -1;
 
-	singleton->ecb_aes = ecb_aes_setup();
-	if (singleton->ecb_aes < 0) {
-		free(singleton);
-		singleton = NULL;
-		return NULL;
-	}
+	crypto->urandom = urandom_setup();
+	if (crypto->urandom < 0)
+		goto fail;
 
-	singleton->urandom = urandom_setup();
-	if (singleton->urandom < 0) {
-		close(singleton->ecb_aes);
-		free(singleton);
-		singleton = NULL;
-		return NULL;
-	}
+	/* The software backend does not need any kernel sockets */
+	if (backend == BT_CRYPTO_BACKEND_SOFTWARE)
+		return crypto;
+
+	crypto->ecb_aes = ecb_aes_setup();
+	if (crypto->ecb_aes < 0)
+		goto fail;
 
-	singleton->cmac_aes = cmac_aes_setup();
-	if (singleton->cmac_aes < 0) {
-		close(singleton->urandom);
-		close(singleton->ecb_aes);
-		free(singleton);
-		singleton = NULL;
+	crypto->cmac_aes = cmac_aes_setup();
+	if (crypto->cmac_aes < 0)
+		goto fail;
+
+	return crypto;
+
+fail:
+	if (crypto->ecb_aes >= 0)
+		close(crypto->ecb_aes);
+
+	if (crypto->urandom >= 0)
+		close(crypto->urandom);
+
+	free(crypto);
+	return NULL;
+}
+
+struct bt_crypto *bt_crypto_new_backend(enum bt_crypto_backend backend)
+{
+	struct bt_crypto *crypto;
+
+	switch (backend) {
+	case BT_CRYPTO_BACKEND_AUTO:
+		/*
+		 * Prefer the in-process implementation when the CPU has AES
+		 * instructions since it avoids several syscalls per block,
+		 * otherwise use AF_ALG and only fall back to the plain C
+		 * implementation if the kernel does not provide it.
+		 */
+		if (bt_aes_hw_support())
+			return bt_crypto_new_backend(
+						BT_CRYPTO_BACKEND_SOFTWARE);
+
+		crypto = bt_crypto_new_backend(BT_CRYPTO_BACKEND_KERNEL);
+		if (crypto)
+			return crypto;
+
+		return bt_crypto_new_backend(BT_CRYPTO_BACKEND_SOFTWARE);
+	case BT_CRYPTO_BACKEND_KERNEL:
+	case BT_CRYPTO_BACKEND_SOFTWARE:
+		break;
+	default:
 		return NULL;
 	}
 
-	return bt_crypto_ref(singleton);
+	if (singleton[backend])
+		return bt_crypto_ref(singleton[backend]);
+
+	singleton[backend] = crypto_new(backend);
+
+	return bt_crypto_ref(singleton[backend]);
+}
+
+struct bt_crypto *bt_crypto_new(void)
+{
+	return bt_crypto_new_backend(BT_CRYPTO_BACKEND_AUTO);
+}
+
+enum bt_crypto_backend bt_crypto_get_backend(struct bt_crypto *crypto)
+{
+	if (!crypto)
+		return BT_CRYPTO_BACKEND_AUTO;
+
+	return crypto->backend;
 }
 
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto)
@@ -181,11 +241,15 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
 
+	if (crypto->ecb_aes >= 0)
+		close(crypto->ecb_aes);
+
+	if (crypto->cmac_aes >= 0)
+		close(crypto->cmac_aes);
+
+	singleton[crypto->backend] = NULL;
 	free(crypto);
-	singleton = NULL;
 }
 
 bool bt_crypto_random_bytes(struct bt_crypto *crypto,
@@ -259,17 +323,87 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+/* AES-128 encryption of a single block, key and data in FIPS-197 order */
+static bool crypto_encrypt(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t in[16], uint8_t out[16])
+{
+	struct bt_aes aes;
+	bool ret;
+	int fd;
+
+	if (crypto->backend == BT_CRYPTO_BACKEND_SOFTWARE) {
+		bt_aes_set_key(&aes, key);
+		bt_aes_encrypt(&aes, in, out);
+		memset(&aes, 0, sizeof(aes));
+		return true;
+	}
+
+	fd = alg_new(crypto->ecb_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	ret = alg_encrypt(fd, in, 16, out, 16);
+
+	close(fd);
+
+	return ret;
+}
+
+/* AES-CMAC over a vector of buffers, key and data in RFC 4493 order */
+static bool crypto_cmac(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *iov, size_t iov_len,
+				uint8_t res[16])
+{
+	struct msghdr msg;
+	ssize_t len;
+	int fd;
+
+	if (crypto->backend == BT_CRYPTO_BACKEND_SOFTWARE) {
+		bt_aes_cmac(key, iov, iov_len, res);
+		return true;
+	}
+
+	fd = alg_new(crypto->cmac_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	memset(&msg, 0, sizeof(msg));
+
+	/*
+	 * Vectors longer than IOV_MAX are passed in chunks with MSG_MORE
+	 * so the kernel keeps accumulating them into the same digest.
+	 */
+	do {
+		msg.msg_iov = (struct iovec *) iov;
+		msg.msg_iovlen = iov_len > IOV_MAX ? IOV_MAX : iov_len;
+
+		iov += msg.msg_iovlen;
+		iov_len -= msg.msg_iovlen;
+
+		len = sendmsg(fd, &msg, iov_len ? MSG_MORE : 0);
+		if (len < 0) {
+			close(fd);
+			return false;
+		}
+	} while (iov_len);
+
+	len = read(fd, res, 16);
+
+	close(fd);
+
+	return len == 16;
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt,
 				uint8_t signature[ATT_SIGN_LEN])
 {
-	int fd;
-	int len;
 	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
 	uint8_t msg_s[msg_len];
+	struct iovec iov;
 
 	if (!crypto)
 		return false;
@@ -283,26 +417,14 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
 	/* Swap msg before signing */
 	swap_buf(msg, msg_s, msg_len);
 
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
+	iov.iov_base = msg_s;
+	iov.iov_len = msg_len;
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!crypto_cmac(crypto, tmp, &iov, 1, out))
 		return false;
-	}
-
-	close(fd);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -358,7 +480,6 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
 	uint8_t tmp[16], in[16], out[16];
-	int fd;
 
 	if (!crypto)
 		return false;
@@ -366,24 +487,15 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
-
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
+	if (!crypto_encrypt(crypto, tmp, in, out))
 		return false;
-	}
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -442,6 +554,86 @@ bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 	return true;
 }
 
+/* Number of IRKs whose key schedules are expanded at once */
+#define RESOLVE_BATCH	16
+
+/*
+ * Resolve a resolvable private address against a set of IRKs
+ *
+ * All keys are tried with the same r' = padding || prand so the software
+ * backend encrypts that block under a whole batch of keys at once, which
+ * lets the AES instructions of several keys be pipelined.
+ */
+bool bt_crypto_resolve_rpa(struct bt_crypto *crypto,
+				const uint8_t (*irks)[16], size_t num_irks,
+				const uint8_t rpa[6], size_t *index)
+{
+	struct bt_aes aes[RESOLVE_BATCH];
+	uint8_t rp[16], out[RESOLVE_BATCH][16];
+	size_t i, j, n;
+
+	if (!crypto || !irks || !rpa)
+		return false;
+
+	/* Only resolvable private addresses can be resolved */
+	if ((rpa[5] & 0xc0) != 0x40)
+		return false;
+
+	if (crypto->backend != BT_CRYPTO_BACKEND_SOFTWARE) {
+		for (i = 0; i < num_irks; i++) {
+			uint8_t hash[3];
+
+			if (!bt_crypto_ah(crypto, irks[i], rpa + 3, hash))
+				return false;
+
+			if (!memcmp(hash, rpa, 3))
+				goto done;
+		}
+
+		return false;
+	}
+
+	/* r' = padding || prand in most significant octet first order */
+	memset(rp, 0, 13);
+	swap_buf(rpa + 3, rp + 13, 3);
+
+	for (i = 0; i < num_irks; i += n) {
+		n = num_irks - i;
+		if (n > RESOLVE_BATCH)
+			n = RESOLVE_BATCH;
+
+		for (j = 0; j < n; j++) {
+			uint8_t key[16];
+
+			swap_buf(irks[i + j], key, 16);
+			bt_aes_set_key(&aes[j], key);
+		}
+
+		bt_aes_encrypt_multi(aes, n, rp, out);
+
+		/* ah(k, r) = e(k, r') mod 2^24 */
+		for (j = 0; j < n; j++) {
+			if (out[j][15] == rpa[0] && out[j][14] == rpa[1] &&
+							out[j][13] == rpa[2]) {
+				i += j;
+				goto done;
+			}
+		}
+	}
+
+	memset(aes, 0, sizeof(aes));
+
+	return false;
+
+done:
+	memset(aes, 0, sizeof(aes));
+
+	if (index)
+		*index = i;
+
+	return true;
+}
+
 typedef struct {
 	uint64_t a, b;
 } u128;
@@ -590,34 +782,22 @@ static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t *msg, size_t msg_len, uint8_t res[16])
 {
 	uint8_t key_msb[16], out[16], msg_msb[CMAC_MSG_MAX];
-	ssize_t len;
-	int fd;
+	struct iovec iov;
 
-	if (msg_len > CMAC_MSG_MAX)
+	if (!crypto || msg_len > CMAC_MSG_MAX)
 		return false;
 
 	swap_buf(key, key_msb, 16);
-	fd = alg_new(crypto->cmac_aes, key_msb, 16);
-	if (fd < 0)
-		return false;
-
 	swap_buf(msg, msg_msb, msg_len);
-	len = send(fd, msg_msb, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	iov.iov_base = msg_msb;
+	iov.iov_len = msg_len;
+
+	if (!crypto_cmac(crypto, key_msb, &iov, 1, out))
 		return false;
-	}
 
 	swap_buf(out, res, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -711,29 +891,9 @@ bool bt_crypto_gatt_hash(struct bt_crypto *crypto, struct iovec *iov,
 				size_t iov_len, uint8_t res[16])
 {
 	const uint8_t key[16] = {};
-	ssize_t len;
-	int fd;
 
 	if (!crypto)
 		return false;
 
-	fd = alg_new(crypto->cmac_aes, key, 16);
-	if (fd < 0)
-		return false;
-
-	len = writev(fd, iov, iov_len);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, res, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
-
-	return true;
+	return crypto_cmac(crypto, key, iov, iov_len, res);
 }
@@ -14,7 +14,15 @@
 
 struct bt_crypto;
 
+enum bt_crypto_backend {
+	BT_CRYPTO_BACKEND_AUTO,
+	BT_CRYPTO_BACKEND_KERNEL,
+	BT_CRYPTO_BACKEND_SOFTWARE,
+};
+
 struct bt_crypto *bt_crypto_new(void);
+struct bt_crypto *bt_crypto_new_backend(enum bt_crypto_backend backend);
+enum bt_crypto_backend bt_crypto_get_backend(struct bt_crypto *crypto);
 
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto);
 void bt_crypto_unref(struct bt_crypto *crypto);
@@ -26,6 +34,9 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16]);
 bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 					const uint8_t r[3], uint8_t hash[3]);
+bool bt_crypto_resolve_rpa(struct bt_crypto *crypto,
+				const uint8_t (*irks)[16], size_t num_irks,
+				const uint8_t rpa[6], size_t *index);
 bool bt_crypto_c1(struct bt_crypto *crypto, const uint8_t k[16],
 			const uint8_t r[16], const uint8_t pres[7],
 			const uint8_t preq[7], uint8_t iat,
@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include "ecc.h"
+#include "timeout.h"
 
 /* 256-bit curve */
 #define ECC_BYTES 32
@@ -594,9 +595,9 @@ static void ecc_point_double_jacobian(uint64_t *x1, uint64_t *y1, uint64_t *z1)
 	uint64_t t4[NUM_ECC_DIGITS];
 	uint64_t t5[NUM_ECC_DIGITS];
 
-	if (vli_is_zero(z1))
-		return;
-
+	/* No shortcut for z1 == 0, the point at infinity stays there anyway
+	 * and the fixed base comb relies on doubling taking the same time.
+	 */
 	vli_mod_square_fast(t4, y1);   /* t4 = y1^2 */
 	vli_mod_mult_fast(t5, x1, t4); /* t5 = x1*y1^2 = A */
 	vli_mod_square_fast(t4, t4);   /* t4 = y1^4 */
@@ -770,6 +771,275 @@ static void ecc_point_mult(struct ecc_point *result,
 	vli_set(result->y, ry[0]);
 }
 
+/* Fixed base comb with one tooth per 64-bit digit, split into two halves
+ * of 32 bits, so k * G takes 32 doublings and 64 mixed additions instead
+ * of the 256 steps of the ladder. Entry j - 1 of comb_table[s] holds the
+ * sum of 2^(64t + 32s) * G for every bit t set in j.
+ */
+#define COMB_TEETH	NUM_ECC_DIGITS
+#define COMB_HALF	32
+#define COMB_ENTRIES	((1 << COMB_TEETH) - 1)
+
+static const struct ecc_point comb_table[2][COMB_ENTRIES] = {
+	{
+		{ {	0xF4A13945D898C296ull, 0x77037D812DEB33A0ull,
+			0xF8BCE6E563A440F2ull, 0x6B17D1F2E12C4247ull },
+		  {	0xCBB6406837BF51F5ull, 0x2BCE33576B315ECEull,
+			0x8EE7EB4A7C0F9E16ull, 0x4FE342E2FE1A7F9Bull } },
+		{ {	0x90E75CB48E14DB63ull, 0x29493BAAAD651F7Eull,
+			0x8492592E326E25DEull, 0x0FA822BC2811AAA5ull },
+		  {	0xE41124545F462EE7ull, 0x34B1A65050FE82F5ull,
+			0x6F4AD4BCB3DF188Bull, 0xBFF44AE8F5DBA80Dull } },
+		{ {	0x93391CE2097992AFull, 0xE96C98FD0D35F1FAull,
+			0xB257C0DE95E02789ull, 0x300A4BBC89D6726Full },
+		  {	0xAA54A291C08127A0ull, 0x5BB1EEADA9D806A5ull,
+			0x7F1DDB25FF1E3C6Full, 0x72AAC7E0D09B4644ull } },
+		{ {	0x57C84FC9D789BD85ull, 0xFC35FF7DC297EAC3ull,
+			0xFB982FD588C6766Eull, 0x447D739BEEDB5E67ull },
+		  {	0x0C7E33C972E25B32ull, 0x3D349B95A7FAE500ull,
+			0xE12E9D953A4AAFF7ull, 0x2D4825AB834131EEull } },
+		{ {	0x13949C932A1D367Full, 0xEF7FBD2B1A0A11B7ull,
+			0xDDC6068BB91DFC60ull, 0xEF9519328A9C72FFull },
+		  {	0x196035A77376D8A8ull, 0x23183B0895CA1740ull,
+			0xC1EE9807022C219Cull, 0x611E9FC37DBB2C9Bull } },
+		{ {	0xCAE2B1920B57F4BCull, 0x2936DF5EC6C9BC36ull,
+			0x7DEA6482E11238BFull, 0x550663797B51F5D8ull },
+		  {	0x44FFE216348A964Cull, 0x9FB3D576DBDEFBE1ull,
+			0x0AFA40018D9D50E5ull, 0x157164848AECB851ull } },
+		{ {	0xE48ECAFFFC5CDE01ull, 0x7CCD84E70D715F26ull,
+			0xA2E8F483F43E4391ull, 0xEB5D7745B21141EAull },
+		  {	0xCAC917E2731A3479ull, 0x85F22CFE2844B645ull,
+			0x0990E6A158006CEEull, 0xEAFD72EBDBECC17Bull } },
+		{ {	0x6CF20FFB313728BEull, 0x96439591A3C6B94Aull,
+			0x2736FF8344315FC5ull, 0xA6D39677A7849276ull },
+		  {	0xF2BAB833C357F5F4ull, 0x824A920C2284059Bull,
+			0x66B8BABD2D27ECDFull, 0x674F84749B0B8816ull } },
+		{ {	0x2DF48C04677C8A3Eull, 0x74E02F080203A56Bull,
+			0x31855F7DB8C7FEDBull, 0x4E769E7672C9DDADull },
+		  {	0xA4C36165B824BBB0ull, 0xFB9AE16F3B9122A5ull,
+			0x1EC0057206947281ull, 0x42B99082DE830663ull } },
+		{ {	0x6EF95150DDA868B9ull, 0xD1F89E799C0CE131ull,
+			0x7FDC1CA008A1C478ull, 0x78878EF61C6CE04Dull },
+		  {	0x9C62B9121FE0D976ull, 0x6ACE570EBDE08D4Full,
+			0xDE53142C12309DEFull, 0xB6CB3F5D7B72C321ull } },
+		{ {	0x7F991ED2C31A3573ull, 0x5B82DD5BD54FB496ull,
+			0x595C5220812FFCAEull, 0x0C88BC4D716B1287ull },
+		  {	0x3A57BF635F48ACA8ull, 0x7C8181F4DF2564F3ull,
+			0x18D1B5B39C04E6AAull, 0xDD5DDEA3F3901DC6ull } },
+		{ {	0xE96A79FB3E72AD0Cull, 0x43A0A28C42BA792Full,
+			0xEFE0A423083E49F3ull, 0x68F344AF6B317466ull },
+		  {	0xCDFE17DB3FB24D4Aull, 0x668BFC2271F5C626ull,
+			0x604ED93C24D67FF3ull, 0x31B9C405F8540A20ull } },
+		{ {	0xD36B4789A2582E7Full, 0x0D1A10144EC39C28ull,
+			0x663C62C3EDBAD7A0ull, 0x4052BF4B6F461DB9ull },
+		  {	0x235A27C3188D25EBull, 0xE724F33999BFCC5Bull,
+			0x862BE6BD71D70CC8ull, 0xFECF4D5190B0FC61ull } },
+		{ {	0x74346C10A1D4CFACull, 0xAFDF5CC08526A7A4ull,
+			0x123202A8F62BFF7Aull, 0x1EDDBAE2C802E41Aull },
+		  {	0x8FA0AF2DD603F844ull, 0x36E06B7E4C701917ull,
+			0x0C45F45273DB33A0ull, 0x43104D86560EBCFCull } },
+		{ {	0x9615B5110D1D78E5ull, 0x66B0DE3225C4744Bull,
+			0x0A4A46FB6AAF363Aull, 0xB48E26B484F7A21Cull },
+		  {	0x06EBB0F621A01B2Dull, 0xC004E4048B7B0F98ull,
+			0x64131BCDFED6F668ull, 0xFAC015404D4D3DABull } },
+	},
+	{
+		{ {	0x3A5A9E22185A5943ull, 0x1AB919365C65DFB6ull,
+			0x21656B32262C71DAull, 0x7FE36B40AF22AF89ull },
+		  {	0xD50D152C699CA101ull, 0x74B3D5867B8AF212ull,
+			0x9F09F40407DCA6F1ull, 0xE697D45825B63624ull } },
+		{ {	0xA84AA9397512218Eull, 0xE9A521B074CA0141ull,
+			0x57880B3A18A2E902ull, 0x4A5B506612A677A6ull },
+		  {	0x0BEADA7A4C4F3840ull, 0x626DB15419E26D9Dull,
+			0xC42604FBE1627D40ull, 0xEB13461CEAC089F1ull } },
+		{ {	0xF9FAED0927A43281ull, 0x5E52C4144103ECBCull,
+			0xC342967AA815C857ull, 0x0781B8291C6A220Aull },
+		  {	0x5A8343CEEAC55F80ull, 0x88F80EEEE54A05E3ull,
+			0x97B2A14F12916434ull, 0x690CDE8DF0151593ull } },
+		{ {	0xAEE9C75DF7F82F2Aull, 0x9E4C35874AFDF43Aull,
+			0xF5622DF437371326ull, 0x8A535F566EC73617ull },
+		  {	0xC5F9A0AC223094B7ull, 0xCDE533864C8C7669ull,
+			0x37E02819085A92BFull, 0x0455C08468B08BD7ull } },
+		{ {	0x0C0A6E2C9477B5D9ull, 0xF9A4BF62876DC444ull,
+			0x5050A949B6CDC279ull, 0x06BADA7AB77F8276ull },
+		  {	0xC8B4AED1EA48DAC9ull, 0xDEBD8A4B7EA1070Full,
+			0x427D49101366EB70ull, 0x5B476DFD0E6CB18Aull } },
+		{ {	0x7C5C3E44278C340Aull, 0x4D54606812D66F3Bull,
+			0x29A751B1AE23C5D8ull, 0x3E29864E8A2EC908ull },
+		  {	0x142D2A6626DBB850ull, 0xAD1744C4765BD780ull,
+			0x1F150E68E322D1EDull, 0x239B90EA3DC31E7Eull } },
+		{ {	0x78C416527A53322Aull, 0x305DDE6709776F8Eull,
+			0xDBCAB759F8862ED4ull, 0x820F4DD949F72FF7ull },
+		  {	0x6CC544A62B5DEBD4ull, 0x75BE5D937B4E8CC4ull,
+			0x1B481B1B215C14D3ull, 0x140406EC783A05ECull } },
+		{ {	0x6A703F10E895DF07ull, 0xFD75F3FA01876BD8ull,
+			0xEB5B06E70CE08FFEull, 0x68F6B8542783DFEEull },
+		  {	0x90C76F8A78712655ull, 0xCF5293D2F310BF7Full,
+			0xFBC8044DFDA45028ull, 0xCBE1FEBA92E40CE6ull } },
+		{ {	0xE998CEEA4396E4C1ull, 0xFC82EF0B6ACEA274ull,
+			0x230F729F2250E927ull, 0xD0B2F94D2F420109ull },
+		  {	0x4305ADDDB38D4966ull, 0x10B838F8624C3B45ull,
+			0x7DB2636658954E7Aull, 0x971459828B0719E5ull } },
+		{ {	0x4BD6B72623369FC9ull, 0x57F2929E53D0B876ull,
+			0xC2D5CBA4F2340687ull, 0x961610004A866ABAull },
+		  {	0x49997BCD2E407A5Eull, 0x69AB197D92DDCB24ull,
+			0x2CF1F2438FE5131Cull, 0x7ACB9FADCEE75E44ull } },
+		{ {	0x254E839423D2D4C0ull, 0xF57F0C917AEA685Bull,
+			0xA60D880F6F75AAEAull, 0x24EB9ACCA333BF5Bull },
+		  {	0xE3DE4CCB1CDA5DEAull, 0xFEEF9341C51A6B4Full,
+			0x743125F88BAC4C4Dull, 0x69F891C5ACD079CCull } },
+		{ {	0xEEE44B35702476B5ull, 0x7ED031A0E45C2258ull,
+			0xB422D1E7BD6F8514ull, 0xE51F547C5972A107ull },
+		  {	0xA25BCD6FC9CF343Dull, 0x8CA922EE097C184Eull,
+			0xA62F98B3A9FE9A06ull, 0x1C309A2B25BB1387ull } },
+		{ {	0x9295DBEB1967C459ull, 0xB00148833472C98Eull,
+			0xC504977708011828ull, 0x20B87B8AA2C4E503ull },
+		  {	0x3063175DE057C277ull, 0x1BD539338FE582DDull,
+			0x0D11ADEF5F69A044ull, 0xF5C6FA49919776BEull } },
+		{ {	0x8C944E760FD59E11ull, 0x3876CBA1102FAD5Full,
+			0xA454C3FAD83FAA56ull, 0x1ED7D1B9332010B9ull },
+		  {	0xA1011A270024B889ull, 0x05E4D0DCAC0CD344ull,
+			0x52B520F0EB6A2A24ull, 0x3A2B03F03217257Aull } },
+		{ {	0xF20FC2AFDF1D043Dull, 0xF330240DB58D5A62ull,
+			0xFC7D229CA0058C3Bull, 0x15FEE545C78DD9F6ull },
+		  {	0x501E82885BC98CDAull, 0x41EF80E5D046AC04ull,
+			0x557D9F49461210FBull, 0x4AB5B6B2B8753F81ull } },
+	},
+};
+
+/* Set dest to src if mask is all ones, leave it if mask is zero */
+static void vli_cmov(uint64_t *dest, const uint64_t *src, uint64_t mask)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		dest[i] ^= (dest[i] ^ src[i]) & mask;
+}
+
+/* Reads every entry whatever the index, index 0 stands for the point at
+ * infinity and gets the first entry as a placeholder.
+ */
+static void comb_lookup(struct ecc_point *result, unsigned int half,
+							unsigned int index)
+{
+	unsigned int j;
+	uint64_t mask;
+
+	vli_set(result->x, comb_table[half][0].x);
+	vli_set(result->y, comb_table[half][0].y);
+
+	for (j = 1; j < COMB_ENTRIES; j++) {
+		mask = -(((uint64_t) ((j + 1) ^ index) - 1) >> 63);
+
+		vli_cmov(result->x, comb_table[half][j].x, mask);
+		vli_cmov(result->y, comb_table[half][j].y, mask);
+	}
+}
+
+/* (x1, y1, z1) => (x1, y1, z1) + point, with point in affine coordinates */
+static void ecc_point_add_mixed(uint64_t *x1, uint64_t *y1, uint64_t *z1,
+						const struct ecc_point *point)
+{
+	uint64_t t1[NUM_ECC_DIGITS];
+	uint64_t t2[NUM_ECC_DIGITS];
+	uint64_t t3[NUM_ECC_DIGITS];
+	uint64_t t4[NUM_ECC_DIGITS];
+
+	vli_mod_square_fast(t1, z1);         /* t1 = z1^2 */
+	vli_mod_mult_fast(t2, t1, z1);       /* t2 = z1^3 */
+	vli_mod_mult_fast(t1, t1, point->x); /* t1 = x2*z1^2 */
+	vli_mod_mult_fast(t2, t2, point->y); /* t2 = y2*z1^3 */
+	vli_mod_sub(t1, t1, x1, curve_p);    /* t1 = x2*z1^2 - x1 = H */
+	vli_mod_sub(t2, t2, y1, curve_p);    /* t2 = y2*z1^3 - y1 = R */
+	vli_mod_mult_fast(z1, z1, t1);       /* z1 = z1*H = z3 */
+
+	vli_mod_square_fast(t3, t1);         /* t3 = H^2 */
+	vli_mod_mult_fast(t4, t3, t1);       /* t4 = H^3 */
+	vli_mod_mult_fast(t3, t3, x1);       /* t3 = x1*H^2 */
+	vli_mod_square_fast(x1, t2);         /* x1 = R^2 */
+	vli_mod_sub(x1, x1, t4, curve_p);    /* x1 = R^2 - H^3 */
+	vli_mod_sub(x1, x1, t3, curve_p);
+	vli_mod_sub(x1, x1, t3, curve_p);    /* x1 = R^2 - H^3 - 2*x1*H^2 = x3 */
+
+	vli_mod_sub(t3, t3, x1, curve_p);    /* t3 = x1*H^2 - x3 */
+	vli_mod_mult_fast(t3, t3, t2);       /* t3 = R*(x1*H^2 - x3) */
+	vli_mod_mult_fast(t4, t4, y1);       /* t4 = y1*H^3 */
+	vli_mod_sub(y1, t3, t4, curve_p);    /* y1 = y3 */
+}
+
+/* Computes scalar * G with the same sequence of operations and memory
+ * accesses for every scalar. Returns false in the exceptional case of an
+ * addition turning into a doubling, which the caller handles with the
+ * ladder instead.
+ */
+static bool ecc_point_mult_comb(struct ecc_point *result,
+						const uint64_t *scalar)
+{
+	uint64_t x[NUM_ECC_DIGITS], y[NUM_ECC_DIGITS], z[NUM_ECC_DIGITS];
+	uint64_t sx[NUM_ECC_DIGITS], sy[NUM_ECC_DIGITS], sz[NUM_ECC_DIGITS];
+	uint64_t one[NUM_ECC_DIGITS] = { 1 };
+	uint64_t infinity = ~0ull, add;
+	struct ecc_point point;
+	unsigned int half, index, bit;
+	int i, t;
+
+	vli_clear(x);
+	vli_clear(y);
+	vli_clear(z);
+
+	for (i = COMB_HALF - 1; i >= 0; i--) {
+		ecc_point_double_jacobian(x, y, z);
+
+		for (half = 0; half < 2; half++) {
+			bit = half * COMB_HALF + i;
+			index = 0;
+
+			for (t = 0; t < COMB_TEETH; t++)
+				index |= (scalar[t] >> bit & 1) << t;
+
+			comb_lookup(&point, half, index);
+
+			vli_set(sx, x);
+			vli_set(sy, y);
+			vli_set(sz, z);
+			ecc_point_add_mixed(sx, sy, sz, &point);
+
+			/* Adding infinity keeps the sum as it is, adding to
+			 * infinity gives the table entry.
+			 */
+			add = -(uint64_t) ((index + COMB_ENTRIES) >> COMB_TEETH);
+
+			vli_cmov(x, sx, add & ~infinity);
+			vli_cmov(y, sy, add & ~infinity);
+			vli_cmov(z, sz, add & ~infinity);
+			vli_cmov(x, point.x, add & infinity);
+			vli_cmov(y, point.y, add & infinity);
+			vli_cmov(z, one, add & infinity);
+
+			infinity &= ~add;
+		}
+	}
+
+	if (infinity || vli_is_zero(z))
+		return false;
+
+	vli_mod_inv(z, z, curve_p);
+	vli_mod_square_fast(sz, z);
+	vli_mod_mult_fast(result->x, x, sz);
+	vli_mod_mult_fast(sz, sz, z);
+	vli_mod_mult_fast(result->y, y, sz);
+
+	return true;
+}
+
+static void ecc_point_mult_g(struct ecc_point *result, uint64_t *scalar)
+{
+	if (ecc_point_mult_comb(result, scalar))
+		return;
+
+	ecc_point_mult(result, &curve_g, scalar, NULL, vli_num_bits(scalar));
+}
+
 static bool ecc_valid_point(const struct ecc_point *point)
 {
 	uint64_t tmp1[NUM_ECC_DIGITS];
@@ -853,7 +1123,7 @@ bool ecc_make_public_key(const uint8_t private_key[32], uint8_t public_key[64])
 	if (vli_cmp(curve_n, priv) != 1)
 		return false;
 
-	ecc_point_mult(&pk, &curve_g, priv, NULL, vli_num_bits(priv));
+	ecc_point_mult_g(&pk, priv);
 
 	if (ecc_point_is_zero(&pk))
 		return false;
@@ -864,7 +1134,7 @@ bool ecc_make_public_key(const uint8_t private_key[32], uint8_t public_key[64])
 	return true;
 }
 
-bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
+static bool generate_key(uint8_t public_key[64], uint8_t private_key[32])
 {
 	struct ecc_point pk;
 	uint64_t priv[NUM_ECC_DIGITS];
@@ -881,7 +1151,7 @@ bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
 		if (vli_cmp(curve_n, priv) != 1)
 			continue;
 
-		ecc_point_mult(&pk, &curve_g, priv, NULL, vli_num_bits(priv));
+		ecc_point_mult_g(&pk, priv);
 	} while (ecc_point_is_zero(&pk));
 
 	ecc_native2bytes(priv, private_key);
@@ -891,6 +1161,100 @@ bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
 	return true;
 }
 
+struct key_pair {
+	uint8_t public_key[64];
+	uint8_t private_key[32];
+};
+
+static struct key_pair *pool;
+static unsigned int pool_size;
+static unsigned int pool_count;
+static unsigned int pool_timeout;
+
+static bool pool_refill(void *user_data)
+{
+	struct key_pair *pair;
+
+	/* One key pair per run so that the mainloop stays responsive */
+	if (pool_count < pool_size) {
+		pair = &pool[pool_count];
+
+		if (generate_key(pair->public_key, pair->private_key))
+			pool_count++;
+	}
+
+	if (pool_count < pool_size)
+		return true;
+
+	pool_timeout = 0;
+
+	return false;
+}
+
+static void pool_schedule(void)
+{
+	if (pool_timeout || pool_count >= pool_size)
+		return;
+
+	pool_timeout = timeout_add(1, pool_refill, NULL, NULL);
+}
+
+bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
+{
+	struct key_pair *pair;
+
+	if (!pool_count) {
+		pool_schedule();
+		return generate_key(public_key, private_key);
+	}
+
+	/* Every pooled key pair is handed out exactly once */
+	pair = &pool[--pool_count];
+
+	memcpy(public_key, pair->public_key, sizeof(pair->public_key));
+	memcpy(private_key, pair->private_key, sizeof(pair->private_key));
+	memset(pair, 0, sizeof(*pair));
+
+	pool_schedule();
+
+	return true;
+}
+
+bool ecc_set_key_pool(unsigned int count)
+{
+	struct key_pair *new_pool;
+
+	if (pool_count > count) {
+		memset(&pool[count], 0, (pool_count - count) * sizeof(*pool));
+		pool_count = count;
+	}
+
+	if (!count) {
+		timeout_remove(pool_timeout);
+		pool_timeout = 0;
+		free(pool);
+		pool = NULL;
+		pool_size = 0;
+		return true;
+	}
+
+	new_pool = realloc(pool, count * sizeof(*pool));
+	if (!new_pool)
+		return false;
+
+	pool = new_pool;
+	pool_size = count;
+
+	pool_schedule();
+
+	return true;
+}
+
+unsigned int ecc_get_key_pool(void)
+{
+	return pool_count;
+}
+
 bool ecc_valid_public_key(const uint8_t public_key[64])
 {
 	struct ecc_point pk;
@@ -32,6 +32,23 @@ bool ecc_make_public_key(const uint8_t private_key[32], uint8_t public_key[64]);
  */
 bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32]);
 
+/* Keep a pool of precomputed key pairs for ecc_make_key().
+ *
+ * Inputs:
+ *	count - Number of key pairs to keep ready, 0 disables the pool.
+ *
+ * The pool is filled one key pair at a time from a timeout of the
+ * mainloop and refilled whenever ecc_make_key() takes a key pair out
+ * of it. Each key pair is only ever handed out once.
+ *
+ * Returns true if the pool was resized successfully, false if an
+ * error occurred.
+ */
+bool ecc_set_key_pool(unsigned int count);
+
+/* Returns the number of precomputed key pairs currently in the pool. */
+unsigned int ecc_get_key_pool(void);
+
 /* Check to see if a public key is valid.
  *
  * Inputs:
@@ -0,0 +1,644 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+
+/*
+ * The cache starts with a header and a table of all services, followed by
+ * the attributes of each service in handle order:
+ *
+ *   header:	magic[4] version[1] num_services[2]
+ *   service:	start[2] end[2] primary[1] num_attrs[2] uuid_len[1] uuid
+ *   attribute:	type[1] handle[2] uuid_len[1] uuid value_len[2] value
+ *
+ * Values are little endian. Included services store the start handle of the
+ * service they include as value and characteristics store their properties
+ * followed by any value worth caching, with the handle being the one of the
+ * characteristic value.
+ *
+ * Only values that cannot change without the Database Hash changing as well
+ * are worth caching, such as the HID Report Map and Report References which
+ * would otherwise be read again on every reconnection.
+ */
+
+#define CACHE_MAGIC		"BZGC"
+#define CACHE_VERSION		2
+
+#define CACHE_INCL		0x01
+#define CACHE_CHRC		0x02
+#define CACHE_DESC		0x03
+
+
+struct cache_buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	bool failed;
+};
+
+struct cache_saver {
+	struct gatt_db *db;
+	struct cache_buf *buf;
+	size_t count_offset;
+	uint16_t count;
+	uint16_t value_handle;
+	uint16_t ext_props;
+};
+
+struct cache_reader {
+	const uint8_t *data;
+	size_t len;
+};
+
+static void *buf_reserve(struct cache_buf *buf, size_t len)
+{
+	void *ptr;
+
+	if (buf->failed)
+		return NULL;
+
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size : 512;
+		uint8_t *data;
+
+		while (size < buf->len + len)
+			size *= 2;
+
+		data = realloc(buf->data, size);
+		if (!data) {
+			buf->failed = true;
+			return NULL;
+		}
+
+		buf->data = data;
+		buf->size = size;
+	}
+
+	ptr = buf->data + buf->len;
+	buf->len += len;
+
+	return ptr;
+}
+
+static void buf_put(struct cache_buf *buf, const void *data, size_t len)
+{
+	void *ptr = buf_reserve(buf, len);
+
+	if (ptr)
+		memcpy(ptr, data, len);
+}
+
+static void buf_put_u8(struct cache_buf *buf, uint8_t value)
+{
+	buf_put(buf, &value, sizeof(value));
+}
+
+static void buf_put_le16(struct cache_buf *buf, uint16_t value)
+{
+	void *ptr = buf_reserve(buf, sizeof(value));
+
+	if (ptr)
+		put_le16(value, ptr);
+}
+
+static void buf_put_uuid(struct cache_buf *buf, const bt_uuid_t *uuid)
+{
+	uint8_t *ptr;
+
+	if (!uuid) {
+		buf_put_u8(buf, 0);
+		return;
+	}
+
+	if (uuid->type == BT_UUID16) {
+		buf_put_u8(buf, 2);
+		buf_put_le16(buf, uuid->value.u16);
+		return;
+	}
+
+	buf_put_u8(buf, 16);
+
+	ptr = buf_reserve(buf, 16);
+	if (ptr)
+		bt_uuid_to_le(uuid, ptr);
+}
+
+static void put_attribute(struct cache_saver *saver, uint8_t type,
+					uint16_t handle, const bt_uuid_t *uuid,
+					const uint8_t *value, uint16_t len)
+{
+	buf_put_u8(saver->buf, type);
+	buf_put_le16(saver->buf, handle);
+	buf_put_uuid(saver->buf, uuid);
+	buf_put_le16(saver->buf, len);
+	buf_put(saver->buf, value, len);
+
+	saver->count++;
+}
+
+static void read_value_cb(struct gatt_db_attribute *attrib, int err,
+					const uint8_t *value, size_t length,
+					void *user_data)
+{
+	struct iovec *iov = user_data;
+
+	if (err)
+		return;
+
+	iov->iov_base = (void *) value;
+	iov->iov_len = length;
+}
+
+static size_t get_value(struct gatt_db_attribute *attr, struct iovec *iov,
+								size_t max_len)
+{
+	iov->iov_len = 0;
+
+	gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
+							read_value_cb, iov);
+	if (iov->iov_len > max_len)
+		iov->iov_len = 0;
+
+	return iov->iov_len;
+}
+
+static void store_incl(struct cache_saver *saver,
+					struct gatt_db_attribute *attr)
+{
+	uint16_t handle, start, end;
+	uint8_t value[2];
+
+	if (!gatt_db_attribute_get_incl_data(attr, &handle, &start, &end)) {
+		saver->buf->failed = true;
+		return;
+	}
+
+	put_le16(start, value);
+
+	put_attribute(saver, CACHE_INCL, handle, NULL, value, sizeof(value));
+}
+
+static void store_chrc(struct cache_saver *saver,
+					struct gatt_db_attribute *attr)
+{
+	struct gatt_db_attribute *value_attr;
+	struct iovec iov = { NULL, 0 };
+	uint16_t handle;
+	uint8_t value[1 + BT_ATT_MAX_VALUE_LEN];
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_char_data(attr, &handle,
+						&saver->value_handle, &value[0],
+						&saver->ext_props, &uuid)) {
+		saver->buf->failed = true;
+		return;
+	}
+
+	value_attr = gatt_db_get_attribute(saver->db, saver->value_handle);
+
+	if (uuid.type == BT_UUID16) {
+		switch (uuid.value.u16) {
+		case GATT_CHARAC_DB_HASH:
+			/* What validates the cache on reconnection */
+			if (get_value(value_attr, &iov, 16) != 16)
+				iov.iov_len = 0;
+			break;
+		case GATT_CHARAC_REPORT_MAP:
+			get_value(value_attr, &iov, BT_ATT_MAX_VALUE_LEN);
+			break;
+		}
+	}
+
+	if (iov.iov_len)
+		memcpy(&value[1], iov.iov_base, iov.iov_len);
+
+	put_attribute(saver, CACHE_CHRC, saver->value_handle, &uuid, value,
+							1 + iov.iov_len);
+}
+
+static void store_desc(struct cache_saver *saver,
+					struct gatt_db_attribute *attr)
+{
+	const bt_uuid_t *uuid = gatt_db_attribute_get_type(attr);
+	uint8_t value[2];
+	struct iovec iov = { value, 0 };
+
+	if (uuid->type == BT_UUID16) {
+		switch (uuid->value.u16) {
+		case GATT_CHARAC_EXT_PROPER_UUID:
+			if (!saver->ext_props)
+				break;
+
+			put_le16(saver->ext_props, value);
+			iov.iov_base = value;
+			iov.iov_len = sizeof(value);
+			break;
+		case GATT_EXTERNAL_REPORT_REFERENCE:
+		case GATT_REPORT_REFERENCE:
+			get_value(attr, &iov, 16);
+			break;
+		}
+	}
+
+	put_attribute(saver, CACHE_DESC, gatt_db_attribute_get_handle(attr),
+						uuid, iov.iov_base, iov.iov_len);
+}
+
+static void store_attribute(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_saver *saver = user_data;
+	const bt_uuid_t *uuid = gatt_db_attribute_get_type(attr);
+	uint16_t handle = gatt_db_attribute_get_handle(attr);
+
+	/* Values are implied by the characteristic declaration */
+	if (handle == saver->value_handle)
+		return;
+
+	if (uuid->type == BT_UUID16) {
+		switch (uuid->value.u16) {
+		case GATT_INCLUDE_UUID:
+			store_incl(saver, attr);
+			return;
+		case GATT_CHARAC_UUID:
+			store_chrc(saver, attr);
+			return;
+		}
+	}
+
+	store_desc(saver, attr);
+}
+
+static void store_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_saver *saver = user_data;
+	struct cache_buf *buf = saver->buf;
+	uint16_t start, end;
+	bool primary;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+								&uuid)) {
+		buf->failed = true;
+		return;
+	}
+
+	buf_put_le16(buf, start);
+	buf_put_le16(buf, end);
+	buf_put_u8(buf, primary);
+	buf_put_le16(buf, 0);
+	buf_put_uuid(buf, &uuid);
+}
+
+static void store_service_attributes(struct gatt_db_attribute *attr,
+							void *user_data)
+{
+	struct cache_saver *saver = user_data;
+	struct cache_buf *buf = saver->buf;
+	uint16_t start, end;
+
+	gatt_db_attribute_get_service_handles(attr, &start, &end);
+
+	saver->count = 0;
+	saver->value_handle = start;
+	saver->ext_props = 0;
+
+	gatt_db_service_foreach(attr, NULL, store_attribute, saver);
+
+	if (buf->failed)
+		return;
+
+	/* Fill in the attribute count left empty in the service table */
+	put_le16(saver->count, buf->data + saver->count_offset + 5);
+	saver->count_offset += 8 + buf->data[saver->count_offset + 7];
+}
+
+static void count_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	uint16_t *count = user_data;
+
+	(*count)++;
+}
+
+static bool write_file(const char *filename, const void *data, size_t len)
+{
+	char tmpname[PATH_MAX];
+	ssize_t written;
+	int fd;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >=
+							(int) sizeof(tmpname))
+		return false;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	written = write(fd, data, len);
+	close(fd);
+
+	/* Replace the cache atomically so it is never left half written */
+	if (written != (ssize_t) len || rename(tmpname, filename) < 0) {
+		unlink(tmpname);
+		return false;
+	}
+
+	return true;
+}
+
+bool gatt_cache_store(struct gatt_db *db, const char *filename)
+{
+	struct cache_buf buf;
+	struct cache_saver saver;
+	uint16_t num_services = 0;
+	bool result;
+
+	if (!db || !filename)
+		return false;
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&saver, 0, sizeof(saver));
+	saver.db = db;
+	saver.buf = &buf;
+
+	gatt_db_foreach_service(db, NULL, count_service, &num_services);
+
+	buf_put(&buf, CACHE_MAGIC, 4);
+	buf_put_u8(&buf, CACHE_VERSION);
+	buf_put_le16(&buf, num_services);
+
+	saver.count_offset = buf.len;
+
+	gatt_db_foreach_service(db, NULL, store_service, &saver);
+	gatt_db_foreach_service(db, NULL, store_service_attributes, &saver);
+
+	result = !buf.failed && write_file(filename, buf.data, buf.len);
+
+	free(buf.data);
+
+	return result;
+}
+
+static bool read_u8(struct cache_reader *reader, uint8_t *value)
+{
+	if (reader->len < 1)
+		return false;
+
+	*value = reader->data[0];
+
+	reader->data++;
+	reader->len--;
+
+	return true;
+}
+
+static bool read_le16(struct cache_reader *reader, uint16_t *value)
+{
+	if (reader->len < 2)
+		return false;
+
+	*value = get_le16(reader->data);
+
+	reader->data += 2;
+	reader->len -= 2;
+
+	return true;
+}
+
+static bool read_data(struct cache_reader *reader, const uint8_t **data,
+								size_t len)
+{
+	if (reader->len < len)
+		return false;
+
+	*data = reader->data;
+
+	reader->data += len;
+	reader->len -= len;
+
+	return true;
+}
+
+static bool read_value(struct cache_reader *reader, const uint8_t **value,
+								uint16_t *len)
+{
+	return read_le16(reader, len) && read_data(reader, value, *len);
+}
+
+static bool read_uuid(struct cache_reader *reader, bt_uuid_t *uuid)
+{
+	const uint8_t *data;
+	uint128_t u128;
+	uint8_t len;
+
+	if (!read_u8(reader, &len) || !read_data(reader, &data, len))
+		return false;
+
+	switch (len) {
+	case 2:
+		bt_uuid16_create(uuid, get_le16(data));
+		return true;
+	case 16:
+		bswap_128(data, &u128);
+		bt_uuid128_create(uuid, u128);
+		return true;
+	}
+
+	return false;
+}
+
+static void load_value_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+}
+
+static bool load_value(struct gatt_db_attribute *attr, const uint8_t *value,
+								uint16_t len)
+{
+	if (!len)
+		return true;
+
+	return gatt_db_attribute_write(attr, 0, value, len, 0, NULL,
+							load_value_cb, NULL);
+}
+
+static bool load_attribute(struct cache_reader *reader, struct gatt_db *db,
+					struct gatt_db_attribute *service)
+{
+	struct gatt_db_attribute *attr;
+	const uint8_t *value;
+	uint16_t handle, len;
+	uint8_t type, uuid_len;
+	bt_uuid_t uuid;
+
+	if (!read_u8(reader, &type) || !read_le16(reader, &handle))
+		return false;
+
+	if (type == CACHE_INCL) {
+		if (!read_u8(reader, &uuid_len) || uuid_len)
+			return false;
+	} else if (!read_uuid(reader, &uuid))
+		return false;
+
+	if (!read_value(reader, &value, &len))
+		return false;
+
+	switch (type) {
+	case CACHE_INCL:
+		if (len != 2)
+			return false;
+
+		attr = gatt_db_get_service(db, get_le16(value));
+		if (!attr)
+			return false;
+
+		attr = gatt_db_service_insert_included(service, handle, attr);
+		break;
+	case CACHE_CHRC:
+		if (len < 1)
+			return false;
+
+		attr = gatt_db_service_insert_characteristic(service, handle,
+							&uuid, 0, value[0],
+							NULL, NULL, NULL);
+		if (!attr || !load_value(attr, value + 1, len - 1))
+			return false;
+		break;
+	case CACHE_DESC:
+		attr = gatt_db_service_insert_descriptor(service, handle, &uuid,
+							0, NULL, NULL, NULL);
+		if (!attr || !load_value(attr, value, len))
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	return attr && gatt_db_attribute_get_handle(attr) == handle;
+}
+
+static bool load_cache(struct cache_reader *reader, struct gatt_db *db)
+{
+	struct gatt_db_attribute **services;
+	uint16_t *counts;
+	uint16_t num_services, i, j;
+	uint8_t version;
+	bool result = false;
+
+	if (reader->len < 4 || memcmp(reader->data, CACHE_MAGIC, 4))
+		return false;
+
+	reader->data += 4;
+	reader->len -= 4;
+
+	if (!read_u8(reader, &version) || version != CACHE_VERSION)
+		return false;
+
+	if (!read_le16(reader, &num_services))
+		return false;
+
+	services = new0(struct gatt_db_attribute *, num_services + 1);
+	counts = new0(uint16_t, num_services + 1);
+
+	/* All services first since they can be included by any other */
+	for (i = 0; i < num_services; i++) {
+		uint16_t start, end;
+		uint8_t primary;
+		bt_uuid_t uuid;
+
+		if (!read_le16(reader, &start) || !read_le16(reader, &end) ||
+				!read_u8(reader, &primary) ||
+				!read_le16(reader, &counts[i]) ||
+				!read_uuid(reader, &uuid) || end < start)
+			goto done;
+
+		services[i] = gatt_db_insert_service(db, start, &uuid, primary,
+							end - start + 1);
+		if (!services[i])
+			goto done;
+	}
+
+	for (i = 0; i < num_services; i++) {
+		for (j = 0; j < counts[i]; j++) {
+			if (!load_attribute(reader, db, services[i]))
+				goto done;
+		}
+	}
+
+	if (reader->len)
+		goto done;
+
+	for (i = 0; i < num_services; i++)
+		gatt_db_service_set_active(services[i], true);
+
+	result = true;
+
+done:
+	free(counts);
+	free(services);
+
+	return result;
+}
+
+bool gatt_cache_load(struct gatt_db *db, const char *filename)
+{
+	struct cache_reader reader;
+	struct stat st;
+	void *data;
+	bool result;
+	int fd;
+
+	if (!db || !filename)
+		return false;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return false;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	reader.data = data;
+	reader.len = st.st_size;
+
+	result = load_cache(&reader, db);
+
+	munmap(data, st.st_size);
+
+	if (!result)
+		gatt_db_clear(db);
+
+	return result;
+}
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+
+struct gatt_db;
+
+bool gatt_cache_store(struct gatt_db *db, const char *filename);
+bool gatt_cache_load(struct gatt_db *db, const char *filename);
@@ -18,8 +18,10 @@
 #include "src/shared/gatt-helpers.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
+#include "src/shared/timeout.h"
 
 #include <assert.h>
 #include <limits.h>
@@ -35,6 +37,13 @@
 
 #define UUID_BYTES (BT_GATT_UUID_SIZE * sizeof(uint8_t))
 
+/*
+ * Delay before coalesced reads are sent, long enough to collect the reads
+ * issued in the current main loop iteration. Zero would disarm the timer
+ * with the plain mainloop backend.
+ */
+#define READ_BATCH_DELAY	1
+
 #define GATT_SVC_UUID	0x1801
 #define SVC_CHNGD_UUID	0x2a05
 #define DBG(_client, _format, arg...) \
@@ -82,7 +91,9 @@ struct bt_gatt_client {
 
 	/* List of registered disconnect/notification/indication callbacks */
 	struct queue *notify_list;
+	struct hashmap *notify_map;	/* notify_list entries by id */
 	struct queue *notify_chrcs;
+	struct hashmap *chrc_map;	/* notify_chrcs by value handle */
 	int next_reg_id;
 	unsigned int disc_id, nfy_id, nfy_mult_id, ind_id;
 
@@ -102,9 +113,17 @@ struct bt_gatt_client {
 	 * id to an ATT request id.
 	 */
 	struct queue *pending_requests;
+	struct hashmap *request_map;	/* pending_requests by id */
 	unsigned int next_request_id;
 
+	/*
+	 * Reads issued by this client and its clones in the current main
+	 * loop iteration, only used on the client with no parent.
+	 */
+	struct read_batch *read_batch;
+
 	struct bt_gatt_request *discovery_req;
+	struct queue *discovery_steps;	/* Steps with a request outstanding */
 	unsigned int mtu_req_id;
 };
 
@@ -116,10 +135,18 @@ struct request {
 	int ref_count;
 	unsigned int id;
 	unsigned int att_id;
+	struct read_batch *batch;
 	void *data;
 	void (*destroy)(void *);
 };
 
+struct read_batch {
+	struct bt_gatt_client *client;
+	struct queue *reqs;
+	unsigned int timeout_id;
+	unsigned int att_id;
+};
+
 static struct request *request_ref(struct request *req)
 {
 	__sync_fetch_and_add(&req->ref_count, 1);
@@ -142,6 +169,7 @@ static struct request *request_create(struct bt_gatt_client *client)
 	queue_push_tail(client->pending_requests, req);
 	req->client = client;
 	req->id = client->next_request_id++;
+	hashmap_insert(client->request_map, req->id, req);
 
 	return request_ref(req);
 }
@@ -156,8 +184,10 @@ static void request_unref(void *data)
 	if (req->destroy)
 		req->destroy(req->data);
 
-	if (!req->removed)
+	if (!req->removed) {
 		queue_remove(req->client->pending_requests, req);
+		hashmap_remove(req->client->request_map, req->id);
+	}
 
 	free(req);
 }
@@ -170,6 +200,7 @@ struct notify_chrc {
 	uint16_t properties;
 	unsigned int notify_id;
 	int notify_count;  /* Reference count of registered notify callbacks */
+	struct queue *notify_list;	/* notify_data of this characteristic */
 
 	/* Pending calls to register_notify are queued here so that they can be
 	 * processed after a write that modifies the CCC descriptor.
@@ -253,6 +284,7 @@ static void notify_chrc_free(void *data)
 		gatt_db_attribute_unregister(chrc->attr, chrc->notify_id);
 
 	queue_destroy(chrc->reg_notify_queue, notify_data_unref);
+	queue_destroy(chrc->notify_list, NULL);
 	free(chrc);
 }
 
@@ -265,10 +297,13 @@ static void chrc_removed(struct gatt_db_attribute *attr, void *user_data)
 	chrc->notify_id = 0;
 
 	while ((data = queue_remove_if(client->notify_list, match_notify_chrc,
-								chrc)))
+								chrc))) {
+		hashmap_remove(client->notify_map, data->id);
 		notify_data_cleanup(data);
+	}
 
 	queue_remove(client->notify_chrcs, chrc);
+	hashmap_remove(client->chrc_map, chrc->value_handle);
 	notify_chrc_free(chrc);
 }
 
@@ -301,6 +336,8 @@ static struct notify_chrc *notify_chrc_create(struct bt_gatt_client *client,
 		return NULL;
 	}
 
+	chrc->notify_list = queue_new();
+
 	/*
 	 * Find the CCC characteristic. Some characteristics that allow
 	 * notifications may not have a CCC descriptor. We treat these as
@@ -319,18 +356,11 @@ static struct notify_chrc *notify_chrc_create(struct bt_gatt_client *client,
 									NULL);
 
 	queue_push_tail(client->notify_chrcs, chrc);
+	hashmap_insert(client->chrc_map, value_handle, chrc);
 
 	return chrc;
 }
 
-static bool match_notify_data_id(const void *a, const void *b)
-{
-	const struct notify_data *notify_data = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify_data->id == id;
-}
-
 struct handle_range {
 	uint16_t start;
 	uint16_t end;
@@ -348,7 +378,10 @@ struct discovery_op {
 	struct queue *discov_ranges;
 	struct queue *pending_svcs;
 	struct queue *pending_chrcs;
-	struct queue *ext_prop_desc;
+	struct queue *range_steps;
+	struct queue *chrc_steps;
+	struct gatt_db *db;		/* Database being discovered into */
+	unsigned int pending;		/* Requests sent by steps */
 	struct gatt_db_attribute *cur_svc;
 	struct gatt_db_attribute *hash;
 	uint8_t server_feat;
@@ -364,19 +397,104 @@ struct discovery_op {
 	discovery_op_fail_func_t failure_func;
 };
 
+struct chrc {
+	uint16_t start_handle;
+	uint16_t end_handle;
+	uint16_t value_handle;
+	uint8_t properties;
+	bt_uuid_t uuid;
+};
+
+struct discovery_desc {
+	uint16_t handle;
+	bt_uuid_t uuid;
+	uint8_t *value;
+	uint16_t len;
+};
+
+/*
+ * Included services and characteristics of a range, or the descriptors of a
+ * characteristic, are discovered by a step. Steps are started in handle order
+ * and may run at the same time, one per ATT channel, but their results are
+ * only inserted into the database once all the steps before them are done
+ * since the attributes of a service have to be inserted in order.
+ */
+struct discovery_step {
+	struct discovery_op *op;
+	struct bt_gatt_request *req;
+	unsigned int read_id;
+	uint16_t start;
+	uint16_t end;
+	struct chrc *chrc;		/* NULL if discovering a range */
+	struct queue *results;		/* struct chrc or struct discovery_desc */
+	struct queue *ext_prop;		/* Descriptors to be read */
+	bool done;
+	int ref_count;
+};
+
+typedef struct bt_gatt_request *(*discovery_step_func_t)(struct bt_att *att,
+					uint16_t start, uint16_t end,
+					bt_gatt_request_callback_t callback,
+					void *user_data,
+					bt_gatt_destroy_func_t destroy);
+
+static void discovery_desc_free(void *data)
+{
+	struct discovery_desc *desc = data;
+
+	free(desc->value);
+	free(desc);
+}
+
+static struct discovery_step *discovery_step_ref(
+						struct discovery_step *step)
+{
+	__sync_fetch_and_add(&step->ref_count, 1);
+
+	return step;
+}
+
+static struct discovery_step *discovery_step_new(struct discovery_op *op)
+{
+	struct discovery_step *step;
+
+	step = new0(struct discovery_step, 1);
+	step->op = op;
+	step->results = queue_new();
+
+	return discovery_step_ref(step);
+}
+
+static void discovery_step_unref(void *data)
+{
+	struct discovery_step *step = data;
+
+	if (__sync_sub_and_fetch(&step->ref_count, 1))
+		return;
+
+	queue_destroy(step->ext_prop, NULL);
+	queue_destroy(step->results, step->chrc ? discovery_desc_free : free);
+	free(step->chrc);
+	free(step);
+}
+
 static void discovery_op_free(struct discovery_op *op)
 {
 	if (op->db_id > 0)
-		gatt_db_unregister(op->client->db, op->db_id);
+		gatt_db_unregister(op->db, op->db_id);
+
+	gatt_db_unref(op->db);
 
 	queue_destroy(op->discov_ranges, free);
 	queue_destroy(op->pending_svcs, NULL);
 	queue_destroy(op->pending_chrcs, free);
-	queue_destroy(op->ext_prop_desc, NULL);
+	queue_destroy(op->range_steps, discovery_step_unref);
+	queue_destroy(op->chrc_steps, discovery_step_unref);
 	free(op);
 }
 
 static bool read_db_hash(struct discovery_op *op);
+static void discovery_cancel_steps(struct discovery_op *op);
 
 static void gatt_log(struct bt_gatt_client *client, const char *format, ...)
 {
@@ -395,6 +513,9 @@ static void discovery_op_complete(struct discovery_op *op, bool success,
 {
 	const struct queue_entry *svc;
 
+	/* Stop any other step still running */
+	discovery_cancel_steps(op);
+
 	op->success = success;
 
 	/* Read database hash if discovery has been successful */
@@ -405,7 +526,7 @@ static void discovery_op_complete(struct discovery_op *op, bool success,
 	 * Unregister remove callback so it is not called when clearing unused
 	 * range.
 	 */
-	gatt_db_unregister(op->client->db, op->db_id);
+	gatt_db_unregister(op->db, op->db_id);
 	op->db_id = 0;
 
 	/* Remove services pending */
@@ -423,12 +544,12 @@ static void discovery_op_complete(struct discovery_op *op, bool success,
 		DBG(op->client, "service disappeared: start 0x%04x end 0x%04x",
 			start, end);
 
-		gatt_db_remove_service(op->client->db, attr);
+		gatt_db_remove_service(op->db, attr);
 	}
 
 	/* Reset remaining range */
 	if (op->last != UINT16_MAX)
-		gatt_db_clear_range(op->client->db, op->last + 1, UINT16_MAX);
+		gatt_db_clear_range(op->db, op->last + 1, UINT16_MAX);
 
 	op->complete_func(op, success, err);
 }
@@ -450,7 +571,7 @@ static void discovery_service_changed(struct gatt_db_attribute *attr,
 }
 
 static struct discovery_op *discovery_op_create(struct bt_gatt_client *client,
-				uint16_t start, uint16_t end,
+				struct gatt_db *db, uint16_t start, uint16_t end,
 				discovery_op_complete_func_t complete_func,
 				discovery_op_fail_func_t failure_func)
 {
@@ -461,26 +582,27 @@ static struct discovery_op *discovery_op_create(struct bt_gatt_client *client,
 	op->discov_ranges = queue_new();
 	op->pending_svcs = queue_new();
 	op->pending_chrcs = queue_new();
-	op->ext_prop_desc = queue_new();
+	op->range_steps = queue_new();
+	op->chrc_steps = queue_new();
 	op->client = client;
+	op->db = gatt_db_ref(db);
 	op->complete_func = complete_func;
 	op->failure_func = failure_func;
 	op->start = start;
 	op->end = end;
-	op->last = gatt_db_isempty(client->db) ? 0 : UINT16_MAX;
+	op->last = gatt_db_isempty(db) ? 0 : UINT16_MAX;
 	op->svc_first = UINT16_MAX;
 	op->svc_last = 0;
 
 	/* Load existing services as pending */
-	gatt_db_foreach_service_in_range(client->db, NULL,
-					 discovery_load_services, op,
-					 start, end);
+	gatt_db_foreach_service_in_range(db, NULL, discovery_load_services, op,
+								start, end);
 
 	/*
 	 * Services are only added when set active in which case they are no
 	 * longer pending so it is safe to remove either way.
 	 */
-	op->db_id = gatt_db_register(client->db, discovery_service_changed,
+	op->db_id = gatt_db_register(db, discovery_service_changed,
 						discovery_service_changed,
 						op, NULL);
 
@@ -521,6 +643,91 @@ static void discovery_req_clear(struct bt_gatt_client *client)
 	client->discovery_req = NULL;
 }
 
+static void discovery_step_destroy(void *data)
+{
+	struct discovery_step *step = data;
+	struct discovery_op *op = step->op;
+
+	discovery_step_unref(step);
+	discovery_op_unref(op);
+}
+
+static bool discovery_step_send(struct discovery_step *step,
+					discovery_step_func_t func,
+					uint16_t start, uint16_t end,
+					bt_gatt_request_callback_t callback)
+{
+	struct discovery_op *op = step->op;
+	struct bt_gatt_client *client = op->client;
+
+	step->req = func(client->att, start, end, callback, step,
+						discovery_step_destroy);
+	if (!step->req)
+		return false;
+
+	discovery_step_ref(step);
+	discovery_op_ref(op);
+	queue_push_tail(client->discovery_steps, step);
+	op->pending++;
+
+	return true;
+}
+
+static void discovery_step_clear(struct discovery_step *step)
+{
+	struct discovery_op *op = step->op;
+
+	if (!step->req)
+		return;
+
+	queue_remove(op->client->discovery_steps, step);
+	bt_gatt_request_unref(step->req);
+	step->req = NULL;
+	op->pending--;
+}
+
+static void cancel_discovery_step(void *data)
+{
+	struct discovery_step *step = data;
+	struct bt_gatt_request *req = step->req;
+
+	/* Canceling may release the last reference to the step */
+	step->req = NULL;
+
+	bt_gatt_request_cancel(req);
+	bt_gatt_request_unref(req);
+}
+
+static void discovery_cancel_step(void *data, void *user_data)
+{
+	struct discovery_step *step = data;
+	struct bt_gatt_client *client = user_data;
+
+	if (step->req && queue_remove(client->discovery_steps, step))
+		cancel_discovery_step(step);
+
+	if (step->read_id) {
+		bt_gatt_client_cancel(client, step->read_id);
+		step->read_id = 0;
+	}
+}
+
+static void discovery_cancel_steps(struct discovery_op *op)
+{
+	queue_foreach(op->range_steps, discovery_cancel_step, op->client);
+	queue_foreach(op->chrc_steps, discovery_cancel_step, op->client);
+	op->pending = 0;
+}
+
+static unsigned int discovery_window(struct discovery_op *op)
+{
+	int channels = bt_att_get_channels(op->client->att);
+
+	return channels > 1 ? channels : 1;
+}
+
+static void discovery_pipeline(struct discovery_op *op);
+
 static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data);
@@ -528,7 +735,8 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 static void discover_incl_cb(bool success, uint8_t att_ecode,
 				struct bt_gatt_result *result, void *user_data)
 {
-	struct discovery_op *op = user_data;
+	struct discovery_step *step = user_data;
+	struct discovery_op *op = step->op;
 	struct bt_gatt_client *client = op->client;
 	struct bt_gatt_iter iter;
 	struct gatt_db_attribute *attr;
@@ -537,9 +745,8 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 	bt_uuid_t uuid;
 	char uuid_str[MAX_LEN_UUID_STR];
 	unsigned int includes_count, i;
-	struct handle_range *range;
 
-	discovery_req_clear(client);
+	discovery_step_clear(step);
 
 	if (!success) {
 		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
@@ -569,7 +776,11 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 		DBG(client, "handle: 0x%04x, start: 0x%04x, end: 0x%04x,"
 				"uuid: %s", handle, start, end, uuid_str);
 
-		attr = gatt_db_get_attribute(client->db, start);
+		/* Services outside a changed range are only in the client db */
+		attr = gatt_db_get_attribute(op->db, start);
+		if (!attr)
+			attr = gatt_db_get_attribute(client->db, start);
+
 		if (!attr) {
 			DBG(client,
 				"Unable to find attribute at 0x%04x: skipping",
@@ -577,7 +788,7 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 			continue;
 		}
 
-		attr = gatt_db_insert_included(client->db, handle, attr);
+		attr = gatt_db_insert_included(op->db, handle, attr);
 		if (!attr) {
 			DBG(client,
 				"Unable to add include attribute at 0x%04x",
@@ -600,159 +811,80 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 	}
 
 next:
-	range = queue_pop_head(op->discov_ranges);
-	if (!range)
-		goto failed;
-
-	client->discovery_req = bt_gatt_discover_characteristics(client->att,
-							range->start,
-							range->end,
-							discover_chrcs_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-	free(range);
-	if (client->discovery_req)
+	if (discovery_step_send(step, bt_gatt_discover_characteristics,
+						step->start, step->end,
+						discover_chrcs_cb))
 		return;
 
 	DBG(client, "Failed to start characteristic discovery");
 
-	discovery_op_unref(op);
 failed:
 	discovery_op_complete(op, false, att_ecode);
 }
 
-struct chrc {
-	uint16_t start_handle;
-	uint16_t end_handle;
-	uint16_t value_handle;
-	uint8_t properties;
-	bt_uuid_t uuid;
-};
-
-static void discover_descs_cb(bool success, uint8_t att_ecode,
+static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
-						void *user_data);
-
-static bool discover_descs(struct discovery_op *op, bool *discovering)
+						void *user_data)
 {
+	struct discovery_step *step = user_data;
+	struct discovery_op *op = step->op;
 	struct bt_gatt_client *client = op->client;
-	struct gatt_db_attribute *attr;
+	struct bt_gatt_iter iter;
 	struct chrc *chrc_data;
-	uint16_t desc_start;
-
-	*discovering = false;
-
-	while ((chrc_data = queue_pop_head(op->pending_chrcs))) {
-		struct gatt_db_attribute *svc;
-		uint16_t start, end;
-
-		/* Adjust current service */
-		svc = gatt_db_get_service(client->db, chrc_data->value_handle);
-		if (op->cur_svc != svc) {
-			if (op->cur_svc) {
-				queue_remove(op->pending_svcs, op->cur_svc);
-
-				/* Done with the current service */
-				gatt_db_service_set_active(op->cur_svc, true);
-			}
-
-			op->cur_svc = svc;
-		}
-
-		attr = gatt_db_insert_characteristic(client->db,
-							chrc_data->value_handle,
-							&chrc_data->uuid, 0,
-							chrc_data->properties,
-							NULL, NULL, NULL);
-
-		if (!attr) {
-			DBG(client,
-				"Failed to insert characteristic at 0x%04x",
-				chrc_data->value_handle);
-
-			/* Some devices have been seen reporting orphaned
-			 * characteristics.  In order to favor interoperability
-			 * we skip over characteristics in error
-			 */
-			free(chrc_data);
-			continue;
-		}
+	uint16_t start, end, value;
+	uint8_t properties;
+	uint128_t u128;
+	bt_uuid_t uuid;
+	char uuid_str[MAX_LEN_UUID_STR];
+	unsigned int chrc_count;
 
-		if (gatt_db_attribute_get_handle(attr) !=
-							chrc_data->value_handle)
-			goto failed;
+	discovery_step_clear(step);
 
-		gatt_db_attribute_get_service_handles(svc, &start, &end);
+	if (!success) {
+		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
+			goto done;
 
-		/*
-		 * Adjust end_handle in case the next chrc is not within the
-		 * same service.
-		 */
-		if (chrc_data->end_handle > end)
-			chrc_data->end_handle = end;
+		goto failed;
+	}
 
-		/*
-		 * check for descriptors presence, before initializing the
-		 * desc_handle and avoid integer overflow during desc_handle
-		 * initialization.
-		 */
-		if (chrc_data->value_handle >= chrc_data->end_handle) {
-			free(chrc_data);
-			continue;
-		}
+	if (!result || !bt_gatt_iter_init(&iter, result))
+		goto failed;
 
-		desc_start = chrc_data->value_handle + 1;
+	chrc_count = bt_gatt_result_characteristic_count(result);
 
-		if (desc_start == chrc_data->end_handle &&
-			(chrc_data->properties & BT_GATT_CHRC_PROP_NOTIFY ||
-			 chrc_data->properties & BT_GATT_CHRC_PROP_INDICATE)) {
-			bt_uuid_t ccc_uuid;
+	DBG(client, "Characteristics found: %u", chrc_count);
 
-			/* If there is only one descriptor that must be the CCC
-			 * in case either notify or indicate are supported.
-			 */
-			bt_uuid16_create(&ccc_uuid,
-					GATT_CLIENT_CHARAC_CFG_UUID);
-			attr = gatt_db_insert_descriptor(client->db, desc_start,
-							&ccc_uuid, 0, NULL,
-							NULL, NULL);
-			if (attr) {
-				free(chrc_data);
-				continue;
-			}
-		}
+	if (chrc_count == 0)
+		goto failed;
 
-		/* Check if the start range is within characteristic range */
-		if (desc_start > chrc_data->end_handle) {
-			free(chrc_data);
-			continue;
-		}
+	while (bt_gatt_iter_next_characteristic(&iter, &start, &end, &value,
+						&properties, u128.data)) {
+		bt_uuid128_create(&uuid, u128);
 
-		client->discovery_req = bt_gatt_discover_descriptors(
-							client->att, desc_start,
-							chrc_data->end_handle,
-							discover_descs_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-		if (client->discovery_req) {
-			*discovering = true;
-			goto done;
-		}
+		/* Log debug message */
+		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+		DBG(client, "start: 0x%04x, end: 0x%04x, value: 0x%04x, "
+				"props: 0x%02x, uuid: %s",
+				start, end, value, properties, uuid_str);
 
-		DBG(client, "Failed to start descriptor discovery");
+		chrc_data = new0(struct chrc, 1);
 
-		discovery_op_unref(op);
+		chrc_data->start_handle = start;
+		chrc_data->end_handle = end;
+		chrc_data->value_handle = value;
+		chrc_data->properties = properties;
+		chrc_data->uuid = uuid;
 
-		goto failed;
+		queue_push_tail(step->results, chrc_data);
 	}
 
 done:
-	free(chrc_data);
-	return true;
+	step->done = true;
+	discovery_pipeline(op);
+	return;
 
 failed:
-	free(chrc_data);
-	return false;
+	discovery_op_complete(op, false, att_ecode);
 }
 
 static void ext_prop_write_cb(struct gatt_db_attribute *attrib,
@@ -767,23 +899,25 @@ static void ext_prop_read_cb(bool success, uint8_t att_ecode,
 					const uint8_t *value, uint16_t length,
 					void *user_data);
 
-static bool read_ext_prop_desc(struct discovery_op *op)
+static bool read_ext_prop_desc(struct discovery_step *step)
 {
-	struct bt_gatt_client *client = op->client;
-	uint16_t handle;
-	struct gatt_db_attribute *attr;
+	struct discovery_op *op = step->op;
+	struct discovery_desc *desc;
 
-	attr = queue_peek_head(op->ext_prop_desc);
-	if (!attr)
+	desc = queue_peek_head(step->ext_prop);
+	if (!desc)
 		return false;
 
-	handle = gatt_db_attribute_get_handle(attr);
-
-	if (!bt_gatt_client_read_value(client, handle, ext_prop_read_cb,
-							discovery_op_ref(op),
-							discovery_op_unref))
+	step->read_id = bt_gatt_client_read_value(op->client, desc->handle,
+							ext_prop_read_cb, step,
+							discovery_step_destroy);
+	if (!step->read_id)
 		return false;
 
+	discovery_step_ref(step);
+	discovery_op_ref(op);
+	op->pending++;
+
 	return true;
 }
 
@@ -791,71 +925,66 @@ static void ext_prop_read_cb(bool success, uint8_t att_ecode,
 					const uint8_t *value, uint16_t length,
 					void *user_data)
 {
-	struct discovery_op *op = user_data;
+	struct discovery_step *step = user_data;
+	struct discovery_op *op = step->op;
 	struct bt_gatt_client *client = op->client;
-	bool discovering;
-	struct gatt_db_attribute *desc_attr = NULL;
+	struct discovery_desc *desc;
 
-	if (!success)
-		goto done;
+	step->read_id = 0;
+	op->pending--;
 
-	DBG(client, "Ext. prop value: 0x%04x", (uint16_t)value[0]);
+	if (!success)
+		goto failed;
 
-	desc_attr = queue_pop_head(op->ext_prop_desc);
-	if (!desc_attr)
+	desc = queue_pop_head(step->ext_prop);
+	if (!desc)
 		goto failed;
 
-	if (!gatt_db_attribute_write(desc_attr, 0, value, length, 0, NULL,
-						ext_prop_write_cb, client))
+	if (!length)
 		goto failed;
 
-	/* Any other descriptor to read? */
-	if (read_ext_prop_desc(op))
-		return;
+	DBG(client, "Ext. prop value: 0x%04x", (uint16_t)value[0]);
 
-	if (!discover_descs(op, &discovering))
-			goto failed;
+	/* Written once the descriptor is inserted */
+	desc->value = util_memdup(value, length);
+	desc->len = length;
 
-	if (discovering)
+	/* Any other descriptor to read? */
+	if (read_ext_prop_desc(step))
 		return;
 
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
-
-	goto done;
+	step->done = true;
+	discovery_pipeline(op);
+	return;
 
 failed:
-	success = false;
-
-done:
-	discovery_op_complete(op, success, att_ecode);
+	discovery_op_complete(op, false, att_ecode);
 }
 
 static void discover_descs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data)
 {
-	struct discovery_op *op = user_data;
+	struct discovery_step *step = user_data;
+	struct discovery_op *op = step->op;
 	struct bt_gatt_client *client = op->client;
 	struct bt_gatt_iter iter;
 	struct gatt_db_attribute *attr;
+	struct discovery_desc *desc;
 	uint16_t handle;
 	uint128_t u128;
 	bt_uuid_t uuid;
 	char uuid_str[MAX_LEN_UUID_STR];
 	unsigned int desc_count;
-	bool discovering;
 	bt_uuid_t ext_prop_uuid;
 
-	discovery_req_clear(client);
+	discovery_step_clear(step);
 
 	if (!success) {
-		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-			success = true;
-			goto next;
-		}
+		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
+			goto done;
 
-		goto done;
+		goto failed;
 	}
 
 	if (!result || !bt_gatt_iter_init(&iter, result))
@@ -877,157 +1006,308 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 
 		DBG(client, "handle: 0x%04x, uuid: %s", handle, uuid_str);
 
-		attr = gatt_db_insert_descriptor(client->db, handle,
-							&uuid, 0, NULL, NULL,
-							NULL);
-		if (!attr) {
-			attr = gatt_db_get_attribute(client->db, handle);
-			if (attr && !bt_uuid_cmp(&uuid,
-					gatt_db_attribute_get_type(attr)))
-				continue;
+		desc = new0(struct discovery_desc, 1);
+		desc->handle = handle;
+		desc->uuid = uuid;
 
-			DBG(client, "Failed to insert descriptor at 0x%04x",
-				handle);
-			goto failed;
-		}
+		queue_push_tail(step->results, desc);
 
-		if (gatt_db_attribute_get_handle(attr) != handle)
-			goto failed;
+		if (bt_uuid_cmp(&ext_prop_uuid, &uuid))
+			continue;
+
+		/* Only read values of descriptors not found in the cache */
+		attr = gatt_db_get_attribute(op->db, handle);
+		if (attr && !bt_uuid_cmp(&uuid,
+					gatt_db_attribute_get_type(attr)))
+			continue;
 
-		if (!bt_uuid_cmp(&ext_prop_uuid, &uuid))
-			queue_push_tail(op->ext_prop_desc, attr);
+		queue_push_tail(step->ext_prop, desc);
 	}
 
 	/* If we got extended prop descriptor, lets read it right away */
-	if (read_ext_prop_desc(op))
+	if (read_ext_prop_desc(step))
 		return;
 
-next:
-	if (!discover_descs(op, &discovering))
-		goto failed;
+done:
+	step->done = true;
+	discovery_pipeline(op);
+	return;
 
-	if (discovering)
-		return;
+failed:
+	discovery_op_complete(op, false, att_ecode);
+}
 
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
+/*
+ * Returns the end of the first service pending discovery within the range,
+ * so ranges can be split into services discovered in parallel.
+ */
+static uint16_t discovery_range_split(struct discovery_op *op, uint16_t start,
+								uint16_t end)
+{
+	const struct queue_entry *entry;
+	uint16_t first = end, last = end;
 
-	goto done;
+	for (entry = queue_get_entries(op->pending_svcs); entry;
+							entry = entry->next) {
+		uint16_t svc_start, svc_end;
 
-failed:
-	success = false;
+		gatt_db_attribute_get_service_handles(entry->data, &svc_start,
+								&svc_end);
 
-done:
-	discovery_op_complete(op, success, att_ecode);
+		if (svc_start < start || svc_start > first)
+			continue;
+
+		first = svc_start;
+		last = MIN(svc_end, end);
+	}
+
+	return last;
 }
 
-static void discover_chrcs_cb(bool success, uint8_t att_ecode,
-						struct bt_gatt_result *result,
-						void *user_data)
+static bool discovery_start_range(struct discovery_op *op, bool split)
 {
-	struct discovery_op *op = user_data;
 	struct bt_gatt_client *client = op->client;
-	struct bt_gatt_iter iter;
+	struct handle_range *range;
+	struct discovery_step *step;
+
+	range = queue_peek_head(op->discov_ranges);
+
+	step = discovery_step_new(op);
+	step->start = range->start;
+	step->end = split ? discovery_range_split(op, range->start, range->end) :
+								range->end;
+
+	if (step->end < range->end)
+		range->start = step->end + 1;
+	else
+		free(queue_pop_head(op->discov_ranges));
+
+	queue_push_tail(op->range_steps, step);
+
+	if (discovery_step_send(step, bt_gatt_discover_included_services,
+						step->start, step->end,
+						discover_incl_cb))
+		return true;
+
+	DBG(client, "Failed to start included services discovery");
+
+	return false;
+}
+
+static bool discovery_start_chrc(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	struct discovery_step *step;
+	struct discovery_desc *desc;
+	struct gatt_db_attribute *svc;
 	struct chrc *chrc_data;
-	uint16_t start, end, value;
-	uint8_t properties;
-	uint128_t u128;
-	bt_uuid_t uuid;
-	char uuid_str[MAX_LEN_UUID_STR];
-	unsigned int chrc_count;
-	bool discovering;
+	uint16_t start, end, desc_start;
 
-	discovery_req_clear(client);
+	chrc_data = queue_pop_head(op->pending_chrcs);
 
-	if (!success) {
-		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-			success = true;
-			goto next;
+	step = discovery_step_new(op);
+	step->chrc = chrc_data;
+	step->ext_prop = queue_new();
+	step->done = true;
+
+	queue_push_tail(op->chrc_steps, step);
+
+	/* Orphaned characteristics are skipped when inserting them */
+	svc = gatt_db_get_service(op->db, chrc_data->value_handle);
+	if (!svc)
+		return true;
+
+	gatt_db_attribute_get_service_handles(svc, &start, &end);
+
+	/*
+	 * Adjust end_handle in case the next chrc is not within the
+	 * same service.
+	 */
+	if (chrc_data->end_handle > end)
+		chrc_data->end_handle = end;
+
+	/*
+	 * check for descriptors presence, before initializing the
+	 * desc_handle and avoid integer overflow during desc_handle
+	 * initialization.
+	 */
+	if (chrc_data->value_handle >= chrc_data->end_handle)
+		return true;
+
+	desc_start = chrc_data->value_handle + 1;
+
+	if (desc_start == chrc_data->end_handle &&
+		(chrc_data->properties & BT_GATT_CHRC_PROP_NOTIFY ||
+		 chrc_data->properties & BT_GATT_CHRC_PROP_INDICATE)) {
+		/* If there is only one descriptor that must be the CCC
+		 * in case either notify or indicate are supported.
+		 */
+		desc = new0(struct discovery_desc, 1);
+		desc->handle = desc_start;
+		bt_uuid16_create(&desc->uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+
+		queue_push_tail(step->results, desc);
+
+		return true;
+	}
+
+	step->done = false;
+
+	if (discovery_step_send(step, bt_gatt_discover_descriptors,
+						desc_start,
+						chrc_data->end_handle,
+						discover_descs_cb))
+		return true;
+
+	DBG(client, "Failed to start descriptor discovery");
+
+	return false;
+}
+
+static bool discovery_insert_chrc(struct discovery_op *op,
+						struct discovery_step *step)
+{
+	struct bt_gatt_client *client = op->client;
+	struct chrc *chrc_data = step->chrc;
+	struct gatt_db_attribute *attr, *svc;
+	struct discovery_desc *desc;
+
+	/* Adjust current service */
+	svc = gatt_db_get_service(op->db, chrc_data->value_handle);
+	if (op->cur_svc != svc) {
+		if (op->cur_svc) {
+			queue_remove(op->pending_svcs, op->cur_svc);
+
+			/* Done with the current service */
+			gatt_db_service_set_active(op->cur_svc, true);
 		}
 
-		goto done;
+		op->cur_svc = svc;
 	}
 
-	if (!result || !bt_gatt_iter_init(&iter, result))
-		goto failed;
+	attr = gatt_db_insert_characteristic(op->db,
+						chrc_data->value_handle,
+						&chrc_data->uuid, 0,
+						chrc_data->properties,
+						NULL, NULL, NULL);
+	if (!attr) {
+		DBG(client, "Failed to insert characteristic at 0x%04x",
+						chrc_data->value_handle);
+
+		/* Some devices have been seen reporting orphaned
+		 * characteristics.  In order to favor interoperability
+		 * we skip over characteristics in error
+		 */
+		return true;
+	}
 
-	chrc_count = bt_gatt_result_characteristic_count(result);
+	if (gatt_db_attribute_get_handle(attr) != chrc_data->value_handle)
+		return false;
 
-	DBG(client, "Characteristics found: %u", chrc_count);
+	while ((desc = queue_pop_head(step->results))) {
+		attr = gatt_db_insert_descriptor(op->db, desc->handle,
+							&desc->uuid, 0, NULL,
+							NULL, NULL);
+		if (!attr) {
+			attr = gatt_db_get_attribute(op->db, desc->handle);
+			if (attr && !bt_uuid_cmp(&desc->uuid,
+					gatt_db_attribute_get_type(attr))) {
+				discovery_desc_free(desc);
+				continue;
+			}
 
-	if (chrc_count == 0)
-		goto failed;
+			DBG(client, "Failed to insert descriptor at 0x%04x",
+								desc->handle);
+			discovery_desc_free(desc);
+			return false;
+		}
 
-	while (bt_gatt_iter_next_characteristic(&iter, &start, &end, &value,
-						&properties, u128.data)) {
-		bt_uuid128_create(&uuid, u128);
+		if (gatt_db_attribute_get_handle(attr) != desc->handle) {
+			discovery_desc_free(desc);
+			return false;
+		}
+
+		if (desc->value && !gatt_db_attribute_write(attr, 0,
+						desc->value, desc->len, 0,
+						NULL, ext_prop_write_cb,
+						client)) {
+			discovery_desc_free(desc);
+			return false;
+		}
+
+		discovery_desc_free(desc);
+	}
+
+	return true;
+}
+
+static bool discovery_commit(struct discovery_op *op)
+{
+	struct discovery_step *step;
+	struct chrc *chrc_data;
+	bool result = true;
+
+	/* Characteristics are kept in handle order */
+	while ((step = queue_peek_head(op->range_steps)) && step->done) {
+		queue_pop_head(op->range_steps);
 
-		/* Log debug message */
-		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-		DBG(client, "start: 0x%04x, end: 0x%04x, value: 0x%04x, "
-				"props: 0x%02x, uuid: %s",
-				start, end, value, properties, uuid_str);
+		while ((chrc_data = queue_pop_head(step->results)))
+			queue_push_tail(op->pending_chrcs, chrc_data);
 
-		chrc_data = new0(struct chrc, 1);
+		discovery_step_unref(step);
+	}
 
-		chrc_data->start_handle = start;
-		chrc_data->end_handle = end;
-		chrc_data->value_handle = value;
-		chrc_data->properties = properties;
-		chrc_data->uuid = uuid;
+	while (result && (step = queue_peek_head(op->chrc_steps)) &&
+								step->done) {
+		queue_pop_head(op->chrc_steps);
 
-		queue_push_tail(op->pending_chrcs, chrc_data);
+		result = discovery_insert_chrc(op, step);
+
+		discovery_step_unref(step);
 	}
 
-next:
-	/*
-	 * Before attempting to process discovered characteristics make sure we
-	 * discovered all missing ranges.
-	 */
-	if (queue_length(op->discov_ranges)) {
-		struct handle_range *range;
+	return result;
+}
 
-		range = queue_peek_head(op->discov_ranges);
-		if (!range)
-			goto failed;
+/*
+ * Keep as many steps running as there are channels to send them, starting
+ * with any range left since characteristics are only known once each range
+ * is done.
+ */
+static void discovery_pipeline(struct discovery_op *op)
+{
+	unsigned int window = discovery_window(op);
 
-		client->discovery_req =
-			bt_gatt_discover_included_services(client->att,
-							range->start,
-							range->end,
-							discover_incl_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-		if (client->discovery_req)
+	while (discovery_commit(op)) {
+		if (op->pending >= window)
 			return;
 
-		DBG(client, "Failed to start included services discovery");
+		if (!queue_isempty(op->discov_ranges)) {
+			if (!discovery_start_range(op, window > 1))
+				goto failed;
 
-		discovery_op_unref(op);
+			continue;
+		}
 
-		goto failed;
-	}
+		if (!queue_isempty(op->pending_chrcs)) {
+			if (!discovery_start_chrc(op))
+				goto failed;
 
-	/*
-	 * Sequentially discover descriptors for each characteristic and insert
-	 * the characteristics into the database as we proceed.
-	 */
-	if (!discover_descs(op, &discovering))
-		goto failed;
+			continue;
+		}
 
-	if (discovering)
-		return;
+		if (op->pending)
+			return;
 
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
+		/* Done with the current service */
+		gatt_db_service_set_active(op->cur_svc, true);
 
-	goto done;
+		discovery_op_complete(op, true, 0);
+		return;
+	}
 
 failed:
-	success = false;
-
-done:
-	discovery_op_complete(op, success, att_ecode);
+	discovery_op_complete(op, false, 0);
 }
 
 static bool match_handle_range(const void *data, const void *match_data)
@@ -1117,11 +1397,11 @@ static bool discovery_parse_services(struct discovery_op *op, bool primary,
 				start, end, uuid_str);
 
 		/* Store the service */
-		attr = gatt_db_insert_service(client->db, start, &uuid, primary,
+		attr = gatt_db_insert_service(op->db, start, &uuid, primary,
 							end - start + 1);
 		if (!attr) {
-			gatt_db_clear_range(client->db, start, end);
-			attr = gatt_db_insert_service(client->db, start, &uuid,
+			gatt_db_clear_range(op->db, start, end);
+			attr = gatt_db_insert_service(op->db, start, &uuid,
 							false, end - start + 1);
 			if (!attr) {
 				DBG(client, "Failed to store service");
@@ -1145,7 +1425,6 @@ static void discover_secondary_cb(bool success, uint8_t att_ecode,
 	struct discovery_op *op = user_data;
 	struct bt_gatt_client *client = op->client;
 	struct bt_gatt_iter iter;
-	struct handle_range *range;
 
 	discovery_req_clear(client);
 
@@ -1186,21 +1465,8 @@ next:
 	if (op->svc_last < 0xffff)
 		remove_discov_range(op, op->svc_last + 1, 0xffff);
 
-	range = queue_peek_head(op->discov_ranges);
-
-	client->discovery_req = bt_gatt_discover_included_services(client->att,
-							range->start,
-							range->end,
-							discover_incl_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-	if (client->discovery_req)
-		return;
-
-	DBG(client, "Failed to start included services discovery");
-
-	discovery_op_unref(op);
-	success = false;
+	discovery_pipeline(op);
+	return;
 
 done:
 	discovery_op_complete(op, success, att_ecode);
@@ -1648,14 +1914,6 @@ static void enable_ccc_callback(uint8_t opcode, const void *pdu,
 	bt_gatt_client_unref(notify_data->client);
 }
 
-static bool match_notify_chrc_value_handle(const void *a, const void *b)
-{
-	const struct notify_chrc *chrc = a;
-	uint16_t value_handle = PTR_TO_UINT(b);
-
-	return chrc->value_handle == value_handle;
-}
-
 static unsigned int register_notify(struct bt_gatt_client *client,
 				uint16_t handle,
 				bt_gatt_client_register_callback_t callback,
@@ -1667,8 +1925,7 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 	struct notify_chrc *chrc = NULL;
 
 	/* Check if a characteristic ref count has been started already */
-	chrc = queue_find(client->notify_chrcs, match_notify_chrc_value_handle,
-						UINT_TO_PTR(handle));
+	chrc = hashmap_lookup(client->chrc_map, handle);
 
 	if (!chrc) {
 		/*
@@ -1693,14 +1950,19 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 	notify_data->user_data = user_data;
 	notify_data->destroy = destroy;
 
-	/* Add the handler to the bt_gatt_client's general list */
+	/*
+	 * Add the handler to the bt_gatt_client's general list and to the
+	 * characteristic's list used to dispatch notifications.
+	 */
 	queue_push_tail(client->notify_list, notify_data);
+	queue_push_tail(chrc->notify_list, notify_data);
 
 	/* Assign an ID to the handler. */
 	if (client->next_reg_id < 1)
 		client->next_reg_id = 1;
 
 	notify_data->id = client->next_reg_id++;
+	hashmap_insert(client->notify_map, notify_data->id, notify_data);
 
 	/* Increment the per-characteristic ref count of notify handlers */
 	__sync_fetch_and_add(&notify_data->chrc->notify_count, 1);
@@ -1725,6 +1987,8 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 	/* Write to the CCC descriptor */
 	if (!notify_data_write_ccc(notify_data, true, enable_ccc_callback)) {
 		queue_remove(client->notify_list, notify_data);
+		queue_remove(chrc->notify_list, notify_data);
+		hashmap_remove(client->notify_map, notify_data->id);
 		free(notify_data);
 		return 0;
 	}
@@ -1783,6 +2047,65 @@ static bool register_service_changed(struct bt_gatt_client *client)
 	return client->svc_chngd_ind_id ? true : false;
 }
 
+static void collect_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct queue *services = user_data;
+
+	queue_push_tail(services, attr);
+}
+
+/*
+ * The changed range has been discovered into a database of its own, so it
+ * can be compared service by service with the client database: services
+ * which are unchanged are left alone, keeping their attributes and whoever
+ * uses them, e.g. notification registrations and exported objects, while
+ * the others are removed and replaced with the ones just discovered.
+ */
+static void service_changed_merge(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	struct gatt_db_attribute *attr, *new_attr;
+	struct queue *services;
+	uint16_t start, end;
+
+	services = queue_new();
+
+	gatt_db_foreach_service_in_range(client->db, NULL, collect_service,
+						services, op->start, op->end);
+
+	while ((attr = queue_pop_head(services))) {
+		gatt_db_attribute_get_service_handles(attr, &start, &end);
+
+		new_attr = gatt_db_get_service(op->db, start);
+		if (gatt_db_attribute_get_handle(new_attr) == start &&
+				gatt_db_service_equal(attr, new_attr)) {
+			gatt_db_remove_service(op->db, new_attr);
+			continue;
+		}
+
+		DBG(client, "service changed: start 0x%04x end 0x%04x",
+								start, end);
+
+		gatt_db_remove_service(client->db, attr);
+	}
+
+	gatt_db_foreach_service(op->db, NULL, collect_service, services);
+
+	while ((attr = queue_pop_head(services))) {
+		if (gatt_db_move_service(client->db, attr))
+			continue;
+
+		/* Drop whatever the new service overlaps outside the range */
+		gatt_db_attribute_get_service_handles(attr, &start, &end);
+		gatt_db_clear_range(client->db, start, end);
+
+		if (!gatt_db_move_service(client->db, attr))
+			DBG(client, "Failed to add service at 0x%04x", start);
+	}
+
+	queue_destroy(services, NULL);
+}
+
 static void service_changed_complete(struct discovery_op *op, bool success,
 							uint8_t att_ecode)
 {
@@ -1800,7 +2123,8 @@ static void service_changed_complete(struct discovery_op *op, bool success,
 			"error: 0x%02x", att_ecode);
 
 		gatt_db_clear_range(client->db, start_handle, end_handle);
-	}
+	} else
+		service_changed_merge(op);
 
 	/* Notify the upper layer of changed services */
 	if (client->svc_chngd_callback)
@@ -1845,10 +2169,15 @@ static void process_service_changed(struct bt_gatt_client *client,
 							uint16_t end_handle)
 {
 	struct discovery_op *op;
+	struct gatt_db *db;
 
-	op = discovery_op_create(client, start_handle, end_handle,
+	/* Discover the range aside so it can be compared once done */
+	db = gatt_db_new();
+
+	op = discovery_op_create(client, db, start_handle, end_handle,
 						service_changed_complete,
 						service_changed_failure);
+	gatt_db_unref(db);
 	if (!op)
 		goto fail;
 
@@ -2008,7 +2337,8 @@ static bool gatt_client_init(struct bt_gatt_client *client, uint16_t mtu)
 	if (client->in_init || client->ready)
 		return false;
 
-	op = discovery_op_create(client, 0x0001, 0xffff, init_complete, NULL);
+	op = discovery_op_create(client, client->db, 0x0001, 0xffff,
+							init_complete, NULL);
 	if (!op)
 		return false;
 
@@ -2122,9 +2452,6 @@ static void notify_handler(void *data, void *user_data)
 	struct notify_data *notify_data = data;
 	struct value_data *value_data = user_data;
 
-	if (notify_data->chrc->value_handle != value_data->handle)
-		return;
-
 	/*
 	 * Even if the notify data has a pending ATT request to write to the
 	 * CCC, there is really no reason not to notify the handlers.
@@ -2134,6 +2461,18 @@ static void notify_handler(void *data, void *user_data)
 				value_data->len, notify_data->user_data);
 }
 
+static void notify_dispatch(struct bt_gatt_client *client,
+						struct value_data *data)
+{
+	struct notify_chrc *chrc;
+
+	chrc = hashmap_lookup(client->chrc_map, data->handle);
+	if (!chrc)
+		return;
+
+	queue_foreach(chrc->notify_list, notify_handler, data);
+}
+
 static void notify_cb(struct bt_att_chan *chan, uint8_t opcode,
 					const void *pdu, uint16_t length,
 					void *user_data)
@@ -2160,8 +2499,7 @@ static void notify_cb(struct bt_att_chan *chan, uint8_t opcode,
 
 			data.data = pdu;
 
-			queue_foreach(client->notify_list, notify_handler,
-								&data);
+			notify_dispatch(client, &data);
 
 			length -= data.len;
 			pdu += data.len;
@@ -2174,7 +2512,7 @@ static void notify_cb(struct bt_att_chan *chan, uint8_t opcode,
 		data.len = length;
 		data.data = pdu;
 
-		queue_foreach(client->notify_list, notify_handler, &data);
+		notify_dispatch(client, &data);
 	}
 
 	if (opcode == BT_ATT_OP_HANDLE_IND && !client->parent)
@@ -2188,7 +2526,9 @@ static void bt_gatt_client_free(struct bt_gatt_client *client)
 {
 	bt_gatt_client_cancel_all(client);
 
+	hashmap_destroy(client->chrc_map, NULL);
 	queue_destroy(client->notify_chrcs, notify_chrc_free);
+	hashmap_destroy(client->notify_map, NULL);
 	queue_destroy(client->notify_list, notify_data_cleanup);
 
 	queue_destroy(client->ready_cbs, ready_destroy);
@@ -2210,6 +2550,8 @@ static void bt_gatt_client_free(struct bt_gatt_client *client)
 	queue_destroy(client->svc_chngd_queue, free);
 	queue_destroy(client->long_write_queue, request_unref);
 	queue_destroy(client->pending_requests, request_unref);
+	hashmap_destroy(client->request_map, NULL);
+	queue_destroy(client->discovery_steps, NULL);
 
 	if (client->parent) {
 		queue_remove(client->parent->clones, client);
@@ -2253,8 +2595,12 @@ static struct bt_gatt_client *gatt_client_new(struct gatt_db *db,
 	client->long_write_queue = queue_new();
 	client->svc_chngd_queue = queue_new();
 	client->notify_list = queue_new();
+	client->notify_map = hashmap_new();
 	client->notify_chrcs = queue_new();
+	client->chrc_map = hashmap_new();
 	client->pending_requests = queue_new();
+	client->request_map = hashmap_new();
+	client->discovery_steps = queue_new();
 
 	client->nfy_id = bt_att_register(att, BT_ATT_OP_HANDLE_NFY,
 						notify_cb, client, NULL);
@@ -2457,14 +2803,6 @@ uint8_t bt_gatt_client_get_features(struct bt_gatt_client *client)
 	return client->features;
 }
 
-static bool match_req_id(const void *a, const void *b)
-{
-	const struct request *req = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return req->id == id;
-}
-
 static void cancel_long_write_cb(uint8_t opcode, const void *pdu, uint16_t len,
 								void *user_data)
 {
@@ -2514,10 +2852,15 @@ static bool cancel_prep_write_session(struct bt_gatt_client *client,
 							req, request_unref);
 }
 
+static bool cancel_batched_read(struct request *req);
+
 static bool cancel_request(struct request *req)
 {
 	req->removed = true;
 
+	if (req->batch)
+		return cancel_batched_read(req);
+
 	if (req->long_write)
 		return cancel_long_write_req(req->client, req);
 
@@ -2534,11 +2877,12 @@ bool bt_gatt_client_cancel(struct bt_gatt_client *client, unsigned int id)
 	if (!client || !id || !client->att)
 		return false;
 
-	req = queue_remove_if(client->pending_requests, match_req_id,
-							UINT_TO_PTR(id));
+	req = hashmap_remove(client->request_map, id);
 	if (!req)
 		return false;
 
+	queue_remove(client->pending_requests, req);
+
 	return cancel_request(req);
 }
 
@@ -2549,9 +2893,12 @@ static void cancel_pending(void *data)
 
 bool bt_gatt_client_cancel_all(struct bt_gatt_client *client)
 {
+	struct discovery_step *step;
+
 	if (!client || !client->att)
 		return false;
 
+	hashmap_clear(client->request_map, NULL);
 	queue_remove_all(client->pending_requests, NULL, NULL, cancel_pending);
 
 	if (client->discovery_req) {
@@ -2560,6 +2907,9 @@ bool bt_gatt_client_cancel_all(struct bt_gatt_client *client)
 		client->discovery_req = NULL;
 	}
 
+	while ((step = queue_pop_head(client->discovery_steps)))
+		cancel_discovery_step(step);
+
 	if (client->mtu_req_id)
 		bt_att_cancel(client->att, client->mtu_req_id);
 
@@ -2570,6 +2920,7 @@ struct read_op {
 	bt_gatt_client_read_callback_t callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
+	uint16_t handle;
 };
 
 static void destroy_read_op(void *data)
@@ -2613,6 +2964,231 @@ done:
 		op->callback(success, att_ecode, value, length, op->user_data);
 }
 
+static bool read_send(struct request *req)
+{
+	struct read_op *op = req->data;
+	uint8_t pdu[2];
+
+	put_le16(op->handle, pdu);
+
+	req->att_id = bt_att_send(req->client->att, BT_ATT_OP_READ_REQ,
+							pdu, sizeof(pdu),
+							read_cb, req,
+							request_unref);
+
+	return req->att_id != 0;
+}
+
+static void read_batch_release(struct read_batch *batch)
+{
+	struct request *req;
+
+	while ((req = queue_pop_head(batch->reqs))) {
+		req->batch = NULL;
+		request_unref(req);
+	}
+}
+
+static void read_batch_free(void *data)
+{
+	struct read_batch *batch = data;
+
+	/* Only the batch still being filled is referenced by its client */
+	if (batch->timeout_id) {
+		batch->client->read_batch = NULL;
+		timeout_remove(batch->timeout_id);
+	}
+
+	read_batch_release(batch);
+	queue_destroy(batch->reqs, NULL);
+	free(batch);
+}
+
+static struct read_batch *read_batch_new(struct bt_gatt_client *client)
+{
+	struct read_batch *batch;
+
+	batch = new0(struct read_batch, 1);
+	batch->client = client;
+	batch->reqs = queue_new();
+
+	return batch;
+}
+
+/* Send whatever a batch could not return as individual reads */
+static void read_batch_split(struct read_batch *batch)
+{
+	struct request *req;
+
+	while ((req = queue_pop_head(batch->reqs))) {
+		req->batch = NULL;
+
+		if (!read_send(req))
+			request_unref(req);
+	}
+}
+
+static void read_batch_cb(uint8_t opcode, const void *pdu, uint16_t length,
+								void *user_data)
+{
+	struct read_batch *batch = user_data;
+	const uint8_t *value = pdu;
+	struct request *req;
+
+	/*
+	 * A single handle failing fails the whole batch, so in that case
+	 * every value is read again on its own to report its own error.
+	 */
+	if (opcode != BT_ATT_OP_READ_MULT_VL_RSP || (!pdu && length)) {
+		read_batch_split(batch);
+		return;
+	}
+
+	while (length >= 2 && (req = queue_peek_head(batch->reqs))) {
+		struct read_op *op = req->data;
+		uint16_t len;
+
+		len = get_le16(value);
+		value += 2;
+		length -= 2;
+
+		/* Truncated values are read again on their own */
+		if (len > length)
+			break;
+
+		queue_pop_head(batch->reqs);
+		req->batch = NULL;
+
+		if (op->callback)
+			op->callback(true, 0, len ? value : NULL, len,
+							op->user_data);
+
+		request_unref(req);
+
+		value += len;
+		length -= len;
+	}
+
+	read_batch_split(batch);
+}
+
+static void read_batch_send(struct read_batch *batch)
+{
+	unsigned int count = queue_length(batch->reqs);
+	const struct queue_entry *entry;
+	uint8_t pdu[count * 2];
+	unsigned int i = 0;
+
+	if (count < 2) {
+		read_batch_split(batch);
+		read_batch_free(batch);
+		return;
+	}
+
+	for (entry = queue_get_entries(batch->reqs); entry;
+							entry = entry->next) {
+		struct request *req = entry->data;
+		struct read_op *op = req->data;
+
+		put_le16(op->handle, pdu + (2 * i++));
+	}
+
+	batch->att_id = bt_att_send(batch->client->att,
+						BT_ATT_OP_READ_MULT_VL_REQ,
+						pdu, sizeof(pdu),
+						read_batch_cb, batch,
+						read_batch_free);
+	if (!batch->att_id)
+		read_batch_free(batch);
+}
+
+static bool read_batch_flush(void *user_data)
+{
+	struct read_batch *batch = user_data;
+	struct bt_gatt_client *client = batch->client;
+	unsigned int max;
+
+	batch->timeout_id = 0;
+	client->read_batch = NULL;
+
+	/* All the handles have to fit in a single request */
+	max = (bt_att_get_mtu(client->att) - 1) / 2;
+
+	while (queue_length(batch->reqs) > max) {
+		struct read_batch *next = read_batch_new(client);
+		unsigned int i;
+
+		for (i = 0; i < max; i++) {
+			struct request *req = queue_pop_head(batch->reqs);
+
+			req->batch = next;
+			queue_push_tail(next->reqs, req);
+		}
+
+		read_batch_send(next);
+	}
+
+	read_batch_send(batch);
+
+	return false;
+}
+
+/*
+ * Reads issued in the same main loop iteration are sent together as Read
+ * Multiple Variable Length requests once the server is known to support
+ * them, that is once EATT has been enabled in the client features.
+ */
+static bool read_batch_add(struct bt_gatt_client *client,
+							struct request *req)
+{
+	struct bt_gatt_client *root = client;
+	struct read_batch *batch;
+
+	if (!(bt_gatt_client_get_features(client) &
+					BT_GATT_CHRC_CLI_FEAT_EATT))
+		return false;
+
+	while (root->parent)
+		root = root->parent;
+
+	batch = root->read_batch;
+	if (!batch) {
+		batch = read_batch_new(root);
+		batch->timeout_id = timeout_add(READ_BATCH_DELAY,
+						read_batch_flush, batch, NULL);
+		if (!batch->timeout_id) {
+			read_batch_free(batch);
+			return false;
+		}
+
+		root->read_batch = batch;
+	}
+
+	req->batch = batch;
+	queue_push_tail(batch->reqs, req);
+
+	return true;
+}
+
+static bool cancel_batched_read(struct request *req)
+{
+	struct read_batch *batch = req->batch;
+
+	queue_remove(batch->reqs, req);
+	req->batch = NULL;
+
+	/*
+	 * A batch already sent is left to complete since the response may
+	 * be being processed right now.
+	 */
+	if (batch->timeout_id && queue_isempty(batch->reqs))
+		read_batch_free(batch);
+
+	request_unref(req);
+
+	return true;
+}
+
 unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
 					uint16_t value_handle,
 					bt_gatt_client_read_callback_t callback,
@@ -2621,7 +3197,6 @@ unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
 {
 	struct request *req;
 	struct read_op *op;
-	uint8_t pdu[2];
 
 	if (!client)
 		return 0;
@@ -2637,17 +3212,15 @@ unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
 	op->callback = callback;
 	op->user_data = user_data;
 	op->destroy = destroy;
+	op->handle = value_handle;
 
 	req->data = op;
 	req->destroy = destroy_read_op;
 
-	put_le16(value_handle, pdu);
+	if (read_batch_add(client, req))
+		return req->id;
 
-	req->att_id = bt_att_send(client->att, BT_ATT_OP_READ_REQ,
-							pdu, sizeof(pdu),
-							read_cb, req,
-							request_unref);
-	if (!req->att_id) {
+	if (!read_send(req)) {
 		op->destroy = NULL;
 		request_unref(req);
 		return 0;
@@ -2707,9 +3280,12 @@ static void read_multiple_cb(uint8_t opcode, const void *pdu, uint16_t length,
 		 * current ATT_MTU.
 		 */
 		if (len > length)
-			length = len;
+			len = length;
 
 		op->callback(success, att_ecode, pdu, len, op->user_data);
+
+		pdu += len;
+		length -= len;
 	}
 }
 
@@ -2982,6 +3558,42 @@ unsigned int bt_gatt_client_write_without_response(
 	return req->id;
 }
 
+unsigned int bt_gatt_client_get_write_queued(struct bt_gatt_client *client)
+{
+	if (!client)
+		return 0;
+
+	return bt_att_get_write_queued(client->att);
+}
+
+/*
+ * Write Without Response has no feedback from the remote, so callers
+ * streaming data should stop once bt_gatt_client_get_write_queued() goes
+ * above their limit and resume from the callback, which is called once the
+ * queue has drained down to limit bytes.
+ */
+unsigned int bt_gatt_client_wait_writable(struct bt_gatt_client *client,
+				unsigned int limit,
+				bt_gatt_client_writable_callback_t callback,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy)
+{
+	if (!client)
+		return 0;
+
+	return bt_att_wait_writable(client->att, limit, callback, user_data,
+								destroy);
+}
+
+bool bt_gatt_client_cancel_writable(struct bt_gatt_client *client,
+							unsigned int id)
+{
+	if (!client)
+		return false;
+
+	return bt_att_cancel_writable(client->att, id);
+}
+
 struct write_op {
 	struct bt_gatt_client *client;
 	bt_gatt_client_callback_t callback;
@@ -3444,8 +4056,7 @@ static struct request *get_reliable_request(struct bt_gatt_client *client,
 
 	/* Following prepare writes */
 	if (id != 0)
-		req = queue_find(client->pending_requests, match_req_id,
-							UINT_TO_PTR(id));
+		req = hashmap_lookup(client->request_map, id);
 	else
 		req = request_create(client);
 
@@ -3599,8 +4210,7 @@ unsigned int bt_gatt_client_write_execute(struct bt_gatt_client *client,
 
 	op = new0(struct write_op, 1);
 
-	req = queue_find(client->pending_requests, match_req_id,
-							UINT_TO_PTR(id));
+	req = hashmap_lookup(client->request_map, id);
 	if (!req) {
 		free(op);
 		return 0;
@@ -3653,11 +4263,13 @@ bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 	if (!client || !id)
 		return false;
 
-	notify_data = queue_remove_if(client->notify_list, match_notify_data_id,
-							UINT_TO_PTR(id));
+	notify_data = hashmap_remove(client->notify_map, id);
 	if (!notify_data)
 		return false;
 
+	queue_remove(client->notify_list, notify_data);
+	queue_remove(notify_data->chrc->notify_list, notify_data);
+
 	/* Remove data if it has been queued */
 	queue_remove(notify_data->chrc->reg_notify_queue, notify_data);
 
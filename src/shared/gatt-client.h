@@ -35,6 +35,7 @@ typedef void (*bt_gatt_client_read_callback_t)(bool success, uint8_t att_ecode,
 typedef void (*bt_gatt_client_write_long_callback_t)(bool success,
 					bool reliable_error, uint8_t att_ecode,
 					void *user_data);
+typedef void (*bt_gatt_client_writable_callback_t)(void *user_data);
 typedef void (*bt_gatt_client_notify_callback_t)(uint16_t value_handle,
 					const uint8_t *value, uint16_t length,
 					void *user_data);
@@ -89,6 +90,14 @@ unsigned int bt_gatt_client_write_without_response(
 					uint16_t value_handle,
 					bool signed_write,
 					const uint8_t *value, uint16_t length);
+unsigned int bt_gatt_client_get_write_queued(struct bt_gatt_client *client);
+unsigned int bt_gatt_client_wait_writable(struct bt_gatt_client *client,
+				unsigned int limit,
+				bt_gatt_client_writable_callback_t callback,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_cancel_writable(struct bt_gatt_client *client,
+							unsigned int id);
 unsigned int bt_gatt_client_write_value(struct bt_gatt_client *client,
 					uint16_t value_handle,
 					const uint8_t *value, uint16_t length,
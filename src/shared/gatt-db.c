@@ -13,12 +13,14 @@
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <errno.h>
 
 #include "lib/bluetooth.h"
 #include "lib/uuid.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/timeout.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
@@ -46,6 +48,22 @@ static const bt_uuid_t ext_desc_uuid = { .type = BT_UUID16,
 static const bt_uuid_t ccc_uuid = { .type = BT_UUID16,
 				.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID };
 
+/*
+ * Attribute values and types are kept in a content addressed store shared
+ * by all databases, so the declarations of many devices exposing the same
+ * services are only stored once. Stored values are never modified in
+ * place, a write replaces the value of the attribute with a new one.
+ */
+struct stored_value {
+	struct stored_value *next;
+	unsigned int key;
+	unsigned int ref_count;
+	unsigned int len;
+	uint8_t data[];
+};
+
+static struct hashmap *value_store;
+
 struct gatt_db_ccc {
 	gatt_db_read_t read_func;
 	gatt_db_write_t write_func;
@@ -58,9 +76,15 @@ struct gatt_db {
 	struct bt_crypto *crypto;
 	uint8_t hash[16];
 	unsigned int hash_id;
+	bool hash_dirty;
 	uint16_t next_handle;
 	struct queue *services;
 
+	/* Services sorted by start handle for O(log n) handle lookups */
+	struct gatt_db_service **index;
+	unsigned int index_len;
+	unsigned int index_size;
+
 	struct queue *notify_list;
 	unsigned int next_notify_id;
 
@@ -102,14 +126,11 @@ struct pending_write {
 	void *user_data;
 };
 
-struct gatt_db_attribute {
-	struct gatt_db_service *service;
-	uint16_t handle;
-	bt_uuid_t uuid;
-	uint32_t permissions;
-	uint16_t value_len;
-	uint8_t *value;
-
+/*
+ * Callbacks and request state of an attribute, only allocated when used so
+ * the attributes of cached remote databases, which have neither, stay small.
+ */
+struct attribute_ext {
 	gatt_db_read_t read_func;
 	gatt_db_write_t write_func;
 	gatt_db_notify_t notify_func;
@@ -125,24 +146,135 @@ struct gatt_db_attribute {
 	struct queue *notify_list;
 };
 
+struct gatt_db_attribute {
+	struct gatt_db_service *service;
+	const bt_uuid_t *uuid;
+	uint8_t *value;
+	struct attribute_ext *ext;
+	uint32_t permissions;
+	uint16_t handle;
+	uint16_t value_len;
+};
+
 struct gatt_db_service {
 	struct gatt_db *db;
 	bool active;
 	bool claimed;
 	uint16_t num_handles;
 	struct gatt_db_attribute **attributes;
+
+	/* Cached Database Hash input of this service */
+	bool hash_dirty;
+	uint8_t *hash_data;
+	size_t hash_len;
 };
 
+static uint16_t service_end_handle(const struct gatt_db_service *service)
+{
+	return service->attributes[0]->handle + service->num_handles - 1;
+}
+
+/*
+ * Return the position of the first indexed service whose range ends at or
+ * after the given handle, which is either the service containing the handle
+ * or the first service located after it.
+ */
+static unsigned int index_lower_bound(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int lo = 0, hi = db->index_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (service_end_handle(db->index[mid]) < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct gatt_db_service *index_find(struct gatt_db *db, uint16_t handle)
+{
+	struct gatt_db_service *service;
+	unsigned int i;
+
+	i = index_lower_bound(db, handle);
+	if (i >= db->index_len)
+		return NULL;
+
+	service = db->index[i];
+	if (service->attributes[0]->handle > handle)
+		return NULL;
+
+	return service;
+}
+
+static bool index_add(struct gatt_db *db, struct gatt_db_service *service)
+{
+	unsigned int i;
+
+	if (db->index_len == db->index_size) {
+		struct gatt_db_service **index;
+		unsigned int size = db->index_size ? db->index_size * 2 : 16;
+
+		index = realloc(db->index, size * sizeof(*index));
+		if (!index)
+			return false;
+
+		db->index = index;
+		db->index_size = size;
+	}
+
+	i = index_lower_bound(db, service->attributes[0]->handle);
+
+	memmove(&db->index[i + 1], &db->index[i],
+				(db->index_len - i) * sizeof(*db->index));
+	db->index[i] = service;
+	db->index_len++;
+
+	return true;
+}
+
+static void index_remove(struct gatt_db *db, struct gatt_db_service *service)
+{
+	unsigned int i;
+
+	i = index_lower_bound(db, service->attributes[0]->handle);
+	if (i >= db->index_len || db->index[i] != service)
+		return;
+
+	db->index_len--;
+	memmove(&db->index[i], &db->index[i + 1],
+				(db->index_len - i) * sizeof(*db->index));
+}
+
+static struct attribute_ext *attribute_ext(struct gatt_db_attribute *attrib)
+{
+	if (!attrib->ext)
+		attrib->ext = new0(struct attribute_ext, 1);
+
+	return attrib->ext;
+}
+
 static void set_attribute_data(struct gatt_db_attribute *attribute,
 						gatt_db_read_t read_func,
 						gatt_db_write_t write_func,
 						uint32_t permissions,
 						void *user_data)
 {
+	struct attribute_ext *ext;
+
 	attribute->permissions = permissions;
-	attribute->read_func = read_func;
-	attribute->write_func = write_func;
-	attribute->user_data = user_data;
+
+	if (!read_func && !write_func && !user_data && !attribute->ext)
+		return;
+
+	ext = attribute_ext(attribute);
+	ext->read_func = read_func;
+	ext->write_func = write_func;
+	ext->user_data = user_data;
 }
 
 static void pending_read_result(struct pending_read *p, int err,
@@ -190,20 +322,322 @@ static void attribute_notify_destroy(void *data)
 	free(notify);
 }
 
+static unsigned int value_key(const uint8_t *data, uint16_t len)
+{
+	unsigned int key = 2166136261u;
+	uint16_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		key ^= data[i];
+		key *= 16777619u;
+	}
+
+	return key ^ len;
+}
+
+static uint8_t *value_get(const uint8_t *data, uint16_t len)
+{
+	struct stored_value *head, *value;
+	unsigned int key;
+
+	key = value_key(data, len);
+
+	if (!value_store)
+		value_store = hashmap_new();
+
+	head = hashmap_lookup(value_store, key);
+
+	for (value = head; value; value = value->next) {
+		if (value->len == len && !memcmp(value->data, data, len)) {
+			value->ref_count++;
+			return value->data;
+		}
+	}
+
+	value = malloc(sizeof(*value) + len);
+	if (!value)
+		return NULL;
+
+	value->key = key;
+	value->ref_count = 1;
+	value->len = len;
+	memcpy(value->data, data, len);
+
+	if (head) {
+		value->next = head->next;
+		head->next = value;
+	} else {
+		value->next = NULL;
+		hashmap_insert(value_store, key, value);
+	}
+
+	return value->data;
+}
+
+static uint16_t value_len(const uint8_t *data)
+{
+	const struct stored_value *value;
+
+	if (!data)
+		return 0;
+
+	value = (const void *) (data - offsetof(struct stored_value, data));
+
+	return value->len;
+}
+
+static void value_put(uint8_t *data)
+{
+	struct stored_value *value, *head, *prev;
+
+	if (!data)
+		return;
+
+	value = (void *) (data - offsetof(struct stored_value, data));
+
+	if (--value->ref_count)
+		return;
+
+	head = hashmap_lookup(value_store, value->key);
+
+	if (head == value) {
+		hashmap_remove(value_store, value->key);
+		if (value->next)
+			hashmap_insert(value_store, value->key, value->next);
+	} else {
+		for (prev = head; prev->next != value; prev = prev->next);
+		prev->next = value->next;
+	}
+
+	free(value);
+
+	if (hashmap_isempty(value_store)) {
+		hashmap_destroy(value_store, NULL);
+		value_store = NULL;
+	}
+}
+
+static const bt_uuid_t *known_uuids[] = {
+	&primary_service_uuid,
+	&secondary_service_uuid,
+	&characteristic_uuid,
+	&included_service_uuid,
+	&ext_desc_uuid,
+	&ccc_uuid,
+};
+
+static const bt_uuid_t *uuid_get(const bt_uuid_t *uuid)
+{
+	bt_uuid_t key;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(known_uuids); i++) {
+		if (uuid->type == BT_UUID16 &&
+				known_uuids[i]->value.u16 == uuid->value.u16)
+			return known_uuids[i];
+	}
+
+	/* Clear the unused bytes so equal UUIDs have equal contents */
+	memset(&key, 0, sizeof(key));
+	key.type = uuid->type;
+
+	switch (uuid->type) {
+	case BT_UUID16:
+		key.value.u16 = uuid->value.u16;
+		break;
+	case BT_UUID32:
+		key.value.u32 = uuid->value.u32;
+		break;
+	case BT_UUID128:
+		key.value.u128 = uuid->value.u128;
+		break;
+	case BT_UUID_UNSPEC:
+		break;
+	}
+
+	return (const void *) value_get((const void *) &key, sizeof(key));
+}
+
+static bool uuid_is_known(const bt_uuid_t *uuid)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(known_uuids); i++) {
+		if (uuid == known_uuids[i])
+			return true;
+	}
+
+	return false;
+}
+
+static void uuid_put(const bt_uuid_t *uuid)
+{
+	if (uuid && !uuid_is_known(uuid))
+		value_put((void *) uuid);
+}
+
 static void attribute_destroy(struct gatt_db_attribute *attribute)
 {
+	struct attribute_ext *ext;
+
 	/* Attribute was not initialized by user */
 	if (!attribute)
 		return;
 
-	queue_destroy(attribute->pending_reads, pending_read_free);
-	queue_destroy(attribute->pending_writes, pending_write_free);
-	queue_destroy(attribute->notify_list, attribute_notify_destroy);
+	ext = attribute->ext;
+	if (ext) {
+		queue_destroy(ext->pending_reads, pending_read_free);
+		queue_destroy(ext->pending_writes, pending_write_free);
+		queue_destroy(ext->notify_list, attribute_notify_destroy);
+		free(ext);
+	}
 
-	free(attribute->value);
+	uuid_put(attribute->uuid);
+	value_put(attribute->value);
 	free(attribute);
 }
 
+struct hash_data {
+	struct iovec *iov;
+	uint16_t i;
+};
+
+/*
+ * Return the number of bytes the attribute contributes to the Database Hash
+ * and, if data is set, serialize them into it.
+ */
+static size_t gen_hash_m(const struct gatt_db_attribute *attr, uint8_t *data)
+{
+	size_t len;
+
+	if (bt_uuid_len(attr->uuid) != 2)
+		return 0;
+
+	switch (attr->uuid->value.u16) {
+	case GATT_PRIM_SVC_UUID:
+	case GATT_SND_SVC_UUID:
+	case GATT_INCLUDE_UUID:
+	case GATT_CHARAC_UUID:
+		/* Handle + type + value */
+		len = 2 + 2 + attr->value_len;
+		if (data)
+			memcpy(data + 4, attr->value, attr->value_len);
+		break;
+	case GATT_CHARAC_USER_DESC_UUID:
+	case GATT_CLIENT_CHARAC_CFG_UUID:
+	case GATT_SERVER_CHARAC_CFG_UUID:
+	case GATT_CHARAC_FMT_UUID:
+	case GATT_CHARAC_AGREG_FMT_UUID:
+		/* Handle + type  */
+		len = 2 + 2;
+		break;
+	default:
+		return 0;
+	}
+
+	if (data) {
+		put_le16(attr->handle, data);
+		bt_uuid_to_le(attr->uuid, data + 2);
+	}
+
+	return len;
+}
+
+static bool service_hash_update(struct gatt_db_service *service)
+{
+	struct gatt_db_attribute *attr;
+	size_t len = 0;
+	uint8_t *data;
+	uint16_t i;
+
+	for (i = 0; i < service->num_handles; i++) {
+		attr = service->attributes[i];
+		if (attr)
+			len += gen_hash_m(attr, NULL);
+	}
+
+	data = realloc(service->hash_data, len);
+	if (len && !data)
+		return false;
+
+	service->hash_data = data;
+	service->hash_len = len;
+
+	for (i = 0; i < service->num_handles; i++) {
+		attr = service->attributes[i];
+		if (attr)
+			data += gen_hash_m(attr, data);
+	}
+
+	service->hash_dirty = false;
+
+	return true;
+}
+
+static void service_gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct gatt_db_service *service = attr->service;
+	struct hash_data *hash = user_data;
+
+	/* Only re-serialize services that changed since the last update */
+	if (service->hash_dirty && !service_hash_update(service))
+		return;
+
+	if (!service->hash_len)
+		return;
+
+	hash->iov[hash->i].iov_base = service->hash_data;
+	hash->iov[hash->i].iov_len = service->hash_len;
+	hash->i++;
+}
+
+static bool db_hash_update(void *user_data)
+{
+	struct gatt_db *db = user_data;
+	struct hash_data hash;
+
+	db->hash_id = 0;
+
+	if (!db->next_handle)
+		return false;
+
+	hash.iov = new0(struct iovec, queue_length(db->services) + 1);
+	hash.i = 0;
+
+	gatt_db_foreach_service(db, NULL, service_gen_hash_m, &hash);
+	if (bt_crypto_gatt_hash(db->crypto, hash.iov, hash.i, db->hash))
+		db->hash_dirty = false;
+
+	free(hash.iov);
+
+	return false;
+}
+
+static void db_hash_changed(struct gatt_db *db)
+{
+	db->hash_dirty = true;
+
+	/* Coalesce changes into a single hash update */
+	if (!db->hash_id && db->crypto)
+		db->hash_id = timeout_add(HASH_UPDATE_TIMEOUT, db_hash_update,
+								db, NULL);
+}
+
+static void service_hash_changed(struct gatt_db_service *service)
+{
+	service->hash_dirty = true;
+
+	if (service->db && service->active)
+		db_hash_changed(service->db);
+}
+
+static void attribute_hash_changed(struct gatt_db_attribute *attr)
+{
+	if (gen_hash_m(attr, NULL))
+		service_hash_changed(attr->service);
+}
+
 static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 							uint16_t handle,
 							const bt_uuid_t *type,
@@ -216,19 +650,19 @@ static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 
 	attribute->service = service;
 	attribute->handle = handle;
-	attribute->uuid = *type;
 	attribute->value_len = len;
+
+	attribute->uuid = uuid_get(type);
+	if (!attribute->uuid)
+		goto failed;
+
 	if (len) {
-		attribute->value = malloc0(len);
+		attribute->value = value_get(val, len);
 		if (!attribute->value)
 			goto failed;
-
-		memcpy(attribute->value, val, len);
 	}
 
-	attribute->pending_reads = queue_new();
-	attribute->pending_writes = queue_new();
-	attribute->notify_list = queue_new();
+	service_hash_changed(service);
 
 	return attribute;
 
@@ -294,85 +728,6 @@ static void handle_notify(void *data, void *user_data)
 		notify->service_removed(notify_data->attr, notify->user_data);
 }
 
-struct hash_data {
-	struct iovec *iov;
-	uint16_t i;
-};
-
-static void gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct hash_data *hash = user_data;
-	uint8_t *data;
-	size_t len;
-
-	if (bt_uuid_len(&attr->uuid) != 2)
-		return;
-
-	switch (attr->uuid.value.u16) {
-	case GATT_PRIM_SVC_UUID:
-	case GATT_SND_SVC_UUID:
-	case GATT_INCLUDE_UUID:
-	case GATT_CHARAC_UUID:
-		/* Allocate space for handle + type + value */
-		len = 2 + 2 + attr->value_len;
-		data = malloc(2 + 2 + attr->value_len);
-		put_le16(attr->handle, data);
-		bt_uuid_to_le(&attr->uuid, data + 2);
-		memcpy(data + 4, attr->value, attr->value_len);
-		break;
-	case GATT_CHARAC_USER_DESC_UUID:
-	case GATT_CLIENT_CHARAC_CFG_UUID:
-	case GATT_SERVER_CHARAC_CFG_UUID:
-	case GATT_CHARAC_FMT_UUID:
-	case GATT_CHARAC_AGREG_FMT_UUID:
-		/* Allocate space for handle + type  */
-		len = 2 + 2;
-		data = malloc(2 + 2 + attr->value_len);
-		put_le16(attr->handle, data);
-		bt_uuid_to_le(&attr->uuid, data + 2);
-		break;
-	default:
-		return;
-	}
-
-	hash->iov[hash->i].iov_base = data;
-	hash->iov[hash->i].iov_len = len;
-
-	hash->i++;
-
-	return;
-}
-
-static void service_gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
-{
-	gatt_db_service_foreach(attr, NULL, gen_hash_m, user_data);
-}
-
-static bool db_hash_update(void *user_data)
-{
-	struct gatt_db *db = user_data;
-	struct hash_data hash;
-	uint16_t i;
-
-	db->hash_id = 0;
-
-	if (!db->next_handle)
-		return false;
-
-	hash.iov = new0(struct iovec, db->next_handle);
-	hash.i = 0;
-
-	gatt_db_foreach_service(db, NULL, service_gen_hash_m, &hash);
-	bt_crypto_gatt_hash(db->crypto, hash.iov, db->next_handle, db->hash);
-
-	for (i = 0; i < hash.i; i++)
-		free(hash.iov[i].iov_base);
-
-	free(hash.iov);
-
-	return false;
-}
-
 static void handle_attribute_notify(void *data, void *user_data)
 {
 	struct attribute_notify *notify = data;
@@ -392,7 +747,9 @@ static void notify_attribute_changed(struct gatt_db_service *service)
 		if (!attr)
 			continue;
 
-		queue_foreach(attr->notify_list, handle_attribute_notify, attr);
+		if (attr->ext)
+			queue_foreach(attr->ext->notify_list,
+						handle_attribute_notify, attr);
 	}
 }
 
@@ -405,6 +762,8 @@ static void notify_service_changed(struct gatt_db *db,
 	if (!added)
 		notify_attribute_changed(service);
 
+	db_hash_changed(db);
+
 	if (queue_isempty(db->notify_list))
 		return;
 
@@ -415,11 +774,6 @@ static void notify_service_changed(struct gatt_db *db,
 
 	queue_foreach(db->notify_list, handle_notify, &data);
 
-	/* Tigger hash update */
-	if (!db->hash_id && db->crypto)
-		db->hash_id = timeout_add(HASH_UPDATE_TIMEOUT, db_hash_update,
-								db, NULL);
-
 	gatt_db_unref(db);
 }
 
@@ -428,6 +782,9 @@ static void gatt_db_service_destroy(void *data)
 	struct gatt_db_service *service = data;
 	int i;
 
+	if (service->db)
+		index_remove(service->db, service);
+
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
@@ -435,6 +792,7 @@ static void gatt_db_service_destroy(void *data)
 		attribute_destroy(service->attributes[i]);
 
 	free(service->attributes);
+	free(service->hash_data);
 	free(service);
 }
 
@@ -455,7 +813,9 @@ static void gatt_db_destroy(struct gatt_db *db)
 	if (db->hash_id)
 		timeout_remove(db->hash_id);
 
+	db->index_len = 0;
 	queue_destroy(db->services, gatt_db_service_destroy);
+	free(db->index);
 	free(db->ccc);
 	free(db);
 }
@@ -471,6 +831,66 @@ void gatt_db_unref(struct gatt_db *db)
 	gatt_db_destroy(db);
 }
 
+static void stored_usage(const void *data, struct gatt_db_usage *usage)
+{
+	const struct stored_value *value;
+	size_t size;
+
+	if (!data)
+		return;
+
+	value = (const void *) ((const uint8_t *) data -
+					offsetof(struct stored_value, data));
+	size = sizeof(*value) + value->len;
+
+	if (value->ref_count > 1)
+		usage->shared_bytes += size;
+	else
+		usage->bytes += size;
+}
+
+static void service_usage(void *data, void *user_data)
+{
+	struct gatt_db_service *service = data;
+	struct gatt_db_usage *usage = user_data;
+	struct gatt_db_attribute *attr;
+	size_t i;
+
+	usage->services++;
+	usage->bytes += sizeof(*service) + service->hash_len +
+			service->num_handles * sizeof(*service->attributes);
+
+	for (i = 0; i < service->num_handles; i++) {
+		attr = service->attributes[i];
+		if (!attr)
+			continue;
+
+		usage->attributes++;
+		usage->bytes += sizeof(*attr);
+
+		if (attr->ext)
+			usage->bytes += sizeof(*attr->ext);
+
+		if (!uuid_is_known(attr->uuid))
+			stored_usage(attr->uuid, usage);
+
+		stored_usage(attr->value, usage);
+	}
+}
+
+bool gatt_db_get_usage(struct gatt_db *db, struct gatt_db_usage *usage)
+{
+	if (!db || !usage)
+		return false;
+
+	memset(usage, 0, sizeof(*usage));
+	usage->bytes = sizeof(*db) + db->index_size * sizeof(*db->index);
+
+	queue_foreach(db->services, service_usage, usage);
+
+	return true;
+}
+
 bool gatt_db_isempty(struct gatt_db *db)
 {
 	if (!db)
@@ -611,6 +1031,7 @@ bool gatt_db_clear_range(struct gatt_db *db, uint16_t start_handle,
 
 	/* Check if it is a full clear */
 	if (start_handle == 1 && end_handle == UINT16_MAX) {
+		db->index_len = 0;
 		queue_remove_all(db->services, NULL, NULL,
 						gatt_db_service_destroy);
 		goto done;
@@ -636,9 +1057,10 @@ uint8_t *gatt_db_get_hash(struct gatt_db *db)
 	if (!db || !db->crypto)
 		return NULL;
 
-	/* Generate hash if if has not been generated yet */
-	if (db->hash_id || !memcmp(db->hash, hash, 16)) {
-		timeout_remove(db->hash_id);
+	/* Generate hash if it is outdated or has not been generated yet */
+	if (db->hash_dirty || !memcmp(db->hash, hash, 16)) {
+		if (db->hash_id)
+			timeout_remove(db->hash_id);
 		db_hash_update(db);
 	}
 
@@ -657,31 +1079,24 @@ static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 						uint16_t start, uint16_t end,
 						struct gatt_db_service **after)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
-	uint16_t cur_start, cur_end;
+	unsigned int i;
 
 	*after = NULL;
 
-	services_entry = queue_get_entries(db->services);
-
-	while (services_entry) {
-		service = services_entry->data;
-
-		gatt_db_service_get_handles(service, &cur_start, &cur_end);
+	i = index_lower_bound(db, start);
 
-		if (start >= cur_start && start <= cur_end)
-			return service;
+	if (i > 0)
+		*after = db->index[i - 1];
 
-		if (end >= cur_start && end <= cur_end)
-			return service;
+	if (i >= db->index_len)
+		return NULL;
 
-		if (end < cur_start)
-			return NULL;
+	service = db->index[i];
 
-		*after = service;
-		services_entry = services_entry->next;
-	}
+	/* Services are disjoint so only the lower bound may overlap */
+	if (service->attributes[0]->handle <= end)
+		return service;
 
 	return NULL;
 }
@@ -719,7 +1134,7 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 									&value);
 
 		/* Check if service match */
-		if (!bt_uuid_cmp(&service->attributes[0]->uuid, type) &&
+		if (!bt_uuid_cmp(service->attributes[0]->uuid, type) &&
 				!bt_uuid_cmp(&value, uuid) &&
 				service->num_handles == num_handles &&
 				service->attributes[0]->handle == handle)
@@ -733,27 +1148,120 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	if (!service)
 		return NULL;
 
+	service->attributes[0]->handle = handle;
+	service->num_handles = num_handles;
+
+	if (!index_add(db, service))
+		goto fail;
+
 	if (after) {
 		if (!queue_push_after(db->services, after, service))
-			goto fail;
+			goto fail_index;
 	} else if (!queue_push_head(db->services, service)) {
-		goto fail;
+		goto fail_index;
 	}
 
 	service->db = db;
-	service->attributes[0]->handle = handle;
-	service->num_handles = num_handles;
 
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
 	return service->attributes[0];
 
+fail_index:
+	index_remove(db, service);
 fail:
 	gatt_db_service_destroy(service);
 	return NULL;
 }
 
+struct gatt_db_attribute *gatt_db_move_service(struct gatt_db *db,
+					struct gatt_db_attribute *attrib)
+{
+	struct gatt_db_service *service, *after;
+	struct gatt_db *src;
+	uint16_t start, end;
+
+	if (!db || !attrib)
+		return NULL;
+
+	service = attrib->service;
+	src = service->db;
+
+	if (src == db)
+		return service->attributes[0];
+
+	gatt_db_service_get_handles(service, &start, &end);
+
+	if (find_insert_loc(db, start, end, &after))
+		return NULL;
+
+	if (!index_add(db, service))
+		return NULL;
+
+	if (after) {
+		if (!queue_push_after(db->services, after, service)) {
+			index_remove(db, service);
+			return NULL;
+		}
+	} else if (!queue_push_head(db->services, service)) {
+		index_remove(db, service);
+		return NULL;
+	}
+
+	/* Watchers of the source database are not notified */
+	if (src) {
+		index_remove(src, service);
+		queue_remove(src->services, service);
+		db_hash_changed(src);
+	}
+
+	service->db = db;
+	db->next_handle = MAX(end + 1, db->next_handle);
+
+	if (service->active)
+		notify_service_changed(db, service, true);
+
+	return service->attributes[0];
+}
+
+bool gatt_db_service_equal(const struct gatt_db_attribute *a,
+					const struct gatt_db_attribute *b)
+{
+	const struct gatt_db_service *s1, *s2;
+	const struct gatt_db_attribute *x, *y;
+	int i;
+
+	if (!a || !b)
+		return false;
+
+	s1 = a->service;
+	s2 = b->service;
+
+	if (s1->num_handles != s2->num_handles)
+		return false;
+
+	for (i = 0; i < s1->num_handles; i++) {
+		x = s1->attributes[i];
+		y = s2->attributes[i];
+
+		if (!x || !y) {
+			if (x != y)
+				return false;
+
+			continue;
+		}
+
+		/* Stored values are shared so equal values have equal data */
+		if (x->handle != y->handle || x->value != y->value ||
+				x->value_len != y->value_len ||
+				bt_uuid_cmp(x->uuid, y->uuid))
+			return false;
+	}
+
+	return true;
+}
+
 struct gatt_db_attribute *gatt_db_add_service(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						bool primary,
@@ -897,7 +1405,8 @@ service_insert_characteristic(struct gatt_db_service *service,
 
 	service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
 	if (!service->attributes[i]) {
-		free(service->attributes[i - 1]);
+		attribute_destroy(service->attributes[i - 1]);
+		service->attributes[i - 1] = NULL;
 		return NULL;
 	}
 
@@ -1081,7 +1590,7 @@ gatt_db_service_add_ccc(struct gatt_db_attribute *attrib, uint32_t permissions)
 		return NULL;
 
 	value = gatt_db_get_attribute(db, handle);
-	if (!value || value->notify_func)
+	if (!value || (value->ext && value->ext->notify_func))
 		return NULL;
 
 	ccc = service_insert_descriptor(attrib->service, 0, &ccc_uuid,
@@ -1093,8 +1602,8 @@ gatt_db_service_add_ccc(struct gatt_db_attribute *attrib, uint32_t permissions)
 		return ccc;
 
 	gatt_db_attribute_set_fixed_length(ccc, 2);
-	ccc->notify_func = db->ccc->notify_func;
-	value->notify_func = db->ccc->notify_func;
+	attribute_ext(ccc)->notify_func = db->ccc->notify_func;
+	attribute_ext(value)->notify_func = db->ccc->notify_func;
 
 	return ccc;
 }
@@ -1401,7 +1910,7 @@ static void foreach_service_in_range(void *data, void *user_data)
 			/* Compare with attribute UUID in case it is a lookup
 			 * by group type.
 			 */
-			if (bt_uuid_cmp(&attribute->uuid, foreach_data->uuid))
+			if (bt_uuid_cmp(attribute->uuid, foreach_data->uuid))
 				return;
 		}
 	}
@@ -1445,13 +1954,43 @@ static void foreach_in_range(void *data, void *user_data)
 			return;
 
 		if (foreach_data->uuid && bt_uuid_cmp(foreach_data->uuid,
-							&attribute->uuid))
+							attribute->uuid))
 			continue;
 
 		foreach_data->func(attribute, foreach_data->user_data);
 	}
 }
 
+static void foreach_service_index(struct gatt_db *db,
+					struct foreach_data *foreach_data)
+{
+	struct gatt_db_service *service;
+	unsigned int i;
+	uint16_t end;
+
+	i = index_lower_bound(db, foreach_data->start);
+
+	while (i < db->index_len) {
+		service = db->index[i];
+
+		if (service->attributes[0]->handle > foreach_data->end)
+			break;
+
+		end = service_end_handle(service);
+
+		foreach_in_range(service, foreach_data);
+
+		/*
+		 * The callback may have added or removed services so look up
+		 * the next position again instead of relying on the index.
+		 */
+		if (end == UINT16_MAX)
+			break;
+
+		i = index_lower_bound(db, end + 1);
+	}
+}
+
 void gatt_db_foreach_service_in_range(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						gatt_db_attribute_cb_t func,
@@ -1471,7 +2010,7 @@ void gatt_db_foreach_service_in_range(struct gatt_db *db,
 	data.end = end_handle;
 	data.attr = false;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_service_index(db, &data);
 }
 
 void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
@@ -1492,7 +2031,7 @@ void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
 	data.end = end_handle;
 	data.attr = true;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_service_index(db, &data);
 }
 
 void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
@@ -1514,7 +2053,7 @@ void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
 		if (!attr)
 			continue;
 
-		if (uuid && bt_uuid_cmp(uuid, &attr->uuid))
+		if (uuid && bt_uuid_cmp(uuid, attr->uuid))
 			continue;
 
 		func(attr, user_data);
@@ -1560,10 +2099,10 @@ gatt_db_attribute_get_value(struct gatt_db_attribute *attrib)
 
 	service = attrib->service;
 
-	if (!bt_uuid_cmp(&characteristic_uuid, &attrib->uuid))
+	if (!bt_uuid_cmp(&characteristic_uuid, attrib->uuid))
 		index++;
 	else if (bt_uuid_cmp(&characteristic_uuid,
-				&service->attributes[index - 1]->uuid))
+				service->attributes[index - 1]->uuid))
 		return NULL;
 
 	return service->attributes[index];
@@ -1598,8 +2137,8 @@ void gatt_db_service_foreach_desc(struct gatt_db_attribute *attrib,
 			continue;
 
 		/* Return if we reached the end of this characteristic */
-		if (!bt_uuid_cmp(&characteristic_uuid, &attr->uuid) ||
-			!bt_uuid_cmp(&included_service_uuid, &attr->uuid))
+		if (!bt_uuid_cmp(&characteristic_uuid, attr->uuid) ||
+			!bt_uuid_cmp(&included_service_uuid, attr->uuid))
 			return;
 
 		func(attr, user_data);
@@ -1614,17 +2153,6 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute *attrib,
 								user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
-{
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_UINT(user_data);
-	uint16_t start, end;
-
-	gatt_db_service_get_handles(service, &start, &end);
-
-	return (start <= handle) && (handle <= end);
-}
-
 struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 							uint16_t handle)
 {
@@ -1633,8 +2161,7 @@ struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 	if (!db || !handle)
 		return NULL;
 
-	service = queue_find(db->services, find_service_for_handle,
-						UINT_TO_PTR(handle));
+	service = index_find(db, handle);
 	if (!service)
 		return NULL;
 
@@ -1646,20 +2173,38 @@ struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 {
 	struct gatt_db_attribute *attrib;
 	struct gatt_db_service *service;
-	int i;
+	int lo, hi;
 
-	attrib = gatt_db_get_service(db, handle);
-	if (!attrib)
+	if (!db || !handle)
 		return NULL;
 
-	service = attrib->service;
+	service = index_find(db, handle);
+	if (!service)
+		return NULL;
 
-	for (i = 0; i < service->num_handles; i++) {
-		if (!service->attributes[i])
-			continue;
+	/* Attributes are usually allocated at consecutive handles */
+	lo = handle - service->attributes[0]->handle;
+	attrib = service->attributes[lo];
+	if (attrib && attrib->handle == handle)
+		return attrib;
+
+	/*
+	 * Otherwise fall back to a binary search, attributes are stored in
+	 * ascending handle order with any unused slots at the end.
+	 */
+	lo = 0;
+	hi = service->num_handles;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
 
-		if (service->attributes[i]->handle == handle)
-			return service->attributes[i];
+		attrib = service->attributes[mid];
+		if (!attrib || attrib->handle > handle)
+			hi = mid;
+		else if (attrib->handle < handle)
+			lo = mid + 1;
+		else
+			return attrib;
 	}
 
 	return NULL;
@@ -1697,7 +2242,7 @@ const bt_uuid_t *gatt_db_attribute_get_type(
 	if (!attrib)
 		return NULL;
 
-	return &attrib->uuid;
+	return attrib->uuid;
 }
 
 uint16_t gatt_db_attribute_get_handle(const struct gatt_db_attribute *attrib)
@@ -1774,7 +2319,7 @@ bool gatt_db_attribute_get_service_data(const struct gatt_db_attribute *attrib,
 	gatt_db_service_get_handles(service, start_handle, end_handle);
 
 	if (primary)
-		*primary = bt_uuid_cmp(&decl->uuid, &secondary_service_uuid);
+		*primary = bt_uuid_cmp(decl->uuid, &secondary_service_uuid);
 
 	if (!uuid)
 		return true;
@@ -1810,7 +2355,7 @@ static void read_ext_prop(struct gatt_db_attribute *attrib,
 	if (*ext_prop != 0)
 		return;
 
-	if (bt_uuid_cmp(&ext_desc_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&ext_desc_uuid, attrib->uuid))
 		return;
 
 	gatt_db_attribute_read(attrib, 0, BT_ATT_OP_READ_REQ, NULL,
@@ -1824,7 +2369,7 @@ static uint8_t get_char_extended_prop(const struct gatt_db_attribute *attrib)
 	if (!attrib)
 		return 0;
 
-	if (bt_uuid_cmp(&characteristic_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&characteristic_uuid, attrib->uuid))
 		return 0;
 
 	/* Check properties first */
@@ -1853,7 +2398,7 @@ bool gatt_db_attribute_get_char_data(const struct gatt_db_attribute *attrib,
 	if (!attrib)
 		return false;
 
-	if (bt_uuid_cmp(&characteristic_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&characteristic_uuid, attrib->uuid))
 		return false;
 
 	/*
@@ -1892,7 +2437,7 @@ bool gatt_db_attribute_get_incl_data(const struct gatt_db_attribute *attrib,
 	if (!attrib)
 		return false;
 
-	if (bt_uuid_cmp(&included_service_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&included_service_uuid, attrib->uuid))
 		return false;
 
 	/*
@@ -1935,7 +2480,7 @@ static bool read_timeout(void *user_data)
 
 	p->timeout_id = 0;
 
-	queue_remove(p->attrib->pending_reads, p);
+	queue_remove(p->attrib->ext->pending_reads, p);
 
 	pending_read_result(p, -ETIMEDOUT, NULL, 0);
 
@@ -1968,7 +2513,7 @@ bool gatt_db_attribute_set_fixed_length(struct gatt_db_attribute *attrib,
 		return false;
 
 	/* If attribute is a characteristic declaration ajust to its value */
-	if (!bt_uuid_cmp(&characteristic_uuid, &attrib->uuid)) {
+	if (!bt_uuid_cmp(&characteristic_uuid, attrib->uuid)) {
 		int i;
 
 		/* Start from the attribute following the value handle */
@@ -2000,7 +2545,8 @@ bool gatt_db_attribute_read(struct gatt_db_attribute *attrib, uint16_t offset,
 		return true;
 	}
 
-	if (attrib->read_func) {
+	if (attrib->ext && attrib->ext->read_func) {
+		struct attribute_ext *ext = attrib->ext;
 		struct pending_read *p;
 		uint8_t err;
 
@@ -2012,16 +2558,19 @@ bool gatt_db_attribute_read(struct gatt_db_attribute *attrib, uint16_t offset,
 
 		p = new0(struct pending_read, 1);
 		p->attrib = attrib;
-		p->id = ++attrib->read_id;
+		p->id = ++ext->read_id;
 		p->timeout_id = timeout_add(ATTRIBUTE_TIMEOUT, read_timeout,
 								p, NULL);
 		p->func = func;
 		p->user_data = user_data;
 
-		queue_push_tail(attrib->pending_reads, p);
+		if (!ext->pending_reads)
+			ext->pending_reads = queue_new();
+
+		queue_push_tail(ext->pending_reads, p);
 
-		attrib->read_func(attrib, p->id, offset, opcode, att,
-							attrib->user_data);
+		ext->read_func(attrib, p->id, offset, opcode, att,
+							ext->user_data);
 		return true;
 	}
 
@@ -2050,7 +2599,10 @@ bool gatt_db_attribute_read_result(struct gatt_db_attribute *attrib,
 	if (!attrib || !id)
 		return false;
 
-	p = queue_remove_if(attrib->pending_reads, find_pending,
+	if (!attrib->ext)
+		return false;
+
+	p = queue_remove_if(attrib->ext->pending_reads, find_pending,
 							UINT_TO_PTR(id));
 	if (!p)
 		return false;
@@ -2066,7 +2618,7 @@ static bool write_timeout(void *user_data)
 
 	p->timeout_id = 0;
 
-	queue_remove(p->attrib->pending_writes, p);
+	queue_remove(p->attrib->ext->pending_writes, p);
 
 	pending_write_result(p, -ETIMEDOUT);
 
@@ -2080,11 +2632,14 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 					void *user_data)
 {
 	uint8_t err = 0;
+	uint8_t *buf, *stored;
+	uint16_t buf_len, stored_len;
 
 	if (!attrib || !func)
 		return false;
 
-	if (attrib->write_func) {
+	if (attrib->ext && attrib->ext->write_func) {
+		struct attribute_ext *ext = attrib->ext;
 		struct pending_write *p;
 
 		/* Check boundaries if value_len is set */
@@ -2106,16 +2661,19 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 
 		p = new0(struct pending_write, 1);
 		p->attrib = attrib;
-		p->id = ++attrib->write_id;
+		p->id = ++ext->write_id;
 		p->timeout_id = timeout_add(ATTRIBUTE_TIMEOUT, write_timeout,
 								p, NULL);
 		p->func = func;
 		p->user_data = user_data;
 
-		queue_push_tail(attrib->pending_writes, p);
+		if (!ext->pending_writes)
+			ext->pending_writes = queue_new();
+
+		queue_push_tail(ext->pending_writes, p);
 
-		attrib->write_func(attrib, p->id, offset, value, len, opcode,
-							att, attrib->user_data);
+		ext->write_func(attrib, p->id, offset, value, len, opcode,
+							att, ext->user_data);
 		return true;
 	}
 
@@ -2123,25 +2681,30 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 	if (len == 0)
 		goto done;
 
-	/* For values stored in db allocate on demand */
-	if (!attrib->value || offset >= attrib->value_len ||
-				len > (unsigned) (attrib->value_len - offset)) {
-		void *buf;
+	/* Stored values may be shared so build the new value aside */
+	stored_len = value_len(attrib->value);
+	buf_len = MAX(stored_len, len + offset);
 
-		buf = realloc(attrib->value, len + offset);
-		if (!buf)
-			return false;
+	buf = malloc0(buf_len);
+	if (!buf)
+		return false;
 
-		attrib->value = buf;
+	if (stored_len)
+		memcpy(buf, attrib->value, stored_len);
 
-		/* Init data in the first allocation */
-		if (!attrib->value_len)
-			memset(attrib->value, 0, offset);
+	memcpy(&buf[offset], value, len);
 
-		attrib->value_len = len + offset;
-	}
+	stored = value_get(buf, buf_len);
+	free(buf);
 
-	memcpy(&attrib->value[offset], value, len);
+	if (!stored)
+		return false;
+
+	value_put(attrib->value);
+	attrib->value = stored;
+	attrib->value_len = buf_len;
+
+	attribute_hash_changed(attrib);
 
 done:
 	func(attrib, err, user_data);
@@ -2157,7 +2720,10 @@ bool gatt_db_attribute_write_result(struct gatt_db_attribute *attrib,
 	if (!attrib || !id)
 		return false;
 
-	p = queue_remove_if(attrib->pending_writes, find_pending,
+	if (!attrib->ext)
+		return false;
+
+	p = queue_remove_if(attrib->ext->pending_writes, find_pending,
 							UINT_TO_PTR(id));
 	if (!p)
 		return false;
@@ -2174,7 +2740,7 @@ static void find_ccc(struct gatt_db_attribute *attrib, void *user_data)
 	if (*ccc)
 		return;
 
-	if (bt_uuid_cmp(&ccc_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&ccc_uuid, attrib->uuid))
 		return;
 
 	*ccc = attrib;
@@ -2199,18 +2765,19 @@ bool gatt_db_attribute_notify(struct gatt_db_attribute *attrib,
 {
 	struct gatt_db_attribute *ccc;
 
-	if (!attrib || !attrib->notify_func)
+	if (!attrib || !attrib->ext || !attrib->ext->notify_func)
 		return false;
 
 	attrib = gatt_db_attribute_get_value(attrib);
-	if (!attrib)
+	if (!attrib || !attrib->ext || !attrib->ext->notify_func)
 		return false;
 
 	ccc = gatt_db_attribute_get_ccc(attrib);
 	if (!ccc)
 		return false;
 
-	attrib->notify_func(attrib, ccc, value, len, att, ccc->user_data);
+	attrib->ext->notify_func(attrib, ccc, value, len, att,
+				ccc->ext ? ccc->ext->user_data : NULL);
 
 	return true;
 }
@@ -2223,19 +2790,21 @@ bool gatt_db_attribute_reset(struct gatt_db_attribute *attrib)
 	if (!attrib->value || !attrib->value_len)
 		return true;
 
-	free(attrib->value);
+	value_put(attrib->value);
 	attrib->value = NULL;
 	attrib->value_len = 0;
 
+	attribute_hash_changed(attrib);
+
 	return true;
 }
 
 void *gatt_db_attribute_get_user_data(struct gatt_db_attribute *attrib)
 {
-	if (!attrib)
+	if (!attrib || !attrib->ext)
 		return NULL;
 
-	return attrib->user_data;
+	return attrib->ext->user_data;
 }
 
 static bool match_attribute_notify_id(const void *a, const void *b)
@@ -2251,22 +2820,28 @@ unsigned int gatt_db_attribute_register(struct gatt_db_attribute *attrib,
 					void *user_data,
 					gatt_db_destroy_func_t destroy)
 {
+	struct attribute_ext *ext;
 	struct attribute_notify *notify;
 
 	if (!attrib || !removed)
 		return 0;
 
+	ext = attribute_ext(attrib);
+
 	notify = new0(struct attribute_notify, 1);
 	notify->removed = removed;
 	notify->destroy = destroy;
 	notify->user_data = user_data;
 
-	if (attrib->next_notify_id < 1)
-		attrib->next_notify_id = 1;
+	if (ext->next_notify_id < 1)
+		ext->next_notify_id = 1;
+
+	notify->id = ext->next_notify_id++;
 
-	notify->id = attrib->next_notify_id++;
+	if (!ext->notify_list)
+		ext->notify_list = queue_new();
 
-	if (!queue_push_tail(attrib->notify_list, notify)) {
+	if (!queue_push_tail(ext->notify_list, notify)) {
 		free(notify);
 		return 0;
 	}
@@ -2279,15 +2854,15 @@ bool gatt_db_attribute_unregister(struct gatt_db_attribute *attrib,
 {
 	struct attribute_notify *notify;
 
-	if (!attrib || !id)
+	if (!attrib || !attrib->ext || !id)
 		return false;
 
-	notify = queue_find(attrib->notify_list, match_attribute_notify_id,
-						UINT_TO_PTR(id));
+	notify = queue_find(attrib->ext->notify_list,
+				match_attribute_notify_id, UINT_TO_PTR(id));
 	if (!notify)
 		return false;
 
-	queue_remove(attrib->notify_list, notify);
+	queue_remove(attrib->ext->notify_list, notify);
 	attribute_notify_destroy(notify);
 
 	return true;
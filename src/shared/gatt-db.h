@@ -18,6 +18,15 @@ void gatt_db_unref(struct gatt_db *db);
 
 bool gatt_db_isempty(struct gatt_db *db);
 
+struct gatt_db_usage {
+	unsigned int services;
+	unsigned int attributes;
+	size_t bytes;		/* Memory only used by this database */
+	size_t shared_bytes;	/* Values and types referenced more than once */
+};
+
+bool gatt_db_get_usage(struct gatt_db *db, struct gatt_db_usage *usage);
+
 struct gatt_db_attribute *gatt_db_add_service(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						bool primary,
@@ -37,6 +46,11 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 							bool primary,
 							uint16_t num_handles);
 
+struct gatt_db_attribute *gatt_db_move_service(struct gatt_db *db,
+					struct gatt_db_attribute *attrib);
+bool gatt_db_service_equal(const struct gatt_db_attribute *a,
+					const struct gatt_db_attribute *b);
+
 typedef void (*gatt_db_read_t) (struct gatt_db_attribute *attrib,
 					unsigned int id, uint16_t offset,
 					uint8_t opcode, struct bt_att *att,
@@ -38,6 +38,8 @@
  * perhaps an API to set this value if there is a use case for it.
  */
 #define DEFAULT_MAX_PREP_QUEUE_LEN 30
+#define DEFAULT_MAX_PREP_QUEUE_SIZE (DEFAULT_MAX_PREP_QUEUE_LEN * \
+							BT_ATT_MAX_VALUE_LEN)
 
 #define NFY_MULT_TIMEOUT 10
 
@@ -63,7 +65,7 @@ struct async_write_op {
 
 struct prep_write_data {
 	struct bt_gatt_server *server;
-	uint8_t *value;
+	size_t pos;		/* Position of the value in prep_buf */
 	uint16_t handle;
 	uint16_t offset;
 	uint16_t length;
@@ -73,10 +75,7 @@ struct prep_write_data {
 
 static void prep_write_data_destroy(void *user_data)
 {
-	struct prep_write_data *data = user_data;
-
-	free(data->value);
-	free(data);
+	free(user_data);
 }
 
 struct nfy_mult_data {
@@ -111,6 +110,15 @@ struct bt_gatt_server {
 	struct queue *prep_queue;
 	unsigned int max_prep_queue_len;
 
+	/*
+	 * The values of the queued writes are stored back to back in a
+	 * single buffer, which is reused until the server is freed.
+	 */
+	uint8_t *prep_buf;
+	size_t prep_buf_len;
+	size_t prep_buf_size;
+	size_t max_prep_queue_size;
+
 	bt_gatt_server_debug_func_t debug_callback;
 	bt_gatt_server_destroy_func_t debug_destroy;
 	void *debug_data;
@@ -141,6 +149,7 @@ static void bt_gatt_server_free(struct bt_gatt_server *server)
 	bt_att_unregister(server->att, server->exec_write_id);
 
 	queue_destroy(server->prep_queue, prep_write_data_destroy);
+	free(server->prep_buf);
 
 	gatt_db_unref(server->db);
 	bt_att_unref(server->att);
@@ -1158,25 +1167,54 @@ error:
 	bt_att_chan_send_error_rsp(chan, opcode, handle, ecode);
 }
 
+static void clear_prep_queue(struct bt_gatt_server *server)
+{
+	queue_remove_all(server->prep_queue, NULL, NULL,
+						prep_write_data_destroy);
+	server->prep_buf_len = 0;
+}
+
+static bool append_prep_buf(struct bt_gatt_server *server, uint16_t length,
+							const uint8_t *value)
+{
+	size_t len = server->prep_buf_len + length;
+	size_t size;
+	uint8_t *buf;
+
+	if (len > server->max_prep_queue_size)
+		return false;
+
+	if (len > server->prep_buf_size) {
+		size = MAX(server->prep_buf_size, BT_ATT_MAX_VALUE_LEN);
+		while (size < len)
+			size *= 2;
+
+		size = MIN(size, server->max_prep_queue_size);
+
+		buf = realloc(server->prep_buf, size);
+		if (!buf)
+			return false;
+
+		server->prep_buf = buf;
+		server->prep_buf_size = size;
+	}
+
+	memcpy(server->prep_buf + server->prep_buf_len, value, length);
+	server->prep_buf_len = len;
+
+	return true;
+}
+
 static bool append_prep_data(struct prep_write_data *prep_data, uint16_t handle,
 					uint16_t length, uint8_t *value)
 {
-	uint8_t *val;
-	uint16_t len;
-
 	if (!length)
 		return true;
 
-	len = prep_data->length + length;
-
-	val = realloc(prep_data->value, len);
-	if (!val)
+	if (!append_prep_buf(prep_data->server, length, value))
 		return false;
 
-	memcpy(val + prep_data->length, value, length);
-
-	prep_data->value = val;
-	prep_data->length = len;
+	prep_data->length += length;
 
 	return true;
 }
@@ -1205,13 +1243,14 @@ static bool prep_data_new(struct bt_gatt_server *server,
 	struct prep_write_data *prep_data;
 
 	prep_data = new0(struct prep_write_data, 1);
+	prep_data->server = server;
+	prep_data->pos = server->prep_buf_len;
 
 	if (!append_prep_data(prep_data, handle, length, value)) {
 		prep_write_data_destroy(prep_data);
 		return false;
 	}
 
-	prep_data->server = server;
 	prep_data->handle = handle;
 	prep_data->offset = offset;
 
@@ -1235,7 +1274,8 @@ static bool store_prep_data(struct bt_gatt_server *server,
 
 	/*
 	 * Now lets check if prep write is a continuation of long write
-	 * If so do aggregation of data
+	 * If so do aggregation of data, the tail entry always ends at the
+	 * end of prep_buf so the value stays contiguous.
 	 */
 	prep_data = queue_peek_tail(server->prep_queue);
 	if (prep_data && (prep_data->handle == handle) &&
@@ -1273,10 +1313,15 @@ static void prep_write_complete_cb(struct gatt_db_attribute *attr, int err,
 	offset = get_le16(pwcd->pdu + 2);
 
 	if (!store_prep_data(pwcd->server, handle, offset, pwcd->length - 4,
-						&((uint8_t *) pwcd->pdu)[4]))
-		bt_att_chan_send_error_rsp(pwcd->chan, BT_ATT_OP_PREP_WRITE_RSP,
+						&((uint8_t *) pwcd->pdu)[4])) {
+		bt_att_chan_send_error_rsp(pwcd->chan, BT_ATT_OP_PREP_WRITE_REQ,
 					handle,
-					BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+					BT_ATT_ERROR_PREPARE_QUEUE_FULL);
+		free(pwcd->pdu);
+		free(pwcd);
+
+		return;
+	}
 
 	bt_att_chan_send_rsp(pwcd->chan, BT_ATT_OP_PREP_WRITE_RSP, pwcd->pdu,
 								pwcd->length);
@@ -1301,7 +1346,9 @@ static void prep_write_cb(struct bt_att_chan *chan, uint8_t opcode,
 		goto error;
 	}
 
-	if (queue_length(server->prep_queue) >= server->max_prep_queue_len) {
+	if (queue_length(server->prep_queue) >= server->max_prep_queue_len ||
+			server->prep_buf_len + length - 4 >
+					server->max_prep_queue_size) {
 		ecode = BT_ATT_ERROR_PREPARE_QUEUE_FULL;
 		goto error;
 	}
@@ -1375,6 +1422,7 @@ static void exec_next_prep_write(struct exec_data *data, uint16_t ehandle,
 
 	next = queue_pop_head(data->server->prep_queue);
 	if (!next) {
+		data->server->prep_buf_len = 0;
 		bt_att_chan_send_rsp(data->chan, BT_ATT_OP_EXEC_WRITE_RSP,
 								NULL, 0);
 		free(data);
@@ -1388,7 +1436,8 @@ static void exec_next_prep_write(struct exec_data *data, uint16_t ehandle,
 	}
 
 	status = gatt_db_attribute_write(attr, next->offset,
-						next->value, next->length,
+					data->server->prep_buf + next->pos,
+					next->length,
 						BT_ATT_OP_EXEC_WRITE_REQ,
 						data->server->att,
 						exec_write_complete_cb, data);
@@ -1401,8 +1450,7 @@ static void exec_next_prep_write(struct exec_data *data, uint16_t ehandle,
 	err = BT_ATT_ERROR_UNLIKELY;
 
 error:
-	queue_remove_all(data->server->prep_queue, NULL, NULL,
-						prep_write_data_destroy);
+	clear_prep_queue(data->server);
 
 	bt_att_chan_send_error_rsp(data->chan, BT_ATT_OP_EXEC_WRITE_REQ,
 								ehandle, err);
@@ -1447,8 +1495,7 @@ static void exec_write_cb(struct bt_att_chan *chan, uint8_t opcode,
 	}
 
 	if (!write) {
-		queue_remove_all(server->prep_queue, NULL, NULL,
-						prep_write_data_destroy);
+		clear_prep_queue(server);
 		bt_att_chan_send_rsp(chan, BT_ATT_OP_EXEC_WRITE_RSP, NULL, 0);
 		return;
 	}
@@ -1475,8 +1522,7 @@ static void exec_write_cb(struct bt_att_chan *chan, uint8_t opcode,
 	return;
 
 error:
-	queue_remove_all(server->prep_queue, NULL, NULL,
-						prep_write_data_destroy);
+	clear_prep_queue(server);
 	bt_att_chan_send_error_rsp(chan, opcode, ehandle, ecode);
 }
 
@@ -1629,6 +1675,7 @@ struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
 	server->att = bt_att_ref(att);
 	server->mtu = MAX(mtu, BT_ATT_DEFAULT_LE_MTU);
 	server->max_prep_queue_len = DEFAULT_MAX_PREP_QUEUE_LEN;
+	server->max_prep_queue_size = DEFAULT_MAX_PREP_QUEUE_SIZE;
 	server->prep_queue = queue_new();
 	server->min_enc_size = min_enc_size;
 
@@ -1695,6 +1742,28 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 	return true;
 }
 
+bool bt_gatt_server_set_max_prep_queue_size(struct bt_gatt_server *server,
+								size_t size)
+{
+	/* A single long write of the largest value must always fit */
+	if (!server || size < BT_ATT_MAX_VALUE_LEN)
+		return false;
+
+	/* Only change the limit when there is nothing queued */
+	if (!queue_isempty(server->prep_queue))
+		return false;
+
+	server->max_prep_queue_size = size;
+
+	if (server->prep_buf_size > size) {
+		free(server->prep_buf);
+		server->prep_buf = NULL;
+		server->prep_buf_size = 0;
+	}
+
+	return true;
+}
+
 static bool notify_multiple(void *user_data)
 {
 	struct bt_gatt_server *server = user_data;
@@ -1791,6 +1860,22 @@ error:
 	return false;
 }
 
+bool bt_gatt_server_send_notification_pdu(struct bt_gatt_server *server,
+						struct bt_att_pdu *pdu)
+{
+	if (!server || !pdu)
+		return false;
+
+	/* Don't let the notification overtake any buffered ones */
+	if (server->nfy_mult && server->nfy_mult->offset > 0) {
+		if (server->nfy_mult->id)
+			timeout_remove(server->nfy_mult->id);
+		notify_multiple(server);
+	}
+
+	return !!bt_att_send_pdu(server->att, pdu, NULL, NULL, NULL);
+}
+
 struct ind_data {
 	bt_gatt_server_conf_func_t callback;
 	bt_gatt_server_destroy_func_t destroy;
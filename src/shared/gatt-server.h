@@ -37,9 +37,14 @@ bool bt_gatt_server_set_authorize(struct bt_gatt_server *server,
 					bt_gatt_server_authorize_cb_t cb,
 					void *user_data);
 
+bool bt_gatt_server_set_max_prep_queue_size(struct bt_gatt_server *server,
+								size_t size);
+
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length, bool multiple);
+bool bt_gatt_server_send_notification_pdu(struct bt_gatt_server *server,
+						struct bt_att_pdu *pdu);
 
 bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
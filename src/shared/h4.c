@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "monitor/bt.h"
+#include "src/shared/util.h"
+#include "src/shared/h4.h"
+
+/*
+ * Packets are handed out in place from one large receive buffer. Only the
+ * partial packet left at the end of a read is moved back to the front, and
+ * only right before the next read.
+ */
+struct h4 {
+	uint8_t *buf;
+	size_t size;
+	size_t start;
+	size_t end;
+};
+
+struct h4 *h4_new(size_t size)
+{
+	struct h4 *h4;
+
+	if (size < 1 + sizeof(struct bt_hci_acl_hdr))
+		return NULL;
+
+	h4 = new0(struct h4, 1);
+	h4->buf = malloc(size);
+	if (!h4->buf) {
+		free(h4);
+		return NULL;
+	}
+
+	h4->size = size;
+
+	return h4;
+}
+
+void h4_free(struct h4 *h4)
+{
+	if (!h4)
+		return;
+
+	free(h4->buf);
+	free(h4);
+}
+
+/*
+ * Returns the length of the packet at data including the packet type, 0 if
+ * more data is needed to tell or -EBADMSG for an unknown packet type.
+ */
+ssize_t h4_packet_len(const void *data, size_t len)
+{
+	const uint8_t *pkt = data;
+
+	if (len < 1)
+		return 0;
+
+	switch (pkt[0]) {
+	case BT_H4_CMD_PKT:
+		if (len < 1 + sizeof(struct bt_hci_cmd_hdr))
+			return 0;
+
+		return 1 + sizeof(struct bt_hci_cmd_hdr) + pkt[3];
+	case BT_H4_ACL_PKT:
+		if (len < 1 + sizeof(struct bt_hci_acl_hdr))
+			return 0;
+
+		return 1 + sizeof(struct bt_hci_acl_hdr) + get_le16(pkt + 3);
+	case BT_H4_SCO_PKT:
+		if (len < 1 + sizeof(struct bt_hci_sco_hdr))
+			return 0;
+
+		return 1 + sizeof(struct bt_hci_sco_hdr) + pkt[3];
+	case BT_H4_EVT_PKT:
+		if (len < 1 + sizeof(struct bt_hci_evt_hdr))
+			return 0;
+
+		return 1 + sizeof(struct bt_hci_evt_hdr) + pkt[2];
+	case BT_H4_ISO_PKT:
+		if (len < 1 + sizeof(struct bt_hci_iso_hdr))
+			return 0;
+
+		/* Upper two bits of the length are reserved */
+		return 1 + sizeof(struct bt_hci_iso_hdr) +
+					(get_le16(pkt + 3) & 0x3fff);
+	}
+
+	return -EBADMSG;
+}
+
+ssize_t h4_read(struct h4 *h4, int fd)
+{
+	ssize_t len;
+
+	if (!h4 || fd < 0)
+		return -EINVAL;
+
+	if (h4->start == h4->end) {
+		h4->start = 0;
+		h4->end = 0;
+	} else if (h4->start) {
+		memmove(h4->buf, h4->buf + h4->start, h4->end - h4->start);
+		h4->end -= h4->start;
+		h4->start = 0;
+	}
+
+	/* A packet larger than the buffer can never be completed */
+	if (h4->end == h4->size)
+		return -ENOBUFS;
+
+	len = read(fd, h4->buf + h4->end, h4->size - h4->end);
+	if (len < 0)
+		return -errno;
+
+	h4->end += len;
+
+	return len;
+}
+
+void *h4_peek(struct h4 *h4, size_t *len)
+{
+	if (!h4)
+		return NULL;
+
+	if (len)
+		*len = h4->end - h4->start;
+
+	return h4->buf + h4->start;
+}
+
+void h4_drain(struct h4 *h4, size_t len)
+{
+	if (!h4)
+		return;
+
+	h4->start += MIN(len, h4->end - h4->start);
+}
+
+/*
+ * Calls func for every complete packet received so far. Processing stops
+ * without touching h4 again once func returns false, so func may free it.
+ * Returns the number of packets processed or -EBADMSG if the pending data
+ * starts with an unknown packet type, which is left for the caller to
+ * inspect or drain.
+ */
+int h4_process(struct h4 *h4, h4_packet_func_t func, void *user_data)
+{
+	int count = 0;
+
+	if (!h4 || !func)
+		return -EINVAL;
+
+	while (h4->start < h4->end) {
+		uint8_t *data = h4->buf + h4->start;
+		ssize_t len;
+
+		len = h4_packet_len(data, h4->end - h4->start);
+		if (len < 0)
+			return len;
+
+		if (!len || (size_t) len > h4->end - h4->start)
+			break;
+
+		h4->start += len;
+		count++;
+
+		if (!func(data, len, user_data))
+			break;
+	}
+
+	return count;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Large enough for a maximum sized ACL or ISO packet */
+#define H4_MAX_PACKET_SIZE	(1 + 4 + 65535)
+
+typedef bool (*h4_packet_func_t)(void *data, uint16_t size,
+							void *user_data);
+
+struct h4;
+
+struct h4 *h4_new(size_t size);
+void h4_free(struct h4 *h4);
+
+ssize_t h4_packet_len(const void *data, size_t len);
+
+ssize_t h4_read(struct h4 *h4, int fd);
+void *h4_peek(struct h4 *h4, size_t *len);
+void h4_drain(struct h4 *h4, size_t len);
+int h4_process(struct h4 *h4, h4_packet_func_t func, void *user_data);
@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/hashmap.h"
+
+/*
+ * Open addressing hash map from integer keys, such as ids and handles, to
+ * non-NULL values. Collisions are resolved by linear probing and removal
+ * shifts the following entries back, so lookups never have to skip over
+ * deleted slots.
+ */
+
+#define MIN_BITS 3
+
+struct hashmap_slot {
+	unsigned int key;
+	void *value;
+};
+
+struct hashmap {
+	struct hashmap_slot *slots;
+	unsigned int mask;
+	unsigned int bits;
+	unsigned int entries;
+};
+
+static inline unsigned int hash_key(const struct hashmap *map,
+							unsigned int key)
+{
+	/* Fibonacci hashing, taking the well mixed upper bits */
+	return ((uint32_t) (key * 2654435769u)) >> (32 - map->bits);
+}
+
+struct hashmap *hashmap_new(void)
+{
+	return new0(struct hashmap, 1);
+}
+
+void hashmap_clear(struct hashmap *map, hashmap_destroy_func_t destroy)
+{
+	struct hashmap_slot *slots;
+	unsigned int i, size;
+
+	if (!map || !map->slots)
+		return;
+
+	/*
+	 * Detach the table first so destroy callbacks looking up or removing
+	 * other keys see an empty map.
+	 */
+	slots = map->slots;
+	size = map->mask + 1;
+
+	map->slots = NULL;
+	map->mask = 0;
+	map->bits = 0;
+	map->entries = 0;
+
+	for (i = 0; i < size; i++) {
+		if (slots[i].value && destroy)
+			destroy(slots[i].value);
+	}
+
+	free(slots);
+}
+
+void hashmap_destroy(struct hashmap *map, hashmap_destroy_func_t destroy)
+{
+	if (!map)
+		return;
+
+	hashmap_clear(map, destroy);
+	free(map);
+}
+
+static struct hashmap_slot *find_slot(const struct hashmap *map,
+							unsigned int key)
+{
+	unsigned int i;
+
+	if (!map->slots)
+		return NULL;
+
+	for (i = hash_key(map, key); map->slots[i].value;
+						i = (i + 1) & map->mask) {
+		if (map->slots[i].key == key)
+			return &map->slots[i];
+	}
+
+	return NULL;
+}
+
+static void insert_slot(struct hashmap *map, unsigned int key, void *value)
+{
+	unsigned int i;
+
+	for (i = hash_key(map, key); map->slots[i].value;
+						i = (i + 1) & map->mask)
+		;
+
+	map->slots[i].key = key;
+	map->slots[i].value = value;
+}
+
+static void resize(struct hashmap *map, unsigned int bits)
+{
+	unsigned int size = 1 << bits;
+	struct hashmap_slot *old = map->slots;
+	unsigned int old_size = old ? map->mask + 1 : 0;
+	unsigned int i;
+
+	map->slots = new0(struct hashmap_slot, size);
+	map->mask = size - 1;
+	map->bits = bits;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].value)
+			insert_slot(map, old[i].key, old[i].value);
+	}
+
+	free(old);
+}
+
+bool hashmap_insert(struct hashmap *map, unsigned int key, void *value)
+{
+	if (!map || !value)
+		return false;
+
+	if (find_slot(map, key))
+		return false;
+
+	/* Keep the load factor at or below 3/4 */
+	if (!map->slots)
+		resize(map, MIN_BITS);
+	else if ((map->entries + 1) * 4 > (map->mask + 1) * 3)
+		resize(map, map->bits + 1);
+
+	insert_slot(map, key, value);
+	map->entries++;
+
+	return true;
+}
+
+void *hashmap_lookup(struct hashmap *map, unsigned int key)
+{
+	struct hashmap_slot *slot;
+
+	if (!map)
+		return NULL;
+
+	slot = find_slot(map, key);
+
+	return slot ? slot->value : NULL;
+}
+
+void *hashmap_remove(struct hashmap *map, unsigned int key)
+{
+	struct hashmap_slot *slot;
+	unsigned int i, j;
+	void *value;
+
+	if (!map)
+		return NULL;
+
+	slot = find_slot(map, key);
+	if (!slot)
+		return NULL;
+
+	value = slot->value;
+	i = slot - map->slots;
+
+	/*
+	 * Move back any entry of the following run that would no longer be
+	 * reachable from its home slot once this one is emptied.
+	 */
+	for (j = (i + 1) & map->mask; map->slots[j].value;
+						j = (j + 1) & map->mask) {
+		unsigned int home = hash_key(map, map->slots[j].key);
+
+		if (((j - home) & map->mask) < ((j - i) & map->mask))
+			continue;
+
+		map->slots[i] = map->slots[j];
+		i = j;
+	}
+
+	map->slots[i].key = 0;
+	map->slots[i].value = NULL;
+	map->entries--;
+
+	return value;
+}
+
+/* The map must not be modified from within the callback */
+void hashmap_foreach(struct hashmap *map, hashmap_foreach_func_t function,
+							void *user_data)
+{
+	unsigned int i;
+
+	if (!map || !function || !map->slots)
+		return;
+
+	for (i = 0; i <= map->mask; i++) {
+		if (map->slots[i].value)
+			function(map->slots[i].key, map->slots[i].value,
+								user_data);
+	}
+}
+
+unsigned int hashmap_size(struct hashmap *map)
+{
+	if (!map)
+		return 0;
+
+	return map->entries;
+}
+
+bool hashmap_isempty(struct hashmap *map)
+{
+	if (!map)
+		return true;
+
+	return map->entries == 0;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+
+typedef void (*hashmap_destroy_func_t)(void *value);
+typedef void (*hashmap_foreach_func_t)(unsigned int key, void *value,
+							void *user_data);
+
+struct hashmap;
+
+struct hashmap *hashmap_new(void);
+void hashmap_destroy(struct hashmap *map, hashmap_destroy_func_t destroy);
+void hashmap_clear(struct hashmap *map, hashmap_destroy_func_t destroy);
+
+bool hashmap_insert(struct hashmap *map, unsigned int key, void *value);
+void *hashmap_lookup(struct hashmap *map, unsigned int key);
+void *hashmap_remove(struct hashmap *map, unsigned int key);
+
+void hashmap_foreach(struct hashmap *map, hashmap_foreach_func_t function,
+							void *user_data);
+
+unsigned int hashmap_size(struct hashmap *map);
+bool hashmap_isempty(struct hashmap *map);
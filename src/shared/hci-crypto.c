@@ -16,23 +16,77 @@
 
 #include "monitor/bt.h"
 #include "src/shared/util.h"
+#include "src/shared/aes.h"
 #include "src/shared/hci.h"
 #include "src/shared/hci-crypto.h"
 
 struct crypto_data {
 	uint8_t size;
+	uint8_t key[16];
+	uint8_t plaintext[16];
 	bt_hci_crypto_func_t callback;
 	void *user_data;
 };
 
+struct crypto_batch {
+	int ref_count;
+	size_t num;
+	size_t done;
+	bool failed;
+	bool cancelled;
+	uint8_t *result;
+	bt_hci_crypto_batch_func_t callback;
+	void *user_data;
+};
+
+struct batch_entry {
+	struct crypto_batch *batch;
+	uint8_t key[16];
+	uint8_t plaintext[16];
+	size_t index;
+};
+
+static bool local_aes;
+
+static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		dst[len - 1 - i] = src[i];
+}
+
+/* Same byte order as the LE Encrypt command, least significant first */
+static void local_encrypt(const uint8_t key[16], const uint8_t plaintext[16],
+							uint8_t encrypted[16])
+{
+	struct bt_aes aes;
+	uint8_t tmp[16], in[16], out[16];
+
+	swap_buf(key, tmp, 16);
+	bt_aes_set_key(&aes, tmp);
+
+	swap_buf(plaintext, in, 16);
+	bt_aes_encrypt(&aes, in, out);
+	swap_buf(out, encrypted, 16);
+}
+
+void bt_hci_crypto_set_local(bool enable)
+{
+	local_aes = enable;
+}
+
 static void le_encrypt_callback(const void *response, uint8_t size,
 							void *user_data)
 {
 	struct crypto_data *data = user_data;
 	const struct bt_hci_rsp_le_encrypt *rsp = response;
+	uint8_t encrypted[16];
 
+	/* The result doesn't depend on who computes it */
 	if (rsp->status) {
-		data->callback(NULL, 0, data->user_data);
+		local_encrypt(data->key, data->plaintext, encrypted);
+		data->callback(encrypted, data->size, data->user_data);
 		return;
 	}
 
@@ -45,15 +99,25 @@ static bool le_encrypt(struct bt_hci *hci, uint8_t size,
 {
 	struct crypto_data *data;
 	struct bt_hci_cmd_le_encrypt cmd;
+	uint8_t encrypted[16];
 
 	if (!callback || !size || size > 16)
 		return false;
 
+	/* A controller round trip costs more than the computation itself */
+	if (local_aes) {
+		local_encrypt(key, plaintext, encrypted);
+		callback(encrypted, size, user_data);
+		return true;
+	}
+
 	memcpy(cmd.key, key, 16);
 	memcpy(cmd.plaintext, plaintext, 16);
 
 	data = new0(struct crypto_data, 1);
 	data->size = size;
+	memcpy(data->key, key, 16);
+	memcpy(data->plaintext, plaintext, 16);
 	data->callback = callback;
 	data->user_data = user_data;
 
@@ -66,6 +130,120 @@ static bool le_encrypt(struct bt_hci *hci, uint8_t size,
 	return true;
 }
 
+static void batch_unref(struct crypto_batch *batch)
+{
+	if (--batch->ref_count)
+		return;
+
+	free(batch->result);
+	free(batch);
+}
+
+static void batch_entry_free(void *user_data)
+{
+	struct batch_entry *entry = user_data;
+
+	batch_unref(entry->batch);
+	free(entry);
+}
+
+static void batch_complete(struct crypto_batch *batch)
+{
+	if (++batch->done < batch->num || batch->cancelled)
+		return;
+
+	if (batch->failed)
+		batch->callback(NULL, 0, batch->user_data);
+	else
+		batch->callback((const void *) batch->result, batch->num,
+							batch->user_data);
+}
+
+static void batch_callback(const void *response, uint8_t size,
+							void *user_data)
+{
+	struct batch_entry *entry = user_data;
+	struct crypto_batch *batch = entry->batch;
+	const struct bt_hci_rsp_le_encrypt *rsp = response;
+
+	if (size < sizeof(*rsp))
+		batch->failed = true;
+	else if (rsp->status)
+		local_encrypt(entry->key, entry->plaintext,
+					batch->result + entry->index * 16);
+	else
+		memcpy(batch->result + entry->index * 16, rsp->data, 16);
+
+	batch_complete(batch);
+}
+
+/*
+ * Independent blocks are all queued at once so that bt_hci can send as
+ * many of them as the controller has command credits for, instead of
+ * waiting for each result before asking for the next one.
+ */
+bool bt_hci_crypto_e_batch(struct bt_hci *hci, const uint8_t (*key)[16],
+				const uint8_t (*plaintext)[16], size_t num,
+				bt_hci_crypto_batch_func_t callback,
+				void *user_data)
+{
+	struct crypto_batch *batch;
+	size_t i;
+
+	if (!callback || !num)
+		return false;
+
+	batch = new0(struct crypto_batch, 1);
+	batch->result = new0(uint8_t, num * 16);
+	batch->num = num;
+	batch->callback = callback;
+	batch->user_data = user_data;
+	batch->ref_count = 1;
+
+	if (local_aes) {
+		for (i = 0; i < num; i++)
+			local_encrypt(key[i], plaintext[i],
+						batch->result + i * 16);
+
+		callback((const void *) batch->result, num, user_data);
+		batch_unref(batch);
+		return true;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct bt_hci_cmd_le_encrypt cmd;
+		struct batch_entry *entry;
+
+		memcpy(cmd.key, key[i], 16);
+		memcpy(cmd.plaintext, plaintext[i], 16);
+
+		entry = new0(struct batch_entry, 1);
+		entry->batch = batch;
+		memcpy(entry->key, key[i], 16);
+		memcpy(entry->plaintext, plaintext[i], 16);
+		entry->index = i;
+
+		/*
+		 * Commands already sent can't be taken back without
+		 * confusing the matching of the responses, so those just
+		 * complete without calling back.
+		 */
+		if (!bt_hci_send(hci, BT_HCI_CMD_LE_ENCRYPT, &cmd, sizeof(cmd),
+				batch_callback, entry, batch_entry_free)) {
+			free(entry);
+			batch->cancelled = true;
+			batch_unref(batch);
+			return false;
+		}
+
+		batch->ref_count++;
+	}
+
+	batch_unref(batch);
+
+	return true;
+}
+
 static void prand_callback(const void *response, uint8_t size,
 							void *user_data)
 {
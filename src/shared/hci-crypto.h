@@ -10,17 +10,26 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 struct bt_hci;
 
 typedef void (*bt_hci_crypto_func_t)(const void *data, uint8_t size,
 							void *user_data);
+typedef void (*bt_hci_crypto_batch_func_t)(const uint8_t (*data)[16],
+						size_t num, void *user_data);
+
+void bt_hci_crypto_set_local(bool enable);
 
 bool bt_hci_crypto_prand(struct bt_hci *hci,
 			bt_hci_crypto_func_t callback, void *user_data);
 bool bt_hci_crypto_e(struct bt_hci *hci,
 			const uint8_t key[16], const uint8_t plaintext[16],
 			bt_hci_crypto_func_t callback, void *user_data);
+bool bt_hci_crypto_e_batch(struct bt_hci *hci, const uint8_t (*key)[16],
+				const uint8_t (*plaintext)[16], size_t num,
+				bt_hci_crypto_batch_func_t callback,
+				void *user_data);
 bool bt_hci_crypto_d1(struct bt_hci *hci,
 			const uint8_t k[16], uint16_t d, uint16_t r,
 			bt_hci_crypto_func_t callback, void *user_data);
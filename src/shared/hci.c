@@ -13,6 +13,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -94,16 +95,17 @@ static void evt_free(void *data)
 	free(evt);
 }
 
-static void send_command(struct bt_hci *hci, uint16_t opcode,
+static int send_command(struct bt_hci *hci, uint16_t opcode,
 						void *data, uint8_t size)
 {
 	uint8_t type = BT_H4_CMD_PKT;
 	struct bt_hci_cmd_hdr hdr;
 	struct iovec iov[3];
 	int iovcnt;
+	int err;
 
 	if (hci->num_cmds < 1)
-		return;
+		return -EBUSY;
 
 	hdr.opcode = cpu_to_le16(opcode);
 	hdr.plen = size;
@@ -120,20 +122,42 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 	} else
 		iovcnt = 2;
 
-	if (io_send(hci->io, iov, iovcnt) < 0)
-		return;
+	err = io_send(hci->io, iov, iovcnt);
+	if (err < 0)
+		return err;
 
 	hci->num_cmds--;
+
+	return 0;
 }
 
 static bool io_write_callback(struct io *io, void *user_data)
 {
 	struct bt_hci *hci = user_data;
 	struct cmd *cmd;
+	int err;
+
+	/*
+	 * Send as many commands as the controller has announced buffers
+	 * for with Num_HCI_Command_Packets, and not just one per response.
+	 */
+	while ((cmd = queue_peek_head(hci->cmd_queue))) {
+		err = send_command(hci, cmd->opcode, cmd->data, cmd->size);
+		if (err == -EAGAIN)
+			return true;
+
+		/* Out of credits, wait for the next Command Complete/Status */
+		if (err == -EBUSY)
+			break;
+
+		queue_pop_head(hci->cmd_queue);
+
+		/* A command that cannot be sent is not going to get a reply */
+		if (err < 0) {
+			cmd_free(cmd);
+			continue;
+		}
 
-	cmd = queue_pop_head(hci->cmd_queue);
-	if (cmd) {
-		send_command(hci, cmd->opcode, cmd->data, cmd->size);
 		queue_push_tail(hci->rsp_queue, cmd);
 	}
 
@@ -437,6 +461,14 @@ bool bt_hci_set_close_on_unref(struct bt_hci *hci, bool do_close)
 	return io_set_close_on_destroy(hci->io, do_close);
 }
 
+int bt_hci_get_fd(struct bt_hci *hci)
+{
+	if (!hci)
+		return -1;
+
+	return io_get_fd(hci->io);
+}
+
 unsigned int bt_hci_send(struct bt_hci *hci, uint16_t opcode,
 				const void *data, uint8_t size,
 				bt_hci_callback_func_t callback,
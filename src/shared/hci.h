@@ -23,6 +23,7 @@ struct bt_hci *bt_hci_ref(struct bt_hci *hci);
 void bt_hci_unref(struct bt_hci *hci);
 
 bool bt_hci_set_close_on_unref(struct bt_hci *hci, bool do_close);
+int bt_hci_get_fd(struct bt_hci *hci);
 
 typedef void (*bt_hci_callback_func_t)(const void *data, uint8_t size,
 							void *user_data);
@@ -32,7 +32,7 @@ struct hfp_gw {
 	struct io *io;
 	struct ringbuf *read_buf;
 	struct ringbuf *write_buf;
-	struct queue *cmd_handlers;
+	struct cmd_node *cmd_trie;
 	bool writer_active;
 	bool result_pending;
 	hfp_command_func_t command_callback;
@@ -82,6 +82,17 @@ struct cmd_handler {
 	hfp_result_func_t callback;
 };
 
+/*
+ * Command handlers are kept in a trie indexed by the upper case prefix so
+ * a received command is matched while its prefix is being scanned.
+ */
+struct cmd_node {
+	char c;
+	struct cmd_node *next;
+	struct cmd_node *child;
+	struct cmd_handler *handler;
+};
+
 struct hfp_context {
 	const char *data;
 	unsigned int offset;
@@ -113,15 +124,53 @@ static void destroy_cmd_handler(void *data)
 	free(handler);
 }
 
-static bool match_handler_prefix(const void *a, const void *b)
+static struct cmd_node *cmd_node_find(struct cmd_node *node, char c)
 {
-	const struct cmd_handler *handler = a;
-	const char *prefix = b;
+	for (; node; node = node->next) {
+		if (node->c == c)
+			return node;
+	}
 
-	if (strcmp(handler->prefix, prefix) != 0)
-		return false;
+	return NULL;
+}
 
-	return true;
+static struct cmd_node *cmd_trie_lookup(struct cmd_node **trie,
+					const char *prefix, bool create)
+{
+	struct cmd_node **list = trie;
+	struct cmd_node *node = NULL;
+
+	for (; *prefix; prefix++) {
+		node = cmd_node_find(*list, *prefix);
+		if (!node) {
+			if (!create)
+				return NULL;
+
+			node = new0(struct cmd_node, 1);
+			node->c = *prefix;
+			node->next = *list;
+			*list = node;
+		}
+
+		list = &node->child;
+	}
+
+	return node;
+}
+
+static void cmd_trie_free(struct cmd_node *node)
+{
+	while (node) {
+		struct cmd_node *next = node->next;
+
+		cmd_trie_free(node->child);
+
+		if (node->handler)
+			destroy_cmd_handler(node->handler);
+
+		free(node);
+		node = next;
+	}
 }
 
 static void write_watch_destroy(void *user_data)
@@ -180,12 +229,12 @@ static void handle_unknown_at_command(struct hfp_gw *hfp,
 
 static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 {
-	struct cmd_handler *handler;
+	struct cmd_handler *handler = NULL;
+	struct cmd_node *node = hfp->cmd_trie;
 	const char *separators = ";?=\0";
 	struct hfp_context context;
 	enum hfp_gw_cmd_type type;
-	char lookup_prefix[18];
-	uint8_t pref_len = 0;
+	uint8_t pref_len;
 	const char *prefix;
 	int i;
 
@@ -194,7 +243,7 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 
 	skip_whitespace(&context);
 
-	if (strlen(data + context.offset) < 3)
+	if (strnlen(data + context.offset, 3) < 3)
 		return false;
 
 	if (strncmp(data + context.offset, "AT", 2))
@@ -205,20 +254,24 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 	prefix = data + context.offset;
 
 	if (isalpha(prefix[0])) {
-		lookup_prefix[pref_len++] = toupper(prefix[0]);
+		pref_len = 1;
 	} else {
 		pref_len = strcspn(prefix, separators);
 		if (pref_len > 17 || pref_len < 2)
 			return false;
+	}
 
-		for (i = 0; i < pref_len; i++)
-			lookup_prefix[i] = toupper(prefix[i]);
+	for (i = 0; i < pref_len && node; i++) {
+		node = cmd_node_find(node, toupper(prefix[i]));
+		if (node && i == pref_len - 1)
+			handler = node->handler;
+		else if (node)
+			node = node->child;
 	}
 
-	lookup_prefix[pref_len] = '\0';
 	context.offset += pref_len;
 
-	if (lookup_prefix[0] == 'D') {
+	if (toupper(prefix[0]) == 'D') {
 		type = HFP_GW_CMD_TYPE_SET;
 		goto done;
 	}
@@ -243,9 +296,6 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 	type = HFP_GW_CMD_TYPE_COMMAND;
 
 done:
-
-	handler = queue_find(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
 	if (!handler) {
 		handle_unknown_at_command(hfp, data);
 		return true;
@@ -479,7 +529,8 @@ static void process_input(struct hfp_gw *hfp)
 
 			/*
 			 * If there is no more data in ringbuffer,
-			 * it's just an incomplete command.
+			 * it's just an incomplete command. Wrapped data is
+			 * only left if the buffer could not be mirrored.
 			 */
 			if (len == ringbuf_len(hfp->read_buf))
 				return;
@@ -566,7 +617,7 @@ struct hfp_gw *hfp_gw_new(int fd)
 	hfp->fd = fd;
 	hfp->close_on_unref = false;
 
-	hfp->read_buf = ringbuf_new(4096);
+	hfp->read_buf = ringbuf_new_mirrored(4096);
 	if (!hfp->read_buf) {
 		free(hfp);
 		return NULL;
@@ -587,11 +638,8 @@ struct hfp_gw *hfp_gw_new(int fd)
 		return NULL;
 	}
 
-	hfp->cmd_handlers = queue_new();
-
 	if (!io_set_read_handler(hfp->io, can_read_data, hfp,
 							read_watch_destroy)) {
-		queue_destroy(hfp->cmd_handlers, destroy_cmd_handler);
 		io_destroy(hfp->io);
 		ringbuf_free(hfp->write_buf);
 		ringbuf_free(hfp->read_buf);
@@ -643,8 +691,8 @@ void hfp_gw_unref(struct hfp_gw *hfp)
 	ringbuf_free(hfp->write_buf);
 	hfp->write_buf = NULL;
 
-	queue_destroy(hfp->cmd_handlers, destroy_cmd_handler);
-	hfp->cmd_handlers = NULL;
+	cmd_trie_free(hfp->cmd_trie);
+	hfp->cmd_trie = NULL;
 
 	if (!hfp->in_disconnect) {
 		free(hfp);
@@ -820,6 +868,14 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 						hfp_destroy_func_t destroy)
 {
 	struct cmd_handler *handler;
+	struct cmd_node *node;
+
+	if (!prefix || !*prefix)
+		return false;
+
+	node = cmd_trie_lookup(&hfp->cmd_trie, prefix, true);
+	if (node->handler)
+		return false;
 
 	handler = new0(struct cmd_handler, 1);
 	handler->callback = callback;
@@ -831,32 +887,24 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 		return false;
 	}
 
-	if (queue_find(hfp->cmd_handlers, match_handler_prefix,
-							handler->prefix)) {
-		destroy_cmd_handler(handler);
-		return false;
-	}
-
 	handler->destroy = destroy;
+	node->handler = handler;
 
-	return queue_push_tail(hfp->cmd_handlers, handler);
+	return true;
 }
 
 bool hfp_gw_unregister(struct hfp_gw *hfp, const char *prefix)
 {
 	struct cmd_handler *handler;
-	char *lookup_prefix;
+	struct cmd_node *node;
 
-	lookup_prefix = strdup(prefix);
-	if (!lookup_prefix)
+	node = cmd_trie_lookup(&hfp->cmd_trie, prefix, false);
+	if (!node || !node->handler)
 		return false;
 
-	handler = queue_remove_if(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
-	free(lookup_prefix);
-
-	if (!handler)
-		return false;
+	/* Nodes are kept, they are released together with the trie */
+	handler = node->handler;
+	node->handler = NULL;
 
 	destroy_cmd_handler(handler);
 
@@ -1169,7 +1217,7 @@ static void hf_process_input(struct hfp_hf *hfp)
 
 	/*
 	 * Just check if there is no wrapped data in ring buffer.
-	 * Should not happen too often
+	 * Only happens if the buffer could not be mirrored.
 	 */
 	if (len == ringbuf_len(hfp->read_buf))
 		goto done;
@@ -1240,7 +1288,7 @@ struct hfp_hf *hfp_hf_new(int fd)
 	hfp->fd = fd;
 	hfp->close_on_unref = false;
 
-	hfp->read_buf = ringbuf_new(4096);
+	hfp->read_buf = ringbuf_new_mirrored(4096);
 	if (!hfp->read_buf) {
 		free(hfp);
 		return NULL;
@@ -12,7 +12,9 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 
@@ -270,6 +272,49 @@ ssize_t io_send(struct io *io, const struct iovec *iov, int iovcnt)
 	return ret;
 }
 
+/*
+ * Send or receive several messages with one system call, keeping the
+ * message boundaries. Return the number of messages transferred or a
+ * negative error. Receiving never blocks.
+ */
+int io_sendmmsg(struct io *io, struct mmsghdr *msgs, unsigned int count)
+{
+	int ret, fd;
+
+	if (!io || !io->channel)
+		return -ENOTCONN;
+
+	fd = io_get_fd(io);
+
+	do {
+		ret = sendmmsg(fd, msgs, count, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+int io_recvmmsg(struct io *io, struct mmsghdr *msgs, unsigned int count)
+{
+	int ret, fd;
+
+	if (!io || !io->channel)
+		return -ENOTCONN;
+
+	fd = io_get_fd(io);
+
+	do {
+		ret = recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
 bool io_shutdown(struct io *io)
 {
 	if (!io || !io->channel)
@@ -14,6 +14,7 @@
 typedef void (*io_destroy_func_t)(void *data);
 
 struct io;
+struct mmsghdr;
 
 struct io *io_new(int fd);
 void io_destroy(struct io *io);
@@ -22,6 +23,8 @@ int io_get_fd(struct io *io);
 bool io_set_close_on_destroy(struct io *io, bool do_close);
 
 ssize_t io_send(struct io *io, const struct iovec *iov, int iovcnt);
+int io_sendmmsg(struct io *io, struct mmsghdr *msgs, unsigned int count);
+int io_recvmmsg(struct io *io, struct mmsghdr *msgs, unsigned int count);
 bool io_shutdown(struct io *io);
 
 typedef bool (*io_callback_func_t)(struct io *io, void *user_data);
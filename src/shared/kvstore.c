@@ -0,0 +1,798 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/kvstore.h"
+
+/*
+ * String keyed store made of a snapshot and a journal. The snapshot holds a
+ * table of all entries sorted by key followed by the keys and values, so it
+ * can be mapped and searched in place:
+ *
+ *   header:	magic[4] version[1] reserved[3] count[4]
+ *   entry:	key_offset[4] key_len[4] data_offset[4] data_len[4]
+ *
+ * Keys are stored with a terminating NUL which is not part of key_len.
+ * Changes are appended to the journal and kept in memory on top of the
+ * snapshot until the journal grows large enough for both to be merged into
+ * a new snapshot:
+ *
+ *   record:	op[1] key_len[2] data_len[4] checksum[4] key data
+ *
+ * A record that is truncated or fails its checksum ends the journal, which
+ * makes an interrupted append lose only the change being written.
+ */
+
+#define SNAPSHOT_MAGIC		"BZKV"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_HDR_SIZE	12
+#define SNAPSHOT_ENTRY_SIZE	16
+
+#define JOURNAL_HDR_SIZE	11
+#define JOURNAL_OP_PUT		0x01
+#define JOURNAL_OP_REMOVE	0x02
+
+#define JOURNAL_MIN_COMPACT	(64 * 1024)
+#define OVERLAY_MAX_ENTRIES	256
+
+struct kv_entry {
+	char *key;
+	void *data;
+	size_t len;
+	bool removed;
+};
+
+struct kv_item {
+	const char *key;
+	size_t key_len;
+	const void *data;
+	size_t len;
+};
+
+struct kvstore {
+	char *path;
+	char *journal_path;
+	int journal_fd;
+	size_t journal_size;
+	void *map;
+	size_t map_len;
+	uint32_t count;
+	struct queue *overlay;
+};
+
+static uint32_t checksum(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *ptr = data;
+	size_t i;
+
+	/* FNV-1a, only meant to catch torn writes */
+	for (i = 0; i < len; i++) {
+		hash ^= ptr[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static const uint8_t *snapshot_entry(struct kvstore *store, uint32_t index)
+{
+	return (const uint8_t *) store->map + SNAPSHOT_HDR_SIZE +
+						index * SNAPSHOT_ENTRY_SIZE;
+}
+
+static const char *snapshot_key(struct kvstore *store, uint32_t index,
+							size_t *len)
+{
+	const uint8_t *entry = snapshot_entry(store, index);
+
+	if (len)
+		*len = get_le32(entry + 4);
+
+	return (const char *) store->map + get_le32(entry);
+}
+
+static const void *snapshot_data(struct kvstore *store, uint32_t index,
+							size_t *len)
+{
+	const uint8_t *entry = snapshot_entry(store, index);
+
+	*len = get_le32(entry + 12);
+
+	return (const uint8_t *) store->map + get_le32(entry + 8);
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int ret = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+	if (ret)
+		return ret;
+
+	return a_len < b_len ? -1 : a_len > b_len;
+}
+
+/* Index of the first entry not sorting before key */
+static uint32_t snapshot_lower_bound(struct kvstore *store, const char *key,
+							size_t key_len)
+{
+	uint32_t low = 0, high = store->count;
+
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		const char *mid_key;
+		size_t mid_len;
+
+		mid_key = snapshot_key(store, mid, &mid_len);
+
+		if (key_cmp(mid_key, mid_len, key, key_len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool snapshot_find(struct kvstore *store, const char *key,
+							uint32_t *index)
+{
+	size_t key_len = strlen(key);
+	const char *found;
+	size_t found_len;
+	uint32_t i;
+
+	i = snapshot_lower_bound(store, key, key_len);
+	if (i == store->count)
+		return false;
+
+	found = snapshot_key(store, i, &found_len);
+	if (key_cmp(found, found_len, key, key_len))
+		return false;
+
+	*index = i;
+
+	return true;
+}
+
+static bool snapshot_validate(struct kvstore *store)
+{
+	const char *prev_key = NULL;
+	size_t prev_len = 0;
+	uint32_t i;
+
+	if (store->map_len < SNAPSHOT_HDR_SIZE ||
+			memcmp(store->map, SNAPSHOT_MAGIC, 4) ||
+			((uint8_t *) store->map)[4] != SNAPSHOT_VERSION)
+		return false;
+
+	store->count = get_le32((uint8_t *) store->map + 8);
+
+	if ((uint64_t) store->count * SNAPSHOT_ENTRY_SIZE >
+				store->map_len - SNAPSHOT_HDR_SIZE)
+		return false;
+
+	for (i = 0; i < store->count; i++) {
+		const uint8_t *entry = snapshot_entry(store, i);
+		uint64_t key_off = get_le32(entry);
+		uint64_t key_len = get_le32(entry + 4);
+		uint64_t data_off = get_le32(entry + 8);
+		uint64_t data_len = get_le32(entry + 12);
+		const char *key;
+
+		if (key_off + key_len + 1 > store->map_len ||
+				data_off + data_len > store->map_len)
+			return false;
+
+		key = (const char *) store->map + key_off;
+
+		/* Lookups rely on keys being strings in strictly sorted order */
+		if (key[key_len] || memchr(key, '\0', key_len))
+			return false;
+
+		if (prev_key && key_cmp(prev_key, prev_len, key, key_len) >= 0)
+			return false;
+
+		prev_key = key;
+		prev_len = key_len;
+	}
+
+	return true;
+}
+
+static bool snapshot_map(struct kvstore *store)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	store->map = NULL;
+	store->map_len = 0;
+	store->count = 0;
+
+	fd = open(store->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return false;
+	}
+
+	if (!st.st_size) {
+		close(fd);
+		return true;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return false;
+
+	store->map = map;
+	store->map_len = st.st_size;
+
+	if (!snapshot_validate(store)) {
+		munmap(store->map, store->map_len);
+		store->map = NULL;
+		store->map_len = 0;
+		store->count = 0;
+		return false;
+	}
+
+	return true;
+}
+
+static void snapshot_unmap(struct kvstore *store)
+{
+	if (store->map)
+		munmap(store->map, store->map_len);
+
+	store->map = NULL;
+	store->map_len = 0;
+	store->count = 0;
+}
+
+static void entry_free(void *data)
+{
+	struct kv_entry *entry = data;
+
+	free(entry->key);
+	free(entry->data);
+	free(entry);
+}
+
+static bool entry_match_key(const void *data, const void *match_data)
+{
+	const struct kv_entry *entry = data;
+
+	return !strcmp(entry->key, match_data);
+}
+
+static void overlay_put(struct kvstore *store, const char *key,
+					const void *data, size_t len)
+{
+	struct kv_entry *entry;
+	void *copy;
+
+	copy = malloc(len ? len : 1);
+	if (!copy)
+		return;
+
+	if (len)
+		memcpy(copy, data, len);
+
+	entry = queue_find(store->overlay, entry_match_key, key);
+	if (!entry) {
+		entry = new0(struct kv_entry, 1);
+		entry->key = strdup(key);
+		queue_push_tail(store->overlay, entry);
+	}
+
+	free(entry->data);
+	entry->data = copy;
+	entry->len = len;
+	entry->removed = false;
+}
+
+static void overlay_remove(struct kvstore *store, const char *key)
+{
+	struct kv_entry *entry;
+	uint32_t index;
+
+	/* Only entries present in the snapshot need to be masked */
+	if (!snapshot_find(store, key, &index)) {
+		entry = queue_remove_if(store->overlay, entry_match_key,
+								(void *) key);
+		if (entry)
+			entry_free(entry);
+		return;
+	}
+
+	entry = queue_find(store->overlay, entry_match_key, key);
+	if (!entry) {
+		entry = new0(struct kv_entry, 1);
+		entry->key = strdup(key);
+		queue_push_tail(store->overlay, entry);
+	}
+
+	free(entry->data);
+	entry->data = NULL;
+	entry->len = 0;
+	entry->removed = true;
+}
+
+static bool journal_replay(struct kvstore *store)
+{
+	struct stat st;
+	uint8_t *data;
+	size_t offset = 0;
+
+	if (fstat(store->journal_fd, &st) < 0)
+		return false;
+
+	store->journal_size = 0;
+
+	if (!st.st_size)
+		return true;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+						store->journal_fd, 0);
+	if (data == MAP_FAILED)
+		return false;
+
+	while (st.st_size - offset >= JOURNAL_HDR_SIZE) {
+		const uint8_t *hdr = data + offset;
+		uint8_t op = hdr[0];
+		size_t key_len = get_le16(hdr + 1);
+		size_t len = get_le32(hdr + 3);
+		uint32_t sum;
+		char *key;
+
+		if (st.st_size - offset - JOURNAL_HDR_SIZE < key_len + len ||
+								!key_len)
+			break;
+
+		sum = checksum(2166136261u, hdr + JOURNAL_HDR_SIZE,
+								key_len + len);
+		if (sum != get_le32(hdr + 7) || memchr(hdr + JOURNAL_HDR_SIZE,
+							'\0', key_len))
+			break;
+
+		key = strndup((const char *) hdr + JOURNAL_HDR_SIZE, key_len);
+		if (!key)
+			break;
+
+		if (op == JOURNAL_OP_PUT)
+			overlay_put(store, key, hdr + JOURNAL_HDR_SIZE +
+							key_len, len);
+		else if (op == JOURNAL_OP_REMOVE)
+			overlay_remove(store, key);
+
+		free(key);
+
+		if (op != JOURNAL_OP_PUT && op != JOURNAL_OP_REMOVE)
+			break;
+
+		offset += JOURNAL_HDR_SIZE + key_len + len;
+	}
+
+	munmap(data, st.st_size);
+
+	/* Drop whatever follows the last complete record */
+	if ((off_t) offset != st.st_size &&
+				ftruncate(store->journal_fd, offset) < 0)
+		return false;
+
+	store->journal_size = offset;
+
+	return true;
+}
+
+static bool journal_append(struct kvstore *store, uint8_t op,
+				const char *key, const void *data, size_t len)
+{
+	size_t key_len = strlen(key);
+	size_t total = JOURNAL_HDR_SIZE + key_len + len;
+	uint8_t *record;
+	ssize_t written;
+
+	if (!key_len || key_len > UINT16_MAX || len > UINT32_MAX)
+		return false;
+
+	record = malloc(total);
+	if (!record)
+		return false;
+
+	record[0] = op;
+	put_le16(key_len, record + 1);
+	put_le32(len, record + 3);
+	memcpy(record + JOURNAL_HDR_SIZE, key, key_len);
+	if (len)
+		memcpy(record + JOURNAL_HDR_SIZE + key_len, data, len);
+	put_le32(checksum(2166136261u, record + JOURNAL_HDR_SIZE,
+						key_len + len), record + 7);
+
+	written = write(store->journal_fd, record, total);
+
+	free(record);
+
+	if (written != (ssize_t) total) {
+		/* Never leave a partial record in front of later ones */
+		if (ftruncate(store->journal_fd, store->journal_size) < 0)
+			return false;
+
+		return false;
+	}
+
+	store->journal_size += total;
+
+	return true;
+}
+
+static void journal_check(struct kvstore *store)
+{
+	if (queue_length(store->overlay) < OVERLAY_MAX_ENTRIES &&
+			(store->journal_size < JOURNAL_MIN_COMPACT ||
+				store->journal_size < store->map_len))
+		return;
+
+	kvstore_compact(store);
+}
+
+struct kvstore *kvstore_open(const char *path)
+{
+	struct kvstore *store;
+
+	if (!path)
+		return NULL;
+
+	store = new0(struct kvstore, 1);
+	store->path = strdup(path);
+	store->overlay = queue_new();
+	store->journal_fd = -1;
+
+	if (asprintf(&store->journal_path, "%s.journal", path) < 0) {
+		store->journal_path = NULL;
+		goto fail;
+	}
+
+	if (!snapshot_map(store))
+		goto fail;
+
+	store->journal_fd = open(store->journal_path,
+				O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (store->journal_fd < 0)
+		goto fail;
+
+	if (!journal_replay(store))
+		goto fail;
+
+	return store;
+
+fail:
+	kvstore_close(store);
+	return NULL;
+}
+
+void kvstore_close(struct kvstore *store)
+{
+	if (!store)
+		return;
+
+	if (store->journal_fd >= 0)
+		close(store->journal_fd);
+
+	snapshot_unmap(store);
+	queue_destroy(store->overlay, entry_free);
+	free(store->journal_path);
+	free(store->path);
+	free(store);
+}
+
+bool kvstore_get(struct kvstore *store, const char *key, const void **data,
+								size_t *len)
+{
+	struct kv_entry *entry;
+	uint32_t index;
+
+	if (!store || !key || !data || !len)
+		return false;
+
+	entry = queue_find(store->overlay, entry_match_key, key);
+	if (entry) {
+		if (entry->removed)
+			return false;
+
+		*data = entry->data;
+		*len = entry->len;
+		return true;
+	}
+
+	if (!snapshot_find(store, key, &index))
+		return false;
+
+	*data = snapshot_data(store, index, len);
+
+	return true;
+}
+
+bool kvstore_put(struct kvstore *store, const char *key, const void *data,
+								size_t len)
+{
+	if (!store || !key || (!data && len))
+		return false;
+
+	if (!journal_append(store, JOURNAL_OP_PUT, key, data, len))
+		return false;
+
+	overlay_put(store, key, data, len);
+	journal_check(store);
+
+	return true;
+}
+
+bool kvstore_remove(struct kvstore *store, const char *key)
+{
+	const void *data;
+	size_t len;
+
+	if (!store || !key)
+		return false;
+
+	if (!kvstore_get(store, key, &data, &len))
+		return true;
+
+	if (!journal_append(store, JOURNAL_OP_REMOVE, key, NULL, 0))
+		return false;
+
+	overlay_remove(store, key);
+	journal_check(store);
+
+	return true;
+}
+
+struct foreach_data {
+	const char *prefix;
+	size_t prefix_len;
+	kvstore_foreach_func_t function;
+	void *user_data;
+};
+
+static void foreach_overlay(void *data, void *user_data)
+{
+	struct kv_entry *entry = data;
+	struct foreach_data *foreach = user_data;
+
+	if (entry->removed || strncmp(entry->key, foreach->prefix,
+							foreach->prefix_len))
+		return;
+
+	foreach->function(entry->key, entry->data, entry->len,
+							foreach->user_data);
+}
+
+void kvstore_foreach(struct kvstore *store, const char *prefix,
+				kvstore_foreach_func_t function, void *user_data)
+{
+	struct foreach_data foreach;
+	uint32_t i;
+
+	if (!store || !function)
+		return;
+
+	foreach.prefix = prefix ? prefix : "";
+	foreach.prefix_len = strlen(foreach.prefix);
+	foreach.function = function;
+	foreach.user_data = user_data;
+
+	for (i = snapshot_lower_bound(store, foreach.prefix,
+				foreach.prefix_len); i < store->count; i++) {
+		const char *key = snapshot_key(store, i, NULL);
+		const void *data;
+		size_t len;
+
+		if (strncmp(key, foreach.prefix, foreach.prefix_len))
+			break;
+
+		/* Entries changed since the snapshot are reported below */
+		if (queue_find(store->overlay, entry_match_key, key))
+			continue;
+
+		data = snapshot_data(store, i, &len);
+		function(key, data, len, user_data);
+	}
+
+	queue_foreach(store->overlay, foreach_overlay, &foreach);
+}
+
+bool kvstore_sync(struct kvstore *store)
+{
+	if (!store)
+		return false;
+
+	return !fdatasync(store->journal_fd);
+}
+
+static int item_cmp(const void *a, const void *b)
+{
+	const struct kv_item *item_a = a;
+	const struct kv_item *item_b = b;
+
+	return key_cmp(item_a->key, item_a->key_len, item_b->key,
+							item_b->key_len);
+}
+
+static void collect_overlay(void *data, void *user_data)
+{
+	struct kv_entry *entry = data;
+	struct kv_item **item = user_data;
+
+	if (entry->removed)
+		return;
+
+	(*item)->key = entry->key;
+	(*item)->key_len = strlen(entry->key);
+	(*item)->data = entry->data;
+	(*item)->len = entry->len;
+	(*item)++;
+}
+
+static bool write_snapshot(const char *path, const struct kv_item *items,
+							uint32_t count)
+{
+	uint64_t size = SNAPSHOT_HDR_SIZE +
+				(uint64_t) count * SNAPSHOT_ENTRY_SIZE;
+	uint8_t *buf, *entry;
+	size_t offset;
+	uint32_t i;
+	bool result;
+	int fd;
+
+	for (i = 0; i < count; i++)
+		size += items[i].key_len + 1 + items[i].len;
+
+	if (size > UINT32_MAX)
+		return false;
+
+	buf = malloc(size);
+	if (!buf)
+		return false;
+
+	memcpy(buf, SNAPSHOT_MAGIC, 4);
+	buf[4] = SNAPSHOT_VERSION;
+	memset(buf + 5, 0, 3);
+	put_le32(count, buf + 8);
+
+	entry = buf + SNAPSHOT_HDR_SIZE;
+	offset = SNAPSHOT_HDR_SIZE + count * SNAPSHOT_ENTRY_SIZE;
+
+	for (i = 0; i < count; i++, entry += SNAPSHOT_ENTRY_SIZE) {
+		put_le32(offset, entry);
+		put_le32(items[i].key_len, entry + 4);
+		memcpy(buf + offset, items[i].key, items[i].key_len);
+		buf[offset + items[i].key_len] = '\0';
+		offset += items[i].key_len + 1;
+
+		put_le32(offset, entry + 8);
+		put_le32(items[i].len, entry + 12);
+		if (items[i].len)
+			memcpy(buf + offset, items[i].data, items[i].len);
+		offset += items[i].len;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		free(buf);
+		return false;
+	}
+
+	result = write(fd, buf, size) == (ssize_t) size && !fsync(fd);
+
+	close(fd);
+	free(buf);
+
+	return result;
+}
+
+bool kvstore_compact(struct kvstore *store)
+{
+	struct kv_item *items, *item, *merged;
+	unsigned int overlay_count;
+	uint32_t i, count = 0;
+	char *tmp_path;
+	bool result = false;
+	size_t j;
+
+	if (!store)
+		return false;
+
+	overlay_count = queue_length(store->overlay);
+
+	items = new0(struct kv_item, overlay_count + 1);
+	merged = new0(struct kv_item, store->count + overlay_count + 1);
+
+	item = items;
+	queue_foreach(store->overlay, collect_overlay, &item);
+	qsort(items, item - items, sizeof(*items), item_cmp);
+
+	/* Merge both sorted lists, dropping entries changed since */
+	for (i = 0, j = 0; i < store->count || items + j < item;) {
+		struct kv_item entry;
+
+		if (i < store->count) {
+			entry.key = snapshot_key(store, i, &entry.key_len);
+
+			if (queue_find(store->overlay, entry_match_key,
+								entry.key)) {
+				i++;
+				continue;
+			}
+
+			if (items + j == item || item_cmp(&entry,
+							&items[j]) < 0) {
+				entry.data = snapshot_data(store, i,
+								&entry.len);
+				merged[count++] = entry;
+				i++;
+				continue;
+			}
+		}
+
+		merged[count++] = items[j++];
+	}
+
+	if (asprintf(&tmp_path, "%s.tmp", store->path) < 0)
+		goto done;
+
+	if (!write_snapshot(tmp_path, merged, count) ||
+					rename(tmp_path, store->path) < 0) {
+		unlink(tmp_path);
+		free(tmp_path);
+		goto done;
+	}
+
+	free(tmp_path);
+
+	/*
+	 * The journal only repeats what is in the new snapshot now, so a
+	 * failure past this point can't lose any data.
+	 */
+	snapshot_unmap(store);
+	queue_remove_all(store->overlay, NULL, NULL, entry_free);
+
+	if (ftruncate(store->journal_fd, 0) == 0)
+		store->journal_size = 0;
+
+	result = snapshot_map(store);
+
+	if (store->journal_size)
+		journal_replay(store);
+
+done:
+	free(merged);
+	free(items);
+
+	return result;
+}
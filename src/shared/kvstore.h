@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*kvstore_foreach_func_t)(const char *key, const void *data,
+						size_t len, void *user_data);
+
+struct kvstore;
+
+struct kvstore *kvstore_open(const char *path);
+void kvstore_close(struct kvstore *store);
+
+bool kvstore_get(struct kvstore *store, const char *key, const void **data,
+								size_t *len);
+bool kvstore_put(struct kvstore *store, const char *key, const void *data,
+								size_t len);
+bool kvstore_remove(struct kvstore *store, const char *key);
+
+void kvstore_foreach(struct kvstore *store, const char *prefix,
+				kvstore_foreach_func_t function, void *user_data);
+
+bool kvstore_sync(struct kvstore *store);
+bool kvstore_compact(struct kvstore *store);
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+/*
+ * Compressor and decompressor for the LZ4 block format, so that data
+ * can be exchanged with the reference implementation without adding a
+ * dependency on it. Only the block format is supported, framing is left
+ * to the caller.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/lz4.h"
+
+#define MIN_MATCH	4
+#define LAST_LITERALS	5
+#define MF_LIMIT	12
+#define MAX_OFFSET	65535
+#define MAX_INPUT	0x7e000000
+
+#define HASH_BITS	12
+
+static inline uint32_t hash_seq(uint32_t seq)
+{
+	return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = len;
+
+	return op;
+}
+
+static uint8_t *put_literals(uint8_t *op, uint8_t *end, const uint8_t *lit,
+						size_t len, size_t match)
+{
+	/* Token, literal length, literals, offset and match length */
+	if ((size_t) (end - op) < 1 + len / 255 + 1 + len + 2 + match / 255 + 1)
+		return NULL;
+
+	*op++ = (len < 15 ? len : 15) << 4;
+
+	if (len >= 15)
+		op = put_length(op, len - 15);
+
+	memcpy(op, lit, len);
+
+	return op + len;
+}
+
+/*
+ * Compresses len bytes from src into at most size bytes at dst and returns
+ * the compressed size, or 0 if the result does not fit.
+ */
+size_t lz4_compress(const void *src, size_t len, void *dst, size_t size)
+{
+	uint32_t table[1 << HASH_BITS];
+	const uint8_t *in = src;
+	const uint8_t *end = in + len;
+	const uint8_t *ip = in, *anchor = in;
+	uint8_t *out = dst, *op = out;
+	uint8_t *token;
+
+	if (len > MAX_INPUT)
+		return 0;
+
+	memset(table, 0, sizeof(table));
+
+	/* The last match has to start MF_LIMIT bytes before the end */
+	while (len > MF_LIMIT && ip < end - MF_LIMIT) {
+		const uint8_t *ref, *mp, *rp;
+		uint32_t seq, h;
+		size_t mlen;
+
+		seq = get_le32(ip);
+		h = hash_seq(seq);
+		ref = in + table[h];
+		table[h] = ip - in;
+
+		if (ref >= ip || ip - ref > MAX_OFFSET || get_le32(ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		/* The last LAST_LITERALS bytes are always literals */
+		mp = ip + MIN_MATCH;
+		rp = ref + MIN_MATCH;
+		while (mp < end - LAST_LITERALS && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		mlen = mp - ip - MIN_MATCH;
+
+		token = op;
+		op = put_literals(op, out + size, anchor, ip - anchor, mlen);
+		if (!op)
+			return 0;
+
+		put_le16(ip - ref, op);
+		op += 2;
+
+		*token |= mlen < 15 ? mlen : 15;
+		if (mlen >= 15)
+			op = put_length(op, mlen - 15);
+
+		ip = mp;
+		anchor = ip;
+	}
+
+	op = put_literals(op, out + size, anchor, end - anchor, 0);
+	if (!op)
+		return 0;
+
+	return op - out;
+}
+
+static bool get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+	uint8_t val;
+
+	do {
+		if (*ip >= end)
+			return false;
+
+		val = *(*ip)++;
+		*len += val;
+	} while (val == 255);
+
+	return true;
+}
+
+/*
+ * Decompresses the len byte block at src into at most size bytes at dst
+ * and returns the decompressed size, or -1 if the block is malformed or
+ * does not fit.
+ */
+ssize_t lz4_decompress(const void *src, size_t len, void *dst, size_t size)
+{
+	const uint8_t *ip = src;
+	const uint8_t *end = ip + len;
+	uint8_t *out = dst, *op = out;
+	uint8_t *oend = out + size;
+
+	while (ip < end) {
+		const uint8_t *ref;
+		uint8_t token;
+		size_t lit, mlen;
+		uint16_t offset;
+
+		token = *ip++;
+
+		lit = token >> 4;
+		if (lit == 15 && !get_length(&ip, end, &lit))
+			return -1;
+
+		if (lit > (size_t) (end - ip) || lit > (size_t) (oend - op))
+			return -1;
+
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+
+		/* The last sequence has no match part */
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return -1;
+
+		offset = get_le16(ip);
+		ip += 2;
+
+		if (!offset || offset > op - out)
+			return -1;
+
+		mlen = token & 0x0f;
+		if (mlen == 15 && !get_length(&ip, end, &mlen))
+			return -1;
+
+		mlen += MIN_MATCH;
+		if (mlen > (size_t) (oend - op))
+			return -1;
+
+		/* Matches may overlap the bytes they produce */
+		ref = op - offset;
+		while (mlen--)
+			*op++ = *ref++;
+	}
+
+	return op - out;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Largest compressed size of len bytes of input */
+#define LZ4_COMPRESS_BOUND(len)	((len) + (len) / 255 + 16)
+
+size_t lz4_compress(const void *src, size_t len, void *dst, size_t size);
+ssize_t lz4_decompress(const void *src, size_t len, void *dst, size_t size);
@@ -15,22 +15,29 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #include "mainloop.h"
 #include "mainloop-notify.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define MIN_EPOLL_EVENTS 16
 
 static int epoll_fd;
 static int epoll_terminate;
@@ -42,27 +49,369 @@ struct mainloop_data {
 	mainloop_event_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
+	struct mainloop_data *next;
+	uint32_t gen;
+	bool armed;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MIN_MAINLOOP_ENTRIES 128
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/* Table of watched file descriptors indexed by fd, grown on demand */
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_size;
+static unsigned int mainloop_count;
 
-struct timeout_data {
+/* Event batch passed to epoll_wait, grown when it fills up */
+static struct epoll_event *epoll_events;
+static int epoll_max_events;
+
+/*
+ * Entries removed while dispatching a batch of events are only freed once
+ * the batch has been processed since later events may still point to them.
+ */
+static bool dispatching;
+static struct mainloop_data *removed_list;
+
+/*
+ * With io_uring the fds are watched with one-shot poll requests that are
+ * re-armed after their callback has run. Adding, modifying and removing
+ * watches only queues requests, which are submitted together with the
+ * wait for the next events, so there is a single system call per loop
+ * iteration. Completions carry the fd and a generation number so that
+ * those of watches removed in the meantime can be told apart. If the
+ * kernel refuses to set up a ring, epoll is used instead.
+ */
+static bool use_uring;
+
+#ifdef HAVE_IO_URING
+#define URING_ENTRIES 256
+
+static uint32_t uring_gen;
+
+static struct {
 	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	unsigned int sq_entries;
+	unsigned int queued;
+} uring = { .fd = -1 };
+
+static int uring_enter(unsigned int submit, unsigned int wait)
+{
+	int ret;
+
+	ret = syscall(__NR_io_uring_enter, uring.fd, submit, wait,
+				wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (ret < 0)
+		return -errno;
+
+	uring.queued -= ret;
+
+	return ret;
+}
+
+static void uring_close(void)
+{
+	if (uring.fd < 0)
+		return;
+
+	if (uring.sqes)
+		munmap(uring.sqes,
+			uring.sq_entries * sizeof(struct io_uring_sqe));
+
+	if (uring.cq_ring && uring.cq_ring != uring.sq_ring)
+		munmap(uring.cq_ring, uring.cq_ring_size);
+
+	if (uring.sq_ring)
+		munmap(uring.sq_ring, uring.sq_ring_size);
+
+	close(uring.fd);
+
+	memset(&uring, 0, sizeof(uring));
+	uring.fd = -1;
+}
+
+static int uring_setup(void)
+{
+	struct io_uring_params p;
+	void *ring;
+
+	uring_close();
+
+	memset(&p, 0, sizeof(p));
+
+	uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (uring.fd < 0)
+		return -errno;
+
+	uring.sq_entries = p.sq_entries;
+	uring.sq_ring_size = p.sq_off.array +
+				p.sq_entries * sizeof(unsigned int);
+	uring.cq_ring_size = p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uring.cq_ring_size > uring.sq_ring_size)
+			uring.sq_ring_size = uring.cq_ring_size;
+		uring.cq_ring_size = uring.sq_ring_size;
+	}
+
+	ring = mmap(NULL, uring.sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED)
+		goto failed;
+
+	uring.sq_ring = ring;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		uring.cq_ring = ring;
+	else {
+		ring = mmap(NULL, uring.cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+		if (ring == MAP_FAILED)
+			goto failed;
+
+		uring.cq_ring = ring;
+	}
+
+	ring = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			uring.fd, IORING_OFF_SQES);
+	if (ring == MAP_FAILED)
+		goto failed;
+
+	uring.sqes = ring;
+
+	uring.sq_head = uring.sq_ring + p.sq_off.head;
+	uring.sq_tail = uring.sq_ring + p.sq_off.tail;
+	uring.sq_mask = uring.sq_ring + p.sq_off.ring_mask;
+	uring.sq_array = uring.sq_ring + p.sq_off.array;
+	uring.cq_head = uring.cq_ring + p.cq_off.head;
+	uring.cq_tail = uring.cq_ring + p.cq_off.tail;
+	uring.cq_mask = uring.cq_ring + p.cq_off.ring_mask;
+	uring.cqes = uring.cq_ring + p.cq_off.cqes;
+
+	return 0;
+
+failed:
+	uring_close();
+	return -ENOMEM;
+}
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, index;
+
+	head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+	tail = *uring.sq_tail;
+
+	/* Ring is full, hand what is queued to the kernel right away */
+	if (tail - head >= uring.sq_entries) {
+		if (uring_enter(uring.queued, 0) < 0)
+			return NULL;
+	}
+
+	index = tail & *uring.sq_mask;
+
+	sqe = &uring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	uring.sq_array[index] = index;
+
+	return sqe;
+}
+
+static void uring_queue_sqe(void)
+{
+	__atomic_store_n(uring.sq_tail, *uring.sq_tail + 1, __ATOMIC_RELEASE);
+	uring.queued++;
+}
+
+static uint64_t uring_token(struct mainloop_data *data)
+{
+	return (uint64_t) data->gen << 32 | (uint32_t) data->fd;
+}
+
+static int uring_arm(struct mainloop_data *data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe();
+	if (!sqe)
+		return -EIO;
+
+	data->gen = ++uring_gen ? uring_gen : ++uring_gen;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = data->fd;
+	sqe->poll32_events = data->events;
+	sqe->user_data = uring_token(data);
+
+	uring_queue_sqe();
+
+	data->armed = true;
+
+	return 0;
+}
+
+static int uring_disarm(struct mainloop_data *data)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!data->armed)
+		return 0;
+
+	sqe = uring_get_sqe();
+	if (!sqe)
+		return -EIO;
+
+	/* Completion of the removal itself is ignored */
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_token(data);
+	sqe->user_data = 0;
+
+	uring_queue_sqe();
+
+	data->armed = false;
+
+	return 0;
+}
+
+static int uring_wait(struct epoll_event *events, int max_events)
+{
+	unsigned int head, tail;
+	int ret, count = 0;
+
+	ret = uring_enter(uring.queued, 1);
+	if (ret < 0)
+		return ret;
+
+	head = *uring.cq_head;
+	tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail && count < max_events) {
+		struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+		struct mainloop_data *data = NULL;
+		uint32_t fd = cqe->user_data;
+
+		head++;
+
+		if (!cqe->user_data || fd >= mainloop_size)
+			continue;
+
+		data = mainloop_list[fd];
+		if (!data || data->gen != cqe->user_data >> 32)
+			continue;
+
+		data->armed = false;
+
+		events[count].events = cqe->res < 0 ? EPOLLERR | EPOLLHUP :
+								cqe->res;
+		events[count].data.ptr = data;
+		count++;
+	}
+
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+
+	return count;
+}
+#else
+static int uring_setup(void)
+{
+	return -ENOTSUP;
+}
+
+static void uring_close(void)
+{
+}
+
+static int uring_arm(struct mainloop_data *data)
+{
+	return -ENOTSUP;
+}
+
+static int uring_disarm(struct mainloop_data *data)
+{
+	return -ENOTSUP;
+}
+
+static int uring_wait(struct epoll_event *events, int max_events)
+{
+	return -ENOTSUP;
+}
+#endif
+
+/*
+ * Timeouts are kept in a hierarchical timer wheel driven by a single
+ * timerfd. Every slot of a level spans a full turn of the level below it,
+ * so adding, modifying and removing a timeout only touches one slot list.
+ * Timeouts in upper levels are cascaded down once the wheel reaches the
+ * start of their slot, and the timerfd is only reprogrammed when the
+ * earliest pending expiry moves forward.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 6
+#define WHEEL_SHIFT(level) ((level) * WHEEL_BITS)
+#define WHEEL_MAX_DELTA ((UINT64_C(1) << WHEEL_SHIFT(WHEEL_LEVELS)) - 1)
+
+#define MIN_TIMEOUT_ENTRIES 16
+
+struct timeout_data {
+	int id;
+	bool pending;
+	uint8_t level;
+	uint8_t slot;
+	uint64_t expires;
+	struct timeout_data *next;
+	struct timeout_data **pprev;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+static int timer_fd = -1;
+static bool wheel_running;
+static uint64_t wheel_time;
+static uint64_t wheel_armed;
+static unsigned int wheel_pending;
+static uint64_t wheel_bitmap[WHEEL_LEVELS];
+static struct timeout_data *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Table of timeouts indexed by id, with a stack of ids free for reuse */
+static struct timeout_data **timeout_list;
+static int *timeout_free;
+static unsigned int timeout_size;
+static unsigned int timeout_free_count;
+
 void mainloop_init(void)
 {
-	unsigned int i;
+	use_uring = uring_setup() == 0;
+	if (!use_uring)
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	free(mainloop_list);
+	mainloop_list = calloc(MIN_MAINLOOP_ENTRIES, sizeof(*mainloop_list));
+	mainloop_size = mainloop_list ? MIN_MAINLOOP_ENTRIES : 0;
+	mainloop_count = 0;
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	free(epoll_events);
+	epoll_events = calloc(MIN_EPOLL_EVENTS, sizeof(*epoll_events));
+	epoll_max_events = epoll_events ? MIN_EPOLL_EVENTS : 0;
 
 	epoll_terminate = 0;
 
@@ -88,33 +437,89 @@ void mainloop_exit_failure(void)
 	epoll_terminate = 1;
 }
 
+static void grow_events(void)
+{
+	struct epoll_event *events;
+	int max_events = epoll_max_events * 2;
+
+	/* No point in asking for more events than there are fds watched */
+	if (epoll_max_events >= (int) mainloop_count)
+		return;
+
+	events = realloc(epoll_events, max_events * sizeof(*events));
+	if (!events)
+		return;
+
+	epoll_events = events;
+	epoll_max_events = max_events;
+}
+
+static void free_removed(void)
+{
+	while (removed_list) {
+		struct mainloop_data *data = removed_list;
+
+		removed_list = data->next;
+		free(data);
+	}
+}
+
 int mainloop_run(void)
 {
 	unsigned int i;
 
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
 		int n, nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		if (use_uring)
+			nfds = uring_wait(epoll_events, epoll_max_events);
+		else
+			nfds = epoll_wait(epoll_fd, epoll_events,
+							epoll_max_events, -1);
 		if (nfds < 0)
 			continue;
 
+		dispatching = true;
+
 		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
+			struct mainloop_data *data = epoll_events[n].data.ptr;
+
+			/* Skip entries removed by a previous callback */
+			if (!data->callback)
+				continue;
 
-			data->callback(data->fd, events[n].events,
+			data->callback(data->fd, epoll_events[n].events,
 							data->user_data);
 		}
+
+		/* Watch again whatever is left after the callbacks ran */
+		for (n = 0; use_uring && n < nfds; n++) {
+			struct mainloop_data *data = epoll_events[n].data.ptr;
+
+			if (data->callback && !data->armed)
+				uring_arm(data);
+		}
+
+		dispatching = false;
+		free_removed();
+
+		/*
+		 * A full batch means more fds are likely ready, so fetch more
+		 * of them per wakeup from now on.
+		 */
+		if (nfds == epoll_max_events)
+			grow_events();
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	for (i = 0; i < mainloop_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
 
 		if (data) {
-			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+			if (!use_uring)
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd,
+									NULL);
 
 			if (data->destroy)
 				data->destroy(data->user_data);
@@ -123,7 +528,13 @@ int mainloop_run(void)
 		}
 	}
 
-	close(epoll_fd);
+	mainloop_count = 0;
+
+	if (use_uring)
+		uring_close();
+	else
+		close(epoll_fd);
+
 	epoll_fd = 0;
 
 	mainloop_notify_exit();
@@ -131,6 +542,35 @@ int mainloop_run(void)
 	return exit_status;
 }
 
+static int grow_list(unsigned int fd)
+{
+	struct mainloop_data **list;
+	unsigned int size = mainloop_size ? mainloop_size : MIN_MAINLOOP_ENTRIES;
+
+	while (size <= fd)
+		size *= 2;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + mainloop_size, 0,
+				(size - mainloop_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_size = size;
+
+	return 0;
+}
+
+static struct mainloop_data *lookup_fd(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_size)
+		return NULL;
+
+	return mainloop_list[fd];
+}
+
 int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 				void *user_data, mainloop_destroy_func destroy)
 {
@@ -138,9 +578,15 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if ((unsigned int) fd >= mainloop_size) {
+		err = grow_list(fd);
+		if (err < 0)
+			return err;
+	}
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -152,17 +598,23 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	memset(&ev, 0, sizeof(ev));
-	ev.events = events;
-	ev.data.ptr = data;
+	if (use_uring) {
+		err = uring_arm(data);
+	} else {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = data;
+
+		err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
+	}
 
-	err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
 	if (err < 0) {
 		free(data);
 		return err;
 	}
 
 	mainloop_list[fd] = data;
+	mainloop_count++;
 
 	return 0;
 }
@@ -173,13 +625,27 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = lookup_fd(fd);
 	if (!data)
 		return -ENXIO;
 
+	if (use_uring) {
+		/* Watches waiting for their callback are re-armed after it */
+		data->events = events;
+
+		if (!data->armed)
+			return 0;
+
+		err = uring_disarm(data);
+		if (err < 0)
+			return err;
+
+		return uring_arm(data);
+	}
+
 	memset(&ev, 0, sizeof(ev));
 	ev.events = events;
 	ev.data.ptr = data;
@@ -198,124 +664,452 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = lookup_fd(fd);
 	if (!data)
 		return -ENXIO;
 
 	mainloop_list[fd] = NULL;
+	mainloop_count--;
 
-	err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+	if (use_uring)
+		err = uring_disarm(data);
+	else
+		err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
 	if (data->destroy)
 		data->destroy(data->user_data);
 
+	if (dispatching) {
+		data->callback = NULL;
+		data->next = removed_list;
+		removed_list = data;
+		return err;
+	}
+
 	free(data);
 
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static uint64_t wheel_now(bool round_up)
 {
-	struct timeout_data *data = user_data;
+	struct timespec ts;
+	uint64_t msec;
 
-	close(data->fd);
-	data->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+	msec = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 
-	free(data);
+	/* Never let a timeout fire before its full interval has passed */
+	if (round_up && ts.tv_nsec % 1000000)
+		msec++;
+
+	return msec;
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static void wheel_link(struct timeout_data *data)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
-	ssize_t result;
+	struct timeout_data **head;
+	unsigned int level = 0;
+	uint64_t delta;
 
-	if (events & (EPOLLERR | EPOLLHUP))
-		return;
+	if (data->expires < wheel_time)
+		data->expires = wheel_time;
+
+	delta = data->expires - wheel_time;
+	if (delta > WHEEL_MAX_DELTA) {
+		delta = WHEEL_MAX_DELTA;
+		data->expires = wheel_time + delta;
+	}
+
+	while (delta >> WHEEL_SHIFT(level + 1))
+		level++;
+
+	data->level = level;
+	data->slot = (data->expires >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+
+	head = &wheel[level][data->slot];
 
-	result = read(data->fd, &expired, sizeof(expired));
-	if (result != sizeof(expired))
+	data->next = *head;
+	if (data->next)
+		data->next->pprev = &data->next;
+
+	*head = data;
+	data->pprev = head;
+
+	wheel_bitmap[level] |= UINT64_C(1) << data->slot;
+
+	data->pending = true;
+	wheel_pending++;
+}
+
+static void wheel_unlink(struct timeout_data *data)
+{
+	if (!data->pending)
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	*data->pprev = data->next;
+	if (data->next)
+		data->next->pprev = data->pprev;
+
+	if (!wheel[data->level][data->slot])
+		wheel_bitmap[data->level] &= ~(UINT64_C(1) << data->slot);
+
+	data->next = NULL;
+	data->pprev = NULL;
+	data->pending = false;
+	wheel_pending--;
+}
+
+static inline uint64_t rotate_right(uint64_t value, unsigned int count)
+{
+	count &= 63;
+
+	return count ? (value >> count) | (value << (64 - count)) : value;
+}
+
+/*
+ * Find the time at which the wheel next needs to run, either because a
+ * timeout in the lowest level expires or because a slot of an upper level
+ * needs to be cascaded.
+ */
+static bool wheel_next(uint64_t *next)
+{
+	bool found = false;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		uint64_t bitmap = wheel_bitmap[level];
+		uint64_t base, when;
+		unsigned int cur, dist;
+
+		if (!bitmap)
+			continue;
+
+		base = wheel_time >> WHEEL_SHIFT(level);
+		cur = base & WHEEL_MASK;
+
+		/*
+		 * The current slot of an upper level can only hold timeouts
+		 * for its next turn since they would be in a lower level
+		 * otherwise.
+		 */
+		if (!level)
+			dist = __builtin_ctzll(rotate_right(bitmap, cur));
+		else
+			dist = __builtin_ctzll(rotate_right(bitmap, cur + 1)) + 1;
+
+		when = (base + dist) << WHEEL_SHIFT(level);
+
+		if (!found || when < *next) {
+			*next = when;
+			found = true;
+		}
+	}
+
+	return found;
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static void wheel_arm(void)
 {
 	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	uint64_t next;
+
+	if (!wheel_next(&next))
+		next = 0;
+
+	if (next == wheel_armed)
+		return;
 
 	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
+	itimer.it_value.tv_sec = next / 1000;
+	itimer.it_value.tv_nsec = (next % 1000) * 1000 * 1000;
+
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	wheel_armed = next;
+}
+
+static void wheel_cascade(unsigned int level)
+{
+	unsigned int slot = (wheel_time >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+	struct timeout_data *list = wheel[level][slot];
+
+	wheel[level][slot] = NULL;
+	wheel_bitmap[level] &= ~(UINT64_C(1) << slot);
+
+	while (list) {
+		struct timeout_data *data = list;
+
+		list = data->next;
+
+		data->pending = false;
+		wheel_pending--;
+
+		wheel_link(data);
+	}
+}
+
+static void wheel_expire(void)
+{
+	unsigned int slot = wheel_time & WHEEL_MASK;
+	struct timeout_data *expired = wheel[0][slot];
+
+	if (!expired)
+		return;
+
+	/*
+	 * Move the slot to a local list so callbacks can still remove or
+	 * modify any of the timeouts that have not been processed yet.
+	 */
+	wheel[0][slot] = NULL;
+	wheel_bitmap[0] &= ~(UINT64_C(1) << slot);
+	expired->pprev = &expired;
+
+	while (expired) {
+		struct timeout_data *data = expired;
+
+		wheel_unlink(data);
+
+		data->callback(data->id, data->user_data);
+	}
+}
+
+static void wheel_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t expired, next, now;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	/*
+	 * The read fails if the timer has been reprogrammed after it fired,
+	 * in which case it is still worth checking for expired timeouts.
+	 */
+	if (read(fd, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+		return;
+
+	wheel_armed = 0;
+	wheel_running = true;
+
+	now = wheel_now(false);
+
+	while (wheel_next(&next) && next <= now) {
+		unsigned int level;
+
+		wheel_time = next;
+
+		for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+			uint64_t mask = (UINT64_C(1) << WHEEL_SHIFT(level)) - 1;
+
+			if (!(wheel_time & mask))
+				wheel_cascade(level);
+		}
+
+		wheel_expire();
+	}
+
+	wheel_running = false;
+
+	wheel_arm();
+}
+
+static void wheel_destroy(void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < timeout_size; i++) {
+		struct timeout_data *data = timeout_list[i];
+
+		timeout_list[i] = NULL;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+		if (data) {
+			if (data->destroy)
+				data->destroy(data->user_data);
+
+			free(data);
+		}
+	}
+
+	free(timeout_list);
+	timeout_list = NULL;
+	free(timeout_free);
+	timeout_free = NULL;
+	timeout_size = 0;
+	timeout_free_count = 0;
+
+	memset(wheel, 0, sizeof(wheel));
+	memset(wheel_bitmap, 0, sizeof(wheel_bitmap));
+	wheel_pending = 0;
+	wheel_armed = 0;
+
+	close(timer_fd);
+	timer_fd = -1;
+}
+
+static int wheel_init(void)
+{
+	if (timer_fd >= 0)
+		return 0;
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0)
+		return -EIO;
+
+	if (mainloop_add_fd(timer_fd, EPOLLIN, wheel_callback, NULL,
+							wheel_destroy) < 0) {
+		close(timer_fd);
+		timer_fd = -1;
+		return -EIO;
+	}
+
+	wheel_armed = 0;
+
+	return 0;
+}
+
+static int grow_timeouts(void)
+{
+	struct timeout_data **list;
+	unsigned int size, i;
+	int *ids;
+
+	size = timeout_size ? timeout_size * 2 : MIN_TIMEOUT_ENTRIES;
+
+	ids = realloc(timeout_free, size * sizeof(*ids));
+	if (!ids)
+		return -ENOMEM;
+
+	timeout_free = ids;
+
+	list = realloc(timeout_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + timeout_size, 0, (size - timeout_size) * sizeof(*list));
+
+	timeout_list = list;
+
+	/* Id 0 is never handed out and the lowest ids are used first */
+	for (i = size - 1; i > 0 && i >= timeout_size; i--)
+		timeout_free[timeout_free_count++] = i;
+
+	timeout_size = size;
+
+	return 0;
+}
+
+static int timeout_alloc_id(void)
+{
+	if (!timeout_free_count && grow_timeouts() < 0)
+		return -ENOMEM;
+
+	return timeout_free[--timeout_free_count];
+}
+
+static struct timeout_data *lookup_timeout(int id)
+{
+	if (id <= 0 || (unsigned int) id >= timeout_size)
+		return NULL;
+
+	return timeout_list[id];
+}
+
+static void timeout_start(struct timeout_data *data, unsigned int msec)
+{
+	wheel_unlink(data);
+
+	/* Restart an idle wheel at the current time */
+	if (!wheel_pending)
+		wheel_time = wheel_now(false);
+
+	data->expires = wheel_now(true) + msec;
+
+	wheel_link(data);
+
+	/* Leave reprogramming the timer to the wheel while it is running */
+	if (wheel_running)
+		return;
+
+	if (!wheel_armed || data->expires < wheel_armed)
+		wheel_arm();
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 				void *user_data, mainloop_destroy_func destroy)
 {
 	struct timeout_data *data;
+	int id;
 
 	if (!callback)
 		return -EINVAL;
 
+	if (wheel_init() < 0)
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
 
+	id = timeout_alloc_id();
+	if (id < 0) {
+		free(data);
+		return id;
+	}
+
 	memset(data, 0, sizeof(*data));
+	data->id = id;
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
-		free(data);
-		return -EIO;
-	}
-
-	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
-	}
+	timeout_list[id] = data;
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
+	if (msec > 0)
+		timeout_start(data, msec);
 
-	return data->fd;
+	return id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
-	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
+	data = lookup_timeout(id);
+	if (!data)
 		return -EIO;
 
+	if (msec > 0)
+		timeout_start(data, msec);
+
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	if (id <= 0)
+		return -EINVAL;
+
+	data = lookup_timeout(id);
+	if (!data)
+		return -ENXIO;
+
+	/* The timer is left armed, an early wakeup just finds nothing due */
+	wheel_unlink(data);
+
+	timeout_list[id] = NULL;
+	timeout_free[timeout_free_count++] = id;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+
+	return 0;
 }
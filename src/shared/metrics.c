@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/metrics.h"
+
+/*
+ * Process wide registry of counters, gauges and histograms. Metrics are
+ * looked up by name when registered, so every user can simply register
+ * what it needs and share the result with other instances.
+ *
+ * Histograms use METRICS_BUCKETS buckets whose upper bounds double from
+ * first_bound on, plus one bucket for anything larger.
+ */
+
+static struct queue *metrics;
+
+static bool match_name(const void *data, const void *match_data)
+{
+	const struct metric *metric = data;
+
+	return !strcmp(metric->name, match_data);
+}
+
+static struct metric *metric_new(const char *name, const char *help,
+						enum metrics_type type)
+{
+	struct metric *metric;
+
+	if (!name)
+		return NULL;
+
+	if (!metrics)
+		metrics = queue_new();
+
+	metric = queue_find(metrics, match_name, name);
+	if (metric)
+		return metric->type == type ? metric : NULL;
+
+	metric = new0(struct metric, 1);
+	metric->name = name;
+	metric->help = help;
+	metric->type = type;
+
+	queue_push_tail(metrics, metric);
+
+	return metric;
+}
+
+struct metric *metrics_counter(const char *name, const char *help)
+{
+	return metric_new(name, help, METRICS_COUNTER);
+}
+
+struct metric *metrics_gauge(const char *name, const char *help)
+{
+	return metric_new(name, help, METRICS_GAUGE);
+}
+
+struct metric *metrics_histogram(const char *name, const char *help,
+							uint64_t first_bound)
+{
+	struct metric *metric;
+	int i;
+
+	metric = metric_new(name, help, METRICS_HISTOGRAM);
+	if (!metric || metric->bounds[0])
+		return metric;
+
+	metric->bounds[0] = first_bound ? first_bound : 1;
+
+	for (i = 1; i < METRICS_BUCKETS; i++)
+		metric->bounds[i] = metric->bounds[i - 1] * 2;
+
+	return metric;
+}
+
+void metrics_add(struct metric *metric, uint64_t value)
+{
+	if (!metric)
+		return;
+
+	metric->value += value;
+}
+
+void metrics_set(struct metric *metric, int64_t value)
+{
+	if (!metric)
+		return;
+
+	metric->value = value;
+}
+
+void metrics_observe(struct metric *metric, uint64_t value)
+{
+	int i;
+
+	if (!metric || metric->type != METRICS_HISTOGRAM)
+		return;
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		if (value <= metric->bounds[i])
+			break;
+	}
+
+	metric->buckets[i]++;
+	metric->count++;
+	metric->sum += value;
+}
+
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct foreach_data {
+	metrics_func_t func;
+	void *user_data;
+};
+
+static void foreach_metric(void *data, void *user_data)
+{
+	struct foreach_data *foreach = user_data;
+
+	foreach->func(data, foreach->user_data);
+}
+
+void metrics_foreach(metrics_func_t func, void *user_data)
+{
+	struct foreach_data foreach = { func, user_data };
+
+	if (!func)
+		return;
+
+	queue_foreach(metrics, foreach_metric, &foreach);
+}
+
+static const char *type_str(enum metrics_type type)
+{
+	switch (type) {
+	case METRICS_COUNTER:
+		return "counter";
+	case METRICS_GAUGE:
+		return "gauge";
+	case METRICS_HISTOGRAM:
+		return "histogram";
+	}
+
+	return "untyped";
+}
+
+static void format_metric(const struct metric *metric, void *user_data)
+{
+	FILE *fp = user_data;
+	uint64_t total = 0;
+	int i;
+
+	if (metric->help)
+		fprintf(fp, "# HELP %s %s\n", metric->name, metric->help);
+
+	fprintf(fp, "# TYPE %s %s\n", metric->name, type_str(metric->type));
+
+	if (metric->type != METRICS_HISTOGRAM) {
+		fprintf(fp, "%s %" PRId64 "\n", metric->name, metric->value);
+		return;
+	}
+
+	/* Bucket counts are cumulative in the text format */
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		total += metric->buckets[i];
+		fprintf(fp, "%s_bucket{le=\"%" PRIu64 "\"} %" PRIu64 "\n",
+					metric->name, metric->bounds[i], total);
+	}
+
+	fprintf(fp, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", metric->name,
+								metric->count);
+	fprintf(fp, "%s_sum %" PRIu64 "\n", metric->name, metric->sum);
+	fprintf(fp, "%s_count %" PRIu64 "\n", metric->name, metric->count);
+}
+
+/*
+ * Return all metrics in the Prometheus text exposition format. The string
+ * has to be freed by the caller.
+ */
+char *metrics_format(void)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp)
+		return NULL;
+
+	metrics_foreach(format_metric, fp);
+
+	if (fclose(fp)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+void metrics_cleanup(void)
+{
+	queue_destroy(metrics, free);
+	metrics = NULL;
+}
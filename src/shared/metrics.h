@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define METRICS_BUCKETS	16
+
+enum metrics_type {
+	METRICS_COUNTER,
+	METRICS_GAUGE,
+	METRICS_HISTOGRAM,
+};
+
+struct metric {
+	const char *name;
+	const char *help;
+	enum metrics_type type;
+	int64_t value;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t bounds[METRICS_BUCKETS];
+	uint64_t buckets[METRICS_BUCKETS + 1];
+};
+
+typedef void (*metrics_func_t)(const struct metric *metric, void *user_data);
+
+struct metric *metrics_counter(const char *name, const char *help);
+struct metric *metrics_gauge(const char *name, const char *help);
+struct metric *metrics_histogram(const char *name, const char *help,
+							uint64_t first_bound);
+
+void metrics_add(struct metric *metric, uint64_t value);
+void metrics_set(struct metric *metric, int64_t value);
+void metrics_observe(struct metric *metric, uint64_t value);
+uint64_t metrics_now(void);
+
+static inline void metrics_inc(struct metric *metric)
+{
+	metrics_add(metric, 1);
+}
+
+void metrics_foreach(metrics_func_t func, void *user_data);
+char *metrics_format(void);
+void metrics_cleanup(void);
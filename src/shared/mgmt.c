@@ -23,9 +23,11 @@
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/util.h"
 #include "src/shared/mgmt.h"
 #include "src/shared/timeout.h"
+#include "src/shared/metrics.h"
 
 #define DBG(_mgmt, _format, arg...) \
 	mgmt_log(_mgmt, "%s:%s() " _format, __FILE__, __func__, ## arg)
@@ -36,10 +38,13 @@ struct mgmt {
 	bool close_on_unref;
 	struct io *io;
 	bool writer_active;
+	unsigned int pipeline;
 	struct queue *request_queue;
 	struct queue *reply_queue;
 	struct queue *pending_list;
+	struct hashmap *request_map;
 	struct queue *notify_list;
+	struct hashmap *notify_map;
 	unsigned int next_request_id;
 	unsigned int next_notify_id;
 	bool need_notify_cleanup;
@@ -50,6 +55,10 @@ struct mgmt {
 	mgmt_debug_func_t debug_callback;
 	mgmt_destroy_func_t debug_destroy;
 	void *debug_data;
+	struct metric *commands;
+	struct metric *failures;
+	struct metric *pending;
+	struct metric *rtt;
 };
 
 struct mgmt_request {
@@ -64,6 +73,7 @@ struct mgmt_request {
 	void *user_data;
 	int timeout;
 	unsigned int timeout_id;
+	uint64_t sent;
 };
 
 struct mgmt_notify {
@@ -84,6 +94,10 @@ struct mgmt_tlv_list {
 static void destroy_request(void *data)
 {
 	struct mgmt_request *request = data;
+	struct hashmap *map = request->mgmt->request_map;
+
+	if (hashmap_lookup(map, request->id) == request)
+		hashmap_remove(map, request->id);
 
 	if (request->destroy)
 		request->destroy(request->user_data);
@@ -95,14 +109,6 @@ static void destroy_request(void *data)
 	free(request);
 }
 
-static bool match_request_id(const void *a, const void *b)
-{
-	const struct mgmt_request *request = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return request->id == id;
-}
-
 static bool match_request_index(const void *a, const void *b)
 {
 	const struct mgmt_request *request = a;
@@ -121,6 +127,63 @@ static void destroy_notify(void *data)
 	free(notify);
 }
 
+/*
+ * Registrations are also kept in per (event, index) queues so incoming events
+ * are only dispatched to the handlers they can match.
+ */
+static unsigned int notify_key(uint16_t event, uint16_t index)
+{
+	return (unsigned int) event << 16 | index;
+}
+
+static void notify_map_add(struct mgmt *mgmt, struct mgmt_notify *notify)
+{
+	unsigned int key = notify_key(notify->event, notify->index);
+	struct queue *queue;
+
+	queue = hashmap_lookup(mgmt->notify_map, key);
+	if (!queue) {
+		queue = queue_new();
+		hashmap_insert(mgmt->notify_map, key, queue);
+	}
+
+	queue_push_tail(queue, notify);
+}
+
+static void notify_map_remove(struct mgmt *mgmt, struct mgmt_notify *notify)
+{
+	unsigned int key = notify_key(notify->event, notify->index);
+	struct queue *queue;
+
+	queue = hashmap_lookup(mgmt->notify_map, key);
+	if (!queue)
+		return;
+
+	queue_remove(queue, notify);
+
+	if (queue_isempty(queue)) {
+		hashmap_remove(mgmt->notify_map, key);
+		queue_destroy(queue, NULL);
+	}
+}
+
+static void destroy_notify_queue(void *data)
+{
+	queue_destroy(data, NULL);
+}
+
+static void remove_notify_if(struct mgmt *mgmt, queue_match_func_t function,
+							const void *match_data)
+{
+	struct mgmt_notify *notify;
+
+	while ((notify = queue_remove_if(mgmt->notify_list, function,
+						(void *) match_data))) {
+		notify_map_remove(mgmt, notify);
+		destroy_notify(notify);
+	}
+}
+
 static bool match_notify_id(const void *a, const void *b)
 {
 	const struct mgmt_notify *notify = a;
@@ -171,6 +234,10 @@ static bool request_timeout(void *data)
 
 	queue_remove_if(request->mgmt->pending_list, NULL, request);
 
+	metrics_inc(request->mgmt->failures);
+	metrics_set(request->mgmt->pending,
+			queue_length(request->mgmt->pending_list));
+
 	if (request->callback)
 		request->callback(MGMT_STATUS_TIMEOUT, 0, NULL,
 						request->user_data);
@@ -219,11 +286,24 @@ static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 
 	DBG(mgmt, "[0x%04x] command 0x%04x", request->index, request->opcode);
 
+	request->sent = metrics_now();
 	queue_push_tail(mgmt->pending_list, request);
 
+	metrics_inc(mgmt->commands);
+	metrics_set(mgmt->pending, queue_length(mgmt->pending_list));
+
 	return true;
 }
 
+static bool request_slot_free(struct mgmt *mgmt)
+{
+	/* without pipelining only one command is in flight at a time */
+	if (!mgmt->pipeline)
+		return queue_isempty(mgmt->pending_list);
+
+	return queue_length(mgmt->pending_list) < mgmt->pipeline;
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct mgmt *mgmt = user_data;
@@ -233,19 +313,24 @@ static bool can_write_data(struct io *io, void *user_data)
 	request = queue_pop_head(mgmt->reply_queue);
 	if (!request) {
 		/* only reply commands can jump the queue */
-		if (!queue_isempty(mgmt->pending_list))
+		if (!request_slot_free(mgmt))
 			return false;
 
 		request = queue_pop_head(mgmt->request_queue);
 		if (!request)
 			return false;
 
-		can_write = false;
-	} else {
-		/* allow multiple replies to jump the queue */
-		can_write = !queue_isempty(mgmt->reply_queue);
+		if (!send_request(mgmt, request))
+			return true;
+
+		/* keep sending while pipeline slots are available */
+		return request_slot_free(mgmt) &&
+					!queue_isempty(mgmt->request_queue);
 	}
 
+	/* allow multiple replies to jump the queue */
+	can_write = !queue_isempty(mgmt->reply_queue);
+
 	if (!send_request(mgmt, request))
 		return true;
 
@@ -254,7 +339,7 @@ static bool can_write_data(struct io *io, void *user_data)
 
 static void wakeup_writer(struct mgmt *mgmt)
 {
-	if (!queue_isempty(mgmt->pending_list)) {
+	if (!request_slot_free(mgmt)) {
 		/* only queued reply commands trigger wakeup */
 		if (queue_isempty(mgmt->reply_queue))
 			return;
@@ -302,6 +387,12 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 	}
 
 	if (request) {
+		metrics_observe(mgmt->rtt, metrics_now() - request->sent);
+		metrics_set(mgmt->pending, queue_length(mgmt->pending_list));
+
+		if (status)
+			metrics_inc(mgmt->failures);
+
 		if (request->callback)
 			request->callback(status, length, param,
 							request->user_data);
@@ -319,40 +410,68 @@ struct event_index {
 	const void *param;
 };
 
-static void notify_handler(void *data, void *user_data)
+static void notify_handler(struct mgmt_notify *notify,
+						struct event_index *match)
 {
-	struct mgmt_notify *notify = data;
-	struct event_index *match = user_data;
-
 	if (notify->removed)
 		return;
 
-	if (notify->event != match->event)
-		return;
-
-	if (notify->index != match->index && notify->index != MGMT_INDEX_NONE)
-		return;
-
 	if (notify->callback)
 		notify->callback(match->index, match->length, match->param,
 							notify->user_data);
 }
 
+static unsigned int entry_id(const struct queue_entry *entry)
+{
+	const struct mgmt_notify *notify = entry->data;
+
+	return notify->id;
+}
+
+static const struct queue_entry *notify_entries(struct mgmt *mgmt,
+						uint16_t event, uint16_t index)
+{
+	struct queue *queue;
+
+	queue = hashmap_lookup(mgmt->notify_map, notify_key(event, index));
+
+	return queue_get_entries(queue);
+}
+
 static void process_notify(struct mgmt *mgmt, uint16_t event, uint16_t index,
 					uint16_t length, const void *param)
 {
 	struct event_index match = { .event = event, .index = index,
 					.length = length, .param = param };
+	const struct queue_entry *entry, *any = NULL;
+
+	entry = notify_entries(mgmt, event, index);
+	if (index != MGMT_INDEX_NONE)
+		any = notify_entries(mgmt, event, MGMT_INDEX_NONE);
 
 	mgmt->in_notify = true;
 
-	queue_foreach(mgmt->notify_list, notify_handler, &match);
+	/*
+	 * Handlers for this index and for any index are called in the order
+	 * they were registered in. Entries are not freed while dispatching
+	 * since unregistering only marks them as removed.
+	 */
+	while (entry || any) {
+		const struct queue_entry **next;
+
+		if (!any || (entry && entry_id(entry) < entry_id(any)))
+			next = &entry;
+		else
+			next = &any;
+
+		notify_handler((*next)->data, &match);
+		*next = (*next)->next;
+	}
 
 	mgmt->in_notify = false;
 
 	if (mgmt->need_notify_cleanup) {
-		queue_remove_all(mgmt->notify_list, match_notify_removed,
-							NULL, destroy_notify);
+		remove_notify_if(mgmt, match_notify_removed, NULL);
 		mgmt->need_notify_cleanup = false;
 	}
 }
@@ -470,10 +589,24 @@ struct mgmt *mgmt_new(int fd)
 	mgmt->request_queue = queue_new();
 	mgmt->reply_queue = queue_new();
 	mgmt->pending_list = queue_new();
+	mgmt->request_map = hashmap_new();
 	mgmt->notify_list = queue_new();
+	mgmt->notify_map = hashmap_new();
+
+	mgmt->commands = metrics_counter("mgmt_commands_total",
+					"Management commands sent");
+	mgmt->failures = metrics_counter("mgmt_command_failures_total",
+					"Management commands that failed");
+	mgmt->pending = metrics_gauge("mgmt_pending_commands",
+					"Management commands awaiting a reply");
+	mgmt->rtt = metrics_histogram("mgmt_command_rtt_usec",
+					"Management command round trip time",
+					100);
 
 	if (!io_set_read_handler(mgmt->io, can_read_data, mgmt, NULL)) {
+		hashmap_destroy(mgmt->notify_map, NULL);
 		queue_destroy(mgmt->notify_list, NULL);
+		hashmap_destroy(mgmt->request_map, NULL);
 		queue_destroy(mgmt->pending_list, NULL);
 		queue_destroy(mgmt->reply_queue, NULL);
 		queue_destroy(mgmt->request_queue, NULL);
@@ -565,8 +698,10 @@ void mgmt_unref(struct mgmt *mgmt)
 	mgmt->buf = NULL;
 
 	if (!mgmt->in_notify) {
+		hashmap_destroy(mgmt->notify_map, NULL);
 		queue_destroy(mgmt->notify_list, NULL);
 		queue_destroy(mgmt->pending_list, NULL);
+		hashmap_destroy(mgmt->request_map, NULL);
 		free(mgmt);
 		return;
 	}
@@ -588,6 +723,19 @@ bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 	return true;
 }
 
+bool mgmt_set_pipeline(struct mgmt *mgmt, unsigned int depth)
+{
+	if (!mgmt)
+		return false;
+
+	mgmt->pipeline = depth;
+
+	/* A deeper pipeline may allow queued commands to go out now */
+	wakeup_writer(mgmt);
+
+	return true;
+}
+
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 {
 	if (!mgmt)
@@ -797,8 +945,10 @@ unsigned int mgmt_send_timeout(struct mgmt *mgmt, uint16_t opcode,
 		mgmt->next_request_id = 1;
 
 	request->id = mgmt->next_request_id++;
+	hashmap_insert(mgmt->request_map, request->id, request);
 
 	if (!queue_push_tail(mgmt->request_queue, request)) {
+		hashmap_remove(mgmt->request_map, request->id);
 		free(request->buf);
 		free(request);
 		return 0;
@@ -838,6 +988,7 @@ unsigned int mgmt_send_nowait(struct mgmt *mgmt, uint16_t opcode, uint16_t index
 		mgmt->next_request_id = 1;
 
 	request->id = mgmt->next_request_id++;
+	hashmap_insert(mgmt->request_map, request->id, request);
 
 	if (!send_request(mgmt, request))
 		return 0;
@@ -865,8 +1016,10 @@ unsigned int mgmt_reply_timeout(struct mgmt *mgmt, uint16_t opcode,
 		mgmt->next_request_id = 1;
 
 	request->id = mgmt->next_request_id++;
+	hashmap_insert(mgmt->request_map, request->id, request);
 
 	if (!queue_push_tail(mgmt->reply_queue, request)) {
+		hashmap_remove(mgmt->request_map, request->id);
 		free(request->buf);
 		free(request);
 		return 0;
@@ -893,22 +1046,16 @@ bool mgmt_cancel(struct mgmt *mgmt, unsigned int id)
 	if (!mgmt || !id)
 		return false;
 
-	request = queue_remove_if(mgmt->request_queue, match_request_id,
-							UINT_TO_PTR(id));
-	if (request)
-		goto done;
-
-	request = queue_remove_if(mgmt->reply_queue, match_request_id,
-							UINT_TO_PTR(id));
-	if (request)
-		goto done;
-
-	request = queue_remove_if(mgmt->pending_list, match_request_id,
-							UINT_TO_PTR(id));
+	request = hashmap_lookup(mgmt->request_map, id);
 	if (!request)
 		return false;
 
-done:
+	/* Requests being completed are no longer on any of the queues */
+	if (!queue_remove(mgmt->request_queue, request) &&
+			!queue_remove(mgmt->reply_queue, request) &&
+			!queue_remove(mgmt->pending_list, request))
+		return false;
+
 	destroy_request(request);
 
 	wakeup_writer(mgmt);
@@ -970,6 +1117,8 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 		return 0;
 	}
 
+	notify_map_add(mgmt, notify);
+
 	return notify->id;
 }
 
@@ -980,16 +1129,23 @@ bool mgmt_unregister(struct mgmt *mgmt, unsigned int id)
 	if (!mgmt || !id)
 		return false;
 
-	notify = queue_remove_if(mgmt->notify_list, match_notify_id,
+	if (!mgmt->in_notify) {
+		notify = queue_remove_if(mgmt->notify_list, match_notify_id,
 							UINT_TO_PTR(id));
-	if (!notify)
-		return false;
+		if (!notify)
+			return false;
 
-	if (!mgmt->in_notify) {
+		notify_map_remove(mgmt, notify);
 		destroy_notify(notify);
 		return true;
 	}
 
+	/* Removal is deferred until the dispatch loop is done */
+	notify = queue_find(mgmt->notify_list, match_notify_id,
+							UINT_TO_PTR(id));
+	if (!notify || notify->removed)
+		return false;
+
 	notify->removed = true;
 	mgmt->need_notify_cleanup = true;
 
@@ -1006,8 +1162,7 @@ bool mgmt_unregister_index(struct mgmt *mgmt, uint16_t index)
 							UINT_TO_PTR(index));
 		mgmt->need_notify_cleanup = true;
 	} else
-		queue_remove_all(mgmt->notify_list, match_notify_index,
-					UINT_TO_PTR(index), destroy_notify);
+		remove_notify_if(mgmt, match_notify_index, UINT_TO_PTR(index));
 
 	return true;
 }
@@ -1021,8 +1176,10 @@ bool mgmt_unregister_all(struct mgmt *mgmt)
 		queue_foreach(mgmt->notify_list, mark_notify_removed,
 						UINT_TO_PTR(MGMT_INDEX_NONE));
 		mgmt->need_notify_cleanup = true;
-	} else
+	} else {
+		hashmap_clear(mgmt->notify_map, destroy_notify_queue);
 		queue_remove_all(mgmt->notify_list, NULL, NULL, destroy_notify);
+	}
 
 	return true;
 }
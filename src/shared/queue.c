@@ -17,11 +17,22 @@
 
 struct queue {
 	int ref_count;
+	bool intrusive;
 	struct queue_entry *head;
 	struct queue_entry *tail;
 	unsigned int entries;
 };
 
+/*
+ * Entries released by any queue are kept on a per-thread freelist and
+ * handed out again by the next push, so steady state traffic through a
+ * queue does not allocate.
+ */
+#define ENTRY_POOL_MAX 256
+
+static __thread struct queue_entry *entry_pool;
+static __thread unsigned int entry_pool_len;
+
 static struct queue *queue_ref(struct queue *queue)
 {
 	if (!queue)
@@ -52,6 +63,16 @@ struct queue *queue_new(void)
 	return queue_ref(queue);
 }
 
+struct queue *queue_new_intrusive(void)
+{
+	struct queue *queue;
+
+	queue = queue_new();
+	queue->intrusive = true;
+
+	return queue;
+}
+
 void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 {
 	if (!queue)
@@ -64,23 +85,38 @@ void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 
 static struct queue_entry *queue_entry_new(void *data)
 {
-	struct queue_entry *entry;
+	struct queue_entry *entry = entry_pool;
+
+	if (entry) {
+		entry_pool = entry->next;
+		entry_pool_len--;
+		entry->next = NULL;
+	} else
+		entry = new0(struct queue_entry, 1);
 
-	entry = new0(struct queue_entry, 1);
 	entry->data = data;
 
 	return entry;
 }
 
-bool queue_push_tail(struct queue *queue, void *data)
+static void queue_entry_free(struct queue *queue, struct queue_entry *entry)
 {
-	struct queue_entry *entry;
+	/* Entries of intrusive queues are owned by the caller */
+	if (queue->intrusive)
+		return;
 
-	if (!queue)
-		return false;
+	if (entry_pool_len >= ENTRY_POOL_MAX) {
+		free(entry);
+		return;
+	}
 
-	entry = queue_entry_new(data);
+	entry->next = entry_pool;
+	entry_pool = entry;
+	entry_pool_len++;
+}
 
+static void push_tail(struct queue *queue, struct queue_entry *entry)
+{
 	if (queue->tail)
 		queue->tail->next = entry;
 
@@ -90,19 +126,20 @@ bool queue_push_tail(struct queue *queue, void *data)
 		queue->head = entry;
 
 	queue->entries++;
-
-	return true;
 }
 
-bool queue_push_head(struct queue *queue, void *data)
+bool queue_push_tail(struct queue *queue, void *data)
 {
-	struct queue_entry *entry;
-
-	if (!queue)
+	if (!queue || queue->intrusive)
 		return false;
 
-	entry = queue_entry_new(data);
+	push_tail(queue, queue_entry_new(data));
 
+	return true;
+}
+
+static void push_head(struct queue *queue, struct queue_entry *entry)
+{
 	entry->next = queue->head;
 
 	queue->head = entry;
@@ -111,6 +148,41 @@ bool queue_push_head(struct queue *queue, void *data)
 		queue->tail = entry;
 
 	queue->entries++;
+}
+
+bool queue_push_head(struct queue *queue, void *data)
+{
+	if (!queue || queue->intrusive)
+		return false;
+
+	push_head(queue, queue_entry_new(data));
+
+	return true;
+}
+
+bool queue_push_tail_entry(struct queue *queue, struct queue_entry *entry,
+								void *data)
+{
+	if (!queue || !queue->intrusive || !entry)
+		return false;
+
+	entry->data = data;
+	entry->next = NULL;
+
+	push_tail(queue, entry);
+
+	return true;
+}
+
+bool queue_push_head_entry(struct queue *queue, struct queue_entry *entry,
+								void *data)
+{
+	if (!queue || !queue->intrusive || !entry)
+		return false;
+
+	entry->data = data;
+
+	push_head(queue, entry);
 
 	return true;
 }
@@ -121,7 +193,7 @@ bool queue_push_after(struct queue *queue, void *entry, void *data)
 
 	qentry = NULL;
 
-	if (!queue)
+	if (!queue || queue->intrusive)
 		return false;
 
 	for (tmp = queue->head; tmp; tmp = tmp->next) {
@@ -165,7 +237,7 @@ void *queue_pop_head(struct queue *queue)
 
 	data = entry->data;
 
-	free(entry);
+	queue_entry_free(queue, entry);
 	queue->entries--;
 
 	return data;
@@ -253,7 +325,7 @@ bool queue_remove(struct queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		free(entry);
+		queue_entry_free(queue, entry);
 		queue->entries--;
 
 		return true;
@@ -289,7 +361,7 @@ void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 
 			data = entry->data;
 
-			free(entry);
+			queue_entry_free(queue, entry);
 			queue->entries--;
 
 			return data;
@@ -340,7 +412,7 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 			if (destroy)
 				destroy(tmp->data);
 
-			free(tmp);
+			queue_entry_free(queue, tmp);
 			count++;
 		}
 	}
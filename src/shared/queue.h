@@ -22,6 +22,17 @@ struct queue_entry {
 struct queue *queue_new(void);
 void queue_destroy(struct queue *queue, queue_destroy_func_t destroy);
 
+/*
+ * Intrusive queues link entries embedded in the queued objects instead of
+ * allocating them, so they only accept the *_entry push variants and an
+ * entry must stay valid until it has been removed from the queue.
+ */
+struct queue *queue_new_intrusive(void);
+bool queue_push_tail_entry(struct queue *queue, struct queue_entry *entry,
+								void *data);
+bool queue_push_head_entry(struct queue *queue, struct queue_entry *entry,
+								void *data);
+
 bool queue_push_tail(struct queue *queue, void *data);
 bool queue_push_head(struct queue *queue, void *data);
 bool queue_push_after(struct queue *queue, void *entry, void *data);
@@ -15,8 +15,11 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
 
 #include "src/shared/util.h"
 #include "src/shared/ringbuf.h"
@@ -25,11 +28,16 @@
 #define MIN(x,y) ((x)<(y)?(x):(y))
 #endif
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 struct ringbuf {
 	void *buffer;
 	size_t size;
 	size_t in;
 	size_t out;
+	bool mirrored;
 	ringbuf_tracing_func_t in_tracing;
 	void *in_data;
 };
@@ -73,12 +81,88 @@ struct ringbuf *ringbuf_new(size_t size)
 	return ringbuf;
 }
 
+static void *mirror_map(size_t size)
+{
+	void *addr;
+	int fd;
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "ringbuf", MFD_CLOEXEC);
+#else
+	fd = -1;
+#endif
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, size) < 0)
+		goto failed;
+
+	/* Reserve both halves first so the second mapping can't collide */
+	addr = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+								-1, 0);
+	if (addr == MAP_FAILED)
+		goto failed;
+
+	if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+						fd, 0) == MAP_FAILED)
+		goto unmap;
+
+	if (mmap(addr + size, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+		goto unmap;
+
+	close(fd);
+
+	return addr;
+
+unmap:
+	munmap(addr, size * 2);
+failed:
+	close(fd);
+	return NULL;
+}
+
+struct ringbuf *ringbuf_new_mirrored(size_t size)
+{
+	struct ringbuf *ringbuf;
+	size_t real_size;
+	long page_size;
+
+	if (size < 2 || size > UINT_MAX)
+		return NULL;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size > 0 && size < (size_t) page_size)
+		size = page_size;
+
+	/* Page size is a power of two so this is a multiple of it */
+	real_size = align_power2(size);
+
+	ringbuf = new0(struct ringbuf, 1);
+	ringbuf->buffer = mirror_map(real_size);
+	if (!ringbuf->buffer) {
+		free(ringbuf);
+		return ringbuf_new(size);
+	}
+
+	ringbuf->size = real_size;
+	ringbuf->in = RINGBUF_RESET;
+	ringbuf->out = RINGBUF_RESET;
+	ringbuf->mirrored = true;
+
+	return ringbuf;
+}
+
 void ringbuf_free(struct ringbuf *ringbuf)
 {
 	if (!ringbuf)
 		return;
 
-	free(ringbuf->buffer);
+	if (ringbuf->mirrored)
+		munmap(ringbuf->buffer, ringbuf->size * 2);
+	else
+		free(ringbuf->buffer);
+
 	free(ringbuf);
 }
 
@@ -131,17 +215,32 @@ size_t ringbuf_drain(struct ringbuf *ringbuf, size_t count)
 	return len;
 }
 
+/*
+ * Number of bytes that can be accessed from offset without wrapping, with
+ * the buffer mapped twice back to back the whole length always can.
+ */
+static size_t contiguous_len(struct ringbuf *ringbuf, size_t offset,
+								size_t len)
+{
+	if (ringbuf->mirrored)
+		return len;
+
+	return MIN(len, ringbuf->size - offset);
+}
+
 void *ringbuf_peek(struct ringbuf *ringbuf, size_t offset, size_t *len_nowrap)
 {
 	if (!ringbuf)
 		return NULL;
 
-	offset = (ringbuf->out + offset) & (ringbuf->size - 1);
-
 	if (len_nowrap) {
 		size_t len = ringbuf->in - ringbuf->out;
-		*len_nowrap = MIN(len, ringbuf->size - offset);
-	}
+
+		len = offset < len ? len - offset : 0;
+		offset = (ringbuf->out + offset) & (ringbuf->size - 1);
+		*len_nowrap = contiguous_len(ringbuf, offset, len);
+	} else
+		offset = (ringbuf->out + offset) & (ringbuf->size - 1);
 
 	return ringbuf->buffer + offset;
 }
@@ -162,7 +261,7 @@ ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd)
 
 	/* Grab data from buffer starting at offset until the end */
 	offset = ringbuf->out & (ringbuf->size - 1);
-	end = MIN(len, ringbuf->size - offset);
+	end = contiguous_len(ringbuf, offset, len);
 
 	iov[0].iov_base = ringbuf->buffer + offset;
 	iov[0].iov_len = end;
@@ -230,7 +329,7 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 
 	/* Determine possible length of string before wrapping */
 	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN((size_t) len, ringbuf->size - offset);
+	end = contiguous_len(ringbuf, offset, len);
 	memcpy(ringbuf->buffer + offset, str, end);
 
 	if (ringbuf->in_tracing)
@@ -269,7 +368,7 @@ ssize_t ringbuf_read(struct ringbuf *ringbuf, int fd)
 
 	/* Determine how much to consume before wrapping */
 	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN(avail, ringbuf->size - offset);
+	end = contiguous_len(ringbuf, offset, avail);
 
 	iov[0].iov_base = ringbuf->buffer + offset;
 	iov[0].iov_len = end;
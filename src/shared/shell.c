@@ -15,6 +15,8 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
+#include <time.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -85,6 +87,28 @@ static struct {
 	struct queue *envs;
 } data;
 
+/* Seconds a batch barrier waits for outstanding commands by default */
+#define BATCH_TIMEOUT	10
+
+struct batch_cmd {
+	char *input;
+	unsigned int line;
+	struct timespec start;
+	bool done;
+	int status;
+};
+
+static struct {
+	FILE *fp;
+	unsigned int line;
+	struct queue *pending;
+	struct batch_cmd *current;
+	unsigned int wait_id;
+	bool waiting;
+	bool eof;
+	int status;
+} batch;
+
 static void shell_print_menu(void);
 static void shell_print_menu_zsh_complete(void);
 
@@ -1023,10 +1047,197 @@ static void rl_init(void)
 	rl_init_history();
 }
 
+static void batch_cmd_free(void *data)
+{
+	struct batch_cmd *cmd = data;
+
+	free(cmd->input);
+	free(cmd);
+}
+
+static void batch_finish(struct batch_cmd *cmd, const char *result)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - cmd->start.tv_sec) * 1000 +
+				(now.tv_nsec - cmd->start.tv_nsec) / 1000000;
+
+	printf("[batch:%u] %s: %s (%ld ms)\n", cmd->line, cmd->input,
+							result, ms);
+
+	batch_cmd_free(cmd);
+}
+
+static void batch_complete(struct batch_cmd *cmd, int status)
+{
+	if (status != EXIT_SUCCESS)
+		batch.status = EXIT_FAILURE;
+
+	batch_finish(cmd, status == EXIT_SUCCESS ? "done" : "failed");
+}
+
+static void batch_run(void);
+
+static bool batch_resume(void *user_data)
+{
+	batch_run();
+
+	return false;
+}
+
+static void batch_release(void)
+{
+	batch.waiting = false;
+
+	if (batch.wait_id) {
+		timeout_remove(batch.wait_id);
+		batch.wait_id = 0;
+	}
+
+	if (batch.eof) {
+		bt_shell_quit(batch.status);
+		return;
+	}
+
+	/* Continue outside of the completion callback */
+	timeout_add(1, batch_resume, NULL, NULL);
+}
+
+static bool batch_wait_expired(void *user_data)
+{
+	struct batch_cmd *cmd;
+
+	batch.wait_id = 0;
+
+	while ((cmd = queue_pop_head(batch.pending)))
+		batch_finish(cmd, "pending");
+
+	batch_release();
+
+	return false;
+}
+
+static void batch_wait(unsigned int seconds)
+{
+	if (!seconds)
+		seconds = data.timeout ? data.timeout : BATCH_TIMEOUT;
+
+	batch.waiting = true;
+	batch.wait_id = timeout_add(seconds * 1000, batch_wait_expired,
+								NULL, NULL);
+}
+
+/*
+ * Commands report completion through bt_shell_noninteractive_quit(). A
+ * command completing while it is being executed is matched directly,
+ * completions arriving later are matched to the oldest outstanding one.
+ */
+static void batch_quit(int status)
+{
+	struct batch_cmd *cmd;
+
+	if (batch.current) {
+		batch.current->done = true;
+		batch.current->status = status;
+		return;
+	}
+
+	cmd = queue_pop_head(batch.pending);
+	if (!cmd)
+		return;
+
+	batch_complete(cmd, status);
+
+	if (batch.waiting && queue_isempty(batch.pending))
+		batch_release();
+}
+
+static void batch_exec(const char *input)
+{
+	struct batch_cmd *cmd;
+	int err;
+
+	cmd = new0(struct batch_cmd, 1);
+	cmd->input = strdup(input);
+	cmd->line = batch.line;
+	clock_gettime(CLOCK_MONOTONIC, &cmd->start);
+
+	batch.current = cmd;
+	err = bt_shell_exec(input);
+	batch.current = NULL;
+
+	if (err < 0) {
+		batch_complete(cmd, EXIT_FAILURE);
+		return;
+	}
+
+	if (cmd->done) {
+		batch_complete(cmd, cmd->status);
+		return;
+	}
+
+	queue_push_tail(batch.pending, cmd);
+}
+
+/*
+ * Execute commands from the batch file without waiting for them to
+ * complete, until a "wait [seconds]" barrier or the end of the file is
+ * reached.
+ */
+static void batch_run(void)
+{
+	char *line = NULL, *str;
+	size_t len = 0;
+	ssize_t n;
+
+	while ((n = getline(&line, &len, batch.fp)) >= 0) {
+		batch.line++;
+
+		while (n > 0 && isspace((unsigned char) line[n - 1]))
+			line[--n] = '\0';
+
+		for (str = line; isspace((unsigned char) *str); str++)
+			;
+
+		if (*str == '\0' || *str == '#')
+			continue;
+
+		if (!strncmp(str, "wait", 4) &&
+				(!str[4] || isspace((unsigned char) str[4]))) {
+			if (queue_isempty(batch.pending))
+				continue;
+
+			batch_wait(atoi(str + 4));
+			free(line);
+			return;
+		}
+
+		if (data.monitor)
+			bt_log_printf(0xffff, data.name, LOG_INFO, "%s", str);
+
+		batch_exec(str);
+	}
+
+	free(line);
+
+	batch.eof = true;
+
+	/* Outstanding commands are waited for before exiting */
+	if (!queue_isempty(batch.pending)) {
+		batch_wait(0);
+		return;
+	}
+
+	bt_shell_quit(batch.status);
+}
+
 static const struct option main_options[] = {
 	{ "version",	no_argument, 0, 'v' },
 	{ "help",	no_argument, 0, 'h' },
 	{ "timeout",	required_argument, 0, 't' },
+	{ "batch",	required_argument, 0, 'b' },
 	{ "monitor",	no_argument, 0, 'm' },
 	{ "zsh-complete",	no_argument, 0, 'z' },
 };
@@ -1046,6 +1257,8 @@ static void usage(int argc, char **argv, const struct bt_shell_opt *opt)
 
 	printf("\t--monitor \tEnable monitor output\n"
 		"\t--timeout \tTimeout in seconds for non-interactive mode\n"
+		"\t--batch \tExecute commands from file, \"wait\" lines\n"
+		"\t\t\twait for the commands issued before them\n"
 		"\t--version \tDisplay version\n"
 		"\t--help \t\tDisplay help\n");
 }
@@ -1064,9 +1277,9 @@ void bt_shell_init(int argc, char **argv, const struct bt_shell_opt *opt)
 	if (opt) {
 		memcpy(options + offset, opt->options,
 				sizeof(struct option) * opt->optno);
-		snprintf(optstr, sizeof(optstr), "+mhvt:%s", opt->optstr);
+		snprintf(optstr, sizeof(optstr), "+mhvt:b:%s", opt->optstr);
 	} else
-		snprintf(optstr, sizeof(optstr), "+mhvt:");
+		snprintf(optstr, sizeof(optstr), "+mhvt:b:");
 
 	data.name = strrchr(argv[0], '/');
 	if (!data.name)
@@ -1089,6 +1302,14 @@ void bt_shell_init(int argc, char **argv, const struct bt_shell_opt *opt)
 		case 't':
 			data.timeout = atoi(optarg);
 			break;
+		case 'b':
+			batch.fp = fopen(optarg, "r");
+			if (!batch.fp) {
+				printf("Unable to open %s: %s\n", optarg,
+							strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'z':
 			data.zsh = 1;
 			break;
@@ -1124,7 +1345,7 @@ void bt_shell_init(int argc, char **argv, const struct bt_shell_opt *opt)
 	data.argc = argc - optind;
 	data.argv = argv + optind;
 	optind = 0;
-	data.mode = (data.argc > 0);
+	data.mode = (data.argc > 0 || batch.fp);
 
 done:
 	if (data.mode)
@@ -1210,6 +1431,13 @@ void bt_shell_cleanup(void)
 	queue_destroy(data.prompts, prompt_free);
 	data.prompts = NULL;
 
+	if (batch.fp) {
+		timeout_remove(batch.wait_id);
+		queue_destroy(batch.pending, batch_cmd_free);
+		fclose(batch.fp);
+		memset(&batch, 0, sizeof(batch));
+	}
+
 	data.init = false;
 	free(data.name);
 }
@@ -1224,6 +1452,11 @@ void bt_shell_quit(int status)
 
 void bt_shell_noninteractive_quit(int status)
 {
+	if (batch.fp) {
+		batch_quit(status);
+		return;
+	}
+
 	if (!data.mode || data.timeout)
 		return;
 
@@ -1298,6 +1531,12 @@ bool bt_shell_attach(int fd)
 
 	data.input = io;
 
+	if (batch.fp) {
+		batch.pending = queue_new();
+		batch_run();
+		return true;
+	}
+
 	if (data.mode) {
 		if (shell_exec(data.argc, data.argv) < 0) {
 			bt_shell_noninteractive_quit(EXIT_FAILURE);
@@ -108,6 +108,8 @@ static gboolean option_monitor = FALSE;
 static gboolean option_list = FALSE;
 static const char *option_prefix = NULL;
 static const char *option_string = NULL;
+static gboolean option_virtual_time = FALSE;
+static gboolean option_reuse = FALSE;
 
 struct monitor_hdr {
 	uint16_t opcode;
@@ -805,6 +807,11 @@ bool tester_use_debug(void)
 	return option_debug == TRUE ? true : false;
 }
 
+bool tester_use_reuse(void)
+{
+	return option_reuse == TRUE ? true : false;
+}
+
 static GOptionEntry options[] = {
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
 				"Show version information and exit" },
@@ -820,6 +827,10 @@ static GOptionEntry options[] = {
 				"Run tests matching provided prefix" },
 	{ "string", 's', 0, G_OPTION_ARG_STRING, &option_string,
 				"Run tests matching provided string" },
+	{ "virtual-time", 't', 0, G_OPTION_ARG_NONE, &option_virtual_time,
+				"Skip ahead timeouts when idle" },
+	{ "reuse", 'r', 0, G_OPTION_ARG_NONE, &option_reuse,
+				"Reuse emulated controllers between tests" },
 	{ NULL },
 };
 
@@ -849,6 +860,11 @@ void tester_init(int *argc, char ***argv)
 
 	mainloop_init();
 
+	if (option_virtual_time && !timeout_set_virtual(true)) {
+		g_printerr("Virtual time not supported\n");
+		exit(EXIT_FAILURE);
+	}
+
 	tester_name = strrchr(*argv[0], '/');
 	if (!tester_name)
 		tester_name = strdup(*argv[0]);
@@ -17,6 +17,7 @@ int tester_run(void);
 
 bool tester_use_quiet(void);
 bool tester_use_debug(void);
+bool tester_use_reuse(void);
 
 void tester_print(const char *format, ...)
 				__attribute__((format(printf, 1, 2)));
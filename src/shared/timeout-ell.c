@@ -107,3 +107,8 @@ unsigned int timeout_add_seconds(unsigned int timeout, timeout_func_t func,
 {
 	return timeout_add(timeout * 1000, func, user_data, destroy);
 }
+
+bool timeout_set_virtual(bool enable)
+{
+	return !enable;
+}
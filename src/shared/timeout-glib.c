@@ -18,6 +18,128 @@ struct timeout_data {
 	void *user_data;
 };
 
+/*
+ * With virtual time the clock of the timeouts is the monotonic clock plus
+ * a skew. Whenever the main loop has been idle for VIRTUAL_IDLE_MS the
+ * clock jumps ahead to the earliest timeout, so timeouts fire in the same
+ * order as with real time but without waiting for them.
+ */
+#define VIRTUAL_IDLE_MS 5
+
+struct virtual_source {
+	GSource source;
+	gint64 deadline;
+	gint64 prepared;
+	guint interval;
+};
+
+static bool virtual_time;
+static gint64 virtual_skew;
+static GSList *virtual_sources;
+
+static gint64 virtual_now(void)
+{
+	return g_get_monotonic_time() + virtual_skew;
+}
+
+static gboolean virtual_prepare(GSource *source, gint *timeout)
+{
+	struct virtual_source *vs = (struct virtual_source *) source;
+	gint64 remaining;
+
+	vs->prepared = g_get_monotonic_time();
+
+	remaining = vs->deadline - virtual_now();
+	if (remaining <= 0) {
+		*timeout = 0;
+		return TRUE;
+	}
+
+	*timeout = MIN((remaining + 999) / 1000, VIRTUAL_IDLE_MS);
+
+	return FALSE;
+}
+
+static gboolean virtual_check(GSource *source)
+{
+	struct virtual_source *vs = (struct virtual_source *) source;
+	GSList *l;
+
+	if (vs->deadline <= virtual_now())
+		return TRUE;
+
+	/* Only jump ahead if nothing happened while polling */
+	if (g_get_monotonic_time() - vs->prepared < VIRTUAL_IDLE_MS * 1000)
+		return FALSE;
+
+	for (l = virtual_sources; l; l = l->next) {
+		struct virtual_source *other = l->data;
+
+		if (g_source_is_destroyed(&other->source))
+			continue;
+
+		if (other->deadline < vs->deadline)
+			return FALSE;
+	}
+
+	virtual_skew += vs->deadline - virtual_now();
+
+	return TRUE;
+}
+
+static gboolean virtual_dispatch(GSource *source, GSourceFunc callback,
+							gpointer user_data)
+{
+	struct virtual_source *vs = (struct virtual_source *) source;
+
+	if (!callback(user_data))
+		return FALSE;
+
+	vs->deadline = virtual_now() + (gint64) vs->interval * 1000;
+
+	return TRUE;
+}
+
+static void virtual_finalize(GSource *source)
+{
+	virtual_sources = g_slist_remove(virtual_sources, source);
+}
+
+static GSourceFuncs virtual_funcs = {
+	.prepare = virtual_prepare,
+	.check = virtual_check,
+	.dispatch = virtual_dispatch,
+	.finalize = virtual_finalize,
+};
+
+static guint virtual_timeout_add(guint interval, GSourceFunc function,
+					gpointer data, GDestroyNotify notify)
+{
+	struct virtual_source *vs;
+	GSource *source;
+	guint id;
+
+	source = g_source_new(&virtual_funcs, sizeof(*vs));
+	vs = (struct virtual_source *) source;
+	vs->interval = interval;
+	vs->deadline = virtual_now() + (gint64) interval * 1000;
+
+	g_source_set_callback(source, function, data, notify);
+	id = g_source_attach(source, NULL);
+	g_source_unref(source);
+
+	virtual_sources = g_slist_append(virtual_sources, vs);
+
+	return id;
+}
+
+bool timeout_set_virtual(bool enable)
+{
+	virtual_time = enable;
+
+	return true;
+}
+
 static gboolean timeout_callback(gpointer user_data)
 {
 	struct timeout_data *data  = user_data;
@@ -52,8 +174,13 @@ unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	id = g_timeout_add_full(G_PRIORITY_DEFAULT, timeout, timeout_callback,
-						data, timeout_destroy);
+	if (virtual_time)
+		id = virtual_timeout_add(timeout, timeout_callback, data,
+							timeout_destroy);
+	else
+		id = g_timeout_add_full(G_PRIORITY_DEFAULT, timeout,
+							timeout_callback, data,
+							timeout_destroy);
 	if (!id)
 		g_free(data);
 
@@ -89,6 +216,9 @@ unsigned int timeout_add_seconds(unsigned int timeout, timeout_func_t func,
 	if (!timeout)
 		id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, timeout_callback,
 							data, timeout_destroy);
+	else if (virtual_time)
+		id = virtual_timeout_add(timeout * 1000, timeout_callback,
+							data, timeout_destroy);
 	else
 		id = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT, timeout,
 							timeout_callback, data,
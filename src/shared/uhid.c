@@ -14,6 +14,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -26,6 +27,10 @@
 
 #define UHID_DEVICE_FILE "/dev/uhid"
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 struct bt_uhid {
 	int ref_count;
 	struct io *io;
@@ -215,6 +220,32 @@ bool bt_uhid_unregister_all(struct bt_uhid *uhid)
 	return true;
 }
 
+/*
+ * The kernel zeroes its copy of the event before reading it, so events
+ * carrying a sized payload only need the used part of it to be written.
+ */
+static size_t uhid_event_len(const struct uhid_event *ev)
+{
+	switch (ev->type) {
+	case UHID_INPUT2:
+		return offsetof(struct uhid_event, u.input2.data) +
+				MIN(ev->u.input2.size, UHID_DATA_MAX);
+	case UHID_CREATE2:
+		return offsetof(struct uhid_event, u.create2.rd_data) +
+				MIN(ev->u.create2.rd_size,
+					HID_MAX_DESCRIPTOR_SIZE);
+	case UHID_GET_REPORT_REPLY:
+		return offsetof(struct uhid_event, u.get_report_reply.data) +
+				MIN(ev->u.get_report_reply.size,
+					UHID_DATA_MAX);
+	case UHID_SET_REPORT_REPLY:
+		return offsetof(struct uhid_event, u.set_report_reply) +
+				sizeof(ev->u.set_report_reply);
+	default:
+		return sizeof(*ev);
+	}
+}
+
 int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
 {
 	ssize_t len;
@@ -224,12 +255,54 @@ int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
 		return -ENOTCONN;
 
 	iov.iov_base = (void *) ev;
-	iov.iov_len = sizeof(*ev);
+	iov.iov_len = uhid_event_len(ev);
 
 	len = io_send(uhid->io, &iov, 1);
 	if (len < 0)
 		return -errno;
 
 	/* uHID kernel driver does not handle partial writes */
-	return len != sizeof(*ev) ? -EIO : 0;
+	return len != (ssize_t) iov.iov_len ? -EIO : 0;
+}
+
+int bt_uhid_input(struct bt_uhid *uhid, uint8_t number, const void *data,
+								size_t size)
+{
+	struct {
+		uint32_t type;
+		uint16_t size;
+	} __attribute__((packed)) hdr;
+	struct iovec iov[3];
+	ssize_t len;
+	int cnt = 0;
+
+	if (!uhid->io)
+		return -ENOTCONN;
+
+	if (size > UHID_DATA_MAX - !!number)
+		size = UHID_DATA_MAX - !!number;
+
+	/*
+	 * The kernel accepts UHID_INPUT2 events as long as the data they
+	 * announce, so only write the used part instead of a whole event.
+	 */
+	hdr.type = UHID_INPUT2;
+	hdr.size = size + !!number;
+
+	iov[cnt].iov_base = &hdr;
+	iov[cnt++].iov_len = sizeof(hdr);
+
+	if (number) {
+		iov[cnt].iov_base = &number;
+		iov[cnt++].iov_len = sizeof(number);
+	}
+
+	iov[cnt].iov_base = (void *) data;
+	iov[cnt++].iov_len = size;
+
+	len = io_send(uhid->io, iov, cnt);
+	if (len < 0)
+		return -errno;
+
+	return len != (ssize_t) (sizeof(hdr) + hdr.size) ? -EIO : 0;
 }
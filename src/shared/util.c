@@ -1152,16 +1152,93 @@ static const struct {
 	{ }
 };
 
+/*
+ * The tables above are grouped by origin rather than sorted, so lookups go
+ * through index arrays that are sorted on first use. Duplicated entries
+ * keep their table order so the first one is still the one returned.
+ */
+static uint16_t uuid16_index[ARRAY_SIZE(uuid16_table) - 1];
+static uint16_t uuid128_index[ARRAY_SIZE(uuid128_table) - 1];
+
+static int uuid16_index_cmp(const void *a, const void *b)
+{
+	uint16_t i1 = *(const uint16_t *) a;
+	uint16_t i2 = *(const uint16_t *) b;
+
+	if (uuid16_table[i1].uuid != uuid16_table[i2].uuid)
+		return uuid16_table[i1].uuid < uuid16_table[i2].uuid ? -1 : 1;
+
+	return i1 < i2 ? -1 : 1;
+}
+
+static int uuid16_key_cmp(const void *key, const void *elem)
+{
+	uint16_t uuid = *(const uint16_t *) key;
+	uint16_t i = *(const uint16_t *) elem;
+
+	if (uuid == uuid16_table[i].uuid)
+		return 0;
+
+	return uuid < uuid16_table[i].uuid ? -1 : 1;
+}
+
+static int uuid128_index_cmp(const void *a, const void *b)
+{
+	uint16_t i1 = *(const uint16_t *) a;
+	uint16_t i2 = *(const uint16_t *) b;
+	int ret;
+
+	ret = strcasecmp(uuid128_table[i1].uuid, uuid128_table[i2].uuid);
+	if (ret)
+		return ret;
+
+	return i1 < i2 ? -1 : 1;
+}
+
+static int uuid128_key_cmp(const void *key, const void *elem)
+{
+	uint16_t i = *(const uint16_t *) elem;
+
+	return strcasecmp(key, uuid128_table[i].uuid);
+}
+
+static void uuid_index_init(void)
+{
+	static bool sorted;
+	uint16_t i;
+
+	if (sorted)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(uuid16_index); i++)
+		uuid16_index[i] = i;
+
+	for (i = 0; i < ARRAY_SIZE(uuid128_index); i++)
+		uuid128_index[i] = i;
+
+	qsort(uuid16_index, ARRAY_SIZE(uuid16_index), sizeof(uint16_t),
+							uuid16_index_cmp);
+	qsort(uuid128_index, ARRAY_SIZE(uuid128_index), sizeof(uint16_t),
+							uuid128_index_cmp);
+
+	sorted = true;
+}
+
 const char *bt_uuid16_to_str(uint16_t uuid)
 {
-	int i;
+	uint16_t *idx;
 
-	for (i = 0; uuid16_table[i].str; i++) {
-		if (uuid16_table[i].uuid == uuid)
-			return uuid16_table[i].str;
-	}
+	uuid_index_init();
 
-	return "Unknown";
+	idx = bsearch(&uuid, uuid16_index, ARRAY_SIZE(uuid16_index),
+					sizeof(uint16_t), uuid16_key_cmp);
+	if (!idx)
+		return "Unknown";
+
+	while (idx > uuid16_index && uuid16_table[idx[-1]].uuid == uuid)
+		idx--;
+
+	return uuid16_table[*idx].str;
 }
 
 const char *bt_uuid32_to_str(uint32_t uuid)
@@ -1186,9 +1263,9 @@ const char *bt_uuid128_to_str(const uint8_t uuid[16])
 
 const char *bt_uuidstr_to_str(const char *uuid)
 {
+	uint16_t *idx;
 	uint32_t val;
 	size_t len;
-	int i;
 
 	if (!uuid)
 		return NULL;
@@ -1211,9 +1288,16 @@ const char *bt_uuidstr_to_str(const char *uuid)
 	if (len != 36)
 		return NULL;
 
-	for (i = 0; uuid128_table[i].str; i++) {
-		if (strcasecmp(uuid128_table[i].uuid, uuid) == 0)
-			return uuid128_table[i].str;
+	uuid_index_init();
+
+	idx = bsearch(uuid, uuid128_index, ARRAY_SIZE(uuid128_index),
+					sizeof(uint16_t), uuid128_key_cmp);
+	if (idx) {
+		while (idx > uuid128_index &&
+			!strcasecmp(uuid128_table[idx[-1]].uuid, uuid))
+			idx--;
+
+		return uuid128_table[*idx].str;
 	}
 
 	if (strncasecmp(uuid + 8, "-0000-1000-8000-00805f9b34fb", 28))
@@ -1289,26 +1373,29 @@ static const struct {
 
 const char *bt_appear_to_str(uint16_t appearance)
 {
-	const char *str = NULL;
-	int i, type = 0;
-
-	for (i = 0; appearance_table[i].str; i++) {
-		if (appearance_table[i].generic) {
-			if (appearance < appearance_table[i].val)
-				break;
-			type = i;
-		}
+	size_t lo = 0, hi = ARRAY_SIZE(appearance_table) - 1;
 
-		if (appearance_table[i].val == appearance) {
-			str = appearance_table[i].str;
-			break;
-		}
+	/* The table is sorted, find the last entry not above appearance */
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (appearance_table[mid].val <= appearance)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	if (!str)
-		str = appearance_table[type].str;
+	if (!lo)
+		return appearance_table[0].str;
+
+	if (appearance_table[--lo].val == appearance)
+		return appearance_table[lo].str;
+
+	/* Fall back to the generic category the value belongs to */
+	while (lo && !appearance_table[lo].generic)
+		lo--;
 
-	return str;
+	return appearance_table[lo].str;
 }
 
 char *strdelimit(char *str, char *del, char c)
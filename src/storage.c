@@ -21,6 +21,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 
@@ -31,10 +33,22 @@
 #include "lib/sdp_lib.h"
 #include "lib/uuid.h"
 
+#include "src/shared/util.h"
+#include "src/shared/kvstore.h"
+#include "src/shared/metrics.h"
+
+#include "btd.h"
+#include "log.h"
 #include "textfile.h"
 #include "uuid-helper.h"
 #include "storage.h"
 
+#define STORAGE_PREFIX STORAGEDIR "/"
+
+/* Replaces the files below STORAGEDIR when the journal backend is used */
+static struct kvstore *store;
+static struct metric *storage_writes;
+
 /* When all services should trust a remote device */
 #define GLOBAL_TRUST "[all]"
 
@@ -184,3 +198,283 @@ sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
 	}
 	return NULL;
 }
+
+int btd_storage_init(void)
+{
+	storage_writes = metrics_counter("storage_writes_total",
+					"Files written to the storage backend");
+
+	if (btd_opts.storage != BT_STORAGE_JOURNAL)
+		return 0;
+
+	if (mkdir(STORAGEDIR, 0700) < 0 && errno != EEXIST)
+		return -errno;
+
+	store = kvstore_open(STORAGEDIR "/storage");
+	if (!store)
+		return -EIO;
+
+	DBG("Using journal storage backend");
+
+	return 0;
+}
+
+void btd_storage_cleanup(void)
+{
+	storage_writes = NULL;
+
+	if (!store)
+		return;
+
+	kvstore_compact(store);
+	kvstore_close(store);
+	store = NULL;
+}
+
+static const char *storage_key(const char *filename)
+{
+	if (!store || strncmp(filename, STORAGE_PREFIX, strlen(STORAGE_PREFIX)))
+		return NULL;
+
+	return filename + strlen(STORAGE_PREFIX);
+}
+
+gboolean btd_storage_load(GKeyFile *key_file, const char *filename,
+					GKeyFileFlags flags, GError **error)
+{
+	const char *key = storage_key(filename);
+	const void *data;
+	size_t len;
+
+	if (key && kvstore_get(store, key, &data, &len))
+		return g_key_file_load_from_data(key_file, data, len, flags,
+									error);
+
+	/* Files stored before switching backends are still picked up */
+	return g_key_file_load_from_file(key_file, filename, flags, error);
+}
+
+gboolean btd_storage_set_contents(const char *filename, const char *contents,
+					gssize length, GError **error)
+{
+	const char *key = storage_key(filename);
+
+	if (length < 0)
+		length = strlen(contents);
+
+	metrics_inc(storage_writes);
+
+	if (!key)
+		return g_file_set_contents(filename, contents, length, error);
+
+	if (!kvstore_put(store, key, contents, length)) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_IO,
+					"Unable to store %s", key);
+		return FALSE;
+	}
+
+	if (btd_opts.storage_sync == BT_STORAGE_SYNC_ALWAYS)
+		kvstore_sync(store);
+
+	/* Don't let an older file shadow the entry once it is removed */
+	unlink(filename);
+
+	return TRUE;
+}
+
+void btd_storage_sync(void)
+{
+	if (store && btd_opts.storage_sync == BT_STORAGE_SYNC_BATCH)
+		kvstore_sync(store);
+}
+
+gboolean btd_storage_exists(const char *filename)
+{
+	const char *key = storage_key(filename);
+	const void *data;
+	size_t len;
+
+	if (key && kvstore_get(store, key, &data, &len))
+		return TRUE;
+
+	return access(filename, F_OK) == 0;
+}
+
+/* Same as create_file() so loading a missing entry yields an empty file */
+void btd_storage_create(const char *filename)
+{
+	const char *key = storage_key(filename);
+
+	if (!key) {
+		create_file(filename, 0600);
+		return;
+	}
+
+	if (!btd_storage_exists(filename))
+		kvstore_put(store, key, NULL, 0);
+}
+
+void btd_storage_remove(const char *filename)
+{
+	const char *key = storage_key(filename);
+
+	if (key)
+		kvstore_remove(store, key);
+
+	unlink(filename);
+}
+
+static void delete_folder_tree(const char *dirname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char filename[PATH_MAX];
+
+	dir = opendir(dirname);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (g_str_equal(entry->d_name, ".") ||
+				g_str_equal(entry->d_name, ".."))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
+
+		if (entry->d_type == DT_DIR)
+			delete_folder_tree(filename);
+		else
+			unlink(filename);
+	}
+	closedir(dir);
+
+	rmdir(dirname);
+}
+
+static void collect_key(const char *key, const void *data, size_t len,
+							void *user_data)
+{
+	GSList **keys = user_data;
+
+	*keys = g_slist_prepend(*keys, g_strdup(key));
+}
+
+static void remove_key(gpointer data, gpointer user_data)
+{
+	kvstore_remove(store, data);
+}
+
+void btd_storage_remove_tree(const char *dirname)
+{
+	const char *key = storage_key(dirname);
+	GSList *keys = NULL;
+	char *prefix;
+
+	if (key) {
+		prefix = g_strconcat(key, "/", NULL);
+		kvstore_foreach(store, prefix, collect_key, &keys);
+		g_free(prefix);
+
+		g_slist_foreach(keys, remove_key, NULL);
+		g_slist_free_full(keys, g_free);
+	}
+
+	delete_folder_tree(dirname);
+}
+
+struct list_dirs {
+	size_t prefix_len;
+	GSList *names;
+};
+
+static void add_dir(GSList **names, const char *name, size_t len)
+{
+	GSList *l;
+
+	for (l = *names; l; l = g_slist_next(l)) {
+		if (strlen(l->data) == len && !strncmp(l->data, name, len))
+			return;
+	}
+
+	*names = g_slist_prepend(*names, g_strndup(name, len));
+}
+
+static void add_key_dir(const char *key, const void *data, size_t len,
+							void *user_data)
+{
+	struct list_dirs *list = user_data;
+	const char *name = key + list->prefix_len;
+	const char *end = strchr(name, '/');
+
+	/* Only entries with a path below the name are directories */
+	if (end && end != name)
+		add_dir(&list->names, name, end - name);
+}
+
+GSList *btd_storage_list_dirs(const char *dirname)
+{
+	const char *key = storage_key(dirname);
+	struct list_dirs list;
+	struct dirent *entry;
+	DIR *dir;
+
+	list.names = NULL;
+
+	dir = opendir(dirname);
+	if (dir) {
+		while ((entry = readdir(dir)) != NULL) {
+			if (g_str_equal(entry->d_name, ".") ||
+					g_str_equal(entry->d_name, ".."))
+				continue;
+
+			if (entry->d_type == DT_UNKNOWN)
+				entry->d_type = util_get_dt(dirname,
+								entry->d_name);
+
+			if (entry->d_type == DT_DIR)
+				add_dir(&list.names, entry->d_name,
+						strlen(entry->d_name));
+		}
+
+		closedir(dir);
+	}
+
+	if (key) {
+		char *prefix = g_strconcat(key, "/", NULL);
+
+		list.prefix_len = strlen(prefix);
+		kvstore_foreach(store, prefix, add_key_dir, &list);
+		g_free(prefix);
+	}
+
+	return list.names;
+}
+
+gboolean btd_storage_dir_exists(const char *dirname)
+{
+	GSList *names = NULL;
+	struct stat st;
+	const char *key;
+	char *prefix;
+
+	if (!stat(dirname, &st) && S_ISDIR(st.st_mode))
+		return TRUE;
+
+	key = storage_key(dirname);
+	if (!key)
+		return FALSE;
+
+	prefix = g_strconcat(key, "/", NULL);
+	kvstore_foreach(store, prefix, collect_key, &names);
+	g_free(prefix);
+
+	if (!names)
+		return FALSE;
+
+	g_slist_free_full(names, g_free);
+
+	return TRUE;
+}
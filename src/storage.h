@@ -14,3 +14,19 @@ int read_on_mode(const char *src, char *mode, int length);
 int read_local_name(const bdaddr_t *bdaddr, char *name);
 sdp_record_t *record_from_string(const char *str);
 sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid);
+
+int btd_storage_init(void);
+void btd_storage_cleanup(void);
+
+gboolean btd_storage_load(GKeyFile *key_file, const char *filename,
+					GKeyFileFlags flags, GError **error);
+gboolean btd_storage_set_contents(const char *filename, const char *contents,
+					gssize length, GError **error);
+gboolean btd_storage_exists(const char *filename);
+void btd_storage_create(const char *filename);
+void btd_storage_sync(void);
+void btd_storage_remove(const char *filename);
+
+gboolean btd_storage_dir_exists(const char *dirname);
+GSList *btd_storage_list_dirs(const char *dirname);
+void btd_storage_remove_tree(const char *dirname);
@@ -81,95 +81,386 @@ int create_name(char *buf, size_t size, const char *path, const char *address, c
 	return snprintf(buf, size, "%s/%s/%s", path, address, name);
 }
 
-static inline char *find_key(char *map, size_t size, const char *key, size_t len, int icase)
+/*
+ * Files are indexed in memory the first time they are accessed so lookups
+ * do not have to scan them. Updates are appended and the last line of a
+ * key wins, a key without a value separator marks it as deleted. Once the
+ * superseded lines outweigh the live ones the file is compacted.
+ */
+#define MAX_INDEXES	16
+#define COMPACT_MIN	4096
+
+struct textfile_entry {
+	char *key;
+	char *value;
+	unsigned int hash;
+	struct textfile_entry *chain;
+	struct textfile_entry *prev;
+	struct textfile_entry *next;
+};
+
+struct textfile_index {
+	char *pathname;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct textfile_entry **buckets;
+	unsigned int num_buckets;
+	unsigned int count;
+	struct textfile_entry *head;
+	struct textfile_entry *tail;
+	size_t live;
+	struct textfile_index *next;
+};
+
+static struct textfile_index *indexes = NULL;
+
+static unsigned int key_hash(const char *key, size_t len)
 {
-	char *ptr = map;
-	size_t ptrlen = size;
-
-	while (ptrlen > len + 1) {
-		int cmp = (icase) ? strncasecmp(ptr, key, len) : strncmp(ptr, key, len);
-		if (cmp == 0) {
-			if (ptr == map && *(ptr + len) == ' ')
-				return ptr;
-
-			if ((*(ptr - 1) == '\r' || *(ptr - 1) == '\n') &&
-							*(ptr + len) == ' ')
-				return ptr;
-		}
+	unsigned int hash = 5381;
 
-		if (icase) {
-			char *p1 = memchr(ptr + 1, tolower(*key), ptrlen - 1);
-			char *p2 = memchr(ptr + 1, toupper(*key), ptrlen - 1);
+	while (len--)
+		hash = hash * 33 + (unsigned char) *key++;
 
-			if (!p1)
-				ptr = p2;
-			else if (!p2)
-				ptr = p1;
-			else
-				ptr = (p1 < p2) ? p1 : p2;
-		} else
-			ptr = memchr(ptr + 1, *key, ptrlen - 1);
+	return hash;
+}
 
-		if (!ptr)
-			return NULL;
+static size_t entry_size(const struct textfile_entry *entry)
+{
+	return strlen(entry->key) + strlen(entry->value) + 2;
+}
+
+static struct textfile_entry *index_find(struct textfile_index *index,
+						const char *key, size_t len,
+						unsigned int hash)
+{
+	struct textfile_entry *entry;
 
-		ptrlen = size - (ptr - map);
+	entry = index->buckets[hash % index->num_buckets];
+
+	for (; entry; entry = entry->chain) {
+		if (entry->hash == hash && !strncmp(entry->key, key, len) &&
+							!entry->key[len])
+			return entry;
 	}
 
 	return NULL;
 }
 
-static inline int write_key_value(int fd, const char *key, const char *value)
+static int index_grow(struct textfile_index *index)
+{
+	struct textfile_entry **buckets, *entry;
+	unsigned int num = index->num_buckets ? index->num_buckets * 2 : 64;
+
+	buckets = calloc(num, sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+
+	for (entry = index->head; entry; entry = entry->next) {
+		entry->chain = buckets[entry->hash % num];
+		buckets[entry->hash % num] = entry;
+	}
+
+	free(index->buckets);
+	index->buckets = buckets;
+	index->num_buckets = num;
+
+	return 0;
+}
+
+static void index_unlink(struct textfile_index *index,
+					struct textfile_entry *entry)
 {
+	struct textfile_entry **ptr;
+
+	ptr = &index->buckets[entry->hash % index->num_buckets];
+	while (*ptr != entry)
+		ptr = &(*ptr)->chain;
+	*ptr = entry->chain;
+
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		index->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		index->tail = entry->prev;
+
+	index->live -= entry_size(entry);
+	index->count--;
+
+	free(entry->key);
+	free(entry->value);
+	free(entry);
+}
+
+static int index_set(struct textfile_index *index, const char *key,
+				size_t key_len, const char *value,
+				size_t value_len)
+{
+	struct textfile_entry *entry;
+	unsigned int hash;
 	char *str;
-	size_t size;
-	int err = 0;
 
-	size = strlen(key) + strlen(value) + 2;
+	hash = key_hash(key, key_len);
+	entry = index_find(index, key, key_len, hash);
 
-	str = malloc(size + 1);
+	if (!value) {
+		if (entry)
+			index_unlink(index, entry);
+		return 0;
+	}
+
+	str = strndup(value, value_len);
 	if (!str)
-		return ENOMEM;
+		return -ENOMEM;
 
-	sprintf(str, "%s %s\n", key, value);
+	if (entry) {
+		index->live -= entry_size(entry);
+		free(entry->value);
+		entry->value = str;
+		index->live += entry_size(entry);
+		return 0;
+	}
 
-	if (write(fd, str, size) < 0)
-		err = -errno;
+	if (index->count >= index->num_buckets && index_grow(index) < 0) {
+		free(str);
+		return -ENOMEM;
+	}
 
-	free(str);
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		free(str);
+		return -ENOMEM;
+	}
+
+	entry->key = strndup(key, key_len);
+	if (!entry->key) {
+		free(entry);
+		free(str);
+		return -ENOMEM;
+	}
+
+	entry->value = str;
+	entry->hash = hash;
+	entry->chain = index->buckets[hash % index->num_buckets];
+	index->buckets[hash % index->num_buckets] = entry;
+
+	entry->prev = index->tail;
+	if (index->tail)
+		index->tail->next = entry;
+	else
+		index->head = entry;
+	index->tail = entry;
+
+	index->live += entry_size(entry);
+	index->count++;
+
+	return 0;
+}
+
+static void index_clear(struct textfile_index *index)
+{
+	while (index->head)
+		index_unlink(index, index->head);
+
+	free(index->buckets);
+	index->buckets = NULL;
+	index->num_buckets = 0;
+}
+
+static void index_stat(struct textfile_index *index, const struct stat *st)
+{
+	index->dev = st->st_dev;
+	index->ino = st->st_ino;
+	index->size = st->st_size;
+	index->mtime = st->st_mtim;
+}
+
+static int index_valid(struct textfile_index *index, const struct stat *st)
+{
+	return index->dev == st->st_dev && index->ino == st->st_ino &&
+		index->size == st->st_size &&
+		index->mtime.tv_sec == st->st_mtim.tv_sec &&
+		index->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static int index_parse(struct textfile_index *index, const char *map,
+								size_t size)
+{
+	const char *off = map, *end = map + size;
+
+	while (off < end) {
+		const char *eol, *sep;
+		size_t len;
+		int err;
+
+		if (*off == '\r' || *off == '\n') {
+			off++;
+			continue;
+		}
+
+		for (eol = off; eol < end && *eol != '\r' && *eol != '\n';)
+			eol++;
+
+		len = eol - off;
+		sep = memchr(off, ' ', len);
+
+		/* Skip anything that cannot be a key, such as NUL padding */
+		if (memchr(off, '\0', sep ? (size_t) (sep - off) : len)) {
+			off = eol;
+			continue;
+		}
+
+		if (sep && sep > off)
+			err = index_set(index, off, sep - off, sep + 1,
+							eol - sep - 1);
+		else if (!sep)
+			err = index_set(index, off, len, NULL, 0);
+		else
+			err = 0;
+
+		if (err < 0)
+			return err;
+
+		off = eol;
+	}
+
+	return 0;
+}
+
+static int index_load(struct textfile_index *index, int fd,
+							const struct stat *st)
+{
+	char *map;
+	int err;
+
+	index_clear(index);
+
+	if (index_grow(index) < 0)
+		return -ENOMEM;
+
+	index_stat(index, st);
+
+	if (!st->st_size)
+		return 0;
+
+	map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (!map || map == MAP_FAILED)
+		return -errno;
+
+	err = index_parse(index, map, st->st_size);
+
+	munmap(map, st->st_size);
 
 	return err;
 }
 
-static char *strnpbrk(const char *s, ssize_t len, const char *accept)
+static void index_free(struct textfile_index *index)
 {
-	const char *p = s;
-	const char *end;
+	index_clear(index);
+	free(index->pathname);
+	free(index);
+}
 
-	end = s + len - 1;
+/*
+ * Return the up to date index of pathname, the caller has to hold the
+ * file lock.
+ */
+static struct textfile_index *get_index(const char *pathname, int fd)
+{
+	struct textfile_index *index, **ptr;
+	struct stat st;
+	unsigned int num = 0;
+	int err;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	for (ptr = &indexes; *ptr; ptr = &(*ptr)->next, num++) {
+		if (!strcmp((*ptr)->pathname, pathname))
+			break;
+	}
+
+	index = *ptr;
+	if (index) {
+		/* Most recently used first */
+		*ptr = index->next;
+		index->next = indexes;
+		indexes = index;
+
+		if (index_valid(index, &st))
+			return index;
+	} else {
+		if (num >= MAX_INDEXES) {
+			for (ptr = &indexes; (*ptr)->next; ptr = &(*ptr)->next)
+				;
+			index_free(*ptr);
+			*ptr = NULL;
+		}
 
-	while (p <= end && *p) {
-		const char *a = accept;
+		index = calloc(1, sizeof(*index));
+		if (!index) {
+			errno = ENOMEM;
+			return NULL;
+		}
 
-		while (*a) {
-			if (*p == *a)
-				return (char *) p;
-			a++;
+		index->pathname = strdup(pathname);
+		if (!index->pathname) {
+			free(index);
+			errno = ENOMEM;
+			return NULL;
 		}
 
-		p++;
+		index->next = indexes;
+		indexes = index;
 	}
 
-	return NULL;
+	err = index_load(index, fd, &st);
+	if (err < 0) {
+		/* Force a reload on next access */
+		index->size = -1;
+		errno = -err;
+		return NULL;
+	}
+
+	return index;
+}
+
+static int compact(struct textfile_index *index, int fd)
+{
+	struct textfile_entry *entry;
+	char *buf, *ptr;
+	int err = 0;
+
+	buf = malloc(index->live + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	ptr = buf;
+	for (entry = index->head; entry; entry = entry->next)
+		ptr += sprintf(ptr, "%s %s\n", entry->key, entry->value);
+
+	if (pwrite(fd, buf, index->live, 0) < 0 ||
+					ftruncate(fd, index->live) < 0)
+		err = -errno;
+
+	free(buf);
+
+	return err;
 }
 
-static int write_key(const char *pathname, const char *key, const char *value, int icase)
+static int write_key(const char *pathname, const char *key, const char *value)
 {
+	struct textfile_index *index;
+	struct textfile_entry *entry;
 	struct stat st;
-	char *map, *off, *end, *str;
-	off_t size;
-	size_t base;
-	int fd, len, err = 0;
+	size_t len;
+	char *str;
+	int fd, err = 0;
 
 	fd = open(pathname, O_RDWR);
 	if (fd < 0)
@@ -180,100 +471,60 @@ static int write_key(const char *pathname, const char *key, const char *value, i
 		goto close;
 	}
 
-	if (fstat(fd, &st) < 0) {
+	index = get_index(pathname, fd);
+	if (!index) {
 		err = -errno;
 		goto unlock;
 	}
 
-	size = st.st_size;
-
-	if (!size) {
-		if (value) {
-			lseek(fd, size, SEEK_SET);
-			err = write_key_value(fd, key, value);
-		}
-		goto unlock;
-	}
+	len = strlen(key);
+	entry = index_find(index, key, len, key_hash(key, len));
 
-	map = mmap(NULL, size, PROT_READ | PROT_WRITE,
-					MAP_PRIVATE | MAP_LOCKED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
+	if (!value && !entry)
 		goto unlock;
-	}
 
-	len = strlen(key);
-	off = find_key(map, size, key, len, icase);
-	if (!off) {
-		munmap(map, size);
-		if (value) {
-			lseek(fd, size, SEEK_SET);
-			err = write_key_value(fd, key, value);
-		}
+	if (value && entry && !strcmp(entry->value, value))
 		goto unlock;
-	}
-
-	base = off - map;
 
-	end = strnpbrk(off, size, "\r\n");
-	if (!end) {
-		err = -EILSEQ;
-		goto unmap;
-	}
-
-	if (value && ((ssize_t) strlen(value) == end - off - len - 1) &&
-			!strncmp(off + len + 1, value, end - off - len - 1))
-		goto unmap;
-
-	len = strspn(end, "\r\n");
-	end += len;
-
-	len = size - (end - map);
-	if (!len) {
-		munmap(map, size);
-		if (ftruncate(fd, base) < 0) {
-			err = -errno;
-			goto unlock;
-		}
-		lseek(fd, base, SEEK_SET);
-		if (value)
-			err = write_key_value(fd, key, value);
+	if (value)
+		err = asprintf(&str, "%s %s\n", key, value);
+	else
+		err = asprintf(&str, "%s\n", key);
 
+	if (err < 0) {
+		err = -ENOMEM;
 		goto unlock;
 	}
 
-	if (len < 0 || len > size) {
-		err = -EILSEQ;
-		goto unmap;
-	}
-
-	str = malloc(len);
-	if (!str) {
+	if (pwrite(fd, str, err, index->size) < 0)
 		err = -errno;
-		goto unmap;
-	}
+	else
+		err = index_set(index, key, len, value,
+						value ? strlen(value) : 0);
 
-	memcpy(str, end, len);
+	free(str);
 
-	munmap(map, size);
-	if (ftruncate(fd, base) < 0) {
-		err = -errno;
-		free(str);
+	if (err < 0) {
+		index->size = -1;
 		goto unlock;
 	}
-	lseek(fd, base, SEEK_SET);
-	if (value)
-		err = write_key_value(fd, key, value);
 
-	if (write(fd, str, len) < 0)
+	if (fstat(fd, &st) < 0) {
 		err = -errno;
+		index->size = -1;
+		goto unlock;
+	}
 
-	free(str);
-
-	goto unlock;
+	if ((size_t) st.st_size - index->live > index->live &&
+			(size_t) st.st_size - index->live >= COMPACT_MIN) {
+		err = compact(index, fd);
+		if (err < 0 || fstat(fd, &st) < 0) {
+			index->size = -1;
+			goto unlock;
+		}
+	}
 
-unmap:
-	munmap(map, size);
+	index_stat(index, &st);
 
 unlock:
 	flock(fd, LOCK_UN);
@@ -287,11 +538,12 @@ close:
 	return err;
 }
 
-static char *read_key(const char *pathname, const char *key, int icase)
+static char *read_key(const char *pathname, const char *key)
 {
-	struct stat st;
-	char *map, *off, *end, *str = NULL;
-	off_t size; size_t len;
+	struct textfile_index *index;
+	struct textfile_entry *entry;
+	char *str = NULL;
+	size_t len;
 	int fd, err = 0;
 
 	fd = open(pathname, O_RDONLY);
@@ -303,43 +555,22 @@ static char *read_key(const char *pathname, const char *key, int icase)
 		goto close;
 	}
 
-	if (fstat(fd, &st) < 0) {
-		err = -errno;
-		goto unlock;
-	}
-
-	size = st.st_size;
-
-	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-	if (!map || map == MAP_FAILED) {
+	index = get_index(pathname, fd);
+	if (!index) {
 		err = -errno;
 		goto unlock;
 	}
 
 	len = strlen(key);
-	off = find_key(map, size, key, len, icase);
-	if (!off) {
+	entry = index_find(index, key, len, key_hash(key, len));
+	if (!entry) {
 		err = -EILSEQ;
-		goto unmap;
-	}
-
-	end = strnpbrk(off, size - (off - map), "\r\n");
-	if (!end) {
-		err = -EILSEQ;
-		goto unmap;
-	}
-
-	str = malloc(end - off - len);
-	if (!str) {
-		err = -EILSEQ;
-		goto unmap;
+		goto unlock;
 	}
 
-	memset(str, 0, end - off - len);
-	strncpy(str, off + len + 1, end - off - len - 1);
-
-unmap:
-	munmap(map, size);
+	str = strdup(entry->value);
+	if (!str)
+		err = -ENOMEM;
 
 unlock:
 	flock(fd, LOCK_UN);
@@ -353,24 +584,25 @@ close:
 
 int textfile_put(const char *pathname, const char *key, const char *value)
 {
-	return write_key(pathname, key, value, 0);
+	return write_key(pathname, key, value);
 }
 
 int textfile_del(const char *pathname, const char *key)
 {
-	return write_key(pathname, key, NULL, 0);
+	return write_key(pathname, key, NULL);
 }
 
 char *textfile_get(const char *pathname, const char *key)
 {
-	return read_key(pathname, key, 0);
+	return read_key(pathname, key);
 }
 
 int textfile_foreach(const char *pathname, textfile_cb func, void *data)
 {
-	struct stat st;
-	char *map, *off, *end, *key, *value;
-	off_t size; size_t len;
+	struct textfile_index *index;
+	struct textfile_entry *entry;
+	char **pairs = NULL;
+	unsigned int i, num = 0;
 	int fd, err = 0;
 
 	fd = open(pathname, O_RDONLY);
@@ -382,81 +614,45 @@ int textfile_foreach(const char *pathname, textfile_cb func, void *data)
 		goto close;
 	}
 
-	if (fstat(fd, &st) < 0) {
+	index = get_index(pathname, fd);
+	if (!index) {
 		err = -errno;
 		goto unlock;
 	}
 
-	size = st.st_size;
-
-	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
+	/* Copy the entries since the callback may modify the file */
+	pairs = calloc(index->count * 2, sizeof(char *));
+	if (!pairs && index->count) {
+		err = -ENOMEM;
 		goto unlock;
 	}
 
-	off = map;
+	for (entry = index->head; entry; entry = entry->next) {
+		pairs[num] = strdup(entry->key);
+		pairs[num + 1] = strdup(entry->value);
+		num += 2;
 
-	while (size - (off - map) > 0) {
-		end = strnpbrk(off, size - (off - map), " ");
-		if (!end) {
-			err = -EILSEQ;
+		if (!pairs[num - 2] || !pairs[num - 1]) {
+			err = -ENOMEM;
 			break;
 		}
-
-		len = end - off;
-
-		key = malloc(len + 1);
-		if (!key) {
-			err = -errno;
-			break;
-		}
-
-		memset(key, 0, len + 1);
-		memcpy(key, off, len);
-
-		off = end + 1;
-
-		if (size - (off - map) < 0) {
-			err = -EILSEQ;
-			free(key);
-			break;
-		}
-
-		end = strnpbrk(off, size - (off - map), "\r\n");
-		if (!end) {
-			err = -EILSEQ;
-			free(key);
-			break;
-		}
-
-		len = end - off;
-
-		value = malloc(len + 1);
-		if (!value) {
-			err = -errno;
-			free(key);
-			break;
-		}
-
-		memset(value, 0, len + 1);
-		memcpy(value, off, len);
-
-		func(key, value, data);
-
-		free(key);
-		free(value);
-
-		off = end + 1;
 	}
 
-	munmap(map, size);
-
 unlock:
 	flock(fd, LOCK_UN);
 
 close:
 	close(fd);
+
+	for (i = 0; i < num; i += 2) {
+		if (!err)
+			func(pairs[i], pairs[i + 1], data);
+
+		free(pairs[i]);
+		free(pairs[i + 1]);
+	}
+
+	free(pairs);
 	errno = -err;
 
 	return 0;
@@ -20,6 +20,8 @@
 #include <getopt.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -31,14 +33,27 @@
 #include "src/shared/util.h"
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
+#include "src/shared/timeout.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
 
 #define ATT_CID 4
 
+#define UUID_BENCH		"bdc41d40-7679-4831-baa5-bc69040d2374"
+#define UUID_BENCH_DATA		"bdc41d41-7679-4831-baa5-bc69040d2374"
+#define UUID_BENCH_CTRL		"bdc41d42-7679-4831-baa5-bc69040d2374"
+
+/* Write commands are topped up every tick, keeping a bounded queue */
+#define BENCH_TICK		1
+#define BENCH_WRITE_WINDOW	32
+
 #define PRLOG(...) \
 	printf(__VA_ARGS__); print_prompt();
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 #define COLOR_OFF	"\x1B[0m"
 #define COLOR_RED	"\x1B[0;91m"
 #define COLOR_GREEN	"\x1B[0;92m"
@@ -49,6 +64,38 @@
 #define COLOR_BOLDWHITE	"\x1B[1;37m"
 
 static bool verbose = false;
+static bool benchmark = false;
+static int bench_duration = 5;
+static int bench_rate = 0;
+static int bench_size = 0;
+
+enum bench_phase {
+	BENCH_READ,
+	BENCH_WRITE,
+	BENCH_NOTIFY,
+	BENCH_DONE,
+};
+
+struct bench {
+	struct client *cli;
+	enum bench_phase phase;
+	uint16_t data_handle;
+	uint16_t ctrl_handle;
+	int inflight;
+	int outstanding;
+	uint64_t start;
+	uint64_t end;
+	uint64_t last;
+	uint64_t ops;
+	uint64_t bytes;
+	uint32_t next_seq;
+	uint32_t lost;
+	uint64_t *samples;
+	size_t samples_len;
+	size_t samples_size;
+	unsigned int timeout_id;
+	unsigned int notify_id;
+};
 
 struct client {
 	int fd;
@@ -57,6 +104,8 @@ struct client {
 	struct bt_gatt_client *gatt;
 
 	unsigned int reliable_session_id;
+
+	struct bench *bench;
 };
 
 static void print_prompt(void)
@@ -135,6 +184,8 @@ static void gatt_debug_cb(const char *str, void *user_data)
 }
 
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data);
+static void bench_start(struct client *cli);
+static void bench_free(struct bench *bench);
 static void service_changed_cb(uint16_t start_handle, uint16_t end_handle,
 							void *user_data);
 
@@ -236,6 +287,7 @@ static struct client *client_create(int fd, uint16_t mtu)
 
 static void client_destroy(struct client *cli)
 {
+	bench_free(cli->bench);
 	bt_gatt_client_unref(cli->gatt);
 	bt_att_unref(cli->att);
 	free(cli);
@@ -349,6 +401,428 @@ static void print_services_by_handle(struct client *cli, uint16_t handle)
 	gatt_db_foreach_service(cli->db, NULL, print_service, cli);
 }
 
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_sample(struct bench *bench, uint64_t value)
+{
+	if (bench->samples_len == bench->samples_size) {
+		size_t size = bench->samples_size ? bench->samples_size * 2 :
+									1024;
+		uint64_t *samples;
+
+		samples = realloc(bench->samples, size * sizeof(*samples));
+		if (!samples)
+			return;
+
+		bench->samples = samples;
+		bench->samples_size = size;
+	}
+
+	bench->samples[bench->samples_len++] = value;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	uint64_t v1 = *(const uint64_t *) a;
+	uint64_t v2 = *(const uint64_t *) b;
+
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static double bench_percentile(struct bench *bench, int percent)
+{
+	if (!bench->samples_len)
+		return 0;
+
+	return bench->samples[(bench->samples_len - 1) * percent / 100] /
+									1000.0;
+}
+
+static void bench_reset(struct bench *bench)
+{
+	bench->start = bench_now();
+	bench->end = bench->start + (uint64_t) bench_duration * 1000000000;
+	bench->last = 0;
+	bench->ops = 0;
+	bench->bytes = 0;
+	bench->next_seq = 0;
+	bench->lost = 0;
+	bench->samples_len = 0;
+}
+
+static void bench_print(struct bench *bench, const char *name,
+						const char *unit, uint64_t end)
+{
+	double secs = (end - bench->start) / 1000000000.0;
+
+	qsort(bench->samples, bench->samples_len, sizeof(*bench->samples),
+								bench_compare);
+
+	printf("%s: %" PRIu64 " ops, %" PRIu64 " bytes in %.3f s\n", name,
+					bench->ops, bench->bytes, secs);
+	printf("\t%.1f ops/s, %.1f kB/s\n", secs > 0 ? bench->ops / secs : 0,
+				secs > 0 ? bench->bytes / secs / 1000 : 0);
+
+	if (!bench->samples_len)
+		return;
+
+	printf("\t%s us min/p50/p90/p99/max: %.1f/%.1f/%.1f/%.1f/%.1f\n",
+				unit, bench_percentile(bench, 0),
+				bench_percentile(bench, 50),
+				bench_percentile(bench, 90),
+				bench_percentile(bench, 99),
+				bench_percentile(bench, 100));
+}
+
+static void bench_next(struct bench *bench);
+
+struct bench_op {
+	struct bench *bench;
+	uint64_t sent;
+};
+
+static void bench_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data);
+
+static bool bench_read(struct bench *bench)
+{
+	struct bench_op *op;
+
+	op = new0(struct bench_op, 1);
+	op->bench = bench;
+	op->sent = bench_now();
+
+	if (!bt_gatt_client_read_value(bench->cli->gatt, bench->data_handle,
+						bench_read_cb, op, free)) {
+		free(op);
+		return false;
+	}
+
+	bench->outstanding++;
+
+	return true;
+}
+
+static void bench_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct bench_op *op = user_data;
+	struct bench *bench = op->bench;
+	uint64_t now = bench_now();
+	char name[32];
+
+	bench->outstanding--;
+
+	if (!success) {
+		printf("Read failed - error code: 0x%02x\n", att_ecode);
+		bench->end = now;
+	} else {
+		bench_sample(bench, now - op->sent);
+		bench->ops++;
+		bench->bytes += length;
+	}
+
+	if (now < bench->end && bench_read(bench))
+		return;
+
+	if (bench->outstanding)
+		return;
+
+	snprintf(name, sizeof(name), "read (%d in flight)", bench->inflight);
+	bench_print(bench, name, "rtt", now);
+
+	/* Scale the requests in flight up to the number of channels */
+	if (success && bench->inflight < bt_att_get_channels(bench->cli->att))
+		bench->inflight = MIN(bench->inflight * 2,
+				bt_att_get_channels(bench->cli->att));
+	else
+		bench->phase++;
+
+	bench_next(bench);
+}
+
+static void bench_write_destroy(void *user_data)
+{
+	struct bench *bench = user_data;
+
+	bench->outstanding--;
+}
+
+static void bench_stats_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct bench *bench = user_data;
+	uint64_t now = bench_now();
+	uint64_t sent = bench->bytes;
+
+	if (!success || length < 12) {
+		printf("Reading statistics failed - error code: 0x%02x\n",
+								att_ecode);
+		mainloop_quit();
+		return;
+	}
+
+	/* Count what the server received until it answered the read */
+	bench->ops = get_le32(value);
+	bench->bytes = get_le64(value + 4);
+
+	bench_print(bench, "write-without-response", NULL, now);
+	printf("\t%" PRIu64 " bytes sent\n", sent);
+
+	bench->phase++;
+	bench_next(bench);
+}
+
+static bool bench_write_cb(void *user_data)
+{
+	struct bench *bench = user_data;
+	uint8_t pdu[BT_ATT_MAX_LE_MTU];
+	uint16_t len = bench_size;
+	uint16_t mtu = bt_att_get_mtu(bench->cli->att);
+
+	if (!len || len > mtu - 3)
+		len = mtu - 3;
+
+	if (len > sizeof(pdu) - 2)
+		len = sizeof(pdu) - 2;
+
+	if (bench_now() >= bench->end) {
+		if (bench->outstanding)
+			return true;
+
+		bench->timeout_id = 0;
+
+		/* The server handles the writes before answering the read */
+		if (!bt_gatt_client_read_value(bench->cli->gatt,
+						bench->ctrl_handle,
+						bench_stats_cb, bench, NULL))
+			mainloop_quit();
+
+		return false;
+	}
+
+	memset(pdu, 0, len + 2);
+	put_le16(bench->data_handle, pdu);
+
+	/*
+	 * Use bt_att_send directly so that the destroy callback tells when
+	 * each write has left the queue.
+	 */
+	while (bench->outstanding < BENCH_WRITE_WINDOW) {
+		if (!bt_att_send(bench->cli->att, BT_ATT_OP_WRITE_CMD, pdu,
+					len + 2, NULL, bench,
+					bench_write_destroy))
+			break;
+
+		bench->outstanding++;
+		bench->ops++;
+		bench->bytes += len;
+	}
+
+	return true;
+}
+
+static bool bench_notify_timeout(void *user_data)
+{
+	struct bench *bench = user_data;
+
+	bench->timeout_id = 0;
+
+	bt_gatt_client_unregister_notify(bench->cli->gatt, bench->notify_id);
+	bench->notify_id = 0;
+
+	bench_print(bench, "notify", "interval", bench_now());
+	printf("\t%u lost\n", bench->lost);
+
+	bench->phase++;
+	bench_next(bench);
+
+	return false;
+}
+
+static void bench_notify_cb(uint16_t value_handle, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct bench *bench = user_data;
+	uint64_t now = bench_now();
+	uint32_t seq;
+
+	if (value_handle != bench->data_handle || length < 4 || !bench->start)
+		return;
+
+	/* Only count gaps once the first notification has been seen */
+	seq = get_le32(value);
+	if (bench->last) {
+		if (seq > bench->next_seq)
+			bench->lost += seq - bench->next_seq;
+
+		bench_sample(bench, now - bench->last);
+	}
+
+	bench->next_seq = seq + 1;
+
+	bench->last = now;
+	bench->ops++;
+	bench->bytes += length;
+}
+
+static void bench_register_cb(uint16_t att_ecode, void *user_data)
+{
+	struct bench *bench = user_data;
+
+	if (att_ecode) {
+		printf("Failed to enable notifications - error code: 0x%02x\n",
+								att_ecode);
+		mainloop_quit();
+		return;
+	}
+
+	bench_reset(bench);
+	bench->timeout_id = timeout_add(bench_duration * 1000,
+						bench_notify_timeout, bench,
+						NULL);
+}
+
+static void bench_ctrl_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	struct bench *bench = user_data;
+
+	if (!success) {
+		printf("Control point write failed - error code: 0x%02x\n",
+								att_ecode);
+		mainloop_quit();
+		return;
+	}
+
+	switch (bench->phase) {
+	case BENCH_WRITE:
+		bench_reset(bench);
+		bench->timeout_id = timeout_add(BENCH_TICK, bench_write_cb,
+								bench, NULL);
+		break;
+	case BENCH_NOTIFY:
+		/* Notifications may arrive before the registration completes */
+		bench->start = 0;
+		bench->notify_id = bt_gatt_client_register_notify(
+							bench->cli->gatt,
+							bench->data_handle,
+							bench_register_cb,
+							bench_notify_cb,
+							bench, NULL);
+		if (!bench->notify_id)
+			mainloop_quit();
+		break;
+	case BENCH_READ:
+	case BENCH_DONE:
+		break;
+	}
+}
+
+static void bench_next(struct bench *bench)
+{
+	uint8_t value[4];
+	int i;
+
+	switch (bench->phase) {
+	case BENCH_READ:
+		bench_reset(bench);
+
+		for (i = 0; i < bench->inflight; i++)
+			bench_read(bench);
+
+		if (!bench->outstanding)
+			mainloop_quit();
+		return;
+	case BENCH_WRITE:
+	case BENCH_NOTIFY:
+		/* Configure notifications and reset the server counters */
+		put_le16(bench_rate, value);
+		put_le16(bench_size, value + 2);
+
+		if (!bt_gatt_client_write_value(bench->cli->gatt,
+						bench->ctrl_handle, value,
+						sizeof(value), bench_ctrl_cb,
+						bench, NULL))
+			mainloop_quit();
+		return;
+	case BENCH_DONE:
+		mainloop_quit();
+		return;
+	}
+}
+
+static void bench_find_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct bench *bench = user_data;
+	uint16_t value_handle;
+	bt_uuid_t uuid, data, ctrl;
+
+	if (!gatt_db_attribute_get_char_data(attr, NULL, &value_handle, NULL,
+								NULL, &uuid))
+		return;
+
+	bt_string_to_uuid(&data, UUID_BENCH_DATA);
+	bt_string_to_uuid(&ctrl, UUID_BENCH_CTRL);
+
+	if (!bt_uuid_cmp(&uuid, &data))
+		bench->data_handle = value_handle;
+	else if (!bt_uuid_cmp(&uuid, &ctrl))
+		bench->ctrl_handle = value_handle;
+}
+
+static void bench_find_service(struct gatt_db_attribute *attr,
+							void *user_data)
+{
+	gatt_db_service_foreach_char(attr, bench_find_chrc, user_data);
+}
+
+static void bench_start(struct client *cli)
+{
+	struct bench *bench;
+	bt_uuid_t uuid;
+
+	bench = new0(struct bench, 1);
+	bench->cli = cli;
+	bench->inflight = 1;
+	cli->bench = bench;
+
+	bt_string_to_uuid(&uuid, UUID_BENCH);
+	gatt_db_foreach_service(cli->db, &uuid, bench_find_service, bench);
+
+	if (!bench->data_handle || !bench->ctrl_handle) {
+		printf("Benchmark service not found\n");
+		mainloop_quit();
+		return;
+	}
+
+	printf("Running benchmark: mtu %u, %d channels, %d s per test\n",
+					bt_att_get_mtu(cli->att),
+					bt_att_get_channels(cli->att),
+					bench_duration);
+
+	bench_next(bench);
+}
+
+static void bench_free(struct bench *bench)
+{
+	if (!bench)
+		return;
+
+	timeout_remove(bench->timeout_id);
+	free(bench->samples);
+	free(bench);
+}
+
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct client *cli = user_data;
@@ -361,6 +835,11 @@ static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 
 	PRLOG("GATT discovery procedures complete\n");
 
+	if (benchmark) {
+		bench_start(cli);
+		return;
+	}
+
 	print_services(cli);
 	print_prompt();
 }
@@ -1470,6 +1949,62 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
 	return sock;
 }
 
+static int l2cap_le_eatt_connect(bdaddr_t *src, bdaddr_t *dst,
+						uint8_t dst_type, int sec)
+{
+	int sock;
+	struct sockaddr_l2 srcaddr, dstaddr;
+	struct bt_security btsec;
+	uint8_t mode = BT_MODE_EXT_FLOWCTL;
+
+	sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+	if (sock < 0) {
+		perror("Failed to create L2CAP socket");
+		return -1;
+	}
+
+	memset(&srcaddr, 0, sizeof(srcaddr));
+	srcaddr.l2_family = AF_BLUETOOTH;
+	srcaddr.l2_bdaddr_type = BDADDR_LE_PUBLIC;
+	bacpy(&srcaddr.l2_bdaddr, src);
+
+	if (bind(sock, (struct sockaddr *)&srcaddr, sizeof(srcaddr)) < 0) {
+		perror("Failed to bind L2CAP socket");
+		goto fail;
+	}
+
+	memset(&btsec, 0, sizeof(btsec));
+	btsec.level = sec;
+	if (setsockopt(sock, SOL_BLUETOOTH, BT_SECURITY, &btsec,
+							sizeof(btsec)) != 0) {
+		fprintf(stderr, "Failed to set L2CAP security level\n");
+		goto fail;
+	}
+
+	if (setsockopt(sock, SOL_BLUETOOTH, BT_MODE, &mode,
+							sizeof(mode)) < 0) {
+		perror("Failed to set EATT mode");
+		goto fail;
+	}
+
+	memset(&dstaddr, 0, sizeof(dstaddr));
+	dstaddr.l2_family = AF_BLUETOOTH;
+	dstaddr.l2_psm = htobs(BT_ATT_EATT_PSM);
+	dstaddr.l2_bdaddr_type = dst_type;
+	bacpy(&dstaddr.l2_bdaddr, dst);
+
+	if (connect(sock, (struct sockaddr *) &dstaddr, sizeof(dstaddr)) < 0) {
+		perror("Failed to connect EATT channel");
+		goto fail;
+	}
+
+	return sock;
+
+fail:
+	close(sock);
+	return -1;
+}
+
 static void usage(void)
 {
 	printf("btgatt-client\n");
@@ -1482,6 +2017,13 @@ static void usage(void)
 		"\t-m, --mtu <mtu> \t\tThe ATT MTU to use\n"
 		"\t-s, --security-level <sec> \tSet security level (low|medium|"
 								"high|fips)\n"
+		"\t-e, --eatt <num>\t\tNumber of EATT channels to open\n"
+		"\t-b, --benchmark\t\t\tRun against btgatt-server -b\n"
+		"\t-D, --duration <sec>\t\tBenchmark duration per test\n"
+		"\t-R, --rate <num>\t\tNotifications per second "
+						"(0 = unlimited)\n"
+		"\t-S, --size <bytes>\t\tWrite and notification size "
+						"(0 = MTU)\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
@@ -1489,6 +2031,11 @@ static void usage(void)
 static struct option main_options[] = {
 	{ "index",		1, 0, 'i' },
 	{ "dest",		1, 0, 'd' },
+	{ "eatt",		1, 0, 'e' },
+	{ "benchmark",		0, 0, 'b' },
+	{ "duration",		1, 0, 'D' },
+	{ "rate",		1, 0, 'R' },
+	{ "size",		1, 0, 'S' },
 	{ "type",		1, 0, 't' },
 	{ "mtu",		1, 0, 'm' },
 	{ "security-level",	1, 0, 's' },
@@ -1506,10 +2053,10 @@ int main(int argc, char *argv[])
 	bool dst_addr_given = false;
 	bdaddr_t src_addr, dst_addr;
 	int dev_id = -1;
-	int fd;
+	int fd, eatt = 0;
 	struct client *cli;
 
-	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:",
+	while ((opt = getopt_long(argc, argv, "+hvbs:m:t:d:i:e:D:R:S:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1518,6 +2065,39 @@ int main(int argc, char *argv[])
 		case 'v':
 			verbose = true;
 			break;
+		case 'b':
+			benchmark = true;
+			break;
+		case 'e':
+			eatt = atoi(optarg);
+			if (eatt < 0) {
+				fprintf(stderr, "Invalid EATT channels: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'D':
+			bench_duration = atoi(optarg);
+			if (bench_duration <= 0) {
+				fprintf(stderr, "Invalid duration: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'R':
+			bench_rate = atoi(optarg);
+			if (bench_rate < 0 || bench_rate > UINT16_MAX) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			bench_size = atoi(optarg);
+			if (bench_size < 0 || bench_size > UINT16_MAX) {
+				fprintf(stderr, "Invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's':
 			if (strcmp(optarg, "low") == 0)
 				sec = BT_SECURITY_LOW;
@@ -1622,6 +2202,23 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	while (eatt--) {
+		fd = l2cap_le_eatt_connect(&src_addr, &dst_addr, dst_type, sec);
+		if (fd < 0)
+			break;
+
+		if (bt_att_attach_fd(cli->att, fd) < 0) {
+			close(fd);
+			break;
+		}
+	}
+
+	if (benchmark) {
+		mainloop_run_with_signal(signal_cb, NULL);
+		client_destroy(cli);
+		return EXIT_SUCCESS;
+	}
+
 	if (mainloop_add_fd(fileno(stdin),
 				EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
 				prompt_read_cb, cli, NULL) < 0) {
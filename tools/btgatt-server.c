@@ -42,6 +42,15 @@
 #define UUID_HEART_RATE_BODY		0x2a38
 #define UUID_HEART_RATE_CTRL		0x2a39
 
+#define UUID_BENCH		"bdc41d40-7679-4831-baa5-bc69040d2374"
+#define UUID_BENCH_DATA		"bdc41d41-7679-4831-baa5-bc69040d2374"
+#define UUID_BENCH_CTRL		"bdc41d42-7679-4831-baa5-bc69040d2374"
+
+/* Notifications are topped up every tick, keeping a bounded queue */
+#define BENCH_INTERVAL		10
+#define BENCH_WINDOW		64
+#define BENCH_DEFAULT_RATE	100
+
 #define ATT_CID 4
 
 #define PRLOG(...) \
@@ -86,6 +95,19 @@ struct server {
 	bool hr_msrmt_enabled;
 	int hr_ee_count;
 	unsigned int hr_timeout_id;
+
+	uint16_t bench_handle;
+	bool bench_visible;
+	bool bench_enabled;
+	uint16_t bench_rate;
+	uint16_t bench_size;
+	unsigned int bench_credits;
+	unsigned int bench_pending;
+	uint32_t bench_seq;
+	uint32_t bench_rx_count;
+	uint64_t bench_rx_bytes;
+	unsigned int bench_timeout_id;
+	int eatt_fd;
 };
 
 static void print_prompt(void)
@@ -388,6 +410,218 @@ done:
 	gatt_db_attribute_write_result(attrib, id, ecode);
 }
 
+static void bench_nfy_destroy(void *user_data)
+{
+	struct server *server = user_data;
+
+	server->bench_pending--;
+}
+
+static bool bench_send(struct server *server)
+{
+	uint8_t pdu[BT_ATT_MAX_LE_MTU];
+	uint16_t mtu = bt_att_get_mtu(server->att);
+	uint16_t len = server->bench_size;
+
+	if (!len || len > mtu - 3)
+		len = mtu - 3;
+
+	if (len > sizeof(pdu) - 2)
+		len = sizeof(pdu) - 2;
+
+	if (len < 4)
+		return false;
+
+	memset(pdu, 0, len + 2);
+	put_le16(server->bench_handle, pdu);
+	put_le32(server->bench_seq, pdu + 2);
+
+	if (!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY, pdu, len + 2,
+					NULL, server, bench_nfy_destroy))
+		return false;
+
+	server->bench_seq++;
+	server->bench_pending++;
+
+	return true;
+}
+
+static bool bench_nfy_cb(void *user_data)
+{
+	struct server *server = user_data;
+
+	/* A rate of 0 streams notifications as fast as the link allows */
+	if (!server->bench_rate)
+		server->bench_credits = BENCH_WINDOW;
+	else
+		server->bench_credits += server->bench_rate;
+
+	while (server->bench_pending < BENCH_WINDOW) {
+		if (server->bench_rate) {
+			if (server->bench_credits < 1000 / BENCH_INTERVAL)
+				break;
+
+			server->bench_credits -= 1000 / BENCH_INTERVAL;
+		} else if (!server->bench_credits--)
+			break;
+
+		if (!bench_send(server))
+			break;
+	}
+
+	/* Don't let credits pile up while the queue is full */
+	if (server->bench_credits > server->bench_rate)
+		server->bench_credits = server->bench_rate;
+
+	return true;
+}
+
+static void update_bench_simulation(struct server *server)
+{
+	timeout_remove(server->bench_timeout_id);
+	server->bench_timeout_id = 0;
+
+	if (!server->bench_enabled)
+		return;
+
+	server->bench_credits = 0;
+	server->bench_timeout_id = timeout_add(BENCH_INTERVAL, bench_nfy_cb,
+								server, NULL);
+}
+
+static void bench_data_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	static const uint8_t value[BT_ATT_MAX_VALUE_LEN];
+
+	if (offset > sizeof(value)) {
+		gatt_db_attribute_read_result(attrib, id,
+					BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+		return;
+	}
+
+	/* The response is truncated to fit the MTU of the bearer */
+	gatt_db_attribute_read_result(attrib, id, 0, value + offset,
+							sizeof(value) - offset);
+}
+
+static void bench_data_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+
+	server->bench_rx_count++;
+	server->bench_rx_bytes += len;
+
+	gatt_db_attribute_write_result(attrib, id, 0);
+}
+
+static void bench_ccc_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t value[2];
+
+	value[0] = server->bench_enabled ? 0x01 : 0x00;
+	value[1] = 0x00;
+
+	gatt_db_attribute_read_result(attrib, id, 0, value, 2);
+}
+
+static void bench_ccc_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t ecode = 0;
+
+	if (!value || len != 2) {
+		ecode = BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+		goto done;
+	}
+
+	if (offset) {
+		ecode = BT_ATT_ERROR_INVALID_OFFSET;
+		goto done;
+	}
+
+	if (value[0] > 0x01) {
+		ecode = 0x80;
+		goto done;
+	}
+
+	server->bench_enabled = value[0] == 0x01;
+
+	PRLOG("Benchmark: Notifications Enabled: %s\n",
+				server->bench_enabled ? "true" : "false");
+
+	update_bench_simulation(server);
+
+done:
+	gatt_db_attribute_write_result(attrib, id, ecode);
+}
+
+static void bench_ctrl_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t value[12];
+
+	put_le32(server->bench_rx_count, value);
+	put_le64(server->bench_rx_bytes, value + 4);
+
+	gatt_db_attribute_read_result(attrib, id, 0, value, sizeof(value));
+}
+
+/*
+ * Writing the control point sets the notification rate and size, both
+ * as little endian 16 bit values, and resets the counters.
+ */
+static void bench_ctrl_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t ecode = 0;
+
+	if (!value || len != 4) {
+		ecode = BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+		goto done;
+	}
+
+	if (offset) {
+		ecode = BT_ATT_ERROR_INVALID_OFFSET;
+		goto done;
+	}
+
+	server->bench_rate = get_le16(value);
+	server->bench_size = get_le16(value + 2);
+	server->bench_seq = 0;
+	server->bench_rx_count = 0;
+	server->bench_rx_bytes = 0;
+
+	PRLOG("Benchmark: rate %u size %u\n", server->bench_rate,
+							server->bench_size);
+
+	update_bench_simulation(server);
+
+done:
+	gatt_db_attribute_write_result(attrib, id, ecode);
+}
+
 static void confirm_write(struct gatt_db_attribute *attr, int err,
 							void *user_data)
 {
@@ -527,14 +761,55 @@ static void populate_hr_service(struct server *server)
 		gatt_db_service_set_active(service, true);
 }
 
+static void populate_bench_service(struct server *server)
+{
+	bt_uuid_t uuid;
+	struct gatt_db_attribute *service, *data;
+
+	bt_string_to_uuid(&uuid, UUID_BENCH);
+	service = gatt_db_add_service(server->db, &uuid, true, 6);
+
+	/* Data Characteristic for reads, writes and notifications */
+	bt_string_to_uuid(&uuid, UUID_BENCH_DATA);
+	data = gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_WRITE_WITHOUT_RESP |
+					BT_GATT_CHRC_PROP_NOTIFY,
+					bench_data_read_cb,
+					bench_data_write_cb, server);
+	server->bench_handle = gatt_db_attribute_get_handle(data);
+
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	gatt_db_service_add_descriptor(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					bench_ccc_read_cb,
+					bench_ccc_write_cb, server);
+
+	/* Control Point Characteristic */
+	bt_string_to_uuid(&uuid, UUID_BENCH_CTRL);
+	gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_WRITE,
+					bench_ctrl_read_cb,
+					bench_ctrl_write_cb, server);
+
+	gatt_db_service_set_active(service, true);
+}
+
 static void populate_db(struct server *server)
 {
 	populate_gap_service(server);
 	populate_gatt_service(server);
 	populate_hr_service(server);
+
+	if (server->bench_visible)
+		populate_bench_service(server);
 }
 
-static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
+static struct server *server_create(int fd, uint16_t mtu, bool hr_visible,
+							int bench_rate)
 {
 	struct server *server;
 	size_t name_len = strlen(test_device_name);
@@ -586,6 +861,9 @@ static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
 	}
 
 	server->hr_visible = hr_visible;
+	server->bench_visible = bench_rate >= 0;
+	server->bench_rate = bench_rate > 0 ? bench_rate : 0;
+	server->eatt_fd = -1;
 
 	if (verbose) {
 		bt_att_set_debug(server->att, BT_ATT_DEBUG_VERBOSE,
@@ -614,6 +892,13 @@ fail:
 static void server_destroy(struct server *server)
 {
 	timeout_remove(server->hr_timeout_id);
+	timeout_remove(server->bench_timeout_id);
+
+	if (server->eatt_fd >= 0) {
+		mainloop_remove_fd(server->eatt_fd);
+		close(server->eatt_fd);
+	}
+
 	bt_gatt_server_unref(server->gatt);
 	gatt_db_unref(server->db);
 }
@@ -631,6 +916,8 @@ static void usage(void)
 		"\t-t, --type [random|public] \t The source address type\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-r, --heart-rate\t\tEnable Heart Rate service\n"
+		"\t-b, --benchmark [rate]\t\tEnable benchmark service and "
+						"EATT, notifying at rate/s\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
 
@@ -641,6 +928,7 @@ static struct option main_options[] = {
 	{ "type",		1, 0, 't' },
 	{ "verbose",		0, 0, 'v' },
 	{ "heart-rate",		0, 0, 'r' },
+	{ "benchmark",		2, 0, 'b' },
 	{ "help",		0, 0, 'h' },
 	{ }
 };
@@ -707,6 +995,86 @@ fail:
 	return -1;
 }
 
+static void eatt_accept_cb(int fd, uint32_t events, void *user_data)
+{
+	struct server *server = user_data;
+	struct sockaddr_l2 addr;
+	socklen_t optlen;
+	int nsk;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(fd);
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	optlen = sizeof(addr);
+	nsk = accept(fd, (struct sockaddr *) &addr, &optlen);
+	if (nsk < 0) {
+		perror("Accept failed");
+		return;
+	}
+
+	if (bt_att_attach_fd(server->att, nsk) < 0) {
+		fprintf(stderr, "Failed to attach EATT channel\n");
+		close(nsk);
+		return;
+	}
+
+	PRLOG("EATT channel attached (%d channels)\n",
+					bt_att_get_channels(server->att));
+}
+
+static int l2cap_le_eatt_listen(bdaddr_t *src, int sec, uint8_t src_type)
+{
+	int sk;
+	struct sockaddr_l2 srcaddr;
+	struct bt_security btsec;
+	uint8_t mode = BT_MODE_EXT_FLOWCTL;
+
+	sk = socket(PF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK,
+							BTPROTO_L2CAP);
+	if (sk < 0) {
+		perror("Failed to create L2CAP socket");
+		return -1;
+	}
+
+	memset(&srcaddr, 0, sizeof(srcaddr));
+	srcaddr.l2_family = AF_BLUETOOTH;
+	srcaddr.l2_psm = htobs(BT_ATT_EATT_PSM);
+	srcaddr.l2_bdaddr_type = src_type;
+	bacpy(&srcaddr.l2_bdaddr, src);
+
+	if (bind(sk, (struct sockaddr *) &srcaddr, sizeof(srcaddr)) < 0) {
+		perror("Failed to bind EATT socket");
+		goto fail;
+	}
+
+	memset(&btsec, 0, sizeof(btsec));
+	btsec.level = sec;
+	if (setsockopt(sk, SOL_BLUETOOTH, BT_SECURITY, &btsec,
+							sizeof(btsec)) != 0) {
+		fprintf(stderr, "Failed to set L2CAP security level\n");
+		goto fail;
+	}
+
+	if (setsockopt(sk, SOL_BLUETOOTH, BT_MODE, &mode, sizeof(mode)) < 0) {
+		perror("Failed to set EATT mode");
+		goto fail;
+	}
+
+	if (listen(sk, 10) < 0) {
+		perror("Listening on EATT socket failed");
+		goto fail;
+	}
+
+	return sk;
+
+fail:
+	close(sk);
+	return -1;
+}
+
 static void notify_usage(void)
 {
 	printf("Usage: notify [options] <value_handle> <value>\n"
@@ -1137,9 +1505,10 @@ int main(int argc, char *argv[])
 	uint8_t src_type = BDADDR_LE_PUBLIC;
 	uint16_t mtu = 0;
 	bool hr_visible = false;
+	int bench_rate = -1;
 	struct server *server;
 
-	while ((opt = getopt_long(argc, argv, "+hvrs:t:m:i:",
+	while ((opt = getopt_long(argc, argv, "+hvrb::s:t:m:i:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1151,6 +1520,13 @@ int main(int argc, char *argv[])
 		case 'r':
 			hr_visible = true;
 			break;
+		case 'b':
+			bench_rate = optarg ? atoi(optarg) : BENCH_DEFAULT_RATE;
+			if (bench_rate < 0 || bench_rate > UINT16_MAX) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's':
 			if (strcmp(optarg, "low") == 0)
 				sec = BT_SECURITY_LOW;
@@ -1229,12 +1605,26 @@ int main(int argc, char *argv[])
 
 	mainloop_init();
 
-	server = server_create(fd, mtu, hr_visible);
+	server = server_create(fd, mtu, hr_visible, bench_rate);
 	if (!server) {
 		close(fd);
 		return EXIT_FAILURE;
 	}
 
+	if (bench_rate >= 0) {
+		server->eatt_fd = l2cap_le_eatt_listen(&src_addr, sec,
+								src_type);
+		if (server->eatt_fd >= 0 &&
+			mainloop_add_fd(server->eatt_fd, EPOLLIN,
+					eatt_accept_cb, server, NULL) < 0) {
+			close(server->eatt_fd);
+			server->eatt_fd = -1;
+		}
+
+		if (server->eatt_fd < 0)
+			fprintf(stderr, "EATT not available\n");
+	}
+
 	if (mainloop_add_fd(fileno(stdin),
 				EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
 				prompt_read_cb, server, NULL) < 0) {
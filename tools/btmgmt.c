@@ -27,6 +27,7 @@
 #include <stdbool.h>
 #include <wordexp.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -4295,6 +4296,325 @@ static void cmd_clr_devices(int argc, char **argv)
 	cmd_del_device(2, rm_argv);
 }
 
+#define BULK_PIPELINE	16
+#define BULK_MAX_KEYS	((UINT16_MAX - sizeof(struct mgmt_cp_load_link_keys)) \
+					/ sizeof(struct mgmt_link_key_info))
+
+struct bulk {
+	const char *name;
+	FILE *fp;
+	uint16_t index;
+	unsigned int total;
+	unsigned int failed;
+	unsigned int pending;
+	struct timespec start;
+};
+
+struct bulk_entry {
+	struct bulk *bulk;
+	unsigned int line;
+	unsigned int count;
+};
+
+static struct option bulk_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "pipeline",	1, 0, 'p' },
+	{ 0, 0, 0, 0 }
+};
+
+static struct bulk *bulk_new(const char *name, int argc, char **argv)
+{
+	struct bulk *bulk;
+	unsigned int depth = BULK_PIPELINE;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "+p:h", bulk_options,
+								NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			bt_shell_usage();
+			optind = 0;
+			bt_shell_noninteractive_quit(EXIT_SUCCESS);
+			return NULL;
+		default:
+			bt_shell_usage();
+			optind = 0;
+			bt_shell_noninteractive_quit(EXIT_FAILURE);
+			return NULL;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+	optind = 0;
+
+	if (argc < 1) {
+		bt_shell_usage();
+		bt_shell_noninteractive_quit(EXIT_FAILURE);
+		return NULL;
+	}
+
+	bulk = new0(struct bulk, 1);
+	bulk->name = name;
+
+	bulk->fp = fopen(argv[0], "r");
+	if (!bulk->fp) {
+		error("Unable to open %s: %s", argv[0], strerror(errno));
+		free(bulk);
+		bt_shell_noninteractive_quit(EXIT_FAILURE);
+		return NULL;
+	}
+
+	bulk->index = mgmt_index;
+	if (bulk->index == MGMT_INDEX_NONE)
+		bulk->index = 0;
+
+	/* Keep several commands in flight instead of one at a time */
+	mgmt_set_pipeline(mgmt, depth);
+
+	clock_gettime(CLOCK_MONOTONIC, &bulk->start);
+
+	return bulk;
+}
+
+static int bulk_fields(char *buf, char **fields, int max)
+{
+	char *comment, *tok, *saveptr = NULL;
+	int count = 0;
+
+	comment = strchr(buf, '#');
+	if (comment)
+		*comment = '\0';
+
+	tok = strtok_r(buf, " \t\r\n", &saveptr);
+	while (tok && count < max) {
+		fields[count++] = tok;
+		tok = strtok_r(NULL, " \t\r\n", &saveptr);
+	}
+
+	return count;
+}
+
+static void bulk_invalid(struct bulk *bulk, unsigned int line,
+							const char *reason)
+{
+	error("%s: line %u: %s", bulk->name, line, reason);
+	bulk->total++;
+	bulk->failed++;
+}
+
+static void bulk_done(struct bulk *bulk)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - bulk->start.tv_sec) * 1000 +
+				(now.tv_nsec - bulk->start.tv_nsec) / 1000000;
+
+	print("%s: %u of %u entries succeeded in %ld ms", bulk->name,
+				bulk->total - bulk->failed, bulk->total, ms);
+
+	mgmt_set_pipeline(mgmt, 0);
+
+	bt_shell_noninteractive_quit(bulk->failed ? EXIT_FAILURE :
+								EXIT_SUCCESS);
+	free(bulk);
+}
+
+static void bulk_rsp(uint8_t status, uint16_t len, const void *param,
+							void *user_data)
+{
+	struct bulk_entry *entry = user_data;
+	struct bulk *bulk = entry->bulk;
+
+	if (status != 0) {
+		error("%s: line %u failed with status 0x%02x (%s)",
+					bulk->name, entry->line, status,
+					mgmt_errstr(status));
+		bulk->failed += entry->count;
+	}
+
+	if (--bulk->pending == 0)
+		bulk_done(bulk);
+}
+
+static void bulk_send(struct bulk *bulk, uint16_t opcode, uint16_t len,
+				const void *param, unsigned int line,
+				unsigned int count)
+{
+	struct bulk_entry *entry;
+
+	entry = new0(struct bulk_entry, 1);
+	entry->bulk = bulk;
+	entry->line = line;
+	entry->count = count;
+
+	if (mgmt_send(mgmt, opcode, bulk->index, len, param, bulk_rsp,
+							entry, free) == 0) {
+		error("%s: line %u: unable to send command", bulk->name, line);
+		free(entry);
+		bulk->total += count;
+		bulk->failed += count;
+		return;
+	}
+
+	bulk->total += count;
+	bulk->pending++;
+}
+
+static void bulk_finish(struct bulk *bulk, char *buf)
+{
+	free(buf);
+	fclose(bulk->fp);
+	bulk->fp = NULL;
+
+	/* Responses only arrive once control is back in the mainloop */
+	if (!bulk->pending)
+		bulk_done(bulk);
+}
+
+static void cmd_bulk_add_device(int argc, char **argv)
+{
+	struct bulk *bulk;
+	char *buf = NULL;
+	size_t size = 0;
+	unsigned int line = 0;
+
+	bulk = bulk_new("bulk-add-device", argc, argv);
+	if (!bulk)
+		return;
+
+	while (getline(&buf, &size, bulk->fp) != -1) {
+		struct mgmt_cp_add_device cp;
+		char *fields[3];
+		int count;
+
+		line++;
+
+		count = bulk_fields(buf, fields, 3);
+		if (!count)
+			continue;
+
+		if (bachk(fields[0]) < 0) {
+			bulk_invalid(bulk, line, "invalid address");
+			continue;
+		}
+
+		memset(&cp, 0, sizeof(cp));
+		str2ba(fields[0], &cp.addr.bdaddr);
+		cp.addr.type = count > 1 ? strtol(fields[1], NULL, 0) :
+								BDADDR_BREDR;
+		cp.action = count > 2 ? strtol(fields[2], NULL, 0) : 0x00;
+
+		bulk_send(bulk, MGMT_OP_ADD_DEVICE, sizeof(cp), &cp, line, 1);
+	}
+
+	bulk_finish(bulk, buf);
+}
+
+static void cmd_bulk_del_device(int argc, char **argv)
+{
+	struct bulk *bulk;
+	char *buf = NULL;
+	size_t size = 0;
+	unsigned int line = 0;
+
+	bulk = bulk_new("bulk-del-device", argc, argv);
+	if (!bulk)
+		return;
+
+	while (getline(&buf, &size, bulk->fp) != -1) {
+		struct mgmt_cp_remove_device cp;
+		char *fields[2];
+		int count;
+
+		line++;
+
+		count = bulk_fields(buf, fields, 2);
+		if (!count)
+			continue;
+
+		if (bachk(fields[0]) < 0) {
+			bulk_invalid(bulk, line, "invalid address");
+			continue;
+		}
+
+		memset(&cp, 0, sizeof(cp));
+		str2ba(fields[0], &cp.addr.bdaddr);
+		cp.addr.type = count > 1 ? strtol(fields[1], NULL, 0) :
+								BDADDR_BREDR;
+
+		bulk_send(bulk, MGMT_OP_REMOVE_DEVICE, sizeof(cp), &cp, line,
+									1);
+	}
+
+	bulk_finish(bulk, buf);
+}
+
+static void cmd_bulk_keys(int argc, char **argv)
+{
+	struct mgmt_cp_load_link_keys *cp;
+	struct bulk *bulk;
+	char *buf = NULL;
+	size_t size = 0, cp_len;
+	unsigned int line = 0;
+	uint16_t count = 0;
+
+	bulk = bulk_new("bulk-keys", argc, argv);
+	if (!bulk)
+		return;
+
+	cp_len = sizeof(*cp) + BULK_MAX_KEYS * sizeof(cp->keys[0]);
+	cp = malloc0(cp_len);
+
+	while (getline(&buf, &size, bulk->fp) != -1) {
+		struct mgmt_link_key_info *info;
+		char *fields[4];
+		int n;
+
+		line++;
+
+		n = bulk_fields(buf, fields, 4);
+		if (!n)
+			continue;
+
+		if (bachk(fields[0]) < 0) {
+			bulk_invalid(bulk, line, "invalid address");
+			continue;
+		}
+
+		if (n < 2 || strlen(fields[1]) != 32) {
+			bulk_invalid(bulk, line, "invalid key");
+			continue;
+		}
+
+		if (count == BULK_MAX_KEYS) {
+			bulk_invalid(bulk, line, "too many keys");
+			continue;
+		}
+
+		info = &cp->keys[count++];
+		str2ba(fields[0], &info->addr.bdaddr);
+		info->addr.type = BDADDR_BREDR;
+		hex2bin(fields[1], info->val, sizeof(info->val));
+		info->type = n > 2 ? strtol(fields[2], NULL, 0) : 0x00;
+		info->pin_len = n > 3 ? strtol(fields[3], NULL, 0) : 0;
+	}
+
+	/* The kernel replaces its key list, so all keys go in one command */
+	cp->key_count = cpu_to_le16(count);
+	cp_len = sizeof(*cp) + count * sizeof(cp->keys[0]);
+
+	bulk_send(bulk, MGMT_OP_LOAD_LINK_KEYS, cp_len, cp, line, count);
+
+	free(cp);
+	bulk_finish(bulk, buf);
+}
+
 static void local_oob_ext_rsp(uint8_t status, uint16_t len, const void *param,
 							void *user_data)
 {
@@ -5604,6 +5924,12 @@ static const struct bt_shell_menu main_menu = {
 		cmd_del_device,		"Remove Device"			},
 	{ "clr-devices",	NULL,
 		cmd_clr_devices,	"Clear Devices"			},
+	{ "bulk-add-device",	"[-p pipeline] <file>",
+		cmd_bulk_add_device,	"Add Devices listed in file"	},
+	{ "bulk-del-device",	"[-p pipeline] <file>",
+		cmd_bulk_del_device,	"Remove Devices listed in file"	},
+	{ "bulk-keys",		"<file>",
+		cmd_bulk_keys,		"Load Link Keys listed in file"	},
 	{ "bredr-oob",		NULL,
 		cmd_bredr_oob,		"Local OOB data (BR/EDR)"	},
 	{ "le-oob",		NULL,
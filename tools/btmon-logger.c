@@ -38,6 +38,8 @@
 
 #define MONITOR_INDEX_NONE 0xffff
 
+#define FLUSH_INTERVAL 5000
+
 struct monitor_hdr {
 	uint16_t opcode;
 	uint16_t index;
@@ -186,6 +188,14 @@ static void drop_capabilities(void)
 		perror("Failed to set capabilities");
 }
 
+static void flush_callback(int id, void *user_data)
+{
+	btsnoop_flush(btsnoop_file);
+
+	if (mainloop_modify_timeout(id, FLUSH_INTERVAL) < 0)
+		mainloop_exit_failure();
+}
+
 static void usage(void)
 {
 	printf("btmon-logger - Bluetooth monitor\n"
@@ -196,6 +206,7 @@ static void usage(void)
 		"\t-p, --parents          Create basename parent directories\n"
 		"\t-l, --limit <limit>    Limit traces file size (rotate)\n"
 		"\t-c, --count <count>    Limit number of rotated files\n"
+		"\t-z, --compress         Save traces compressed\n"
 		"\t-v, --version          Show version\n"
 		"\t-h, --help             Show help options\n");
 }
@@ -205,6 +216,7 @@ static const struct option main_options[] = {
 	{ "parents",	no_argument,		NULL, 'p' },
 	{ "limit",	required_argument,	NULL, 'l' },
 	{ "count",	required_argument,	NULL, 'c' },
+	{ "compress",	no_argument,		NULL, 'z' },
 	{ "version",	no_argument,		NULL, 'v' },
 	{ "help",	no_argument,		NULL, 'h' },
 	{ }
@@ -263,6 +275,7 @@ int main(int argc, char *argv[])
 	unsigned long max_count = 0;
 	size_t size_limit = 0;
 	bool parents = false;
+	bool compress = false;
 	int exit_status;
 	char *endptr;
 
@@ -273,7 +286,7 @@ int main(int argc, char *argv[])
 	while (true) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "b:l:c:vhp", main_options,
+		opt = getopt_long(argc, argv, "b:l:c:zvhp", main_options,
 									NULL);
 		if (opt < 0)
 			break;
@@ -314,6 +327,9 @@ int main(int argc, char *argv[])
 		case 'c':
 			max_count = strtoul(optarg, &endptr, 10);
 			break;
+		case 'z':
+			compress = true;
+			break;
 		case 'p':
 			if (getppid() != 1) {
 				fprintf(stderr, "Parents option allowed only "
@@ -345,11 +361,20 @@ int main(int argc, char *argv[])
 	if (parents && create_dir(path) < 0)
 		return EXIT_FAILURE;
 
-	btsnoop_file = btsnoop_create(path, size_limit, max_count,
+	if (compress)
+		btsnoop_file = btsnoop_create_compressed(path, size_limit,
+					max_count, BTSNOOP_FORMAT_MONITOR);
+	else
+		btsnoop_file = btsnoop_create(path, size_limit, max_count,
 							BTSNOOP_FORMAT_MONITOR);
 	if (!btsnoop_file)
 		return EXIT_FAILURE;
 
+	/* Bound what is lost if we get killed with a block pending */
+	if (compress)
+		mainloop_add_timeout(FLUSH_INTERVAL, flush_callback, NULL,
+									NULL);
+
 	drop_capabilities();
 
 	printf("Bluetooth monitor logger ver %s\n", VERSION);
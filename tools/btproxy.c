@@ -28,13 +28,16 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 #include <netdb.h>
 #include <arpa/inet.h>
 
 #include "src/shared/util.h"
 #include "src/shared/mainloop.h"
+#include "src/shared/queue.h"
 #include "src/shared/ecc.h"
+#include "src/shared/h4.h"
 #include "monitor/bt.h"
 
 #define HCI_PRIMARY	0x00
@@ -54,6 +57,28 @@ static bool client_active = false;
 static bool debug_enabled = false;
 static bool emulate_ecc = false;
 static bool skip_first_zero = false;
+static bool mirror_enabled = false;
+
+/* Backlog after which packets for a slow observer are dropped */
+#define MIRROR_QUEUE_MAX	(256 * 1024)
+#define MIRROR_IOV_MAX		32
+
+static struct queue *observers = NULL;
+
+struct mirror_buf {
+	int ref_count;
+	uint16_t len;
+	uint8_t data[];
+};
+
+struct observer {
+	int fd;
+	struct queue *bufs;
+	size_t offset;
+	size_t queued;
+	unsigned int drops;
+	bool writing;
+};
 
 static void hexdump_print(const char *str, void *user_data)
 {
@@ -63,15 +88,13 @@ static void hexdump_print(const char *str, void *user_data)
 struct proxy {
 	/* Receive commands, ACL, SCO and ISO data */
 	int host_fd;
-	uint8_t host_buf[4096];
-	uint16_t host_len;
+	struct h4 *host_h4;
 	bool host_shutdown;
 	bool host_skip_first_zero;
 
 	/* Receive events, ACL, SCO and ISO data */
 	int dev_fd;
-	uint8_t dev_buf[4096];
-	uint16_t dev_len;
+	struct h4 *dev_h4;
 	bool dev_shutdown;
 
 	/* ECC emulation */
@@ -79,6 +102,13 @@ struct proxy {
 	uint8_t local_sk256[32];
 };
 
+static void free_proxy(struct proxy *proxy)
+{
+	h4_free(proxy->host_h4);
+	h4_free(proxy->dev_h4);
+	free(proxy);
+}
+
 static bool write_packet(int fd, const void *data, size_t size,
 							void *user_data)
 {
@@ -103,23 +133,30 @@ static bool write_packet(int fd, const void *data, size_t size,
 	return true;
 }
 
-static void host_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+/* Returns false if the proxy might have been freed */
+static bool host_write_packet(struct proxy *proxy, void *buf, uint16_t len)
 {
 	if (!write_packet(proxy->dev_fd, buf, len, "D: ")) {
 		fprintf(stderr, "Write to device descriptor failed\n");
 		mainloop_remove_fd(proxy->dev_fd);
+		return false;
 	}
+
+	return true;
 }
 
-static void dev_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+static bool dev_write_packet(struct proxy *proxy, void *buf, uint16_t len)
 {
 	if (!write_packet(proxy->host_fd, buf, len, "H: ")) {
 		fprintf(stderr, "Write to host descriptor failed\n");
 		mainloop_remove_fd(proxy->host_fd);
+		return false;
 	}
+
+	return true;
 }
 
-static void cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
+static bool cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
 {
 	size_t buf_size = 1 + sizeof(struct bt_hci_evt_hdr) +
 					sizeof(struct bt_hci_evt_cmd_status);
@@ -136,10 +173,10 @@ static void cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
 	cs->ncmd = 0x01;
 	cs->opcode = cpu_to_le16(opcode);
 
-	dev_write_packet(proxy, buf, buf_size);
+	return dev_write_packet(proxy, buf, buf_size);
 }
 
-static void le_meta_event(struct proxy *proxy, uint8_t event,
+static bool le_meta_event(struct proxy *proxy, uint8_t event,
 						void *data, uint8_t len)
 {
 	size_t buf_size = 1 + sizeof(struct bt_hci_evt_hdr) + 1 + len;
@@ -156,10 +193,10 @@ static void le_meta_event(struct proxy *proxy, uint8_t event,
 	if (len > 0)
 		memcpy(buf + 1 + sizeof(*hdr) + 1, data, len);
 
-	dev_write_packet(proxy, buf, buf_size);
+	return dev_write_packet(proxy, buf, buf_size);
 }
 
-static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
+static bool host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 {
 	uint8_t pkt_type = *((uint8_t *) buf);
 	struct bt_hci_cmd_hdr *hdr = buf + 1;
@@ -168,10 +205,8 @@ static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 	struct bt_hci_evt_le_read_local_pk256_complete lrlpkc;
 	struct bt_hci_evt_le_generate_dhkey_complete lgdc;
 
-	if (pkt_type != BT_H4_CMD_PKT) {
-		host_write_packet(proxy, buf, len);
-		return;
-	}
+	if (pkt_type != BT_H4_CMD_PKT)
+		return host_write_packet(proxy, buf, len);
 
 	switch (le16_to_cpu(hdr->opcode)) {
 	case BT_HCI_CMD_LE_SET_EVENT_MASK:
@@ -181,62 +216,60 @@ static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 		lsem->mask[0] &= ~0x80;		/* P-256 Public Key Complete */
 		lsem->mask[1] &= ~0x01;		/* Generate DHKey Complete */
 
-		host_write_packet(proxy, buf, len);
-		break;
+		return host_write_packet(proxy, buf, len);
 
 	case BT_HCI_CMD_LE_READ_LOCAL_PK256:
-		if (!ecc_make_key(lrlpkc.local_pk256, proxy->local_sk256)) {
-			cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
-					BT_HCI_CMD_LE_READ_LOCAL_PK256);
-			break;
-		}
-		cmd_status(proxy, BT_HCI_ERR_SUCCESS,
+		if (!ecc_make_key(lrlpkc.local_pk256, proxy->local_sk256))
+			return cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
 					BT_HCI_CMD_LE_READ_LOCAL_PK256);
 
+		if (!cmd_status(proxy, BT_HCI_ERR_SUCCESS,
+					BT_HCI_CMD_LE_READ_LOCAL_PK256))
+			return false;
+
 		if (!(proxy->event_mask[0] & 0x80))
 			break;
 
 		lrlpkc.status = BT_HCI_ERR_SUCCESS;
-		le_meta_event(proxy, BT_HCI_EVT_LE_READ_LOCAL_PK256_COMPLETE,
-						&lrlpkc, sizeof(lrlpkc));
-		break;
+		return le_meta_event(proxy,
+					BT_HCI_EVT_LE_READ_LOCAL_PK256_COMPLETE,
+					&lrlpkc, sizeof(lrlpkc));
 
 	case BT_HCI_CMD_LE_GENERATE_DHKEY:
 		lgd = buf + 1 + sizeof(*hdr);
 		if (!ecdh_shared_secret(lgd->remote_pk256, proxy->local_sk256,
-								lgdc.dhkey)) {
-			cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
+								lgdc.dhkey))
+			return cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
 						BT_HCI_CMD_LE_GENERATE_DHKEY);
-			break;
-		}
-		cmd_status(proxy, BT_HCI_ERR_SUCCESS,
-					BT_HCI_CMD_LE_GENERATE_DHKEY);
+
+		if (!cmd_status(proxy, BT_HCI_ERR_SUCCESS,
+					BT_HCI_CMD_LE_GENERATE_DHKEY))
+			return false;
 
 		if (!(proxy->event_mask[1] & 0x01))
 			break;
 
 		lgdc.status = BT_HCI_ERR_SUCCESS;
-		le_meta_event(proxy, BT_HCI_EVT_LE_GENERATE_DHKEY_COMPLETE,
-							&lgdc, sizeof(lgdc));
-		break;
+		return le_meta_event(proxy,
+					BT_HCI_EVT_LE_GENERATE_DHKEY_COMPLETE,
+					&lgdc, sizeof(lgdc));
 
 	default:
-		host_write_packet(proxy, buf, len);
-		break;
+		return host_write_packet(proxy, buf, len);
 	}
+
+	return true;
 }
 
-static void dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
+static bool dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 {
 	uint8_t pkt_type = *((uint8_t *) buf);
 	struct bt_hci_evt_hdr *hdr = buf + 1;
 	struct bt_hci_evt_cmd_complete *cc;
 	struct bt_hci_rsp_read_local_commands *rlc;
 
-	if (pkt_type != BT_H4_EVT_PKT) {
-		dev_write_packet(proxy, buf, len);
-		return;
-	}
+	if (pkt_type != BT_H4_EVT_PKT)
+		return dev_write_packet(proxy, buf, len);
 
 	switch (hdr->evt) {
 	case BT_HCI_EVT_CMD_COMPLETE:
@@ -250,13 +283,198 @@ static void dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 			break;
 		}
 
-		dev_write_packet(proxy, buf, len);
-		break;
+		return dev_write_packet(proxy, buf, len);
 
 	default:
-		dev_write_packet(proxy, buf, len);
-		break;
+		return dev_write_packet(proxy, buf, len);
+	}
+}
+
+static struct mirror_buf *mirror_buf_ref(struct mirror_buf *buf)
+{
+	__sync_fetch_and_add(&buf->ref_count, 1);
+
+	return buf;
+}
+
+static void mirror_buf_unref(void *data)
+{
+	struct mirror_buf *buf = data;
+
+	if (__sync_sub_and_fetch(&buf->ref_count, 1))
+		return;
+
+	free(buf);
+}
+
+static void observer_destroy(void *user_data)
+{
+	struct observer *obs = user_data;
+
+	printf("Closing observer descriptor\n");
+
+	queue_remove(observers, obs);
+	queue_destroy(obs->bufs, mirror_buf_unref);
+	close(obs->fd);
+	free(obs);
+}
+
+static bool observer_flush(struct observer *obs)
+{
+	struct iovec iov[MIRROR_IOV_MAX];
+
+	while (!queue_isempty(obs->bufs)) {
+		const struct queue_entry *entry;
+		int iovcnt = 0;
+		ssize_t written;
+
+		/* Gather as many queued packets as possible into one write */
+		for (entry = queue_get_entries(obs->bufs);
+				entry && iovcnt < MIRROR_IOV_MAX;
+				entry = entry->next) {
+			struct mirror_buf *buf = entry->data;
+
+			iov[iovcnt].iov_base = buf->data;
+			iov[iovcnt].iov_len = buf->len;
+			iovcnt++;
+		}
+
+		iov[0].iov_base += obs->offset;
+		iov[0].iov_len -= obs->offset;
+
+		written = writev(obs->fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return false;
+		}
+
+		written += obs->offset;
+		obs->offset = 0;
+
+		while (written > 0) {
+			struct mirror_buf *buf = queue_peek_head(obs->bufs);
+
+			if (written < buf->len) {
+				obs->offset = written;
+				break;
+			}
+
+			written -= buf->len;
+			obs->queued -= buf->len;
+			queue_pop_head(obs->bufs);
+			mirror_buf_unref(buf);
+		}
+	}
+
+	if (queue_isempty(obs->bufs)) {
+		if (obs->drops) {
+			printf("Observer dropped %u packets\n", obs->drops);
+			obs->drops = 0;
+		}
+
+		if (obs->writing) {
+			mainloop_modify_fd(obs->fd, EPOLLIN | EPOLLRDHUP);
+			obs->writing = false;
+		}
+	} else if (!obs->writing) {
+		mainloop_modify_fd(obs->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		obs->writing = true;
+	}
+
+	return true;
+}
+
+static void observer_callback(int fd, uint32_t events, void *user_data)
+{
+	struct observer *obs = user_data;
+	uint8_t buf[256];
+
+	if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+		mainloop_remove_fd(obs->fd);
+		return;
+	}
+
+	/* Observers are read-only, anything they send is discarded */
+	if (events & EPOLLIN) {
+		if (read(obs->fd, buf, sizeof(buf)) == 0) {
+			mainloop_remove_fd(obs->fd);
+			return;
+		}
+	}
+
+	if ((events & EPOLLOUT) && !observer_flush(obs))
+		mainloop_remove_fd(obs->fd);
+}
+
+static void observer_queue(void *data, void *user_data)
+{
+	struct observer *obs = data;
+	struct mirror_buf *buf = user_data;
+
+	/* Drop whole packets so the observer still sees valid framing */
+	if (obs->queued + buf->len > MIRROR_QUEUE_MAX) {
+		obs->drops++;
+		return;
+	}
+
+	queue_push_tail(obs->bufs, mirror_buf_ref(buf));
+	obs->queued += buf->len;
+
+	/*
+	 * Errors are picked up by the observer callback, removing the
+	 * observer here would modify the queue being iterated.
+	 */
+	if (!obs->writing && !observer_flush(obs))
+		shutdown(obs->fd, SHUT_RDWR);
+}
+
+static void mirror_packet(const void *data, uint16_t len)
+{
+	struct mirror_buf *buf;
+
+	if (queue_isempty(observers))
+		return;
+
+	/* Copied once and shared by all observers */
+	buf = malloc(sizeof(*buf) + len);
+	if (!buf)
+		return;
+
+	buf->ref_count = 1;
+	buf->len = len;
+	memcpy(buf->data, data, len);
+
+	queue_foreach(observers, observer_queue, buf);
+
+	mirror_buf_unref(buf);
+}
+
+static bool add_observer(int fd)
+{
+	struct observer *obs;
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return false;
+
+	obs = new0(struct observer, 1);
+	obs->fd = fd;
+	obs->bufs = queue_new();
+
+	if (mainloop_add_fd(fd, EPOLLIN | EPOLLRDHUP, observer_callback,
+						obs, observer_destroy) < 0) {
+		queue_destroy(obs->bufs, NULL);
+		free(obs);
+		return false;
 	}
+
+	queue_push_tail(observers, obs);
+
+	return true;
 }
 
 static void host_read_destroy(void *user_data)
@@ -273,20 +491,35 @@ static void host_read_destroy(void *user_data)
 
 	if (proxy->dev_fd < 0) {
 		client_active = false;
-		free(proxy);
+		free_proxy(proxy);
 	} else
 		mainloop_remove_fd(proxy->dev_fd);
 }
 
+static bool host_packet(void *data, uint16_t size, void *user_data)
+{
+	struct proxy *proxy = user_data;
+	uint8_t pkt_type = *((uint8_t *) data);
+
+	if (pkt_type == BT_H4_EVT_PKT) {
+		fprintf(stderr, "Received unknown host packet type 0x%02x\n",
+								pkt_type);
+		mainloop_remove_fd(proxy->host_fd);
+		return false;
+	}
+
+	if (emulate_ecc)
+		return host_emulate_ecc(proxy, data, size);
+
+	return host_write_packet(proxy, data, size);
+}
+
 static void host_read_callback(int fd, uint32_t events, void *user_data)
 {
 	struct proxy *proxy = user_data;
-	struct bt_hci_cmd_hdr *cmd_hdr;
-	struct bt_hci_acl_hdr *acl_hdr;
-	struct bt_hci_sco_hdr *sco_hdr;
-	struct bt_hci_iso_hdr *iso_hdr;
+	uint8_t *buf;
 	ssize_t len;
-	uint16_t pktlen;
+	size_t pending;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		fprintf(stderr, "Error from host descriptor\n");
@@ -300,10 +533,9 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	len = read(proxy->host_fd, proxy->host_buf + proxy->host_len,
-				sizeof(proxy->host_buf) - proxy->host_len);
+	len = h4_read(proxy->host_h4, proxy->host_fd);
 	if (len < 0) {
-		if (errno == EAGAIN || errno == EINTR)
+		if (len == -EAGAIN || len == -EINTR)
 			return;
 
 		fprintf(stderr, "Read from host descriptor failed\n");
@@ -311,82 +543,34 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
+	buf = h4_peek(proxy->host_h4, &pending);
+
 	if (debug_enabled)
-		util_hexdump('>', proxy->host_buf + proxy->host_len, len,
+		util_hexdump('>', buf + pending - len, len,
 						hexdump_print, "H: ");
 
 	if (proxy->host_skip_first_zero && len > 0) {
 		proxy->host_skip_first_zero = false;
-		if (proxy->host_buf[proxy->host_len] == '\0') {
+		if (buf[pending - len] == '\0') {
 			printf("Skipping initial zero byte\n");
-			len--;
-			memmove(proxy->host_buf + proxy->host_len,
-				proxy->host_buf + proxy->host_len + 1, len);
+			h4_drain(proxy->host_h4, 1);
 		}
 	}
 
-	proxy->host_len += len;
-
-process_packet:
-	if (proxy->host_len < 1)
+	/* Complete packets are forwarded straight from the read buffer */
+	if (h4_process(proxy->host_h4, host_packet, proxy) != -EBADMSG)
 		return;
 
-	switch (proxy->host_buf[0]) {
-	case BT_H4_CMD_PKT:
-		if (proxy->host_len < 1 + sizeof(*cmd_hdr))
-			return;
-
-		cmd_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->host_len < 1 + sizeof(*acl_hdr))
-			return;
-
-		acl_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->host_len < 1 + sizeof(*sco_hdr))
-			return;
-
-		sco_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	case BT_H4_ISO_PKT:
-		if (proxy->host_len < 1 + sizeof(*iso_hdr))
-			return;
+	buf = h4_peek(proxy->host_h4, &pending);
 
-		iso_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*iso_hdr) + cpu_to_le16(iso_hdr->dlen);
-		break;
-	case 0xff:
-		/* Notification packet from /dev/vhci - ignore */
-		proxy->host_len = 0;
-		return;
-	default:
-		fprintf(stderr, "Received unknown host packet type 0x%02x\n",
-							proxy->host_buf[0]);
-		mainloop_remove_fd(proxy->host_fd);
+	/* Notification packet from /dev/vhci - ignore */
+	if (buf[0] == 0xff) {
+		h4_drain(proxy->host_h4, pending);
 		return;
 	}
 
-	if (proxy->host_len < pktlen)
-		return;
-
-	if (emulate_ecc)
-		host_emulate_ecc(proxy, proxy->host_buf, pktlen);
-	else
-		host_write_packet(proxy, proxy->host_buf, pktlen);
-
-	if (proxy->host_len > pktlen) {
-		memmove(proxy->host_buf, proxy->host_buf + pktlen,
-						proxy->host_len - pktlen);
-		proxy->host_len -= pktlen;
-		goto process_packet;
-	}
-
-	proxy->host_len = 0;
+	fprintf(stderr, "Received unknown host packet type 0x%02x\n", buf[0]);
+	mainloop_remove_fd(proxy->host_fd);
 }
 
 static void dev_read_destroy(void *user_data)
@@ -403,20 +587,37 @@ static void dev_read_destroy(void *user_data)
 
 	if (proxy->host_fd < 0) {
 		client_active = false;
-		free(proxy);
+		free_proxy(proxy);
 	} else
 		mainloop_remove_fd(proxy->host_fd);
 }
 
+static bool dev_packet(void *data, uint16_t size, void *user_data)
+{
+	struct proxy *proxy = user_data;
+	uint8_t pkt_type = *((uint8_t *) data);
+
+	if (pkt_type == BT_H4_CMD_PKT) {
+		fprintf(stderr, "Received unknown device packet type 0x%02x\n",
+								pkt_type);
+		mainloop_remove_fd(proxy->dev_fd);
+		return false;
+	}
+
+	mirror_packet(data, size);
+
+	if (emulate_ecc)
+		return dev_emulate_ecc(proxy, data, size);
+
+	return dev_write_packet(proxy, data, size);
+}
+
 static void dev_read_callback(int fd, uint32_t events, void *user_data)
 {
 	struct proxy *proxy = user_data;
-	struct bt_hci_evt_hdr *evt_hdr;
-	struct bt_hci_acl_hdr *acl_hdr;
-	struct bt_hci_sco_hdr *sco_hdr;
-	struct bt_hci_iso_hdr *iso_hdr;
+	uint8_t *buf;
 	ssize_t len;
-	uint16_t pktlen;
+	size_t pending;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		fprintf(stderr, "Error from device descriptor\n");
@@ -430,10 +631,9 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	len = read(proxy->dev_fd, proxy->dev_buf + proxy->dev_len,
-				sizeof(proxy->dev_buf) - proxy->dev_len);
+	len = h4_read(proxy->dev_h4, proxy->dev_fd);
 	if (len < 0) {
-		if (errno == EAGAIN || errno == EINTR)
+		if (len == -EAGAIN || len == -EINTR)
 			return;
 
 		fprintf(stderr, "Read from device descriptor failed\n");
@@ -441,68 +641,20 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	if (debug_enabled)
-		util_hexdump('>', proxy->dev_buf + proxy->dev_len, len,
+	if (debug_enabled) {
+		buf = h4_peek(proxy->dev_h4, &pending);
+		util_hexdump('>', buf + pending - len, len,
 						hexdump_print, "D: ");
-
-	proxy->dev_len += len;
-
-process_packet:
-	if (proxy->dev_len < 1)
-		return;
-
-	switch (proxy->dev_buf[0]) {
-	case BT_H4_EVT_PKT:
-		if (proxy->dev_len < 1 + sizeof(*evt_hdr))
-			return;
-
-		evt_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*evt_hdr) + evt_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->dev_len < 1 + sizeof(*acl_hdr))
-			return;
-
-		acl_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->dev_len < 1 + sizeof(*sco_hdr))
-			return;
-
-		sco_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	case BT_H4_ISO_PKT:
-		if (proxy->dev_len < 1 + sizeof(*iso_hdr))
-			return;
-
-		iso_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*iso_hdr) + cpu_to_le16(iso_hdr->dlen);
-		break;
-	default:
-		fprintf(stderr, "Received unknown device packet type 0x%02x\n",
-							proxy->dev_buf[0]);
-		mainloop_remove_fd(proxy->dev_fd);
-		return;
 	}
 
-	if (proxy->dev_len < pktlen)
+	if (h4_process(proxy->dev_h4, dev_packet, proxy) != -EBADMSG)
 		return;
 
-	if (emulate_ecc)
-		dev_emulate_ecc(proxy, proxy->dev_buf, pktlen);
-	else
-		dev_write_packet(proxy, proxy->dev_buf, pktlen);
-
-	if (proxy->dev_len > pktlen) {
-		memmove(proxy->dev_buf, proxy->dev_buf + pktlen,
-						proxy->dev_len - pktlen);
-		proxy->dev_len -= pktlen;
-		goto process_packet;
-	}
+	buf = h4_peek(proxy->dev_h4, NULL);
 
-	proxy->dev_len = 0;
+	fprintf(stderr, "Received unknown device packet type 0x%02x\n",
+								buf[0]);
+	mainloop_remove_fd(proxy->dev_fd);
 }
 
 static bool setup_proxy(int host_fd, bool host_shutdown,
@@ -514,6 +666,13 @@ static bool setup_proxy(int host_fd, bool host_shutdown,
 	if (!proxy)
 		return false;
 
+	proxy->host_h4 = h4_new(H4_MAX_PACKET_SIZE);
+	proxy->dev_h4 = h4_new(H4_MAX_PACKET_SIZE);
+	if (!proxy->host_h4 || !proxy->dev_h4) {
+		free_proxy(proxy);
+		return false;
+	}
+
 	if (emulate_ecc)
 		printf("Enabling ECC emulation\n");
 
@@ -601,6 +760,16 @@ static void server_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
+	if (client_active && mirror_enabled) {
+		if (!add_observer(host_fd)) {
+			close(host_fd);
+			return;
+		}
+
+		printf("New observer connected\n");
+		return;
+	}
+
 	if (client_active && hci_index != HCI_INDEX_NONE) {
 		fprintf(stderr, "Active client already present\n");
 		close(host_fd);
@@ -769,6 +938,8 @@ static void usage(void)
 		"\t-i, --index <num>           Use specified controller\n"
 		"\t-a, --amp                   Create AMP controller\n"
 		"\t-e, --ecc                   Emulate ECC support\n"
+		"\t-m, --mirror                Mirror controller packets to\n"
+		"\t                            additional clients\n"
 		"\t-d, --debug                 Enable debugging output\n"
 		"\t-h, --help                  Show help options\n");
 }
@@ -782,6 +953,7 @@ static const struct option main_options[] = {
 	{ "index",    required_argument, NULL, 'i' },
 	{ "amp",      no_argument,       NULL, 'a' },
 	{ "ecc",      no_argument,       NULL, 'e' },
+	{ "mirror",   no_argument,       NULL, 'm' },
 	{ "debug",    no_argument,       NULL, 'd' },
 	{ "version",  no_argument,       NULL, 'v' },
 	{ "help",     no_argument,       NULL, 'h' },
@@ -801,7 +973,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "rc:l::u::p:i:aezdvh",
+		opt = getopt_long(argc, argv, "rc:l::u::p:i:aemzdvh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -852,6 +1024,9 @@ int main(int argc, char *argv[])
 		case 'e':
 			emulate_ecc = true;
 			break;
+		case 'm':
+			mirror_enabled = true;
+			break;
 		case 'z':
 			skip_first_zero = true;
 			break;
@@ -884,6 +1059,11 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (mirror_enabled && !unix_path && !server_address) {
+		fprintf(stderr, "Mirroring requires server mode\n");
+		return EXIT_FAILURE;
+	}
+
 	mainloop_init();
 
 	if (connect_address || use_redirect) {
@@ -938,6 +1118,9 @@ int main(int argc, char *argv[])
 
 		mainloop_add_fd(server_fd, EPOLLIN, server_callback,
 							NULL, NULL);
+
+		if (mirror_enabled)
+			observers = queue_new();
 	}
 
 	return mainloop_run_with_signal(signal_callback, NULL);
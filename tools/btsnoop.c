@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
@@ -51,32 +52,6 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 
 static const uint32_t btsnoop_version = 1;
 
-static int create_btsnoop(const char *path)
-{
-	struct btsnoop_hdr hdr;
-	ssize_t written;
-	int fd;
-
-	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
-	if (fd < 0) {
-		perror("failed to output file");
-		return -1;
-	}
-
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(2001);
-
-	written = write(fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
-		perror("failed to write output header");
-		close(fd);
-		return -1;
-	}
-
-	return fd;
-}
-
 static int open_btsnoop(const char *path, uint32_t *type)
 {
 	struct btsnoop_hdr hdr;
@@ -114,149 +89,227 @@ static int open_btsnoop(const char *path, uint32_t *type)
 	return fd;
 }
 
-#define MAX_MERGE 8
+#define MERGE_BUFFER_SIZE	(1024 * 1024)
+
+struct merge_input {
+	struct btsnoop *btsnoop;
+	uint16_t index;
+	uint64_t ts;
+	struct timeval tv;
+	uint16_t opcode;
+	const void *data;
+	uint16_t size;
+};
 
-static void command_merge(const char *output, int argc, char *argv[])
+static bool merge_read(struct merge_input *input, uint64_t to)
 {
-	struct btsnoop_pkt input_pkt[MAX_MERGE];
-	unsigned char buf[2048];
-	int output_fd, input_fd[MAX_MERGE], num_input = 0;
-	int i, select_input;
-	ssize_t len, written;
-	uint32_t toread, flags;
-	uint16_t index, opcode;
-
-	if (argc > MAX_MERGE) {
-		fprintf(stderr, "only up to %d files allowed\n", MAX_MERGE);
-		return;
-	}
+	uint16_t index;
 
-	for (i = 0; i < argc; i++) {
-		uint32_t type;
-		int fd;
+	do {
+		if (!btsnoop_next_hci(input->btsnoop, &input->tv, &index,
+						&input->opcode, &input->data,
+						&input->size))
+			return false;
 
-		fd = open_btsnoop(argv[i], &type);
-		if (fd < 0)
-			break;
+		input->ts = (uint64_t) input->tv.tv_sec * 1000000 +
+							input->tv.tv_usec;
+	} while (input->opcode == 0xffff);
 
-		if (type != 1002) {
-			fprintf(stderr, "unsupported link data type %u\n",
-									type);
-			close(fd);
+	return input->ts <= to;
+}
+
+static bool merge_before(const struct merge_input *a,
+					const struct merge_input *b)
+{
+	/* Equal timestamps keep the order of the input files */
+	if (a->ts != b->ts)
+		return a->ts < b->ts;
+
+	return a->index < b->index;
+}
+
+static void merge_sift_down(struct merge_input **heap, int num, int i)
+{
+	struct merge_input *tmp;
+	int child;
+
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && merge_before(heap[child + 1],
+								heap[child]))
+			child++;
+
+		if (!merge_before(heap[child], heap[i]))
 			break;
-		}
 
-		input_fd[num_input++] = fd;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
 	}
+}
 
-	if (num_input != argc) {
-		fprintf(stderr, "failed to open all input files\n");
-		goto close_input;
+static bool parse_window(const char *str, double *from, double *to)
+{
+	char *end;
+
+	*from = 0;
+	*to = -1;
+
+	if (*str != ',') {
+		*from = strtod(str, &end);
+		if (end == str || *from < 0)
+			return false;
+		str = end;
 	}
 
-	output_fd = create_btsnoop(output);
-	if (output_fd < 0)
-		goto close_input;
+	if (*str == '\0')
+		return true;
 
-	for (i = 0; i < num_input; i++) {
-		len = read(input_fd[i], &input_pkt[i], BTSNOOP_PKT_SIZE);
-		if (len < 0 || len != BTSNOOP_PKT_SIZE) {
-			close(input_fd[i]);
-			input_fd[i] = -1;
-		}
+	if (*str++ != ',')
+		return false;
+
+	*to = strtod(str, &end);
+	if (end == str || *end != '\0' || *to < *from)
+		return false;
+
+	return true;
+}
+
+/*
+ * The inputs are memory mapped by the btsnoop reader and merged with a
+ * heap ordered by timestamp, and the output is written in large chunks.
+ * With a time window, relative to the earliest record of all inputs,
+ * the index files written by --index are used to skip ahead.
+ */
+static void command_merge(const char *output, int argc, char *argv[],
+							const char *window)
+{
+	struct merge_input *inputs, **heap;
+	struct btsnoop *out;
+	int i, num, num_heap = 0;
+	double from_sec = 0, to_sec = -1;
+	uint64_t base = UINT64_MAX, from = 0, to = UINT64_MAX;
+	unsigned long count = 0;
+
+	if (window && !parse_window(window, &from_sec, &to_sec)) {
+		fprintf(stderr, "invalid time window %s\n", window);
+		return;
 	}
 
-next_packet:
-	select_input = -1;
+	if (argc > UINT16_MAX) {
+		fprintf(stderr, "only up to %d files allowed\n", UINT16_MAX);
+		return;
+	}
 
-	for (i = 0; i < num_input; i++) {
-		uint64_t ts;
+	inputs = calloc(argc, sizeof(*inputs));
+	heap = calloc(argc, sizeof(*heap));
+	if (!inputs || !heap) {
+		fprintf(stderr, "failed to allocate inputs\n");
+		goto done;
+	}
 
-		if (input_fd[i] < 0)
-			continue;
+	for (i = 0; i < argc; i++) {
+		struct merge_input *input = &inputs[i];
+		uint32_t format;
 
-		if (select_input < 0) {
-			select_input = i;
-			continue;
+		input->btsnoop = btsnoop_open(argv[i], 0);
+		if (!input->btsnoop) {
+			fprintf(stderr, "failed to open %s\n", argv[i]);
+			goto close_input;
 		}
 
-		ts = be64toh(input_pkt[i].ts);
+		format = btsnoop_get_format(input->btsnoop);
+		if (format != BTSNOOP_FORMAT_HCI &&
+					format != BTSNOOP_FORMAT_UART) {
+			fprintf(stderr, "unsupported link data type %u\n",
+									format);
+			goto close_input;
+		}
 
-		if (ts < be64toh(input_pkt[select_input].ts))
-			select_input = i;
-	}
+		input->index = i;
 
-	if (select_input < 0)
-		goto close_output;
+		if (!merge_read(input, UINT64_MAX))
+			continue;
 
-	toread = be32toh(input_pkt[select_input].size);
-	flags = be32toh(input_pkt[select_input].flags);
+		if (input->ts < base)
+			base = input->ts;
 
-	len = read(input_fd[select_input], buf, toread);
-	if (len < 0 || len != (ssize_t) toread) {
-		close(input_fd[select_input]);
-		input_fd[select_input] = -1;
-		goto next_packet;
+		heap[num_heap++] = input;
 	}
 
-	written = htobe32(toread - 1);
-	input_pkt[select_input].size = written;
-	input_pkt[select_input].len = written;
+	if (window && base != UINT64_MAX) {
+		from = base + (uint64_t) (from_sec * 1000000);
+		if (to_sec >= 0)
+			to = base + (uint64_t) (to_sec * 1000000);
 
-	switch (buf[0]) {
-	case 0x01:
-		opcode = BTSNOOP_OPCODE_COMMAND_PKT;
-		break;
-	case 0x02:
-		if (flags & 0x01)
-			opcode = BTSNOOP_OPCODE_ACL_RX_PKT;
-		else
-			opcode = BTSNOOP_OPCODE_ACL_TX_PKT;
-		break;
-	case 0x03:
-		if (flags & 0x01)
-			opcode = BTSNOOP_OPCODE_SCO_RX_PKT;
-		else
-			opcode = BTSNOOP_OPCODE_SCO_TX_PKT;
-		break;
-	case 0x04:
-		opcode = BTSNOOP_OPCODE_EVENT_PKT;
-		break;
-	default:
-		goto skip_write;
-	}
+		num = num_heap;
+		num_heap = 0;
+
+		for (i = 0; i < num; i++) {
+			struct merge_input *input = heap[i];
+			struct timeval tv;
+
+			tv.tv_sec = from / 1000000;
+			tv.tv_usec = from % 1000000;
 
-	index = select_input;
-	input_pkt[select_input].flags = htobe32((index << 16) | opcode);
+			if (input->ts < from &&
+					btsnoop_seek(input->btsnoop, &tv,
+							0xffff, 0xffff) &&
+					!merge_read(input, UINT64_MAX))
+				continue;
 
-	written = write(output_fd, &input_pkt[select_input], BTSNOOP_PKT_SIZE);
-	if (written != BTSNOOP_PKT_SIZE) {
-		fprintf(stderr, "write of packet header failed\n");
-		goto close_output;
+			while (input->ts < from)
+				if (!merge_read(input, UINT64_MAX))
+					break;
+
+			if (input->ts >= from && input->ts <= to)
+				heap[num_heap++] = input;
+		}
 	}
 
-	written = write(output_fd, buf + 1, toread - 1);
-	if (written != (ssize_t) toread - 1) {
-		fprintf(stderr, "write of packet data failed\n");
-		goto close_output;
+	out = btsnoop_create(output, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	if (!out) {
+		perror("failed to output file");
+		goto close_input;
 	}
 
-skip_write:
-	len = read(input_fd[select_input],
-				&input_pkt[select_input], BTSNOOP_PKT_SIZE);
-	if (len < 0 || len != BTSNOOP_PKT_SIZE) {
-		close(input_fd[select_input]);
-		input_fd[select_input] = -1;
+	btsnoop_set_write_buffer(out, MERGE_BUFFER_SIZE);
+
+	for (i = num_heap / 2 - 1; i >= 0; i--)
+		merge_sift_down(heap, num_heap, i);
+
+	while (num_heap > 0) {
+		struct merge_input *input = heap[0];
+
+		if (!btsnoop_write_hci(out, &input->tv, input->index,
+						input->opcode, 0,
+						input->data, input->size)) {
+			fprintf(stderr, "write of packet failed\n");
+			break;
+		}
+
+		count++;
+
+		if (!merge_read(input, to))
+			heap[0] = heap[--num_heap];
+
+		merge_sift_down(heap, num_heap, 0);
 	}
 
-	goto next_packet;
+	if (!btsnoop_flush(out))
+		fprintf(stderr, "failed to flush output file\n");
+	else
+		printf("%lu packets merged from %d files\n", count, argc);
 
-close_output:
-	close(output_fd);
+	btsnoop_unref(out);
 
 close_input:
-	for (i = 0; i < num_input; i++)
-		close(input_fd[i]);
+	for (i = 0; i < argc; i++)
+		btsnoop_unref(inputs[i].btsnoop);
+
+done:
+	free(heap);
+	free(inputs);
 }
 
 static void command_extract_eir(const char *input)
@@ -403,6 +456,292 @@ next_packet:
 close_input:
 	close(fd);
 }
+#define AD_MAX_MFR	4
+
+struct ad_entry {
+	uint8_t addr[6];
+	uint8_t addr_type;
+	int8_t rssi_min;
+	int8_t rssi_max;
+	uint8_t num_mfr;
+	uint16_t mfr[AD_MAX_MFR];
+	uint32_t types[8];
+	uint64_t first;
+	uint64_t last;
+	uint32_t count;
+};
+
+struct ad_table {
+	struct ad_entry *entries;
+	size_t count;
+	size_t alloc;
+};
+
+static void ad_table_add(struct ad_table *table, uint64_t ts,
+				uint8_t addr_type, const uint8_t *addr,
+				const uint8_t *data, uint8_t len, int8_t rssi)
+{
+	struct ad_entry *entry;
+	uint8_t i, j;
+
+	if (table->count == table->alloc) {
+		size_t alloc = table->alloc ? table->alloc * 2 : 4096;
+		struct ad_entry *entries;
+
+		entries = realloc(table->entries, alloc * sizeof(*entries));
+		if (!entries)
+			return;
+
+		table->entries = entries;
+		table->alloc = alloc;
+	}
+
+	entry = &table->entries[table->count++];
+	memset(entry, 0, sizeof(*entry));
+	memcpy(entry->addr, addr, 6);
+	entry->addr_type = addr_type;
+	entry->rssi_min = rssi;
+	entry->rssi_max = rssi;
+	entry->first = ts;
+	entry->last = ts;
+	entry->count = 1;
+
+	for (i = 0; i + 1 < len; i += data[i] + 1) {
+		uint8_t field_len = data[i];
+		uint8_t type = data[i + 1];
+		uint16_t mfr;
+
+		if (field_len == 0 || i + 1 + field_len > len)
+			break;
+
+		entry->types[type / 32] |= 1u << (type % 32);
+
+		if (type != 0xff || field_len < 3 ||
+					entry->num_mfr == AD_MAX_MFR)
+			continue;
+
+		mfr = data[i + 2] | data[i + 3] << 8;
+
+		/* Keep the manufacturer IDs sorted for comparing entries */
+		for (j = entry->num_mfr; j > 0 && entry->mfr[j - 1] > mfr; j--)
+			entry->mfr[j] = entry->mfr[j - 1];
+
+		if (j > 0 && entry->mfr[j - 1] == mfr) {
+			memmove(&entry->mfr[j], &entry->mfr[j + 1],
+				(entry->num_mfr - j) * sizeof(entry->mfr[0]));
+			continue;
+		}
+
+		entry->mfr[j] = mfr;
+		entry->num_mfr++;
+	}
+}
+
+static int ad_entry_key_cmp(const struct ad_entry *a, const struct ad_entry *b)
+{
+	int i;
+
+	/* Ordered as the address is printed */
+	for (i = 5; i >= 0; i--) {
+		if (a->addr[i] != b->addr[i])
+			return a->addr[i] < b->addr[i] ? -1 : 1;
+	}
+
+	if (a->addr_type != b->addr_type)
+		return a->addr_type < b->addr_type ? -1 : 1;
+
+	for (i = 0; i < 8; i++) {
+		if (a->types[i] != b->types[i])
+			return a->types[i] < b->types[i] ? -1 : 1;
+	}
+
+	if (a->num_mfr != b->num_mfr)
+		return a->num_mfr < b->num_mfr ? -1 : 1;
+
+	return memcmp(a->mfr, b->mfr, a->num_mfr * sizeof(a->mfr[0]));
+}
+
+static int ad_entry_cmp(const void *a, const void *b)
+{
+	const struct ad_entry *entry_a = a, *entry_b = b;
+	int cmp;
+
+	cmp = ad_entry_key_cmp(entry_a, entry_b);
+	if (cmp)
+		return cmp;
+
+	if (entry_a->first != entry_b->first)
+		return entry_a->first < entry_b->first ? -1 : 1;
+
+	return 0;
+}
+
+static void ad_table_parse(struct ad_table *table, uint64_t ts,
+					const uint8_t *buf, uint16_t size)
+{
+	const uint8_t *ptr;
+	uint16_t left;
+	uint8_t num, len;
+
+	/* LE Meta event with LE Advertising or Extended Advertising Report */
+	if (size < 4 || buf[0] != 0x3e)
+		return;
+
+	num = buf[3];
+	ptr = buf + 4;
+	left = size - 4;
+
+	while (num--) {
+		if (buf[2] == 0x02) {
+			/* type, address type, address, length, data, RSSI */
+			if (left < 10)
+				return;
+
+			len = ptr[8];
+			if (left < 10 + len)
+				return;
+
+			ad_table_add(table, ts, ptr[1], ptr + 2, ptr + 9, len,
+								ptr[9 + len]);
+
+			ptr += 10 + len;
+			left -= 10 + len;
+		} else if (buf[2] == 0x0d) {
+			/* RSSI at offset 13 and data after a 24 byte header */
+			if (left < 24)
+				return;
+
+			len = ptr[23];
+			if (left < 24 + len)
+				return;
+
+			ad_table_add(table, ts, ptr[2], ptr + 3, ptr + 24, len,
+								ptr[13]);
+
+			ptr += 24 + len;
+			left -= 24 + len;
+		} else
+			return;
+	}
+}
+
+static void print_ad_entry(const struct ad_entry *entry)
+{
+	bool first = true;
+	int i;
+
+	printf("%02X:%02X:%02X:%02X:%02X:%02X\t%u", entry->addr[5],
+				entry->addr[4], entry->addr[3],
+				entry->addr[2], entry->addr[1],
+				entry->addr[0], entry->addr_type);
+
+	printf("\t%" PRIu64 ".%06" PRIu64 "\t%" PRIu64 ".%06" PRIu64,
+				entry->first / 1000000, entry->first % 1000000,
+				entry->last / 1000000, entry->last % 1000000);
+
+	printf("\t%u\t%d\t%d\t", entry->count, entry->rssi_min,
+							entry->rssi_max);
+
+	for (i = 0; i < 256; i++) {
+		if (!(entry->types[i / 32] & (1u << (i % 32))))
+			continue;
+
+		printf("%s%02x", first ? "" : ",", i);
+		first = false;
+	}
+
+	printf("%s\t", first ? "-" : "");
+
+	for (i = 0; i < entry->num_mfr; i++)
+		printf("%s%04x", i ? "," : "", entry->mfr[i]);
+
+	printf("%s\n", entry->num_mfr ? "" : "-");
+}
+
+/*
+ * Writes one tab separated line per address and advertising content, with
+ * the AD types and manufacturer IDs as key, sorted by address and merged
+ * over all input files. Such a table is small compared to the captures and
+ * can be searched and joined with the standard text tools.
+ */
+static void ad_table_load(struct ad_table *table, const char *path)
+{
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+	uint16_t index, opcode, size;
+	const void *data;
+
+	btsnoop = btsnoop_open(path, 0);
+	if (!btsnoop) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return;
+	}
+
+	while (btsnoop_next_hci(btsnoop, &tv, &index, &opcode, &data, &size)) {
+		if (opcode != BTSNOOP_OPCODE_EVENT_PKT)
+			continue;
+
+		ad_table_parse(table, (uint64_t) tv.tv_sec * 1000000 +
+							tv.tv_usec, data, size);
+	}
+
+	btsnoop_unref(btsnoop);
+}
+
+/*
+ * Writes one tab separated line per address and advertising content, with
+ * the AD types and manufacturer IDs as key, sorted by address and merged
+ * over all input files. Such a table is small compared to the captures and
+ * can be searched and joined with the standard text tools.
+ */
+static void command_extract_ad_index(const char *input, int argc,
+								char *argv[])
+{
+	struct ad_table table;
+	struct ad_entry *merged = NULL;
+	size_t i;
+	int n;
+
+	memset(&table, 0, sizeof(table));
+
+	ad_table_load(&table, input);
+
+	for (n = 0; n < argc; n++)
+		ad_table_load(&table, argv[n]);
+
+	if (table.count)
+		qsort(table.entries, table.count, sizeof(*table.entries),
+								ad_entry_cmp);
+
+	printf("address\ttype\tfirst\tlast\tcount\trssi_min\trssi_max\t"
+						"ad_types\tmanufacturers\n");
+
+	for (i = 0; i < table.count; i++) {
+		struct ad_entry *entry = &table.entries[i];
+
+		if (merged && !ad_entry_key_cmp(merged, entry)) {
+			if (entry->last > merged->last)
+				merged->last = entry->last;
+			if (entry->rssi_min < merged->rssi_min)
+				merged->rssi_min = entry->rssi_min;
+			if (entry->rssi_max > merged->rssi_max)
+				merged->rssi_max = entry->rssi_max;
+			merged->count += entry->count;
+			continue;
+		}
+
+		if (merged)
+			print_ad_entry(merged);
+
+		merged = entry;
+	}
+
+	if (merged)
+		print_ad_entry(merged);
+
+	free(table.entries);
+}
+
 static const uint8_t conn_complete[] = { 0x04, 0x03, 0x0B, 0x00 };
 static const uint8_t disc_complete[] = { 0x04, 0x05, 0x04, 0x00 };
 
@@ -469,10 +808,24 @@ next_packet:
 			}
 
 			/* next 4 bytes are data len and cid */
+			if (len < 9 || len - 9 > (ssize_t) sizeof(pdu_buf)) {
+				current_cid = 0x0000;
+				pdu_len = 0;
+				goto next_packet;
+			}
+
 			current_cid = buf[8] << 8 | buf[7];
 			memcpy(pdu_buf, buf + 9, len - 9);
 			pdu_len = len - 9;
 		} else if (acl_flags & 0x01) {
+			/* drop PDUs that do not fit the reassembly buffer */
+			if (len < 5 || pdu_len + len - 5 >
+						(ssize_t) sizeof(pdu_buf)) {
+				current_cid = 0x0000;
+				pdu_len = 0;
+				goto next_packet;
+			}
+
 			memcpy(pdu_buf + pdu_len, buf + 5, len - 5);
 			pdu_len += len - 5;
 		}
@@ -497,6 +850,16 @@ close_input:
 	close(fd);
 }
 
+static void command_index(const char *input, unsigned int interval)
+{
+	if (!btsnoop_write_index(input, interval)) {
+		fprintf(stderr, "failed to index %s\n", input);
+		return;
+	}
+
+	printf("index written to %s.idx\n", input);
+}
+
 static void usage(void)
 {
 	printf("btsnoop trace file handling tool\n"
@@ -505,31 +868,45 @@ static void usage(void)
 	printf("commands:\n"
 		"\t-m, --merge <output>   Merge multiple btsnoop files\n"
 		"\t-e, --extract <input>  Extract data from btsnoop file\n"
+		"\t-i, --index <input>    Create index for btsnoop file\n"
 		"\t-h, --help             Show help options\n");
+	printf("extract types:\n"
+		"\teir, ad, sdp           Dump the data of single records\n"
+		"\tad-index [files]       Table of advertisers in all files\n");
+	printf("merge options:\n"
+		"\t-w, --window <from>[,<to>]\n"
+		"\t                       Only merge records in the window,\n"
+		"\t                       in seconds from the first record\n");
 }
 
 static const struct option main_options[] = {
 	{ "merge",   required_argument, NULL, 'm' },
 	{ "extract", required_argument, NULL, 'e' },
+	{ "index",   required_argument, NULL, 'i' },
 	{ "type",    required_argument, NULL, 't' },
+	{ "interval", required_argument, NULL, 'n' },
+	{ "window",  required_argument, NULL, 'w' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
 };
 
-enum { INVALID, MERGE, EXTRACT };
+enum { INVALID, MERGE, EXTRACT, INDEX };
 
 int main(int argc, char *argv[])
 {
 	const char *output_path = NULL;
 	const char *input_path = NULL;
 	const char *type = NULL;
+	const char *window = NULL;
+	unsigned int interval = 1000;
 	unsigned short command = INVALID;
 
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "m:e:t:vh", main_options, NULL);
+		opt = getopt_long(argc, argv, "m:e:i:t:n:w:vh", main_options,
+									NULL);
 		if (opt < 0)
 			break;
 
@@ -542,9 +919,23 @@ int main(int argc, char *argv[])
 			command = EXTRACT;
 			input_path = optarg;
 			break;
+		case 'i':
+			command = INDEX;
+			input_path = optarg;
+			break;
 		case 't':
 			type = optarg;
 			break;
+		case 'n':
+			interval = atoi(optarg);
+			if (!interval) {
+				fprintf(stderr, "invalid index interval\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			window = optarg;
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -563,10 +954,18 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
-		command_merge(output_path, argc - optind, argv + optind);
+		command_merge(output_path, argc - optind, argv + optind,
+								window);
 		break;
 
 	case EXTRACT:
+		/* The AD index is built over any number of input files */
+		if (type && !strcasecmp(type, "ad-index")) {
+			command_extract_ad_index(input_path, argc - optind,
+							argv + optind);
+			break;
+		}
+
 		if (argc - optind > 0) {
 			fprintf(stderr, "extra arguments not allowed\n");
 			return EXIT_FAILURE;
@@ -587,6 +986,15 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "extract type not supported\n");
 		break;
 
+	case INDEX:
+		if (argc - optind > 0) {
+			fprintf(stderr, "extra arguments not allowed\n");
+			return EXIT_FAILURE;
+		}
+
+		command_index(input_path, interval);
+		break;
+
 	default:
 		usage();
 		return EXIT_FAILURE;
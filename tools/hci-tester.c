@@ -924,6 +924,9 @@ int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
 
+	/* Generate the P-256 key pairs while the tests are idle */
+	ecc_set_key_pool(2);
+
 	test_hci_local("Reset", NULL, NULL, test_reset);
 
 	test_hci_local("Read Local Version Information", NULL, NULL,
@@ -44,6 +44,11 @@ enum {
 	AUDIO
 };
 
+#define READ_BUF_SIZE	65536
+#define OUT_BUF_SIZE	65536
+
+static char out_buf[OUT_BUF_SIZE];
+
 /* Default options */
 static int  snap_len = SNAP_LEN;
 static int  mode = PARSE;
@@ -106,6 +111,49 @@ static inline int read_n(int fd, char *buf, int len)
 	return t;
 }
 
+/*
+ * Dump files are read through a buffer, so that a long capture does not
+ * cost two read() calls per packet.
+ */
+static struct {
+	char data[READ_BUF_SIZE];
+	int start;
+	int end;
+} rbuf;
+
+static int read_buffered(int fd, char *buf, int len)
+{
+	int t = 0, w;
+
+	while (len > 0) {
+		if (rbuf.start == rbuf.end) {
+			w = read(fd, rbuf.data, sizeof(rbuf.data));
+			if (w < 0) {
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				return -1;
+			}
+			if (!w)
+				return 0;
+
+			rbuf.start = 0;
+			rbuf.end = w;
+		}
+
+		w = rbuf.end - rbuf.start;
+		if (w > len)
+			w = len;
+		if (buf) {
+			memcpy(buf, rbuf.data + rbuf.start, w);
+			buf += w;
+		}
+
+		rbuf.start += w;
+		len -= w; t += w;
+	}
+	return t;
+}
+
 static inline int write_n(int fd, char *buf, int len)
 {
 	int t = 0, w;
@@ -162,6 +210,7 @@ static int process_frames(int dev, int sock, int fd, unsigned long flags)
 		printf("device: hci%d ", dev);
 
 	printf("snap_len: %d filter: 0x%lx\n", snap_len, parser.filter);
+	fflush(stdout);
 
 	memset(&msg, 0, sizeof(msg));
 
@@ -256,8 +305,9 @@ static int process_frames(int dev, int sock, int fd, unsigned long flags)
 			break;
 
 		default:
-			/* Parse and print */
+			/* Parse and print, one write per packet */
 			parse(&frm);
+			fflush(stdout);
 			break;
 		}
 	}
@@ -281,11 +331,11 @@ static void read_dump(int fd)
 
 	while (1) {
 		if (parser.flags & DUMP_PKTLOG)
-			err = read_n(fd, (void *) &ph, PKTLOG_HDR_SIZE);
+			err = read_buffered(fd, (void *) &ph, PKTLOG_HDR_SIZE);
 		else if (parser.flags & DUMP_BTSNOOP)
-			err = read_n(fd, (void *) &dp, BTSNOOP_PKT_SIZE);
+			err = read_buffered(fd, (void *) &dp, BTSNOOP_PKT_SIZE);
 		else
-			err = read_n(fd, (void *) &dh, HCIDUMP_HDR_SIZE);
+			err = read_buffered(fd, (void *) &dh, HCIDUMP_HDR_SIZE);
 
 		if (err < 0)
 			goto failed;
@@ -311,12 +361,15 @@ static void read_dump(int fd)
 				frm.in = 1;
 				break;
 			default:
-				lseek(fd, be32toh(ph.len) - 9, SEEK_CUR);
+				err = read_buffered(fd, NULL,
+							be32toh(ph.len) - 9);
+				if (err < 0)
+					goto failed;
 				continue;
 			}
 
 			frm.data_len = be32toh(ph.len) - 8;
-			err = read_n(fd, frm.data + 1, frm.data_len - 1);
+			err = read_buffered(fd, frm.data + 1, frm.data_len - 1);
 		} else if (parser.flags & DUMP_BTSNOOP) {
 			uint32_t opcode;
 			uint8_t pkt_type;
@@ -334,12 +387,13 @@ static void read_dump(int fd)
 				((uint8_t *) frm.data)[0] = pkt_type;
 
 				frm.data_len = be32toh(dp.len) + 1;
-				err = read_n(fd, frm.data + 1, frm.data_len - 1);
+				err = read_buffered(fd, frm.data + 1,
+							frm.data_len - 1);
 				break;
 
 			case 1002:
 				frm.data_len = be32toh(dp.len);
-				err = read_n(fd, frm.data, frm.data_len);
+				err = read_buffered(fd, frm.data, frm.data_len);
 				break;
 
 			case 2001:
@@ -378,11 +432,12 @@ static void read_dump(int fd)
 				((uint8_t *) frm.data)[0] = pkt_type;
 
 				frm.data_len = be32toh(dp.len) + 1;
-				err = read_n(fd, frm.data + 1, frm.data_len - 1);
+				err = read_buffered(fd, frm.data + 1,
+							frm.data_len - 1);
 			}
 		} else {
 			frm.data_len = btohs(dh.len);
-			err = read_n(fd, frm.data, frm.data_len);
+			err = read_buffered(fd, frm.data, frm.data_len);
 		}
 
 		if (err < 0)
@@ -768,6 +823,10 @@ int main(int argc, char *argv[])
 	argv += optind;
 	optind = 0;
 
+	/* Decoded packets are written out in one go instead of per field */
+	if (mode == PARSE || mode == READ)
+		setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
 	printf("HCI sniffer - Bluetooth packet analyzer ver %s\n", VERSION);
 
 	if (argc > 0)
@@ -29,6 +29,7 @@
 
 #include "src/shared/tester.h"
 #include "src/shared/mgmt.h"
+#include "src/shared/util.h"
 
 struct test_data {
 	const void *test_data;
@@ -196,6 +197,65 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 	tester_print("New hciemu instance created");
 }
 
+/*
+ * With --reuse the emulated controllers are kept between tests, which
+ * saves creating and removing a vhci device and its index every time.
+ */
+static struct {
+	enum hciemu_type type;
+	struct hciemu *hciemu;
+	uint16_t index;
+} pool[] = {
+	{ HCIEMU_TYPE_BREDR },
+	{ HCIEMU_TYPE_LE },
+};
+
+static bool pool_get(struct test_data *data)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (pool[i].type != data->hciemu_type || !pool[i].hciemu)
+			continue;
+
+		data->hciemu = pool[i].hciemu;
+		data->mgmt_index = pool[i].index;
+		pool[i].hciemu = NULL;
+
+		return true;
+	}
+
+	return false;
+}
+
+static bool pool_put(struct test_data *data)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(pool); i++) {
+		if (pool[i].type != data->hciemu_type || pool[i].hciemu)
+			continue;
+
+		pool[i].hciemu = data->hciemu;
+		pool[i].index = data->mgmt_index;
+		data->hciemu = NULL;
+
+		return true;
+	}
+
+	return false;
+}
+
+static void pool_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(pool); i++) {
+		hciemu_unref(pool[i].hciemu);
+		pool[i].hciemu = NULL;
+	}
+}
+
 static void test_pre_setup(const void *test_data)
 {
 	struct test_data *data = tester_get_data();
@@ -210,10 +270,78 @@ static void test_pre_setup(const void *test_data)
 	if (tester_use_debug())
 		mgmt_set_debug(data->mgmt, print_debug, "mgmt: ", NULL);
 
+	if (tester_use_reuse() && pool_get(data)) {
+		tester_print("Reusing hciemu instance");
+
+		mgmt_send(data->mgmt, MGMT_OP_READ_INFO, data->mgmt_index, 0,
+					NULL, read_info_callback, NULL, NULL);
+		return;
+	}
+
 	mgmt_send(data->mgmt, MGMT_OP_READ_INDEX_LIST, MGMT_INDEX_NONE, 0, NULL,
 					read_index_list_callback, NULL, NULL);
 }
 
+static void reset_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct test_data *data = tester_get_data();
+
+	if (status || !hciemu_reset(data->hciemu) || !pool_put(data)) {
+		tester_warn("Unable to reuse hciemu instance");
+		hciemu_unref(data->hciemu);
+		data->hciemu = NULL;
+	}
+
+	mgmt_unregister_index(data->mgmt, data->mgmt_index);
+
+	mgmt_unref(data->mgmt);
+	data->mgmt = NULL;
+
+	tester_post_teardown_complete();
+}
+
+/*
+ * Undo whatever the setup functions and pairing may have changed so the
+ * next test finds the controller as if its index had just been added.
+ */
+static void reset_controller(struct test_data *data)
+{
+	struct mgmt_cp_load_link_keys keys;
+	struct mgmt_cp_load_long_term_keys ltks;
+	unsigned char param[] = { 0x00 };
+
+	mgmt_send(data->mgmt, MGMT_OP_SET_POWERED, data->mgmt_index,
+				sizeof(param), param, NULL, NULL, NULL);
+
+	mgmt_send(data->mgmt, MGMT_OP_SET_CONNECTABLE, data->mgmt_index,
+				sizeof(param), param, NULL, NULL, NULL);
+
+	mgmt_send(data->mgmt, MGMT_OP_SET_BONDABLE, data->mgmt_index,
+				sizeof(param), param, NULL, NULL, NULL);
+
+	if (data->hciemu_type == HCIEMU_TYPE_LE) {
+		memset(&ltks, 0, sizeof(ltks));
+
+		mgmt_send(data->mgmt, MGMT_OP_SET_ADVERTISING,
+				data->mgmt_index, sizeof(param), param,
+				NULL, NULL, NULL);
+
+		mgmt_send(data->mgmt, MGMT_OP_LOAD_LONG_TERM_KEYS,
+				data->mgmt_index, sizeof(ltks), &ltks,
+				reset_complete, NULL, NULL);
+		return;
+	}
+
+	memset(&keys, 0, sizeof(keys));
+
+	mgmt_send(data->mgmt, MGMT_OP_SET_SSP, data->mgmt_index,
+				sizeof(param), param, NULL, NULL, NULL);
+
+	mgmt_send(data->mgmt, MGMT_OP_LOAD_LINK_KEYS, data->mgmt_index,
+				sizeof(keys), &keys, reset_complete, NULL, NULL);
+}
+
 static void test_post_teardown(const void *test_data)
 {
 	struct test_data *data = tester_get_data();
@@ -223,6 +351,11 @@ static void test_post_teardown(const void *test_data)
 		data->io_id = 0;
 	}
 
+	if (tester_use_reuse() && data->mgmt) {
+		reset_controller(data);
+		return;
+	}
+
 	hciemu_unref(data->hciemu);
 	data->hciemu = NULL;
 }
@@ -1922,6 +2055,8 @@ done:
 
 int main(int argc, char *argv[])
 {
+	int ret;
+
 	tester_init(&argc, &argv);
 
 	test_l2cap_bredr("Basic L2CAP Socket - Success", NULL,
@@ -2072,5 +2207,9 @@ int main(int argc, char *argv[])
 				&le_att_server_success_test_1,
 				setup_powered_server, test_server);
 
-	return tester_run();
+	ret = tester_run();
+
+	pool_free();
+
+	return ret;
 }
@@ -22,8 +22,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <getopt.h>
 #include <syslog.h>
+#include <time.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <poll.h>
@@ -63,6 +65,8 @@ enum {
 	CSENDRECV,
 	INFOREQ,
 	PAIRING,
+	ECHO,
+	BENCHMARK,
 };
 
 static unsigned char *buf;
@@ -124,6 +128,15 @@ static int rcvbuf = 0;
 static int chan_policy = -1;
 static int bdaddr_type = 0;
 
+/* Benchmark parameters */
+#define MAX_BENCH_SIZES 16
+
+static int bench_sizes[MAX_BENCH_SIZES];
+static int bench_num_sizes = 0;
+static int bench_warmup = 1;
+static int bench_duration = 5;
+static int bench_window = 4;
+
 struct lookup_table {
 	const char *name;
 	int flag;
@@ -1035,6 +1048,283 @@ static void send_and_recv_mode(int sk)
 	return;
 }
 
+static void echo_mode(int sk)
+{
+	int len;
+
+	syslog(LOG_INFO, "Echoing ...");
+
+	while (1) {
+		len = recv(sk, buf, buffer_size, 0);
+		if (len <= 0) {
+			if (len < 0)
+				syslog(LOG_ERR, "Read failed: %s (%d)",
+							strerror(errno), errno);
+			return;
+		}
+
+		if (send(sk, buf, len, 0) != len) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			return;
+		}
+	}
+}
+
+/* Each benchmark packet starts with its sequence number and send time */
+#define BENCH_HDR_SIZE	(sizeof(uint32_t) + sizeof(uint64_t))
+
+struct bench_result {
+	int size;
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t duration;
+	uint64_t *latency;
+	size_t latency_len;
+	size_t latency_size;
+	uint64_t jitter_sum;
+	uint64_t last_latency;
+	uint32_t lost;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_record(struct bench_result *res, uint64_t latency)
+{
+	if (res->latency_len == res->latency_size) {
+		size_t size = res->latency_size ? res->latency_size * 2 : 1024;
+		uint64_t *latency;
+
+		latency = realloc(res->latency, size * sizeof(*latency));
+		if (!latency)
+			return;
+
+		res->latency = latency;
+		res->latency_size = size;
+	}
+
+	/* Jitter as the mean difference between consecutive latencies */
+	if (res->latency_len)
+		res->jitter_sum += latency > res->last_latency ?
+					latency - res->last_latency :
+					res->last_latency - latency;
+
+	res->latency[res->latency_len++] = latency;
+	res->last_latency = latency;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	uint64_t l1 = *(const uint64_t *) a;
+	uint64_t l2 = *(const uint64_t *) b;
+
+	return l1 < l2 ? -1 : l1 > l2;
+}
+
+static double bench_percentile(struct bench_result *res, int percent)
+{
+	size_t idx;
+
+	if (!res->latency_len)
+		return 0;
+
+	idx = (res->latency_len - 1) * percent / 100;
+
+	return res->latency[idx] / 1000.0;
+}
+
+/*
+ * Keep up to bench_window packets in flight and time the round trip of
+ * each one via the echo on the remote side. Only packets sent after the
+ * warm-up period count towards the results.
+ */
+static int bench_run(int sk, int size, uint32_t *seq, struct bench_result *res)
+{
+	uint64_t start, measure, end, now;
+	uint32_t first_seq = *seq, measure_seq = 0;
+	int inflight = 0, i;
+	struct pollfd p;
+
+	memset(res, 0, sizeof(*res));
+	res->size = size;
+
+	for (i = BENCH_HDR_SIZE; i < size; i++)
+		buf[i] = 0x7f;
+
+	start = bench_now();
+	measure = start + (uint64_t) bench_warmup * 1000000000;
+	end = measure + (uint64_t) bench_duration * 1000000000;
+
+	p.fd = sk;
+	p.events = POLLIN;
+
+	while ((now = bench_now()) < end || inflight > 0) {
+		uint64_t sent;
+		uint32_t sq;
+		int len, timeout;
+
+		while (now < end && inflight < bench_window) {
+			if (now >= measure && !measure_seq)
+				measure_seq = *seq;
+
+			put_le32(*seq, buf);
+			put_le64(now, buf + sizeof(uint32_t));
+
+			if (send(sk, buf, size, 0) != size) {
+				syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+				return -1;
+			}
+
+			(*seq)++;
+			inflight++;
+		}
+
+		/* Give packets in flight one second once the run is over */
+		timeout = now < end ? (int) ((end - now) / 1000000) + 1 : 1000;
+
+		p.revents = 0;
+		if (poll(&p, 1, timeout) <= 0) {
+			res->lost += inflight;
+			break;
+		}
+
+		len = recv(sk, buf, buffer_size, 0);
+		if (len <= 0) {
+			syslog(LOG_ERR, "Read failed: %s (%d)",
+							strerror(errno), errno);
+			return -1;
+		}
+
+		if ((size_t) len < BENCH_HDR_SIZE)
+			continue;
+
+		sq = get_le32(buf);
+		sent = get_le64(buf + sizeof(uint32_t));
+
+		/* Ignore echoes of previous runs */
+		if (sq < first_seq)
+			continue;
+
+		inflight--;
+
+		if (!measure_seq || sq < measure_seq)
+			continue;
+
+		bench_record(res, bench_now() - sent);
+		res->packets++;
+		res->bytes += len;
+	}
+
+	if (measure_seq)
+		res->duration = bench_now() - measure;
+
+	qsort(res->latency, res->latency_len, sizeof(*res->latency),
+							bench_compare);
+
+	return 0;
+}
+
+static void bench_print(struct bench_result *res, bool last)
+{
+	double secs = res->duration / 1000000000.0;
+
+	printf("    {\n");
+	printf("      \"size\": %d,\n", res->size);
+	printf("      \"packets\": %" PRIu64 ",\n", res->packets);
+	printf("      \"bytes\": %" PRIu64 ",\n", res->bytes);
+	printf("      \"lost\": %u,\n", res->lost);
+	printf("      \"duration_s\": %.3f,\n", secs);
+	printf("      \"throughput_bps\": %.0f,\n",
+				secs > 0 ? res->bytes * 8 / secs : 0);
+	printf("      \"jitter_us\": %.1f,\n", res->latency_len > 1 ?
+				res->jitter_sum / 1000.0 /
+				(res->latency_len - 1) : 0);
+	printf("      \"latency_us\": {\n");
+	printf("        \"min\": %.1f,\n", bench_percentile(res, 0));
+	printf("        \"p50\": %.1f,\n", bench_percentile(res, 50));
+	printf("        \"p90\": %.1f,\n", bench_percentile(res, 90));
+	printf("        \"p99\": %.1f,\n", bench_percentile(res, 99));
+	printf("        \"max\": %.1f\n", bench_percentile(res, 100));
+	printf("      }\n");
+	printf("    }%s\n", last ? "" : ",");
+}
+
+static void benchmark_mode(int sk)
+{
+	struct bench_result res;
+	uint32_t seq = 0;
+	int i;
+
+	if (!bench_num_sizes)
+		bench_sizes[bench_num_sizes++] = omtu;
+
+	printf("{\n");
+	printf("  \"mode\": \"%s\",\n",
+			get_lookup_str(l2cap_modes, rfcmode) ? : "basic");
+	printf("  \"imtu\": %d,\n", imtu);
+	printf("  \"omtu\": %d,\n", omtu);
+	printf("  \"rcvbuf\": %d,\n", rcvbuf);
+	printf("  \"window\": %d,\n", bench_window);
+	printf("  \"warmup_s\": %d,\n", bench_warmup);
+	printf("  \"duration_s\": %d,\n", bench_duration);
+	printf("  \"results\": [\n");
+
+	for (i = 0; i < bench_num_sizes; i++) {
+		int size = bench_sizes[i];
+
+		if (size < (int) BENCH_HDR_SIZE)
+			size = BENCH_HDR_SIZE;
+
+		if (size > omtu) {
+			syslog(LOG_ERR, "Size %d exceeds the MTU %d",
+								size, omtu);
+			size = omtu;
+		}
+
+		syslog(LOG_INFO, "Running benchmark with %d bytes", size);
+
+		if (bench_run(sk, size, &seq, &res) < 0) {
+			free(res.latency);
+			break;
+		}
+
+		bench_print(&res, i == bench_num_sizes - 1);
+		free(res.latency);
+	}
+
+	printf("  ]\n");
+	printf("}\n");
+	fflush(stdout);
+
+	shutdown(sk, SHUT_RDWR);
+}
+
+static int parse_bench_sizes(char *list)
+{
+	char *ptr;
+
+	for (ptr = strtok(list, ","); ptr; ptr = strtok(NULL, ",")) {
+		if (bench_num_sizes == MAX_BENCH_SIZES)
+			return -1;
+
+		bench_sizes[bench_num_sizes] = atoi(ptr);
+		if (bench_sizes[bench_num_sizes] <= 0)
+			return -1;
+
+		bench_num_sizes++;
+	}
+
+	return 0;
+}
+
 static void reconnect_mode(char *svr)
 {
 	while (1) {
@@ -1297,7 +1587,9 @@ static void usage(void)
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
 		"\t-p trigger dedicated bonding\n"
-		"\t-z information request\n");
+		"\t-z information request\n"
+		"\t-l listen and echo incoming data\n"
+		"\t-f connect and run benchmark against echo\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P psm] [-J cid]\n"
@@ -1326,17 +1618,22 @@ static void usage(void)
 		"\t[-M] become central\n"
 		"\t[-T] enable timestamps\n"
 		"\t[-V type] address type (help for list, default = bredr)\n"
-		"\t[-e seq] initial sequence value (default = 0)\n");
+		"\t[-e seq] initial sequence value (default = 0)\n"
+		"\t[-j sizes] benchmark payload sizes, comma separated "
+		"(default = omtu)\n"
+		"\t[-k seconds] benchmark warm-up (default = 1)\n"
+		"\t[-o seconds] benchmark duration (default = 5)\n"
+		"\t[-h num] benchmark packets in flight (default = 4)\n");
 }
 
 int main(int argc, char *argv[])
 {
 	struct sigaction sa;
-	int opt, sk, mode = RECV, need_addr = 0;
+	int opt, sk, i, mode = RECV, need_addr = 0;
 
 	bacpy(&bdaddr, BDADDR_ANY);
 
-	while ((opt = getopt(argc, argv, "a:b:cde:g:i:mnpqrstuwxyz"
+	while ((opt = getopt(argc, argv, "a:b:cde:fg:h:i:j:k:lmno:pqrstuwxyz"
 		"AB:C:D:EF:GH:I:J:K:L:MN:O:P:Q:RSTUV:W:X:Y:Z:")) != EOF) {
 		switch (opt) {
 		case 'r':
@@ -1403,6 +1700,36 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'l':
+			mode = ECHO;
+			break;
+
+		case 'f':
+			mode = BENCHMARK;
+			need_addr = 1;
+			break;
+
+		case 'j':
+			if (parse_bench_sizes(optarg) < 0) {
+				fprintf(stderr, "Invalid benchmark sizes\n");
+				exit(1);
+			}
+			break;
+
+		case 'k':
+			bench_warmup = atoi(optarg);
+			break;
+
+		case 'o':
+			bench_duration = atoi(optarg);
+			break;
+
+		case 'h':
+			bench_window = atoi(optarg);
+			if (bench_window < 1)
+				bench_window = 1;
+			break;
+
 		case 'b':
 			data_size = atoi(optarg);
 			break;
@@ -1574,6 +1901,11 @@ int main(int argc, char *argv[])
 	else
 		buffer_size = data_size;
 
+	for (i = 0; i < bench_num_sizes; i++) {
+		if (bench_sizes[i] > buffer_size)
+			buffer_size = bench_sizes[i];
+	}
+
 	if (!(buf = malloc(buffer_size))) {
 		perror("Can't allocate data buffer");
 		exit(1);
@@ -1655,6 +1987,17 @@ int main(int argc, char *argv[])
 		case PAIRING:
 			do_pairing(argv[optind]);
 			exit(0);
+
+		case ECHO:
+			do_listen(echo_mode);
+			break;
+
+		case BENCHMARK:
+			sk = do_connect(argv[optind]);
+			if (sk < 0)
+				exit(1);
+			benchmark_mode(sk);
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
@@ -0,0 +1,767 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <ell/ell.h>
+
+#include "mesh/mesh-defs.h"
+#include "mesh/net.h"
+#include "mesh/crypto.h"
+
+#define BENCH_SRC		0x7f00
+#define BENCH_DST		0x7ffe
+#define NODE_ADDR(i)		(0x0100 + (i))
+
+#define SEG_PAYLOAD_LEN		12
+#define UNSEG_PAYLOAD_LEN	11
+
+#define START_DELAY_MS		500
+#define STALL_TIMEOUT_MS	2000
+
+struct bench_node {
+	unsigned int index;
+	pid_t pid;
+	int fd;
+	struct l_io *io;
+	char *dir;
+	char *sk_path;
+	char *air_path;
+	uint64_t *rx_time;
+	uint8_t *relayed;
+	unsigned long long cpu_ticks;
+};
+
+static const uint8_t net_key[16] = {
+	0x7d, 0xd7, 0x36, 0x4c, 0xd8, 0x42, 0xad, 0x18,
+	0xc1, 0x7c, 0x2b, 0x82, 0x0c, 0x84, 0xc3, 0xd6
+};
+
+static struct bench_node *nodes;
+static struct mesh_crypto_key enc_key;
+static struct mesh_crypto_key priv_key;
+static uint8_t nid;
+
+static unsigned int num_nodes = 4;
+static unsigned int num_msgs = 1000;
+static unsigned int num_segs = 1;
+static unsigned int window = 16;
+static uint8_t ttl;
+static const char *exe;
+static char *test_dir;
+
+static unsigned int total_pkts;
+static unsigned int next_pkt;
+static unsigned int done_pkts;
+static unsigned int deliveries;
+static unsigned int duplicates;
+static unsigned int rerelays;
+static unsigned int undecoded;
+
+static uint32_t *hop_lat;
+static unsigned int num_hop_lat;
+static uint32_t *e2e_lat;
+static unsigned int num_e2e_lat;
+
+static uint64_t start_time;
+static uint64_t last_progress;
+static bool started;
+static struct l_timeout *bench_timeout;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned long long read_cpu_ticks(pid_t pid)
+{
+	unsigned long long utime, stime;
+	char path[64], buf[1024];
+	ssize_t len;
+	char *ptr;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+
+	/* The command name may contain spaces, skip past it */
+	ptr = strrchr(buf, ')');
+	if (!ptr)
+		return 0;
+
+	if (sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+					"%llu %llu", &utime, &stime) != 2)
+		return 0;
+
+	return utime + stime;
+}
+
+static int del_fobject(const char *fpath, const struct stat *sb, int typeflag,
+						struct FTW *ftwbuf)
+{
+	switch (typeflag) {
+	case FTW_DP:
+		rmdir(fpath);
+		break;
+
+	case FTW_SL:
+	default:
+		remove(fpath);
+		break;
+	}
+
+	return 0;
+}
+
+static bool write_node_config(struct bench_node *node)
+{
+	uint8_t uuid[16], dev_key[16], token[8];
+	char uuid_str[33];
+	char *path;
+	FILE *fp;
+	int i;
+
+	l_getrandom(uuid, sizeof(uuid));
+	l_getrandom(dev_key, sizeof(dev_key));
+	l_getrandom(token, sizeof(token));
+
+	for (i = 0; i < 16; i++)
+		sprintf(uuid_str + i * 2, "%2.2x", uuid[i]);
+
+	path = l_strdup_printf("%s/%s", node->dir, uuid_str);
+	if (mkdir(path, 0700) < 0) {
+		l_free(path);
+		return false;
+	}
+
+	l_free(path);
+
+	path = l_strdup_printf("%s/%s/node.json", node->dir, uuid_str);
+	fp = fopen(path, "w");
+	l_free(path);
+
+	if (!fp)
+		return false;
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"cid\":\"05f1\",\n");
+	fprintf(fp, "  \"pid\":\"0002\",\n");
+	fprintf(fp, "  \"vid\":\"0001\",\n");
+	fprintf(fp, "  \"crpl\":\"7fff\",\n");
+	fprintf(fp, "  \"relay\":{ \"mode\":\"enabled\", \"count\":0, "
+						"\"interval\":10 },\n");
+	fprintf(fp, "  \"beacon\":\"disabled\",\n");
+	fprintf(fp, "  \"proxy\":\"unsupported\",\n");
+	fprintf(fp, "  \"friend\":\"unsupported\",\n");
+	fprintf(fp, "  \"lowPower\":\"unsupported\",\n");
+	fprintf(fp, "  \"defaultTTL\":%u,\n", ttl);
+	fprintf(fp, "  \"retransmit\":{ \"count\":0, \"interval\":10 },\n");
+	fprintf(fp, "  \"IVindex\":0,\n");
+	fprintf(fp, "  \"IVupdate\":0,\n");
+	fprintf(fp, "  \"unicastAddress\":\"%4.4x\",\n",
+						NODE_ADDR(node->index));
+
+	fprintf(fp, "  \"deviceKey\":\"");
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "%2.2x", dev_key[i]);
+	fprintf(fp, "\",\n");
+
+	fprintf(fp, "  \"token\":\"");
+	for (i = 0; i < 8; i++)
+		fprintf(fp, "%2.2x", token[i]);
+	fprintf(fp, "\",\n");
+
+	fprintf(fp, "  \"netKeys\":[ { \"index\":0, \"key\":\"");
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "%2.2x", net_key[i]);
+	fprintf(fp, "\" } ],\n");
+
+	fprintf(fp, "  \"elements\":[ { \"elementIndex\":0, "
+						"\"location\":\"0000\" } ]\n");
+	fprintf(fp, "}\n");
+
+	return !fclose(fp);
+}
+
+static void send_to_node(struct bench_node *node, const uint8_t *pkt,
+								uint8_t len)
+{
+	uint8_t buf[32];
+
+	if (len > sizeof(buf) - 1)
+		return;
+
+	/* A non-zero first octet marks an advertising packet */
+	buf[0] = 0x01;
+	memcpy(buf + 1, pkt, len);
+
+	if (send(node->fd, buf, len + 1, MSG_DONTWAIT) < 0)
+		l_error("Failed to send to node %u (%d)", node->index, errno);
+}
+
+static bool build_pkt(unsigned int idx, uint8_t *pkt, uint8_t *len)
+{
+	uint8_t payload[SEG_PAYLOAD_LEN];
+	uint32_t seq = idx + 1;
+	uint8_t pkt_len;
+	bool segmented = num_segs > 1;
+	uint8_t seg_o = 0;
+	uint16_t seq_zero = 0;
+
+	l_getrandom(payload, sizeof(payload));
+
+	if (segmented) {
+		seg_o = idx % num_segs;
+		seq_zero = (seq - seg_o) & SEQ_ZERO_MASK;
+	}
+
+	if (!mesh_crypto_packet_build(false, ttl, seq, BENCH_SRC, BENCH_DST,
+					0, segmented, 0, false, false,
+					seq_zero, seg_o, num_segs - 1, payload,
+					segmented ? SEG_PAYLOAD_LEN :
+							UNSEG_PAYLOAD_LEN,
+					pkt + 1, &pkt_len))
+		return false;
+
+	if (!mesh_crypto_packet_encode_ctx(pkt + 1, pkt_len, 0, &enc_key,
+								&priv_key))
+		return false;
+
+	if (!mesh_crypto_packet_label(pkt + 1, pkt_len, 0, nid))
+		return false;
+
+	pkt[0] = MESH_AD_TYPE_NETWORK;
+	*len = pkt_len + 1;
+
+	return true;
+}
+
+static void inject_pkts(void)
+{
+	uint8_t pkt[30];
+	uint8_t len;
+
+	while (next_pkt < total_pkts && next_pkt - done_pkts < window) {
+		if (!build_pkt(next_pkt, pkt, &len)) {
+			l_error("Failed to build packet %u", next_pkt);
+			l_main_quit();
+			return;
+		}
+
+		nodes[0].rx_time[next_pkt] = now_us();
+		deliveries++;
+
+		send_to_node(&nodes[0], pkt, len);
+		next_pkt++;
+	}
+}
+
+static void deliver(struct bench_node *node, unsigned int idx,
+					const uint8_t *pkt, uint8_t len)
+{
+	deliveries++;
+
+	if (node->rx_time[idx])
+		duplicates++;
+	else
+		node->rx_time[idx] = now_us();
+
+	send_to_node(node, pkt, len);
+}
+
+static bool air_incoming(struct l_io *io, void *user_data)
+{
+	struct bench_node *node = user_data;
+	uint8_t buf[31], out[29];
+	unsigned int idx;
+	uint64_t now;
+	uint32_t seq;
+	ssize_t len;
+
+	len = recv(node->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len < 11 || buf[0] != MESH_AD_TYPE_NETWORK)
+		return true;
+
+	now = now_us();
+
+	if (!mesh_crypto_packet_decode_ctx(buf + 1, len - 1, false, out, 0,
+							&enc_key, &priv_key) ||
+				l_get_be16(out + 5) != BENCH_SRC) {
+		undecoded++;
+		return true;
+	}
+
+	seq = l_get_be32(out + 1) & SEQ_MASK;
+	if (!seq || seq > total_pkts) {
+		undecoded++;
+		return true;
+	}
+
+	idx = seq - 1;
+
+	if (node->relayed[idx]) {
+		rerelays++;
+		return true;
+	}
+
+	node->relayed[idx] = 1;
+	last_progress = now;
+
+	if (node->rx_time[idx])
+		hop_lat[num_hop_lat++] = now - node->rx_time[idx];
+
+	/* Chain topology, only the neighbours hear a node */
+	if (node->index > 0)
+		deliver(&nodes[node->index - 1], idx, buf, len);
+
+	if (node->index + 1 < num_nodes) {
+		deliver(&nodes[node->index + 1], idx, buf, len);
+		return true;
+	}
+
+	e2e_lat[num_e2e_lat++] = now - nodes[0].rx_time[idx];
+
+	done_pkts++;
+	if (done_pkts == total_pkts)
+		l_main_quit();
+	else
+		inject_pkts();
+
+	return true;
+}
+
+static void bench_to(struct l_timeout *timeout, void *user_data)
+{
+	unsigned int i;
+
+	if (!started) {
+		for (i = 0; i < num_nodes; i++) {
+			if (access(nodes[i].sk_path, F_OK) < 0) {
+				l_timeout_modify_ms(timeout, 100);
+				return;
+			}
+		}
+
+		for (i = 0; i < num_nodes; i++) {
+			struct sockaddr_un addr;
+
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_LOCAL;
+			snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+							nodes[i].sk_path);
+
+			if (connect(nodes[i].fd, (struct sockaddr *) &addr,
+							sizeof(addr)) < 0) {
+				l_error("Failed to connect to node %u", i);
+				l_main_quit();
+				return;
+			}
+		}
+
+		/* Give the daemons a moment to load the nodes */
+		started = true;
+		l_timeout_modify_ms(timeout, START_DELAY_MS);
+		return;
+	}
+
+	if (!start_time) {
+		for (i = 0; i < num_nodes; i++)
+			nodes[i].cpu_ticks = read_cpu_ticks(nodes[i].pid);
+
+		start_time = last_progress = now_us();
+		inject_pkts();
+		l_timeout_modify_ms(timeout, STALL_TIMEOUT_MS);
+		return;
+	}
+
+	if (now_us() - last_progress >= STALL_TIMEOUT_MS * 1000) {
+		l_info("No progress for %u ms, stopping", STALL_TIMEOUT_MS);
+		l_main_quit();
+		return;
+	}
+
+	l_timeout_modify_ms(timeout, STALL_TIMEOUT_MS);
+}
+
+static bool node_init(struct bench_node *node, unsigned int index)
+{
+	struct sockaddr_un addr;
+
+	node->index = index;
+	node->fd = -1;
+	node->dir = l_strdup_printf("%s/node%u", test_dir, index);
+	node->sk_path = l_strdup_printf("%s/sk%u", test_dir, index);
+	node->air_path = l_strdup_printf("%s/air%u", test_dir, index);
+	node->rx_time = l_new(uint64_t, total_pkts);
+	node->relayed = l_new(uint8_t, total_pkts);
+
+	if (mkdir(node->dir, 0700) < 0 || !write_node_config(node))
+		return false;
+
+	node->fd = socket(PF_LOCAL, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (node->fd < 0)
+		return false;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_LOCAL;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", node->air_path);
+
+	if (bind(node->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		return false;
+
+	node->io = l_io_new(node->fd);
+	l_io_set_read_handler(node->io, air_incoming, node, NULL);
+
+	return true;
+}
+
+static bool node_spawn(struct bench_node *node)
+{
+	char *io = l_strdup_printf("unit:%s", node->sk_path);
+	char *const dargs[] = {
+		(char *) exe,
+		"--io",
+		io,
+		"-s",
+		node->dir,
+		NULL
+	};
+
+	node->pid = fork();
+	if (node->pid < 0) {
+		l_free(io);
+		return false;
+	}
+
+	if (node->pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		/* Keep the daemon logs out of the report */
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+
+		execv(exe, dargs);
+		exit(EXIT_FAILURE);
+	}
+
+	l_free(io);
+
+	return true;
+}
+
+static void node_cleanup(struct bench_node *node)
+{
+	if (node->pid > 0) {
+		kill(node->pid, SIGTERM);
+		waitpid(node->pid, NULL, 0);
+	}
+
+	l_io_destroy(node->io);
+
+	if (node->fd >= 0)
+		close(node->fd);
+
+	l_free(node->dir);
+	l_free(node->sk_path);
+	l_free(node->air_path);
+	l_free(node->rx_time);
+	l_free(node->relayed);
+}
+
+static int compare_lat(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t *) a;
+	uint32_t vb = *(const uint32_t *) b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+static void print_percentiles(const char *label, uint32_t *lat,
+							unsigned int num)
+{
+	if (!num) {
+		printf("%-20s no samples\n", label);
+		return;
+	}
+
+	qsort(lat, num, sizeof(*lat), compare_lat);
+
+	printf("%-20s p50 %u us, p90 %u us, p99 %u us, max %u us\n", label,
+				lat[num / 2], lat[num * 90 / 100],
+				lat[num * 99 / 100], lat[num - 1]);
+}
+
+static void print_report(void)
+{
+	unsigned long long ticks = 0;
+	unsigned int relays = num_hop_lat;
+	double elapsed;
+	unsigned int i;
+
+	if (!start_time) {
+		printf("Benchmark did not start\n");
+		return;
+	}
+
+	for (i = 0; i < num_nodes; i++)
+		ticks += read_cpu_ticks(nodes[i].pid) - nodes[i].cpu_ticks;
+
+	elapsed = (last_progress - start_time) / 1000000.0;
+
+	printf("Nodes %u, messages %u, segments %u, window %u\n",
+				num_nodes, num_msgs, num_segs, window);
+	printf("%-20s %u of %u packets in %.3f s\n", "Completed:",
+				done_pkts, total_pkts, elapsed);
+
+	if (elapsed > 0)
+		printf("%-20s %.1f packets/s, %.1f messages/s\n",
+				"Throughput:", done_pkts / elapsed,
+				(double) done_pkts / num_segs / elapsed);
+
+	print_percentiles("Relay latency:", hop_lat, num_hop_lat);
+	print_percentiles("End to end latency:", e2e_lat, num_e2e_lat);
+
+	printf("%-20s %u deliveries, %u duplicates, %u relayed again\n",
+				"Message cache:", deliveries, duplicates,
+				rerelays);
+
+	if (duplicates)
+		printf("%-20s %.1f%%\n", "Cache hit rate:",
+				100.0 * (duplicates - rerelays) / duplicates);
+
+	if (relays)
+		printf("%-20s %.1f us per relayed packet\n", "CPU:",
+				ticks * 1000000.0 / sysconf(_SC_CLK_TCK) /
+								relays);
+
+	if (undecoded)
+		printf("%-20s %u\n", "Undecoded packets:", undecoded);
+}
+
+static void signal_callback(unsigned int signum, void *user_data)
+{
+	switch (signum) {
+	case SIGINT:
+	case SIGTERM:
+		l_main_quit();
+		break;
+	}
+}
+
+static const struct option options[] = {
+	{ "nodes",	required_argument,	NULL, 'n' },
+	{ "messages",	required_argument,	NULL, 'm' },
+	{ "segments",	required_argument,	NULL, 's' },
+	{ "window",	required_argument,	NULL, 'w' },
+	{ "daemon",	required_argument,	NULL, 'd' },
+	{ "version",	no_argument,		NULL, 'v' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"\tmesh-bench [options]\n");
+	fprintf(stderr,
+		"Options:\n"
+		"\t-n, --nodes <num>	Number of relay nodes in the chain\n"
+		"\t-m, --messages <num>	Number of messages to send\n"
+		"\t-s, --segments <num>	Segments per message (1-32)\n"
+		"\t-w, --window <num>	Packets in flight\n"
+		"\t-d, --daemon <path>	bluetooth-meshd executable\n"
+		"\t-v, --version	Show version information and exit\n"
+		"\t-h, --help		Show help options\n");
+}
+
+static bool parse_options(int argc, char *argv[])
+{
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:m:s:w:d:vh", options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'm':
+			num_msgs = atoi(optarg);
+			break;
+		case 's':
+			num_segs = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'd':
+			exe = optarg;
+			break;
+		case 'v':
+			printf("%s\n", VERSION);
+			exit(EXIT_SUCCESS);
+		case 'h':
+			usage();
+			exit(EXIT_SUCCESS);
+		default:
+			usage();
+			return false;
+		}
+	}
+
+	/* Every node decrements the TTL once, the last one must still relay */
+	if (!num_nodes || num_nodes > TTL_MASK - 1 || !num_msgs || !window ||
+				!num_segs || num_segs > SEG_MASK + 1) {
+		usage();
+		return false;
+	}
+
+	ttl = num_nodes + 1;
+	total_pkts = num_msgs * num_segs;
+
+	if (total_pkts > SEQ_MASK) {
+		fprintf(stderr, "Too many packets\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool setup_test_dir(void)
+{
+	static char daemon[PATH_MAX];
+	char buf[PATH_MAX];
+	ssize_t len;
+
+	test_dir = l_strdup_printf("/tmp/mesh-bench-%d", getpid());
+	nftw(test_dir, del_fobject, 5, FTW_DEPTH | FTW_PHYS);
+
+	if (mkdir(test_dir, 0700) != 0) {
+		fprintf(stderr, "Failed to create dir %s\n", test_dir);
+		return false;
+	}
+
+	if (exe)
+		return true;
+
+	len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+	if (len == -1)
+		return false;
+
+	buf[len] = '\0';
+
+	snprintf(daemon, sizeof(daemon), "%s/mesh/bluetooth-meshd",
+							dirname(dirname(buf)));
+	exe = daemon;
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int status = EXIT_FAILURE;
+	unsigned int i;
+	uint8_t enc[16], priv[16];
+	uint8_t p = 0;
+
+	if (!parse_options(argc, argv))
+		return EXIT_FAILURE;
+
+	if (!mesh_crypto_k2(net_key, &p, 1, &nid, enc, priv))
+		return EXIT_FAILURE;
+
+	if (!setup_test_dir())
+		return EXIT_FAILURE;
+
+	l_log_set_stderr();
+
+	if (!l_main_init())
+		goto done;
+
+	mesh_crypto_key_init(&enc_key, enc);
+	mesh_crypto_key_init(&priv_key, priv);
+
+	hop_lat = l_new(uint32_t, total_pkts * num_nodes);
+	e2e_lat = l_new(uint32_t, total_pkts);
+	nodes = l_new(struct bench_node, num_nodes);
+
+	for (i = 0; i < num_nodes; i++) {
+		if (!node_init(&nodes[i], i) || !node_spawn(&nodes[i])) {
+			fprintf(stderr, "Failed to start node %u\n", i);
+			goto cleanup;
+		}
+	}
+
+	bench_timeout = l_timeout_create_ms(100, bench_to, NULL, NULL);
+
+	l_main_run_with_signal(signal_callback, NULL);
+
+	l_timeout_remove(bench_timeout);
+
+	print_report();
+
+	if (done_pkts == total_pkts)
+		status = EXIT_SUCCESS;
+
+cleanup:
+	for (i = 0; i < num_nodes; i++)
+		node_cleanup(&nodes[i]);
+
+	l_free(nodes);
+	l_free(hop_lat);
+	l_free(e2e_lat);
+	mesh_crypto_key_clear(&enc_key);
+	mesh_crypto_key_clear(&priv_key);
+	l_main_exit();
+
+done:
+	nftw(test_dir, del_fobject, 5, FTW_DEPTH | FTW_PHYS);
+	l_free(test_dir);
+
+	return status;
+}
@@ -2319,6 +2319,8 @@ int main(int argc, char *argv[])
 
 	status = bt_shell_run();
 
+	mesh_db_flush();
+
 	l_dbus_client_destroy(client);
 	l_dbus_destroy(dbus);
 
@@ -12,17 +12,20 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <wordexp.h>
 
 #include <glib.h>
 
 #include "src/shared/io.h"
+#include "src/shared/queue.h"
 #include "src/shared/shell.h"
 #include "src/shared/util.h"
 #include "gdbus/gdbus.h"
@@ -38,19 +41,23 @@
 #define MESH_PROV_DATA_OUT_UUID_STR	"00002adc-0000-1000-8000-00805f9b34fb"
 #define MESH_PROXY_DATA_OUT_UUID_STR	"00002ade-0000-1000-8000-00805f9b34fb"
 
+/* Segments handed to the kernel in a single sendmmsg() call */
+#define WRITE_BATCH	16
+
 static struct io *write_io;
 static uint16_t write_mtu;
+static struct queue *write_queue;
+static bool write_acquiring;
 
 static struct io *notify_io;
 static uint16_t notify_mtu;
 
 struct write_data {
-	GDBusProxy *proxy;
 	void *user_data;
-	struct iovec iov;
 	GDBusReturnFunction cb;
 	uint8_t *gatt_data;
 	uint8_t gatt_len;
+	uint8_t offset;
 };
 
 struct notify_data {
@@ -155,88 +162,103 @@ uint16_t mesh_gatt_sar(uint8_t **pkt, uint16_t size)
 	}
 }
 
-static int sock_send(struct io *io, struct iovec *iov, size_t iovlen)
+static uint8_t build_segments(struct write_data *data, uint16_t max_len,
+				struct mmsghdr *msgs, struct iovec (*iov)[2],
+				uint8_t *sar, uint8_t count)
 {
-	struct msghdr msg;
-	int ret;
-
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	msg.msg_iovlen = iovlen;
-
-	ret = sendmsg(io_get_fd(io), &msg, MSG_NOSIGNAL);
-	if (ret < 0) {
-		ret = -errno;
-		bt_shell_printf("sendmsg: %s", strerror(-ret));
-	}
-
-	return ret;
+	uint8_t total = data->gatt_len - 1;
+	uint8_t offset = data->offset;
+	uint8_t n = 0;
+
+	/* A Proxy PDU with no payload still goes out as one segment */
+	do {
+		uint8_t len = MIN(total - offset, max_len);
+
+		sar[n] = data->gatt_data[0] & GATT_TYPE_MASK;
+		if (offset + len < total)
+			sar[n] |= offset ? GATT_SAR_CONTINUE : GATT_SAR_FIRST;
+		else if (offset)
+			sar[n] |= GATT_SAR_LAST;
+
+		iov[n][0].iov_base = &sar[n];
+		iov[n][0].iov_len = sizeof(sar[n]);
+		iov[n][1].iov_base = data->gatt_data + 1 + offset;
+		iov[n][1].iov_len = len;
+
+		memset(&msgs[n], 0, sizeof(msgs[n]));
+		msgs[n].msg_hdr.msg_iov = iov[n];
+		msgs[n].msg_hdr.msg_iovlen = 2;
+
+		offset += len;
+		n++;
+	} while (offset < total && n < count);
+
+	return n;
 }
 
 static bool sock_write(struct io *io, void *user_data)
 {
-	struct write_data *data = user_data;
-	struct iovec iov[2];
-	uint8_t sar;
-	uint8_t max_len;
-
-	if (data == NULL)
-		return true;
-
-	max_len = write_mtu ? write_mtu - 3 - 1 : GATT_MTU - 3 - 1;
-	print_byte_array("GATT-TX:\t", data->gatt_data, data->gatt_len);
-
-	sar = data->gatt_data[0];
+	struct mmsghdr msgs[WRITE_BATCH];
+	struct iovec iov[WRITE_BATCH][2];
+	uint8_t sar[WRITE_BATCH];
+	struct write_data *owner[WRITE_BATCH];
+	const struct queue_entry *entry;
+	uint16_t max_len;
+	uint8_t count = 0;
+	int i, sent;
+
+	/* Each segment is one Write Without Response with a SAR header */
+	max_len = (write_mtu ? write_mtu : GATT_MTU) - 3 - 1;
+
+	for (entry = queue_get_entries(write_queue);
+				entry && count < WRITE_BATCH;
+				entry = entry->next) {
+		uint8_t n;
+
+		n = build_segments(entry->data, max_len, msgs + count,
+						iov + count, sar + count,
+						WRITE_BATCH - count);
+
+		for (i = 0; i < n; i++)
+			owner[count + i] = entry->data;
+
+		count += n;
+	}
 
-	data->iov.iov_base = data->gatt_data + 1;
-	data->iov.iov_len--;
+	if (!count)
+		return false;
 
-	sar = data->gatt_data[0] & GATT_TYPE_MASK;
-	data->gatt_len--;
+	sent = io_sendmmsg(io, msgs, count);
+	if (sent < 0) {
+		/* Socket is full, wait until it becomes writable again */
+		if (sent == -EAGAIN)
+			return true;
 
-	if (data->gatt_len > max_len) {
-		sar |= GATT_SAR_FIRST;
-		data->iov.iov_len = max_len;
+		bt_shell_printf("sendmmsg: %s\n", strerror(-sent));
+		queue_remove_all(write_queue, NULL, NULL, write_data_free);
+		return false;
 	}
 
-	iov[0].iov_base = &sar;
-	iov[0].iov_len = sizeof(sar);
-
-	while (1) {
-		int err;
-
-		iov[1] = data->iov;
+	for (i = 0; i < sent; i++) {
+		struct write_data *data = owner[i];
 
-		err = sock_send(io, iov, 2);
-		if (err < 0) {
-			write_data_free(data);
-			return false;
-		}
+		data->offset += iov[i][1].iov_len;
 
-		switch (sar & GATT_SAR_MASK) {
+		switch (sar[i] & GATT_SAR_MASK) {
 		case GATT_SAR_FIRST:
 		case GATT_SAR_CONTINUE:
-			data->gatt_len -= max_len;
-			data->iov.iov_base = data->iov.iov_base + max_len;
-
-			sar &= GATT_TYPE_MASK;
-			if (max_len < data->gatt_len) {
-				data->iov.iov_len = max_len;
-				sar |= GATT_SAR_CONTINUE;
-			} else {
-				data->iov.iov_len = data->gatt_len;
-				sar |= GATT_SAR_LAST;
-			}
-
-			break;
-
-		default:
-			if(data->cb)
-				data->cb(NULL, data->user_data);
-			write_data_free(data);
-			return true;
+			continue;
 		}
+
+		queue_remove(write_queue, data);
+
+		if (data->cb)
+			data->cb(NULL, data->user_data);
+
+		write_data_free(data);
 	}
+
+	return !queue_isempty(write_queue);
 }
 
 static void write_io_destroy(void)
@@ -244,6 +266,8 @@ static void write_io_destroy(void)
 	io_destroy(write_io);
 	write_io = NULL;
 	write_mtu = 0;
+
+	queue_remove_all(write_queue, NULL, NULL, write_data_free);
 }
 
 static void notify_io_destroy(void)
@@ -280,16 +304,17 @@ static struct io *sock_io_new(int fd)
 
 static void acquire_write_reply(DBusMessage *message, void *user_data)
 {
-	struct write_data *data = user_data;
 	DBusError error;
 	int fd;
 
+	write_acquiring = false;
+
 	dbus_error_init(&error);
 
 	if (dbus_set_error_from_message(&error, message) == TRUE) {
 		dbus_error_free(&error);
 		bt_shell_printf("Failed to write\n");
-		write_data_free(data);
+		queue_remove_all(write_queue, NULL, NULL, write_data_free);
 		return;
 	}
 
@@ -297,6 +322,7 @@ static void acquire_write_reply(DBusMessage *message, void *user_data)
 					DBUS_TYPE_UINT16, &write_mtu,
 					DBUS_TYPE_INVALID) == false)) {
 		bt_shell_printf("Invalid AcquireWrite response\n");
+		queue_remove_all(write_queue, NULL, NULL, write_data_free);
 		return;
 	}
 
@@ -304,7 +330,8 @@ static void acquire_write_reply(DBusMessage *message, void *user_data)
 
 	write_io = sock_io_new(fd);
 
-	sock_write(write_io, data);
+	/* Everything queued while acquiring goes out in one batch */
+	io_set_write_handler(write_io, sock_write, NULL, NULL);
 }
 
 static void acquire_setup(DBusMessageIter *iter, void *user_data)
@@ -336,27 +363,42 @@ bool mesh_gatt_write(GDBusProxy *proxy, uint8_t *buf, uint16_t len,
 	if (!data)
 		return false;
 
-	/* TODO: should keep in queue in case we need to cancel write? */
-
 	data->gatt_len = len;
 	data->gatt_data = util_memdup(buf, len);
 	data->gatt_data[0] &= GATT_TYPE_MASK;
-	data->iov.iov_base = data->gatt_data;
-	data->iov.iov_len = len;
-	data->proxy = proxy;
 	data->user_data = user_data;
 	data->cb = cb;
 
-	if (write_io)
-		return sock_write(write_io, data);
+	print_byte_array("GATT-TX:\t", data->gatt_data, data->gatt_len);
+
+	if (!write_queue)
+		write_queue = queue_new();
+
+	/*
+	 * Writes are queued and flushed once the socket is writable, so
+	 * PDUs issued back to back share a single sendmmsg() call.
+	 */
+	queue_push_tail(write_queue, data);
+
+	if (write_io) {
+		io_set_write_handler(write_io, sock_write, NULL, NULL);
+		return true;
+	}
+
+	if (write_acquiring)
+		return true;
 
 	if (g_dbus_proxy_method_call(proxy, "AcquireWrite",
 				acquire_setup, acquire_write_reply,
-				data, NULL) == FALSE) {
+				NULL, NULL) == FALSE) {
 		bt_shell_printf("Failed to AcquireWrite\n");
+		queue_remove(write_queue, data);
 		write_data_free(data);
 		return false;
 	}
+
+	write_acquiring = true;
+
 	return true;
 }
 
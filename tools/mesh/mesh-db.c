@@ -38,10 +38,16 @@
 #define KEY_IDX_INVALID NET_IDX_INVALID
 #define DEFAULT_LOCATION 0x0000
 
+/* Delay to coalesce configuration changes into a single write */
+#define SAVE_DELAY_MS 500
+
 struct mesh_db {
 	json_object *jcfg;
 	char *cfg_fname;
 	uint8_t token[8];
+	struct l_hashmap *node_by_unicast;
+	struct l_hashmap *node_by_uuid;
+	struct l_timeout *save_timeout;
 };
 
 static struct mesh_db *cfg;
@@ -102,6 +108,8 @@ static bool save_config_file(const char *fname)
 
 	if (fwrite(str, sizeof(char), strlen(str), outfile) < strlen(str))
 		l_warn("Incomplete write of mesh configuration");
+	else if (fflush(outfile) || fsync(fileno(outfile)))
+		l_warn("Failed to sync mesh configuration");
 	else
 		result = true;
 
@@ -110,11 +118,14 @@ static bool save_config_file(const char *fname)
 	return result;
 }
 
-static bool save_config(void)
+static bool flush_config(void)
 {
 	char *fname_tmp, *fname_bak, *fname_cfg;
 	bool result = false;
 
+	l_timeout_remove(cfg->save_timeout);
+	cfg->save_timeout = NULL;
+
 	fname_cfg = cfg->cfg_fname;
 	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
 	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
@@ -122,10 +133,20 @@ static bool save_config(void)
 
 	result = save_config_file(fname_tmp);
 
+	/*
+	 * Keep the current file in place while the backup is linked so the
+	 * configuration is replaced atomically by the final rename.
+	 */
 	if (result) {
 		remove(fname_bak);
-		rename(fname_cfg, fname_bak);
-		rename(fname_tmp, fname_cfg);
+		if (link(fname_cfg, fname_bak) < 0 && errno != ENOENT)
+			l_warn("Failed to back up mesh configuration");
+
+		if (rename(fname_tmp, fname_cfg) < 0) {
+			l_error("Failed to save configuration to %s",
+								fname_cfg);
+			result = false;
+		}
 	}
 
 	remove(fname_tmp);
@@ -136,19 +157,122 @@ static bool save_config(void)
 	return result;
 }
 
+static void save_timeout(struct l_timeout *timeout, void *user_data)
+{
+	flush_config();
+}
+
+static bool save_config(void)
+{
+	if (cfg->save_timeout)
+		return true;
+
+	cfg->save_timeout = l_timeout_create_ms(SAVE_DELAY_MS, save_timeout,
+								NULL, NULL);
+	if (!cfg->save_timeout)
+		return flush_config();
+
+	return true;
+}
+
 static void release_config(void)
 {
+	l_timeout_remove(cfg->save_timeout);
+	l_hashmap_destroy(cfg->node_by_unicast, NULL);
+	l_hashmap_destroy(cfg->node_by_uuid, NULL);
 	l_free(cfg->cfg_fname);
 	json_object_put(cfg->jcfg);
 	l_free(cfg);
 	cfg = NULL;
 }
 
+static bool get_node_unicast(json_object *jnode, uint16_t *unicast)
+{
+	json_object *jval;
+	const char *str;
+
+	if (!json_object_object_get_ex(jnode, "unicastAddress", &jval))
+		return false;
+
+	str = json_object_get_string(jval);
+
+	return sscanf(str, "%04hx", unicast) == 1;
+}
+
+static const char *get_node_uuid(json_object *jnode)
+{
+	json_object *jval;
+	const char *str;
+
+	if (!json_object_object_get_ex(jnode, "UUID", &jval))
+		return NULL;
+
+	str = json_object_get_string(jval);
+	if (!str || strlen(str) != 36)
+		return NULL;
+
+	return str;
+}
+
+static void index_node(json_object *jnode)
+{
+	const char *uuid;
+	uint16_t unicast;
+
+	if (get_node_unicast(jnode, &unicast))
+		l_hashmap_replace(cfg->node_by_unicast, L_UINT_TO_PTR(unicast),
+								jnode, NULL);
+
+	uuid = get_node_uuid(jnode);
+	if (uuid)
+		l_hashmap_replace(cfg->node_by_uuid, uuid, jnode, NULL);
+}
+
+static void unindex_node(json_object *jnode)
+{
+	const char *uuid;
+	uint16_t unicast;
+
+	if (get_node_unicast(jnode, &unicast) &&
+			l_hashmap_lookup(cfg->node_by_unicast,
+					L_UINT_TO_PTR(unicast)) == jnode)
+		l_hashmap_remove(cfg->node_by_unicast, L_UINT_TO_PTR(unicast));
+
+	uuid = get_node_uuid(jnode);
+	if (uuid && l_hashmap_lookup(cfg->node_by_uuid, uuid) == jnode)
+		l_hashmap_remove(cfg->node_by_uuid, uuid);
+}
+
+static void index_nodes(json_object *jcfg)
+{
+	json_object *jarray;
+	int i, sz;
+
+	cfg->node_by_unicast = l_hashmap_new();
+	cfg->node_by_uuid = l_hashmap_string_new();
+
+	if (!json_object_object_get_ex(jcfg, "nodes", &jarray))
+		return;
+
+	if (!jarray || json_object_get_type(jarray) != json_type_array)
+		return;
+
+	sz = json_object_array_length(jarray);
+
+	for (i = 0; i < sz; ++i)
+		index_node(json_object_array_get_idx(jarray, i));
+}
+
 static json_object *get_node_by_unicast(json_object *jcfg, uint16_t unicast)
 {
 	json_object *jarray;
 	int i, sz;
 
+	/* Exported copies are not indexed */
+	if (cfg && jcfg == cfg->jcfg)
+		return l_hashmap_lookup(cfg->node_by_unicast,
+						L_UINT_TO_PTR(unicast));
+
 	if (!json_object_object_get_ex(jcfg, "nodes", &jarray))
 		return NULL;
 
@@ -306,6 +430,9 @@ static json_object *get_node_by_uuid(json_object *jcfg, uint8_t uuid[16])
 	if (!l_uuid_to_string(uuid, buf, sizeof(buf)))
 		return NULL;
 
+	if (cfg && jcfg == cfg->jcfg)
+		return l_hashmap_lookup(cfg->node_by_uuid, buf);
+
 	json_object_object_get_ex(jcfg, "nodes", &jarray);
 	if (!jarray || json_object_get_type(jarray) != json_type_array)
 		return NULL;
@@ -1763,6 +1890,7 @@ bool mesh_db_add_node(uint8_t uuid[16], uint8_t num_els, uint16_t unicast,
 		goto fail;
 
 	json_object_array_add(jnodes, jnode);
+	index_node(jnode);
 
 	return save_config();
 
@@ -1773,7 +1901,7 @@ fail:
 
 bool mesh_db_del_node(uint16_t unicast)
 {
-	json_object *jarray;
+	json_object *jarray, *jnode;
 	int i, sz;
 
 	if (!json_object_object_get_ex(cfg->jcfg, "nodes", &jarray))
@@ -1782,29 +1910,21 @@ bool mesh_db_del_node(uint16_t unicast)
 	if (!jarray || json_object_get_type(jarray) != json_type_array)
 		return false;
 
+	jnode = get_node_by_unicast(cfg->jcfg, unicast);
+	if (!jnode)
+		return true;
+
 	sz = json_object_array_length(jarray);
 
 	for (i = 0; i < sz; ++i) {
-		json_object *jentry, *jval;
-		uint16_t addr;
-		const char *str;
-
-		jentry = json_object_array_get_idx(jarray, i);
-		if (!json_object_object_get_ex(jentry, "unicastAddress",
-								&jval))
-			continue;
-
-		str = json_object_get_string(jval);
-		if (sscanf(str, "%04hx", &addr) != 1)
-			continue;
-
-		if (addr == unicast)
+		if (json_object_array_get_idx(jarray, i) == jnode)
 			break;
 	}
 
 	if (i == sz)
 		return true;
 
+	unindex_node(jnode);
 	json_object_array_del_idx(jarray, i, 1);
 
 	return save_config();
@@ -2348,7 +2468,9 @@ bool mesh_db_create(const char *fname, const uint8_t token[8],
 
 	write_int(jcfg, "ivIndex", 0);
 
-	if (!save_config())
+	index_nodes(jcfg);
+
+	if (!flush_config())
 		goto fail;
 
 	return true;
@@ -2359,6 +2481,14 @@ fail:
 	return false;
 }
 
+bool mesh_db_flush(void)
+{
+	if (!cfg || !cfg->save_timeout)
+		return true;
+
+	return flush_config();
+}
+
 bool mesh_db_load(const char *fname)
 {
 	int fd;
@@ -2409,6 +2539,8 @@ bool mesh_db_load(const char *fname)
 	if (!load_keys(jcfg))
 		goto fail;
 
+	index_nodes(jcfg);
+
 	load_remotes(jcfg);
 
 	load_rejected_addresses(jcfg);
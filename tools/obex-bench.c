@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gobex/gobex.h"
+
+#define MINIMUM_MTU	255
+#define MAXIMUM_MTU	65535
+
+static GMainLoop *main_loop = NULL;
+
+static gboolean option_srm = FALSE;
+static gboolean option_get = FALSE;
+static int option_mtu = MAXIMUM_MTU;
+static int option_size = 100;
+static int option_window = -1;
+
+static GOptionEntry options[] = {
+	{ "srm", 's', 0, G_OPTION_ARG_NONE, &option_srm,
+			"Use a packet transport with SRM enabled" },
+	{ "get", 'g', 0, G_OPTION_ARG_NONE, &option_get,
+			"Benchmark GET instead of PUT" },
+	{ "mtu", 'm', 0, G_OPTION_ARG_INT, &option_mtu,
+			"OBEX MTU", "MTU" },
+	{ "size", 'n', 0, G_OPTION_ARG_INT, &option_size,
+			"Transfer size in MiB", "SIZE" },
+	{ "window", 'w', 0, G_OPTION_ARG_INT, &option_window,
+			"Packets written back to back with SRM", "COUNT" },
+	{ NULL },
+};
+
+struct bench {
+	GObex *client;
+	GObex *server;
+	guint64 size;
+	guint64 sent;
+	guint64 received;
+	gint64 start;
+	struct rusage usage;
+	int status;
+};
+
+static gint64 cpu_time(const struct rusage *usage)
+{
+	return (gint64) (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) *
+					G_USEC_PER_SEC +
+					usage->ru_utime.tv_usec +
+					usage->ru_stime.tv_usec;
+}
+
+static void bench_report(struct bench *bench)
+{
+	struct rusage usage;
+	gint64 elapsed, cpu;
+	double mib;
+
+	elapsed = g_get_monotonic_time() - bench->start;
+
+	getrusage(RUSAGE_SELF, &usage);
+	cpu = cpu_time(&usage) - cpu_time(&bench->usage);
+
+	mib = (double) bench->received / (1024 * 1024);
+
+	g_print("%s %s mtu %d: %.1f MiB in %.3f s\n",
+			option_get ? "GET" : "PUT",
+			option_srm ? "SRM" : "stream", option_mtu,
+			mib, (double) elapsed / G_USEC_PER_SEC);
+	g_print("throughput %.2f MiB/s, cpu %.3f ms/MiB "
+			"(client and server)\n",
+			mib * G_USEC_PER_SEC / MAX(elapsed, 1),
+			(double) cpu / 1000 / MAX(mib, 1.0 / 1024));
+}
+
+static gssize produce_data(void *buf, gsize len, gpointer user_data)
+{
+	struct bench *bench = user_data;
+
+	/* The payload is not checked so the buffer is sent as is */
+	len = MIN(len, bench->size - bench->sent);
+	bench->sent += len;
+
+	return len;
+}
+
+static gboolean consume_data(const void *buf, gsize len, gpointer user_data)
+{
+	struct bench *bench = user_data;
+
+	bench->received += len;
+
+	return TRUE;
+}
+
+static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
+{
+	struct bench *bench = user_data;
+
+	if (obex == bench->server)
+		return;
+
+	if (err != NULL) {
+		g_printerr("Transfer failed: %s\n", err->message);
+		bench->status = EXIT_FAILURE;
+	} else if (bench->received != bench->size) {
+		g_printerr("Transfer incomplete: %" G_GUINT64_FORMAT
+				" of %" G_GUINT64_FORMAT " bytes\n",
+				bench->received, bench->size);
+		bench->status = EXIT_FAILURE;
+	} else
+		bench_report(bench);
+
+	g_main_loop_quit(main_loop);
+}
+
+static void handle_connect(GObex *obex, GObexPacket *req, gpointer user_data)
+{
+	GObexPacket *rsp;
+
+	rsp = g_obex_packet_new(G_OBEX_RSP_SUCCESS, TRUE, G_OBEX_HDR_INVALID);
+	g_obex_send(obex, rsp, NULL);
+}
+
+static void handle_put(GObex *obex, GObexPacket *req, gpointer user_data)
+{
+	GError *err = NULL;
+
+	g_obex_put_rsp(obex, req, consume_data, transfer_complete, user_data,
+						&err, G_OBEX_HDR_INVALID);
+	if (err != NULL) {
+		g_printerr("Unable to send response: %s\n", err->message);
+		g_error_free(err);
+	}
+}
+
+static void handle_get(GObex *obex, GObexPacket *req, gpointer user_data)
+{
+	GError *err = NULL;
+
+	g_obex_get_rsp(obex, produce_data, transfer_complete, user_data, &err,
+							G_OBEX_HDR_INVALID);
+	if (err != NULL) {
+		g_printerr("Unable to send response: %s\n", err->message);
+		g_error_free(err);
+	}
+}
+
+static void connect_rsp(GObex *obex, GError *err, GObexPacket *rsp,
+							gpointer user_data)
+{
+	struct bench *bench = user_data;
+
+	if (err != NULL) {
+		g_printerr("Connect failed: %s\n", err->message);
+		goto failed;
+	}
+
+	bench->start = g_get_monotonic_time();
+	getrusage(RUSAGE_SELF, &bench->usage);
+
+	if (option_get)
+		g_obex_get_req(obex, consume_data, transfer_complete, bench,
+					&err, G_OBEX_HDR_NAME, "bench",
+					G_OBEX_HDR_INVALID);
+	else
+		g_obex_put_req(obex, produce_data, transfer_complete, bench,
+					&err, G_OBEX_HDR_NAME, "bench",
+					G_OBEX_HDR_INVALID);
+
+	if (err == NULL)
+		return;
+
+	g_printerr("Unable to start transfer: %s\n", err->message);
+	g_error_free(err);
+
+failed:
+	bench->status = EXIT_FAILURE;
+	g_main_loop_quit(main_loop);
+}
+
+static GObex *create_obex(int sk, GObexTransportType transport)
+{
+	GIOChannel *io;
+	GObex *obex;
+
+	io = g_io_channel_unix_new(sk);
+	g_io_channel_set_flags(io, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_channel_set_close_on_unref(io, TRUE);
+
+	obex = g_obex_new(io, transport, option_mtu, option_mtu);
+	g_io_channel_unref(io);
+
+	if (obex != NULL && option_window > 0)
+		g_obex_set_tx_window(obex, option_window);
+
+	return obex;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *err = NULL;
+	GObexTransportType transport;
+	struct bench bench;
+	int sv[2], type;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	g_option_context_parse(context, &argc, &argv, &err);
+	if (err != NULL) {
+		g_printerr("%s\n", err->message);
+		g_error_free(err);
+		exit(EXIT_FAILURE);
+	}
+
+	if (option_mtu < MINIMUM_MTU || option_mtu > MAXIMUM_MTU ||
+							option_size <= 0) {
+		g_printerr("Invalid MTU or transfer size\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* gobex negotiates SRM on every packet based transport */
+	if (option_srm) {
+		type = SOCK_SEQPACKET;
+		transport = G_OBEX_TRANSPORT_PACKET;
+	} else {
+		type = SOCK_STREAM;
+		transport = G_OBEX_TRANSPORT_STREAM;
+	}
+
+	if (socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&bench, 0, sizeof(bench));
+	bench.size = (guint64) option_size * 1024 * 1024;
+	bench.status = EXIT_SUCCESS;
+
+	bench.server = create_obex(sv[0], transport);
+	bench.client = create_obex(sv[1], transport);
+	if (bench.server == NULL || bench.client == NULL) {
+		g_printerr("Unable to create OBEX sessions\n");
+		exit(EXIT_FAILURE);
+	}
+
+	g_obex_add_request_function(bench.server, G_OBEX_OP_CONNECT,
+						handle_connect, &bench);
+	g_obex_add_request_function(bench.server, G_OBEX_OP_PUT, handle_put,
+									&bench);
+	g_obex_add_request_function(bench.server, G_OBEX_OP_GET, handle_get,
+									&bench);
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+
+	g_obex_connect(bench.client, connect_rsp, &bench, &err,
+							G_OBEX_HDR_INVALID);
+	if (err != NULL) {
+		g_printerr("Unable to connect: %s\n", err->message);
+		g_error_free(err);
+		exit(EXIT_FAILURE);
+	}
+
+	g_main_loop_run(main_loop);
+
+	g_obex_unref(bench.client);
+	g_obex_unref(bench.server);
+	g_option_context_free(context);
+	g_main_loop_unref(main_loop);
+
+	exit(bench.status);
+}
@@ -23,6 +23,7 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -85,12 +86,172 @@ static int linger = 0;
 static int timestamp = 0;
 static int defer_setup = 0;
 static int priority = -1;
+static int sock_buf = 0;
+static int json = 0;
+
+/* Concurrent streams use consecutive channels, one DLC each */
+static int streams = 1;
+static int stream_id = 0;
+static int result_fd = -1;
+static pid_t main_pid;
+
+struct result {
+	int stream;
+	long bytes;
+	long usec;
+};
+
+/* Kernel RFCOMM settings, applied to sessions set up afterwards */
+#define RFCOMM_PARAMS "/sys/module/rfcomm/parameters/"
+
+struct rfcomm_param {
+	const char *name;
+	const char *value;
+	char saved[16];
+	bool changed;
+};
+
+static struct rfcomm_param params[] = {
+	{ "disable_cfc" },
+	{ "channel_mtu" },
+	{ }
+};
 
 static float tv2fl(struct timeval tv)
 {
 	return (float)tv.tv_sec + (float)(tv.tv_usec/1000000.0);
 }
 
+static void report(const char *mode, int stream, long bytes, long usec)
+{
+	double sec = usec / 1000000.0;
+	double rate = sec > 0 ? bytes / sec / 1024.0 : 0;
+
+	if (stream < 0)
+		syslog(LOG_INFO, "%d streams: %ld bytes in %.2f sec, "
+				"%.2f kB/s", streams, bytes, sec, rate);
+	else
+		syslog(LOG_INFO, "Stream %d: %ld bytes in %.2f sec, %.2f kB/s",
+						stream, bytes, sec, rate);
+
+	if (!json)
+		return;
+
+	printf("{\"mode\":\"%s\",", mode);
+
+	if (stream < 0)
+		printf("\"streams\":%d,", streams);
+	else
+		printf("\"stream\":%d,\"channel\":%d,", stream,
+							channel + stream);
+
+	printf("\"size\":%ld,\"sock_buf\":%d,\"bytes\":%ld,"
+			"\"seconds\":%.6f,\"rate_kBps\":%.2f}\n",
+			data_size, sock_buf, bytes, sec, rate);
+	fflush(stdout);
+}
+
+static long elapsed_usec(const struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+
+	return diff.tv_sec * 1000000L + diff.tv_usec;
+}
+
+static int set_param(struct rfcomm_param *param)
+{
+	char path[64];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), RFCOMM_PARAMS "%s", param->name);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		syslog(LOG_ERR, "Can't open %s: %s (%d)", path,
+							strerror(errno), errno);
+		return -1;
+	}
+
+	len = read(fd, param->saved, sizeof(param->saved) - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+
+	param->saved[len] = '\0';
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, param->value, strlen(param->value)) < 0) {
+		syslog(LOG_ERR, "Can't set RFCOMM %s: %s (%d)", param->name,
+							strerror(errno), errno);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	param->changed = true;
+
+	syslog(LOG_INFO, "RFCOMM %s set to %s", param->name, param->value);
+
+	return 0;
+}
+
+static void restore_params(void)
+{
+	struct rfcomm_param *param;
+	char path[64];
+	int fd;
+
+	/* Only the process that changed the settings restores them */
+	if (getpid() != main_pid)
+		return;
+
+	for (param = params; param->name; param++) {
+		if (!param->changed)
+			continue;
+
+		snprintf(path, sizeof(path), RFCOMM_PARAMS "%s", param->name);
+
+		fd = open(path, O_WRONLY);
+		if (fd < 0)
+			continue;
+
+		if (write(fd, param->saved, strlen(param->saved)) < 0)
+			syslog(LOG_ERR, "Can't restore RFCOMM %s", param->name);
+
+		close(fd);
+		param->changed = false;
+	}
+}
+
+static void sig_term(int sig)
+{
+	restore_params();
+	_exit(0);
+}
+
+static int set_sock_buf(int sk)
+{
+	if (!sock_buf)
+		return 0;
+
+	if (setsockopt(sk, SOL_SOCKET, SO_SNDBUF, &sock_buf,
+						sizeof(sock_buf)) < 0 ||
+			setsockopt(sk, SOL_SOCKET, SO_RCVBUF, &sock_buf,
+						sizeof(sock_buf)) < 0) {
+		syslog(LOG_ERR, "Can't set socket buffer size: %s (%d)",
+							strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
 static uint8_t get_channel(const char *svr, uint16_t uuid)
 {
 	sdp_session_t *sdp;
@@ -176,6 +337,9 @@ static int do_connect(const char *svr)
 		goto error;
 	}
 
+	if (set_sock_buf(sk) < 0)
+		goto error;
+
 #if 0
 	/* Enable SO_TIMESTAMP */
 	if (timestamp) {
@@ -221,7 +385,7 @@ static int do_connect(const char *svr)
 	memset(&addr, 0, sizeof(addr));
 	addr.rc_family = AF_BLUETOOTH;
 	str2ba(svr, &addr.rc_bdaddr);
-	addr.rc_channel = channel;
+	addr.rc_channel = channel + stream_id;
 
 	if (connect(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
 		syslog(LOG_ERR, "Can't connect: %s (%d)",
@@ -283,7 +447,7 @@ static void do_listen(void (*handler)(int sk))
 	memset(&addr, 0, sizeof(addr));
 	addr.rc_family = AF_BLUETOOTH;
 	bacpy(&addr.rc_bdaddr, &bdaddr);
-	addr.rc_channel = channel;
+	addr.rc_channel = channel ? channel + stream_id : 0;
 
 	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
 		syslog(LOG_ERR, "Can't bind socket: %s (%d)",
@@ -335,9 +499,8 @@ static void do_listen(void (*handler)(int sk))
 		goto error;
 	}
 
-	channel = addr.rc_channel;
-
-	syslog(LOG_INFO, "Waiting for connection on channel %d ...", channel);
+	syslog(LOG_INFO, "Waiting for connection on channel %d ...",
+							addr.rc_channel);
 
 	while (1) {
 		memset(&addr, 0, sizeof(addr));
@@ -414,6 +577,11 @@ static void do_listen(void (*handler)(int sk))
 			}
 		}
 
+		if (set_sock_buf(nsk) < 0) {
+			close(nsk);
+			goto error;
+		}
+
 		/* Handle deferred setup */
 		if (defer_setup) {
 			syslog(LOG_INFO, "Waiting for %d seconds",
@@ -535,11 +703,22 @@ static void recv_mode(int sk)
 
 		syslog(LOG_INFO,"%s%ld bytes in %.2f sec, %.2f kB/s", ts, total,
 			tv2fl(tv_diff), (float)(total / tv2fl(tv_diff) ) / 1024.0);
+
+		if (json) {
+			printf("{\"mode\":\"recv\",\"stream\":%d,"
+				"\"bytes\":%ld,\"seconds\":%.6f,"
+				"\"rate_kBps\":%.2f}\n", stream_id, total,
+				tv_diff.tv_sec + tv_diff.tv_usec / 1000000.0,
+				total / tv2fl(tv_diff) / 1024.0);
+			fflush(stdout);
+		}
 	}
 }
 
 static void do_send(int sk)
 {
+	struct timeval start;
+	struct result res;
 	uint32_t seq;
 	int i, fd, len;
 
@@ -561,6 +740,8 @@ static void do_send(int sk)
 			buf[i] = 0x7f;
 	}
 
+	gettimeofday(&start, NULL);
+
 	seq = 0;
 	while ((num_frames == -1) || (num_frames-- > 0)) {
 		put_le32(seq, buf);
@@ -577,6 +758,16 @@ static void do_send(int sk)
 		if (num_frames && delay && count && !(seq % count))
 			usleep(delay);
 	}
+
+	res.stream = stream_id;
+	res.bytes = (long) seq * data_size;
+	res.usec = elapsed_usec(&start);
+
+	report("send", stream_id, res.bytes, res.usec);
+
+	if (result_fd >= 0 && write(result_fd, &res, sizeof(res)) < 0)
+		syslog(LOG_ERR, "Can't pass result: %s (%d)",
+							strerror(errno), errno);
 }
 
 static void send_mode(int sk)
@@ -591,6 +782,69 @@ static void send_mode(int sk)
 	close(sk);
 }
 
+/*
+ * Each stream sends from its own process over its own DLC and the totals
+ * are reported once all of them are done. The DLCs share one RFCOMM
+ * session and ACL link, so this shows how the session divides it.
+ */
+static void multi_send_mode(char *svr)
+{
+	struct result res;
+	long bytes = 0, usec = 0;
+	int pfd[2], i, sk;
+
+	if (pipe(pfd) < 0) {
+		syslog(LOG_ERR, "Can't create pipe: %s (%d)",
+							strerror(errno), errno);
+		exit(1);
+	}
+
+	for (i = 0; i < streams; i++) {
+		if (fork())
+			continue;
+
+		/* Child */
+		close(pfd[0]);
+		result_fd = pfd[1];
+		stream_id = i;
+
+		sk = do_connect(svr);
+		if (sk < 0)
+			exit(1);
+
+		send_mode(sk);
+		exit(0);
+	}
+
+	close(pfd[1]);
+
+	while (read(pfd[0], &res, sizeof(res)) == sizeof(res)) {
+		bytes += res.bytes;
+		if (res.usec > usec)
+			usec = res.usec;
+	}
+
+	close(pfd[0]);
+
+	report("send", -1, bytes, usec);
+}
+
+static void listen_streams(void (*handler)(int sk))
+{
+	int i;
+
+	for (i = 1; i < streams; i++) {
+		if (fork())
+			continue;
+
+		/* Child, do_listen() never returns */
+		stream_id = i;
+		do_listen(handler);
+	}
+
+	do_listen(handler);
+}
+
 static void reconnect_mode(char *svr)
 {
 	while(1) {
@@ -686,7 +940,12 @@ static void usage(void)
 		"\t[-E] request encryption\n"
 		"\t[-S] secure connection\n"
 		"\t[-M] become central\n"
-		"\t[-T] enable timestamps\n");
+		"\t[-T] enable timestamps\n"
+		"\t[-K num] concurrent streams on consecutive channels\n"
+		"\t[-Z bytes] socket send and receive buffer size\n"
+		"\t[-Q mtu] RFCOMM channel MTU for new sessions\n"
+		"\t[-F] disable credit based flow control for new sessions\n"
+		"\t[-J] print results as JSON\n");
 }
 
 int main(int argc, char *argv[])
@@ -698,7 +957,8 @@ int main(int argc, char *argv[])
 	bacpy(&auto_bdaddr, BDADDR_ANY);
 
 	while ((opt = getopt(argc, argv,
-			"rdscuwmna:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T")) != EOF) {
+			"rdscuwmna:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T"
+			"K:Z:Q:FJ")) != EOF) {
 		switch (opt) {
 		case 'r':
 			mode = RECV;
@@ -822,6 +1082,30 @@ int main(int argc, char *argv[])
 			timestamp = 1;
 			break;
 
+		case 'K':
+			streams = atoi(optarg);
+			if (streams < 1 || streams > 30) {
+				fprintf(stderr, "Invalid number of streams\n");
+				exit(1);
+			}
+			break;
+
+		case 'Z':
+			sock_buf = atoi(optarg);
+			break;
+
+		case 'Q':
+			params[1].value = optarg;
+			break;
+
+		case 'F':
+			params[0].value = "Y";
+			break;
+
+		case 'J':
+			json = 1;
+			break;
+
 		default:
 			usage();
 			exit(1);
@@ -848,9 +1132,27 @@ int main(int argc, char *argv[])
 
 	openlog("rctest", LOG_PERROR | LOG_PID, LOG_LOCAL0);
 
+	main_pid = getpid();
+
+	if (params[0].value || params[1].value) {
+		struct rfcomm_param *param;
+
+		atexit(restore_params);
+
+		sa.sa_handler = sig_term;
+		sa.sa_flags = 0;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+
+		for (param = params; param->name; param++) {
+			if (param->value && set_param(param) < 0)
+				exit(1);
+		}
+	}
+
 	switch (mode) {
 		case RECV:
-			do_listen(recv_mode);
+			listen_streams(recv_mode);
 			break;
 
 		case CRECV:
@@ -861,10 +1163,15 @@ int main(int argc, char *argv[])
 			break;
 
 		case DUMP:
-			do_listen(dump_mode);
+			listen_streams(dump_mode);
 			break;
 
 		case SEND:
+			if (streams > 1) {
+				multi_send_mode(argv[optind]);
+				break;
+			}
+
 			sk = do_connect(argv[optind]);
 			if (sk < 0)
 				exit(1);
@@ -872,7 +1179,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case LSEND:
-			do_listen(send_mode);
+			listen_streams(send_mode);
 			break;
 
 		case RECONNECT:
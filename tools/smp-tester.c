@@ -899,6 +899,9 @@ int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
 
+	/* Generate the P-256 key pairs while the tests are idle */
+	ecc_set_key_pool(4);
+
 	test_smp("SMP Server - Basic Request 1",
 					&smp_server_basic_req_1_test,
 					setup_powered_server, test_server);
@@ -50,6 +50,8 @@ static bool start_dbus = false;
 static bool start_emulator = false;
 static bool start_monitor = false;
 static int num_devs = 0;
+static int num_jobs = 1;
+static int shard_index = 0;
 static const char *qemu_binary = NULL;
 static const char *kernel_image = NULL;
 
@@ -219,7 +221,7 @@ static void check_virtualization(void)
 #endif
 }
 
-static void start_qemu(void)
+static void start_qemu(int shard)
 {
 	char cwd[PATH_MAX/2], initcmd[PATH_MAX], testargs[PATH_MAX];
 	char cmdline[CMDLINE_MAX];
@@ -251,9 +253,11 @@ static void start_qemu(void)
 				"bluetooth.enable_ecred=1"
 				"TESTHOME=%s TESTDBUS=%u TESTMONITOR=%u "
 				"TESTEMULATOR=%u TESTDEVS=%d TESTAUTO=%u "
+				"TESTSHARD=%d TESTJOBS=%d "
 				"TESTARGS=\'%s\'",
 				initcmd, cwd, start_dbus, start_monitor,
-				start_emulator, num_devs, run_auto, testargs);
+				start_emulator, num_devs, run_auto,
+				shard, num_jobs, testargs);
 
 	argv = alloca(sizeof(qemu_argv) +
 				(sizeof(char *) * (4 + (num_devs * 4))));
@@ -712,7 +716,9 @@ start_next:
 			if (!test_table[idx])
 				return;
 
-			if (!stat(test_table[idx], &st))
+			/* Other shards run the remaining tests */
+			if (idx % num_jobs == shard_index &&
+						!stat(test_table[idx], &st))
 				break;
 
 			idx++;
@@ -886,6 +892,20 @@ static void run_tests(void)
 		start_emulator = true;
 	}
 
+	ptr = strstr(cmdline, "TESTJOBS=");
+	if (ptr) {
+		num_jobs = atoi(ptr + 9);
+		if (num_jobs < 1)
+			num_jobs = 1;
+	}
+
+	ptr = strstr(cmdline, "TESTSHARD=");
+	if (ptr)
+		shard_index = atoi(ptr + 10);
+
+	if (num_jobs > 1)
+		printf("Running shard %d of %d\n", shard_index + 1, num_jobs);
+
 	ptr = strstr(cmdline, "TESTHOME=");
 	if (ptr) {
 		home = ptr + 4;
@@ -897,6 +917,111 @@ static void run_tests(void)
 	run_command(cmds, home);
 }
 
+static int summary_value(const char *line, const char *field)
+{
+	const char *ptr = strstr(line, field);
+
+	if (!ptr)
+		return 0;
+
+	return atoi(ptr + strlen(field));
+}
+
+/*
+ * Every shard runs in its own VM, so each one has its own kernel and
+ * its own virtual controllers. The console output of each VM goes to a
+ * log file which is printed once all of them are done.
+ */
+static int run_jobs(void)
+{
+	int total = 0, passed = 0, failed = 0, not_run = 0;
+	pid_t *pids;
+	char path[32];
+	int i, running = 0;
+
+	pids = alloca(sizeof(pid_t) * num_jobs);
+
+	for (i = 0; i < num_jobs; i++) {
+		int fd;
+
+		snprintf(path, sizeof(path), "test-runner-%d.log", i);
+
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+									0644);
+		if (fd < 0) {
+			perror("Failed to create log file");
+			break;
+		}
+
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("Failed to fork new process");
+			close(fd);
+			break;
+		}
+
+		if (pids[i] == 0) {
+			int null_fd = open("/dev/null", O_RDONLY);
+
+			if (null_fd >= 0)
+				dup2(null_fd, STDIN_FILENO);
+
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+
+			start_qemu(i);
+			exit(EXIT_FAILURE);
+		}
+
+		close(fd);
+		running++;
+
+		printf("Shard %d running in process %d\n", i + 1, pids[i]);
+	}
+
+	while (running > 0) {
+		if (waitpid(WAIT_ANY, NULL, 0) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		running--;
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		char line[512];
+		FILE *fp;
+
+		snprintf(path, sizeof(path), "test-runner-%d.log", i);
+
+		fp = fopen(path, "re");
+		if (!fp)
+			continue;
+
+		printf("\n==> Shard %d (%s) <==\n", i + 1, path);
+
+		while (fgets(line, sizeof(line), fp)) {
+			fputs(line, stdout);
+
+			if (!strstr(line, "Total: "))
+				continue;
+
+			total += summary_value(line, "Total: ");
+			passed += summary_value(line, "Passed: ");
+			failed += summary_value(line, "Failed: ");
+			not_run += summary_value(line, "Not Run: ");
+		}
+
+		fclose(fp);
+	}
+
+	printf("\nAll shards: Total: %d, Passed: %d, Failed: %d, "
+				"Not Run: %d\n", total, passed, failed, not_run);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static void usage(void)
 {
 	printf("test-runner - Automated test execution utility\n"
@@ -910,6 +1035,7 @@ static void usage(void)
 		"\t-u, --unix [path]      Provide serial device\n"
 		"\t-q, --qemu <path>      QEMU binary\n"
 		"\t-k, --kernel <image>   Kernel image (bzImage)\n"
+		"\t-j, --jobs <num>       Number of VMs running tests\n"
 		"\t-h, --help             Show help options\n");
 }
 
@@ -922,6 +1048,7 @@ static const struct option main_options[] = {
 	{ "monitor", no_argument,       NULL, 'm' },
 	{ "qemu",    required_argument, NULL, 'q' },
 	{ "kernel",  required_argument, NULL, 'k' },
+	{ "jobs",    required_argument, NULL, 'j' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
@@ -941,7 +1068,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "audlmq:k:vh", main_options,
+		opt = getopt_long(argc, argv, "audlmq:k:j:vh", main_options,
 								NULL);
 		if (opt < 0)
 			break;
@@ -968,6 +1095,13 @@ int main(int argc, char *argv[])
 		case 'k':
 			kernel_image = optarg;
 			break;
+		case 'j':
+			num_jobs = atoi(optarg);
+			if (num_jobs < 1) {
+				fprintf(stderr, "Invalid number of jobs\n");
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -979,6 +1113,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (num_jobs > 1 && !run_auto) {
+		fprintf(stderr, "Multiple jobs require automatic mode\n");
+		return EXIT_FAILURE;
+	}
+
 	if (run_auto) {
 		if (argc - optind > 0) {
 			fprintf(stderr, "Invalid command line parameters\n");
@@ -1014,7 +1153,10 @@ int main(int argc, char *argv[])
 	printf("Using QEMU binary %s\n", qemu_binary);
 	printf("Using kernel image %s\n", kernel_image);
 
-	start_qemu();
+	if (num_jobs > 1)
+		return run_jobs();
+
+	start_qemu(0);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/ad.h"
+#include "unit/bench.h"
+
+/* Flags, two 16-bit service UUIDs, name, manufacturer data and TX power */
+static const uint8_t adv_data[] = {
+	0x02, 0x01, 0x06,
+	0x05, 0x03, 0x0d, 0x18, 0x0f, 0x18,
+	0x06, 0x09, 'B', 'e', 'n', 'c', 'h',
+	0x07, 0xff, 0xf1, 0x05, 0x01, 0x02, 0x03, 0x04,
+	0x02, 0x0a, 0x08,
+};
+
+static struct bt_ad *ad;
+
+static void bench_generate(const void *data)
+{
+	uint8_t *adv;
+	size_t len;
+
+	adv = bt_ad_generate(ad, &len);
+	free(adv);
+}
+
+static void bench_new_with_data(const void *data)
+{
+	struct bt_ad *parsed;
+
+	parsed = bt_ad_new_with_data(sizeof(adv_data), adv_data);
+	bt_ad_unref(parsed);
+}
+
+static void populate_ad(void)
+{
+	uint8_t flags = 0x06;
+	uint8_t msd[] = { 0x01, 0x02, 0x03, 0x04 };
+	bt_uuid_t uuid;
+
+	ad = bt_ad_new();
+
+	bt_ad_add_flags(ad, &flags, sizeof(flags));
+
+	bt_uuid16_create(&uuid, 0x180d);
+	bt_ad_add_service_uuid(ad, &uuid);
+
+	bt_uuid16_create(&uuid, 0x180f);
+	bt_ad_add_service_uuid(ad, &uuid);
+
+	bt_ad_add_name(ad, "Bench");
+	bt_ad_add_manufacturer_data(ad, 0x05f1, msd, sizeof(msd));
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	bench_init(&argc, &argv);
+
+	populate_ad();
+
+	bench_add("/ad/generate", bench_generate, NULL);
+	bench_add("/ad/new-with-data", bench_new_with_data, NULL);
+
+	ret = bench_run();
+
+	bt_ad_unref(ad);
+
+	return ret;
+}
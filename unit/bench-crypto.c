@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/crypto.h"
+#include "unit/bench.h"
+
+#define NUM_IRKS	16
+
+static const uint8_t key[16] = {
+	0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab,
+	0xa6, 0xd2, 0xae, 0x28, 0x16, 0x15, 0x7e, 0x2b,
+};
+
+static uint8_t pdu[64];
+static uint8_t irks[NUM_IRKS][16];
+static uint8_t rpa[6];
+
+static void bench_e(const void *data)
+{
+	struct bt_crypto *crypto = (void *) data;
+	uint8_t res[16];
+
+	bt_crypto_e(crypto, key, pdu, res);
+}
+
+static void bench_ah(const void *data)
+{
+	struct bt_crypto *crypto = (void *) data;
+	uint8_t hash[3];
+
+	bt_crypto_ah(crypto, key, rpa + 3, hash);
+}
+
+static void bench_resolve_rpa(const void *data)
+{
+	struct bt_crypto *crypto = (void *) data;
+	size_t index;
+
+	bt_crypto_resolve_rpa(crypto, irks, NUM_IRKS, rpa, &index);
+}
+
+static void bench_sign_att(const void *data)
+{
+	struct bt_crypto *crypto = (void *) data;
+	uint8_t signature[12];
+
+	bt_crypto_sign_att(crypto, key, pdu, sizeof(pdu), 1, signature);
+}
+
+static void bench_f4(const void *data)
+{
+	struct bt_crypto *crypto = (void *) data;
+	uint8_t res[16];
+
+	bt_crypto_f4(crypto, pdu, pdu + 32, irks[0], 0, res);
+}
+
+static void add_benches(const char *backend, struct bt_crypto *crypto)
+{
+	char name[64];
+
+	if (!crypto) {
+		fprintf(stderr, "Skipping %s crypto backend\n", backend);
+		return;
+	}
+
+	snprintf(name, sizeof(name), "/crypto/%s/e", backend);
+	bench_add(name, bench_e, crypto);
+
+	snprintf(name, sizeof(name), "/crypto/%s/ah", backend);
+	bench_add(name, bench_ah, crypto);
+
+	snprintf(name, sizeof(name), "/crypto/%s/resolve-rpa-16", backend);
+	bench_add(name, bench_resolve_rpa, crypto);
+
+	snprintf(name, sizeof(name), "/crypto/%s/sign-att-64", backend);
+	bench_add(name, bench_sign_att, crypto);
+
+	snprintf(name, sizeof(name), "/crypto/%s/f4", backend);
+	bench_add(name, bench_f4, crypto);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bt_crypto *kernel, *software;
+	unsigned int i;
+	int ret;
+
+	bench_init(&argc, &argv);
+
+	for (i = 0; i < sizeof(pdu); i++)
+		pdu[i] = i;
+
+	for (i = 0; i < NUM_IRKS; i++)
+		irks[i][0] = i + 1;
+
+	/* Random part of a resolvable address that matches no IRK */
+	rpa[5] = 0x40;
+
+	kernel = bt_crypto_new_backend(BT_CRYPTO_BACKEND_KERNEL);
+	software = bt_crypto_new_backend(BT_CRYPTO_BACKEND_SOFTWARE);
+
+	add_benches("kernel", kernel);
+	add_benches("software", software);
+
+	ret = bench_run();
+
+	bt_crypto_unref(software);
+	bt_crypto_unref(kernel);
+
+	return ret;
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "src/shared/ecc.h"
+#include "unit/bench.h"
+
+static uint8_t public_a[64], private_a[32];
+static uint8_t public_b[64], private_b[32];
+
+static void bench_make_key(const void *data)
+{
+	uint8_t public_key[64], private_key[32];
+
+	ecc_make_key(public_key, private_key);
+}
+
+static void bench_shared_secret(const void *data)
+{
+	uint8_t secret[32];
+
+	ecdh_shared_secret(public_b, private_a, secret);
+}
+
+static void bench_valid_public_key(const void *data)
+{
+	ecc_valid_public_key(public_b);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_init(&argc, &argv);
+
+	if (!ecc_make_key(public_a, private_a) ||
+				!ecc_make_key(public_b, private_b))
+		return EXIT_FAILURE;
+
+	bench_add("/ecc/make-key", bench_make_key, NULL);
+	bench_add("/ecc/shared-secret", bench_shared_secret, NULL);
+	bench_add("/ecc/valid-public-key", bench_valid_public_key, NULL);
+
+	return bench_run();
+}
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/sdp.h"
+#include "lib/uuid.h"
+#include "src/eir.h"
+#include "unit/bench.h"
+
+/* Typical LE advertising report of a heart rate sensor */
+static const uint8_t adv_data[] = {
+	0x02, 0x01, 0x06,
+	0x05, 0x03, 0x0d, 0x18, 0x0f, 0x18,
+	0x06, 0x09, 'B', 'e', 'n', 'c', 'h',
+	0x07, 0xff, 0xf1, 0x05, 0x01, 0x02, 0x03, 0x04,
+	0x02, 0x0a, 0x08,
+};
+
+/* Extended inquiry response of a phone */
+static const uint8_t eir_data[] = {
+	0x0e, 0x09, 'B', 'e', 'n', 'c', 'h', ' ',
+	'P', 'h', 'o', 'n', 'e', ' ', '1',
+	0x02, 0x0a, 0x04,
+	0x0d, 0x03, 0x00, 0x12, 0x1f, 0x11, 0x2f, 0x11,
+	0x0a, 0x11, 0x0c, 0x11, 0x32, 0x11,
+	0x11, 0x07, 0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80,
+	0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x09, 0x10, 0x02, 0x00, 0x4c, 0x00, 0x01, 0x00, 0x10, 0x0e,
+};
+
+struct eir_input {
+	const uint8_t *data;
+	uint8_t len;
+};
+
+static const struct eir_input adv_input = { adv_data, sizeof(adv_data) };
+static const struct eir_input eir_input = { eir_data, sizeof(eir_data) };
+
+static unsigned int fields;
+
+static void bench_parse(const void *data)
+{
+	const struct eir_input *input = data;
+	struct eir_data eir;
+
+	memset(&eir, 0, sizeof(eir));
+	eir_parse(&eir, input->data, input->len);
+	eir_data_free(&eir);
+}
+
+static void bench_iter(const void *data)
+{
+	const struct eir_input *input = data;
+	struct eir_field field;
+	struct eir_iter iter;
+
+	eir_iter_init(&iter, input->data, input->len);
+
+	while (eir_iter_next(&iter, &field))
+		fields++;
+}
+
+static void bench_view_has_uuid(const void *data)
+{
+	const struct eir_input *input = data;
+	struct eir_view view;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, 0x180f);
+
+	eir_view_init(&view, input->data, input->len);
+	eir_view_has_uuid(&view, &uuid);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_init(&argc, &argv);
+
+	bench_add("/eir/parse/adv", bench_parse, &adv_input);
+	bench_add("/eir/parse/eir", bench_parse, &eir_input);
+	bench_add("/eir/iter/adv", bench_iter, &adv_input);
+	bench_add("/eir/iter/eir", bench_iter, &eir_input);
+	bench_add("/eir/view-has-uuid/adv", bench_view_has_uuid, &adv_input);
+
+	return bench_run();
+}
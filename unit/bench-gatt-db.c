@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "unit/bench.h"
+
+#define NUM_SERVICES	32
+#define NUM_CHRCS	6
+
+/* Service, and per characteristic a declaration, value and CCC */
+#define SERVICE_HANDLES	(1 + NUM_CHRCS * 3)
+
+static struct gatt_db *db;
+static struct queue *results;
+static bt_uuid_t primary_uuid;
+static bt_uuid_t chrc_uuid;
+static unsigned int found;
+
+static void populate_db(void)
+{
+	unsigned int i, j;
+	bt_uuid_t uuid;
+
+	db = gatt_db_new();
+
+	for (i = 0; i < NUM_SERVICES; i++) {
+		struct gatt_db_attribute *service;
+
+		bt_uuid16_create(&uuid, 0x1800 + i);
+		service = gatt_db_add_service(db, &uuid, true,
+							SERVICE_HANDLES);
+
+		for (j = 0; j < NUM_CHRCS; j++) {
+			bt_uuid16_create(&uuid, 0x2a00 + i * NUM_CHRCS + j);
+			gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_NOTIFY,
+					NULL, NULL, NULL);
+
+			bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+			gatt_db_service_add_descriptor(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					NULL, NULL, NULL);
+		}
+
+		gatt_db_service_set_active(service, true);
+	}
+}
+
+static void bench_get_attribute(const void *data)
+{
+	gatt_db_get_attribute(db, NUM_SERVICES * SERVICE_HANDLES / 2);
+}
+
+static void count_attribute(struct gatt_db_attribute *attrib,
+							void *user_data)
+{
+	found++;
+}
+
+static void bench_find_by_type(const void *data)
+{
+	gatt_db_find_by_type(db, 0x0001, 0xffff, &primary_uuid,
+						count_attribute, NULL);
+}
+
+static void bench_read_by_type(const void *data)
+{
+	gatt_db_read_by_type(db, 0x0001, 0xffff, chrc_uuid, results);
+	queue_remove_all(results, NULL, NULL, NULL);
+}
+
+static void bench_find_information(const void *data)
+{
+	uint16_t start = NUM_SERVICES * SERVICE_HANDLES / 2;
+
+	gatt_db_find_information(db, start, start + SERVICE_HANDLES, results);
+	queue_remove_all(results, NULL, NULL, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	bench_init(&argc, &argv);
+
+	bt_uuid16_create(&primary_uuid, GATT_PRIM_SVC_UUID);
+	bt_uuid16_create(&chrc_uuid, GATT_CHARAC_UUID);
+
+	populate_db();
+	results = queue_new();
+
+	bench_add("/gatt-db/get-attribute", bench_get_attribute, NULL);
+	bench_add("/gatt-db/find-by-type", bench_find_by_type, NULL);
+	bench_add("/gatt-db/read-by-type", bench_read_by_type, NULL);
+	bench_add("/gatt-db/find-information", bench_find_information,
+									NULL);
+
+	ret = bench_run();
+
+	queue_destroy(results, NULL);
+	gatt_db_unref(db);
+
+	return ret;
+}
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "monitor/packet.h"
+#include "unit/bench.h"
+
+#define BENCH_INDEX	0
+
+static const uint8_t pkt_cmd_reset[] = { 0x03, 0x0c, 0x00 };
+
+static const uint8_t pkt_evt_reset_complete[] = {
+	0x0e, 0x04, 0x01, 0x03, 0x0c, 0x00,
+};
+
+static const uint8_t pkt_evt_adv_report[] = {
+	0x3e, 0x27, 0x02, 0x01, 0x00, 0x00,
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x1b,
+	0x02, 0x01, 0x06,
+	0x05, 0x03, 0x0d, 0x18, 0x0f, 0x18,
+	0x06, 0x09, 'B', 'e', 'n', 'c', 'h',
+	0x07, 0xff, 0xf1, 0x05, 0x01, 0x02, 0x03, 0x04,
+	0x02, 0x0a, 0x08,
+	0xc4,
+};
+
+static const uint8_t pkt_evt_le_conn_complete[] = {
+	0x3e, 0x13, 0x01, 0x00, 0x40, 0x00, 0x00, 0x00,
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	0x18, 0x00, 0x00, 0x00, 0xf4, 0x01, 0x00,
+};
+
+/* ATT Read By Group Type Request for primary services */
+static const uint8_t pkt_acl_att_req[] = {
+	0x40, 0x20, 0x0b, 0x00, 0x07, 0x00, 0x04, 0x00,
+	0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28,
+};
+
+static const uint8_t pkt_acl_att_rsp[] = {
+	0x40, 0x20, 0x12, 0x00, 0x0e, 0x00, 0x04, 0x00,
+	0x11, 0x06, 0x01, 0x00, 0x05, 0x00, 0x00, 0x18,
+	0x06, 0x00, 0x09, 0x00, 0x01, 0x18,
+};
+
+static const uint8_t pkt_evt_num_completed[] = {
+	0x13, 0x05, 0x01, 0x40, 0x00, 0x01, 0x00,
+};
+
+static const uint8_t pkt_evt_disconn_complete[] = {
+	0x05, 0x04, 0x00, 0x40, 0x00, 0x13,
+};
+
+struct corpus_packet {
+	uint16_t opcode;
+	const uint8_t *data;
+	uint16_t len;
+};
+
+#define CORPUS_PACKET(_opcode, _data) \
+	{ .opcode = _opcode, .data = _data, .len = sizeof(_data) }
+
+/* A short LE session, replayed as a whole so connection state is reset */
+static const struct corpus_packet corpus[] = {
+	CORPUS_PACKET(BTSNOOP_OPCODE_COMMAND_PKT, pkt_cmd_reset),
+	CORPUS_PACKET(BTSNOOP_OPCODE_EVENT_PKT, pkt_evt_reset_complete),
+	CORPUS_PACKET(BTSNOOP_OPCODE_EVENT_PKT, pkt_evt_adv_report),
+	CORPUS_PACKET(BTSNOOP_OPCODE_EVENT_PKT, pkt_evt_le_conn_complete),
+	CORPUS_PACKET(BTSNOOP_OPCODE_ACL_TX_PKT, pkt_acl_att_req),
+	CORPUS_PACKET(BTSNOOP_OPCODE_EVENT_PKT, pkt_evt_num_completed),
+	CORPUS_PACKET(BTSNOOP_OPCODE_ACL_RX_PKT, pkt_acl_att_rsp),
+	CORPUS_PACKET(BTSNOOP_OPCODE_EVENT_PKT, pkt_evt_disconn_complete),
+};
+
+static void bench_decode(const void *data)
+{
+	const struct corpus_packet *pkt = data;
+	struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+
+	packet_monitor(&tv, NULL, BENCH_INDEX, pkt->opcode, pkt->data,
+								pkt->len);
+}
+
+static void bench_decode_corpus(const void *data)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(corpus); i++)
+		bench_decode(&corpus[i]);
+}
+
+static void new_index(void)
+{
+	struct btsnoop_opcode_new_index ni;
+
+	memset(&ni, 0, sizeof(ni));
+	ni.type = HCI_PRIMARY;
+	ni.bus = HCI_VIRTUAL;
+	strcpy(ni.name, "hci0");
+
+	packet_monitor(NULL, NULL, BENCH_INDEX, BTSNOOP_OPCODE_NEW_INDEX,
+							&ni, sizeof(ni));
+}
+
+int main(int argc, char *argv[])
+{
+	bench_init(&argc, &argv);
+
+	/* Only the cost of decoding and formatting is of interest */
+	if (!freopen("/dev/null", "w", stdout))
+		return EXIT_FAILURE;
+
+	new_index();
+
+	bench_add("/packet/corpus", bench_decode_corpus, NULL);
+	bench_add("/packet/adv-report", bench_decode, &corpus[2]);
+
+	return bench_run();
+}
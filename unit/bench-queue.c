@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "unit/bench.h"
+
+#define QUEUE_LEN	64
+
+static struct queue *empty_queue;
+static struct queue *full_queue;
+static unsigned int visited;
+
+static void bench_push_pop(const void *data)
+{
+	queue_push_tail(empty_queue, UINT_TO_PTR(1));
+	queue_pop_head(empty_queue);
+}
+
+static void bench_push_head_pop(const void *data)
+{
+	queue_push_head(empty_queue, UINT_TO_PTR(1));
+	queue_pop_head(empty_queue);
+}
+
+static bool match_ptr(const void *data, const void *match_data)
+{
+	return data == match_data;
+}
+
+static void bench_find_last(const void *data)
+{
+	queue_find(full_queue, match_ptr, UINT_TO_PTR(QUEUE_LEN));
+}
+
+static void bench_remove_push(const void *data)
+{
+	queue_remove(full_queue, UINT_TO_PTR(QUEUE_LEN / 2));
+	queue_push_tail(full_queue, UINT_TO_PTR(QUEUE_LEN / 2));
+}
+
+static void visit(void *data, void *user_data)
+{
+	visited++;
+}
+
+static void bench_foreach(const void *data)
+{
+	queue_foreach(full_queue, visit, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int ret;
+
+	bench_init(&argc, &argv);
+
+	empty_queue = queue_new();
+	full_queue = queue_new();
+
+	for (i = 1; i <= QUEUE_LEN; i++)
+		queue_push_tail(full_queue, UINT_TO_PTR(i));
+
+	bench_add("/queue/push-tail-pop", bench_push_pop, NULL);
+	bench_add("/queue/push-head-pop", bench_push_head_pop, NULL);
+	bench_add("/queue/find-64", bench_find_last, NULL);
+	bench_add("/queue/remove-push-64", bench_remove_push, NULL);
+	bench_add("/queue/foreach-64", bench_foreach, NULL);
+
+	ret = bench_run();
+
+	queue_destroy(full_queue, NULL);
+	queue_destroy(empty_queue, NULL);
+
+	return ret;
+}
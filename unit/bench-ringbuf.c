@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "src/shared/ringbuf.h"
+#include "unit/bench.h"
+
+#define RINGBUF_SIZE	4096
+
+static struct ringbuf *ringbuf;
+
+static void bench_printf_drain(const void *data)
+{
+	int len;
+
+	len = ringbuf_printf(ringbuf, "%s %u\n", "bench", 0x1234);
+	ringbuf_drain(ringbuf, len);
+}
+
+static void bench_printf_peek(const void *data)
+{
+	size_t len_nowrap;
+	int len;
+
+	len = ringbuf_printf(ringbuf, "%s", (const char *) data);
+	ringbuf_peek(ringbuf, 0, &len_nowrap);
+	ringbuf_drain(ringbuf, len);
+}
+
+static const char long_str[] =
+	"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+	"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	bench_init(&argc, &argv);
+
+	ringbuf = ringbuf_new(RINGBUF_SIZE);
+	if (!ringbuf)
+		return EXIT_FAILURE;
+
+	bench_add("/ringbuf/printf-drain", bench_printf_drain, NULL);
+	bench_add("/ringbuf/printf-peek-128", bench_printf_peek, long_str);
+
+	ret = bench_run();
+
+	ringbuf_free(ringbuf);
+
+	return ret;
+}
@@ -0,0 +1,331 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "unit/bench.h"
+
+#define DEFAULT_RUN_MS		200
+#define DEFAULT_RUNS		5
+#define MAX_RUNS		100
+
+struct bench_case {
+	char *name;
+	bench_func_t func;
+	const void *data;
+};
+
+struct bench_result {
+	char name[64];
+	double ns_per_op;
+};
+
+static struct queue *bench_list;
+static struct queue *baseline;
+static FILE *out;
+
+static bool option_list;
+static const char *option_prefix;
+static unsigned int option_run_ms = DEFAULT_RUN_MS;
+static unsigned int option_runs = DEFAULT_RUNS;
+
+/*
+ * The bench programs are linked with --wrap for the allocator entry points
+ * so every allocation made by BlueZ code is counted. Allocations done
+ * inside other libraries, GLib in particular, are not visible here.
+ */
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+
+	return __real_realloc(ptr, size);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t run_iterations(struct bench_case *bench,
+						unsigned int iterations)
+{
+	uint64_t start;
+	unsigned int i;
+
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++)
+		bench->func(bench->data);
+
+	return now_ns() - start;
+}
+
+/*
+ * Double the number of iterations until a batch takes a tenth of the run
+ * time, which also serves as warm-up for caches and the allocator, and
+ * then scale it so that each measured run takes about option_run_ms.
+ */
+static unsigned int calibrate(struct bench_case *bench)
+{
+	uint64_t target = (uint64_t) option_run_ms * 1000000;
+	uint64_t elapsed, iterations = 1;
+
+	while (1) {
+		elapsed = run_iterations(bench, iterations);
+		if (elapsed >= target / 10 || iterations >= UINT32_MAX / 2)
+			break;
+
+		iterations *= 2;
+	}
+
+	iterations = iterations * target / (elapsed ? elapsed : 1);
+	if (!iterations)
+		iterations = 1;
+	else if (iterations > UINT32_MAX)
+		iterations = UINT32_MAX;
+
+	return iterations;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static bool match_result(const void *data, const void *match_data)
+{
+	const struct bench_result *result = data;
+
+	return !strcmp(result->name, match_data);
+}
+
+static void run_bench(void *data, void *user_data)
+{
+	struct bench_case *bench = data;
+	double runs[MAX_RUNS], ns_per_op, allocs_per_op;
+	struct bench_result *base;
+	unsigned long start_allocs;
+	unsigned int iterations, i;
+
+	if (option_prefix && strncmp(bench->name, option_prefix,
+						strlen(option_prefix)))
+		return;
+
+	if (option_list) {
+		fprintf(out, "%s\n", bench->name);
+		return;
+	}
+
+	iterations = calibrate(bench);
+
+	start_allocs = allocations;
+
+	for (i = 0; i < option_runs; i++)
+		runs[i] = (double) run_iterations(bench, iterations) /
+								iterations;
+
+	allocs_per_op = (double) (allocations - start_allocs) /
+					((double) iterations * option_runs);
+
+	/* The median is far less affected by scheduling noise than the mean */
+	qsort(runs, option_runs, sizeof(double), compare_double);
+	ns_per_op = runs[option_runs / 2];
+
+	fprintf(out, "%-40s %10u iter %12.1f ns/op %8.2f allocs/op",
+				bench->name, iterations, ns_per_op,
+				allocs_per_op);
+
+	base = queue_find(baseline, match_result, bench->name);
+	if (base && base->ns_per_op > 0)
+		fprintf(out, " %+7.1f%%",
+				(ns_per_op / base->ns_per_op - 1) * 100);
+
+	fprintf(out, "\n");
+}
+
+static bool load_baseline(const char *path)
+{
+	struct bench_result result;
+	char line[256];
+	double allocs;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("Failed to open baseline");
+		return false;
+	}
+
+	baseline = queue_new();
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned int iterations;
+
+		if (sscanf(line, "%63s %u iter %lf ns/op %lf allocs/op",
+					result.name, &iterations,
+					&result.ns_per_op, &allocs) != 4)
+			continue;
+
+		queue_push_tail(baseline, util_memdup(&result,
+							sizeof(result)));
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+static void free_bench(void *data)
+{
+	struct bench_case *bench = data;
+
+	free(bench->name);
+	free(bench);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage:\n"
+		"\t%s [options]\n", name);
+	fprintf(stderr, "Options:\n"
+		"\t-l, --list             Only list the benchmarks\n"
+		"\t-p, --prefix <prefix>  Run benchmarks matching prefix\n"
+		"\t-t, --time <msec>      Duration of each run\n"
+		"\t-r, --runs <count>     Number of measured runs\n"
+		"\t-c, --compare <file>   Compare with the output of an "
+						"earlier run\n"
+		"\t-h, --help             Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "list",	no_argument,		NULL, 'l' },
+	{ "prefix",	required_argument,	NULL, 'p' },
+	{ "time",	required_argument,	NULL, 't' },
+	{ "runs",	required_argument,	NULL, 'r' },
+	{ "compare",	required_argument,	NULL, 'c' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+void bench_init(int *argc, char ***argv)
+{
+	/*
+	 * Results always go to the original stdout so that benchmarks may
+	 * redirect stdout to discard the output of the code under test.
+	 */
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!out)
+		exit(EXIT_FAILURE);
+
+	setvbuf(out, NULL, _IOLBF, 0);
+
+	bench_list = queue_new();
+
+	while (1) {
+		int opt;
+
+		opt = getopt_long(*argc, *argv, "lp:t:r:c:h", main_options,
+									NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'l':
+			option_list = true;
+			break;
+		case 'p':
+			option_prefix = optarg;
+			break;
+		case 't':
+			option_run_ms = atoi(optarg);
+			break;
+		case 'r':
+			option_runs = atoi(optarg);
+			break;
+		case 'c':
+			if (!load_baseline(optarg))
+				exit(EXIT_FAILURE);
+			break;
+		case 'h':
+			usage((*argv)[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage((*argv)[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!option_run_ms || !option_runs || option_runs > MAX_RUNS) {
+		fprintf(stderr, "Invalid run time or number of runs\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void bench_add(const char *name, bench_func_t func, const void *data)
+{
+	struct bench_case *bench;
+
+	bench = new0(struct bench_case, 1);
+	bench->name = strdup(name);
+	bench->func = func;
+	bench->data = data;
+
+	queue_push_tail(bench_list, bench);
+}
+
+int bench_run(void)
+{
+	queue_foreach(bench_list, run_bench, NULL);
+
+	queue_destroy(bench_list, free_bench);
+	queue_destroy(baseline, free);
+
+	fclose(out);
+
+	return EXIT_SUCCESS;
+}
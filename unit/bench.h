@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*bench_func_t)(const void *data);
+
+void bench_init(int *argc, char ***argv);
+void bench_add(const char *name, bench_func_t func, const void *data);
+int bench_run(void);
@@ -20,6 +20,8 @@
 #include <glib.h>
 
 static struct bt_crypto *crypto;
+static struct bt_crypto *kernel;
+static struct bt_crypto *software;
 
 static void print_debug(const char *str, void *user_data)
 {
@@ -311,36 +313,100 @@ static void test_verify_sign(gconstpointer data)
 	tester_test_passed();
 }
 
+static void test_resolve_rpa(gconstpointer data)
+{
+	/* IRK and RPA from Core Spec Vol 3, Part H, D.7 in LSB order */
+	const uint8_t irk[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t rpa[6] = { 0xaa, 0xfb, 0x0d, 0x94, 0x81, 0x70 };
+	uint8_t irks[20][16];
+	size_t i, index;
+
+	for (i = 0; i < 20; i++)
+		memset(irks[i], i + 1, 16);
+
+	if (bt_crypto_resolve_rpa(crypto, (const uint8_t (*)[16]) irks, 20,
+								rpa, &index)) {
+		tester_test_failed();
+		return;
+	}
+
+	memcpy(irks[17], irk, 16);
+
+	if (!bt_crypto_resolve_rpa(crypto, (const uint8_t (*)[16]) irks, 20,
+								rpa, &index)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_debug("Resolved at index %zu", index);
+
+	if (index != 17) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
+static void setup_software(const void *data)
+{
+	crypto = software;
+
+	tester_setup_complete();
+}
+
+static void teardown_software(const void *data)
+{
+	crypto = kernel;
+
+	tester_teardown_complete();
+}
+
+#define add_test(name, data, func) \
+	do { \
+		if (kernel) \
+			tester_add("/crypto/" name, data, NULL, func, NULL); \
+		tester_add("/crypto/software/" name, data, setup_software, \
+						func, teardown_software); \
+	} while (0)
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
 
-	crypto = bt_crypto_new();
-	if (!crypto)
+	kernel = bt_crypto_new_backend(BT_CRYPTO_BACKEND_KERNEL);
+	software = bt_crypto_new_backend(BT_CRYPTO_BACKEND_SOFTWARE);
+	if (!software)
 		return 0;
 
+	crypto = kernel;
+
 	tester_init(&argc, &argv);
 
-	tester_add("/crypto/h6", NULL, NULL, test_h6, NULL);
+	add_test("h6", NULL, test_h6);
+
+	add_test("sign_att_1", &test_data_1, test_sign);
+	add_test("sign_att_2", &test_data_2, test_sign);
+	add_test("sign_att_3", &test_data_3, test_sign);
+	add_test("sign_att_4", &test_data_4, test_sign);
+	add_test("sign_att_5", &test_data_5, test_sign);
 
-	tester_add("/crypto/sign_att_1", &test_data_1, NULL, test_sign, NULL);
-	tester_add("/crypto/sign_att_2", &test_data_2, NULL, test_sign, NULL);
-	tester_add("/crypto/sign_att_3", &test_data_3, NULL, test_sign, NULL);
-	tester_add("/crypto/sign_att_4", &test_data_4, NULL, test_sign, NULL);
-	tester_add("/crypto/sign_att_5", &test_data_5, NULL, test_sign, NULL);
+	add_test("gatt_hash", NULL, test_gatt_hash);
 
-	tester_add("/crypto/gatt_hash", NULL, NULL, test_gatt_hash, NULL);
+	add_test("resolve_rpa", NULL, test_resolve_rpa);
 
-	tester_add("/crypto/verify_sign_pass", &verify_sign_pass_data,
-						NULL, test_verify_sign, NULL);
-	tester_add("/crypto/verify_sign_bad_sign", &verify_sign_bad_sign_data,
-						NULL, test_verify_sign, NULL);
-	tester_add("/crypto/verify_sign_too_short", &verify_sign_too_short_data,
-						NULL, test_verify_sign, NULL);
+	add_test("verify_sign_pass", &verify_sign_pass_data, test_verify_sign);
+	add_test("verify_sign_bad_sign", &verify_sign_bad_sign_data,
+							test_verify_sign);
+	add_test("verify_sign_too_short", &verify_sign_too_short_data,
+							test_verify_sign);
 
 	exit_status = tester_run();
 
-	bt_crypto_unref(crypto);
+	bt_crypto_unref(software);
+	bt_crypto_unref(kernel);
 
 	return exit_status;
 }
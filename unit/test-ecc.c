@@ -16,10 +16,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "src/shared/ecc.h"
 #include "src/shared/util.h"
 #include "src/shared/tester.h"
+#include "src/shared/timeout.h"
 
 static void print_dump(const char *str, void *user_data)
 {
@@ -261,6 +263,129 @@ static void test_invalid_pub(const void *data)
 	tester_test_passed();
 }
 
+/* Generator point, LSB first */
+static const uint8_t curve_g[64] = {
+				0x96, 0xc2, 0x98, 0xd8, 0x45, 0x39, 0xa1, 0xf4,
+				0xa0, 0x33, 0xeb, 0x2d, 0x81, 0x7d, 0x03, 0x77,
+				0xf2, 0x40, 0xa4, 0x63, 0xe5, 0xe6, 0xbc, 0xf8,
+				0x47, 0x42, 0x2c, 0xe1, 0xf2, 0xd1, 0x17, 0x6b,
+
+				0xf5, 0x51, 0xbf, 0x37, 0x68, 0x40, 0xb6, 0xcb,
+				0xce, 0x5e, 0x31, 0x6b, 0x57, 0x33, 0xce, 0x2b,
+				0x16, 0x9e, 0x0f, 0x7c, 0x4a, 0xeb, 0xe7, 0x8e,
+				0x9b, 0x7f, 0x1a, 0xfe, 0xe2, 0x42, 0xe3, 0x4f,
+};
+
+/*
+ * Public keys come from the fixed base comb while ECDH goes through the
+ * ladder, so a shared secret with the generator has to match the X
+ * coordinate of the public key.
+ */
+static void test_public_key(const void *data)
+{
+	uint8_t public[64], private[32], secret[32];
+	int i;
+
+	for (i = 0; i < PAIR_COUNT; i++) {
+		g_assert(ecc_make_key(public, private));
+		g_assert(ecc_valid_public_key(public));
+		g_assert(ecdh_shared_secret(curve_g, private, secret));
+
+		if (memcmp(secret, public, sizeof(secret)) != 0) {
+			print_buf("Private key = ", private, sizeof(private));
+			g_assert_not_reached();
+		}
+	}
+
+	/* Single bits exercise every comb column and table entry */
+	for (i = 1; i < 256; i++) {
+		memset(private, 0, sizeof(private));
+		private[i / 8] = 1 << (i % 8);
+
+		g_assert(ecc_make_public_key(private, public));
+		g_assert(ecdh_shared_secret(curve_g, private, secret));
+		g_assert(memcmp(secret, public, sizeof(secret)) == 0);
+	}
+
+	tester_test_passed();
+}
+
+#define BENCHMARK_ROUNDS 200
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+				(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void test_benchmark(const void *data)
+{
+	uint8_t public[64], private[32], secret[32];
+	struct timespec start;
+	double secs;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCHMARK_ROUNDS; i++)
+		g_assert(ecc_make_key(public, private));
+
+	secs = elapsed(&start);
+	tester_debug("ecc_make_key: %.0f us", secs * 1e6 / BENCHMARK_ROUNDS);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCHMARK_ROUNDS; i++)
+		g_assert(ecdh_shared_secret(public, private, secret));
+
+	secs = elapsed(&start);
+	tester_debug("ecdh_shared_secret: %.0f us",
+					secs * 1e6 / BENCHMARK_ROUNDS);
+
+	tester_test_passed();
+}
+
+#define POOL_SIZE 4
+
+static bool pool_check(void *user_data)
+{
+	uint8_t public[POOL_SIZE][64], private[32], secret[32];
+	int i;
+
+	if (ecc_get_key_pool() < POOL_SIZE)
+		return true;
+
+	for (i = 0; i < POOL_SIZE; i++) {
+		g_assert(ecc_make_key(public[i], private));
+		g_assert(ecc_get_key_pool() == POOL_SIZE - i - 1);
+		g_assert(ecc_valid_public_key(public[i]));
+		g_assert(ecdh_shared_secret(curve_g, private, secret));
+		g_assert(memcmp(secret, public[i], sizeof(secret)) == 0);
+
+		/* Pooled key pairs must never be handed out twice */
+		if (i > 0)
+			g_assert(memcmp(public[i], public[i - 1], 64) != 0);
+	}
+
+	g_assert(ecc_set_key_pool(0));
+	g_assert(ecc_get_key_pool() == 0);
+
+	tester_test_passed();
+
+	return false;
+}
+
+static void test_key_pool(const void *data)
+{
+	g_assert(ecc_set_key_pool(POOL_SIZE));
+
+	timeout_add(10, pool_check, NULL, NULL);
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -273,5 +398,9 @@ int main(int argc, char *argv[])
 
 	tester_add("/ecdh/invalid", NULL, NULL, test_invalid_pub, NULL);
 
+	tester_add("/ecdh/public_key", NULL, NULL, test_public_key, NULL);
+	tester_add("/ecdh/key_pool", NULL, NULL, test_key_pool, NULL);
+	tester_add("/ecdh/benchmark", NULL, NULL, test_benchmark, NULL);
+
 	return tester_run();
 }
@@ -539,6 +539,35 @@ static void print_debug(const char *str, void *user_data)
 	tester_debug("%s%s", prefix, str);
 }
 
+static void test_view(const struct test_data *test, struct eir_data *eir)
+{
+	struct eir_view view;
+	bt_uuid_t uuid;
+	char *name;
+	int n;
+
+	eir_view_init(&view, test->eir_data, test->eir_size);
+
+	g_assert_cmpint(view.flags, ==, eir->flags);
+	g_assert(view.tx_power == eir->tx_power);
+
+	name = eir_view_get_name(&view);
+	g_assert_cmpstr(name, ==, eir->name);
+	g_free(name);
+
+	if (eir->name)
+		g_assert(view.name_complete == eir->name_complete);
+
+	for (n = 0; test->uuid && test->uuid[n]; n++) {
+		g_assert(!bt_string_to_uuid(&uuid, test->uuid[n]));
+		g_assert(eir_view_has_uuid(&view, &uuid));
+	}
+
+	/* Not used by any of the samples */
+	bt_uuid16_create(&uuid, 0x1234);
+	g_assert(!eir_view_has_uuid(&view, &uuid));
+}
+
 static void test_parsing(gconstpointer data)
 {
 	const struct test_data *test = data;
@@ -583,6 +612,8 @@ static void test_parsing(gconstpointer data)
 		g_assert(eir.services == NULL);
 	}
 
+	test_view(test, &eir);
+
 	for (list = eir.msd_list; list; list = list->next) {
 		struct eir_msd *msd = list->data;
 
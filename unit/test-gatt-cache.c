@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+#include "src/shared/tester.h"
+
+static const uint8_t db_hash[16] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+};
+
+static void write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+	g_assert(!err);
+}
+
+static void read_cb(struct gatt_db_attribute *attrib, int err,
+					const uint8_t *value, size_t length,
+					void *user_data)
+{
+	struct iovec *iov = user_data;
+
+	g_assert(!err);
+
+	iov->iov_base = g_memdup(value, length);
+	iov->iov_len = length;
+}
+
+static struct gatt_db *make_db(void)
+{
+	struct gatt_db_attribute *gap, *gatt, *svc, *attr;
+	struct gatt_db *db;
+	uint16_t ext_props;
+	uint128_t u128;
+	bt_uuid_t uuid;
+
+	db = gatt_db_new();
+	g_assert(db);
+
+	bt_uuid16_create(&uuid, 0x1800);
+	gap = gatt_db_insert_service(db, 0x0001, &uuid, true, 5);
+	g_assert(gap);
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DEVICE_NAME);
+	g_assert(gatt_db_service_insert_characteristic(gap, 0x0003, &uuid, 0,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_EXT_PROP,
+					NULL, NULL, NULL));
+
+	ext_props = 0x0001;
+	bt_uuid16_create(&uuid, GATT_CHARAC_EXT_PROPER_UUID);
+	attr = gatt_db_service_insert_descriptor(gap, 0x0004, &uuid, 0, NULL,
+								NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_write(attr, 0, (void *) &ext_props,
+					sizeof(ext_props), 0, NULL, write_cb,
+					NULL));
+
+	bt_uuid16_create(&uuid, 0x1801);
+	gatt = gatt_db_insert_service(db, 0x0010, &uuid, true, 4);
+	g_assert(gatt);
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+	attr = gatt_db_service_insert_characteristic(gatt, 0x0012, &uuid, 0,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_write(attr, 0, db_hash, sizeof(db_hash), 0,
+						NULL, write_cb, NULL));
+
+	memset(&u128, 0xa5, sizeof(u128));
+	bt_uuid128_create(&uuid, u128);
+	svc = gatt_db_insert_service(db, 0x0020, &uuid, false, 5);
+	g_assert(svc);
+
+	g_assert(gatt_db_service_insert_included(svc, 0x0021, gatt));
+
+	g_assert(gatt_db_service_insert_characteristic(svc, 0x0023, &uuid, 0,
+						BT_GATT_CHRC_PROP_NOTIFY,
+						NULL, NULL, NULL));
+
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	g_assert(gatt_db_service_insert_descriptor(svc, 0x0024, &uuid, 0,
+							NULL, NULL, NULL));
+
+	gatt_db_service_set_active(gap, true);
+	gatt_db_service_set_active(gatt, true);
+	gatt_db_service_set_active(svc, true);
+
+	return db;
+}
+
+static char *make_filename(void)
+{
+	char *filename = g_strdup("/tmp/test-gatt-cache-XXXXXX");
+	int fd;
+
+	fd = mkstemp(filename);
+	g_assert(fd >= 0);
+	close(fd);
+
+	return filename;
+}
+
+static void test_store_load(const void *data)
+{
+	struct gatt_db *db, *copy;
+	struct gatt_db_attribute *attr;
+	struct iovec iov;
+	uint16_t ext_props;
+	uint8_t properties;
+	char *filename;
+	bt_uuid_t uuid;
+	uint8_t hash[16];
+
+	db = make_db();
+	filename = make_filename();
+
+	g_assert(gatt_cache_store(db, filename));
+
+	copy = gatt_db_new();
+	g_assert(gatt_cache_load(copy, filename));
+
+	memcpy(hash, gatt_db_get_hash(db), sizeof(hash));
+	g_assert(!memcmp(hash, gatt_db_get_hash(copy), sizeof(hash)));
+
+	attr = gatt_db_get_attribute(copy, 0x0002);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_get_char_data(attr, NULL, NULL, &properties,
+						&ext_props, &uuid));
+	g_assert(properties & BT_GATT_CHRC_PROP_EXT_PROP);
+	g_assert(ext_props == 0x0001);
+
+	attr = gatt_db_get_attribute(copy, 0x0012);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
+							read_cb, &iov));
+	g_assert(iov.iov_len == sizeof(db_hash));
+	g_assert(!memcmp(iov.iov_base, db_hash, sizeof(db_hash)));
+	g_free(iov.iov_base);
+
+	attr = gatt_db_get_service(copy, 0x0020);
+	g_assert(attr);
+	g_assert(gatt_db_service_get_active(attr));
+
+	unlink(filename);
+	g_free(filename);
+	gatt_db_unref(copy);
+	gatt_db_unref(db);
+	tester_test_passed();
+}
+
+static void test_hid_values(const void *data)
+{
+	struct gatt_db *db, *copy;
+	struct gatt_db_attribute *svc, *attr;
+	struct iovec iov;
+	uint8_t report_map[300];
+	uint8_t report_ref[2] = { 0x01, 0x01 };
+	char *filename;
+	bt_uuid_t uuid;
+	size_t i;
+
+	db = make_db();
+	filename = make_filename();
+
+	for (i = 0; i < sizeof(report_map); i++)
+		report_map[i] = i;
+
+	bt_uuid16_create(&uuid, 0x1812);
+	svc = gatt_db_insert_service(db, 0x0030, &uuid, true, 6);
+	g_assert(svc);
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_REPORT_MAP);
+	attr = gatt_db_service_insert_characteristic(svc, 0x0032, &uuid, 0,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_write(attr, 0, report_map,
+					sizeof(report_map), 0, NULL, write_cb,
+					NULL));
+
+	bt_uuid16_create(&uuid, 0x2a4d);
+	g_assert(gatt_db_service_insert_characteristic(svc, 0x0034, &uuid, 0,
+						BT_GATT_CHRC_PROP_NOTIFY,
+						NULL, NULL, NULL));
+
+	bt_uuid16_create(&uuid, GATT_REPORT_REFERENCE);
+	attr = gatt_db_service_insert_descriptor(svc, 0x0035, &uuid, 0, NULL,
+								NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_write(attr, 0, report_ref,
+					sizeof(report_ref), 0, NULL, write_cb,
+					NULL));
+
+	gatt_db_service_set_active(svc, true);
+
+	g_assert(gatt_cache_store(db, filename));
+
+	copy = gatt_db_new();
+	g_assert(gatt_cache_load(copy, filename));
+
+	/* Values which only change along with the hash are kept */
+	attr = gatt_db_get_attribute(copy, 0x0032);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
+							read_cb, &iov));
+	g_assert(iov.iov_len == sizeof(report_map));
+	g_assert(!memcmp(iov.iov_base, report_map, sizeof(report_map)));
+	g_free(iov.iov_base);
+
+	attr = gatt_db_get_attribute(copy, 0x0035);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
+							read_cb, &iov));
+	g_assert(iov.iov_len == sizeof(report_ref));
+	g_assert(!memcmp(iov.iov_base, report_ref, sizeof(report_ref)));
+	g_free(iov.iov_base);
+
+	unlink(filename);
+	g_free(filename);
+	gatt_db_unref(copy);
+	gatt_db_unref(db);
+	tester_test_passed();
+}
+
+static void test_corrupted(const void *data)
+{
+	struct gatt_db *db, *copy;
+	char *filename;
+	gchar *contents;
+	gsize len;
+
+	db = make_db();
+	filename = make_filename();
+	copy = gatt_db_new();
+
+	g_assert(gatt_cache_store(db, filename));
+	g_assert(g_file_get_contents(filename, &contents, &len, NULL));
+
+	/* Any truncation must be detected and leave the database empty */
+	while (--len > 0) {
+		g_assert(g_file_set_contents(filename, contents, len, NULL));
+		g_assert(!gatt_cache_load(copy, filename));
+		g_assert(gatt_db_isempty(copy));
+	}
+
+	/* Unknown versions are not loaded */
+	contents[4]++;
+	g_assert(g_file_set_contents(filename, contents, 16, NULL));
+	g_assert(!gatt_cache_load(copy, filename));
+	g_assert(gatt_db_isempty(copy));
+
+	unlink(filename);
+	g_assert(!gatt_cache_load(copy, filename));
+
+	g_free(contents);
+	g_free(filename);
+	gatt_db_unref(copy);
+	gatt_db_unref(db);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-cache/store-load", NULL, NULL, test_store_load,
+									NULL);
+	tester_add("/gatt-cache/hid-values", NULL, NULL, test_hid_values,
+									NULL);
+	tester_add("/gatt-cache/corrupted", NULL, NULL, test_corrupted, NULL);
+
+	return tester_run();
+}
@@ -11,6 +11,7 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
@@ -29,6 +30,10 @@ static uint8_t pkt_put_action[] = { G_OBEX_OP_PUT, 0x00, 0x05,
 static uint8_t pkt_put_body[] = { G_OBEX_OP_PUT, 0x00, 0x0a,
 					G_OBEX_HDR_BODY, 0x00, 0x07,
 					1, 2, 3, 4 };
+static uint8_t pkt_put_body_action[] = { G_OBEX_OP_PUT, 0x00, 0x0c,
+					G_OBEX_HDR_BODY, 0x00, 0x07,
+					1, 2, 3, 4,
+					G_OBEX_HDR_ACTION, 0xab };
 static uint8_t pkt_put[] = { G_OBEX_OP_PUT, 0x00, 0x03 };
 
 static uint8_t pkt_nval_len[] = { G_OBEX_OP_PUT, 0xab, 0xcd, 0x12 };
@@ -148,6 +153,44 @@ static void test_decode_encode(void)
 	g_obex_packet_free(pkt);
 }
 
+static void test_decode_body(void)
+{
+	GObexPacket *pkt;
+	GObexHeader *header;
+	GError *err = NULL;
+	uint8_t data[] = { 1, 2, 3, 4 };
+	uint8_t buf[255];
+	const guint8 *body;
+	gsize body_len;
+	gssize len;
+
+	pkt = g_obex_packet_decode(pkt_put_body_action,
+					sizeof(pkt_put_body_action), 0,
+					G_OBEX_DATA_REF, &err);
+	g_assert_no_error(err);
+
+	g_assert(g_obex_packet_get_body_bytes(pkt, &body, &body_len));
+	g_assert(body == &pkt_put_body_action[6]);
+	assert_memequal(data, sizeof(data), body, body_len);
+
+	header = g_obex_packet_get_header(pkt, G_OBEX_HDR_ACTION);
+	g_assert(header != NULL);
+
+	header = g_obex_packet_get_body(pkt);
+	g_assert(header != NULL);
+
+	len = g_obex_packet_encode(pkt, buf, sizeof(buf));
+	if (len < 0) {
+		g_printerr("Encoding failed: %s\n", g_strerror(-len));
+		g_assert_not_reached();
+	}
+
+	assert_memequal(pkt_put_body_action, sizeof(pkt_put_body_action),
+								buf, len);
+
+	g_obex_packet_free(pkt);
+}
+
 static gssize get_body_data(void *buf, gsize len, gpointer user_data)
 {
 	uint8_t data[] = { 1, 2, 3, 4 };
@@ -177,6 +220,97 @@ static void test_encode_on_demand(void)
 	g_obex_packet_free(pkt);
 }
 
+static const uint8_t body_ref_data[] = { 1, 2, 3, 4 };
+
+static gssize get_body_ref(const void **buf, gsize len, gpointer user_data)
+{
+	*buf = body_ref_data;
+
+	return sizeof(body_ref_data);
+}
+
+static void test_encode_on_demand_ref(void)
+{
+	GObexPacket *pkt;
+	uint8_t buf[255];
+	gssize len;
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_ref(pkt, get_body_ref, NULL);
+
+	len = g_obex_packet_encode(pkt, buf, sizeof(buf));
+	if (len < 0) {
+		g_printerr("Encoding failed: %s\n", g_strerror(-len));
+		g_assert_not_reached();
+	}
+
+	assert_memequal(pkt_put_body, sizeof(pkt_put_body), buf, len);
+
+	g_obex_packet_free(pkt);
+}
+
+static void test_encode_iov(void)
+{
+	GObexPacket *pkt;
+	struct iovec iov[2];
+	uint8_t buf[255];
+	gssize len;
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_ref(pkt, get_body_ref, NULL);
+
+	len = g_obex_packet_encode_iov(pkt, buf, sizeof(buf), iov);
+	g_assert_cmpint(len, ==, sizeof(pkt_put_body));
+
+	g_assert(iov[0].iov_base == buf);
+	g_assert(iov[1].iov_base == body_ref_data);
+	g_assert_cmpuint(iov[1].iov_len, ==, sizeof(body_ref_data));
+
+	assert_memequal(pkt_put_body, iov[0].iov_len, buf, iov[0].iov_len);
+
+	g_obex_packet_free(pkt);
+}
+
+static gssize get_body_fd(int *fd, off_t *offset, gsize len,
+							gpointer user_data)
+{
+	FILE *file = user_data;
+
+	*fd = fileno(file);
+	*offset = 2;
+
+	return sizeof(body_ref_data);
+}
+
+static void test_encode_on_demand_fd(void)
+{
+	uint8_t data[] = { 0, 0, 1, 2, 3, 4, 5 };
+	GObexPacket *pkt;
+	struct iovec iov[2];
+	uint8_t buf[255];
+	FILE *file;
+	gssize len;
+
+	file = tmpfile();
+	g_assert(file != NULL);
+	g_assert_cmpint(fwrite(data, sizeof(data), 1, file), ==, 1);
+	fflush(file);
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_fd(pkt, get_body_fd, file);
+
+	len = g_obex_packet_encode_iov(pkt, buf, sizeof(buf), iov);
+	g_assert_cmpint(len, ==, sizeof(pkt_put_body));
+	g_assert(iov[1].iov_base == NULL);
+	g_assert_cmpuint(iov[1].iov_len, ==, sizeof(body_ref_data));
+
+	len = g_obex_packet_encode(pkt, buf, sizeof(buf));
+	assert_memequal(pkt_put_body, sizeof(pkt_put_body), buf, len);
+
+	g_obex_packet_free(pkt);
+	fclose(file);
+}
+
 static gssize get_body_data_fail(void *buf, gsize len, gpointer user_data)
 {
 	return -EIO;
@@ -234,10 +368,16 @@ int main(int argc, char *argv[])
 						test_decode_connect);
 
 	g_test_add_func("/gobex/test_decode_nval", test_decode_nval);
+	g_test_add_func("/gobex/test_decode_body", test_decode_body);
 
 	g_test_add_func("/gobex/test_encode_pkt", test_decode_encode);
 
 	g_test_add_func("/gobex/test_encode_on_demand", test_encode_on_demand);
+	g_test_add_func("/gobex/test_encode_on_demand_ref",
+						test_encode_on_demand_ref);
+	g_test_add_func("/gobex/test_encode_iov", test_encode_iov);
+	g_test_add_func("/gobex/test_encode_on_demand_fd",
+						test_encode_on_demand_fd);
 	g_test_add_func("/gobex/test_encode_on_demand_fail",
 						test_encode_on_demand_fail);
 
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/h4.h"
+#include "src/shared/tester.h"
+
+static const uint8_t h4_stream[] = {
+	0x01, 0x03, 0x0c, 0x00,				/* Reset */
+	0x04, 0x0e, 0x04, 0x01, 0x03, 0x0c, 0x00,	/* Command Complete */
+	0x02, 0x01, 0x20, 0x03, 0x00, 0xaa, 0xbb, 0xcc,	/* ACL */
+	0x03, 0x02, 0x00, 0x02, 0x11, 0x22,		/* SCO */
+	0x05, 0x03, 0x00, 0x02, 0x40, 0x33, 0x44,	/* ISO */
+};
+
+static const uint16_t h4_lens[] = { 4, 7, 8, 6, 7 };
+
+struct test_data {
+	unsigned int count;
+	size_t offset;
+	unsigned int stop;
+};
+
+static bool check_packet(void *data, uint16_t size, void *user_data)
+{
+	struct test_data *test = user_data;
+
+	g_assert(test->count < G_N_ELEMENTS(h4_lens));
+	g_assert(size == h4_lens[test->count]);
+	g_assert(memcmp(data, h4_stream + test->offset, size) == 0);
+
+	test->offset += size;
+	test->count++;
+
+	return test->count != test->stop;
+}
+
+static void test_packet_len(const void *data)
+{
+	static const uint8_t unknown[] = { 0x06, 0x00, 0x00, 0x00 };
+	size_t i;
+
+	for (i = 0; i < 4; i++)
+		g_assert(h4_packet_len(h4_stream, i) == 0);
+
+	g_assert(h4_packet_len(h4_stream, 4) == 4);
+	g_assert(h4_packet_len(unknown, sizeof(unknown)) == -EBADMSG);
+
+	tester_test_passed();
+}
+
+static void test_stream(const void *data)
+{
+	struct test_data test = { .stop = 0 };
+	struct h4 *h4;
+	size_t i;
+	int sv[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	h4 = h4_new(H4_MAX_PACKET_SIZE);
+	g_assert(h4 != NULL);
+
+	/* Feed one byte at a time so every header split is covered */
+	for (i = 0; i < sizeof(h4_stream); i++) {
+		g_assert(write(sv[1], h4_stream + i, 1) == 1);
+		g_assert(h4_read(h4, sv[0]) == 1);
+		g_assert(h4_process(h4, check_packet, &test) >= 0);
+	}
+
+	g_assert(test.count == G_N_ELEMENTS(h4_lens));
+	g_assert(test.offset == sizeof(h4_stream));
+
+	h4_free(h4);
+	close(sv[0]);
+	close(sv[1]);
+
+	tester_test_passed();
+}
+
+static void test_batch(const void *data)
+{
+	struct test_data test = { .stop = 2 };
+	struct h4 *h4;
+	size_t len;
+	int sv[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	h4 = h4_new(H4_MAX_PACKET_SIZE);
+	g_assert(h4 != NULL);
+
+	g_assert(write(sv[1], h4_stream, sizeof(h4_stream)) ==
+						sizeof(h4_stream));
+	g_assert(h4_read(h4, sv[0]) == sizeof(h4_stream));
+
+	/* Stopping leaves the remaining packets queued */
+	g_assert(h4_process(h4, check_packet, &test) == 2);
+	h4_peek(h4, &len);
+	g_assert(len == sizeof(h4_stream) - 11);
+
+	g_assert(h4_process(h4, check_packet, &test) == 3);
+	h4_peek(h4, &len);
+	g_assert(len == 0);
+
+	h4_free(h4);
+	close(sv[0]);
+	close(sv[1]);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/h4/packet_len", NULL, NULL, test_packet_len, NULL);
+	tester_add("/h4/stream", NULL, NULL, test_stream, NULL);
+	tester_add("/h4/batch", NULL, NULL, test_batch, NULL);
+
+	return tester_run();
+}
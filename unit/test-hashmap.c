@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/hashmap.h"
+#include "src/shared/tester.h"
+
+static void test_basic(const void *data)
+{
+	struct hashmap *map;
+	unsigned int i;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+	g_assert(hashmap_isempty(map));
+	g_assert(hashmap_lookup(map, 0) == NULL);
+	g_assert(hashmap_remove(map, 0) == NULL);
+
+	/* NULL values can't be told apart from missing keys */
+	g_assert(!hashmap_insert(map, 1, NULL));
+
+	for (i = 0; i < 1024; i++)
+		g_assert(hashmap_insert(map, i, UINT_TO_PTR(i + 1)));
+
+	g_assert(hashmap_size(map) == 1024);
+	g_assert(!hashmap_insert(map, 10, UINT_TO_PTR(1)));
+
+	for (i = 0; i < 1024; i++)
+		g_assert(hashmap_lookup(map, i) == UINT_TO_PTR(i + 1));
+
+	g_assert(hashmap_lookup(map, 1024) == NULL);
+
+	for (i = 0; i < 1024; i += 2)
+		g_assert(hashmap_remove(map, i) == UINT_TO_PTR(i + 1));
+
+	g_assert(hashmap_size(map) == 512);
+
+	for (i = 0; i < 1024; i++) {
+		if (i % 2)
+			g_assert(hashmap_lookup(map, i) == UINT_TO_PTR(i + 1));
+		else
+			g_assert(hashmap_lookup(map, i) == NULL);
+	}
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+#define RANDOM_KEYS 512
+#define RANDOM_OPS 100000
+
+static void test_random(const void *data)
+{
+	void *values[RANDOM_KEYS] = { };
+	struct hashmap *map;
+	unsigned int i, count = 0;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	srand(0);
+
+	/* Keys share their low bits to get long probe sequences */
+	for (i = 0; i < RANDOM_OPS; i++) {
+		unsigned int n = rand() % RANDOM_KEYS;
+		unsigned int key = n << 16;
+
+		if (values[n]) {
+			g_assert(hashmap_lookup(map, key) == values[n]);
+			g_assert(hashmap_remove(map, key) == values[n]);
+			g_assert(hashmap_lookup(map, key) == NULL);
+			values[n] = NULL;
+			count--;
+		} else {
+			g_assert(hashmap_lookup(map, key) == NULL);
+			values[n] = UINT_TO_PTR(i + 1);
+			g_assert(hashmap_insert(map, key, values[n]));
+			count++;
+		}
+
+		g_assert(hashmap_size(map) == count);
+	}
+
+	for (i = 0; i < RANDOM_KEYS; i++)
+		g_assert(hashmap_lookup(map, i << 16) == values[i]);
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+static void count_value(unsigned int key, void *value, void *user_data)
+{
+	unsigned int *sum = user_data;
+
+	g_assert(PTR_TO_UINT(value) == key * 2);
+
+	*sum += key;
+}
+
+static void test_foreach(const void *data)
+{
+	struct hashmap *map;
+	unsigned int i, sum = 0;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	for (i = 1; i <= 100; i++)
+		g_assert(hashmap_insert(map, i, UINT_TO_PTR(i * 2)));
+
+	hashmap_foreach(map, count_value, &sum);
+	g_assert(sum == 5050);
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+static void free_value(void *value)
+{
+	free(value);
+}
+
+static void test_destroy(const void *data)
+{
+	struct hashmap *map;
+	unsigned int i;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	for (i = 0; i < 64; i++)
+		g_assert(hashmap_insert(map, i, malloc(1)));
+
+	hashmap_destroy(map, free_value);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/hashmap/basic", NULL, NULL, test_basic, NULL);
+	tester_add("/hashmap/random", NULL, NULL, test_random, NULL);
+	tester_add("/hashmap/foreach", NULL, NULL, test_foreach, NULL);
+	tester_add("/hashmap/destroy", NULL, NULL, test_destroy, NULL);
+
+	return tester_run();
+}
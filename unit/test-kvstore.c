@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/kvstore.h"
+#include "src/shared/tester.h"
+
+struct test_store {
+	char *path;
+	char *journal;
+};
+
+static void test_store_init(struct test_store *test)
+{
+	char path[] = "/tmp/test-kvstore-XXXXXX";
+	int fd;
+
+	fd = mkstemp(path);
+	g_assert(fd >= 0);
+	close(fd);
+	unlink(path);
+
+	test->path = g_strdup(path);
+	test->journal = g_strdup_printf("%s.journal", path);
+}
+
+static void test_store_cleanup(struct test_store *test)
+{
+	unlink(test->path);
+	unlink(test->journal);
+	g_free(test->path);
+	g_free(test->journal);
+}
+
+static bool check_value(struct kvstore *store, const char *key,
+							const char *value)
+{
+	const void *data;
+	size_t len;
+
+	if (!kvstore_get(store, key, &data, &len))
+		return !value;
+
+	return value && len == strlen(value) && !memcmp(data, value, len);
+}
+
+static void test_basic(const void *data)
+{
+	struct test_store test;
+	struct kvstore *store;
+
+	test_store_init(&test);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+
+	g_assert(check_value(store, "a/info", NULL));
+	g_assert(kvstore_put(store, "a/info", "one", 3));
+	g_assert(kvstore_put(store, "b/info", "two", 3));
+	g_assert(kvstore_put(store, "a/info", "three", 5));
+	g_assert(kvstore_put(store, "empty", NULL, 0));
+	g_assert(kvstore_remove(store, "b/info"));
+	g_assert(kvstore_remove(store, "missing"));
+
+	g_assert(check_value(store, "a/info", "three"));
+	g_assert(check_value(store, "b/info", NULL));
+	g_assert(check_value(store, "empty", ""));
+
+	g_assert(kvstore_sync(store));
+	kvstore_close(store);
+
+	/* Everything has to come back from the journal alone */
+	store = kvstore_open(test.path);
+	g_assert(store);
+	g_assert(check_value(store, "a/info", "three"));
+	g_assert(check_value(store, "b/info", NULL));
+	g_assert(check_value(store, "empty", ""));
+
+	g_assert(kvstore_compact(store));
+	g_assert(check_value(store, "a/info", "three"));
+
+	g_assert(kvstore_remove(store, "a/info"));
+	kvstore_close(store);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+	g_assert(check_value(store, "a/info", NULL));
+	g_assert(check_value(store, "empty", ""));
+	kvstore_close(store);
+
+	test_store_cleanup(&test);
+	tester_test_passed();
+}
+
+static void test_compact(const void *data)
+{
+	struct test_store test;
+	struct kvstore *store;
+	char key[32], value[32];
+	struct stat st;
+	int i;
+
+	test_store_init(&test);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+
+	/* Enough distinct keys to trigger compaction on its own */
+	for (i = 0; i < 1000; i++) {
+		sprintf(key, "%04d/info", i);
+		sprintf(value, "value %d", i);
+		g_assert(kvstore_put(store, key, value, strlen(value)));
+	}
+
+	g_assert(!stat(test.path, &st));
+	g_assert(st.st_size > 0);
+
+	for (i = 0; i < 1000; i += 2) {
+		sprintf(key, "%04d/info", i);
+		g_assert(kvstore_remove(store, key));
+	}
+
+	kvstore_close(store);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(key, "%04d/info", i);
+		sprintf(value, "value %d", i);
+		g_assert(check_value(store, key, i % 2 ? value : NULL));
+	}
+
+	kvstore_close(store);
+
+	test_store_cleanup(&test);
+	tester_test_passed();
+}
+
+static void count_entry(const char *key, const void *data, size_t len,
+							void *user_data)
+{
+	unsigned int *count = user_data;
+
+	g_assert(!strncmp(key, "dev/", 4));
+	(*count)++;
+}
+
+static void test_foreach(const void *data)
+{
+	struct test_store test;
+	struct kvstore *store;
+	unsigned int count = 0;
+
+	test_store_init(&test);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+
+	g_assert(kvstore_put(store, "dev/1", "a", 1));
+	g_assert(kvstore_put(store, "dev/2", "b", 1));
+	g_assert(kvstore_put(store, "dev/3", "c", 1));
+	g_assert(kvstore_put(store, "other", "d", 1));
+	g_assert(kvstore_compact(store));
+
+	/* Mix snapshot and journal entries */
+	g_assert(kvstore_put(store, "dev/2", "e", 1));
+	g_assert(kvstore_remove(store, "dev/3"));
+	g_assert(kvstore_put(store, "dev/4", "f", 1));
+
+	kvstore_foreach(store, "dev/", count_entry, &count);
+	g_assert(count == 3);
+
+	kvstore_close(store);
+
+	test_store_cleanup(&test);
+	tester_test_passed();
+}
+
+static void test_truncated(const void *data)
+{
+	struct test_store test;
+	struct kvstore *store;
+	struct stat st;
+
+	test_store_init(&test);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+	g_assert(kvstore_put(store, "first", "1", 1));
+	g_assert(kvstore_put(store, "second", "2", 1));
+	kvstore_close(store);
+
+	/* Cut the last record short as if the daemon died while writing */
+	g_assert(!stat(test.journal, &st));
+	g_assert(!truncate(test.journal, st.st_size - 1));
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+	g_assert(check_value(store, "first", "1"));
+	g_assert(check_value(store, "second", NULL));
+
+	/* New records must not end up behind the partial one */
+	g_assert(kvstore_put(store, "third", "3", 1));
+	kvstore_close(store);
+
+	store = kvstore_open(test.path);
+	g_assert(store);
+	g_assert(check_value(store, "first", "1"));
+	g_assert(check_value(store, "third", "3"));
+	kvstore_close(store);
+
+	test_store_cleanup(&test);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/kvstore/basic", NULL, NULL, test_basic, NULL);
+	tester_add("/kvstore/compact", NULL, NULL, test_compact, NULL);
+	tester_add("/kvstore/foreach", NULL, NULL, test_foreach, NULL);
+	tester_add("/kvstore/truncated", NULL, NULL, test_truncated, NULL);
+
+	return tester_run();
+}
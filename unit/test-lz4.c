@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/lz4.h"
+#include "src/shared/tester.h"
+
+#define DATA_SIZE (64 * 1024)
+
+static uint8_t src[DATA_SIZE];
+static uint8_t dst[LZ4_COMPRESS_BOUND(DATA_SIZE)];
+static uint8_t out[DATA_SIZE];
+
+static void check_roundtrip(size_t len)
+{
+	size_t zlen;
+
+	zlen = lz4_compress(src, len, dst, sizeof(dst));
+	g_assert(zlen > 0);
+	g_assert(lz4_decompress(dst, zlen, out, len) == (ssize_t) len);
+	g_assert(!memcmp(src, out, len));
+}
+
+static void test_empty(const void *data)
+{
+	check_roundtrip(0);
+
+	tester_test_passed();
+}
+
+static void test_repeated(const void *data)
+{
+	size_t len;
+
+	memset(src, 0xaa, sizeof(src));
+
+	for (len = 1; len < 64; len++)
+		check_roundtrip(len);
+
+	check_roundtrip(sizeof(src));
+	g_assert(lz4_compress(src, sizeof(src), dst, sizeof(dst)) < 512);
+
+	tester_test_passed();
+}
+
+static void test_random(const void *data)
+{
+	size_t i;
+
+	srand(0);
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = rand();
+
+	check_roundtrip(sizeof(src));
+
+	/* Incompressible data must not fit into a smaller buffer */
+	g_assert(!lz4_compress(src, sizeof(src), dst, sizeof(src)));
+
+	tester_test_passed();
+}
+
+static void test_records(const void *data)
+{
+	size_t i;
+
+	/* Similar headers with short varying payloads as in traces */
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = i % 24 < 16 ? i % 24 : rand() % 4;
+
+	check_roundtrip(sizeof(src));
+
+	tester_test_passed();
+}
+
+static void test_malformed(const void *data)
+{
+	/* Literal length beyond the input */
+	static const uint8_t lit[] = { 0x50, 'a', 'b' };
+	/* Match offset before the start of the output */
+	static const uint8_t offset[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+	/* Match offset of zero */
+	static const uint8_t zero[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+	size_t i, zlen;
+
+	g_assert(lz4_decompress(lit, sizeof(lit), out, sizeof(out)) < 0);
+	g_assert(lz4_decompress(offset, sizeof(offset), out, sizeof(out)) < 0);
+	g_assert(lz4_decompress(zero, sizeof(zero), out, sizeof(out)) < 0);
+
+	memset(src, 'x', sizeof(src));
+	zlen = lz4_compress(src, sizeof(src), dst, sizeof(dst));
+	g_assert(zlen > 0);
+
+	/* Output does not fit */
+	g_assert(lz4_decompress(dst, zlen, out, sizeof(out) - 1) < 0);
+
+	/* Truncated input never reads or writes out of bounds */
+	for (i = 0; i < zlen; i++)
+		g_assert(lz4_decompress(dst, i, out, sizeof(out)) !=
+						(ssize_t) sizeof(src));
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/lz4/empty", NULL, NULL, test_empty, NULL);
+	tester_add("/lz4/repeated", NULL, NULL, test_repeated, NULL);
+	tester_add("/lz4/random", NULL, NULL, test_random, NULL);
+	tester_add("/lz4/records", NULL, NULL, test_records, NULL);
+	tester_add("/lz4/malformed", NULL, NULL, test_malformed, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/metrics.h"
+#include "src/shared/tester.h"
+
+static void test_register(const void *data)
+{
+	struct metric *counter, *gauge;
+
+	counter = metrics_counter("test_total", "Test counter");
+	g_assert(counter != NULL);
+	g_assert(metrics_counter("test_total", NULL) == counter);
+
+	/* A name can only be used by one type */
+	g_assert(metrics_gauge("test_total", NULL) == NULL);
+
+	gauge = metrics_gauge("test_gauge", NULL);
+	g_assert(gauge != NULL && gauge != counter);
+
+	metrics_inc(counter);
+	metrics_add(counter, 41);
+	g_assert(counter->value == 42);
+
+	metrics_set(gauge, -3);
+	g_assert(gauge->value == -3);
+
+	/* Nothing registered is fine to update */
+	metrics_inc(NULL);
+	metrics_observe(NULL, 1);
+
+	metrics_cleanup();
+	tester_test_passed();
+}
+
+static void test_histogram(const void *data)
+{
+	struct metric *hist;
+
+	hist = metrics_histogram("test_usec", NULL, 100);
+	g_assert(hist != NULL);
+	g_assert(hist->bounds[0] == 100);
+	g_assert(hist->bounds[3] == 800);
+
+	metrics_observe(hist, 0);
+	metrics_observe(hist, 100);
+	metrics_observe(hist, 101);
+	metrics_observe(hist, UINT32_MAX);
+
+	g_assert(hist->buckets[0] == 2);
+	g_assert(hist->buckets[1] == 1);
+	g_assert(hist->buckets[METRICS_BUCKETS] == 1);
+	g_assert(hist->count == 4);
+	g_assert(hist->sum == 201 + (uint64_t) UINT32_MAX);
+
+	metrics_cleanup();
+	tester_test_passed();
+}
+
+static void test_format(const void *data)
+{
+	struct metric *counter, *hist;
+	char *text;
+
+	counter = metrics_counter("test_total", "Test counter");
+	hist = metrics_histogram("test_usec", NULL, 10);
+
+	metrics_add(counter, 7);
+	metrics_observe(hist, 5);
+	metrics_observe(hist, 15);
+
+	text = metrics_format();
+	g_assert(text != NULL);
+
+	g_assert(strstr(text, "# HELP test_total Test counter\n"));
+	g_assert(strstr(text, "# TYPE test_total counter\ntest_total 7\n"));
+	g_assert(strstr(text, "# TYPE test_usec histogram\n"));
+	g_assert(strstr(text, "test_usec_bucket{le=\"10\"} 1\n"));
+	g_assert(strstr(text, "test_usec_bucket{le=\"20\"} 2\n"));
+	g_assert(strstr(text, "test_usec_bucket{le=\"+Inf\"} 2\n"));
+	g_assert(strstr(text, "test_usec_sum 20\ntest_usec_count 2\n"));
+
+	free(text);
+	metrics_cleanup();
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/metrics/register", NULL, NULL, test_register, NULL);
+	tester_add("/metrics/histogram", NULL, NULL, test_histogram, NULL);
+	tester_add("/metrics/format", NULL, NULL, test_format, NULL);
+
+	return tester_run();
+}
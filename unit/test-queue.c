@@ -12,6 +12,8 @@
 #include <config.h>
 #endif
 
+#include <time.h>
+
 #include <glib.h>
 
 #include "src/shared/util.h"
@@ -246,6 +248,127 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+struct item {
+	struct queue_entry entry;
+	unsigned int value;
+};
+
+static void test_intrusive(const void *data)
+{
+	struct queue *queue;
+	struct item items[8];
+	struct item *item;
+	unsigned int i;
+
+	queue = queue_new_intrusive();
+	g_assert(queue != NULL);
+
+	/* Intrusive queues never allocate entries on their own */
+	g_assert(!queue_push_tail(queue, &items[0]));
+	g_assert(!queue_push_head(queue, &items[0]));
+
+	for (i = 0; i < 8; i++) {
+		items[i].value = i;
+
+		if (i % 2)
+			g_assert(queue_push_tail_entry(queue, &items[i].entry,
+								&items[i]));
+		else
+			g_assert(queue_push_head_entry(queue, &items[i].entry,
+								&items[i]));
+	}
+
+	g_assert(queue_length(queue) == 8);
+	g_assert(queue_peek_head(queue) == &items[6]);
+	g_assert(queue_peek_tail(queue) == &items[7]);
+
+	g_assert(queue_remove(queue, &items[3]));
+	g_assert(!queue_remove(queue, &items[3]));
+	g_assert(queue_length(queue) == 7);
+
+	/* Removed entries can be queued again right away */
+	g_assert(queue_push_tail_entry(queue, &items[3].entry, &items[3]));
+
+	item = queue_pop_head(queue);
+	g_assert(item == &items[6]);
+	g_assert(item->value == 6);
+
+	queue_destroy(queue, NULL);
+
+	/* Regular queues refuse caller provided entries */
+	queue = queue_new();
+	g_assert(!queue_push_tail_entry(queue, &items[0].entry, &items[0]));
+	queue_destroy(queue, NULL);
+
+	tester_test_passed();
+}
+
+#define BENCHMARK_DEPTH 64
+#define BENCHMARK_ROUNDS 20000
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+				(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void test_benchmark(const void *data)
+{
+	struct queue *queue;
+	struct item *items;
+	struct timespec start;
+	unsigned int i, n;
+	double secs;
+
+	items = new0(struct item, BENCHMARK_DEPTH);
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (n = 0; n < BENCHMARK_ROUNDS; n++) {
+		for (i = 0; i < BENCHMARK_DEPTH; i++)
+			queue_push_tail(queue, &items[i]);
+
+		for (i = 0; i < BENCHMARK_DEPTH; i++)
+			g_assert(queue_pop_head(queue) == &items[i]);
+	}
+
+	secs = elapsed(&start);
+	tester_debug("queue: %.0f push/pop per second",
+				BENCHMARK_ROUNDS * BENCHMARK_DEPTH / secs);
+
+	queue_destroy(queue, NULL);
+
+	queue = queue_new_intrusive();
+	g_assert(queue != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (n = 0; n < BENCHMARK_ROUNDS; n++) {
+		for (i = 0; i < BENCHMARK_DEPTH; i++)
+			queue_push_tail_entry(queue, &items[i].entry,
+								&items[i]);
+
+		for (i = 0; i < BENCHMARK_DEPTH; i++)
+			g_assert(queue_pop_head(queue) == &items[i]);
+	}
+
+	secs = elapsed(&start);
+	tester_debug("intrusive queue: %.0f push/pop per second",
+				BENCHMARK_ROUNDS * BENCHMARK_DEPTH / secs);
+
+	queue_destroy(queue, NULL);
+	free(items);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -263,6 +386,8 @@ int main(int argc, char *argv[])
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/queue/intrusive", NULL, NULL, test_intrusive, NULL);
+	tester_add("/queue/benchmark", NULL, NULL, test_benchmark, NULL);
 
 	return tester_run();
 }
@@ -14,6 +14,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -133,6 +134,52 @@ static void test_printf(const void *data)
 	tester_test_passed();
 }
 
+static void test_mirrored(const void *data)
+{
+	struct ringbuf *rb;
+	size_t capa, len;
+	char *str, *ptr;
+	int i;
+
+	rb = ringbuf_new_mirrored(500);
+	g_assert(rb != NULL);
+
+	capa = ringbuf_capacity(rb);
+	g_assert(capa >= 512);
+
+	str = malloc(capa);
+	g_assert(str != NULL);
+
+	len = ringbuf_printf(rb, "x");
+	g_assert(len == 1);
+
+	for (i = 1; i < 10000; i++) {
+		size_t count = i % (capa / 2) + 1;
+
+		tester_debug("Iteration %i\n", i);
+
+		/* Keep one byte queued so data wraps around the buffer end */
+		memset(str, 'a' + i % 26, count);
+		str[count] = '\0';
+
+		len = ringbuf_printf(rb, "%s", str);
+		g_assert(len == count);
+
+		ptr = ringbuf_peek(rb, 1, &len);
+		g_assert(ptr != NULL);
+		g_assert(len == count);
+		g_assert(memcmp(str, ptr, len) == 0);
+
+		len = ringbuf_drain(rb, count);
+		g_assert(len == count);
+		g_assert(ringbuf_len(rb) == 1);
+	}
+
+	free(str);
+	ringbuf_free(rb);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -140,6 +187,7 @@ int main(int argc, char *argv[])
 	tester_add("/ringbuf/power2", NULL, NULL, test_power2, NULL);
 	tester_add("/ringbuf/alloc", NULL, NULL, test_alloc, NULL);
 	tester_add("/ringbuf/printf", NULL, NULL, test_printf, NULL);
+	tester_add("/ringbuf/mirrored", NULL, NULL, test_mirrored, NULL);
 
 	return tester_run();
 }
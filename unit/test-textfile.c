@@ -18,6 +18,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 
@@ -249,6 +250,39 @@ static void test_multiple(const void *data)
 	tester_test_passed();
 }
 
+static void test_compact(const void *data)
+{
+	char key[18], value[512], *str;
+	struct stat st;
+	unsigned int i;
+
+	util_create_empty();
+
+	memset(value, 0, sizeof(value));
+	memset(value, 'x', 100);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(key, "00:00:00:00:00:%02X", i % 4);
+		value[0] = 'a' + i % 26;
+		g_assert(textfile_put(test_pathname, key, value) == 0);
+	}
+
+	g_assert(stat(test_pathname, &st) == 0);
+
+	tester_debug("File size after updates %ld\n", (long) st.st_size);
+
+	g_assert(st.st_size < 1000 * 100 / 2);
+
+	sprintf(key, "00:00:00:00:00:%02X", 999 % 4);
+	str = textfile_get(test_pathname, key);
+	g_assert(str != NULL);
+	g_assert(str[0] == 'a' + 999 % 26);
+	g_assert(strlen(str) == 100);
+
+	free(str);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -257,6 +291,7 @@ int main(int argc, char *argv[])
 	tester_add("/textfile/delete", NULL, NULL, test_delete, NULL);
 	tester_add("/textfile/overwrite", NULL, NULL, test_overwrite, NULL);
 	tester_add("/textfile/multiple", NULL, NULL, test_multiple, NULL);
+	tester_add("/textfile/compact", NULL, NULL, test_compact, NULL);
 
 	return tester_run();
 }
@@ -217,6 +217,24 @@ static const struct uhid_event ev_input = {
 	.type = UHID_INPUT,
 };
 
+static const struct {
+	uint32_t type;
+	uint16_t size;
+	uint8_t data[3];
+} __attribute__((packed)) ev_input2 = {
+	.type = UHID_INPUT2,
+	.size = 3,
+	.data = { 0x01, 0xaa, 0xbb },
+};
+
+static const uint8_t input2_data[] = { 0xaa, 0xbb };
+
+static const struct uhid_event ev_input2_send = {
+	.type = UHID_INPUT2,
+	.u.input2.size = 3,
+	.u.input2.data = { 0x01, 0xaa, 0xbb },
+};
+
 static const struct uhid_event ev_output = {
 	.type = UHID_OUTPUT,
 };
@@ -242,6 +260,13 @@ static void test_client(gconstpointer data)
 	if (g_str_equal(context->data->test_name, "/uhid/command/input"))
 		bt_uhid_send(context->uhid, &ev_input);
 
+	if (g_str_equal(context->data->test_name, "/uhid/command/input2/send"))
+		bt_uhid_send(context->uhid, &ev_input2_send);
+
+	if (g_str_equal(context->data->test_name, "/uhid/command/input2"))
+		bt_uhid_input(context->uhid, 0x01, input2_data,
+							sizeof(input2_data));
+
 	context_quit(context);
 }
 
@@ -278,6 +303,9 @@ int main(int argc, char *argv[])
 	define_test("/uhid/command/feature_answer", test_client,
 						event(&ev_feature_answer));
 	define_test("/uhid/command/input", test_client, event(&ev_input));
+	define_test("/uhid/command/input2", test_client, event(&ev_input2));
+	define_test("/uhid/command/input2/send", test_client,
+							event(&ev_input2));
 
 	define_test("/uhid/event/output", test_server, event(&ev_output));
 	define_test("/uhid/event/feature", test_server, event(&ev_feature));